@@ -0,0 +1,69 @@
+#!/bin/sh
+# BlueALSA - bluealsa-trace-latency.sh
+# Copyright (c) 2016-2021 Arkadiusz Bokowy
+#
+# Per-transport latency breakdown of the audio data path, based on the
+# static tracing probes (see the src/trace.h file). In order to use this
+# script, BlueALSA has to be configured with the --enable-systemtap option
+# and the bpftrace tool has to be installed.
+#
+# Usage: bluealsa-trace-latency.sh [BLUEALSA]
+#
+# Tracing can be stopped with Ctrl-C, then for every IO thread (identified
+# by the thread name and the address of the transport thread structure)
+# the histograms of the following stages (in microseconds) are printed:
+#
+#  - pcm_read -> encode_begin: buffering of PCM data before encoding
+#  - encode_begin -> encode_end: encoding
+#  - encode_end -> bt_write: BT write, including pacing and queueing
+#  - bt_read -> decode_begin: RTP processing and concealment
+#  - decode_begin -> decode_end: decoding
+#  - decode_end -> fifo_write: PCM FIFO write, including waiting for client
+
+BLUEALSA=${1:-$(command -v bluealsa)}
+
+if [ ! -x "$BLUEALSA" ]; then
+	echo "BlueALSA binary not found: $BLUEALSA" >&2
+	exit 1
+fi
+
+P="usdt:$BLUEALSA:bluealsa"
+
+exec bpftrace -e "$(cat <<EOF
+$P:pcm_read /@pcm_read[arg0] == 0/ { @pcm_read[arg0] = nsecs; @name[arg0] = comm; }
+$P:encode_begin /@pcm_read[arg0] != 0/ {
+	@us[@name[arg0], arg0, "1: pcm_read -> encode_begin"] = hist((nsecs - @pcm_read[arg0]) / 1000);
+	delete(@pcm_read[arg0]);
+	@encode_begin[arg0] = nsecs;
+}
+$P:encode_end /@encode_begin[arg0] != 0/ {
+	@us[@name[arg0], arg0, "2: encode_begin -> encode_end"] = hist((nsecs - @encode_begin[arg0]) / 1000);
+	delete(@encode_begin[arg0]);
+	@encode_end[arg0] = nsecs;
+}
+$P:bt_write /@encode_end[arg0] != 0/ {
+	@us[@name[arg0], arg0, "3: encode_end -> bt_write"] = hist((nsecs - @encode_end[arg0]) / 1000);
+	delete(@encode_end[arg0]);
+}
+$P:bt_read { @bt_read[arg0] = nsecs; @name[arg0] = comm; }
+$P:decode_begin /@bt_read[arg0] != 0/ {
+	@us[@name[arg0], arg0, "1: bt_read -> decode_begin"] = hist((nsecs - @bt_read[arg0]) / 1000);
+	delete(@bt_read[arg0]);
+	@decode_begin[arg0] = nsecs;
+}
+$P:decode_end /@decode_begin[arg0] != 0/ {
+	@us[@name[arg0], arg0, "2: decode_begin -> decode_end"] = hist((nsecs - @decode_begin[arg0]) / 1000);
+	delete(@decode_begin[arg0]);
+	@decode_end[arg0] = nsecs;
+}
+$P:fifo_write /@decode_end[arg0] != 0/ {
+	@us[@name[arg0], arg0, "3: decode_end -> fifo_write"] = hist((nsecs - @decode_end[arg0]) / 1000);
+	delete(@decode_end[arg0]);
+}
+END {
+	clear(@pcm_read); clear(@encode_begin); clear(@encode_end);
+	clear(@bt_read); clear(@decode_begin); clear(@decode_end);
+	clear(@name);
+}
+EOF
+)"
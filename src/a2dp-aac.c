@@ -27,15 +27,22 @@
 
 #include "a2dp.h"
 #include "a2dp-codecs.h"
+#include "ba-device.h"
 #include "bluealsa.h"
 #include "io.h"
 #include "rtp.h"
+#include "trace.h"
 #include "utils.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
 #include "shared/log.h"
+#include "shared/rb.h"
 #include "shared/rt.h"
 
+/**
+ * The shortest frame length supported by the AAC-ELD object type. */
+#define A2DP_AAC_ELD_FRAME_LEN 480
+
 void a2dp_aac_transport_set_codec(struct ba_transport *t) {
 
 	const struct a2dp_codec *codec = t->a2dp.codec;
@@ -46,6 +53,11 @@ void a2dp_aac_transport_set_codec(struct ba_transport *t) {
 	t->a2dp.pcm.sampling = a2dp_codec_lookup_frequency(codec,
 			AAC_GET_FREQUENCY(*(a2dp_aac_t *)t->a2dp.configuration), false);
 
+	/* AAC-ELD encoder is configured with the shortest frame length, the
+	 * actual value is updated by the encoder thread once it is known */
+	t->a2dp.pcm.block_frames = ((a2dp_aac_t *)t->a2dp.configuration)->object_type ==
+		AAC_OBJECT_TYPE_MPEG4_AAC_ELD2 ? A2DP_AAC_ELD_FRAME_LEN : 1024;
+
 }
 
 static void *a2dp_aac_enc_thread(struct ba_transport_thread *th) {
@@ -65,13 +77,33 @@ static void *a2dp_aac_enc_thread(struct ba_transport_thread *th) {
 	const unsigned int channels = t->a2dp.pcm.channels;
 	const unsigned int samplerate = t->a2dp.pcm.sampling;
 
+	struct ba_device_codec codec = {
+		.d = t->d,
+		.name = "aac-enc",
+		.config = t->a2dp.configuration,
+		.config_size = t->a2dp.codec->capabilities_size,
+		.state = &handle,
+		.state_size = sizeof(handle),
+		.destroy = PTHREAD_CLEANUP(aacEncClose),
+	};
+
+	if (ba_device_codec_acquire(&codec) == 0) {
+		/* Reset the state of the cached encoder. All parameters will be set
+		 * once again, so any bitrate adjustment made by the ABR is undone. */
+		if ((err = aacEncoder_SetParam(handle, AACENC_CONTROL_STATE,
+						AACENC_INIT_ALL)) != AACENC_OK) {
+			error("Couldn't reset AAC encoder: %s", aacenc_strerror(err));
+			aacEncClose(&handle);
+			goto fail_open;
+		}
+	}
 	/* create AAC encoder without the Meta Data module */
-	if ((err = aacEncOpen(&handle, 0x07, channels)) != AACENC_OK) {
+	else if ((err = aacEncOpen(&handle, 0x07, channels)) != AACENC_OK) {
 		error("Couldn't open AAC encoder: %s", aacenc_strerror(err));
 		goto fail_open;
 	}
 
-	pthread_cleanup_push(PTHREAD_CLEANUP(aacEncClose), &handle);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_device_codec_release), &codec);
 
 	unsigned int aot = AOT_NONE;
 	unsigned int channelmode = channels == 1 ? MODE_1 : MODE_2;
@@ -92,6 +124,9 @@ static void *a2dp_aac_enc_thread(struct ba_transport_thread *th) {
 	case AAC_OBJECT_TYPE_MPEG4_AAC_SCA:
 		aot = AOT_AAC_SCAL;
 		break;
+	case AAC_OBJECT_TYPE_MPEG4_AAC_ELD2:
+		aot = AOT_ER_AAC_ELD;
+		break;
 	}
 
 	if ((err = aacEncoder_SetParam(handle, AACENC_AOT, aot)) != AACENC_OK) {
@@ -110,6 +145,13 @@ static void *a2dp_aac_enc_thread(struct ba_transport_thread *th) {
 		error("Couldn't set channel mode: %s", aacenc_strerror(err));
 		goto fail_init;
 	}
+	/* use the shortest frame supported by the low delay object type */
+	if (aot == AOT_ER_AAC_ELD &&
+			(err = aacEncoder_SetParam(handle, AACENC_GRANULE_LENGTH,
+					A2DP_AAC_ELD_FRAME_LEN)) != AACENC_OK) {
+		error("Couldn't set AAC-ELD frame length: %s", aacenc_strerror(err));
+		goto fail_init;
+	}
 	if (configuration->vbr) {
 		if ((err = aacEncoder_SetParam(handle, AACENC_BITRATEMODE, config.aac_vbr_mode)) != AACENC_OK) {
 			error("Couldn't set VBR bitrate mode %u: %s", config.aac_vbr_mode, aacenc_strerror(err));
@@ -144,14 +186,26 @@ static void *a2dp_aac_enc_thread(struct ba_transport_thread *th) {
 		goto fail_init;
 	}
 
+	codec.ready = true;
+
+	/* Algorithmic delay of the encoder (including the frame length) in
+	 * 1/10 of millisecond, which will be reported as a part of the PCM
+	 * delay, so the client can synchronize audio with video. */
+	const unsigned int aac_delay = (aacinf.nDelay + aacinf.frameLength) * 10000 / samplerate;
+	debug("AAC encoder delay: %u.%u ms", aac_delay / 10, aac_delay % 10);
+	t->a2dp.pcm.codec_delay = aac_delay;
+
+	/* the number of PCM frames consumed by every encoded AAC frame */
+	t->a2dp.pcm.block_frames = aacinf.frameLength;
+
 	ffb_t bt = { 0 };
-	ffb_t pcm = { 0 };
+	rb_t pcm = { 0 };
 	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
+	pthread_cleanup_push(PTHREAD_CLEANUP(rb_free), &pcm);
 
 	const unsigned int aac_frame_size = aacinf.inputChannels * aacinf.frameLength;
-	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(t->a2dp.pcm.format);
-	if (ffb_init(&pcm, aac_frame_size, sample_size) == -1 ||
+	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(t->a2dp.pcm.codec_format);
+	if (rb_init(&pcm, aac_frame_size, sample_size, true) == -1 ||
 			ffb_init_uint8_t(&bt, RTP_HEADER_LEN + aacinf.maxOutBufBytes) == -1) {
 		error("Couldn't create data buffers: %s", strerror(errno));
 		goto fail_ffb;
@@ -161,11 +215,13 @@ static void *a2dp_aac_enc_thread(struct ba_transport_thread *th) {
 
 	/* initialize RTP header and get anchor for payload */
 	uint8_t *rtp_payload = rtp_a2dp_init(bt.data, &rtp_header, NULL, 0);
-	uint16_t seq_number = be16toh(rtp_header->seq_number);
-	uint32_t timestamp = be32toh(rtp_header->timestamp);
+
+	struct rtp_state rtp = { 0 };
+	rtp_state_init(&rtp, samplerate, samplerate);
 
 	int in_bufferIdentifiers[] = { IN_AUDIO_DATA };
 	int out_bufferIdentifiers[] = { OUT_BITSTREAM_DATA };
+	void *in_buf_data = rb_head(&pcm);
 	int in_bufSizes[] = { pcm.nmemb * pcm.size };
 	int out_bufSizes[] = { aacinf.maxOutBufBytes };
 	int in_bufElSizes[] = { pcm.size };
@@ -173,7 +229,7 @@ static void *a2dp_aac_enc_thread(struct ba_transport_thread *th) {
 
 	AACENC_BufDesc in_buf = {
 		.numBufs = 1,
-		.bufs = (void **)&pcm.data,
+		.bufs = &in_buf_data,
 		.bufferIdentifiers = in_bufferIdentifiers,
 		.bufSizes = in_bufSizes,
 		.bufElSizes = in_bufElSizes,
@@ -188,62 +244,112 @@ static void *a2dp_aac_enc_thread(struct ba_transport_thread *th) {
 	AACENC_InArgs in_args = { 0 };
 	AACENC_OutArgs out_args = { 0 };
 
+	if (config.a2dp.fast_start) {
+
+		/* Prime the encoder with silence, so it will not hold back the
+		 * first frame of the stream due to its internal delay. Also, the
+		 * first packet will be sent without waiting for a complete frame. */
+		io.fast_start.samples = aac_frame_size;
+
+		size_t i;
+		for (i = 0; i < 1 + aacinf.nDelay / aacinf.frameLength; i++) {
+			memset(rb_tail(&pcm), 0, aac_frame_size * sample_size);
+			rb_seek(&pcm, aac_frame_size);
+			in_buf_data = rb_head(&pcm);
+			in_args.numInSamples = aac_frame_size;
+			if ((err = aacEncEncode(handle, &in_buf, &out_buf, &in_args, &out_args)) != AACENC_OK) {
+				warn("Couldn't prime AAC encoder: %s", aacenc_strerror(err));
+				break;
+			}
+			rb_shift(&pcm, out_args.numInSamples);
+		}
+
+		rb_rewind(&pcm);
+
+	}
+
+	struct io_bt_batch bt_batch = { 0 };
+	rtp_header_t rtp_headers[IO_BT_BATCH_SIZE];
+
+	/* In the VBR mode the bit rate is not controlled by us. */
+	const bool abr_enabled = config.a2dp.abr && !configuration->vbr;
+	struct io_bt_abr abr;
+	io_bt_abr_init(&abr, bitrate / 4, bitrate, bitrate / 16);
+	io_bt_abr_set_low_power(&abr, bitrate / 2);
+	bool low_power = false;
+
 	debug_transport_thread_loop(th, "START");
 	for (ba_transport_thread_set_state_running(th);;) {
 
 		ssize_t samples;
 		if ((samples = io_poll_and_read_pcm(&io, &t->a2dp.pcm,
-						pcm.tail, ffb_len_in(&pcm))) <= 0) {
+						rb_tail(&pcm), rb_len_in(&pcm))) <= 0) {
 			if (samples == -1)
 				error("PCM poll and read error: %s", strerror(errno));
 			ba_transport_stop_if_no_clients(t);
 			continue;
 		}
 
-		ffb_seek(&pcm, samples);
-		while ((in_args.numInSamples = ffb_len_out(&pcm)) > 0) {
+		rb_seek(&pcm, samples);
+		while ((in_args.numInSamples = rb_len_out(&pcm)) > 0) {
 
+			in_buf_data = rb_head(&pcm);
+			trace_probe2(encode_begin, th, in_args.numInSamples);
 			if ((err = aacEncEncode(handle, &in_buf, &out_buf, &in_args, &out_args)) != AACENC_OK)
 				error("AAC encoding error: %s", aacenc_strerror(err));
+			trace_probe2(encode_end, th, out_args.numOutBytes);
 
 			if (out_args.numOutBytes > 0) {
 
-				size_t payload_len_max = t->mtu_write - RTP_HEADER_LEN;
+				const size_t payload_len_max = t->mtu_write - RTP_HEADER_LEN;
+				const uint8_t *payload = rtp_payload;
 				size_t payload_len = out_args.numOutBytes;
-				rtp_header->timestamp = htobe32(timestamp);
+
+				if (payload_len > payload_len_max)
+					debug("Payload fragmentation: extra %zd bytes", payload_len - payload_len_max);
 
 				/* If the size of the RTP packet exceeds writing MTU, the RTP payload
 				 * should be fragmented. According to the RFC 3016, fragmentation of
 				 * the audioMuxElement requires no extra header - the payload should
-				 * be fragmented and spread across multiple RTP packets. */
-				for (;;) {
+				 * be fragmented and spread across multiple RTP packets. Every packet
+				 * gets its own copy of the RTP header, so all fragments can be sent
+				 * to the BT socket with a single system call. */
+				while (payload_len > 0) {
+
+					const size_t chunk_len = MIN(payload_len, payload_len_max);
+					rtp_header_t *header = rtp_state_new_packet_from(&rtp,
+							&rtp_headers[bt_batch.len], rtp_header, 0);
+					header->markbit = payload_len <= payload_len_max;
+					io_bt_batch_add(&bt_batch, header, RTP_HEADER_LEN, payload, chunk_len);
 
-					size_t chunk_len;
-					chunk_len = payload_len > payload_len_max ? payload_len_max : payload_len;
-					rtp_header->markbit = payload_len <= payload_len_max;
-					rtp_header->seq_number = htobe16(++seq_number);
+					payload += chunk_len;
+					payload_len -= chunk_len;
 
-					ffb_rewind(&bt);
-					ffb_seek(&bt, RTP_HEADER_LEN + chunk_len);
+					if (payload_len > 0 && !io_bt_batch_is_full(&bt_batch))
+						continue;
 
-					ssize_t len = ffb_blen_out(&bt);
-					if ((len = io_bt_write(th, bt.data, len)) <= 0) {
+					ssize_t len;
+					if ((len = io_bt_write_batch(th, &bt_batch)) <= 0) {
 						if (len == -1)
 							error("BT write error: %s", strerror(errno));
 						goto fail;
 					}
 
-					/* account written payload only */
-					len -= RTP_HEADER_LEN;
-
-					/* break if the last part of the payload has been written */
-					if ((payload_len -= len) == 0)
-						break;
+				}
 
-					/* move rest of data to the beginning of the payload */
-					debug("Payload fragmentation: extra %zd bytes", payload_len);
-					memmove(rtp_payload, rtp_payload + len, payload_len);
+				if (!configuration->vbr && io_bt_abr_update(&abr, th, abr_enabled)) {
+					debug("Changing AAC bit rate: %u", abr.value);
+					if ((err = aacEncoder_SetParam(handle, AACENC_BITRATE, abr.value)) != AACENC_OK)
+						error("Couldn't set bitrate: %s", aacenc_strerror(err));
+				}
 
+				/* afterburner is the most expensive part of the encoder */
+				const bool battery_low = atomic_load_explicit(&config.battery.low, memory_order_relaxed);
+				if (config.aac_afterburner && low_power != battery_low) {
+					low_power = battery_low;
+					debug("%s AAC afterburner", low_power ? "Disabling" : "Enabling");
+					if ((err = aacEncoder_SetParam(handle, AACENC_AFTERBURNER, !low_power)) != AACENC_OK)
+						error("Couldn't set afterburner: %s", aacenc_strerror(err));
 				}
 
 			}
@@ -251,16 +357,15 @@ static void *a2dp_aac_enc_thread(struct ba_transport_thread *th) {
 			/* keep data transfer at a constant bit rate, also
 			 * get a timestamp for the next RTP frame */
 			unsigned int pcm_frames = out_args.numInSamples / channels;
-			asrsync_sync(&io.asrs, pcm_frames);
-			timestamp += pcm_frames * 10000 / samplerate;
+			io_poll_pace(&io, th, pcm_frames);
+			rtp_state_update(&rtp, pcm_frames);
 
 			/* update busy delay (encoding overhead) */
 			t->a2dp.pcm.delay = asrsync_get_busy_usec(&io.asrs) / 100;
 
-			/* If the input buffer was not consumed, we have to append new data to
-			 * the existing one. Since we do not use ring buffer, we will simply
-			 * move unprocessed data to the front of our linear buffer. */
-			ffb_shift(&pcm, out_args.numInSamples);
+			/* If the input buffer was not consumed, the unprocessed data will
+			 * stay in the ring buffer and new data will be appended to it. */
+			rb_shift(&pcm, out_args.numInSamples);
 
 		}
 
@@ -280,6 +385,313 @@ fail_open:
 	return NULL;
 }
 
+/**
+ * The maximal length of the LOAS frame - the 3-byte sync header followed by
+ * the AudioMuxElement with the 13-bit length. */
+#define A2DP_AAC_LOAS_FRAME_LEN_MAX (3 + 0x1FFF)
+
+/**
+ * Bit stream reader of the AudioMuxElement. */
+struct a2dp_aac_bits {
+	const uint8_t *data;
+	size_t len;
+	/* position in bits */
+	size_t pos;
+	/* read beyond the end of the data */
+	bool overrun;
+};
+
+static uint32_t a2dp_aac_bits_read(struct a2dp_aac_bits *bits, unsigned int n) {
+	uint32_t value = 0;
+	for (; n > 0; n--, bits->pos++) {
+		if (bits->pos >= bits->len * 8) {
+			bits->overrun = true;
+			return 0;
+		}
+		value = (value << 1) | ((bits->data[bits->pos / 8] >> (7 - bits->pos % 8)) & 1);
+	}
+	return value;
+}
+
+/**
+ * Get the audio object type of the AudioSpecificConfig for the A2DP AAC
+ * object type. */
+static unsigned int a2dp_aac_get_asc_object_type(uint8_t object_type) {
+	switch (object_type) {
+	case AAC_OBJECT_TYPE_MPEG2_AAC_LC:
+	case AAC_OBJECT_TYPE_MPEG4_AAC_LC:
+		return 2;
+	case AAC_OBJECT_TYPE_MPEG4_AAC_LTP:
+		return 4;
+	case AAC_OBJECT_TYPE_MPEG4_AAC_SCA:
+		return 6;
+	case AAC_OBJECT_TYPE_MPEG4_AAC_ELD2:
+		return 39;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Check the StreamMuxConfig of the AudioMuxElement.
+ *
+ * Only the configuration with a single program and a single layer, i.e.
+ * the one produced by our encoder, is supported.
+ *
+ * @param data Address of the AudioMuxElement (muxConfigPresent = 1).
+ * @param len The length of the AudioMuxElement.
+ * @param object_type The audio object type of the AudioSpecificConfig.
+ * @param sampling The sampling frequency.
+ * @param channels The number of channels.
+ * @return If the AudioMuxElement carries the configuration which matches
+ *   given parameters, this function returns 1. If the AudioMuxElement uses
+ *   the configuration of the previous one, 0 is returned. Otherwise, -1 is
+ *   returned. */
+static int a2dp_aac_latm_check_config(const uint8_t *data, size_t len,
+		unsigned int object_type, unsigned int sampling, unsigned int channels) {
+
+	static const unsigned int samplings[] = {
+		96000, 88200, 64000, 48000, 44100, 32000, 24000,
+		22050, 16000, 12000, 11025, 8000, 7350 };
+
+	struct a2dp_aac_bits bits = { data, len, 0, false };
+
+	/* useSameStreamMux */
+	if (a2dp_aac_bits_read(&bits, 1))
+		return bits.overrun ? -1 : 0;
+
+	const unsigned int version = a2dp_aac_bits_read(&bits, 1);
+	if (version == 1) {
+		/* audioMuxVersionA */
+		if (a2dp_aac_bits_read(&bits, 1))
+			return -1;
+		/* taraBufferFullness = LatmGetValue() */
+		a2dp_aac_bits_read(&bits, 8 * (a2dp_aac_bits_read(&bits, 2) + 1));
+	}
+
+	/* allStreamsSameTimeFraming, numSubFrames, numProgram, numLayer */
+	if (a2dp_aac_bits_read(&bits, 1) != 1 ||
+			a2dp_aac_bits_read(&bits, 6) != 0 ||
+			a2dp_aac_bits_read(&bits, 4) != 0 ||
+			a2dp_aac_bits_read(&bits, 3) != 0)
+		return -1;
+
+	if (version == 1)
+		/* ascLen = LatmGetValue() */
+		a2dp_aac_bits_read(&bits, 8 * (a2dp_aac_bits_read(&bits, 2) + 1));
+
+	/* AudioSpecificConfig */
+	unsigned int asc_object_type = a2dp_aac_bits_read(&bits, 5);
+	if (asc_object_type == 31)
+		asc_object_type = 32 + a2dp_aac_bits_read(&bits, 6);
+	unsigned int asc_sampling = a2dp_aac_bits_read(&bits, 4);
+	if (asc_sampling == 0x0F)
+		asc_sampling = a2dp_aac_bits_read(&bits, 24);
+	else if (asc_sampling < ARRAYSIZE(samplings))
+		asc_sampling = samplings[asc_sampling];
+	else
+		return -1;
+	const unsigned int asc_channels = a2dp_aac_bits_read(&bits, 4);
+
+	if (bits.overrun ||
+			asc_object_type != object_type ||
+			asc_sampling != sampling ||
+			asc_channels != channels)
+		return -1;
+
+	return 1;
+}
+
+/**
+ * State of the AAC stream provided by the client. */
+struct a2dp_aac_passthrough {
+	ffb_t loas;
+	/* the in-band configuration matches the negotiated one */
+	bool config_ok;
+};
+
+static enum ba_transport_thread_signal a2dp_aac_passthrough_io_poll_signal_filter(
+		enum ba_transport_thread_signal signal, void *userdata) {
+	struct a2dp_aac_passthrough *stream = userdata;
+	/* discard incomplete frame of the previous stream */
+	if (signal == BA_TRANSPORT_THREAD_SIGNAL_PCM_OPEN ||
+			signal == BA_TRANSPORT_THREAD_SIGNAL_PCM_CLOSE ||
+			signal == BA_TRANSPORT_THREAD_SIGNAL_PCM_DROP) {
+		ffb_rewind(&stream->loas);
+		stream->config_ok = false;
+	}
+	return signal;
+}
+
+/**
+ * Packetize AAC stream provided by the client.
+ *
+ * The client shall write the LOAS stream (AudioSyncStream) which carries the
+ * AudioMuxElement with the in-band StreamMuxConfig, i.e. the LATM stream in
+ * the same format as the one produced by our encoder. The configuration of
+ * the stream shall match the negotiated A2DP configuration - frames with
+ * a different configuration (or frames which refer to the configuration
+ * which has not been validated yet) are skipped. The LOAS sync header is
+ * stripped and the AudioMuxElement is sent as the RTP payload. */
+static void *a2dp_aac_passthrough_thread(struct ba_transport_thread *th) {
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_thread_cleanup), th);
+
+	struct ba_transport *t = th->t;
+	struct ba_transport_pcm *t_pcm = &t->a2dp.pcm;
+	struct a2dp_aac_passthrough stream = { 0 };
+	ffb_t *loas = &stream.loas;
+	struct io_poll io = {
+		.signal.filter = a2dp_aac_passthrough_io_poll_signal_filter,
+		.signal.userdata = &stream,
+		.timeout = -1,
+	};
+
+	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), loas);
+
+	const a2dp_aac_t *configuration = (a2dp_aac_t *)t->a2dp.configuration;
+	const unsigned int object_type = a2dp_aac_get_asc_object_type(configuration->object_type);
+	const unsigned int channels = t_pcm->channels;
+	const unsigned int samplerate = t_pcm->sampling;
+	/* the number of PCM frames carried by every AAC frame */
+	const unsigned int aac_frames = t_pcm->block_frames;
+
+	if (ffb_init_uint8_t(loas, 2 * A2DP_AAC_LOAS_FRAME_LEN_MAX) == -1) {
+		error("Couldn't create data buffers: %s", strerror(errno));
+		goto fail_ffb;
+	}
+
+	/* The frame is sent when it is completely received from the client,
+	 * so there is no other delay than the time needed to collect it. */
+	t_pcm->codec_delay = aac_frames * 10000 / samplerate;
+
+	rtp_header_t rtp_header_template;
+	rtp_header_t *rtp_header;
+
+	/* initialize RTP header template */
+	rtp_a2dp_init(&rtp_header_template, &rtp_header, NULL, 0);
+
+	struct rtp_state rtp = { 0 };
+	rtp_state_init(&rtp, samplerate, samplerate);
+
+	struct io_bt_batch bt_batch = { 0 };
+	rtp_header_t rtp_headers[IO_BT_BATCH_SIZE];
+
+	debug_transport_thread_loop(th, "START");
+	for (ba_transport_thread_set_state_running(th);;) {
+
+		ssize_t len;
+		if ((len = io_poll_and_read_pcm(&io, t_pcm, loas->tail, ffb_len_in(loas))) <= 0) {
+			if (len == -1)
+				error("PCM poll and read error: %s", strerror(errno));
+			ba_transport_stop_if_no_clients(t);
+			continue;
+		}
+
+		ffb_seek(loas, len);
+
+		const uint8_t *data = loas->data;
+		size_t data_len = ffb_len_out(loas);
+		size_t skipped = 0;
+
+		while (data_len >= 3) {
+
+			/* check the 11-bit LOAS sync word (0x2B7) */
+			if (data[0] != 0x56 || (data[1] & 0xE0) != 0xE0) {
+				/* resynchronize with the next frame header */
+				data++;
+				data_len--;
+				skipped++;
+				continue;
+			}
+
+			const size_t frame_len = 3 + (((data[1] & 0x1F) << 8) | data[2]);
+
+			/* wait for the rest of the frame */
+			if (frame_len > data_len)
+				break;
+
+			int rv;
+			if ((rv = a2dp_aac_latm_check_config(data + 3, frame_len - 3,
+							object_type, samplerate, channels)) == 1)
+				stream.config_ok = true;
+			else if (rv == -1)
+				stream.config_ok = false;
+			if (!stream.config_ok) {
+				/* skip the whole frame with unsupported configuration */
+				data += frame_len;
+				data_len -= frame_len;
+				skipped += frame_len;
+				continue;
+			}
+
+			const size_t payload_len_max = t->mtu_write - RTP_HEADER_LEN;
+			const uint8_t *payload = data + 3;
+			size_t payload_len = frame_len - 3;
+
+			if (payload_len > payload_len_max)
+				debug("Payload fragmentation: extra %zd bytes", payload_len - payload_len_max);
+
+			/* Fragmentation of the audioMuxElement requires no extra header,
+			 * see the comment in the encoder thread for details. */
+			while (payload_len > 0) {
+
+				const size_t chunk_len = MIN(payload_len, payload_len_max);
+				rtp_header_t *header = rtp_state_new_packet_from(&rtp,
+						&rtp_headers[bt_batch.len], rtp_header, 0);
+				header->markbit = payload_len <= payload_len_max;
+				io_bt_batch_add(&bt_batch, header, RTP_HEADER_LEN, payload, chunk_len);
+
+				payload += chunk_len;
+				payload_len -= chunk_len;
+
+				if (payload_len > 0 && !io_bt_batch_is_full(&bt_batch))
+					continue;
+
+				if ((len = io_bt_write_batch(th, &bt_batch)) <= 0) {
+					if (len == -1)
+						error("BT write error: %s", strerror(errno));
+					goto fail;
+				}
+
+			}
+
+			pthread_mutex_lock(&t_pcm->mutex);
+			ba_transport_pcm_position_update(t_pcm, aac_frames * channels);
+			pthread_mutex_unlock(&t_pcm->mutex);
+
+			/* keep data transfer at a constant bit rate, also
+			 * get a timestamp for the next RTP frame */
+			io_poll_pace(&io, th, aac_frames);
+			rtp_state_update(&rtp, aac_frames);
+
+			data += frame_len;
+			data_len -= frame_len;
+
+		}
+
+		if (skipped > 0)
+			debug("Skipped LOAS stream data: %zu bytes", skipped);
+
+		/* update busy delay (packetization overhead) */
+		t_pcm->delay = asrsync_get_busy_usec(&io.asrs) / 100;
+
+		/* move incomplete frame to the beginning of the buffer */
+		ffb_shift(loas, data - (uint8_t *)loas->data);
+
+	}
+
+fail:
+	debug_transport_thread_loop(th, "EXIT");
+	ba_transport_thread_set_state_stopping(th);
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+fail_ffb:
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+
 static enum ba_transport_thread_signal a2dp_aac_dec_io_poll_signal_filter(
 		enum ba_transport_thread_signal signal, void *userdata) {
 	uint16_t *rtp_seq_number = userdata;
@@ -288,6 +700,46 @@ static enum ba_transport_thread_signal a2dp_aac_dec_io_poll_signal_filter(
 	return signal;
 }
 
+/**
+ * Conceal lost AAC frames with the FDK-AAC decoder error concealment.
+ *
+ * For every lost packet one frame is synthesized by the decoder, based on
+ * the signal decoded so far. However, at most IO_PCM_CONCEAL_MAX_MS of the
+ * signal is generated for a single gap. */
+static void a2dp_aac_dec_conceal(struct ba_transport *t,
+		HANDLE_AACDECODER handle, ffb_t *pcm, unsigned int missing) {
+
+	const CStreamInfo *aacinf;
+	AAC_DECODER_ERROR err;
+
+	/* nothing was decoded yet, so there is nothing to conceal */
+	if ((aacinf = aacDecoder_GetStreamInfo(handle)) == NULL ||
+			aacinf->frameSize <= 0)
+		return;
+
+	const unsigned int frame_size = aacinf->frameSize;
+	const size_t samples = (size_t)frame_size * t->a2dp.pcm.channels;
+	const unsigned int max = t->a2dp.pcm.sampling * IO_PCM_CONCEAL_MAX_MS / 1000 / frame_size + 1;
+
+	missing = MIN(missing, max);
+	debug("Concealing lost AAC frames: %u", missing);
+
+	for (; missing > 0; missing--) {
+		if ((err = aacDecoder_DecodeFrame(handle, pcm->tail, ffb_blen_in(pcm), AACDEC_CONCEAL)) != AAC_DEC_OK) {
+			error("AAC concealment error: %s", aacdec_strerror(err));
+			break;
+		}
+		io_pcm_scale(&t->a2dp.pcm, pcm->data, samples);
+		if (io_pcm_write(&t->a2dp.pcm, pcm->data, samples) == -1) {
+			error("FIFO write error: %s", strerror(errno));
+			break;
+		}
+		atomic_fetch_add_explicit(&t->a2dp.pcm.concealed_frames,
+				frame_size, memory_order_relaxed);
+	}
+
+}
+
 static void *a2dp_aac_dec_thread(struct ba_transport_thread *th) {
 
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
@@ -358,8 +810,16 @@ static void *a2dp_aac_dec_thread(struct ba_transport_thread *th) {
 			continue;
 
 		const uint8_t *rtp_latm;
-		if ((rtp_latm = rtp_a2dp_payload(bt.data, &rtp_seq_number)) == NULL)
+		unsigned int missing;
+		if ((rtp_latm = rtp_a2dp_payload(bt.data, &rtp_seq_number, &missing)) == NULL)
 			continue;
+		ba_transport_thread_stats_add(th, rtp_lost, missing);
+
+		if (missing > 0) {
+			/* drop incomplete LATM frame, if any */
+			ffb_rewind(&latm);
+			a2dp_aac_dec_conceal(t, handle, &pcm, missing);
+		}
 
 		const rtp_header_t *rtp_header = (rtp_header_t *)bt.data;
 		size_t rtp_latm_len = len - (rtp_latm - (uint8_t *)bt.data);
@@ -395,6 +855,7 @@ static void *a2dp_aac_dec_thread(struct ba_transport_thread *th) {
 		unsigned int valid = ffb_len_out(&latm);
 		CStreamInfo *aacinf;
 
+		trace_probe2(decode_begin, th, data_len);
 		if ((err = aacDecoder_Fill(handle, (uint8_t **)&latm.data, &data_len, &valid)) != AAC_DEC_OK)
 			error("AAC buffer fill error: %s", aacdec_strerror(err));
 		else if ((err = aacDecoder_DecodeFrame(handle, pcm.tail, ffb_blen_in(&pcm), 0)) != AAC_DEC_OK)
@@ -405,6 +866,7 @@ static void *a2dp_aac_dec_thread(struct ba_transport_thread *th) {
 			if ((unsigned int)aacinf->numChannels != channels)
 				warn("AAC channels mismatch: %u != %u", aacinf->numChannels, channels);
 			const size_t samples = (size_t)aacinf->frameSize * channels;
+			trace_probe2(decode_end, th, samples);
 			io_pcm_scale(&t->a2dp.pcm, pcm.data, samples);
 			if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1)
 				error("FIFO write error: %s", strerror(errno));
@@ -432,8 +894,11 @@ fail_open:
 
 int a2dp_aac_transport_start(struct ba_transport *t) {
 
-	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE)
+	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE) {
+		if (BA_TRANSPORT_PCM_FORMAT_IS_COMPRESSED(t->a2dp.pcm.format))
+			return ba_transport_thread_create(&t->thread_enc, a2dp_aac_passthrough_thread, "ba-a2dp-aac", true);
 		return ba_transport_thread_create(&t->thread_enc, a2dp_aac_enc_thread, "ba-a2dp-aac", true);
+	}
 
 	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SINK)
 		return ba_transport_thread_create(&t->thread_dec, a2dp_aac_dec_thread, "ba-a2dp-aac", true);
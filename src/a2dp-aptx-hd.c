@@ -23,13 +23,17 @@
 
 #include "a2dp.h"
 #include "a2dp-codecs.h"
+#include "audio.h"
+#include "bluealsa.h"
 #include "codec-aptx.h"
 #include "io.h"
 #include "rtp.h"
+#include "trace.h"
 #include "utils.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
 #include "shared/log.h"
+#include "shared/rb.h"
 #include "shared/rt.h"
 
 void a2dp_aptx_hd_transport_set_codec(struct ba_transport *t) {
@@ -42,6 +46,9 @@ void a2dp_aptx_hd_transport_set_codec(struct ba_transport *t) {
 	t->a2dp.pcm.sampling = a2dp_codec_lookup_frequency(codec,
 			((a2dp_aptx_hd_t *)t->a2dp.configuration)->aptx.frequency, false);
 
+	/* apt-X HD codeword encodes 4 PCM frames */
+	t->a2dp.pcm.block_frames = 4;
+
 }
 
 static void *a2dp_aptx_hd_enc_thread(struct ba_transport_thread *th) {
@@ -59,9 +66,9 @@ static void *a2dp_aptx_hd_enc_thread(struct ba_transport_thread *th) {
 	}
 
 	ffb_t bt = { 0 };
-	ffb_t pcm = { 0 };
+	rb_t pcm = { 0 };
 	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
+	pthread_cleanup_push(PTHREAD_CLEANUP(rb_free), &pcm);
 	pthread_cleanup_push(PTHREAD_CLEANUP(aptxhdenc_destroy), handle);
 
 	const unsigned int channels = t->a2dp.pcm.channels;
@@ -70,35 +77,51 @@ static void *a2dp_aptx_hd_enc_thread(struct ba_transport_thread *th) {
 	const size_t aptx_code_len = 2 * 3 * sizeof(uint8_t);
 	const size_t mtu_write = t->mtu_write;
 
-	if (ffb_init_int32_t(&pcm, aptx_pcm_samples * ((mtu_write - RTP_HEADER_LEN) / aptx_code_len)) == -1 ||
+	if (rb_init_int32_t(&pcm, aptx_pcm_samples * ((mtu_write - RTP_HEADER_LEN) / aptx_code_len)) == -1 ||
 			ffb_init_uint8_t(&bt, mtu_write) == -1) {
 		error("Couldn't create data buffers: %s", strerror(errno));
 		goto fail_ffb;
 	}
 
+	/* Codec delay consists of the QMF filter bank delay (90 frames) and the
+	 * time needed to collect PCM frames for the whole RTP packet. */
+	t->a2dp.pcm.codec_delay = (90 + 4 * ((mtu_write - RTP_HEADER_LEN) / aptx_code_len)) *
+		10000 / samplerate;
+
 	rtp_header_t *rtp_header;
 
 	/* initialize RTP header and get anchor for payload */
 	uint8_t *rtp_payload = rtp_a2dp_init(bt.data, &rtp_header, NULL, 0);
-	uint16_t seq_number = be16toh(rtp_header->seq_number);
-	uint32_t timestamp = be32toh(rtp_header->timestamp);
+
+	struct rtp_state rtp = { 0 };
+	rtp_state_init(&rtp, samplerate, samplerate);
+
+	struct io_bt_pipeline pipeline = { 0 };
+	pthread_cleanup_push(PTHREAD_CLEANUP(io_bt_pipeline_free), &pipeline);
+
+	if (config.a2dp.pipeline) {
+		if (io_bt_pipeline_init(&pipeline, th, mtu_write) == -1)
+			warn("Couldn't create BT writer thread: %s", strerror(errno));
+		else
+			io.pipeline = &pipeline;
+	}
 
 	debug_transport_thread_loop(th, "START");
 	for (ba_transport_thread_set_state_running(th);;) {
 
 		ssize_t samples;
 		if ((samples = io_poll_and_read_pcm(&io, &t->a2dp.pcm,
-						pcm.tail, ffb_len_in(&pcm))) <= 0) {
+						rb_tail(&pcm), rb_len_in(&pcm))) <= 0) {
 			if (samples == -1)
 				error("PCM poll and read error: %s", strerror(errno));
 			ba_transport_stop_if_no_clients(t);
 			continue;
 		}
 
-		ffb_seek(&pcm, samples);
-		samples = ffb_len_out(&pcm);
+		rb_seek(&pcm, samples);
+		samples = rb_len_out(&pcm);
 
-		int32_t *input = pcm.data;
+		int32_t *input = rb_head(&pcm);
 		size_t input_samples = samples;
 
 		/* encode and transfer obtained data */
@@ -113,6 +136,7 @@ static void *a2dp_aptx_hd_enc_thread(struct ba_transport_thread *th) {
 			/* Generate as many apt-X frames as possible to fill the output buffer
 			 * without overflowing it. The size of the output buffer is based on
 			 * the socket MTU, so such a transfer should be most efficient. */
+			trace_probe2(encode_begin, th, input_samples);
 			while (input_samples >= aptx_pcm_samples && output_len >= aptx_code_len) {
 
 				size_t encoded = output_len;
@@ -132,33 +156,32 @@ static void *a2dp_aptx_hd_enc_thread(struct ba_transport_thread *th) {
 			}
 
 			ssize_t len = ffb_blen_out(&bt);
-			if ((len = io_bt_write(th, bt.data, len)) <= 0) {
+			trace_probe2(encode_end, th, len);
+			rtp_state_new_packet(&rtp, rtp_header);
+			if ((len = io_poll_bt_write(&io, th, bt.data, len)) <= 0) {
 				if (len == -1)
 					error("BT write error: %s", strerror(errno));
 				goto fail;
 			}
 
-			/* keep data transfer at a constant bit rate */
+			/* keep data transfer at a constant bit rate, also
+			 * get a timestamp for the next RTP frame */
 			unsigned int pcm_frames = pcm_samples / channels;
-			asrsync_sync(&io.asrs, pcm_frames);
-			timestamp += pcm_frames * 10000 / samplerate;
+			io_poll_pace(&io, th, pcm_frames);
+			rtp_state_update(&rtp, pcm_frames);
 
 			/* update busy delay (encoding overhead) */
 			t->a2dp.pcm.delay = asrsync_get_busy_usec(&io.asrs) / 100;
 
-			rtp_header->seq_number = htobe16(++seq_number);
-			rtp_header->timestamp = htobe32(timestamp);
-
 			/* reinitialize output buffer */
 			ffb_rewind(&bt);
 
 		}
 
-		/* If the input buffer was not consumed (due to codesize limit), we
-		 * have to append new data to the existing one. Since we do not use
-		 * ring buffer, we will simply move unprocessed data to the front
-		 * of our linear buffer. */
-		ffb_shift(&pcm, samples - input_samples);
+		/* If the input buffer was not consumed (due to codesize limit), the
+		 * unprocessed data will stay in the ring buffer and new data will
+		 * be appended to it. */
+		rb_shift(&pcm, samples - input_samples);
 
 	}
 
@@ -166,6 +189,7 @@ fail:
 	debug_transport_thread_loop(th, "EXIT");
 	ba_transport_thread_set_state_stopping(th);
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_pop(1);
 fail_ffb:
 	pthread_cleanup_pop(1);
 	pthread_cleanup_pop(1);
@@ -206,18 +230,32 @@ static void *a2dp_aptx_hd_dec_thread(struct ba_transport_thread *th) {
 
 	ffb_t bt = { 0 };
 	ffb_t pcm = { 0 };
+	struct audio_plc plc = { 0 };
 	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
 	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
+	pthread_cleanup_push(PTHREAD_CLEANUP(audio_plc_free), &plc);
 	pthread_cleanup_push(PTHREAD_CLEANUP(aptxhddec_destroy), handle);
 
 	/* Note, that we are allocating space for one extra output packed, which is
 	 * required by the aptx_decode_sync() function of libopenaptx library. */
-	if (ffb_init_int32_t(&pcm, (t->mtu_read / 6 + 1) * 8) == -1 ||
-			ffb_init_uint8_t(&bt, t->mtu_read) == -1) {
+	const size_t pcm_samples = (t->mtu_read / 6 + 1) * 8;
+	if (ffb_init_int32_t(&pcm, pcm_samples) == -1 ||
+			ffb_init_uint8_t(&bt, t->mtu_read) == -1 ||
+			audio_plc_init(&plc, sizeof(int32_t), t->a2dp.pcm.channels, pcm_samples) == -1) {
 		error("Couldn't create data buffers: %s", strerror(errno));
 		goto fail_ffb;
 	}
 
+	struct io_bt_receiver receiver = { 0 };
+	pthread_cleanup_push(PTHREAD_CLEANUP(io_bt_receiver_free), &receiver);
+
+	if (config.a2dp.receiver) {
+		if (io_bt_receiver_init(&receiver, th, t->mtu_read) == -1)
+			warn("Couldn't create BT reader thread: %s", strerror(errno));
+		else
+			io.receiver = &receiver;
+	}
+
 	debug_transport_thread_loop(th, "START");
 	for (ba_transport_thread_set_state_running(th);;) {
 
@@ -232,11 +270,19 @@ static void *a2dp_aptx_hd_dec_thread(struct ba_transport_thread *th) {
 			continue;
 
 		const uint8_t *rtp_payload;
-		if ((rtp_payload = rtp_a2dp_payload(bt.data, &rtp_seq_number)) == NULL)
+		unsigned int missing;
+		if ((rtp_payload = rtp_a2dp_payload(bt.data, &rtp_seq_number, &missing)) == NULL)
 			continue;
+		ba_transport_thread_stats_add(th, rtp_lost, missing);
 
 		size_t rtp_payload_len = len - (rtp_payload - (uint8_t *)bt.data);
 
+		/* fill the gap with the faded out copy of the last packet */
+		if (missing > 0 &&
+				io_pcm_conceal(&t->a2dp.pcm, &plc, pcm.data, missing) == -1)
+			error("FIFO write error: %s", strerror(errno));
+
+		trace_probe2(decode_begin, th, rtp_payload_len);
 		ffb_rewind(&pcm);
 		while (rtp_payload_len >= 6) {
 
@@ -255,7 +301,9 @@ static void *a2dp_aptx_hd_dec_thread(struct ba_transport_thread *th) {
 		}
 
 		const size_t samples = ffb_len_out(&pcm);
+		trace_probe2(decode_end, th, samples);
 		io_pcm_scale(&t->a2dp.pcm, pcm.data, samples);
+		audio_plc_update(&plc, pcm.data, samples);
 		if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1)
 			error("FIFO write error: %s", strerror(errno));
 
@@ -265,10 +313,12 @@ fail:
 	debug_transport_thread_loop(th, "EXIT");
 	ba_transport_thread_set_state_stopping(th);
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_pop(1);
 fail_ffb:
 	pthread_cleanup_pop(1);
 	pthread_cleanup_pop(1);
 	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
 fail_init:
 	pthread_cleanup_pop(1);
 	return NULL;
@@ -24,22 +24,37 @@
 #include "a2dp-codecs.h"
 #include "codec-aptx.h"
 #include "io.h"
+#include "trace.h"
 #include "utils.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
 #include "shared/log.h"
+#include "shared/rb.h"
 #include "shared/rt.h"
 
+/**
+ * The maximal duration of the apt-X LL packet in milliseconds. Short packets
+ * sent at a high rate keep the encoder buffering low, so together with the
+ * small play-out buffer of the remote device the end-to-end delay can stay
+ * around 40 ms. */
+#define APTX_LL_PACKET_MS 4
+
 void a2dp_aptx_transport_set_codec(struct ba_transport *t) {
 
 	const struct a2dp_codec *codec = t->a2dp.codec;
 
+	/* NOTE: The apt-X LL configuration starts with the apt-X one, and
+	 *       the bit stream of both codecs is exactly the same. */
+
 	t->a2dp.pcm.format = BA_TRANSPORT_PCM_FORMAT_S16_2LE;
 	t->a2dp.pcm.channels = a2dp_codec_lookup_channels(codec,
 			((a2dp_aptx_t *)t->a2dp.configuration)->channel_mode, false);
 	t->a2dp.pcm.sampling = a2dp_codec_lookup_frequency(codec,
 			((a2dp_aptx_t *)t->a2dp.configuration)->frequency, false);
 
+	/* apt-X codeword encodes 4 PCM frames */
+	t->a2dp.pcm.block_frames = 4;
+
 }
 
 static void *a2dp_aptx_enc_thread(struct ba_transport_thread *th) {
@@ -57,38 +72,49 @@ static void *a2dp_aptx_enc_thread(struct ba_transport_thread *th) {
 	}
 
 	ffb_t bt = { 0 };
-	ffb_t pcm = { 0 };
+	rb_t pcm = { 0 };
 	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
+	pthread_cleanup_push(PTHREAD_CLEANUP(rb_free), &pcm);
 	pthread_cleanup_push(PTHREAD_CLEANUP(aptxenc_destroy), handle);
 
 	const unsigned int channels = t->a2dp.pcm.channels;
 	const size_t aptx_pcm_samples = 4 * channels;
 	const size_t aptx_code_len = 2 * sizeof(uint16_t);
-	const size_t mtu_write = t->mtu_write;
+	size_t aptx_codewords = t->mtu_write / aptx_code_len;
+
+	/* In the low latency mode the packet size is limited by its duration
+	 * rather than by the socket MTU. */
+	if (t->type.codec == A2DP_CODEC_VENDOR_APTX_LL)
+		aptx_codewords = MIN(aptx_codewords,
+				MAX(1, t->a2dp.pcm.sampling * APTX_LL_PACKET_MS / 1000 / 4));
 
-	if (ffb_init_int16_t(&pcm, aptx_pcm_samples * (mtu_write / aptx_code_len)) == -1 ||
-			ffb_init_uint8_t(&bt, mtu_write) == -1) {
+	if (rb_init_int16_t(&pcm, aptx_pcm_samples * aptx_codewords) == -1 ||
+			ffb_init_uint8_t(&bt, aptx_code_len * aptx_codewords) == -1) {
 		error("Couldn't create data buffers: %s", strerror(errno));
 		goto fail_ffb;
 	}
 
+	/* Codec delay consists of the QMF filter bank delay (90 frames) and the
+	 * time needed to collect PCM frames for the whole packet. */
+	t->a2dp.pcm.codec_delay = (90 + 4 * aptx_codewords) *
+		10000 / t->a2dp.pcm.sampling;
+
 	debug_transport_thread_loop(th, "START");
 	for (ba_transport_thread_set_state_running(th);;) {
 
 		ssize_t samples;
 		if ((samples = io_poll_and_read_pcm(&io, &t->a2dp.pcm,
-						pcm.tail, ffb_len_in(&pcm))) <= 0) {
+						rb_tail(&pcm), rb_len_in(&pcm))) <= 0) {
 			if (samples == -1)
 				error("PCM poll and read error: %s", strerror(errno));
 			ba_transport_stop_if_no_clients(t);
 			continue;
 		}
 
-		ffb_seek(&pcm, samples);
-		samples = ffb_len_out(&pcm);
+		rb_seek(&pcm, samples);
+		samples = rb_len_out(&pcm);
 
-		int16_t *input = pcm.data;
+		int16_t *input = rb_head(&pcm);
 		size_t input_samples = samples;
 
 		/* encode and transfer obtained data */
@@ -100,6 +126,7 @@ static void *a2dp_aptx_enc_thread(struct ba_transport_thread *th) {
 			/* Generate as many apt-X frames as possible to fill the output buffer
 			 * without overflowing it. The size of the output buffer is based on
 			 * the socket MTU, so such a transfer should be most efficient. */
+			trace_probe2(encode_begin, th, input_samples);
 			while (input_samples >= aptx_pcm_samples && output_len >= aptx_code_len) {
 
 				size_t encoded = output_len;
@@ -119,6 +146,7 @@ static void *a2dp_aptx_enc_thread(struct ba_transport_thread *th) {
 			}
 
 			ssize_t len = ffb_blen_out(&bt);
+			trace_probe2(encode_end, th, len);
 			if ((len = io_bt_write(th, bt.data, len)) <= 0) {
 				if (len == -1)
 					error("BT write error: %s", strerror(errno));
@@ -126,7 +154,7 @@ static void *a2dp_aptx_enc_thread(struct ba_transport_thread *th) {
 			}
 
 			/* keep data transfer at a constant bit rate */
-			asrsync_sync(&io.asrs, pcm_samples / channels);
+			io_poll_pace(&io, th, pcm_samples / channels);
 
 			/* update busy delay (encoding overhead) */
 			t->a2dp.pcm.delay = asrsync_get_busy_usec(&io.asrs) / 100;
@@ -136,11 +164,10 @@ static void *a2dp_aptx_enc_thread(struct ba_transport_thread *th) {
 
 		}
 
-		/* If the input buffer was not consumed (due to codesize limit), we
-		 * have to append new data to the existing one. Since we do not use
-		 * ring buffer, we will simply move unprocessed data to the front
-		 * of our linear buffer. */
-		ffb_shift(&pcm, samples - input_samples);
+		/* If the input buffer was not consumed (due to codesize limit), the
+		 * unprocessed data will stay in the ring buffer and new data will
+		 * be appended to it. */
+		rb_shift(&pcm, samples - input_samples);
 
 	}
 
@@ -202,6 +229,7 @@ static void *a2dp_aptx_dec_thread(struct ba_transport_thread *th) {
 		uint8_t *input = bt.data;
 		size_t input_len = len;
 
+		trace_probe2(decode_begin, th, input_len);
 		ffb_rewind(&pcm);
 		while (input_len >= 4) {
 
@@ -220,6 +248,7 @@ static void *a2dp_aptx_dec_thread(struct ba_transport_thread *th) {
 		}
 
 		const size_t samples = ffb_len_out(&pcm);
+		trace_probe2(decode_end, th, samples);
 		io_pcm_scale(&t->a2dp.pcm, pcm.data, samples);
 		if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1)
 			error("FIFO write error: %s", strerror(errno));
@@ -242,12 +271,15 @@ fail_init:
 
 int a2dp_aptx_transport_start(struct ba_transport *t) {
 
+	const char *name = t->type.codec == A2DP_CODEC_VENDOR_APTX_LL ?
+		"ba-a2dp-aptx-ll" : "ba-a2dp-aptx";
+
 	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE)
-		return ba_transport_thread_create(&t->thread_enc, a2dp_aptx_enc_thread, "ba-a2dp-aptx", true);
+		return ba_transport_thread_create(&t->thread_enc, a2dp_aptx_enc_thread, name, true);
 
 #if HAVE_APTX_DECODE
 	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SINK)
-		return ba_transport_thread_create(&t->thread_dec, a2dp_aptx_dec_thread, "ba-a2dp-aptx", true);
+		return ba_transport_thread_create(&t->thread_dec, a2dp_aptx_dec_thread, name, true);
 #endif
 
 	g_assert_not_reached();
@@ -189,6 +189,7 @@
 #define AAC_OBJECT_TYPE_MPEG4_AAC_LC    0x40
 #define AAC_OBJECT_TYPE_MPEG4_AAC_LTP   0x20
 #define AAC_OBJECT_TYPE_MPEG4_AAC_SCA   0x10
+#define AAC_OBJECT_TYPE_MPEG4_AAC_ELD2  0x02
 
 #define AAC_SAMPLING_FREQ_8000          0x0800
 #define AAC_SAMPLING_FREQ_11025         0x0400
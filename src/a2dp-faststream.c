@@ -24,12 +24,15 @@
 
 #include "a2dp.h"
 #include "a2dp-codecs.h"
+#include "bluealsa.h"
 #include "codec-sbc.h"
 #include "io.h"
+#include "trace.h"
 #include "utils.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
 #include "shared/log.h"
+#include "shared/rb.h"
 #include "shared/rt.h"
 
 void a2dp_faststream_transport_set_codec(struct ba_transport *t) {
@@ -39,6 +42,10 @@ void a2dp_faststream_transport_set_codec(struct ba_transport *t) {
 	t->a2dp.pcm.format = BA_TRANSPORT_PCM_FORMAT_S16_2LE;
 	t->a2dp.pcm_bc.format = BA_TRANSPORT_PCM_FORMAT_S16_2LE;
 
+	/* FastStream uses SBC with 16 blocks and 8 sub-bands */
+	t->a2dp.pcm.block_frames = 128;
+	t->a2dp.pcm_bc.block_frames = 128;
+
 	if (((a2dp_faststream_t *)t->a2dp.configuration)->direction & FASTSTREAM_DIRECTION_MUSIC) {
 		t->a2dp.pcm.channels = 2;
 		t->a2dp.pcm.sampling = a2dp_codec_lookup_frequency(codec,
@@ -51,6 +58,90 @@ void a2dp_faststream_transport_set_codec(struct ba_transport *t) {
 				((a2dp_faststream_t *)t->a2dp.configuration)->frequency_voice, true);
 	}
 
+	/* In the duplex mode the voice back-channel of the A2DP source is
+	 * serviced by the music encoder thread. */
+	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE)
+		t->a2dp.pcm_bc.th = a2dp_faststream_is_duplex(t) ? &t->thread_enc : &t->thread_dec;
+
+}
+
+/**
+ * Check whether both FastStream streams shall be serviced by the single
+ * IO thread. It is possible only for the A2DP source with both music and
+ * voice directions configured. */
+bool a2dp_faststream_is_duplex(const struct ba_transport *t) {
+	const uint8_t direction = ((a2dp_faststream_t *)t->a2dp.configuration)->direction;
+	return config.a2dp.duplex &&
+		t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE &&
+		direction & FASTSTREAM_DIRECTION_MUSIC &&
+		direction & FASTSTREAM_DIRECTION_VOICE;
+}
+
+/**
+ * Voice decoder of the duplex IO thread. */
+struct a2dp_faststream_voice {
+	sbc_t sbc;
+	size_t sbc_frame_len;
+	ffb_t bt;
+	ffb_t pcm;
+};
+
+static void a2dp_faststream_voice_free(struct a2dp_faststream_voice *voice) {
+	sbc_finish(&voice->sbc);
+	ffb_free(&voice->bt);
+	ffb_free(&voice->pcm);
+}
+
+/**
+ * Decode voice received from the remote device.
+ *
+ * This function shall be called when the BT socket is ready for reading,
+ * so it will not block the music transfer.
+ *
+ * @return This function returns the value returned by the io_bt_read(). */
+static ssize_t a2dp_faststream_voice_decode(
+		struct ba_transport_thread *th,
+		struct a2dp_faststream_voice *voice) {
+
+	struct ba_transport_pcm *t_a2dp_pcm = &th->t->a2dp.pcm_bc;
+
+	ssize_t len;
+	if ((len = io_bt_read(th, voice->bt.data, ffb_blen_in(&voice->bt))) <= 0) {
+		if (len == -1 && errno != EAGAIN)
+			error("BT read error: %s", strerror(errno));
+		return len;
+	}
+
+	const ssize_t ret = len;
+	if (!ba_transport_pcm_is_active(t_a2dp_pcm))
+		return ret;
+
+	uint8_t *input = voice->bt.data;
+	size_t input_len = len;
+
+	while (input_len >= voice->sbc_frame_len) {
+
+		size_t decoded;
+
+		trace_probe2(decode_begin, th, input_len);
+		if ((len = sbc_decode(&voice->sbc, input, input_len,
+						voice->pcm.data, ffb_blen_in(&voice->pcm), &decoded)) < 0) {
+			error("FastStream SBC decoding error: %s", strerror(-len));
+			break;
+		}
+
+		input += len;
+		input_len -= len;
+
+		const size_t samples = decoded / sizeof(int16_t);
+		trace_probe2(decode_end, th, samples);
+		io_pcm_scale(t_a2dp_pcm, voice->pcm.data, samples);
+		if (io_pcm_write(t_a2dp_pcm, voice->pcm.data, samples) == -1)
+			error("FIFO write error: %s", strerror(errno));
+
+	}
+
+	return ret;
 }
 
 static void *a2dp_faststream_enc_thread(struct ba_transport_thread *th) {
@@ -73,42 +164,76 @@ static void *a2dp_faststream_enc_thread(struct ba_transport_thread *th) {
 	}
 
 	ffb_t bt = { 0 };
-	ffb_t pcm = { 0 };
+	rb_t pcm = { 0 };
+	struct a2dp_faststream_voice voice = { 0 };
 	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
+	pthread_cleanup_push(PTHREAD_CLEANUP(rb_free), &pcm);
 	pthread_cleanup_push(PTHREAD_CLEANUP(sbc_finish), &sbc);
 
+	/* In the duplex mode the voice decoder shares the IO loop with the
+	 * music encoder, so both streams are clocked by the same timer. */
+	if (!is_voice && t->a2dp.pcm_bc.th == th) {
+
+		if ((errno = -sbc_init_a2dp_faststream(&voice.sbc, 0, t->a2dp.configuration,
+						t->a2dp.codec->capabilities_size, true)) != 0) {
+			error("Couldn't initialize FastStream SBC codec: %s", strerror(errno));
+			goto fail_voice;
+		}
+
+		voice.sbc_frame_len = sbc_get_frame_length(&voice.sbc);
+		const size_t voice_frame_samples = sbc_get_codesize(&voice.sbc) / sizeof(int16_t);
+		if (ffb_init_int16_t(&voice.pcm, voice_frame_samples) == -1 ||
+				ffb_init_uint8_t(&voice.bt, t->mtu_read) == -1) {
+			error("Couldn't create data buffers: %s", strerror(ENOMEM));
+			sbc_finish(&voice.sbc);
+			goto fail_voice;
+		}
+
+		io.bt.reader = (io_poll_bt_reader *)a2dp_faststream_voice_decode;
+		io.bt.userdata = &voice;
+
+	}
+
+	pthread_cleanup_push(PTHREAD_CLEANUP(a2dp_faststream_voice_free), &voice);
+
 	const unsigned int channels = t_a2dp_pcm->channels;
 	const size_t sbc_frame_len = sbc_get_frame_length(&sbc);
 	const size_t sbc_frame_samples = sbc_get_codesize(&sbc) / sizeof(int16_t);
 
-	if (ffb_init_int16_t(&pcm, sbc_frame_samples * 3) == -1 ||
+	if (rb_init_int16_t(&pcm, sbc_frame_samples * 3) == -1 ||
 			ffb_init_uint8_t(&bt, t->mtu_write) == -1) {
 		error("Couldn't create data buffers: %s", strerror(ENOMEM));
 		goto fail_ffb;
 	}
 
+	/* Codec delay consists of the SBC analysis filter bank delay (73 frames
+	 * for 8 sub-bands) and the time needed to collect PCM frames for up to
+	 * three SBC frames sent in a single packet. */
+	t_a2dp_pcm->codec_delay = (73 + sbc_frame_samples * 3 / channels) *
+		10000 / t_a2dp_pcm->sampling;
+
 	debug_transport_thread_loop(th, "START");
 	for (ba_transport_thread_set_state_running(th);;) {
 
 
-		ssize_t samples = ffb_len_in(&pcm);
-		if ((samples = io_poll_and_read_pcm(&io, t_a2dp_pcm, pcm.tail, samples)) <= 0) {
+		ssize_t samples = rb_len_in(&pcm);
+		if ((samples = io_poll_and_read_pcm(&io, t_a2dp_pcm, rb_tail(&pcm), samples)) <= 0) {
 			if (samples == -1)
 				error("PCM poll and read error: %s", strerror(errno));
 			ba_transport_stop_if_no_clients(t);
 			continue;
 		}
 
-		ffb_seek(&pcm, samples);
-		samples = ffb_len_out(&pcm);
+		rb_seek(&pcm, samples);
+		samples = rb_len_out(&pcm);
 
-		const int16_t *input = pcm.data;
+		const int16_t *input = rb_head(&pcm);
 		size_t input_len = samples;
 		size_t output_len = ffb_len_in(&bt);
 		size_t pcm_frames = 0;
 		size_t sbc_frames = 0;
 
+		trace_probe2(encode_begin, th, input_len);
 		while (input_len >= sbc_frame_samples &&
 				output_len >= sbc_frame_len &&
 				sbc_frames < 3) {
@@ -135,6 +260,7 @@ static void *a2dp_faststream_enc_thread(struct ba_transport_thread *th) {
 		if (sbc_frames > 0) {
 
 			ssize_t len = ffb_blen_out(&bt);
+			trace_probe2(encode_end, th, len);
 			if ((len = io_bt_write(th, bt.data, len)) <= 0) {
 				if (len == -1)
 					error("BT write error: %s", strerror(errno));
@@ -145,16 +271,15 @@ static void *a2dp_faststream_enc_thread(struct ba_transport_thread *th) {
 			ffb_rewind(&bt);
 
 			/* keep data transfer at a constant bit rate */
-			asrsync_sync(&io.asrs, pcm_frames);
+			io_poll_pace(&io, th, pcm_frames);
 
 			/* update busy delay (encoding overhead) */
 			t_a2dp_pcm->delay = asrsync_get_busy_usec(&io.asrs) / 100;
 
-			/* If the input buffer was not consumed (due to codesize limit), we
-			 * have to append new data to the existing one. Since we do not use
-			 * ring buffer, we will simply move unprocessed data to the front
-			 * of our linear buffer. */
-			ffb_shift(&pcm, samples - input_len);
+			/* If the input buffer was not consumed (due to codesize limit), the
+			 * unprocessed data will stay in the ring buffer and new data will
+			 * be appended to it. */
+			rb_shift(&pcm, samples - input_len);
 
 		}
 
@@ -166,6 +291,8 @@ fail:
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 fail_ffb:
 	pthread_cleanup_pop(1);
+fail_voice:
+	pthread_cleanup_pop(1);
 	pthread_cleanup_pop(1);
 	pthread_cleanup_pop(1);
 fail_init:
@@ -229,6 +356,7 @@ static void *a2dp_faststream_dec_thread(struct ba_transport_thread *th) {
 			ssize_t len;
 			size_t decoded;
 
+			trace_probe2(decode_begin, th, input_len);
 			if ((len = sbc_decode(&sbc, input, input_len,
 							pcm.data, ffb_blen_in(&pcm), &decoded)) < 0) {
 				error("FastStream SBC decoding error: %s", strerror(-len));
@@ -239,6 +367,7 @@ static void *a2dp_faststream_dec_thread(struct ba_transport_thread *th) {
 			input_len -= len;
 
 			const size_t samples = decoded / sizeof(int16_t);
+			trace_probe2(decode_end, th, samples);
 			io_pcm_scale(t_a2dp_pcm, pcm.data, samples);
 			if (io_pcm_write(t_a2dp_pcm, pcm.data, samples) == -1)
 				error("FIFO write error: %s", strerror(errno));
@@ -267,6 +396,8 @@ int a2dp_faststream_transport_start(struct ba_transport *t) {
 	int rv = 0;
 
 	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE) {
+		if (a2dp_faststream_is_duplex(t))
+			return ba_transport_thread_create(th_enc, a2dp_faststream_enc_thread, "ba-a2dp-fs-io", true);
 		if (((a2dp_faststream_t *)t->a2dp.configuration)->direction & FASTSTREAM_DIRECTION_MUSIC)
 			rv |= ba_transport_thread_create(th_enc, a2dp_faststream_enc_thread, "ba-a2dp-fs-m", true);
 		if (((a2dp_faststream_t *)t->a2dp.configuration)->direction & FASTSTREAM_DIRECTION_VOICE)
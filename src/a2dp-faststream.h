@@ -16,9 +16,12 @@
 # include <config.h>
 #endif
 
+#include <stdbool.h>
+
 #include "ba-transport.h"
 
 void a2dp_faststream_transport_set_codec(struct ba_transport *t);
+bool a2dp_faststream_is_duplex(const struct ba_transport *t);
 int a2dp_faststream_transport_start(struct ba_transport *t);
 
 #endif
@@ -12,11 +12,11 @@
 
 #include <errno.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
-#include <sys/ioctl.h>
 #include <unistd.h>
 
 #include <glib.h>
@@ -26,13 +26,17 @@
 
 #include "a2dp.h"
 #include "a2dp-codecs.h"
+#include "audio.h"
+#include "ba-device.h"
 #include "bluealsa.h"
 #include "io.h"
 #include "rtp.h"
+#include "trace.h"
 #include "utils.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
 #include "shared/log.h"
+#include "shared/rb.h"
 #include "shared/rt.h"
 
 void a2dp_ldac_transport_set_codec(struct ba_transport *t) {
@@ -48,6 +52,25 @@ void a2dp_ldac_transport_set_codec(struct ba_transport *t) {
 	t->a2dp.pcm.sampling = a2dp_codec_lookup_frequency(codec,
 			((a2dp_ldac_t *)t->a2dp.configuration)->frequency, false);
 
+	t->a2dp.pcm.block_frames = LDACBT_ENC_LSU;
+
+}
+
+/**
+ * Get the number of PCM frames covered by a single LDAC frame.
+ *
+ * It is 128 frames for 44.1 and 48 kHz, 256 frames for 88.2 and 96 kHz,
+ * and 512 frames (LDACBT_MAX_LSU) for 176.4 and 192 kHz. */
+static unsigned int a2dp_ldac_get_frame_length(unsigned int samplerate) {
+	if (samplerate > 96000)
+		return LDACBT_ENC_LSU * 4;
+	if (samplerate > 48000)
+		return LDACBT_ENC_LSU * 2;
+	return LDACBT_ENC_LSU;
+}
+
+static void a2dp_ldac_free_handle(HANDLE_LDAC_BT *handle) {
+	ldacBT_free_handle(*handle);
 }
 
 static void *a2dp_ldac_enc_thread(struct ba_transport_thread *th) {
@@ -59,12 +82,26 @@ static void *a2dp_ldac_enc_thread(struct ba_transport_thread *th) {
 	struct io_poll io = { .timeout = -1 };
 
 	HANDLE_LDAC_BT handle;
-	if ((handle = ldacBT_get_handle()) == NULL) {
+	struct ba_device_codec codec = {
+		.d = t->d,
+		.name = "ldac-enc",
+		.config = t->a2dp.configuration,
+		.config_size = t->a2dp.codec->capabilities_size,
+		.state = &handle,
+		.state_size = sizeof(handle),
+		.destroy = PTHREAD_CLEANUP(a2dp_ldac_free_handle),
+	};
+
+	/* The LDAC library does not provide a way to reset the encoder state,
+	 * so the cached handle has to be closed before (re)initialization. */
+	if (ba_device_codec_acquire(&codec) == 0)
+		ldacBT_close_handle(handle);
+	else if ((handle = ldacBT_get_handle()) == NULL) {
 		error("Couldn't get LDAC handle: %s", strerror(errno));
 		goto fail_open_ldac;
 	}
 
-	pthread_cleanup_push(PTHREAD_CLEANUP(ldacBT_free_handle), handle);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_device_codec_release), &codec);
 
 	HANDLE_LDAC_ABR handle_abr;
 	if ((handle_abr = ldac_ABR_get_handle()) == NULL) {
@@ -75,17 +112,20 @@ static void *a2dp_ldac_enc_thread(struct ba_transport_thread *th) {
 	pthread_cleanup_push(PTHREAD_CLEANUP(ldac_ABR_free_handle), handle_abr);
 
 	const a2dp_ldac_t *configuration = (a2dp_ldac_t *)t->a2dp.configuration;
-	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(t->a2dp.pcm.format);
+	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(t->a2dp.pcm.codec_format);
 	const unsigned int channels = t->a2dp.pcm.channels;
 	const unsigned int samplerate = t->a2dp.pcm.sampling;
 	const size_t ldac_pcm_samples = LDACBT_ENC_LSU * channels;
 
-	if (ldacBT_init_handle_encode(handle, t->mtu_write, config.ldac_eqmid,
+	int eqmid = atomic_load_explicit(&t->a2dp.ldac_eqmid, memory_order_relaxed);
+	if (ldacBT_init_handle_encode(handle, t->mtu_write, eqmid,
 				configuration->channel_mode, LDACBT_SMPL_FMT_S32, samplerate) == -1) {
 		error("Couldn't initialize LDAC encoder: %s", ldacBT_strerror(ldacBT_get_error_code(handle)));
 		goto fail_init;
 	}
 
+	codec.ready = true;
+
 	if (ldac_ABR_Init(handle_abr, 1000 * ldac_pcm_samples / channels / samplerate) == -1) {
 		error("Couldn't initialize LDAC ABR");
 		goto fail_init;
@@ -96,42 +136,62 @@ static void *a2dp_ldac_enc_thread(struct ba_transport_thread *th) {
 	}
 
 	ffb_t bt = { 0 };
-	ffb_t pcm = { 0 };
+	rb_t pcm = { 0 };
 	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
+	pthread_cleanup_push(PTHREAD_CLEANUP(rb_free), &pcm);
 
-	if (ffb_init_int32_t(&pcm, ldac_pcm_samples) == -1 ||
+	if (rb_init_int32_t(&pcm, ldac_pcm_samples) == -1 ||
 			ffb_init_uint8_t(&bt, t->mtu_write) == -1) {
 		error("Couldn't create data buffers: %s", strerror(errno));
 		goto fail_ffb;
 	}
 
+	/* Codec delay consists of the MDCT overlap (one LDAC frame) and the
+	 * time needed to collect PCM frames for the LDAC frame. Note, that the
+	 * LDAC frame length depends on the sampling frequency, even though the
+	 * encoder is fed with LDACBT_ENC_LSU frames at a time. */
+	t->a2dp.pcm.codec_delay = 2 * a2dp_ldac_get_frame_length(samplerate) * 10000 / samplerate;
+
 	rtp_header_t *rtp_header;
 	rtp_media_header_t *rtp_media_header;
 
 	/* initialize RTP headers and get anchor for payload */
 	uint8_t *rtp_payload = rtp_a2dp_init(bt.data, &rtp_header,
 			(void **)&rtp_media_header, sizeof(*rtp_media_header));
-	uint16_t seq_number = be16toh(rtp_header->seq_number);
-	uint32_t timestamp = be32toh(rtp_header->timestamp);
-	size_t ts_frames = 0;
+
+	struct rtp_state rtp = { 0 };
+	rtp_state_init(&rtp, samplerate, samplerate);
+
+	/* prime the encoder with silence up to one LDAC frame */
+	if (config.a2dp.fast_start)
+		io.fast_start.samples = ldac_pcm_samples;
+
+	struct io_bt_pipeline pipeline = { 0 };
+	pthread_cleanup_push(PTHREAD_CLEANUP(io_bt_pipeline_free), &pipeline);
+
+	if (config.a2dp.pipeline) {
+		if (io_bt_pipeline_init(&pipeline, th, t->mtu_write) == -1)
+			warn("Couldn't create BT writer thread: %s", strerror(errno));
+		else
+			io.pipeline = &pipeline;
+	}
 
 	debug_transport_thread_loop(th, "START");
 	for (ba_transport_thread_set_state_running(th);;) {
 
 		ssize_t samples;
 		if ((samples = io_poll_and_read_pcm(&io, &t->a2dp.pcm,
-						pcm.tail, ffb_len_in(&pcm))) <= 0) {
+						rb_tail(&pcm), rb_len_in(&pcm))) <= 0) {
 			if (samples == -1)
 				error("PCM poll and read error: %s", strerror(errno));
 			ba_transport_stop_if_no_clients(t);
 			continue;
 		}
 
-		ffb_seek(&pcm, samples);
-		samples = ffb_len_out(&pcm);
+		rb_seek(&pcm, samples);
+		samples = rb_len_out(&pcm);
 
-		int16_t *input = pcm.data;
+		int16_t *input = rb_head(&pcm);
 		size_t input_len = samples;
 
 		/* encode and transfer obtained data */
@@ -144,11 +204,13 @@ static void *a2dp_ldac_enc_thread(struct ba_transport_thread *th) {
 			int encoded;
 			int frames;
 
+			trace_probe2(encode_begin, th, input_len);
 			if (ldacBT_encode(handle, input, &used, bt.tail, &encoded, &frames) != 0) {
 				error("LDAC encoding error: %s", ldacBT_strerror(ldacBT_get_error_code(handle)));
 				break;
 			}
 
+			trace_probe2(encode_end, th, encoded);
 			rtp_media_header->frame_count = frames;
 
 			frames = used / sample_size;
@@ -158,53 +220,61 @@ static void *a2dp_ldac_enc_thread(struct ba_transport_thread *th) {
 
 			if (encoded > 0) {
 
-				/* Try to get the number of bytes queued in the
-				 * socket output buffer. */
-				int queued_bytes = 0;
-				if (ioctl(t->bt_fd, TIOCOUTQ, &queued_bytes) != -1)
-					queued_bytes = abs(t->a2dp.bt_fd_coutq_init - queued_bytes);
-
-				errno = 0;
+				rtp_state_new_packet(&rtp, rtp_header);
 
 				ssize_t len = ffb_blen_out(&bt);
-				if ((len = io_bt_write(th, bt.data, len)) <= 0) {
+				if ((len = io_poll_bt_write(&io, th, bt.data, len)) <= 0) {
 					if (len == -1)
 						error("BT write error: %s", strerror(errno));
 					goto fail;
 				}
 
-				if (errno == EAGAIN)
+				/* Get the number of bytes queued in the socket output
+				 * buffer, sampled just before the write. */
+				int queued_bytes = th->bt_coutq.queued;
+				if (th->bt_coutq.blocked)
 					/* The io_bt_write() call was blocking due to not enough
 					 * space in the BT socket. Set the queued_bytes to some
 					 * arbitrary big value. */
 					queued_bytes = 1024 * 16;
 
-				if (config.ldac_abr)
+				if (atomic_load_explicit(&config.battery.low, memory_order_relaxed)) {
+					/* battery saver overrides the adaptive bit rate */
+					if (eqmid != LDACBT_EQMID_MQ) {
+						eqmid = LDACBT_EQMID_MQ;
+						debug("Changing LDAC encoder quality: %d", eqmid);
+						if (ldacBT_set_eqmid(handle, eqmid) == -1)
+							warn("Couldn't set LDAC encoder quality: %s",
+									ldacBT_strerror(ldacBT_get_error_code(handle)));
+					}
+				}
+				else if (config.ldac_abr)
 					ldac_ABR_Proc(handle, handle_abr, queued_bytes / t->mtu_write, 1);
+				else if (eqmid != atomic_load_explicit(&t->a2dp.ldac_eqmid, memory_order_relaxed)) {
+					/* apply quality requested by the link quality policy */
+					eqmid = atomic_load_explicit(&t->a2dp.ldac_eqmid, memory_order_relaxed);
+					debug("Changing LDAC encoder quality: %d", eqmid);
+					if (ldacBT_set_eqmid(handle, eqmid) == -1)
+						warn("Couldn't set LDAC encoder quality: %s",
+								ldacBT_strerror(ldacBT_get_error_code(handle)));
+				}
 
 			}
 
-			/* keep data transfer at a constant bit rate */
-			asrsync_sync(&io.asrs, frames / channels);
-			ts_frames += frames;
+			/* keep data transfer at a constant bit rate, also
+			 * get a timestamp for the next RTP frame */
+			io_poll_pace(&io, th, frames / channels);
+			rtp_state_update(&rtp, frames / channels);
 
 			/* update busy delay (encoding overhead) */
 			t->a2dp.pcm.delay = asrsync_get_busy_usec(&io.asrs) / 100;
 
-			if (encoded > 0) {
-				timestamp += ts_frames / channels * 10000 / samplerate;
-				rtp_header->seq_number = htobe16(++seq_number);
-				rtp_header->timestamp = htobe32(timestamp);
-				ts_frames = 0;
-			}
-
 		}
 
-		/* If the input buffer was not consumed (due to codesize limit), we
-		 * have to append new data to the existing one. Since we do not use
-		 * ring buffer, we will simply move unprocessed data to the front
-		 * of our linear buffer. */
-		ffb_shift(&pcm, samples - input_len);
+		/* If the input buffer was not consumed (due to codesize limit), the
+		 * unprocessed data will stay in the ring buffer and new data will
+		 * be appended to it. */
+		rb_shift(&pcm, samples - input_len);
 
 	}
 
@@ -212,6 +282,7 @@ fail:
 	debug_transport_thread_loop(th, "EXIT");
 	ba_transport_thread_set_state_stopping(th);
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_pop(1);
 fail_ffb:
 	pthread_cleanup_pop(1);
 	pthread_cleanup_pop(1);
@@ -256,7 +327,7 @@ static void *a2dp_ldac_dec_thread(struct ba_transport_thread *th) {
 	pthread_cleanup_push(PTHREAD_CLEANUP(ldacBT_free_handle), handle);
 
 	const a2dp_ldac_t *configuration = (a2dp_ldac_t *)t->a2dp.configuration;
-	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(t->a2dp.pcm.format);
+	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(t->a2dp.pcm.codec_format);
 	const unsigned int channels = t->a2dp.pcm.channels;
 	const unsigned int samplerate = t->a2dp.pcm.sampling;
 
@@ -267,15 +338,31 @@ static void *a2dp_ldac_dec_thread(struct ba_transport_thread *th) {
 
 	ffb_t bt = { 0 };
 	ffb_t pcm = { 0 };
+	struct audio_plc plc = { 0 };
 	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
 	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
+	pthread_cleanup_push(PTHREAD_CLEANUP(audio_plc_free), &plc);
 
 	if (ffb_init_int32_t(&pcm, LDACBT_MAX_LSU * channels) == -1 ||
-			ffb_init_uint8_t(&bt, t->mtu_read) == -1) {
+			ffb_init_uint8_t(&bt, t->mtu_read) == -1 ||
+			audio_plc_init(&plc, sample_size, channels, LDACBT_MAX_LSU * channels) == -1) {
 		error("Couldn't create data buffers: %s", strerror(errno));
 		goto fail_ffb;
 	}
 
+	/* Decoder delay is the MDCT overlap of a single LDAC frame. */
+	t->a2dp.pcm.codec_delay = a2dp_ldac_get_frame_length(samplerate) * 10000 / samplerate;
+
+	struct io_bt_receiver receiver = { 0 };
+	pthread_cleanup_push(PTHREAD_CLEANUP(io_bt_receiver_free), &receiver);
+
+	if (config.a2dp.receiver) {
+		if (io_bt_receiver_init(&receiver, th, t->mtu_read) == -1)
+			warn("Couldn't create BT reader thread: %s", strerror(errno));
+		else
+			io.receiver = &receiver;
+	}
+
 	debug_transport_thread_loop(th, "START");
 	for (ba_transport_thread_set_state_running(th);;) {
 
@@ -290,18 +377,27 @@ static void *a2dp_ldac_dec_thread(struct ba_transport_thread *th) {
 			continue;
 
 		const rtp_media_header_t *rtp_media_header;
-		if ((rtp_media_header = rtp_a2dp_payload(bt.data, &rtp_seq_number)) == NULL)
+		unsigned int missing;
+		if ((rtp_media_header = rtp_a2dp_payload(bt.data, &rtp_seq_number, &missing)) == NULL)
 			continue;
+		ba_transport_thread_stats_add(th, rtp_lost, missing);
 
 		const uint8_t *rtp_payload = (uint8_t *)(rtp_media_header + 1);
 		size_t rtp_payload_len = len - (rtp_payload - (uint8_t *)bt.data);
-
 		size_t frames = rtp_media_header->frame_count;
+
+		/* LDAC decoder does not provide any concealment on its own, so the
+		 * gap is filled with the faded out copy of the last LDAC frame. */
+		if (missing > 0 &&
+				io_pcm_conceal(&t->a2dp.pcm, &plc, pcm.data, missing * frames) == -1)
+			error("FIFO write error: %s", strerror(errno));
+
 		while (frames--) {
 
 			int used;
 			int decoded;
 
+			trace_probe2(decode_begin, th, rtp_payload_len);
 			if (ldacBT_decode(handle, (void *)rtp_payload, pcm.data,
 						LDACBT_SMPL_FMT_S32, rtp_payload_len, &used, &decoded) != 0) {
 				error("LDAC decoding error: %s", ldacBT_strerror(ldacBT_get_error_code(handle)));
@@ -312,7 +408,9 @@ static void *a2dp_ldac_dec_thread(struct ba_transport_thread *th) {
 			rtp_payload_len -= used;
 
 			const size_t samples = decoded / sample_size;
+			trace_probe2(decode_end, th, samples);
 			io_pcm_scale(&t->a2dp.pcm, pcm.data, samples);
+			audio_plc_update(&plc, pcm.data, samples);
 			if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1)
 				error("FIFO write error: %s", strerror(errno));
 
@@ -324,9 +422,11 @@ fail:
 	debug_transport_thread_loop(th, "EXIT");
 	ba_transport_thread_set_state_stopping(th);
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_pop(1);
 fail_ffb:
 	pthread_cleanup_pop(1);
 	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
 fail_init:
 	pthread_cleanup_pop(1);
 fail_open:
@@ -33,12 +33,18 @@
 #include "bluealsa.h"
 #include "io.h"
 #include "rtp.h"
+#include "trace.h"
 #include "utils.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
 #include "shared/log.h"
 #include "shared/rt.h"
 
+/**
+ * LAME algorithm quality used in the battery saver mode. The lower the
+ * value, the better (and slower) the encoding is. */
+#define LAME_QUALITY_LOW_POWER 7
+
 void a2dp_mpeg_transport_set_codec(struct ba_transport *t) {
 
 	const struct a2dp_codec *codec = t->a2dp.codec;
@@ -49,6 +55,16 @@ void a2dp_mpeg_transport_set_codec(struct ba_transport *t) {
 	t->a2dp.pcm.sampling = a2dp_codec_lookup_frequency(codec,
 			((a2dp_mpeg_t *)t->a2dp.configuration)->frequency, false);
 
+	/* Layer I frame consists of 384 samples, layer II and III of 1152, but
+	 * layer III frame is halved for the MPEG-2 low sampling frequencies. */
+	const a2dp_mpeg_t *configuration = (a2dp_mpeg_t *)t->a2dp.configuration;
+	if (configuration->layer == MPEG_LAYER_MP1)
+		t->a2dp.pcm.block_frames = 384;
+	else if (configuration->layer == MPEG_LAYER_MP3 && t->a2dp.pcm.sampling < 32000)
+		t->a2dp.pcm.block_frames = 576;
+	else
+		t->a2dp.pcm.block_frames = 1152;
+
 }
 
 #if ENABLE_MP3LAME
@@ -130,8 +146,12 @@ static void *a2dp_mp3_enc_thread(struct ba_transport_thread *th) {
 			goto fail_setup;
 		}
 	}
-	if (lame_set_quality(handle, config.lame_quality) != 0) {
-		error("LAME: Couldn't set quality: %d", config.lame_quality);
+	/* LAME quality can not be changed after the encoder setup, so in the
+	 * battery saver mode it is lowered for the whole stream. */
+	const int lame_quality = atomic_load_explicit(&config.battery.low, memory_order_relaxed) ?
+		MAX(config.lame_quality, LAME_QUALITY_LOW_POWER) : config.lame_quality;
+	if (lame_set_quality(handle, lame_quality) != 0) {
+		error("LAME: Couldn't set quality: %d", lame_quality);
 		goto fail_setup;
 	}
 
@@ -157,14 +177,25 @@ static void *a2dp_mp3_enc_thread(struct ba_transport_thread *th) {
 		goto fail_ffb;
 	}
 
+	/* Codec delay consists of the encoder delay reported by LAME and the
+	 * time needed to collect PCM frames for the whole MPEG frame. */
+	t->a2dp.pcm.codec_delay = (lame_get_encoder_delay(handle) + lame_get_framesize(handle)) *
+		10000 / samplerate;
+	debug("MPEG encoder delay: %u.%u ms", t->a2dp.pcm.codec_delay / 10,
+			t->a2dp.pcm.codec_delay % 10);
+
 	rtp_header_t *rtp_header;
 	rtp_mpeg_audio_header_t *rtp_mpeg_audio_header;
 
 	/* initialize RTP headers and get anchor for payload */
 	uint8_t *rtp_payload = rtp_a2dp_init(bt.data, &rtp_header,
 			(void **)&rtp_mpeg_audio_header, sizeof(*rtp_mpeg_audio_header));
-	uint16_t seq_number = be16toh(rtp_header->seq_number);
-	uint32_t timestamp = be32toh(rtp_header->timestamp);
+
+	struct rtp_state rtp = { 0 };
+	rtp_state_init(&rtp, samplerate, RTP_MPEG_AUDIO_CLOCK_RATE);
+
+	struct io_bt_batch bt_batch = { 0 };
+	uint8_t rtp_headers[IO_BT_BATCH_SIZE][RTP_HEADER_LEN + sizeof(rtp_mpeg_audio_header_t)];
 
 	debug_transport_thread_loop(th, "START");
 	for (ba_transport_thread_set_state_running(th);;) {
@@ -187,6 +218,7 @@ static void *a2dp_mp3_enc_thread(struct ba_transport_thread *th) {
 		size_t pcm_frames = samples / channels;
 		ssize_t len;
 
+		trace_probe2(encode_begin, th, samples);
 		if ((len = channels == 1 ?
 					lame_encode_buffer(handle, pcm.data, NULL, pcm_frames, bt.tail, ffb_len_in(&bt)) :
 					lame_encode_buffer_interleaved(handle, pcm.data, pcm_frames, bt.tail, ffb_len_in(&bt))) < 0) {
@@ -194,50 +226,51 @@ static void *a2dp_mp3_enc_thread(struct ba_transport_thread *th) {
 			continue;
 		}
 
+		trace_probe2(encode_end, th, len);
+
 		if (len > 0) {
 
-			size_t payload_len_max = t->mtu_write - RTP_HEADER_LEN - sizeof(*rtp_mpeg_audio_header);
-			size_t payload_len_total = len;
+			const size_t payload_len_max = t->mtu_write - rtp_headers_len;
+			const size_t payload_len_total = len;
+			const uint8_t *payload = rtp_payload;
 			size_t payload_len = len;
-			rtp_header->timestamp = htobe32(timestamp);
 
-			for (;;) {
+			if (payload_len > payload_len_max)
+				debug("Payload fragmentation: extra %zd bytes", payload_len - payload_len_max);
 
-				size_t chunk_len;
-				chunk_len = payload_len > payload_len_max ? payload_len_max : payload_len;
-				rtp_header->markbit = payload_len <= payload_len_max;
-				rtp_header->seq_number = htobe16(++seq_number);
-				rtp_mpeg_audio_header->offset = payload_len_total - payload_len;
+			/* Every fragment gets its own copy of the RTP headers, so the
+			 * payload does not have to be moved and all fragments can be
+			 * sent to the BT socket with a single system call. */
+			while (payload_len > 0) {
 
-				ffb_rewind(&bt);
-				ffb_seek(&bt, RTP_HEADER_LEN + sizeof(*rtp_mpeg_audio_header) + chunk_len);
+				const size_t chunk_len = MIN(payload_len, payload_len_max);
+				rtp_header_t *header = rtp_state_new_packet_from(&rtp,
+						rtp_headers[bt_batch.len], rtp_header, sizeof(*rtp_mpeg_audio_header));
+				rtp_mpeg_audio_header_t *mpeg_header = (void *)&header->csrc[header->cc];
+				header->markbit = payload_len <= payload_len_max;
+				mpeg_header->offset = htobe16(payload_len_total - payload_len);
+				io_bt_batch_add(&bt_batch, header, rtp_headers_len, payload, chunk_len);
 
-				ssize_t len = ffb_blen_out(&bt);
-				if ((len = io_bt_write(th, bt.data, len)) <= 0) {
+				payload += chunk_len;
+				payload_len -= chunk_len;
+
+				if (payload_len > 0 && !io_bt_batch_is_full(&bt_batch))
+					continue;
+
+				if ((len = io_bt_write_batch(th, &bt_batch)) <= 0) {
 					if (len == -1)
 						error("BT write error: %s", strerror(errno));
 					goto fail;
 				}
 
-				/* account written payload only */
-				len -= RTP_HEADER_LEN + sizeof(*rtp_mpeg_audio_header);
-
-				/* break if the last part of the payload has been written */
-				if ((payload_len -= len) == 0)
-					break;
-
-				/* move rest of data to the beginning of the payload */
-				debug("Payload fragmentation: extra %zd bytes", payload_len);
-				memmove(rtp_payload, rtp_payload + len, payload_len);
-
 			}
 
 		}
 
 		/* keep data transfer at a constant bit rate, also
 		 * get a timestamp for the next RTP frame */
-		asrsync_sync(&io.asrs, pcm_frames);
-		timestamp += pcm_frames * 10000 / samplerate;
+		io_poll_pace(&io, th, pcm_frames);
+		rtp_state_update(&rtp, pcm_frames);
 
 		/* update busy delay (encoding overhead) */
 		t->a2dp.pcm.delay = asrsync_get_busy_usec(&io.asrs) / 100;
@@ -265,6 +298,265 @@ fail_init:
 }
 #endif
 
+#if ENABLE_MP3LAME
+
+/**
+ * The maximal length of the MPEG audio frame (layer II, 384 kbit/s, 32 kHz
+ * with padding) rounded up to the power of two. */
+#define A2DP_MPEG_FRAME_LEN_MAX 2048
+
+/**
+ * MPEG audio frame information. */
+struct a2dp_mpeg_frame {
+	/* layer as defined in the A2DP configuration */
+	unsigned int layer;
+	unsigned int sampling;
+	unsigned int channels;
+	/* the number of PCM frames carried by the frame */
+	unsigned int frames;
+	/* the length of the frame in bytes */
+	size_t len;
+};
+
+/**
+ * Parse MPEG audio frame header.
+ *
+ * Frames with the free format bit rate are not supported, because their
+ * length can not be determined from the header alone.
+ *
+ * @param data Address of at least 4 bytes of the MPEG audio stream.
+ * @param frame Address where the frame information shall be stored.
+ * @return On success this function returns 0. If the data does not start
+ *   with the valid frame header, -1 is returned. */
+static int a2dp_mpeg_frame_parse(const uint8_t *data,
+		struct a2dp_mpeg_frame *frame) {
+
+	static const uint16_t bitrates[][15] = {
+		/* MPEG-1 layer I, II and III */
+		{ 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },
+		{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },
+		{ 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+		/* MPEG-2 (and MPEG-2.5) layer I, II and III */
+		{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },
+		{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+	};
+	static const unsigned int samplings[] = { 44100, 48000, 32000 };
+
+	/* check frame sync word */
+	if (data[0] != 0xFF || (data[1] & 0xE0) != 0xE0)
+		return -1;
+
+	/* 0 - MPEG-2.5, 1 - reserved, 2 - MPEG-2, 3 - MPEG-1 */
+	const unsigned int version = (data[1] >> 3) & 0x03;
+	/* 1 - layer I, 2 - layer II, 3 - layer III, 4 - reserved */
+	const unsigned int layer = 4 - ((data[1] >> 1) & 0x03);
+	const unsigned int bitrate_index = data[2] >> 4;
+	const unsigned int sampling_index = (data[2] >> 2) & 0x03;
+	const unsigned int padding = (data[2] >> 1) & 0x01;
+
+	if (version == 1 || layer == 4 || sampling_index == 3 ||
+			bitrate_index == 0 || bitrate_index == 15)
+		return -1;
+
+	/* low sampling frequency extension */
+	const bool lsf = version != 3;
+
+	const unsigned int bitrate = 1000 *
+		bitrates[lsf ? (layer == 1 ? 3 : 4) : layer - 1][bitrate_index];
+	unsigned int sampling = samplings[sampling_index];
+	if (version == 2)
+		sampling /= 2;
+	else if (version == 0)
+		sampling /= 4;
+
+	frame->layer = 1 << (3 - layer);
+	frame->sampling = sampling;
+	frame->channels = data[3] >> 6 == 0x03 ? 1 : 2;
+
+	switch (layer) {
+	case 1:
+		frame->frames = 384;
+		frame->len = (12 * bitrate / sampling + padding) * 4;
+		break;
+	case 2:
+		frame->frames = 1152;
+		frame->len = 144 * bitrate / sampling + padding;
+		break;
+	case 3:
+		frame->frames = lsf ? 576 : 1152;
+		frame->len = (lsf ? 72 : 144) * bitrate / sampling + padding;
+		break;
+	}
+
+	return 0;
+}
+
+static enum ba_transport_thread_signal a2dp_mpeg_passthrough_io_poll_signal_filter(
+		enum ba_transport_thread_signal signal, void *userdata) {
+	ffb_t *mpeg = userdata;
+	/* discard incomplete frame of the previous stream */
+	if (signal == BA_TRANSPORT_THREAD_SIGNAL_PCM_OPEN ||
+			signal == BA_TRANSPORT_THREAD_SIGNAL_PCM_CLOSE ||
+			signal == BA_TRANSPORT_THREAD_SIGNAL_PCM_DROP)
+		ffb_rewind(mpeg);
+	return signal;
+}
+
+/**
+ * Packetize MPEG audio stream provided by the client.
+ *
+ * The client shall write MPEG audio frames which match the negotiated A2DP
+ * configuration. Everything else (e.g. ID3 tags or frames with different
+ * sampling frequency) is skipped while looking for the next valid frame. */
+static void *a2dp_mpeg_passthrough_thread(struct ba_transport_thread *th) {
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_thread_cleanup), th);
+
+	struct ba_transport *t = th->t;
+	struct ba_transport_pcm *t_pcm = &t->a2dp.pcm;
+	ffb_t bt = { 0 };
+	ffb_t mpeg = { 0 };
+	struct io_poll io = {
+		.signal.filter = a2dp_mpeg_passthrough_io_poll_signal_filter,
+		.signal.userdata = &mpeg,
+		.timeout = -1,
+	};
+
+	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &mpeg);
+
+	const a2dp_mpeg_t *configuration = (a2dp_mpeg_t *)t->a2dp.configuration;
+	const unsigned int channels = t_pcm->channels;
+	const unsigned int samplerate = t_pcm->sampling;
+	const size_t rtp_headers_len = RTP_HEADER_LEN + sizeof(rtp_mpeg_audio_header_t);
+
+	/* Frames are sent directly from the stream buffer, so the BT
+	 * buffer has to hold the RTP headers template only. */
+	if (ffb_init_uint8_t(&mpeg, 2 * A2DP_MPEG_FRAME_LEN_MAX) == -1 ||
+			ffb_init_uint8_t(&bt, rtp_headers_len) == -1) {
+		error("Couldn't create data buffers: %s", strerror(errno));
+		goto fail_ffb;
+	}
+
+	/* The frame is sent when it is completely received from the client,
+	 * so there is no other delay than the time needed to collect it. */
+	t_pcm->codec_delay = t_pcm->block_frames * 10000 / samplerate;
+
+	rtp_header_t *rtp_header;
+	rtp_mpeg_audio_header_t *rtp_mpeg_audio_header;
+
+	/* initialize RTP headers and get anchor for payload */
+	rtp_a2dp_init(bt.data, &rtp_header,
+			(void **)&rtp_mpeg_audio_header, sizeof(*rtp_mpeg_audio_header));
+
+	struct rtp_state rtp = { 0 };
+	rtp_state_init(&rtp, samplerate, RTP_MPEG_AUDIO_CLOCK_RATE);
+
+	struct io_bt_batch bt_batch = { 0 };
+	uint8_t rtp_headers[IO_BT_BATCH_SIZE][RTP_HEADER_LEN + sizeof(rtp_mpeg_audio_header_t)];
+
+	debug_transport_thread_loop(th, "START");
+	for (ba_transport_thread_set_state_running(th);;) {
+
+		ssize_t len;
+		if ((len = io_poll_and_read_pcm(&io, t_pcm, mpeg.tail, ffb_len_in(&mpeg))) <= 0) {
+			if (len == -1)
+				error("PCM poll and read error: %s", strerror(errno));
+			ba_transport_stop_if_no_clients(t);
+			continue;
+		}
+
+		ffb_seek(&mpeg, len);
+
+		const uint8_t *data = mpeg.data;
+		size_t data_len = ffb_len_out(&mpeg);
+		size_t skipped = 0;
+
+		while (data_len >= 4) {
+
+			struct a2dp_mpeg_frame frame;
+			if (a2dp_mpeg_frame_parse(data, &frame) == -1 ||
+					frame.layer != configuration->layer ||
+					frame.sampling != samplerate ||
+					frame.channels != channels) {
+				/* resynchronize with the next frame header */
+				data++;
+				data_len--;
+				skipped++;
+				continue;
+			}
+
+			/* wait for the rest of the frame */
+			if (frame.len > data_len)
+				break;
+
+			const size_t payload_len_max = t->mtu_write - rtp_headers_len;
+			size_t payload_len = frame.len;
+
+			/* The payload is taken directly from the stream buffer, see the
+			 * comment in the encoder thread for details. */
+			while (payload_len > 0) {
+
+				const size_t chunk_len = MIN(payload_len, payload_len_max);
+				rtp_header_t *header = rtp_state_new_packet_from(&rtp,
+						rtp_headers[bt_batch.len], rtp_header, sizeof(*rtp_mpeg_audio_header));
+				rtp_mpeg_audio_header_t *mpeg_header = (void *)&header->csrc[header->cc];
+				header->markbit = payload_len <= payload_len_max;
+				mpeg_header->offset = htobe16(frame.len - payload_len);
+				io_bt_batch_add(&bt_batch, header, rtp_headers_len,
+						data + frame.len - payload_len, chunk_len);
+
+				payload_len -= chunk_len;
+
+				if (payload_len > 0 && !io_bt_batch_is_full(&bt_batch))
+					continue;
+
+				if ((len = io_bt_write_batch(th, &bt_batch)) <= 0) {
+					if (len == -1)
+						error("BT write error: %s", strerror(errno));
+					goto fail;
+				}
+
+			}
+
+			pthread_mutex_lock(&t_pcm->mutex);
+			ba_transport_pcm_position_update(t_pcm, frame.frames * channels);
+			pthread_mutex_unlock(&t_pcm->mutex);
+
+			/* keep data transfer at a constant bit rate, also
+			 * get a timestamp for the next RTP frame */
+			io_poll_pace(&io, th, frame.frames);
+			rtp_state_update(&rtp, frame.frames);
+
+			data += frame.len;
+			data_len -= frame.len;
+
+		}
+
+		if (skipped > 0)
+			debug("Skipped MPEG stream data: %zu bytes", skipped);
+
+		/* update busy delay (packetization overhead) */
+		t_pcm->delay = asrsync_get_busy_usec(&io.asrs) / 100;
+
+		/* move incomplete frame to the beginning of the buffer */
+		ffb_shift(&mpeg, data - (uint8_t *)mpeg.data);
+
+	}
+
+fail:
+	debug_transport_thread_loop(th, "EXIT");
+	ba_transport_thread_set_state_stopping(th);
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+fail_ffb:
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+#endif
+
 #if ENABLE_MP3LAME || ENABLE_MPG123
 
 static enum ba_transport_thread_signal a2dp_mpeg_dec_io_poll_signal_filter(
@@ -368,8 +660,10 @@ static void *a2dp_mpeg_dec_thread(struct ba_transport_thread *th) {
 			continue;
 
 		const rtp_mpeg_audio_header_t *rtp_mpeg_header;
-		if ((rtp_mpeg_header = rtp_a2dp_payload(bt.data, &rtp_seq_number)) == NULL)
+		unsigned int missing;
+		if ((rtp_mpeg_header = rtp_a2dp_payload(bt.data, &rtp_seq_number, &missing)) == NULL)
 			continue;
+		ba_transport_thread_stats_add(th, rtp_lost, missing);
 
 		uint8_t *rtp_mpeg = (uint8_t *)(rtp_mpeg_header + 1);
 		size_t rtp_mpeg_len = len - (rtp_mpeg - (uint8_t *)bt.data);
@@ -381,6 +675,7 @@ static void *a2dp_mpeg_dec_thread(struct ba_transport_thread *th) {
 		int encoding;
 
 decode:
+		trace_probe2(decode_begin, th, rtp_mpeg_len);
 		switch (mpg123_decode(handle, rtp_mpeg, rtp_mpeg_len,
 					(uint8_t *)pcm.data, ffb_blen_in(&pcm), (size_t *)&len)) {
 		case MPG123_DONE:
@@ -397,6 +692,7 @@ decode:
 		}
 
 		const size_t samples = len / sizeof(int16_t);
+		trace_probe2(decode_end, th, samples);
 		io_pcm_scale(&t->a2dp.pcm, pcm.data, samples);
 		if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1)
 			error("FIFO write error: %s", strerror(errno));
@@ -412,11 +708,14 @@ decode:
 		int16_t pcm_r[MPEG_PCM_DECODE_SAMPLES];
 		ssize_t samples;
 
+		trace_probe2(decode_begin, th, rtp_mpeg_len);
 		if ((samples = hip_decode(handle, rtp_mpeg, rtp_mpeg_len, pcm_l, pcm_r)) < 0) {
 			error("LAME decoding error: %zd", samples);
 			continue;
 		}
 
+		trace_probe2(decode_end, th, samples);
+
 		if (channels == 1) {
 			io_pcm_scale(&t->a2dp.pcm, pcm_l, samples);
 			if (io_pcm_write(&t->a2dp.pcm, pcm_l, samples) == -1)
@@ -461,6 +760,8 @@ int a2dp_mpeg_transport_start(struct ba_transport *t) {
 
 	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE) {
 #if ENABLE_MP3LAME
+		if (BA_TRANSPORT_PCM_FORMAT_IS_COMPRESSED(t->a2dp.pcm.format))
+			return ba_transport_thread_create(&t->thread_enc, a2dp_mpeg_passthrough_thread, "ba-a2dp-mpeg", true);
 		if (((a2dp_mpeg_t *)t->a2dp.configuration)->layer == MPEG_LAYER_MP3)
 			return ba_transport_thread_create(&t->thread_enc, a2dp_mp3_enc_thread, "ba-a2dp-mp3", true);
 #endif
@@ -0,0 +1,119 @@
+/*
+ * BlueALSA - a2dp-plugin-abi.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+/*
+ * This header defines the interface between BlueALSA and external A2DP
+ * codec plug-ins. It is self-contained, so it can be copied into the
+ * plug-in source tree as is.
+ *
+ * Plug-in is a shared object which exports BA_A2DP_PLUGIN_ENTRY function.
+ * The function shall return the address of the statically allocated codec
+ * descriptor. BlueALSA takes care of the RTP framing, the PCM transfer and
+ * the IO threading, the plug-in shall only convert a single block of PCM
+ * frames into the codec payload and vice versa.
+ */
+
+#ifndef BLUEALSA_A2DPPLUGINABI_H_
+#define BLUEALSA_A2DPPLUGINABI_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Version of the plug-in interface. Plug-ins built against different
+ * version of this header are rejected by the loader. */
+#define BA_A2DP_PLUGIN_ABI_VERSION 1
+
+/**
+ * The name of the plug-in entry point function. */
+#define BA_A2DP_PLUGIN_ENTRY "ba_a2dp_plugin_entry"
+
+/**
+ * The maximal size of the codec capabilities blob. */
+#define BA_A2DP_PLUGIN_CAPABILITIES_MAX 32
+
+/**
+ * Every packet starts with the RTP header followed by the A2DP media
+ * payload header (with the frame counter set to 1). Without this flag
+ * the encoded block is transferred as a raw BT packet. */
+#define BA_A2DP_PLUGIN_FLAG_RTP (1 << 0)
+
+/**
+ * PCM stream parameters of the selected configuration. The PCM signal is
+ * always exchanged as interleaved signed 16-bit samples. */
+struct ba_a2dp_plugin_stream {
+	unsigned int channels;
+	unsigned int sampling;
+	/* number of PCM frames in a single encoded block */
+	unsigned int block_frames;
+	/* algorithmic delay of the codec in PCM frames */
+	unsigned int delay_frames;
+};
+
+/**
+ * Codec plug-in descriptor.
+ *
+ * The encode() and decode() callbacks are called from the transport IO
+ * threads, possibly concurrently for different streams, so all the codec
+ * state shall be kept in the handle returned by the init() callback. */
+struct ba_a2dp_plugin {
+
+	/* shall be set to BA_A2DP_PLUGIN_ABI_VERSION */
+	unsigned int abi_version;
+
+	/* Codec name used in the BlueALSA D-Bus API. It shall consist of
+	 * letters, digits and underscores only and it shall not be the same
+	 * as the name of any built-in codec. */
+	const char *name;
+
+	/* combination of BA_A2DP_PLUGIN_FLAG_* values */
+	unsigned int flags;
+
+	/* A2DP vendor codec capabilities - the blob shall start with the 32-bit
+	 * vendor ID and the 16-bit codec ID in the little-endian byte order */
+	const void *capabilities;
+	size_t capabilities_size;
+
+	/* Select configuration from the remote device capabilities. Given
+	 * capabilities are already masked with ours and shall be narrowed
+	 * in-place to a single configuration. This function shall return 0
+	 * on success, or -1 if none of the values is supported. */
+	int (*select_configuration)(void *capabilities, size_t size);
+
+	/* Validate configuration and get PCM stream parameters. This function
+	 * shall return 0 on success, or -1 for invalid configuration. */
+	int (*get_stream)(const void *configuration, size_t size,
+			struct ba_a2dp_plugin_stream *stream);
+
+	/* Create encoder (if encoder is non-zero) or decoder instance for given
+	 * configuration. On error this function shall return NULL. */
+	void *(*init)(const void *configuration, size_t size, int encoder);
+	void (*destroy)(void *handle);
+
+	/* Encode exactly one block of PCM frames. This function shall return
+	 * the number of bytes written to the output buffer, or -1 on error. It
+	 * might be NULL, if the plug-in does not support encoding. */
+	ssize_t (*encode)(void *handle, const int16_t *pcm,
+			void *buffer, size_t size);
+
+	/* Decode a single encoded block. This function shall return the number
+	 * of decoded PCM frames (at most block_frames), or -1 on error. It might
+	 * be NULL, if the plug-in does not support decoding. */
+	ssize_t (*decode)(void *handle, const void *buffer, size_t size,
+			int16_t *pcm);
+
+};
+
+/**
+ * Plug-in entry point function type. */
+typedef const struct ba_a2dp_plugin *ba_a2dp_plugin_entry_t(void);
+
+#endif
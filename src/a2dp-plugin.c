@@ -0,0 +1,326 @@
+/*
+ * BlueALSA - a2dp-plugin.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "a2dp-plugin.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "a2dp.h"
+#include "audio.h"
+#include "codec-plugin.h"
+#include "io.h"
+#include "rtp.h"
+#include "utils.h"
+#include "shared/defs.h"
+#include "shared/ffb.h"
+#include "shared/log.h"
+#include "shared/rb.h"
+#include "shared/rt.h"
+
+/**
+ * Set up the PCM of the transport with the plug-in codec.
+ *
+ * If the plug-in rejects the configuration, the PCM is left without
+ * channels, so it will not be exposed to clients.
+ *
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int a2dp_plugin_transport_set_codec(struct ba_transport *t) {
+
+	const struct codec_plugin *plugin = codec_plugin_lookup(t->type.codec);
+	struct ba_a2dp_plugin_stream stream = { 0 };
+
+	t->a2dp.pcm.format = BA_TRANSPORT_PCM_FORMAT_S16_2LE;
+
+	if (plugin->abi->get_stream(t->a2dp.configuration,
+				t->a2dp.codec->capabilities_size, &stream) == -1 ||
+			stream.channels == 0 || stream.sampling == 0) {
+		error("Invalid %s configuration", plugin->abi->name);
+		t->a2dp.pcm.channels = 0;
+		t->a2dp.pcm.sampling = 0;
+		t->a2dp.pcm.block_frames = 0;
+		return errno = EINVAL, -1;
+	}
+
+	t->a2dp.pcm.channels = stream.channels;
+	t->a2dp.pcm.sampling = stream.sampling;
+	t->a2dp.pcm.block_frames = stream.block_frames;
+
+	return 0;
+}
+
+static void *a2dp_plugin_enc_thread(struct ba_transport_thread *th) {
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_thread_cleanup), th);
+
+	struct ba_transport *t = th->t;
+	struct io_poll io = { .timeout = -1 };
+
+	const struct ba_a2dp_plugin *abi = codec_plugin_lookup(t->type.codec)->abi;
+	const size_t config_size = t->a2dp.codec->capabilities_size;
+
+	struct ba_a2dp_plugin_stream stream;
+	if (abi->get_stream(t->a2dp.configuration, config_size, &stream) == -1) {
+		error("Invalid %s configuration", abi->name);
+		goto fail_init;
+	}
+
+	void *handle;
+	if ((handle = abi->init(t->a2dp.configuration, config_size, 1)) == NULL) {
+		error("Couldn't initialize %s encoder", abi->name);
+		goto fail_init;
+	}
+
+	ffb_t bt = { 0 };
+	rb_t pcm = { 0 };
+	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
+	pthread_cleanup_push(PTHREAD_CLEANUP(rb_free), &pcm);
+	pthread_cleanup_push(abi->destroy, handle);
+
+	const bool rtp = abi->flags & BA_A2DP_PLUGIN_FLAG_RTP;
+	const size_t block_samples = stream.block_frames * stream.channels;
+	const size_t headers_len = rtp ? RTP_HEADER_LEN + sizeof(rtp_media_header_t) : 0;
+
+	if (block_samples == 0 || t->mtu_write <= headers_len) {
+		error("Invalid %s stream setup: %zu samples, MTU %zu",
+				abi->name, block_samples, t->mtu_write);
+		goto fail_ffb;
+	}
+
+	if (rb_init_int16_t(&pcm, block_samples) == -1 ||
+			ffb_init_uint8_t(&bt, t->mtu_write) == -1) {
+		error("Couldn't create data buffers: %s", strerror(errno));
+		goto fail_ffb;
+	}
+
+	/* Codec delay consists of the algorithmic delay reported by the plug-in
+	 * and the time needed to collect PCM frames for the whole block. */
+	t->a2dp.pcm.codec_delay = (stream.delay_frames + stream.block_frames) *
+		10000 / stream.sampling;
+
+	rtp_header_t *rtp_header = NULL;
+	rtp_media_header_t *rtp_media_header = NULL;
+	uint8_t *payload = bt.data;
+
+	struct rtp_state rtp_stream = { 0 };
+	rtp_state_init(&rtp_stream, stream.sampling, stream.sampling);
+
+	/* initialize RTP headers and get anchor for payload */
+	if (rtp)
+		payload = rtp_a2dp_init(bt.data, &rtp_header,
+				(void **)&rtp_media_header, sizeof(*rtp_media_header));
+
+	debug_transport_thread_loop(th, "START");
+	for (ba_transport_thread_set_state_running(th);;) {
+
+		ssize_t samples;
+		if ((samples = io_poll_and_read_pcm(&io, &t->a2dp.pcm,
+						rb_tail(&pcm), rb_len_in(&pcm))) <= 0) {
+			if (samples == -1)
+				error("PCM poll and read error: %s", strerror(errno));
+			ba_transport_stop_if_no_clients(t);
+			continue;
+		}
+
+		rb_seek(&pcm, samples);
+
+		/* every packet carries exactly one encoded block */
+		while (rb_len_out(&pcm) >= block_samples) {
+
+			bt.tail = payload;
+
+			ssize_t len;
+			if ((len = abi->encode(handle, rb_head(&pcm), bt.tail, ffb_len_in(&bt))) < 0) {
+				error("%s encoding error", abi->name);
+				rb_shift(&pcm, block_samples);
+				continue;
+			}
+
+			ffb_seek(&bt, len);
+			rb_shift(&pcm, block_samples);
+
+			if (rtp) {
+				rtp_state_new_packet(&rtp_stream, rtp_header);
+				rtp_media_header->frame_count = 1;
+			}
+
+			len = ffb_blen_out(&bt);
+			if ((len = io_bt_write(th, bt.data, len)) <= 0) {
+				if (len == -1)
+					error("BT write error: %s", strerror(errno));
+				goto fail;
+			}
+
+			/* keep data transfer at a constant bit rate, also
+			 * get a timestamp for the next RTP frame */
+			io_poll_pace(&io, th, stream.block_frames);
+			rtp_state_update(&rtp_stream, stream.block_frames);
+
+			/* update busy delay (encoding overhead) */
+			t->a2dp.pcm.delay = asrsync_get_busy_usec(&io.asrs) / 100;
+
+		}
+
+	}
+
+fail:
+	debug_transport_thread_loop(th, "EXIT");
+	ba_transport_thread_set_state_stopping(th);
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+fail_ffb:
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+fail_init:
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+
+static enum ba_transport_thread_signal a2dp_plugin_dec_io_poll_signal_filter(
+		enum ba_transport_thread_signal signal, void *userdata) {
+	uint16_t *rtp_seq_number = userdata;
+	if (signal == BA_TRANSPORT_THREAD_SIGNAL_PCM_CLOSE)
+		*rtp_seq_number = 0;
+	return signal;
+}
+
+static void *a2dp_plugin_dec_thread(struct ba_transport_thread *th) {
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_thread_cleanup), th);
+
+	struct ba_transport *t = th->t;
+	uint16_t rtp_seq_number = 0;
+	struct io_poll io = {
+		.signal.filter = a2dp_plugin_dec_io_poll_signal_filter,
+		.signal.userdata = &rtp_seq_number,
+		.timeout = -1,
+	};
+
+	const struct ba_a2dp_plugin *abi = codec_plugin_lookup(t->type.codec)->abi;
+	const size_t config_size = t->a2dp.codec->capabilities_size;
+
+	struct ba_a2dp_plugin_stream stream;
+	if (abi->get_stream(t->a2dp.configuration, config_size, &stream) == -1) {
+		error("Invalid %s configuration", abi->name);
+		goto fail_init;
+	}
+
+	void *handle;
+	if ((handle = abi->init(t->a2dp.configuration, config_size, 0)) == NULL) {
+		error("Couldn't initialize %s decoder", abi->name);
+		goto fail_init;
+	}
+
+	ffb_t bt = { 0 };
+	ffb_t pcm = { 0 };
+	struct audio_plc plc = { 0 };
+	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
+	pthread_cleanup_push(PTHREAD_CLEANUP(audio_plc_free), &plc);
+	pthread_cleanup_push(abi->destroy, handle);
+
+	const bool rtp = abi->flags & BA_A2DP_PLUGIN_FLAG_RTP;
+	const size_t block_samples = stream.block_frames * stream.channels;
+
+	if (ffb_init_int16_t(&pcm, block_samples) == -1 ||
+			ffb_init_uint8_t(&bt, t->mtu_read) == -1 ||
+			audio_plc_init(&plc, sizeof(int16_t), stream.channels, block_samples) == -1) {
+		error("Couldn't create data buffers: %s", strerror(errno));
+		goto fail_ffb;
+	}
+
+	debug_transport_thread_loop(th, "START");
+	for (ba_transport_thread_set_state_running(th);;) {
+
+		ssize_t len = ffb_blen_in(&bt);
+		if ((len = io_poll_and_read_bt(&io, th, bt.data, len)) <= 0) {
+			if (len == -1)
+				error("BT poll and read error: %s", strerror(errno));
+			goto fail;
+		}
+
+		if (!ba_transport_pcm_is_active(&t->a2dp.pcm))
+			continue;
+
+		const uint8_t *payload = bt.data;
+		size_t payload_len = len;
+
+		if (rtp) {
+
+			const rtp_media_header_t *rtp_media_header;
+			unsigned int missing;
+			if ((rtp_media_header = rtp_a2dp_payload(bt.data, &rtp_seq_number, &missing)) == NULL)
+				continue;
+			ba_transport_thread_stats_add(th, rtp_lost, missing);
+
+			payload = (uint8_t *)(rtp_media_header + 1);
+			payload_len = len - (payload - (uint8_t *)bt.data);
+
+			/* every lost packet has carried a single encoded block */
+			if (missing > 0 &&
+					io_pcm_conceal(&t->a2dp.pcm, &plc, pcm.data, missing) == -1)
+				error("FIFO write error: %s", strerror(errno));
+
+		}
+
+		ssize_t frames;
+		if ((frames = abi->decode(handle, payload, payload_len, pcm.data)) < 0) {
+			error("%s decoding error", abi->name);
+			continue;
+		}
+
+		const size_t samples = MIN((size_t)frames, stream.block_frames) * stream.channels;
+		io_pcm_scale(&t->a2dp.pcm, pcm.data, samples);
+		audio_plc_update(&plc, pcm.data, samples);
+		if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1)
+			error("FIFO write error: %s", strerror(errno));
+
+	}
+
+fail:
+	debug_transport_thread_loop(th, "EXIT");
+	ba_transport_thread_set_state_stopping(th);
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+fail_ffb:
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+fail_init:
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+
+/**
+ * Start IO thread of the codec plug-in.
+ *
+ * All codec plug-ins share the same encoder and decoder threads, which do
+ * the RTP framing and the PCM transfer, so the plug-in itself does not have
+ * to deal with the transport internals. */
+int a2dp_plugin_transport_start(struct ba_transport *t) {
+
+	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE)
+		return ba_transport_thread_create(&t->thread_enc, a2dp_plugin_enc_thread, "ba-a2dp-plugin", true);
+
+	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SINK)
+		return ba_transport_thread_create(&t->thread_dec, a2dp_plugin_dec_thread, "ba-a2dp-plugin", true);
+
+	g_assert_not_reached();
+	return -1;
+}
@@ -0,0 +1,481 @@
+/*
+ * BlueALSA - a2dp-policy.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "a2dp-policy.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+#include <glib.h>
+
+#if ENABLE_LDAC
+# include <ldacBT.h>
+#endif
+
+#include "a2dp.h"
+#include "a2dp-codecs.h"
+#include "ba-adapter.h"
+#include "ba-device.h"
+#include "ba-transport.h"
+#include "bluealsa.h"
+#include "hci.h"
+#include "utils.h"
+#include "shared/defs.h"
+#include "shared/log.h"
+
+/**
+ * Single step of the codec ladder. */
+struct a2dp_policy_step {
+	uint16_t codec_id;
+	/* LDAC encoder quality or -1 */
+	int ldac_eqmid;
+};
+
+/**
+ * Codec ladder ordered from the best quality (and the highest bit rate)
+ * to the most robust one. */
+static const struct a2dp_policy_step steps[] = {
+#if ENABLE_LDAC
+	{ A2DP_CODEC_VENDOR_LDAC, LDACBT_EQMID_HQ },
+	{ A2DP_CODEC_VENDOR_LDAC, LDACBT_EQMID_SQ },
+	{ A2DP_CODEC_VENDOR_LDAC, LDACBT_EQMID_MQ },
+#endif
+	{ A2DP_CODEC_VENDOR_APTX_HD, -1 },
+	{ A2DP_CODEC_VENDOR_APTX, -1 },
+	{ A2DP_CODEC_MPEG24, -1 },
+	{ A2DP_CODEC_SBC, -1 },
+};
+
+/**
+ * Link policy state of a single device. Entries are accessed from the
+ * main loop only, so there is no need for locking. */
+struct a2dp_policy_entry {
+	int hci_dev_id;
+	bdaddr_t addr;
+	/* BlueZ path of the monitored transport */
+	char *transport_path;
+	/* the best allowed and the currently selected ladder step,
+	 * or -1 if the codec is not handled by the policy */
+	int preferred;
+	int selected;
+	struct a2dp_policy_link link;
+	/* IO statistics snapshot */
+	unsigned int tx_packets;
+	unsigned int overdue;
+	unsigned int congestion_drops;
+	/* the sampling tick when the device was seen for the last time */
+	unsigned int seen;
+};
+
+static GList *entries = NULL;
+static unsigned int ticks = 0;
+
+/**
+ * Get the quality of the link based on metrics from the last interval. */
+enum a2dp_policy_quality a2dp_policy_get_quality(
+		const struct a2dp_policy_metrics *metrics) {
+
+	const bool rssi_poor = metrics->rssi_valid &&
+		metrics->rssi < A2DP_POLICY_RSSI_POOR;
+	const bool rssi_good = !metrics->rssi_valid ||
+		metrics->rssi >= A2DP_POLICY_RSSI_GOOD;
+
+	if (metrics->congestion_drops > 0 ||
+			metrics->queued >= A2DP_POLICY_QUEUE_POOR ||
+			metrics->overdue * 10 > metrics->tx_packets ||
+			rssi_poor)
+		return A2DP_POLICY_QUALITY_POOR;
+
+	if (metrics->overdue == 0 &&
+			metrics->queued == 0 &&
+			rssi_good)
+		return A2DP_POLICY_QUALITY_GOOD;
+
+	return A2DP_POLICY_QUALITY_FAIR;
+}
+
+void a2dp_policy_link_init(
+		struct a2dp_policy_link *link) {
+	link->poor = 0;
+	link->good = 0;
+	link->upgrade_samples = A2DP_POLICY_UPGRADE_SAMPLES;
+	link->upgraded = false;
+}
+
+/**
+ * Reset consecutive sample counters, e.g. when the stream is idle. */
+void a2dp_policy_link_reset(
+		struct a2dp_policy_link *link) {
+	link->poor = 0;
+	link->good = 0;
+}
+
+/**
+ * Update link quality hysteresis with the new sample.
+ *
+ * @param link Pointer to the link hysteresis state.
+ * @param quality The link quality of the last sampling interval.
+ * @return This function returns the action which shall be taken. */
+enum a2dp_policy_action a2dp_policy_link_update(
+		struct a2dp_policy_link *link,
+		enum a2dp_policy_quality quality) {
+
+	switch (quality) {
+	case A2DP_POLICY_QUALITY_POOR:
+		link->good = 0;
+		if (++link->poor < A2DP_POLICY_DOWNGRADE_SAMPLES)
+			break;
+		link->poor = 0;
+		/* The recent upgrade did not hold, so postpone the next one. This
+		 * prevents from flapping between two codecs when the link quality is
+		 * just on the edge. */
+		if (link->upgraded)
+			link->upgrade_samples = MIN(link->upgrade_samples * 2,
+					A2DP_POLICY_UPGRADE_SAMPLES_MAX);
+		link->upgraded = false;
+		return A2DP_POLICY_ACTION_DOWNGRADE;
+	case A2DP_POLICY_QUALITY_FAIR:
+		a2dp_policy_link_reset(link);
+		break;
+	case A2DP_POLICY_QUALITY_GOOD:
+		link->poor = 0;
+		if (++link->good < link->upgrade_samples)
+			break;
+		link->good = 0;
+		/* the recent upgrade has held for the whole period */
+		if (link->upgraded)
+			link->upgrade_samples = A2DP_POLICY_UPGRADE_SAMPLES;
+		link->upgraded = false;
+		return A2DP_POLICY_ACTION_UPGRADE;
+	}
+
+	return A2DP_POLICY_ACTION_NONE;
+}
+
+/**
+ * Mark that the upgrade requested by the hysteresis has been done. */
+void a2dp_policy_link_upgraded(
+		struct a2dp_policy_link *link) {
+	link->upgraded = true;
+}
+
+/**
+ * Lookup ladder step of the currently used codec. */
+static int a2dp_policy_step_lookup(struct ba_transport *t) {
+	for (size_t i = 0; i < ARRAYSIZE(steps); i++) {
+		if (steps[i].codec_id != t->type.codec)
+			continue;
+#if ENABLE_LDAC
+		if (steps[i].codec_id == A2DP_CODEC_VENDOR_LDAC &&
+				steps[i].ldac_eqmid != atomic_load_explicit(&t->a2dp.ldac_eqmid,
+					memory_order_relaxed))
+			continue;
+#endif
+		return i;
+	}
+	return -1;
+}
+
+static struct a2dp_sep *a2dp_policy_sep_lookup(
+		const struct ba_transport *t,
+		uint16_t codec_id) {
+
+	const GArray *seps = t->d->seps;
+	const enum a2dp_dir dir = !t->a2dp.codec->dir;
+
+	for (size_t i = 0; seps != NULL && i < seps->len; i++)
+		if (g_array_index(seps, struct a2dp_sep, i).dir == dir &&
+				g_array_index(seps, struct a2dp_sep, i).codec_id == codec_id)
+			return &g_array_index(seps, struct a2dp_sep, i);
+
+	return NULL;
+}
+
+/**
+ * Check whether given ladder step can be used with the transport. */
+static bool a2dp_policy_step_available(
+		const struct ba_transport *t,
+		size_t step) {
+
+	const struct a2dp_policy_step *s = &steps[step];
+
+	if (s->codec_id != t->type.codec) {
+		if (a2dp_codec_lookup(s->codec_id, t->a2dp.codec->dir) == NULL)
+			return false;
+		if (a2dp_policy_sep_lookup(t, s->codec_id) == NULL)
+			return false;
+	}
+
+#if ENABLE_LDAC
+	if (s->codec_id == A2DP_CODEC_VENDOR_LDAC) {
+		/* LDAC quality is controlled by the LDAC ABR */
+		if (config.ldac_abr)
+			return s->ldac_eqmid == config.ldac_eqmid;
+		/* do not exceed the configured LDAC quality */
+		if (s->ldac_eqmid < config.ldac_eqmid)
+			return false;
+	}
+#endif
+
+	return true;
+}
+
+static int a2dp_policy_select_step(
+		struct a2dp_policy_entry *entry,
+		struct ba_transport *t,
+		size_t step) {
+
+	const struct a2dp_policy_step *s = &steps[step];
+
+	debug("Link policy: %s: Selecting codec: %s",
+			batostr_(&entry->addr), ba_transport_codecs_a2dp_to_string(s->codec_id));
+
+	if (s->codec_id != t->type.codec) {
+
+		struct a2dp_sep *sep = a2dp_policy_sep_lookup(t, s->codec_id);
+		const struct a2dp_codec *codec = a2dp_codec_lookup(s->codec_id, t->a2dp.codec->dir);
+
+		/* setup default codec configuration */
+		memcpy(sep->configuration, sep->capabilities, sep->capabilities_size);
+		if (a2dp_select_configuration(codec, sep->configuration, sep->capabilities_size) == -1)
+			return -1;
+
+		/* This call will trigger the A2DP reconfiguration, so the current
+		 * transport will be replaced by a new one with the selected codec. */
+		if (ba_transport_select_codec_a2dp(t, sep) == -1)
+			return -1;
+
+	}
+
+#if ENABLE_LDAC
+	if (s->codec_id == A2DP_CODEC_VENDOR_LDAC && s->codec_id == t->type.codec)
+		atomic_store_explicit(&t->a2dp.ldac_eqmid, s->ldac_eqmid, memory_order_relaxed);
+#endif
+
+	entry->selected = step;
+	return 0;
+}
+
+static struct a2dp_policy_entry *a2dp_policy_entry_get(
+		const struct ba_device *d) {
+
+	struct a2dp_policy_entry *entry;
+	GList *el;
+
+	for (el = entries; el != NULL; el = el->next) {
+		entry = el->data;
+		if (entry->hci_dev_id == d->a->hci.dev_id &&
+				bacmp(&entry->addr, &d->addr) == 0)
+			return entry;
+	}
+
+	if ((entry = calloc(1, sizeof(*entry))) == NULL)
+		return NULL;
+
+	entry->hci_dev_id = d->a->hci.dev_id;
+	bacpy(&entry->addr, &d->addr);
+	entry->preferred = -1;
+	entry->selected = -1;
+	a2dp_policy_link_init(&entry->link);
+
+	entries = g_list_prepend(entries, entry);
+	return entry;
+}
+
+static void a2dp_policy_entry_free(struct a2dp_policy_entry *entry) {
+	free(entry->transport_path);
+	free(entry);
+}
+
+/**
+ * Sample the link quality of the A2DP source transport. */
+static void a2dp_policy_sample_transport(
+		struct a2dp_policy_entry *entry,
+		struct ba_transport *t) {
+
+	const struct ba_transport_thread *th = &t->thread_enc;
+	const unsigned int tx_packets = atomic_load_explicit(&th->stats.tx_packets, memory_order_relaxed);
+	const unsigned int overdue = atomic_load_explicit(&th->stats.overdue, memory_order_relaxed);
+	const unsigned int congestion_drops = atomic_load_explicit(&th->stats.congestion_drops, memory_order_relaxed);
+
+	if (entry->transport_path == NULL ||
+			strcmp(entry->transport_path, t->bluez_dbus_path) != 0) {
+
+		free(entry->transport_path);
+		entry->transport_path = strdup(t->bluez_dbus_path);
+
+		/* New transport with a codec other than the one selected by us means
+		 * that the codec has been selected by the remote device or by the
+		 * user. In such case, this codec will be the best one allowed. */
+		if (entry->selected == -1 ||
+				steps[entry->selected].codec_id != t->type.codec) {
+			entry->preferred = entry->selected = a2dp_policy_step_lookup(t);
+			a2dp_policy_link_init(&entry->link);
+			if (entry->selected != -1)
+				debug("Link policy: %s: Preferred codec: %s", batostr_(&entry->addr),
+						ba_transport_codecs_a2dp_to_string(t->type.codec));
+		}
+#if ENABLE_LDAC
+		else if (t->type.codec == A2DP_CODEC_VENDOR_LDAC)
+			/* restore LDAC quality selected before the reconfiguration */
+			atomic_store_explicit(&t->a2dp.ldac_eqmid, steps[entry->selected].ldac_eqmid,
+					memory_order_relaxed);
+#endif
+
+		goto snapshot;
+	}
+
+	/* Codec not handled by the policy or the codec switch is in progress,
+	 * i.e. we are waiting for BlueZ to replace the transport. */
+	if (entry->selected == -1 ||
+			steps[entry->selected].codec_id != t->type.codec)
+		return;
+
+	/* IO thread has been restarted, so the statistics were reset */
+	if (tx_packets < entry->tx_packets ||
+			overdue < entry->overdue ||
+			congestion_drops < entry->congestion_drops)
+		goto snapshot;
+
+	struct a2dp_policy_metrics metrics = {
+		.tx_packets = tx_packets - entry->tx_packets,
+		.overdue = overdue - entry->overdue,
+		.congestion_drops = congestion_drops - entry->congestion_drops,
+	};
+
+	/* there is no point in sampling idle link */
+	if (metrics.tx_packets == 0) {
+		a2dp_policy_link_reset(&entry->link);
+		goto snapshot;
+	}
+
+	const int queued = atomic_load_explicit(&th->bt_coutq.queued, memory_order_relaxed);
+	if (queued > 0 && t->mtu_write > 0)
+		metrics.queued = queued / t->mtu_write;
+
+	if (hci_read_conn_rssi(entry->hci_dev_id, &entry->addr, &metrics.rssi) == 0)
+		metrics.rssi_valid = true;
+
+	int step = -1;
+	switch (a2dp_policy_link_update(&entry->link, a2dp_policy_get_quality(&metrics))) {
+	case A2DP_POLICY_ACTION_NONE:
+		break;
+	case A2DP_POLICY_ACTION_DOWNGRADE:
+		for (size_t i = entry->selected + 1; i < ARRAYSIZE(steps); i++)
+			if (a2dp_policy_step_available(t, i)) {
+				step = i;
+				break;
+			}
+		break;
+	case A2DP_POLICY_ACTION_UPGRADE:
+		for (int i = entry->selected - 1; i >= entry->preferred; i--)
+			if (a2dp_policy_step_available(t, i)) {
+				step = i;
+				break;
+			}
+		break;
+	}
+
+	if (step != -1) {
+		const bool upgrade = step < entry->selected;
+		info("Link policy: %s: Link quality %s (RSSI: %d, queued: %u, late: %u, dropped: %u)",
+				batostr_(&entry->addr), upgrade ? "recovered" : "degraded",
+				metrics.rssi_valid ? metrics.rssi : 0, metrics.queued,
+				metrics.overdue, metrics.congestion_drops);
+		if (a2dp_policy_select_step(entry, t, step) == -1)
+			error("Couldn't switch A2DP codec: %s", strerror(errno));
+		else if (upgrade)
+			a2dp_policy_link_upgraded(&entry->link);
+		a2dp_policy_link_reset(&entry->link);
+	}
+
+snapshot:
+	entry->tx_packets = tx_packets;
+	entry->overdue = overdue;
+	entry->congestion_drops = congestion_drops;
+}
+
+static gboolean a2dp_policy_sample(void *userdata) {
+	(void)userdata;
+
+	GHashTableIter iter_d, iter_t;
+	struct ba_adapter *a;
+	struct ba_device *d;
+	struct ba_transport *t;
+	GList *transports = NULL;
+	GList *el, *next;
+	size_t i;
+
+	ticks++;
+
+	/* Collect all A2DP source transports, so the sampling (and possible
+	 * codec switch) can be done without holding any locks. */
+	for (i = 0; i < HCI_MAX_DEV; i++) {
+		if ((a = ba_adapter_lookup(i)) == NULL)
+			continue;
+		pthread_rwlock_rdlock(&a->devices_lock);
+		g_hash_table_iter_init(&iter_d, a->devices);
+		while (g_hash_table_iter_next(&iter_d, NULL, (gpointer)&d)) {
+			pthread_rwlock_rdlock(&d->transports_lock);
+			g_hash_table_iter_init(&iter_t, d->transports);
+			while (g_hash_table_iter_next(&iter_t, NULL, (gpointer)&t))
+				if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE)
+					transports = g_list_prepend(transports, ba_transport_ref(t));
+			pthread_rwlock_unlock(&d->transports_lock);
+		}
+		pthread_rwlock_unlock(&a->devices_lock);
+		ba_adapter_unref(a);
+	}
+
+	for (el = transports; el != NULL; el = el->next) {
+		t = el->data;
+		struct a2dp_policy_entry *entry;
+		if ((entry = a2dp_policy_entry_get(t->d)) == NULL)
+			continue;
+		entry->seen = ticks;
+		a2dp_policy_sample_transport(entry, t);
+	}
+
+	g_list_free_full(transports, (GDestroyNotify)ba_transport_unref);
+
+	/* discard state of disconnected devices */
+	for (el = entries; el != NULL; el = next) {
+		struct a2dp_policy_entry *entry = el->data;
+		next = el->next;
+		if (ticks - entry->seen > A2DP_POLICY_EXPIRE_SAMPLES) {
+			entries = g_list_delete_link(entries, el);
+			a2dp_policy_entry_free(entry);
+		}
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Start A2DP link quality monitoring.
+ *
+ * The link quality of every A2DP source transport is sampled periodically
+ * in the main loop. When the link degrades, the codec (or the LDAC encoder
+ * quality) is lowered by one step of the codec ladder. When the link quality
+ * stays good for a while, the codec is raised back by one step, but not above
+ * the codec selected by the remote device or by the user.
+ *
+ * @return On success this function returns 0. Otherwise -1 is returned. */
+int a2dp_policy_init(void) {
+	g_timeout_add_seconds(A2DP_POLICY_INTERVAL, a2dp_policy_sample, NULL);
+	return 0;
+}
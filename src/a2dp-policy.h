@@ -0,0 +1,110 @@
+/*
+ * BlueALSA - a2dp-policy.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_A2DPPOLICY_H_
+#define BLUEALSA_A2DPPOLICY_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Link quality sampling interval in seconds. */
+#define A2DP_POLICY_INTERVAL 1
+
+/**
+ * The number of consecutive poor quality samples after which the codec
+ * shall be downgraded. */
+#define A2DP_POLICY_DOWNGRADE_SAMPLES 3
+
+/**
+ * The number of consecutive good quality samples after which the codec
+ * shall be upgraded. This value is doubled every time the upgraded codec
+ * does not hold, up to the given maximum. */
+#define A2DP_POLICY_UPGRADE_SAMPLES 30
+#define A2DP_POLICY_UPGRADE_SAMPLES_MAX 240
+
+/**
+ * RSSI thresholds (in dB relative to the Golden Receive Power Range) for
+ * the poor and good link quality. The gap between these two values works
+ * as a hysteresis. */
+#define A2DP_POLICY_RSSI_POOR -10
+#define A2DP_POLICY_RSSI_GOOD -4
+
+/**
+ * The number of packets waiting in the BT socket output queue which is
+ * regarded as a poor link quality. */
+#define A2DP_POLICY_QUEUE_POOR 4
+
+/**
+ * The number of sampling intervals after which the state of the device
+ * which has no A2DP source transport is discarded. It shall be long enough
+ * to cover the A2DP reconfiguration done by BlueZ when switching codecs. */
+#define A2DP_POLICY_EXPIRE_SAMPLES 30
+
+/**
+ * Link metrics collected during the single sampling interval. */
+struct a2dp_policy_metrics {
+	/* RSSI of the ACL link, if available */
+	bool rssi_valid;
+	int8_t rssi;
+	/* packets written to the BT socket */
+	unsigned int tx_packets;
+	/* writes which missed the synchronization deadline */
+	unsigned int overdue;
+	/* PCM data drops due to the BT congestion */
+	unsigned int congestion_drops;
+	/* packets queued in the BT socket output buffer */
+	unsigned int queued;
+};
+
+enum a2dp_policy_quality {
+	A2DP_POLICY_QUALITY_POOR,
+	A2DP_POLICY_QUALITY_FAIR,
+	A2DP_POLICY_QUALITY_GOOD,
+};
+
+enum a2dp_policy_action {
+	A2DP_POLICY_ACTION_NONE,
+	A2DP_POLICY_ACTION_DOWNGRADE,
+	A2DP_POLICY_ACTION_UPGRADE,
+};
+
+/**
+ * Link quality hysteresis state. */
+struct a2dp_policy_link {
+	/* consecutive poor and good quality samples */
+	unsigned int poor;
+	unsigned int good;
+	/* good samples required for the upgrade */
+	unsigned int upgrade_samples;
+	/* the last action was an upgrade */
+	bool upgraded;
+};
+
+enum a2dp_policy_quality a2dp_policy_get_quality(
+		const struct a2dp_policy_metrics *metrics);
+
+void a2dp_policy_link_init(
+		struct a2dp_policy_link *link);
+void a2dp_policy_link_reset(
+		struct a2dp_policy_link *link);
+enum a2dp_policy_action a2dp_policy_link_update(
+		struct a2dp_policy_link *link,
+		enum a2dp_policy_quality quality);
+void a2dp_policy_link_upgraded(
+		struct a2dp_policy_link *link);
+
+int a2dp_policy_init(void);
+
+#endif
@@ -10,7 +10,6 @@
 
 #include "a2dp-sbc.h"
 
-#include <ctype.h>
 #include <errno.h>
 #include <pthread.h>
 #include <stdbool.h>
@@ -25,14 +24,18 @@
 
 #include "a2dp.h"
 #include "a2dp-codecs.h"
+#include "audio.h"
+#include "ba-device.h"
 #include "codec-sbc.h"
 #include "bluealsa.h"
 #include "io.h"
 #include "rtp.h"
+#include "trace.h"
 #include "utils.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
 #include "shared/log.h"
+#include "shared/rb.h"
 #include "shared/rt.h"
 
 void a2dp_sbc_transport_set_codec(struct ba_transport *t) {
@@ -45,6 +48,23 @@ void a2dp_sbc_transport_set_codec(struct ba_transport *t) {
 	t->a2dp.pcm.sampling = a2dp_codec_lookup_frequency(codec,
 			((a2dp_sbc_t *)t->a2dp.configuration)->frequency, false);
 
+	const a2dp_sbc_t *configuration = (a2dp_sbc_t *)t->a2dp.configuration;
+	unsigned int blocks = 16;
+	switch (configuration->block_length) {
+	case SBC_BLOCK_LENGTH_4:
+		blocks = 4;
+		break;
+	case SBC_BLOCK_LENGTH_8:
+		blocks = 8;
+		break;
+	case SBC_BLOCK_LENGTH_12:
+		blocks = 12;
+		break;
+	}
+
+	t->a2dp.pcm.block_frames = blocks *
+		(configuration->subbands == SBC_SUBBANDS_4 ? 4 : 8);
+
 }
 
 static void *a2dp_sbc_enc_thread(struct ba_transport_thread *th) {
@@ -56,17 +76,33 @@ static void *a2dp_sbc_enc_thread(struct ba_transport_thread *th) {
 	struct io_poll io = { .timeout = -1 };
 
 	sbc_t sbc;
-	if ((errno = -sbc_init_a2dp(&sbc, 0, t->a2dp.configuration,
-					t->a2dp.codec->capabilities_size)) != 0) {
+	struct ba_device_codec codec = {
+		.d = t->d,
+		.name = "sbc-enc",
+		.config = t->a2dp.configuration,
+		.config_size = t->a2dp.codec->capabilities_size,
+		.state = &sbc,
+		.state_size = sizeof(sbc),
+		.destroy = PTHREAD_CLEANUP(sbc_finish),
+	};
+
+	/* reset cached SBC encoder or create a new one */
+	if (ba_device_codec_acquire(&codec) == 0)
+		errno = -sbc_reinit_a2dp(&sbc, 0, codec.config, codec.config_size);
+	else
+		errno = -sbc_init_a2dp(&sbc, 0, codec.config, codec.config_size);
+	if (errno != 0) {
 		error("Couldn't initialize SBC codec: %s", strerror(errno));
 		goto fail_init;
 	}
 
+	codec.ready = true;
+
 	ffb_t bt = { 0 };
-	ffb_t pcm = { 0 };
+	rb_t pcm = { 0 };
 	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
-	pthread_cleanup_push(PTHREAD_CLEANUP(sbc_finish), &sbc);
+	pthread_cleanup_push(PTHREAD_CLEANUP(rb_free), &pcm);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_device_codec_release), &codec);
 
 	const a2dp_sbc_t *configuration = (a2dp_sbc_t *)t->a2dp.configuration;
 	const size_t sbc_frame_samples = sbc_get_codesize(&sbc) / sizeof(int16_t);
@@ -90,97 +126,115 @@ static void *a2dp_sbc_enc_thread(struct ba_transport_thread *th) {
 		warn("Writing MTU too small for one single SBC frame: %zu < %zu",
 				t->mtu_write, RTP_HEADER_LEN + sizeof(rtp_media_header_t) + sbc_frame_len);
 
-	if (ffb_init_int16_t(&pcm, sbc_frame_samples * (mtu_write_payload / sbc_frame_len)) == -1 ||
+	const size_t sbc_packet_samples = sbc_frame_samples * (mtu_write_payload / sbc_frame_len);
+
+	if (rb_init_int16_t(&pcm, sbc_packet_samples) == -1 ||
 			ffb_init_uint8_t(&bt, t->mtu_write) == -1) {
 		error("Couldn't create data buffers: %s", strerror(errno));
 		goto fail_ffb;
 	}
 
+	/* Codec delay consists of the analysis filter bank delay (73 frames for
+	 * 8 sub-bands, 37 frames for 4 sub-bands) and the time needed to collect
+	 * PCM frames for the whole RTP packet. */
+	const unsigned int subbands = configuration->subbands == SBC_SUBBANDS_4 ? 4 : 8;
+	t->a2dp.pcm.codec_delay = (9 * subbands + 1 + sbc_packet_samples / channels) *
+		10000 / samplerate;
+	debug("SBC encoder delay: %u.%u ms", t->a2dp.pcm.codec_delay / 10,
+			t->a2dp.pcm.codec_delay % 10);
+
 	rtp_header_t *rtp_header;
 	rtp_media_header_t *rtp_media_header;
 
 	/* initialize RTP headers and get anchor for payload */
 	uint8_t *rtp_payload = rtp_a2dp_init(bt.data, &rtp_header,
 			(void **)&rtp_media_header, sizeof(*rtp_media_header));
-	uint16_t seq_number = be16toh(rtp_header->seq_number);
-	uint32_t timestamp = be32toh(rtp_header->timestamp);
+
+	struct rtp_state rtp = { 0 };
+	rtp_state_init(&rtp, samplerate, samplerate);
+
+	/* Adaptive bit rate will never exceed the bit-pool selected with the
+	 * configured quality, also it will not go below the low quality. */
+	struct io_bt_abr abr;
+	io_bt_abr_init(&abr, sbc_a2dp_get_bitpool(configuration, SBC_QUALITY_LOW),
+			sbc.bitpool, 2);
+	io_bt_abr_set_low_power(&abr, sbc_a2dp_get_bitpool(configuration, SBC_QUALITY_MEDIUM));
+
+	/* prime the first RTP payload with silence up to one SBC frame */
+	if (config.a2dp.fast_start)
+		io.fast_start.samples = sbc_frame_samples;
 
 	debug_transport_thread_loop(th, "START");
 	for (ba_transport_thread_set_state_running(th);;) {
 
 		ssize_t samples;
 		if ((samples = io_poll_and_read_pcm(&io, &t->a2dp.pcm,
-						pcm.tail, ffb_len_in(&pcm))) <= 0) {
+						rb_tail(&pcm), rb_len_in(&pcm))) <= 0) {
 			if (samples == -1)
 				error("PCM poll and read error: %s", strerror(errno));
 			ba_transport_stop_if_no_clients(t);
 			continue;
 		}
 
-		ffb_seek(&pcm, samples);
-		samples = ffb_len_out(&pcm);
+		rb_seek(&pcm, samples);
+		samples = rb_len_out(&pcm);
 
 		/* anchor for RTP payload */
 		bt.tail = rtp_payload;
 
-		const int16_t *input = pcm.data;
 		size_t input_samples = samples;
-		size_t output_len = ffb_len_in(&bt);
 		size_t pcm_frames = 0;
-		size_t sbc_frames = 0;
+		size_t sbc_frames = (1 << 4) - 1;
+		size_t encoded;
+		ssize_t len;
 
 		/* Generate as many SBC frames as possible, but less than a 4-bit media
 		 * header frame counter can contain. The size of the output buffer is
 		 * based on the socket MTU, so such transfer should be most efficient. */
-		while (input_samples >= sbc_frame_samples &&
-				output_len >= sbc_frame_len &&
-				sbc_frames < ((1 << 4) - 1)) {
-
-			ssize_t len;
-			ssize_t encoded;
-
-			if ((len = sbc_encode(&sbc, input, input_samples * sizeof(int16_t),
-							bt.tail, output_len, &encoded)) < 0) {
-				error("SBC encoding error: %s", strerror(-len));
-				break;
-			}
-
+		trace_probe2(encode_begin, th, samples);
+		if ((len = sbc_encode_frames(&sbc, rb_head(&pcm), samples * sizeof(int16_t),
+						bt.tail, ffb_len_in(&bt), &encoded, &sbc_frames)) < 0) {
+			error("SBC encoding error: %s", strerror(-len));
+			sbc_frames = 0;
+		}
+		else {
 			len = len / sizeof(int16_t);
-			input += len;
 			input_samples -= len;
 			ffb_seek(&bt, encoded);
-			output_len -= encoded;
-			pcm_frames += len / channels;
-			sbc_frames++;
-
+			pcm_frames = len / channels;
+			trace_probe2(encode_end, th, encoded);
 		}
 
 		if (sbc_frames > 0) {
 
-			rtp_header->seq_number = htobe16(++seq_number);
-			rtp_header->timestamp = htobe32(timestamp);
+			rtp_state_new_packet(&rtp, rtp_header);
 			rtp_media_header->frame_count = sbc_frames;
 
-			ssize_t len = ffb_blen_out(&bt);
+			len = ffb_blen_out(&bt);
 			if ((len = io_bt_write(th, bt.data, len)) <= 0) {
 				if (len == -1)
 					error("BT write error: %s", strerror(errno));
 				goto fail;
 			}
 
+			if (io_bt_abr_update(&abr, th, config.a2dp.abr)) {
+				/* new bit-pool will be used for the next SBC frame */
+				debug("Changing SBC bit-pool: %u -> %u", sbc.bitpool, abr.value);
+				sbc.bitpool = abr.value;
+			}
+
 			/* keep data transfer at a constant bit rate, also
 			 * get a timestamp for the next RTP frame */
-			asrsync_sync(&io.asrs, pcm_frames);
-			timestamp += pcm_frames * 10000 / samplerate;
+			io_poll_pace(&io, th, pcm_frames);
+			rtp_state_update(&rtp, pcm_frames);
 
 			/* update busy delay (encoding overhead) */
 			t->a2dp.pcm.delay = asrsync_get_busy_usec(&io.asrs) / 100;
 
-			/* If the input buffer was not consumed (due to codesize limit), we
-			 * have to append new data to the existing one. Since we do not use
-			 * ring buffer, we will simply move unprocessed data to the front
-			 * of our linear buffer. */
-			ffb_shift(&pcm, samples - input_samples);
+			/* If the input buffer was not consumed (due to codesize limit), the
+			 * unprocessed data will stay in the ring buffer and new data will
+			 * be appended to it. */
+			rb_shift(&pcm, samples - input_samples);
 
 		}
 
@@ -223,20 +277,40 @@ static void *a2dp_sbc_dec_thread(struct ba_transport_thread *th) {
 	};
 
 	sbc_t sbc;
-	if ((errno = -sbc_init_a2dp(&sbc, 0, t->a2dp.configuration,
-					t->a2dp.codec->capabilities_size)) != 0) {
+	struct ba_device_codec codec = {
+		.d = t->d,
+		.name = "sbc-dec",
+		.config = t->a2dp.configuration,
+		.config_size = t->a2dp.codec->capabilities_size,
+		.state = &sbc,
+		.state_size = sizeof(sbc),
+		.destroy = PTHREAD_CLEANUP(sbc_finish),
+	};
+
+	/* reset cached SBC decoder or create a new one */
+	if (ba_device_codec_acquire(&codec) == 0)
+		errno = -sbc_reinit_a2dp(&sbc, 0, codec.config, codec.config_size);
+	else
+		errno = -sbc_init_a2dp(&sbc, 0, codec.config, codec.config_size);
+	if (errno != 0) {
 		error("Couldn't initialize SBC codec: %s", strerror(errno));
 		goto fail_init;
 	}
 
+	codec.ready = true;
+
 	ffb_t bt = { 0 };
 	ffb_t pcm = { 0 };
-	pthread_cleanup_push(PTHREAD_CLEANUP(sbc_finish), &sbc);
+	struct audio_plc plc = { 0 };
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_device_codec_release), &codec);
 	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
 	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
+	pthread_cleanup_push(PTHREAD_CLEANUP(audio_plc_free), &plc);
 
-	if (ffb_init_int16_t(&pcm, sbc_get_codesize(&sbc)) == -1 ||
-			ffb_init_uint8_t(&bt, t->mtu_read) == -1) {
+	const size_t sbc_frame_samples = sbc_get_codesize(&sbc) / sizeof(int16_t);
+	if (ffb_init_int16_t(&pcm, sbc_frame_samples) == -1 ||
+			ffb_init_uint8_t(&bt, t->mtu_read) == -1 ||
+			audio_plc_init(&plc, sizeof(int16_t), t->a2dp.pcm.channels, sbc_frame_samples) == -1) {
 		error("Couldn't create data buffers: %s", strerror(errno));
 		goto fail_ffb;
 	}
@@ -259,19 +333,28 @@ static void *a2dp_sbc_dec_thread(struct ba_transport_thread *th) {
 			continue;
 
 		const rtp_media_header_t *rtp_media_header;
-		if ((rtp_media_header = rtp_a2dp_payload(bt.data, &rtp_seq_number)) == NULL)
+		unsigned int missing;
+		if ((rtp_media_header = rtp_a2dp_payload(bt.data, &rtp_seq_number, &missing)) == NULL)
 			continue;
+		ba_transport_thread_stats_add(th, rtp_lost, missing);
 
 		const uint8_t *rtp_payload = (uint8_t *)(rtp_media_header + 1);
 		size_t rtp_payload_len = len - (rtp_payload - (uint8_t *)bt.data);
+		size_t frames = rtp_media_header->frame_count;
+
+		/* Fill the gap caused by lost packets. We assume that every lost
+		 * packet has carried the same number of SBC frames as this one. */
+		if (missing > 0 &&
+				io_pcm_conceal(&t->a2dp.pcm, &plc, pcm.data, missing * frames) == -1)
+			error("FIFO write error: %s", strerror(errno));
 
 		/* decode retrieved SBC frames */
-		size_t frames = rtp_media_header->frame_count;
 		while (frames--) {
 
 			ssize_t len;
 			size_t decoded;
 
+			trace_probe2(decode_begin, th, rtp_payload_len);
 			if ((len = sbc_decode(&sbc, rtp_payload, rtp_payload_len,
 							pcm.data, ffb_blen_in(&pcm), &decoded)) < 0) {
 				error("SBC decoding error: %s", strerror(-len));
@@ -289,7 +372,9 @@ static void *a2dp_sbc_dec_thread(struct ba_transport_thread *th) {
 			rtp_payload_len -= len;
 
 			const size_t samples = decoded / sizeof(int16_t);
+			trace_probe2(decode_end, th, samples);
 			io_pcm_scale(&t->a2dp.pcm, pcm.data, samples);
+			audio_plc_update(&plc, pcm.data, samples);
 			if (io_pcm_write(&t->a2dp.pcm, pcm.data, samples) == -1)
 				error("FIFO write error: %s", strerror(errno));
 
@@ -305,72 +390,11 @@ fail_ffb:
 	pthread_cleanup_pop(1);
 	pthread_cleanup_pop(1);
 	pthread_cleanup_pop(1);
-fail_init:
 	pthread_cleanup_pop(1);
-	return NULL;
-}
-
-#if DEBUG
-/**
- * Dump incoming BT data to a file. */
-__attribute__ ((unused))
-static void *a2dp_sink_dump(struct ba_transport_thread *th) {
-
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_thread_cleanup), th);
-
-	struct ba_transport *t = th->t;
-	struct io_poll io = { .timeout = -1 };
-	ffb_t bt = { 0 };
-	FILE *f = NULL;
-	char fname[64];
-	char *ptr;
-
-	sprintf(fname, "/tmp/ba-%s.dump", ba_transport_type_to_string(t->type));
-	for (ptr = fname; *ptr != '\0'; ptr++) {
-		*ptr = tolower(*ptr);
-		if (*ptr == ' ' || *ptr == '(' || *ptr == ')')
-			*ptr = '-';
-	}
-
-	debug("Opening BT dump file: %s", fname);
-	if ((f = fopen(fname, "wb")) == NULL) {
-		error("Couldn't create dump file: %s", strerror(errno));
-		goto fail_open;
-	}
-
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
-	pthread_cleanup_push(PTHREAD_CLEANUP(fclose), f);
-
-	if (ffb_init_uint8_t(&bt, t->mtu_read) == -1) {
-		error("Couldn't create data buffer: %s", strerror(errno));
-		goto fail_ffb;
-	}
-
-	debug_transport_thread_loop(th, "START");
-	for (ba_transport_thread_set_state_running(th);;) {
-		ssize_t len = ffb_blen_in(&bt);
-		if ((len = io_poll_and_read_bt(&io, th, bt.data, len)) <= 0) {
-			if (len == -1)
-				error("BT poll and read error: %s", strerror(errno));
-			goto fail;
-		}
-		debug("BT read: %zd", len);
-		fwrite(bt.data, 1, len, f);
-	}
-
-fail:
-	debug_transport_thread_loop(th, "EXIT");
-	ba_transport_thread_set_state_stopping(th);
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-fail_ffb:
-	pthread_cleanup_pop(1);
-	pthread_cleanup_pop(1);
-fail_open:
+fail_init:
 	pthread_cleanup_pop(1);
 	return NULL;
 }
-#endif
 
 int a2dp_sbc_transport_start(struct ba_transport *t) {
 
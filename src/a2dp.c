@@ -18,6 +18,7 @@
 
 #include "a2dp-codecs.h"
 #include "bluealsa.h"
+#include "codec-plugin.h"
 #include "codec-sbc.h"
 #include "hci.h"
 #include "shared/defs.h"
@@ -56,6 +57,12 @@ static const struct a2dp_channel_mode a2dp_sbc_channels[] = {
 	{ A2DP_CHM_JOINT_STEREO, 2, SBC_CHANNEL_MODE_JOINT_STEREO },
 };
 
+#define A2DP_SBC_CHANNELS_MASK ( \
+	SBC_CHANNEL_MODE_MONO | \
+	SBC_CHANNEL_MODE_DUAL_CHANNEL | \
+	SBC_CHANNEL_MODE_STEREO | \
+	SBC_CHANNEL_MODE_JOINT_STEREO)
+
 static const struct a2dp_sampling_freq a2dp_sbc_samplings[] = {
 	{ 16000, SBC_SAMPLING_FREQ_16000 },
 	{ 32000, SBC_SAMPLING_FREQ_32000 },
@@ -63,6 +70,12 @@ static const struct a2dp_sampling_freq a2dp_sbc_samplings[] = {
 	{ 48000, SBC_SAMPLING_FREQ_48000 },
 };
 
+#define A2DP_SBC_SAMPLINGS_MASK ( \
+	SBC_SAMPLING_FREQ_16000 | \
+	SBC_SAMPLING_FREQ_32000 | \
+	SBC_SAMPLING_FREQ_44100 | \
+	SBC_SAMPLING_FREQ_48000)
+
 static const a2dp_mpeg_t a2dp_mpeg_source = {
 	.layer =
 		MPEG_LAYER_MP3,
@@ -156,6 +169,12 @@ static const struct a2dp_channel_mode a2dp_mpeg_channels[] = {
 	{ A2DP_CHM_JOINT_STEREO, 2, MPEG_CHANNEL_MODE_JOINT_STEREO },
 };
 
+#define A2DP_MPEG_CHANNELS_MASK ( \
+	MPEG_CHANNEL_MODE_MONO | \
+	MPEG_CHANNEL_MODE_DUAL_CHANNEL | \
+	MPEG_CHANNEL_MODE_STEREO | \
+	MPEG_CHANNEL_MODE_JOINT_STEREO)
+
 static const struct a2dp_sampling_freq a2dp_mpeg_samplings[] = {
 	{ 16000, MPEG_SAMPLING_FREQ_16000 },
 	{ 22050, MPEG_SAMPLING_FREQ_22050 },
@@ -165,7 +184,15 @@ static const struct a2dp_sampling_freq a2dp_mpeg_samplings[] = {
 	{ 48000, MPEG_SAMPLING_FREQ_48000 },
 };
 
-static const a2dp_aac_t a2dp_aac = {
+#define A2DP_MPEG_SAMPLINGS_MASK ( \
+	MPEG_SAMPLING_FREQ_16000 | \
+	MPEG_SAMPLING_FREQ_22050 | \
+	MPEG_SAMPLING_FREQ_24000 | \
+	MPEG_SAMPLING_FREQ_32000 | \
+	MPEG_SAMPLING_FREQ_44100 | \
+	MPEG_SAMPLING_FREQ_48000)
+
+static a2dp_aac_t a2dp_aac = {
 	.object_type =
 		/* NOTE: AAC Long Term Prediction and AAC Scalable are
 		 *       not supported by the FDK-AAC library. */
@@ -196,6 +223,10 @@ static const struct a2dp_channel_mode a2dp_aac_channels[] = {
 	{ A2DP_CHM_STEREO, 2, AAC_CHANNELS_2 },
 };
 
+#define A2DP_AAC_CHANNELS_MASK ( \
+	AAC_CHANNELS_1 | \
+	AAC_CHANNELS_2)
+
 static const struct a2dp_sampling_freq a2dp_aac_samplings[] = {
 	{ 8000, AAC_SAMPLING_FREQ_8000 },
 	{ 11025, AAC_SAMPLING_FREQ_11025 },
@@ -211,6 +242,20 @@ static const struct a2dp_sampling_freq a2dp_aac_samplings[] = {
 	{ 96000, AAC_SAMPLING_FREQ_96000 },
 };
 
+#define A2DP_AAC_SAMPLINGS_MASK ( \
+	AAC_SAMPLING_FREQ_8000 | \
+	AAC_SAMPLING_FREQ_11025 | \
+	AAC_SAMPLING_FREQ_12000 | \
+	AAC_SAMPLING_FREQ_16000 | \
+	AAC_SAMPLING_FREQ_22050 | \
+	AAC_SAMPLING_FREQ_24000 | \
+	AAC_SAMPLING_FREQ_32000 | \
+	AAC_SAMPLING_FREQ_44100 | \
+	AAC_SAMPLING_FREQ_48000 | \
+	AAC_SAMPLING_FREQ_64000 | \
+	AAC_SAMPLING_FREQ_88200 | \
+	AAC_SAMPLING_FREQ_96000)
+
 static const a2dp_aptx_t a2dp_aptx = {
 	.info = A2DP_SET_VENDOR_ID_CODEC_ID(APTX_VENDOR_ID, APTX_CODEC_ID),
 	.channel_mode =
@@ -228,6 +273,9 @@ static const struct a2dp_channel_mode a2dp_aptx_channels[] = {
 	{ A2DP_CHM_STEREO, 2, APTX_CHANNEL_MODE_STEREO },
 };
 
+#define A2DP_APTX_CHANNELS_MASK ( \
+	APTX_CHANNEL_MODE_STEREO)
+
 static const struct a2dp_sampling_freq a2dp_aptx_samplings[] = {
 	{ 16000, APTX_SAMPLING_FREQ_16000 },
 	{ 32000, APTX_SAMPLING_FREQ_32000 },
@@ -235,6 +283,34 @@ static const struct a2dp_sampling_freq a2dp_aptx_samplings[] = {
 	{ 48000, APTX_SAMPLING_FREQ_48000 },
 };
 
+#define A2DP_APTX_SAMPLINGS_MASK ( \
+	APTX_SAMPLING_FREQ_16000 | \
+	APTX_SAMPLING_FREQ_32000 | \
+	APTX_SAMPLING_FREQ_44100 | \
+	APTX_SAMPLING_FREQ_48000)
+
+static const a2dp_aptx_ll_t a2dp_aptx_ll = {
+	.aptx.info = A2DP_SET_VENDOR_ID_CODEC_ID(APTX_LL_VENDOR_ID, APTX_LL_CODEC_ID),
+	.aptx.channel_mode =
+		APTX_CHANNEL_MODE_STEREO,
+	.aptx.frequency =
+		APTX_SAMPLING_FREQ_44100 |
+		APTX_SAMPLING_FREQ_48000,
+	/* NOTE: Voice back-channel and the encoder buffer level
+	 *       parameters (new capabilities) are not supported. */
+	.bidirect_link = 0,
+	.has_new_caps = 0,
+};
+
+static const struct a2dp_sampling_freq a2dp_aptx_ll_samplings[] = {
+	{ 44100, APTX_SAMPLING_FREQ_44100 },
+	{ 48000, APTX_SAMPLING_FREQ_48000 },
+};
+
+#define A2DP_APTX_LL_SAMPLINGS_MASK ( \
+	APTX_SAMPLING_FREQ_44100 | \
+	APTX_SAMPLING_FREQ_48000)
+
 static const a2dp_faststream_t a2dp_faststream = {
 	.info = A2DP_SET_VENDOR_ID_CODEC_ID(FASTSTREAM_VENDOR_ID, FASTSTREAM_CODEC_ID),
 	.direction = FASTSTREAM_DIRECTION_MUSIC | FASTSTREAM_DIRECTION_VOICE,
@@ -250,10 +326,17 @@ static const struct a2dp_sampling_freq a2dp_faststream_samplings_music[] = {
 	{ 48000, FASTSTREAM_SAMPLING_FREQ_MUSIC_48000 },
 };
 
+#define A2DP_FASTSTREAM_SAMPLINGS_MUSIC_MASK ( \
+	FASTSTREAM_SAMPLING_FREQ_MUSIC_44100 | \
+	FASTSTREAM_SAMPLING_FREQ_MUSIC_48000)
+
 static const struct a2dp_sampling_freq a2dp_faststream_samplings_voice[] = {
 	{ 16000, FASTSTREAM_SAMPLING_FREQ_VOICE_16000 },
 };
 
+#define A2DP_FASTSTREAM_SAMPLINGS_VOICE_MASK ( \
+	FASTSTREAM_SAMPLING_FREQ_VOICE_16000)
+
 static const a2dp_aptx_hd_t a2dp_aptx_hd = {
 	.aptx.info = A2DP_SET_VENDOR_ID_CODEC_ID(APTX_HD_VENDOR_ID, APTX_HD_CODEC_ID),
 	.aptx.channel_mode =
@@ -271,6 +354,9 @@ static const struct a2dp_channel_mode a2dp_aptx_hd_channels[] = {
 	{ A2DP_CHM_STEREO, 2, APTX_CHANNEL_MODE_STEREO },
 };
 
+#define A2DP_APTX_HD_CHANNELS_MASK ( \
+	APTX_CHANNEL_MODE_STEREO)
+
 static const struct a2dp_sampling_freq a2dp_aptx_hd_samplings[] = {
 	{ 16000, APTX_SAMPLING_FREQ_16000 },
 	{ 32000, APTX_SAMPLING_FREQ_32000 },
@@ -278,6 +364,12 @@ static const struct a2dp_sampling_freq a2dp_aptx_hd_samplings[] = {
 	{ 48000, APTX_SAMPLING_FREQ_48000 },
 };
 
+#define A2DP_APTX_HD_SAMPLINGS_MASK ( \
+	APTX_SAMPLING_FREQ_16000 | \
+	APTX_SAMPLING_FREQ_32000 | \
+	APTX_SAMPLING_FREQ_44100 | \
+	APTX_SAMPLING_FREQ_48000)
+
 static const a2dp_ldac_t a2dp_ldac = {
 	.info = A2DP_SET_VENDOR_ID_CODEC_ID(LDAC_VENDOR_ID, LDAC_CODEC_ID),
 	.channel_mode =
@@ -299,6 +391,11 @@ static const struct a2dp_channel_mode a2dp_ldac_channels[] = {
 	{ A2DP_CHM_STEREO, 2, LDAC_CHANNEL_MODE_STEREO },
 };
 
+#define A2DP_LDAC_CHANNELS_MASK ( \
+	LDAC_CHANNEL_MODE_MONO | \
+	LDAC_CHANNEL_MODE_DUAL | \
+	LDAC_CHANNEL_MODE_STEREO)
+
 static const struct a2dp_sampling_freq a2dp_ldac_samplings[] = {
 	{ 44100, LDAC_SAMPLING_FREQ_44100 },
 	{ 48000, LDAC_SAMPLING_FREQ_48000 },
@@ -306,6 +403,12 @@ static const struct a2dp_sampling_freq a2dp_ldac_samplings[] = {
 	{ 96000, LDAC_SAMPLING_FREQ_96000 },
 };
 
+#define A2DP_LDAC_SAMPLINGS_MASK ( \
+	LDAC_SAMPLING_FREQ_44100 | \
+	LDAC_SAMPLING_FREQ_48000 | \
+	LDAC_SAMPLING_FREQ_88200 | \
+	LDAC_SAMPLING_FREQ_96000)
+
 static const struct a2dp_codec a2dp_codec_source_sbc = {
 	.dir = A2DP_SOURCE,
 	.codec_id = A2DP_CODEC_SBC,
@@ -313,8 +416,10 @@ static const struct a2dp_codec a2dp_codec_source_sbc = {
 	.capabilities_size = sizeof(a2dp_sbc),
 	.channels[0] = a2dp_sbc_channels,
 	.channels_size[0] = ARRAYSIZE(a2dp_sbc_channels),
+	.channels_mask[0] = A2DP_SBC_CHANNELS_MASK,
 	.samplings[0] = a2dp_sbc_samplings,
 	.samplings_size[0] = ARRAYSIZE(a2dp_sbc_samplings),
+	.samplings_mask[0] = A2DP_SBC_SAMPLINGS_MASK,
 };
 
 static const struct a2dp_codec a2dp_codec_sink_sbc = {
@@ -324,8 +429,10 @@ static const struct a2dp_codec a2dp_codec_sink_sbc = {
 	.capabilities_size = sizeof(a2dp_sbc),
 	.channels[0] = a2dp_sbc_channels,
 	.channels_size[0] = ARRAYSIZE(a2dp_sbc_channels),
+	.channels_mask[0] = A2DP_SBC_CHANNELS_MASK,
 	.samplings[0] = a2dp_sbc_samplings,
 	.samplings_size[0] = ARRAYSIZE(a2dp_sbc_samplings),
+	.samplings_mask[0] = A2DP_SBC_SAMPLINGS_MASK,
 };
 
 __attribute__ ((unused))
@@ -336,8 +443,10 @@ static const struct a2dp_codec a2dp_codec_source_mpeg = {
 	.capabilities_size = sizeof(a2dp_mpeg_source),
 	.channels[0] = a2dp_mpeg_channels,
 	.channels_size[0] = ARRAYSIZE(a2dp_mpeg_channels),
+	.channels_mask[0] = A2DP_MPEG_CHANNELS_MASK,
 	.samplings[0] = a2dp_mpeg_samplings,
 	.samplings_size[0] = ARRAYSIZE(a2dp_mpeg_samplings),
+	.samplings_mask[0] = A2DP_MPEG_SAMPLINGS_MASK,
 };
 
 __attribute__ ((unused))
@@ -348,8 +457,10 @@ static const struct a2dp_codec a2dp_codec_sink_mpeg = {
 	.capabilities_size = sizeof(a2dp_mpeg_sink),
 	.channels[0] = a2dp_mpeg_channels,
 	.channels_size[0] = ARRAYSIZE(a2dp_mpeg_channels),
+	.channels_mask[0] = A2DP_MPEG_CHANNELS_MASK,
 	.samplings[0] = a2dp_mpeg_samplings,
 	.samplings_size[0] = ARRAYSIZE(a2dp_mpeg_samplings),
+	.samplings_mask[0] = A2DP_MPEG_SAMPLINGS_MASK,
 };
 
 __attribute__ ((unused))
@@ -360,8 +471,10 @@ static const struct a2dp_codec a2dp_codec_source_aac = {
 	.capabilities_size = sizeof(a2dp_aac),
 	.channels[0] = a2dp_aac_channels,
 	.channels_size[0] = ARRAYSIZE(a2dp_aac_channels),
+	.channels_mask[0] = A2DP_AAC_CHANNELS_MASK,
 	.samplings[0] = a2dp_aac_samplings,
 	.samplings_size[0] = ARRAYSIZE(a2dp_aac_samplings),
+	.samplings_mask[0] = A2DP_AAC_SAMPLINGS_MASK,
 };
 
 __attribute__ ((unused))
@@ -372,8 +485,10 @@ static const struct a2dp_codec a2dp_codec_sink_aac = {
 	.capabilities_size = sizeof(a2dp_aac),
 	.channels[0] = a2dp_aac_channels,
 	.channels_size[0] = ARRAYSIZE(a2dp_aac_channels),
+	.channels_mask[0] = A2DP_AAC_CHANNELS_MASK,
 	.samplings[0] = a2dp_aac_samplings,
 	.samplings_size[0] = ARRAYSIZE(a2dp_aac_samplings),
+	.samplings_mask[0] = A2DP_AAC_SAMPLINGS_MASK,
 };
 
 __attribute__ ((unused))
@@ -384,8 +499,10 @@ static const struct a2dp_codec a2dp_codec_source_aptx = {
 	.capabilities_size = sizeof(a2dp_aptx),
 	.channels[0] = a2dp_aptx_channels,
 	.channels_size[0] = ARRAYSIZE(a2dp_aptx_channels),
+	.channels_mask[0] = A2DP_APTX_CHANNELS_MASK,
 	.samplings[0] = a2dp_aptx_samplings,
 	.samplings_size[0] = ARRAYSIZE(a2dp_aptx_samplings),
+	.samplings_mask[0] = A2DP_APTX_SAMPLINGS_MASK,
 };
 
 __attribute__ ((unused))
@@ -396,8 +513,38 @@ static const struct a2dp_codec a2dp_codec_sink_aptx = {
 	.capabilities_size = sizeof(a2dp_aptx),
 	.channels[0] = a2dp_aptx_channels,
 	.channels_size[0] = ARRAYSIZE(a2dp_aptx_channels),
+	.channels_mask[0] = A2DP_APTX_CHANNELS_MASK,
 	.samplings[0] = a2dp_aptx_samplings,
 	.samplings_size[0] = ARRAYSIZE(a2dp_aptx_samplings),
+	.samplings_mask[0] = A2DP_APTX_SAMPLINGS_MASK,
+};
+
+__attribute__ ((unused))
+static const struct a2dp_codec a2dp_codec_source_aptx_ll = {
+	.dir = A2DP_SOURCE,
+	.codec_id = A2DP_CODEC_VENDOR_APTX_LL,
+	.capabilities = &a2dp_aptx_ll,
+	.capabilities_size = sizeof(a2dp_aptx_ll),
+	.channels[0] = a2dp_aptx_channels,
+	.channels_size[0] = ARRAYSIZE(a2dp_aptx_channels),
+	.channels_mask[0] = A2DP_APTX_CHANNELS_MASK,
+	.samplings[0] = a2dp_aptx_ll_samplings,
+	.samplings_size[0] = ARRAYSIZE(a2dp_aptx_ll_samplings),
+	.samplings_mask[0] = A2DP_APTX_LL_SAMPLINGS_MASK,
+};
+
+__attribute__ ((unused))
+static const struct a2dp_codec a2dp_codec_sink_aptx_ll = {
+	.dir = A2DP_SINK,
+	.codec_id = A2DP_CODEC_VENDOR_APTX_LL,
+	.capabilities = &a2dp_aptx_ll,
+	.capabilities_size = sizeof(a2dp_aptx_ll),
+	.channels[0] = a2dp_aptx_channels,
+	.channels_size[0] = ARRAYSIZE(a2dp_aptx_channels),
+	.channels_mask[0] = A2DP_APTX_CHANNELS_MASK,
+	.samplings[0] = a2dp_aptx_ll_samplings,
+	.samplings_size[0] = ARRAYSIZE(a2dp_aptx_ll_samplings),
+	.samplings_mask[0] = A2DP_APTX_LL_SAMPLINGS_MASK,
 };
 
 __attribute__ ((unused))
@@ -408,8 +555,10 @@ static const struct a2dp_codec a2dp_codec_source_aptx_hd = {
 	.capabilities_size = sizeof(a2dp_aptx_hd),
 	.channels[0] = a2dp_aptx_hd_channels,
 	.channels_size[0] = ARRAYSIZE(a2dp_aptx_hd_channels),
+	.channels_mask[0] = A2DP_APTX_HD_CHANNELS_MASK,
 	.samplings[0] = a2dp_aptx_hd_samplings,
 	.samplings_size[0] = ARRAYSIZE(a2dp_aptx_hd_samplings),
+	.samplings_mask[0] = A2DP_APTX_HD_SAMPLINGS_MASK,
 };
 
 __attribute__ ((unused))
@@ -420,8 +569,10 @@ static const struct a2dp_codec a2dp_codec_sink_aptx_hd = {
 	.capabilities_size = sizeof(a2dp_aptx_hd),
 	.channels[0] = a2dp_aptx_hd_channels,
 	.channels_size[0] = ARRAYSIZE(a2dp_aptx_hd_channels),
+	.channels_mask[0] = A2DP_APTX_HD_CHANNELS_MASK,
 	.samplings[0] = a2dp_aptx_hd_samplings,
 	.samplings_size[0] = ARRAYSIZE(a2dp_aptx_hd_samplings),
+	.samplings_mask[0] = A2DP_APTX_HD_SAMPLINGS_MASK,
 };
 
 __attribute__ ((unused))
@@ -433,8 +584,10 @@ static const struct a2dp_codec a2dp_codec_source_faststream = {
 	.capabilities_size = sizeof(a2dp_faststream),
 	.samplings[0] = a2dp_faststream_samplings_music,
 	.samplings_size[0] = ARRAYSIZE(a2dp_faststream_samplings_music),
+	.samplings_mask[0] = A2DP_FASTSTREAM_SAMPLINGS_MUSIC_MASK,
 	.samplings[1] = a2dp_faststream_samplings_voice,
 	.samplings_size[1] = ARRAYSIZE(a2dp_faststream_samplings_voice),
+	.samplings_mask[1] = A2DP_FASTSTREAM_SAMPLINGS_VOICE_MASK,
 };
 
 __attribute__ ((unused))
@@ -446,8 +599,10 @@ static const struct a2dp_codec a2dp_codec_sink_faststream = {
 	.capabilities_size = sizeof(a2dp_faststream),
 	.samplings[0] = a2dp_faststream_samplings_music,
 	.samplings_size[0] = ARRAYSIZE(a2dp_faststream_samplings_music),
+	.samplings_mask[0] = A2DP_FASTSTREAM_SAMPLINGS_MUSIC_MASK,
 	.samplings[1] = a2dp_faststream_samplings_voice,
 	.samplings_size[1] = ARRAYSIZE(a2dp_faststream_samplings_voice),
+	.samplings_mask[1] = A2DP_FASTSTREAM_SAMPLINGS_VOICE_MASK,
 };
 
 __attribute__ ((unused))
@@ -458,8 +613,10 @@ static const struct a2dp_codec a2dp_codec_source_ldac = {
 	.capabilities_size = sizeof(a2dp_ldac),
 	.channels[0] = a2dp_ldac_channels,
 	.channels_size[0] = ARRAYSIZE(a2dp_ldac_channels),
+	.channels_mask[0] = A2DP_LDAC_CHANNELS_MASK,
 	.samplings[0] = a2dp_ldac_samplings,
 	.samplings_size[0] = ARRAYSIZE(a2dp_ldac_samplings),
+	.samplings_mask[0] = A2DP_LDAC_SAMPLINGS_MASK,
 };
 
 __attribute__ ((unused))
@@ -470,11 +627,15 @@ static const struct a2dp_codec a2dp_codec_sink_ldac = {
 	.capabilities_size = sizeof(a2dp_ldac),
 	.channels[0] = a2dp_ldac_channels,
 	.channels_size[0] = ARRAYSIZE(a2dp_ldac_channels),
+	.channels_mask[0] = A2DP_LDAC_CHANNELS_MASK,
 	.samplings[0] = a2dp_ldac_samplings,
 	.samplings_size[0] = ARRAYSIZE(a2dp_ldac_samplings),
+	.samplings_mask[0] = A2DP_LDAC_SAMPLINGS_MASK,
 };
 
-const struct a2dp_codec *a2dp_codecs[] = {
+/* Spare slots at the end of this list are filled with the codecs provided
+ * by the loaded codec plug-ins during the initialization. */
+const struct a2dp_codec *a2dp_codecs[A2DP_CODECS_MAX + 1] = {
 #if ENABLE_LDAC
 	&a2dp_codec_source_ldac,
 # if HAVE_LDAC_DECODE
@@ -491,6 +652,10 @@ const struct a2dp_codec *a2dp_codecs[] = {
 	&a2dp_codec_source_aptx,
 # if HAVE_APTX_DECODE
 	&a2dp_codec_sink_aptx,
+# endif
+	&a2dp_codec_source_aptx_ll,
+# if HAVE_APTX_DECODE
+	&a2dp_codec_sink_aptx_ll,
 # endif
 #endif
 #if ENABLE_FASTSTREAM
@@ -514,6 +679,33 @@ const struct a2dp_codec *a2dp_codecs[] = {
 	NULL,
 };
 
+/**
+ * Adjust A2DP codecs capabilities according to the global configuration.
+ *
+ * This function shall be called before the registration of A2DP Stream
+ * End-Points and after the global configuration has been set up. */
+void a2dp_codecs_init(void) {
+#if ENABLE_AAC
+	if (config.aac_low_delay)
+		a2dp_aac.object_type |= AAC_OBJECT_TYPE_MPEG4_AAC_ELD2;
+#endif
+
+	size_t n;
+	for (n = 0; a2dp_codecs[n] != NULL; n++)
+		continue;
+
+	const struct codec_plugin *p;
+	size_t i;
+
+	for (i = 0; (p = codec_plugin_get(i)) != NULL; i++) {
+		if (p->supported[A2DP_SOURCE] && n < A2DP_CODECS_MAX)
+			a2dp_codecs[n++] = &p->codecs[A2DP_SOURCE];
+		if (p->supported[A2DP_SINK] && n < A2DP_CODECS_MAX)
+			a2dp_codecs[n++] = &p->codecs[A2DP_SINK];
+	}
+
+}
+
 /**
  * Lookup codec configuration for given stream direction.
  *
@@ -523,7 +715,7 @@ const struct a2dp_codec *a2dp_codecs[] = {
  *   configuration structure. Otherwise, NULL is returned. */
 const struct a2dp_codec *a2dp_codec_lookup(uint16_t codec_id, enum a2dp_dir dir) {
 	size_t i;
-	for (i = 0; i < ARRAYSIZE(a2dp_codecs) - 1; i++)
+	for (i = 0; a2dp_codecs[i] != NULL; i++)
 		if (a2dp_codecs[i]->dir == dir &&
 				a2dp_codecs[i]->codec_id == codec_id)
 			return a2dp_codecs[i];
@@ -638,30 +830,36 @@ uint16_t a2dp_get_vendor_codec_id(const void *capabilities, size_t size) {
 		} break;
 	}
 
+	const struct codec_plugin *plugin;
+	if ((plugin = codec_plugin_lookup_vendor(vendor_id, codec_id)) != NULL)
+		return plugin->codec_id;
+
 	hexdump("Unknown vendor codec", capabilities, size);
 
 	errno = ENOTSUP;
 	return 0xFFFF;
 }
 
+/**
+ * Check whether given configuration value is a single bit of the mask. */
+static bool a2dp_codec_check_mask(
+		unsigned int mask,
+		unsigned int capabilities) {
+	return capabilities != 0 &&
+		(capabilities & (capabilities - 1)) == 0 &&
+		(capabilities & ~mask) == 0;
+}
+
 /**
  * Check whether channel mode configuration is valid. */
 static bool a2dp_codec_check_channel_mode(
 		const struct a2dp_codec *codec,
 		unsigned int capabilities,
 		bool backchannel) {
-
 	const size_t slot = backchannel ? 1 : 0;
-	size_t i;
-
 	if (codec->channels_size[slot] == 0)
 		return true;
-
-	for (i = 0; i < codec->channels_size[slot]; i++)
-		if (capabilities == codec->channels[slot][i].value)
-			return true;
-
-	return false;
+	return a2dp_codec_check_mask(codec->channels_mask[slot], capabilities);
 }
 
 /**
@@ -670,18 +868,10 @@ static bool a2dp_codec_check_sampling_freq(
 		const struct a2dp_codec *codec,
 		unsigned int capabilities,
 		bool backchannel) {
-
 	const size_t slot = backchannel ? 1 : 0;
-	size_t i;
-
 	if (codec->samplings_size[slot] == 0)
 		return true;
-
-	for (i = 0; i < codec->samplings_size[slot]; i++)
-		if (capabilities == codec->samplings[slot][i].value)
-			return true;
-
-	return false;
+	return a2dp_codec_check_mask(codec->samplings_mask[slot], capabilities);
 }
 
 /**
@@ -705,6 +895,16 @@ uint32_t a2dp_check_configuration(
 	if (size != codec->capabilities_size)
 		return A2DP_CHECK_ERR_SIZE;
 
+	const struct codec_plugin *plugin;
+	if ((plugin = codec_plugin_lookup(codec->codec_id)) != NULL) {
+		struct ba_a2dp_plugin_stream stream;
+		if (plugin->abi->get_stream(configuration, size, &stream) == -1) {
+			debug("Invalid %s configuration", plugin->abi->name);
+			return A2DP_CHECK_ERR_PLUGIN;
+		}
+		return A2DP_CHECK_OK;
+	}
+
 	switch (codec->codec_id) {
 	case A2DP_CODEC_SBC: {
 
@@ -766,7 +966,8 @@ uint32_t a2dp_check_configuration(
 		if (cap->object_type != AAC_OBJECT_TYPE_MPEG2_AAC_LC &&
 				cap->object_type != AAC_OBJECT_TYPE_MPEG4_AAC_LC &&
 				cap->object_type != AAC_OBJECT_TYPE_MPEG4_AAC_LTP &&
-				cap->object_type != AAC_OBJECT_TYPE_MPEG4_AAC_SCA) {
+				cap->object_type != AAC_OBJECT_TYPE_MPEG4_AAC_SCA &&
+				cap->object_type != AAC_OBJECT_TYPE_MPEG4_AAC_ELD2) {
 			debug("Invalid AAC object type: %#x", cap->object_type);
 			ret |= A2DP_CHECK_ERR_AAC_OBJ_TYPE;
 		}
@@ -782,6 +983,12 @@ uint32_t a2dp_check_configuration(
 		cap_freq = cap->frequency;
 		break;
 	}
+	case A2DP_CODEC_VENDOR_APTX_LL: {
+		const a2dp_aptx_ll_t *cap = configuration;
+		cap_chm = cap->aptx.channel_mode;
+		cap_freq = cap->aptx.frequency;
+		break;
+	}
 #endif
 
 #if ENABLE_APTX_HD
@@ -887,6 +1094,8 @@ int a2dp_filter_capabilities(
 #if ENABLE_APTX
 	case A2DP_CODEC_VENDOR_APTX:
 		break;
+	case A2DP_CODEC_VENDOR_APTX_LL:
+		break;
 #endif
 #if ENABLE_APTX_HD
 	case A2DP_CODEC_VENDOR_APTX_HD:
@@ -901,6 +1110,9 @@ int a2dp_filter_capabilities(
 		break;
 #endif
 	default:
+		/* codec plug-ins rely on the capabilities mask only */
+		if (codec_plugin_lookup(codec->codec_id) != NULL)
+			break;
 		g_assert_not_reached();
 	}
 
@@ -918,6 +1130,10 @@ static unsigned int a2dp_codec_select_channel_mode(
 	const size_t slot = backchannel ? 1 : 0;
 	size_t i;
 
+	/* bail out early if none of our channel modes is supported */
+	if ((capabilities & codec->channels_mask[slot]) == 0)
+		return 0;
+
 	/* If monophonic sound has been forced, check whether given codec supports
 	 * such a channel mode. Since mono channel mode shall be stored at index 0
 	 * we can simply check for its existence with a simple index lookup. */
@@ -944,6 +1160,10 @@ static unsigned int a2dp_codec_select_sampling_freq(
 	const size_t slot = backchannel ? 1 : 0;
 	size_t i;
 
+	/* bail out early if none of our sampling frequencies is supported */
+	if ((capabilities & codec->samplings_mask[slot]) == 0)
+		return 0;
+
 	if (config.a2dp.force_44100)
 		for (i = 0; i < codec->samplings_size[slot]; i++)
 			if (codec->samplings[slot][i].frequency == 44100) {
@@ -960,6 +1180,30 @@ static unsigned int a2dp_codec_select_sampling_freq(
 	return 0;
 }
 
+/**
+ * Remove sampling frequencies higher than the given limit from the
+ * capabilities, unless there would be no frequency left. */
+__attribute__ ((unused))
+static unsigned int a2dp_codec_limit_sampling_freq(
+		const struct a2dp_codec *codec,
+		unsigned int capabilities,
+		unsigned int max) {
+
+	unsigned int mask = 0;
+	size_t i;
+
+	if (max == 0)
+		return capabilities;
+
+	for (i = 0; i < codec->samplings_size[0]; i++)
+		if (codec->samplings[0][i].frequency <= max)
+			mask |= codec->samplings[0][i].value;
+
+	if ((capabilities & mask) == 0)
+		return capabilities;
+	return capabilities & mask;
+}
+
 /**
  * Select (best) A2DP codec configuration. */
 int a2dp_select_configuration(
@@ -972,6 +1216,15 @@ int a2dp_select_configuration(
 		return errno = EINVAL, -1;
 	}
 
+	const struct codec_plugin *plugin;
+	if ((plugin = codec_plugin_lookup(codec->codec_id)) != NULL) {
+		if (plugin->abi->select_configuration(capabilities, size) == -1) {
+			error("%s: No supported configuration", plugin->abi->name);
+			goto fail;
+		}
+		return 0;
+	}
+
 	switch (codec->codec_id) {
 	case A2DP_CODEC_SBC: {
 
@@ -1073,7 +1326,9 @@ int a2dp_select_configuration(
 		unsigned int cap_chm = cap->channels;
 		unsigned int cap_freq = AAC_GET_FREQUENCY(*cap);
 
-		if (cap->object_type & AAC_OBJECT_TYPE_MPEG4_AAC_SCA)
+		if (config.aac_low_delay && cap->object_type & AAC_OBJECT_TYPE_MPEG4_AAC_ELD2)
+			cap->object_type = AAC_OBJECT_TYPE_MPEG4_AAC_ELD2;
+		else if (cap->object_type & AAC_OBJECT_TYPE_MPEG4_AAC_SCA)
 			cap->object_type = AAC_OBJECT_TYPE_MPEG4_AAC_SCA;
 		else if (cap->object_type & AAC_OBJECT_TYPE_MPEG4_AAC_LTP)
 			cap->object_type = AAC_OBJECT_TYPE_MPEG4_AAC_LTP;
@@ -1123,6 +1378,28 @@ int a2dp_select_configuration(
 			goto fail;
 		}
 
+		break;
+	}
+	case A2DP_CODEC_VENDOR_APTX_LL: {
+
+		a2dp_aptx_ll_t *cap = capabilities;
+		unsigned int cap_chm = cap->aptx.channel_mode;
+		unsigned int cap_freq = cap->aptx.frequency;
+
+		if ((cap->aptx.channel_mode = a2dp_codec_select_channel_mode(codec, cap_chm, false)) == 0) {
+			error("apt-X LL: No supported channel modes: %#x", cap_chm);
+			goto fail;
+		}
+
+		if ((cap->aptx.frequency = a2dp_codec_select_sampling_freq(codec, cap_freq, false)) == 0) {
+			error("apt-X LL: No supported sampling frequencies: %#x", cap_freq);
+			goto fail;
+		}
+
+		/* back-channel and new capabilities are not supported */
+		cap->bidirect_link = 0;
+		cap->has_new_caps = 0;
+
 		break;
 	}
 #endif
@@ -1185,7 +1462,11 @@ int a2dp_select_configuration(
 			goto fail;
 		}
 
-		if ((cap->frequency = a2dp_codec_select_sampling_freq(codec, cap_freq, false)) == 0) {
+		/* avoid sampling frequencies which this host can not sustain */
+		const unsigned int cap_freq_limited = a2dp_codec_limit_sampling_freq(
+				codec, cap_freq, config.ldac_max_sampling);
+
+		if ((cap->frequency = a2dp_codec_select_sampling_freq(codec, cap_freq_limited, false)) == 0) {
 			error("LDAC: No supported sampling frequencies: %#x", cap_freq);
 			goto fail;
 		}
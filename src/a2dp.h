@@ -59,6 +59,11 @@ struct a2dp_codec {
 	/* list of supported sampling frequencies */
 	const struct a2dp_sampling_freq *samplings[2];
 	size_t samplings_size[2];
+	/* Bit-masks of all capability values from the lists above. These masks
+	 * are defined at build time, so checking whether given configuration is
+	 * supported is a single bit-wise operation. */
+	uint16_t channels_mask[2];
+	uint16_t samplings_mask[2];
 };
 
 /**
@@ -75,9 +80,16 @@ struct a2dp_sep {
 	void *configuration;
 };
 
+/**
+ * The maximal number of A2DP codecs, including the ones provided by the
+ * codec plug-ins. */
+#define A2DP_CODECS_MAX 48
+
 /* NULL-terminated list of available A2DP codecs */
 extern const struct a2dp_codec *a2dp_codecs[];
 
+void a2dp_codecs_init(void);
+
 const struct a2dp_codec *a2dp_codec_lookup(
 		uint16_t codec_id,
 		enum a2dp_dir dir);
@@ -108,6 +120,7 @@ uint16_t a2dp_get_vendor_codec_id(
 #define A2DP_CHECK_ERR_MPEG_LAYER        (1 << 7)
 #define A2DP_CHECK_ERR_AAC_OBJ_TYPE      (1 << 8)
 #define A2DP_CHECK_ERR_FASTSTREAM_DIR    (1 << 9)
+#define A2DP_CHECK_ERR_PLUGIN            (1 << 10)
 
 uint32_t a2dp_check_configuration(
 		const struct a2dp_codec *codec,
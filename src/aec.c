@@ -0,0 +1,238 @@
+/*
+ * BlueALSA - aec.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "aec.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The step size of the NLMS filter adaptation. */
+#define AEC_NLMS_MU 0.5f
+
+/**
+ * The regularization of the NLMS step size normalization, expressed as the
+ * power of a single far-end sample (normalized to [-1, 1) range). Without
+ * it the adaptation would be unstable for very quiet far-end signal. */
+#define AEC_NLMS_DELTA 1e-6
+
+/**
+ * The Geigel double-talk detector threshold. The near-end signal louder
+ * than the far-end peak multiplied by this factor can not be an echo. */
+#define AEC_GEIGEL_THRESHOLD 0.5f
+
+/**
+ * The time for which the adaptation is frozen after the double-talk. */
+#define AEC_GEIGEL_HANGOVER_MS 30
+
+/**
+ * The noise suppressor parameters: the over-subtraction factor and the
+ * maximal attenuation (power gain floor). */
+#define AEC_NS_OVERSUB 2.0f
+#define AEC_NS_FLOOR 0.01f
+
+static float aec_time_constant(unsigned int rate, double ms) {
+	return 1 - exp(-1000.0 / (rate * ms));
+}
+
+/**
+ * Initialize acoustic echo canceller.
+ *
+ * @param a Pointer to the AEC structure.
+ * @param rate The sampling frequency of both signals.
+ * @param ns If true, the noise suppression is enabled as well.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int aec_init(struct aec *a, unsigned int rate, bool ns) {
+
+	memset(a, 0, sizeof(*a));
+
+	if (rate == 0)
+		return errno = EINVAL, -1;
+
+	if ((a->taps = rate * AEC_TAIL_MS / 1000) > AEC_TAPS_MAX)
+		a->taps = AEC_TAPS_MAX;
+	/* make the filter length suitable for the unrolled convolution */
+	a->taps -= a->taps % 4;
+	a->ref_capacity = rate * AEC_REF_MS / 1000;
+
+	if ((a->w = malloc(sizeof(*a->w) * a->taps)) == NULL ||
+			(a->x = malloc(sizeof(*a->x) * a->taps * 2)) == NULL ||
+			(a->ref = malloc(sizeof(*a->ref) * a->ref_capacity)) == NULL) {
+		aec_free(a);
+		return -1;
+	}
+
+	/* The far-end peak shall decay by 20 dB over the filter window. */
+	a->peak_decay = exp(log(0.1) / a->taps);
+	a->dt_hangover = rate * AEC_GEIGEL_HANGOVER_MS / 1000;
+
+	a->ns = ns;
+	a->ns_attack = aec_time_constant(rate, 10);
+	a->ns_release = aec_time_constant(rate, 50);
+	/* let the noise floor estimation rise by 6 dB per second */
+	a->ns_rise = exp(log(4.0) / rate);
+
+	aec_reset(a);
+	return 0;
+}
+
+/**
+ * Free resources allocated by the aec_init(). */
+void aec_free(struct aec *a) {
+	free(a->w);
+	a->w = NULL;
+	free(a->x);
+	a->x = NULL;
+	free(a->ref);
+	a->ref = NULL;
+}
+
+/**
+ * Reset echo canceller state.
+ *
+ * The estimated echo path is lost, so the filter has to converge again. */
+void aec_reset(struct aec *a) {
+	memset(a->w, 0, sizeof(*a->w) * a->taps);
+	memset(a->x, 0, sizeof(*a->x) * a->taps * 2);
+	a->pos = 0;
+	a->energy = 0;
+	a->peak = 0;
+	a->dt_hold = 0;
+	a->ref_len = 0;
+	a->ns_level = 0;
+	/* start with the noise floor of -50 dBFS */
+	a->ns_noise = 1e-5;
+	a->ns_gain = 1;
+}
+
+/**
+ * Queue the far-end signal.
+ *
+ * The far-end signal shall be queued at the time it is played back, e.g.
+ * when it is written to the BT socket. If there is not enough space in the
+ * queue, the oldest samples are discarded.
+ *
+ * @param a Pointer to initialized AEC structure.
+ * @param buffer Address of the buffer with the far-end signal.
+ * @param samples The number of samples in the buffer. */
+void aec_push_ref(struct aec *a, const int16_t *buffer, size_t samples) {
+
+	if (samples > a->ref_capacity) {
+		buffer += samples - a->ref_capacity;
+		samples = a->ref_capacity;
+	}
+
+	const size_t space = a->ref_capacity - a->ref_len;
+	if (samples > space) {
+		const size_t drop = samples - space;
+		memmove(a->ref, &a->ref[drop], sizeof(*a->ref) * (a->ref_len - drop));
+		a->ref_len -= drop;
+	}
+
+	memcpy(&a->ref[a->ref_len], buffer, sizeof(*a->ref) * samples);
+	a->ref_len += samples;
+
+}
+
+/**
+ * Suppress the noise in a single sample of the near-end signal. */
+static float aec_ns_process(struct aec *a, float s) {
+
+	const float p = s * s;
+	a->ns_level += a->ns_attack * (p - a->ns_level);
+
+	/* The noise floor follows the signal level downwards quickly, and it
+	 * rises slowly, so the speech will not be mistaken for the noise. */
+	if (a->ns_level < a->ns_noise)
+		a->ns_noise += a->ns_release * (a->ns_level - a->ns_noise);
+	else
+		a->ns_noise *= a->ns_rise;
+
+	float gain = 1 - AEC_NS_OVERSUB * a->ns_noise / (a->ns_level + 1e-12f);
+	if (gain < AEC_NS_FLOOR)
+		gain = AEC_NS_FLOOR;
+
+	a->ns_gain += a->ns_attack * (sqrtf(gain) - a->ns_gain);
+	return s * a->ns_gain;
+}
+
+/**
+ * Cancel the echo of the far-end signal in the near-end signal.
+ *
+ * Every processed near-end sample consumes one queued far-end sample. If
+ * the queue is empty, the far-end signal is assumed to be silent.
+ *
+ * @param a Pointer to initialized AEC structure.
+ * @param buffer Address of the buffer with the near-end signal, which will
+ *   be replaced with the processed signal.
+ * @param samples The number of samples in the buffer. */
+void aec_process(struct aec *a, int16_t *buffer, size_t samples) {
+
+	const unsigned int taps = a->taps;
+	float * restrict w = a->w;
+	size_t ref_used = 0;
+
+	for (size_t n = 0; n < samples; n++) {
+
+		float r = 0;
+		if (ref_used < a->ref_len)
+			r = a->ref[ref_used++] / 32768.0f;
+
+		/* Store the far-end sample in both halves of the mirrored history,
+		 * so the filter window is always available as a contiguous array.
+		 * The overwritten sample is the one leaving the window. */
+		a->pos = a->pos == 0 ? taps - 1 : a->pos - 1;
+		const float old = a->x[a->pos];
+		a->x[a->pos] = a->x[a->pos + taps] = r;
+		if ((a->energy += r * r - old * old) < 0)
+			a->energy = 0;
+
+		const float * restrict x = &a->x[a->pos];
+		const float d = buffer[n] / 32768.0f;
+
+		/* Independent partial sums break the dependency chain of the float
+		 * accumulator, so the convolution can be pipelined or vectorized. */
+		float y0 = 0, y1 = 0, y2 = 0, y3 = 0;
+		for (unsigned int k = 0; k < taps; k += 4) {
+			y0 += w[k + 0] * x[k + 0];
+			y1 += w[k + 1] * x[k + 1];
+			y2 += w[k + 2] * x[k + 2];
+			y3 += w[k + 3] * x[k + 3];
+		}
+		const float y = (y0 + y1) + (y2 + y3);
+
+		const float e = d - y;
+
+		if ((a->peak *= a->peak_decay) < fabsf(r))
+			a->peak = fabsf(r);
+
+		if (fabsf(d) > AEC_GEIGEL_THRESHOLD * a->peak)
+			a->dt_hold = a->dt_hangover;
+		else if (a->dt_hold > 0)
+			a->dt_hold--;
+		else {
+			const float g = AEC_NLMS_MU * e / (a->energy + taps * AEC_NLMS_DELTA);
+			for (unsigned int k = 0; k < taps; k++)
+				w[k] += g * x[k];
+		}
+
+		float v = a->ns ? aec_ns_process(a, e) : e;
+		v = roundf(v * 32768);
+		buffer[n] = v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : v;
+
+	}
+
+	a->ref_len -= ref_used;
+	memmove(a->ref, &a->ref[ref_used], sizeof(*a->ref) * a->ref_len);
+
+}
@@ -0,0 +1,92 @@
+/*
+ * BlueALSA - aec.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_AEC_H_
+#define BLUEALSA_AEC_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The length of the echo path covered by the adaptive filter. The far-end
+ * signal is queued when it is written to the BT socket, so the filter has
+ * to cover the echo path of the remote device only. */
+#define AEC_TAIL_MS 64
+
+/**
+ * The maximal number of the adaptive filter taps. The echo canceller runs
+ * in the SCO IO thread, so the cost of processing a single sample shall not
+ * grow with the sampling frequency (e.g. for the super-wideband speech). */
+#define AEC_TAPS_MAX 1024
+
+/**
+ * The maximal amount of the far-end signal which can be queued before it
+ * is aligned with the near-end signal. */
+#define AEC_REF_MS 500
+
+/**
+ * Acoustic echo canceller with optional noise suppression.
+ *
+ * The echo of the far-end (reference) signal is estimated with the NLMS
+ * adaptive filter and subtracted from the near-end (microphone) signal.
+ * The adaptation is frozen during the double-talk, which is detected with
+ * the Geigel algorithm. The noise suppressor tracks the noise floor with
+ * the minimum statistics and attenuates the signal which is close to it.
+ *
+ * Both signals have to be monophonic, with the same sampling frequency.
+ * The far-end signal has to be queued with the aec_push_ref() before the
+ * corresponding near-end signal is processed. */
+struct aec {
+	/* adaptive filter coefficients */
+	float *w;
+	/* mirrored far-end signal history (2 x taps) */
+	float *x;
+	unsigned int taps;
+	/* position of the latest sample in the history */
+	unsigned int pos;
+	/* energy of the far-end signal within the filter window */
+	double energy;
+	/* decaying peak of the far-end signal */
+	float peak;
+	float peak_decay;
+	/* remaining samples for which the adaptation is frozen */
+	unsigned int dt_hold;
+	unsigned int dt_hangover;
+	/* queued far-end signal */
+	int16_t *ref;
+	size_t ref_len;
+	size_t ref_capacity;
+	/* noise suppression */
+	bool ns;
+	float ns_level;
+	float ns_noise;
+	float ns_gain;
+	float ns_attack;
+	float ns_release;
+	float ns_rise;
+};
+
+int aec_init(struct aec *a, unsigned int rate, bool ns);
+void aec_free(struct aec *a);
+void aec_reset(struct aec *a);
+
+/**
+ * Check whether the echo canceller has been initialized. */
+#define aec_is_initialized(a) ((a)->w != NULL)
+
+void aec_push_ref(struct aec *a, const int16_t *buffer, size_t samples);
+void aec_process(struct aec *a, int16_t *buffer, size_t samples);
+
+#endif
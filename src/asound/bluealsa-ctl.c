@@ -50,6 +50,8 @@ struct bt_dev {
 	char device_path[sizeof(((struct ba_pcm *)0)->device_path)];
 	char rfcomm_path[sizeof(((struct ba_pcm *)0)->device_path)];
 	char name[sizeof(((struct ctl_elem *)0)->name)];
+	/* unique ID used for name duplications */
+	int id;
 	int battery_level;
 	int mask;
 };
@@ -60,15 +62,16 @@ struct bluealsa_ctl {
 	/* D-Bus connection context */
 	struct ba_dbus_ctx dbus_ctx;
 
-	/* list of BT devices */
+	/* Cache of BT devices sorted by the device path. Devices are never
+	 * removed from this cache, so pointers to them remain valid. */
 	struct bt_dev **dev_list;
 	size_t dev_list_size;
 
 	/* list of all BlueALSA PCMs */
-	struct ba_pcm *pcm_list;
+	struct ba_pcm **pcm_list;
 	size_t pcm_list_size;
 
-	/* list of ALSA control elements */
+	/* list of ALSA control elements sorted by the name */
 	struct ctl_elem *elem_list;
 	size_t elem_list_size;
 
@@ -82,16 +85,8 @@ struct bluealsa_ctl {
 
 };
 
-static int bluealsa_bt_dev_cmp(const void *p1, const void *p2) {
-	const struct bt_dev *d1 = *(const struct bt_dev **)p1;
-	const struct bt_dev *d2 = *(const struct bt_dev **)p2;
-	return strcmp(d1->device_path, d2->device_path);
-}
-
-static int bluealsa_elem_cmp(const void *p1, const void *p2) {
+static int bluealsa_elem_cmp(const struct ctl_elem *e1, const struct ctl_elem *e2) {
 
-	const struct ctl_elem *e1 = (const struct ctl_elem *)p1;
-	const struct ctl_elem *e2 = (const struct ctl_elem *)p2;
 	int rv;
 
 	if ((rv = strcmp(e1->name, e2->name)) == 0)
@@ -125,22 +120,6 @@ fail:
 	return rep;
 }
 
-/**
- * Get BT device ID number.
- *
- * @param ctl The BlueALSA controller context.
- * @param pcm BlueALSA PCM structure.
- * @return The device ID number, or -1 upon error. */
-static int bluealsa_dev_get_id(struct bluealsa_ctl *ctl, const struct ba_pcm *pcm) {
-
-	size_t i;
-	for (i = 0; i < ctl->dev_list_size; i++)
-		if (strcmp(ctl->dev_list[i]->device_path, pcm->device_path) == 0)
-			return i + 1;
-
-	return -1;
-}
-
 static int bluealsa_dev_fetch_name(struct bluealsa_ctl *ctl, struct bt_dev *dev) {
 
 	DBusMessage *rep;
@@ -187,6 +166,38 @@ static int bluealsa_dev_fetch_battery(struct bluealsa_ctl *ctl, struct bt_dev *d
 	return battery;
 }
 
+/**
+ * Lookup BT device in the device cache.
+ *
+ * @param ctl The BlueALSA controller context.
+ * @param path BlueZ device D-Bus object path.
+ * @param index If not NULL, the position of the device in the cache (or the
+ *   position at which the device shall be inserted) will be stored here.
+ * @return The BT device, or NULL if device is not cached. */
+static struct bt_dev *bluealsa_dev_lookup(struct bluealsa_ctl *ctl,
+		const char *path, size_t *index) {
+
+	struct bt_dev *dev = NULL;
+	size_t lo = 0, hi = ctl->dev_list_size;
+
+	while (lo < hi) {
+		const size_t mid = (lo + hi) / 2;
+		const int rv = strcmp(ctl->dev_list[mid]->device_path, path);
+		if (rv == 0) {
+			dev = ctl->dev_list[lo = mid];
+			break;
+		}
+		if (rv < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (index != NULL)
+		*index = lo;
+	return dev;
+}
+
 /**
  * Get BT device structure.
  *
@@ -195,10 +206,11 @@ static int bluealsa_dev_fetch_battery(struct bluealsa_ctl *ctl, struct bt_dev *d
  * @return The BT device, or NULL upon error. */
 static struct bt_dev *bluealsa_dev_get(struct bluealsa_ctl *ctl, const struct ba_pcm *pcm) {
 
+	struct bt_dev *dev;
 	size_t i;
-	for (i = 0; i < ctl->dev_list_size; i++)
-		if (strcmp(ctl->dev_list[i]->device_path, pcm->device_path) == 0)
-			return ctl->dev_list[i];
+
+	if ((dev = bluealsa_dev_lookup(ctl, pcm->device_path, &i)) != NULL)
+		return dev;
 
 	/* If device is not cached yet, fetch data from
 	 * the BlueZ via the B-Bus interface. */
@@ -209,9 +221,12 @@ static struct bt_dev *bluealsa_dev_get(struct bluealsa_ctl *ctl, const struct ba
 		return NULL;
 	ctl->dev_list = dev_list;
 
-	struct bt_dev *dev;
-	if ((dev_list[size] = dev = malloc(sizeof(*dev))) == NULL)
+	if ((dev = malloc(sizeof(*dev))) == NULL)
 		return NULL;
+
+	/* keep the device list sorted by an object path */
+	memmove(&dev_list[i + 1], &dev_list[i], (size - i) * sizeof(*dev_list));
+	dev_list[i] = dev;
 	ctl->dev_list_size++;
 
 	strcpy(dev->device_path, pcm->device_path);
@@ -219,33 +234,42 @@ static struct bt_dev *bluealsa_dev_get(struct bluealsa_ctl *ctl, const struct ba
 	sprintf(dev->name, "%.2X:%.2X:%.2X:%.2X:%.2X:%.2X",
 			pcm->addr.b[5], pcm->addr.b[4], pcm->addr.b[3],
 			pcm->addr.b[2], pcm->addr.b[1], pcm->addr.b[0]);
+	/* Devices are never removed from the cache, so the cache size is the
+	 * unique ID which will not change in case of other devices updates. */
+	dev->id = ctl->dev_list_size;
 	dev->battery_level = -1;
-
-	/* Sort device list by an object path, so the bluealsa_dev_get_id() will
-	 * return consistent IDs ordering in case of name duplications. */
-	qsort(dev_list, ctl->dev_list_size, sizeof(*dev_list), bluealsa_bt_dev_cmp);
+	dev->mask = 0;
 
 	bluealsa_dev_fetch_name(ctl, dev);
+	if (ctl->battery)
+		bluealsa_dev_fetch_battery(ctl, dev);
+
 	return dev;
 }
 
-static int bluealsa_pcm_add(struct bluealsa_ctl *ctl, struct ba_pcm *pcm) {
-	struct ba_pcm *tmp = ctl->pcm_list;
-	if ((tmp = realloc(tmp, (ctl->pcm_list_size + 1) * sizeof(*tmp))) == NULL)
+static int bluealsa_elem_update_list_add(struct bluealsa_ctl *ctl,
+		const char *elem_name, unsigned int mask) {
+
+	struct ctl_elem_update *tmp = ctl->elem_update_list;
+	if ((tmp = realloc(tmp, (ctl->elem_update_list_size + 1) * sizeof(*tmp))) == NULL)
 		return -1;
-	memcpy(&tmp[ctl->pcm_list_size++], pcm, sizeof(*tmp));
-	ctl->pcm_list = tmp;
-	return 0;
-}
 
-static int bluealsa_pcm_remove(struct bluealsa_ctl *ctl, const char *path) {
-	size_t i;
-	for (i = 0; i < ctl->pcm_list_size; i++)
-		if (strcmp(ctl->pcm_list[i].pcm_path, path) == 0)
-			memcpy(&ctl->pcm_list[i], &ctl->pcm_list[--ctl->pcm_list_size], sizeof(*ctl->pcm_list));
+	tmp[ctl->elem_update_list_size].event_mask = mask;
+	*stpncpy(tmp[ctl->elem_update_list_size].name, elem_name,
+			sizeof(tmp[ctl->elem_update_list_size].name) - 1) = '\0';
+
+	ctl->elem_update_list = tmp;
+	ctl->elem_update_list_size++;
 	return 0;
 }
 
+#define bluealsa_event_elem_added(ctl, elem) \
+	bluealsa_elem_update_list_add(ctl, elem, SND_CTL_EVENT_MASK_ADD)
+#define bluealsa_event_elem_removed(ctl, elem) \
+	bluealsa_elem_update_list_add(ctl, elem, SND_CTL_EVENT_MASK_REMOVE)
+#define bluealsa_event_elem_updated(ctl, elem) \
+	bluealsa_elem_update_list_add(ctl, elem, SND_CTL_EVENT_MASK_VALUE)
+
 /**
  * Update element name based on given string and PCM type.
  *
@@ -309,97 +333,289 @@ static void bluealsa_elem_set_name(struct ctl_elem *elem, const char *name, int
 
 }
 
-static int bluealsa_create_elem_list(struct bluealsa_ctl *ctl) {
+/**
+ * Insert element into the sorted list of control elements.
+ *
+ * @return On success this function returns index of inserted element.
+ *   Otherwise, -1 is returned. */
+static ssize_t bluealsa_elem_insert(struct bluealsa_ctl *ctl, const struct ctl_elem *elem) {
+
+	struct ctl_elem *elem_list = ctl->elem_list;
+	size_t size = ctl->elem_list_size;
+	if ((elem_list = realloc(elem_list, (size + 1) * sizeof(*elem_list))) == NULL)
+		return -1;
+	ctl->elem_list = elem_list;
+
+	size_t lo = 0, hi = size;
+	while (lo < hi) {
+		const size_t mid = (lo + hi) / 2;
+		if (bluealsa_elem_cmp(&elem_list[mid], elem) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	memmove(&elem_list[lo + 1], &elem_list[lo], (size - lo) * sizeof(*elem_list));
+	memcpy(&elem_list[lo], elem, sizeof(*elem_list));
+	ctl->elem_list_size++;
+
+	return lo;
+}
+
+/**
+ * Find control element of the given type associated with the PCM.
+ *
+ * @return The index of the element, or -1 if element was not found. */
+static ssize_t bluealsa_elem_find(struct bluealsa_ctl *ctl,
+		enum ctl_elem_type type, const struct ba_pcm *pcm) {
 
-	size_t count = 0;
 	size_t i;
-	struct ctl_elem *elem_list = ctl->elem_list;
+	for (i = 0; i < ctl->elem_list_size; i++)
+		if (ctl->elem_list[i].type == type && ctl->elem_list[i].pcm == pcm)
+			return i;
 
-	if (ctl->pcm_list_size > 0) {
+	return -1;
+}
 
-		for (i = 0; i < ctl->pcm_list_size; i++) {
-			/* Every stream has two controls associated to
-			 * itself - volume adjustment and mute switch. */
-			count += 2;
-			/* It is possible, that BT device battery level will be exposed via
-			 * RFCOMM interface, so in order to account for a special "battery"
-			 * element we have to increment our element counter by one. */
-			count += 1;
-		}
+/**
+ * Rename given element and move it to the new position in the list. */
+static int bluealsa_elem_rename(struct bluealsa_ctl *ctl, size_t index, int id) {
 
-		if ((elem_list = realloc(elem_list, count * sizeof(*elem_list))) == NULL)
-			return -1;
+	struct ctl_elem elem = ctl->elem_list[index];
 
+	bluealsa_event_elem_removed(ctl, elem.name);
+	memmove(&ctl->elem_list[index], &ctl->elem_list[index + 1],
+			(--ctl->elem_list_size - index) * sizeof(*ctl->elem_list));
+
+	bluealsa_elem_set_name(&elem, elem.dev->name, id);
+	if (bluealsa_elem_insert(ctl, &elem) == -1)
+		return -1;
+
+	bluealsa_event_elem_added(ctl, elem.name);
+	return 0;
+}
+
+/**
+ * Add new control element.
+ *
+ * If the name of the new element collides with the name of an existing one,
+ * both elements are annotated with the device ID number, so there will be
+ * no duplications - make ALSA library happy. */
+static int bluealsa_elem_add(struct bluealsa_ctl *ctl, enum ctl_elem_type type,
+		struct bt_dev *dev, struct ba_pcm *pcm, bool playback) {
+
+	struct ctl_elem elem = {
+		.type = type,
+		.dev = dev,
+		.pcm = pcm,
+		.playback = playback,
+	};
+
+	struct ctl_elem tmp;
+	bool duplicated = false;
+	size_t i;
+
+	bluealsa_elem_set_name(&elem, dev->name, -1);
+
+	for (i = 0; i < ctl->elem_list_size; i++) {
+		tmp = ctl->elem_list[i];
+		bluealsa_elem_set_name(&tmp, tmp.dev->name, -1);
+		if (strcmp(tmp.name, elem.name) != 0)
+			continue;
+		duplicated = true;
+		/* Elements which share the same name are either all annotated with
+		 * the ID number or there is exactly one element without it. */
+		if (strcmp(ctl->elem_list[i].name, tmp.name) == 0) {
+			if (bluealsa_elem_rename(ctl, i, tmp.dev->id) == -1)
+				return -1;
+			break;
+		}
 	}
 
-	/* Clear device mask, so we can distinguish currently used and unused (old)
-	 * device entries - we are not invalidating device list after PCM remove. */
-	for (i = 0; i < ctl->dev_list_size; i++)
-		ctl->dev_list[i]->mask = 0;
-
-	count = 0;
-
-	/* Construct control elements based on available PCMs. */
-	for (i = 0; i < ctl->pcm_list_size; i++) {
-
-		struct ba_pcm *pcm = &ctl->pcm_list[i];
-		struct bt_dev *dev = bluealsa_dev_get(ctl, pcm);
-
-		elem_list[count].type = CTL_ELEM_TYPE_VOLUME;
-		elem_list[count].dev = dev;
-		elem_list[count].pcm = pcm;
-		elem_list[count].playback = pcm->mode == BA_PCM_MODE_SINK;
-		bluealsa_elem_set_name(&elem_list[count], dev->name, -1);
-		count++;
-
-		elem_list[count].type = CTL_ELEM_TYPE_SWITCH;
-		elem_list[count].dev = dev;
-		elem_list[count].pcm = pcm;
-		elem_list[count].playback = pcm->mode == BA_PCM_MODE_SINK;
-		bluealsa_elem_set_name(&elem_list[count], dev->name, -1);
-		count++;
-
-		/* Try to add special "battery" element. */
-		if (ctl->battery && dev->battery_level == -1 &&
-				bluealsa_dev_fetch_battery(ctl, dev) != -1) {
-			elem_list[count].type = CTL_ELEM_TYPE_BATTERY;
-			elem_list[count].dev = dev;
-			elem_list[count].pcm = pcm;
-			elem_list[count].playback = true;
-			bluealsa_elem_set_name(&elem_list[count], dev->name, -1);
+	if (duplicated)
+		bluealsa_elem_set_name(&elem, dev->name, dev->id);
+
+	if (bluealsa_elem_insert(ctl, &elem) == -1)
+		return -1;
+
+	bluealsa_event_elem_added(ctl, elem.name);
+	return 0;
+}
+
+/**
+ * Remove control element from the list.
+ *
+ * If after the removal there is only one element left with the name which
+ * was annotated with the device ID number, the annotation is removed. */
+static void bluealsa_elem_remove(struct bluealsa_ctl *ctl, size_t index) {
+
+	struct ctl_elem elem = ctl->elem_list[index];
+	struct ctl_elem tmp;
+	ssize_t match = -1;
+	size_t count = 0;
+	size_t i;
+
+	bluealsa_event_elem_removed(ctl, elem.name);
+	memmove(&ctl->elem_list[index], &ctl->elem_list[index + 1],
+			(--ctl->elem_list_size - index) * sizeof(*ctl->elem_list));
+
+	bluealsa_elem_set_name(&elem, elem.dev->name, -1);
+
+	for (i = 0; i < ctl->elem_list_size; i++) {
+		tmp = ctl->elem_list[i];
+		bluealsa_elem_set_name(&tmp, tmp.dev->name, -1);
+		if (strcmp(tmp.name, elem.name) == 0) {
+			match = i;
 			count++;
 		}
+	}
+
+	if (count == 1)
+		bluealsa_elem_rename(ctl, match, -1);
+
+}
+
+/**
+ * Add special "battery" element for the given device.
+ *
+ * The battery element is created only once per device and it is associated
+ * with one of the device PCMs. */
+static int bluealsa_dev_add_battery(struct bluealsa_ctl *ctl, struct bt_dev *dev) {
+
+	struct ba_pcm *pcm = NULL;
+	size_t i;
+
+	if (!ctl->battery || dev->battery_level == -1)
+		return 0;
+
+	for (i = 0; i < ctl->elem_list_size; i++)
+		if (ctl->elem_list[i].dev == dev) {
+			if (ctl->elem_list[i].type == CTL_ELEM_TYPE_BATTERY)
+				return 0;
+			pcm = ctl->elem_list[i].pcm;
+		}
+
+	if (pcm == NULL)
+		return 0;
+
+	return bluealsa_elem_add(ctl, CTL_ELEM_TYPE_BATTERY, dev, pcm, true);
+}
+
+/**
+ * Recreate all control elements of the given device.
+ *
+ * This function shall be called when the device name has changed. */
+static int bluealsa_dev_update_elems(struct bluealsa_ctl *ctl, struct bt_dev *dev) {
+
+	struct ctl_elem *elems;
+	size_t count = 0;
+	size_t i;
+	int rv = 0;
 
+	if ((elems = malloc(ctl->elem_list_size * sizeof(*elems) + 1)) == NULL)
+		return -1;
+
+	for (i = 0; i < ctl->elem_list_size; i++)
+		if (ctl->elem_list[i].dev == dev)
+			elems[count++] = ctl->elem_list[i];
+
+	for (i = 0; i < count; i++)
+		bluealsa_elem_remove(ctl, bluealsa_elem_find(ctl, elems[i].type, elems[i].pcm));
+	for (i = 0; i < count; i++)
+		if (bluealsa_elem_add(ctl, elems[i].type, dev, elems[i].pcm, elems[i].playback) == -1)
+			rv = -1;
+
+	free(elems);
+	return rv;
+}
+
+static struct ba_pcm *bluealsa_pcm_get(struct bluealsa_ctl *ctl, const char *path) {
+	size_t i;
+	for (i = 0; i < ctl->pcm_list_size; i++)
+		if (strcmp(ctl->pcm_list[i]->pcm_path, path) == 0)
+			return ctl->pcm_list[i];
+	return NULL;
+}
+
+/**
+ * Add new PCM and create its control elements.
+ *
+ * Every stream has two controls associated to itself - volume adjustment
+ * and mute switch. Additionally, it is possible, that BT device battery
+ * level will be exposed via RFCOMM interface. */
+static int bluealsa_pcm_add(struct bluealsa_ctl *ctl, const struct ba_pcm *pcm) {
+
+	struct ba_pcm **pcm_list = ctl->pcm_list;
+	if ((pcm_list = realloc(pcm_list, (ctl->pcm_list_size + 1) * sizeof(*pcm_list))) == NULL)
+		return -1;
+	ctl->pcm_list = pcm_list;
+
+	struct ba_pcm *_pcm;
+	if ((_pcm = malloc(sizeof(*_pcm))) == NULL)
+		return -1;
+
+	struct bt_dev *dev;
+	if ((dev = bluealsa_dev_get(ctl, pcm)) == NULL) {
+		free(_pcm);
+		return -1;
 	}
 
-	/* Sort control elements alphabetically. */
-	qsort(elem_list, count, sizeof(*elem_list), bluealsa_elem_cmp);
+	memcpy(_pcm, pcm, sizeof(*_pcm));
+	pcm_list[ctl->pcm_list_size++] = _pcm;
 
-	/* Detect element name duplicates and annotate them with the
-	 * consecutive device ID number - make ALSA library happy. */
-	for (i = 0; i < count; i++) {
+	const bool playback = pcm->mode == BA_PCM_MODE_SINK;
+	if (bluealsa_elem_add(ctl, CTL_ELEM_TYPE_VOLUME, dev, _pcm, playback) == -1 ||
+			bluealsa_elem_add(ctl, CTL_ELEM_TYPE_SWITCH, dev, _pcm, playback) == -1 ||
+			bluealsa_dev_add_battery(ctl, dev) == -1)
+		return -1;
 
-		char tmp[sizeof(elem_list[0].name)];
-		bool duplicated = false;
-		size_t ii;
+	return 0;
+}
 
-		for (ii = i + 1; ii < count; ii++)
-			if (strcmp(elem_list[i].name, elem_list[ii].name) == 0) {
-				bluealsa_elem_set_name(&elem_list[ii], strcpy(tmp, elem_list[ii].dev->name),
-						bluealsa_dev_get_id(ctl, elem_list[ii].pcm));
-				duplicated = true;
-			}
+/**
+ * Remove PCM and all its control elements. */
+static int bluealsa_pcm_remove(struct bluealsa_ctl *ctl, const char *path) {
+
+	struct ba_pcm *pcm;
+	ssize_t index;
+	size_t i;
+
+	if ((pcm = bluealsa_pcm_get(ctl, path)) == NULL)
+		return 0;
+
+	for (i = 0; i < ctl->elem_list_size; i++) {
+
+		struct ctl_elem *elem = &ctl->elem_list[i];
+		if (elem->pcm != pcm)
+			continue;
 
-		if (duplicated)
-			bluealsa_elem_set_name(&elem_list[i], strcpy(tmp, elem_list[i].dev->name),
-					bluealsa_dev_get_id(ctl, elem_list[i].pcm));
+		/* The battery element belongs to the device rather than to the PCM,
+		 * so if possible, associate it with other PCM of this device. */
+		if (elem->type == CTL_ELEM_TYPE_BATTERY) {
+			size_t ii;
+			for (ii = 0; ii < ctl->pcm_list_size; ii++)
+				if (ctl->pcm_list[ii] != pcm &&
+						strcmp(ctl->pcm_list[ii]->device_path, pcm->device_path) == 0) {
+					elem->pcm = ctl->pcm_list[ii];
+					break;
+				}
+		}
 
 	}
 
-	ctl->elem_list = elem_list;
-	ctl->elem_list_size = count;
+	while ((index = bluealsa_elem_find(ctl, CTL_ELEM_TYPE_VOLUME, pcm)) != -1 ||
+			(index = bluealsa_elem_find(ctl, CTL_ELEM_TYPE_SWITCH, pcm)) != -1 ||
+			(index = bluealsa_elem_find(ctl, CTL_ELEM_TYPE_BATTERY, pcm)) != -1)
+		bluealsa_elem_remove(ctl, index);
+
+	for (i = 0; i < ctl->pcm_list_size; i++)
+		if (ctl->pcm_list[i] == pcm) {
+			ctl->pcm_list[i] = ctl->pcm_list[--ctl->pcm_list_size];
+			break;
+		}
 
-	return count;
+	free(pcm);
+	return 0;
 }
 
 static void bluealsa_close(snd_ctl_ext_t *ext) {
@@ -411,6 +627,8 @@ static void bluealsa_close(snd_ctl_ext_t *ext) {
 	for (i = 0; i < ctl->dev_list_size; i++)
 		free(ctl->dev_list[i]);
 	free(ctl->dev_list);
+	for (i = 0; i < ctl->pcm_list_size; i++)
+		free(ctl->pcm_list[i]);
 	free(ctl->pcm_list);
 	free(ctl->elem_list);
 	free(ctl->elem_update_list);
@@ -439,12 +657,16 @@ static snd_ctl_ext_key_t bluealsa_find_elem(snd_ctl_ext_t *ext, const snd_ctl_el
 
 	unsigned int numid = snd_ctl_elem_id_get_numid(id);
 
-	if (numid > 0 && numid <= ctl->elem_list_size)
-		return numid - 1;
-
 	const char *name = snd_ctl_elem_id_get_name(id);
 	size_t i;
 
+	/* Elements are kept sorted, so the numid of an element changes when
+	 * other element is inserted or removed before it. Hence, if the name
+	 * is given, make sure that it matches the element pointed by numid. */
+	if (numid > 0 && numid <= ctl->elem_list_size &&
+			(name[0] == '\0' || strcmp(ctl->elem_list[numid - 1].name, name) == 0))
+		return numid - 1;
+
 	for (i = 0; i < ctl->elem_list_size; i++)
 		if (strcmp(ctl->elem_list[i].name, name) == 0)
 			return i;
@@ -614,46 +836,22 @@ static void bluealsa_subscribe_events(snd_ctl_ext_t *ext, int subscribe) {
 	dbus_connection_flush(ctl->dbus_ctx.conn);
 }
 
-static int bluealsa_elem_update_list_add(struct bluealsa_ctl *ctl,
-		const char *elem_name, unsigned int mask) {
-
-	struct ctl_elem_update *tmp = ctl->elem_update_list;
-	if ((tmp = realloc(tmp, (ctl->elem_update_list_size + 1) * sizeof(*tmp))) == NULL)
-		return -1;
-
-	tmp[ctl->elem_update_list_size].event_mask = mask;
-	*stpncpy(tmp[ctl->elem_update_list_size].name, elem_name,
-			sizeof(tmp[ctl->elem_update_list_size].name) - 1) = '\0';
-
-	ctl->elem_update_list = tmp;
-	ctl->elem_update_list_size++;
-	return 0;
-}
-
-#define bluealsa_event_elem_added(ctl, elem) \
-	bluealsa_elem_update_list_add(ctl, elem, SND_CTL_EVENT_MASK_ADD)
-#define bluealsa_event_elem_removed(ctl, elem) \
-	bluealsa_elem_update_list_add(ctl, elem, SND_CTL_EVENT_MASK_REMOVE)
-#define bluealsa_event_elem_updated(ctl, elem) \
-	bluealsa_elem_update_list_add(ctl, elem, SND_CTL_EVENT_MASK_VALUE)
-
 static dbus_bool_t bluealsa_dbus_msg_update_dev(const char *key,
 		DBusMessageIter *variant, void *userdata, DBusError *error) {
 	(void)error;
 
 	struct bt_dev *dev = (struct bt_dev *)userdata;
-	dev->mask = 0;
 
 	if (strcmp(key, "Alias") == 0) {
 		const char *alias;
 		dbus_message_iter_get_basic(variant, &alias);
 		*stpncpy(dev->name, alias, sizeof(dev->name) - 1) = '\0';
-		dev->mask = SND_CTL_EVENT_MASK_ADD;
+		dev->mask |= SND_CTL_EVENT_MASK_ADD;
 	}
 	if (strcmp(key, "Battery") == 0) {
 		char battery_level;
 		dbus_message_iter_get_basic(variant, &battery_level);
-		dev->mask = dev->battery_level == -1 ? SND_CTL_EVENT_MASK_ADD : SND_CTL_EVENT_MASK_VALUE;
+		dev->mask |= dev->battery_level == -1 ? SND_CTL_EVENT_MASK_ADD : SND_CTL_EVENT_MASK_VALUE;
 		dev->battery_level = battery_level;
 	}
 
@@ -685,49 +883,52 @@ static DBusHandlerResult bluealsa_dbus_msg_filter(DBusConnection *conn,
 		dbus_message_iter_next(&iter);
 
 		/* handle BlueZ device properties update */
-		if (strcmp(updated_interface, "org.bluez.Device1") == 0)
-			for (i = 0; i < ctl->elem_list_size; i++) {
-				struct bt_dev *dev = ctl->elem_list[i].dev;
-				if (strcmp(dev->device_path, path) == 0)
-					bluealsa_dbus_message_iter_dict(&iter, NULL,
-							bluealsa_dbus_msg_update_dev, dev);
+		if (strcmp(updated_interface, "org.bluez.Device1") == 0) {
+			struct bt_dev *dev;
+			if ((dev = bluealsa_dev_lookup(ctl, path, NULL)) != NULL) {
+				dev->mask = 0;
+				bluealsa_dbus_message_iter_dict(&iter, NULL,
+						bluealsa_dbus_msg_update_dev, dev);
+				/* The name of the device has changed, so all its elements
+				 * have to be removed and added again with the new name. */
 				if (dev->mask & SND_CTL_EVENT_MASK_ADD)
-					goto remove_add;
+					bluealsa_dev_update_elems(ctl, dev);
 			}
+		}
 
 		/* handle BlueALSA RFCOMM properties update */
 		if (strcmp(updated_interface, BLUEALSA_INTERFACE_RFCOMM) == 0)
-			for (i = 0; i < ctl->elem_list_size; i++) {
-				struct bt_dev *dev = ctl->elem_list[i].dev;
-				if (strcmp(dev->rfcomm_path, path) == 0) {
-					bluealsa_dbus_message_iter_dict(&iter, NULL,
-							bluealsa_dbus_msg_update_dev, dev);
-					if (dev->mask & SND_CTL_EVENT_MASK_ADD)
-						goto remove_add;
-					if (dev->mask & SND_CTL_EVENT_MASK_VALUE)
-						bluealsa_event_elem_updated(ctl, ctl->elem_list[i].name);
+			for (i = 0; i < ctl->dev_list_size; i++) {
+				struct bt_dev *dev = ctl->dev_list[i];
+				if (strcmp(dev->rfcomm_path, path) != 0)
+					continue;
+				dev->mask = 0;
+				bluealsa_dbus_message_iter_dict(&iter, NULL,
+						bluealsa_dbus_msg_update_dev, dev);
+				if (dev->mask & SND_CTL_EVENT_MASK_ADD)
+					bluealsa_dev_add_battery(ctl, dev);
+				else if (dev->mask & SND_CTL_EVENT_MASK_VALUE) {
+					size_t ii;
+					for (ii = 0; ii < ctl->elem_list_size; ii++)
+						if (ctl->elem_list[ii].dev == dev &&
+								ctl->elem_list[ii].type == CTL_ELEM_TYPE_BATTERY)
+							bluealsa_event_elem_updated(ctl, ctl->elem_list[ii].name);
 				}
+				break;
 			}
 
 		/* handle BlueALSA PCM properties update */
-		if (strcmp(updated_interface, BLUEALSA_INTERFACE_PCM) == 0)
-			for (i = 0; i < ctl->elem_list_size; i++) {
-				struct ctl_elem *elem = &ctl->elem_list[i];
-				if (strcmp(elem->pcm->pcm_path, path) == 0) {
-					if (elem->type == CTL_ELEM_TYPE_BATTERY) {
-						bluealsa_dbus_message_iter_dict(&iter, NULL,
-								bluealsa_dbus_msg_update_dev, elem->dev);
-						if (elem->dev->mask & SND_CTL_EVENT_MASK_ADD)
-							goto remove_add;
-						if (elem->dev->mask & SND_CTL_EVENT_MASK_VALUE)
-							bluealsa_event_elem_updated(ctl, ctl->elem_list[i].name);
-					}
-					else {
-						bluealsa_dbus_message_iter_get_pcm_props(&iter, NULL, elem->pcm);
+		if (strcmp(updated_interface, BLUEALSA_INTERFACE_PCM) == 0) {
+			struct ba_pcm *pcm;
+			if ((pcm = bluealsa_pcm_get(ctl, path)) != NULL) {
+				bluealsa_dbus_message_iter_get_pcm_props(&iter, NULL, pcm);
+				for (i = 0; i < ctl->elem_list_size; i++) {
+					struct ctl_elem *elem = &ctl->elem_list[i];
+					if (elem->pcm == pcm && elem->type != CTL_ELEM_TYPE_BATTERY)
 						bluealsa_event_elem_updated(ctl, elem->name);
-					}
 				}
 			}
+		}
 
 	}
 	else if (strcmp(interface, BLUEALSA_INTERFACE_MANAGER) == 0) {
@@ -736,14 +937,12 @@ static DBusHandlerResult bluealsa_dbus_msg_filter(DBusConnection *conn,
 			struct ba_pcm pcm;
 			bluealsa_dbus_message_iter_get_pcm(&iter, NULL, &pcm);
 			bluealsa_pcm_add(ctl, &pcm);
-			goto remove_add;
 		}
 
 		if (strcmp(signal, "PCMRemoved") == 0) {
 			const char *path;
 			dbus_message_iter_get_basic(&iter, &path);
 			bluealsa_pcm_remove(ctl, path);
-			goto remove_add;
 		}
 
 	}
@@ -760,8 +959,8 @@ static DBusHandlerResult bluealsa_dbus_msg_filter(DBusConnection *conn,
 				if (strlen(arg2) == 0) {
 					/* BlueALSA daemon has terminated,
 					 * so all PCMs have been removed. */
-					ctl->pcm_list_size = 0;
-					goto remove_add;
+					while (ctl->pcm_list_size > 0)
+						bluealsa_pcm_remove(ctl, ctl->pcm_list[0]->pcm_path);
 				}
 			}
 		}
@@ -769,25 +968,7 @@ static DBusHandlerResult bluealsa_dbus_msg_filter(DBusConnection *conn,
 	}
 
 	return DBUS_HANDLER_RESULT_HANDLED;
-
-remove_add: {
-
-	/* During a PCM name change, new PCM insertion and/or deletion, the name
-	 * of all control elements might have change, because of optional unique
-	 * device ID suffix - for more information see the bluealsa_elem_set_name()
-	 * function. So, in such a case we will simply remove all old controllers
-	 * and add new ones in order to update potential name changes. */
-
-	for (i = 0; i < ctl->elem_list_size; i++)
-		bluealsa_event_elem_removed(ctl, ctl->elem_list[i].name);
-
-	bluealsa_create_elem_list(ctl);
-
-	for (i = 0; i < ctl->elem_list_size; i++)
-		bluealsa_event_elem_added(ctl, ctl->elem_list[i].name);
-
-	return DBUS_HANDLER_RESULT_HANDLED;
-}}
+}
 
 static int bluealsa_read_event(snd_ctl_ext_t *ext, snd_ctl_elem_id_t *id, unsigned int *event_mask) {
 	struct bluealsa_ctl *ctl = ext->private_data;
@@ -940,6 +1121,8 @@ SND_CTL_PLUGIN_DEFINE_FUNC(bluealsa) {
 	const char *service = BLUEALSA_SERVICE;
 	const char *battery = "no";
 	struct bluealsa_ctl *ctl;
+	struct ba_pcm *pcms = NULL;
+	size_t pcms_count = 0;
 	int ret;
 
 	snd_config_for_each(i, next, conf) {
@@ -992,17 +1175,25 @@ SND_CTL_PLUGIN_DEFINE_FUNC(bluealsa) {
 		goto fail;
 	}
 
-	if (!bluealsa_dbus_get_pcms(&ctl->dbus_ctx, &ctl->pcm_list, &ctl->pcm_list_size, &err)) {
+	if (!bluealsa_dbus_get_pcms(&ctl->dbus_ctx, &pcms, &pcms_count, &err)) {
 		SNDERR("Couldn't get BlueALSA PCM list: %s", err.message);
 		ret = -ENODEV;
 		goto fail;
 	}
 
-	if (bluealsa_create_elem_list(ctl) == -1) {
-		SNDERR("Couldn't create control elements: %s", strerror(errno));
-		ret = -errno;
-		goto fail;
-	}
+	size_t ii;
+	for (ii = 0; ii < pcms_count; ii++)
+		if (bluealsa_pcm_add(ctl, &pcms[ii]) == -1) {
+			SNDERR("Couldn't create control elements: %s", strerror(errno));
+			ret = -errno;
+			goto fail;
+		}
+
+	/* Initial elements are reported via the element list,
+	 * so there is no need to generate events for them. */
+	ctl->elem_update_list_size = 0;
+	free(pcms);
+	pcms = NULL;
 
 	ctl->ext.version = SND_CTL_EXT_VERSION;
 	ctl->ext.card_idx = 0;
@@ -1028,6 +1219,7 @@ SND_CTL_PLUGIN_DEFINE_FUNC(bluealsa) {
 fail:
 	bluealsa_dbus_connection_ctx_free(&ctl->dbus_ctx);
 	dbus_error_free(&err);
+	free(pcms);
 	free(ctl);
 	return ret;
 }
@@ -17,6 +17,7 @@
 #include <poll.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -38,11 +39,27 @@
 #include "shared/defs.h"
 #include "shared/log.h"
 #include "shared/rt.h"
+#include "shared/shm.h"
 
 #define BA_PAUSE_STATE_RUNNING 0
 #define BA_PAUSE_STATE_PAUSED  (1 << 0)
 #define BA_PAUSE_STATE_PENDING (1 << 1)
 
+/**
+ * Latency profiles which trade robustness against the audio latency. */
+static const struct {
+	const char *name;
+	/* FIFO size for playback and capture, 0 keeps the system default */
+	unsigned int fifo_playback;
+	unsigned int fifo_capture;
+	/* minimal period time in milliseconds */
+	unsigned int period_ms;
+} latency_profiles[] = {
+	{ "low", 2048, 2048, 5 },
+	{ "normal", 2048, 0, 10 },
+	{ "high", 0, 0, 20 },
+};
+
 struct bluealsa_pcm {
 	snd_pcm_ioplug_t io;
 
@@ -59,9 +76,25 @@ struct bluealsa_pcm {
 	size_t ba_pcm_buffer_size;
 	int ba_pcm_fd;
 	int ba_pcm_ctrl_fd;
+	/* server supports binary status query */
+	bool ba_pcm_ctrl_status;
+	/* server supports binary presentation position query */
+	bool ba_pcm_ctrl_position;
+
+	/* Use shared memory ring instead of the FIFO. If the ring is mapped,
+	 * the ba_pcm_fd field holds the shared memory file descriptor. */
+	bool ba_pcm_shm_enabled;
+	shm_ring_t ba_pcm_shm;
+	/* In the direct mode (shared memory ring with the mmap access) frames
+	 * are transferred between the HW buffer and the ring by the application
+	 * thread, so there is no IO thread at all. */
+	bool io_direct;
 
 	/* event file descriptor */
 	int event_fd;
+	/* The event file descriptor has been signaled and not cleared by the
+	 * application yet, so there is no need to signal it once more. */
+	atomic_bool event_pending;
 
 	/* virtual hardware - ring buffer */
 	char *io_hw_buffer;
@@ -73,12 +106,21 @@ struct bluealsa_pcm {
 	snd_pcm_uframes_t io_hw_boundary;
 	/* Permit the application to modify the frequency of poll() events. */
 	volatile snd_pcm_uframes_t io_avail_min;
+	/* IO thread transfer granularity in milliseconds and frames. If zero,
+	 * frames are transferred one period at a time. */
+	unsigned int io_chunk_ms;
+	snd_pcm_uframes_t io_chunk_size;
 	pthread_t io_thread;
 	bool io_started;
 
 	/* ALSA operates on frames, we on bytes */
 	size_t frame_size;
 
+	/* FIFO size in bytes, if zero the system default is used */
+	unsigned int fifo_size;
+	/* minimal period time in milliseconds */
+	unsigned int period_ms;
+
 	struct timespec delay_ts;
 	snd_pcm_uframes_t delay_hw_ptr;
 	unsigned int delay_pcm_nread;
@@ -125,11 +167,27 @@ static snd_pcm_uframes_t snd_pcm_ioplug_hw_avail(const snd_pcm_ioplug_t * const
 }
 #endif
 
+/**
+ * Signal the application that the PCM might be ready.
+ *
+ * The event file descriptor is kept readable as long as the PCM is ready,
+ * so it is written only if it has not been signaled already. */
+static void event_signal(struct bluealsa_pcm *pcm) {
+	if (!atomic_exchange(&pcm->event_pending, true))
+		eventfd_write(pcm->event_fd, 1);
+}
+
 /**
  * Helper function for closing PCM transport. */
 static int close_transport(struct bluealsa_pcm *pcm) {
 	int rv = 0;
 	pthread_mutex_lock(&pcm->mutex);
+	if (shm_ring_is_mapped(&pcm->ba_pcm_shm)) {
+		/* the PCM file descriptor is owned by the ring */
+		shm_ring_close(&pcm->ba_pcm_shm);
+		shm_ring_free(&pcm->ba_pcm_shm);
+		pcm->ba_pcm_fd = -1;
+	}
 	if (pcm->ba_pcm_fd != -1) {
 		rv |= close(pcm->ba_pcm_fd);
 		pcm->ba_pcm_fd = -1;
@@ -158,7 +216,10 @@ static void io_thread_update_delay(struct bluealsa_pcm *pcm,
 	unsigned int nread = 0;
 
 	gettimestamp(&now);
-	ioctl(pcm->ba_pcm_fd, FIONREAD, &nread);
+	if (shm_ring_is_mapped(&pcm->ba_pcm_shm))
+		nread = shm_ring_len_out(&pcm->ba_pcm_shm);
+	else
+		ioctl(pcm->ba_pcm_fd, FIONREAD, &nread);
 
 	pthread_mutex_lock(&pcm->mutex);
 
@@ -180,6 +241,104 @@ static void io_thread_update_delay(struct bluealsa_pcm *pcm,
 
 }
 
+/**
+ * Wait for the shared memory ring event.
+ *
+ * @param pcm Pointer to the BlueALSA PCM structure.
+ * @param efd Event file descriptor to wait for.
+ * @return On success this function returns 0. If the ring has been closed
+ *   or the server has hung up, -1 is returned. */
+static int io_thread_shm_wait(struct bluealsa_pcm *pcm, int efd) {
+
+	/* Shared memory does not report peer disconnection, so we will poll
+	 * the controller socket for hang-up as well. */
+	struct pollfd pfds[2] = {
+		{ efd, POLLIN, 0 },
+		{ pcm->ba_pcm_ctrl_fd, 0, 0 }};
+
+	while (!shm_ring_is_closed(&pcm->ba_pcm_shm)) {
+		if (poll(pfds, ARRAYSIZE(pfds), -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			SNDERR("PCM shared memory poll error: %s", strerror(errno));
+			return -1;
+		}
+		if (pfds[1].revents & (POLLERR | POLLHUP))
+			break;
+		if (pfds[0].revents & POLLIN)
+			return 0;
+	}
+
+	return -1;
+}
+
+/**
+ * Transfer frames between the HW buffer and the shared memory ring.
+ *
+ * This function is used in the direct mode instead of the IO thread. It
+ * moves as many frames as possible without blocking and updates the HW
+ * pointer accordingly.
+ *
+ * @param pcm Pointer to the BlueALSA PCM structure.
+ * @param appl_ptr The application pointer. It might be ahead of the one
+ *   known by the ioplug, e.g. when frames are being committed.
+ * @return This function returns the number of transferred frames. If the
+ *   ring has been closed, -1 is returned. */
+static snd_pcm_sframes_t io_direct_transfer(struct bluealsa_pcm *pcm,
+		snd_pcm_uframes_t appl_ptr) {
+
+	snd_pcm_ioplug_t *io = &pcm->io;
+	shm_ring_t *ring = &pcm->ba_pcm_shm;
+	snd_pcm_uframes_t io_hw_ptr = pcm->io_hw_ptr;
+	snd_pcm_uframes_t total = 0;
+
+	if (shm_ring_is_closed(ring))
+		return -1;
+	if (pcm->io_hw_ptr == -1)
+		return 0;
+
+	for (;;) {
+
+		/* For playback this is the number of frames committed by the application
+		 * but not yet transferred, for capture the free space in the buffer. */
+		snd_pcm_uframes_t frames = snd_pcm_ioplug_hw_avail(io, io_hw_ptr, appl_ptr);
+
+		const size_t len_ring = io->stream == SND_PCM_STREAM_PLAYBACK ?
+			shm_ring_len_in(ring) : shm_ring_len_out(ring);
+		if (frames > len_ring / pcm->frame_size)
+			frames = len_ring / pcm->frame_size;
+
+		/* do not cross the end of the HW buffer in one go */
+		snd_pcm_uframes_t offset = io_hw_ptr % io->buffer_size;
+		if (io->buffer_size - offset < frames)
+			frames = io->buffer_size - offset;
+
+		if (frames == 0)
+			break;
+
+		char *head = pcm->io_hw_buffer + offset * pcm->frame_size;
+		size_t len = frames * pcm->frame_size;
+
+		if (io->stream == SND_PCM_STREAM_PLAYBACK)
+			shm_ring_write(ring, head, len);
+		else
+			shm_ring_read(ring, head, len);
+
+		io_hw_ptr += frames;
+		if (io_hw_ptr >= pcm->io_hw_boundary)
+			io_hw_ptr -= pcm->io_hw_boundary;
+		total += frames;
+
+	}
+
+	if (total > 0) {
+		pcm->io_hw_ptr = io_hw_ptr;
+		io_thread_update_delay(pcm, io_hw_ptr);
+	}
+
+	return total;
+}
+
 /**
  * IO thread, which facilitates ring buffer. */
 static void *io_thread(snd_pcm_ioplug_t *io) {
@@ -206,8 +365,8 @@ static void *io_thread(snd_pcm_ioplug_t *io) {
 	asrsync_init(&asrs, io->rate);
 
 	/* We update pcm->io_hw_ptr (i.e. the value seen by ioplug) only when
-	 * a period has been completed. We use a temporary copy during the
-	 * transfer procedure. */
+	 * a transfer chunk (by default a period) has been completed. We use a
+	 * temporary copy during the transfer procedure. */
 	snd_pcm_uframes_t io_hw_ptr = pcm->io_hw_ptr;
 
 	debug2("Starting IO loop: %d", pcm->ba_pcm_fd);
@@ -250,15 +409,15 @@ static void *io_thread(snd_pcm_ioplug_t *io) {
 		if ((avail = snd_pcm_ioplug_hw_avail(io, io_hw_ptr, io->appl_ptr)) == 0) {
 			io_thread_update_delay(pcm, 0);
 			pcm->io_hw_ptr = io_hw_ptr = -1;
-			eventfd_write(pcm->event_fd, 1);
+			event_signal(pcm);
 			continue;
 		}
 
 		/* current offset of the head pointer in the IO buffer */
 		snd_pcm_uframes_t offset = io_hw_ptr % io->buffer_size;
 
-		/* Transfer at most 1 period of frames in each iteration ... */
-		snd_pcm_uframes_t frames = io->period_size;
+		/* Transfer at most 1 chunk of frames in each iteration ... */
+		snd_pcm_uframes_t frames = pcm->io_chunk_size;
 		/* ... but do not try to transfer more frames than are available in the
 		 * ring buffer! */
 		if (frames > avail)
@@ -283,21 +442,33 @@ static void *io_thread(snd_pcm_ioplug_t *io) {
 		ssize_t ret = 0;
 		if (io->stream == SND_PCM_STREAM_CAPTURE) {
 
-			/* Read the whole period "atomically". This will assure, that frames
+			/* Read the whole chunk "atomically". This will assure, that frames
 			 * are not fragmented, so the pointer can be correctly updated. */
-			while (len != 0 && (ret = read(pcm->ba_pcm_fd, head, len)) != 0) {
-				if (ret == -1) {
-					if (errno == EINTR)
+			if (shm_ring_is_mapped(&pcm->ba_pcm_shm)) {
+				while (len != 0) {
+					if ((ret = shm_ring_read(&pcm->ba_pcm_shm, head, len)) == 0) {
+						if (io_thread_shm_wait(pcm, pcm->ba_pcm_shm.efd_data) == -1)
+							goto fail;
 						continue;
-					SNDERR("PCM FIFO read error: %s", strerror(errno));
-					goto fail;
+					}
+					head += ret;
+					len -= ret;
 				}
-				head += ret;
-				len -= ret;
 			}
-
-			if (ret == 0)
-				goto fail;
+			else {
+				while (len != 0 && (ret = read(pcm->ba_pcm_fd, head, len)) != 0) {
+					if (ret == -1) {
+						if (errno == EINTR)
+							continue;
+						SNDERR("PCM FIFO read error: %s", strerror(errno));
+						goto fail;
+					}
+					head += ret;
+					len -= ret;
+				}
+				if (ret == 0)
+					goto fail;
+			}
 
 			io_thread_update_delay(pcm, io_hw_ptr);
 
@@ -305,17 +476,30 @@ static void *io_thread(snd_pcm_ioplug_t *io) {
 		else {
 
 			/* Perform atomic write - see the explanation above. */
-			do {
-				if ((ret = write(pcm->ba_pcm_fd, head, len)) == -1) {
-					if (errno == EINTR)
+			if (shm_ring_is_mapped(&pcm->ba_pcm_shm)) {
+				while (len != 0) {
+					if ((ret = shm_ring_write(&pcm->ba_pcm_shm, head, len)) == 0) {
+						if (io_thread_shm_wait(pcm, pcm->ba_pcm_shm.efd_space) == -1)
+							goto fail;
 						continue;
-					if (errno != EPIPE)
-						SNDERR("PCM FIFO write error: %s", strerror(errno));
-					goto fail;
+					}
+					head += ret;
+					len -= ret;
 				}
-				head += ret;
-				len -= ret;
-			} while (len != 0);
+			}
+			else {
+				do {
+					if ((ret = write(pcm->ba_pcm_fd, head, len)) == -1) {
+						if (errno == EINTR)
+							continue;
+						if (errno != EPIPE)
+							SNDERR("PCM FIFO write error: %s", strerror(errno));
+						goto fail;
+					}
+					head += ret;
+					len -= ret;
+				} while (len != 0);
+			}
 
 			io_thread_update_delay(pcm, io_hw_ptr);
 
@@ -327,9 +511,11 @@ static void *io_thread(snd_pcm_ioplug_t *io) {
 		/* Make the new HW pointer value visible to the ioplug. */
 		pcm->io_hw_ptr = io_hw_ptr;
 
-		/* Wake application thread if enough space/frames is available. */
+		/* Wake application thread if enough space/frames is available. The
+		 * event is written only when the avail min threshold is crossed, i.e.
+		 * when the application has cleared the previous one. */
 		if (frames + io->buffer_size - avail >= pcm->io_avail_min)
-			eventfd_write(pcm->event_fd, 1);
+			event_signal(pcm);
 	}
 
 fail:
@@ -364,6 +550,13 @@ static int bluealsa_start(snd_pcm_ioplug_t *io) {
 	pcm->delay_running = io->stream == SND_PCM_STREAM_CAPTURE ? true : false;
 	gettimestamp(&pcm->delay_ts);
 
+	if (pcm->io_direct) {
+		/* Publish frames written by the application so far. Subsequent
+		 * transfers will be done by the pointer and transfer callbacks. */
+		io_direct_transfer(pcm, io->appl_ptr);
+		return 0;
+	}
+
 	/* start the IO thread */
 	pcm->io_started = true;
 	if ((errno = pthread_create(&pcm->io_thread, NULL,
@@ -400,7 +593,7 @@ static int bluealsa_stop(snd_pcm_ioplug_t *io) {
 
 	/* Applications that call poll() after snd_pcm_drain() will be blocked
 	 * forever unless we generate a poll() event here. */
-	eventfd_write(pcm->event_fd, 1);
+	event_signal(pcm);
 
 	return 0;
 }
@@ -420,6 +613,23 @@ static snd_pcm_sframes_t bluealsa_pointer(snd_pcm_ioplug_t *io) {
 		snd_pcm_ioplug_set_state(io, SND_PCM_STATE_DISCONNECTED);
 		return -ENODEV;
 	}
+	if (pcm->io_direct && (io->state == SND_PCM_STATE_RUNNING ||
+				io->state == SND_PCM_STATE_DRAINING)) {
+		if (io_direct_transfer(pcm, io->appl_ptr) == -1) {
+			close_transport(pcm);
+			snd_pcm_ioplug_set_state(io, SND_PCM_STATE_DISCONNECTED);
+			return -ENODEV;
+		}
+		/* Playback underrun occurs when all frames committed by the application
+		 * have been consumed by the server. */
+		if (io->stream == SND_PCM_STREAM_PLAYBACK &&
+				pcm->io_hw_ptr != -1 &&
+				snd_pcm_ioplug_hw_avail(io, pcm->io_hw_ptr, io->appl_ptr) == 0 &&
+				shm_ring_len_out(&pcm->ba_pcm_shm) == 0) {
+			io_thread_update_delay(pcm, 0);
+			pcm->io_hw_ptr = -1;
+		}
+	}
 #ifndef SND_PCM_IOPLUG_FLAG_BOUNDARY_WA
 	if (pcm->io_hw_ptr != -1)
 		return pcm->io_hw_ptr % io->buffer_size;
@@ -427,6 +637,34 @@ static snd_pcm_sframes_t bluealsa_pointer(snd_pcm_ioplug_t *io) {
 	return pcm->io_hw_ptr;
 }
 
+/**
+ * Transfer committed frames in the direct mode.
+ *
+ * With the mmap emulation enabled, the ioplug calls this function when the
+ * application commits playback frames (or checks available capture frames)
+ * with the mmap access. Frames are already stored in the HW buffer, so in
+ * the direct mode we can push them to the shared memory ring right away.
+ * In all other cases the IO thread takes care of the transfer. */
+static snd_pcm_sframes_t bluealsa_transfer(snd_pcm_ioplug_t *io,
+		const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset,
+		snd_pcm_uframes_t size) {
+	struct bluealsa_pcm *pcm = io->private_data;
+	(void)areas;
+	(void)offset;
+
+	if (pcm->io_direct &&
+			io->stream == SND_PCM_STREAM_PLAYBACK &&
+			io->state == SND_PCM_STATE_RUNNING) {
+		snd_pcm_uframes_t appl_ptr = io->appl_ptr + size;
+		if (appl_ptr >= pcm->io_hw_boundary)
+			appl_ptr -= pcm->io_hw_boundary;
+		if (io_direct_transfer(pcm, appl_ptr) == -1)
+			return -EPIPE;
+	}
+
+	return size;
+}
+
 static int bluealsa_close(snd_pcm_ioplug_t *io) {
 	struct bluealsa_pcm *pcm = io->private_data;
 	debug2("Closing");
@@ -438,6 +676,24 @@ static int bluealsa_close(snd_pcm_ioplug_t *io) {
 	return 0;
 }
 
+static snd_pcm_format_t get_snd_pcm_format(uint16_t format) {
+	switch (format) {
+	case 0x0108:
+		return SND_PCM_FORMAT_U8;
+	case 0x8210:
+		return SND_PCM_FORMAT_S16_LE;
+	case 0x8318:
+		return SND_PCM_FORMAT_S24_3LE;
+	case 0x8418:
+		return SND_PCM_FORMAT_S24_LE;
+	case 0x8420:
+		return SND_PCM_FORMAT_S32_LE;
+	default:
+		SNDERR("Unknown PCM format: %#x", format);
+		return SND_PCM_FORMAT_UNKNOWN;
+	}
+}
+
 static int bluealsa_hw_params(snd_pcm_ioplug_t *io, snd_pcm_hw_params_t *params) {
 	struct bluealsa_pcm *pcm = io->private_data;
 	(void)params;
@@ -446,29 +702,119 @@ static int bluealsa_hw_params(snd_pcm_ioplug_t *io, snd_pcm_hw_params_t *params)
 	pcm->frame_size = (snd_pcm_format_physical_width(io->format) * io->channels) / 8;
 
 	DBusError err = DBUS_ERROR_INIT;
-	if (!bluealsa_dbus_open_pcm(&pcm->dbus_ctx, pcm->ba_pcm.pcm_path,
+
+	/* Select stream format (before opening the PCM) in case when it differs
+	 * from the current one. The server will convert the signal for us. */
+	for (size_t i = 0; i < pcm->ba_pcm.formats_len; i++)
+		if (get_snd_pcm_format(pcm->ba_pcm.formats[i]) == io->format &&
+				pcm->ba_pcm.formats[i] != pcm->ba_pcm.format) {
+			pcm->ba_pcm.format = pcm->ba_pcm.formats[i];
+			debug2("Selecting PCM format: %#x", pcm->ba_pcm.format);
+			if (!bluealsa_dbus_pcm_update(&pcm->dbus_ctx, &pcm->ba_pcm,
+						BLUEALSA_PCM_FORMAT, &err)) {
+				SNDERR("Couldn't set PCM format: %s", err.message);
+				dbus_error_free(&err);
+				return -EIO;
+			}
+			break;
+		}
+
+	/* Select the number of channels in the same manner. The server will
+	 * down-mix or up-mix the signal for us. */
+	if (io->channels != pcm->ba_pcm.channels) {
+		pcm->ba_pcm.channels = io->channels;
+		debug2("Selecting PCM channels: %u", pcm->ba_pcm.channels);
+		if (!bluealsa_dbus_pcm_update(&pcm->dbus_ctx, &pcm->ba_pcm,
+					BLUEALSA_PCM_CHANNELS, &err)) {
+			SNDERR("Couldn't set PCM channels: %s", err.message);
+			dbus_error_free(&err);
+			return -EIO;
+		}
+	}
+
+	/* Select sampling frequency in the same manner. If it differs from
+	 * the native one, the server will resample the signal. */
+	for (size_t i = 0; i < pcm->ba_pcm.samplings_len; i++)
+		if (pcm->ba_pcm.samplings[i] == io->rate &&
+				pcm->ba_pcm.samplings[i] != pcm->ba_pcm.sampling) {
+			pcm->ba_pcm.sampling = pcm->ba_pcm.samplings[i];
+			debug2("Selecting PCM sampling: %u", pcm->ba_pcm.sampling);
+			if (!bluealsa_dbus_pcm_update(&pcm->dbus_ctx, &pcm->ba_pcm,
+						BLUEALSA_PCM_SAMPLING, &err)) {
+				SNDERR("Couldn't set PCM sampling: %s", err.message);
+				dbus_error_free(&err);
+				return -EIO;
+			}
+			break;
+		}
+
+	if (pcm->ba_pcm_shm_enabled) {
+		int fd_shm, fd_shm_data, fd_shm_space;
+		if (!bluealsa_dbus_open_pcm_shm(&pcm->dbus_ctx, pcm->ba_pcm.pcm_path,
+					&fd_shm, &fd_shm_data, &fd_shm_space, &pcm->ba_pcm_ctrl_fd, &err)) {
+			/* fall back to the FIFO, e.g. server does not support it */
+			debug2("Couldn't open PCM shared memory: %s", err.message);
+			dbus_error_free(&err);
+		}
+		else if (shm_ring_attach(&pcm->ba_pcm_shm, fd_shm, fd_shm_data, fd_shm_space) == -1) {
+			debug2("Couldn't attach PCM shared memory: %s", strerror(errno));
+			close_transport(pcm);
+		}
+		else
+			pcm->ba_pcm_fd = pcm->ba_pcm_shm.fd;
+	}
+
+	if (pcm->ba_pcm_fd == -1 &&
+			!bluealsa_dbus_open_pcm(&pcm->dbus_ctx, pcm->ba_pcm.pcm_path,
 				&pcm->ba_pcm_fd, &pcm->ba_pcm_ctrl_fd, &err)) {
 		debug2("Couldn't open PCM: %s", err.message);
 		dbus_error_free(&err);
 		return -EBUSY;
 	}
 
-	if (pcm->io.stream == SND_PCM_STREAM_PLAYBACK)
+	pcm->ba_pcm_ctrl_status = true;
+	pcm->ba_pcm_ctrl_position = true;
+
+	if (shm_ring_is_mapped(&pcm->ba_pcm_shm))
+		pcm->delay_fifo_size = pcm->ba_pcm_shm.size / pcm->frame_size;
+	else {
 		/* By default, the size of the pipe buffer is set to a too large value for
 		 * our purpose. On modern Linux system it is 65536 bytes. Large buffer in
 		 * the playback mode might contribute to an unnecessary audio delay. Since
-		 * it is possible to modify the size of this buffer we will set is to some
-		 * low value, but big enough to prevent audio tearing. Note, that the size
-		 * will be rounded up to the page size (typically 4096 bytes). */
-		pcm->delay_fifo_size = fcntl(pcm->ba_pcm_fd, F_SETPIPE_SZ, 2048) / pcm->frame_size;
-	else
-		pcm->delay_fifo_size = fcntl(pcm->ba_pcm_fd, F_GETPIPE_SZ)  / pcm->frame_size;
+		 * it is possible to modify the size of this buffer we will set is to the
+		 * value selected by the latency profile. Note, that the size will be
+		 * rounded up to the page size (typically 4096 bytes). */
+		int size = -1;
+		if (pcm->fifo_size > 0 &&
+				(size = fcntl(pcm->ba_pcm_fd, F_SETPIPE_SZ, pcm->fifo_size)) == -1)
+			debug2("Couldn't set FIFO size: %s", strerror(errno));
+		if (size == -1)
+			size = fcntl(pcm->ba_pcm_fd, F_GETPIPE_SZ);
+		pcm->delay_fifo_size = size / pcm->frame_size;
+	}
 
 	debug2("FIFO buffer size: %zd frames", pcm->delay_fifo_size);
 
 	/* ALSA default for avail min is one period. */
 	pcm->io_avail_min = io->period_size;
 
+	/* Fine-grained transfer allows to update the HW pointer more often than
+	 * once per period, so small avail min can be used with large buffers. */
+	pcm->io_chunk_size = io->period_size;
+	if (pcm->io_chunk_ms > 0) {
+		snd_pcm_uframes_t frames = io->rate * pcm->io_chunk_ms / 1000;
+		if (frames == 0)
+			frames = 1;
+		if (frames < pcm->io_chunk_size)
+			pcm->io_chunk_size = frames;
+		debug2("IO transfer chunk size: %zu frames", pcm->io_chunk_size);
+	}
+
+	pcm->io_direct = shm_ring_is_mapped(&pcm->ba_pcm_shm) &&
+		io->access == SND_PCM_ACCESS_MMAP_INTERLEAVED;
+	if (pcm->io_direct)
+		debug2("Using direct shared memory ring access");
+
 	debug2("Selected HW buffer: %zd periods x %zd bytes %c= %zd bytes",
 			io->buffer_size / io->period_size, pcm->frame_size * io->period_size,
 			io->period_size * (io->buffer_size / io->period_size) == io->buffer_size ? '=' : '<',
@@ -480,6 +826,7 @@ static int bluealsa_hw_params(snd_pcm_ioplug_t *io, snd_pcm_hw_params_t *params)
 static int bluealsa_hw_free(snd_pcm_ioplug_t *io) {
 	struct bluealsa_pcm *pcm = io->private_data;
 	debug2("Freeing HW");
+	pcm->io_direct = false;
 	if (close_transport(pcm) == -1)
 		return -errno;
 	return 0;
@@ -524,7 +871,7 @@ static int bluealsa_prepare(snd_pcm_ioplug_t *io) {
 	 * true - the IO thread may not be running yet. Applications using
 	 * snd_pcm_sw_params_set_start_threshold() require the PCM to be usable
 	 * as soon as it has been prepared. */
-	eventfd_write(pcm->event_fd, 1);
+	event_signal(pcm);
 
 	debug2("Prepared");
 	return 0;
@@ -532,6 +879,15 @@ static int bluealsa_prepare(snd_pcm_ioplug_t *io) {
 
 static int bluealsa_drain(snd_pcm_ioplug_t *io) {
 	struct bluealsa_pcm *pcm = io->private_data;
+
+	/* In the direct mode there is no IO thread which would flush frames
+	 * left in the HW buffer, so we have to do it here. */
+	if (pcm->io_direct && io->stream == SND_PCM_STREAM_PLAYBACK)
+		while (io_direct_transfer(pcm, io->appl_ptr) != -1 &&
+				pcm->io_hw_ptr != -1 &&
+				snd_pcm_ioplug_hw_avail(io, pcm->io_hw_ptr, io->appl_ptr) > 0)
+			if (io_thread_shm_wait(pcm, pcm->ba_pcm_shm.efd_space) == -1)
+				break;
 	bluealsa_dbus_pcm_ctrl_send_drain(pcm->ba_pcm_ctrl_fd, NULL);
 	/* We cannot recover from an error here. By returning zero we ensure that
 	 * ioplug stops the pcm. Returning an error code would be interpreted by
@@ -539,6 +895,55 @@ static int bluealsa_drain(snd_pcm_ioplug_t *io) {
 	return 0;
 }
 
+/**
+ * Calculate playback delay based on the server presentation position.
+ *
+ * The server reports the number of frames read from the FIFO and the number
+ * of frames written to the Bluetooth socket, together with the time of the
+ * last write. Adding frames queued in the HW buffer and in the FIFO gives
+ * the number of frames which will be played before the next frame written
+ * by the application. */
+static snd_pcm_sframes_t bluealsa_calculate_playback_delay(snd_pcm_ioplug_t *io,
+		const struct ba_pcm_ctrl_position *position) {
+	struct bluealsa_pcm *pcm = io->private_data;
+
+	const snd_pcm_sframes_t hw_ptr = pcm->io_hw_ptr;
+	unsigned int nread = 0;
+	struct timespec now;
+
+	/* The HW pointer is updated by the IO thread after the transfer, so it
+	 * has to be read before the FIFO level. Otherwise, frames which are in
+	 * the middle of the transfer might not be counted at all. */
+	if (shm_ring_is_mapped(&pcm->ba_pcm_shm))
+		nread = shm_ring_len_out(&pcm->ba_pcm_shm);
+	else
+		ioctl(pcm->ba_pcm_fd, FIONREAD, &nread);
+	gettimestamp(&now);
+
+	snd_pcm_sframes_t delay = nread / pcm->frame_size;
+
+	if (hw_ptr != -1 && io->state != SND_PCM_STATE_XRUN)
+		delay += snd_pcm_ioplug_hw_avail(io, hw_ptr, io->appl_ptr);
+
+	/* frames buffered by the server but not written to the BT socket yet */
+	if (position->frames > position->frames_bt)
+		delay += position->frames - position->frames_bt;
+
+	/* The codec and transport delay applies to the last written frame. Since
+	 * that time the device has been playing, so reduce it accordingly. */
+	snd_pcm_sframes_t ba_delay = (io->rate / 100) * position->delay / 100;
+	if (pcm->delay_running) {
+		const struct timespec ts = { position->ts_sec, position->ts_nsec };
+		struct timespec diff;
+		difftimespec(&ts, &now, &diff);
+		const snd_pcm_sframes_t elapsed =
+			(diff.tv_sec * 1000 + diff.tv_nsec / 1000000) * io->rate / 1000;
+		ba_delay = elapsed < ba_delay ? ba_delay - elapsed : 0;
+	}
+
+	return delay + ba_delay + pcm->delay_ex;
+}
+
 /**
  * Calculate overall PCM delay.
  *
@@ -556,9 +961,29 @@ static snd_pcm_sframes_t bluealsa_calculate_delay(snd_pcm_ioplug_t *io) {
 	if (!pcm->delay_running && io->stream == SND_PCM_STREAM_CAPTURE)
 		return 0;
 
+	/* For playback, use the server presentation position if available. */
+	if (io->stream == SND_PCM_STREAM_PLAYBACK && pcm->ba_pcm_ctrl_position) {
+		struct ba_pcm_ctrl_position position;
+		if (bluealsa_dbus_pcm_ctrl_get_position(pcm->ba_pcm_ctrl_fd, &position, NULL))
+			return bluealsa_calculate_playback_delay(io, &position);
+		if (errno == ENOTSUP)
+			pcm->ba_pcm_ctrl_position = false;
+	}
+
 	struct timespec now;
 	gettimestamp(&now);
 
+	/* Get the BlueALSA component of the delay directly from the server via
+	 * the PCM controller socket, which is much cheaper than D-Bus. */
+	struct ba_pcm_ctrl_status status;
+	bool ba_delay_queried = false;
+	if (pcm->ba_pcm_ctrl_status) {
+		if (bluealsa_dbus_pcm_ctrl_get_status(pcm->ba_pcm_ctrl_fd, &status, NULL))
+			ba_delay_queried = true;
+		else if (errno == ENOTSUP)
+			pcm->ba_pcm_ctrl_status = false;
+	}
+
 	/* In most cases, dispatching D-Bus messages/signals should be done in the
 	 * poll_revents() callback. However, this mode of operation requires client
 	 * code to use ALSA polling API. If for some reasons, client simply writes
@@ -568,8 +993,10 @@ static snd_pcm_sframes_t bluealsa_calculate_delay(snd_pcm_ioplug_t *io) {
 	 *
 	 * This synchronous dispatching will be performed only if the last D-Bus
 	 * dispatching was done more than one second ago - this should prioritize
-	 * asynchronous dispatching in the poll_revents() callback. */
-	if (pcm->dbus_dispatch_ts.tv_sec + 1 < now.tv_sec) {
+	 * asynchronous dispatching in the poll_revents() callback. Also, it is
+	 * not required at all if the delay has been queried via controller. */
+	if (!ba_delay_queried &&
+			pcm->dbus_dispatch_ts.tv_sec + 1 < now.tv_sec) {
 		bluealsa_dbus_connection_dispatch(&pcm->dbus_ctx);
 		gettimestamp(&pcm->dbus_dispatch_ts);
 	}
@@ -632,7 +1059,8 @@ static snd_pcm_sframes_t bluealsa_calculate_delay(snd_pcm_ioplug_t *io) {
 	pthread_mutex_unlock(&pcm->mutex);
 
 	/* data transfer (communication) and encoding/decoding */
-	delay += (io->rate / 100) * pcm->ba_pcm.delay / 100;
+	const unsigned int ba_delay = ba_delay_queried ? status.delay : pcm->ba_pcm.delay;
+	delay += (io->rate / 100) * ba_delay / 100;
 
 	delay += pcm->delay_ex;
 
@@ -642,7 +1070,7 @@ static snd_pcm_sframes_t bluealsa_calculate_delay(snd_pcm_ioplug_t *io) {
 static int bluealsa_pause(snd_pcm_ioplug_t *io, int enable) {
 	struct bluealsa_pcm *pcm = io->private_data;
 
-	if (enable == 1) {
+	if (enable == 1 && !pcm->io_direct) {
 		/* Synchronize the IO thread with an application thread to ensure that
 		 * the server will not be paused while we are processing a transfer. */
 		pthread_mutex_lock(&pcm->mutex);
@@ -656,8 +1084,10 @@ static int bluealsa_pause(snd_pcm_ioplug_t *io, int enable) {
 				enable ? "Pause" : "Resume", NULL))
 		return -errno;
 
-	if (enable == 0)
-		pthread_kill(pcm->io_thread, SIGIO);
+	if (enable == 0) {
+		if (!pcm->io_direct)
+			pthread_kill(pcm->io_thread, SIGIO);
+	}
 	else
 		/* store current delay value */
 		pcm->delay_paused = bluealsa_calculate_delay(io);
@@ -666,7 +1096,7 @@ static int bluealsa_pause(snd_pcm_ioplug_t *io, int enable) {
 	 * the implementer relies on the PCM file descriptor readiness, we have to
 	 * bump our internal event trigger. Otherwise, client might stuck forever
 	 * in the poll/select system call. */
-	eventfd_write(pcm->event_fd, 1);
+	event_signal(pcm);
 
 	return 0;
 }
@@ -724,22 +1154,34 @@ static int bluealsa_poll_descriptors_count(snd_pcm_ioplug_t *io) {
 	nfds_t dbus_nfds = 0;
 	bluealsa_dbus_connection_poll_fds(&pcm->dbus_ctx, NULL, &dbus_nfds);
 
-	return 1 + dbus_nfds;
+	return 1 + pcm->io_direct + dbus_nfds;
 }
 
 static int bluealsa_poll_descriptors(snd_pcm_ioplug_t *io, struct pollfd *pfd,
 		unsigned int nfds) {
 	struct bluealsa_pcm *pcm = io->private_data;
 
-	nfds_t dbus_nfds = nfds - 1;
-	if (!bluealsa_dbus_connection_poll_fds(&pcm->dbus_ctx, &pfd[1], &dbus_nfds))
+	const unsigned int pcm_nfds = 1 + pcm->io_direct;
+	if (nfds < pcm_nfds)
+		return -EINVAL;
+
+	nfds_t dbus_nfds = nfds - pcm_nfds;
+	if (!bluealsa_dbus_connection_poll_fds(&pcm->dbus_ctx, &pfd[pcm_nfds], &dbus_nfds))
 		return -EINVAL;
 
 	/* PCM plug-in relies on our internal event file descriptor. */
 	pfd[0].fd = pcm->event_fd;
 	pfd[0].events = POLLIN;
 
-	return 1 + dbus_nfds;
+	/* In the direct mode, the shared memory ring readiness triggers the
+	 * transfer of frames between the HW buffer and the ring. */
+	if (pcm->io_direct) {
+		pfd[1].fd = io->stream == SND_PCM_STREAM_PLAYBACK ?
+			pcm->ba_pcm_shm.efd_space : pcm->ba_pcm_shm.efd_data;
+		pfd[1].events = POLLIN;
+	}
+
+	return pcm_nfds + dbus_nfds;
 }
 
 static int bluealsa_poll_revents(snd_pcm_ioplug_t *io, struct pollfd *pfd,
@@ -749,21 +1191,25 @@ static int bluealsa_poll_revents(snd_pcm_ioplug_t *io, struct pollfd *pfd,
 	*revents = 0;
 	int ret = 0;
 
-	bluealsa_dbus_connection_poll_dispatch(&pcm->dbus_ctx, &pfd[1], nfds - 1);
-	while (dbus_connection_dispatch(pcm->dbus_ctx.conn) == DBUS_DISPATCH_DATA_REMAINS)
-		continue;
+	const unsigned int pcm_nfds = 1 + pcm->io_direct;
+	if (nfds < pcm_nfds)
+		return -EINVAL;
+
+	/* Dispatch D-Bus messages only if there was some activity on the D-Bus
+	 * connection, or there are messages queued by the synchronous calls. */
+	if (bluealsa_dbus_connection_poll_dispatch(&pcm->dbus_ctx, &pfd[pcm_nfds], nfds - pcm_nfds) ||
+			dbus_connection_get_dispatch_status(pcm->dbus_ctx.conn) == DBUS_DISPATCH_DATA_REMAINS)
+		while (dbus_connection_dispatch(pcm->dbus_ctx.conn) == DBUS_DISPATCH_DATA_REMAINS)
+			continue;
 	gettimestamp(&pcm->dbus_dispatch_ts);
 
 	if (pcm->ba_pcm_fd == -1)
 		goto fail;
 
-	if (pfd[0].revents & POLLIN) {
+	/* The ring event is level-triggered, so it shall not be read here. */
+	const bool ring_ready = pcm->io_direct && pfd[1].revents & POLLIN;
 
-		eventfd_t event;
-		eventfd_read(pcm->event_fd, &event);
-
-		if (event & 0xDEAD0000)
-			goto fail;
+	if (pfd[0].revents & POLLIN || ring_ready) {
 
 		/* This call synchronizes the ring buffer pointers and updates the
 		 * ioplug state. */
@@ -773,7 +1219,7 @@ static int bluealsa_poll_revents(snd_pcm_ioplug_t *io, struct pollfd *pfd,
 		 * playback will not start if the event is for reading. */
 		*revents = io->stream == SND_PCM_STREAM_CAPTURE ? POLLIN : POLLOUT;
 
-		/* We hold the event fd ready, unless insufficient frames are
+		/* We keep the event fd ready, unless insufficient frames are
 		 * available in the ring buffer. */
 		bool ready = true;
 
@@ -810,8 +1256,25 @@ static int bluealsa_poll_revents(snd_pcm_ioplug_t *io, struct pollfd *pfd,
 				break;
 		};
 
-		if (ready)
-			eventfd_write(pcm->event_fd, 1);
+		/* Clear the event if the PCM is not ready. In order not to miss the
+		 * event signaled by the IO thread in the meantime, the readiness has
+		 * to be checked once more after clearing the event. */
+		if (!ready && pfd[0].revents & POLLIN) {
+
+			eventfd_t event;
+			atomic_store(&pcm->event_pending, false);
+			eventfd_read(pcm->event_fd, &event);
+
+			if (event & 0xDEAD0000)
+				goto fail;
+
+			if (io->state == SND_PCM_STATE_RUNNING &&
+					(snd_pcm_uframes_t)snd_pcm_avail(io->pcm) >= pcm->io_avail_min) {
+				*revents = io->stream == SND_PCM_STREAM_CAPTURE ? POLLIN : POLLOUT;
+				event_signal(pcm);
+			}
+
+		}
 
 	}
 
@@ -827,6 +1290,7 @@ static const snd_pcm_ioplug_callback_t bluealsa_callback = {
 	.start = bluealsa_start,
 	.stop = bluealsa_stop,
 	.pointer = bluealsa_pointer,
+	.transfer = bluealsa_transfer,
 	.close = bluealsa_close,
 	.hw_params = bluealsa_hw_params,
 	.hw_free = bluealsa_hw_free,
@@ -864,24 +1328,6 @@ static int str2profile(const char *str) {
 	return 0;
 }
 
-static snd_pcm_format_t get_snd_pcm_format(uint16_t format) {
-	switch (format) {
-	case 0x0108:
-		return SND_PCM_FORMAT_U8;
-	case 0x8210:
-		return SND_PCM_FORMAT_S16_LE;
-	case 0x8318:
-		return SND_PCM_FORMAT_S24_3LE;
-	case 0x8418:
-		return SND_PCM_FORMAT_S24_LE;
-	case 0x8420:
-		return SND_PCM_FORMAT_S32_LE;
-	default:
-		SNDERR("Unknown PCM format: %#x", format);
-		return SND_PCM_FORMAT_UNKNOWN;
-	}
-}
-
 static DBusHandlerResult bluealsa_dbus_msg_filter(DBusConnection *conn,
 		DBusMessage *message, void *data) {
 	struct bluealsa_pcm *pcm = (struct bluealsa_pcm *)data;
@@ -925,9 +1371,16 @@ static int bluealsa_set_hw_constraint(struct bluealsa_pcm *pcm) {
 					ARRAYSIZE(accesses), accesses)) < 0)
 		return err;
 
-	unsigned int formats[] = { get_snd_pcm_format(pcm->ba_pcm.format) };
+	/* Older servers do not report supported formats. */
+	unsigned int formats[ARRAYSIZE(pcm->ba_pcm.formats)] = {
+		get_snd_pcm_format(pcm->ba_pcm.format) };
+	size_t formats_len = 1;
+	for (size_t i = 0; i < pcm->ba_pcm.formats_len; i++)
+		formats[i] = get_snd_pcm_format(pcm->ba_pcm.formats[i]);
+	if (pcm->ba_pcm.formats_len > 0)
+		formats_len = pcm->ba_pcm.formats_len;
 	if ((err = snd_pcm_ioplug_set_param_list(io, SND_PCM_IOPLUG_HW_FORMAT,
-					ARRAYSIZE(formats), formats)) < 0)
+					formats_len, formats)) < 0)
 		return err;
 
 	if ((err = snd_pcm_ioplug_set_param_minmax(io, SND_PCM_IOPLUG_HW_PERIODS,
@@ -937,25 +1390,68 @@ static int bluealsa_set_hw_constraint(struct bluealsa_pcm *pcm) {
 	/* In order to prevent audio tearing and minimize CPU utilization, we're
 	 * going to setup period size constraint. The limit is derived from the
 	 * transport sampling rate and the number of channels, so the period
-	 * "time" size will be constant, and should be about 10ms. The upper
-	 * limit will not be constrained. */
-	unsigned int min_p = pcm->ba_pcm.sampling / 100 * pcm->ba_pcm.channels *
+	 * "time" size will be constant, and should match the latency profile.
+	 * The upper limit will not be constrained. */
+	const unsigned int frame_bytes = pcm->ba_pcm.channels *
 		snd_pcm_format_physical_width(get_snd_pcm_format(pcm->ba_pcm.format)) / 8;
+	unsigned int min_p = pcm->ba_pcm.sampling * pcm->period_ms / 1000 * frame_bytes;
+	const unsigned int max_p = 1024 * 1024;
+
+	/* Align the minimal period to the codec block, so the encoder will not
+	 * have to wait for the next period in order to fill the last block. */
+	const unsigned int block_p = (pcm->ba_pcm.block_frames > 1 ?
+			pcm->ba_pcm.block_frames : 1) * frame_bytes;
+	min_p = (min_p + block_p - 1) / block_p * block_p;
+
+	/* Steer applications to period sizes which are multiples of the codec
+	 * block. However, if the block is so small that the list of all aligned
+	 * sizes would be huge, only the minimal period size is aligned. */
+	const size_t periods_len = (max_p - min_p) / block_p + 1;
+	if (pcm->ba_pcm.block_frames > 1 && periods_len <= 4096) {
+
+		unsigned int *periods;
+		if ((periods = malloc(periods_len * sizeof(*periods))) == NULL)
+			return -ENOMEM;
+		for (size_t i = 0; i < periods_len; i++)
+			periods[i] = min_p + i * block_p;
+
+		err = snd_pcm_ioplug_set_param_list(io, SND_PCM_IOPLUG_HW_PERIOD_BYTES,
+				periods_len, periods);
+		free(periods);
+		if (err < 0)
+			return err;
 
-	if ((err = snd_pcm_ioplug_set_param_minmax(io, SND_PCM_IOPLUG_HW_PERIOD_BYTES,
-					min_p, 1024 * 1024)) < 0)
+	}
+	else if ((err = snd_pcm_ioplug_set_param_minmax(io, SND_PCM_IOPLUG_HW_PERIOD_BYTES,
+					min_p, max_p)) < 0)
 		return err;
 
 	if ((err = snd_pcm_ioplug_set_param_minmax(io, SND_PCM_IOPLUG_HW_BUFFER_BYTES,
 					2 * min_p, 2 * 1024 * 1024)) < 0)
 		return err;
 
+	/* Mono and stereo streams can be converted by the server, so the
+	 * application is allowed to select either of them. */
+	unsigned int channels_min = pcm->ba_pcm.channels;
+	unsigned int channels_max = pcm->ba_pcm.channels;
+	if (channels_max <= 2) {
+		channels_min = 1;
+		channels_max = 2;
+	}
 	if ((err = snd_pcm_ioplug_set_param_minmax(io, SND_PCM_IOPLUG_HW_CHANNELS,
-					pcm->ba_pcm.channels, pcm->ba_pcm.channels)) < 0)
+					channels_min, channels_max)) < 0)
 		return err;
 
-	if ((err = snd_pcm_ioplug_set_param_minmax(io, SND_PCM_IOPLUG_HW_RATE,
-					pcm->ba_pcm.sampling, pcm->ba_pcm.sampling)) < 0)
+	/* Older servers do not report supported sampling frequencies. */
+	unsigned int samplings[ARRAYSIZE(pcm->ba_pcm.samplings)] = {
+		pcm->ba_pcm.sampling };
+	size_t samplings_len = 1;
+	for (size_t i = 0; i < pcm->ba_pcm.samplings_len; i++)
+		samplings[i] = pcm->ba_pcm.samplings[i];
+	if (pcm->ba_pcm.samplings_len > 0)
+		samplings_len = pcm->ba_pcm.samplings_len;
+	if ((err = snd_pcm_ioplug_set_param_list(io, SND_PCM_IOPLUG_HW_RATE,
+					samplings_len, samplings)) < 0)
 		return err;
 
 	return 0;
@@ -970,6 +1466,10 @@ SND_PCM_PLUGIN_DEFINE_FUNC(bluealsa) {
 	const char *profile = NULL;
 	struct bluealsa_pcm *pcm;
 	long delay = 0;
+	long chunk = 0;
+	long fifo = 0;
+	const char *latency = "normal";
+	int shm = 0;
 	int ret;
 
 	snd_config_for_each(i, next, conf) {
@@ -1012,6 +1512,42 @@ SND_PCM_PLUGIN_DEFINE_FUNC(bluealsa) {
 			}
 			continue;
 		}
+		if (strcmp(id, "chunk") == 0) {
+			if (snd_config_get_integer(n, &chunk) < 0) {
+				SNDERR("Invalid type for %s", id);
+				return -EINVAL;
+			}
+			if (chunk < 0) {
+				SNDERR("Invalid transfer chunk time: %ld", chunk);
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "latency") == 0) {
+			if (snd_config_get_string(n, &latency) < 0) {
+				SNDERR("Invalid type for %s", id);
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "fifo") == 0) {
+			if (snd_config_get_integer(n, &fifo) < 0) {
+				SNDERR("Invalid type for %s", id);
+				return -EINVAL;
+			}
+			if (fifo < 0) {
+				SNDERR("Invalid FIFO size: %ld", fifo);
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "shm") == 0) {
+			if ((shm = snd_config_get_bool(n)) < 0) {
+				SNDERR("Invalid type for %s", id);
+				return -EINVAL;
+			}
+			continue;
+		}
 
 		SNDERR("Unknown field %s", id);
 		return -EINVAL;
@@ -1029,6 +1565,15 @@ SND_PCM_PLUGIN_DEFINE_FUNC(bluealsa) {
 		return -EINVAL;
 	}
 
+	size_t ba_latency;
+	for (ba_latency = 0; ba_latency < ARRAYSIZE(latency_profiles); ba_latency++)
+		if (strcmp(latency_profiles[ba_latency].name, latency) == 0)
+			break;
+	if (ba_latency == ARRAYSIZE(latency_profiles)) {
+		SNDERR("Invalid latency profile [low, normal, high]: %s", latency);
+		return -EINVAL;
+	}
+
 	if ((pcm = calloc(1, sizeof(*pcm))) == NULL)
 		return -ENOMEM;
 
@@ -1036,6 +1581,14 @@ SND_PCM_PLUGIN_DEFINE_FUNC(bluealsa) {
 	pcm->ba_pcm_fd = -1;
 	pcm->ba_pcm_ctrl_fd = -1;
 	pcm->delay_ex = delay;
+	pcm->io_chunk_ms = chunk;
+	pcm->fifo_size = fifo;
+	if (fifo == 0)
+		pcm->fifo_size = stream == SND_PCM_STREAM_PLAYBACK ?
+			latency_profiles[ba_latency].fifo_playback :
+			latency_profiles[ba_latency].fifo_capture;
+	pcm->period_ms = latency_profiles[ba_latency].period_ms;
+	pcm->ba_pcm_shm_enabled = shm;
 	pthread_mutex_init(&pcm->mutex, NULL);
 	pthread_cond_init(&pcm->pause_cond, NULL);
 	pcm->pause_state = BA_PAUSE_STATE_RUNNING;
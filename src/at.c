@@ -12,6 +12,7 @@
 #include "at.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -63,50 +64,25 @@ char *at_build(char *buffer, enum bt_at_type type, const char *command,
 }
 
 /**
- * Parse AT message.
+ * Parse AT message in place.
  *
- * @param str String to parse.
+ * @param msg NUL-terminated message without the trailing <CR> character.
+ *   This buffer is modified by this function, and the command and value of
+ *   the parsed message will point to it.
  * @param at Address of the AT structure, where the parsed information will
  *   be stored.
- * @return On success this function returns a pointer to the next message
- *   within the input string. If the input string contains only one message,
- *   returned value will point to the end null byte. On error, this function
- *   returns NULL. */
-char *at_parse(const char *str, struct bt_at *at) {
+ * @return On success this function returns 0, otherwise -1 is returned. */
+static int at_parse_message(char *msg, struct bt_at *at) {
 
-	char *command = at->command;
-	bool is_command = false;
-	const char *feed;
+	char *command;
 	char *tmp;
 
-	/* locate <CR> character, which indicates end of message */
-	if ((feed = strchr(str, '\r')) == NULL)
-		return NULL;
-
-	/* consume empty message */
-	if (feed == str)
-		return at_parse(feed + 1, at);
-
-	/* check whether we are parsing AT command */
-	if (strncasecmp(str, "AT", 2) == 0) {
-		is_command = true;
-		str += 2;
-	}
-	else {
-		/* response starts with <LF> sequence */
-		if (str[0] != '\n')
-			return NULL;
-		str += 1;
-	}
-
-	strncpy(command, str, sizeof(at->command) - 1);
 	at->value = NULL;
 
-	/* check everything twice (we don't want to be hacked) */
-	if ((size_t)(feed - str) < sizeof(at->command))
-		command[feed - str] = '\0';
+	/* check whether we are parsing AT command */
+	if (strncasecmp(msg, "AT", 2) == 0) {
 
-	if (is_command) {
+		command = msg + 2;
 
 		/* determine command type */
 		if ((tmp = strchr(command, '=')) != NULL) {
@@ -126,9 +102,11 @@ char *at_parse(const char *str, struct bt_at *at) {
 			*tmp = '\0';
 
 	}
-	else {
+	/* response starts with <LF> sequence */
+	else if (msg[0] == '\n') {
 
 		at->type = AT_TYPE_RESP;
+		command = msg + 1;
 
 		if ((tmp = strchr(command, ':')) == NULL)
 			/* provide support for GSM standard */
@@ -139,29 +117,184 @@ char *at_parse(const char *str, struct bt_at *at) {
 			*tmp = '\0';
 		}
 		else {
-			/* unsolicited (with empty command) result code */
-			at->value = memmove(command + 1, command, sizeof(at->command) - 1);
-			command[0] = command[sizeof(at->command) - 1] = '\0';
+			/* unsolicited (with empty command) result code, so
+			 * reuse the leading <LF> as an empty command string */
+			at->value = command;
+			command = msg;
+			command[0] = '\0';
 		}
 
-		/* consume <LF> from the end of the response */
-		if (feed[1] == '\n')
-			feed++;
-
 	}
+	else
+		return -1;
+
+	at->command = command;
 
 	/* In the BT specification, all AT commands are in uppercase letters.
 	 * However, if someone will not respect this "convention", we will make
 	 * life easier by converting received command to all uppercase. */
-	while (*command != '\0') {
+	for (; *command != '\0'; command++)
 		*command = toupper(*command);
-		command++;
-	}
 
 	debug("AT message: %s: command:%s, value:%s", at_type2str(at->type), at->command, at->value);
+	return 0;
+}
+
+/**
+ * Parse AT message.
+ *
+ * The parsed message is copied into the AT structure storage, so the input
+ * string is not modified. Messages longer than this storage are truncated.
+ *
+ * @param str String to parse.
+ * @param at Address of the AT structure, where the parsed information will
+ *   be stored.
+ * @return On success this function returns a pointer to the next message
+ *   within the input string. If the input string contains only one message,
+ *   returned value will point to the end null byte. On error, this function
+ *   returns NULL. */
+char *at_parse(const char *str, struct bt_at *at) {
+
+	const char *feed;
+
+	/* consume empty messages */
+	while (*str == '\r')
+		str++;
+
+	/* locate <CR> character, which indicates end of message */
+	if ((feed = strchr(str, '\r')) == NULL)
+		return NULL;
+
+	size_t len = feed - str;
+	if (len > sizeof(at->buffer) - 1)
+		len = sizeof(at->buffer) - 1;
+
+	memcpy(at->buffer, str, len);
+	at->buffer[len] = '\0';
+
+	if (at_parse_message(at->buffer, at) == -1)
+		return NULL;
+
+	/* consume <LF> from the end of the response */
+	if (at->type == AT_TYPE_RESP && feed[1] == '\n')
+		feed++;
+
 	return (char *)&feed[1];
 }
 
+/**
+ * Get the free space of the AT reader buffer.
+ *
+ * This function invalidates the command and value of the last parsed
+ * message, because not parsed data is moved to the beginning of the buffer.
+ *
+ * @param reader Pointer to the AT reader structure.
+ * @param len Address where the number of bytes which can be written to the
+ *   returned address will be stored.
+ * @return Address of the free space within the reader buffer. */
+char *at_reader_tail(struct at_reader *reader, size_t *len) {
+
+	if (reader->offset > 0) {
+		memmove(reader->buffer, &reader->buffer[reader->offset], reader->len - reader->offset);
+		reader->len -= reader->offset;
+		reader->scanned -= reader->scanned > reader->offset ? reader->offset : reader->scanned;
+		reader->offset = 0;
+	}
+
+	/* keep space for the NUL terminator of the overlong message */
+	*len = sizeof(reader->buffer) - 1 - reader->len;
+	return &reader->buffer[reader->len];
+}
+
+/**
+ * Mark given number of bytes written to the AT reader buffer tail. */
+void at_reader_seek(struct at_reader *reader, size_t len) {
+	reader->len += len;
+}
+
+/**
+ * Check whether the AT reader holds complete message.
+ *
+ * Leading empty messages are consumed and the scanned part of the buffer is
+ * remembered, so subsequent calls do not scan the same data again. */
+bool at_reader_has_message(struct at_reader *reader) {
+
+	while (reader->offset < reader->len && reader->buffer[reader->offset] == '\r')
+		reader->offset++;
+	if (reader->scanned < reader->offset)
+		reader->scanned = reader->offset;
+
+	const char *feed;
+	if ((feed = memchr(&reader->buffer[reader->scanned], '\r',
+					reader->len - reader->scanned)) == NULL) {
+		reader->scanned = reader->len;
+		return false;
+	}
+
+	reader->scanned = feed - reader->buffer;
+	return true;
+}
+
+/**
+ * Parse the next AT message from the AT reader buffer.
+ *
+ * The parsed message is stored in the at field of the reader structure. Its
+ * command and value are valid until the next at_reader_tail() call.
+ *
+ * @param reader Pointer to the AT reader structure.
+ * @return On success this function returns 0. Otherwise, -1 is returned and
+ *   errno is set to indicate the error. If there is no complete message in
+ *   the buffer, errno is set to EAGAIN. In case of invalid or overlong
+ *   message, errno is set to EBADMSG, the message is discarded and it is
+ *   available as the command of the AT_TYPE_RAW message. */
+int at_reader_parse(struct at_reader *reader) {
+
+	struct bt_at *at = &reader->at;
+	char *msg;
+
+	for (;;) {
+
+		if (!at_reader_has_message(reader)) {
+
+			if (reader->len - reader->offset < sizeof(reader->buffer) - 1)
+				return errno = EAGAIN, -1;
+
+			/* message does not fit into the buffer */
+			msg = &reader->buffer[reader->offset];
+			reader->buffer[reader->len] = '\0';
+			reader->offset = reader->scanned = reader->len;
+			goto fail;
+
+		}
+
+		msg = &reader->buffer[reader->offset];
+		reader->buffer[reader->scanned] = '\0';
+		reader->offset = reader->scanned + 1;
+
+		/* Consume empty response. It might be a result of the trailing
+		 * <LF> of the previous response, which has not been available
+		 * when the previous response was parsed. */
+		if (msg[0] == '\n' && msg[1] == '\0')
+			continue;
+
+		if (at_parse_message(msg, at) == -1)
+			goto fail;
+
+		/* consume <LF> from the end of the response */
+		if (at->type == AT_TYPE_RESP && reader->offset < reader->len &&
+				reader->buffer[reader->offset] == '\n')
+			reader->offset++;
+
+		return 0;
+	}
+
+fail:
+	at->type = AT_TYPE_RAW;
+	at->command = msg;
+	at->value = NULL;
+	return errno = EBADMSG, -1;
+}
+
 /**
  * Parse AT +BIA SET command value.
  *
@@ -13,6 +13,7 @@
 #define BLUEALSA_AT_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #include "hfp.h"
 
@@ -28,13 +29,39 @@ enum bt_at_type {
 
 struct bt_at {
 	enum bt_at_type type;
-	char command[256];
+	/* command (in uppercase) or empty string */
+	char *command;
+	/* command value or NULL */
 	char *value;
+	/* storage for the message parsed with at_parse() */
+	char buffer[256];
+};
+
+/**
+ * Incremental AT message reader.
+ *
+ * Data is appended to the reader buffer as it arrives, and messages are
+ * parsed in place, so the command and value of the parsed message point
+ * directly to the reader buffer. Messages split across several reads are
+ * reassembled. */
+struct at_reader {
+	struct bt_at at;
+	char buffer[256];
+	/* number of bytes stored in the buffer */
+	size_t len;
+	/* offset of the first not parsed byte */
+	size_t offset;
+	/* offset up to which the buffer has been scanned for <CR> */
+	size_t scanned;
 };
 
 char *at_build(char *buffer, enum bt_at_type type, const char *command,
 		const char *value);
 char *at_parse(const char *str, struct bt_at *at);
+char *at_reader_tail(struct at_reader *reader, size_t *len);
+void at_reader_seek(struct at_reader *reader, size_t len);
+bool at_reader_has_message(struct at_reader *reader);
+int at_reader_parse(struct at_reader *reader);
 int at_parse_bia(const char *str, bool state[__HFP_IND_MAX]);
 int at_parse_cind(const char *str, enum hfp_ind map[20]);
 int at_parse_cmer(const char *str, unsigned int map[5]);
@@ -13,6 +13,7 @@
 #include <endian.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <glib.h>
@@ -37,12 +38,139 @@ double audio_loudness_to_decibel(double value) {
 	return 10 * log2(value);
 }
 
+#if HAVE_ATTRIBUTE_TARGET_CLONES && (defined(__x86_64__) || defined(__i386__))
+/* Let the dynamic linker select the best kernel for the host CPU. The
+ * baseline (default) kernel uses SSE2 on x86_64 and NEON on aarch64. */
+# define AUDIO_KERNEL __attribute__ ((target_clones("avx2", "default")))
+#else
+# define AUDIO_KERNEL
+#endif
+
+/* Number of samples processed by a single kernel iteration. */
+#define AUDIO_KERNEL_LANES 8
+
+typedef int16_t audio_v8s16 __attribute__ ((vector_size(AUDIO_KERNEL_LANES * 2)));
+typedef int32_t audio_v8s32 __attribute__ ((vector_size(AUDIO_KERNEL_LANES * 4)));
+typedef uint32_t audio_v8u32 __attribute__ ((vector_size(AUDIO_KERNEL_LANES * 4)));
+typedef int64_t audio_v8s64 __attribute__ ((vector_size(AUDIO_KERNEL_LANES * 8)));
+typedef uint64_t audio_v8u64 __attribute__ ((vector_size(AUDIO_KERNEL_LANES * 8)));
+typedef uint8_t audio_v32u8 __attribute__ ((vector_size(AUDIO_KERNEL_LANES * 4)));
+
+#if defined(__has_builtin)
+# if __has_builtin(__builtin_shufflevector)
+#  define AUDIO_HAVE_SHUFFLEVECTOR 1
+# endif
+#endif
+
+/**
+ * Convert scaling factor to the fixed-point gain value.
+ *
+ * The gain is stored with one integer bit and the given number of fraction
+ * bits, e.g. Q15 for 16-bit samples. It means that the gain is limited to
+ * the [0, 2) range, which is equivalent of up to +6 dB amplification. */
+static int64_t audio_scale_to_gain(double scale, unsigned int bits) {
+	const int64_t max = (INT64_C(2) << bits) - 1;
+	const double gain = round(scale * (INT64_C(1) << bits));
+	return gain <= 0 ? 0 : gain >= max ? max : (int64_t)gain;
+}
+
+/**
+ * Scale 16-bit samples using Q15 fixed-point gains.
+ *
+ * For interleaved stereo signal the gain for every even sample shall be
+ * given in g1 and for every odd sample in g2. For monophonic signal both
+ * gains shall be equal. Results are truncated towards zero (as in the
+ * case of the floating-point arithmetic) and saturated. */
+AUDIO_KERNEL
+static void audio_scale_s16_q15(int16_t *buffer, size_t samples, int32_t g1, int32_t g2) {
+
+	const audio_v8s32 gain = { g1, g2, g1, g2, g1, g2, g1, g2 };
+	const audio_v8s32 round = { 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF };
+	const audio_v8s32 max = { INT16_MAX, INT16_MAX, INT16_MAX, INT16_MAX,
+		INT16_MAX, INT16_MAX, INT16_MAX, INT16_MAX };
+	const audio_v8s32 min = -max - 1;
+	size_t i;
+
+	for (i = 0; i + AUDIO_KERNEL_LANES <= samples; i += AUDIO_KERNEL_LANES) {
+
+		audio_v8s16 v16;
+		memcpy(&v16, &buffer[i], sizeof(v16));
+
+		audio_v8s32 v = __builtin_convertvector(v16, audio_v8s32) * gain;
+		v = (v + ((v >> 31) & round)) >> 15;
+
+		audio_v8s32 mask;
+		mask = v > max;
+		v = (v & ~mask) | (max & mask);
+		mask = v < min;
+		v = (v & ~mask) | (min & mask);
+
+		v16 = __builtin_convertvector(v, audio_v8s16);
+		memcpy(&buffer[i], &v16, sizeof(v16));
+
+	}
+
+	/* Process remaining samples. Since the number of kernel lanes is even,
+	 * the channel alignment of the remaining samples is preserved. */
+	for (; i < samples; i++) {
+		int32_t v = (int32_t)buffer[i] * (i % 2 == 0 ? g1 : g2);
+		v = (v + ((v >> 31) & 0x7FFF)) >> 15;
+		buffer[i] = v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : v;
+	}
+
+}
+
+/**
+ * Scale 32-bit samples using Q31 fixed-point gains.
+ *
+ * See audio_scale_s16_q15() for details. */
+AUDIO_KERNEL
+static void audio_scale_s32_q31(int32_t *buffer, size_t samples, int64_t g1, int64_t g2) {
+
+	const audio_v8s64 gain = { g1, g2, g1, g2, g1, g2, g1, g2 };
+	const audio_v8s64 round = { 0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF,
+		0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF };
+	const audio_v8s64 max = { INT32_MAX, INT32_MAX, INT32_MAX, INT32_MAX,
+		INT32_MAX, INT32_MAX, INT32_MAX, INT32_MAX };
+	const audio_v8s64 min = -max - 1;
+	size_t i;
+
+	for (i = 0; i + AUDIO_KERNEL_LANES <= samples; i += AUDIO_KERNEL_LANES) {
+
+		audio_v8s32 v32;
+		memcpy(&v32, &buffer[i], sizeof(v32));
+
+		audio_v8s64 v = __builtin_convertvector(v32, audio_v8s64) * gain;
+		v = (v + ((v >> 63) & round)) >> 31;
+
+		audio_v8s64 mask;
+		mask = v > max;
+		v = (v & ~mask) | (max & mask);
+		mask = v < min;
+		v = (v & ~mask) | (min & mask);
+
+		v32 = __builtin_convertvector(v, audio_v8s32);
+		memcpy(&buffer[i], &v32, sizeof(v32));
+
+	}
+
+	for (; i < samples; i++) {
+		int64_t v = (int64_t)buffer[i] * (i % 2 == 0 ? g1 : g2);
+		v = (v + ((v >> 63) & 0x7FFFFFFF)) >> 31;
+		buffer[i] = v > INT32_MAX ? INT32_MAX : v < INT32_MIN ? INT32_MIN : v;
+	}
+
+}
+
 /**
  * Scale S16_2LE PCM signal.
  *
  * Neutral value for scaling factor is 1.0. It is possible to increase
- * signal gain by using scaling factor values greater than 1, however,
- * clipping will most certainly occur.
+ * signal gain by using scaling factor values greater than 1 (up to +6 dB),
+ * however, clipping will most certainly occur. In such a case the signal
+ * will be saturated. The scaling factor of 0 mutes given channel. Muting
+ * and scaling is performed in a single pass over the buffer, and if all
+ * scaling factors equal 1.0, the buffer is not accessed at all.
  *
  * @param buffer Address to the buffer where the PCM signal is stored.
  * @param channels The number of channels in the buffer.
@@ -50,19 +178,23 @@ double audio_loudness_to_decibel(double value) {
  * @param ch1 The scaling factor for 1st channel.
  * @param ch1 The scaling factor for 2nd channel. */
 void audio_scale_s16_2le(int16_t *buffer, int channels, size_t frames, double ch1, double ch2) {
-	audio_silence_s16_2le(buffer, channels, frames, ch1 == 0, ch2 == 0);
 	switch (channels) {
 	case 1:
-		if (ch1 != 0 && ch1 != 1)
-			while (frames--)
-				buffer[frames] *= ch1;
+		if (ch1 == 0 || ch1 == 1)
+			audio_silence_s16_2le(buffer, channels, frames, ch1 == 0, false);
+		else {
+			const int32_t g = audio_scale_to_gain(ch1, 15);
+			audio_scale_s16_q15(buffer, frames, g, g);
+		}
 		break;
 	case 2:
-		if ((ch1 != 0 && ch1 != 1) || (ch2 != 0 && ch2 != 1))
-			while (frames--) {
-				buffer[2 * frames] *= ch1;
-				buffer[2 * frames + 1] *= ch2;
-			}
+		/* Muted channel is scaled with zero gain, so in case when any of the
+		 * channels requires scaling, the signal is processed in one pass. */
+		if ((ch1 == 0 || ch1 == 1) && (ch2 == 0 || ch2 == 1))
+			audio_silence_s16_2le(buffer, channels, frames, ch1 == 0, ch2 == 0);
+		else
+			audio_scale_s16_q15(buffer, frames * 2,
+					audio_scale_to_gain(ch1, 15), audio_scale_to_gain(ch2, 15));
 		break;
 	default:
 		g_assert_not_reached();
@@ -72,25 +204,144 @@ void audio_scale_s16_2le(int16_t *buffer, int channels, size_t frames, double ch
 /**
  * Scale S32_4LE PCM signal. */
 void audio_scale_s32_4le(int32_t *buffer, int channels, size_t frames, double ch1, double ch2) {
-	audio_silence_s32_4le(buffer, channels, frames, ch1 == 0, ch2 == 0);
 	switch (channels) {
 	case 1:
-		if (ch1 != 0 && ch1 != 1)
-			while (frames--)
-				buffer[frames] *= ch1;
+		if (ch1 == 0 || ch1 == 1)
+			audio_silence_s32_4le(buffer, channels, frames, ch1 == 0, false);
+		else {
+			const int64_t g = audio_scale_to_gain(ch1, 31);
+			audio_scale_s32_q31(buffer, frames, g, g);
+		}
 		break;
 	case 2:
-		if ((ch1 != 0 && ch1 != 1) || (ch2 != 0 && ch2 != 1))
-			while (frames--) {
-				buffer[2 * frames] *= ch1;
-				buffer[2 * frames + 1] *= ch2;
-			}
+		if ((ch1 == 0 || ch1 == 1) && (ch2 == 0 || ch2 == 1))
+			audio_silence_s32_4le(buffer, channels, frames, ch1 == 0, ch2 == 0);
+		else
+			audio_scale_s32_q31(buffer, frames * 2,
+					audio_scale_to_gain(ch1, 31), audio_scale_to_gain(ch2, 31));
 		break;
 	default:
 		g_assert_not_reached();
 	}
 }
 
+/**
+ * Mix 16-bit samples using Q15 fixed-point gain.
+ *
+ * Scaled source samples are added to the destination samples and the
+ * result is saturated. Rounding is the same as in audio_scale_s16_q15(). */
+AUDIO_KERNEL
+static void audio_mix_s16_q15(int16_t *dst, const int16_t *src, size_t samples, int32_t g) {
+
+	const audio_v8s32 gain = { g, g, g, g, g, g, g, g };
+	const audio_v8s32 round = { 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF };
+	const audio_v8s32 max = { INT16_MAX, INT16_MAX, INT16_MAX, INT16_MAX,
+		INT16_MAX, INT16_MAX, INT16_MAX, INT16_MAX };
+	const audio_v8s32 min = -max - 1;
+	size_t i;
+
+	for (i = 0; i + AUDIO_KERNEL_LANES <= samples; i += AUDIO_KERNEL_LANES) {
+
+		audio_v8s16 s16, d16;
+		memcpy(&s16, &src[i], sizeof(s16));
+		memcpy(&d16, &dst[i], sizeof(d16));
+
+		audio_v8s32 v = __builtin_convertvector(s16, audio_v8s32) * gain;
+		v = (v + ((v >> 31) & round)) >> 15;
+		v += __builtin_convertvector(d16, audio_v8s32);
+
+		audio_v8s32 mask;
+		mask = v > max;
+		v = (v & ~mask) | (max & mask);
+		mask = v < min;
+		v = (v & ~mask) | (min & mask);
+
+		d16 = __builtin_convertvector(v, audio_v8s16);
+		memcpy(&dst[i], &d16, sizeof(d16));
+
+	}
+
+	for (; i < samples; i++) {
+		int32_t v = (int32_t)src[i] * g;
+		v = ((v + ((v >> 31) & 0x7FFF)) >> 15) + dst[i];
+		dst[i] = v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : v;
+	}
+
+}
+
+/**
+ * Mix samples stored in 32-bit container using Q31 fixed-point gain.
+ *
+ * The result is saturated to the [-max - 1, max] range, so this kernel
+ * can be used for both S24_4LE and S32_4LE signals. */
+AUDIO_KERNEL
+static void audio_mix_s32_q31(int32_t *dst, const int32_t *src, size_t samples, int64_t g, int64_t m) {
+
+	const audio_v8s64 gain = { g, g, g, g, g, g, g, g };
+	const audio_v8s64 round = { 0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF,
+		0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF };
+	const audio_v8s64 max = { m, m, m, m, m, m, m, m };
+	const audio_v8s64 min = -max - 1;
+	size_t i;
+
+	for (i = 0; i + AUDIO_KERNEL_LANES <= samples; i += AUDIO_KERNEL_LANES) {
+
+		audio_v8s32 s32, d32;
+		memcpy(&s32, &src[i], sizeof(s32));
+		memcpy(&d32, &dst[i], sizeof(d32));
+
+		audio_v8s64 v = __builtin_convertvector(s32, audio_v8s64) * gain;
+		v = (v + ((v >> 63) & round)) >> 31;
+		v += __builtin_convertvector(d32, audio_v8s64);
+
+		audio_v8s64 mask;
+		mask = v > max;
+		v = (v & ~mask) | (max & mask);
+		mask = v < min;
+		v = (v & ~mask) | (min & mask);
+
+		d32 = __builtin_convertvector(v, audio_v8s32);
+		memcpy(&dst[i], &d32, sizeof(d32));
+
+	}
+
+	for (; i < samples; i++) {
+		int64_t v = (int64_t)src[i] * g;
+		v = ((v + ((v >> 63) & 0x7FFFFFFF)) >> 31) + dst[i];
+		dst[i] = v > m ? m : v < -m - 1 ? -m - 1 : v;
+	}
+
+}
+
+/**
+ * Mix S16_2LE PCM signal.
+ *
+ * Samples from the source buffer are scaled by the given factor (up to
+ * +6 dB, see the audio_scale_s16_2le() function) and added to the samples
+ * stored in the destination buffer. In case of overflow the result is
+ * saturated. Since the same factor is applied to all samples, the number
+ * of channels is irrelevant.
+ *
+ * @param dst Address of the buffer with the mixed PCM signal.
+ * @param src Address of the buffer with the PCM signal to add.
+ * @param samples The number of samples in both buffers.
+ * @param scale The scaling factor for the source signal. */
+void audio_mix_s16_2le(int16_t *dst, const int16_t *src, size_t samples, double scale) {
+	audio_mix_s16_q15(dst, src, samples, audio_scale_to_gain(scale, 15));
+}
+
+/**
+ * Mix S24_4LE PCM signal. */
+void audio_mix_s24_4le(int32_t *dst, const int32_t *src, size_t samples, double scale) {
+	audio_mix_s32_q31(dst, src, samples, audio_scale_to_gain(scale, 31), 0x7FFFFF);
+}
+
+/**
+ * Mix S32_4LE PCM signal. */
+void audio_mix_s32_4le(int32_t *dst, const int32_t *src, size_t samples, double scale) {
+	audio_mix_s32_q31(dst, src, samples, audio_scale_to_gain(scale, 31), INT32_MAX);
+}
+
 /**
  * Silence S16_2LE PCM signal. */
 void audio_silence_s16_2le(int16_t *buffer, int channels, size_t frames, bool ch1, bool ch2) {
@@ -133,3 +384,559 @@ void audio_silence_s32_4le(int32_t *buffer, int channels, size_t frames, bool ch
 		g_assert_not_reached();
 	}
 }
+
+/**
+ * Get the peak magnitude of S16_2LE PCM signal.
+ *
+ * This function is intended for cheap level checks (e.g. the silence
+ * detection), so the number of channels is irrelevant.
+ *
+ * @param buffer Address of the buffer with the PCM signal.
+ * @param samples The number of samples in the buffer.
+ * @return This function returns the maximal absolute sample value. */
+AUDIO_KERNEL
+unsigned int audio_peak_s16_2le(const int16_t *buffer, size_t samples) {
+
+	audio_v8s32 peak = { 0 };
+	unsigned int max = 0;
+	size_t i;
+
+	for (i = 0; i + AUDIO_KERNEL_LANES <= samples; i += AUDIO_KERNEL_LANES) {
+
+		audio_v8s16 v16;
+		memcpy(&v16, &buffer[i], sizeof(v16));
+
+		audio_v8s32 v = __builtin_convertvector(v16, audio_v8s32);
+		v = (v ^ (v >> 31)) - (v >> 31);
+
+		const audio_v8s32 mask = v > peak;
+		peak = (peak & ~mask) | (v & mask);
+
+	}
+
+	for (size_t j = 0; j < AUDIO_KERNEL_LANES; j++)
+		max = MAX(max, (unsigned int)peak[j]);
+
+	for (; i < samples; i++)
+		max = MAX(max, (unsigned int)abs(buffer[i]));
+
+	return max;
+}
+
+/**
+ * Get the peak magnitude of PCM signal stored in 32-bit container.
+ *
+ * In order to avoid overflow, the magnitude of negative samples is computed
+ * as the one's complement, i.e. it is less by one than the actual value. It
+ * can be used for both S24_4LE and S32_4LE signals. */
+AUDIO_KERNEL
+uint32_t audio_peak_s32_4le(const int32_t *buffer, size_t samples) {
+
+	audio_v8u32 peak = { 0 };
+	uint32_t max = 0;
+	size_t i;
+
+	for (i = 0; i + AUDIO_KERNEL_LANES <= samples; i += AUDIO_KERNEL_LANES) {
+
+		audio_v8s32 v;
+		memcpy(&v, &buffer[i], sizeof(v));
+
+		const audio_v8u32 u = (audio_v8u32)(v ^ (v >> 31));
+		const audio_v8u32 mask = (audio_v8u32)(u > peak);
+		peak = (peak & ~mask) | (u & mask);
+
+	}
+
+	for (size_t j = 0; j < AUDIO_KERNEL_LANES; j++)
+		max = MAX(max, peak[j]);
+
+	for (; i < samples; i++)
+		max = MAX(max, (uint32_t)(buffer[i] ^ (buffer[i] >> 31)));
+
+	return max;
+}
+
+/**
+ * Convert 16-bit samples to 32-bit container.
+ *
+ * Samples are shifted left by the given number of bits, e.g. by 16 bits for
+ * the S32_4LE format or by 8 bits for the S24_4LE format. The conversion can
+ * be done in place (dst and src pointing to the same address), because the
+ * buffer is processed from its end towards the beginning.
+ *
+ * @param dst Address of the buffer for the converted signal.
+ * @param src Address of the buffer with the 16-bit signal.
+ * @param samples The number of samples to convert.
+ * @param shift The number of bits by which samples shall be shifted. */
+AUDIO_KERNEL
+void audio_s16_to_s32(int32_t *dst, const int16_t *src, size_t samples, unsigned int shift) {
+
+	size_t i = samples;
+
+	/* Process samples which do not fill the whole kernel first,
+	 * so the rest of the buffer is aligned to the number of lanes. */
+	for (; i % AUDIO_KERNEL_LANES != 0; i--)
+		dst[i - 1] = (int32_t)((uint32_t)src[i - 1] << shift);
+
+	while (i > 0) {
+		i -= AUDIO_KERNEL_LANES;
+
+		audio_v8s16 v16;
+		memcpy(&v16, &src[i], sizeof(v16));
+
+		audio_v8s32 v = __builtin_convertvector(v16, audio_v8s32);
+		v = (audio_v8s32)((audio_v8u32)v << shift);
+
+		memcpy(&dst[i], &v, sizeof(v));
+
+	}
+
+}
+
+/**
+ * Convert samples stored in 32-bit container to 16-bit samples.
+ *
+ * Samples are shifted right by the given number of bits (see the
+ * audio_s16_to_s32() function), so the least significant bits are
+ * truncated. The conversion can be done in place.
+ *
+ * @param dst Address of the buffer for the 16-bit signal.
+ * @param src Address of the buffer with the signal to convert.
+ * @param samples The number of samples to convert.
+ * @param shift The number of bits by which samples shall be shifted. */
+AUDIO_KERNEL
+void audio_s32_to_s16(int16_t *dst, const int32_t *src, size_t samples, unsigned int shift) {
+
+	size_t i;
+
+	for (i = 0; i + AUDIO_KERNEL_LANES <= samples; i += AUDIO_KERNEL_LANES) {
+
+		audio_v8s32 v;
+		memcpy(&v, &src[i], sizeof(v));
+
+		audio_v8s16 v16 = __builtin_convertvector(v >> (int32_t)shift, audio_v8s16);
+		memcpy(&dst[i], &v16, sizeof(v16));
+
+	}
+
+	for (; i < samples; i++)
+		dst[i] = src[i] >> shift;
+
+}
+
+/**
+ * Change the width of samples stored in 32-bit container in place.
+ *
+ * This function converts S24_4LE signal to S32_4LE when the shift is
+ * positive, and S32_4LE signal to S24_4LE when the shift is negative.
+ *
+ * @param buffer Address of the buffer with the signal to convert.
+ * @param samples The number of samples in the buffer.
+ * @param shift The number of bits by which samples shall be shifted. */
+AUDIO_KERNEL
+void audio_s32_shift(int32_t *buffer, size_t samples, int shift) {
+
+	const unsigned int bits = shift < 0 ? -shift : shift;
+	size_t i;
+
+	for (i = 0; i + AUDIO_KERNEL_LANES <= samples; i += AUDIO_KERNEL_LANES) {
+
+		audio_v8s32 v;
+		memcpy(&v, &buffer[i], sizeof(v));
+
+		if (shift < 0)
+			v >>= (int32_t)bits;
+		else
+			v = (audio_v8s32)((audio_v8u32)v << bits);
+
+		memcpy(&buffer[i], &v, sizeof(v));
+
+	}
+
+	for (; i < samples; i++)
+		buffer[i] = shift < 0 ? buffer[i] >> bits :
+			(int32_t)((uint32_t)buffer[i] << bits);
+
+}
+
+/**
+ * Convert packed 24-bit samples to 32-bit container.
+ *
+ * Every packed sample is moved to the upper bytes of the 32-bit lane with
+ * a single byte shuffle, so the sign extension is done with an arithmetic
+ * shift. Then samples are shifted left by the given number of bits, i.e.
+ * by 8 bits for the S32_4LE format or not shifted at all for the S24_4LE
+ * format. The conversion can be done in place, because the buffer is
+ * processed from its end towards the beginning.
+ *
+ * @param dst Address of the buffer for the converted signal.
+ * @param src Address of the buffer with the S24_3LE signal.
+ * @param samples The number of samples to convert.
+ * @param shift The number of bits by which samples shall be shifted. */
+AUDIO_KERNEL
+void audio_s24_3le_to_s32(int32_t *dst, const void *src, size_t samples, unsigned int shift) {
+
+	const uint8_t *src8 = src;
+	size_t i = samples;
+
+	for (; i % AUDIO_KERNEL_LANES != 0; i--) {
+		const uint8_t *s = &src8[(i - 1) * 3];
+		const int32_t v = (int32_t)((uint32_t)s[0] << 8 |
+				(uint32_t)s[1] << 16 | (uint32_t)s[2] << 24) >> 8;
+		dst[i - 1] = (int32_t)((uint32_t)v << shift);
+	}
+
+	while (i > 0) {
+		i -= AUDIO_KERNEL_LANES;
+
+#if AUDIO_HAVE_SHUFFLEVECTOR
+		audio_v32u8 v8 = { 0 };
+		memcpy(&v8, &src8[i * 3], AUDIO_KERNEL_LANES * 3);
+		/* the last byte is always zero, it is used as a padding */
+		v8 = __builtin_shufflevector(v8, v8,
+				31, 0, 1, 2, 31, 3, 4, 5, 31, 6, 7, 8, 31, 9, 10, 11,
+				31, 12, 13, 14, 31, 15, 16, 17, 31, 18, 19, 20, 31, 21, 22, 23);
+		audio_v8s32 v = (audio_v8s32)v8 >> 8;
+#else
+		audio_v8s32 v;
+		for (size_t j = 0; j < AUDIO_KERNEL_LANES; j++) {
+			const uint8_t *s = &src8[(i + j) * 3];
+			v[j] = (int32_t)((uint32_t)s[0] << 8 |
+					(uint32_t)s[1] << 16 | (uint32_t)s[2] << 24) >> 8;
+		}
+#endif
+
+		v = (audio_v8s32)((audio_v8u32)v << shift);
+		memcpy(&dst[i], &v, sizeof(v));
+
+	}
+
+}
+
+/**
+ * Convert samples stored in 32-bit container to packed 24-bit samples.
+ *
+ * Samples are shifted right by the given number of bits (see the
+ * audio_s24_3le_to_s32() function), so the least significant bits are
+ * truncated. The conversion can be done in place.
+ *
+ * @param dst Address of the buffer for the S24_3LE signal.
+ * @param src Address of the buffer with the signal to convert.
+ * @param samples The number of samples to convert.
+ * @param shift The number of bits by which samples shall be shifted. */
+AUDIO_KERNEL
+void audio_s32_to_s24_3le(void *dst, const int32_t *src, size_t samples, unsigned int shift) {
+
+	uint8_t *dst8 = dst;
+	size_t i;
+
+	for (i = 0; i + AUDIO_KERNEL_LANES <= samples; i += AUDIO_KERNEL_LANES) {
+
+		audio_v8s32 v;
+		memcpy(&v, &src[i], sizeof(v));
+		v >>= (int32_t)shift;
+
+#if AUDIO_HAVE_SHUFFLEVECTOR
+		audio_v32u8 v8 = __builtin_shufflevector((audio_v32u8)v, (audio_v32u8)v,
+				0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 16, 17, 18, 20,
+				21, 22, 24, 25, 26, 28, 29, 30, 3, 7, 11, 15, 19, 23, 27, 31);
+		memcpy(&dst8[i * 3], &v8, AUDIO_KERNEL_LANES * 3);
+#else
+		for (size_t j = 0; j < AUDIO_KERNEL_LANES; j++) {
+			uint8_t *d = &dst8[(i + j) * 3];
+			d[0] = v[j];
+			d[1] = v[j] >> 8;
+			d[2] = v[j] >> 16;
+		}
+#endif
+
+	}
+
+	for (; i < samples; i++) {
+		const int32_t v = src[i] >> shift;
+		uint8_t *d = &dst8[i * 3];
+		d[0] = v;
+		d[1] = v >> 8;
+		d[2] = v >> 16;
+	}
+
+}
+
+/**
+ * Down-mix stereo S16_2LE PCM signal to mono.
+ *
+ * Both channels are averaged. Every stereo frame is loaded as a single
+ * 32-bit lane, so the channels are separated with shifts instead of the
+ * vector shuffles. The conversion can be done in place.
+ *
+ * @param dst Address of the buffer for the mono signal.
+ * @param src Address of the buffer with the stereo signal.
+ * @param frames The number of frames to convert. */
+AUDIO_KERNEL
+void audio_downmix_s16_2le(int16_t *dst, const int16_t *src, size_t frames) {
+
+	size_t i;
+
+	for (i = 0; i + AUDIO_KERNEL_LANES <= frames; i += AUDIO_KERNEL_LANES) {
+
+		audio_v8s32 v;
+		memcpy(&v, &src[i * 2], sizeof(v));
+
+		const audio_v8s32 l = (audio_v8s32)((audio_v8u32)v << 16) >> 16;
+		const audio_v8s32 r = v >> 16;
+
+		audio_v8s16 v16 = __builtin_convertvector((l + r) >> 1, audio_v8s16);
+		memcpy(&dst[i], &v16, sizeof(v16));
+
+	}
+
+	for (; i < frames; i++)
+		dst[i] = ((int32_t)src[i * 2] + src[i * 2 + 1]) >> 1;
+
+}
+
+/**
+ * Down-mix stereo PCM signal stored in 32-bit container to mono.
+ *
+ * It can be used for both S24_4LE and S32_4LE signals. The conversion can
+ * be done in place.
+ *
+ * @param dst Address of the buffer for the mono signal.
+ * @param src Address of the buffer with the stereo signal.
+ * @param frames The number of frames to convert. */
+AUDIO_KERNEL
+void audio_downmix_s32_4le(int32_t *dst, const int32_t *src, size_t frames) {
+
+	size_t i;
+
+	for (i = 0; i + AUDIO_KERNEL_LANES <= frames; i += AUDIO_KERNEL_LANES) {
+
+		audio_v8s64 v;
+		memcpy(&v, &src[i * 2], sizeof(v));
+
+		const audio_v8s64 l = (audio_v8s64)((audio_v8u64)v << 32) >> 32;
+		const audio_v8s64 r = v >> 32;
+
+		audio_v8s32 v32 = __builtin_convertvector((l + r) >> 1, audio_v8s32);
+		memcpy(&dst[i], &v32, sizeof(v32));
+
+	}
+
+	for (; i < frames; i++)
+		dst[i] = ((int64_t)src[i * 2] + src[i * 2 + 1]) >> 1;
+
+}
+
+/**
+ * Up-mix mono S16_2LE PCM signal to stereo.
+ *
+ * The signal is duplicated to both channels. The conversion can be done
+ * in place, because the buffer is processed from its end towards the
+ * beginning.
+ *
+ * @param dst Address of the buffer for the stereo signal.
+ * @param src Address of the buffer with the mono signal.
+ * @param frames The number of frames to convert. */
+AUDIO_KERNEL
+void audio_upmix_s16_2le(int16_t *dst, const int16_t *src, size_t frames) {
+
+	size_t i = frames;
+
+	for (; i % AUDIO_KERNEL_LANES != 0; i--)
+		dst[i * 2 - 2] = dst[i * 2 - 1] = src[i - 1];
+
+	while (i > 0) {
+		i -= AUDIO_KERNEL_LANES;
+
+		audio_v8s16 v16;
+		memcpy(&v16, &src[i], sizeof(v16));
+
+		const audio_v8u32 u = (audio_v8u32)__builtin_convertvector(v16, audio_v8s32);
+		const audio_v8u32 v = (u & 0xFFFF) | (u << 16);
+
+		memcpy(&dst[i * 2], &v, sizeof(v));
+
+	}
+
+}
+
+/**
+ * Up-mix mono PCM signal stored in 32-bit container to stereo.
+ *
+ * It can be used for both S24_4LE and S32_4LE signals. The conversion can
+ * be done in place.
+ *
+ * @param dst Address of the buffer for the stereo signal.
+ * @param src Address of the buffer with the mono signal.
+ * @param frames The number of frames to convert. */
+AUDIO_KERNEL
+void audio_upmix_s32_4le(int32_t *dst, const int32_t *src, size_t frames) {
+
+	size_t i = frames;
+
+	for (; i % AUDIO_KERNEL_LANES != 0; i--)
+		dst[i * 2 - 2] = dst[i * 2 - 1] = src[i - 1];
+
+	while (i > 0) {
+		i -= AUDIO_KERNEL_LANES;
+
+		audio_v8s32 v32;
+		memcpy(&v32, &src[i], sizeof(v32));
+
+		const audio_v8u64 u = (audio_v8u64)__builtin_convertvector(v32, audio_v8s64);
+		const audio_v8u64 v = (u & 0xFFFFFFFF) | (u << 32);
+
+		memcpy(&dst[i * 2], &v, sizeof(v));
+
+	}
+
+}
+
+/**
+ * Swap left and right channels of stereo S16_2LE PCM signal in place. */
+AUDIO_KERNEL
+void audio_swap_s16_2le(int16_t *buffer, size_t frames) {
+
+	size_t i;
+
+	for (i = 0; i + AUDIO_KERNEL_LANES <= frames; i += AUDIO_KERNEL_LANES) {
+
+		audio_v8u32 v;
+		memcpy(&v, &buffer[i * 2], sizeof(v));
+
+		v = (v >> 16) | (v << 16);
+		memcpy(&buffer[i * 2], &v, sizeof(v));
+
+	}
+
+	for (; i < frames; i++) {
+		const int16_t tmp = buffer[i * 2];
+		buffer[i * 2] = buffer[i * 2 + 1];
+		buffer[i * 2 + 1] = tmp;
+	}
+
+}
+
+/**
+ * Swap left and right channels of stereo PCM signal stored in 32-bit
+ * container in place. */
+AUDIO_KERNEL
+void audio_swap_s32_4le(int32_t *buffer, size_t frames) {
+
+	size_t i;
+
+	for (i = 0; i + AUDIO_KERNEL_LANES <= frames; i += AUDIO_KERNEL_LANES) {
+
+		audio_v8u64 v;
+		memcpy(&v, &buffer[i * 2], sizeof(v));
+
+		v = (v >> 32) | (v << 32);
+		memcpy(&buffer[i * 2], &v, sizeof(v));
+
+	}
+
+	for (; i < frames; i++) {
+		const int32_t tmp = buffer[i * 2];
+		buffer[i * 2] = buffer[i * 2 + 1];
+		buffer[i * 2 + 1] = tmp;
+	}
+
+}
+
+/**
+ * Initialize packet loss concealment.
+ *
+ * @param plc Pointer to the PLC structure.
+ * @param sample_size The size of a single PCM sample, either 2 or 4 bytes.
+ * @param channels The number of channels.
+ * @param samples The maximal number of samples in the decoded block.
+ * @return On success this function returns 0, otherwise -1. */
+int audio_plc_init(struct audio_plc *plc, size_t sample_size, unsigned int channels, size_t samples) {
+
+	audio_plc_free(plc);
+
+	if ((plc->block = malloc(samples * sample_size)) == NULL)
+		return -1;
+
+	plc->samples = 0;
+	plc->capacity = samples;
+	plc->sample_size = sample_size;
+	plc->channels = channels;
+	plc->concealed = 0;
+
+	return 0;
+}
+
+/**
+ * Free resources allocated with the audio_plc_init(). */
+void audio_plc_free(struct audio_plc *plc) {
+	free(plc->block);
+	plc->block = NULL;
+	plc->samples = 0;
+}
+
+/**
+ * Store the last correctly decoded block.
+ *
+ * @param plc Pointer to the initialized PLC structure.
+ * @param buffer Address of the buffer with the decoded PCM signal.
+ * @param samples The number of samples in the buffer. If it exceeds the
+ *   capacity of the PLC block, only the tail of the signal is stored. */
+void audio_plc_update(struct audio_plc *plc, const void *buffer, size_t samples) {
+
+	if (samples < plc->channels)
+		return;
+
+	const size_t offset = samples > plc->capacity ? samples - plc->capacity : 0;
+	/* keep the channel alignment of the stored block */
+	samples -= offset + (samples - offset) % plc->channels;
+
+	memcpy(plc->block, (const uint8_t *)buffer + offset * plc->sample_size,
+			samples * plc->sample_size);
+	plc->samples = samples;
+	plc->concealed = 0;
+
+}
+
+/**
+ * Synthesize the next block of the lost signal.
+ *
+ * Every call produces one block with the same length as the last decoded
+ * one. The first AUDIO_PLC_FADE_BLOCKS blocks repeat the last decoded
+ * block with a decreasing gain, all subsequent ones are silent.
+ *
+ * @param plc Pointer to the initialized PLC structure.
+ * @param buffer Address of the buffer where the concealed signal shall be
+ *   stored. It has to be big enough to hold the PLC block capacity.
+ * @return This function returns the number of samples stored in the
+ *   buffer. If no block has been decoded yet, 0 is returned. */
+size_t audio_plc_conceal(struct audio_plc *plc, void *buffer) {
+
+	const size_t samples = plc->samples;
+	if (samples == 0)
+		return 0;
+
+	if (plc->concealed >= AUDIO_PLC_FADE_BLOCKS) {
+		memset(buffer, 0, samples * plc->sample_size);
+		return samples;
+	}
+
+	/* Fade-out gain decreases linearly with every frame, starting from the
+	 * level at which the previous concealed block has ended. The gain is
+	 * stored in the Q16 fixed-point format. */
+	const size_t frames = samples / plc->channels;
+	const int64_t range = (int64_t)AUDIO_PLC_FADE_BLOCKS * frames;
+	const int64_t start = (int64_t)(AUDIO_PLC_FADE_BLOCKS - plc->concealed) * frames;
+
+	for (size_t i = 0; i < frames; i++) {
+		const int64_t gain = ((start - (int64_t)i) << 16) / range;
+		for (size_t j = i * plc->channels; j < (i + 1) * plc->channels; j++)
+			if (plc->sample_size == sizeof(int16_t))
+				((int16_t *)buffer)[j] = ((int16_t *)plc->block)[j] * gain / 65536;
+			else
+				((int32_t *)buffer)[j] = ((int32_t *)plc->block)[j] * gain / 65536;
+	}
+
+	plc->concealed++;
+	return samples;
+}
@@ -26,8 +26,62 @@ void audio_scale_s16_2le(int16_t *buffer, int channels, size_t frames, double ch
 void audio_scale_s32_4le(int32_t *buffer, int channels, size_t frames, double ch1, double ch2);
 #define audio_scale_s24_4le audio_scale_s32_4le
 
+void audio_mix_s16_2le(int16_t *dst, const int16_t *src, size_t samples, double scale);
+void audio_mix_s24_4le(int32_t *dst, const int32_t *src, size_t samples, double scale);
+void audio_mix_s32_4le(int32_t *dst, const int32_t *src, size_t samples, double scale);
+
 void audio_silence_s16_2le(int16_t *buffer, int channels, size_t frames, bool ch1, bool ch2);
 void audio_silence_s32_4le(int32_t *buffer, int channels, size_t frames, bool ch1, bool ch2);
 #define audio_silence_s24_4le audio_silence_s32_4le
 
+unsigned int audio_peak_s16_2le(const int16_t *buffer, size_t samples);
+uint32_t audio_peak_s32_4le(const int32_t *buffer, size_t samples);
+#define audio_peak_s24_4le audio_peak_s32_4le
+
+void audio_s16_to_s32(int32_t *dst, const int16_t *src, size_t samples, unsigned int shift);
+void audio_s32_to_s16(int16_t *dst, const int32_t *src, size_t samples, unsigned int shift);
+void audio_s32_shift(int32_t *buffer, size_t samples, int shift);
+void audio_s24_3le_to_s32(int32_t *dst, const void *src, size_t samples, unsigned int shift);
+void audio_s32_to_s24_3le(void *dst, const int32_t *src, size_t samples, unsigned int shift);
+
+void audio_downmix_s16_2le(int16_t *dst, const int16_t *src, size_t frames);
+void audio_downmix_s32_4le(int32_t *dst, const int32_t *src, size_t frames);
+#define audio_downmix_s24_4le audio_downmix_s32_4le
+void audio_upmix_s16_2le(int16_t *dst, const int16_t *src, size_t frames);
+void audio_upmix_s32_4le(int32_t *dst, const int32_t *src, size_t frames);
+#define audio_upmix_s24_4le audio_upmix_s32_4le
+void audio_swap_s16_2le(int16_t *buffer, size_t frames);
+void audio_swap_s32_4le(int32_t *buffer, size_t frames);
+#define audio_swap_s24_4le audio_swap_s32_4le
+
+/**
+ * The number of concealed blocks over which the signal fades out. */
+#define AUDIO_PLC_FADE_BLOCKS 4
+
+/**
+ * Packet loss concealment.
+ *
+ * The PLC keeps a copy of the last decoded PCM block, which is used to fill
+ * the gap caused by lost packets. The first concealed blocks are repeated
+ * with a linear fade-out, so the signal reaches silence smoothly. */
+struct audio_plc {
+	/* copy of the last decoded block */
+	void *block;
+	/* the number of samples in the block */
+	size_t samples;
+	/* the capacity of the block in samples */
+	size_t capacity;
+	/* the size of a single sample (2 or 4 bytes) */
+	size_t sample_size;
+	unsigned int channels;
+	/* the number of consecutive concealed blocks */
+	unsigned int concealed;
+};
+
+int audio_plc_init(struct audio_plc *plc, size_t sample_size, unsigned int channels, size_t samples);
+void audio_plc_free(struct audio_plc *plc);
+
+void audio_plc_update(struct audio_plc *plc, const void *buffer, size_t samples);
+size_t audio_plc_conceal(struct audio_plc *plc, void *buffer);
+
 #endif
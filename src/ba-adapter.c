@@ -11,9 +11,13 @@
 #include "ba-adapter.h"
 
 #include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
@@ -24,6 +28,7 @@
 #include "hci.h"
 #include "hfp.h"
 #include "utils.h"
+#include "shared/defs.h"
 #include "shared/log.h"
 
 struct ba_adapter *ba_adapter_new(int dev_id) {
@@ -52,20 +57,26 @@ struct ba_adapter *ba_adapter_new(int dev_id) {
 	if (hci_get_version(dev_id, &a->chip) == -1)
 		warn("Couldn't get HCI version: %s", strerror(errno));
 
-	a->sco_dispatcher = config.main_thread;
+	a->sco_listen_fd = -1;
 	a->ref_count = 1;
 
+	pthread_mutex_init(&a->sco_pool_mtx, NULL);
+	for (size_t i = 0; i < ARRAYSIZE(a->sco_pool); i++)
+		a->sco_pool[i] = -1;
+
 	sprintf(a->ba_dbus_path, "/org/bluealsa/%s", a->hci.name);
 	g_variant_sanitize_object_path(a->ba_dbus_path);
 	sprintf(a->bluez_dbus_path, "/org/bluez/%s", a->hci.name);
 	g_variant_sanitize_object_path(a->bluez_dbus_path);
 
-	pthread_mutex_init(&a->devices_mutex, NULL);
+	pthread_rwlock_init(&a->devices_lock, NULL);
 	a->devices = g_hash_table_new_full(g_bdaddr_hash, g_bdaddr_equal, NULL, NULL);
 
-	pthread_mutex_lock(&config.adapters_mutex);
+	pthread_rwlock_wrlock(&config.adapters_lock);
 	config.adapters[a->hci.dev_id] = a;
-	pthread_mutex_unlock(&config.adapters_mutex);
+	pthread_rwlock_unlock(&config.adapters_lock);
+
+	ba_adapter_sco_pool_fill(a);
 
 	return a;
 }
@@ -77,18 +88,18 @@ struct ba_adapter *ba_adapter_lookup(int dev_id) {
 
 	struct ba_adapter *a;
 
-	pthread_mutex_lock(&config.adapters_mutex);
+	/* The last reference is dropped with the write lock held, so it is
+	 * safe to take a new one while holding the read lock. */
+	pthread_rwlock_rdlock(&config.adapters_lock);
 	if ((a = config.adapters[dev_id]) != NULL)
-		a->ref_count++;
-	pthread_mutex_unlock(&config.adapters_mutex);
+		atomic_fetch_add(&a->ref_count, 1);
+	pthread_rwlock_unlock(&config.adapters_lock);
 
 	return a;
 }
 
 struct ba_adapter *ba_adapter_ref(struct ba_adapter *a) {
-	pthread_mutex_lock(&config.adapters_mutex);
-	a->ref_count++;
-	pthread_mutex_unlock(&config.adapters_mutex);
+	atomic_fetch_add(&a->ref_count, 1);
 	return a;
 }
 
@@ -96,7 +107,7 @@ void ba_adapter_destroy(struct ba_adapter *a) {
 
 	/* XXX: Modification-safe remove-all loop.
 	 *
-	 * Before calling ba_device_destroy() we have to unlock mutex, so
+	 * Before calling ba_device_destroy() we have to release the lock, so
 	 * in theory it is possible that someone will modify devices hash
 	 * table over which we are iterating. Since, the iterator uses an
 	 * internal cache, we have to reinitialize it after every unlock. */
@@ -105,18 +116,18 @@ void ba_adapter_destroy(struct ba_adapter *a) {
 		GHashTableIter iter;
 		struct ba_device *d;
 
-		pthread_mutex_lock(&a->devices_mutex);
+		pthread_rwlock_wrlock(&a->devices_lock);
 
 		g_hash_table_iter_init(&iter, a->devices);
 		if (!g_hash_table_iter_next(&iter, NULL, (gpointer)&d)) {
-			pthread_mutex_unlock(&a->devices_mutex);
+			pthread_rwlock_unlock(&a->devices_lock);
 			break;
 		}
 
-		d->ref_count++;
+		atomic_fetch_add(&d->ref_count, 1);
 		g_hash_table_iter_steal(&iter);
 
-		pthread_mutex_unlock(&a->devices_mutex);
+		pthread_rwlock_unlock(&a->devices_lock);
 
 		ba_device_destroy(d);
 	}
@@ -127,13 +138,18 @@ void ba_adapter_destroy(struct ba_adapter *a) {
 void ba_adapter_unref(struct ba_adapter *a) {
 
 	int ref_count;
-	int err;
 
-	pthread_mutex_lock(&config.adapters_mutex);
-	if ((ref_count = --a->ref_count) == 0)
+	/* drop the reference without locking unless it might be the last one */
+	ref_count = atomic_load(&a->ref_count);
+	while (ref_count > 1)
+		if (atomic_compare_exchange_weak(&a->ref_count, &ref_count, ref_count - 1))
+			return;
+
+	pthread_rwlock_wrlock(&config.adapters_lock);
+	if ((ref_count = atomic_fetch_sub(&a->ref_count, 1) - 1) == 0)
 		/* detach adapter from global configuration */
 		config.adapters[a->hci.dev_id] = NULL;
-	pthread_mutex_unlock(&config.adapters_mutex);
+	pthread_rwlock_unlock(&config.adapters_lock);
 
 	if (ref_count > 0)
 		return;
@@ -141,19 +157,92 @@ void ba_adapter_unref(struct ba_adapter *a) {
 	debug("Freeing adapter: %s", a->hci.name);
 	g_assert_cmpint(ref_count, ==, 0);
 
-	/* make sure that the SCO dispatcher is terminated before free() */
-	if (!pthread_equal(a->sco_dispatcher, config.main_thread)) {
-		if ((err = pthread_cancel(a->sco_dispatcher)) != 0)
-			warn("Couldn't cancel SCO dispatcher thread: %s", strerror(err));
-		if ((err = pthread_join(a->sco_dispatcher, NULL)) != 0)
-			warn("Couldn't join SCO dispatcher thread: %s", strerror(err));
-	}
+	/* Closing the listening socket removes it from the SCO dispatcher. The
+	 * dispatcher looks up the adapter by its ID, so it will not be reached
+	 * after it was detached from the global configuration above. */
+	if (a->sco_listen_fd != -1)
+		close(a->sco_listen_fd);
+
+	for (size_t i = 0; i < ARRAYSIZE(a->sco_pool); i++)
+		if (a->sco_pool[i] != -1)
+			close(a->sco_pool[i]);
+	pthread_mutex_destroy(&a->sco_pool_mtx);
 
 	g_hash_table_unref(a->devices);
-	pthread_mutex_destroy(&a->devices_mutex);
+	pthread_rwlock_destroy(&a->devices_lock);
 	free(a);
 }
 
+/**
+ * Voice settings of the SCO pool slots. */
+static const uint16_t sco_pool_voice[] = {
+	BT_VOICE_CVSD_16BIT,
+	BT_VOICE_TRANSPARENT,
+};
+
+static int adapter_sco_open(struct ba_adapter *a, uint16_t voice) {
+
+	int fd;
+	if ((fd = hci_sco_open(a->hci.dev_id)) == -1)
+		return -1;
+
+	if (hci_sco_setup(fd, voice) == -1) {
+		int err = errno;
+		close(fd);
+		return errno = err, -1;
+	}
+
+	return fd;
+}
+
+/**
+ * Get SCO socket ready for the outgoing connection.
+ *
+ * Opening, binding and configuring the SCO socket is done ahead of time, so
+ * this function returns pre-opened socket from the pool if available. Empty
+ * pool slot can be refilled with the ba_adapter_sco_pool_fill() function.
+ *
+ * @param a Pointer to the adapter structure.
+ * @param voice Bluetooth voice mode used during connection.
+ * @return On success this function returns socket file descriptor, which
+ *   shall be closed by the caller. Otherwise, -1 is returned and errno is
+ *   set to indicate the error. */
+int ba_adapter_sco_pool_get(struct ba_adapter *a, uint16_t voice) {
+
+	int fd = -1;
+
+	pthread_mutex_lock(&a->sco_pool_mtx);
+	for (size_t i = 0; i < ARRAYSIZE(sco_pool_voice); i++)
+		if (sco_pool_voice[i] == voice) {
+			fd = a->sco_pool[i];
+			a->sco_pool[i] = -1;
+		}
+	pthread_mutex_unlock(&a->sco_pool_mtx);
+
+	if (fd != -1)
+		return fd;
+
+	debug("SCO socket pool miss: %s: %#x", a->hci.name, voice);
+	return adapter_sco_open(a, voice);
+}
+
+/**
+ * Pre-open SCO sockets for all empty pool slots. */
+void ba_adapter_sco_pool_fill(struct ba_adapter *a) {
+
+	pthread_mutex_lock(&a->sco_pool_mtx);
+
+	for (size_t i = 0; i < ARRAYSIZE(sco_pool_voice); i++) {
+		if (a->sco_pool[i] != -1)
+			continue;
+		if ((a->sco_pool[i] = adapter_sco_open(a, sco_pool_voice[i])) == -1)
+			debug("Couldn't pre-open SCO socket: %s: %s", a->hci.name, strerror(errno));
+	}
+
+	pthread_mutex_unlock(&a->sco_pool_mtx);
+
+}
+
 int ba_adapter_get_hfp_features_hf(struct ba_adapter *a) {
 	int features = config.hfp.features_rfcomm_hf;
 	if (BA_TEST_ESCO_SUPPORT(a)) {
@@ -16,6 +16,9 @@
 #endif
 
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 #include <glib.h>
 
@@ -30,19 +33,27 @@ struct ba_adapter {
 	struct hci_dev_info hci;
 	struct hci_version chip;
 
-	/* incoming SCO links dispatcher */
-	pthread_t sco_dispatcher;
+	/* socket listening for incoming SCO links, which is
+	 * registered in the SCO dispatcher shared by all adapters */
+	int sco_listen_fd;
+	/* SCO audio is routed via the PCM interface */
+	bool sco_offload;
+
+	/* Pre-opened SCO sockets (bound to the adapter and configured for
+	 * the outgoing connection) indexed by the voice setting slot. */
+	pthread_mutex_t sco_pool_mtx;
+	int sco_pool[2];
 
 	/* data for D-Bus management */
 	char ba_dbus_path[32];
 	char bluez_dbus_path[32];
 
 	/* collection of connected devices */
-	pthread_mutex_t devices_mutex;
+	pthread_rwlock_t devices_lock;
 	GHashTable *devices;
 
 	/* memory self-management */
-	int ref_count;
+	atomic_int ref_count;
 
 };
 
@@ -57,6 +68,9 @@ void ba_adapter_unref(struct ba_adapter *a);
 #define BA_TEST_ESCO_SUPPORT(a) \
 	((a)->hci.features[2] & LMP_TRSP_SCO && (a)->hci.features[3] & LMP_ESCO)
 
+int ba_adapter_sco_pool_get(struct ba_adapter *a, uint16_t voice);
+void ba_adapter_sco_pool_fill(struct ba_adapter *a);
+
 int ba_adapter_get_hfp_features_hf(struct ba_adapter *a);
 int ba_adapter_get_hfp_features_ag(struct ba_adapter *a);
 
@@ -10,15 +10,36 @@
 
 #include "ba-device.h"
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "ba-transport.h"
 #include "bluealsa.h"
 #include "hci.h"
+#include "storage.h"
+#include "shared/defs.h"
 #include "shared/log.h"
 
+/**
+ * Cached codec state. The configuration blob and the codec state are
+ * stored just after the entry structure. */
+struct codec_cache_entry {
+	const char *name;
+	size_t config_size;
+	size_t state_size;
+	void (*destroy)(void *state);
+	uint8_t data[];
+};
+
+static void codec_cache_entry_free(struct codec_cache_entry *entry) {
+	entry->destroy(&entry->data[entry->config_size]);
+	free(entry);
+}
+
 struct ba_device *ba_device_new(
 		struct ba_adapter *adapter,
 		const bdaddr_t *addr) {
@@ -42,12 +63,19 @@ struct ba_device *ba_device_new(
 
 	d->battery_level = -1;
 
-	pthread_mutex_init(&d->transports_mutex, NULL);
+	/* the warm mode is kept across reconnections */
+	bool warm;
+	if (storage_device_load_warm(addr, &warm) == 0)
+		d->warm = warm;
+
+	pthread_rwlock_init(&d->transports_lock, NULL);
 	d->transports = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, NULL);
 
-	pthread_mutex_lock(&adapter->devices_mutex);
+	pthread_mutex_init(&d->codec_cache_mutex, NULL);
+
+	pthread_rwlock_wrlock(&adapter->devices_lock);
 	g_hash_table_insert(adapter->devices, &d->addr, d);
-	pthread_mutex_unlock(&adapter->devices_mutex);
+	pthread_rwlock_unlock(&adapter->devices_lock);
 
 	return d;
 }
@@ -58,10 +86,10 @@ struct ba_device *ba_device_lookup(
 
 	struct ba_device *d;
 
-	pthread_mutex_lock(&adapter->devices_mutex);
+	pthread_rwlock_rdlock(&adapter->devices_lock);
 	if ((d = g_hash_table_lookup(adapter->devices, addr)) != NULL)
-		d->ref_count++;
-	pthread_mutex_unlock(&adapter->devices_mutex);
+		atomic_fetch_add(&d->ref_count, 1);
+	pthread_rwlock_unlock(&adapter->devices_lock);
 
 	return d;
 }
@@ -69,12 +97,7 @@ struct ba_device *ba_device_lookup(
 struct ba_device *ba_device_ref(
 		struct ba_device *d) {
 
-	struct ba_adapter *a = d->a;
-
-	pthread_mutex_lock(&a->devices_mutex);
-	d->ref_count++;
-	pthread_mutex_unlock(&a->devices_mutex);
-
+	atomic_fetch_add(&d->ref_count, 1);
 	return d;
 }
 
@@ -99,18 +122,18 @@ void ba_device_destroy(struct ba_device *d) {
 		GHashTableIter iter;
 		struct ba_transport *t;
 
-		pthread_mutex_lock(&d->transports_mutex);
+		pthread_rwlock_wrlock(&d->transports_lock);
 
 		g_hash_table_iter_init(&iter, d->transports);
 		if (!g_hash_table_iter_next(&iter, NULL, (gpointer)&t)) {
-			pthread_mutex_unlock(&d->transports_mutex);
+			pthread_rwlock_unlock(&d->transports_lock);
 			break;
 		}
 
-		t->ref_count++;
+		atomic_fetch_add(&t->ref_count, 1);
 		g_hash_table_iter_steal(&iter);
 
-		pthread_mutex_unlock(&d->transports_mutex);
+		pthread_rwlock_unlock(&d->transports_lock);
 
 		ba_transport_destroy(t);
 	}
@@ -123,11 +146,17 @@ void ba_device_unref(struct ba_device *d) {
 	int ref_count;
 	struct ba_adapter *a = d->a;
 
-	pthread_mutex_lock(&a->devices_mutex);
-	if ((ref_count = --d->ref_count) == 0)
+	/* drop the reference without locking unless it might be the last one */
+	ref_count = atomic_load(&d->ref_count);
+	while (ref_count > 1)
+		if (atomic_compare_exchange_weak(&d->ref_count, &ref_count, ref_count - 1))
+			return;
+
+	pthread_rwlock_wrlock(&a->devices_lock);
+	if ((ref_count = atomic_fetch_sub(&d->ref_count, 1) - 1) == 0)
 		/* detach device from the adapter */
 		g_hash_table_steal(a->devices, &d->addr);
-	pthread_mutex_unlock(&a->devices_mutex);
+	pthread_rwlock_unlock(&a->devices_lock);
 
 	if (ref_count > 0)
 		return;
@@ -137,8 +166,192 @@ void ba_device_unref(struct ba_device *d) {
 
 	ba_adapter_unref(a);
 	g_hash_table_unref(d->transports);
-	pthread_mutex_destroy(&d->transports_mutex);
+	pthread_rwlock_destroy(&d->transports_lock);
+	g_list_free_full(d->codec_cache, (GDestroyNotify)codec_cache_entry_free);
+	pthread_mutex_destroy(&d->codec_cache_mutex);
 	g_free(d->bluez_dbus_path);
 	g_free(d->ba_dbus_path);
 	free(d);
 }
+
+/**
+ * Acquire transport of the warm device.
+ *
+ * The transport acquisition is a blocking operation, so this function
+ * runs in a dedicated thread. */
+static void *device_warm_acquire(struct ba_transport *t) {
+	if (ba_transport_acquire(t) == -1 && errno != EINPROGRESS)
+		warn("Couldn't pre-acquire transport: %s", strerror(errno));
+	ba_transport_unref(t);
+	return NULL;
+}
+
+/**
+ * Check whether transport shall be kept acquired in the warm mode. */
+static bool device_warm_transport_check(const struct ba_transport *t) {
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_AG)
+		/* HFP codec has to be negotiated before the SCO link setup */
+		return t->type.codec != HFP_CODEC_UNDEFINED;
+	return t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE ||
+		t->type.profile & BA_TRANSPORT_PROFILE_BAP_SOURCE;
+}
+
+/**
+ * Pre-acquire newly set up transport of the warm device.
+ *
+ * This function shall be called when the transport codec is known. The
+ * acquisition is scheduled in the main loop, so it is safe to call this
+ * function before the transport setup has been finished.
+ *
+ * @param t Pointer to the transport structure. */
+void ba_device_warm_transport(struct ba_transport *t) {
+	if (atomic_load_explicit(&t->d->warm, memory_order_relaxed) &&
+			device_warm_transport_check(t))
+		ba_transport_acquire_async(t);
+}
+
+/**
+ * Set the warm mode of the device.
+ *
+ * In the warm mode, source transports (A2DP Source and SCO Audio Gateway)
+ * are acquired in advance and they are not released when the last client
+ * closes its PCM. The A2DP encoder sends silence in the meantime, so the
+ * playback can start right away, without waiting for the stream setup.
+ *
+ * @param d Pointer to the device structure.
+ * @param warm If true, the source transports will be kept acquired.
+ * @return This function returns 0. */
+int ba_device_set_warm(struct ba_device *d, bool warm) {
+
+	if (atomic_exchange(&d->warm, warm) == warm)
+		return 0;
+
+	debug("Setting device warm mode: %s: %s", batostr_(&d->addr), warm ? "on" : "off");
+
+	if (storage_device_save_warm(&d->addr, warm) == -1 && errno != ENOTSUP)
+		warn("Couldn't store device warm mode: %s", strerror(errno));
+
+	GHashTableIter iter;
+	struct ba_transport *t;
+
+	pthread_rwlock_rdlock(&d->transports_lock);
+
+	g_hash_table_iter_init(&iter, d->transports);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer)&t)) {
+
+		if (!device_warm_transport_check(t))
+			continue;
+
+		/* When the warm mode is disabled, release the
+		 * transport with the regular keep-alive logic. */
+		if (!warm) {
+			ba_transport_stop_if_no_clients(t);
+			continue;
+		}
+
+		pthread_t thread;
+		int ret;
+
+		ba_transport_ref(t);
+		if ((ret = pthread_create(&thread, NULL,
+						PTHREAD_ROUTINE(device_warm_acquire), t)) != 0) {
+			warn("Couldn't create pre-acquire thread: %s", strerror(ret));
+			ba_transport_unref(t);
+			continue;
+		}
+
+		pthread_detach(thread);
+
+	}
+
+	pthread_rwlock_unlock(&d->transports_lock);
+
+	return 0;
+}
+
+/**
+ * Acquire cached codec state.
+ *
+ * On success, the codec state is copied to the memory pointed by the
+ * state field of the codec structure and it is removed from the cache.
+ * Such a state shall be reset by the caller before use.
+ *
+ * @param codec Codec cache structure with the key and the state storage.
+ * @return If the state was found in the cache, this function returns 0,
+ *   otherwise -1 is returned and errno is set to ENOENT. */
+int ba_device_codec_acquire(struct ba_device_codec *codec) {
+
+	struct ba_device *d = codec->d;
+	struct codec_cache_entry *entry = NULL;
+	GList *el;
+
+	pthread_mutex_lock(&d->codec_cache_mutex);
+
+	for (el = d->codec_cache; el != NULL; el = el->next) {
+		struct codec_cache_entry *e = el->data;
+		if (strcmp(e->name, codec->name) == 0 &&
+				e->config_size == codec->config_size &&
+				e->state_size == codec->state_size &&
+				memcmp(e->data, codec->config, codec->config_size) == 0) {
+			d->codec_cache = g_list_delete_link(d->codec_cache, el);
+			entry = e;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&d->codec_cache_mutex);
+
+	if (entry == NULL)
+		return errno = ENOENT, -1;
+
+	debug("Reusing cached codec state: %s", codec->name);
+	memcpy(codec->state, &entry->data[entry->config_size], entry->state_size);
+	free(entry);
+
+	return 0;
+}
+
+/**
+ * Release codec state.
+ *
+ * If the codec state is marked as ready, it is moved to the device cache,
+ * so it might be reused by the next codec of the same kind. Otherwise, or
+ * in case of a memory allocation error, the state is destroyed. This
+ * function is suitable for the thread cancellation cleanup.
+ *
+ * @param codec Codec cache structure with the key and the state. */
+void ba_device_codec_release(struct ba_device_codec *codec) {
+
+	struct ba_device *d = codec->d;
+	struct codec_cache_entry *entry;
+
+	if (!codec->ready ||
+			(entry = malloc(sizeof(*entry) + codec->config_size + codec->state_size)) == NULL) {
+		codec->destroy(codec->state);
+		return;
+	}
+
+	entry->name = codec->name;
+	entry->config_size = codec->config_size;
+	entry->state_size = codec->state_size;
+	entry->destroy = codec->destroy;
+	memcpy(entry->data, codec->config, codec->config_size);
+	memcpy(&entry->data[codec->config_size], codec->state, codec->state_size);
+
+	GList *evicted = NULL;
+
+	pthread_mutex_lock(&d->codec_cache_mutex);
+
+	d->codec_cache = g_list_prepend(d->codec_cache, entry);
+	if (g_list_length(d->codec_cache) > BA_DEVICE_CODEC_CACHE_SIZE) {
+		evicted = g_list_last(d->codec_cache);
+		d->codec_cache = g_list_remove_link(d->codec_cache, evicted);
+	}
+
+	pthread_mutex_unlock(&d->codec_cache_mutex);
+
+	/* destroy evicted state outside of the critical section,
+	 * because codec library cleanup might take a while */
+	g_list_free_full(evicted, (GDestroyNotify)codec_cache_entry_free);
+
+}
@@ -16,6 +16,9 @@
 #endif
 
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include <bluetooth/bluetooth.h>
@@ -23,6 +26,13 @@
 
 #include "ba-adapter.h"
 
+/**
+ * Maximal number of codec states cached by a single device. */
+#define BA_DEVICE_CODEC_CACHE_SIZE 4
+
+struct ba_transport;
+struct ba_transport_pcm_handover;
+
 struct ba_device {
 
 	/* backward reference to adapter */
@@ -41,6 +51,9 @@ struct ba_device {
 	/* battery level in range [0, 100] or -1 */
 	int8_t battery_level;
 
+	/* keep source transports acquired even if there are no clients */
+	atomic_bool warm;
+
 	/* Apple's extension used with HFP profile */
 	struct {
 
@@ -58,11 +71,20 @@ struct ba_device {
 	const GArray *seps;
 
 	/* hash-map with connected transports */
-	pthread_mutex_t transports_mutex;
+	pthread_rwlock_t transports_lock;
 	GHashTable *transports;
 
+	/* initialized codec states kept for reuse,
+	 * the most recently released ones first */
+	pthread_mutex_t codec_cache_mutex;
+	GList *codec_cache;
+
+	/* PCM client stream detached from the transport during the A2DP codec
+	 * switch, waiting for the new transport (main loop access only) */
+	struct ba_transport_pcm_handover *pcm_handover;
+
 	/* memory self-management */
-	int ref_count;
+	atomic_int ref_count;
 
 };
 
@@ -79,4 +101,34 @@ struct ba_device *ba_device_ref(
 void ba_device_destroy(struct ba_device *d);
 void ba_device_unref(struct ba_device *d);
 
+int ba_device_set_warm(struct ba_device *d, bool warm);
+void ba_device_warm_transport(struct ba_transport *t);
+
+/**
+ * Codec state which might be cached by the device.
+ *
+ * The state is identified by the codec name and its configuration blob.
+ * It is copied by value, so the state structure itself (or the handle
+ * to the codec library) shall be stored in the memory pointed by the
+ * state field. */
+struct ba_device_codec {
+	/* device which owns the cache */
+	struct ba_device *d;
+	/* codec identifier, e.g. "sbc-enc" */
+	const char *name;
+	/* codec configuration blob */
+	const void *config;
+	size_t config_size;
+	/* address and size of the codec state */
+	void *state;
+	size_t state_size;
+	/* if true, the state will be cached upon release */
+	bool ready;
+	/* function called to free the codec state */
+	void (*destroy)(void *state);
+};
+
+int ba_device_codec_acquire(struct ba_device_codec *codec);
+void ba_device_codec_release(struct ba_device_codec *codec);
+
 #endif
@@ -11,12 +11,15 @@
 #include "ba-rfcomm.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
@@ -30,40 +33,32 @@
 #include "utils.h"
 #include "shared/defs.h"
 #include "shared/log.h"
-
-/**
- * Structure used for buffered reading from the RFCOMM. */
-struct at_reader {
-	struct bt_at at;
-	char buffer[256];
-	/* pointer to the next message within the buffer */
-	char *next;
-};
+#include "shared/rt.h"
 
 /**
  * Read AT message.
  *
- * Upon error it is required to set the next pointer of the reader structure
- * to NULL. Otherwise, this function might fail indefinitely.
+ * In case of reading more than one message from the RFCOMM, all of them are
+ * parsed before reading from the socket once more. If the reader does not
+ * contain complete message, data is read from the socket only once. The
+ * socket is non-blocking, so if there is nothing to read, this function
+ * fails with EAGAIN error code.
  *
  * @param fd RFCOMM socket file descriptor.
  * @param reader Pointer to initialized reader structure.
  * @return On success this function returns 0. Otherwise, -1 is returned and
- *   errno is set to indicate the error. */
+ *   errno is set to indicate the error. If received data does not contain
+ *   complete message, errno is set to EAGAIN. */
 static int rfcomm_read_at(int fd, struct at_reader *reader) {
 
-	char *buffer = reader->buffer;
-	char *msg = reader->next;
-	char *tmp;
-
-	/* In case of reading more than one message from the RFCOMM, we have to
-	 * parse all of them before we can read from the socket once more. */
-	if (msg == NULL) {
+	if (!at_reader_has_message(reader)) {
 
+		size_t size;
+		char *tail = at_reader_tail(reader, &size);
 		ssize_t len;
 
 retry:
-		if ((len = read(fd, buffer, sizeof(reader->buffer))) == -1) {
+		if ((len = read(fd, tail, size)) == -1) {
 			if (errno == EINTR)
 				goto retry;
 			return -1;
@@ -74,32 +69,65 @@ retry:
 			return -1;
 		}
 
-		buffer[len] = '\0';
-		msg = buffer;
+		at_reader_seek(reader, len);
 	}
 
 	/* parse AT message received from the RFCOMM */
-	if ((tmp = at_parse(msg, &reader->at)) == NULL) {
-		reader->next = msg;
-		errno = EBADMSG;
-		return -1;
+	return at_reader_parse(reader);
+}
+
+/**
+ * Send queued AT messages.
+ *
+ * The RFCOMM socket is non-blocking, so a single link with a stalled remote
+ * device can not block the shared RFCOMM loop. If the socket is not ready
+ * for writing, the unsent part of the data is kept in the queue and the
+ * loop will poll the socket for writing.
+ *
+ * @param r Pointer to the RFCOMM structure.
+ * @return On success this function returns 0. Otherwise, -1 is returned and
+ *   errno is set to indicate the error. In case of an error the queue is
+ *   emptied, so the failed transfer will not be repeated. */
+static int rfcomm_flush_at(struct ba_rfcomm *r) {
+
+	const char *data = r->tx.data;
+	size_t len = r->tx.len;
+	ssize_t ret;
+
+	while (len > 0) {
+		if ((ret = write(r->fd, data, len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			r->tx.len = 0;
+			return -1;
+		}
+		data += ret;
+		len -= ret;
 	}
 
-	reader->next = tmp[0] != '\0' ? tmp : NULL;
+	memmove(r->tx.data, data, len);
+	r->tx.len = len;
+
 	return 0;
 }
 
 /**
  * Write AT message.
  *
- * @param fd RFCOMM socket file descriptor.
+ * The message is not written to the RFCOMM socket right away. Instead, it
+ * is appended to the TX queue, so all responses generated while processing
+ * received data are sent to the remote device with a single write.
+ *
+ * @param r Pointer to the RFCOMM structure.
  * @param type Type of the AT message.
  * @param command AT command or response code.
  * @param value AT value or NULL if not applicable.
  * @return On success this function returns 0. Otherwise, -1 is returned and
  *   errno is set to indicate the error. */
-static int rfcomm_write_at(int fd, enum bt_at_type type, const char *command,
-		const char *value) {
+static int rfcomm_write_at(struct ba_rfcomm *r, enum bt_at_type type,
+		const char *command, const char *value) {
 
 	char msg[256];
 	size_t len;
@@ -110,16 +138,43 @@ static int rfcomm_write_at(int fd, enum bt_at_type type, const char *command,
 	at_build(msg, type, command, value);
 	len = strlen(msg);
 
-retry:
-	if (write(fd, msg, len) == -1) {
-		if (errno == EINTR)
-			goto retry;
+	if (r->tx.len + len > r->tx.size &&
+			rfcomm_flush_at(r) == -1)
 		return -1;
+
+	if (r->tx.len + len > r->tx.size) {
+		/* Remote device does not keep up with our messages, so keep them
+		 * queued until the RFCOMM socket becomes writable. However, if the
+		 * remote device does not read at all, there is no point in queuing
+		 * messages indefinitely. */
+		size_t size = MAX(r->tx.size * 2, BA_RFCOMM_TX_BUFFER_SIZE);
+		if (r->tx.len + len > BA_RFCOMM_TX_BUFFER_SIZE_MAX)
+			return errno = ENOBUFS, -1;
+		size = MIN(size, BA_RFCOMM_TX_BUFFER_SIZE_MAX);
+		char *tmp;
+		if ((tmp = realloc(r->tx.data, size)) == NULL)
+			return -1;
+		r->tx.data = tmp;
+		r->tx.size = size;
 	}
 
+	memcpy(&r->tx.data[r->tx.len], msg, len);
+	r->tx.len += len;
+
 	return 0;
 }
 
+/**
+ * Notify the ba_transport_select_codec() caller that codec selection is over.
+ *
+ * The mutex is taken, so the notification can not be lost in case when the
+ * caller has not started waiting yet. */
+static void rfcomm_codec_selection_complete(struct ba_rfcomm *r) {
+	pthread_mutex_lock(&r->codec_selection_completed_mtx);
+	pthread_cond_signal(&r->codec_selection_completed);
+	pthread_mutex_unlock(&r->codec_selection_completed_mtx);
+}
+
 /**
  * HFP set state wrapper for debugging purposes. */
 static void rfcomm_set_hfp_state(struct ba_rfcomm *r, enum hfp_slc_state state) {
@@ -128,6 +183,40 @@ static void rfcomm_set_hfp_state(struct ba_rfcomm *r, enum hfp_slc_state state)
 	r->state = state;
 }
 
+/**
+ * Check whether given HFP codec can be used with our adapter. */
+static bool rfcomm_is_hfp_codec_available(const struct ba_rfcomm *r, int codec) {
+	switch (codec) {
+	case HFP_CODEC_CVSD:
+		return true;
+#if ENABLE_MSBC
+	case HFP_CODEC_MSBC:
+#endif
+#if ENABLE_LC3_SWB
+	case HFP_CODEC_LC3_SWB:
+#endif
+		return BA_TEST_ESCO_SUPPORT(r->sco->d->a);
+	default:
+		return false;
+	}
+}
+
+/**
+ * Get the list of HFP codecs supported with our adapter.
+ *
+ * @return This function returns the value of the AT+BAC command. */
+static const char *rfcomm_get_hfp_codecs(const struct ba_rfcomm *r) {
+	if (!rfcomm_is_hfp_codec_available(r, HFP_CODEC_MSBC))
+		return "1";
+#if ENABLE_LC3_SWB
+	/* advertise, that we are supporting CVSD (1), mSBC (2) and LC3-SWB (3) */
+	return "1,2,3";
+#else
+	/* advertise, that we are supporting CVSD (1) and mSBC (2) */
+	return "1,2";
+#endif
+}
+
 /**
  * Handle AT command response code. */
 static int rfcomm_handler_resp_ok_cb(struct ba_rfcomm *r, const struct bt_at *at) {
@@ -149,11 +238,10 @@ static int rfcomm_handler_resp_ok_cb(struct ba_rfcomm *r, const struct bt_at *at
 static int rfcomm_handler_cind_test_cb(struct ba_rfcomm *r, const struct bt_at *at) {
 	(void)at;
 
-	const int fd = r->fd;
 
 	/* NOTE: The order of indicators in the CIND response message
 	 *       has to be consistent with the hfp_ind enumeration. */
-	if (rfcomm_write_at(fd, AT_TYPE_RESP, "+CIND",
+	if (rfcomm_write_at(r, AT_TYPE_RESP, "+CIND",
 				"(\"service\",(0-1))"
 				",(\"call\",(0,1))"
 				",(\"callsetup\",(0-3))"
@@ -163,7 +251,7 @@ static int rfcomm_handler_cind_test_cb(struct ba_rfcomm *r, const struct bt_at *
 				",(\"battchg\",(0-5))"
 			) == -1)
 		return -1;
-	if (rfcomm_write_at(fd, AT_TYPE_RESP, NULL, "OK") == -1)
+	if (rfcomm_write_at(r, AT_TYPE_RESP, NULL, "OK") == -1)
 		return -1;
 
 	if (r->state < HFP_SLC_CIND_TEST_OK)
@@ -177,14 +265,13 @@ static int rfcomm_handler_cind_test_cb(struct ba_rfcomm *r, const struct bt_at *
 static int rfcomm_handler_cind_get_cb(struct ba_rfcomm *r, const struct bt_at *at) {
 	(void)at;
 
-	const int fd = r->fd;
 	const int battchg = config.battery.available ? (config.battery.level + 1) / 17 : 5;
 	char tmp[32];
 
 	sprintf(tmp, "0,0,0,0,0,0,%d", battchg);
-	if (rfcomm_write_at(fd, AT_TYPE_RESP, "+CIND", tmp) == -1)
+	if (rfcomm_write_at(r, AT_TYPE_RESP, "+CIND", tmp) == -1)
 		return -1;
-	if (rfcomm_write_at(fd, AT_TYPE_RESP, NULL, "OK") == -1)
+	if (rfcomm_write_at(r, AT_TYPE_RESP, NULL, "OK") == -1)
 		return -1;
 
 	if (r->state < HFP_SLC_CIND_GET_OK)
@@ -235,7 +322,6 @@ static int rfcomm_handler_cind_resp_get_cb(struct ba_rfcomm *r, const struct bt_
 static int rfcomm_handler_cmer_set_cb(struct ba_rfcomm *r, const struct bt_at *at) {
 	(void)at;
 
-	const int fd = r->fd;
 	const char *resp = "OK";
 
 	if (at_parse_cmer(at->value, r->hfp_cmer) == -1) {
@@ -243,7 +329,7 @@ static int rfcomm_handler_cmer_set_cb(struct ba_rfcomm *r, const struct bt_at *a
 		resp = "ERROR";
 	}
 
-	if (rfcomm_write_at(fd, AT_TYPE_RESP, NULL, resp) == -1)
+	if (rfcomm_write_at(r, AT_TYPE_RESP, NULL, resp) == -1)
 		return -1;
 
 	if (r->state < HFP_SLC_CMER_SET_OK)
@@ -280,7 +366,6 @@ static int rfcomm_handler_ciev_resp_cb(struct ba_rfcomm *r, const struct bt_at *
  * SET: Bluetooth Indicators Activation */
 static int rfcomm_handler_bia_set_cb(struct ba_rfcomm *r, const struct bt_at *at) {
 
-	const int fd = r->fd;
 	const char *resp = "OK";
 
 	if (at_parse_bia(at->value, r->hfp_ind_state) == -1) {
@@ -288,7 +373,7 @@ static int rfcomm_handler_bia_set_cb(struct ba_rfcomm *r, const struct bt_at *at
 		resp = "ERROR";
 	}
 
-	if (rfcomm_write_at(fd, AT_TYPE_RESP, NULL, resp) == -1)
+	if (rfcomm_write_at(r, AT_TYPE_RESP, NULL, resp) == -1)
 		return -1;
 	return 0;
 }
@@ -298,7 +383,6 @@ static int rfcomm_handler_bia_set_cb(struct ba_rfcomm *r, const struct bt_at *at
 static int rfcomm_handler_brsf_set_cb(struct ba_rfcomm *r, const struct bt_at *at) {
 
 	struct ba_transport * const t_sco = r->sco;
-	const int fd = r->fd;
 	char tmp[16];
 
 	r->hfp_features = atoi(at->value);
@@ -309,9 +393,9 @@ static int rfcomm_handler_brsf_set_cb(struct ba_rfcomm *r, const struct bt_at *a
 		ba_transport_set_codec(t_sco, HFP_CODEC_CVSD);
 
 	sprintf(tmp, "%u", ba_adapter_get_hfp_features_ag(t_sco->d->a));
-	if (rfcomm_write_at(fd, AT_TYPE_RESP, "+BRSF", tmp) == -1)
+	if (rfcomm_write_at(r, AT_TYPE_RESP, "+BRSF", tmp) == -1)
 		return -1;
-	if (rfcomm_write_at(fd, AT_TYPE_RESP, NULL, "OK") == -1)
+	if (rfcomm_write_at(r, AT_TYPE_RESP, NULL, "OK") == -1)
 		return -1;
 
 	if (r->state < HFP_SLC_BRSF_SET_OK)
@@ -341,10 +425,9 @@ static int rfcomm_handler_brsf_resp_cb(struct ba_rfcomm *r, const struct bt_at *
  * SET: Noise Reduction and Echo Canceling */
 static int rfcomm_handler_nrec_set_cb(struct ba_rfcomm *r, const struct bt_at *at) {
 	(void)at;
-	const int fd = r->fd;
 	/* Currently, we are not supporting Noise Reduction & Echo Canceling,
 	 * so just acknowledge this SET request with "ERROR" response code. */
-	if (rfcomm_write_at(fd, AT_TYPE_RESP, NULL, "ERROR") == -1)
+	if (rfcomm_write_at(r, AT_TYPE_RESP, NULL, "ERROR") == -1)
 		return -1;
 	return 0;
 }
@@ -355,16 +438,15 @@ static int rfcomm_handler_vgm_set_cb(struct ba_rfcomm *r, const struct bt_at *at
 
 	struct ba_transport * const t_sco = r->sco;
 	struct ba_transport_pcm *pcm = &t_sco->sco.mic_pcm;
-	const int fd = r->fd;
 
 	/* skip update in case of software volume */
 	if (pcm->soft_volume)
-		return rfcomm_write_at(fd, AT_TYPE_RESP, NULL, "OK");
+		return rfcomm_write_at(r, AT_TYPE_RESP, NULL, "OK");
 
 	r->gain_mic = atoi(at->value);
 	int level = ba_transport_pcm_volume_bt_to_level(pcm, r->gain_mic);
 	ba_transport_pcm_volume_set(&pcm->volume[0], &level, NULL);
-	if (rfcomm_write_at(fd, AT_TYPE_RESP, NULL, "OK") == -1)
+	if (rfcomm_write_at(r, AT_TYPE_RESP, NULL, "OK") == -1)
 		return -1;
 
 	bluealsa_dbus_pcm_update(pcm, BA_DBUS_PCM_UPDATE_VOLUME);
@@ -392,16 +474,15 @@ static int rfcomm_handler_vgs_set_cb(struct ba_rfcomm *r, const struct bt_at *at
 
 	struct ba_transport * const t_sco = r->sco;
 	struct ba_transport_pcm *pcm = &t_sco->sco.spk_pcm;
-	const int fd = r->fd;
 
 	/* skip update in case of software volume */
 	if (pcm->soft_volume)
-		return rfcomm_write_at(fd, AT_TYPE_RESP, NULL, "OK");
+		return rfcomm_write_at(r, AT_TYPE_RESP, NULL, "OK");
 
 	r->gain_spk = atoi(at->value);
 	int level = ba_transport_pcm_volume_bt_to_level(pcm, r->gain_spk);
 	ba_transport_pcm_volume_set(&pcm->volume[0], &level, NULL);
-	if (rfcomm_write_at(fd, AT_TYPE_RESP, NULL, "OK") == -1)
+	if (rfcomm_write_at(r, AT_TYPE_RESP, NULL, "OK") == -1)
 		return -1;
 
 	bluealsa_dbus_pcm_update(pcm, BA_DBUS_PCM_UPDATE_VOLUME);
@@ -427,22 +508,54 @@ static int rfcomm_handler_vgs_resp_cb(struct ba_rfcomm *r, const struct bt_at *a
  * SET: Bluetooth Response and Hold Feature */
 static int rfcomm_handler_btrh_get_cb(struct ba_rfcomm *r, const struct bt_at *at) {
 	(void)at;
-	const int fd = r->fd;
 	/* Currently, we are not supporting Respond & Hold feature, so just
 	 * acknowledge this GET request without reporting +BTRH status. */
-	if (rfcomm_write_at(fd, AT_TYPE_RESP, NULL, "OK") == -1)
+	if (rfcomm_write_at(r, AT_TYPE_RESP, NULL, "OK") == -1)
 		return -1;
 	return 0;
 }
 
+/**
+ * Establish SCO link of the offloaded transport.
+ *
+ * Connecting SCO link is a blocking operation, so this function runs in
+ * a dedicated thread, not to stall the shared RFCOMM loop. */
+static void *rfcomm_sco_offload_acquire(struct ba_transport *t) {
+	if (ba_transport_acquire(t) == -1)
+		error("Couldn't establish offloaded SCO link: %s", strerror(errno));
+	ba_transport_unref(t);
+	return NULL;
+}
+
 /**
  * SET: Bluetooth Codec Connection */
 static int rfcomm_handler_bcc_cmd_cb(struct ba_rfcomm *r, const struct bt_at *at) {
 	(void)at;
-	const int fd = r->fd;
-	/* TODO: Start Codec Connection procedure because HF wants to send audio. */
-	if (rfcomm_write_at(fd, AT_TYPE_RESP, NULL, "ERROR") == -1)
+
+	struct ba_transport * const t_sco = r->sco;
+	pthread_t thread;
+	int ret;
+
+	/* Normally, the SCO link is established when the PCM is opened by our
+	 * client. In the offload mode there are no PCM clients, so the link has
+	 * to be established when HF wants to send audio.
+	 * TODO: Start Codec Connection procedure if codec is not selected. */
+	if (!t_sco->d->a->sco_offload ||
+			t_sco->type.codec == HFP_CODEC_UNDEFINED)
+		return rfcomm_write_at(r, AT_TYPE_RESP, NULL, "ERROR");
+
+	if (rfcomm_write_at(r, AT_TYPE_RESP, NULL, "OK") == -1)
 		return -1;
+
+	ba_transport_ref(t_sco);
+	if ((ret = pthread_create(&thread, NULL,
+					PTHREAD_ROUTINE(rfcomm_sco_offload_acquire), t_sco)) != 0) {
+		error("Couldn't create SCO link thread: %s", strerror(ret));
+		ba_transport_unref(t_sco);
+		return 0;
+	}
+
+	pthread_detach(thread);
 	return 0;
 }
 
@@ -451,17 +564,16 @@ static int rfcomm_handler_bcc_cmd_cb(struct ba_rfcomm *r, const struct bt_at *at
 static int rfcomm_handler_bcs_set_cb(struct ba_rfcomm *r, const struct bt_at *at) {
 
 	struct ba_transport * const t_sco = r->sco;
-	const int fd = r->fd;
 	int codec;
 
 	if ((codec = atoi(at->value)) != r->codec) {
 		warn("Codec not acknowledged: %s != %d", at->value, r->codec);
-		if (rfcomm_write_at(fd, AT_TYPE_RESP, NULL, "ERROR") == -1)
+		if (rfcomm_write_at(r, AT_TYPE_RESP, NULL, "ERROR") == -1)
 			return -1;
 		goto final;
 	}
 
-	if (rfcomm_write_at(fd, AT_TYPE_RESP, NULL, "OK") == -1)
+	if (rfcomm_write_at(r, AT_TYPE_RESP, NULL, "OK") == -1)
 		return -1;
 
 	/* Codec negotiation process is complete. Update transport and
@@ -473,7 +585,7 @@ static int rfcomm_handler_bcs_set_cb(struct ba_rfcomm *r, const struct bt_at *at
 			BA_DBUS_PCM_UPDATE_SAMPLING | BA_DBUS_PCM_UPDATE_CODEC);
 
 final:
-	pthread_cond_signal(&r->codec_selection_completed);
+	rfcomm_codec_selection_complete(r);
 	return 0;
 }
 
@@ -499,7 +611,7 @@ static int rfcomm_handler_resp_bcs_ok_cb(struct ba_rfcomm *r, const struct bt_at
 			BA_DBUS_PCM_UPDATE_SAMPLING | BA_DBUS_PCM_UPDATE_CODEC);
 
 final:
-	pthread_cond_signal(&r->codec_selection_completed);
+	rfcomm_codec_selection_complete(r);
 	return 0;
 }
 
@@ -509,10 +621,22 @@ static int rfcomm_handler_bcs_resp_cb(struct ba_rfcomm *r, const struct bt_at *a
 
 	static const struct ba_rfcomm_handler handler = {
 		AT_TYPE_RESP, "", rfcomm_handler_resp_bcs_ok_cb };
-	const int fd = r->fd;
+	static const struct ba_rfcomm_handler handler_bac = {
+		AT_TYPE_RESP, "", rfcomm_handler_resp_ok_cb };
+
+	/* If the requested codec is not supported, we shall reply with
+	 * the list of available codecs, so the AG can select another one. */
+	if (!rfcomm_is_hfp_codec_available(r, atoi(at->value))) {
+		warn("Unsupported codec requested: %s", at->value);
+		if (rfcomm_write_at(r, AT_TYPE_CMD_SET, "+BAC", rfcomm_get_hfp_codecs(r)) == -1)
+			return -1;
+		r->handler = &handler_bac;
+		r->handler_resp_ok_new_state = r->state;
+		return 0;
+	}
 
 	r->codec = atoi(at->value);
-	if (rfcomm_write_at(fd, AT_TYPE_CMD_SET, "+BCS", at->value) == -1)
+	if (rfcomm_write_at(r, AT_TYPE_CMD_SET, "+BCS", at->value) == -1)
 		return -1;
 	r->handler = &handler;
 
@@ -523,7 +647,6 @@ static int rfcomm_handler_bcs_resp_cb(struct ba_rfcomm *r, const struct bt_at *a
  * SET: Bluetooth Available Codecs */
 static int rfcomm_handler_bac_set_cb(struct ba_rfcomm *r, const struct bt_at *at) {
 
-	const int fd = r->fd;
 	char *tmp = at->value - 1;
 
 	do {
@@ -531,10 +654,14 @@ static int rfcomm_handler_bac_set_cb(struct ba_rfcomm *r, const struct bt_at *at
 #if ENABLE_MSBC
 		if (atoi(tmp) == HFP_CODEC_MSBC)
 			r->msbc = true;
+#endif
+#if ENABLE_LC3_SWB
+		if (atoi(tmp) == HFP_CODEC_LC3_SWB)
+			r->lc3_swb = true;
 #endif
 	} while ((tmp = strchr(tmp, ',')) != NULL);
 
-	if (rfcomm_write_at(fd, AT_TYPE_RESP, NULL, "OK") == -1)
+	if (rfcomm_write_at(r, AT_TYPE_RESP, NULL, "OK") == -1)
 		return -1;
 
 	if (r->state < HFP_SLC_BAC_SET_OK)
@@ -548,7 +675,6 @@ static int rfcomm_handler_bac_set_cb(struct ba_rfcomm *r, const struct bt_at *at
 static int rfcomm_handler_iphoneaccev_set_cb(struct ba_rfcomm *r, const struct bt_at *at) {
 
 	struct ba_device * const d = r->sco->d;
-	const int fd = r->fd;
 
 	char *ptr = at->value;
 	size_t count = atoi(strsep(&ptr, ","));
@@ -571,7 +697,7 @@ static int rfcomm_handler_iphoneaccev_set_cb(struct ba_rfcomm *r, const struct b
 			strsep(&ptr, ",");
 		}
 
-	if (rfcomm_write_at(fd, AT_TYPE_RESP, NULL, "OK") == -1)
+	if (rfcomm_write_at(r, AT_TYPE_RESP, NULL, "OK") == -1)
 		return -1;
 	return 0;
 }
@@ -581,7 +707,6 @@ static int rfcomm_handler_iphoneaccev_set_cb(struct ba_rfcomm *r, const struct b
 static int rfcomm_handler_xapl_set_cb(struct ba_rfcomm *r, const struct bt_at *at) {
 
 	struct ba_device * const d = r->sco->d;
-	const int fd = r->fd;
 
 	unsigned int vendor, product;
 	char version[sizeof(d->xapl.software_version)];
@@ -590,7 +715,7 @@ static int rfcomm_handler_xapl_set_cb(struct ba_rfcomm *r, const struct bt_at *a
 
 	if ((tmp = strrchr(at->value, ',')) == NULL) {
 		warn("Invalid +XAPL value: %s", at->value);
-		if (rfcomm_write_at(fd, AT_TYPE_RESP, NULL, "ERROR") == -1)
+		if (rfcomm_write_at(r, AT_TYPE_RESP, NULL, "ERROR") == -1)
 			return -1;
 		return 0;
 	}
@@ -607,9 +732,9 @@ static int rfcomm_handler_xapl_set_cb(struct ba_rfcomm *r, const struct bt_at *a
 
 	snprintf(resp, sizeof(resp), "+XAPL=%s,%u",
 			config.hfp.xapl_product_name, config.hfp.xapl_features);
-	if (rfcomm_write_at(fd, AT_TYPE_RESP, NULL, resp) == -1)
+	if (rfcomm_write_at(r, AT_TYPE_RESP, NULL, resp) == -1)
 		return -1;
-	if (rfcomm_write_at(fd, AT_TYPE_RESP, NULL, "OK") == -1)
+	if (rfcomm_write_at(r, AT_TYPE_RESP, NULL, "OK") == -1)
 		return -1;
 	return 0;
 }
@@ -741,7 +866,6 @@ static enum ba_rfcomm_signal rfcomm_recv_signal(struct ba_rfcomm *r) {
 static int rfcomm_set_hfp_codec(struct ba_rfcomm *r, uint16_t codec) {
 
 	struct ba_transport * const t_sco = r->sco;
-	const int fd = r->fd;
 	char tmp[16];
 
 	debug("RFCOMM: %s setting codec: %s",
@@ -750,26 +874,34 @@ static int rfcomm_set_hfp_codec(struct ba_rfcomm *r, uint16_t codec) {
 
 	/* Codec selection can be requested only after Service Level Connection
 	 * establishment, and make sense only if mSBC encoding is supported. */
-	if (r->state != HFP_SLC_CONNECTED || !r->msbc) {
+	bool available = r->msbc;
+#if ENABLE_LC3_SWB
+	/* LC3-SWB can be selected only if it was advertised by the HF */
+	if (codec == HFP_CODEC_LC3_SWB)
+		available = r->lc3_swb;
+#endif
+	if (r->state != HFP_SLC_CONNECTED || !available) {
 		/* If codec selection was requested by some other thread by calling the
 		 * ba_transport_select_codec(), we have to signal it that the selection
 		 * procedure has been completed. */
-		pthread_cond_signal(&r->codec_selection_completed);
+		rfcomm_codec_selection_complete(r);
 		return 0;
 	}
 
 	/* for AG request codec selection using unsolicited response code */
 	if (t_sco->type.profile & BA_TRANSPORT_PROFILE_HFP_AG) {
 		sprintf(tmp, "%d", codec);
-		if (rfcomm_write_at(fd, AT_TYPE_RESP, "+BCS", tmp) == -1)
+		if (rfcomm_write_at(r, AT_TYPE_RESP, "+BCS", tmp) == -1) {
+			rfcomm_codec_selection_complete(r);
 			return -1;
+		}
 		r->codec = codec;
 		r->handler = &rfcomm_handler_bcs_set;
 		return 0;
 	}
 
 	/* TODO: Send codec connection initialization request to AG. */
-	pthread_cond_signal(&r->codec_selection_completed);
+	rfcomm_codec_selection_complete(r);
 	return 0;
 }
 #endif
@@ -779,20 +911,19 @@ static int rfcomm_set_hfp_codec(struct ba_rfcomm *r, uint16_t codec) {
 static int rfcomm_notify_battery_level_change(struct ba_rfcomm *r) {
 
 	struct ba_transport * const t_sco = r->sco;
-	const int fd = r->fd;
 	char tmp[32];
 
 	/* for HFP-AG return battery level indicator if reporting is enabled */
 	if (t_sco->type.profile & BA_TRANSPORT_PROFILE_HFP_AG &&
 			r->hfp_cmer[3] > 0 && r->hfp_ind_state[HFP_IND_BATTCHG]) {
 		sprintf(tmp, "%d,%d", HFP_IND_BATTCHG, (config.battery.level + 1) / 17);
-		return rfcomm_write_at(fd, AT_TYPE_RESP, "+CIND", tmp);
+		return rfcomm_write_at(r, AT_TYPE_RESP, "+CIND", tmp);
 	}
 
 	if (t_sco->type.profile & BA_TRANSPORT_PROFILE_MASK_HF &&
 			t_sco->d->xapl.features & (XAPL_FEATURE_BATTERY | XAPL_FEATURE_DOCKING)) {
 		sprintf(tmp, "2,1,%d,2,0", (config.battery.level + 1) / 10);
-		if (rfcomm_write_at(fd, AT_TYPE_CMD_SET, "+IPHONEACCEV", tmp) == -1)
+		if (rfcomm_write_at(r, AT_TYPE_CMD_SET, "+IPHONEACCEV", tmp) == -1)
 			return -1;
 		r->handler = &rfcomm_handler_resp_ok;
 	}
@@ -806,7 +937,6 @@ static int rfcomm_notify_volume_change_mic(struct ba_rfcomm *r, bool force) {
 
 	struct ba_transport * const t_sco = r->sco;
 	struct ba_transport_pcm *pcm = &t_sco->sco.mic_pcm;
-	const int fd = r->fd;
 	int gain = 0;
 	char tmp[16];
 
@@ -823,11 +953,11 @@ static int rfcomm_notify_volume_change_mic(struct ba_rfcomm *r, bool force) {
 	/* for AG return unsolicited response code */
 	if (t_sco->type.profile & BA_TRANSPORT_PROFILE_MASK_AG) {
 		sprintf(tmp, "+VGM=%d", gain);
-		return rfcomm_write_at(fd, AT_TYPE_RESP, NULL, tmp);
+		return rfcomm_write_at(r, AT_TYPE_RESP, NULL, tmp);
 	}
 
 	sprintf(tmp, "%d", gain);
-	if (rfcomm_write_at(fd, AT_TYPE_CMD_SET, "+VGM", tmp) == -1)
+	if (rfcomm_write_at(r, AT_TYPE_CMD_SET, "+VGM", tmp) == -1)
 		return -1;
 	r->handler = &rfcomm_handler_resp_ok;
 
@@ -840,7 +970,6 @@ static int rfcomm_notify_volume_change_spk(struct ba_rfcomm *r, bool force) {
 
 	struct ba_transport * const t_sco = r->sco;
 	struct ba_transport_pcm *pcm = &t_sco->sco.spk_pcm;
-	const int fd = r->fd;
 	int gain = 0;
 	char tmp[16];
 
@@ -857,28 +986,94 @@ static int rfcomm_notify_volume_change_spk(struct ba_rfcomm *r, bool force) {
 	/* for AG return unsolicited response code */
 	if (t_sco->type.profile & BA_TRANSPORT_PROFILE_MASK_AG) {
 		sprintf(tmp, "+VGS=%d", gain);
-		return rfcomm_write_at(fd, AT_TYPE_RESP, NULL, tmp);
+		return rfcomm_write_at(r, AT_TYPE_RESP, NULL, tmp);
 	}
 
 	sprintf(tmp, "%d", gain);
-	if (rfcomm_write_at(fd, AT_TYPE_CMD_SET, "+VGS", tmp) == -1)
+	if (rfcomm_write_at(r, AT_TYPE_CMD_SET, "+VGS", tmp) == -1)
 		return -1;
 	r->handler = &rfcomm_handler_resp_ok;
 
 	return 0;
 }
 
-static void rfcomm_thread_cleanup(struct ba_rfcomm *r) {
+/**
+ * Shared RFCOMM loop data.
+ *
+ * Single loop thread handles RFCOMM links of all connected devices. Every
+ * link is driven by events: the RFCOMM socket, the signal pipe and the
+ * external handler socket are polled by the loop, and the link timeout is
+ * tracked by the loop as well, so a connected device does not require a
+ * separate thread. The list link is embedded in the RFCOMM structure. */
+static struct {
+	pthread_once_t once;
+	pthread_t thread_id;
+	bool running;
+	pthread_mutex_t mutex;
+	/* link processing completed notification */
+	pthread_cond_t changed;
+	/* loop wake-up event */
+	int event_fd;
+	/* RFCOMM links handled by the loop */
+	GQueue links;
+	/* incremented on every links list change */
+	unsigned int links_generation;
+	/* link processed by the loop at the moment */
+	struct ba_rfcomm *current;
+} rfcomm_loop = {
+	.once = PTHREAD_ONCE_INIT,
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.changed = PTHREAD_COND_INITIALIZER,
+	.event_fd = -1,
+	.links = G_QUEUE_INIT,
+};
+
+/**
+ * Get the current time of the RFCOMM loop in milliseconds. */
+static uint64_t rfcomm_loop_now(void) {
+	struct timespec now;
+	gettimestamp(&now);
+	return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * Wake up the RFCOMM loop, so it will rebuild the list of polled links. */
+static void rfcomm_loop_wakeup(void) {
+	eventfd_write(rfcomm_loop.event_fd, 1);
+}
+
+/**
+ * Remove RFCOMM link from the loop.
+ *
+ * The caller shall hold the loop mutex. */
+static void rfcomm_loop_unlink(struct ba_rfcomm *r) {
+	if (!r->loop.linked)
+		return;
+	g_queue_unlink(&rfcomm_loop.links, &r->loop.link);
+	r->loop.linked = false;
+	rfcomm_loop.links_generation++;
+	rfcomm_loop_wakeup();
+}
+
+static void rfcomm_link_cleanup(struct ba_rfcomm *r) {
 
 	if (r->fd == -1)
 		return;
 
 	debug("Closing RFCOMM: %d", r->fd);
 
+	pthread_mutex_lock(&rfcomm_loop.mutex);
+	rfcomm_loop_unlink(r);
+	pthread_mutex_unlock(&rfcomm_loop.mutex);
+
 	shutdown(r->fd, SHUT_RDWR);
 	close(r->fd);
 	r->fd = -1;
 
+	/* wake up codec selection caller, if any */
+	r->handler = NULL;
+	rfcomm_codec_selection_complete(r);
+
 	if (r->sco != NULL) {
 
 		if (r->link_lost_quirk) {
@@ -890,349 +1085,403 @@ static void rfcomm_thread_cleanup(struct ba_rfcomm *r) {
 			return;
 		}
 
-		ba_transport_unref(r->sco);
+		/* The last reference might be held by us, in which case the
+		 * transport destroy will free this RFCOMM structure as well. */
+		struct ba_transport *t_sco = r->sco;
 		r->sco = NULL;
+		ba_transport_unref(t_sco);
 
 	}
 
 }
 
-static void *rfcomm_thread(struct ba_rfcomm *r) {
-
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_push(PTHREAD_CLEANUP(rfcomm_thread_cleanup), r);
+/**
+ * Advance the service level connection and the initial setup procedure.
+ *
+ * @param r Pointer to the RFCOMM structure.
+ * @param timeout Address where the link timeout in milliseconds will be
+ *   stored. If the link shall wait for events infinitely, it is set to -1.
+ * @return On success this function returns 0. Otherwise, -1 is returned and
+ *   errno is set to indicate the error. */
+static int rfcomm_link_setup(struct ba_rfcomm *r, int *timeout) {
 
 	struct ba_transport * const t_sco = r->sco;
-	struct at_reader reader = { .next = NULL };
-	struct pollfd pfds[] = {
-		{ r->sig_fd[0], POLLIN, 0 },
-		{ r->fd, POLLIN, 0 },
-		{ -1, POLLIN, 0 },
-	};
+	char tmp[256];
 
-	debug("Starting RFCOMM loop: %s", ba_transport_type_to_string(t_sco->type));
-	for (;;) {
+	/* During normal operation, RFCOMM should block indefinitely. However,
+	 * in the HFP-HF mode, service level connection has to be initialized
+	 * by ourself. In order to do this reliably, we have to assume, that
+	 * AG might not receive our message and will not send proper response.
+	 * Hence, we will incorporate timeout, after which we will send our
+	 * AT command once more. */
+	*timeout = BA_RFCOMM_TIMEOUT_IDLE;
 
-		/* During normal operation, RFCOMM should block indefinitely. However,
-		 * in the HFP-HF mode, service level connection has to be initialized
-		 * by ourself. In order to do this reliably, we have to assume, that
-		 * AG might not receive our message and will not send proper response.
-		 * Hence, we will incorporate timeout, after which we will send our
-		 * AT command once more. */
-		int timeout = BA_RFCOMM_TIMEOUT_IDLE;
+	if (r->handler != NULL)
+		goto final;
 
-		ba_rfcomm_callback *callback;
-		char tmp[256];
+	if (r->state != HFP_SLC_CONNECTED) {
 
-		if (r->handler != NULL)
-			goto process;
+		/* If some progress has been made in the SLC procedure, reset the
+		 * retries counter. */
+		if (r->state != r->state_prev) {
+			r->state_prev = r->state;
+			r->retries = 0;
+		}
 
-		if (r->state != HFP_SLC_CONNECTED) {
+		/* If the maximal number of retries has been reached, terminate the
+		 * connection. Trying indefinitely will only use up our resources. */
+		if (r->retries > BA_RFCOMM_SLC_RETRIES) {
+			error("Couldn't establish connection: Too many retries");
+			errno = ETIMEDOUT;
+			return -1;
+		}
 
-			/* If some progress has been made in the SLC procedure, reset the
-			 * retries counter. */
-			if (r->state != r->state_prev) {
-				r->state_prev = r->state;
-				r->retries = 0;
+		if (t_sco->type.profile & BA_TRANSPORT_PROFILE_MASK_HSP)
+			/* There is not logic behind the HSP connection,
+			 * simply set status as connected. */
+			rfcomm_set_hfp_state(r, HFP_SLC_CONNECTED);
+
+		if (t_sco->type.profile & BA_TRANSPORT_PROFILE_HFP_HF)
+			switch (r->state) {
+			case HFP_DISCONNECTED:
+				sprintf(tmp, "%u", ba_adapter_get_hfp_features_hf(t_sco->d->a));
+				if (rfcomm_write_at(r, AT_TYPE_CMD_SET, "+BRSF", tmp) == -1)
+					return -1;
+				r->handler = &rfcomm_handler_brsf_resp;
+				break;
+			case HFP_SLC_BRSF_SET:
+				r->handler = &rfcomm_handler_resp_ok;
+				r->handler_resp_ok_new_state = HFP_SLC_BRSF_SET_OK;
+				break;
+			case HFP_SLC_BRSF_SET_OK:
+				if (r->hfp_features & HFP_AG_FEAT_CODEC) {
+					if (rfcomm_write_at(r, AT_TYPE_CMD_SET, "+BAC",
+								rfcomm_get_hfp_codecs(r)) == -1)
+						return -1;
+					r->handler = &rfcomm_handler_resp_ok;
+					r->handler_resp_ok_new_state = HFP_SLC_BAC_SET_OK;
+					break;
+				}
+				/* fall-through */
+			case HFP_SLC_BAC_SET_OK:
+				if (rfcomm_write_at(r, AT_TYPE_CMD_TEST, "+CIND", NULL) == -1)
+					return -1;
+				r->handler = &rfcomm_handler_cind_resp_test;
+				break;
+			case HFP_SLC_CIND_TEST:
+				r->handler = &rfcomm_handler_resp_ok;
+				r->handler_resp_ok_new_state = HFP_SLC_CIND_TEST_OK;
+				break;
+			case HFP_SLC_CIND_TEST_OK:
+				if (rfcomm_write_at(r, AT_TYPE_CMD_GET, "+CIND", NULL) == -1)
+					return -1;
+				r->handler = &rfcomm_handler_cind_resp_get;
+				break;
+			case HFP_SLC_CIND_GET:
+				r->handler = &rfcomm_handler_resp_ok;
+				r->handler_resp_ok_new_state = HFP_SLC_CIND_GET_OK;
+				break;
+			case HFP_SLC_CIND_GET_OK:
+				/* Activate indicator events reporting. The +CMER specification is
+				 * as follows: AT+CMER=[<mode>[,<keyp>[,<disp>[,<ind>[,<bfr>]]]]] */
+				if (rfcomm_write_at(r, AT_TYPE_CMD_SET, "+CMER", "3,0,0,1,0") == -1)
+					return -1;
+				r->handler = &rfcomm_handler_resp_ok;
+				r->handler_resp_ok_new_state = HFP_SLC_CMER_SET_OK;
+				break;
+			case HFP_SLC_CMER_SET_OK:
+				rfcomm_set_hfp_state(r, HFP_SLC_CONNECTED);
+				/* fall-through */
+			case HFP_SLC_CONNECTED:
+				bluealsa_dbus_pcm_update(&t_sco->sco.spk_pcm,
+						BA_DBUS_PCM_UPDATE_SAMPLING | BA_DBUS_PCM_UPDATE_CODEC);
+				bluealsa_dbus_pcm_update(&t_sco->sco.mic_pcm,
+						BA_DBUS_PCM_UPDATE_SAMPLING | BA_DBUS_PCM_UPDATE_CODEC);
 			}
 
-			/* If the maximal number of retries has been reached, terminate the
-			 * connection. Trying indefinitely will only use up our resources. */
-			if (r->retries > BA_RFCOMM_SLC_RETRIES) {
-				error("Couldn't establish connection: Too many retries");
-				errno = ETIMEDOUT;
-				goto ioerror;
+		if (t_sco->type.profile & BA_TRANSPORT_PROFILE_HFP_AG)
+			switch (r->state) {
+			case HFP_DISCONNECTED:
+			case HFP_SLC_BRSF_SET:
+			case HFP_SLC_BRSF_SET_OK:
+			case HFP_SLC_BAC_SET_OK:
+			case HFP_SLC_CIND_TEST:
+			case HFP_SLC_CIND_TEST_OK:
+			case HFP_SLC_CIND_GET:
+			case HFP_SLC_CIND_GET_OK:
+				break;
+			case HFP_SLC_CMER_SET_OK:
+				rfcomm_set_hfp_state(r, HFP_SLC_CONNECTED);
+				/* fall-through */
+			case HFP_SLC_CONNECTED:
+				bluealsa_dbus_pcm_update(&t_sco->sco.spk_pcm,
+						BA_DBUS_PCM_UPDATE_SAMPLING | BA_DBUS_PCM_UPDATE_CODEC);
+				bluealsa_dbus_pcm_update(&t_sco->sco.mic_pcm,
+						BA_DBUS_PCM_UPDATE_SAMPLING | BA_DBUS_PCM_UPDATE_CODEC);
 			}
 
-			if (t_sco->type.profile & BA_TRANSPORT_PROFILE_MASK_HSP)
-				/* There is not logic behind the HSP connection,
-				 * simply set status as connected. */
-				rfcomm_set_hfp_state(r, HFP_SLC_CONNECTED);
+	}
+	else if (r->setup != HFP_SETUP_COMPLETE) {
+
+		if (t_sco->type.profile & BA_TRANSPORT_PROFILE_HSP_AG)
+			/* We are not making any initialization setup with
+			 * HSP AG. Simply mark setup as completed. */
+			r->setup = HFP_SETUP_COMPLETE;
+
+		/* Notify audio gateway about our initial setup. This setup
+		 * is dedicated for HSP and HFP, because both profiles have
+		 * volume gain control and Apple accessory extension. */
+		if (t_sco->type.profile & BA_TRANSPORT_PROFILE_MASK_HF)
+			switch (r->setup) {
+			case HFP_SETUP_GAIN_MIC:
+				if (rfcomm_notify_volume_change_mic(r, true) == -1)
+					return -1;
+				r->setup++;
+				break;
+			case HFP_SETUP_GAIN_SPK:
+				if (rfcomm_notify_volume_change_spk(r, true) == -1)
+					return -1;
+				r->setup++;
+				break;
+			case HFP_SETUP_ACCESSORY_XAPL:
+				sprintf(tmp, "%04X-%04X-%s,%u",
+						config.hfp.xapl_vendor_id, config.hfp.xapl_product_id,
+						config.hfp.xapl_software_version, config.hfp.xapl_features);
+				if (rfcomm_write_at(r, AT_TYPE_CMD_SET, "+XAPL", tmp) == -1)
+					return -1;
+				r->handler = &rfcomm_handler_xapl_resp;
+				r->setup++;
+				break;
+			case HFP_SETUP_ACCESSORY_BATT:
+				if (config.battery.available &&
+						rfcomm_notify_battery_level_change(r) == -1)
+					return -1;
+				r->setup++;
+				break;
+			case HFP_SETUP_COMPLETE:
+				debug("Initial connection setup completed");
+			}
+
+		/* If HFP transport codec is already selected (e.g. device
+		 * does not support mSBC) mark setup as completed. */
+		if (t_sco->type.profile & BA_TRANSPORT_PROFILE_HFP_AG &&
+				t_sco->type.codec != HFP_CODEC_UNDEFINED)
+			r->setup = HFP_SETUP_COMPLETE;
 
-			if (t_sco->type.profile & BA_TRANSPORT_PROFILE_HFP_HF)
-				switch (r->state) {
-				case HFP_DISCONNECTED:
-					sprintf(tmp, "%u", ba_adapter_get_hfp_features_hf(t_sco->d->a));
-					if (rfcomm_write_at(pfds[1].fd, AT_TYPE_CMD_SET, "+BRSF", tmp) == -1)
-						goto ioerror;
-					r->handler = &rfcomm_handler_brsf_resp;
-					break;
-				case HFP_SLC_BRSF_SET:
-					r->handler = &rfcomm_handler_resp_ok;
-					r->handler_resp_ok_new_state = HFP_SLC_BRSF_SET_OK;
-					break;
-				case HFP_SLC_BRSF_SET_OK:
-					if (r->hfp_features & HFP_AG_FEAT_CODEC) {
 #if ENABLE_MSBC
-						/* advertise, that we are supporting CVSD (1) and mSBC (2) */
-						const char *value = BA_TEST_ESCO_SUPPORT(t_sco->d->a) ? "1,2" : "1";
-						if (rfcomm_write_at(pfds[1].fd, AT_TYPE_CMD_SET, "+BAC", value) == -1)
-#else
-						if (rfcomm_write_at(pfds[1].fd, AT_TYPE_CMD_SET, "+BAC", "1") == -1)
+		/* Select HFP transport codec. Please note, that this setup
+		 * stage will be performed when the connection becomes idle. */
+		if (t_sco->type.profile & BA_TRANSPORT_PROFILE_HFP_AG &&
+				t_sco->type.codec == HFP_CODEC_UNDEFINED &&
+				r->idle) {
+			uint16_t codec = HFP_CODEC_MSBC;
+#if ENABLE_LC3_SWB
+			/* prefer super-wideband speech if HF supports it */
+			if (r->lc3_swb)
+				codec = HFP_CODEC_LC3_SWB;
+#endif
+			if (rfcomm_set_hfp_codec(r, codec) == -1)
+				return -1;
+			r->setup = HFP_SETUP_COMPLETE;
+		}
 #endif
-							goto ioerror;
-						r->handler = &rfcomm_handler_resp_ok;
-						r->handler_resp_ok_new_state = HFP_SLC_BAC_SET_OK;
-						break;
-					}
-					/* fall-through */
-				case HFP_SLC_BAC_SET_OK:
-					if (rfcomm_write_at(pfds[1].fd, AT_TYPE_CMD_TEST, "+CIND", NULL) == -1)
-						goto ioerror;
-					r->handler = &rfcomm_handler_cind_resp_test;
-					break;
-				case HFP_SLC_CIND_TEST:
-					r->handler = &rfcomm_handler_resp_ok;
-					r->handler_resp_ok_new_state = HFP_SLC_CIND_TEST_OK;
-					break;
-				case HFP_SLC_CIND_TEST_OK:
-					if (rfcomm_write_at(pfds[1].fd, AT_TYPE_CMD_GET, "+CIND", NULL) == -1)
-						goto ioerror;
-					r->handler = &rfcomm_handler_cind_resp_get;
-					break;
-				case HFP_SLC_CIND_GET:
-					r->handler = &rfcomm_handler_resp_ok;
-					r->handler_resp_ok_new_state = HFP_SLC_CIND_GET_OK;
-					break;
-				case HFP_SLC_CIND_GET_OK:
-					/* Activate indicator events reporting. The +CMER specification is
-					 * as follows: AT+CMER=[<mode>[,<keyp>[,<disp>[,<ind>[,<bfr>]]]]] */
-					if (rfcomm_write_at(pfds[1].fd, AT_TYPE_CMD_SET, "+CMER", "3,0,0,1,0") == -1)
-						goto ioerror;
-					r->handler = &rfcomm_handler_resp_ok;
-					r->handler_resp_ok_new_state = HFP_SLC_CMER_SET_OK;
-					break;
-				case HFP_SLC_CMER_SET_OK:
-					rfcomm_set_hfp_state(r, HFP_SLC_CONNECTED);
-					/* fall-through */
-				case HFP_SLC_CONNECTED:
-					bluealsa_dbus_pcm_update(&t_sco->sco.spk_pcm,
-							BA_DBUS_PCM_UPDATE_SAMPLING | BA_DBUS_PCM_UPDATE_CODEC);
-					bluealsa_dbus_pcm_update(&t_sco->sco.mic_pcm,
-							BA_DBUS_PCM_UPDATE_SAMPLING | BA_DBUS_PCM_UPDATE_CODEC);
-				}
 
-			if (t_sco->type.profile & BA_TRANSPORT_PROFILE_HFP_AG)
-				switch (r->state) {
-				case HFP_DISCONNECTED:
-				case HFP_SLC_BRSF_SET:
-				case HFP_SLC_BRSF_SET_OK:
-				case HFP_SLC_BAC_SET_OK:
-				case HFP_SLC_CIND_TEST:
-				case HFP_SLC_CIND_TEST_OK:
-				case HFP_SLC_CIND_GET:
-				case HFP_SLC_CIND_GET_OK:
-					break;
-				case HFP_SLC_CMER_SET_OK:
-					rfcomm_set_hfp_state(r, HFP_SLC_CONNECTED);
-					/* fall-through */
-				case HFP_SLC_CONNECTED:
-					bluealsa_dbus_pcm_update(&t_sco->sco.spk_pcm,
-							BA_DBUS_PCM_UPDATE_SAMPLING | BA_DBUS_PCM_UPDATE_CODEC);
-					bluealsa_dbus_pcm_update(&t_sco->sco.mic_pcm,
-							BA_DBUS_PCM_UPDATE_SAMPLING | BA_DBUS_PCM_UPDATE_CODEC);
-				}
+	}
+	else {
+		/* setup is complete, block infinitely */
+		*timeout = -1;
+	}
 
-		}
-		else if (r->setup != HFP_SETUP_COMPLETE) {
-
-			if (t_sco->type.profile & BA_TRANSPORT_PROFILE_HSP_AG)
-				/* We are not making any initialization setup with
-				 * HSP AG. Simply mark setup as completed. */
-				r->setup = HFP_SETUP_COMPLETE;
-
-			/* Notify audio gateway about our initial setup. This setup
-			 * is dedicated for HSP and HFP, because both profiles have
-			 * volume gain control and Apple accessory extension. */
-			if (t_sco->type.profile & BA_TRANSPORT_PROFILE_MASK_HF)
-				switch (r->setup) {
-				case HFP_SETUP_GAIN_MIC:
-					if (rfcomm_notify_volume_change_mic(r, true) == -1)
-						goto ioerror;
-					r->setup++;
-					break;
-				case HFP_SETUP_GAIN_SPK:
-					if (rfcomm_notify_volume_change_spk(r, true) == -1)
-						goto ioerror;
-					r->setup++;
-					break;
-				case HFP_SETUP_ACCESSORY_XAPL:
-					sprintf(tmp, "%04X-%04X-%s,%u",
-							config.hfp.xapl_vendor_id, config.hfp.xapl_product_id,
-							config.hfp.xapl_software_version, config.hfp.xapl_features);
-					if (rfcomm_write_at(r->fd, AT_TYPE_CMD_SET, "+XAPL", tmp) == -1)
-						goto ioerror;
-					r->handler = &rfcomm_handler_xapl_resp;
-					r->setup++;
-					break;
-				case HFP_SETUP_ACCESSORY_BATT:
-					if (config.battery.available &&
-							rfcomm_notify_battery_level_change(r) == -1)
-						goto ioerror;
-					r->setup++;
-					break;
-				case HFP_SETUP_COMPLETE:
-					debug("Initial connection setup completed");
-				}
+final:
+	if (r->handler != NULL) {
+		*timeout = BA_RFCOMM_TIMEOUT_ACK;
+		r->retries++;
+	}
 
-			/* If HFP transport codec is already selected (e.g. device
-			 * does not support mSBC) mark setup as completed. */
-			if (t_sco->type.profile & BA_TRANSPORT_PROFILE_HFP_AG &&
-					t_sco->type.codec != HFP_CODEC_UNDEFINED)
-				r->setup = HFP_SETUP_COMPLETE;
+	return 0;
+}
 
+/**
+ * Dispatch signal received by the RFCOMM link.
+ *
+ * @return On success this function returns 0. Otherwise, -1 is returned and
+ *   errno is set to indicate the error. */
+static int rfcomm_link_signal(struct ba_rfcomm *r) {
+	switch (rfcomm_recv_signal(r)) {
 #if ENABLE_MSBC
-			/* Select HFP transport codec. Please note, that this setup
-			 * stage will be performed when the connection becomes idle. */
-			if (t_sco->type.profile & BA_TRANSPORT_PROFILE_HFP_AG &&
-					t_sco->type.codec == HFP_CODEC_UNDEFINED &&
-					r->idle) {
-				if (rfcomm_set_hfp_codec(r, HFP_CODEC_MSBC) == -1)
-					goto ioerror;
-				r->setup = HFP_SETUP_COMPLETE;
-			}
+	case BA_RFCOMM_SIGNAL_HFP_SET_CODEC_CVSD:
+		return rfcomm_set_hfp_codec(r, HFP_CODEC_CVSD);
+	case BA_RFCOMM_SIGNAL_HFP_SET_CODEC_MSBC:
+		return rfcomm_set_hfp_codec(r, HFP_CODEC_MSBC);
+#endif
+#if ENABLE_LC3_SWB
+	case BA_RFCOMM_SIGNAL_HFP_SET_CODEC_LC3_SWB:
+		return rfcomm_set_hfp_codec(r, HFP_CODEC_LC3_SWB);
 #endif
+	case BA_RFCOMM_SIGNAL_UPDATE_BATTERY:
+		return rfcomm_notify_battery_level_change(r);
+	case BA_RFCOMM_SIGNAL_UPDATE_VOLUME:
+		if (rfcomm_notify_volume_change_mic(r, false) == -1)
+			return -1;
+		return rfcomm_notify_volume_change_spk(r, false);
+	default:
+		return 0;
+	}
+}
 
-		}
-		else {
-			/* setup is complete, block infinitely */
-			timeout = -1;
-		}
+/**
+ * Read and dispatch AT message received from the RFCOMM.
+ *
+ * @return On success this function returns 0. Otherwise, -1 is returned and
+ *   errno is set to indicate the error. */
+static int rfcomm_link_read(struct ba_rfcomm *r) {
 
-process:
-		if (r->handler != NULL) {
-			timeout = BA_RFCOMM_TIMEOUT_ACK;
-			r->retries++;
+	struct at_reader *reader = &r->reader;
+	ba_rfcomm_callback *callback;
+	char tmp[256];
+
+	if (rfcomm_read_at(r->fd, reader) == -1)
+		switch (errno) {
+		case EAGAIN:
+			/* wait for the rest of the message */
+			return 0;
+		case EBADMSG:
+			warn("Invalid AT message: %s", reader->at.command);
+			return 0;
+		default:
+			return -1;
 		}
 
-		/* skip poll() since we've got unprocessed data */
-		if (reader.next != NULL)
-			goto read;
+	/* use predefined callback, otherwise get generic one */
+	bool predefined_callback = false;
+	if (r->handler != NULL && r->handler->type == reader->at.type &&
+			strcmp(r->handler->command, reader->at.command) == 0) {
+		callback = r->handler->callback;
+		predefined_callback = true;
+		r->handler = NULL;
+	}
+	else
+		callback = rfcomm_get_callback(&reader->at);
 
-		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	if (r->handler_fd != -1 && !predefined_callback) {
+		at_build(tmp, reader->at.type, reader->at.command, reader->at.value);
+		if (write(r->handler_fd, tmp, strlen(tmp)) == -1)
+			warn("Couldn't forward AT: %s", strerror(errno));
+	}
 
-		r->idle = false;
-		pfds[2].fd = r->handler_fd;
-		switch (poll(pfds, ARRAYSIZE(pfds), timeout)) {
-		case 0:
-			debug("RFCOMM poll timeout");
-			r->idle = true;
-			continue;
-		case -1:
-			if (errno == EINTR)
-				continue;
-			error("RFCOMM poll error: %s", strerror(errno));
-			goto fail;
-		}
+	if (callback != NULL)
+		return callback(r, &reader->at);
 
-		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	if (r->handler_fd == -1) {
+		warn("Unsupported AT message: %s: command:%s, value:%s",
+				at_type2str(reader->at.type), reader->at.command, reader->at.value);
+		if (reader->at.type != AT_TYPE_RESP)
+			return rfcomm_write_at(r, AT_TYPE_RESP, NULL, "ERROR");
+	}
 
-		if (pfds[0].revents & POLLIN) {
-			/* dispatch incoming event */
-			switch (rfcomm_recv_signal(r)) {
-#if ENABLE_MSBC
-			case BA_RFCOMM_SIGNAL_HFP_SET_CODEC_CVSD:
-				if (rfcomm_set_hfp_codec(r, HFP_CODEC_CVSD) == -1)
-					goto ioerror;
-				break;
-			case BA_RFCOMM_SIGNAL_HFP_SET_CODEC_MSBC:
-				if (rfcomm_set_hfp_codec(r, HFP_CODEC_MSBC) == -1)
-					goto ioerror;
-				break;
-#endif
-			case BA_RFCOMM_SIGNAL_UPDATE_BATTERY:
-				if (rfcomm_notify_battery_level_change(r) == -1)
-					goto ioerror;
-				break;
-			case BA_RFCOMM_SIGNAL_UPDATE_VOLUME:
-				if (rfcomm_notify_volume_change_mic(r, false) == -1)
-					goto ioerror;
-				if (rfcomm_notify_volume_change_spk(r, false) == -1)
-					goto ioerror;
-				break;
-			default:
-				break;
-			}
-		}
+	return 0;
+}
 
-		if (pfds[1].revents & POLLIN) {
-			/* read data from the RFCOMM */
-
-read:
-			if (rfcomm_read_at(pfds[1].fd, &reader) == -1)
-				switch (errno) {
-				case EBADMSG:
-					warn("Invalid AT message: %s", reader.next);
-					reader.next = NULL;
-					continue;
-				default:
-					goto ioerror;
-				}
+/**
+ * Forward data received from the external handler to the RFCOMM.
+ *
+ * @return On success this function returns 0. Otherwise, -1 is returned and
+ *   errno is set to indicate the error. Upon the external handler error,
+ *   the handler is closed and this function returns 0. */
+static int rfcomm_link_handler(struct ba_rfcomm *r, short revents) {
 
-			/* use predefined callback, otherwise get generic one */
-			bool predefined_callback = false;
-			if (r->handler != NULL && r->handler->type == reader.at.type &&
-					strcmp(r->handler->command, reader.at.command) == 0) {
-				callback = r->handler->callback;
-				predefined_callback = true;
-				r->handler = NULL;
-			}
-			else
-				callback = rfcomm_get_callback(&reader.at);
+	char tmp[256];
+	ssize_t ret;
 
-			if (pfds[2].fd != -1 && !predefined_callback) {
-				at_build(tmp, reader.at.type, reader.at.command, reader.at.value);
-				if (write(pfds[2].fd, tmp, strlen(tmp)) == -1)
-					warn("Couldn't forward AT: %s", strerror(errno));
-			}
+	if (revents & POLLIN) {
 
-			if (callback != NULL) {
-				if (callback(r, &reader.at) == -1)
-					goto ioerror;
-			}
-			else if (pfds[2].fd == -1) {
-				warn("Unsupported AT message: %s: command:%s, value:%s",
-						at_type2str(reader.at.type), reader.at.command, reader.at.value);
-				if (reader.at.type != AT_TYPE_RESP)
-					if (rfcomm_write_at(pfds[1].fd, AT_TYPE_RESP, NULL, "ERROR") == -1)
-						goto ioerror;
-			}
+		while ((ret = read(r->handler_fd, tmp, sizeof(tmp) - 1)) == -1 &&
+				errno == EINTR)
+			continue;
 
+		if (ret > 0) {
+			tmp[ret] = '\0';
+			return rfcomm_write_at(r, AT_TYPE_RAW, tmp, NULL);
 		}
-		else if (pfds[1].revents & (POLLERR | POLLHUP)) {
-			errno = ECONNRESET;
-			goto ioerror;
+
+		if (ret == 0)
+			errno = 0;
+
+	}
+	else
+		errno = ECONNRESET;
+
+	if (errno != 0)
+		error("AT handler IO error: %s", strerror(errno));
+	close(r->handler_fd);
+	r->handler_fd = -1;
+	return 0;
+}
+
+/**
+ * Process events of the RFCOMM link.
+ *
+ * @param r Pointer to the RFCOMM structure.
+ * @param revents Returned events of the signal pipe, RFCOMM socket and the
+ *   external handler socket respectively.
+ * @param timedout If true, the link timeout has elapsed.
+ * @return If the link has been terminated, this function returns false. In
+ *   such case the RFCOMM structure might have been freed already. */
+static bool rfcomm_link_process(struct ba_rfcomm *r,
+		const short revents[3], bool timedout) {
+
+	int timeout;
+
+	if (timedout) {
+		debug("RFCOMM poll timeout");
+		r->idle = true;
+		if (r->state == HFP_SLC_CONNECTED && r->handler != NULL) {
+			/* Remote device did not acknowledge our request, e.g. the codec
+			 * selection. Do not wait for the response any more, otherwise,
+			 * the ba_transport_select_codec() caller would never return. */
+			warn("RFCOMM response timeout: %s", r->handler->command);
+			r->handler = NULL;
+			rfcomm_codec_selection_complete(r);
 		}
+	}
 
-		if (pfds[2].revents & POLLIN) {
-			/* read data from the external handler */
+	if (revents[0] & POLLIN)
+		/* dispatch incoming event */
+		if (rfcomm_link_signal(r) == -1)
+			goto ioerror;
 
-			ssize_t ret;
-			while ((ret = read(pfds[2].fd, tmp, sizeof(tmp) - 1)) == -1 &&
-					errno == EINTR)
-				continue;
+	if (revents[1] & POLLIN) {
+		/* read data from the RFCOMM */
+		if (rfcomm_link_read(r) == -1)
+			goto ioerror;
+	}
+	else if (revents[1] & (POLLERR | POLLHUP)) {
+		errno = ECONNRESET;
+		goto ioerror;
+	}
 
-			if (ret <= 0)
-				goto ioerror_exthandler;
+	if (revents[2] & (POLLIN | POLLERR | POLLHUP))
+		/* read data from the external handler */
+		if (rfcomm_link_handler(r, revents[2]) == -1)
+			goto ioerror;
 
-			tmp[ret] = '\0';
-			if (rfcomm_write_at(pfds[1].fd, AT_TYPE_RAW, tmp, NULL) == -1)
-				goto ioerror;
+	for (;;) {
 
-		}
-		else if (pfds[2].revents & (POLLERR | POLLHUP)) {
-			errno = ECONNRESET;
-			goto ioerror_exthandler;
+		if (rfcomm_link_setup(r, &timeout) == -1)
+			goto ioerror;
+
+		/* process unprocessed data before going back to the loop */
+		if (at_reader_has_message(&r->reader)) {
+			if (rfcomm_link_read(r) == -1)
+				goto ioerror;
+			continue;
 		}
 
-		continue;
+		/* send all queued AT messages at once */
+		if (rfcomm_flush_at(r) == -1)
+			goto ioerror;
 
-ioerror_exthandler:
-		if (errno != 0)
-			error("AT handler IO error: %s", strerror(errno));
-		close(r->handler_fd);
-		r->handler_fd = -1;
-		continue;
+		break;
 
 ioerror:
 		switch (errno) {
@@ -1241,25 +1490,174 @@ ioerror:
 		case ENOTCONN:
 		case ETIMEDOUT:
 		case EPIPE:
-			/* exit the thread upon socket disconnection */
+			/* terminate the link upon socket disconnection */
 			debug("RFCOMM disconnected: %s", strerror(errno));
 			goto fail;
+		case ENOBUFS:
+			/* remote device does not read our messages at all */
+			error("RFCOMM TX queue overflow: %s", strerror(errno));
+			goto fail;
 		default:
 			error("RFCOMM IO error: %s", strerror(errno));
 		}
+
 	}
 
+	r->idle = false;
+	r->loop.timeout = timeout == -1 ? 0 : rfcomm_loop_now() + timeout;
+	return true;
+
 fail:
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_pop(1);
+	rfcomm_link_cleanup(r);
+	return false;
+}
+
+/**
+ * Shared RFCOMM loop.
+ *
+ * This loop handles RFCOMM links of all connected devices. */
+static void *rfcomm_loop_thread(void *userdata) {
+	(void)userdata;
+
+	struct pollfd *pfds = NULL;
+	struct ba_rfcomm **links = NULL;
+	size_t links_size = 0;
+
+	pthread_setname_np(pthread_self(), "ba-rfcomm");
+	debug("Starting RFCOMM loop");
+
+	pthread_mutex_lock(&rfcomm_loop.mutex);
+
+	for (;;) {
+
+		const unsigned int generation = rfcomm_loop.links_generation;
+		const size_t links_count = rfcomm_loop.links.length;
+		uint64_t now = rfcomm_loop_now();
+		int timeout = -1;
+		size_t i = 0;
+
+		if (pfds == NULL || links_count > links_size) {
+			struct pollfd *tmp_pfds;
+			struct ba_rfcomm **tmp_links;
+			if ((tmp_pfds = realloc(pfds, (1 + 3 * links_count) * sizeof(*pfds))) != NULL)
+				pfds = tmp_pfds;
+			if ((tmp_links = realloc(links, (links_count + 1) * sizeof(*links))) != NULL)
+				links = tmp_links;
+			if (tmp_pfds == NULL || tmp_links == NULL) {
+				error("Couldn't resize RFCOMM loop: %s", strerror(ENOMEM));
+				pthread_mutex_unlock(&rfcomm_loop.mutex);
+				sleep(1);
+				pthread_mutex_lock(&rfcomm_loop.mutex);
+				continue;
+			}
+			links_size = links_count;
+		}
+
+		pfds[0].fd = rfcomm_loop.event_fd;
+		pfds[0].events = POLLIN;
+
+		for (GList *el = rfcomm_loop.links.head; el != NULL; el = el->next, i++) {
+
+			struct ba_rfcomm *r = links[i] = el->data;
+			struct pollfd *pfd = &pfds[1 + 3 * i];
+
+			pfd[0] = (struct pollfd){ r->sig_fd[0], POLLIN, 0 };
+			/* wait for the socket space if there is unsent data */
+			pfd[1] = (struct pollfd){ r->fd, r->tx.len > 0 ? POLLIN | POLLOUT : POLLIN, 0 };
+			pfd[2] = (struct pollfd){ r->handler_fd, POLLIN, 0 };
+
+			if (r->loop.timeout != 0) {
+				const int t = r->loop.timeout > now ? r->loop.timeout - now : 0;
+				if (timeout == -1 || t < timeout)
+					timeout = t;
+			}
+
+		}
+
+		pthread_mutex_unlock(&rfcomm_loop.mutex);
+
+		if (poll(pfds, 1 + 3 * links_count, timeout) == -1 && errno != EINTR) {
+			error("RFCOMM poll error: %s", strerror(errno));
+			pfds[0].revents = 0;
+			for (i = 0; i < links_count; i++) {
+				struct pollfd *pfd = &pfds[1 + 3 * i];
+				pfd[0].revents = pfd[1].revents = pfd[2].revents = 0;
+			}
+		}
+
+		if (pfds[0].revents & POLLIN) {
+			eventfd_t value;
+			eventfd_read(rfcomm_loop.event_fd, &value);
+		}
+
+		pthread_mutex_lock(&rfcomm_loop.mutex);
+		now = rfcomm_loop_now();
+
+		for (i = 0; i < links_count; i++) {
+
+			/* Links might have been added or removed while polling,
+			 * so our snapshot is not valid anymore. Pending events
+			 * will be reported by the next poll() once more. */
+			if (rfcomm_loop.links_generation != generation)
+				break;
+
+			struct ba_rfcomm *r = links[i];
+			const struct pollfd *pfd = &pfds[1 + 3 * i];
+			const short revents[3] = { pfd[0].revents, pfd[1].revents, pfd[2].revents };
+			const bool timedout = r->loop.timeout != 0 && r->loop.timeout <= now;
+			const bool pending = r->loop.pending;
+
+			if (!revents[0] && !revents[1] && !revents[2] && !timedout && !pending)
+				continue;
+
+			r->loop.pending = false;
+
+			/* Process link without holding the loop lock, so others can
+			 * signal the link, e.g. to request codec selection. */
+			rfcomm_loop.current = r;
+			pthread_mutex_unlock(&rfcomm_loop.mutex);
+
+			rfcomm_link_process(r, revents, timedout);
+
+			pthread_mutex_lock(&rfcomm_loop.mutex);
+			rfcomm_loop.current = NULL;
+			pthread_cond_broadcast(&rfcomm_loop.changed);
+
+		}
+
+	}
+
 	return NULL;
 }
 
+static void rfcomm_loop_init(void) {
+
+	if ((rfcomm_loop.event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1) {
+		error("Couldn't create RFCOMM loop event: %s", strerror(errno));
+		return;
+	}
+
+	int ret;
+	if ((ret = pthread_create(&rfcomm_loop.thread_id, NULL, rfcomm_loop_thread, NULL)) != 0) {
+		error("Couldn't create RFCOMM loop: %s", strerror(ret));
+		close(rfcomm_loop.event_fd);
+		rfcomm_loop.event_fd = -1;
+		return;
+	}
+
+	rfcomm_loop.running = true;
+
+}
+
 struct ba_rfcomm *ba_rfcomm_new(struct ba_transport *sco, int fd) {
 
 	struct ba_rfcomm *r;
 	int err;
 
+	pthread_once(&rfcomm_loop.once, rfcomm_loop_init);
+	if (!rfcomm_loop.running)
+		return errno = ENOSYS, NULL;
+
 	if ((r = calloc(1, sizeof(*r))) == NULL)
 		return NULL;
 
@@ -1267,7 +1665,6 @@ struct ba_rfcomm *ba_rfcomm_new(struct ba_transport *sco, int fd) {
 	r->sig_fd[0] = -1;
 	r->sig_fd[1] = -1;
 	r->handler_fd = -1;
-	r->thread = config.main_thread;
 	r->state = HFP_DISCONNECTED;
 	r->state_prev = HFP_DISCONNECTED;
 	r->codec = HFP_CODEC_UNDEFINED;
@@ -1280,30 +1677,37 @@ struct ba_rfcomm *ba_rfcomm_new(struct ba_transport *sco, int fd) {
 	r->gain_spk = ba_transport_pcm_volume_level_to_bt(
 			&r->sco->sco.spk_pcm, r->sco->sco.spk_pcm.volume[0].level);
 
-	if (pipe(r->sig_fd) == -1)
-		goto fail;
-
 	pthread_mutex_init(&r->codec_selection_completed_mtx, NULL);
 	pthread_cond_init(&r->codec_selection_completed, NULL);
 
-	if ((err = pthread_create(&r->thread, NULL, PTHREAD_ROUTINE(rfcomm_thread), r)) != 0) {
-		error("Couldn't create RFCOMM thread: %s", strerror(err));
-		r->thread = config.main_thread;
+	if (pipe(r->sig_fd) == -1)
 		goto fail;
-	}
 
-	const char *name = "ba-rfcomm";
-	pthread_setname_np(r->thread, name);
-	debug("Created new RFCOMM thread [%s]: %s",
-			name, ba_transport_type_to_string(sco->type));
+	/* all links are handled by a single loop, so writes must not block */
+	if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1)
+		goto fail;
 
 	r->ba_dbus_path = g_strdup_printf("%s/rfcomm", sco->d->ba_dbus_path);
 	bluealsa_dbus_rfcomm_register(r, NULL);
 
+	pthread_mutex_lock(&rfcomm_loop.mutex);
+	r->loop.link.data = r;
+	g_queue_push_tail_link(&rfcomm_loop.links, &r->loop.link);
+	r->loop.linked = true;
+	/* start the SLC procedure as soon as possible */
+	r->loop.pending = true;
+	rfcomm_loop.links_generation++;
+	rfcomm_loop_wakeup();
+	pthread_mutex_unlock(&rfcomm_loop.mutex);
+
+	debug("Added new RFCOMM link: %s", ba_transport_type_to_string(sco->type));
+
 	return r;
 
 fail:
 	err = errno;
+	/* on failure the socket is not owned by us */
+	r->fd = -1;
 	ba_rfcomm_destroy(r);
 	errno = err;
 	return NULL;
@@ -1311,22 +1715,29 @@ fail:
 
 void ba_rfcomm_destroy(struct ba_rfcomm *r) {
 
-	int err;
-
 	/* Disable link lost quirk, because we don't want
 	 * any interference during the destroy procedure. */
 	r->link_lost_quirk = false;
 
 	/* Remove D-Bus interfaces, so no one will access
-	 * RFCOMM thread during the destroy procedure. */
+	 * RFCOMM link during the destroy procedure. */
 	bluealsa_dbus_rfcomm_unregister(r);
 
-	if (!pthread_equal(r->thread, config.main_thread) &&
-			!pthread_equal(r->thread, pthread_self())) {
-		if ((err = pthread_cancel(r->thread)) != 0 && err != ESRCH)
-			warn("Couldn't cancel RFCOMM thread: %s", strerror(err));
-		if ((err = pthread_join(r->thread, NULL)) != 0)
-			warn("Couldn't join RFCOMM thread: %s", strerror(err));
+	pthread_mutex_lock(&rfcomm_loop.mutex);
+
+	rfcomm_loop_unlink(r);
+
+	/* The link might be destroyed by the loop thread itself, e.g. by the
+	 * link lost quirk, so do not wait for ourself. */
+	if (!pthread_equal(pthread_self(), rfcomm_loop.thread_id))
+		while (rfcomm_loop.current == r)
+			pthread_cond_wait(&rfcomm_loop.changed, &rfcomm_loop.mutex);
+
+	pthread_mutex_unlock(&rfcomm_loop.mutex);
+
+	if (r->fd != -1) {
+		shutdown(r->fd, SHUT_RDWR);
+		close(r->fd);
 	}
 
 	if (r->handler_fd != -1)
@@ -1345,6 +1756,8 @@ void ba_rfcomm_destroy(struct ba_rfcomm *r) {
 	if (r->ba_dbus_path != NULL)
 		g_free(r->ba_dbus_path);
 
+	free(r->tx.data);
+
 	pthread_mutex_destroy(&r->codec_selection_completed_mtx);
 	pthread_cond_destroy(&r->codec_selection_completed);
 
@@ -20,6 +20,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include <glib.h>
+
 #include "at.h"
 #include "ba-transport.h"
 #include "hfp.h"
@@ -30,11 +32,16 @@
 #define BA_RFCOMM_TIMEOUT_IDLE 2500
 /* Number of retries during the SLC stage. */
 #define BA_RFCOMM_SLC_RETRIES 10
+/* Initial size of the buffer for coalesced outgoing AT messages. */
+#define BA_RFCOMM_TX_BUFFER_SIZE 1024
+/* Limit for outgoing AT messages not yet picked up by the remote device. */
+#define BA_RFCOMM_TX_BUFFER_SIZE_MAX (16 * 1024)
 
 enum ba_rfcomm_signal {
 	BA_RFCOMM_SIGNAL_PING,
 	BA_RFCOMM_SIGNAL_HFP_SET_CODEC_CVSD,
 	BA_RFCOMM_SIGNAL_HFP_SET_CODEC_MSBC,
+	BA_RFCOMM_SIGNAL_HFP_SET_CODEC_LC3_SWB,
 	BA_RFCOMM_SIGNAL_UPDATE_BATTERY,
 	BA_RFCOMM_SIGNAL_UPDATE_VOLUME,
 };
@@ -49,11 +56,31 @@ struct ba_rfcomm {
 	/* RFCOMM socket */
 	int fd;
 
-	pthread_t thread;
-
-	/* thread notification PIPE */
+	/* shared RFCOMM loop data */
+	struct {
+		GList link;
+		bool linked;
+		/* process link even if there are no events */
+		bool pending;
+		/* link timeout in milliseconds (0 if not armed) */
+		uint64_t timeout;
+	} loop;
+
+	/* link notification PIPE */
 	int sig_fd[2];
 
+	/* buffered reader of the RFCOMM data */
+	struct at_reader reader;
+
+	/* Outgoing AT messages queued during the link processing. All of them
+	 * are sent with a single RFCOMM write before returning to the loop. If
+	 * the socket is not writable, the rest is sent when it becomes so. */
+	struct {
+		char *data;
+		size_t size;
+		size_t len;
+	} tx;
+
 	/* service level connection state */
 	enum hfp_slc_state state;
 	enum hfp_slc_state state_prev;
@@ -103,6 +130,10 @@ struct ba_rfcomm {
 	/* determine whether mSBC is available */
 	bool msbc;
 #endif
+#if ENABLE_LC3_SWB
+	/* determine whether LC3-SWB is available */
+	bool lc3_swb;
+#endif
 
 	/* exported RFCOMM D-Bus API */
 	char *ba_dbus_path;
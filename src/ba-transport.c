@@ -11,13 +11,17 @@
 #include "ba-transport.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <math.h>
 #include <poll.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
 #include <bluetooth/bluetooth.h>
@@ -50,18 +54,25 @@
 #ifdef ENABLE_MPEG
 # include "a2dp-mpeg.h"
 #endif
+#include "a2dp-plugin.h"
 #include "a2dp-sbc.h"
 #include "audio.h"
 #include "ba-adapter.h"
 #include "ba-rfcomm.h"
+#if ENABLE_LE_AUDIO
+# include "bap-lc3.h"
+#endif
 #include "bluealsa-dbus.h"
 #include "bluealsa.h"
 #include "bluez-iface.h"
 #include "bluez.h"
+#include "codec-plugin.h"
 #include "dbus.h"
 #include "hci.h"
 #include "hfp.h"
+#include "metrics.h"
 #include "sco.h"
+#include "storage.h"
 #include "utils.h"
 #include "shared/defs.h"
 #include "shared/log.h"
@@ -82,6 +93,10 @@ static const char *transport_get_dbus_path_type(
 		return "hsphs";
 	case BA_TRANSPORT_PROFILE_HSP_AG:
 		return "hspag";
+	case BA_TRANSPORT_PROFILE_BAP_SOURCE:
+		return "bapsrc";
+	case BA_TRANSPORT_PROFILE_BAP_SINK:
+		return "bapsnk";
 	default:
 		return NULL;
 	}
@@ -98,7 +113,11 @@ static int transport_pcm_init(
 	pcm->th = th;
 	pcm->mode = mode;
 	pcm->fd = -1;
+	pcm->shm_ctrl_fd = -1;
+	pcm->ba_dbus_ctrl_fd = -1;
+	pcm->jitter.timer_fd = -1;
 	pcm->active = true;
+	pcm->overrun = config.pcm_overrun;
 
 	pcm->volume[0].level = config.volume_init_level;
 	pcm->volume[1].level = config.volume_init_level;
@@ -108,6 +127,7 @@ static int transport_pcm_init(
 	pthread_mutex_init(&pcm->mutex, NULL);
 	pthread_mutex_init(&pcm->synced_mtx, NULL);
 	pthread_cond_init(&pcm->synced, NULL);
+	pthread_mutex_init(&pcm->ba_dbus_props_mtx, NULL);
 
 	pcm->ba_dbus_path = g_strdup_printf("%s/%s/%s",
 			t->d->ba_dbus_path, transport_get_dbus_path_type(t->type),
@@ -116,6 +136,20 @@ static int transport_pcm_init(
 	return 0;
 }
 
+/**
+ * Restore PCM state saved during the previous connection.
+ *
+ * This function shall be called when the PCM is fully initialized, but
+ * before it is exposed on D-Bus, so clients will see the restored state
+ * right away, without any additional volume update round trips. */
+static void transport_pcm_restore(
+		struct ba_transport_pcm *pcm) {
+	if (storage_pcm_data_sync(pcm) == -1)
+		return;
+	ba_transport_pcm_volume_set(&pcm->volume[0], NULL, NULL);
+	ba_transport_pcm_volume_set(&pcm->volume[1], NULL, NULL);
+}
+
 static void transport_pcm_free(
 		struct ba_transport_pcm *pcm) {
 
@@ -126,9 +160,18 @@ static void transport_pcm_free(
 	pthread_mutex_destroy(&pcm->mutex);
 	pthread_mutex_destroy(&pcm->synced_mtx);
 	pthread_cond_destroy(&pcm->synced);
+	pthread_mutex_destroy(&pcm->ba_dbus_props_mtx);
 
+	if (pcm->ba_dbus_props != NULL)
+		g_variant_unref(pcm->ba_dbus_props);
 	if (pcm->ba_dbus_path != NULL)
 		g_free(pcm->ba_dbus_path);
+	free(pcm->mix_buffer);
+	ffb_free(&pcm->overrun_backlog);
+
+	jitter_buffer_free(&pcm->jitter.jb);
+	if (pcm->jitter.timer_fd != -1)
+		close(pcm->jitter.timer_fd);
 
 }
 
@@ -162,18 +205,91 @@ static int transport_thread_init(
 	th->state = BA_TRANSPORT_THREAD_STATE_NONE;
 	th->id = config.main_thread;
 	th->bt_fd = -1;
-	th->pipe[0] = -1;
-	th->pipe[1] = -1;
+	th->bt_coutq.queued = 0;
+	th->bt_coutq.blocked = false;
+	th->bt_coutq.congested = 0;
+	ba_transport_thread_stats_reset(th);
+
+	for (size_t i = 0; i < ARRAYSIZE(th->signals); i++)
+		atomic_init(&th->signals[i].seq, i);
+	atomic_init(&th->signals_head, 0);
+	th->signals_tail = 0;
 
 	pthread_mutex_init(&th->mutex, NULL);
 	pthread_cond_init(&th->changed, NULL);
 
-	if (pipe(th->pipe) == -1)
+	th->event_fd = -1;
+	th->pacing_timer_fd = -1;
+	th->capture.f = NULL;
+#if ENABLE_IO_URING
+	th->bt_uring = NULL;
+	th->bt_uring_failed = false;
+#endif
+
+	return 0;
+}
+
+/**
+ * Open transport thread file descriptors.
+ *
+ * The event file descriptor and the pacing timer are created when the
+ * thread is started for the first time, so the direction which is not
+ * used by the transport (e.g. decoding for A2DP source without the
+ * back-channel) does not hold any kernel resources. */
+static int transport_thread_open(
+		struct ba_transport_thread *th) {
+
+	if (th->event_fd == -1 &&
+			(th->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1)
+		return -1;
+
+	if (config.pacing_timer && th->pacing_timer_fd == -1 &&
+			(th->pacing_timer_fd = timerfd_create(CLOCK_MONOTONIC,
+					TFD_CLOEXEC | TFD_NONBLOCK)) == -1)
 		return -1;
 
 	return 0;
 }
 
+/**
+ * Start capturing BT traffic of the transport thread.
+ *
+ * Every started thread gets a new capture file, named after the thread,
+ * the device address and the start time, so captures of consecutive
+ * connections (or codec reconfigurations) are not overwritten. */
+static void transport_thread_capture_open(
+		struct ba_transport_thread *th,
+		const char *name) {
+
+	struct ba_transport *t = th->t;
+
+	if (config.bt_capture_dir == NULL)
+		return;
+
+	bt_capture_close(&th->capture);
+
+	char addr[18];
+	ba2str(&t->d->addr, addr);
+	for (char *ptr = addr; *ptr != '\0'; ptr++)
+		if (*ptr == ':')
+			*ptr = '-';
+
+	char stamp[32];
+	struct tm tm;
+	time_t now = time(NULL);
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime_r(&now, &tm));
+
+	char *path = g_strdup_printf("%s/%s_%s_%s.pcap",
+			config.bt_capture_dir, name, addr, stamp);
+
+	if (bt_capture_open(&th->capture, path, t->type.profile, t->type.codec) == -1)
+		warn("Couldn't open BT capture: %s: %s", path, strerror(errno));
+	else
+		debug("Capturing BT traffic: %s", path);
+
+	g_free(path);
+}
+
 /**
  * Prepare synchronous transport thread cancellation.
  *
@@ -199,6 +315,12 @@ static void transport_thread_cancel(struct ba_transport_thread *th) {
 	int err;
 	if ((err = pthread_cancel(id)) != 0 && err != ESRCH)
 		warn("Couldn't cancel transport thread: %s", strerror(err));
+#if ENABLE_IO_URING
+	/* The io_uring wait is not a cancellation point, so the thread has
+	 * to be woken up after the cancellation request has been made. */
+	if (err == 0)
+		ba_transport_thread_signal_send(th, BA_TRANSPORT_THREAD_SIGNAL_PING);
+#endif
 	if ((err = pthread_join(id, NULL)) != 0)
 		warn("Couldn't join transport thread: %s", strerror(err));
 
@@ -229,10 +351,11 @@ static void transport_thread_free(
 		struct ba_transport_thread *th) {
 	if (th->bt_fd != -1)
 		close(th->bt_fd);
-	if (th->pipe[0] != -1)
-		close(th->pipe[0]);
-	if (th->pipe[1] != -1)
-		close(th->pipe[1]);
+	if (th->event_fd != -1)
+		close(th->event_fd);
+	if (th->pacing_timer_fd != -1)
+		close(th->pacing_timer_fd);
+	bt_capture_close(&th->capture);
 	pthread_mutex_destroy(&th->mutex);
 	pthread_cond_destroy(&th->changed);
 }
@@ -257,6 +380,8 @@ int ba_transport_thread_set_state(
 
 	th->state = state;
 	pthread_cond_signal(&th->changed);
+	if (th->state_watch != NULL)
+		th->state_watch(th, th->state_watch_data);
 
 skip:
 	pthread_mutex_unlock(&th->mutex);
@@ -294,6 +419,9 @@ int ba_transport_thread_bt_acquire(
 		goto fail;
 	}
 
+	/* new socket has its own overflow counter */
+	th->bt_rxq_drops = 0;
+
 	debug("Created BT socket duplicate: [%d]: %d", bt_fd, th->bt_fd);
 	ret = 0;
 
@@ -305,6 +433,13 @@ fail:
 int ba_transport_thread_bt_release(
 		struct ba_transport_thread *th) {
 
+#if ENABLE_IO_URING
+	/* The BT socket is registered with the ring, so the ring
+	 * has to be freed before the socket is closed. */
+	bt_uring_free(th->bt_uring);
+	th->bt_uring = NULL;
+#endif
+
 	if (th->bt_fd != -1) {
 		debug("Closing BT socket duplicate [%d]: %d", th->t->bt_fd, th->bt_fd);
 		close(th->bt_fd);
@@ -314,32 +449,176 @@ int ba_transport_thread_bt_release(
 	return 0;
 }
 
+/**
+ * Sample the number of bytes queued in the BT socket output buffer.
+ *
+ * This function shall be called just before writing to the BT socket. For
+ * transports other than A2DP the queue depth is not monitored. */
+void ba_transport_thread_bt_coutq_sample(
+		struct ba_transport_thread *th) {
+
+	struct ba_transport *t = th->t;
+	int queued = 0;
+
+	th->bt_coutq.blocked = false;
+
+	if (!(t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP))
+		return;
+
+	if (ioctl(th->bt_fd, TIOCOUTQ, &queued) != -1)
+		th->bt_coutq.queued = abs(t->a2dp.bt_fd_coutq_init - queued);
+
+}
+
+/**
+ * Update BT socket output queue congestion counter.
+ *
+ * This function shall be called after successful write to the BT socket.
+ * The write is considered as congested if it had to wait for the socket
+ * space or if there were more than two MTU-sized packets queued in the
+ * socket output buffer before the write. */
+void ba_transport_thread_bt_coutq_update(
+		struct ba_transport_thread *th) {
+	if (th->bt_coutq.blocked ||
+			(size_t)th->bt_coutq.queued > th->t->mtu_write * 2)
+		th->bt_coutq.congested++;
+	else
+		th->bt_coutq.congested = 0;
+}
+
 int ba_transport_thread_signal_send(
 		struct ba_transport_thread *th,
 		enum ba_transport_thread_signal signal) {
+	return ba_transport_thread_signal_send_pcm(th, signal, NULL);
+}
+
+/**
+ * Send signal which applies to the given PCM.
+ *
+ * A single IO thread might service more than one PCM (e.g. in the duplex
+ * mode), so the receiver can tell which PCM the signal is meant for. */
+int ba_transport_thread_signal_send_pcm(
+		struct ba_transport_thread *th,
+		enum ba_transport_thread_signal signal,
+		struct ba_transport_pcm *pcm) {
+
 	if (pthread_equal(th->id, config.main_thread))
 		return errno = ESRCH, -1;
-	if (write(th->pipe[1], &signal, sizeof(signal)) == sizeof(signal))
+
+	const size_t mask = ARRAYSIZE(th->signals) - 1;
+	size_t pos = atomic_load_explicit(&th->signals_head, memory_order_relaxed);
+	unsigned int waited = 0;
+
+	for (;;) {
+		const size_t seq = atomic_load_explicit(&th->signals[pos & mask].seq,
+				memory_order_acquire);
+		const ptrdiff_t diff = (ptrdiff_t)(seq - pos);
+		if (diff == 0) {
+			/* slot is free, try to claim it */
+			if (atomic_compare_exchange_weak_explicit(&th->signals_head, &pos,
+						pos + 1, memory_order_relaxed, memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0) {
+			/* Every queued signal wakes up the thread, so the ping signal
+			 * can be coalesced with signals which are already queued. */
+			if (signal == BA_TRANSPORT_THREAD_SIGNAL_PING)
+				return 0;
+			/* Other signals change the state of the IO thread, so they must
+			 * not be dropped. Wait for the consumer to make some room, unless
+			 * the consumer is the caller itself. */
+			if (pthread_equal(th->id, pthread_self()) ||
+					waited++ >= BA_TRANSPORT_THREAD_SIGNAL_SEND_TIMEOUT) {
+				warn("Couldn't queue transport thread signal: %s", strerror(ENOBUFS));
+				return errno = ENOBUFS, -1;
+			}
+			usleep(1000);
+			if (pthread_equal(th->id, config.main_thread))
+				return errno = ESRCH, -1;
+			pos = atomic_load_explicit(&th->signals_head, memory_order_relaxed);
+		}
+		else
+			pos = atomic_load_explicit(&th->signals_head, memory_order_relaxed);
+	}
+
+	th->signals[pos & mask].signal = signal;
+	th->signals[pos & mask].pcm = pcm;
+	atomic_store_explicit(&th->signals[pos & mask].seq, pos + 1, memory_order_release);
+
+	if (eventfd_write(th->event_fd, 1) == 0)
 		return 0;
+
 	warn("Couldn't write transport thread signal: %s", strerror(errno));
 	return -1;
 }
 
+/**
+ * Take signal from the queue - consumer side. */
+static bool transport_thread_signal_dequeue(
+		struct ba_transport_thread *th,
+		enum ba_transport_thread_signal *signal,
+		struct ba_transport_pcm **pcm) {
+
+	const size_t mask = ARRAYSIZE(th->signals) - 1;
+	const size_t pos = th->signals_tail;
+
+	if (atomic_load_explicit(&th->signals[pos & mask].seq,
+				memory_order_acquire) != pos + 1)
+		return false;
+
+	*signal = th->signals[pos & mask].signal;
+	if (pcm != NULL)
+		*pcm = th->signals[pos & mask].pcm;
+	/* release slot for the next round of producers */
+	atomic_store_explicit(&th->signals[pos & mask].seq,
+			pos + ARRAYSIZE(th->signals), memory_order_release);
+	th->signals_tail = pos + 1;
+
+	return true;
+}
+
+/**
+ * Receive transport thread signal.
+ *
+ * This function shall be called when the event file descriptor is ready
+ * for reading. It can be called in a loop until it returns -1, so all
+ * pending signals will be dispatched within a single wakeup.
+ *
+ * @param th Pointer to the transport thread structure.
+ * @param signal Address where the received signal will be stored. If there
+ *   is no pending signal, it will be set to the PING signal.
+ * @param pcm Optional address where the PCM which the signal applies to will
+ *   be stored. It is set to NULL if the signal was not sent for any PCM.
+ * @return On success this function returns 0. If the queue is empty, -1 is
+ *   returned and errno is set to EAGAIN. */
 int ba_transport_thread_signal_recv(
 		struct ba_transport_thread *th,
-		enum ba_transport_thread_signal *signal) {
+		enum ba_transport_thread_signal *signal,
+		struct ba_transport_pcm **pcm) {
 
-	ssize_t ret;
-	while ((ret = read(th->pipe[0], signal, sizeof(*signal))) == -1 &&
-			errno == EINTR)
-		continue;
+	if (transport_thread_signal_dequeue(th, signal, pcm))
+		return 0;
 
-	if (ret == sizeof(*signal))
+	/* Queue seems to be empty, so reset the event counter. Afterwards,
+	 * check the queue once again, because producer might have queued
+	 * new signal just before the reset. */
+	eventfd_t event;
+	eventfd_read(th->event_fd, &event);
+
+	if (transport_thread_signal_dequeue(th, signal, pcm)) {
+		/* keep the event armed if there are more pending signals */
+		const size_t mask = ARRAYSIZE(th->signals) - 1;
+		const size_t pos = th->signals_tail;
+		if (atomic_load_explicit(&th->signals[pos & mask].seq,
+					memory_order_acquire) == pos + 1)
+			eventfd_write(th->event_fd, 1);
 		return 0;
+	}
 
-	warn("Couldn't read transport thread signal: %s", strerror(errno));
 	*signal = BA_TRANSPORT_THREAD_SIGNAL_PING;
-	return -1;
+	if (pcm != NULL)
+		*pcm = NULL;
+	return errno = EAGAIN, -1;
 }
 
 static void transport_threads_cancel(struct ba_transport *t) {
@@ -364,16 +643,29 @@ static void transport_threads_cancel_if_no_clients(struct ba_transport *t) {
 	pthread_mutex_lock(&t->bt_fd_mtx);
 
 	bool stop = false;
+	bool release = false;
 
-	if (t->stopping)
+	/* transports of the warm device are kept acquired */
+	if (t->stopping || atomic_load_explicit(&t->d->warm, memory_order_relaxed))
 		goto final;
 
 	switch (t->type.profile) {
 	case BA_TRANSPORT_PROFILE_A2DP_SOURCE:
 		/* Release bidirectional A2DP transport only in case when there
 		 * is no active PCM connection - neither encoder nor decoder. */
-		if (t->a2dp.pcm.fd == -1 && t->a2dp.pcm_bc.fd == -1)
+		if (t->a2dp.pcm.fd == -1 && t->a2dp.pcm_bc.fd == -1) {
+			t->a2dp.pcm.silence_suspended = false;
 			t->stopping = stop = true;
+		}
+		/* If the streaming has been suspended due to the silence, release
+		 * the BT transport only, the IO thread waits for the signal. */
+		else if (t->a2dp.pcm.silence_suspended && t->a2dp.pcm_bc.fd == -1) {
+			/* Mark the release while holding the BT lock, so the state
+			 * change notification from BlueZ will see it. */
+			if (t->a2dp.state != BLUEZ_A2DP_TRANSPORT_STATE_IDLE)
+				t->a2dp.silence_released = true;
+			release = true;
+		}
 		break;
 	case BA_TRANSPORT_PROFILE_HFP_AG:
 	case BA_TRANSPORT_PROFILE_HSP_AG:
@@ -384,6 +676,12 @@ static void transport_threads_cancel_if_no_clients(struct ba_transport *t) {
 		if (t->sco.spk_pcm.fd == -1 && t->sco.mic_pcm.fd == -1)
 			t->stopping = stop = true;
 		break;
+	case BA_TRANSPORT_PROFILE_BAP_SOURCE:
+		/* Without PCM clients there is no point in keeping the ISO link
+		 * established, it will be released by the master IO thread. */
+		if (t->bap.pcm.fd == -1)
+			t->stopping = stop = true;
+		break;
 	}
 
 	if (stop) {
@@ -394,6 +692,12 @@ static void transport_threads_cancel_if_no_clients(struct ba_transport *t) {
 
 final:
 	pthread_mutex_unlock(&t->bt_fd_mtx);
+
+	if (release) {
+		debug("Releasing transport: %s", "Silence on PCM input");
+		ba_transport_release(t);
+	}
+
 	ba_transport_pcms_unlock(t);
 
 	if (stop) {
@@ -403,60 +707,276 @@ final:
 }
 
 /**
- * Transport thread manager.
+ * The number of slots in the keep-alive timer wheel. */
+#define TRANSPORT_THREAD_MANAGER_WHEEL_SLOTS 64
+/**
+ * The keep-alive timer wheel resolution in milliseconds. */
+#define TRANSPORT_THREAD_MANAGER_WHEEL_TICK 100
+
+/**
+ * Shared transport thread manager data.
  *
- * This manager handles transport IO threads asynchronous cancellation. */
-static void *transport_thread_manager(struct ba_transport *t) {
+ * Single manager thread handles asynchronous IO threads cancellation of
+ * all transports. Transports with pending commands are linked into the
+ * work queue, while transports waiting for the keep-alive timeout are
+ * linked into the hashed timer wheel. Both links are embedded in the
+ * transport structure, so sending commands does not allocate memory. */
+static struct {
+	pthread_once_t once;
+	pthread_t thread_id;
+	bool running;
+	pthread_mutex_t mutex;
+	/* manager state changed notification */
+	pthread_cond_t changed;
+	/* transports with pending commands */
+	GQueue queue;
+	/* transport processed by the manager at the moment */
+	struct ba_transport *current;
+	/* keep-alive timer wheel */
+	GQueue wheel[TRANSPORT_THREAD_MANAGER_WHEEL_SLOTS];
+	/* number of armed keep-alive timers */
+	size_t wheel_armed;
+	/* the last processed wheel tick */
+	uint64_t wheel_tick;
+	/* wheel ticks time reference */
+	struct timespec wheel_epoch;
+} transport_thread_manager = {
+	.once = PTHREAD_ONCE_INIT,
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.queue = G_QUEUE_INIT,
+};
 
-	pthread_setname_np(pthread_self(), "ba-th-manager");
+/**
+ * Get the current keep-alive timer wheel tick. */
+static uint64_t transport_thread_manager_wheel_now(void) {
+	struct timespec now;
+	/* the same clock as the one used by the condition variable */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timespecsub(&now, &transport_thread_manager.wheel_epoch, &now);
+	return ((uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000) /
+		TRANSPORT_THREAD_MANAGER_WHEEL_TICK;
+}
 
-	struct pollfd fds[] = {
-		{ t->thread_manager_pipe[0], POLLIN, 0 }};
-	int timeout = -1;
+/**
+ * Queue manager commands for the given transport.
+ *
+ * The caller shall hold the manager mutex. */
+static void transport_thread_manager_queue(struct ba_transport *t, unsigned int commands) {
+	if (t->thread_manager.commands == 0) {
+		t->thread_manager.queue_link.data = t;
+		g_queue_push_tail_link(&transport_thread_manager.queue, &t->thread_manager.queue_link);
+	}
+	t->thread_manager.commands |= commands;
+	pthread_cond_signal(&transport_thread_manager.changed);
+}
 
-	for (;;) {
+/**
+ * Disarm keep-alive timer of the given transport.
+ *
+ * The caller shall hold the manager mutex. */
+static void transport_thread_manager_timer_disarm(struct ba_transport *t) {
+	if (!t->thread_manager.wheel_armed)
+		return;
+	const size_t slot = t->thread_manager.wheel_expire % TRANSPORT_THREAD_MANAGER_WHEEL_SLOTS;
+	g_queue_unlink(&transport_thread_manager.wheel[slot], &t->thread_manager.wheel_link);
+	t->thread_manager.wheel_armed = false;
+	transport_thread_manager.wheel_armed--;
+}
 
-		if (poll(fds, ARRAYSIZE(fds), timeout) == 0) {
-			transport_threads_cancel_if_no_clients(t);
-			timeout = -1;
-		}
+/**
+ * Arm (or re-arm) keep-alive timer of the given transport.
+ *
+ * The caller shall hold the manager mutex. */
+static void transport_thread_manager_timer_arm(struct ba_transport *t, int timeout) {
+
+	transport_thread_manager_timer_disarm(t);
+
+	/* The timeout is rounded up to the wheel resolution, so the timer will
+	 * never fire too early. However, it might fire one tick too late. */
+	const uint64_t now = transport_thread_manager_wheel_now();
+	const uint64_t ticks = (timeout + TRANSPORT_THREAD_MANAGER_WHEEL_TICK - 1) /
+		TRANSPORT_THREAD_MANAGER_WHEEL_TICK;
+
+	if (transport_thread_manager.wheel_armed == 0)
+		/* there is no need to process ticks of the empty wheel */
+		transport_thread_manager.wheel_tick = now;
+
+	t->thread_manager.wheel_expire = now + MAX(ticks, 1);
+	t->thread_manager.wheel_link.data = t;
+
+	const size_t slot = t->thread_manager.wheel_expire % TRANSPORT_THREAD_MANAGER_WHEEL_SLOTS;
+	g_queue_push_tail_link(&transport_thread_manager.wheel[slot], &t->thread_manager.wheel_link);
+	t->thread_manager.wheel_armed = true;
+	transport_thread_manager.wheel_armed++;
+
+	pthread_cond_signal(&transport_thread_manager.changed);
+}
+
+/**
+ * Move transports with expired keep-alive timers to the work queue.
+ *
+ * The caller shall hold the manager mutex. */
+static void transport_thread_manager_timer_advance(void) {
 
-		if (fds[0].revents & POLLIN) {
-			/* incoming manager command */
+	const uint64_t now = transport_thread_manager_wheel_now();
 
-			enum ba_transport_thread_manager_command cmd;
-			if (read(fds[0].fd, &cmd, sizeof(cmd)) != sizeof(cmd)) {
-				error("Couldn't read manager command: %s", strerror(errno));
+	while (transport_thread_manager.wheel_armed > 0 &&
+			transport_thread_manager.wheel_tick < now) {
+
+		const uint64_t tick = ++transport_thread_manager.wheel_tick;
+		GQueue *slot = &transport_thread_manager.wheel[tick % TRANSPORT_THREAD_MANAGER_WHEEL_SLOTS];
+
+		for (GList *el = slot->head, *next; el != NULL; el = next) {
+			struct ba_transport *t = el->data;
+			next = el->next;
+			if (t->thread_manager.wheel_expire > tick)
 				continue;
-			}
+			transport_thread_manager_timer_disarm(t);
+			transport_thread_manager_queue(t,
+					1 << BA_TRANSPORT_THREAD_MANAGER_CANCEL_IF_NO_CLIENTS);
+		}
+
+	}
+
+}
+
+/**
+ * Shared transport thread manager.
+ *
+ * This manager handles IO threads asynchronous cancellation of all
+ * transports. */
+static void *transport_thread_manager_loop(void *userdata) {
+	(void)userdata;
+
+	pthread_setname_np(pthread_self(), "ba-th-manager");
+	pthread_mutex_lock(&transport_thread_manager.mutex);
+
+	for (;;) {
+
+		transport_thread_manager_timer_advance();
 
-			switch (cmd) {
-			case BA_TRANSPORT_THREAD_MANAGER_TERMINATE:
-				goto exit;
-			case BA_TRANSPORT_THREAD_MANAGER_CANCEL_THREADS:
+		GList *link;
+		if ((link = g_queue_pop_head_link(&transport_thread_manager.queue)) != NULL) {
+
+			struct ba_transport *t = link->data;
+			const unsigned int commands = t->thread_manager.commands;
+			t->thread_manager.commands = 0;
+			transport_thread_manager.current = t;
+
+			/* Process commands without holding the manager lock, because
+			 * IO threads cancellation might take a while. */
+			pthread_mutex_unlock(&transport_thread_manager.mutex);
+
+			if (commands & (1 << BA_TRANSPORT_THREAD_MANAGER_CANCEL_THREADS))
 				transport_threads_cancel(t);
-				timeout = -1;
-				break;
-			case BA_TRANSPORT_THREAD_MANAGER_CANCEL_IF_NO_CLIENTS:
-				debug("PCM clients check keep-alive: %d ms", config.keep_alive_time);
-				timeout = config.keep_alive_time;
-				break;
-			}
+			else if (commands & (1 << BA_TRANSPORT_THREAD_MANAGER_CANCEL_IF_NO_CLIENTS))
+				transport_threads_cancel_if_no_clients(t);
+
+			pthread_mutex_lock(&transport_thread_manager.mutex);
+			transport_thread_manager.current = NULL;
+			pthread_cond_broadcast(&transport_thread_manager.changed);
+			continue;
+		}
 
+		if (transport_thread_manager.wheel_armed == 0) {
+			pthread_cond_wait(&transport_thread_manager.changed,
+					&transport_thread_manager.mutex);
+			continue;
 		}
 
+		/* wait until the next wheel tick */
+		struct timespec ts = { 0 };
+		const uint64_t ms = (transport_thread_manager.wheel_tick + 1) *
+			TRANSPORT_THREAD_MANAGER_WHEEL_TICK;
+		ts.tv_sec = ms / 1000;
+		ts.tv_nsec = (ms % 1000) * 1000000;
+		timespecadd(&transport_thread_manager.wheel_epoch, &ts, &ts);
+		pthread_cond_timedwait(&transport_thread_manager.changed,
+				&transport_thread_manager.mutex, &ts);
+
 	}
 
-exit:
 	return NULL;
 }
 
+static void transport_thread_manager_init(void) {
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&transport_thread_manager.changed, &attr);
+	pthread_condattr_destroy(&attr);
+
+	for (size_t i = 0; i < ARRAYSIZE(transport_thread_manager.wheel); i++)
+		g_queue_init(&transport_thread_manager.wheel[i]);
+	clock_gettime(CLOCK_MONOTONIC, &transport_thread_manager.wheel_epoch);
+
+	int ret;
+	if ((ret = pthread_create(&transport_thread_manager.thread_id,
+					NULL, transport_thread_manager_loop, NULL)) != 0) {
+		error("Couldn't create thread manager: %s", strerror(ret));
+		return;
+	}
+
+	transport_thread_manager.running = true;
+
+}
+
+/**
+ * Remove transport from the shared thread manager.
+ *
+ * This function waits until the manager finishes processing of the given
+ * transport (if any), so afterwards it is safe to free the transport. */
+static void transport_thread_manager_remove(struct ba_transport *t) {
+
+	pthread_mutex_lock(&transport_thread_manager.mutex);
+
+	if (t->thread_manager.commands != 0) {
+		g_queue_unlink(&transport_thread_manager.queue, &t->thread_manager.queue_link);
+		t->thread_manager.commands = 0;
+	}
+
+	transport_thread_manager_timer_disarm(t);
+
+	/* The last reference might be dropped by the manager thread itself,
+	 * e.g. by the IO thread cancellation, so do not wait for ourself. */
+	if (!pthread_equal(pthread_self(), transport_thread_manager.thread_id))
+		while (transport_thread_manager.current == t)
+			pthread_cond_wait(&transport_thread_manager.changed,
+					&transport_thread_manager.mutex);
+
+	pthread_mutex_unlock(&transport_thread_manager.mutex);
+
+}
+
 static int transport_thread_manager_send_command(struct ba_transport *t,
 		enum ba_transport_thread_manager_command cmd) {
-	if (write(t->thread_manager_pipe[1], &cmd, sizeof(cmd)) == sizeof(cmd))
-		return 0;
-	error("Couldn't send thread manager command: %s", strerror(errno));
-	return -1;
+
+	pthread_once(&transport_thread_manager.once, transport_thread_manager_init);
+	if (!transport_thread_manager.running) {
+		error("Couldn't send thread manager command: %s", strerror(ENOSYS));
+		return errno = ENOSYS, -1;
+	}
+
+	pthread_mutex_lock(&transport_thread_manager.mutex);
+
+	switch (cmd) {
+	case BA_TRANSPORT_THREAD_MANAGER_CANCEL_THREADS:
+		transport_thread_manager_timer_disarm(t);
+		transport_thread_manager_queue(t, 1 << cmd);
+		break;
+	case BA_TRANSPORT_THREAD_MANAGER_CANCEL_IF_NO_CLIENTS:
+		debug("PCM clients check keep-alive: %d ms", config.keep_alive_time);
+		if (config.keep_alive_time == 0)
+			transport_thread_manager_queue(t, 1 << cmd);
+		else if (config.keep_alive_time > 0)
+			transport_thread_manager_timer_arm(t, config.keep_alive_time);
+		/* negative value means infinite keep-alive time */
+		break;
+	}
+
+	pthread_mutex_unlock(&transport_thread_manager.mutex);
+	return 0;
 }
 
 /**
@@ -488,32 +1008,20 @@ static struct ba_transport *transport_new(
 
 	t->bt_fd = -1;
 
-	t->thread_manager_thread_id = config.main_thread;
-	t->thread_manager_pipe[0] = -1;
-	t->thread_manager_pipe[1] = -1;
-
 	err = 0;
 	err |= transport_thread_init(&t->thread_enc, t);
 	err |= transport_thread_init(&t->thread_dec, t);
 	if (err != 0)
 		goto fail;
 
-	if (pipe(t->thread_manager_pipe) == -1)
-		goto fail;
-	if ((errno = pthread_create(&t->thread_manager_thread_id,
-			NULL, PTHREAD_ROUTINE(transport_thread_manager), t)) != 0) {
-		t->thread_manager_thread_id = config.main_thread;
-		goto fail;
-	}
-
 	if ((t->bluez_dbus_owner = strdup(dbus_owner)) == NULL)
 		goto fail;
 	if ((t->bluez_dbus_path = strdup(dbus_path)) == NULL)
 		goto fail;
 
-	pthread_mutex_lock(&device->transports_mutex);
+	pthread_rwlock_wrlock(&device->transports_lock);
 	g_hash_table_insert(device->transports, t->bluez_dbus_path, t);
-	pthread_mutex_unlock(&device->transports_mutex);
+	pthread_rwlock_unlock(&device->transports_lock);
 
 	return t;
 
@@ -524,7 +1032,88 @@ fail:
 	return NULL;
 }
 
-static int transport_acquire_bt_a2dp(struct ba_transport *t) {
+/**
+ * Get the upper bound of the A2DP stream bit rate.
+ *
+ * @return This function returns the bit rate in bits per second. */
+static unsigned int transport_get_a2dp_bitrate(const struct ba_transport *t) {
+
+	const unsigned int samples = t->a2dp.pcm.sampling * t->a2dp.pcm.channels;
+
+	switch (t->type.codec) {
+	case A2DP_CODEC_SBC:
+		/* covers the high bit-pool dual channel mode (SBC XQ) */
+		return 512000;
+	case A2DP_CODEC_MPEG12:
+		return 320000;
+	case A2DP_CODEC_MPEG24: {
+		const unsigned int bitrate = AAC_GET_BITRATE(*(a2dp_aac_t *)t->a2dp.configuration);
+		return bitrate != 0 ? bitrate : 320000;
+	}
+	case A2DP_CODEC_VENDOR_APTX:
+	case A2DP_CODEC_VENDOR_APTX_LL:
+		return samples * 4;
+	case A2DP_CODEC_VENDOR_APTX_HD:
+		return samples * 6;
+	case A2DP_CODEC_VENDOR_FASTSTREAM:
+		/* music and voice streams */
+		return 212000 + 56000;
+	case A2DP_CODEC_VENDOR_LDAC:
+		return 990000;
+	default:
+		/* uncompressed 16-bit PCM */
+		return samples * 16;
+	}
+
+}
+
+/**
+ * Setup the BT socket of the A2DP sink.
+ *
+ * The receive buffer shall hold incoming data for the target jitter
+ * duration, so short host side stalls (e.g. CPU load peaks) will not cause
+ * the kernel to drop packets. On the other hand, the buffer shall not be
+ * too large, because stale data queued in the socket adds up to the audio
+ * delay. */
+static void transport_set_a2dp_sink_sockopts(struct ba_transport *t, int fd) {
+
+	const unsigned int window = config.a2dp.jitter_buffer > 0 ?
+		config.a2dp.jitter_buffer : BA_TRANSPORT_RCVBUF_WINDOW;
+	const unsigned long bytes = (unsigned long)transport_get_a2dp_bitrate(t) / 8 * window / 1000;
+	int size = MAX(bytes, t->mtu_read * 4);
+
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) == -1)
+		warn("Couldn't set socket input buffer size: %s", strerror(errno));
+
+	/* Let the kernel report the number of packets dropped due to the
+	 * receive buffer overflow, so we can tell them from the RF losses. */
+	const int enable = 1;
+	if (setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable)) == -1)
+		warn("Couldn't enable socket overflow reporting: %s", strerror(errno));
+
+	/* Packet arrival times taken by the kernel are not disturbed by the IO
+	 * thread scheduling, so they are used for the source clock estimation.
+	 * Bluetooth controllers do not provide hardware RX time-stamps, hence
+	 * the software time-stamping is used. */
+	if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) == -1)
+		warn("Couldn't enable socket time-stamping: %s", strerror(errno));
+
+	debug("A2DP socket input buffer: %d: %d bytes", fd, size);
+
+}
+
+/**
+ * Acquire BlueZ media transport.
+ *
+ * Both A2DP and BAP transports are exposed by BlueZ via the same media
+ * transport interface, the only difference is the type of the socket.
+ *
+ * @param t Transport structure.
+ * @param try If true, the transport will be acquired only if the remote
+ *   device has already requested the stream (pending state).
+ * @return On success this function returns the BT socket file descriptor.
+ *   Otherwise, -1 is returned. */
+static int transport_acquire_bt_media(struct ba_transport *t, bool try) {
 
 	GDBusMessage *msg, *rep;
 	GUnixFDList *fd_list;
@@ -533,7 +1122,7 @@ static int transport_acquire_bt_a2dp(struct ba_transport *t) {
 
 	msg = g_dbus_message_new_method_call(t->bluez_dbus_owner,
 			t->bluez_dbus_path, BLUEZ_IFACE_MEDIA_TRANSPORT,
-			t->a2dp.state == BLUEZ_A2DP_TRANSPORT_STATE_PENDING ? "TryAcquire" : "Acquire");
+			try ? "TryAcquire" : "Acquire");
 
 	if ((rep = g_dbus_connection_send_message_with_reply_sync(config.dbus, msg,
 					G_DBUS_SEND_MESSAGE_FLAGS_NONE, -1, NULL, NULL, &err)) == NULL)
@@ -555,6 +1144,25 @@ static int transport_acquire_bt_a2dp(struct ba_transport *t) {
 	fd = g_unix_fd_list_get(fd_list, 0, &err);
 	t->bt_fd = fd;
 
+fail:
+	g_object_unref(msg);
+	if (rep != NULL)
+		g_object_unref(rep);
+	if (err != NULL) {
+		error("Couldn't acquire transport: %s", err->message);
+		g_error_free(err);
+	}
+
+	return fd;
+}
+
+static int transport_acquire_bt_a2dp(struct ba_transport *t) {
+
+	int fd;
+	if ((fd = transport_acquire_bt_media(t,
+					t->a2dp.state == BLUEZ_A2DP_TRANSPORT_STATE_PENDING)) == -1)
+		return -1;
+
 	/* Minimize audio delay and increase responsiveness (seeking, stopping) by
 	 * decreasing the BT socket output buffer. We will use a tripled write MTU
 	 * value, in order to prevent tearing due to temporal heavy load. */
@@ -565,34 +1173,33 @@ static int transport_acquire_bt_a2dp(struct ba_transport *t) {
 	if (ioctl(fd, TIOCOUTQ, &t->a2dp.bt_fd_coutq_init) == -1)
 		warn("Couldn't get socket queued bytes: %s", strerror(errno));
 
-	debug("New A2DP transport: %d", fd);
-	debug("A2DP socket MTU: %d: R:%u W:%u", fd, mtu_read, mtu_write);
+	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SINK)
+		transport_set_a2dp_sink_sockopts(t, fd);
 
-fail:
-	g_object_unref(msg);
-	if (rep != NULL)
-		g_object_unref(rep);
-	if (err != NULL) {
-		error("Couldn't acquire transport: %s", err->message);
-		g_error_free(err);
-	}
+	debug("New A2DP transport: %d", fd);
+	debug("A2DP socket MTU: %d: R:%zu W:%zu", fd, t->mtu_read, t->mtu_write);
 
 	return fd;
 }
 
-static int transport_release_bt_a2dp(struct ba_transport *t) {
+/**
+ * Release BlueZ media transport and close the BT socket.
+ *
+ * @param t Transport structure.
+ * @param idle If true, the release request will not be sent. If the state
+ *   is idle, it means that either transport was not acquired, or was
+ *   released by the BlueZ. In both cases there is no point in a explicit
+ *   release request. It might even return error (e.g. not authorized).
+ * @return On success this function returns 0. Otherwise, -1 is returned. */
+static int transport_release_bt_media(struct ba_transport *t, bool idle) {
 
 	GDBusMessage *msg = NULL, *rep = NULL;
 	GError *err = NULL;
 	int ret = -1;
 
-	/* If the state is idle, it means that either transport was not acquired, or
-	 * was released by the BlueZ. In both cases there is no point in a explicit
-	 * release request. It might even return error (e.g. not authorized). */
-	if (t->a2dp.state != BLUEZ_A2DP_TRANSPORT_STATE_IDLE &&
-			t->bluez_dbus_owner != NULL) {
+	if (!idle && t->bluez_dbus_owner != NULL) {
 
-		debug("Releasing A2DP transport: %d", t->bt_fd);
+		debug("Releasing media transport: %d", t->bt_fd);
 
 		msg = g_dbus_message_new_method_call(t->bluez_dbus_owner, t->bluez_dbus_path,
 				BLUEZ_IFACE_MEDIA_TRANSPORT, "Release");
@@ -619,7 +1226,7 @@ static int transport_release_bt_a2dp(struct ba_transport *t) {
 
 	}
 
-	debug("Closing A2DP transport: %d", t->bt_fd);
+	debug("Closing media transport: %d", t->bt_fd);
 
 	ret = 0;
 	close(t->bt_fd);
@@ -638,16 +1245,124 @@ fail:
 	return ret;
 }
 
-struct ba_transport *ba_transport_new_a2dp(
-		struct ba_device *device,
-		struct ba_transport_type type,
-		const char *dbus_owner,
-		const char *dbus_path,
-		const struct a2dp_codec *codec,
-		const void *configuration) {
+static int transport_release_bt_a2dp(struct ba_transport *t) {
+	return transport_release_bt_media(t,
+			t->a2dp.state == BLUEZ_A2DP_TRANSPORT_STATE_IDLE);
+}
 
-	const bool is_sink = type.profile & BA_TRANSPORT_PROFILE_A2DP_SINK;
-	struct ba_transport *t;
+/**
+ * Free PCM client stream handover.
+ *
+ * If the stream has not been attached to any PCM, closing its descriptors
+ * will notify the client that the PCM is no longer available. */
+static void transport_pcm_handover_free(
+		struct ba_transport_pcm_handover *h) {
+
+	if (h->d->pcm_handover == h)
+		h->d->pcm_handover = NULL;
+	if (h->timeout_source != 0)
+		g_source_remove(h->timeout_source);
+
+	if (shm_ring_is_mapped(&h->shm)) {
+		shm_ring_close(&h->shm);
+		shm_ring_free(&h->shm);
+	}
+	if (h->shm_ctrl_fd != -1)
+		close(h->shm_ctrl_fd);
+	if (h->fd != -1)
+		close(h->fd);
+	if (h->ctrl_fd != -1)
+		close(h->ctrl_fd);
+
+	ba_device_unref(h->d);
+	g_free(h->ba_dbus_path);
+	free(h);
+
+}
+
+static gboolean transport_pcm_handover_timeout(void *userdata) {
+	struct ba_transport_pcm_handover *h = userdata;
+	warn("PCM handover timeout: %s", h->ba_dbus_path);
+	h->timeout_source = 0;
+	transport_pcm_handover_free(h);
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * Detach PCM client stream for the A2DP codec switch.
+ *
+ * The transport IO threads shall be stopped before calling this function.
+ *
+ * @return On success, the handover structure registered in the device is
+ *   returned. Otherwise, NULL is returned. */
+static struct ba_transport_pcm_handover *transport_pcm_handover_new(
+		struct ba_transport_pcm *pcm) {
+
+	struct ba_device *d = pcm->t->d;
+	struct ba_transport_pcm_handover *h;
+
+	if ((h = malloc(sizeof(*h))) == NULL)
+		return NULL;
+
+	*h = (struct ba_transport_pcm_handover){
+		.fd = -1,
+		.shm_ctrl_fd = -1,
+		.ctrl_fd = -1,
+	};
+
+	if (bluealsa_dbus_pcm_handover_detach(pcm, h) == -1) {
+		warn("Couldn't detach PCM stream: %s", strerror(errno));
+		free(h);
+		return NULL;
+	}
+
+	h->d = ba_device_ref(d);
+	h->ba_dbus_path = g_strdup(pcm->ba_dbus_path);
+	h->timeout_source = g_timeout_add(BA_TRANSPORT_PCM_HANDOVER_TIMEOUT,
+			transport_pcm_handover_timeout, h);
+
+	d->pcm_handover = h;
+	return h;
+}
+
+/**
+ * Attach PCM client stream to the given PCM.
+ *
+ * The handover is consumed unless the PCM is not the one from which the
+ * stream has been detached (e.g. it belongs to other A2DP profile). If
+ * the stream configuration is not supported by the new codec, the stream
+ * is closed, so the client can reopen the PCM. */
+static void transport_pcm_handover_attach(
+		struct ba_transport_pcm_handover *h,
+		struct ba_transport_pcm *pcm) {
+
+	if (strcmp(h->ba_dbus_path, pcm->ba_dbus_path) != 0)
+		return;
+
+	if (ba_transport_pcm_set_channels(pcm, h->channels) == -1 ||
+			ba_transport_pcm_set_format(pcm, h->format) == -1 ||
+			ba_transport_pcm_set_sampling(pcm, h->client_sampling) == -1 ||
+			bluealsa_dbus_pcm_handover_attach(pcm, h) == -1)
+		goto fail;
+
+	transport_pcm_handover_free(h);
+	return;
+
+fail:
+	warn("Couldn't attach PCM stream: %s: %s", pcm->ba_dbus_path, strerror(errno));
+	transport_pcm_handover_free(h);
+}
+
+struct ba_transport *ba_transport_new_a2dp(
+		struct ba_device *device,
+		struct ba_transport_type type,
+		const char *dbus_owner,
+		const char *dbus_path,
+		const struct a2dp_codec *codec,
+		const void *configuration) {
+
+	const bool is_sink = type.profile & BA_TRANSPORT_PROFILE_A2DP_SINK;
+	struct ba_transport *t;
 
 	if ((t = transport_new(device, dbus_owner, dbus_path)) == NULL)
 		return NULL;
@@ -657,6 +1372,12 @@ struct ba_transport *ba_transport_new_a2dp(
 	t->a2dp.codec = codec;
 	t->a2dp.configuration = g_memdup(configuration, codec->capabilities_size);
 	t->a2dp.state = BLUEZ_A2DP_TRANSPORT_STATE_IDLE;
+#if ENABLE_LDAC
+	t->a2dp.ldac_eqmid = config.ldac_eqmid;
+#endif
+
+	t->a2dp.group.leader = t;
+	pthread_mutex_init(&t->a2dp.group.mutex, NULL);
 
 	transport_pcm_init(&t->a2dp.pcm,
 			is_sink ? &t->thread_dec : &t->thread_enc,
@@ -670,15 +1391,43 @@ struct ba_transport *ba_transport_new_a2dp(
 	t->a2dp.pcm_bc.soft_volume = !config.a2dp.volume;
 	t->a2dp.pcm_bc.max_bt_volume = 127;
 
+	/* The monitor PCM is fed by the encoder thread with the stream which
+	 * has been already read from the playback PCM, so it shall never block
+	 * the encoder, regardless of the configured overrun policy. */
+	transport_pcm_init(&t->a2dp.pcm_monitor,
+			&t->thread_enc, BA_TRANSPORT_PCM_MODE_SOURCE);
+	g_free(t->a2dp.pcm_monitor.ba_dbus_path);
+	t->a2dp.pcm_monitor.ba_dbus_path = g_strdup_printf("%s/%s/monitor",
+			device->ba_dbus_path, transport_get_dbus_path_type(type));
+	t->a2dp.pcm_monitor.overrun = BA_TRANSPORT_PCM_OVERRUN_DROP_NEWEST;
+	t->a2dp.pcm_monitor.soft_volume = true;
+	if (!is_sink && config.a2dp.monitor)
+		t->a2dp.pcm.monitor = &t->a2dp.pcm_monitor;
+
 	t->acquire = transport_acquire_bt_a2dp;
 	t->release = transport_release_bt_a2dp;
 
 	ba_transport_set_codec(t, type.codec);
 
+	/* codec (plug-in) has rejected the configuration */
+	if (t->a2dp.pcm.channels == 0) {
+		ba_transport_destroy(t);
+		return errno = EINVAL, NULL;
+	}
+
+	transport_pcm_restore(&t->a2dp.pcm);
+	transport_pcm_restore(&t->a2dp.pcm_bc);
+
 	if (t->a2dp.pcm.channels > 0)
 		bluealsa_dbus_pcm_register(&t->a2dp.pcm, NULL);
 	if (t->a2dp.pcm_bc.channels > 0)
 		bluealsa_dbus_pcm_register(&t->a2dp.pcm_bc, NULL);
+	if (t->a2dp.pcm.monitor != NULL && t->a2dp.pcm.channels > 0)
+		bluealsa_dbus_pcm_register(&t->a2dp.pcm_monitor, NULL);
+
+	/* resume client stream detached during the codec switch */
+	if (device->pcm_handover != NULL)
+		transport_pcm_handover_attach(device->pcm_handover, &t->a2dp.pcm);
 
 	return t;
 }
@@ -686,9 +1435,11 @@ struct ba_transport *ba_transport_new_a2dp(
 static int transport_acquire_bt_sco(struct ba_transport *t) {
 
 	struct ba_device *d = t->d;
+	const uint16_t voice = t->type.codec == HFP_CODEC_CVSD ?
+		BT_VOICE_CVSD_16BIT : BT_VOICE_TRANSPARENT;
 	int fd = -1;
 
-	if ((fd = hci_sco_open(d->a->hci.dev_id)) == -1) {
+	if ((fd = ba_adapter_sco_pool_get(d->a, voice)) == -1) {
 		error("Couldn't open SCO socket: %s", strerror(errno));
 		goto fail;
 	}
@@ -705,8 +1456,7 @@ static int transport_acquire_bt_sco(struct ba_transport *t) {
 		nanosleep(&delay, NULL);
 	}
 
-	if (hci_sco_connect(fd, &d->addr,
-				t->type.codec == HFP_CODEC_CVSD ? BT_VOICE_CVSD_16BIT : BT_VOICE_TRANSPARENT) == -1) {
+	if (hci_sco_connect(fd, &d->addr) == -1) {
 		error("Couldn't establish SCO link: %s", strerror(errno));
 		goto fail;
 	}
@@ -736,6 +1486,9 @@ static int transport_release_bt_sco(struct ba_transport *t) {
 	 * for calculating close-connect quirk delay in the acquire function. */
 	gettimestamp(&t->sco.closed_at);
 
+	/* prepare SCO socket for the next acquire */
+	ba_adapter_sco_pool_fill(t->d->a);
+
 	return 0;
 }
 
@@ -770,7 +1523,9 @@ struct ba_transport *ba_transport_new_sco(
 	transport_pcm_init(&t->sco.spk_pcm, &t->thread_enc, BA_TRANSPORT_PCM_MODE_SINK);
 	t->sco.spk_pcm.max_bt_volume = 15;
 
-	transport_pcm_init(&t->sco.mic_pcm, &t->thread_dec, BA_TRANSPORT_PCM_MODE_SOURCE);
+	/* In the duplex mode both PCMs are serviced by the encoder thread. */
+	transport_pcm_init(&t->sco.mic_pcm, config.sco.duplex ? &t->thread_enc : &t->thread_dec,
+			BA_TRANSPORT_PCM_MODE_SOURCE);
 	t->sco.mic_pcm.max_bt_volume = 15;
 
 	t->acquire = transport_acquire_bt_sco;
@@ -783,6 +1538,9 @@ struct ba_transport *ba_transport_new_sco(
 
 	ba_transport_set_codec(t, type.codec);
 
+	transport_pcm_restore(&t->sco.spk_pcm);
+	transport_pcm_restore(&t->sco.mic_pcm);
+
 	bluealsa_dbus_pcm_register(&t->sco.spk_pcm, NULL);
 	bluealsa_dbus_pcm_register(&t->sco.mic_pcm, NULL);
 
@@ -795,16 +1553,74 @@ fail:
 	return NULL;
 }
 
+static int transport_acquire_bt_bap(struct ba_transport *t) {
+
+	int fd;
+	if ((fd = transport_acquire_bt_media(t,
+					t->bap.state == BLUEZ_A2DP_TRANSPORT_STATE_PENDING)) == -1)
+		return -1;
+
+	debug("New BAP transport: %d", fd);
+	debug("ISO socket MTU: %d: R:%zu W:%zu", fd, t->mtu_read, t->mtu_write);
+
+	return fd;
+}
+
+static int transport_release_bt_bap(struct ba_transport *t) {
+	return transport_release_bt_media(t,
+			t->bap.state == BLUEZ_A2DP_TRANSPORT_STATE_IDLE);
+}
+
+struct ba_transport *ba_transport_new_bap(
+		struct ba_device *device,
+		struct ba_transport_type type,
+		const char *dbus_owner,
+		const char *dbus_path,
+		const struct bap_lc3_configuration *configuration) {
+
+	const bool is_sink = type.profile & BA_TRANSPORT_PROFILE_BAP_SINK;
+	struct ba_transport *t;
+
+	if ((t = transport_new(device, dbus_owner, dbus_path)) == NULL)
+		return NULL;
+
+	t->type = type;
+
+	t->bap.configuration = *configuration;
+	t->bap.state = BLUEZ_A2DP_TRANSPORT_STATE_IDLE;
+	t->bap.delay = BAP_QOS_PRESENTATION_DELAY_US / 100;
+
+	transport_pcm_init(&t->bap.pcm,
+			is_sink ? &t->thread_dec : &t->thread_enc,
+			is_sink ? BA_TRANSPORT_PCM_MODE_SOURCE : BA_TRANSPORT_PCM_MODE_SINK);
+	t->bap.pcm.max_bt_volume = 127;
+
+	t->acquire = transport_acquire_bt_bap;
+	t->release = transport_release_bt_bap;
+
+	ba_transport_set_codec(t, type.codec);
+
+	transport_pcm_restore(&t->bap.pcm);
+	/* LE Audio volume is controlled by the Volume Control Profile,
+	 * which is not supported, so the software volume is used. */
+	t->bap.pcm.soft_volume = true;
+
+	if (t->bap.pcm.channels > 0)
+		bluealsa_dbus_pcm_register(&t->bap.pcm, NULL);
+
+	return t;
+}
+
 struct ba_transport *ba_transport_lookup(
 		struct ba_device *device,
 		const char *dbus_path) {
 
 	struct ba_transport *t;
 
-	pthread_mutex_lock(&device->transports_mutex);
+	pthread_rwlock_rdlock(&device->transports_lock);
 	if ((t = g_hash_table_lookup(device->transports, dbus_path)) != NULL)
-		t->ref_count++;
-	pthread_mutex_unlock(&device->transports_mutex);
+		atomic_fetch_add(&t->ref_count, 1);
+	pthread_rwlock_unlock(&device->transports_lock);
 
 	return t;
 }
@@ -812,12 +1628,7 @@ struct ba_transport *ba_transport_lookup(
 struct ba_transport *ba_transport_ref(
 		struct ba_transport *t) {
 
-	struct ba_device *d = t->d;
-
-	pthread_mutex_lock(&d->transports_mutex);
-	t->ref_count++;
-	pthread_mutex_unlock(&d->transports_mutex);
-
+	atomic_fetch_add(&t->ref_count, 1);
 	return t;
 }
 
@@ -828,6 +1639,7 @@ void ba_transport_destroy(struct ba_transport *t) {
 	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP) {
 		bluealsa_dbus_pcm_unregister(&t->a2dp.pcm);
 		bluealsa_dbus_pcm_unregister(&t->a2dp.pcm_bc);
+		bluealsa_dbus_pcm_unregister(&t->a2dp.pcm_monitor);
 	}
 	else if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO) {
 		bluealsa_dbus_pcm_unregister(&t->sco.spk_pcm);
@@ -836,21 +1648,34 @@ void ba_transport_destroy(struct ba_transport *t) {
 			ba_rfcomm_destroy(t->sco.rfcomm);
 		t->sco.rfcomm = NULL;
 	}
+	else if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_BAP)
+		bluealsa_dbus_pcm_unregister(&t->bap.pcm);
 
 	/* stop transport IO threads */
 	ba_transport_stop(t);
 
+	/* dissolve broadcast group - there is no one to feed its members */
+	if (t->type.profile == BA_TRANSPORT_PROFILE_A2DP_SOURCE) {
+		if (ba_transport_group_is_member(t))
+			ba_transport_group_leave(t);
+		while (t->a2dp.group.members_len > 0)
+			ba_transport_group_leave(t->a2dp.group.members[0].t);
+	}
+
 	ba_transport_pcms_lock(t);
 
 	/* terminate on-going PCM connections - exit PCM controllers */
 	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP) {
 		ba_transport_pcm_release(&t->a2dp.pcm);
 		ba_transport_pcm_release(&t->a2dp.pcm_bc);
+		ba_transport_pcm_release(&t->a2dp.pcm_monitor);
 	}
 	else if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO) {
 		ba_transport_pcm_release(&t->sco.spk_pcm);
 		ba_transport_pcm_release(&t->sco.mic_pcm);
 	}
+	else if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_BAP)
+		ba_transport_pcm_release(&t->bap.pcm);
 
 	/* make sure that transport is released */
 	ba_transport_release(t);
@@ -865,11 +1690,17 @@ void ba_transport_unref(struct ba_transport *t) {
 	int ref_count;
 	struct ba_device *d = t->d;
 
-	pthread_mutex_lock(&d->transports_mutex);
-	if ((ref_count = --t->ref_count) == 0)
+	/* drop the reference without locking unless it might be the last one */
+	ref_count = atomic_load(&t->ref_count);
+	while (ref_count > 1)
+		if (atomic_compare_exchange_weak(&t->ref_count, &ref_count, ref_count - 1))
+			return;
+
+	pthread_rwlock_wrlock(&d->transports_lock);
+	if ((ref_count = atomic_fetch_sub(&t->ref_count, 1) - 1) == 0)
 		/* detach transport from the device */
 		g_hash_table_steal(d->transports, t->bluez_dbus_path);
-	pthread_mutex_unlock(&d->transports_mutex);
+	pthread_rwlock_unlock(&d->transports_lock);
 
 	if (ref_count > 0)
 		return;
@@ -877,6 +1708,9 @@ void ba_transport_unref(struct ba_transport *t) {
 	debug("Freeing transport: %s", ba_transport_type_to_string(t->type));
 	g_assert_cmpint(ref_count, ==, 0);
 
+	/* make sure that the manager will not touch this transport */
+	transport_thread_manager_remove(t);
+
 	if (t->bt_fd != -1)
 		close(t->bt_fd);
 
@@ -885,6 +1719,8 @@ void ba_transport_unref(struct ba_transport *t) {
 	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP) {
 		transport_pcm_free(&t->a2dp.pcm);
 		transport_pcm_free(&t->a2dp.pcm_bc);
+		transport_pcm_free(&t->a2dp.pcm_monitor);
+		pthread_mutex_destroy(&t->a2dp.group.mutex);
 		free(t->a2dp.configuration);
 	}
 	else if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO) {
@@ -893,20 +1729,12 @@ void ba_transport_unref(struct ba_transport *t) {
 		transport_pcm_free(&t->sco.spk_pcm);
 		transport_pcm_free(&t->sco.mic_pcm);
 	}
-
-	if (!pthread_equal(t->thread_manager_thread_id, config.main_thread)) {
-		transport_thread_manager_send_command(t, BA_TRANSPORT_THREAD_MANAGER_TERMINATE);
-		pthread_join(t->thread_manager_thread_id, NULL);
-	}
+	else if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_BAP)
+		transport_pcm_free(&t->bap.pcm);
 
 	transport_thread_free(&t->thread_enc);
 	transport_thread_free(&t->thread_dec);
 
-	if (t->thread_manager_pipe[0] != -1)
-		close(t->thread_manager_pipe[0]);
-	if (t->thread_manager_pipe[1] != -1)
-		close(t->thread_manager_pipe[1]);
-
 	pthread_mutex_destroy(&t->bt_fd_mtx);
 	pthread_mutex_destroy(&t->type_mtx);
 	free(t->bluez_dbus_owner);
@@ -927,6 +1755,7 @@ int ba_transport_pcms_lock(struct ba_transport *t) {
 	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP) {
 		pthread_mutex_lock(&t->a2dp.pcm.mutex);
 		pthread_mutex_lock(&t->a2dp.pcm_bc.mutex);
+		pthread_mutex_lock(&t->a2dp.pcm_monitor.mutex);
 		return 0;
 	}
 	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO) {
@@ -934,6 +1763,10 @@ int ba_transport_pcms_lock(struct ba_transport *t) {
 		pthread_mutex_lock(&t->sco.mic_pcm.mutex);
 		return 0;
 	}
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_BAP) {
+		pthread_mutex_lock(&t->bap.pcm.mutex);
+		return 0;
+	}
 	errno = EINVAL;
 	return -1;
 }
@@ -942,6 +1775,7 @@ int ba_transport_pcms_unlock(struct ba_transport *t) {
 	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP) {
 		pthread_mutex_unlock(&t->a2dp.pcm.mutex);
 		pthread_mutex_unlock(&t->a2dp.pcm_bc.mutex);
+		pthread_mutex_unlock(&t->a2dp.pcm_monitor.mutex);
 		return 0;
 	}
 	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO) {
@@ -949,6 +1783,10 @@ int ba_transport_pcms_unlock(struct ba_transport *t) {
 		pthread_mutex_unlock(&t->sco.mic_pcm.mutex);
 		return 0;
 	}
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_BAP) {
+		pthread_mutex_unlock(&t->bap.pcm.mutex);
+		return 0;
+	}
 	errno = EINVAL;
 	return -1;
 }
@@ -968,11 +1806,33 @@ int ba_transport_select_codec_a2dp(
 			memcmp(sep->configuration, t->a2dp.configuration, sep->capabilities_size) == 0)
 		goto final;
 
+	/* all transports in the broadcast group shall use the same codec */
+	if (t->type.profile == BA_TRANSPORT_PROFILE_A2DP_SOURCE &&
+			(ba_transport_group_is_member(t) || t->a2dp.group.members_len > 0)) {
+		pthread_mutex_unlock(&t->type_mtx);
+		return errno = EBUSY, -1;
+	}
+
+	/* BlueZ will destroy this transport and create a new one with the new
+	 * codec configuration. In order not to disconnect the PCM client, its
+	 * stream is detached and it will be attached to the new transport. */
+	struct ba_transport_pcm_handover *handover = NULL;
+	const bool handover_stop = t->a2dp.pcm.fd != -1 && t->d->pcm_handover == NULL;
+	if (handover_stop) {
+		ba_transport_stop(t);
+		handover = transport_pcm_handover_new(&t->a2dp.pcm);
+	}
+
 	GError *err = NULL;
 	if (!bluez_a2dp_set_configuration(t->a2dp.bluez_dbus_sep_path, sep, &err)) {
 		error("Couldn't set A2DP configuration: %s", err->message);
 		pthread_mutex_unlock(&t->type_mtx);
 		g_error_free(err);
+		/* reconfiguration failed, so give the stream back */
+		if (handover_stop && t->a2dp.state == BLUEZ_A2DP_TRANSPORT_STATE_ACTIVE)
+			ba_transport_start(t);
+		if (handover != NULL)
+			transport_pcm_handover_attach(handover, &t->a2dp.pcm);
 		return errno = EIO, -1;
 	}
 
@@ -1022,6 +1882,12 @@ int ba_transport_select_codec_sco(
 			ba_rfcomm_send_signal(r, BA_RFCOMM_SIGNAL_HFP_SET_CODEC_MSBC);
 			pthread_cond_wait(&r->codec_selection_completed, &r->codec_selection_completed_mtx);
 			break;
+#if ENABLE_LC3_SWB
+		case HFP_CODEC_LC3_SWB:
+			ba_rfcomm_send_signal(r, BA_RFCOMM_SIGNAL_HFP_SET_CODEC_LC3_SWB);
+			pthread_cond_wait(&r->codec_selection_completed, &r->codec_selection_completed_mtx);
+			break;
+#endif
 		}
 
 		pthread_mutex_unlock(&r->codec_selection_completed_mtx);
@@ -1064,6 +1930,7 @@ static void ba_transport_set_codec_a2dp(struct ba_transport *t) {
 #endif
 #if ENABLE_APTX
 	case A2DP_CODEC_VENDOR_APTX:
+	case A2DP_CODEC_VENDOR_APTX_LL:
 		a2dp_aptx_transport_set_codec(t);
 		break;
 #endif
@@ -1083,6 +1950,11 @@ static void ba_transport_set_codec_a2dp(struct ba_transport *t) {
 		break;
 #endif
 	default:
+		if (codec_plugin_lookup(codec_id) != NULL) {
+			/* errors are reported by the plug-in glue code */
+			a2dp_plugin_transport_set_codec(t);
+			break;
+		}
 		error("Unsupported A2DP codec: %#x", codec_id);
 		g_assert_not_reached();
 	}
@@ -1101,10 +1973,22 @@ static void ba_transport_set_codec_sco(struct ba_transport *t) {
 	case HFP_CODEC_CVSD:
 		t->sco.spk_pcm.sampling = 8000;
 		t->sco.mic_pcm.sampling = 8000;
+		t->sco.spk_pcm.block_frames = 1;
+		t->sco.mic_pcm.block_frames = 1;
 		return;
 	case HFP_CODEC_MSBC:
 		t->sco.spk_pcm.sampling = 16000;
 		t->sco.mic_pcm.sampling = 16000;
+		/* mSBC frame consists of 15 blocks with 8 sub-bands */
+		t->sco.spk_pcm.block_frames = 120;
+		t->sco.mic_pcm.block_frames = 120;
+		return;
+	case HFP_CODEC_LC3_SWB:
+		t->sco.spk_pcm.sampling = 32000;
+		t->sco.mic_pcm.sampling = 32000;
+		/* LC3-SWB frame covers 7.5 ms of audio */
+		t->sco.spk_pcm.block_frames = 240;
+		t->sco.mic_pcm.block_frames = 240;
 		return;
 	default:
 		debug("Unsupported SCO codec: %#x", t->type.codec);
@@ -1112,6 +1996,8 @@ static void ba_transport_set_codec_sco(struct ba_transport *t) {
 	case HFP_CODEC_UNDEFINED:
 		t->sco.spk_pcm.sampling = 0;
 		t->sco.mic_pcm.sampling = 0;
+		t->sco.spk_pcm.block_frames = 0;
+		t->sco.mic_pcm.block_frames = 0;
 	}
 
 }
@@ -1128,18 +2014,120 @@ void ba_transport_set_codec(
 	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO)
 		ba_transport_set_codec_sco(t);
 
+#if ENABLE_LE_AUDIO
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_BAP)
+		bap_lc3_transport_set_codec(t);
+#endif
+
+	/* Codec setup selects the native PCM format. Clients might choose
+	 * another one later, before opening the PCM. */
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP) {
+		t->a2dp.pcm.codec_format = t->a2dp.pcm.format;
+		t->a2dp.pcm.client_sampling = t->a2dp.pcm.sampling;
+		t->a2dp.pcm.client_channels = t->a2dp.pcm.channels;
+		t->a2dp.pcm_bc.codec_format = t->a2dp.pcm_bc.format;
+		t->a2dp.pcm_bc.client_sampling = t->a2dp.pcm_bc.sampling;
+		t->a2dp.pcm_bc.client_channels = t->a2dp.pcm_bc.channels;
+		/* monitor mirrors the stream in the codec format */
+		t->a2dp.pcm_monitor.format = t->a2dp.pcm.format;
+		t->a2dp.pcm_monitor.codec_format = t->a2dp.pcm.format;
+		t->a2dp.pcm_monitor.channels = t->a2dp.pcm.channels;
+		t->a2dp.pcm_monitor.sampling = t->a2dp.pcm.sampling;
+		t->a2dp.pcm_monitor.block_frames = t->a2dp.pcm.block_frames;
+		t->a2dp.pcm_monitor.client_sampling = t->a2dp.pcm.sampling;
+		t->a2dp.pcm_monitor.client_channels = t->a2dp.pcm.channels;
+	}
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO) {
+		t->sco.spk_pcm.codec_format = t->sco.spk_pcm.format;
+		t->sco.spk_pcm.client_sampling = t->sco.spk_pcm.sampling;
+		t->sco.spk_pcm.client_channels = t->sco.spk_pcm.channels;
+		t->sco.mic_pcm.codec_format = t->sco.mic_pcm.format;
+		t->sco.mic_pcm.client_sampling = t->sco.mic_pcm.sampling;
+		t->sco.mic_pcm.client_channels = t->sco.mic_pcm.channels;
+	}
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_BAP) {
+		t->bap.pcm.codec_format = t->bap.pcm.format;
+		t->bap.pcm.client_sampling = t->bap.pcm.sampling;
+		t->bap.pcm.client_channels = t->bap.pcm.channels;
+	}
+
+	/* Transport of the warm device is acquired as soon as its codec is
+	 * known, e.g. when the device has been reconnected. However, do not
+	 * bother if the codec has rejected the configuration. */
+	if (!(t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP &&
+				t->a2dp.pcm.channels == 0))
+		ba_device_warm_transport(t);
+
+}
+
+/**
+ * Release the offloaded SCO link upon its disconnection.
+ *
+ * In the offload mode there are no IO threads which would otherwise
+ * detect that the remote device has closed the link. */
+static gboolean transport_sco_offload_watch(GIOChannel *ch,
+		GIOCondition condition, void *userdata) {
+	(void)ch;
+	(void)condition;
+
+	struct ba_transport *t = userdata;
+
+	debug("Offloaded SCO link disconnected: %s", batostr_(&t->d->addr));
+
+	pthread_mutex_lock(&t->bt_fd_mtx);
+	t->sco.offload_watch_id = 0;
+	pthread_mutex_unlock(&t->bt_fd_mtx);
+
+	ba_transport_release(t);
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * Watch the offloaded SCO link for the remote disconnection. */
+static void transport_sco_offload_watch_add(struct ba_transport *t) {
+
+	pthread_mutex_lock(&t->bt_fd_mtx);
+
+	if (t->bt_fd != -1 && t->sco.offload_watch_id == 0) {
+		GIOChannel *ch = g_io_channel_unix_new(t->bt_fd);
+		t->sco.offload_watch_id = g_io_add_watch_full(ch, G_PRIORITY_DEFAULT,
+				G_IO_ERR | G_IO_HUP | G_IO_NVAL, transport_sco_offload_watch,
+				ba_transport_ref(t), (GDestroyNotify)ba_transport_unref);
+		g_io_channel_unref(ch);
+	}
+
+	pthread_mutex_unlock(&t->bt_fd_mtx);
+
+}
+
+/**
+ * Remove the offloaded SCO link watch.
+ *
+ * The caller shall hold the BT socket mutex. */
+static void transport_sco_offload_watch_remove(struct ba_transport *t) {
+	if (t->sco.offload_watch_id == 0)
+		return;
+	g_source_remove(t->sco.offload_watch_id);
+	t->sco.offload_watch_id = 0;
 }
 
 int ba_transport_start(struct ba_transport *t) {
 
+	/* Transport resumed after the silence suspension (or re-activated by
+	 * BlueZ) keeps its IO threads running, so there is nothing to do. */
 	if (!pthread_equal(t->thread_enc.id, config.main_thread) ||
 			!pthread_equal(t->thread_dec.id, config.main_thread)) {
-		errno = EEXIST;
-		return -1;
+		debug("Transport already started: %s", ba_transport_type_to_string(t->type));
+		return 0;
 	}
 
 	debug("Starting transport: %s", ba_transport_type_to_string(t->type));
 
+	/* audio for the member of the broadcast group is encoded by the leader */
+	if (t->type.profile == BA_TRANSPORT_PROFILE_A2DP_SOURCE &&
+			ba_transport_group_is_member(t))
+		return 0;
+
 	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP)
 		switch (t->type.codec) {
 		case A2DP_CODEC_SBC:
@@ -1154,6 +2142,7 @@ int ba_transport_start(struct ba_transport *t) {
 #endif
 #if ENABLE_APTX
 		case A2DP_CODEC_VENDOR_APTX:
+		case A2DP_CODEC_VENDOR_APTX_LL:
 			return a2dp_aptx_transport_start(t);
 #endif
 #if ENABLE_APTX_HD
@@ -1168,14 +2157,32 @@ int ba_transport_start(struct ba_transport *t) {
 		case A2DP_CODEC_VENDOR_LDAC:
 			return a2dp_ldac_transport_start(t);
 #endif
+		default:
+			if (codec_plugin_lookup(t->type.codec) != NULL)
+				return a2dp_plugin_transport_start(t);
 		}
 
 	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO) {
+		/* When SCO audio is routed to the hardware codec,
+		 * there is no audio data for us to process. */
+		if (t->d->a->sco_offload) {
+			debug("SCO audio offloaded: %s", batostr_(&t->d->addr));
+			transport_sco_offload_watch_add(t);
+			return 0;
+		}
+		if (config.sco.duplex)
+			return ba_transport_thread_create(&t->thread_enc, sco_duplex_thread, "ba-sco-io", true);
 		ba_transport_thread_create(&t->thread_enc, sco_enc_thread, "ba-sco-enc", true);
 		ba_transport_thread_create(&t->thread_dec, sco_dec_thread, "ba-sco-dec", false);
 		return 0;
 	}
 
+#if ENABLE_LE_AUDIO
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_BAP &&
+			t->type.codec == BAP_CODEC_LC3)
+		return bap_lc3_transport_start(t);
+#endif
+
 	errno = ENOTSUP;
 	return -1;
 }
@@ -1203,6 +2210,26 @@ int ba_transport_stop_if_no_clients(struct ba_transport *t) {
 	return 0;
 }
 
+/**
+ * Clamp write MTU of the group leader to the smallest MTU of members.
+ *
+ * Members with the smaller MTU are rejected when joining the group, but
+ * the leader might have been acquired after they joined. */
+static void transport_group_clamp_mtu(struct ba_transport *t) {
+
+	struct ba_transport_group *g = &t->a2dp.group;
+
+	pthread_mutex_lock(&g->mutex);
+	for (size_t i = 0; i < g->members_len; i++)
+		if (g->members[i].t->mtu_write < t->mtu_write) {
+			debug("Clamping group write MTU: %zu -> %zu",
+					t->mtu_write, g->members[i].t->mtu_write);
+			t->mtu_write = g->members[i].t->mtu_write;
+		}
+	pthread_mutex_unlock(&g->mutex);
+
+}
+
 int ba_transport_acquire(struct ba_transport *t) {
 
 	int fd = -1;
@@ -1223,7 +2250,9 @@ int ba_transport_acquire(struct ba_transport *t) {
 	}
 
 	/* Call transport specific acquire callback. */
-	fd = t->acquire(t);
+	if ((fd = t->acquire(t)) != -1 &&
+			t->type.profile == BA_TRANSPORT_PROFILE_A2DP_SOURCE)
+		transport_group_clamp_mtu(t);
 
 final:
 	pthread_mutex_unlock(&t->bt_fd_mtx);
@@ -1237,6 +2266,24 @@ final:
 	return fd;
 }
 
+static gboolean transport_acquire_dispatch(void *userdata) {
+	struct ba_transport *t = userdata;
+	if (ba_transport_acquire(t) == -1)
+		error("Couldn't acquire transport: %s", strerror(errno));
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * Schedule transport acquisition in the main loop.
+ *
+ * The acquire callback might block on the D-Bus call to BlueZ, so it
+ * shall not be called from the real-time IO thread. The caller shall
+ * poll for the BT socket to become valid. */
+void ba_transport_acquire_async(struct ba_transport *t) {
+	g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, transport_acquire_dispatch,
+			ba_transport_ref(t), (GDestroyNotify)ba_transport_unref);
+}
+
 int ba_transport_release(struct ba_transport *t) {
 
 	int ret = 0;
@@ -1249,6 +2296,9 @@ int ba_transport_release(struct ba_transport *t) {
 	if (t->bt_fd == -1)
 		goto final;
 
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO)
+		transport_sco_offload_watch_remove(t);
+
 	ret = t->release(t);
 
 final:
@@ -1271,123 +2321,840 @@ int ba_transport_set_a2dp_state(
 		return ba_transport_start(t);
 	case BLUEZ_A2DP_TRANSPORT_STATE_IDLE:
 	default:
+		/* Transport released due to the silence shall keep IO threads
+		 * running, so the streaming can be resumed by the PCM client. */
+		pthread_mutex_lock(&t->bt_fd_mtx);
+		bool silence_released = t->a2dp.silence_released;
+		t->a2dp.silence_released = false;
+		pthread_mutex_unlock(&t->bt_fd_mtx);
+		if (silence_released)
+			return 0;
 		return ba_transport_stop(t);
 	}
 }
 
-bool ba_transport_pcm_is_active(struct ba_transport_pcm *pcm) {
-	return pcm->fd != -1 && pcm->active;
+int ba_transport_set_bap_state(
+		struct ba_transport *t,
+		enum bluez_a2dp_transport_state state) {
+	switch (t->bap.state = state) {
+	case BLUEZ_A2DP_TRANSPORT_STATE_PENDING:
+		/* Just like with A2DP, the BAP source transport is acquired
+		 * by our controller during the PCM open request. */
+		if (t->type.profile == BA_TRANSPORT_PROFILE_BAP_SINK)
+			return ba_transport_acquire(t);
+		return 0;
+	case BLUEZ_A2DP_TRANSPORT_STATE_ACTIVE:
+		return ba_transport_start(t);
+	case BLUEZ_A2DP_TRANSPORT_STATE_IDLE:
+	default:
+		return ba_transport_stop(t);
+	}
 }
 
-int ba_transport_pcm_get_delay(const struct ba_transport_pcm *pcm) {
-	const struct ba_transport *t = pcm->t;
-	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP)
-		return t->a2dp.delay + pcm->delay;
-	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO)
-		return pcm->delay + 10;
-	return pcm->delay;
-}
+/**
+ * Add A2DP source transport to the broadcast group.
+ *
+ * The member transport is acquired right away and it does not run its own
+ * IO threads. Instead, RTP packets encoded by the group leader are written
+ * to the member BT socket as well. While in the group, PCM of the member
+ * can not be opened and neither the leader nor members can change codec.
+ *
+ * @param leader Transport which encodes the PCM stream.
+ * @param t Transport which shall join the group.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int ba_transport_group_join(
+		struct ba_transport *leader,
+		struct ba_transport *t) {
 
-unsigned int ba_transport_pcm_volume_level_to_bt(
-		const struct ba_transport_pcm *pcm,
-		int value) {
-	int volume = audio_decibel_to_loudness(value / 100.0) * pcm->max_bt_volume;
-	return MIN((unsigned int)MAX(volume, 0), pcm->max_bt_volume);
-}
+	struct ba_transport_group *g = &leader->a2dp.group;
+	int ret = -1;
+	int fd;
 
-int ba_transport_pcm_volume_bt_to_level(
-		const struct ba_transport_pcm *pcm,
-		unsigned int value) {
-	double level = audio_loudness_to_decibel(1.0 * value / pcm->max_bt_volume);
-	return MIN(MAX(level, -96.0), 96.0) * 100;
-}
+	if (leader->type.profile != BA_TRANSPORT_PROFILE_A2DP_SOURCE ||
+			t->type.profile != BA_TRANSPORT_PROFILE_A2DP_SOURCE)
+		return errno = ENOTSUP, -1;
 
-int ba_transport_pcm_volume_update(struct ba_transport_pcm *pcm) {
+	/* groups can not be nested */
+	if (leader == t ||
+			ba_transport_group_is_member(leader) ||
+			t->a2dp.group.members_len > 0)
+		return errno = EINVAL, -1;
 
-	const struct ba_transport *t = pcm->t;
+	/* RTP packets are not re-encoded for the member */
+	if (leader->type.codec != t->type.codec ||
+			memcmp(leader->a2dp.configuration, t->a2dp.configuration,
+				leader->a2dp.codec->capabilities_size) != 0)
+		return errno = EINVAL, -1;
 
-	/* In case of A2DP Source or HSP/HFP Audio Gateway skip notifying Bluetooth
-	 * device if we are using software volume control. This will prevent volume
-	 * double scaling - firstly by us and then by Bluetooth headset/speaker. */
-	if (pcm->soft_volume && t->type.profile & (
-				BA_TRANSPORT_PROFILE_A2DP_SOURCE | BA_TRANSPORT_PROFILE_MASK_AG))
-		goto final;
+	pthread_mutex_lock(&t->a2dp.pcm.mutex);
+	pthread_mutex_lock(&g->mutex);
 
-	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP) {
+	if (ba_transport_group_is_member(t) ||
+			t->a2dp.pcm.fd != -1 || t->a2dp.pcm.opening) {
+		errno = EBUSY;
+		goto fail;
+	}
 
-		int level = 0;
-		if (!pcm->volume[0].muted && !pcm->volume[1].muted)
-			level = (pcm->volume[0].level + pcm->volume[1].level) / 2;
+	if (g->members_len == ARRAYSIZE(g->members)) {
+		errno = ENOSPC;
+		goto fail;
+	}
 
-		GError *err = NULL;
-		unsigned int volume = ba_transport_pcm_volume_level_to_bt(pcm, level);
-		g_dbus_set_property(config.dbus, t->bluez_dbus_owner, t->bluez_dbus_path,
-				BLUEZ_IFACE_MEDIA_TRANSPORT, "Volume", g_variant_new_uint16(volume), &err);
+	g->members[g->members_len].t = ba_transport_ref(t);
+	g->members[g->members_len].bt_fd = -1;
+	g->members_len++;
+	t->a2dp.group_joined = g;
+	ret = 0;
 
-		if (err != NULL) {
-			warn("Couldn't set BT device volume: %s", err->message);
-			g_error_free(err);
-		}
+fail:
+	pthread_mutex_unlock(&g->mutex);
+	pthread_mutex_unlock(&t->a2dp.pcm.mutex);
+	if (ret == -1)
+		return -1;
+
+	/* stop IO threads which might be running in the keep-alive mode */
+	ba_transport_stop(t);
 
+	if ((fd = ba_transport_acquire(t)) == -1) {
+		const int err = errno;
+		ba_transport_group_leave(t);
+		return errno = err, -1;
 	}
-	else if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO &&
-			t->sco.rfcomm != NULL) {
-		/* notify associated RFCOMM transport */
-		ba_rfcomm_send_signal(t->sco.rfcomm, BA_RFCOMM_SIGNAL_UPDATE_VOLUME);
+
+	/* RTP packets are sized for the leader link, so they would not
+	 * fit into the member link with the smaller write MTU */
+	if (t->mtu_write < leader->mtu_write) {
+		debug("Member write MTU too small: %zu < %zu",
+				t->mtu_write, leader->mtu_write);
+		ba_transport_group_leave(t);
+		return errno = EMSGSIZE, -1;
 	}
 
-final:
-	/* notify connected clients (including requester) */
-	bluealsa_dbus_pcm_update(pcm, BA_DBUS_PCM_UPDATE_VOLUME);
-	return 0;
-}
+	pthread_mutex_lock(&g->mutex);
+	for (size_t i = 0; i < g->members_len; i++)
+		if (g->members[i].t == t &&
+				(g->members[i].bt_fd = dup(fd)) == -1)
+			warn("Couldn't duplicate BT socket [%d]: %s", fd, strerror(errno));
+	pthread_mutex_unlock(&g->mutex);
 
-int ba_transport_pcm_pause(struct ba_transport_pcm *pcm) {
-	pcm->active = false;
-	ba_transport_thread_signal_send(pcm->th, BA_TRANSPORT_THREAD_SIGNAL_PCM_PAUSE);
-	debug("PCM paused: %d", pcm->fd);
+	debug("New broadcast group member: %s: %s",
+			batostr_(&leader->d->addr), batostr_(&t->d->addr));
 	return 0;
 }
 
-int ba_transport_pcm_resume(struct ba_transport_pcm *pcm) {
-	pcm->active = true;
-	ba_transport_thread_signal_send(pcm->th, BA_TRANSPORT_THREAD_SIGNAL_PCM_RESUME);
-	debug("PCM resumed: %d", pcm->fd);
-	return 0;
-}
+/**
+ * Remove A2DP source transport from its broadcast group.
+ *
+ * @param t Transport which shall leave the group.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int ba_transport_group_leave(
+		struct ba_transport *t) {
 
-int ba_transport_pcm_drain(struct ba_transport_pcm *pcm) {
+	struct ba_transport_group *g;
+	size_t i;
+
+	if (t->type.profile != BA_TRANSPORT_PROFILE_A2DP_SOURCE ||
+			(g = t->a2dp.group_joined) == NULL)
+		return errno = ENOENT, -1;
+
+	pthread_mutex_lock(&g->mutex);
+	for (i = 0; i < g->members_len; i++)
+		if (g->members[i].t == t) {
+			if (g->members[i].bt_fd != -1)
+				close(g->members[i].bt_fd);
+			memmove(&g->members[i], &g->members[i + 1],
+					(g->members_len - i - 1) * sizeof(*g->members));
+			g->members_len--;
+			break;
+		}
+	pthread_mutex_unlock(&g->mutex);
 
-	if (pthread_equal(pcm->th->id, config.main_thread))
+	pthread_mutex_lock(&t->a2dp.pcm.mutex);
+	t->a2dp.group_joined = NULL;
+	pthread_mutex_unlock(&t->a2dp.pcm.mutex);
+
+	debug("Leaving broadcast group: %s: %s",
+			batostr_(&g->leader->d->addr), batostr_(&t->d->addr));
+
+	ba_transport_release(t);
+	ba_transport_unref(t);
+	return 0;
+}
+
+bool ba_transport_pcm_is_active(struct ba_transport_pcm *pcm) {
+	return pcm->fd != -1 && pcm->active;
+}
+
+/**
+ * Check whether given PCM is the monitor of the A2DP source PCM. */
+bool ba_transport_pcm_is_monitor(const struct ba_transport_pcm *pcm) {
+	const struct ba_transport *t = pcm->t;
+	return t->type.profile == BA_TRANSPORT_PROFILE_A2DP_SOURCE &&
+		pcm == &t->a2dp.pcm_monitor;
+}
+
+/**
+ * Get the overall PCM delay in 1/10 of millisecond.
+ *
+ * The delay is a sum of the encoding or decoding overhead, the algorithmic
+ * delay of the codec, the delay of the BT socket output queue, the jitter
+ * buffer delay, the resampler delay and the delay reported by the remote
+ * device (A2DP only). */
+int ba_transport_pcm_get_delay(const struct ba_transport_pcm *pcm) {
+	const struct ba_transport *t = pcm->t;
+	int delay = pcm->delay + pcm->codec_delay +
+		atomic_load_explicit(&pcm->queue_delay, memory_order_relaxed) +
+		atomic_load_explicit(&pcm->jitter.delay, memory_order_relaxed);
+	if (resampler_is_initialized(&pcm->resampler))
+		delay += resampler_get_delay(&pcm->resampler);
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP)
+		return t->a2dp.delay + delay;
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO)
+		return delay + 10;
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_BAP)
+		return t->bap.delay + delay;
+	return delay;
+}
+
+static void transport_pcm_counter_set(
+		struct ba_transport_pcm_counter *counter,
+		uint64_t value) {
+
+	struct timespec ts;
+	gettimestamp(&ts);
+
+	const unsigned int seq = atomic_load_explicit(&counter->seq, memory_order_relaxed);
+	atomic_store_explicit(&counter->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	counter->value = value;
+	counter->ts = ts;
+
+	atomic_store_explicit(&counter->seq, seq + 2, memory_order_release);
+
+}
+
+static void transport_pcm_counter_get(
+		const struct ba_transport_pcm_counter *counter,
+		uint64_t *value,
+		struct timespec *ts) {
+
+	unsigned int seq;
+
+	do {
+		/* wait for the writer to finish the update */
+		while ((seq = atomic_load_explicit(&counter->seq, memory_order_acquire)) & 1)
+			continue;
+		*value = counter->value;
+		*ts = counter->ts;
+		atomic_thread_fence(memory_order_acquire);
+	} while (seq != atomic_load_explicit(&counter->seq, memory_order_relaxed));
+
+}
+
+/**
+ * Advance PCM stream position.
+ *
+ * This function shall be called with the PCM mutex locked, so there is
+ * always only one writer of the position.
+ *
+ * @param pcm Pointer to the transport PCM structure.
+ * @param samples The number of samples transferred since the last update. */
+void ba_transport_pcm_position_update(
+		struct ba_transport_pcm *pcm,
+		uint64_t samples) {
+	transport_pcm_counter_set(&pcm->position, pcm->position.value + samples);
+}
+
+/**
+ * Reset PCM stream position.
+ *
+ * This function resets the presentation position as well. It shall be
+ * called with the PCM mutex locked. */
+void ba_transport_pcm_position_reset(
+		struct ba_transport_pcm *pcm) {
+	transport_pcm_counter_set(&pcm->position, 0);
+	transport_pcm_counter_set(&pcm->presentation, 0);
+}
+
+/**
+ * Get PCM stream position.
+ *
+ * This function never blocks, so it can be called without locking the PCM.
+ *
+ * @param pcm Pointer to the transport PCM structure.
+ * @param samples Address where the number of transferred samples shall be
+ *   stored.
+ * @param ts Address where the time of the last position update shall be
+ *   stored. */
+void ba_transport_pcm_position_get(
+		const struct ba_transport_pcm *pcm,
+		uint64_t *samples,
+		struct timespec *ts) {
+	transport_pcm_counter_get(&pcm->position, samples, ts);
+}
+
+/**
+ * Advance PCM presentation position.
+ *
+ * This function shall be called by the encoder thread right after the
+ * encoded frames have been written to the Bluetooth socket.
+ *
+ * @param pcm Pointer to the transport PCM structure.
+ * @param frames The number of frames written since the last update. */
+void ba_transport_pcm_presentation_update(
+		struct ba_transport_pcm *pcm,
+		uint64_t frames) {
+	transport_pcm_counter_set(&pcm->presentation, pcm->presentation.value + frames);
+}
+
+/**
+ * Get PCM presentation position.
+ *
+ * @param pcm Pointer to the transport PCM structure.
+ * @param frames Address where the number of frames (at the codec sampling)
+ *   written to the Bluetooth socket shall be stored.
+ * @param ts Address where the time of the last write shall be stored. */
+void ba_transport_pcm_presentation_get(
+		const struct ba_transport_pcm *pcm,
+		uint64_t *frames,
+		struct timespec *ts) {
+	transport_pcm_counter_get(&pcm->presentation, frames, ts);
+}
+
+/**
+ * Get the compressed stream format supported by the PCM.
+ *
+ * @return This function returns the compressed format identifier or 0 if
+ *   the PCM does not support the compressed stream. */
+static uint16_t transport_pcm_get_compressed_format(
+		const struct ba_transport_pcm *pcm) {
+
+	const struct ba_transport *t = pcm->t;
+
+	if (t->type.profile != BA_TRANSPORT_PROFILE_A2DP_SOURCE ||
+			(pcm != &t->a2dp.pcm && pcm != &t->a2dp.pcm_monitor))
+		return 0;
+
+	switch (t->type.codec) {
+#if ENABLE_MPEG
+	case A2DP_CODEC_MPEG12:
+		return BA_TRANSPORT_PCM_FORMAT_MPEG;
+#endif
+#if ENABLE_AAC
+	case A2DP_CODEC_MPEG24:
+		return BA_TRANSPORT_PCM_FORMAT_AAC_LOAS;
+#endif
+	default:
+		return 0;
+	}
+
+}
+
+/**
+ * Get PCM stream formats available for clients.
+ *
+ * The first format is always the one used by the codec. All other formats
+ * are converted to (or from) the codec format by the IO thread. For high
+ * resolution codecs, the packed S24_3LE format is available too. For the
+ * A2DP source playback PCM, the compressed format of the codec might be
+ * offered as well, in which case the client provides encoded frames.
+ *
+ * @param pcm Pointer to the transport PCM structure.
+ * @param formats Address of the array where formats shall be stored.
+ * @param size The number of elements in the formats array.
+ * @return This function returns the number of stored formats. */
+size_t ba_transport_pcm_get_formats(
+		const struct ba_transport_pcm *pcm,
+		uint16_t *formats,
+		size_t size) {
+
+	static const uint16_t convertible[] = {
+		BA_TRANSPORT_PCM_FORMAT_S16_2LE,
+		BA_TRANSPORT_PCM_FORMAT_S24_4LE,
+		BA_TRANSPORT_PCM_FORMAT_S32_4LE,
+	};
+
+	const uint16_t native = pcm->codec_format;
+	bool convert = false;
+	size_t i, n = 0;
+
+	if (n < size)
+		formats[n++] = native;
+
+	for (i = 0; i < ARRAYSIZE(convertible); i++)
+		if (convertible[i] == native)
+			convert = true;
+
+	if (convert)
+		for (i = 0; i < ARRAYSIZE(convertible) && n < size; i++)
+			if (convertible[i] != native)
+				formats[n++] = convertible[i];
+
+	/* Packed 24-bit format is offered only for codecs with high resolution
+	 * signal, so the client does not have to convert it on its own. */
+	if (BA_TRANSPORT_PCM_FORMAT_BYTES(native) == 4 && n < size)
+		formats[n++] = BA_TRANSPORT_PCM_FORMAT_S24_3LE;
+
+	const uint16_t compressed = transport_pcm_get_compressed_format(pcm);
+	if (compressed != 0 && n < size)
+		formats[n++] = compressed;
+
+	return n;
+}
+
+/**
+ * Select PCM stream format used by the client.
+ *
+ * The format can be changed only when the PCM is not opened.
+ *
+ * @param pcm Pointer to the transport PCM structure.
+ * @param format The 16-bit stream format identifier.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int ba_transport_pcm_set_format(
+		struct ba_transport_pcm *pcm,
+		uint16_t format) {
+
+	uint16_t formats[5];
+	size_t i, n = ba_transport_pcm_get_formats(pcm, formats, ARRAYSIZE(formats));
+
+	for (i = 0; i < n; i++)
+		if (formats[i] == format)
+			break;
+	if (i == n)
+		return errno = EINVAL, -1;
+
+	/* compressed stream can not be down-mixed nor up-mixed */
+	if (BA_TRANSPORT_PCM_FORMAT_IS_COMPRESSED(format) &&
+			pcm->client_channels != pcm->channels)
+		return errno = EINVAL, -1;
+
+	pthread_mutex_lock(&pcm->mutex);
+
+	if (pcm->fd != -1 || pcm->opening) {
+		pthread_mutex_unlock(&pcm->mutex);
+		return errno = EBUSY, -1;
+	}
+
+	const bool changed = pcm->format != format;
+	const bool restart = changed && !ba_transport_pcm_is_monitor(pcm) &&
+		BA_TRANSPORT_PCM_FORMAT_IS_COMPRESSED(pcm->format) !=
+		BA_TRANSPORT_PCM_FORMAT_IS_COMPRESSED(format);
+	pcm->format = format;
+
+	pthread_mutex_unlock(&pcm->mutex);
+
+	/* The compressed stream is handled by a different IO thread than the
+	 * PCM one, so the running thread (e.g. in the keep-alive mode) has to
+	 * be replaced. The PCM is not opened, so no client is disturbed. */
+	struct ba_transport *t = pcm->t;
+	if (restart && !pthread_equal(t->thread_enc.id, config.main_thread)) {
+		ba_transport_stop(t);
+		if (t->a2dp.state == BLUEZ_A2DP_TRANSPORT_STATE_ACTIVE)
+			ba_transport_start(t);
+	}
+
+	if (changed)
+		bluealsa_dbus_pcm_update(pcm, BA_DBUS_PCM_UPDATE_FORMAT);
+
+	return 0;
+}
+
+/**
+ * Get PCM sampling frequencies available for clients.
+ *
+ * The first sampling is always the one used by the codec. Other samplings
+ * are offered only for playback PCMs and only if the resampler is enabled.
+ *
+ * @param pcm Pointer to the transport PCM structure.
+ * @param samplings Address of the array where samplings shall be stored.
+ * @param size The number of elements in the samplings array.
+ * @return This function returns the number of stored samplings. */
+size_t ba_transport_pcm_get_samplings(
+		const struct ba_transport_pcm *pcm,
+		uint32_t *samplings,
+		size_t size) {
+
+	static const unsigned int resampled[] = {
+		8000, 16000, 22050, 24000, 32000, 44100, 48000, 88200, 96000 };
+
+	const unsigned int native = pcm->sampling;
+	size_t i, n = 0;
+
+	if (n < size)
+		samplings[n++] = native;
+
+	if (pcm->mode != BA_TRANSPORT_PCM_MODE_SINK ||
+			config.resampler_quality == RESAMPLER_QUALITY_NONE ||
+			native == 0)
+		return n;
+
+	for (i = 0; i < ARRAYSIZE(resampled) && n < size; i++)
+		if (resampled[i] != native)
+			samplings[n++] = resampled[i];
+
+	return n;
+}
+
+/**
+ * Select PCM sampling frequency used by the client.
+ *
+ * The sampling can be changed only when the PCM is not opened.
+ *
+ * @param pcm Pointer to the transport PCM structure.
+ * @param sampling The sampling frequency in Hz.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int ba_transport_pcm_set_sampling(
+		struct ba_transport_pcm *pcm,
+		unsigned int sampling) {
+
+	uint32_t samplings[16];
+	size_t i, n = ba_transport_pcm_get_samplings(pcm, samplings, ARRAYSIZE(samplings));
+
+	for (i = 0; i < n; i++)
+		if (samplings[i] == sampling)
+			break;
+	if (i == n)
+		return errno = EINVAL, -1;
+
+	pthread_mutex_lock(&pcm->mutex);
+
+	if (pcm->fd != -1 || pcm->opening) {
+		pthread_mutex_unlock(&pcm->mutex);
+		return errno = EBUSY, -1;
+	}
+
+	const bool changed = pcm->client_sampling != sampling;
+	pcm->client_sampling = sampling;
+
+	pthread_mutex_unlock(&pcm->mutex);
+
+	if (changed)
+		bluealsa_dbus_pcm_update(pcm, BA_DBUS_PCM_UPDATE_SAMPLING);
+
+	return 0;
+}
+
+/**
+ * Select the number of PCM channels used by the client.
+ *
+ * Mono and stereo transports accept both mono and stereo clients, the
+ * signal is down-mixed or up-mixed by the IO thread. The number of
+ * channels can be changed only when the PCM is not opened.
+ *
+ * @param pcm Pointer to the transport PCM structure.
+ * @param channels The number of channels.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int ba_transport_pcm_set_channels(
+		struct ba_transport_pcm *pcm,
+		unsigned int channels) {
+
+	if (channels != pcm->channels &&
+			(pcm->channels > 2 || channels < 1 || channels > 2 ||
+			 BA_TRANSPORT_PCM_FORMAT_IS_COMPRESSED(pcm->format)))
+		return errno = EINVAL, -1;
+
+	pthread_mutex_lock(&pcm->mutex);
+
+	if (pcm->fd != -1 || pcm->opening) {
+		pthread_mutex_unlock(&pcm->mutex);
+		return errno = EBUSY, -1;
+	}
+
+	const bool changed = pcm->client_channels != channels;
+	pcm->client_channels = channels;
+
+	pthread_mutex_unlock(&pcm->mutex);
+
+	if (changed)
+		bluealsa_dbus_pcm_update(pcm, BA_DBUS_PCM_UPDATE_CHANNELS);
+
+	return 0;
+}
+
+/**
+ * Swap left and right channels of the stereo PCM signal.
+ *
+ * The swap is applied when both the client and the codec stream are
+ * stereo. It can be changed at any time. */
+int ba_transport_pcm_set_swap_channels(
+		struct ba_transport_pcm *pcm,
+		bool swap) {
+
+	pthread_mutex_lock(&pcm->mutex);
+	pcm->swap_channels = swap;
+	pthread_mutex_unlock(&pcm->mutex);
+
+	return 0;
+}
+
+static const char *transport_pcm_overrun_names[] = {
+	[BA_TRANSPORT_PCM_OVERRUN_BLOCK] = "block",
+	[BA_TRANSPORT_PCM_OVERRUN_DROP_NEWEST] = "drop-newest",
+	[BA_TRANSPORT_PCM_OVERRUN_DROP_OLDEST] = "drop-oldest",
+};
+
+/**
+ * Get the name of the PCM overrun policy. */
+const char *ba_transport_pcm_overrun_to_string(
+		enum ba_transport_pcm_overrun overrun) {
+	if ((size_t)overrun >= ARRAYSIZE(transport_pcm_overrun_names))
+		return NULL;
+	return transport_pcm_overrun_names[overrun];
+}
+
+/**
+ * Get the PCM overrun policy by its name.
+ *
+ * @param name The name of the policy (case insensitive).
+ * @param overrun Address where the policy will be stored.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int ba_transport_pcm_overrun_from_string(
+		const char *name,
+		enum ba_transport_pcm_overrun *overrun) {
+
+	size_t i;
+	for (i = 0; i < ARRAYSIZE(transport_pcm_overrun_names); i++)
+		if (strcasecmp(name, transport_pcm_overrun_names[i]) == 0) {
+			*overrun = i;
+			return 0;
+		}
+
+	return errno = EINVAL, -1;
+}
+
+/**
+ * Select the policy applied when the PCM client does not keep up.
+ *
+ * The policy can be changed at any time. Data which are already kept in
+ * the backlog buffer will be written to the FIFO before new data.
+ *
+ * @param pcm Pointer to the transport PCM structure.
+ * @param overrun The overrun policy.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int ba_transport_pcm_set_overrun(
+		struct ba_transport_pcm *pcm,
+		enum ba_transport_pcm_overrun overrun) {
+
+	if (ba_transport_pcm_overrun_to_string(overrun) == NULL)
+		return errno = EINVAL, -1;
+
+	/* monitor client shall never stall the encoder thread */
+	if (overrun == BA_TRANSPORT_PCM_OVERRUN_BLOCK &&
+			ba_transport_pcm_is_monitor(pcm))
+		return errno = EINVAL, -1;
+
+	pthread_mutex_lock(&pcm->mutex);
+	pcm->overrun = overrun;
+	pthread_mutex_unlock(&pcm->mutex);
+
+	return 0;
+}
+
+unsigned int ba_transport_pcm_volume_level_to_bt(
+		const struct ba_transport_pcm *pcm,
+		int value) {
+	int volume = audio_decibel_to_loudness(value / 100.0) * pcm->max_bt_volume;
+	return MIN((unsigned int)MAX(volume, 0), pcm->max_bt_volume);
+}
+
+int ba_transport_pcm_volume_bt_to_level(
+		const struct ba_transport_pcm *pcm,
+		unsigned int value) {
+	double level = audio_loudness_to_decibel(1.0 * value / pcm->max_bt_volume);
+	return MIN(MAX(level, -96.0), 96.0) * 100;
+}
+
+int ba_transport_pcm_volume_update(struct ba_transport_pcm *pcm) {
+
+	const struct ba_transport *t = pcm->t;
+
+	/* In case of A2DP Source or HSP/HFP Audio Gateway skip notifying Bluetooth
+	 * device if we are using software volume control. This will prevent volume
+	 * double scaling - firstly by us and then by Bluetooth headset/speaker.
+	 * The volume of the monitor PCM never reaches the Bluetooth device. */
+	if ((pcm->soft_volume && t->type.profile & (
+				BA_TRANSPORT_PROFILE_A2DP_SOURCE | BA_TRANSPORT_PROFILE_MASK_AG)) ||
+			ba_transport_pcm_is_monitor(pcm))
+		goto final;
+
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP) {
+
+		int level = 0;
+		if (!pcm->volume[0].muted && !pcm->volume[1].muted)
+			level = (pcm->volume[0].level + pcm->volume[1].level) / 2;
+
+		GError *err = NULL;
+		unsigned int volume = ba_transport_pcm_volume_level_to_bt(pcm, level);
+		g_dbus_set_property(config.dbus, t->bluez_dbus_owner, t->bluez_dbus_path,
+				BLUEZ_IFACE_MEDIA_TRANSPORT, "Volume", g_variant_new_uint16(volume), &err);
+
+		if (err != NULL) {
+			warn("Couldn't set BT device volume: %s", err->message);
+			g_error_free(err);
+		}
+
+	}
+	else if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO &&
+			t->sco.rfcomm != NULL) {
+		/* notify associated RFCOMM transport */
+		ba_rfcomm_send_signal(t->sco.rfcomm, BA_RFCOMM_SIGNAL_UPDATE_VOLUME);
+	}
+
+final:
+	/* notify connected clients (including requester) */
+	bluealsa_dbus_pcm_update(pcm, BA_DBUS_PCM_UPDATE_VOLUME);
+	return 0;
+}
+
+int ba_transport_pcm_pause(struct ba_transport_pcm *pcm) {
+	pcm->active = false;
+	/* the monitor is not serviced by the IO thread on its own */
+	if (!ba_transport_pcm_is_monitor(pcm))
+		ba_transport_thread_signal_send_pcm(pcm->th, BA_TRANSPORT_THREAD_SIGNAL_PCM_PAUSE, pcm);
+	debug("PCM paused: %d", pcm->fd);
+	return 0;
+}
+
+int ba_transport_pcm_resume(struct ba_transport_pcm *pcm) {
+	pcm->active = true;
+	if (!ba_transport_pcm_is_monitor(pcm))
+		ba_transport_thread_signal_send_pcm(pcm->th, BA_TRANSPORT_THREAD_SIGNAL_PCM_RESUME, pcm);
+	debug("PCM resumed: %d", pcm->fd);
+	return 0;
+}
+
+/**
+ * Drain PCM stream.
+ *
+ * The drain is completed by the IO thread when all the data from the PCM
+ * FIFO has been encoded, the encoder has been flushed and the BT socket
+ * output queue has been emptied.
+ *
+ * @param pcm Pointer to the transport PCM structure.
+ * @param cb Optional callback function called when the drain has been
+ *   completed. If it is NULL, this function blocks until completion.
+ * @param userdata Data passed to the callback function.
+ * @return On success this function returns 0. If the IO thread is not
+ *   running (so there is nothing to drain), -1 is returned and errno is
+ *   set to ESRCH. If the drain is already in progress, errno is set to
+ *   EBUSY. In such cases the callback function is not called. */
+int ba_transport_pcm_drain(struct ba_transport_pcm *pcm,
+		ba_transport_pcm_drain_cb *cb, void *userdata) {
+
+	struct ba_transport_thread *th = pcm->th;
+
+	/* The IO thread completes all pending drain requests after it has
+	 * entered the NONE state, so checking the state and registering the
+	 * request has to be done atomically. */
+	pthread_mutex_lock(&th->mutex);
+	if (th->state == BA_TRANSPORT_THREAD_STATE_NONE) {
+		pthread_mutex_unlock(&th->mutex);
 		return errno = ESRCH, -1;
+	}
 
 	pthread_mutex_lock(&pcm->synced_mtx);
+	pthread_mutex_unlock(&th->mutex);
+
+	if (pcm->drain_pending) {
+		pthread_mutex_unlock(&pcm->synced_mtx);
+		return errno = EBUSY, -1;
+	}
 
-	ba_transport_thread_signal_send(pcm->th, BA_TRANSPORT_THREAD_SIGNAL_PCM_SYNC);
-	pthread_cond_wait(&pcm->synced, &pcm->synced_mtx);
+	pcm->drain_pending = true;
+	pcm->drain_cb = cb;
+	pcm->drain_cb_data = userdata;
+
+	ba_transport_thread_signal_send_pcm(th, BA_TRANSPORT_THREAD_SIGNAL_PCM_SYNC, pcm);
+
+	if (cb == NULL)
+		while (pcm->drain_pending)
+			pthread_cond_wait(&pcm->synced, &pcm->synced_mtx);
 
 	pthread_mutex_unlock(&pcm->synced_mtx);
 
-	/* TODO: Asynchronous transport release.
-	 *
-	 * Unfortunately, BlueZ does not provide API for internal buffer drain.
-	 * Also, there is no specification for Bluetooth playback drain. In order
-	 * to make sure, that all samples are played out, we have to wait some
-	 * arbitrary time before releasing transport. In order to make it right,
-	 * there is a requirement for an asynchronous release mechanism, which
-	 * is not implemented - it requires a little bit of refactoring. */
-	usleep(200000);
+	return 0;
+}
+
+/**
+ * Notify the drain waiter that the PCM has been drained.
+ *
+ * This function shall be called by the IO thread. It is a no-op if there
+ * is no pending drain request. */
+void ba_transport_pcm_drain_complete(struct ba_transport_pcm *pcm) {
+
+	pthread_mutex_lock(&pcm->synced_mtx);
+
+	const bool pending = pcm->drain_pending;
+	ba_transport_pcm_drain_cb *cb = pcm->drain_cb;
+	void *userdata = pcm->drain_cb_data;
+
+	pcm->drain_pending = false;
+	pcm->drain_cb = NULL;
+	pcm->drain_cb_data = NULL;
+	pthread_cond_broadcast(&pcm->synced);
+
+	pthread_mutex_unlock(&pcm->synced_mtx);
+
+	if (!pending)
+		return;
 
 	debug("PCM drained: %d", pcm->fd);
-	return 0;
+	if (cb != NULL)
+		cb(pcm, userdata);
+
 }
 
 int ba_transport_pcm_drop(struct ba_transport_pcm *pcm) {
-	ba_transport_thread_signal_send(&pcm->t->thread_enc, BA_TRANSPORT_THREAD_SIGNAL_PCM_DROP);
+	ba_transport_thread_signal_send_pcm(&pcm->t->thread_enc, BA_TRANSPORT_THREAD_SIGNAL_PCM_DROP, pcm);
 	debug("PCM dropped: %d", pcm->fd);
 	return 0;
 }
 
+/**
+ * Close the PCM stream of the client which has opened the PCM. */
+static void transport_pcm_close_stream(struct ba_transport_pcm *pcm) {
+
+	if (pcm->fd == -1)
+		return;
+
+	debug("Closing PCM: %d", pcm->fd);
+
+	if (shm_ring_is_mapped(&pcm->shm)) {
+		/* The fd field is owned by the shared memory ring. */
+		shm_ring_close(&pcm->shm);
+		shm_ring_free(&pcm->shm);
+		close(pcm->shm_ctrl_fd);
+		pcm->shm_ctrl_fd = -1;
+	}
+	else
+		close(pcm->fd);
+
+	pcm->fd = -1;
+	resampler_free(&pcm->resampler);
+
+	/* Data buffered for the closed client are useless. The buffer will be
+	 * allocated again (with the size for the current format) on demand. */
+	ffb_free(&pcm->overrun_backlog);
+	pcm->overrun_frame_offset = 0;
+	pcm->read_tail_len = 0;
+
+}
+
+/**
+ * Release the PCM of all connected clients.
+ *
+ * Controller channels of the mixed clients are not closed, they will be
+ * removed by the main loop when clients hang up.
+ *
+ * This function shall be called with the PCM mutex locked. */
 int ba_transport_pcm_release(struct ba_transport_pcm *pcm) {
 
 #if DEBUG
@@ -1396,17 +3163,116 @@ int ba_transport_pcm_release(struct ba_transport_pcm *pcm) {
 		g_assert_cmpint(pthread_mutex_trylock(&pcm->mutex), !=, 0);
 #endif
 
-	if (pcm->fd == -1)
-		goto final;
+	size_t i;
+	for (i = 0; i < pcm->mix_clients_len; i++)
+		if (pcm->mix_clients[i].fd != -1) {
+			debug("Closing mixed PCM client: %d", pcm->mix_clients[i].fd);
+			close(pcm->mix_clients[i].fd);
+			pcm->mix_clients[i].fd = -1;
+		}
 
-	debug("Closing PCM: %d", pcm->fd);
-	close(pcm->fd);
-	pcm->fd = -1;
+	transport_pcm_close_stream(pcm);
+	return 0;
+}
 
-final:
+/**
+ * Release the PCM of the client which has opened it as the first one.
+ *
+ * If there are other clients mixed into the PCM stream, the first of them
+ * takes over the PCM, so the stream will not be interrupted. Otherwise,
+ * the PCM is released.
+ *
+ * This function shall be called with the PCM mutex locked. */
+int ba_transport_pcm_release_client(struct ba_transport_pcm *pcm) {
+
+	size_t i;
+	for (i = 0; i < pcm->mix_clients_len; i++)
+		if (pcm->mix_clients[i].fd != -1)
+			break;
+
+	if (i == pcm->mix_clients_len)
+		return ba_transport_pcm_release(pcm);
+
+	transport_pcm_close_stream(pcm);
+
+	struct ba_transport_pcm_mix_client *c = &pcm->mix_clients[i];
+	debug("Promoting mixed PCM client: %d", c->fd);
+
+	pcm->fd = c->fd;
+	pcm->active = !c->paused;
+	pcm->ba_dbus_ctrl_source = c->ctrl_source;
+	pcm->ba_dbus_ctrl_fd = c->ctrl_fd;
+
+	memmove(c, c + 1, (--pcm->mix_clients_len - i) * sizeof(*c));
 	return 0;
 }
 
+/**
+ * Apply the scheduling policy and run the transport thread routine. */
+static void *ba_transport_thread_routine(struct ba_transport_thread *th) {
+
+	const struct sched_policy *policy = &config.sco.sched;
+	if (th->t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP)
+		policy = &config.a2dp.sched;
+
+	if (sched_policy_apply(policy) == -1)
+		warn("Couldn't apply IO thread scheduling policy: %s", strerror(errno));
+
+	pthread_mutex_lock(&th->mutex);
+	if (sched_policy_get(&th->sched) == -1)
+		th->sched = *policy;
+	pthread_mutex_unlock(&th->mutex);
+
+	return th->routine(th);
+}
+
+/**
+ * Reset transport thread IO statistics. */
+void ba_transport_thread_stats_reset(
+		struct ba_transport_thread *th) {
+
+	struct ba_transport_thread_stats *stats = &th->stats;
+
+	atomic_store_explicit(&stats->tx_packets, 0, memory_order_relaxed);
+	atomic_store_explicit(&stats->tx_bytes, 0, memory_order_relaxed);
+	atomic_store_explicit(&stats->rx_packets, 0, memory_order_relaxed);
+	atomic_store_explicit(&stats->rx_bytes, 0, memory_order_relaxed);
+	for (size_t i = 0; i < ARRAYSIZE(stats->busy_hist); i++)
+		atomic_store_explicit(&stats->busy_hist[i], 0, memory_order_relaxed);
+	atomic_store_explicit(&stats->overdue, 0, memory_order_relaxed);
+	atomic_store_explicit(&stats->underruns, 0, memory_order_relaxed);
+	atomic_store_explicit(&stats->overruns, 0, memory_order_relaxed);
+	atomic_store_explicit(&stats->rtp_lost, 0, memory_order_relaxed);
+	atomic_store_explicit(&stats->congestion_drops, 0, memory_order_relaxed);
+	atomic_store_explicit(&stats->rx_overflows, 0, memory_order_relaxed);
+	atomic_store_explicit(&stats->overrun_drops, 0, memory_order_relaxed);
+
+}
+
+/**
+ * Add processing time sample to the transport thread IO statistics.
+ *
+ * @param th Pointer to the transport thread structure.
+ * @param ts Time spent on processing data between consecutive transfers. */
+void ba_transport_thread_stats_add_busy(
+		struct ba_transport_thread *th,
+		const struct timespec *ts) {
+
+	static const unsigned int bins[] = BA_TRANSPORT_THREAD_STATS_BUSY_BINS;
+	size_t i = 0;
+
+	if (ts->tv_sec > 0)
+		i = ARRAYSIZE(bins);
+	else if (ts->tv_sec == 0) {
+		const unsigned int msec = ts->tv_nsec / 1000000;
+		while (i < ARRAYSIZE(bins) && msec >= bins[i])
+			i++;
+	}
+
+	ba_transport_thread_stats_add(th, busy_hist[i], 1);
+
+}
+
 /**
  * Create transport thread. */
 int ba_transport_thread_create(
@@ -1418,7 +3284,15 @@ int ba_transport_thread_create(
 	struct ba_transport *t = th->t;
 	int ret;
 
+	if (transport_thread_open(th) == -1) {
+		error("Couldn't open transport thread: %s", strerror(errno));
+		return -1;
+	}
+
 	th->master = master;
+	th->routine = routine;
+	ba_transport_thread_stats_reset(th);
+	transport_thread_capture_open(th, name);
 
 	/* Please note, this call here does not guarantee that the BT socket
 	 * will be acquired, because transport might not be opened yet. */
@@ -1426,12 +3300,15 @@ int ba_transport_thread_create(
 		return -1;
 
 	ba_transport_ref(t);
+	metrics_thread_register(th, name);
 
 	ba_transport_thread_set_state_starting(th);
-	if ((ret = pthread_create(&th->id, NULL, PTHREAD_ROUTINE(routine), th)) != 0) {
+	if ((ret = pthread_create(&th->id, NULL,
+					PTHREAD_ROUTINE(ba_transport_thread_routine), th)) != 0) {
 		error("Couldn't create transport thread: %s", strerror(ret));
 		ba_transport_thread_set_state(th, BA_TRANSPORT_THREAD_STATE_NONE, true);
 		th->id = config.main_thread;
+		metrics_thread_unregister(th);
 		ba_transport_unref(t);
 		return -1;
 	}
@@ -1457,6 +3334,13 @@ void ba_transport_thread_cleanup(struct ba_transport_thread *th) {
 	if (th->master)
 		ba_transport_release(t);
 
+	unsigned int dropped;
+	if (bt_capture_is_open(&th->capture) &&
+			(dropped = atomic_load_explicit(&th->capture.dropped, memory_order_relaxed)) > 0)
+		warn("BT capture overrun: Dropped packets: %u", dropped);
+	bt_capture_close(&th->capture);
+	metrics_thread_unregister(th);
+
 #if DEBUG
 	/* XXX: If the order of the cleanup push is right, this function will
 	 *      indicate the end of the transport IO thread. */
@@ -1468,6 +3352,25 @@ void ba_transport_thread_cleanup(struct ba_transport_thread *th) {
 	/* Reset transport IO thread state back to NONE. */
 	ba_transport_thread_set_state(th, BA_TRANSPORT_THREAD_STATE_NONE, true);
 
+	/* Do not leave drain waiters hanging, there is no one
+	 * who could complete their requests anymore. */
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP) {
+		if (t->a2dp.pcm.th == th)
+			ba_transport_pcm_drain_complete(&t->a2dp.pcm);
+		if (t->a2dp.pcm_bc.th == th)
+			ba_transport_pcm_drain_complete(&t->a2dp.pcm_bc);
+	}
+	else if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO) {
+		if (t->sco.spk_pcm.th == th)
+			ba_transport_pcm_drain_complete(&t->sco.spk_pcm);
+		if (t->sco.mic_pcm.th == th)
+			ba_transport_pcm_drain_complete(&t->sco.mic_pcm);
+	}
+	else if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_BAP) {
+		if (t->bap.pcm.th == th)
+			ba_transport_pcm_drain_complete(&t->bap.pcm);
+	}
+
 	/* Remove reference which was taken by the ba_transport_thread_create(). */
 	ba_transport_unref(t);
 }
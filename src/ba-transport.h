@@ -17,14 +17,27 @@
 #endif
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <time.h>
 
 #include "a2dp.h"
 #include "ba-device.h"
 #include "ba-rfcomm.h"
+#include "bap.h"
 #include "bluez.h"
+#include "bt-capture.h"
+#if ENABLE_IO_URING
+# include "bt-uring.h"
+#endif
+#include "jitter.h"
+#include "pcm-overrun.h"
+#include "resampler.h"
+#include "sched-policy.h"
+#include "shared/ffb.h"
+#include "shared/shm.h"
 
 #define BA_TRANSPORT_PROFILE_NONE        (0)
 #define BA_TRANSPORT_PROFILE_A2DP_SOURCE (1 << 0)
@@ -33,6 +46,8 @@
 #define BA_TRANSPORT_PROFILE_HFP_AG      (2 << 2)
 #define BA_TRANSPORT_PROFILE_HSP_HS      (1 << 4)
 #define BA_TRANSPORT_PROFILE_HSP_AG      (2 << 4)
+#define BA_TRANSPORT_PROFILE_BAP_SOURCE  (1 << 6)
+#define BA_TRANSPORT_PROFILE_BAP_SINK    (2 << 6)
 
 #define BA_TRANSPORT_PROFILE_MASK_A2DP \
 	(BA_TRANSPORT_PROFILE_A2DP_SOURCE | BA_TRANSPORT_PROFILE_A2DP_SINK)
@@ -46,6 +61,8 @@
 	(BA_TRANSPORT_PROFILE_HSP_AG | BA_TRANSPORT_PROFILE_HFP_AG)
 #define BA_TRANSPORT_PROFILE_MASK_HF \
 	(BA_TRANSPORT_PROFILE_HSP_HS | BA_TRANSPORT_PROFILE_HFP_HF)
+#define BA_TRANSPORT_PROFILE_MASK_BAP \
+	(BA_TRANSPORT_PROFILE_BAP_SOURCE | BA_TRANSPORT_PROFILE_BAP_SINK)
 
 /**
  * Selected profile and audio codec.
@@ -80,6 +97,54 @@ enum ba_transport_pcm_mode {
 #define BA_TRANSPORT_PCM_FORMAT_S24_4LE BA_TRANSPORT_PCM_FORMAT(1, 24, 4, 0)
 #define BA_TRANSPORT_PCM_FORMAT_S32_4LE BA_TRANSPORT_PCM_FORMAT(1, 32, 4, 0)
 
+/**
+ * Compressed stream formats have the zero bit-width. The stream consists
+ * of complete codec frames, which are passed to the codec packetizer with
+ * no decoding nor encoding. For such formats, the byte is a "sample". */
+#define BA_TRANSPORT_PCM_FORMAT_MPEG     BA_TRANSPORT_PCM_FORMAT(0, 0, 1, 0)
+#define BA_TRANSPORT_PCM_FORMAT_AAC_LOAS BA_TRANSPORT_PCM_FORMAT(0, 0, 1, 1)
+
+#define BA_TRANSPORT_PCM_FORMAT_IS_COMPRESSED(format) \
+	(BA_TRANSPORT_PCM_FORMAT_WIDTH(format) == 0)
+
+/**
+ * Stream counter with the time of the last update. It is published by the
+ * IO thread with the sequence lock, so readers will never block the IO
+ * thread. */
+struct ba_transport_pcm_counter {
+	atomic_uint seq;
+	uint64_t value;
+	struct timespec ts;
+};
+
+/**
+ * The maximal number of additional clients mixed into the PCM stream. */
+#define BA_TRANSPORT_PCM_MIX_CLIENTS_MAX 7
+
+/**
+ * Additional PCM client whose stream is mixed by the IO thread into the
+ * stream of the client which has opened the PCM as the first one. */
+struct ba_transport_pcm_mix_client {
+	/* FIFO file descriptor */
+	int fd;
+	/* PCM controller channel watch */
+	unsigned int ctrl_source;
+	int ctrl_fd;
+	/* client stream is paused */
+	bool paused;
+	/* incomplete PCM frame read from the FIFO */
+	uint8_t tail[2 * sizeof(int32_t)];
+	size_t tail_len;
+};
+
+struct ba_transport_pcm;
+
+/**
+ * Callback function called when the PCM drain has been completed. It is
+ * called from the transport IO thread (or from the thread terminating the
+ * IO thread), so it shall not block. */
+typedef void ba_transport_pcm_drain_cb(struct ba_transport_pcm *pcm, void *userdata);
+
 struct ba_transport_pcm {
 
 	/* backward reference to transport */
@@ -96,19 +161,95 @@ struct ba_transport_pcm {
 	/* FIFO file descriptor */
 	int fd;
 
+	/* Shared memory ring used instead of the FIFO. If the ring is mapped,
+	 * the fd field holds one of the ring event file descriptors. */
+	shm_ring_t shm;
+	/* duplicated PCM controller socket used for client hang-up detection */
+	int shm_ctrl_fd;
+
+	/* Clients mixed into the PCM stream. This list is guarded by the PCM
+	 * mutex, the mixing buffer is used by the IO thread only. */
+	struct ba_transport_pcm_mix_client mix_clients[BA_TRANSPORT_PCM_MIX_CLIENTS_MAX];
+	size_t mix_clients_len;
+	void *mix_buffer;
+	size_t mix_buffer_size;
+
 	/* indicates whether PCM shall be active */
 	bool active;
+	/* PCM open request is in progress */
+	bool opening;
+	/* streaming has been suspended due to the silence on the input */
+	bool silence_suspended;
 
 	/* 16-bit stream format identifier */
 	uint16_t format;
+	/* Format used by the codec. If it differs from the stream format
+	 * selected by the client, the signal is converted by the IO thread. */
+	uint16_t codec_format;
 	/* number of audio channels */
 	unsigned int channels;
 	/* PCM sampling frequency */
 	unsigned int sampling;
+	/* Sampling frequency selected by the client. If it differs from the
+	 * codec sampling, the signal is resampled by the IO thread. */
+	unsigned int client_sampling;
+	struct resampler resampler;
+	/* Number of channels selected by the client. If it differs from the
+	 * codec channels, the signal is down-mixed or up-mixed by the IO thread,
+	 * which can also swap left and right channels of the stereo signal. */
+	unsigned int client_channels;
+	bool swap_channels;
+	/* incomplete client frame kept between FIFO reads */
+	uint8_t read_tail[8];
+	size_t read_tail_len;
+	/* The number of PCM frames (at the codec sampling) encoded or decoded
+	 * by the codec at once. For codecs without the fixed block size it is
+	 * set to 1. */
+	unsigned int block_frames;
 
 	/* Overall PCM delay in 1/10 of millisecond, caused by
 	 * audio encoding or decoding and data transfer. */
 	unsigned int delay;
+	/* Algorithmic delay of the codec (including buffering of PCM frames
+	 * for the whole packet) in 1/10 of millisecond. It is set by the IO
+	 * thread when the codec is initialized. */
+	unsigned int codec_delay;
+	/* Delay in 1/10 of millisecond caused by the data waiting in the BT
+	 * socket output queue. It is updated by the encoder thread. */
+	atomic_uint queue_delay;
+
+	/* number of PCM frames synthesized by the packet loss concealment */
+	atomic_uint concealed_frames;
+
+	/* Policy applied when the client does not consume data fast enough.
+	 * Data which have not been written to the FIFO yet are kept in the
+	 * backlog buffer, which is guarded by the PCM mutex. */
+	enum ba_transport_pcm_overrun overrun;
+	ffb_t overrun_backlog;
+	/* number of bytes of the last frame which have reached the FIFO */
+	size_t overrun_frame_offset;
+
+	/* Optional jitter buffer of the decoded signal with the playout timer.
+	 * It is used by the decoder thread only. */
+	struct {
+		struct jitter_buffer jb;
+		int timer_fd;
+		bool armed;
+		/* buffered signal delay in 1/10 of millisecond */
+		atomic_uint delay;
+	} jitter;
+
+	/* The number of samples transferred between the client and the IO thread
+	 * with the time of the last update. */
+	struct ba_transport_pcm_counter position;
+	/* The number of frames (at the codec sampling) written to the Bluetooth
+	 * socket with the time of the last write. It is maintained for the PCM
+	 * which is the source of the encoder thread only. */
+	struct ba_transport_pcm_counter presentation;
+
+	/* Optional monitor PCM, which receives a copy of the stream read by the
+	 * IO thread from this PCM, after mixing and volume scaling. */
+	struct ba_transport_pcm *monitor;
 
 	/* internal software volume control */
 	bool soft_volume;
@@ -131,10 +272,23 @@ struct ba_transport_pcm {
 	/* data synchronization */
 	pthread_mutex_t synced_mtx;
 	pthread_cond_t synced;
+	/* pending asynchronous drain request */
+	bool drain_pending;
+	ba_transport_pcm_drain_cb *drain_cb;
+	void *drain_cb_data;
 
 	/* exported PCM D-Bus API */
 	char *ba_dbus_path;
 	unsigned int ba_dbus_id;
+	/* cached snapshot of PCM D-Bus properties */
+	pthread_mutex_t ba_dbus_props_mtx;
+	GVariant *ba_dbus_props;
+	/* properties changed since the last D-Bus signal */
+	unsigned int ba_dbus_update_mask;
+	GSource *ba_dbus_update_source;
+	/* PCM controller channel watch */
+	unsigned int ba_dbus_ctrl_source;
+	int ba_dbus_ctrl_fd;
 
 };
 
@@ -142,6 +296,49 @@ void ba_transport_pcm_volume_set(
 		struct ba_transport_pcm_volume *volume,
 		const int *level, const bool *muted);
 
+/**
+ * Time in milliseconds for which the detached PCM client stream waits for
+ * the new transport after the A2DP codec switch. */
+#define BA_TRANSPORT_PCM_HANDOVER_TIMEOUT 5000
+
+/**
+ * Duration in milliseconds of the A2DP sink stream which shall fit in the
+ * BT socket receive buffer, if the jitter buffer is not enabled. */
+#define BA_TRANSPORT_RCVBUF_WINDOW 200
+
+/**
+ * PCM client stream detached from the transport.
+ *
+ * During the A2DP codec switch, BlueZ destroys the old transport and creates
+ * a new one. In order to keep the client stream (FIFO or shared memory ring
+ * and the PCM controller socket) open, it is detached from the PCM of the old
+ * transport and attached to the PCM of the new one. */
+struct ba_transport_pcm_handover {
+
+	/* device which owns the detached stream */
+	struct ba_device *d;
+	/* D-Bus path of the PCM */
+	char *ba_dbus_path;
+	enum ba_transport_pcm_mode mode;
+
+	/* FIFO file descriptor or the shared memory ring */
+	int fd;
+	shm_ring_t shm;
+	int shm_ctrl_fd;
+	/* PCM controller socket */
+	int ctrl_fd;
+
+	/* stream configuration selected by the client */
+	uint16_t format;
+	unsigned int channels;
+	unsigned int client_sampling;
+	struct ba_transport_pcm_volume volume[2];
+
+	/* handover expiration timer */
+	unsigned int timeout_source;
+
+};
+
 enum ba_transport_thread_state {
 	BA_TRANSPORT_THREAD_STATE_NONE,
 	BA_TRANSPORT_THREAD_STATE_STARTING,
@@ -159,6 +356,58 @@ enum ba_transport_thread_signal {
 	BA_TRANSPORT_THREAD_SIGNAL_PCM_DROP,
 };
 
+/**
+ * The capacity of the transport thread signal queue. It has to be
+ * a power of 2. */
+#define BA_TRANSPORT_THREAD_SIGNAL_QUEUE_SIZE 32
+
+/**
+ * The time in milliseconds for which the sender waits for the free slot
+ * in the full signal queue before the signal is dropped. */
+#define BA_TRANSPORT_THREAD_SIGNAL_SEND_TIMEOUT 200
+
+/**
+ * Histogram bins of the processing time in milliseconds. The last bin
+ * collects all samples greater or equal to the last bin boundary. */
+#define BA_TRANSPORT_THREAD_STATS_BUSY_BINS { 1, 2, 5, 10, 20 }
+#define BA_TRANSPORT_THREAD_STATS_BUSY_BINS_SIZE 6
+
+/**
+ * Transport thread IO statistics.
+ *
+ * Counters are updated by the IO thread (or the BT writer thread in the
+ * pipelined mode) without any locking, so they can be read at any time
+ * by the main thread. */
+struct ba_transport_thread_stats {
+	/* packets and bytes written to the BT socket */
+	atomic_uint tx_packets;
+	atomic_uint tx_bytes;
+	/* packets and bytes read from the BT socket */
+	atomic_uint rx_packets;
+	atomic_uint rx_bytes;
+	/* processing time between consecutive transfers */
+	atomic_uint busy_hist[BA_TRANSPORT_THREAD_STATS_BUSY_BINS_SIZE];
+	/* transfers which missed the synchronization deadline */
+	atomic_uint overdue;
+	/* PCM FIFO was empty when the transfer was due */
+	atomic_uint underruns;
+	/* PCM FIFO was full, so the write had to wait for the client */
+	atomic_uint overruns;
+	/* missing RTP packets detected by the sequence number */
+	atomic_uint rtp_lost;
+	/* PCM data drops due to the BT congestion */
+	atomic_uint congestion_drops;
+	/* packets dropped due to the BT socket receive buffer overflow */
+	atomic_uint rx_overflows;
+	/* PCM frames dropped due to the overrun policy */
+	atomic_uint overrun_drops;
+};
+
+/**
+ * Increment transport thread IO statistics counter. */
+#define ba_transport_thread_stats_add(th, counter, n) \
+	atomic_fetch_add_explicit(&(th)->stats.counter, n, memory_order_relaxed)
+
 struct ba_transport_thread {
 	/* backward reference to transport */
 	struct ba_transport *t;
@@ -170,12 +419,59 @@ struct ba_transport_thread {
 	enum ba_transport_thread_state state;
 	/* state changed notification */
 	pthread_cond_t changed;
+	/* optional state change callback invoked with the mutex held */
+	void (*state_watch)(struct ba_transport_thread *th, void *userdata);
+	void *state_watch_data;
 	/* actual thread ID */
 	pthread_t id;
+	/* thread main routine */
+	void *(*routine)(struct ba_transport_thread *);
+	/* effective scheduling policy */
+	struct sched_policy sched;
 	/* clone of BT socket */
 	int bt_fd;
-	/* notification PIPE */
-	int pipe[2];
+	/* notification event file descriptor */
+	int event_fd;
+	/* Lock-free multi-producer single-consumer signal queue. Every slot has
+	 * a sequence number, which indicates whether it is ready for writing or
+	 * for reading, so producers do not have to lock anything. */
+	struct {
+		atomic_size_t seq;
+		enum ba_transport_thread_signal signal;
+		/* PCM which the signal applies to (might be NULL) */
+		struct ba_transport_pcm *pcm;
+	} signals[BA_TRANSPORT_THREAD_SIGNAL_QUEUE_SIZE];
+	/* position for producers */
+	atomic_size_t signals_head;
+	/* position for the consumer */
+	size_t signals_tail;
+	/* optional transfer pacing timer */
+	int pacing_timer_fd;
+	/* BT socket output queue monitor - it might be updated by the
+	 * BT writer thread, see the io_bt_pipeline structure */
+	struct {
+		/* bytes queued before the last write */
+		atomic_int queued;
+		/* the last write had to wait for space */
+		atomic_bool blocked;
+		/* number of consecutive congested writes */
+		atomic_uint congested;
+	} bt_coutq;
+	/* the last value of the BT socket receive queue drop counter
+	 * reported by the kernel with the SO_RXQ_OVFL control message */
+	uint32_t bt_rxq_drops;
+	/* arrival time of the last packet read from the BT socket */
+	struct timespec bt_rx_ts;
+#if ENABLE_IO_URING
+	/* io_uring receive path of the BT socket duplicate */
+	struct bt_uring *bt_uring;
+	/* io_uring is not available, use poll() instead */
+	bool bt_uring_failed;
+#endif
+	/* IO statistics - all counters wrap around */
+	struct ba_transport_thread_stats stats;
+	/* optional capture of the BT traffic */
+	struct bt_capture capture;
 };
 
 int ba_transport_thread_set_state(
@@ -195,16 +491,69 @@ int ba_transport_thread_bt_acquire(
 int ba_transport_thread_bt_release(
 		struct ba_transport_thread *th);
 
+/**
+ * The number of consecutive congested BT writes after which the PCM data
+ * waiting for the transfer shall be dropped. */
+#define BA_TRANSPORT_THREAD_BT_COUTQ_CONGESTED_WRITES 8
+
+void ba_transport_thread_bt_coutq_sample(
+		struct ba_transport_thread *th);
+void ba_transport_thread_bt_coutq_update(
+		struct ba_transport_thread *th);
+
+/**
+ * Check whether the BT socket output queue is persistently congested. */
+#define ba_transport_thread_bt_coutq_congested(th) \
+	((th)->bt_coutq.congested >= BA_TRANSPORT_THREAD_BT_COUTQ_CONGESTED_WRITES)
+
+void ba_transport_thread_stats_reset(
+		struct ba_transport_thread *th);
+void ba_transport_thread_stats_add_busy(
+		struct ba_transport_thread *th,
+		const struct timespec *ts);
+
 int ba_transport_thread_signal_send(
 		struct ba_transport_thread *th,
 		enum ba_transport_thread_signal signal);
+int ba_transport_thread_signal_send_pcm(
+		struct ba_transport_thread *th,
+		enum ba_transport_thread_signal signal,
+		struct ba_transport_pcm *pcm);
 int ba_transport_thread_signal_recv(
 		struct ba_transport_thread *th,
-		enum ba_transport_thread_signal *signal);
+		enum ba_transport_thread_signal *signal,
+		struct ba_transport_pcm **pcm);
+
+/**
+ * The maximal number of member transports in the A2DP broadcast group. */
+#define BA_TRANSPORT_GROUP_MEMBERS_MAX 8
+
+/**
+ * A2DP broadcast group.
+ *
+ * PCM of the leader transport is encoded only once and every RTP packet
+ * written to the leader BT socket is also written to the BT sockets of all
+ * member transports. Members have to use the same codec configuration as
+ * the leader, and they do not run their own IO threads. */
+struct ba_transport_group {
+
+	/* transport which encodes the PCM stream */
+	struct ba_transport *leader;
+
+	/* guard modifications of the member list */
+	pthread_mutex_t mutex;
+
+	struct {
+		struct ba_transport *t;
+		/* duplicated BT socket of the member transport */
+		int bt_fd;
+	} members[BA_TRANSPORT_GROUP_MEMBERS_MAX];
+	size_t members_len;
+
+};
 
 enum ba_transport_thread_manager_command {
-	BA_TRANSPORT_THREAD_MANAGER_TERMINATE = 0,
-	BA_TRANSPORT_THREAD_MANAGER_CANCEL_THREADS,
+	BA_TRANSPORT_THREAD_MANAGER_CANCEL_THREADS = 0,
 	BA_TRANSPORT_THREAD_MANAGER_CANCEL_IF_NO_CLIENTS,
 };
 
@@ -231,7 +580,7 @@ struct ba_transport {
 
 	/* This field stores a file descriptor (socket) associated with the BlueZ
 	 * side of the transport. The role of this socket depends on the transport
-	 * type - it can be either A2DP or SCO link. */
+	 * type - it can be either A2DP, SCO or ISO link. */
 	int bt_fd;
 
 	/* max transfer unit values for bt_fd */
@@ -242,9 +591,19 @@ struct ba_transport {
 	struct ba_transport_thread thread_enc;
 	struct ba_transport_thread thread_dec;
 
-	/* thread for managing IO threads */
-	pthread_t thread_manager_thread_id;
-	int thread_manager_pipe[2];
+	/* Single thread manages IO threads of all transports. These fields are
+	 * guarded by the manager mutex, see the ba-transport.c file. */
+	struct {
+		/* pending commands bitmask */
+		unsigned int commands;
+		/* link in the manager work queue */
+		GList queue_link;
+		/* link in the keep-alive timer wheel */
+		GList wheel_link;
+		/* keep-alive timer expiration tick */
+		uint64_t wheel_expire;
+		bool wheel_armed;
+	} thread_manager;
 
 	/* indicates IO threads stopping */
 	bool stopping;
@@ -267,9 +626,27 @@ struct ba_transport {
 			/* delay reported by the AVDTP */
 			uint16_t delay;
 
+			/* broadcast group led by this transport */
+			struct ba_transport_group group;
+			/* broadcast group which this transport has joined - guarded
+			 * by the PCM mutex */
+			struct ba_transport_group *group_joined;
+
+#if ENABLE_LDAC
+			/* LDAC encoder quality (EQMID) - it might be lowered by the
+			 * link quality policy while the stream is running */
+			atomic_int ldac_eqmid;
+#endif
+
 			struct ba_transport_pcm pcm;
 			/* PCM for back-channel stream */
 			struct ba_transport_pcm pcm_bc;
+			/* PCM mirroring the stream sent to the A2DP sink device */
+			struct ba_transport_pcm pcm_monitor;
+
+			/* BT transport has been released during the silence, but IO
+			 * threads are still running (waiting for the signal) */
+			bool silence_released;
 
 			/* Value reported by the ioctl(TIOCOUTQ) when the output buffer is
 			 * empty. Somehow this ioctl call reports "available" buffer space.
@@ -293,9 +670,31 @@ struct ba_transport {
 
 			/* time-stamp when the SCO link has been closed */
 			struct timespec closed_at;
+			/* SCO link disconnection watch in the offload mode */
+			unsigned int offload_watch_id;
 
 		} sco;
 
+		struct {
+
+			/* used D-Bus endpoint path */
+			const char *bluez_dbus_sep_path;
+
+			/* current state of the transport */
+			enum bluez_a2dp_transport_state state;
+
+			/* selected LC3 codec configuration */
+			struct bap_lc3_configuration configuration;
+
+			/* presentation delay in 1/10 of millisecond */
+			unsigned int delay;
+
+			/* Single BAP stream is unidirectional. Bidirectional
+			 * audio is exposed by BlueZ as two transports. */
+			struct ba_transport_pcm pcm;
+
+		} bap;
+
 	};
 
 	/* callback functions for self-management */
@@ -303,7 +702,7 @@ struct ba_transport {
 	int (*release)(struct ba_transport *);
 
 	/* memory self-management */
-	int ref_count;
+	atomic_int ref_count;
 
 };
 
@@ -320,6 +719,12 @@ struct ba_transport *ba_transport_new_sco(
 		const char *dbus_owner,
 		const char *dbus_path,
 		int rfcomm_fd);
+struct ba_transport *ba_transport_new_bap(
+		struct ba_device *device,
+		struct ba_transport_type type,
+		const char *dbus_owner,
+		const char *dbus_path,
+		const struct bap_lc3_configuration *configuration);
 
 struct ba_transport *ba_transport_lookup(
 		struct ba_device *device,
@@ -352,18 +757,84 @@ int ba_transport_stop(struct ba_transport *t);
 int ba_transport_stop_if_no_clients(struct ba_transport *t);
 
 int ba_transport_acquire(struct ba_transport *t);
+void ba_transport_acquire_async(struct ba_transport *t);
 int ba_transport_release(struct ba_transport *t);
 
 int ba_transport_set_a2dp_state(
 		struct ba_transport *t,
 		enum bluez_a2dp_transport_state state);
+int ba_transport_set_bap_state(
+		struct ba_transport *t,
+		enum bluez_a2dp_transport_state state);
+
+/**
+ * Check whether given A2DP transport is a member of the broadcast group. */
+#define ba_transport_group_is_member(t) \
+	((t)->a2dp.group_joined != NULL)
+
+int ba_transport_group_join(
+		struct ba_transport *leader,
+		struct ba_transport *t);
+int ba_transport_group_leave(
+		struct ba_transport *t);
 
 bool ba_transport_pcm_is_active(
 		struct ba_transport_pcm *pcm);
+bool ba_transport_pcm_is_monitor(
+		const struct ba_transport_pcm *pcm);
 
 int ba_transport_pcm_get_delay(
 		const struct ba_transport_pcm *pcm);
 
+void ba_transport_pcm_position_update(
+		struct ba_transport_pcm *pcm,
+		uint64_t samples);
+void ba_transport_pcm_position_reset(
+		struct ba_transport_pcm *pcm);
+void ba_transport_pcm_position_get(
+		const struct ba_transport_pcm *pcm,
+		uint64_t *samples,
+		struct timespec *ts);
+void ba_transport_pcm_presentation_update(
+		struct ba_transport_pcm *pcm,
+		uint64_t frames);
+void ba_transport_pcm_presentation_get(
+		const struct ba_transport_pcm *pcm,
+		uint64_t *frames,
+		struct timespec *ts);
+
+size_t ba_transport_pcm_get_formats(
+		const struct ba_transport_pcm *pcm,
+		uint16_t *formats,
+		size_t size);
+int ba_transport_pcm_set_format(
+		struct ba_transport_pcm *pcm,
+		uint16_t format);
+
+size_t ba_transport_pcm_get_samplings(
+		const struct ba_transport_pcm *pcm,
+		uint32_t *samplings,
+		size_t size);
+int ba_transport_pcm_set_sampling(
+		struct ba_transport_pcm *pcm,
+		unsigned int sampling);
+
+int ba_transport_pcm_set_channels(
+		struct ba_transport_pcm *pcm,
+		unsigned int channels);
+int ba_transport_pcm_set_swap_channels(
+		struct ba_transport_pcm *pcm,
+		bool swap);
+
+const char *ba_transport_pcm_overrun_to_string(
+		enum ba_transport_pcm_overrun overrun);
+int ba_transport_pcm_overrun_from_string(
+		const char *name,
+		enum ba_transport_pcm_overrun *overrun);
+int ba_transport_pcm_set_overrun(
+		struct ba_transport_pcm *pcm,
+		enum ba_transport_pcm_overrun overrun);
+
 unsigned int ba_transport_pcm_volume_level_to_bt(
 		const struct ba_transport_pcm *pcm,
 		int value);
@@ -376,10 +847,13 @@ int ba_transport_pcm_volume_update(
 
 int ba_transport_pcm_pause(struct ba_transport_pcm *pcm);
 int ba_transport_pcm_resume(struct ba_transport_pcm *pcm);
-int ba_transport_pcm_drain(struct ba_transport_pcm *pcm);
+int ba_transport_pcm_drain(struct ba_transport_pcm *pcm,
+		ba_transport_pcm_drain_cb *cb, void *userdata);
+void ba_transport_pcm_drain_complete(struct ba_transport_pcm *pcm);
 int ba_transport_pcm_drop(struct ba_transport_pcm *pcm);
 
 int ba_transport_pcm_release(struct ba_transport_pcm *pcm);
+int ba_transport_pcm_release_client(struct ba_transport_pcm *pcm);
 
 int ba_transport_thread_create(
 		struct ba_transport_thread *th,
@@ -0,0 +1,293 @@
+/*
+ * BlueALSA - bap-lc3.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "bap-lc3.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include <lc3.h>
+
+#include "bap.h"
+#include "io.h"
+#include "trace.h"
+#include "shared/defs.h"
+#include "shared/ffb.h"
+#include "shared/log.h"
+#include "shared/rb.h"
+#include "shared/rt.h"
+
+/**
+ * LC3 codec instances - the LC3 codec is mono, so every channel of the
+ * BAP stream is encoded (or decoded) by its own instance. */
+struct bap_lc3 {
+	lc3_encoder_t encoder[BAP_LC3_CHANNELS_MAX];
+	lc3_decoder_t decoder[BAP_LC3_CHANNELS_MAX];
+	void *mem[BAP_LC3_CHANNELS_MAX];
+};
+
+static void bap_lc3_free(struct bap_lc3 *lc3) {
+	for (size_t i = 0; i < ARRAYSIZE(lc3->mem); i++)
+		free(lc3->mem[i]);
+}
+
+static int bap_lc3_init(struct bap_lc3 *lc3,
+		const struct bap_lc3_configuration *conf, bool encoder) {
+
+	const int dt_us = conf->frame_us;
+	const int sr_hz = conf->sampling;
+	const unsigned int size = encoder ?
+		lc3_encoder_size(dt_us, sr_hz) : lc3_decoder_size(dt_us, sr_hz);
+
+	if (size == 0)
+		return errno = EINVAL, -1;
+
+	for (size_t i = 0; i < conf->channels; i++) {
+		if ((lc3->mem[i] = malloc(size)) == NULL)
+			return -1;
+		if (encoder) {
+			if ((lc3->encoder[i] = lc3_setup_encoder(dt_us, sr_hz, 0, lc3->mem[i])) == NULL)
+				return errno = EINVAL, -1;
+		} else {
+			if ((lc3->decoder[i] = lc3_setup_decoder(dt_us, sr_hz, 0, lc3->mem[i])) == NULL)
+				return errno = EINVAL, -1;
+		}
+	}
+
+	return 0;
+}
+
+void bap_lc3_transport_set_codec(struct ba_transport *t) {
+
+	const struct bap_lc3_configuration *conf = &t->bap.configuration;
+
+	t->bap.pcm.format = BA_TRANSPORT_PCM_FORMAT_S16_2LE;
+	t->bap.pcm.channels = conf->channels;
+	t->bap.pcm.sampling = conf->sampling;
+	t->bap.pcm.block_frames = bap_lc3_frame_samples(conf);
+
+}
+
+static void *bap_lc3_enc_thread(struct ba_transport_thread *th) {
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_thread_cleanup), th);
+
+	struct ba_transport *t = th->t;
+	struct ba_transport_pcm *t_bap_pcm = &t->bap.pcm;
+	const struct bap_lc3_configuration *conf = &t->bap.configuration;
+	struct io_poll io = { .timeout = -1 };
+
+	struct bap_lc3 lc3 = { 0 };
+	ffb_t bt = { 0 };
+	rb_t pcm = { 0 };
+	pthread_cleanup_push(PTHREAD_CLEANUP(bap_lc3_free), &lc3);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
+	pthread_cleanup_push(PTHREAD_CLEANUP(rb_free), &pcm);
+
+	if (bap_lc3_init(&lc3, conf, true) == -1) {
+		error("Couldn't initialize LC3 codec: %s", strerror(errno));
+		goto fail_init;
+	}
+
+	const unsigned int channels = conf->channels;
+	const size_t frame_samples = bap_lc3_frame_samples(conf);
+	const size_t sdu_frames = frame_samples * conf->frame_blocks;
+	const size_t sdu_samples = sdu_frames * channels;
+	const size_t sdu_size = bap_lc3_sdu_size(conf);
+
+	/* The ISO socket is a sequential packet socket, so the whole SDU
+	 * has to be written at once. */
+	if (sdu_size > t->mtu_write) {
+		error("LC3 SDU too big: %zu > %zu", sdu_size, t->mtu_write);
+		goto fail_init;
+	}
+
+	if (rb_init_int16_t(&pcm, sdu_samples * 2) == -1 ||
+			ffb_init_uint8_t(&bt, sdu_size) == -1) {
+		error("Couldn't create data buffers: %s", strerror(ENOMEM));
+		goto fail_init;
+	}
+
+	/* Codec delay consists of the LC3 algorithmic delay and the time
+	 * needed to collect PCM frames for a single SDU. */
+	t_bap_pcm->codec_delay = (lc3_delay_samples(conf->frame_us, conf->sampling) +
+			sdu_frames) * 10000 / conf->sampling;
+
+	debug_transport_thread_loop(th, "START");
+	for (ba_transport_thread_set_state_running(th);;) {
+
+		ssize_t samples = rb_len_in(&pcm);
+		if ((samples = io_poll_and_read_pcm(&io, t_bap_pcm, rb_tail(&pcm), samples)) <= 0) {
+			if (samples == -1)
+				error("PCM poll and read error: %s", strerror(errno));
+			ba_transport_stop_if_no_clients(t);
+			continue;
+		}
+
+		rb_seek(&pcm, samples);
+
+		while (rb_len_out(&pcm) >= sdu_samples) {
+
+			const int16_t *input = rb_head(&pcm);
+			uint8_t *output = bt.tail;
+
+			/* Within the SDU, LC3 frames are arranged block by block, and in
+			 * every block there is one frame for each allocated location. */
+			trace_probe2(encode_begin, th, sdu_samples);
+			for (size_t i = 0; i < conf->frame_blocks; i++) {
+				for (size_t ch = 0; ch < channels; ch++) {
+					if (lc3_encode(lc3.encoder[ch], LC3_PCM_FORMAT_S16, input + ch,
+								channels, conf->frame_len, output) != 0)
+						error("LC3 encoding error: %s", strerror(EINVAL));
+					output += conf->frame_len;
+				}
+				input += frame_samples * channels;
+			}
+
+			ffb_seek(&bt, sdu_size);
+
+			ssize_t len = ffb_blen_out(&bt);
+			trace_probe2(encode_end, th, len);
+			if ((len = io_poll_bt_write(&io, th, bt.data, len)) <= 0) {
+				if (len == -1)
+					error("BT write error: %s", strerror(errno));
+				goto fail;
+			}
+
+			ffb_rewind(&bt);
+			rb_shift(&pcm, sdu_samples);
+
+			/* keep data transfer at a constant bit rate */
+			io_poll_pace(&io, th, sdu_frames);
+
+			/* update busy delay (encoding overhead) */
+			t_bap_pcm->delay = asrsync_get_busy_usec(&io.asrs) / 100;
+
+		}
+
+	}
+
+fail:
+	debug_transport_thread_loop(th, "EXIT");
+	ba_transport_thread_set_state_stopping(th);
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+fail_init:
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+
+static void *bap_lc3_dec_thread(struct ba_transport_thread *th) {
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_thread_cleanup), th);
+
+	struct ba_transport *t = th->t;
+	struct ba_transport_pcm *t_bap_pcm = &t->bap.pcm;
+	const struct bap_lc3_configuration *conf = &t->bap.configuration;
+	struct io_poll io = { .timeout = -1 };
+
+	struct bap_lc3 lc3 = { 0 };
+	ffb_t bt = { 0 };
+	ffb_t pcm = { 0 };
+	pthread_cleanup_push(PTHREAD_CLEANUP(bap_lc3_free), &lc3);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &pcm);
+
+	if (bap_lc3_init(&lc3, conf, false) == -1) {
+		error("Couldn't initialize LC3 codec: %s", strerror(errno));
+		goto fail_init;
+	}
+
+	const unsigned int channels = conf->channels;
+	const size_t frame_samples = bap_lc3_frame_samples(conf);
+	const size_t sdu_samples = frame_samples * conf->frame_blocks * channels;
+	const size_t sdu_size = bap_lc3_sdu_size(conf);
+
+	if (ffb_init_int16_t(&pcm, sdu_samples) == -1 ||
+			ffb_init_uint8_t(&bt, MAX(sdu_size, t->mtu_read)) == -1) {
+		error("Couldn't create data buffers: %s", strerror(ENOMEM));
+		goto fail_init;
+	}
+
+	debug_transport_thread_loop(th, "START");
+	for (ba_transport_thread_set_state_running(th);;) {
+
+		ssize_t len = ffb_blen_in(&bt);
+		if ((len = io_poll_and_read_bt(&io, th, bt.data, len)) <= 0) {
+			if (len == -1)
+				error("BT poll and read error: %s", strerror(errno));
+			goto fail;
+		}
+
+		if (!ba_transport_pcm_is_active(t_bap_pcm))
+			continue;
+
+		/* The ISO socket delivers whole SDUs, so the SDU with unexpected
+		 * size is corrupted - all its frames are concealed instead. */
+		const bool lost = (size_t)len != sdu_size;
+		if (lost)
+			debug("Concealing LC3 SDU: %zd != %zu", len, sdu_size);
+
+		const uint8_t *input = bt.data;
+		int16_t *output = pcm.data;
+
+		trace_probe2(decode_begin, th, len);
+		for (size_t i = 0; i < conf->frame_blocks; i++) {
+			for (size_t ch = 0; ch < channels; ch++) {
+				if (lc3_decode(lc3.decoder[ch], lost ? NULL : input,
+							lost ? 0 : conf->frame_len, LC3_PCM_FORMAT_S16,
+							output + ch, channels) == -1)
+					error("LC3 decoding error: %s", strerror(EINVAL));
+				input += conf->frame_len;
+			}
+			output += frame_samples * channels;
+		}
+
+		trace_probe2(decode_end, th, sdu_samples);
+		io_pcm_scale(t_bap_pcm, pcm.data, sdu_samples);
+		if (io_pcm_write(t_bap_pcm, pcm.data, sdu_samples) == -1)
+			error("FIFO write error: %s", strerror(errno));
+
+	}
+
+fail:
+	debug_transport_thread_loop(th, "EXIT");
+	ba_transport_thread_set_state_stopping(th);
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+fail_init:
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+
+int bap_lc3_transport_start(struct ba_transport *t) {
+
+	if (t->type.profile & BA_TRANSPORT_PROFILE_BAP_SOURCE)
+		return ba_transport_thread_create(&t->thread_enc, bap_lc3_enc_thread, "ba-bap-lc3", true);
+
+	if (t->type.profile & BA_TRANSPORT_PROFILE_BAP_SINK)
+		return ba_transport_thread_create(&t->thread_dec, bap_lc3_dec_thread, "ba-bap-lc3", true);
+
+	g_assert_not_reached();
+	return -1;
+}
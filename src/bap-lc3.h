@@ -0,0 +1,24 @@
+/*
+ * BlueALSA - bap-lc3.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#pragma once
+#ifndef BLUEALSA_BAPLC3_H_
+#define BLUEALSA_BAPLC3_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "ba-transport.h"
+
+void bap_lc3_transport_set_codec(struct ba_transport *t);
+int bap_lc3_transport_start(struct ba_transport *t);
+
+#endif
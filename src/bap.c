@@ -0,0 +1,332 @@
+/*
+ * BlueALSA - bap.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "bap.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "shared/defs.h"
+#include "shared/log.h"
+
+/* LC3 frame length limits exposed in our capabilities. */
+#define LC3_FRAME_LEN_MIN 26
+#define LC3_FRAME_LEN_MAX 155
+
+#define LTV_LE16(v) ((v) & 0xFF), (((v) >> 8) & 0xFF)
+
+/**
+ * LC3 codec capabilities supported by BlueALSA. The liblc3 does not support
+ * 11.025, 22.05 and 44.1 kHz sampling frequencies, so these are not listed. */
+static const uint8_t bap_lc3_capabilities[] = {
+	0x03, LC3_CAPS_TYPE_SAMPLING, LTV_LE16(
+			LC3_CAPS_SAMPLING_8000 |
+			LC3_CAPS_SAMPLING_16000 |
+			LC3_CAPS_SAMPLING_24000 |
+			LC3_CAPS_SAMPLING_32000 |
+			LC3_CAPS_SAMPLING_48000),
+	0x02, LC3_CAPS_TYPE_FRAME_DURATION,
+		LC3_CAPS_FRAME_DURATION_7_5 |
+		LC3_CAPS_FRAME_DURATION_10 |
+		LC3_CAPS_FRAME_DURATION_PREF_10,
+	0x02, LC3_CAPS_TYPE_CHANNELS,
+		LC3_CAPS_CHANNELS_1 |
+		LC3_CAPS_CHANNELS_2,
+	0x05, LC3_CAPS_TYPE_FRAME_LEN,
+		LTV_LE16(LC3_FRAME_LEN_MIN),
+		LTV_LE16(LC3_FRAME_LEN_MAX),
+	0x02, LC3_CAPS_TYPE_FRAME_BLOCKS, 2,
+};
+
+/**
+ * Iterate over the LTV (length, type, value) structures.
+ *
+ * @param ltv Address of the pointer to the current LTV structure. On success,
+ *   it will be updated to point to the next structure.
+ * @param size Address of the number of bytes left in the LTV buffer.
+ * @param type Address where the type of the structure will be stored.
+ * @param value Address where the pointer to the value will be stored.
+ * @param len Address where the length of the value will be stored.
+ * @return This function returns 1 if the structure has been extracted, 0 if
+ *   there is no more data, or -1 if the LTV structure is truncated. */
+static int ltv_next(const uint8_t **ltv, size_t *size,
+		uint8_t *type, const uint8_t **value, size_t *len) {
+
+	/* skip empty structures used as a padding */
+	while (*size > 0 && (*ltv)[0] == 0) {
+		(*ltv)++;
+		(*size)--;
+	}
+
+	if (*size == 0)
+		return 0;
+
+	const size_t ltv_len = (*ltv)[0];
+	if (ltv_len + 1 > *size)
+		return -1;
+
+	*type = (*ltv)[1];
+	*value = *ltv + 2;
+	*len = ltv_len - 1;
+
+	*ltv += ltv_len + 1;
+	*size -= ltv_len + 1;
+
+	return 1;
+}
+
+/**
+ * Get LC3 capabilities exposed in the Published Audio Capabilities.
+ *
+ * @param size Address where the size of the capabilities blob will
+ *   be stored.
+ * @return This function returns the capabilities blob in the LTV format. */
+const uint8_t *bap_lc3_get_capabilities(size_t *size) {
+	*size = sizeof(bap_lc3_capabilities);
+	return bap_lc3_capabilities;
+}
+
+/**
+ * Parse LC3 Codec Specific Configuration.
+ *
+ * @param conf Address of the structure where the configuration will be
+ *   stored. It is modified only if the configuration is valid.
+ * @param data The configuration blob in the LTV format.
+ * @param size The size of the configuration blob.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to EINVAL. */
+int bap_lc3_parse_configuration(
+		struct bap_lc3_configuration *conf,
+		const void *data,
+		size_t size) {
+
+	struct bap_lc3_configuration tmp = { .frame_blocks = 1 };
+	const uint8_t *ltv = data;
+	const uint8_t *value;
+	uint8_t type;
+	size_t len;
+	int rv;
+
+	while ((rv = ltv_next(&ltv, &size, &type, &value, &len)) == 1)
+		switch (type) {
+		case LC3_CONFIG_TYPE_SAMPLING:
+			if (len != 1)
+				goto fail;
+			switch (value[0]) {
+			case LC3_CONFIG_SAMPLING_8000:
+				tmp.sampling = 8000;
+				break;
+			case LC3_CONFIG_SAMPLING_16000:
+				tmp.sampling = 16000;
+				break;
+			case LC3_CONFIG_SAMPLING_24000:
+				tmp.sampling = 24000;
+				break;
+			case LC3_CONFIG_SAMPLING_32000:
+				tmp.sampling = 32000;
+				break;
+			case LC3_CONFIG_SAMPLING_48000:
+				tmp.sampling = 48000;
+				break;
+			default:
+				debug("Unsupported LC3 sampling: %#x", value[0]);
+				goto fail;
+			}
+			break;
+		case LC3_CONFIG_TYPE_FRAME_DURATION:
+			if (len != 1)
+				goto fail;
+			switch (value[0]) {
+			case LC3_CONFIG_FRAME_DURATION_7_5:
+				tmp.frame_us = 7500;
+				break;
+			case LC3_CONFIG_FRAME_DURATION_10:
+				tmp.frame_us = 10000;
+				break;
+			default:
+				goto fail;
+			}
+			break;
+		case LC3_CONFIG_TYPE_LOCATIONS:
+			if (len != 4)
+				goto fail;
+			tmp.locations = value[0] | value[1] << 8 |
+				value[2] << 16 | (uint32_t)value[3] << 24;
+			break;
+		case LC3_CONFIG_TYPE_FRAME_LEN:
+			if (len != 2)
+				goto fail;
+			tmp.frame_len = value[0] | value[1] << 8;
+			break;
+		case LC3_CONFIG_TYPE_FRAME_BLOCKS:
+			if (len != 1)
+				goto fail;
+			tmp.frame_blocks = value[0];
+			break;
+		}
+
+	if (rv == -1)
+		goto fail;
+
+	/* Without the channel allocation the stream is mono, otherwise there
+	 * is one channel for every allocated audio location. */
+	tmp.channels = tmp.locations == 0 ? 1 : __builtin_popcount(tmp.locations);
+
+	if (tmp.sampling == 0 ||
+			tmp.frame_us == 0 ||
+			tmp.frame_len < BAP_LC3_FRAME_LEN_MIN ||
+			tmp.frame_len > BAP_LC3_FRAME_LEN_MAX ||
+			tmp.frame_blocks == 0 ||
+			tmp.channels > BAP_LC3_CHANNELS_MAX)
+		goto fail;
+
+	*conf = tmp;
+	return 0;
+
+fail:
+	errno = EINVAL;
+	return -1;
+}
+
+/**
+ * Select LC3 Codec Specific Configuration.
+ *
+ * The highest common sampling frequency is selected with the frame length
+ * of the corresponding BAP preset. If the remote device supports stereo
+ * and both front locations, the stream will carry two channels.
+ *
+ * @param capabilities The capabilities blob of the remote device.
+ * @param capabilities_size The size of the capabilities blob.
+ * @param locations Audio locations supported by the remote device.
+ * @param buffer Address of the buffer for the configuration blob.
+ * @param size The size of the buffer.
+ * @return On success this function returns the size of the configuration
+ *   blob. Otherwise, -1 is returned and errno is set to indicate the error. */
+ssize_t bap_lc3_select_configuration(
+		const void *capabilities,
+		size_t capabilities_size,
+		uint32_t locations,
+		void *buffer,
+		size_t size) {
+
+	static const struct {
+		uint16_t caps;
+		uint8_t config;
+		/* frame length for 7.5 ms and 10 ms frames */
+		unsigned int frame_len[2];
+	} presets[] = {
+		{ LC3_CAPS_SAMPLING_48000, LC3_CONFIG_SAMPLING_48000, { 75, 100 } },
+		{ LC3_CAPS_SAMPLING_32000, LC3_CONFIG_SAMPLING_32000, { 60, 80 } },
+		{ LC3_CAPS_SAMPLING_24000, LC3_CONFIG_SAMPLING_24000, { 45, 60 } },
+		{ LC3_CAPS_SAMPLING_16000, LC3_CONFIG_SAMPLING_16000, { 30, 40 } },
+		{ LC3_CAPS_SAMPLING_8000, LC3_CONFIG_SAMPLING_8000, { 26, 30 } },
+	};
+
+	const uint8_t *ltv = capabilities;
+	size_t ltv_size = capabilities_size;
+	const uint8_t *value;
+	uint8_t type;
+	size_t len;
+	int rv;
+
+	unsigned int samplings = 0;
+	unsigned int durations = 0;
+	unsigned int channels = LC3_CAPS_CHANNELS_1;
+	unsigned int frame_len_min = LC3_FRAME_LEN_MIN;
+	unsigned int frame_len_max = LC3_FRAME_LEN_MAX;
+
+	while ((rv = ltv_next(&ltv, &ltv_size, &type, &value, &len)) == 1)
+		switch (type) {
+		case LC3_CAPS_TYPE_SAMPLING:
+			if (len == 2)
+				samplings = value[0] | value[1] << 8;
+			break;
+		case LC3_CAPS_TYPE_FRAME_DURATION:
+			if (len == 1)
+				durations = value[0];
+			break;
+		case LC3_CAPS_TYPE_CHANNELS:
+			if (len == 1)
+				channels = value[0];
+			break;
+		case LC3_CAPS_TYPE_FRAME_LEN:
+			if (len == 4) {
+				frame_len_min = MAX(frame_len_min, (unsigned int)(value[0] | value[1] << 8));
+				frame_len_max = MIN(frame_len_max, (unsigned int)(value[2] | value[3] << 8));
+			}
+			break;
+		}
+
+	if (rv == -1) {
+		debug("Invalid LC3 capabilities: %s", "Truncated LTV");
+		return errno = EINVAL, -1;
+	}
+
+	size_t i;
+	for (i = 0; i < ARRAYSIZE(presets); i++)
+		if (samplings & presets[i].caps)
+			break;
+	if (i == ARRAYSIZE(presets)) {
+		debug("LC3 sampling not supported: %#x", samplings);
+		return errno = ENOTSUP, -1;
+	}
+
+	uint8_t duration;
+	unsigned int frame_len;
+	if (durations & LC3_CAPS_FRAME_DURATION_10) {
+		duration = LC3_CONFIG_FRAME_DURATION_10;
+		frame_len = presets[i].frame_len[1];
+	}
+	else if (durations & LC3_CAPS_FRAME_DURATION_7_5) {
+		duration = LC3_CONFIG_FRAME_DURATION_7_5;
+		frame_len = presets[i].frame_len[0];
+	}
+	else {
+		debug("LC3 frame duration not supported: %#x", durations);
+		return errno = ENOTSUP, -1;
+	}
+
+	if (frame_len_min > frame_len_max) {
+		debug("LC3 frame length not supported: %u > %u", frame_len_min, frame_len_max);
+		return errno = ENOTSUP, -1;
+	}
+
+	frame_len = MIN(MAX(frame_len, frame_len_min), frame_len_max);
+
+	const uint32_t stereo = BAP_LOCATION_FRONT_LEFT | BAP_LOCATION_FRONT_RIGHT;
+	if (channels & LC3_CAPS_CHANNELS_2 && (locations & stereo) == stereo)
+		locations = stereo;
+	else
+		/* allocate the first supported location only */
+		locations &= -locations;
+
+	uint8_t config[] = {
+		0x02, LC3_CONFIG_TYPE_SAMPLING, presets[i].config,
+		0x02, LC3_CONFIG_TYPE_FRAME_DURATION, duration,
+		0x03, LC3_CONFIG_TYPE_FRAME_LEN, LTV_LE16(frame_len),
+		0x02, LC3_CONFIG_TYPE_FRAME_BLOCKS, 1,
+		0x05, LC3_CONFIG_TYPE_LOCATIONS,
+			LTV_LE16(locations), LTV_LE16(locations >> 16),
+	};
+
+	/* omit the channel allocation for mono stream without location */
+	size_t config_size = sizeof(config);
+	if (locations == 0)
+		config_size -= 6;
+
+	if (config_size > size)
+		return errno = ENOBUFS, -1;
+
+	memcpy(buffer, config, config_size);
+	return config_size;
+}
@@ -0,0 +1,124 @@
+/*
+ * BlueALSA - bap.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#pragma once
+#ifndef BLUEALSA_BAP_H_
+#define BLUEALSA_BAP_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* LE Audio coding format of the LC3 codec. */
+#define BAP_CODEC_LC3 0x06
+
+/* Types of the LC3 Codec Specific Capabilities LTV structures. */
+#define LC3_CAPS_TYPE_SAMPLING       0x01
+#define LC3_CAPS_TYPE_FRAME_DURATION 0x02
+#define LC3_CAPS_TYPE_CHANNELS       0x03
+#define LC3_CAPS_TYPE_FRAME_LEN      0x04
+#define LC3_CAPS_TYPE_FRAME_BLOCKS   0x05
+
+#define LC3_CAPS_SAMPLING_8000  (1 << 0)
+#define LC3_CAPS_SAMPLING_11025 (1 << 1)
+#define LC3_CAPS_SAMPLING_16000 (1 << 2)
+#define LC3_CAPS_SAMPLING_22050 (1 << 3)
+#define LC3_CAPS_SAMPLING_24000 (1 << 4)
+#define LC3_CAPS_SAMPLING_32000 (1 << 5)
+#define LC3_CAPS_SAMPLING_44100 (1 << 6)
+#define LC3_CAPS_SAMPLING_48000 (1 << 7)
+
+#define LC3_CAPS_FRAME_DURATION_7_5     (1 << 0)
+#define LC3_CAPS_FRAME_DURATION_10      (1 << 1)
+#define LC3_CAPS_FRAME_DURATION_PREF_10 (1 << 5)
+
+#define LC3_CAPS_CHANNELS_1 (1 << 0)
+#define LC3_CAPS_CHANNELS_2 (1 << 1)
+
+/* Types of the LC3 Codec Specific Configuration LTV structures. */
+#define LC3_CONFIG_TYPE_SAMPLING       0x01
+#define LC3_CONFIG_TYPE_FRAME_DURATION 0x02
+#define LC3_CONFIG_TYPE_LOCATIONS      0x03
+#define LC3_CONFIG_TYPE_FRAME_LEN      0x04
+#define LC3_CONFIG_TYPE_FRAME_BLOCKS   0x05
+
+#define LC3_CONFIG_SAMPLING_8000  0x01
+#define LC3_CONFIG_SAMPLING_16000 0x03
+#define LC3_CONFIG_SAMPLING_24000 0x05
+#define LC3_CONFIG_SAMPLING_32000 0x06
+#define LC3_CONFIG_SAMPLING_48000 0x08
+
+#define LC3_CONFIG_FRAME_DURATION_7_5 0x00
+#define LC3_CONFIG_FRAME_DURATION_10  0x01
+
+/* Audio Locations used for the channel allocation. */
+#define BAP_LOCATION_FRONT_LEFT  (1 << 0)
+#define BAP_LOCATION_FRONT_RIGHT (1 << 1)
+
+/**
+ * The maximal number of channels carried by a single BAP stream. */
+#define BAP_LC3_CHANNELS_MAX 2
+
+/**
+ * The range of LC3 frame length (in octets) supported by the codec. */
+#define BAP_LC3_FRAME_LEN_MIN 20
+#define BAP_LC3_FRAME_LEN_MAX 400
+
+/* Quality of Service parameters used for the stream configuration. These
+ * values correspond to the low latency settings of the BAP presets. */
+#define BAP_QOS_PHY_2M                0x02
+#define BAP_QOS_RETRANSMISSIONS       5
+#define BAP_QOS_LATENCY_MS            20
+#define BAP_QOS_PRESENTATION_DELAY_US 40000
+
+struct bap_lc3_configuration {
+	/* sampling frequency in Hz */
+	unsigned int sampling;
+	/* frame duration in microseconds */
+	unsigned int frame_us;
+	/* allocated audio locations */
+	uint32_t locations;
+	/* number of channels, one LC3 frame per channel */
+	unsigned int channels;
+	/* number of octets in a single LC3 frame */
+	unsigned int frame_len;
+	/* number of LC3 frame blocks in a single SDU */
+	unsigned int frame_blocks;
+};
+
+/**
+ * Get the number of samples (per channel) in a single LC3 frame. */
+#define bap_lc3_frame_samples(conf) \
+	((conf)->sampling / 100 * (conf)->frame_us / 10000)
+
+/**
+ * Get the size of the SDU for the given LC3 configuration. */
+#define bap_lc3_sdu_size(conf) \
+	((size_t)(conf)->frame_len * (conf)->channels * (conf)->frame_blocks)
+
+const uint8_t *bap_lc3_get_capabilities(size_t *size);
+
+int bap_lc3_parse_configuration(
+		struct bap_lc3_configuration *conf,
+		const void *data,
+		size_t size);
+
+ssize_t bap_lc3_select_configuration(
+		const void *capabilities,
+		size_t capabilities_size,
+		uint32_t locations,
+		void *buffer,
+		size_t size);
+
+#endif
@@ -13,10 +13,13 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <bluetooth/hci.h>
@@ -31,13 +34,17 @@
 #include "ba-adapter.h"
 #include "ba-device.h"
 #include "ba-transport.h"
+#include "bap.h"
 #include "bluealsa-iface.h"
 #include "bluealsa.h"
+#include "codec-plugin.h"
 #include "dbus.h"
 #include "hfp.h"
+#include "storage.h"
 #include "utils.h"
 #include "shared/defs.h"
 #include "shared/log.h"
+#include "shared/pcm-ctrl.h"
 
 static GVariant *ba_variant_new_bluealsa_version(void) {
 	return g_variant_new_string(PACKAGE_VERSION);
@@ -49,7 +56,7 @@ static GVariant *ba_variant_new_bluealsa_adapters(void) {
 	GVariant *variant;
 	size_t i, ii = 0;
 
-	pthread_mutex_lock(&config.adapters_mutex);
+	pthread_rwlock_rdlock(&config.adapters_lock);
 
 	for (i = 0; i < HCI_MAX_DEV; i++)
 		if (config.adapters[i] != NULL)
@@ -57,11 +64,25 @@ static GVariant *ba_variant_new_bluealsa_adapters(void) {
 
 	variant = g_variant_new_strv(strv, ii);
 
-	pthread_mutex_unlock(&config.adapters_mutex);
+	pthread_rwlock_unlock(&config.adapters_lock);
 
 	return variant;
 }
 
+static GVariant *ba_variant_new_bluealsa_codec_calibration(void) {
+
+	GVariantBuilder rtfs;
+	g_variant_builder_init(&rtfs, G_VARIANT_TYPE("a{sd}"));
+
+	size_t i;
+	for (i = 0; i < config.codec_rtf_len; i++)
+		g_variant_builder_add(&rtfs, "{sd}",
+				ba_transport_codecs_a2dp_to_string(config.codec_rtf[i].codec_id),
+				config.codec_rtf[i].rtf);
+
+	return g_variant_builder_end(&rtfs);
+}
+
 static GVariant *ba_variant_new_device_path(const struct ba_device *d) {
 	return g_variant_new_object_path(d->bluez_dbus_path);
 }
@@ -87,6 +108,10 @@ static GVariant *ba_variant_new_transport_type(const struct ba_transport *t) {
 		return g_variant_new_string(BLUEALSA_TRANSPORT_TYPE_HSP_AG);
 	if (t->type.profile & BA_TRANSPORT_PROFILE_HSP_HS)
 		return g_variant_new_string(BLUEALSA_TRANSPORT_TYPE_HSP_HS);
+	if (t->type.profile & BA_TRANSPORT_PROFILE_BAP_SOURCE)
+		return g_variant_new_string(BLUEALSA_TRANSPORT_TYPE_BAP_SOURCE);
+	if (t->type.profile & BA_TRANSPORT_PROFILE_BAP_SINK)
+		return g_variant_new_string(BLUEALSA_TRANSPORT_TYPE_BAP_SINK);
 	warn("Unsupported transport type: %#x", t->type.profile);
 	return g_variant_new_string("<null>");
 }
@@ -105,12 +130,24 @@ static GVariant *ba_variant_new_pcm_format(const struct ba_transport_pcm *pcm) {
 	return g_variant_new_uint16(pcm->format);
 }
 
+static GVariant *ba_variant_new_pcm_formats(const struct ba_transport_pcm *pcm) {
+	uint16_t formats[5];
+	size_t n = ba_transport_pcm_get_formats(pcm, formats, ARRAYSIZE(formats));
+	return g_variant_new_fixed_array(G_VARIANT_TYPE_UINT16, formats, n, sizeof(*formats));
+}
+
 static GVariant *ba_variant_new_pcm_channels(const struct ba_transport_pcm *pcm) {
-	return g_variant_new_byte(pcm->channels);
+	return g_variant_new_byte(pcm->client_channels);
 }
 
 static GVariant *ba_variant_new_pcm_sampling(const struct ba_transport_pcm *pcm) {
-	return g_variant_new_uint32(pcm->sampling);
+	return g_variant_new_uint32(pcm->client_sampling);
+}
+
+static GVariant *ba_variant_new_pcm_samplings(const struct ba_transport_pcm *pcm) {
+	uint32_t samplings[16];
+	size_t n = ba_transport_pcm_get_samplings(pcm, samplings, ARRAYSIZE(samplings));
+	return g_variant_new_fixed_array(G_VARIANT_TYPE_UINT32, samplings, n, sizeof(*samplings));
 }
 
 static GVariant *ba_variant_new_pcm_codec(const struct ba_transport_pcm *pcm) {
@@ -120,15 +157,105 @@ static GVariant *ba_variant_new_pcm_codec(const struct ba_transport_pcm *pcm) {
 		codec = ba_transport_codecs_a2dp_to_string(t->type.codec);
 	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO)
 		codec = ba_transport_codecs_hfp_to_string(t->type.codec);
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_BAP)
+		codec = ba_transport_codecs_bap_to_string(t->type.codec);
 	if (codec != NULL)
 		return g_variant_new_string(codec);
 	return g_variant_new_string("<null>");
 }
 
+static GVariant *ba_variant_new_pcm_block_frames(const struct ba_transport_pcm *pcm) {
+	/* codec block size is reported in the client sampling */
+	if (pcm->sampling == 0)
+		return g_variant_new_uint32(0);
+	return g_variant_new_uint32(pcm->block_frames * pcm->client_sampling / pcm->sampling);
+}
+
 static GVariant *ba_variant_new_pcm_delay(const struct ba_transport_pcm *pcm) {
 	return g_variant_new_uint16(ba_transport_pcm_get_delay(pcm));
 }
 
+static GVariant *ba_variant_new_pcm_concealed_frames(const struct ba_transport_pcm *pcm) {
+	return g_variant_new_uint32(atomic_load_explicit(&pcm->concealed_frames, memory_order_relaxed));
+}
+
+static GVariant *ba_variant_new_pcm_scheduling(const struct ba_transport_pcm *pcm) {
+	struct ba_transport_thread *th = pcm->th;
+	char buffer[64] = "";
+	pthread_mutex_lock(&th->mutex);
+	if (th->state != BA_TRANSPORT_THREAD_STATE_NONE)
+		sched_policy_to_string(&th->sched, buffer, sizeof(buffer));
+	pthread_mutex_unlock(&th->mutex);
+	return g_variant_new_string(buffer);
+}
+
+static GVariant *ba_variant_new_pcm_statistics(const struct ba_transport_pcm *pcm) {
+
+	struct ba_transport_thread *th = pcm->th;
+	const struct ba_transport_thread_stats *stats = &th->stats;
+	uint32_t busy_hist[ARRAYSIZE(stats->busy_hist)];
+	uint32_t cpu_time = 0;
+	struct timespec ts;
+	clockid_t clock;
+	size_t i;
+
+	for (i = 0; i < ARRAYSIZE(busy_hist); i++)
+		busy_hist[i] = atomic_load_explicit(&stats->busy_hist[i], memory_order_relaxed);
+
+	pthread_mutex_lock(&th->mutex);
+	if (th->state != BA_TRANSPORT_THREAD_STATE_NONE &&
+			!pthread_equal(th->id, config.main_thread) &&
+			pthread_getcpuclockid(th->id, &clock) == 0 &&
+			clock_gettime(clock, &ts) == 0)
+		cpu_time = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	pthread_mutex_unlock(&th->mutex);
+
+	GVariantBuilder props;
+	g_variant_builder_init(&props, G_VARIANT_TYPE("a{sv}"));
+
+	g_variant_builder_add(&props, "{sv}", "TxPackets", g_variant_new_uint32(
+				atomic_load_explicit(&stats->tx_packets, memory_order_relaxed)));
+	g_variant_builder_add(&props, "{sv}", "TxBytes", g_variant_new_uint32(
+				atomic_load_explicit(&stats->tx_bytes, memory_order_relaxed)));
+	g_variant_builder_add(&props, "{sv}", "RxPackets", g_variant_new_uint32(
+				atomic_load_explicit(&stats->rx_packets, memory_order_relaxed)));
+	g_variant_builder_add(&props, "{sv}", "RxBytes", g_variant_new_uint32(
+				atomic_load_explicit(&stats->rx_bytes, memory_order_relaxed)));
+	g_variant_builder_add(&props, "{sv}", "ProcessingTime", g_variant_new_fixed_array(
+				G_VARIANT_TYPE_UINT32, busy_hist, ARRAYSIZE(busy_hist), sizeof(*busy_hist)));
+	g_variant_builder_add(&props, "{sv}", "Overdue", g_variant_new_uint32(
+				atomic_load_explicit(&stats->overdue, memory_order_relaxed)));
+	g_variant_builder_add(&props, "{sv}", "Underruns", g_variant_new_uint32(
+				atomic_load_explicit(&stats->underruns, memory_order_relaxed)));
+	g_variant_builder_add(&props, "{sv}", "Overruns", g_variant_new_uint32(
+				atomic_load_explicit(&stats->overruns, memory_order_relaxed)));
+	g_variant_builder_add(&props, "{sv}", "RTPLost", g_variant_new_uint32(
+				atomic_load_explicit(&stats->rtp_lost, memory_order_relaxed)));
+	g_variant_builder_add(&props, "{sv}", "CongestionDrops", g_variant_new_uint32(
+				atomic_load_explicit(&stats->congestion_drops, memory_order_relaxed)));
+	g_variant_builder_add(&props, "{sv}", "RxOverflows", g_variant_new_uint32(
+				atomic_load_explicit(&stats->rx_overflows, memory_order_relaxed)));
+	g_variant_builder_add(&props, "{sv}", "OverrunDrops", g_variant_new_uint32(
+				atomic_load_explicit(&stats->overrun_drops, memory_order_relaxed)));
+	g_variant_builder_add(&props, "{sv}", "SendQueue", g_variant_new_uint32(
+				atomic_load_explicit(&th->bt_coutq.queued, memory_order_relaxed)));
+	g_variant_builder_add(&props, "{sv}", "CPUTime", g_variant_new_uint32(cpu_time));
+
+	return g_variant_builder_end(&props);
+}
+
+static GVariant *ba_variant_new_pcm_overrun_policy(const struct ba_transport_pcm *pcm) {
+	return g_variant_new_string(ba_transport_pcm_overrun_to_string(pcm->overrun));
+}
+
+static GVariant *ba_variant_new_pcm_swap_channels(const struct ba_transport_pcm *pcm) {
+	return g_variant_new_boolean(pcm->swap_channels);
+}
+
+static GVariant *ba_variant_new_pcm_keep_warm(const struct ba_transport_pcm *pcm) {
+	return g_variant_new_boolean(atomic_load(&pcm->t->d->warm));
+}
+
 static GVariant *ba_variant_new_pcm_soft_volume(const struct ba_transport_pcm *pcm) {
 	return g_variant_new_boolean(pcm->soft_volume);
 }
@@ -145,19 +272,70 @@ static GVariant *ba_variant_new_pcm_volume(const struct ba_transport_pcm *pcm) {
 	return g_variant_new_uint16((ch1 << 8) | (pcm->channels == 1 ? 0 : ch2));
 }
 
-static void ba_variant_populate_pcm(GVariantBuilder *props, const struct ba_transport_pcm *pcm) {
+/**
+ * Get snapshot of PCM properties which are announced with the update signal.
+ *
+ * The snapshot is cached in the PCM structure until it is invalidated by the
+ * bluealsa_dbus_pcm_update() call. Returned variant shall be unreferenced. */
+static GVariant *ba_variant_get_pcm_props_snapshot(struct ba_transport_pcm *pcm) {
+
+	GVariant *snapshot;
+
+	pthread_mutex_lock(&pcm->ba_dbus_props_mtx);
+
+	if (pcm->ba_dbus_props == NULL) {
+
+		GVariantBuilder props;
+		g_variant_builder_init(&props, G_VARIANT_TYPE("a{sv}"));
+
+		g_variant_builder_add(&props, "{sv}", "Device", ba_variant_new_device_path(pcm->t->d));
+		g_variant_builder_add(&props, "{sv}", "Sequence", ba_variant_new_device_sequence(pcm->t->d));
+		g_variant_builder_add(&props, "{sv}", "Transport", ba_variant_new_transport_type(pcm->t));
+		g_variant_builder_add(&props, "{sv}", "Mode", ba_variant_new_pcm_mode(pcm));
+		g_variant_builder_add(&props, "{sv}", "Format", ba_variant_new_pcm_format(pcm));
+		g_variant_builder_add(&props, "{sv}", "Formats", ba_variant_new_pcm_formats(pcm));
+		g_variant_builder_add(&props, "{sv}", "Channels", ba_variant_new_pcm_channels(pcm));
+		g_variant_builder_add(&props, "{sv}", "Sampling", ba_variant_new_pcm_sampling(pcm));
+		g_variant_builder_add(&props, "{sv}", "Samplings", ba_variant_new_pcm_samplings(pcm));
+		g_variant_builder_add(&props, "{sv}", "Codec", ba_variant_new_pcm_codec(pcm));
+		g_variant_builder_add(&props, "{sv}", "BlockFrames", ba_variant_new_pcm_block_frames(pcm));
+		g_variant_builder_add(&props, "{sv}", "SoftVolume", ba_variant_new_pcm_soft_volume(pcm));
+		g_variant_builder_add(&props, "{sv}", "Volume", ba_variant_new_pcm_volume(pcm));
+
+		pcm->ba_dbus_props = g_variant_ref_sink(g_variant_builder_end(&props));
+
+	}
+
+	snapshot = g_variant_ref(pcm->ba_dbus_props);
+
+	pthread_mutex_unlock(&pcm->ba_dbus_props_mtx);
+
+	return snapshot;
+}
+
+static void ba_variant_populate_pcm(GVariantBuilder *props, struct ba_transport_pcm *pcm) {
+
+	GVariant *snapshot = ba_variant_get_pcm_props_snapshot(pcm);
+	GVariantIter iter;
+	GVariant *prop;
+
 	g_variant_builder_init(props, G_VARIANT_TYPE("a{sv}"));
-	g_variant_builder_add(props, "{sv}", "Device", ba_variant_new_device_path(pcm->t->d));
-	g_variant_builder_add(props, "{sv}", "Sequence", ba_variant_new_device_sequence(pcm->t->d));
-	g_variant_builder_add(props, "{sv}", "Transport", ba_variant_new_transport_type(pcm->t));
-	g_variant_builder_add(props, "{sv}", "Mode", ba_variant_new_pcm_mode(pcm));
-	g_variant_builder_add(props, "{sv}", "Format", ba_variant_new_pcm_format(pcm));
-	g_variant_builder_add(props, "{sv}", "Channels", ba_variant_new_pcm_channels(pcm));
-	g_variant_builder_add(props, "{sv}", "Sampling", ba_variant_new_pcm_sampling(pcm));
-	g_variant_builder_add(props, "{sv}", "Codec", ba_variant_new_pcm_codec(pcm));
+
+	g_variant_iter_init(&iter, snapshot);
+	while ((prop = g_variant_iter_next_value(&iter)) != NULL) {
+		g_variant_builder_add_value(props, prop);
+		g_variant_unref(prop);
+	}
+
+	/* properties which are changing without the update signal */
 	g_variant_builder_add(props, "{sv}", "Delay", ba_variant_new_pcm_delay(pcm));
-	g_variant_builder_add(props, "{sv}", "SoftVolume", ba_variant_new_pcm_soft_volume(pcm));
-	g_variant_builder_add(props, "{sv}", "Volume", ba_variant_new_pcm_volume(pcm));
+	g_variant_builder_add(props, "{sv}", "ConcealedFrames", ba_variant_new_pcm_concealed_frames(pcm));
+	g_variant_builder_add(props, "{sv}", "Scheduling", ba_variant_new_pcm_scheduling(pcm));
+	g_variant_builder_add(props, "{sv}", "OverrunPolicy", ba_variant_new_pcm_overrun_policy(pcm));
+	g_variant_builder_add(props, "{sv}", "SwapChannels", ba_variant_new_pcm_swap_channels(pcm));
+	g_variant_builder_add(props, "{sv}", "KeepWarm", ba_variant_new_pcm_keep_warm(pcm));
+
+	g_variant_unref(snapshot);
 }
 
 static bool ba_variant_populate_sep(GVariantBuilder *props, const struct a2dp_sep *sep) {
@@ -199,6 +377,7 @@ static bool ba_variant_populate_sep(GVariantBuilder *props, const struct a2dp_se
 #endif
 #if ENABLE_APTX
 	case A2DP_CODEC_VENDOR_APTX:
+	case A2DP_CODEC_VENDOR_APTX_LL:
 		break;
 #endif
 #if ENABLE_APTX_HD
@@ -214,6 +393,8 @@ static bool ba_variant_populate_sep(GVariantBuilder *props, const struct a2dp_se
 		break;
 #endif
 	default:
+		if (codec_plugin_lookup(codec->codec_id) != NULL)
+			break;
 		g_assert_not_reached();
 	}
 
@@ -238,11 +419,11 @@ static void bluealsa_manager_get_pcms(GDBusMethodInvocation *inv) {
 		struct ba_device *d;
 		struct ba_transport *t;
 
-		pthread_mutex_lock(&a->devices_mutex);
+		pthread_rwlock_rdlock(&a->devices_lock);
 		g_hash_table_iter_init(&iter_d, a->devices);
 		while (g_hash_table_iter_next(&iter_d, NULL, (gpointer)&d)) {
 
-			pthread_mutex_lock(&d->transports_mutex);
+			pthread_rwlock_rdlock(&d->transports_lock);
 			g_hash_table_iter_init(&iter_t, d->transports);
 			while (g_hash_table_iter_next(&iter_t, NULL, (gpointer)&t)) {
 
@@ -260,6 +441,12 @@ static void bluealsa_manager_get_pcms(GDBusMethodInvocation *inv) {
 						g_variant_builder_clear(&props);
 					}
 
+					if (t->a2dp.pcm_monitor.ba_dbus_id != 0) {
+						ba_variant_populate_pcm(&props, &t->a2dp.pcm_monitor);
+						g_variant_builder_add(&pcms, "{oa{sv}}", t->a2dp.pcm_monitor.ba_dbus_path, &props);
+						g_variant_builder_clear(&props);
+					}
+
 				}
 				else if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO) {
 
@@ -272,13 +459,22 @@ static void bluealsa_manager_get_pcms(GDBusMethodInvocation *inv) {
 					g_variant_builder_clear(&props);
 
 				}
+				else if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_BAP) {
+
+					if (t->bap.pcm.ba_dbus_id != 0) {
+						ba_variant_populate_pcm(&props, &t->bap.pcm);
+						g_variant_builder_add(&pcms, "{oa{sv}}", t->bap.pcm.ba_dbus_path, &props);
+						g_variant_builder_clear(&props);
+					}
+
+				}
 
 			}
 
-			pthread_mutex_unlock(&d->transports_mutex);
+			pthread_rwlock_unlock(&d->transports_lock);
 		}
 
-		pthread_mutex_unlock(&a->devices_mutex);
+		pthread_rwlock_unlock(&a->devices_lock);
 		ba_adapter_unref(a);
 
 	}
@@ -287,6 +483,8 @@ static void bluealsa_manager_get_pcms(GDBusMethodInvocation *inv) {
 	g_variant_builder_clear(&pcms);
 }
 
+static void bluealsa_manager_open_pcms(GDBusMethodInvocation *inv);
+
 static void bluealsa_manager_method_call(GDBusConnection *conn, const char *sender,
 		const char *path, const char *interface, const char *method, GVariant *params,
 		GDBusMethodInvocation *invocation, void *userdata) {
@@ -297,6 +495,8 @@ static void bluealsa_manager_method_call(GDBusConnection *conn, const char *send
 	static const GDBusMethodCallDispatcher dispatchers[] = {
 		{ .method = "GetPCMs",
 			.handler = bluealsa_manager_get_pcms },
+		{ .method = "OpenPCMs",
+			.handler = bluealsa_manager_open_pcms },
 		{ NULL },
 	};
 
@@ -318,6 +518,8 @@ static GVariant *bluealsa_manager_get_property(GDBusConnection *conn,
 		return ba_variant_new_bluealsa_version();
 	if (strcmp(property, "Adapters") == 0)
 		return ba_variant_new_bluealsa_adapters();
+	if (strcmp(property, "CodecCalibration") == 0)
+		return ba_variant_new_bluealsa_codec_calibration();
 
 	*error = g_error_new(G_DBUS_ERROR, G_DBUS_ERROR_NOT_SUPPORTED,
 			"Property not supported '%s'", property);
@@ -337,11 +539,80 @@ unsigned int bluealsa_dbus_manager_register(GError **error) {
 			(GDBusInterfaceInfo *)&bluealsa_iface_manager, &vtable, NULL, NULL, error);
 }
 
+/**
+ * Get the mixed PCM client associated with the given controller watch.
+ *
+ * This function shall be called with the PCM mutex locked. */
+static struct ba_transport_pcm_mix_client *bluealsa_pcm_mix_client_lookup(
+		struct ba_transport_pcm *pcm, unsigned int source) {
+	size_t i;
+	for (i = 0; i < pcm->mix_clients_len; i++)
+		if (pcm->mix_clients[i].ctrl_source == source)
+			return &pcm->mix_clients[i];
+	return NULL;
+}
+
+/**
+ * Handle the PCM control command of the mixed PCM client.
+ *
+ * Mixed clients can not control the PCM stream as a whole, so the drop and
+ * pause commands are applied to the client stream only.
+ *
+ * @return This function returns true if the command has been handled. */
+static bool bluealsa_pcm_mix_client_control(struct ba_transport_pcm *pcm,
+		const char *command, size_t len) {
+
+	const unsigned int source = g_source_get_id(g_main_current_source());
+	struct ba_transport_pcm_mix_client *c;
+	bool rv = true;
+
+	pthread_mutex_lock(&pcm->mutex);
+
+	if ((c = bluealsa_pcm_mix_client_lookup(pcm, source)) == NULL)
+		rv = false;
+	else if (strncmp(command, BLUEALSA_PCM_CTRL_DROP, len) == 0) {
+		if (c->fd != -1)
+			splice(c->fd, NULL, config.null_fd, NULL, 1024 * 32, SPLICE_F_NONBLOCK);
+		c->tail_len = 0;
+	}
+	else if (strncmp(command, BLUEALSA_PCM_CTRL_PAUSE, len) == 0)
+		c->paused = true;
+	else if (strncmp(command, BLUEALSA_PCM_CTRL_RESUME, len) == 0)
+		c->paused = false;
+	else
+		rv = false;
+
+	pthread_mutex_unlock(&pcm->mutex);
+	return rv;
+}
+
+/**
+ * Reply to the drain command in the main thread context. */
+static gboolean bluealsa_pcm_drain_finish(void *userdata) {
+	GIOChannel *ch = userdata;
+	size_t len;
+	g_io_channel_write_chars(ch, "OK", -1, &len, NULL);
+	g_io_channel_flush(ch, NULL);
+	g_io_channel_unref(ch);
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * PCM drain completion callback.
+ *
+ * This function is called by the transport IO thread, so the reply is
+ * deferred to the main loop, which owns the controller channel. */
+static void bluealsa_pcm_drain_complete(struct ba_transport_pcm *pcm, void *userdata) {
+	(void)pcm;
+	g_idle_add(bluealsa_pcm_drain_finish, userdata);
+}
+
 static gboolean bluealsa_pcm_controller(GIOChannel *ch, GIOCondition condition,
 		void *userdata) {
 	(void)condition;
 
 	struct ba_transport_pcm *pcm = (struct ba_transport_pcm *)userdata;
+	struct ba_pcm_ctrl_query query = { 0 };
 	char command[32];
 	size_t len;
 
@@ -350,9 +621,52 @@ static gboolean bluealsa_pcm_controller(GIOChannel *ch, GIOCondition condition,
 		error("Couldn't read controller channel");
 		return TRUE;
 	case G_IO_STATUS_NORMAL:
-		if (strncmp(command, BLUEALSA_PCM_CTRL_DRAIN, len) == 0) {
-			if (pcm->mode == BA_TRANSPORT_PCM_MODE_SINK)
-				ba_transport_pcm_drain(pcm);
+		if (len == sizeof(query))
+			memcpy(&query, command, sizeof(query));
+		if (query.command == BA_PCM_CTRL_QUERY_STATUS) {
+			/* Binary status query is answered with values published by the
+			 * IO thread, so it does not lock the PCM nor the IO thread. */
+			struct ba_pcm_ctrl_status status;
+			memset(&status, 0, sizeof(status));
+			status.command = query.command;
+			status.id = query.id;
+			status.delay = ba_transport_pcm_get_delay(pcm);
+			uint64_t samples;
+			struct timespec ts;
+			ba_transport_pcm_position_get(pcm, &samples, &ts);
+			status.frames = samples / pcm->channels;
+			status.ts_sec = ts.tv_sec;
+			status.ts_nsec = ts.tv_nsec;
+			g_io_channel_write_chars(ch, (const char *)&status, sizeof(status), &len, NULL);
+		}
+		else if (query.command == BA_PCM_CTRL_QUERY_POSITION) {
+			struct ba_pcm_ctrl_position position;
+			memset(&position, 0, sizeof(position));
+			position.command = query.command;
+			position.id = query.id;
+			position.delay = ba_transport_pcm_get_delay(pcm);
+			uint64_t samples, frames;
+			struct timespec ts, ts_bt;
+			ba_transport_pcm_position_get(pcm, &samples, &ts);
+			ba_transport_pcm_presentation_get(pcm, &frames, &ts_bt);
+			position.frames = samples / pcm->channels;
+			/* presentation position is counted at the codec sampling */
+			position.frames_bt = frames * pcm->client_sampling / pcm->sampling;
+			position.ts_sec = ts_bt.tv_sec;
+			position.ts_nsec = ts_bt.tv_nsec;
+			g_io_channel_write_chars(ch, (const char *)&position, sizeof(position), &len, NULL);
+		}
+		else if (bluealsa_pcm_mix_client_control(pcm, command, len))
+			g_io_channel_write_chars(ch, "OK", -1, &len, NULL);
+		else if (strncmp(command, BLUEALSA_PCM_CTRL_DRAIN, len) == 0) {
+			if (pcm->mode == BA_TRANSPORT_PCM_MODE_SINK) {
+				/* The reply is sent when all the data has been transferred
+				 * over the BT link, so the main loop is not blocked. */
+				g_io_channel_ref(ch);
+				if (ba_transport_pcm_drain(pcm, bluealsa_pcm_drain_complete, ch) == 0)
+					return TRUE;
+				g_io_channel_unref(ch);
+			}
 			g_io_channel_write_chars(ch, "OK", -1, &len, NULL);
 		}
 		else if (strncmp(command, BLUEALSA_PCM_CTRL_DROP, len) == 0) {
@@ -376,10 +690,37 @@ static gboolean bluealsa_pcm_controller(GIOChannel *ch, GIOCondition condition,
 		return TRUE;
 	case G_IO_STATUS_AGAIN:
 		return TRUE;
-	case G_IO_STATUS_EOF:
+	case G_IO_STATUS_EOF: {
+		const unsigned int source = g_source_get_id(g_main_current_source());
+		struct ba_transport_pcm_mix_client *c;
 		pthread_mutex_lock(&pcm->mutex);
-		ba_transport_pcm_release(pcm);
-		ba_transport_thread_signal_send(pcm->th, BA_TRANSPORT_THREAD_SIGNAL_PCM_CLOSE);
+		if ((c = bluealsa_pcm_mix_client_lookup(pcm, source)) != NULL) {
+			debug("Removing mixed PCM client: %d", c->fd);
+			if (c->fd != -1)
+				close(c->fd);
+			memmove(c, c + 1, (pcm->mix_clients + --pcm->mix_clients_len - c) * sizeof(*c));
+			pthread_mutex_unlock(&pcm->mutex);
+			return FALSE;
+		}
+		if (pcm->ba_dbus_ctrl_source == source) {
+			pcm->ba_dbus_ctrl_source = 0;
+			pcm->ba_dbus_ctrl_fd = -1;
+		}
+		else if (pcm->ba_dbus_ctrl_source != 0) {
+			/* The PCM has been taken over by the mixed client
+			 * after this client had closed its stream. */
+			pthread_mutex_unlock(&pcm->mutex);
+			return FALSE;
+		}
+		ba_transport_pcm_release_client(pcm);
+		if (pcm->fd != -1) {
+			/* wake up IO thread, so it will poll the new client stream */
+			ba_transport_thread_signal_send(pcm->th, BA_TRANSPORT_THREAD_SIGNAL_PING);
+			pthread_mutex_unlock(&pcm->mutex);
+			return FALSE;
+		}
+		if (!ba_transport_pcm_is_monitor(pcm))
+			ba_transport_thread_signal_send_pcm(pcm->th, BA_TRANSPORT_THREAD_SIGNAL_PCM_CLOSE, pcm);
 		pthread_mutex_unlock(&pcm->mutex);
 		/* Check whether we've just closed the last PCM client and in
 		 * such a case schedule transport IO threads termination. */
@@ -387,118 +728,751 @@ static gboolean bluealsa_pcm_controller(GIOChannel *ch, GIOCondition condition,
 		/* remove channel from watch */
 		return FALSE;
 	}
+	}
+
+	return TRUE;
+}
+
+/**
+ * Asynchronous PCM open request.
+ *
+ * Opening PCM of the source profile requires Bluetooth transport acquisition
+ * which might take a while, so in order not to stall the main loop (and all
+ * other D-Bus requests) the open request goes through following stages:
+ *  - the PCM is claimed and the stream is created on the main loop,
+ *  - the transport is acquired in the worker thread,
+ *  - the IO thread reports (via the state watch) that it is running,
+ *  - the PCM is activated and the reply is sent from the main loop.
+ *
+ * The same stages are used for attaching the PCM client stream handed over
+ * from the old transport, in which case there is no D-Bus invocation. */
+struct bluealsa_pcm_open_request {
+	GDBusMethodInvocation *inv;
+	/* batch of requests opened with a single method call */
+	struct bluealsa_pcm_open_batch *batch;
+	size_t batch_index;
+	struct ba_transport_pcm *pcm;
+	bool shm;
+	/* the PCM has been claimed by this request */
+	bool claimed;
+	/* the transport has to be acquired */
+	bool acquire;
+	/* transport acquisition error */
+	int err;
+	/* next request waiting for the same IO thread */
+	struct bluealsa_pcm_open_request *watch_next;
+	int pcm_fds[4];
+	int shm_fds[3];
+};
+
+/**
+ * Batch of PCM open requests.
+ *
+ * All requests of the batch are processed concurrently (e.g. transports are
+ * acquired in parallel) and the reply is sent when the last one completes.
+ * If any request fails, the error is returned and the client endpoints of
+ * already opened PCMs are closed, so these PCMs are released as if closed
+ * by the client. */
+struct bluealsa_pcm_open_batch {
+	GDBusMethodInvocation *inv;
+	/* number of not completed requests */
+	size_t pending;
+	/* client endpoints (PCM and control) of opened PCMs */
+	int (*fds)[2];
+	size_t fds_len;
+	/* the first error of the batch */
+	GError *error;
+};
+
+static void bluealsa_pcm_open_batch_complete(struct bluealsa_pcm_open_batch *batch) {
+
+	size_t i;
+
+	if (--batch->pending > 0)
+		return;
+
+	if (batch->error != NULL)
+		g_dbus_method_invocation_return_gerror(batch->inv, batch->error);
+	else {
+
+		GUnixFDList *fd_list = g_unix_fd_list_new();
+		GVariantBuilder fds;
+
+		g_variant_builder_init(&fds, G_VARIANT_TYPE("a(hh)"));
+
+		/* Ownership of file descriptors is passed to the FD list. */
+		for (i = 0; i < batch->fds_len; i++) {
+			const int index = g_unix_fd_list_append(fd_list, batch->fds[i][0], NULL);
+			g_variant_builder_add(&fds, "(hh)", index,
+					g_unix_fd_list_append(fd_list, batch->fds[i][1], NULL));
+		}
+
+		g_dbus_method_invocation_return_value_with_unix_fd_list(batch->inv,
+				g_variant_new("(a(hh))", &fds), fd_list);
+		g_object_unref(fd_list);
+
+	}
+
+	for (i = 0; i < batch->fds_len; i++) {
+		if (batch->fds[i][0] != -1)
+			close(batch->fds[i][0]);
+		if (batch->fds[i][1] != -1)
+			close(batch->fds[i][1]);
+	}
+
+	if (batch->error != NULL)
+		g_error_free(batch->error);
+	free(batch->fds);
+	free(batch);
+
+}
+
+/**
+ * Report the open request error.
+ *
+ * For the batch request only the first error is reported. For the PCM
+ * handover there is no D-Bus invocation to reply to, so the error is only
+ * logged. */
+static void bluealsa_pcm_open_request_return_error(struct bluealsa_pcm_open_request *req,
+		GDBusError code, const char *format, ...) {
+
+	va_list ap;
+	va_start(ap, format);
+	char *msg = g_strdup_vprintf(format, ap);
+	va_end(ap);
+
+	if (req->inv != NULL)
+		g_dbus_method_invocation_return_error_literal(req->inv, G_DBUS_ERROR, code, msg);
+	else if (req->batch != NULL) {
+		if (req->batch->error == NULL)
+			req->batch->error = g_error_new(G_DBUS_ERROR, code, "%s: %s",
+					req->pcm->ba_dbus_path, msg);
+	}
+	else
+		error("Couldn't attach PCM stream: %s", msg);
+
+	g_free(msg);
+}
+
+/**
+ * Reply to the open request with the client endpoints of the FIFO stream.
+ *
+ * Ownership of file descriptors is taken by this function. */
+static void bluealsa_pcm_open_request_return_fds(struct bluealsa_pcm_open_request *req,
+		int pcm_fd, int ctrl_fd) {
+
+	if (req->batch != NULL) {
+		req->batch->fds[req->batch_index][0] = pcm_fd;
+		req->batch->fds[req->batch_index][1] = ctrl_fd;
+		return;
+	}
+
+	int fds[2] = { pcm_fd, ctrl_fd };
+	GUnixFDList *fd_list = g_unix_fd_list_new_from_array(fds, 2);
+	g_dbus_method_invocation_return_value_with_unix_fd_list(req->inv,
+			g_variant_new("(hh)", 0, 1), fd_list);
+	g_object_unref(fd_list);
+
+}
+
+static void bluealsa_pcm_open_request_free(struct bluealsa_pcm_open_request *req) {
+
+	struct bluealsa_pcm_open_batch *batch = req->batch;
+	struct ba_transport_pcm *pcm = req->pcm;
+	size_t i;
+
+	if (req->claimed) {
+		pthread_mutex_lock(&pcm->mutex);
+		if (shm_ring_is_mapped(&pcm->shm) && pcm->fd == -1) {
+			shm_ring_free(&pcm->shm);
+			if (pcm->shm_ctrl_fd != -1)
+				close(pcm->shm_ctrl_fd);
+			pcm->shm_ctrl_fd = -1;
+		}
+		pcm->opening = false;
+		pthread_mutex_unlock(&pcm->mutex);
+	}
+
+	/* clean up created file descriptors */
+	for (i = 0; i < ARRAYSIZE(req->pcm_fds); i++)
+		if (req->pcm_fds[i] != -1)
+			close(req->pcm_fds[i]);
+	for (i = 0; i < ARRAYSIZE(req->shm_fds); i++)
+		if (req->shm_fds[i] != -1)
+			close(req->shm_fds[i]);
+
+	ba_transport_pcm_unref(pcm);
+	free(req);
+
+	if (batch != NULL)
+		bluealsa_pcm_open_batch_complete(batch);
+
+}
+
+static void bluealsa_pcm_open_request_error(struct bluealsa_pcm_open_request *req,
+		GDBusError code, const char *stage, int err) {
+	bluealsa_pcm_open_request_return_error(req, code, "%s: %s", stage, strerror(err));
+}
+
+/**
+ * Activate the PCM and reply to the open request. */
+static gboolean bluealsa_pcm_open_finish(void *userdata) {
+
+	struct bluealsa_pcm_open_request *req = userdata;
+	GDBusMethodInvocation *inv = req->inv;
+	struct ba_transport_pcm *pcm = req->pcm;
+	const bool is_sink = pcm->mode == BA_TRANSPORT_PCM_MODE_SINK;
+	struct ba_transport_thread *th = pcm->th;
+	int *pcm_fds = req->pcm_fds;
+	int *shm_fds = req->shm_fds;
+
+	if (req->err != 0) {
+		bluealsa_pcm_open_request_error(req, G_DBUS_ERROR_FAILED,
+				"Acquire transport", req->err);
+		goto fail;
+	}
+
+	pthread_mutex_lock(&th->mutex);
+	enum ba_transport_thread_state state = th->state;
+	pthread_mutex_unlock(&th->mutex);
+
+	/* bail if something has gone wrong */
+	if (req->acquire && state != BA_TRANSPORT_THREAD_STATE_RUNNING) {
+		bluealsa_pcm_open_request_error(req, G_DBUS_ERROR_IO_ERROR,
+				"Acquire transport", EIO);
+		goto fail;
+	}
+
+	pthread_mutex_lock(&pcm->mutex);
+
+	/* compressed stream can not be resampled */
+	if (pcm->client_sampling != pcm->sampling &&
+			BA_TRANSPORT_PCM_FORMAT_IS_COMPRESSED(pcm->format)) {
+		pthread_mutex_unlock(&pcm->mutex);
+		bluealsa_pcm_open_request_error(req, G_DBUS_ERROR_NOT_SUPPORTED,
+				"Setup resampler", ENOTSUP);
+		goto fail;
+	}
+
+	if (pcm->client_sampling != pcm->sampling &&
+			resampler_init(&pcm->resampler, config.resampler_quality,
+				BA_TRANSPORT_PCM_FORMAT_WIDTH(pcm->codec_format), pcm->channels,
+				pcm->client_sampling, pcm->sampling) == -1) {
+		const int err = errno;
+		pthread_mutex_unlock(&pcm->mutex);
+		bluealsa_pcm_open_request_error(req, G_DBUS_ERROR_FAILED,
+				"Setup resampler", err);
+		goto fail;
+	}
+
+	if (req->shm)
+		/* In the sink mode we will wait for data, otherwise for space. */
+		pcm->fd = is_sink ? pcm->shm.efd_data : pcm->shm.efd_space;
+	else {
+		/* get correct PIPE endpoint - PIPE is unidirectional */
+		pcm->fd = pcm_fds[is_sink ? 0 : 1];
+		pcm_fds[is_sink ? 0 : 1] = -1;
+	}
+	/* set newly opened PCM as active */
+	pcm->active = true;
+	pcm->opening = false;
+	ba_transport_pcm_position_reset(pcm);
+	req->claimed = false;
+
+	GIOChannel *ch = g_io_channel_unix_new(pcm_fds[2]);
+	pcm->ba_dbus_ctrl_source = g_io_add_watch_full(ch, G_PRIORITY_DEFAULT,
+			G_IO_IN, bluealsa_pcm_controller, ba_transport_pcm_ref(pcm),
+			(GDestroyNotify)ba_transport_pcm_unref);
+	pcm->ba_dbus_ctrl_fd = pcm_fds[2];
+	g_io_channel_set_close_on_unref(ch, TRUE);
+	g_io_channel_set_encoding(ch, NULL, NULL);
+	g_io_channel_unref(ch);
+	pcm_fds[2] = -1;
+
+	/* notify our audio thread that the FIFO is ready - the monitor is
+	 * fed with the stream of the playback PCM, so there is no one to
+	 * notify in such case */
+	if (!ba_transport_pcm_is_monitor(pcm))
+		ba_transport_thread_signal_send_pcm(th, BA_TRANSPORT_THREAD_SIGNAL_PCM_OPEN, pcm);
+
+	pthread_mutex_unlock(&pcm->mutex);
+
+	/* the handed over stream is already connected with the client */
+	if (inv == NULL && req->batch == NULL)
+		goto fail;
+
+	if (req->shm) {
+		/* Ownership of file descriptors is passed to the FD list. */
+		int fds[4] = { shm_fds[0], shm_fds[1], shm_fds[2], pcm_fds[3] };
+		GUnixFDList *fd_list = g_unix_fd_list_new_from_array(fds, 4);
+		g_dbus_method_invocation_return_value_with_unix_fd_list(inv,
+				g_variant_new("(hhhh)", 0, 1, 2, 3), fd_list);
+		shm_fds[0] = shm_fds[1] = shm_fds[2] = pcm_fds[3] = -1;
+		g_object_unref(fd_list);
+	}
+	else {
+		bluealsa_pcm_open_request_return_fds(req, pcm_fds[is_sink ? 1 : 0], pcm_fds[3]);
+		pcm_fds[is_sink ? 1 : 0] = pcm_fds[3] = -1;
+	}
+
+fail:
+	bluealsa_pcm_open_request_free(req);
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * Transport IO thread state watch of the pending open request.
+ *
+ * This function is called with the IO thread mutex held. */
+static void bluealsa_pcm_open_state_watch(struct ba_transport_thread *th, void *userdata) {
+	/* wait until ready to process audio or until the thread terminates */
+	if (th->state == BA_TRANSPORT_THREAD_STATE_STARTING)
+		return;
+	th->state_watch = NULL;
+	th->state_watch_data = NULL;
+	struct bluealsa_pcm_open_request *req, *next;
+	for (req = userdata; req != NULL; req = next) {
+		next = req->watch_next;
+		g_idle_add(bluealsa_pcm_open_finish, req);
+	}
+}
+
+/**
+ * Acquire transport of the pending open request.
+ *
+ * The transport acquisition is a blocking operation (e.g. it might involve
+ * a D-Bus call to BlueZ), so this function runs in a dedicated thread. */
+static void *bluealsa_pcm_open_acquire(struct bluealsa_pcm_open_request *req) {
+
+	struct ba_transport_thread *th = req->pcm->th;
+
+	/* The transport might be acquired asynchronously (e.g. oFono calls our
+	 * NewConnection method in return), in which case we will wait for the IO
+	 * thread to be started just like after the successful acquisition. */
+	if (ba_transport_acquire(req->pcm->t) == -1 && errno != EINPROGRESS) {
+		req->err = errno;
+		g_idle_add(bluealsa_pcm_open_finish, req);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&th->mutex);
+	if (th->state == BA_TRANSPORT_THREAD_STATE_RUNNING)
+		g_idle_add(bluealsa_pcm_open_finish, req);
+	else {
+		/* other PCM of the same IO thread (e.g. HFP speaker and microphone
+		 * in the duplex mode) might be opened at the same time */
+		if (th->state_watch == bluealsa_pcm_open_state_watch)
+			req->watch_next = th->state_watch_data;
+		th->state_watch = bluealsa_pcm_open_state_watch;
+		th->state_watch_data = req;
+	}
+	pthread_mutex_unlock(&th->mutex);
+
+	return NULL;
+}
+
+/**
+ * Process the open request with the PCM claimed and the stream created. */
+static void bluealsa_pcm_open_dispatch(struct bluealsa_pcm_open_request *req) {
+
+	struct ba_transport *t = req->pcm->t;
+
+	/* The monitor does not transfer any audio on its own, it only mirrors
+	 * the stream of the playback PCM. Hence, opening it shall not acquire
+	 * the transport nor start the encoder. */
+	if (ba_transport_pcm_is_monitor(req->pcm)) {
+		bluealsa_pcm_open_finish(req);
+		return;
+	}
+
+	/* Source profiles (A2DP Source, BAP Source and SCO Audio Gateway) should
+	 * be initialized only if the audio is about to be transferred. It is most
+	 * likely, that BT headset will not run voltage converter (power-on its
+	 * circuit board) until the transport is acquired in order to extend battery
+	 * life. For profiles like A2DP Sink and HFP headset, we will wait for
+	 * incoming connection. */
+	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE ||
+			t->type.profile & BA_TRANSPORT_PROFILE_BAP_SOURCE ||
+			t->type.profile & BA_TRANSPORT_PROFILE_MASK_AG) {
+
+		pthread_t thread;
+		int ret;
+
+		req->acquire = true;
+		if ((ret = pthread_create(&thread, NULL,
+						PTHREAD_ROUTINE(bluealsa_pcm_open_acquire), req)) != 0) {
+			bluealsa_pcm_open_request_error(req, G_DBUS_ERROR_FAILED,
+					"Acquire transport", ret);
+			bluealsa_pcm_open_request_free(req);
+			return;
+		}
+
+		pthread_detach(thread);
+		return;
+	}
+
+	bluealsa_pcm_open_finish(req);
+}
+
+/**
+ * Check whether the new client can be mixed into the opened PCM stream.
+ *
+ * This function shall be called with the PCM mutex locked. */
+static bool bluealsa_pcm_is_mixable(const struct ba_transport_pcm *pcm, bool shm) {
+	const struct ba_transport *t = pcm->t;
+	return config.a2dp.mixer && !shm &&
+		t->type.profile == BA_TRANSPORT_PROFILE_A2DP_SOURCE &&
+		pcm == &t->a2dp.pcm &&
+		!BA_TRANSPORT_PCM_FORMAT_IS_COMPRESSED(pcm->format) &&
+		pcm->fd != -1 && !pcm->opening;
+}
+
+/**
+ * Open the FIFO stream of the client mixed into the opened PCM stream.
+ *
+ * The transport is already acquired and the IO thread is running, so the
+ * reply is sent right away. This function shall be called with the PCM
+ * mutex locked. */
+static void bluealsa_pcm_open_mix_client(struct bluealsa_pcm_open_request *req) {
+
+	struct ba_transport_pcm *pcm = req->pcm;
+	int *pcm_fds = req->pcm_fds;
+
+	if (pcm->mix_clients_len == ARRAYSIZE(pcm->mix_clients)) {
+		bluealsa_pcm_open_request_return_error(req,
+				G_DBUS_ERROR_FAILED, "%s", strerror(EBUSY));
+		return;
+	}
+
+	/* create PCM control socket */
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0, &pcm_fds[2]) == -1) {
+		bluealsa_pcm_open_request_return_error(req,
+				G_DBUS_ERROR_FAILED, "Create socket: %s", strerror(errno));
+		return;
+	}
+
+	/* create PCM stream PIPE with non-blocking reading endpoint */
+	if (pipe2(&pcm_fds[0], O_CLOEXEC) == -1 ||
+			fcntl(pcm_fds[0], F_SETFL, O_NONBLOCK) == -1) {
+		bluealsa_pcm_open_request_return_error(req,
+				G_DBUS_ERROR_FAILED, "Create PIPE: %s", strerror(errno));
+		return;
+	}
+
+	struct ba_transport_pcm_mix_client *c = &pcm->mix_clients[pcm->mix_clients_len++];
+	*c = (struct ba_transport_pcm_mix_client){
+		.fd = pcm_fds[0],
+		.ctrl_fd = pcm_fds[2],
+	};
+
+	GIOChannel *ch = g_io_channel_unix_new(pcm_fds[2]);
+	c->ctrl_source = g_io_add_watch_full(ch, G_PRIORITY_DEFAULT,
+			G_IO_IN, bluealsa_pcm_controller, ba_transport_pcm_ref(pcm),
+			(GDestroyNotify)ba_transport_pcm_unref);
+	g_io_channel_set_close_on_unref(ch, TRUE);
+	g_io_channel_set_encoding(ch, NULL, NULL);
+	g_io_channel_unref(ch);
+	pcm_fds[0] = pcm_fds[2] = -1;
+
+	debug("New mixed PCM client: %d", c->fd);
+
+	bluealsa_pcm_open_request_return_fds(req, pcm_fds[1], pcm_fds[3]);
+	pcm_fds[1] = pcm_fds[3] = -1;
+
+}
+
+/**
+ * Open PCM stream with either the FIFO or the shared memory ring.
+ *
+ * The request shall be initialized with the reference to the PCM and
+ * either the D-Bus invocation or the batch it belongs to. */
+static void bluealsa_pcm_open_request_process(struct bluealsa_pcm_open_request *req) {
+
+	struct ba_transport_pcm *pcm = req->pcm;
+	const bool is_sink = pcm->mode == BA_TRANSPORT_PCM_MODE_SINK;
+	const bool shm = req->shm;
+	struct ba_transport *t = pcm->t;
+	int *pcm_fds = req->pcm_fds;
+	int *shm_fds = req->shm_fds;
+
+	/* Prevent two (or more) clients trying to
+	 * open the same PCM at the same time. */
+	pthread_mutex_lock(&pcm->mutex);
+
+	/* preliminary check whether HFP codes is selected */
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO &&
+			t->type.codec == HFP_CODEC_UNDEFINED) {
+		bluealsa_pcm_open_request_return_error(req,
+				G_DBUS_ERROR_FAILED, "HFP audio codec not selected");
+		goto fail;
+	}
+
+	/* offloaded SCO audio does not pass through BlueALSA */
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO &&
+			t->d->a->sco_offload) {
+		bluealsa_pcm_open_request_return_error(req,
+				G_DBUS_ERROR_NOT_SUPPORTED, "SCO audio routed via PCM interface");
+		goto fail;
+	}
+
+	if (bluealsa_pcm_is_mixable(pcm, shm)) {
+		/* the request is completed without claiming the PCM */
+		bluealsa_pcm_open_mix_client(req);
+		goto fail;
+	}
+
+	if (pcm->fd != -1 || pcm->opening) {
+		bluealsa_pcm_open_request_return_error(req,
+				G_DBUS_ERROR_FAILED, "%s", strerror(EBUSY));
+		goto fail;
+	}
+
+	/* audio for the broadcast group member is provided by the leader */
+	if (t->type.profile == BA_TRANSPORT_PROFILE_A2DP_SOURCE &&
+			ba_transport_group_is_member(t)) {
+		bluealsa_pcm_open_request_return_error(req,
+				G_DBUS_ERROR_FAILED, "PCM is a broadcast group member");
+		goto fail;
+	}
+
+	pcm->opening = true;
+	req->claimed = true;
+
+	/* create PCM control socket */
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0, &pcm_fds[2]) == -1) {
+		bluealsa_pcm_open_request_return_error(req,
+				G_DBUS_ERROR_FAILED, "Create socket: %s", strerror(errno));
+		goto fail;
+	}
+
+	if (shm) {
+
+		/* For playback keep the ring small (about 20 ms of audio), because its
+		 * size contributes to the overall delay. The size for capture matches
+		 * the default size of the PIPE buffer. */
+		const size_t size = is_sink ? pcm->client_sampling / 50 * pcm->client_channels *
+			BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->format) : 65536;
+
+		/* create PCM stream shared memory ring */
+		if (shm_ring_create(&pcm->shm, size) == -1 ||
+				(pcm->shm_ctrl_fd = fcntl(pcm_fds[2], F_DUPFD_CLOEXEC, 0)) == -1 ||
+				(shm_fds[0] = fcntl(pcm->shm.fd, F_DUPFD_CLOEXEC, 0)) == -1 ||
+				(shm_fds[1] = fcntl(pcm->shm.efd_data, F_DUPFD_CLOEXEC, 0)) == -1 ||
+				(shm_fds[2] = fcntl(pcm->shm.efd_space, F_DUPFD_CLOEXEC, 0)) == -1) {
+			bluealsa_pcm_open_request_return_error(req,
+					G_DBUS_ERROR_FAILED, "Create shared memory: %s", strerror(errno));
+			goto fail;
+		}
+
+	}
+	else {
+
+		/* create PCM stream PIPE */
+		if (pipe2(&pcm_fds[0], O_CLOEXEC) == -1) {
+			bluealsa_pcm_open_request_return_error(req,
+					G_DBUS_ERROR_FAILED, "Create PIPE: %s", strerror(errno));
+			goto fail;
+		}
+
+		/* set our internal endpoint as non-blocking. */
+		if (fcntl(pcm_fds[is_sink ? 0 : 1], F_SETFL, O_NONBLOCK) == -1) {
+			bluealsa_pcm_open_request_return_error(req,
+					G_DBUS_ERROR_FAILED, "Setup PIPE: %s", strerror(errno));
+			goto fail;
+		}
+
+	}
+
+	pthread_mutex_unlock(&pcm->mutex);
+
+	bluealsa_pcm_open_dispatch(req);
+	return;
+
+fail:
+	pthread_mutex_unlock(&pcm->mutex);
+	bluealsa_pcm_open_request_free(req);
+}
+
+static void bluealsa_pcm_open_stream(GDBusMethodInvocation *inv, bool shm) {
+
+	void *userdata = g_dbus_method_invocation_get_user_data(inv);
+	struct ba_transport_pcm *pcm = (struct ba_transport_pcm *)userdata;
+	struct bluealsa_pcm_open_request *req;
+
+	if ((req = malloc(sizeof(*req))) == NULL) {
+		g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
+				G_DBUS_ERROR_NO_MEMORY, "%s", strerror(ENOMEM));
+		ba_transport_pcm_unref(pcm);
+		return;
+	}
+
+	*req = (struct bluealsa_pcm_open_request){
+		.inv = inv,
+		.pcm = pcm,
+		.shm = shm,
+		.pcm_fds = { -1, -1, -1, -1 },
+		.shm_fds = { -1, -1, -1 },
+	};
+
+	bluealsa_pcm_open_request_process(req);
+}
+
+static void bluealsa_pcm_open(GDBusMethodInvocation *inv) {
+	bluealsa_pcm_open_stream(inv, false);
+}
+
+/**
+ * Lookup PCM by its D-Bus object path.
+ *
+ * @return On success this function returns the referenced PCM, which shall
+ *   be unreferenced with ba_transport_pcm_unref(). Otherwise, NULL. */
+static struct ba_transport_pcm *bluealsa_pcm_lookup(const char *path) {
+
+	struct ba_adapter *a = NULL;
+	struct ba_device *d = NULL;
+	struct ba_transport_pcm *pcm = NULL;
+	bdaddr_t addr;
+
+	if ((a = ba_adapter_lookup(g_dbus_bluez_object_path_to_hci_dev_id(path))) == NULL ||
+			g_dbus_bluez_object_path_to_bdaddr(path, &addr) == NULL ||
+			(d = ba_device_lookup(a, &addr)) == NULL)
+		goto final;
+
+	GHashTableIter iter;
+	struct ba_transport *t;
+
+	pthread_rwlock_rdlock(&d->transports_lock);
+	g_hash_table_iter_init(&iter, d->transports);
+	while (pcm == NULL && g_hash_table_iter_next(&iter, NULL, (gpointer)&t)) {
+
+		struct ba_transport_pcm *pcms[3] = { NULL };
+		size_t i;
+
+		if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP) {
+			pcms[0] = &t->a2dp.pcm;
+			pcms[1] = &t->a2dp.pcm_bc;
+			pcms[2] = &t->a2dp.pcm_monitor;
+		}
+		else if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO) {
+			pcms[0] = &t->sco.spk_pcm;
+			pcms[1] = &t->sco.mic_pcm;
+		}
+		else if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_BAP) {
+			pcms[0] = &t->bap.pcm;
+		}
+
+		for (i = 0; i < ARRAYSIZE(pcms); i++)
+			if (pcms[i] != NULL && pcms[i]->ba_dbus_id != 0 &&
+					strcmp(pcms[i]->ba_dbus_path, path) == 0) {
+				pcm = ba_transport_pcm_ref(pcms[i]);
+				break;
+			}
+
+	}
+	pthread_rwlock_unlock(&d->transports_lock);
 
-	return TRUE;
+final:
+	if (d != NULL)
+		ba_device_unref(d);
+	if (a != NULL)
+		ba_adapter_unref(a);
+	return pcm;
 }
 
-static void bluealsa_pcm_open(GDBusMethodInvocation *inv) {
+/**
+ * Open several PCMs with a single method call.
+ *
+ * PCMs are opened in the same way as with the Open() method of the PCM
+ * interface, but all transports are acquired concurrently and the FIFO
+ * endpoints of all PCMs are returned in a single reply. */
+static void bluealsa_manager_open_pcms(GDBusMethodInvocation *inv) {
 
-	void *userdata = g_dbus_method_invocation_get_user_data(inv);
-	struct ba_transport_pcm *pcm = (struct ba_transport_pcm *)userdata;
-	const bool is_sink = pcm->mode == BA_TRANSPORT_PCM_MODE_SINK;
-	struct ba_transport_thread *th = pcm->th;
-	struct ba_transport *t = pcm->t;
-	int pcm_fds[4] = { -1, -1, -1, -1 };
-	size_t i;
+	GVariant *params = g_dbus_method_invocation_get_parameters(inv);
+	struct bluealsa_pcm_open_batch *batch;
+	struct ba_transport_pcm **pcms = NULL;
+	GVariantIter *paths;
+	const char *path;
+	size_t i, n = 0;
 
-	/* Prevent two (or more) clients trying to
-	 * open the same PCM at the same time. */
-	pthread_mutex_lock(&pcm->mutex);
+	g_variant_get(params, "(ao)", &paths);
 
-	/* preliminary check whether HFP codes is selected */
-	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO &&
-			t->type.codec == HFP_CODEC_UNDEFINED) {
+	if (g_variant_iter_n_children(paths) == 0) {
 		g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
-				G_DBUS_ERROR_FAILED, "HFP audio codec not selected");
-		goto fail;
+				G_DBUS_ERROR_INVALID_ARGS, "No PCM to open");
+		goto final;
 	}
 
-	if (pcm->fd != -1) {
+	if ((pcms = calloc(g_variant_iter_n_children(paths), sizeof(*pcms))) == NULL) {
 		g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
-				G_DBUS_ERROR_FAILED, "%s", strerror(EBUSY));
-		goto fail;
+				G_DBUS_ERROR_NO_MEMORY, "%s", strerror(ENOMEM));
+		goto final;
 	}
 
-	/* create PCM stream PIPE and PCM control socket */
-	if (pipe2(&pcm_fds[0], O_CLOEXEC) == -1 ||
-			socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0, &pcm_fds[2]) == -1) {
-		g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
-				G_DBUS_ERROR_FAILED, "Create PIPE: %s", strerror(errno));
-		goto fail;
+	/* resolve all PCMs before opening any of them */
+	while (g_variant_iter_next(paths, "&o", &path)) {
+		if ((pcms[n] = bluealsa_pcm_lookup(path)) == NULL) {
+			g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
+					G_DBUS_ERROR_UNKNOWN_OBJECT, "PCM not found: %s", path);
+			goto final;
+		}
+		n++;
 	}
 
-	/* set our internal endpoint as non-blocking. */
-	if (fcntl(pcm_fds[is_sink ? 0 : 1], F_SETFL, O_NONBLOCK) == -1) {
+	if ((batch = calloc(1, sizeof(*batch))) == NULL ||
+			(batch->fds = malloc(n * sizeof(*batch->fds))) == NULL) {
+		free(batch);
 		g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
-				G_DBUS_ERROR_FAILED, "Setup PIPE: %s", strerror(errno));
-		goto fail;
+				G_DBUS_ERROR_NO_MEMORY, "%s", strerror(ENOMEM));
+		goto final;
 	}
 
-	/* Source profiles (A2DP Source and SCO Audio Gateway) should be initialized
-	 * only if the audio is about to be transferred. It is most likely, that BT
-	 * headset will not run voltage converter (power-on its circuit board) until
-	 * the transport is acquired in order to extend battery life. For profiles
-	 * like A2DP Sink and HFP headset, we will wait for incoming connection. */
-	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE ||
-			t->type.profile & BA_TRANSPORT_PROFILE_MASK_AG) {
-
-		enum ba_transport_thread_state state;
+	batch->inv = inv;
+	batch->fds_len = n;
+	for (i = 0; i < n; i++)
+		batch->fds[i][0] = batch->fds[i][1] = -1;
 
-		if (ba_transport_acquire(t) == -1) {
-			g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
-					G_DBUS_ERROR_FAILED, "Acquire transport: %s", strerror(errno));
-			goto fail;
-		}
+	/* Hold the batch until all requests are dispatched, so the reply
+	 * will not be sent before the last request has been processed. */
+	batch->pending = n + 1;
 
-		/* wait until ready to process audio */
-		pthread_mutex_lock(&th->mutex);
-		while ((state = th->state) < BA_TRANSPORT_THREAD_STATE_RUNNING)
-			pthread_cond_wait(&th->changed, &th->mutex);
-		pthread_mutex_unlock(&th->mutex);
+	for (i = 0; i < n; i++) {
 
-		/* bail if something has gone wrong */
-		if (state != BA_TRANSPORT_THREAD_STATE_RUNNING) {
-			g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
-					G_DBUS_ERROR_IO_ERROR, "Acquire transport: %s", strerror(EIO));
-			goto fail;
+		struct bluealsa_pcm_open_request *req;
+		if ((req = malloc(sizeof(*req))) == NULL) {
+			if (batch->error == NULL)
+				batch->error = g_error_new(G_DBUS_ERROR, G_DBUS_ERROR_NO_MEMORY,
+						"%s", strerror(ENOMEM));
+			ba_transport_pcm_unref(pcms[i]);
+			batch->pending--;
+			continue;
 		}
 
-	}
-
-	/* get correct PIPE endpoint - PIPE is unidirectional */
-	pcm->fd = pcm_fds[is_sink ? 0 : 1];
-	/* set newly opened PCM as active */
-	pcm->active = true;
-
-	GIOChannel *ch = g_io_channel_unix_new(pcm_fds[2]);
-	g_io_add_watch_full(ch, G_PRIORITY_DEFAULT, G_IO_IN,
-			bluealsa_pcm_controller, ba_transport_pcm_ref(pcm),
-			(GDestroyNotify)ba_transport_pcm_unref);
-	g_io_channel_set_close_on_unref(ch, TRUE);
-	g_io_channel_set_encoding(ch, NULL, NULL);
-	g_io_channel_unref(ch);
+		*req = (struct bluealsa_pcm_open_request){
+			.batch = batch,
+			.batch_index = i,
+			.pcm = pcms[i],
+			.pcm_fds = { -1, -1, -1, -1 },
+			.shm_fds = { -1, -1, -1 },
+		};
 
-	/* notify our audio thread that the FIFO is ready */
-	ba_transport_thread_signal_send(th, BA_TRANSPORT_THREAD_SIGNAL_PCM_OPEN);
+		bluealsa_pcm_open_request_process(req);
 
-	pthread_mutex_unlock(&pcm->mutex);
-	ba_transport_pcm_unref(pcm);
+	}
 
-	int fds[2] = { pcm_fds[is_sink ? 1 : 0], pcm_fds[3] };
-	GUnixFDList *fd_list = g_unix_fd_list_new_from_array(fds, 2);
-	g_dbus_method_invocation_return_value_with_unix_fd_list(inv,
-			g_variant_new("(hh)", 0, 1), fd_list);
-	g_object_unref(fd_list);
+	/* ownership of PCM references has been passed to requests */
+	n = 0;
+	bluealsa_pcm_open_batch_complete(batch);
 
-	return;
+final:
+	for (i = 0; i < n; i++)
+		if (pcms[i] != NULL)
+			ba_transport_pcm_unref(pcms[i]);
+	free(pcms);
+	g_variant_iter_free(paths);
+}
 
-fail:
-	pthread_mutex_unlock(&pcm->mutex);
-	ba_transport_pcm_unref(pcm);
-	/* clean up created file descriptors */
-	for (i = 0; i < ARRAYSIZE(pcm_fds); i++)
-		if (pcm_fds[i] != -1)
-			close(pcm_fds[i]);
+static void bluealsa_pcm_open_shm(GDBusMethodInvocation *inv) {
+	bluealsa_pcm_open_stream(inv, true);
 }
 
 static void bluealsa_pcm_get_codecs(GDBusMethodInvocation *inv) {
@@ -538,6 +1512,17 @@ static void bluealsa_pcm_get_codecs(GDBusMethodInvocation *inv) {
 			g_variant_builder_add(&codecs, "{sa{sv}}",
 					ba_transport_codecs_hfp_to_string(HFP_CODEC_MSBC), NULL);
 #endif
+#if ENABLE_LC3_SWB
+		if (t->sco.rfcomm != NULL && t->sco.rfcomm->lc3_swb)
+			g_variant_builder_add(&codecs, "{sa{sv}}",
+					ba_transport_codecs_hfp_to_string(HFP_CODEC_LC3_SWB), NULL);
+#endif
+
+	}
+	else if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_BAP) {
+
+		g_variant_builder_add(&codecs, "{sa{sv}}",
+				ba_transport_codecs_bap_to_string(BAP_CODEC_LC3), NULL);
 
 	}
 
@@ -632,13 +1617,18 @@ static void bluealsa_pcm_select_codec(GDBusMethodInvocation *inv) {
 			goto fail;
 
 	}
-	else {
+	else if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO) {
 
 		uint16_t codec_id = ba_transport_codecs_hfp_from_string(codec);
 		if (ba_transport_select_codec_sco(t, codec_id) == -1)
 			goto fail;
 
 	}
+	else {
+		/* BAP stream configuration is chosen by the remote device */
+		errmsg = "Codec switching not supported";
+		goto fail;
+	}
 
 	g_dbus_method_invocation_return_value(inv, NULL);
 	goto final;
@@ -658,6 +1648,99 @@ final:
 		g_variant_unref(value);
 }
 
+/**
+ * Lookup A2DP source transport by the D-Bus object path of its PCM. */
+static struct ba_transport *bluealsa_pcm_lookup_a2dp_source(const char *path) {
+
+	struct ba_adapter *a = NULL;
+	struct ba_device *d = NULL;
+	struct ba_transport *t = NULL;
+	bdaddr_t addr;
+
+	if ((a = ba_adapter_lookup(g_dbus_bluez_object_path_to_hci_dev_id(path))) == NULL ||
+			g_dbus_bluez_object_path_to_bdaddr(path, &addr) == NULL ||
+			(d = ba_device_lookup(a, &addr)) == NULL)
+		goto final;
+
+	GHashTableIter iter;
+	struct ba_transport *tmp;
+
+	pthread_rwlock_rdlock(&d->transports_lock);
+	g_hash_table_iter_init(&iter, d->transports);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer)&tmp))
+		if (tmp->type.profile == BA_TRANSPORT_PROFILE_A2DP_SOURCE &&
+				strcmp(tmp->a2dp.pcm.ba_dbus_path, path) == 0) {
+			t = ba_transport_ref(tmp);
+			break;
+		}
+	pthread_rwlock_unlock(&d->transports_lock);
+
+final:
+	if (d != NULL)
+		ba_device_unref(d);
+	if (a != NULL)
+		ba_adapter_unref(a);
+	return t;
+}
+
+static void bluealsa_pcm_join_group(GDBusMethodInvocation *inv) {
+
+	GVariant *params = g_dbus_method_invocation_get_parameters(inv);
+	void *userdata = g_dbus_method_invocation_get_user_data(inv);
+	struct ba_transport_pcm *pcm = (struct ba_transport_pcm *)userdata;
+	struct ba_transport *t = pcm->t;
+	struct ba_transport *leader = NULL;
+	const char *errmsg = NULL;
+	const char *path;
+
+	g_variant_get(params, "(&o)", &path);
+
+	if (t->type.profile != BA_TRANSPORT_PROFILE_A2DP_SOURCE ||
+			pcm != &t->a2dp.pcm) {
+		errmsg = "Not an A2DP source PCM";
+		goto fail;
+	}
+
+	if ((leader = bluealsa_pcm_lookup_a2dp_source(path)) == NULL) {
+		errmsg = "Group leader PCM not found";
+		goto fail;
+	}
+
+	if (ba_transport_group_join(leader, t) == -1)
+		goto fail;
+
+	g_dbus_method_invocation_return_value(inv, NULL);
+	goto final;
+
+fail:
+	if (errmsg == NULL)
+		errmsg = strerror(errno);
+	error("Couldn't join broadcast group: %s: %s", path, errmsg);
+	g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
+			G_DBUS_ERROR_FAILED, "%s", errmsg);
+
+final:
+	if (leader != NULL)
+		ba_transport_unref(leader);
+	ba_transport_pcm_unref(pcm);
+}
+
+static void bluealsa_pcm_leave_group(GDBusMethodInvocation *inv) {
+
+	void *userdata = g_dbus_method_invocation_get_user_data(inv);
+	struct ba_transport_pcm *pcm = (struct ba_transport_pcm *)userdata;
+	struct ba_transport *t = pcm->t;
+
+	if (pcm != &t->a2dp.pcm ||
+			ba_transport_group_leave(t) == -1)
+		g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
+				G_DBUS_ERROR_FAILED, "Not a broadcast group member");
+	else
+		g_dbus_method_invocation_return_value(inv, NULL);
+
+	ba_transport_pcm_unref(pcm);
+}
+
 static void bluealsa_pcm_method_call(GDBusConnection *conn, const char *sender,
 		const char *path, const char *interface, const char *method, GVariant *params,
 		GDBusMethodInvocation *invocation, void *userdata) {
@@ -666,14 +1749,21 @@ static void bluealsa_pcm_method_call(GDBusConnection *conn, const char *sender,
 
 	static const GDBusMethodCallDispatcher dispatchers[] = {
 		{ .method = "Open",
-			.handler = bluealsa_pcm_open,
-			.asynchronous_call = true },
+			.handler = bluealsa_pcm_open },
+		{ .method = "OpenSharedMemory",
+			.handler = bluealsa_pcm_open_shm },
 		{ .method = "GetCodecs",
 			.handler = bluealsa_pcm_get_codecs,
 			.asynchronous_call = true },
 		{ .method = "SelectCodec",
 			.handler = bluealsa_pcm_select_codec,
 			.asynchronous_call = true },
+		{ .method = "JoinGroup",
+			.handler = bluealsa_pcm_join_group,
+			.asynchronous_call = true },
+		{ .method = "LeaveGroup",
+			.handler = bluealsa_pcm_leave_group,
+			.asynchronous_call = true },
 		{ NULL },
 	};
 
@@ -753,14 +1843,32 @@ static GVariant *bluealsa_pcm_get_property(GDBusConnection *conn,
 		return ba_variant_new_pcm_mode(pcm);
 	if (strcmp(property, "Format") == 0)
 		return ba_variant_new_pcm_format(pcm);
+	if (strcmp(property, "Formats") == 0)
+		return ba_variant_new_pcm_formats(pcm);
 	if (strcmp(property, "Channels") == 0)
 		return ba_variant_new_pcm_channels(pcm);
 	if (strcmp(property, "Sampling") == 0)
 		return ba_variant_new_pcm_sampling(pcm);
+	if (strcmp(property, "Samplings") == 0)
+		return ba_variant_new_pcm_samplings(pcm);
 	if (strcmp(property, "Codec") == 0)
 		return ba_variant_new_pcm_codec(pcm);
+	if (strcmp(property, "BlockFrames") == 0)
+		return ba_variant_new_pcm_block_frames(pcm);
 	if (strcmp(property, "Delay") == 0)
 		return ba_variant_new_pcm_delay(pcm);
+	if (strcmp(property, "ConcealedFrames") == 0)
+		return ba_variant_new_pcm_concealed_frames(pcm);
+	if (strcmp(property, "Scheduling") == 0)
+		return ba_variant_new_pcm_scheduling(pcm);
+	if (strcmp(property, "Statistics") == 0)
+		return ba_variant_new_pcm_statistics(pcm);
+	if (strcmp(property, "OverrunPolicy") == 0)
+		return ba_variant_new_pcm_overrun_policy(pcm);
+	if (strcmp(property, "SwapChannels") == 0)
+		return ba_variant_new_pcm_swap_channels(pcm);
+	if (strcmp(property, "KeepWarm") == 0)
+		return ba_variant_new_pcm_keep_warm(pcm);
 	if (strcmp(property, "SoftVolume") == 0)
 		return ba_variant_new_pcm_soft_volume(pcm);
 	if (strcmp(property, "Volume") == 0)
@@ -805,6 +1913,55 @@ static gboolean bluealsa_pcm_set_property(GDBusConnection *conn,
 
 	struct ba_transport_pcm *pcm = (struct ba_transport_pcm *)userdata;
 
+	if (strcmp(property, "Format") == 0) {
+		const uint16_t format = g_variant_get_uint16(value);
+		if (ba_transport_pcm_set_format(pcm, format) == -1) {
+			*error = g_error_new(G_DBUS_ERROR, errno == EBUSY ?
+					G_DBUS_ERROR_FAILED : G_DBUS_ERROR_INVALID_ARGS,
+					"Couldn't set PCM format %#x: %s", format, strerror(errno));
+			return FALSE;
+		}
+		return TRUE;
+	}
+	if (strcmp(property, "Channels") == 0) {
+		const uint8_t channels = g_variant_get_byte(value);
+		if (ba_transport_pcm_set_channels(pcm, channels) == -1) {
+			*error = g_error_new(G_DBUS_ERROR, errno == EBUSY ?
+					G_DBUS_ERROR_FAILED : G_DBUS_ERROR_INVALID_ARGS,
+					"Couldn't set PCM channels %u: %s", channels, strerror(errno));
+			return FALSE;
+		}
+		return TRUE;
+	}
+	if (strcmp(property, "Sampling") == 0) {
+		const uint32_t sampling = g_variant_get_uint32(value);
+		if (ba_transport_pcm_set_sampling(pcm, sampling) == -1) {
+			*error = g_error_new(G_DBUS_ERROR, errno == EBUSY ?
+					G_DBUS_ERROR_FAILED : G_DBUS_ERROR_INVALID_ARGS,
+					"Couldn't set PCM sampling %u: %s", sampling, strerror(errno));
+			return FALSE;
+		}
+		return TRUE;
+	}
+	if (strcmp(property, "SwapChannels") == 0) {
+		ba_transport_pcm_set_swap_channels(pcm, g_variant_get_boolean(value));
+		return TRUE;
+	}
+	if (strcmp(property, "KeepWarm") == 0) {
+		ba_device_set_warm(pcm->t->d, g_variant_get_boolean(value));
+		return TRUE;
+	}
+	if (strcmp(property, "OverrunPolicy") == 0) {
+		const char *name = g_variant_get_string(value, NULL);
+		enum ba_transport_pcm_overrun overrun;
+		if (ba_transport_pcm_overrun_from_string(name, &overrun) == -1 ||
+				ba_transport_pcm_set_overrun(pcm, overrun) == -1) {
+			*error = g_error_new(G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+					"Invalid PCM overrun policy: %s", name);
+			return FALSE;
+		}
+		return TRUE;
+	}
 	if (strcmp(property, "SoftVolume") == 0) {
 		pcm->soft_volume = g_variant_get_boolean(value);
 		bluealsa_dbus_pcm_update(pcm, BA_DBUS_PCM_UPDATE_SOFT_VOLUME);
@@ -837,6 +1994,77 @@ static gboolean bluealsa_pcm_set_property(GDBusConnection *conn,
 	return FALSE;
 }
 
+static void bluealsa_dbus_pcm_emit_update(struct ba_transport_pcm *pcm, unsigned int mask) {
+
+	GVariantBuilder props;
+	g_variant_builder_init(&props, G_VARIANT_TYPE("a{sv}"));
+
+	if (mask & BA_DBUS_PCM_UPDATE_FORMAT) {
+		g_variant_builder_add(&props, "{sv}", "Format", ba_variant_new_pcm_format(pcm));
+		g_variant_builder_add(&props, "{sv}", "Formats", ba_variant_new_pcm_formats(pcm));
+	}
+	if (mask & BA_DBUS_PCM_UPDATE_CHANNELS)
+		g_variant_builder_add(&props, "{sv}", "Channels", ba_variant_new_pcm_channels(pcm));
+	if (mask & BA_DBUS_PCM_UPDATE_SAMPLING) {
+		g_variant_builder_add(&props, "{sv}", "Sampling", ba_variant_new_pcm_sampling(pcm));
+		g_variant_builder_add(&props, "{sv}", "Samplings", ba_variant_new_pcm_samplings(pcm));
+	}
+	if (mask & BA_DBUS_PCM_UPDATE_CODEC)
+		g_variant_builder_add(&props, "{sv}", "Codec", ba_variant_new_pcm_codec(pcm));
+	if (mask & (BA_DBUS_PCM_UPDATE_SAMPLING | BA_DBUS_PCM_UPDATE_CODEC))
+		g_variant_builder_add(&props, "{sv}", "BlockFrames", ba_variant_new_pcm_block_frames(pcm));
+	if (mask & BA_DBUS_PCM_UPDATE_DELAY)
+		g_variant_builder_add(&props, "{sv}", "Delay", ba_variant_new_pcm_delay(pcm));
+	if (mask & BA_DBUS_PCM_UPDATE_SOFT_VOLUME)
+		g_variant_builder_add(&props, "{sv}", "SoftVolume", ba_variant_new_pcm_soft_volume(pcm));
+	if (mask & BA_DBUS_PCM_UPDATE_VOLUME)
+		g_variant_builder_add(&props, "{sv}", "Volume", ba_variant_new_pcm_volume(pcm));
+
+	g_dbus_connection_emit_signal(config.dbus, NULL, pcm->ba_dbus_path,
+			DBUS_IFACE_PROPERTIES, "PropertiesChanged",
+			g_variant_new("(sa{sv}as)", BLUEALSA_IFACE_PCM, &props, NULL), NULL);
+
+	g_variant_builder_clear(&props);
+}
+
+static gboolean bluealsa_dbus_pcm_update_dispatch(void *userdata) {
+
+	struct ba_transport_pcm *pcm = userdata;
+	unsigned int mask;
+
+	pthread_mutex_lock(&pcm->ba_dbus_props_mtx);
+	mask = pcm->ba_dbus_update_mask;
+	pcm->ba_dbus_update_mask = 0;
+	pthread_mutex_unlock(&pcm->ba_dbus_props_mtx);
+
+	if (mask != 0)
+		bluealsa_dbus_pcm_emit_update(pcm, mask);
+
+	/* Persist the state which shall survive reconnection. Updates are
+	 * already merged here, and the storage is written lazily anyway. */
+	if (mask & (BA_DBUS_PCM_UPDATE_CODEC | BA_DBUS_PCM_UPDATE_SOFT_VOLUME |
+				BA_DBUS_PCM_UPDATE_VOLUME))
+		storage_pcm_data_update(pcm);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean bluealsa_dbus_pcm_update_source_dispatch(GSource *source,
+		GSourceFunc callback, void *userdata) {
+	/* disarm source until the next update request */
+	g_source_set_ready_time(source, -1);
+	return callback(userdata);
+}
+
+/**
+ * PCM update source is created once per PCM and it is armed by setting its
+ * ready time. Unlike the timeout source, which has to be created for every
+ * scheduled update, arming does not allocate memory, so updates can be
+ * requested from the IO thread on the steady-state path. */
+static GSourceFuncs bluealsa_dbus_pcm_update_source_funcs = {
+	.dispatch = bluealsa_dbus_pcm_update_source_dispatch,
+};
+
 /**
  * Register BlueALSA D-Bus PCM interface. */
 unsigned int bluealsa_dbus_pcm_register(struct ba_transport_pcm *pcm, GError **error) {
@@ -853,6 +2081,15 @@ unsigned int bluealsa_dbus_pcm_register(struct ba_transport_pcm *pcm, GError **e
 
 		ba_transport_pcm_ref(pcm);
 
+		GSource *source = g_source_new(&bluealsa_dbus_pcm_update_source_funcs, sizeof(*source));
+		g_source_set_callback(source, bluealsa_dbus_pcm_update_dispatch,
+				ba_transport_pcm_ref(pcm), (GDestroyNotify)ba_transport_pcm_unref);
+		g_source_attach(source, NULL);
+
+		pthread_mutex_lock(&pcm->ba_dbus_props_mtx);
+		pcm->ba_dbus_update_source = source;
+		pthread_mutex_unlock(&pcm->ba_dbus_props_mtx);
+
 		GVariantBuilder props;
 		ba_variant_populate_pcm(&props, pcm);
 
@@ -866,31 +2103,34 @@ unsigned int bluealsa_dbus_pcm_register(struct ba_transport_pcm *pcm, GError **e
 	return pcm->ba_dbus_id;
 }
 
+/**
+ * Announce PCM properties change.
+ *
+ * Changes reported within the configured update interval are merged, so
+ * only one PropertiesChanged signal with the union of changed properties
+ * is emitted. Values are read at the moment of the signal emission. */
 void bluealsa_dbus_pcm_update(struct ba_transport_pcm *pcm, unsigned int mask) {
 
-	GVariantBuilder props;
-	g_variant_builder_init(&props, G_VARIANT_TYPE("a{sv}"));
+	pthread_mutex_lock(&pcm->ba_dbus_props_mtx);
 
-	if (mask & BA_DBUS_PCM_UPDATE_FORMAT)
-		g_variant_builder_add(&props, "{sv}", "Format", ba_variant_new_pcm_format(pcm));
-	if (mask & BA_DBUS_PCM_UPDATE_CHANNELS)
-		g_variant_builder_add(&props, "{sv}", "Channels", ba_variant_new_pcm_channels(pcm));
-	if (mask & BA_DBUS_PCM_UPDATE_SAMPLING)
-		g_variant_builder_add(&props, "{sv}", "Sampling", ba_variant_new_pcm_sampling(pcm));
-	if (mask & BA_DBUS_PCM_UPDATE_CODEC)
-		g_variant_builder_add(&props, "{sv}", "Codec", ba_variant_new_pcm_codec(pcm));
-	if (mask & BA_DBUS_PCM_UPDATE_DELAY)
-		g_variant_builder_add(&props, "{sv}", "Delay", ba_variant_new_pcm_delay(pcm));
-	if (mask & BA_DBUS_PCM_UPDATE_SOFT_VOLUME)
-		g_variant_builder_add(&props, "{sv}", "SoftVolume", ba_variant_new_pcm_soft_volume(pcm));
-	if (mask & BA_DBUS_PCM_UPDATE_VOLUME)
-		g_variant_builder_add(&props, "{sv}", "Volume", ba_variant_new_pcm_volume(pcm));
+	/* Every property announced with this signal is a part of the cached
+	 * snapshot, so any change invalidates the snapshot. The DELAY update
+	 * is an exception, because delay is not cached at all. */
+	if (mask & ~BA_DBUS_PCM_UPDATE_DELAY && pcm->ba_dbus_props != NULL) {
+		g_variant_unref(pcm->ba_dbus_props);
+		pcm->ba_dbus_props = NULL;
+	}
 
-	g_dbus_connection_emit_signal(config.dbus, NULL, pcm->ba_dbus_path,
-			DBUS_IFACE_PROPERTIES, "PropertiesChanged",
-			g_variant_new("(sa{sv}as)", BLUEALSA_IFACE_PCM, &props, NULL), NULL);
+	if (pcm->ba_dbus_update_source != NULL) {
+		/* arm the update source on the first change within the interval */
+		if (pcm->ba_dbus_update_mask == 0)
+			g_source_set_ready_time(pcm->ba_dbus_update_source,
+					g_get_monotonic_time() + config.dbus_update_interval * 1000);
+		pcm->ba_dbus_update_mask |= mask;
+	}
+
+	pthread_mutex_unlock(&pcm->ba_dbus_props_mtx);
 
-	g_variant_builder_clear(&props);
 }
 
 void bluealsa_dbus_pcm_unregister(struct ba_transport_pcm *pcm) {
@@ -901,12 +2141,153 @@ void bluealsa_dbus_pcm_unregister(struct ba_transport_pcm *pcm) {
 	g_dbus_connection_unregister_object(config.dbus, pcm->ba_dbus_id);
 	pcm->ba_dbus_id = 0;
 
+	/* drop pending update of the removed object */
+	pthread_mutex_lock(&pcm->ba_dbus_props_mtx);
+	GSource *source = pcm->ba_dbus_update_source;
+	pcm->ba_dbus_update_source = NULL;
+	pcm->ba_dbus_update_mask = 0;
+	pthread_mutex_unlock(&pcm->ba_dbus_props_mtx);
+	if (source != NULL) {
+		g_source_destroy(source);
+		g_source_unref(source);
+	}
+
 	g_dbus_connection_emit_signal(config.dbus, NULL,
 			"/org/bluealsa", BLUEALSA_IFACE_MANAGER, "PCMRemoved",
 			g_variant_new("(o)", pcm->ba_dbus_path), NULL);
 
 }
 
+/**
+ * Detach PCM client stream for the handover.
+ *
+ * The IO thread of the PCM shall be stopped before calling this function,
+ * so it will not access the stream which is being detached.
+ *
+ * @param pcm Pointer to the transport PCM structure.
+ * @param h Pointer to the handover structure where the stream (with its
+ *   configuration) shall be moved to.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int bluealsa_dbus_pcm_handover_detach(struct ba_transport_pcm *pcm,
+		struct ba_transport_pcm_handover *h) {
+
+	pthread_mutex_lock(&pcm->mutex);
+
+	if (pcm->fd == -1 || pcm->ba_dbus_ctrl_source == 0) {
+		pthread_mutex_unlock(&pcm->mutex);
+		return errno = ENOTCONN, -1;
+	}
+
+	/* Removing the watch will close the controller socket, so we have
+	 * to duplicate it in order to keep the client connected. */
+	if ((h->ctrl_fd = fcntl(pcm->ba_dbus_ctrl_fd, F_DUPFD_CLOEXEC, 0)) == -1) {
+		const int err = errno;
+		pthread_mutex_unlock(&pcm->mutex);
+		return errno = err, -1;
+	}
+
+	h->mode = pcm->mode;
+	h->format = pcm->format;
+	h->channels = pcm->client_channels;
+	h->client_sampling = pcm->client_sampling;
+	memcpy(h->volume, pcm->volume, sizeof(h->volume));
+
+	if (shm_ring_is_mapped(&pcm->shm)) {
+		/* The fd field is owned by the shared memory ring. */
+		h->shm = pcm->shm;
+		h->shm_ctrl_fd = pcm->shm_ctrl_fd;
+		pcm->shm.hdr = NULL;
+		pcm->shm.data = NULL;
+		pcm->shm_ctrl_fd = -1;
+	}
+	else
+		h->fd = pcm->fd;
+
+	pcm->fd = -1;
+	resampler_free(&pcm->resampler);
+
+	unsigned int source = pcm->ba_dbus_ctrl_source;
+	pcm->ba_dbus_ctrl_source = 0;
+	pcm->ba_dbus_ctrl_fd = -1;
+
+	pthread_mutex_unlock(&pcm->mutex);
+
+	g_source_remove(source);
+
+	debug("PCM stream detached: %s", pcm->ba_dbus_path);
+	return 0;
+}
+
+/**
+ * Attach PCM client stream from the handover.
+ *
+ * The stream format and sampling of the PCM shall be already set to match
+ * the ones of the detached stream. The transport is acquired in the same
+ * way as for the PCM open request, but the outcome is only logged.
+ *
+ * @param pcm Pointer to the transport PCM structure.
+ * @param h Pointer to the handover structure. On success, the ownership of
+ *   the stream is moved to the PCM.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int bluealsa_dbus_pcm_handover_attach(struct ba_transport_pcm *pcm,
+		struct ba_transport_pcm_handover *h) {
+
+	const bool is_sink = pcm->mode == BA_TRANSPORT_PCM_MODE_SINK;
+	struct bluealsa_pcm_open_request *req;
+
+	if (h->mode != pcm->mode)
+		return errno = EINVAL, -1;
+
+	if ((req = malloc(sizeof(*req))) == NULL)
+		return -1;
+
+	*req = (struct bluealsa_pcm_open_request){
+		.inv = NULL,
+		.pcm = ba_transport_pcm_ref(pcm),
+		.shm = shm_ring_is_mapped(&h->shm),
+		.pcm_fds = { -1, -1, -1, -1 },
+		.shm_fds = { -1, -1, -1 },
+	};
+
+	pthread_mutex_lock(&pcm->mutex);
+
+	if (pcm->fd != -1 || pcm->opening) {
+		pthread_mutex_unlock(&pcm->mutex);
+		bluealsa_pcm_open_request_free(req);
+		return errno = EBUSY, -1;
+	}
+
+	pcm->opening = true;
+	req->claimed = true;
+
+	memcpy(pcm->volume, h->volume, sizeof(pcm->volume));
+
+	if (req->shm) {
+		pcm->shm = h->shm;
+		pcm->shm_ctrl_fd = h->shm_ctrl_fd;
+		h->shm.hdr = NULL;
+		h->shm.data = NULL;
+		h->shm_ctrl_fd = -1;
+	}
+	else {
+		req->pcm_fds[is_sink ? 0 : 1] = h->fd;
+		h->fd = -1;
+	}
+
+	req->pcm_fds[2] = h->ctrl_fd;
+	h->ctrl_fd = -1;
+
+	pthread_mutex_unlock(&pcm->mutex);
+
+	bluealsa_dbus_pcm_update(pcm, BA_DBUS_PCM_UPDATE_VOLUME);
+
+	debug("Attaching PCM stream: %s", pcm->ba_dbus_path);
+	bluealsa_pcm_open_dispatch(req);
+	return 0;
+}
+
 /**
  * Register BlueALSA D-Bus RFCOMM interface. */
 unsigned int bluealsa_dbus_rfcomm_register(struct ba_rfcomm *r, GError **error) {
@@ -37,6 +37,11 @@ unsigned int bluealsa_dbus_pcm_register(struct ba_transport_pcm *pcm, GError **e
 void bluealsa_dbus_pcm_update(struct ba_transport_pcm *pcm, unsigned int mask);
 void bluealsa_dbus_pcm_unregister(struct ba_transport_pcm *pcm);
 
+int bluealsa_dbus_pcm_handover_detach(struct ba_transport_pcm *pcm,
+		struct ba_transport_pcm_handover *h);
+int bluealsa_dbus_pcm_handover_attach(struct ba_transport_pcm *pcm,
+		struct ba_transport_pcm_handover *h);
+
 unsigned int bluealsa_dbus_rfcomm_register(struct ba_rfcomm *r, GError **error);
 void bluealsa_dbus_rfcomm_update(struct ba_rfcomm *r, unsigned int mask);
 void bluealsa_dbus_rfcomm_unregister(struct ba_rfcomm *r);
@@ -24,10 +24,18 @@ static const GDBusArgInfo arg_fd = {
 	-1, "fd", "h", NULL
 };
 
+static const GDBusArgInfo arg_fds = {
+	-1, "fds", "a(hh)", NULL
+};
+
 static const GDBusArgInfo arg_path = {
 	-1, "path", "o", NULL
 };
 
+static const GDBusArgInfo arg_paths = {
+	-1, "paths", "ao", NULL
+};
+
 static const GDBusArgInfo arg_PCMs = {
 	-1, "PCMs", "a{oa{sv}}", NULL
 };
@@ -48,8 +56,26 @@ static const GDBusMethodInfo bluealsa_iface_manager_GetPCMs = {
 	NULL,
 };
 
+static const GDBusArgInfo *OpenPCMs_in[] = {
+	&arg_paths,
+	NULL,
+};
+
+static const GDBusArgInfo *OpenPCMs_out[] = {
+	&arg_fds,
+	NULL,
+};
+
+static const GDBusMethodInfo bluealsa_iface_manager_OpenPCMs = {
+	-1, "OpenPCMs",
+	(GDBusArgInfo **)OpenPCMs_in,
+	(GDBusArgInfo **)OpenPCMs_out,
+	NULL,
+};
+
 static const GDBusMethodInfo *bluealsa_iface_manager_methods[] = {
 	&bluealsa_iface_manager_GetPCMs,
+	&bluealsa_iface_manager_OpenPCMs,
 	NULL,
 };
 
@@ -90,9 +116,14 @@ static const GDBusPropertyInfo bluealsa_iface_manager_Adapters = {
 	-1, "Adapters", "as", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
 };
 
+static const GDBusPropertyInfo bluealsa_iface_manager_CodecCalibration = {
+	-1, "CodecCalibration", "a{sd}", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
+};
+
 static const GDBusPropertyInfo *bluealsa_iface_manager_properties[] = {
 	&bluealsa_iface_manager_Version,
 	&bluealsa_iface_manager_Adapters,
+	&bluealsa_iface_manager_CodecCalibration,
 	NULL,
 };
 
@@ -102,6 +133,14 @@ static const GDBusArgInfo *pcm_Open_out[] = {
 	NULL,
 };
 
+static const GDBusArgInfo *pcm_OpenSharedMemory_out[] = {
+	&arg_fd,
+	&arg_fd,
+	&arg_fd,
+	&arg_fd,
+	NULL,
+};
+
 static const GDBusArgInfo *pcm_GetCodecs_out[] = {
 	&arg_codecs,
 	NULL,
@@ -113,6 +152,11 @@ static const GDBusArgInfo *pcm_SelectCodec_in[] = {
 	NULL,
 };
 
+static const GDBusArgInfo *pcm_JoinGroup_in[] = {
+	&arg_path,
+	NULL,
+};
+
 static const GDBusMethodInfo bluealsa_iface_pcm_Open = {
 	-1, "Open",
 	NULL,
@@ -120,6 +164,13 @@ static const GDBusMethodInfo bluealsa_iface_pcm_Open = {
 	NULL,
 };
 
+static const GDBusMethodInfo bluealsa_iface_pcm_OpenSharedMemory = {
+	-1, "OpenSharedMemory",
+	NULL,
+	(GDBusArgInfo **)pcm_OpenSharedMemory_out,
+	NULL,
+};
+
 static const GDBusMethodInfo bluealsa_iface_pcm_GetCodecs = {
 	-1, "GetCodecs",
 	NULL,
@@ -134,10 +185,27 @@ static const GDBusMethodInfo bluealsa_iface_pcm_SelectCodec = {
 	NULL,
 };
 
+static const GDBusMethodInfo bluealsa_iface_pcm_JoinGroup = {
+	-1, "JoinGroup",
+	(GDBusArgInfo **)pcm_JoinGroup_in,
+	NULL,
+	NULL,
+};
+
+static const GDBusMethodInfo bluealsa_iface_pcm_LeaveGroup = {
+	-1, "LeaveGroup",
+	NULL,
+	NULL,
+	NULL,
+};
+
 static const GDBusMethodInfo *bluealsa_iface_pcm_methods[] = {
 	&bluealsa_iface_pcm_Open,
+	&bluealsa_iface_pcm_OpenSharedMemory,
 	&bluealsa_iface_pcm_GetCodecs,
 	&bluealsa_iface_pcm_SelectCodec,
+	&bluealsa_iface_pcm_JoinGroup,
+	&bluealsa_iface_pcm_LeaveGroup,
 	NULL,
 };
 
@@ -158,25 +226,79 @@ static const GDBusPropertyInfo bluealsa_iface_pcm_Mode = {
 };
 
 static const GDBusPropertyInfo bluealsa_iface_pcm_Format = {
-	-1, "Format", "q", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
+	-1, "Format", "q",
+	G_DBUS_PROPERTY_INFO_FLAGS_READABLE |
+	G_DBUS_PROPERTY_INFO_FLAGS_WRITABLE,
+	NULL
+};
+
+static const GDBusPropertyInfo bluealsa_iface_pcm_Formats = {
+	-1, "Formats", "aq", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
 };
 
 static const GDBusPropertyInfo bluealsa_iface_pcm_Channels = {
-	-1, "Channels", "y", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
+	-1, "Channels", "y",
+	G_DBUS_PROPERTY_INFO_FLAGS_READABLE |
+	G_DBUS_PROPERTY_INFO_FLAGS_WRITABLE,
+	NULL
 };
 
 static const GDBusPropertyInfo bluealsa_iface_pcm_Sampling = {
-	-1, "Sampling", "u", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
+	-1, "Sampling", "u",
+	G_DBUS_PROPERTY_INFO_FLAGS_READABLE |
+	G_DBUS_PROPERTY_INFO_FLAGS_WRITABLE,
+	NULL
+};
+
+static const GDBusPropertyInfo bluealsa_iface_pcm_Samplings = {
+	-1, "Samplings", "au", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
 };
 
 static const GDBusPropertyInfo bluealsa_iface_pcm_Codec = {
 	-1, "Codec", "s", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
 };
 
+static const GDBusPropertyInfo bluealsa_iface_pcm_BlockFrames = {
+	-1, "BlockFrames", "u", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
+};
+
 static const GDBusPropertyInfo bluealsa_iface_pcm_Delay = {
 	-1, "Delay", "q", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
 };
 
+static const GDBusPropertyInfo bluealsa_iface_pcm_ConcealedFrames = {
+	-1, "ConcealedFrames", "u", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
+};
+
+static const GDBusPropertyInfo bluealsa_iface_pcm_Scheduling = {
+	-1, "Scheduling", "s", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
+};
+
+static const GDBusPropertyInfo bluealsa_iface_pcm_Statistics = {
+	-1, "Statistics", "a{sv}", G_DBUS_PROPERTY_INFO_FLAGS_READABLE, NULL
+};
+
+static const GDBusPropertyInfo bluealsa_iface_pcm_OverrunPolicy = {
+	-1, "OverrunPolicy", "s",
+	G_DBUS_PROPERTY_INFO_FLAGS_READABLE |
+	G_DBUS_PROPERTY_INFO_FLAGS_WRITABLE,
+	NULL
+};
+
+static const GDBusPropertyInfo bluealsa_iface_pcm_SwapChannels = {
+	-1, "SwapChannels", "b",
+	G_DBUS_PROPERTY_INFO_FLAGS_READABLE |
+	G_DBUS_PROPERTY_INFO_FLAGS_WRITABLE,
+	NULL
+};
+
+static const GDBusPropertyInfo bluealsa_iface_pcm_KeepWarm = {
+	-1, "KeepWarm", "b",
+	G_DBUS_PROPERTY_INFO_FLAGS_READABLE |
+	G_DBUS_PROPERTY_INFO_FLAGS_WRITABLE,
+	NULL
+};
+
 static const GDBusPropertyInfo bluealsa_iface_pcm_SoftVolume = {
 	-1, "SoftVolume", "b",
 	G_DBUS_PROPERTY_INFO_FLAGS_READABLE |
@@ -197,10 +319,19 @@ static const GDBusPropertyInfo *bluealsa_iface_pcm_properties[] = {
 	&bluealsa_iface_pcm_Transport,
 	&bluealsa_iface_pcm_Mode,
 	&bluealsa_iface_pcm_Format,
+	&bluealsa_iface_pcm_Formats,
 	&bluealsa_iface_pcm_Channels,
 	&bluealsa_iface_pcm_Sampling,
+	&bluealsa_iface_pcm_Samplings,
 	&bluealsa_iface_pcm_Codec,
+	&bluealsa_iface_pcm_BlockFrames,
 	&bluealsa_iface_pcm_Delay,
+	&bluealsa_iface_pcm_ConcealedFrames,
+	&bluealsa_iface_pcm_Scheduling,
+	&bluealsa_iface_pcm_Statistics,
+	&bluealsa_iface_pcm_OverrunPolicy,
+	&bluealsa_iface_pcm_SwapChannels,
+	&bluealsa_iface_pcm_KeepWarm,
 	&bluealsa_iface_pcm_SoftVolume,
 	&bluealsa_iface_pcm_Volume,
 	NULL,
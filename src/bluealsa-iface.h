@@ -25,6 +25,8 @@
 #define BLUEALSA_TRANSPORT_TYPE_HFP_HF      "HFP-HF"
 #define BLUEALSA_TRANSPORT_TYPE_HSP_AG      "HSP-AG"
 #define BLUEALSA_TRANSPORT_TYPE_HSP_HS      "HSP-HS"
+#define BLUEALSA_TRANSPORT_TYPE_BAP_SINK    "BAP-sink"
+#define BLUEALSA_TRANSPORT_TYPE_BAP_SOURCE  "BAP-source"
 
 #define BLUEALSA_PCM_CTRL_DRAIN  "Drain"
 #define BLUEALSA_PCM_CTRL_DROP   "Drop"
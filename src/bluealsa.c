@@ -28,16 +28,27 @@ struct ba_config config = {
 	.enable.hfp_ag = true,
 	.enable.hsp_ag = true,
 
-	.adapters_mutex = PTHREAD_MUTEX_INITIALIZER,
+	.adapters_lock = PTHREAD_RWLOCK_INITIALIZER,
 
 	.device_seq = 0,
 
 	.null_fd = -1,
 
 	.keep_alive_time = 0,
+	.pacing_timer = false,
 
 	.volume_init_level = 0,
 
+	.resampler_quality = RESAMPLER_QUALITY_NONE,
+
+	.dbus_update_interval = 20,
+
+	.pcm_overrun = BA_TRANSPORT_PCM_OVERRUN_BLOCK,
+
+	/* use default (non real-time) scheduling */
+	.a2dp.sched.policy = SCHED_OTHER,
+	.sco.sched.policy = SCHED_OTHER,
+
 	.hfp.features_sdp_hf =
 		SDP_HFP_HF_FEAT_CLI |
 		SDP_HFP_HF_FEAT_VOLUME |
@@ -76,10 +87,24 @@ struct ba_config config = {
 	 * enabled, this value will be automatically updated via D-Bus event. */
 	.battery.available = false,
 	.battery.level = 100,
+	.battery.discharging = false,
+	.battery.low = false,
 
 	.a2dp.volume = false,
 	.a2dp.force_mono = false,
 	.a2dp.force_44100 = false,
+	.a2dp.abr = false,
+	.a2dp.pipeline = false,
+	.a2dp.pipeline_cpu = -1,
+	.a2dp.receiver = false,
+	.a2dp.battery_saver = 0,
+	.a2dp.fast_start = false,
+	.a2dp.auto_codec = false,
+	.a2dp.mixer = false,
+	.a2dp.monitor = false,
+	.a2dp.jitter_buffer = 0,
+	.a2dp.silence_timeout = 0,
+	.a2dp.duplex = false,
 
 	/* Try to use high SBC encoding quality as a default. */
 	.sbc_quality = SBC_QUALITY_HIGH,
@@ -94,6 +119,7 @@ struct ba_config config = {
 	 * required to use LATM version 0 (ISO-IEC 14496-3 (2001)). */
 	.aac_latm_version = 1,
 	.aac_vbr_mode = 4,
+	.aac_low_delay = false,
 #endif
 
 #if ENABLE_MP3LAME
@@ -106,6 +132,7 @@ struct ba_config config = {
 	.ldac_abr = false,
 	/* Use standard encoder quality as a reasonable default. */
 	.ldac_eqmid = LDACBT_EQMID_SQ,
+	.ldac_max_sampling = 0,
 #endif
 
 };
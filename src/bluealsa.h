@@ -27,6 +27,10 @@
 #include <gio/gio.h>
 #include <glib.h>
 
+#include "pcm-overrun.h"
+#include "resampler.h"
+#include "sched-policy.h"
+
 struct ba_config {
 
 	/* set of enabled profiles */
@@ -38,13 +42,15 @@ struct ba_config {
 		bool hfp_ag;
 		bool hsp_hs;
 		bool hsp_ag;
+		bool bap_source;
+		bool bap_sink;
 	} enable;
 
 	/* established D-Bus connection */
 	GDBusConnection *dbus;
 
 	/* adapters indexed by the HCI device ID */
-	pthread_mutex_t adapters_mutex;
+	pthread_rwlock_t adapters_lock;
 	struct ba_adapter *adapters[HCI_MAX_DEV];
 
 	/* List of HCI names (or BT addresses) used for adapters filtering
@@ -65,9 +71,45 @@ struct ba_config {
 	 * infinite time. This option applies for the source profile only. */
 	int keep_alive_time;
 
+	/* Pace outgoing transfer with a timer instead of sleeping in the IO
+	 * thread, so the PCM can be read while waiting for the deadline. */
+	bool pacing_timer;
+
 	/* the initial volume level */
 	int volume_init_level;
 
+	/* Quality of the resampler used for PCM clients which request sampling
+	 * frequency other than the one used by the codec. The resampling is
+	 * disabled (not offered to clients) when set to none. */
+	enum resampler_quality resampler_quality;
+
+	/* The number of milliseconds for which PCM property changes are merged
+	 * before emitting the D-Bus signal. Zero means no rate limiting. */
+	unsigned int dbus_update_interval;
+
+	/* Default policy applied when PCM clients do not consume data fast
+	 * enough. It can be changed for every PCM via the D-Bus API. */
+	enum ba_transport_pcm_overrun pcm_overrun;
+
+	/* Directory for the BT traffic capture files. Every IO thread stores
+	 * transferred BT packets in its own pcap file. NULL disables capture. */
+	const char *bt_capture_dir;
+
+	/* Path of the memory-mapped file with the IO threads statistics.
+	 * NULL disables metrics publishing. */
+	const char *metrics_path;
+
+	/* Benchmark encoders at startup and lower the quality settings which
+	 * this host can not sustain in real time. */
+	bool codec_calibrate;
+	/* Real-time factors of the selected encoder configurations measured
+	 * by the calibration, exposed via the D-Bus manager interface. */
+	struct {
+		uint32_t codec_id;
+		double rtf;
+	} codec_rtf[4];
+	size_t codec_rtf_len;
+
 	struct {
 		/* set of features exposed via Service Discovery */
 		unsigned int features_sdp_hf;
@@ -87,6 +129,11 @@ struct ba_config {
 		bool available;
 		/* host battery level (percentage) */
 		unsigned int level;
+		/* host is running on battery */
+		bool discharging;
+		/* Battery saver mode is active. It is updated by the main thread and
+		 * read by the IO threads, hence the atomic type. */
+		atomic_bool low;
 	} battery;
 
 	struct {
@@ -107,8 +154,75 @@ struct ba_config {
 		 * to force lower sampling in order to save Bluetooth bandwidth. */
 		bool force_44100;
 
+		/* Adjust the encoder bit rate (e.g. SBC bit-pool) according to the
+		 * BT socket queue depth, so the stream will degrade gracefully in
+		 * case of radio interferences instead of stuttering. */
+		bool abr;
+
+		/* Run BT writing in a separate thread for high bit rate encoders,
+		 * so the encoding can overlap with the transfer synchronization.
+		 * Optionally, the encoder thread can be pinned to the given CPU. */
+		bool pipeline;
+		int pipeline_cpu;
+
+		/* Host battery level (percentage) below which encoders lower their
+		 * computational cost. Zero disables the battery saver. */
+		unsigned int battery_saver;
+
+		/* Drain BT socket in a separate thread for high bit rate decoders,
+		 * so a slow PCM client will not cause the socket queue overflow. */
+		bool receiver;
+
+		/* Prime encoders with silence when the stream starts, so the first
+		 * packet will be sent as soon as any PCM data is available. */
+		bool fast_start;
+
+		/* Monitor the quality of the Bluetooth link and switch to a lower
+		 * quality codec (or codec configuration) when the link degrades. The
+		 * better codec is restored when the link quality recovers. */
+		bool auto_codec;
+
+		/* Allow more than one client to open the A2DP source PCM at the
+		 * same time. Streams are mixed by the daemon before encoding. */
+		bool mixer;
+
+		/* Expose the monitor PCM for every A2DP source transport, which
+		 * mirrors the stream passed to the encoder. */
+		bool monitor;
+
+		/* Target latency (in milliseconds) of the jitter buffer of the
+		 * decoded A2DP sink signal. Zero disables the jitter buffer. */
+		unsigned int jitter_buffer;
+
+		/* Time (in milliseconds) of the silence on the A2DP source PCM input
+		 * after which streaming is suspended. Zero disables the detection. */
+		unsigned int silence_timeout;
+
+		/* Service the A2DP source stream and its back-channel (FastStream
+		 * voice) with a single IO thread. */
+		bool duplex;
+
+		/* scheduling policy of the A2DP IO threads */
+		struct sched_policy sched;
+
 	} a2dp;
 
+	struct {
+		/* scheduling policy of the SCO IO threads and the dispatcher */
+		struct sched_policy sched;
+		/* Service both SCO PCMs with a single IO thread, which transmits
+		 * one packet for every received one, instead of pacing the
+		 * transmission with the local clock. */
+		bool duplex;
+		/* Cancel the echo of the speaker signal and suppress the noise in
+		 * the microphone signal. It requires the duplex mode. */
+		bool aec;
+		/* Route SCO audio via the controller's PCM interface to the hardware
+		 * codec on adapters which support it. In such case, SCO audio data
+		 * is not available via HCI and BlueALSA handles the signalling only. */
+		bool offload;
+	} sco;
+
 	/* BlueALSA supports 4 SBC qualities: low, medium, high and XQ. The XQ mode
 	 * uses 44.1 kHz sampling rate, dual channel mode with bitpool 38, 16 blocks
 	 * in frame, 8 frequency bands and allocation method Loudness, which is also
@@ -119,6 +233,8 @@ struct ba_config {
 	bool aac_afterburner;
 	uint8_t aac_latm_version;
 	uint8_t aac_vbr_mode;
+	/* use low delay AAC-ELD object type if possible */
+	bool aac_low_delay;
 #endif
 
 #if ENABLE_MP3LAME
@@ -129,6 +245,9 @@ struct ba_config {
 #if ENABLE_LDAC
 	bool ldac_abr;
 	uint8_t ldac_eqmid;
+	/* Upper limit of the LDAC sampling frequency, which is lowered by the
+	 * codec calibration on hosts too slow for 96 kHz. Zero means no limit. */
+	unsigned int ldac_max_sampling;
 #endif
 
 };
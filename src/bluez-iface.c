@@ -46,6 +46,16 @@ static const GDBusArgInfo *out_SelectConfiguration[] = {
 	NULL,
 };
 
+static const GDBusArgInfo *in_SelectProperties[] = {
+	&arg_properties,
+	NULL,
+};
+
+static const GDBusArgInfo *out_SelectProperties[] = {
+	&arg_properties,
+	NULL,
+};
+
 static const GDBusArgInfo *in_SetConfiguration[] = {
 	&arg_transport,
 	&arg_properties,
@@ -76,6 +86,13 @@ static const GDBusMethodInfo bluez_iface_endpoint_SelectConfiguration = {
 	NULL,
 };
 
+static const GDBusMethodInfo bluez_iface_endpoint_SelectProperties = {
+	-1, "SelectProperties",
+	(GDBusArgInfo **)in_SelectProperties,
+	(GDBusArgInfo **)out_SelectProperties,
+	NULL,
+};
+
 static const GDBusMethodInfo bluez_iface_endpoint_SetConfiguration = {
 	-1, "SetConfiguration",
 	(GDBusArgInfo **)in_SetConfiguration,
@@ -120,6 +137,7 @@ static const GDBusMethodInfo bluez_iface_profile_Release = {
 
 static const GDBusMethodInfo *bluez_iface_endpoint_methods[] = {
 	&bluez_iface_endpoint_SelectConfiguration,
+	&bluez_iface_endpoint_SelectProperties,
 	&bluez_iface_endpoint_SetConfiguration,
 	&bluez_iface_endpoint_ClearConfiguration,
 	&bluez_iface_endpoint_Release,
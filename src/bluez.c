@@ -33,12 +33,14 @@
 #include "ba-adapter.h"
 #include "ba-device.h"
 #include "ba-transport.h"
+#include "bap.h"
 #include "bluealsa.h"
 #include "bluealsa-dbus.h"
 #include "bluez-iface.h"
 #include "dbus.h"
 #include "hci.h"
 #include "sco.h"
+#include "storage.h"
 #include "utils.h"
 #include "shared/defs.h"
 #include "shared/log.h"
@@ -74,6 +76,8 @@ struct bluez_adapter {
 	struct ba_adapter *adapter;
 	/* array of end-points for connected devices */
 	GHashTable *device_sep_map;
+	/* pending A2DP endpoints registration */
+	unsigned int register_a2dp_source;
 };
 
 static pthread_mutex_t bluez_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -85,6 +89,22 @@ static struct bluez_adapter bluez_adapters[HCI_MAX_DEV] = { NULL };
 #define bluez_adapters_device_get_sep(seps, i) \
 	g_array_index(seps, struct a2dp_sep, i)
 
+/**
+ * Get remote Stream End-Points of given device.
+ *
+ * If SEPs of the device were not discovered yet, try to restore them from
+ * the persistent storage, so the list of available codecs is known right
+ * away after the device reconnects. */
+static GArray *bluez_adapters_device_load_seps(int hci_dev_id, const bdaddr_t *addr) {
+	const struct ba_adapter *a = bluez_adapters[hci_dev_id].adapter;
+	GArray *seps;
+	if ((seps = bluez_adapters_device_lookup(hci_dev_id, addr)) == NULL && a != NULL &&
+			(seps = storage_device_load_seps(&a->hci.bdaddr, addr)) != NULL)
+		g_hash_table_insert(bluez_adapters[hci_dev_id].device_sep_map,
+				g_memdup(addr, sizeof(*addr)), seps);
+	return seps;
+}
+
 static void bluez_dbus_object_data_unref(
 		struct bluez_dbus_object_data *obj) {
 	if (--obj->ref_count != 0)
@@ -150,15 +170,9 @@ static void bluez_endpoint_select_configuration(GDBusMethodInvocation *inv) {
 	if (a2dp_select_configuration(codec, capabilities, size) == -1)
 		goto fail;
 
-	GVariantBuilder caps;
-	size_t i;
-
-	g_variant_builder_init(&caps, G_VARIANT_TYPE("ay"));
-	for (i = 0; i < size; i++)
-		g_variant_builder_add(&caps, "y", ((char *)capabilities)[i]);
-
-	g_dbus_method_invocation_return_value(inv, g_variant_new("(ay)", &caps));
-	g_variant_builder_clear(&caps);
+	GVariant *caps = g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE,
+			capabilities, size, sizeof(uint8_t));
+	g_dbus_method_invocation_return_value(inv, g_variant_new_tuple(&caps, 1));
 
 	goto final;
 
@@ -171,6 +185,7 @@ final:
 }
 
 static void bluez_register_a2dp_all(struct ba_adapter *adapter);
+static void bluez_register_a2dp_all_schedule(int hci_dev_id);
 
 static void bluez_endpoint_set_configuration(GDBusMethodInvocation *inv) {
 
@@ -188,7 +203,7 @@ static void bluez_endpoint_set_configuration(GDBusMethodInvocation *inv) {
 	enum bluez_a2dp_transport_state state = 0xFFFF;
 	char *device_path = NULL;
 	void *configuration = NULL;
-	uint16_t volume = 127;
+	uint16_t volume = 0xFFFF;
 	uint16_t delay = 150;
 
 	const char *transport_path;
@@ -269,7 +284,7 @@ static void bluez_endpoint_set_configuration(GDBusMethodInvocation *inv) {
 	}
 
 	if (d->seps == NULL)
-		d->seps = bluez_adapters_device_lookup(a->hci.dev_id, &addr);
+		d->seps = bluez_adapters_device_load_seps(a->hci.dev_id, &addr);
 
 	if (ba_transport_lookup(d, transport_path) != NULL) {
 		error("Transport already configured: %s", transport_path);
@@ -283,8 +298,10 @@ static void bluez_endpoint_set_configuration(GDBusMethodInvocation *inv) {
 	}
 
 	/* Skip volume level initialization in case of A2DP Source
-	 * profile and software volume control. */
-	if (!(t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE &&
+	 * profile and software volume control. Also, if BlueZ does not
+	 * know the remote volume, keep the level restored from storage. */
+	if (volume != 0xFFFF &&
+			!(t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE &&
 				t->a2dp.pcm.soft_volume)) {
 		int level = ba_transport_pcm_volume_bt_to_level(&t->a2dp.pcm, volume);
 		ba_transport_pcm_volume_set(&t->a2dp.pcm.volume[0], &level, NULL);
@@ -304,7 +321,7 @@ static void bluez_endpoint_set_configuration(GDBusMethodInvocation *inv) {
 	dbus_obj->connected = true;
 
 	g_dbus_method_invocation_return_value(inv, NULL);
-	bluez_register_a2dp_all(a);
+	bluez_register_a2dp_all_schedule(a->hci.dev_id);
 	goto final;
 
 fail:
@@ -396,62 +413,91 @@ static void bluez_endpoint_method_call(GDBusConnection *conn, const char *sender
 
 }
 
+/**
+ * Finish asynchronous object registration in BlueZ.
+ *
+ * Registration requests for all adapters and profiles are sent at once
+ * without waiting for replies, so the start-up is not serialized on the
+ * BlueZ round-trip time. In case of an error, the object is marked as not
+ * registered, so the registration will be retried later. */
+static void bluez_register_finish(GObject *source, GAsyncResult *result,
+		void *userdata) {
+
+	struct bluez_dbus_object_data *dbus_obj = userdata;
+	GDBusMessage *rep;
+	GError *err = NULL;
+
+	if ((rep = g_dbus_connection_send_message_with_reply_finish(
+					G_DBUS_CONNECTION(source), result, &err)) != NULL &&
+			g_dbus_message_get_message_type(rep) == G_DBUS_MESSAGE_TYPE_ERROR)
+		g_dbus_message_to_gerror(rep, &err);
+
+	pthread_mutex_lock(&bluez_mutex);
+
+	if (err != NULL) {
+		warn("Couldn't register %s: %s", dbus_obj->path, err->message);
+		dbus_obj->registered = false;
+		g_error_free(err);
+	}
+
+	bluez_dbus_object_data_unref(dbus_obj);
+	pthread_mutex_unlock(&bluez_mutex);
+
+	if (rep != NULL)
+		g_object_unref(rep);
+
+}
+
+/**
+ * Send registration request to BlueZ.
+ *
+ * This function shall be called with the BlueZ mutex held. The object is
+ * marked as registered right away - see bluez_register_finish(). */
+static void bluez_register_send(
+		struct bluez_dbus_object_data *dbus_obj,
+		GDBusMessage *msg) {
+
+	dbus_obj->registered = true;
+	dbus_obj->ref_count++;
+
+	g_dbus_connection_send_message_with_reply(config.dbus, msg,
+			G_DBUS_SEND_MESSAGE_FLAGS_NONE, -1, NULL, NULL,
+			bluez_register_finish, dbus_obj);
+
+}
+
 /**
  * Register media endpoint in BlueZ. */
-static int bluez_register_media_endpoint(
+static void bluez_register_media_endpoint(
 		const struct ba_adapter *adapter,
-		const struct bluez_dbus_object_data *dbus_obj,
-		const char *uuid,
-		GError **error) {
+		struct bluez_dbus_object_data *dbus_obj,
+		const char *uuid) {
 
 	const struct a2dp_codec *codec = dbus_obj->codec;
-	GDBusMessage *msg = NULL, *rep = NULL;
-	int ret = 0;
-	size_t i;
+	GDBusMessage *msg;
 
 	debug("Registering media endpoint: %s", dbus_obj->path);
 
 	msg = g_dbus_message_new_method_call(BLUEZ_SERVICE, adapter->bluez_dbus_path,
 			BLUEZ_IFACE_MEDIA, "RegisterEndpoint");
 
-	GVariantBuilder caps;
 	GVariantBuilder properties;
-
-	g_variant_builder_init(&caps, G_VARIANT_TYPE("ay"));
 	g_variant_builder_init(&properties, G_VARIANT_TYPE("a{sv}"));
 
-	for (i = 0; i < codec->capabilities_size; i++)
-		g_variant_builder_add(&caps, "y", ((char *)codec->capabilities)[i]);
+	GVariant *caps = g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE,
+			codec->capabilities, codec->capabilities_size, sizeof(uint8_t));
 
 	g_variant_builder_add(&properties, "{sv}", "UUID", g_variant_new_string(uuid));
 	g_variant_builder_add(&properties, "{sv}", "DelayReporting", g_variant_new_boolean(TRUE));
 	g_variant_builder_add(&properties, "{sv}", "Codec", g_variant_new_byte(codec->codec_id));
-	g_variant_builder_add(&properties, "{sv}", "Capabilities", g_variant_builder_end(&caps));
+	g_variant_builder_add(&properties, "{sv}", "Capabilities", caps);
 
 	g_dbus_message_set_body(msg, g_variant_new("(oa{sv})", dbus_obj->path, &properties));
 	g_variant_builder_clear(&properties);
 
-	if ((rep = g_dbus_connection_send_message_with_reply_sync(config.dbus, msg,
-					G_DBUS_SEND_MESSAGE_FLAGS_NONE, -1, NULL, NULL, error)) == NULL)
-		goto fail;
-
-	if (g_dbus_message_get_message_type(rep) == G_DBUS_MESSAGE_TYPE_ERROR) {
-		g_dbus_message_to_gerror(rep, error);
-		goto fail;
-	}
+	bluez_register_send(dbus_obj, msg);
+	g_object_unref(msg);
 
-	goto final;
-
-fail:
-	ret = -1;
-
-final:
-	if (msg != NULL)
-		g_object_unref(msg);
-	if (rep != NULL)
-		g_object_unref(rep);
-
-	return ret;
 }
 
 /**
@@ -517,11 +563,8 @@ static void bluez_register_a2dp(
 
 		}
 
-		if (!dbus_obj->registered) {
-			if (bluez_register_media_endpoint(adapter, dbus_obj, uuid, &err) == -1)
-				goto fail;
-			dbus_obj->registered = true;
-		}
+		if (!dbus_obj->registered)
+			bluez_register_media_endpoint(adapter, dbus_obj, uuid);
 
 		if (dbus_obj->connected)
 			connected++;
@@ -539,6 +582,41 @@ fail:
 
 }
 
+static gboolean bluez_register_a2dp_all_dispatch(void *userdata) {
+
+	const int hci_dev_id = GPOINTER_TO_INT(userdata);
+	struct ba_adapter *a = NULL;
+
+	pthread_mutex_lock(&bluez_mutex);
+	bluez_adapters[hci_dev_id].register_a2dp_source = 0;
+	if (bluez_adapters[hci_dev_id].adapter != NULL)
+		a = ba_adapter_ref(bluez_adapters[hci_dev_id].adapter);
+	pthread_mutex_unlock(&bluez_mutex);
+
+	/* The registration locks the BlueZ mutex by itself,
+	 * so the adapter is only referenced here. */
+	if (a != NULL) {
+		bluez_register_a2dp_all(a);
+		ba_adapter_unref(a);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * Schedule A2DP endpoints registration.
+ *
+ * Registration requests made within a single main loop iteration (e.g. when
+ * several devices are being connected at once) are batched together, so the
+ * endpoints of the given adapter are not walked over for every request. */
+static void bluez_register_a2dp_all_schedule(int hci_dev_id) {
+	pthread_mutex_lock(&bluez_mutex);
+	if (bluez_adapters[hci_dev_id].register_a2dp_source == 0)
+		bluez_adapters[hci_dev_id].register_a2dp_source = g_idle_add(
+				bluez_register_a2dp_all_dispatch, GINT_TO_POINTER(hci_dev_id));
+	pthread_mutex_unlock(&bluez_mutex);
+}
+
 /**
  * Register A2DP endpoints. */
 static void bluez_register_a2dp_all(struct ba_adapter *adapter) {
@@ -561,6 +639,374 @@ static void bluez_register_a2dp_all(struct ba_adapter *adapter) {
 
 }
 
+#if ENABLE_LE_AUDIO
+
+static void bluez_bap_endpoint_select_properties(GDBusMethodInvocation *inv) {
+
+	GVariant *params = g_dbus_method_invocation_get_parameters(inv);
+	void *userdata = g_dbus_method_invocation_get_user_data(inv);
+	struct bluez_dbus_object_data *dbus_obj = userdata;
+
+	void *capabilities = NULL;
+	size_t capabilities_size = 0;
+	uint32_t locations = BAP_LOCATION_FRONT_LEFT;
+	uint32_t delay = BAP_QOS_PRESENTATION_DELAY_US;
+	uint8_t target_latency = 0x02 /* balanced */;
+
+	GVariantIter *properties;
+	GVariant *value = NULL;
+	const char *property;
+
+	g_variant_get(params, "(a{sv})", &properties);
+	while (g_variant_iter_next(properties, "{&sv}", &property, &value)) {
+
+		if (strcmp(property, "Capabilities") == 0 &&
+				g_variant_validate_value(value, G_VARIANT_TYPE_BYTESTRING, property)) {
+			const void *data = g_variant_get_fixed_array(value, &capabilities_size, sizeof(char));
+			g_free(capabilities);
+			capabilities = g_memdup(data, capabilities_size);
+		}
+		else if (strcmp(property, "Locations") == 0 &&
+				g_variant_validate_value(value, G_VARIANT_TYPE_UINT32, property)) {
+			locations = g_variant_get_uint32(value);
+		}
+		else if (strcmp(property, "QoS") == 0 &&
+				g_variant_validate_value(value, G_VARIANT_TYPE_VARDICT, property)) {
+
+			uint32_t delay_min = 0;
+			uint32_t delay_max = 0;
+			g_variant_lookup(value, "MinimumDelay", "u", &delay_min);
+			g_variant_lookup(value, "MaximumDelay", "u", &delay_max);
+			g_variant_lookup(value, "TargetLatency", "y", &target_latency);
+
+			/* fit our presentation delay into the range supported by the remote */
+			if (delay_min != 0 && delay < delay_min)
+				delay = delay_min;
+			if (delay_max != 0 && delay > delay_max)
+				delay = delay_max;
+
+		}
+
+		g_variant_unref(value);
+		value = NULL;
+	}
+
+	uint8_t configuration[32];
+	struct bap_lc3_configuration conf;
+	ssize_t configuration_size;
+
+	if ((configuration_size = bap_lc3_select_configuration(capabilities,
+					capabilities_size, locations, configuration, sizeof(configuration))) == -1 ||
+			bap_lc3_parse_configuration(&conf, configuration, configuration_size) == -1) {
+		error("Couldn't select LC3 configuration: %s: %s", dbus_obj->path, strerror(errno));
+		goto fail;
+	}
+
+	GVariantBuilder qos;
+	g_variant_builder_init(&qos, G_VARIANT_TYPE("a{sv}"));
+	g_variant_builder_add(&qos, "{sv}", "Interval", g_variant_new_uint32(conf.frame_us * conf.frame_blocks));
+	g_variant_builder_add(&qos, "{sv}", "Framing", g_variant_new_byte(0x00 /* unframed */));
+	g_variant_builder_add(&qos, "{sv}", "PHY", g_variant_new_byte(BAP_QOS_PHY_2M));
+	g_variant_builder_add(&qos, "{sv}", "SDU", g_variant_new_uint16(bap_lc3_sdu_size(&conf)));
+	g_variant_builder_add(&qos, "{sv}", "Retransmissions", g_variant_new_byte(BAP_QOS_RETRANSMISSIONS));
+	g_variant_builder_add(&qos, "{sv}", "Latency", g_variant_new_uint16(BAP_QOS_LATENCY_MS));
+	g_variant_builder_add(&qos, "{sv}", "PresentationDelay", g_variant_new_uint32(delay));
+	g_variant_builder_add(&qos, "{sv}", "TargetLatency", g_variant_new_byte(target_latency));
+
+	GVariantBuilder props;
+	g_variant_builder_init(&props, G_VARIANT_TYPE("a{sv}"));
+	g_variant_builder_add(&props, "{sv}", "Capabilities", g_variant_new_fixed_array(
+				G_VARIANT_TYPE_BYTE, configuration, configuration_size, sizeof(uint8_t)));
+	g_variant_builder_add(&props, "{sv}", "QoS", g_variant_builder_end(&qos));
+
+	g_dbus_method_invocation_return_value(inv, g_variant_new("(a{sv})", &props));
+	g_variant_builder_clear(&props);
+
+	goto final;
+
+fail:
+	g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
+			G_DBUS_ERROR_INVALID_ARGS, "Invalid capabilities");
+
+final:
+	g_variant_iter_free(properties);
+	if (value != NULL)
+		g_variant_unref(value);
+	g_free(capabilities);
+}
+
+static void bluez_bap_endpoint_set_configuration(GDBusMethodInvocation *inv) {
+
+	const char *sender = g_dbus_method_invocation_get_sender(inv);
+	GVariant *params = g_dbus_method_invocation_get_parameters(inv);
+	void *userdata = g_dbus_method_invocation_get_user_data(inv);
+	struct bluez_dbus_object_data *dbus_obj = userdata;
+
+	struct ba_adapter *a = NULL;
+	struct ba_transport *t = NULL;
+	struct ba_device *d = NULL;
+
+	/* BAP transport is created in the idle state, streaming will
+	 * be started when the ASE is enabled by the remote device */
+	enum bluez_a2dp_transport_state state = BLUEZ_A2DP_TRANSPORT_STATE_IDLE;
+	struct bap_lc3_configuration configuration;
+	bool configured = false;
+	char *device_path = NULL;
+	uint32_t delay = BAP_QOS_PRESENTATION_DELAY_US;
+
+	const char *transport_path;
+	GVariantIter *properties;
+	GVariant *value = NULL;
+	const char *property;
+
+	g_variant_get(params, "(&oa{sv})", &transport_path, &properties);
+	while (g_variant_iter_next(properties, "{&sv}", &property, &value)) {
+
+		if (strcmp(property, "Device") == 0 &&
+				g_variant_validate_value(value, G_VARIANT_TYPE_OBJECT_PATH, property)) {
+			g_free(device_path);
+			device_path = g_variant_dup_string(value, NULL);
+		}
+		else if (strcmp(property, "Codec") == 0 &&
+				g_variant_validate_value(value, G_VARIANT_TYPE_BYTE, property)) {
+
+			if (g_variant_get_byte(value) != BAP_CODEC_LC3) {
+				error("Invalid configuration: %s", "Codec mismatch");
+				goto fail;
+			}
+
+		}
+		else if (strcmp(property, "Configuration") == 0 &&
+				g_variant_validate_value(value, G_VARIANT_TYPE_BYTESTRING, property)) {
+
+			size_t size = 0;
+			const void *data = g_variant_get_fixed_array(value, &size, sizeof(char));
+
+			if (bap_lc3_parse_configuration(&configuration, data, size) == -1) {
+				error("Invalid configuration: %s", "Invalid configuration blob");
+				goto fail;
+			}
+
+			configured = true;
+
+		}
+		else if (strcmp(property, "QoS") == 0 &&
+				g_variant_validate_value(value, G_VARIANT_TYPE_VARDICT, property)) {
+			g_variant_lookup(value, "PresentationDelay", "u", &delay);
+		}
+		else if (strcmp(property, "State") == 0 &&
+				g_variant_validate_value(value, G_VARIANT_TYPE_STRING, property)) {
+			state = bluez_a2dp_transport_state_from_string(g_variant_get_string(value, NULL));
+		}
+
+		g_variant_unref(value);
+		value = NULL;
+	}
+
+	if (!configured) {
+		error("Invalid configuration: %s", "Missing configuration");
+		goto fail;
+	}
+
+	if ((a = ba_adapter_lookup(dbus_obj->hci_dev_id)) == NULL) {
+		error("Couldn't lookup adapter: hci%d: %s", dbus_obj->hci_dev_id, strerror(errno));
+		goto fail;
+	}
+
+	bdaddr_t addr;
+	g_dbus_bluez_object_path_to_bdaddr(device_path, &addr);
+	if ((d = ba_device_lookup(a, &addr)) == NULL &&
+			(d = ba_device_new(a, &addr)) == NULL) {
+		error("Couldn't create new device: %s", device_path);
+		goto fail;
+	}
+
+	if (ba_transport_lookup(d, transport_path) != NULL) {
+		error("Transport already configured: %s", transport_path);
+		goto fail;
+	}
+
+	if ((t = ba_transport_new_bap(d, dbus_obj->ttype,
+					sender, transport_path, &configuration)) == NULL) {
+		error("Couldn't create new transport: %s", strerror(errno));
+		goto fail;
+	}
+
+	t->bap.bluez_dbus_sep_path = dbus_obj->path;
+	t->bap.delay = delay / 100;
+
+	debug("%s configured for device %s",
+			ba_transport_type_to_string(t->type),
+			batostr_(&d->addr));
+	debug("Configuration: channels: %u, sampling: %u, frame: %u us, %u bytes",
+			configuration.channels, configuration.sampling,
+			configuration.frame_us, configuration.frame_len);
+
+	ba_transport_set_bap_state(t, state);
+	dbus_obj->connected = true;
+
+	g_dbus_method_invocation_return_value(inv, NULL);
+	goto final;
+
+fail:
+	g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
+			G_DBUS_ERROR_INVALID_ARGS, "Unable to set configuration");
+
+final:
+	if (a != NULL)
+		ba_adapter_unref(a);
+	if (d != NULL)
+		ba_device_unref(d);
+	if (t != NULL)
+		ba_transport_unref(t);
+	g_variant_iter_free(properties);
+	if (value != NULL)
+		g_variant_unref(value);
+	g_free(device_path);
+}
+
+static void bluez_bap_endpoint_method_call(GDBusConnection *conn, const char *sender,
+		const char *path, const char *interface, const char *method, GVariant *params,
+		GDBusMethodInvocation *invocation, void *userdata) {
+	(void)conn;
+	(void)params;
+	(void)userdata;
+
+	static const GDBusMethodCallDispatcher dispatchers[] = {
+		{ .method = "SelectProperties",
+			.handler = bluez_bap_endpoint_select_properties },
+		{ .method = "SetConfiguration",
+			.handler = bluez_bap_endpoint_set_configuration },
+		{ .method = "ClearConfiguration",
+			.handler = bluez_endpoint_clear_configuration },
+		{ .method = "Release",
+			.handler = bluez_endpoint_release },
+		{ NULL },
+	};
+
+	if (!g_dbus_dispatch_method_call(dispatchers, sender, path, interface, method, invocation))
+		error("Couldn't dispatch D-Bus method call: %s.%s()", interface, method);
+
+}
+
+/**
+ * Register BAP (LE Audio) endpoint in BlueZ. */
+static void bluez_register_bap_endpoint(
+		const struct ba_adapter *adapter,
+		struct bluez_dbus_object_data *dbus_obj,
+		const char *uuid) {
+
+	const uint32_t locations = BAP_LOCATION_FRONT_LEFT | BAP_LOCATION_FRONT_RIGHT;
+	/* unspecified, conversational and media contexts */
+	const uint16_t context = 0x0001 | 0x0002 | 0x0004;
+	GDBusMessage *msg;
+
+	debug("Registering BAP endpoint: %s", dbus_obj->path);
+
+	msg = g_dbus_message_new_method_call(BLUEZ_SERVICE, adapter->bluez_dbus_path,
+			BLUEZ_IFACE_MEDIA, "RegisterEndpoint");
+
+	GVariantBuilder properties;
+	g_variant_builder_init(&properties, G_VARIANT_TYPE("a{sv}"));
+
+	size_t capabilities_size;
+	const uint8_t *capabilities = bap_lc3_get_capabilities(&capabilities_size);
+	GVariant *caps = g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE,
+			capabilities, capabilities_size, sizeof(uint8_t));
+
+	g_variant_builder_add(&properties, "{sv}", "UUID", g_variant_new_string(uuid));
+	g_variant_builder_add(&properties, "{sv}", "Codec", g_variant_new_byte(BAP_CODEC_LC3));
+	g_variant_builder_add(&properties, "{sv}", "Capabilities", caps);
+	g_variant_builder_add(&properties, "{sv}", "Locations", g_variant_new_uint32(locations));
+	g_variant_builder_add(&properties, "{sv}", "Context", g_variant_new_uint16(context));
+	g_variant_builder_add(&properties, "{sv}", "SupportedContext", g_variant_new_uint16(context));
+
+	g_dbus_message_set_body(msg, g_variant_new("(oa{sv})", dbus_obj->path, &properties));
+	g_variant_builder_clear(&properties);
+
+	bluez_register_send(dbus_obj, msg);
+	g_object_unref(msg);
+
+}
+
+/**
+ * Register BAP endpoint.
+ *
+ * Contrary to A2DP, BlueZ creates separate transport for every remote
+ * ASE configured with the same local endpoint, so there is no need to
+ * keep spare endpoint objects. */
+static void bluez_register_bap(
+		const struct ba_adapter *adapter,
+		uint32_t profile,
+		const char *uuid) {
+
+	static const GDBusInterfaceVTable vtable = {
+		.method_call = bluez_bap_endpoint_method_call,
+	};
+
+	struct ba_transport_type ttype = {
+		.profile = profile,
+		.codec = BAP_CODEC_LC3,
+	};
+
+	struct bluez_dbus_object_data *dbus_obj;
+	GError *err = NULL;
+
+	char path[sizeof(dbus_obj->path)];
+	snprintf(path, sizeof(path), "/org/bluez/%s%s", adapter->hci.name,
+			g_dbus_transport_type_to_bluez_object_path(ttype));
+
+	pthread_mutex_lock(&bluez_mutex);
+
+	if ((dbus_obj = g_hash_table_lookup(dbus_object_data_map, path)) == NULL) {
+
+		debug("Creating BAP endpoint object: %s", path);
+
+		if ((dbus_obj = calloc(1, sizeof(*dbus_obj))) == NULL) {
+			warn("Couldn't register BAP endpoint: %s", strerror(errno));
+			goto final;
+		}
+
+		strncpy(dbus_obj->path, path, sizeof(dbus_obj->path));
+		dbus_obj->hci_dev_id = adapter->hci.dev_id;
+		dbus_obj->ttype = ttype;
+		dbus_obj->ref_count = 2;
+
+		if ((dbus_obj->id = g_dbus_connection_register_object(config.dbus,
+						path, (GDBusInterfaceInfo *)&bluez_iface_endpoint, &vtable,
+						dbus_obj, (GDestroyNotify)bluez_dbus_object_data_unref, &err)) == 0) {
+			warn("Couldn't register BAP endpoint: %s", err->message);
+			g_error_free(err);
+			free(dbus_obj);
+			goto final;
+		}
+
+		g_hash_table_insert(dbus_object_data_map, dbus_obj->path, dbus_obj);
+
+	}
+
+	if (!dbus_obj->registered)
+		bluez_register_bap_endpoint(adapter, dbus_obj, uuid);
+
+final:
+	pthread_mutex_unlock(&bluez_mutex);
+}
+
+#endif
+
+/**
+ * Register BAP endpoints. */
+static void bluez_register_bap_all(struct ba_adapter *adapter) {
+#if ENABLE_LE_AUDIO
+	if (config.enable.bap_source)
+		bluez_register_bap(adapter, BA_TRANSPORT_PROFILE_BAP_SOURCE, BLUETOOTH_UUID_PAC_SOURCE);
+	if (config.enable.bap_sink)
+		bluez_register_bap(adapter, BA_TRANSPORT_PROFILE_BAP_SINK, BLUETOOTH_UUID_PAC_SINK);
+#else
+	(void)adapter;
+#endif
+}
+
 static void bluez_profile_new_connection(GDBusMethodInvocation *inv) {
 
 	GDBusMessage *msg = g_dbus_method_invocation_get_message(inv);
@@ -711,15 +1157,13 @@ static void bluez_profile_method_call(GDBusConnection *conn, const char *sender,
 
 /**
  * Register hands-free profile in BlueZ. */
-static int bluez_register_profile(
-		const struct bluez_dbus_object_data *dbus_obj,
+static void bluez_register_profile(
+		struct bluez_dbus_object_data *dbus_obj,
 		const char *uuid,
 		uint16_t version,
-		uint16_t features,
-		GError **error) {
+		uint16_t features) {
 
-	GDBusMessage *msg = NULL, *rep = NULL;
-	int ret = 0;
+	GDBusMessage *msg;
 
 	debug("Registering hands-free profile: %s", dbus_obj->path);
 
@@ -737,27 +1181,9 @@ static int bluez_register_profile(
 	g_dbus_message_set_body(msg, g_variant_new("(osa{sv})", dbus_obj->path, uuid, &options));
 	g_variant_builder_clear(&options);
 
-	if ((rep = g_dbus_connection_send_message_with_reply_sync(config.dbus, msg,
-					G_DBUS_SEND_MESSAGE_FLAGS_NONE, -1, NULL, NULL, error)) == NULL)
-		goto fail;
+	bluez_register_send(dbus_obj, msg);
+	g_object_unref(msg);
 
-	if (g_dbus_message_get_message_type(rep) == G_DBUS_MESSAGE_TYPE_ERROR) {
-		g_dbus_message_to_gerror(rep, error);
-		goto fail;
-	}
-
-	goto final;
-
-fail:
-	ret = -1;
-
-final:
-	if (msg != NULL)
-		g_object_unref(msg);
-	if (rep != NULL)
-		g_object_unref(rep);
-
-	return ret;
 }
 
 /**
@@ -810,11 +1236,8 @@ static void bluez_register_hfp(
 
 	}
 
-	if (!dbus_obj->registered) {
-		if (bluez_register_profile(dbus_obj, uuid, version, features, &err) == -1)
-			goto fail;
-		dbus_obj->registered = true;
-	}
+	if (!dbus_obj->registered)
+		bluez_register_profile(dbus_obj, uuid, version, features);
 
 fail:
 
@@ -907,6 +1330,7 @@ void bluez_register(void) {
 			bluez_adapters[a->hci.dev_id].device_sep_map = g_hash_table_new_full(
 					g_bdaddr_hash, g_bdaddr_equal, g_free, (GDestroyNotify)bluez_sep_array_free);
 			bluez_register_a2dp_all(a);
+			bluez_register_bap_all(a);
 		}
 
 	/* HFP has to be registered globally */
@@ -933,6 +1357,7 @@ static void bluez_signal_interfaces_added(GDBusConnection *conn, const char *sen
 	const char *property;
 
 	int hci_dev_id = -1;
+	bool sep_a2dp = true;
 	struct a2dp_sep sep = {
 		.dir = A2DP_SOURCE,
 		.codec_id = 0xFFFF,
@@ -953,6 +1378,9 @@ static void bluez_signal_interfaces_added(GDBusConnection *conn, const char *sen
 					const char *uuid = g_variant_get_string(value, NULL);
 					if (strcasecmp(uuid, BLUETOOTH_UUID_A2DP_SINK) == 0)
 						sep.dir = A2DP_SINK;
+					/* remote BAP endpoints are not A2DP Stream End-Points */
+					else if (strcasecmp(uuid, BLUETOOTH_UUID_A2DP_SOURCE) != 0)
+						sep_a2dp = false;
 				}
 				else if (strcmp(property, "Codec") == 0)
 					sep.codec_id = g_variant_get_byte(value);
@@ -978,20 +1406,23 @@ static void bluez_signal_interfaces_added(GDBusConnection *conn, const char *sen
 		bluez_adapters[a->hci.dev_id].device_sep_map = g_hash_table_new_full(
 				g_bdaddr_hash, g_bdaddr_equal, g_free, (GDestroyNotify)bluez_sep_array_free);
 		bluez_register_a2dp_all(a);
+		bluez_register_bap_all(a);
 	}
 
 	/* HFP has to be registered globally */
 	if (strcmp(object_path, "/org/bluez") == 0)
 		bluez_register_hfp_all();
 
-	if (sep.codec_id != 0xFFFF) {
+	if (!sep_a2dp)
+		g_free(sep.capabilities);
+	else if (sep.codec_id != 0xFFFF) {
 
 		bdaddr_t addr;
 		g_dbus_bluez_object_path_to_bdaddr(object_path, &addr);
 		int hci_dev_id = g_dbus_bluez_object_path_to_hci_dev_id(object_path);
 
 		GArray *seps;
-		if ((seps = bluez_adapters_device_lookup(hci_dev_id, &addr)) == NULL)
+		if ((seps = bluez_adapters_device_load_seps(hci_dev_id, &addr)) == NULL)
 			g_hash_table_insert(bluez_adapters[hci_dev_id].device_sep_map,
 					g_memdup(&addr, sizeof(addr)), seps = g_array_new(FALSE, FALSE, sizeof(sep)));
 
@@ -1000,9 +1431,30 @@ static void bluez_signal_interfaces_added(GDBusConnection *conn, const char *sen
 			sep.codec_id = a2dp_get_vendor_codec_id(sep.capabilities, sep.capabilities_size);
 		sep.configuration = g_malloc(sep.capabilities_size);
 
-		debug("Adding new Stream End-Point: %s: %s", batostr_(&addr),
-				ba_transport_codecs_a2dp_to_string(sep.codec_id));
-		g_array_append_val(seps, sep);
+		size_t i;
+		for (i = 0; i < seps->len; i++)
+			if (strcmp(bluez_adapters_device_get_sep(seps, i).bluez_dbus_path, object_path) == 0)
+				break;
+
+		if (i < seps->len) {
+			/* replace SEP restored from the persistent storage */
+			struct a2dp_sep *tmp = &bluez_adapters_device_get_sep(seps, i);
+			debug("Updating Stream End-Point: %s: %s", batostr_(&addr),
+					ba_transport_codecs_a2dp_to_string(sep.codec_id));
+			g_free(tmp->capabilities);
+			g_free(tmp->configuration);
+			*tmp = sep;
+		}
+		else {
+			debug("Adding new Stream End-Point: %s: %s", batostr_(&addr),
+					ba_transport_codecs_a2dp_to_string(sep.codec_id));
+			g_array_append_val(seps, sep);
+		}
+
+		const struct ba_adapter *a = bluez_adapters[hci_dev_id].adapter;
+		if (a != NULL && storage_device_save_seps(&a->hci.bdaddr, &addr, seps) == -1 &&
+				errno != ENOTSUP)
+			warn("Couldn't store Stream End-Points: %s: %s", batostr_(&addr), strerror(errno));
 
 	}
 
@@ -1040,6 +1492,11 @@ static void bluez_signal_interfaces_removed(GDBusConnection *conn, const char *s
 					g_hash_table_iter_remove(&iter);
 				}
 
+			if (bluez_adapters[hci_dev_id].register_a2dp_source != 0) {
+				g_source_remove(bluez_adapters[hci_dev_id].register_a2dp_source);
+				bluez_adapters[hci_dev_id].register_a2dp_source = 0;
+			}
+
 			if (bluez_adapters[hci_dev_id].adapter != NULL) {
 				ba_adapter_destroy(bluez_adapters[hci_dev_id].adapter);
 				bluez_adapters[hci_dev_id].adapter = NULL;
@@ -1107,7 +1564,15 @@ static void bluez_signal_transport_changed(GDBusConnection *conn, const char *se
 	while (g_variant_iter_next(properties, "{&sv}", &property, &value)) {
 		debug("Signal: %s.%s(): %s: %s", interface_, signal, interface, property);
 
-		if (strcmp(property, "State") == 0 &&
+		if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_BAP) {
+			/* BAP volume is controlled by VCP which is not supported */
+			if (strcmp(property, "State") == 0 &&
+					g_variant_validate_value(value, G_VARIANT_TYPE_STRING, property)) {
+				const char *state = g_variant_get_string(value, NULL);
+				ba_transport_set_bap_state(t, bluez_a2dp_transport_state_from_string(state));
+			}
+		}
+		else if (strcmp(property, "State") == 0 &&
 				g_variant_validate_value(value, G_VARIANT_TYPE_STRING, property)) {
 			const char *state = g_variant_get_string(value, NULL);
 			ba_transport_set_a2dp_state(t, bluez_a2dp_transport_state_from_string(state));
@@ -1180,13 +1645,18 @@ static void bluez_signal_name_owner_changed(GDBusConnection *conn, const char *s
 		}
 
 		size_t i;
-		for (i = 0; i < ARRAYSIZE(bluez_adapters); i++)
+		for (i = 0; i < ARRAYSIZE(bluez_adapters); i++) {
+			if (bluez_adapters[i].register_a2dp_source != 0) {
+				g_source_remove(bluez_adapters[i].register_a2dp_source);
+				bluez_adapters[i].register_a2dp_source = 0;
+			}
 			if (bluez_adapters[i].adapter != NULL) {
 				ba_adapter_destroy(bluez_adapters[i].adapter);
 				bluez_adapters[i].adapter = NULL;
 				g_hash_table_destroy(bluez_adapters[i].device_sep_map);
 				bluez_adapters[i].device_sep_map = NULL;
 			}
+		}
 
 		pthread_mutex_unlock(&bluez_mutex);
 
@@ -1254,6 +1724,8 @@ bool bluez_a2dp_set_configuration(
 	g_hash_table_iter_init(&iter, dbus_object_data_map);
 	while (g_hash_table_iter_next(&iter, NULL, (gpointer)&dbus_obj))
 		if (dbus_obj->hci_dev_id == hci_dev_id &&
+				/* skip non-A2DP (e.g. BAP) endpoints */
+				dbus_obj->codec != NULL &&
 				dbus_obj->codec->codec_id == sep->codec_id &&
 				dbus_obj->codec->dir == !sep->dir &&
 				dbus_obj->registered) {
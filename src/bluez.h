@@ -24,6 +24,8 @@
 #define BLUETOOTH_UUID_HSP_AG      "00001112-0000-1000-8000-00805F9B34FB"
 #define BLUETOOTH_UUID_HFP_HF      "0000111E-0000-1000-8000-00805F9B34FB"
 #define BLUETOOTH_UUID_HFP_AG      "0000111F-0000-1000-8000-00805F9B34FB"
+#define BLUETOOTH_UUID_PAC_SINK    "00002BC9-0000-1000-8000-00805F9B34FB"
+#define BLUETOOTH_UUID_PAC_SOURCE  "00002BCB-0000-1000-8000-00805F9B34FB"
 
 enum bluez_a2dp_transport_state {
 	BLUEZ_A2DP_TRANSPORT_STATE_IDLE,
@@ -0,0 +1,368 @@
+/*
+ * BlueALSA - bt-capture.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "bt-capture.h"
+
+#include <arpa/inet.h>
+#include <byteswap.h>
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <bsd/sys/time.h>
+#include <glib.h>
+
+#include "shared/defs.h"
+#include "shared/rt.h"
+
+#define PCAP_MAGIC_USEC 0xA1B2C3D4
+#define PCAP_MAGIC_USEC_SWAPPED 0xD4C3B2A1
+#define PCAP_MAGIC_NSEC 0xA1B23C4D
+#define PCAP_MAGIC_NSEC_SWAPPED 0x4D3CB2A1
+
+struct pcap_file_header {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct pcap_record_header {
+	uint32_t ts_sec;
+	uint32_t ts_frac;
+	uint32_t incl_len;
+	uint32_t orig_len;
+};
+
+/**
+ * Write buffered records to the capture file.
+ *
+ * This thread runs with the default (non real-time) scheduling policy
+ * regardless of the policy of the thread which has opened the capture. */
+static void *bt_capture_writer(struct bt_capture *c) {
+
+	const struct sched_param param = { .sched_priority = 0 };
+	pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+
+	for (;;) {
+
+		const size_t len = rb_blen_out(&c->rb);
+		if (len > 0) {
+			if (fwrite(rb_head(&c->rb), 1, len, c->f) != len ||
+					fflush(c->f) != 0) {
+				atomic_store_explicit(&c->failed, true, memory_order_release);
+				break;
+			}
+			rb_shift(&c->rb, len);
+			continue;
+		}
+
+		/* All records stored before stopping are already written. */
+		if (!atomic_load_explicit(&c->running, memory_order_acquire))
+			break;
+
+		eventfd_t value;
+		if (eventfd_read(c->event_fd, &value) == -1 && errno != EINTR) {
+			atomic_store_explicit(&c->failed, true, memory_order_release);
+			break;
+		}
+
+	}
+
+	return NULL;
+}
+
+/**
+ * Open capture file for writing.
+ *
+ * @param c Pointer to the capture structure.
+ * @param path The path of the capture file. Existing file is truncated.
+ * @param profile The profile of the captured transport.
+ * @param codec The codec of the captured transport.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int bt_capture_open(struct bt_capture *c, const char *path,
+		uint16_t profile, uint16_t codec) {
+
+	const struct pcap_file_header header = {
+		.magic = PCAP_MAGIC_NSEC,
+		.version_major = 2,
+		.version_minor = 4,
+		.snaplen = BT_CAPTURE_SNAPLEN,
+		.linktype = BT_CAPTURE_LINKTYPE,
+	};
+
+	struct timespec ts_real;
+	struct timespec ts;
+	int err;
+
+	c->event_fd = -1;
+	if ((c->f = fopen(path, "wbe")) == NULL)
+		return -1;
+
+	if (fwrite(&header, sizeof(header), 1, c->f) != 1) {
+		err = EIO;
+		goto fail;
+	}
+
+	/* The writer thread consumes the buffer concurrently with the IO thread,
+	 * which is safe only with the mirrored memory mapping. */
+	if (rb_init_uint8_t(&c->rb, BT_CAPTURE_BUFFER_SIZE) == -1 ||
+			!rb_is_mirrored(&c->rb)) {
+		err = ENOMEM;
+		goto fail;
+	}
+
+	if ((c->event_fd = eventfd(0, EFD_CLOEXEC)) == -1) {
+		err = errno;
+		goto fail;
+	}
+
+	/* Time-stamps are taken from the same clock as the one used for the
+	 * transfer synchronization, so the captured inter-arrival times are not
+	 * disturbed by the wall clock adjustments. The real time offset makes
+	 * the capture readable by standard tools. */
+	clock_gettime(CLOCK_REALTIME, &ts_real);
+	gettimestamp(&ts);
+	timespecsub(&ts_real, &ts, &c->ts_offset);
+
+	c->swap = false;
+	c->nsec = true;
+	c->profile = profile;
+	c->codec = codec;
+	c->seq = 0;
+
+	atomic_init(&c->running, true);
+	atomic_init(&c->failed, false);
+	atomic_init(&c->dropped, 0);
+	if ((err = pthread_create(&c->writer, NULL,
+					PTHREAD_ROUTINE(bt_capture_writer), c)) != 0)
+		goto fail;
+
+	c->writer_started = true;
+	pthread_setname_np(c->writer, "ba-capture");
+	return 0;
+
+fail:
+	if (c->event_fd != -1)
+		close(c->event_fd);
+	rb_free(&c->rb);
+	bt_capture_close(c);
+	return errno = err, -1;
+}
+
+/**
+ * Open capture file for reading.
+ *
+ * @param c Pointer to the capture structure.
+ * @param path The path of the capture file.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int bt_capture_open_read(struct bt_capture *c, const char *path) {
+
+	struct pcap_file_header header;
+
+	if ((c->f = fopen(path, "rbe")) == NULL)
+		return -1;
+
+	if (fread(&header, sizeof(header), 1, c->f) != 1)
+		goto fail;
+
+	c->swap = false;
+	switch (header.magic) {
+	case PCAP_MAGIC_USEC_SWAPPED:
+		c->swap = true;
+		/* fall-through */
+	case PCAP_MAGIC_USEC:
+		c->nsec = false;
+		break;
+	case PCAP_MAGIC_NSEC_SWAPPED:
+		c->swap = true;
+		/* fall-through */
+	case PCAP_MAGIC_NSEC:
+		c->nsec = true;
+		break;
+	default:
+		goto fail;
+	}
+
+	uint32_t linktype = header.linktype;
+	if (c->swap)
+		linktype = bswap_32(linktype);
+	if (linktype != BT_CAPTURE_LINKTYPE)
+		goto fail;
+
+	c->seq = 0;
+	return 0;
+
+fail:
+	bt_capture_close(c);
+	return errno = EINVAL, -1;
+}
+
+/**
+ * Close capture file.
+ *
+ * In the write mode, this function waits until all buffered records are
+ * written by the writer thread. */
+void bt_capture_close(struct bt_capture *c) {
+
+	if (c->writer_started) {
+		atomic_store_explicit(&c->running, false, memory_order_release);
+		eventfd_write(c->event_fd, 1);
+		pthread_join(c->writer, NULL);
+		close(c->event_fd);
+		rb_free(&c->rb);
+		c->writer_started = false;
+	}
+
+	if (c->f != NULL)
+		fclose(c->f);
+	c->f = NULL;
+
+}
+
+/**
+ * Write packet to the capture file.
+ *
+ * The packet is only stored in the buffer of the writer thread, so this
+ * function does not block on the disk IO. If there is not enough space in
+ * the buffer, the packet is dropped and the drop counter is incremented.
+ *
+ * @param c Pointer to the capture structure.
+ * @param dir The direction of the packet transfer.
+ * @param iov Vector of the packet data buffers.
+ * @param iovcnt The number of buffers in the vector.
+ * @param len The length of the packet. It might be less than the total
+ *   length of the vector, e.g. in case of a partial write.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int bt_capture_write(struct bt_capture *c, enum bt_capture_direction dir,
+		const struct iovec *iov, size_t iovcnt, size_t len) {
+
+	struct timespec ts;
+	gettimestamp(&ts);
+	timespecadd(&ts, &c->ts_offset, &ts);
+
+	const size_t caplen = MIN(len, BT_CAPTURE_SNAPLEN - sizeof(struct bt_capture_header));
+	const struct pcap_record_header record = {
+		.ts_sec = ts.tv_sec,
+		.ts_frac = ts.tv_nsec,
+		.incl_len = sizeof(struct bt_capture_header) + caplen,
+		.orig_len = sizeof(struct bt_capture_header) + len,
+	};
+	const struct bt_capture_header header = {
+		.version = BT_CAPTURE_VERSION,
+		.direction = dir,
+		.profile = htons(c->profile),
+		.codec = htons(c->codec),
+		.seq = htonl(c->seq++),
+	};
+
+	if (atomic_load_explicit(&c->failed, memory_order_acquire))
+		return errno = EIO, -1;
+
+	const size_t size = sizeof(record) + sizeof(header) + caplen;
+	if (rb_blen_in(&c->rb) < size) {
+		atomic_fetch_add_explicit(&c->dropped, 1, memory_order_relaxed);
+		return 0;
+	}
+
+	uint8_t *tail = rb_tail(&c->rb);
+	memcpy(tail, &record, sizeof(record));
+	tail += sizeof(record);
+	memcpy(tail, &header, sizeof(header));
+	tail += sizeof(header);
+
+	for (size_t i = 0, left = caplen; i < iovcnt && left > 0; i++) {
+		const size_t n = MIN(left, iov[i].iov_len);
+		memcpy(tail, iov[i].iov_base, n);
+		tail += n;
+		left -= n;
+	}
+
+	rb_seek(&c->rb, size);
+	eventfd_write(c->event_fd, 1);
+
+	return 0;
+}
+
+/**
+ * Read packet from the capture file.
+ *
+ * @param c Pointer to the capture structure.
+ * @param packet Address where the packet information shall be stored.
+ * @param buffer Address of the buffer for the packet data.
+ * @param size The size of the buffer.
+ * @return On success this function returns the length of the packet data.
+ *   If there are no more packets (or the last one is truncated) 0 is
+ *   returned. On error -1 is returned and errno is set appropriately. If
+ *   the packet does not fit in the buffer, it is skipped and errno is set
+ *   to EMSGSIZE. */
+ssize_t bt_capture_read(struct bt_capture *c, struct bt_capture_packet *packet,
+		void *buffer, size_t size) {
+
+	struct pcap_record_header record;
+	struct bt_capture_header header;
+
+retry:
+
+	if (fread(&record, sizeof(record), 1, c->f) != 1)
+		goto eof;
+
+	if (c->swap) {
+		record.ts_sec = bswap_32(record.ts_sec);
+		record.ts_frac = bswap_32(record.ts_frac);
+		record.incl_len = bswap_32(record.incl_len);
+	}
+
+	if (record.incl_len < sizeof(header))
+		return errno = EBADMSG, -1;
+
+	if (fread(&header, sizeof(header), 1, c->f) != 1)
+		goto eof;
+
+	const size_t len = record.incl_len - sizeof(header);
+
+	/* skip packets with unsupported pseudo-header */
+	if (header.version != BT_CAPTURE_VERSION) {
+		if (fseek(c->f, len, SEEK_CUR) == -1)
+			return -1;
+		goto retry;
+	}
+
+	if (len > size) {
+		if (fseek(c->f, len, SEEK_CUR) == -1)
+			return -1;
+		return errno = EMSGSIZE, -1;
+	}
+
+	if (fread(buffer, 1, len, c->f) != len)
+		goto eof;
+
+	packet->ts.tv_sec = record.ts_sec;
+	packet->ts.tv_nsec = c->nsec ? record.ts_frac : record.ts_frac * 1000;
+	packet->direction = header.direction;
+	packet->profile = ntohs(header.profile);
+	packet->codec = ntohs(header.codec);
+	packet->seq = ntohl(header.seq);
+
+	return len;
+
+eof:
+	if (ferror(c->f))
+		return errno = EIO, -1;
+	return 0;
+}
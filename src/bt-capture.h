@@ -0,0 +1,123 @@
+/*
+ * BlueALSA - bt-capture.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_BTCAPTURE_H_
+#define BLUEALSA_BTCAPTURE_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#include "shared/rb.h"
+
+/**
+ * Link-layer type of the capture file (LINKTYPE_USER0). */
+#define BT_CAPTURE_LINKTYPE 147
+
+/**
+ * Version of the capture pseudo-header. */
+#define BT_CAPTURE_VERSION 1
+
+/**
+ * The maximal length of the captured packet. */
+#define BT_CAPTURE_SNAPLEN 65535
+
+/**
+ * The size of the buffer between the IO thread and the capture writer. It
+ * shall hold a few BT_CAPTURE_SNAPLEN records, so the writer thread which
+ * is not running with the real-time priority can lag behind. */
+#define BT_CAPTURE_BUFFER_SIZE (256 * 1024)
+
+enum bt_capture_direction {
+	BT_CAPTURE_DIRECTION_RX = 0,
+	BT_CAPTURE_DIRECTION_TX = 1,
+};
+
+/**
+ * Pseudo-header which precedes every captured BT payload. All fields are
+ * stored in the network byte order. */
+struct bt_capture_header {
+	uint8_t version;
+	uint8_t direction;
+	uint16_t profile;
+	uint16_t codec;
+	uint16_t reserved;
+	/* sequence number of the packet within the capture */
+	uint32_t seq;
+} __attribute__ ((packed));
+
+/**
+ * BT traffic capture in the pcap format.
+ *
+ * Every packet read from or written to the BT socket is stored with the
+ * nanosecond time-stamp and the bluez-alsa pseudo-header, so the capture
+ * can be inspected with standard tools and replayed with original timing
+ * by the bluealsa-mock.
+ *
+ * When writing, packets are only copied into the ring buffer by the IO
+ * thread. The file itself is written by the dedicated writer thread, so the
+ * disk IO latency will not stall the real-time transfer. */
+struct bt_capture {
+	FILE *f;
+	/* swap byte order when reading */
+	bool swap;
+	/* time-stamp resolution of the read capture */
+	bool nsec;
+	uint16_t profile;
+	uint16_t codec;
+	uint32_t seq;
+	/* offset between the real time and the time-stamp clock */
+	struct timespec ts_offset;
+	/* records waiting for the writer thread */
+	rb_t rb;
+	pthread_t writer;
+	bool writer_started;
+	int event_fd;
+	atomic_bool running;
+	/* the writer thread has failed to write the file */
+	atomic_bool failed;
+	/* number of records dropped due to the buffer overrun */
+	atomic_uint dropped;
+};
+
+/**
+ * Packet read from the capture file. */
+struct bt_capture_packet {
+	struct timespec ts;
+	enum bt_capture_direction direction;
+	uint16_t profile;
+	uint16_t codec;
+	uint32_t seq;
+};
+
+int bt_capture_open(struct bt_capture *c, const char *path,
+		uint16_t profile, uint16_t codec);
+int bt_capture_open_read(struct bt_capture *c, const char *path);
+void bt_capture_close(struct bt_capture *c);
+
+/**
+ * Check whether the capture file is opened. */
+#define bt_capture_is_open(c) ((c)->f != NULL)
+
+int bt_capture_write(struct bt_capture *c, enum bt_capture_direction dir,
+		const struct iovec *iov, size_t iovcnt, size_t len);
+ssize_t bt_capture_read(struct bt_capture *c, struct bt_capture_packet *packet,
+		void *buffer, size_t size);
+
+#endif
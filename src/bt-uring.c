@@ -0,0 +1,227 @@
+/*
+ * BlueALSA - bt-uring.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "bt-uring.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shared/defs.h"
+
+/**
+ * Indexes of the file descriptors registered with the ring. */
+#define BT_URING_FILE_BT    0
+#define BT_URING_FILE_EVENT 1
+
+/**
+ * The number of the submission queue entries. There are at most three
+ * operations in flight: receive, signal poll and timer poll. */
+#define BT_URING_ENTRIES 4
+
+/**
+ * Create io_uring receive path for the BT socket.
+ *
+ * @param bt_fd The BT socket file descriptor.
+ * @param event_fd The transport thread event file descriptor.
+ * @param size The size of the receive buffer.
+ * @return On success this function returns newly allocated structure,
+ *   which shall be freed with the bt_uring_free(). Otherwise, NULL is
+ *   returned and errno is set to indicate the error. */
+struct bt_uring *bt_uring_new(int bt_fd, int event_fd, size_t size) {
+
+	const int fds[] = { bt_fd, event_fd };
+	struct bt_uring *u;
+	int err;
+
+	if ((u = calloc(1, sizeof(*u))) == NULL)
+		return NULL;
+
+	if ((u->iov.iov_base = malloc(size)) == NULL)
+		goto fail;
+	u->iov.iov_len = size;
+
+	if ((err = io_uring_queue_init(BT_URING_ENTRIES, &u->ring, 0)) < 0) {
+		errno = -err;
+		goto fail;
+	}
+
+	if ((err = io_uring_register_files(&u->ring, fds, ARRAYSIZE(fds))) < 0) {
+		io_uring_queue_exit(&u->ring);
+		errno = -err;
+		goto fail;
+	}
+
+	u->bt_fd = bt_fd;
+	u->event_fd = event_fd;
+	return u;
+
+fail:
+	err = errno;
+	free(u->iov.iov_base);
+	free(u);
+	errno = err;
+	return NULL;
+}
+
+/**
+ * Process all available completion queue entries.
+ *
+ * @return This function returns the mask of the completed events. */
+static int bt_uring_complete(struct bt_uring *u) {
+
+	struct io_uring_cqe *cqe;
+	unsigned int head;
+	unsigned int count = 0;
+	int events = 0;
+
+	io_uring_for_each_cqe(&u->ring, head, cqe) {
+		switch (io_uring_cqe_get_data64(cqe)) {
+		case BT_URING_EVENT_RECV:
+			u->recv_pending = false;
+			if (cqe->res == -ECANCELED)
+				break;
+			u->recv_ret = cqe->res;
+			u->recv_ready = true;
+			events |= BT_URING_EVENT_RECV;
+			break;
+		case BT_URING_EVENT_SIGNAL:
+			u->signal_pending = false;
+			events |= BT_URING_EVENT_SIGNAL;
+			break;
+		case BT_URING_EVENT_TIMER:
+			u->timer_pending = false;
+			events |= BT_URING_EVENT_TIMER;
+			break;
+		}
+		count++;
+	}
+
+	io_uring_cq_advance(&u->ring, count);
+	return events;
+}
+
+/**
+ * Free io_uring receive path. */
+void bt_uring_free(struct bt_uring *u) {
+
+	if (u == NULL)
+		return;
+
+	/* Make sure that the kernel will not write to the receive
+	 * buffer after it has been freed. */
+	if (u->recv_pending) {
+		struct io_uring_sqe *sqe;
+		struct io_uring_cqe *cqe;
+		if ((sqe = io_uring_get_sqe(&u->ring)) != NULL) {
+			io_uring_prep_cancel64(sqe, BT_URING_EVENT_RECV, 0);
+			io_uring_sqe_set_data64(sqe, 0);
+			io_uring_submit(&u->ring);
+		}
+		while (u->recv_pending && io_uring_wait_cqe(&u->ring, &cqe) == 0)
+			bt_uring_complete(u);
+	}
+
+	io_uring_queue_exit(&u->ring);
+	free(u->iov.iov_base);
+	free(u);
+
+}
+
+/**
+ * Submit pending operations and wait for completion.
+ *
+ * The receive operation, the polling of the transport thread event file
+ * descriptor and the polling of the optional timer are submitted (unless
+ * they are still in flight) and waited for with a single system call.
+ *
+ * @param u Pointer to the io_uring receive path structure.
+ * @param timer_fd Optional timer file descriptor which shall be polled for
+ *   reading. Set it to -1 if not used.
+ * Note, that the io_uring_enter() is not a cancellation point. In order to
+ * cancel a thread blocked in this function, the cancellation request has to
+ * be followed by a write to the event file descriptor.
+ *
+ * @param timeout The wait timeout in milliseconds or -1 for infinity.
+ * @return On success this function returns the mask of the completed
+ *   events - zero means that the timeout has expired. Otherwise, -1 is
+ *   returned and errno is set to indicate the error. */
+int bt_uring_wait(struct bt_uring *u, int timer_fd, int timeout) {
+
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	int ret;
+
+	/* completed receive operation has not been consumed yet */
+	if (u->recv_ready)
+		return BT_URING_EVENT_RECV;
+
+	if (!u->recv_pending &&
+			(sqe = io_uring_get_sqe(&u->ring)) != NULL) {
+		memset(&u->msg, 0, sizeof(u->msg));
+		u->msg.msg_iov = &u->iov;
+		u->msg.msg_iovlen = 1;
+		u->msg.msg_control = u->control.buf;
+		u->msg.msg_controllen = sizeof(u->control.buf);
+		io_uring_prep_recvmsg(sqe, BT_URING_FILE_BT, &u->msg, 0);
+		io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+		io_uring_sqe_set_data64(sqe, BT_URING_EVENT_RECV);
+		u->recv_pending = true;
+	}
+
+	if (!u->signal_pending &&
+			(sqe = io_uring_get_sqe(&u->ring)) != NULL) {
+		io_uring_prep_poll_add(sqe, BT_URING_FILE_EVENT, POLLIN);
+		io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+		io_uring_sqe_set_data64(sqe, BT_URING_EVENT_SIGNAL);
+		u->signal_pending = true;
+	}
+
+	if (timer_fd != -1 && !u->timer_pending &&
+			(sqe = io_uring_get_sqe(&u->ring)) != NULL) {
+		io_uring_prep_poll_add(sqe, timer_fd, POLLIN);
+		io_uring_sqe_set_data64(sqe, BT_URING_EVENT_TIMER);
+		u->timer_pending = true;
+	}
+
+	struct __kernel_timespec ts = {
+		.tv_sec = timeout / 1000,
+		.tv_nsec = (timeout % 1000) * 1000000 };
+
+	if ((ret = io_uring_submit_and_wait_timeout(&u->ring, &cqe, 1,
+					timeout < 0 ? NULL : &ts, NULL)) < 0 &&
+			ret != -ETIME)
+		return errno = -ret, -1;
+
+	return bt_uring_complete(u);
+}
+
+/**
+ * Get the result of the completed receive operation.
+ *
+ * @param u Pointer to the io_uring receive path structure.
+ * @param msg Address where the pointer to the received message will be
+ *   stored. The message data is valid until the next bt_uring_wait() call.
+ * @return This function returns the number of received bytes. On error,
+ *   -1 is returned and errno is set to indicate the error. If there is no
+ *   completed receive operation, errno is set to EAGAIN. */
+ssize_t bt_uring_recv(struct bt_uring *u, const struct msghdr **msg) {
+
+	if (!u->recv_ready)
+		return errno = EAGAIN, -1;
+
+	u->recv_ready = false;
+	*msg = &u->msg;
+
+	if (u->recv_ret < 0)
+		return errno = -u->recv_ret, -1;
+	return u->recv_ret;
+}
@@ -0,0 +1,75 @@
+/*
+ * BlueALSA - bt-uring.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_BTURING_H_
+#define BLUEALSA_BTURING_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#include <liburing.h>
+
+/**
+ * Events reported by the bt_uring_wait(). */
+#define BT_URING_EVENT_SIGNAL (1 << 0)
+#define BT_URING_EVENT_TIMER  (1 << 1)
+#define BT_URING_EVENT_RECV   (1 << 2)
+
+/**
+ * Receive path of the BT socket driven by the io_uring.
+ *
+ * The BT socket and the transport thread event file descriptor are
+ * registered with the ring, so there is no file table lookup for every
+ * operation. The receive operation and the polling of the event file
+ * descriptors are submitted and waited for with a single system call. */
+struct bt_uring {
+
+	struct io_uring ring;
+
+	/* file descriptors registered with the ring */
+	int bt_fd;
+	int event_fd;
+
+	/* operations submitted to the ring */
+	bool recv_pending;
+	bool signal_pending;
+	bool timer_pending;
+
+	/* result of the completed receive operation */
+	ssize_t recv_ret;
+	bool recv_ready;
+
+	/* receive buffer with the control data space */
+	struct iovec iov;
+	struct msghdr msg;
+	union {
+		char buf[CMSG_SPACE(sizeof(uint32_t)) +
+			CMSG_SPACE(sizeof(struct timespec))];
+		struct cmsghdr align;
+	} control;
+
+};
+
+struct bt_uring *bt_uring_new(int bt_fd, int event_fd, size_t size);
+void bt_uring_free(struct bt_uring *u);
+
+int bt_uring_wait(struct bt_uring *u, int timer_fd, int timeout);
+ssize_t bt_uring_recv(struct bt_uring *u, const struct msghdr **msg);
+
+#endif
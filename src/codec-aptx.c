@@ -15,12 +15,197 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <openaptx.h>
 
 #include "shared/defs.h"
 #include "shared/log.h"
 
+#if HAVE_ATTRIBUTE_TARGET_CLONES && (defined(__x86_64__) || defined(__i386__))
+/* Let the dynamic linker select the best kernel for the host CPU. The
+ * baseline (default) kernel uses SSE2 on x86_64 and NEON on aarch64. */
+# define APTX_KERNEL __attribute__ ((target_clones("avx2", "default")))
+#else
+# define APTX_KERNEL
+#endif
+
+#if defined(__clang__) || __GNUC__ >= 12
+/* Generic vector shuffles are lowered to SSE/NEON instructions. */
+# define APTX_KERNEL_VECTOR 1
+#endif
+
+typedef int16_t aptx_v8s16 __attribute__ ((vector_size(16)));
+typedef int32_t aptx_v4s32 __attribute__ ((vector_size(16)));
+typedef int32_t aptx_v8s32 __attribute__ ((vector_size(32)));
+typedef uint8_t aptx_v32u8 __attribute__ ((vector_size(32)));
+
+#if !WITH_LIBOPENAPTX
+
+/**
+ * Split 4 interleaved stereo frames into separate channels. */
+static inline void aptx_v8s32_deinterleave(const aptx_v8s32 *v, int32_t *l, int32_t *r) {
+#if APTX_KERNEL_VECTOR
+	const aptx_v4s32 vl = __builtin_shufflevector(*v, *v, 0, 2, 4, 6);
+	const aptx_v4s32 vr = __builtin_shufflevector(*v, *v, 1, 3, 5, 7);
+	memcpy(l, &vl, sizeof(vl));
+	memcpy(r, &vr, sizeof(vr));
+#else
+	size_t i;
+	for (i = 0; i < 4; i++) {
+		l[i] = (*v)[i * 2 + 0];
+		r[i] = (*v)[i * 2 + 1];
+	}
+#endif
+}
+
+/**
+ * Join separate channels into 4 interleaved stereo frames. */
+static inline void aptx_v8s32_interleave(const int32_t *l, const int32_t *r, aptx_v8s32 *v) {
+#if APTX_KERNEL_VECTOR
+	aptx_v4s32 vl, vr;
+	memcpy(&vl, l, sizeof(vl));
+	memcpy(&vr, r, sizeof(vr));
+	*v = __builtin_shufflevector(vl, vr, 0, 4, 1, 5, 2, 6, 3, 7);
+#else
+	*v = (aptx_v8s32){ l[0], r[0], l[1], r[1], l[2], r[2], l[3], r[3] };
+#endif
+}
+
+# if ENABLE_APTX
+/**
+ * Deinterleave 4 stereo frames of 16-bit PCM. */
+APTX_KERNEL
+static void aptx_deinterleave_s16(const int16_t *input, int32_t *l, int32_t *r) {
+	aptx_v8s16 v16;
+	memcpy(&v16, input, sizeof(v16));
+	const aptx_v8s32 v = __builtin_convertvector(v16, aptx_v8s32);
+	aptx_v8s32_deinterleave(&v, l, r);
+}
+# endif
+
+# if ENABLE_APTX && HAVE_APTX_DECODE
+/**
+ * Interleave 4 stereo frames of 16-bit PCM. */
+APTX_KERNEL
+static void aptx_interleave_s16(const int32_t *l, const int32_t *r, int16_t *output) {
+	aptx_v8s32 v;
+	aptx_v8s32_interleave(l, r, &v);
+	const aptx_v8s16 v16 = __builtin_convertvector(v, aptx_v8s16);
+	memcpy(output, &v16, sizeof(v16));
+}
+# endif
+
+# if ENABLE_APTX_HD
+/**
+ * Deinterleave 4 stereo frames of 32-bit PCM. */
+APTX_KERNEL
+static void aptx_deinterleave_s32(const int32_t *input, int32_t *l, int32_t *r) {
+	aptx_v8s32 v;
+	memcpy(&v, input, sizeof(v));
+	aptx_v8s32_deinterleave(&v, l, r);
+}
+# endif
+
+# if ENABLE_APTX_HD && HAVE_APTX_HD_DECODE
+/**
+ * Interleave 4 stereo frames of 32-bit PCM. */
+APTX_KERNEL
+static void aptx_interleave_s32(const int32_t *l, const int32_t *r, int32_t *output) {
+	aptx_v8s32 v;
+	aptx_v8s32_interleave(l, r, &v);
+	memcpy(output, &v, sizeof(v));
+}
+# endif
+
+#endif
+
+#if WITH_LIBOPENAPTX
+
+/**
+ * Pack 8 samples into 24-bit little-endian PCM. */
+static inline void aptx_v8s32_pack_s24le(const aptx_v8s32 *v, uint8_t *output) {
+#if APTX_KERNEL_VECTOR && __BYTE_ORDER == __LITTLE_ENDIAN
+	const aptx_v32u8 b = __builtin_shufflevector((aptx_v32u8)*v, (aptx_v32u8)*v,
+			0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 16, 17, 18, 20, 21, 22,
+			24, 25, 26, 28, 29, 30, 0, 0, 0, 0, 0, 0, 0, 0);
+	memcpy(output, &b, 3 * 8);
+#else
+	size_t i;
+	for (i = 0; i < 8; i++) {
+		*output++ = (*v)[i];
+		*output++ = (*v)[i] >> 8;
+		*output++ = (*v)[i] >> 16;
+	}
+#endif
+}
+
+/**
+ * Unpack 8 samples of 24-bit little-endian PCM with the sign extension. */
+static inline void aptx_v8s32_unpack_s24le(const uint8_t *input, aptx_v8s32 *v) {
+#if APTX_KERNEL_VECTOR && __BYTE_ORDER == __LITTLE_ENDIAN
+	aptx_v32u8 b = { 0 };
+	memcpy(&b, input, 3 * 8);
+	b = __builtin_shufflevector(b, b,
+			0, 1, 2, 2, 3, 4, 5, 5, 6, 7, 8, 8, 9, 10, 11, 11,
+			12, 13, 14, 14, 15, 16, 17, 17, 18, 19, 20, 20, 21, 22, 23, 23);
+	*v = ((aptx_v8s32)b << 8) >> 8;
+#else
+	size_t i;
+	for (i = 0; i < 8; i++, input += 3)
+		(*v)[i] = (int32_t)((uint32_t)input[0] << 8 | (uint32_t)input[1] << 16 |
+				(uint32_t)input[2] << 24) >> 8;
+#endif
+}
+
+# if ENABLE_APTX
+/**
+ * Pack 8 samples of 16-bit PCM into 24-bit little-endian PCM. */
+APTX_KERNEL
+static void aptx_pack_s16_s24le(const int16_t *input, uint8_t *output) {
+	aptx_v8s16 v16;
+	memcpy(&v16, input, sizeof(v16));
+	const aptx_v8s32 v = __builtin_convertvector(v16, aptx_v8s32) << 8;
+	aptx_v8s32_pack_s24le(&v, output);
+}
+# endif
+
+# if ENABLE_APTX && HAVE_APTX_DECODE
+/**
+ * Unpack 8 samples of 24-bit little-endian PCM into 16-bit PCM. */
+APTX_KERNEL
+static void aptx_unpack_s24le_s16(const uint8_t *input, int16_t *output) {
+	aptx_v8s32 v;
+	aptx_v8s32_unpack_s24le(input, &v);
+	const aptx_v8s16 v16 = __builtin_convertvector(v >> 8, aptx_v8s16);
+	memcpy(output, &v16, sizeof(v16));
+}
+# endif
+
+# if ENABLE_APTX_HD
+/**
+ * Pack 8 samples of 32-bit PCM into 24-bit little-endian PCM. */
+APTX_KERNEL
+static void aptx_pack_s32_s24le(const int32_t *input, uint8_t *output) {
+	aptx_v8s32 v;
+	memcpy(&v, input, sizeof(v));
+	aptx_v8s32_pack_s24le(&v, output);
+}
+# endif
+
+# if ENABLE_APTX_HD && HAVE_APTX_HD_DECODE
+/**
+ * Unpack 8 samples of 24-bit little-endian PCM into 32-bit PCM. */
+APTX_KERNEL
+static void aptx_unpack_s24le_s32(const uint8_t *input, int32_t *output) {
+	aptx_v8s32 v;
+	aptx_v8s32_unpack_s24le(input, &v);
+	memcpy(output, &v, sizeof(v));
+}
+# endif
+
+#endif
+
 #if ENABLE_APTX
 /**
  * Initialize apt-X encoder handler.
@@ -119,12 +304,8 @@ ssize_t aptxenc_encode(HANDLE_APTX handle, const int16_t *input, size_t samples,
 
 #if WITH_LIBOPENAPTX
 
-	const uint8_t pcm[3 /* 24bit */ * 8 /* 4 samples * 2 channels */] = {
-		0, input[0], input[0] >> 8, 0, input[1], input[1] >> 8,
-		0, input[2], input[2] >> 8, 0, input[3], input[3] >> 8,
-		0, input[4], input[4] >> 8, 0, input[5], input[5] >> 8,
-		0, input[6], input[6] >> 8, 0, input[7], input[7] >> 8,
-	};
+	uint8_t pcm[3 /* 24bit */ * 8 /* 4 samples * 2 channels */];
+	aptx_pack_s16_s24le(input, pcm);
 
 	size_t rv;
 	if ((rv = aptx_encode(handle, pcm, sizeof(pcm), output, *len, len)) != sizeof(pcm))
@@ -134,8 +315,8 @@ ssize_t aptxenc_encode(HANDLE_APTX handle, const int16_t *input, size_t samples,
 
 #else
 
-	int32_t pcm_l[4] = { input[0], input[2], input[4], input[6] };
-	int32_t pcm_r[4] = { input[1], input[3], input[5], input[7] };
+	int32_t pcm_l[4], pcm_r[4];
+	aptx_deinterleave_s16(input, pcm_l, pcm_r);
 
 	if (aptxbtenc_encodestereo(handle, pcm_l, pcm_r, output) != 0)
 		return -1;
@@ -172,8 +353,13 @@ ssize_t aptxdec_decode(HANDLE_APTX handle, const void *input, size_t len,
 	if (!synced && dropped > 0)
 		info("Apt-X stream out of sync: Dropped bytes: %zd", dropped);
 
-	size_t i;
-	for (i = 0; i < written / 3 / 2; i++) {
+	size_t i = 0;
+	/* fast path for the regular case of 4 decoded stereo frames */
+	if (written == 3 * 8) {
+		aptx_unpack_s24le_s16(pcm, output);
+		i = written / 3 / 2;
+	}
+	for (; i < written / 3 / 2; i++) {
 		*output++ = pcm[i * 6 + 0 + 1] | (pcm[i * 6 + 0 + 2] << 8);
 		*output++ = pcm[i * 6 + 3 + 1] | (pcm[i * 6 + 3 + 2] << 8);
 	}
@@ -187,11 +373,7 @@ ssize_t aptxdec_decode(HANDLE_APTX handle, const void *input, size_t len,
 	if (aptxbtdec_decodestereo(handle, pcm_l, pcm_r, input) != 0)
 		return -1;
 
-	size_t i;
-	for (i = 0; i < ARRAYSIZE(pcm_l); i++) {
-		*output++ = pcm_l[i];
-		*output++ = pcm_r[i];
-	}
+	aptx_interleave_s16(pcm_l, pcm_r, output);
 
 	*samples = 8;
 	return 4;
@@ -214,12 +396,8 @@ ssize_t aptxhdenc_encode(HANDLE_APTX handle, const int32_t *input, size_t sample
 
 #if WITH_LIBOPENAPTX
 
-	const uint8_t pcm[3 /* 24bit */ * 8 /* 4 samples * 2 channels */] = {
-		input[0], input[0] >> 8, input[0] >> 16, input[1], input[1] >> 8, input[1] >> 16,
-		input[2], input[2] >> 8, input[2] >> 16, input[3], input[3] >> 8, input[3] >> 16,
-		input[4], input[4] >> 8, input[4] >> 16, input[5], input[5] >> 8, input[5] >> 16,
-		input[6], input[6] >> 8, input[6] >> 16, input[7], input[7] >> 8, input[7] >> 16,
-	};
+	uint8_t pcm[3 /* 24bit */ * 8 /* 4 samples * 2 channels */];
+	aptx_pack_s32_s24le(input, pcm);
 
 	size_t rv;
 	if ((rv = aptx_encode(handle, pcm, sizeof(pcm), output, *len, len)) != sizeof(pcm))
@@ -229,10 +407,11 @@ ssize_t aptxhdenc_encode(HANDLE_APTX handle, const int32_t *input, size_t sample
 
 #else
 
-	int32_t pcm_l[4] = { input[0], input[2], input[4], input[6] };
-	int32_t pcm_r[4] = { input[1], input[3], input[5], input[7] };
+	int32_t pcm_l[4], pcm_r[4];
 	uint32_t code[2];
 
+	aptx_deinterleave_s32(input, pcm_l, pcm_r);
+
 	if (aptxhdbtenc_encodestereo(handle, pcm_l, pcm_r, code) != 0)
 		return -1;
 
@@ -275,9 +454,14 @@ ssize_t aptxhddec_decode(HANDLE_APTX handle, const void *input, size_t len,
 	if (!synced && dropped > 0)
 		info("Apt-X HD stream out of sync: Dropped bytes: %zd", dropped);
 
-	size_t i;
+	size_t i = 0;
 	int32_t base;
-	for (i = 0; i < written / 3 / 2; i++) {
+	/* fast path for the regular case of 4 decoded stereo frames */
+	if (written == 3 * 8) {
+		aptx_unpack_s24le_s32(pcm, output);
+		i = written / 3 / 2;
+	}
+	for (; i < written / 3 / 2; i++) {
 		base = pcm[i * 6 + 0 + 2] & 0x80 ? 0xFF000000 : 0;
 		*output++ = base | pcm[i * 6 + 0 + 0] | (pcm[i * 6 + 0 + 1] << 8) | (pcm[i * 6 + 0 + 2] << 16);
 		base = pcm[i * 6 + 3 + 2] & 0x80 ? 0xFF000000 : 0;
@@ -297,11 +481,7 @@ ssize_t aptxhddec_decode(HANDLE_APTX handle, const void *input, size_t len,
 	if (aptxhdbtdec_decodestereo(handle, pcm_l, pcm_r, code) != 0)
 		return -1;
 
-	size_t i;
-	for (i = 0; i < ARRAYSIZE(pcm_l); i++) {
-		*output++ = pcm_l[i];
-		*output++ = pcm_r[i];
-	}
+	aptx_interleave_s32(pcm_l, pcm_r, output);
 
 	*samples = 8;
 	return 6;
@@ -0,0 +1,443 @@
+/*
+ * BlueALSA - codec-calibrate.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "codec-calibrate.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+#include <sbc/sbc.h>
+#if ENABLE_AAC
+# include <fdk-aac/aacenc_lib.h>
+#endif
+#if ENABLE_MP3LAME
+# include <lame/lame.h>
+#endif
+#if ENABLE_LDAC
+# include <ldacBT.h>
+#endif
+
+#include "a2dp-codecs.h"
+#include "bluealsa.h"
+#include "codec-sbc.h"
+#include "utils.h"
+#include "shared/defs.h"
+#include "shared/log.h"
+#include "shared/rt.h"
+
+/**
+ * The number of PCM frames in the synthetic input signal. */
+#define CALIBRATE_PCM_FRAMES 4096
+
+/**
+ * LDAC encoder MTU used for benchmarking - the typical value
+ * negotiated by the EDR capable Bluetooth adapters. */
+#define CALIBRATE_LDAC_MTU 679
+
+struct calibrate_timer {
+	struct timespec begin;
+	/* number of encoded PCM frames */
+	size_t frames;
+};
+
+/* white noise is the worst case for all perceptual encoders */
+static int16_t calibrate_pcm_s16[CALIBRATE_PCM_FRAMES * 2];
+#if ENABLE_LDAC
+static int32_t calibrate_pcm_s32[CALIBRATE_PCM_FRAMES * 2];
+#endif
+
+/**
+ * Record the real-time factor of the codec configuration in use. */
+static void calibrate_rtf_save(uint32_t codec_id, double rtf) {
+	g_assert(config.codec_rtf_len < ARRAYSIZE(config.codec_rtf));
+	config.codec_rtf[config.codec_rtf_len].codec_id = codec_id;
+	config.codec_rtf[config.codec_rtf_len++].rtf = rtf;
+}
+
+static void calibrate_pcm_init(void) {
+	uint32_t seed = 0x12345678;
+	for (size_t i = 0; i < ARRAYSIZE(calibrate_pcm_s16); i++) {
+		/* xorshift32 - we do not need anything fancy here */
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		calibrate_pcm_s16[i] = (int16_t)(seed >> 16) / 2;
+#if ENABLE_LDAC
+		calibrate_pcm_s32[i] = (int32_t)calibrate_pcm_s16[i] << 16;
+#endif
+	}
+}
+
+static void calibrate_timer_start(struct calibrate_timer *timer) {
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &timer->begin);
+	timer->frames = 0;
+}
+
+static bool calibrate_timer_running(const struct calibrate_timer *timer) {
+	struct timespec now, diff;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	difftimespec(&timer->begin, &now, &diff);
+	return diff.tv_sec * 1000 + diff.tv_nsec / 1000000 < CODEC_CALIBRATE_TIME_MS;
+}
+
+/**
+ * Get the real-time factor of the encoding. */
+static double calibrate_timer_rtf(const struct calibrate_timer *timer,
+		unsigned int sampling) {
+
+	struct timespec now, diff;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	difftimespec(&timer->begin, &now, &diff);
+
+	const double cpu = diff.tv_sec + diff.tv_nsec / 1e9;
+	const double audio = (double)timer->frames / sampling;
+	return audio > 0 ? cpu / audio : 1e3;
+}
+
+/**
+ * Benchmark SBC encoder with the given quality. */
+static int calibrate_sbc(unsigned int quality, double *rtf) {
+
+	/* XQ mode uses dual channel with forced 44.1 kHz sampling */
+	const a2dp_sbc_t configuration = {
+		.frequency = quality == SBC_QUALITY_XQ ?
+			SBC_SAMPLING_FREQ_44100 : SBC_SAMPLING_FREQ_48000,
+		.channel_mode = quality == SBC_QUALITY_XQ ?
+			SBC_CHANNEL_MODE_DUAL_CHANNEL : SBC_CHANNEL_MODE_JOINT_STEREO,
+		.block_length = SBC_BLOCK_LENGTH_16,
+		.subbands = SBC_SUBBANDS_8,
+		.allocation_method = SBC_ALLOCATION_LOUDNESS,
+		.min_bitpool = SBC_MIN_BITPOOL,
+		.max_bitpool = SBC_MAX_BITPOOL,
+	};
+
+	const unsigned int sampling = quality == SBC_QUALITY_XQ ? 44100 : 48000;
+	struct calibrate_timer timer;
+	uint8_t output[512];
+	sbc_t sbc;
+	int err;
+
+	if ((err = sbc_init_a2dp(&sbc, 0, &configuration, sizeof(configuration))) != 0)
+		return errno = -err, -1;
+
+	sbc.bitpool = sbc_a2dp_get_bitpool(&configuration, quality);
+	const size_t codesize = sbc_get_codesize(&sbc);
+	const size_t frames = codesize / (2 * sizeof(int16_t));
+	size_t offset = 0;
+
+	calibrate_timer_start(&timer);
+	while (calibrate_timer_running(&timer)) {
+		ssize_t len;
+		if (offset + frames > CALIBRATE_PCM_FRAMES)
+			offset = 0;
+		if ((len = sbc_encode(&sbc, &calibrate_pcm_s16[offset * 2], codesize,
+						output, sizeof(output), NULL)) < 0) {
+			sbc_finish(&sbc);
+			return errno = -len, -1;
+		}
+		timer.frames += frames;
+		offset += frames;
+	}
+
+	*rtf = calibrate_timer_rtf(&timer, sampling);
+	sbc_finish(&sbc);
+	return 0;
+}
+
+#if ENABLE_AAC
+/**
+ * Benchmark AAC encoder with the afterburner enabled or not. */
+static int calibrate_aac(bool afterburner, double *rtf) {
+
+	const unsigned int sampling = 48000;
+	struct calibrate_timer timer;
+	HANDLE_AACENCODER handle;
+	AACENC_InfoStruct aacinf;
+	AACENC_ERROR err;
+	int ret = -1;
+
+	if ((err = aacEncOpen(&handle, 0, 2)) != AACENC_OK) {
+		error("Couldn't open AAC encoder: %s", aacenc_strerror(err));
+		return errno = ENODEV, -1;
+	}
+
+	if (aacEncoder_SetParam(handle, AACENC_AOT, AOT_AAC_LC) != AACENC_OK ||
+			aacEncoder_SetParam(handle, AACENC_BITRATE, 320000) != AACENC_OK ||
+			aacEncoder_SetParam(handle, AACENC_SAMPLERATE, sampling) != AACENC_OK ||
+			aacEncoder_SetParam(handle, AACENC_CHANNELMODE, MODE_2) != AACENC_OK ||
+			aacEncoder_SetParam(handle, AACENC_AFTERBURNER, afterburner) != AACENC_OK ||
+			aacEncoder_SetParam(handle, AACENC_TRANSMUX, TT_MP4_LATM_MCP1) != AACENC_OK ||
+			aacEncEncode(handle, NULL, NULL, NULL, NULL) != AACENC_OK ||
+			aacEncInfo(handle, &aacinf) != AACENC_OK) {
+		errno = EINVAL;
+		goto final;
+	}
+
+	const size_t frames = aacinf.frameLength;
+	uint8_t output[2048];
+	size_t offset = 0;
+
+	int in_bufferIdentifiers[] = { IN_AUDIO_DATA };
+	int out_bufferIdentifiers[] = { OUT_BITSTREAM_DATA };
+	int in_bufSizes[] = { frames * 2 * sizeof(int16_t) };
+	int out_bufSizes[] = { sizeof(output) };
+	int in_bufElSizes[] = { sizeof(int16_t) };
+	int out_bufElSizes[] = { sizeof(uint8_t) };
+	void *in_buf_data;
+	void *out_buf_data = output;
+
+	AACENC_BufDesc in_buf = {
+		.numBufs = 1,
+		.bufs = &in_buf_data,
+		.bufferIdentifiers = in_bufferIdentifiers,
+		.bufSizes = in_bufSizes,
+		.bufElSizes = in_bufElSizes,
+	};
+	AACENC_BufDesc out_buf = {
+		.numBufs = 1,
+		.bufs = &out_buf_data,
+		.bufferIdentifiers = out_bufferIdentifiers,
+		.bufSizes = out_bufSizes,
+		.bufElSizes = out_bufElSizes,
+	};
+	AACENC_InArgs in_args = { .numInSamples = frames * 2 };
+	AACENC_OutArgs out_args = { 0 };
+
+	calibrate_timer_start(&timer);
+	while (calibrate_timer_running(&timer)) {
+		if (offset + frames > CALIBRATE_PCM_FRAMES)
+			offset = 0;
+		in_buf_data = &calibrate_pcm_s16[offset * 2];
+		if ((err = aacEncEncode(handle, &in_buf, &out_buf, &in_args, &out_args)) != AACENC_OK) {
+			error("AAC encoding error: %s", aacenc_strerror(err));
+			errno = EIO;
+			goto final;
+		}
+		timer.frames += out_args.numInSamples / 2;
+		offset += frames;
+	}
+
+	*rtf = calibrate_timer_rtf(&timer, sampling);
+	ret = 0;
+
+final:
+	aacEncClose(&handle);
+	return ret;
+}
+#endif
+
+#if ENABLE_MP3LAME
+/**
+ * Benchmark MP3 encoder with the given LAME quality. */
+static int calibrate_mp3(int quality, double *rtf) {
+
+	const unsigned int sampling = 48000;
+	struct calibrate_timer timer;
+	lame_t handle;
+	int ret = -1;
+
+	if ((handle = lame_init()) == NULL)
+		return errno = ENOMEM, -1;
+
+	if (lame_set_num_channels(handle, 2) != 0 ||
+			lame_set_in_samplerate(handle, sampling) != 0 ||
+			lame_set_mode(handle, JOINT_STEREO) != 0 ||
+			lame_set_VBR(handle, vbr_off) != 0 ||
+			lame_set_brate(handle, 320) != 0 ||
+			lame_set_quality(handle, quality) != 0 ||
+			lame_init_params(handle) != 0) {
+		errno = EINVAL;
+		goto final;
+	}
+
+	const size_t frames = lame_get_framesize(handle);
+	unsigned char output[2048 * 2];
+	size_t offset = 0;
+
+	calibrate_timer_start(&timer);
+	while (calibrate_timer_running(&timer)) {
+		if (offset + frames > CALIBRATE_PCM_FRAMES)
+			offset = 0;
+		if (lame_encode_buffer_interleaved(handle, &calibrate_pcm_s16[offset * 2],
+					frames, output, sizeof(output)) < 0) {
+			errno = EIO;
+			goto final;
+		}
+		timer.frames += frames;
+		offset += frames;
+	}
+
+	*rtf = calibrate_timer_rtf(&timer, sampling);
+	ret = 0;
+
+final:
+	lame_close(handle);
+	return ret;
+}
+#endif
+
+#if ENABLE_LDAC
+/**
+ * Benchmark LDAC encoder with the given quality and sampling. */
+static int calibrate_ldac(int eqmid, unsigned int sampling, double *rtf) {
+
+	struct calibrate_timer timer;
+	HANDLE_LDAC_BT handle;
+	int ret = -1;
+
+	if ((handle = ldacBT_get_handle()) == NULL)
+		return -1;
+
+	if (ldacBT_init_handle_encode(handle, CALIBRATE_LDAC_MTU, eqmid,
+				LDACBT_CHANNEL_MODE_STEREO, LDACBT_SMPL_FMT_S32, sampling) == -1) {
+		error("Couldn't initialize LDAC encoder: %s", ldacBT_strerror(ldacBT_get_error_code(handle)));
+		errno = EINVAL;
+		goto final;
+	}
+
+	const size_t frames = LDACBT_ENC_LSU;
+	uint8_t output[1024];
+	size_t offset = 0;
+
+	calibrate_timer_start(&timer);
+	while (calibrate_timer_running(&timer)) {
+		int used, encoded, encoded_frames;
+		if (offset + frames > CALIBRATE_PCM_FRAMES)
+			offset = 0;
+		if (ldacBT_encode(handle, &calibrate_pcm_s32[offset * 2], &used,
+					output, &encoded, &encoded_frames) != 0) {
+			error("LDAC encoding error: %s", ldacBT_strerror(ldacBT_get_error_code(handle)));
+			errno = EIO;
+			goto final;
+		}
+		timer.frames += frames;
+		offset += frames;
+	}
+
+	*rtf = calibrate_timer_rtf(&timer, sampling);
+	ret = 0;
+
+final:
+	ldacBT_free_handle(handle);
+	return ret;
+}
+#endif
+
+/**
+ * Benchmark compiled-in encoders on this host.
+ *
+ * Every encoder configuration is benchmarked for a fraction of a second with
+ * the synthetic signal. If the measured real-time factor exceeds the limit,
+ * the corresponding quality setting in the global configuration is lowered,
+ * so the A2DP configuration selection and the encoder setup will not use
+ * configurations which the CPU can not sustain.
+ *
+ * This function shall be called before the A2DP codecs initialization.
+ *
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int codec_calibrate(void) {
+
+	double rtf;
+
+	calibrate_pcm_init();
+	config.codec_rtf_len = 0;
+
+	for (;;) {
+		if (calibrate_sbc(config.sbc_quality, &rtf) == -1) {
+			error("Couldn't calibrate SBC encoder: %s", strerror(errno));
+			return -1;
+		}
+		info("Codec calibration: SBC quality %u: RTF %.3f", config.sbc_quality, rtf);
+		if (rtf <= CODEC_CALIBRATE_RTF_MAX ||
+				config.sbc_quality <= SBC_QUALITY_MEDIUM)
+			break;
+		warn("SBC quality %u is too expensive for this host", config.sbc_quality);
+		config.sbc_quality--;
+	}
+	calibrate_rtf_save(A2DP_CODEC_SBC, rtf);
+
+#if ENABLE_AAC
+	if (config.aac_afterburner) {
+		if (calibrate_aac(true, &rtf) == -1) {
+			error("Couldn't calibrate AAC encoder: %s", strerror(errno));
+			return -1;
+		}
+		info("Codec calibration: AAC afterburner: RTF %.3f", rtf);
+		if (rtf > CODEC_CALIBRATE_RTF_MAX) {
+			warn("AAC afterburner is too expensive for this host");
+			config.aac_afterburner = false;
+		}
+	}
+	if (!config.aac_afterburner) {
+		if (calibrate_aac(false, &rtf) == -1) {
+			error("Couldn't calibrate AAC encoder: %s", strerror(errno));
+			return -1;
+		}
+		info("Codec calibration: AAC: RTF %.3f", rtf);
+	}
+	calibrate_rtf_save(A2DP_CODEC_MPEG24, rtf);
+#endif
+
+#if ENABLE_MP3LAME
+	for (;;) {
+		if (calibrate_mp3(config.lame_quality, &rtf) == -1) {
+			error("Couldn't calibrate MP3 encoder: %s", strerror(errno));
+			return -1;
+		}
+		info("Codec calibration: MP3 quality %u: RTF %.3f", config.lame_quality, rtf);
+		if (rtf <= CODEC_CALIBRATE_RTF_MAX || config.lame_quality >= 9)
+			break;
+		warn("LAME quality %u is too expensive for this host", config.lame_quality);
+		config.lame_quality = MIN(config.lame_quality + 2, 9);
+	}
+	calibrate_rtf_save(A2DP_CODEC_MPEG12, rtf);
+#endif
+
+#if ENABLE_LDAC
+	/* Prefer lowering the encoder quality over lowering the sampling,
+	 * because high sampling is usually the reason for selecting LDAC. */
+	const unsigned int ldac_samplings[] = { 96000, 48000 };
+	const int ldac_eqmid = config.ldac_eqmid;
+	for (size_t i = 0; i < ARRAYSIZE(ldac_samplings); i++) {
+		bool sustainable = false;
+		for (int eqmid = ldac_eqmid; eqmid <= LDACBT_EQMID_MQ; eqmid++) {
+			if (calibrate_ldac(eqmid, ldac_samplings[i], &rtf) == -1) {
+				error("Couldn't calibrate LDAC encoder: %s", strerror(errno));
+				return -1;
+			}
+			info("Codec calibration: LDAC EQMID %d %u Hz: RTF %.3f",
+					eqmid, ldac_samplings[i], rtf);
+			config.ldac_eqmid = eqmid;
+			if ((sustainable = rtf <= CODEC_CALIBRATE_RTF_MAX))
+				break;
+		}
+		if (sustainable)
+			break;
+		/* there is nothing more we can do - keep the lowest settings */
+		if (i + 1 == ARRAYSIZE(ldac_samplings)) {
+			warn("LDAC encoder is too expensive for this host");
+			break;
+		}
+		warn("LDAC %u Hz sampling is too expensive for this host", ldac_samplings[i]);
+		config.ldac_max_sampling = ldac_samplings[i + 1];
+	}
+	if (config.ldac_eqmid != ldac_eqmid)
+		warn("LDAC EQMID %d is too expensive for this host", ldac_eqmid);
+	calibrate_rtf_save(A2DP_CODEC_VENDOR_LDAC, rtf);
+#endif
+
+	return 0;
+}
@@ -0,0 +1,32 @@
+/*
+ * BlueALSA - codec-calibrate.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_CODECCALIBRATE_H_
+#define BLUEALSA_CODECCALIBRATE_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+/**
+ * The amount of CPU time in milliseconds spent on benchmarking
+ * a single encoder configuration. */
+#define CODEC_CALIBRATE_TIME_MS 100
+
+/**
+ * The maximal real-time factor (CPU time divided by the audio duration)
+ * of the encoder which is considered to be sustainable. Encoder has to
+ * share CPU with other IO threads and the rest of the system, so there
+ * shall be a reasonable headroom. */
+#define CODEC_CALIBRATE_RTF_MAX 0.5
+
+int codec_calibrate(void);
+
+#endif
@@ -0,0 +1,206 @@
+/*
+ * BlueALSA - codec-lc3-swb.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "codec-lc3-swb.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shared/log.h"
+
+int lc3_swb_init(struct esco_lc3_swb *lc3_swb) {
+
+	int err;
+
+	if (!lc3_swb->initialized) {
+		debug("Initializing LC3-SWB codec");
+		lc3_swb->encoder_mem = NULL;
+		lc3_swb->decoder_mem = NULL;
+		if ((lc3_swb->encoder_mem = malloc(lc3_encoder_size(LC3_SWB_FRAME_US, LC3_SWB_SAMPLING))) == NULL)
+			goto fail;
+		if ((lc3_swb->decoder_mem = malloc(lc3_decoder_size(LC3_SWB_FRAME_US, LC3_SWB_SAMPLING))) == NULL)
+			goto fail;
+		if (rb_init_uint8_t(&lc3_swb->data, sizeof(esco_lc3_swb_frame_t) * LC3_SWB_DATA_FRAMES) == -1)
+			goto fail;
+		if (rb_init_int16_t(&lc3_swb->pcm, LC3_SWB_CODESAMPLES * LC3_SWB_DATA_FRAMES) == -1)
+			goto fail;
+	}
+
+	/* The setup of the LC3 encoder/decoder resets its state, and it does
+	 * not allocate any memory, so it can be done every time. */
+	if ((lc3_swb->encoder = lc3_setup_encoder(LC3_SWB_FRAME_US, LC3_SWB_SAMPLING,
+					0, lc3_swb->encoder_mem)) == NULL ||
+			(lc3_swb->decoder = lc3_setup_decoder(LC3_SWB_FRAME_US, LC3_SWB_SAMPLING,
+					0, lc3_swb->decoder_mem)) == NULL) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	rb_rewind(&lc3_swb->data);
+	rb_rewind(&lc3_swb->pcm);
+
+	lc3_swb->seq_initialized = false;
+	lc3_swb->seq_number = 0;
+	lc3_swb->frames = 0;
+	lc3_swb->frames_concealed = 0;
+
+	lc3_swb->initialized = true;
+	return 0;
+
+fail:
+	err = errno;
+	lc3_swb_finish(lc3_swb);
+	lc3_swb->initialized = false;
+	errno = err;
+	return -1;
+}
+
+void lc3_swb_finish(struct esco_lc3_swb *lc3_swb) {
+
+	if (lc3_swb == NULL)
+		return;
+
+	free(lc3_swb->encoder_mem);
+	lc3_swb->encoder_mem = NULL;
+	free(lc3_swb->decoder_mem);
+	lc3_swb->decoder_mem = NULL;
+
+	rb_free(&lc3_swb->data);
+	rb_free(&lc3_swb->pcm);
+
+}
+
+/**
+ * Conceal single lost LC3-SWB frame. */
+static void lc3_swb_conceal(struct esco_lc3_swb *lc3_swb, int16_t *output) {
+	lc3_decode(lc3_swb->decoder, NULL, 0, LC3_PCM_FORMAT_S16, output, 1);
+	lc3_swb->frames_concealed++;
+}
+
+/**
+ * Find and decode single eSCO LC3-SWB frame.
+ *
+ * @return This function returns 1 if the frame has been decoded (or
+ *   concealed), or 0 if there is not enough data. On error, -1 is returned
+ *   and errno is set to indicate the error. */
+int lc3_swb_decode(struct esco_lc3_swb *lc3_swb) {
+
+	if (!lc3_swb->initialized)
+		return errno = EINVAL, -1;
+
+	const uint8_t *input_head = rb_head(&lc3_swb->data);
+	const uint8_t *input = input_head;
+	size_t input_len = rb_blen_out(&lc3_swb->data);
+	int16_t *output = rb_tail(&lc3_swb->pcm);
+	size_t output_len = rb_blen_in(&lc3_swb->pcm);
+	int rv = 0;
+
+	const size_t tmp = input_len;
+	const esco_h2_header_t *_h2 = esco_h2_find_header(input, &input_len);
+	const esco_lc3_swb_frame_t *frame = (esco_lc3_swb_frame_t *)_h2;
+	input += tmp - input_len;
+
+	/* Skip decoding if there is not enough input data or the output
+	 * buffer is not big enough to hold decoded PCM samples.*/
+	if (input_len < sizeof(*frame) ||
+			output_len < LC3_SWB_CODESIZE)
+		goto final;
+
+	const uint16_t h2 = le16toh(*_h2);
+	uint8_t _seq = ESCO_H2_GET_SEQ(h2);
+	unsigned int missing = 0;
+	if (!lc3_swb->seq_initialized) {
+		lc3_swb->seq_initialized = true;
+		lc3_swb->seq_number = _seq;
+	}
+	else if (_seq != ++lc3_swb->seq_number) {
+		warn("Missing LC3-SWB packet: %u != %u", _seq, lc3_swb->seq_number);
+		missing = (_seq - lc3_swb->seq_number) & 0x3;
+		lc3_swb->seq_number = _seq;
+	}
+
+	/* Conceal missing frames, but only as long as there is enough space
+	 * for the current frame in the output buffer. */
+	for (; missing > 0 && output_len >= LC3_SWB_CODESIZE * 2; missing--) {
+		lc3_swb_conceal(lc3_swb, output);
+		rb_seek(&lc3_swb->pcm, LC3_SWB_CODESAMPLES);
+		output += LC3_SWB_CODESAMPLES;
+		output_len -= LC3_SWB_CODESIZE;
+	}
+
+	/* Unlike mSBC, the LC3 frame has no syncword, so it is not possible to
+	 * tell whether the H2 header has been matched by accident. However, the
+	 * LC3 decoder detects corrupted frames and conceals them on its own. */
+	switch (lc3_decode(lc3_swb->decoder, frame->payload, sizeof(frame->payload),
+				LC3_PCM_FORMAT_S16, output, 1)) {
+	case 0:
+		break;
+	case 1:
+		debug("Concealing corrupted LC3-SWB frame");
+		lc3_swb->frames_concealed++;
+		break;
+	default:
+		errno = EINVAL, rv = -1;
+		goto final;
+	}
+
+	rb_seek(&lc3_swb->pcm, LC3_SWB_CODESAMPLES);
+	input += sizeof(*frame);
+	rv = 1;
+
+final:
+	/* Consume scanned and decoded data. */
+	rb_shift(&lc3_swb->data, input - input_head);
+	return rv;
+}
+
+/**
+ * Encode eSCO LC3-SWB frames.
+ *
+ * This function encodes as many frames as possible, i.e. until there is
+ * not enough PCM samples or there is no space left in the data buffer.
+ *
+ * @return This function returns 1 if at least one frame has been encoded,
+ *   or 0 otherwise. On error, -1 is returned and errno is set to indicate
+ *   the error. */
+int lc3_swb_encode(struct esco_lc3_swb *lc3_swb) {
+
+	if (!lc3_swb->initialized)
+		return errno = EINVAL, -1;
+
+	int rv = 0;
+
+	while (rb_blen_out(&lc3_swb->pcm) >= LC3_SWB_CODESIZE &&
+			rb_blen_in(&lc3_swb->data) >= sizeof(esco_lc3_swb_frame_t)) {
+
+		const int16_t *input = rb_head(&lc3_swb->pcm);
+		esco_lc3_swb_frame_t *frame = (esco_lc3_swb_frame_t *)rb_tail(&lc3_swb->data);
+
+		if (lc3_encode(lc3_swb->encoder, LC3_PCM_FORMAT_S16, input, 1,
+					sizeof(frame->payload), frame->payload) != 0)
+			return errno = EINVAL, -1;
+
+		const uint8_t seq = lc3_swb->seq_number++;
+		frame->header = htole16(ESCO_H2_PACK_SEQ(seq));
+
+		rb_seek(&lc3_swb->data, sizeof(*frame));
+		lc3_swb->frames++;
+
+		/* Consume encoded PCM samples. */
+		rb_shift(&lc3_swb->pcm, LC3_SWB_CODESAMPLES);
+		rv = 1;
+
+	}
+
+	return rv;
+}
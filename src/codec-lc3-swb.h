@@ -0,0 +1,78 @@
+/*
+ * BlueALSA - codec-lc3-swb.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_CODECLC3SWB_H_
+#define BLUEALSA_CODECLC3SWB_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <lc3.h>
+
+#include "codec-msbc.h"
+#include "shared/rb.h"
+
+/* HFP uses LC3 encoding with 7.5 ms frames at 32 kHz sampling and constant
+ * bit rate, so the whole eSCO frame (H2 header and LC3 frame) fits exactly
+ * in the 60 bytes eSCO packet. */
+#define LC3_SWB_SAMPLING    32000
+#define LC3_SWB_FRAME_US    7500
+#define LC3_SWB_CODESAMPLES 240
+#define LC3_SWB_CODESIZE    (LC3_SWB_CODESAMPLES * sizeof(int16_t))
+#define LC3_SWB_FRAMELEN    58
+
+/* The number of eSCO LC3-SWB frames which can be queued in the data buffer.
+ * It has the same meaning as the MSBC_DATA_FRAMES. The PCM buffer has the
+ * same capacity, so it can hold concealed frames and the decoded one. */
+#define LC3_SWB_DATA_FRAMES 8
+
+typedef struct esco_lc3_swb_frame {
+	esco_h2_header_t header;
+	uint8_t payload[LC3_SWB_FRAMELEN];
+} __attribute__ ((packed)) esco_lc3_swb_frame_t;
+
+struct esco_lc3_swb {
+
+	/* encoder/decoder and their memory */
+	lc3_encoder_t encoder;
+	lc3_decoder_t decoder;
+	void *encoder_mem;
+	void *decoder_mem;
+
+	/* buffer for eSCO frames */
+	rb_t data;
+	/* buffer for PCM samples */
+	rb_t pcm;
+
+	uint8_t seq_initialized : 1;
+	uint8_t seq_number : 2;
+	/* number of processed frames */
+	size_t frames;
+	/* number of concealed frames */
+	size_t frames_concealed;
+
+	/* Determine whether structure has been initialized. This field is
+	 * used for reinitialization - it makes lc3_swb_init() idempotent. */
+	bool initialized;
+
+};
+
+int lc3_swb_init(struct esco_lc3_swb *lc3_swb);
+void lc3_swb_finish(struct esco_lc3_swb *lc3_swb);
+
+int lc3_swb_decode(struct esco_lc3_swb *lc3_swb);
+int lc3_swb_encode(struct esco_lc3_swb *lc3_swb);
+
+#endif
@@ -13,35 +13,48 @@
 
 #include <endian.h>
 #include <errno.h>
+#include <math.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "codec-sbc.h"
 #include "shared/log.h"
 
-/* Code protected 2-bit sequence numbers (SN0 and SN1) used
- * by the msbc_encode() function. */
-static const uint8_t sn[][2] = {
-	{ 0, 0 }, { 3, 0 }, { 0, 3 }, { 3, 3 }
-};
-
 /**
  * Find H2 synchronization header within eSCO transparent data.
  *
+ * The H2 header is used by all transparent eSCO codecs (mSBC and LC3-SWB)
+ * for the frame synchronization.
+ *
  * @param data Memory area with the eSCO transparent data.
  * @param len Address from where the length of the eSCO transparent data
  *   is read. Upon exit, the remaining length of the eSCO data will be
  *   stored in this variable (received length minus scanned length).
  * @return On success this function returns the first occurrence of the H2
  *   synchronization header. Otherwise, it returns NULL. */
-static esco_h2_header_t *msbc_find_h2_header(const void *data, size_t *len) {
+esco_h2_header_t *esco_h2_find_header(const void *data, size_t *len) {
 
 	esco_h2_header_t *h2 = NULL;
 	const uint8_t *_data = data;
 	size_t _len = *len;
 
 	while (_len >= sizeof(esco_h2_header_t)) {
-		esco_h2_header_t tmp = le16toh(*(esco_h2_header_t *)_data);
 
+		/* Skip to the next byte which might be the first byte of the (little
+		 * endian) syncword. The memchr() function scans memory word-at-a-time
+		 * or with SIMD instructions, which is much faster than our loop. */
+		const uint8_t *ptr;
+		if ((ptr = memchr(_data, ESCO_H2_SYNCWORD & 0xFF, _len - 1)) == NULL) {
+			_data += _len - 1;
+			_len = 1;
+			break;
+		}
+
+		_len -= ptr - _data;
+		_data = ptr;
+
+		esco_h2_header_t tmp = _data[0] | _data[1] << 8;
 		if (ESCO_H2_GET_SYNCWORD(tmp) == ESCO_H2_SYNCWORD &&
 				(ESCO_H2_GET_SN0(tmp) >> 1) == (ESCO_H2_GET_SN0(tmp) & 1) &&
 				(ESCO_H2_GET_SN1(tmp) >> 1) == (ESCO_H2_GET_SN1(tmp) & 1)) {
@@ -58,6 +71,163 @@ final:
 	return h2;
 }
 
+/* Raised cosine table for the overlap-add: cos^2(pi * (i + 1) / 34). */
+static const float msbc_plc_rcos[MSBC_PLC_OLAL] = {
+	0.99148655f, 0.96623611f, 0.92510857f, 0.86950446f,
+	0.80131732f, 0.72286918f, 0.63683150f, 0.54613418f,
+	0.45386582f, 0.36316850f, 0.27713082f, 0.19868268f,
+	0.13049554f, 0.07489143f, 0.03376389f, 0.00851345f,
+};
+
+static int16_t msbc_plc_crop_sample(float value) {
+	return value > INT16_MAX ? INT16_MAX : value < INT16_MIN ? INT16_MIN : value;
+}
+
+/**
+ * Find the lag of the history pattern, which best matches the most recent
+ * part of the signal (normalized cross-correlation). */
+static unsigned int msbc_plc_pattern_match(const int16_t *y) {
+
+	float max_cn = -INFINITY;
+	unsigned int bestmatch = 0;
+	size_t n, i;
+
+	for (n = 0; n < MSBC_PLC_N; n++) {
+		float sumx = 0, energy = 0.000001f;
+		for (i = 0; i < MSBC_PLC_M; i++) {
+			sumx += (float)y[MSBC_PLC_LHIST - MSBC_PLC_M + i] * y[n + i];
+			energy += (float)y[n + i] * y[n + i];
+		}
+		const float cn = sumx / sqrtf(energy);
+		if (cn > max_cn) {
+			bestmatch = n;
+			max_cn = cn;
+		}
+	}
+
+	return bestmatch + MSBC_PLC_M;
+}
+
+/**
+ * Get the scaling factor for the matched pattern, so the amplitude of the
+ * synthesized signal will follow the most recent part of the signal. */
+static float msbc_plc_amplitude_match(const int16_t *y, unsigned int bestmatch) {
+
+	float sumx = 0, sumy = 0.000001f;
+	size_t i;
+
+	for (i = 0; i < MSBC_PLC_FS; i++) {
+		sumx += abs(y[MSBC_PLC_LHIST - MSBC_PLC_FS + i]);
+		sumy += abs(y[bestmatch + i]);
+	}
+
+	const float sf = sumx / sumy;
+	/* do not allow the signal to grow or fade too rapidly */
+	return sf < 0.75f ? 0.75f : sf > 1.2f ? 1.2f : sf;
+}
+
+/**
+ * Synthesize the lost frame from the signal history.
+ *
+ * @param msbc Pointer to the mSBC structure.
+ * @param zir Zero input response of the decoder, i.e. the signal decoded
+ *   from the frame with encoded silence.
+ * @param output Address where the synthesized frame will be stored. */
+static void msbc_plc_bad_frame(struct esco_msbc *msbc, const int16_t *zir, int16_t *output) {
+
+	int16_t *hist = msbc->plc.hist;
+	size_t i;
+
+	if (msbc->plc.nbf == 0) {
+		/* Find the best matching pattern and smoothly switch from the decoder
+		 * signal (ZIR) to the pattern, which will be used from now on. */
+		msbc->plc.bestlag = msbc_plc_pattern_match(hist);
+		const unsigned int lag = msbc->plc.bestlag;
+		const float sf = msbc_plc_amplitude_match(hist, lag);
+		for (i = 0; i < MSBC_PLC_OLAL; i++)
+			hist[MSBC_PLC_LHIST + i] = msbc_plc_crop_sample(zir[i] * msbc_plc_rcos[i] +
+					sf * hist[lag + i] * msbc_plc_rcos[MSBC_PLC_OLAL - 1 - i]);
+		for (; i < MSBC_PLC_FS + MSBC_PLC_SBCRT + MSBC_PLC_OLAL; i++)
+			hist[MSBC_PLC_LHIST + i] = msbc_plc_crop_sample(sf * hist[lag + i]);
+	}
+	else {
+		const unsigned int lag = msbc->plc.bestlag;
+		for (i = 0; i < MSBC_PLC_FS + MSBC_PLC_SBCRT + MSBC_PLC_OLAL; i++)
+			hist[MSBC_PLC_LHIST + i] = hist[lag + i];
+	}
+
+	memcpy(output, &hist[MSBC_PLC_LHIST], MSBC_PLC_FS * sizeof(*output));
+	memmove(hist, &hist[MSBC_PLC_FS],
+			(MSBC_PLC_LHIST + MSBC_PLC_SBCRT + MSBC_PLC_OLAL) * sizeof(*hist));
+
+	msbc->plc.nbf++;
+}
+
+/**
+ * Update the signal history with the correctly decoded frame.
+ *
+ * If the frame follows the lost one, its beginning (which is distorted
+ * because of the SBC reconstruction delay) is replaced with the signal
+ * synthesized by the PLC.
+ *
+ * @param msbc Pointer to the mSBC structure.
+ * @param buffer Address of the decoded frame. Upon exit, it will contain
+ *   the output signal. */
+static void msbc_plc_good_frame(struct esco_msbc *msbc, int16_t *buffer) {
+
+	int16_t *hist = msbc->plc.hist;
+	size_t i = 0;
+
+	if (msbc->plc.nbf > 0) {
+		for (; i < MSBC_PLC_SBCRT; i++)
+			buffer[i] = hist[MSBC_PLC_LHIST + i];
+		for (; i < MSBC_PLC_SBCRT + MSBC_PLC_OLAL; i++)
+			buffer[i] = msbc_plc_crop_sample(
+					hist[MSBC_PLC_LHIST + i] * msbc_plc_rcos[i - MSBC_PLC_SBCRT] +
+					buffer[i] * msbc_plc_rcos[MSBC_PLC_OLAL - 1 - i + MSBC_PLC_SBCRT]);
+	}
+
+	memcpy(&hist[MSBC_PLC_LHIST], buffer, MSBC_PLC_FS * sizeof(*hist));
+	memmove(hist, &hist[MSBC_PLC_FS], MSBC_PLC_LHIST * sizeof(*hist));
+
+	msbc->plc.nbf = 0;
+}
+
+/**
+ * Conceal single lost or corrupted mSBC frame.
+ *
+ * The decoder is fed with the encoded silence, so its internal state will
+ * be updated in the same way as if the frame was received. */
+static void msbc_conceal(struct esco_msbc *msbc, int16_t *output) {
+
+	int16_t zir[MSBC_CODESAMPLES] = { 0 };
+	sbc_decode(&msbc->sbc, msbc->plc.zero_frame, sizeof(msbc->plc.zero_frame),
+			zir, sizeof(zir), NULL);
+
+	msbc_plc_bad_frame(msbc, zir, output);
+	msbc->frames_concealed++;
+
+}
+
+/**
+ * Encode mSBC frame with silence. */
+static int msbc_encode_zero_frame(uint8_t *frame) {
+
+	const int16_t silence[MSBC_CODESAMPLES] = { 0 };
+	ssize_t len;
+	sbc_t sbc;
+
+	if ((errno = -sbc_init_msbc(&sbc, 0)) != 0)
+		return -1;
+
+	if ((len = sbc_encode(&sbc, silence, sizeof(silence),
+					frame, MSBC_FRAMELEN, NULL)) < 0)
+		errno = -len;
+
+	sbc_finish(&sbc);
+	return len < 0 ? -1 : 0;
+}
+
 int msbc_init(struct esco_msbc *msbc) {
 
 	int err;
@@ -66,9 +236,14 @@ int msbc_init(struct esco_msbc *msbc) {
 		debug("Initializing mSBC codec");
 		if ((errno = -sbc_init_msbc(&msbc->sbc, 0)) != 0)
 			goto fail;
-		if (ffb_init_uint8_t(&msbc->data, sizeof(esco_msbc_frame_t) * 3) == -1)
+		if (rb_init_uint8_t(&msbc->data, sizeof(esco_msbc_frame_t) * MSBC_DATA_FRAMES) == -1)
+			goto fail;
+		/* Make room for up to 3 concealed frames (maximal gap which can be
+		 * detected with 2-bit sequence numbers) and the decoded one. For
+		 * the encoder, the PCM buffer shall fill the whole data buffer. */
+		if (rb_init_int16_t(&msbc->pcm, MSBC_CODESAMPLES * MSBC_DATA_FRAMES) == -1)
 			goto fail;
-		if (ffb_init_int16_t(&msbc->pcm, MSBC_CODESAMPLES * 2) == -1)
+		if (msbc_encode_zero_frame(msbc->plc.zero_frame) == -1)
 			goto fail;
 	}
 
@@ -89,12 +264,17 @@ int msbc_init(struct esco_msbc *msbc) {
 	}
 #endif
 
-	ffb_rewind(&msbc->data);
-	ffb_rewind(&msbc->pcm);
+	rb_rewind(&msbc->data);
+	rb_rewind(&msbc->pcm);
 
 	msbc->seq_initialized = false;
 	msbc->seq_number = 0;
 	msbc->frames = 0;
+	msbc->frames_concealed = 0;
+
+	memset(msbc->plc.hist, 0, sizeof(msbc->plc.hist));
+	msbc->plc.bestlag = 0;
+	msbc->plc.nbf = 0;
 
 	msbc->initialized = true;
 	return 0;
@@ -113,8 +293,8 @@ void msbc_finish(struct esco_msbc *msbc) {
 
 	sbc_finish(&msbc->sbc);
 
-	ffb_free(&msbc->data);
-	ffb_free(&msbc->pcm);
+	rb_free(&msbc->data);
+	rb_free(&msbc->pcm);
 
 }
 
@@ -125,14 +305,15 @@ int msbc_decode(struct esco_msbc *msbc) {
 	if (!msbc->initialized)
 		return errno = EINVAL, -1;
 
-	const uint8_t *input = msbc->data.data;
-	size_t input_len = ffb_blen_out(&msbc->data);
-	int16_t *output = msbc->pcm.tail;
-	size_t output_len = ffb_blen_in(&msbc->pcm);
+	const uint8_t *input_head = rb_head(&msbc->data);
+	const uint8_t *input = input_head;
+	size_t input_len = rb_blen_out(&msbc->data);
+	int16_t *output = rb_tail(&msbc->pcm);
+	size_t output_len = rb_blen_in(&msbc->pcm);
 	int rv = 0;
 
 	const size_t tmp = input_len;
-	const esco_h2_header_t *_h2 = msbc_find_h2_header(input, &input_len);
+	const esco_h2_header_t *_h2 = esco_h2_find_header(input, &input_len);
 	const esco_msbc_frame_t *frame = (esco_msbc_frame_t *)_h2;
 	input += tmp - input_len;
 
@@ -143,67 +324,95 @@ int msbc_decode(struct esco_msbc *msbc) {
 		goto final;
 
 	const uint16_t h2 = le16toh(*_h2);
-	uint8_t _seq = (ESCO_H2_GET_SN1(h2) & 2) | (ESCO_H2_GET_SN0(h2) & 1);
+	uint8_t _seq = ESCO_H2_GET_SEQ(h2);
+	unsigned int missing = 0;
 	if (!msbc->seq_initialized) {
 		msbc->seq_initialized = true;
 		msbc->seq_number = _seq;
 	}
 	else if (_seq != ++msbc->seq_number) {
 		warn("Missing mSBC packet: %u != %u", _seq, msbc->seq_number);
+		missing = (_seq - msbc->seq_number) & 0x3;
 		msbc->seq_number = _seq;
-		/* TODO: Implement PLC. */
+	}
+
+	/* Conceal missing frames, but only as long as there is enough space
+	 * for the current frame in the output buffer. */
+	for (; missing > 0 && output_len >= MSBC_CODESIZE * 2; missing--) {
+		msbc_conceal(msbc, output);
+		rb_seek(&msbc->pcm, MSBC_CODESAMPLES);
+		output += MSBC_CODESAMPLES;
+		output_len -= MSBC_CODESIZE;
 	}
 
 	ssize_t len;
 	if ((len = sbc_decode(&msbc->sbc, frame->payload, sizeof(frame->payload),
-					output, output_len, NULL)) < 0) {
+					output, output_len, NULL)) >= 0)
+		msbc_plc_good_frame(msbc, output);
+	else if (frame->payload[0] == MSBC_SYNCWORD) {
+		/* The frame has been found, but it is corrupted, so replace
+		 * it with the concealed signal instead of dropping it. */
+		debug("Concealing corrupted mSBC frame: %s", strerror(-len));
+		msbc_conceal(msbc, output);
+	}
+	else {
+		/* The H2 header has been matched by accident. */
 		errno = -len, rv = -1;
 		input += 1;
 		goto final;
 	}
 
-	ffb_seek(&msbc->pcm, MSBC_CODESAMPLES);
+	rb_seek(&msbc->pcm, MSBC_CODESAMPLES);
 	input += sizeof(*frame);
 	rv = 1;
 
 final:
-	/* Reshuffle remaining data to the beginning of the buffer. */
-	ffb_shift(&msbc->data, input - (uint8_t *)msbc->data.data);
+	/* Consume scanned and decoded data. */
+	rb_shift(&msbc->data, input - input_head);
 	return rv;
 }
 
 /**
- * Encode single eSCO mSBC frame. */
+ * Encode eSCO mSBC frames.
+ *
+ * This function encodes as many frames as possible, i.e. until there is
+ * not enough PCM samples or there is no space left in the data buffer.
+ *
+ * @return This function returns 1 if at least one frame has been encoded,
+ *   or 0 otherwise. On error, -1 is returned and errno is set to indicate
+ *   the error. */
 int msbc_encode(struct esco_msbc *msbc) {
 
 	if (!msbc->initialized)
 		return errno = EINVAL, -1;
 
-	const int16_t *input = msbc->pcm.data;
-	const size_t input_len = ffb_blen_out(&msbc->pcm);
-	esco_msbc_frame_t *frame = (esco_msbc_frame_t *)msbc->data.tail;
-	size_t output_len = ffb_blen_in(&msbc->data);
+	int rv = 0;
 
 	/* Skip encoding if there is not enough PCM samples or the output
 	 * buffer is not big enough to hold whole eSCO mSBC frame.*/
-	if (input_len < MSBC_CODESIZE ||
-			output_len < sizeof(*frame))
-		return 0;
+	while (rb_blen_out(&msbc->pcm) >= MSBC_CODESIZE &&
+			rb_blen_in(&msbc->data) >= sizeof(esco_msbc_frame_t)) {
 
-	ssize_t len;
-	if ((len = sbc_encode(&msbc->sbc, input, input_len,
-					frame->payload, sizeof(frame->payload), NULL)) < 0)
-		return errno = -len, -1;
+		const int16_t *input = rb_head(&msbc->pcm);
+		esco_msbc_frame_t *frame = (esco_msbc_frame_t *)rb_tail(&msbc->data);
 
-	const uint8_t n = msbc->seq_number++;
-	frame->header = htole16(ESCO_H2_PACK(sn[n][0], sn[n][1]));
-	frame->padding = 0;
+		ssize_t len;
+		if ((len = sbc_encode(&msbc->sbc, input, MSBC_CODESIZE,
+						frame->payload, sizeof(frame->payload), NULL)) < 0)
+			return errno = -len, -1;
 
-	ffb_seek(&msbc->data, sizeof(*frame));
-	msbc->frames++;
+		const uint8_t seq = msbc->seq_number++;
+		frame->header = htole16(ESCO_H2_PACK_SEQ(seq));
+		frame->padding = 0;
 
-	/* Reshuffle remaining PCM data to the beginning of the buffer. */
-	ffb_shift(&msbc->pcm, input + MSBC_CODESAMPLES - (int16_t *)msbc->pcm.data);
+		rb_seek(&msbc->data, sizeof(*frame));
+		msbc->frames++;
 
-	return 1;
+		/* Consume encoded PCM samples. */
+		rb_shift(&msbc->pcm, MSBC_CODESAMPLES);
+		rv = 1;
+
+	}
+
+	return rv;
 }
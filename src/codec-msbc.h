@@ -21,13 +21,23 @@
 
 #include <sbc/sbc.h>
 
-#include "shared/ffb.h"
+#include "shared/rb.h"
 
 /* HFP uses SBC encoding with precisely defined parameters. Hence, the size
  * of the input (number of PCM samples) and output is known up front. */
 #define MSBC_CODESIZE    240
 #define MSBC_CODESAMPLES (MSBC_CODESIZE / sizeof(int16_t))
 #define MSBC_FRAMELEN    57
+#define MSBC_SYNCWORD    0xAD
+
+/* The number of eSCO mSBC frames which can be queued in the data buffer,
+ * so the encoded signal can be sliced into many small MTU-sized packets
+ * without any copying. With the smallest eSCO MTU (24 bytes), it is good
+ * for the whole BT write batch. The PCM buffer has the same capacity, so
+ * this value shall not be less than 4 - required by the PLC. Please note,
+ * that it is the capacity only, the encoder thread does not read more PCM
+ * signal than it is required for the next BT packet. */
+#define MSBC_DATA_FRAMES 8
 
 #define ESCO_H2_SYNCWORD 0x801
 #define ESCO_H2_GET_SYNCWORD(h2) ((h2) & 0xFFF)
@@ -37,6 +47,18 @@
  * duplicated) into the 16-bit eSCO H2 header. Note, that after packing,
  * the H2 header value has to be converted to little-endian. */
 #define ESCO_H2_PACK(sn0, sn1) (ESCO_H2_SYNCWORD | (sn0) << 12 | (sn1) << 14)
+/* Pack/unpack 2-bit frame sequence number into/from the eSCO H2 header. */
+#define ESCO_H2_PACK_SEQ(seq) ESCO_H2_PACK(((seq) & 1) * 3, (((seq) >> 1) & 1) * 3)
+#define ESCO_H2_GET_SEQ(h2) ((ESCO_H2_GET_SN1(h2) & 2) | (ESCO_H2_GET_SN0(h2) & 1))
+
+/* Packet loss concealment parameters, see HFP specification, Appendix
+ * A: "Informative Example of Packet Loss Concealment" for details. */
+#define MSBC_PLC_FS    MSBC_CODESAMPLES
+#define MSBC_PLC_N     256
+#define MSBC_PLC_M     64
+#define MSBC_PLC_LHIST (MSBC_PLC_N + MSBC_PLC_FS - 1)
+#define MSBC_PLC_SBCRT 36
+#define MSBC_PLC_OLAL  16
 
 typedef uint16_t esco_h2_header_t;
 typedef struct esco_msbc_frame {
@@ -51,14 +73,28 @@ struct esco_msbc {
 	sbc_t sbc;
 
 	/* buffer for eSCO frames */
-	ffb_t data;
+	rb_t data;
 	/* buffer for PCM samples */
-	ffb_t pcm;
+	rb_t pcm;
 
 	uint8_t seq_initialized : 1;
 	uint8_t seq_number : 2;
 	/* number of processed frames */
 	size_t frames;
+	/* number of concealed frames */
+	size_t frames_concealed;
+
+	/* packet loss concealment */
+	struct {
+		/* history of the decoded signal */
+		int16_t hist[MSBC_PLC_LHIST + MSBC_PLC_FS + MSBC_PLC_SBCRT + MSBC_PLC_OLAL];
+		/* the lag of the best matching pattern */
+		unsigned int bestlag;
+		/* number of consecutive bad frames */
+		unsigned int nbf;
+		/* mSBC frame with encoded silence */
+		uint8_t zero_frame[MSBC_FRAMELEN];
+	} plc;
 
 	/* Determine whether structure has been initialized. This field is
 	 * used for reinitialization - it makes msbc_init() idempotent. */
@@ -66,6 +102,8 @@ struct esco_msbc {
 
 };
 
+esco_h2_header_t *esco_h2_find_header(const void *data, size_t *len);
+
 int msbc_init(struct esco_msbc *msbc);
 void msbc_finish(struct esco_msbc *msbc);
 
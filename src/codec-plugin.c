@@ -0,0 +1,199 @@
+/*
+ * BlueALSA - codec-plugin.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "codec-plugin.h"
+
+#include <ctype.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "shared/defs.h"
+#include "shared/log.h"
+
+static struct codec_plugin codec_plugins[CODEC_PLUGINS_MAX];
+static size_t codec_plugins_len = 0;
+
+/**
+ * Check whether the plug-in name can be used in the D-Bus object path. */
+static bool codec_plugin_is_valid_name(const char *name) {
+
+	if (name == NULL || *name == '\0' || strlen(name) > 32)
+		return false;
+
+	for (; *name != '\0'; name++)
+		if (!isalnum((unsigned char)*name) && *name != '_')
+			return false;
+
+	return true;
+}
+
+/**
+ * Validate descriptor provided by the plug-in. */
+static int codec_plugin_validate(const struct ba_a2dp_plugin *abi) {
+
+	if (abi->abi_version != BA_A2DP_PLUGIN_ABI_VERSION) {
+		error("Unsupported codec plug-in ABI version: %u != %u",
+				abi->abi_version, BA_A2DP_PLUGIN_ABI_VERSION);
+		return errno = ENOTSUP, -1;
+	}
+
+	if (!codec_plugin_is_valid_name(abi->name)) {
+		error("Invalid codec plug-in name: %s", abi->name);
+		return errno = EINVAL, -1;
+	}
+
+	if (abi->capabilities == NULL ||
+			abi->capabilities_size < sizeof(a2dp_vendor_codec_t) ||
+			abi->capabilities_size > BA_A2DP_PLUGIN_CAPABILITIES_MAX) {
+		error("Invalid codec plug-in capabilities: %s", abi->name);
+		return errno = EINVAL, -1;
+	}
+
+	if (abi->select_configuration == NULL ||
+			abi->get_stream == NULL ||
+			abi->init == NULL ||
+			abi->destroy == NULL ||
+			(abi->encode == NULL && abi->decode == NULL)) {
+		error("Incomplete codec plug-in interface: %s", abi->name);
+		return errno = EINVAL, -1;
+	}
+
+	const a2dp_vendor_codec_t *vendor = abi->capabilities;
+	if (codec_plugin_lookup_name(abi->name) != NULL ||
+			codec_plugin_lookup_vendor(A2DP_GET_VENDOR_ID(*vendor),
+				A2DP_GET_CODEC_ID(*vendor)) != NULL) {
+		error("Codec plug-in already loaded: %s", abi->name);
+		return errno = EEXIST, -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Load A2DP codec plug-in.
+ *
+ * This function shall be called before the initialization of the A2DP
+ * codecs, i.e. before the a2dp_codecs_init() call.
+ *
+ * @param path The path to the plug-in shared object.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int codec_plugin_load(const char *path) {
+
+	if (codec_plugins_len >= CODEC_PLUGINS_MAX)
+		return errno = ENOSPC, -1;
+
+	void *dl;
+	if ((dl = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+		error("Couldn't load codec plug-in: %s", dlerror());
+		return errno = ENOENT, -1;
+	}
+
+	ba_a2dp_plugin_entry_t *entry;
+	const struct ba_a2dp_plugin *abi;
+	if ((entry = (ba_a2dp_plugin_entry_t *)dlsym(dl, BA_A2DP_PLUGIN_ENTRY)) == NULL) {
+		error("Couldn't get codec plug-in entry point: %s", dlerror());
+		errno = EINVAL;
+		goto fail;
+	}
+
+	if ((abi = entry()) == NULL) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	if (codec_plugin_validate(abi) == -1)
+		goto fail;
+
+	struct codec_plugin *p = &codec_plugins[codec_plugins_len];
+	const uint16_t codec_id = CODEC_PLUGIN_CODEC_ID(codec_plugins_len);
+
+	memset(p, 0, sizeof(*p));
+	p->dl = dl;
+	p->abi = abi;
+	p->codec_id = codec_id;
+
+	const enum a2dp_dir dirs[] = { A2DP_SOURCE, A2DP_SINK };
+	size_t i;
+
+	for (i = 0; i < ARRAYSIZE(dirs); i++) {
+		const enum a2dp_dir dir = dirs[i];
+		p->codecs[dir].dir = dir;
+		p->codecs[dir].codec_id = codec_id;
+		p->codecs[dir].capabilities = abi->capabilities;
+		p->codecs[dir].capabilities_size = abi->capabilities_size;
+		snprintf(p->bluez_dbus_path[dir], sizeof(p->bluez_dbus_path[dir]), "/A2DP/%s/%s",
+				abi->name, dir == A2DP_SOURCE ? "Source" : "Sink");
+	}
+
+	p->supported[A2DP_SOURCE] = abi->encode != NULL;
+	p->supported[A2DP_SINK] = abi->decode != NULL;
+
+	debug("Loaded codec plug-in: %s [%#x]: %s", abi->name, codec_id, path);
+
+	codec_plugins_len++;
+	return 0;
+
+fail: {
+		const int err = errno;
+		dlclose(dl);
+		errno = err;
+	}
+	return -1;
+}
+
+/**
+ * Get loaded codec plug-in.
+ *
+ * @param index The index of the plug-in in the load order.
+ * @return This function returns the address of the plug-in structure or
+ *   NULL if there is no plug-in with given index. */
+const struct codec_plugin *codec_plugin_get(size_t index) {
+	if (index >= codec_plugins_len)
+		return NULL;
+	return &codec_plugins[index];
+}
+
+/**
+ * Lookup codec plug-in by the BlueALSA A2DP codec ID. */
+const struct codec_plugin *codec_plugin_lookup(uint16_t codec_id) {
+	size_t i;
+	for (i = 0; i < codec_plugins_len; i++)
+		if (codec_plugins[i].codec_id == codec_id)
+			return &codec_plugins[i];
+	return NULL;
+}
+
+/**
+ * Lookup codec plug-in by the codec name. */
+const struct codec_plugin *codec_plugin_lookup_name(const char *name) {
+	size_t i;
+	for (i = 0; i < codec_plugins_len; i++)
+		if (strcmp(codec_plugins[i].abi->name, name) == 0)
+			return &codec_plugins[i];
+	return NULL;
+}
+
+/**
+ * Lookup codec plug-in by the A2DP vendor ID and vendor codec ID. */
+const struct codec_plugin *codec_plugin_lookup_vendor(
+		uint32_t vendor_id,
+		uint16_t codec_id) {
+	size_t i;
+	for (i = 0; i < codec_plugins_len; i++) {
+		const a2dp_vendor_codec_t *vendor = codec_plugins[i].abi->capabilities;
+		if (A2DP_GET_VENDOR_ID(*vendor) == vendor_id &&
+				A2DP_GET_CODEC_ID(*vendor) == codec_id)
+			return &codec_plugins[i];
+	}
+	return NULL;
+}
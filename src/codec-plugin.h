@@ -0,0 +1,60 @@
+/*
+ * BlueALSA - codec-plugin.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_CODECPLUGIN_H_
+#define BLUEALSA_CODECPLUGIN_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "a2dp.h"
+#include "a2dp-codecs.h"
+#include "a2dp-plugin-abi.h"
+
+/**
+ * The maximal number of loaded codec plug-ins. */
+#define CODEC_PLUGINS_MAX 16
+
+/**
+ * BlueALSA A2DP 16-bit codec ID assigned to the n-th loaded plug-in. These
+ * IDs do not collide with the IDs of the built-in vendor codecs. */
+#define CODEC_PLUGIN_CODEC_ID(n) ((uint16_t)(((0xE0 + (n)) << 8) | A2DP_CODEC_VENDOR))
+
+/**
+ * Loaded A2DP codec plug-in. */
+struct codec_plugin {
+	/* shared object handle */
+	void *dl;
+	/* descriptor provided by the plug-in */
+	const struct ba_a2dp_plugin *abi;
+	/* dynamically assigned BlueALSA A2DP codec ID */
+	uint16_t codec_id;
+	/* A2DP codec setups indexed by the stream direction */
+	struct a2dp_codec codecs[2];
+	bool supported[2];
+	/* stream end-point paths indexed by the stream direction */
+	char bluez_dbus_path[2][64];
+};
+
+int codec_plugin_load(const char *path);
+
+const struct codec_plugin *codec_plugin_get(size_t index);
+const struct codec_plugin *codec_plugin_lookup(uint16_t codec_id);
+const struct codec_plugin *codec_plugin_lookup_name(const char *name);
+const struct codec_plugin *codec_plugin_lookup_vendor(
+		uint32_t vendor_id,
+		uint16_t codec_id);
+
+#endif
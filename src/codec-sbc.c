@@ -105,6 +105,61 @@ uint8_t sbc_a2dp_get_bitpool(const a2dp_sbc_t *conf, unsigned int quality) {
 	return MIN(MAX(conf->min_bitpool, bitpool), conf->max_bitpool);
 }
 
+/**
+ * Encode multiple SBC frames with a single call.
+ *
+ * This function encodes as many SBC frames as possible, limited by the
+ * amount of input data, the space in the output buffer and the maximal
+ * number of frames. The code size and the frame length are obtained once
+ * per call, so the per-frame overhead is limited to the encoding itself.
+ *
+ * @param sbc Initialized SBC encoder.
+ * @param input Address of the PCM data to encode.
+ * @param input_len The length of the PCM data in bytes.
+ * @param output Address of the output buffer.
+ * @param output_len The size of the output buffer in bytes.
+ * @param written Address where the number of bytes written to the output
+ *   buffer will be stored.
+ * @param frames On input, the maximal number of SBC frames to encode. On
+ *   output, the number of encoded frames.
+ * @return On success this function returns the number of consumed input
+ *   bytes. If an error has occurred before encoding the first frame, the
+ *   negative error code returned by the sbc_encode() is returned. */
+ssize_t sbc_encode_frames(sbc_t *sbc, const void *input, size_t input_len,
+		void *output, size_t output_len, size_t *written, size_t *frames) {
+
+	const size_t codesize = sbc_get_codesize(sbc);
+	const size_t frame_len = sbc_get_frame_length(sbc);
+	const uint8_t *in = input;
+	uint8_t *out = output;
+	size_t encoded_frames = 0;
+
+	while (encoded_frames < *frames &&
+			input_len >= codesize &&
+			output_len >= frame_len) {
+
+		ssize_t len;
+		ssize_t encoded;
+
+		if ((len = sbc_encode(sbc, in, codesize, out, output_len, &encoded)) < 0) {
+			if (encoded_frames == 0)
+				return len;
+			break;
+		}
+
+		in += len;
+		input_len -= len;
+		out += encoded;
+		output_len -= encoded;
+		encoded_frames++;
+
+	}
+
+	*written = out - (uint8_t *)output;
+	*frames = encoded_frames;
+	return in - (const uint8_t *)input;
+}
+
 #if ENABLE_FASTSTREAM
 /**
  * Initialize SBC audio codec for A2DP FastStream connection.
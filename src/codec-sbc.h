@@ -19,6 +19,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
 
 #include <sbc/sbc.h>
 
@@ -31,6 +32,9 @@
 
 uint8_t sbc_a2dp_get_bitpool(const a2dp_sbc_t *conf, unsigned int quality);
 
+ssize_t sbc_encode_frames(sbc_t *sbc, const void *input, size_t input_len,
+		void *output, size_t output_len, size_t *written, size_t *frames);
+
 #if ENABLE_FASTSTREAM
 int sbc_init_a2dp_faststream(sbc_t *sbc, unsigned long flags,
 		const void *conf, size_t size, bool voice);
@@ -13,6 +13,7 @@
 #include <errno.h>
 #include <poll.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <unistd.h>
@@ -47,6 +48,48 @@ int hci_get_version(int dev_id, struct hci_version *ver) {
 	return 0;
 }
 
+/**
+ * Read RSSI of the ACL connection with the given device.
+ *
+ * The value is reported by the controller as a difference (in dB) between
+ * the received signal strength and the Golden Receive Power Range, so 0 means
+ * that the signal is within the range and negative values mean that the
+ * signal is too weak.
+ *
+ * @param dev_id The ID of the HCI device.
+ * @param ba Pointer to the Bluetooth address of the remote device.
+ * @param rssi Address where the RSSI value will be stored.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int hci_read_conn_rssi(int dev_id, const bdaddr_t *ba, int8_t *rssi) {
+
+	uint8_t buffer[sizeof(struct hci_conn_info_req) + sizeof(struct hci_conn_info)];
+	struct hci_conn_info_req *cr = (struct hci_conn_info_req *)buffer;
+	int dd, err;
+
+	if ((dd = hci_open_dev(dev_id)) == -1)
+		return -1;
+
+	bacpy(&cr->bdaddr, ba);
+	cr->type = ACL_LINK;
+	if (ioctl(dd, HCIGETCONNINFO, cr) == -1)
+		goto fail;
+
+	/* This function is called from the main loop, so make sure that
+	 * an unresponsive controller will not block it for too long. */
+	if (hci_read_rssi(dd, htobs(cr->conn_info->handle), rssi, 100) == -1)
+		goto fail;
+
+	hci_close_dev(dd);
+	return 0;
+
+fail:
+	err = errno;
+	hci_close_dev(dd);
+	errno = err;
+	return -1;
+}
+
 /**
  * Open SCO socket for given HCI device.
  *
@@ -77,19 +120,13 @@ fail:
 }
 
 /**
- * Connect SCO socket with given BT device.
+ * Setup SCO socket for outgoing connection.
  *
  * @param sco_fd File descriptor of opened SCO socket.
- * @param ba Pointer to the Bluetooth address structure for a target device.
  * @param voice Bluetooth voice mode used during connection.
  * @return On success this function returns 0. Otherwise, -1 is returned and
  *   errno is set to indicate the error. */
-int hci_sco_connect(int sco_fd, const bdaddr_t *ba, uint16_t voice) {
-
-	struct sockaddr_sco addr_dev = {
-		.sco_family = AF_BLUETOOTH,
-		.sco_bdaddr = *ba,
-	};
+int hci_sco_setup(int sco_fd, uint16_t voice) {
 
 	struct bt_voice opt = { .setting = voice };
 	if (setsockopt(sco_fd, SOL_BLUETOOTH, BT_VOICE, &opt, sizeof(opt)) == -1)
@@ -99,6 +136,25 @@ int hci_sco_connect(int sco_fd, const bdaddr_t *ba, uint16_t voice) {
 	if (setsockopt(sco_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == -1)
 		warn("Couldn't set SCO connection timeout: %s", strerror(errno));
 
+	return 0;
+}
+
+/**
+ * Connect SCO socket with given BT device.
+ *
+ * The socket shall be configured with the hci_sco_setup() beforehand.
+ *
+ * @param sco_fd File descriptor of opened SCO socket.
+ * @param ba Pointer to the Bluetooth address structure for a target device.
+ * @return On success this function returns 0. Otherwise, -1 is returned and
+ *   errno is set to indicate the error. */
+int hci_sco_connect(int sco_fd, const bdaddr_t *ba) {
+
+	struct sockaddr_sco addr_dev = {
+		.sco_family = AF_BLUETOOTH,
+		.sco_bdaddr = *ba,
+	};
+
 	if (connect(sco_fd, (struct sockaddr *)&addr_dev, sizeof(addr_dev)) == -1)
 		return -1;
 
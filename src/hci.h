@@ -35,6 +35,7 @@
 #define BT_COMPID_SAVITECH           0x053A
 
 int hci_get_version(int dev_id, struct hci_version *ver);
+int hci_read_conn_rssi(int dev_id, const bdaddr_t *ba, int8_t *rssi);
 
 /**
  * SCO close-connect quirk delay (milliseconds).
@@ -47,7 +48,8 @@ int hci_get_version(int dev_id, struct hci_version *ver);
 #define HCI_SCO_CLOSE_CONNECT_QUIRK_DELAY 300
 
 int hci_sco_open(int dev_id);
-int hci_sco_connect(int sco_fd, const bdaddr_t *ba, uint16_t voice);
+int hci_sco_setup(int sco_fd, uint16_t voice);
+int hci_sco_connect(int sco_fd, const bdaddr_t *ba);
 unsigned int hci_sco_get_mtu(int sco_fd);
 
 #define BT_BCM_PARAM_ROUTING_PCM       0x0
@@ -16,6 +16,7 @@
 #define HFP_CODEC_UNDEFINED 0x00
 #define HFP_CODEC_CVSD      0x01
 #define HFP_CODEC_MSBC      0x02
+#define HFP_CODEC_LC3_SWB   0x03
 
 /* SDP AG feature flags */
 #define SDP_HFP_AG_FEAT_TWC    (1 << 0)
@@ -14,32 +14,147 @@
 #include <fcntl.h>
 #include <poll.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
+#include <bsd/sys/time.h>
 #include <glib.h>
 
 #include "audio.h"
+#include "bluealsa-dbus.h"
 #include "bluealsa.h"
+#include "sched-policy.h"
+#include "trace.h"
 #include "shared/defs.h"
 #include "shared/log.h"
 
 /**
- * Read data from the BT transport (SCO or SEQPACKET) socket. */
-ssize_t io_bt_read(
+ * Store BT packet in the capture file of the transport thread.
+ *
+ * In case of a capture write error (e.g. no space left on the device) the
+ * capture is stopped, but the transfer itself is not affected. */
+static void io_bt_capture(
 		struct ba_transport_thread *th,
+		enum bt_capture_direction dir,
+		const struct iovec *iov,
+		size_t iovcnt,
+		size_t len) {
+
+	if (!bt_capture_is_open(&th->capture))
+		return;
+
+	if (bt_capture_write(&th->capture, dir, iov, iovcnt, len) == -1) {
+		error("Couldn't write BT capture: %s", strerror(errno));
+		bt_capture_close(&th->capture);
+	}
+
+}
+
+/**
+ * Parse control messages of the packet received from the BT socket.
+ *
+ * @param msg The message header filled by the recvmsg().
+ * @param drops Address where the kernel receive queue drop counter will be
+ *   stored. It is updated only if the counter has been reported.
+ * @param ts Address where the packet arrival time will be stored. If the
+ *   kernel time-stamp is not available, the current time is used. */
+static void io_bt_recv_cmsg(
+		const struct msghdr *msg,
+		uint32_t *drops,
+		struct timespec *ts) {
+
+	struct timespec ts_real = { 0 };
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+			cmsg = CMSG_NXTHDR((struct msghdr *)msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET)
+			continue;
+		if (cmsg->cmsg_type == SO_RXQ_OVFL)
+			memcpy(drops, CMSG_DATA(cmsg), sizeof(*drops));
+		else if (cmsg->cmsg_type == SCM_TIMESTAMPNS)
+			memcpy(&ts_real, CMSG_DATA(cmsg), sizeof(ts_real));
+	}
+
+	gettimestamp(ts);
+
+	if (ts_real.tv_sec != 0) {
+		/* Kernel time-stamp is taken from the real time clock, so it has to
+		 * be moved to the clock used for the transfer synchronization. */
+		struct timespec now_real, offset, arrival;
+		clock_gettime(CLOCK_REALTIME, &now_real);
+		timespecsub(&now_real, ts, &offset);
+		timespecsub(&ts_real, &offset, &arrival);
+		/* guard against the real time clock adjustments */
+		if (timespeccmp(&arrival, ts, <))
+			*ts = arrival;
+	}
+
+}
+
+/**
+ * Receive single packet from the BT socket.
+ *
+ * @param fd BT socket file descriptor.
+ * @param buffer Address of the buffer for the packet data.
+ * @param count The size of the buffer.
+ * @param drops Address where the kernel receive queue drop counter will be
+ *   stored. It is updated only if the counter has been reported.
+ * @param ts Address where the packet arrival time will be stored. If the
+ *   kernel time-stamp is not available, the current time is used.
+ * @return This function returns the value returned by the recvmsg(). */
+static ssize_t io_bt_recv(
+		int fd,
 		void *buffer,
-		size_t count) {
+		size_t count,
+		uint32_t *drops,
+		struct timespec *ts) {
 
-	const int fd = th->bt_fd;
-	ssize_t ret;
+	union {
+		char buf[CMSG_SPACE(sizeof(uint32_t)) +
+			CMSG_SPACE(sizeof(struct timespec))];
+		struct cmsghdr align;
+	} control;
 
-	if (fd == -1)
-		return errno = EBADFD, -1;
+	struct iovec iov = { buffer, count };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf) };
+	ssize_t ret;
 
-	while ((ret = read(fd, buffer, count)) == -1 &&
+	while ((ret = recvmsg(fd, &msg, 0)) == -1 &&
 			errno == EINTR)
 		continue;
+
+	if (ret > 0)
+		io_bt_recv_cmsg(&msg, drops, ts);
+
+	return ret;
+}
+
+/**
+ * Account BT read result in the transport thread.
+ *
+ * This function shall be called in the IO thread context, even if the data
+ * has been read by the BT reader thread.
+ *
+ * @param drops The value of the kernel receive queue drop counter.
+ * @param ts The arrival time of the packet. */
+static ssize_t io_bt_read_complete(
+		struct ba_transport_thread *th,
+		void *buffer,
+		ssize_t ret,
+		uint32_t drops,
+		const struct timespec *ts) {
+
 	if (ret == -1 && (
 				errno == ECONNABORTED ||
 				errno == ECONNRESET ||
@@ -50,10 +165,101 @@ ssize_t io_bt_read(
 
 	if (ret == 0)
 		ba_transport_thread_bt_release(th);
+	else if (ret > 0) {
+		ba_transport_thread_stats_add(th, rx_packets, 1);
+		ba_transport_thread_stats_add(th, rx_bytes, ret);
+		if (drops != th->bt_rxq_drops) {
+			/* the counter is cumulative for the whole socket life time */
+			ba_transport_thread_stats_add(th, rx_overflows, drops - th->bt_rxq_drops);
+			th->bt_rxq_drops = drops;
+		}
+		th->bt_rx_ts = *ts;
+		trace_probe2(bt_read, th, ret);
+		const struct iovec iov = { buffer, ret };
+		io_bt_capture(th, BT_CAPTURE_DIRECTION_RX, &iov, 1, ret);
+	}
 
 	return ret;
 }
 
+/**
+ * Read data from the BT transport (SCO or SEQPACKET) socket. */
+ssize_t io_bt_read(
+		struct ba_transport_thread *th,
+		void *buffer,
+		size_t count) {
+
+	const int fd = th->bt_fd;
+	uint32_t drops = th->bt_rxq_drops;
+	struct timespec ts;
+	ssize_t ret;
+
+	if (fd == -1)
+		return errno = EBADFD, -1;
+
+	ret = io_bt_recv(fd, buffer, count, &drops, &ts);
+	return io_bt_read_complete(th, buffer, ret, drops, &ts);
+}
+
+/**
+ * Write packets to the BT sockets of the A2DP broadcast group members.
+ *
+ * Every member link is paced on its own - writes are non-blocking, so the
+ * congested link drops packets instead of stalling the whole group.
+ *
+ * @param th Transport thread of the group leader.
+ * @param msgs Packets already written to the leader BT socket.
+ * @param count The number of packets. */
+static void io_bt_write_group(
+		struct ba_transport_thread *th,
+		struct mmsghdr *msgs,
+		size_t count) {
+
+	struct ba_transport *t = th->t;
+	if (t->type.profile != BA_TRANSPORT_PROFILE_A2DP_SOURCE ||
+			th != &t->thread_enc)
+		return;
+
+	struct ba_transport_group *g = &t->a2dp.group;
+	pthread_mutex_lock(&g->mutex);
+
+	for (size_t i = 0; i < g->members_len; i++) {
+
+		struct ba_transport_thread *m_th = &g->members[i].t->thread_enc;
+		int ret;
+
+		if (g->members[i].bt_fd == -1)
+			continue;
+
+		while ((ret = sendmmsg(g->members[i].bt_fd, msgs, count, MSG_DONTWAIT)) == -1 &&
+				errno == EINTR)
+			continue;
+
+		if (ret == -1)
+			switch (errno) {
+			case ECONNABORTED:
+			case ECONNRESET:
+			case ENOTCONN:
+			case ETIMEDOUT:
+				error("BT socket disconnected: %s", strerror(errno));
+				close(g->members[i].bt_fd);
+				g->members[i].bt_fd = -1;
+				continue;
+			default:
+				/* EAGAIN or too small MTU of the member link */
+				ret = 0;
+			}
+
+		if ((size_t)ret < count)
+			ba_transport_thread_stats_add(m_th, congestion_drops, count - ret);
+		ba_transport_thread_stats_add(m_th, tx_packets, ret);
+
+	}
+
+	pthread_mutex_unlock(&g->mutex);
+
+}
+
 /**
  * Write data to the BT transport (SCO or SEQPACKET) socket.
  *
@@ -67,6 +273,9 @@ ssize_t io_bt_write(
 	ssize_t ret;
 	int fd;
 
+	if (th->bt_fd != -1)
+		ba_transport_thread_bt_coutq_sample(th);
+
 retry:
 
 	if ((fd = th->bt_fd) == -1)
@@ -77,6 +286,7 @@ retry:
 		case EINTR:
 			goto retry;
 		case EAGAIN:
+			th->bt_coutq.blocked = true;
 			/* In order to provide a way of escaping from the infinite poll()
 			 * we have to temporally re-enable thread cancellation. */
 			pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
@@ -94,244 +304,2256 @@ retry:
 
 	if (ret == 0)
 		ba_transport_thread_bt_release(th);
+	else if (ret > 0) {
+		ba_transport_thread_bt_coutq_update(th);
+		ba_transport_thread_stats_add(th, tx_packets, 1);
+		ba_transport_thread_stats_add(th, tx_bytes, ret);
+		trace_probe2(bt_write, th, ret);
+		struct iovec iov = { (void *)buffer, ret };
+		struct mmsghdr msg = { .msg_hdr = { .msg_iov = &iov, .msg_iovlen = 1 } };
+		io_bt_capture(th, BT_CAPTURE_DIRECTION_TX, &iov, 1, ret);
+		io_bt_write_group(th, &msg, 1);
+	}
 
 	return ret;
 }
 
 /**
- * Scale PCM signal according to the volume configuration. */
-void io_pcm_scale(
-		const struct ba_transport_pcm *pcm,
-		void *buffer,
-		size_t samples) {
+ * Queue packet in the BT write batch.
+ *
+ * The caller shall make sure that the batch is not full.
+ *
+ * @param batch Pointer to the BT write batch structure.
+ * @param header Address of the packet header or NULL.
+ * @param header_len The length of the packet header.
+ * @param payload Address of the packet payload.
+ * @param payload_len The length of the packet payload. */
+void io_bt_batch_add(
+		struct io_bt_batch *batch,
+		const void *header,
+		size_t header_len,
+		const void *payload,
+		size_t payload_len) {
 
-	const unsigned int channels = pcm->channels;
-	size_t frames = samples / channels;
+	g_assert_cmpuint(batch->len, <, IO_BT_BATCH_SIZE);
 
-	if (!pcm->soft_volume) {
-		/* In case of hardware volume control we will perform mute operation,
-		 * because hardware muting is an equivalent of gain=0 which with some
-		 * headsets does not entirely silence audio. */
-		switch (pcm->format) {
-		case BA_TRANSPORT_PCM_FORMAT_S16_2LE:
-			audio_silence_s16_2le(buffer, channels, frames,
-					pcm->volume[0].muted, pcm->volume[1].muted);
-			break;
-		case BA_TRANSPORT_PCM_FORMAT_S24_4LE:
-		case BA_TRANSPORT_PCM_FORMAT_S32_4LE:
-			audio_silence_s32_4le(buffer, channels, frames,
-					pcm->volume[0].muted, pcm->volume[1].muted);
-			break;
-		default:
-			g_assert_not_reached();
-		}
-		return;
-	}
+	struct iovec *iov = batch->iov[batch->len];
+	struct msghdr *msg = &batch->msgs[batch->len].msg_hdr;
+	size_t iovlen = 0;
 
-	switch (pcm->format) {
-	case BA_TRANSPORT_PCM_FORMAT_S16_2LE:
-		audio_scale_s16_2le(buffer, channels, frames,
-				pcm->volume[0].scale, pcm->volume[1].scale);
-		break;
-	case BA_TRANSPORT_PCM_FORMAT_S24_4LE:
-	case BA_TRANSPORT_PCM_FORMAT_S32_4LE:
-		audio_scale_s32_4le(buffer, channels, frames,
-				pcm->volume[0].scale, pcm->volume[1].scale);
-		break;
-	default:
-		g_assert_not_reached();
+	if (header_len > 0) {
+		iov[iovlen].iov_base = (void *)header;
+		iov[iovlen++].iov_len = header_len;
 	}
 
-}
-
-/**
- * Flush read buffer of the transport PCM FIFO. */
-ssize_t io_pcm_flush(struct ba_transport_pcm *pcm) {
-	ssize_t rv = splice(pcm->fd, NULL, config.null_fd, NULL, 1024 * 32, SPLICE_F_NONBLOCK);
-	if (rv > 0)
-		rv /= BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->format);
-	else if (rv == -1 && errno == EAGAIN)
-		rv = 0;
-	return rv;
-}
-
-/**
- * Read PCM signal from the transport PCM FIFO. */
-ssize_t io_pcm_read(
-		struct ba_transport_pcm *pcm,
-		void *buffer,
-		size_t samples) {
-
-	pthread_mutex_lock(&pcm->mutex);
-
-	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->format);
-	const int fd = pcm->fd;
-	ssize_t ret = -1;
-
-	if (fd == -1)
-		errno = EBADFD;
-	else {
-		while ((ret = read(fd, buffer, samples * sample_size)) == -1 &&
-				errno == EINTR)
-			continue;
-		if (ret == 0) {
-			debug("PCM has been closed: %d", fd);
-			ba_transport_pcm_release(pcm);
-		}
-	}
+	iov[iovlen].iov_base = (void *)payload;
+	iov[iovlen++].iov_len = payload_len;
 
-	pthread_mutex_unlock(&pcm->mutex);
+	memset(msg, 0, sizeof(*msg));
+	msg->msg_iov = iov;
+	msg->msg_iovlen = iovlen;
 
-	if (ret <= 0)
-		return ret;
+	batch->len++;
 
-	samples = ret / sample_size;
-	io_pcm_scale(pcm, buffer, samples);
-	return samples;
 }
 
 /**
- * Write PCM signal to the transport PCM FIFO.
+ * Write batch of packets to the BT transport (SEQPACKET) socket.
+ *
+ * All queued packets are submitted with as few sendmmsg() calls as possible.
+ * This shall not be used for SCO links, which require every packet to be
+ * paced separately.
+ * Upon return the batch is empty, regardless of the result.
  *
  * Note:
- * This function may temporally re-enable thread cancellation! */
-ssize_t io_pcm_write(
-		struct ba_transport_pcm *pcm,
-		const void *buffer,
-		size_t samples) {
+ * This function may temporally re-enable thread cancellation!
+ *
+ * @param th Pointer to the transport thread structure.
+ * @param batch Pointer to the BT write batch structure.
+ * @return On success this function returns the total number of written
+ *   bytes. If the BT socket has been disconnected, 0 is returned. On error
+ *   -1 is returned and errno is set appropriately. */
+ssize_t io_bt_write_batch(
+		struct ba_transport_thread *th,
+		struct io_bt_batch *batch) {
 
-	pthread_mutex_lock(&pcm->mutex);
+	const size_t count = batch->len;
+	ssize_t total = 0;
+	size_t sent = 0;
+	int ret;
+	int fd;
 
-	size_t len = samples * BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->format);
-	ssize_t ret;
+	batch->len = 0;
 
-	do {
+	if (th->bt_fd != -1)
+		ba_transport_thread_bt_coutq_sample(th);
 
-		const int fd = pcm->fd;
-		if (fd == -1) {
-			errno = EBADFD;
-			ret = -1;
-			goto final;
-		}
+	while (sent < count) {
 
-		if ((ret = write(fd, buffer, len)) == -1)
+		if ((fd = th->bt_fd) == -1)
+			return errno = EBADFD, -1;
+
+		if ((ret = sendmmsg(fd, &batch->msgs[sent], count - sent, 0)) == -1)
 			switch (errno) {
 			case EINTR:
 				continue;
 			case EAGAIN:
+				th->bt_coutq.blocked = true;
 				/* In order to provide a way of escaping from the infinite poll()
 				 * we have to temporally re-enable thread cancellation. */
-				pthread_cleanup_push(PTHREAD_CLEANUP(pthread_mutex_unlock), &pcm->mutex);
 				pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 				struct pollfd pfd = { fd, POLLOUT, 0 };
 				poll(&pfd, 1, -1);
 				pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-				pthread_cleanup_pop(0);
 				continue;
-			case EPIPE:
-				/* This errno value will be received only, when the SIGPIPE
-				 * signal is caught, blocked or ignored. */
-				debug("PCM has been closed: %d", fd);
-				ba_transport_pcm_release(pcm);
-				ret = 0;
-				/* fall-through */
+			case ECONNABORTED:
+			case ECONNRESET:
+			case ENOTCONN:
+			case ETIMEDOUT:
+				error("BT socket disconnected: %s", strerror(errno));
+				ba_transport_thread_bt_release(th);
+				return 0;
 			default:
-				goto final;
+				return -1;
 			}
 
-		buffer += ret;
-		len -= ret;
-
-	} while (len != 0);
+		for (size_t i = sent; i < sent + ret; i++)
+			total += batch->msgs[i].msg_len;
+		sent += ret;
 
-	/* It is guaranteed, that this function will write data atomically. */
-	ret = samples;
+	}
 
-final:
-	pthread_mutex_unlock(&pcm->mutex);
-	return ret;
+	ba_transport_thread_bt_coutq_update(th);
+	ba_transport_thread_stats_add(th, tx_packets, count);
+	ba_transport_thread_stats_add(th, tx_bytes, total);
+	trace_probe2(bt_write, th, total);
+	for (size_t i = 0; i < count; i++)
+		io_bt_capture(th, BT_CAPTURE_DIRECTION_TX, batch->msgs[i].msg_hdr.msg_iov,
+				batch->msgs[i].msg_hdr.msg_iovlen, batch->msgs[i].msg_len);
+	io_bt_write_group(th, batch->msgs, count);
+	return total;
 }
 
-static enum ba_transport_thread_signal io_poll_signal_filter_none(
-		enum ba_transport_thread_signal signal,
-		void *userdata) {
-	(void)userdata;
-	return signal;
+/**
+ * Initialize adaptive bit rate controller.
+ *
+ * The initial value is set to the maximum, so the controller will lower
+ * it only in case of BT congestion.
+ *
+ * @param abr Pointer to the ABR controller structure.
+ * @param min The minimal value.
+ * @param max The maximal value.
+ * @param step The adjustment step. */
+void io_bt_abr_init(
+		struct io_bt_abr *abr,
+		unsigned int min,
+		unsigned int max,
+		unsigned int step) {
+	abr->min = MIN(min, max);
+	abr->max = max;
+	abr->max_low_power = max;
+	abr->step = MAX(step, 1);
+	abr->value = max;
+	abr->clean = 0;
+	abr->hold = 0;
 }
 
 /**
- * Poll and read data from the BT transport socket.
+ * Update adaptive bit rate controller after the BT write.
  *
- * Note:
- * This function temporally re-enables thread cancellation! */
-ssize_t io_poll_and_read_bt(
-		struct io_poll *io,
-		struct ba_transport_thread *th,
-		void *buffer,
-		size_t count) {
+ * The write is considered as congested if it had to wait for the socket
+ * space or there were at least two packets queued in the socket output
+ * buffer before the write. After lowering the value, the controller holds
+ * it for a while, so the new bit rate can take effect.
+ *
+ * @param abr Pointer to the ABR controller structure.
+ * @param th Transport thread which performed the BT write.
+ * @param adaptive If false, only the battery saver limit is applied.
+ * @return This function returns true if the value has been changed. */
+bool io_bt_abr_update(
+		struct io_bt_abr *abr,
+		const struct ba_transport_thread *th,
+		bool adaptive) {
 
-	struct pollfd fds[2] = {
-		{ th->pipe[0], POLLIN, 0 },
-		{ th->bt_fd, POLLIN, 0 }};
+	const size_t queued = th->bt_coutq.queued / th->t->mtu_write;
+	const bool low = atomic_load_explicit(&config.battery.low, memory_order_relaxed);
+	const unsigned int max = low ? abr->max_low_power : abr->max;
+	const unsigned int value = abr->value;
 
-	/* Allow escaping from the poll() by thread cancellation. */
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	/* battery saver mode has been entered */
+	if (value > max) {
+		abr->clean = 0;
+		abr->value = max;
+		return true;
+	}
 
-repoll:
+	if (!adaptive) {
+		abr->value = max;
+		return abr->value != value;
+	}
 
-	if (poll(fds, ARRAYSIZE(fds), io->timeout) == -1) {
-		if (errno == EINTR)
-			goto repoll;
-		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-		return -1;
+	if (abr->hold > 0) {
+		abr->hold--;
+		return false;
 	}
 
-	if (fds[0].revents & POLLIN) {
-		/* dispatch incoming event */
-		io_poll_signal_filter *filter = io->signal.filter != NULL ?
-			io->signal.filter : io_poll_signal_filter_none;
-		enum ba_transport_thread_signal signal;
-		ba_transport_thread_signal_recv(th, &signal);
-		switch (filter(signal, io->signal.userdata)) {
-		default:
-			goto repoll;
-		}
+	if (th->bt_coutq.blocked || queued >= 2) {
+		abr->clean = 0;
+		abr->hold = IO_BT_ABR_HOLD_WRITES;
+		abr->value = value > abr->min + abr->step ? value - abr->step : abr->min;
+	}
+	else if (queued == 0 && ++abr->clean >= IO_BT_ABR_RAISE_WRITES) {
+		abr->clean = 0;
+		abr->value = MIN(value + abr->step, max);
 	}
 
+	return abr->value != value;
+}
+
+/**
+ * BT writer thread of the pipelined mode. */
+static void *io_bt_pipeline_writer(struct io_bt_pipeline *p) {
+
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	const unsigned int rate = p->th->t->a2dp.pcm.sampling;
+
+	for (;;) {
+
+		pthread_mutex_lock(&p->mutex);
+		pthread_cleanup_push(PTHREAD_CLEANUP(pthread_mutex_unlock), &p->mutex);
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		while (p->head == p->tail)
+			pthread_cond_wait(&p->changed, &p->mutex);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		pthread_cleanup_pop(1);
+
+		/* The packet at the head position is not going to be modified by
+		 * the IO thread until we will advance the head, so it is safe to
+		 * use it without holding the lock. */
+		const size_t i = p->head % IO_BT_PIPELINE_SIZE;
+
+		if (p->packets[i].resync)
+			asrsync_init(&p->asrs, rate);
+		if (p->packets[i].frames > 0) {
+			/* keep data transfer at a constant bit rate */
+			pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+			if (asrsync_sync(&p->asrs, p->packets[i].frames) == 0)
+				ba_transport_thread_stats_add(p->th, overdue, 1);
+			pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		}
+
+		ssize_t ret = io_bt_write(p->th, p->packets[i].data, p->packets[i].len);
+		const int err = errno;
+
+		pthread_mutex_lock(&p->mutex);
+		p->head++;
+		if (ret <= 0) {
+			p->writer_ret = ret;
+			p->writer_err = err;
+		}
+		pthread_cond_broadcast(&p->changed);
+		pthread_mutex_unlock(&p->mutex);
+
+		if (ret <= 0)
+			break;
+
+	}
 
-	return io_bt_read(th, buffer, count);
+	return NULL;
 }
 
 /**
- * Poll and read data from the PCM FIFO.
+ * Initialize BT writer thread of the pipelined mode.
  *
- * Note:
- * This function temporally re-enables thread cancellation! */
-ssize_t io_poll_and_read_pcm(
-		struct io_poll *io,
-		struct ba_transport_pcm *pcm,
-		void *buffer,
-		size_t samples) {
+ * If the CPU for the encoder is configured, the calling IO thread will be
+ * pinned to that CPU.
+ *
+ * @param p Pointer to the pipeline structure.
+ * @param th Transport IO thread which will use the pipeline.
+ * @param packet_size The maximal size of the BT packet.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int io_bt_pipeline_init(
+		struct io_bt_pipeline *p,
+		struct ba_transport_thread *th,
+		size_t packet_size) {
 
-	struct ba_transport_thread *th = pcm->th;
-	struct pollfd fds[2] = {
-		{ th->pipe[0], POLLIN, 0 },
-		{ -1, POLLIN, 0 }};
+	size_t i;
+	int err;
 
-repoll:
+	memset(p, 0, sizeof(*p));
+	p->th = th;
+	p->packet_size = packet_size;
+	p->writer_ret = 1;
+	p->resync = true;
 
-	/* Allow escaping from the poll() by thread cancellation. */
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	for (i = 0; i < ARRAYSIZE(p->packets); i++)
+		if ((p->packets[i].data = malloc(packet_size)) == NULL)
+			goto fail;
 
-	/* Add PCM socket to the poll if it is active. */
-	fds[1].fd = ba_transport_pcm_is_active(pcm) ? pcm->fd : -1;
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->changed, NULL);
+
+	if ((err = pthread_create(&p->writer, NULL,
+					PTHREAD_ROUTINE(io_bt_pipeline_writer), p)) != 0) {
+		pthread_mutex_destroy(&p->mutex);
+		pthread_cond_destroy(&p->changed);
+		errno = err;
+		goto fail;
+	}
+
+	pthread_setname_np(p->writer, "ba-io-bt-write");
+	p->running = true;
+
+	if (config.a2dp.pipeline_cpu >= 0) {
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		CPU_SET(config.a2dp.pipeline_cpu, &cpuset);
+		if ((err = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset)) != 0)
+			warn("Couldn't pin encoder thread to CPU %d: %s",
+					config.a2dp.pipeline_cpu, strerror(err));
+	}
+
+	return 0;
+
+fail:
+	err = errno;
+	for (i = 0; i < ARRAYSIZE(p->packets); i++)
+		free(p->packets[i].data);
+	memset(p, 0, sizeof(*p));
+	return errno = err, -1;
+}
+
+/**
+ * Terminate BT writer thread and free pipeline resources.
+ *
+ * @param p Pointer to the pipeline structure. */
+void io_bt_pipeline_free(
+		struct io_bt_pipeline *p) {
+
+	if (!p->running)
+		return;
+
+	pthread_cancel(p->writer);
+	pthread_join(p->writer, NULL);
+	pthread_mutex_destroy(&p->mutex);
+	pthread_cond_destroy(&p->changed);
+
+	for (size_t i = 0; i < ARRAYSIZE(p->packets); i++)
+		free(p->packets[i].data);
+
+	p->running = false;
+
+}
+
+/**
+ * Detect transfer synchronization restart requested by the IO polling. */
+static void io_bt_pipeline_check_resync(
+		struct io_bt_pipeline *p,
+		const struct io_poll *io) {
+	if (io->asrs.frames != p->frames_total) {
+		p->frames_total = io->asrs.frames;
+		p->frames = 0;
+		p->resync = true;
+	}
+}
+
+/**
+ * Queue packet for the BT writer thread.
+ *
+ * This function blocks if the queue is full.
+ *
+ * Note:
+ * This function temporally re-enables thread cancellation! */
+static ssize_t io_bt_pipeline_write(
+		struct io_bt_pipeline *p,
+		struct io_poll *io,
+		const void *buffer,
+		size_t count) {
+
+	ssize_t ret;
+
+	if (count > p->packet_size)
+		return errno = EMSGSIZE, -1;
+
+	io_bt_pipeline_check_resync(p, io);
+
+	pthread_mutex_lock(&p->mutex);
+	pthread_cleanup_push(PTHREAD_CLEANUP(pthread_mutex_unlock), &p->mutex);
+
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	while (p->writer_ret > 0 && p->tail - p->head == IO_BT_PIPELINE_SIZE)
+		pthread_cond_wait(&p->changed, &p->mutex);
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+	if ((ret = p->writer_ret) <= 0)
+		errno = p->writer_err;
+	else {
+
+		const size_t i = p->tail % IO_BT_PIPELINE_SIZE;
+		memcpy(p->packets[i].data, buffer, count);
+		p->packets[i].len = count;
+		p->packets[i].frames = p->frames;
+		p->packets[i].resync = p->resync;
+
+		p->tail++;
+		pthread_cond_broadcast(&p->changed);
+
+		p->frames = 0;
+		p->resync = false;
+		ret = count;
+
+	}
+
+	pthread_cleanup_pop(1);
+	return ret;
+}
+
+/**
+ * BT reader thread of the receiver mode. */
+static void *io_bt_receiver_reader(struct io_bt_receiver *r) {
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	struct pollfd pfd = { r->th->bt_fd, POLLIN, 0 };
+
+	/* The reader shall not be preempted by the decoder, so it has to run with
+	 * the A2DP IO thread policy. Please note, that the real-time policy set
+	 * with the RealtimeKit is not inherited by new threads. */
+	if (sched_policy_apply(&config.a2dp.sched) == -1)
+		warn("Couldn't apply BT reader thread scheduling policy: %s", strerror(errno));
+
+	for (;;) {
+
+		/* The packet at the tail position is never accessed by the IO
+		 * thread, so it is safe to read into it without holding the lock. */
+		const size_t i = r->tail % ARRAYSIZE(r->packets);
+		uint32_t drops = r->drops;
+		ssize_t ret;
+
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		while ((ret = poll(&pfd, 1, -1)) == -1 && errno == EINTR)
+			continue;
+		if (ret != -1)
+			ret = io_bt_recv(pfd.fd, r->packets[i].data, r->packet_size,
+					&drops, &r->packets[i].ts);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+		if (ret == -1 && errno == EAGAIN)
+			continue;
+
+		const int err = errno;
+
+		pthread_mutex_lock(&r->mutex);
+		if (ret > 0) {
+			if (r->tail - r->head == IO_BT_RECEIVER_SIZE) {
+				/* drop the oldest packet */
+				r->dropped++;
+				r->head++;
+			}
+			r->packets[i].len = ret;
+			r->tail++;
+			r->drops = drops;
+		}
+		else {
+			r->reader_ret = ret;
+			r->reader_err = err;
+		}
+		eventfd_write(r->event_fd, 1);
+		pthread_mutex_unlock(&r->mutex);
+
+		if (ret <= 0)
+			break;
+
+	}
+
+	return NULL;
+}
+
+/**
+ * Initialize BT reader thread of the receiver mode.
+ *
+ * @param r Pointer to the receiver structure.
+ * @param th Transport IO thread which will use the receiver.
+ * @param packet_size The maximal size of the BT packet.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int io_bt_receiver_init(
+		struct io_bt_receiver *r,
+		struct ba_transport_thread *th,
+		size_t packet_size) {
+
+	size_t i;
+	int err;
+
+	memset(r, 0, sizeof(*r));
+	r->th = th;
+	r->event_fd = -1;
+	r->packet_size = packet_size;
+	r->reader_ret = 1;
+	r->drops = th->bt_rxq_drops;
+
+	if (th->bt_fd == -1) {
+		errno = EBADFD;
+		goto fail;
+	}
+
+	for (i = 0; i < ARRAYSIZE(r->packets); i++)
+		if ((r->packets[i].data = malloc(packet_size)) == NULL)
+			goto fail;
+
+	if ((r->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1)
+		goto fail;
+
+	pthread_mutex_init(&r->mutex, NULL);
+
+	if ((err = pthread_create(&r->reader, NULL,
+					PTHREAD_ROUTINE(io_bt_receiver_reader), r)) != 0) {
+		pthread_mutex_destroy(&r->mutex);
+		errno = err;
+		goto fail;
+	}
+
+	pthread_setname_np(r->reader, "ba-io-bt-read");
+	r->running = true;
+
+	return 0;
+
+fail:
+	err = errno;
+	if (r->event_fd != -1)
+		close(r->event_fd);
+	for (i = 0; i < ARRAYSIZE(r->packets); i++)
+		free(r->packets[i].data);
+	memset(r, 0, sizeof(*r));
+	return errno = err, -1;
+}
+
+/**
+ * Terminate BT reader thread and free receiver resources.
+ *
+ * @param r Pointer to the receiver structure. */
+void io_bt_receiver_free(
+		struct io_bt_receiver *r) {
+
+	if (!r->running)
+		return;
+
+	pthread_cancel(r->reader);
+	pthread_join(r->reader, NULL);
+	pthread_mutex_destroy(&r->mutex);
+	close(r->event_fd);
+
+	if (r->dropped > 0)
+		debug("BT receiver queue overflows: %u", r->dropped);
+
+	for (size_t i = 0; i < ARRAYSIZE(r->packets); i++)
+		free(r->packets[i].data);
+
+	r->running = false;
+
+}
+
+/**
+ * Get packet from the BT reader thread queue.
+ *
+ * @return On success this function returns the length of the packet. If
+ *   the BT reader thread has terminated, its result is returned. If the
+ *   queue is empty, -1 is returned and errno is set to EAGAIN. */
+static ssize_t io_bt_receiver_read(
+		struct io_bt_receiver *r,
+		void *buffer,
+		size_t count,
+		uint32_t *drops,
+		struct timespec *ts) {
+
+	ssize_t ret;
+
+	pthread_mutex_lock(&r->mutex);
+
+	if (r->head == r->tail) {
+		if ((ret = r->reader_ret) > 0)
+			ret = -1, errno = EAGAIN;
+		else
+			errno = r->reader_err;
+		goto final;
+	}
+
+	const size_t i = r->head % ARRAYSIZE(r->packets);
+	ret = MIN(count, r->packets[i].len);
+	*drops = r->drops;
+	*ts = r->packets[i].ts;
+	memcpy(buffer, r->packets[i].data, ret);
+	r->head++;
+
+	/* Clear the notification while holding the lock, so it will not be
+	 * lost if the reader queues another packet in the meantime. */
+	if (r->head == r->tail && r->reader_ret > 0) {
+		eventfd_t value;
+		eventfd_read(r->event_fd, &value);
+	}
+
+final:
+	pthread_mutex_unlock(&r->mutex);
+	return ret;
+}
+
+/**
+ * Scale PCM signal according to the volume configuration. */
+void io_pcm_scale(
+		const struct ba_transport_pcm *pcm,
+		void *buffer,
+		size_t samples) {
+
+	const unsigned int channels = pcm->channels;
+	size_t frames = samples / channels;
+
+	/* In case of hardware volume control we will perform mute operation,
+	 * because hardware muting is an equivalent of gain=0 which with some
+	 * headsets does not entirely silence audio. Both scaling and muting are
+	 * done in a single pass by the audio scaling function. */
+	const double ch1 = pcm->volume[0].muted ? 0 : pcm->soft_volume ? pcm->volume[0].scale : 1.0;
+	const double ch2 = pcm->volume[1].muted ? 0 : pcm->soft_volume ? pcm->volume[1].scale : 1.0;
+
+	switch (pcm->codec_format) {
+	case BA_TRANSPORT_PCM_FORMAT_S16_2LE:
+		audio_scale_s16_2le(buffer, channels, frames, ch1, ch2);
+		break;
+	case BA_TRANSPORT_PCM_FORMAT_S24_4LE:
+	case BA_TRANSPORT_PCM_FORMAT_S32_4LE:
+		audio_scale_s32_4le(buffer, channels, frames, ch1, ch2);
+		break;
+	default:
+		g_assert_not_reached();
+	}
+
+}
+
+/**
+ * Convert PCM signal between stream formats.
+ *
+ * The conversion can be done in place, i.e. dst and src might point to
+ * the same buffer, which shall be big enough for the wider format. The
+ * packed S24_3LE format can be converted only to (or from) the format with
+ * samples stored in 32-bit container. */
+static void io_pcm_convert(
+		void *dst,
+		uint16_t dst_format,
+		const void *src,
+		uint16_t src_format,
+		size_t samples) {
+
+	const unsigned int dst_width = BA_TRANSPORT_PCM_FORMAT_WIDTH(dst_format);
+	const unsigned int src_width = BA_TRANSPORT_PCM_FORMAT_WIDTH(src_format);
+
+	if (src_format == BA_TRANSPORT_PCM_FORMAT_S24_3LE)
+		audio_s24_3le_to_s32(dst, src, samples, dst_width - 24);
+	else if (dst_format == BA_TRANSPORT_PCM_FORMAT_S24_3LE)
+		audio_s32_to_s24_3le(dst, src, samples, src_width - 24);
+	else if (src_format == BA_TRANSPORT_PCM_FORMAT_S16_2LE)
+		audio_s16_to_s32(dst, src, samples, dst_width - 16);
+	else if (dst_format == BA_TRANSPORT_PCM_FORMAT_S16_2LE)
+		audio_s32_to_s16(dst, src, samples, src_width - 16);
+	else {
+		if (dst != src)
+			memcpy(dst, src, samples * sizeof(int32_t));
+		audio_s32_shift(dst, samples, (int)dst_width - (int)src_width);
+	}
+
+}
+
+/**
+ * Check whether the channel conversion is required for the PCM stream. */
+static bool io_pcm_remap_is_required(const struct ba_transport_pcm *pcm) {
+	return pcm->client_channels != pcm->channels ||
+		(pcm->swap_channels && pcm->channels == 2);
+}
+
+/**
+ * Convert the number of channels of the PCM signal in the codec format.
+ *
+ * The conversion can be done in place (dst and src pointing to the same
+ * address). Left and right channels are swapped if requested for the PCM,
+ * when the destination signal is stereo. */
+static void io_pcm_remap(
+		const struct ba_transport_pcm *pcm,
+		void *dst,
+		unsigned int dst_channels,
+		const void *src,
+		unsigned int src_channels,
+		size_t frames) {
+
+	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->codec_format);
+	g_assert(sample_size == 2 || sample_size == 4);
+
+	if (src_channels == 2 && dst_channels == 1) {
+		if (sample_size == 2)
+			audio_downmix_s16_2le(dst, src, frames);
+		else
+			audio_downmix_s32_4le(dst, src, frames);
+		return;
+	}
+
+	if (src_channels == 1 && dst_channels == 2) {
+		if (sample_size == 2)
+			audio_upmix_s16_2le(dst, src, frames);
+		else
+			audio_upmix_s32_4le(dst, src, frames);
+	}
+	else if (dst != src)
+		memcpy(dst, src, frames * src_channels * sample_size);
+
+	if (pcm->swap_channels && dst_channels == 2) {
+		if (sample_size == 2)
+			audio_swap_s16_2le(dst, frames);
+		else
+			audio_swap_s32_4le(dst, frames);
+	}
+
+}
+
+/**
+ * Flush read buffer of the transport PCM FIFO. */
+ssize_t io_pcm_flush(struct ba_transport_pcm *pcm) {
+
+	/* discard signal buffered by the resampler */
+	pthread_mutex_lock(&pcm->mutex);
+	if (resampler_is_initialized(&pcm->resampler))
+		resampler_reset(&pcm->resampler);
+	pthread_mutex_unlock(&pcm->mutex);
+
+	if (shm_ring_is_mapped(&pcm->shm)) {
+		ssize_t rv = 0;
+		pthread_mutex_lock(&pcm->mutex);
+		/* the ring might have been released in the meantime */
+		if (shm_ring_is_mapped(&pcm->shm))
+			rv = shm_ring_read(&pcm->shm, NULL, SIZE_MAX);
+		pthread_mutex_unlock(&pcm->mutex);
+		return rv / BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->format);
+	}
+
+	pthread_mutex_lock(&pcm->mutex);
+	size_t i;
+	for (i = 0; i < pcm->mix_clients_len; i++)
+		if (pcm->mix_clients[i].fd != -1) {
+			splice(pcm->mix_clients[i].fd, NULL, config.null_fd, NULL, 1024 * 32, SPLICE_F_NONBLOCK);
+			pcm->mix_clients[i].tail_len = 0;
+		}
+	pcm->read_tail_len = 0;
+	pthread_mutex_unlock(&pcm->mutex);
+
+	ssize_t rv = splice(pcm->fd, NULL, config.null_fd, NULL, 1024 * 32, SPLICE_F_NONBLOCK);
+	if (rv > 0)
+		rv /= BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->format);
+	else if (rv == -1 && errno == EAGAIN)
+		rv = 0;
+	return rv;
+}
+
+/**
+ * Mix streams of additional PCM clients into the given buffer.
+ *
+ * The buffer shall contain the given number of samples (whole frames) in
+ * the codec format read from the main client. The mixing is clocked by the
+ * encoder, so every client is read up to the maximal number of samples the
+ * encoder has asked for, regardless of the amount of data delivered by the
+ * main client. If some client has delivered more data than the main one,
+ * the buffer is extended with silence before mixing.
+ *
+ * This function shall be called with the PCM mutex locked.
+ *
+ * @return This function returns the number of samples in the buffer. */
+static size_t io_pcm_mix(
+		struct ba_transport_pcm *pcm,
+		void *buffer,
+		size_t samples,
+		size_t samples_max) {
+
+	const uint16_t format = pcm->format;
+	const uint16_t codec_format = pcm->codec_format;
+	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(format);
+	const size_t codec_sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(codec_format);
+	const unsigned int channels = pcm->channels;
+	const unsigned int client_channels = pcm->client_channels;
+	const bool remap = io_pcm_remap_is_required(pcm);
+	const size_t frame_size = sample_size * client_channels;
+	const size_t frames = samples_max / channels;
+	/* the buffer has to fit the incomplete frame kept from the last read */
+	const size_t size = frames * MAX(channels, client_channels) *
+		MAX(sample_size, codec_sample_size) + sizeof(pcm->mix_clients[0].tail);
+	size_t mixed = samples;
+	size_t i;
+
+	if (frames == 0)
+		return samples;
+
+	if (pcm->mix_buffer_size < size) {
+		void *tmp;
+		if ((tmp = realloc(pcm->mix_buffer, size)) == NULL) {
+			warn("Couldn't allocate PCM mixer buffer: %s", strerror(errno));
+			return samples;
+		}
+		pcm->mix_buffer = tmp;
+		pcm->mix_buffer_size = size;
+	}
+
+	for (i = 0; i < pcm->mix_clients_len; i++) {
+
+		struct ba_transport_pcm_mix_client *c = &pcm->mix_clients[i];
+		uint8_t *data = pcm->mix_buffer;
+		ssize_t ret;
+
+		if (c->fd == -1 || c->paused)
+			continue;
+
+		memcpy(data, c->tail, c->tail_len);
+		while ((ret = read(c->fd, data + c->tail_len,
+						frames * frame_size - c->tail_len)) == -1 &&
+				errno == EINTR)
+			continue;
+
+		if (ret == 0) {
+			debug("Mixed PCM client has been closed: %d", c->fd);
+			close(c->fd);
+			c->fd = -1;
+			continue;
+		}
+
+		if (ret == -1) {
+			if (errno != EAGAIN)
+				warn("Couldn't read mixed PCM client: %s", strerror(errno));
+			continue;
+		}
+
+		/* keep incomplete frame for the next read */
+		const size_t len = c->tail_len + ret;
+		c->tail_len = len % frame_size;
+		memcpy(c->tail, data + len - c->tail_len, c->tail_len);
+
+		size_t len_samples = (len - c->tail_len) / sample_size;
+		if (format != codec_format)
+			io_pcm_convert(data, codec_format, data, format, len_samples);
+		if (remap) {
+			io_pcm_remap(pcm, data, channels, data, client_channels,
+					len_samples / client_channels);
+			len_samples = len_samples / client_channels * channels;
+		}
+
+		if (len_samples > mixed) {
+			memset((uint8_t *)buffer + mixed * codec_sample_size, 0,
+					(len_samples - mixed) * codec_sample_size);
+			mixed = len_samples;
+		}
+
+		switch (codec_format) {
+		case BA_TRANSPORT_PCM_FORMAT_S16_2LE:
+			audio_mix_s16_2le(buffer, (int16_t *)data, len_samples, 1.0);
+			break;
+		case BA_TRANSPORT_PCM_FORMAT_S24_4LE:
+			audio_mix_s24_4le(buffer, (int32_t *)data, len_samples, 1.0);
+			break;
+		case BA_TRANSPORT_PCM_FORMAT_S32_4LE:
+			audio_mix_s32_4le(buffer, (int32_t *)data, len_samples, 1.0);
+			break;
+		default:
+			g_assert_not_reached();
+		}
+
+	}
+
+	return mixed;
+}
+
+/**
+ * Write the stream read from the PCM FIFO to the monitor PCM.
+ *
+ * The monitor client receives exactly the same data which are passed to
+ * the encoder (or to the packetizer in case of the compressed stream), so
+ * nothing is decoded nor encoded twice. If the monitor client has selected
+ * the stream kind (PCM signal or compressed) which does not match the one
+ * currently read from the PCM, data are not written. */
+static void io_pcm_monitor_write(
+		struct ba_transport_pcm *monitor,
+		const void *buffer,
+		size_t samples,
+		bool compressed) {
+
+	pthread_mutex_lock(&monitor->mutex);
+	const bool write = ba_transport_pcm_is_active(monitor) &&
+		BA_TRANSPORT_PCM_FORMAT_IS_COMPRESSED(monitor->format) == compressed;
+	pthread_mutex_unlock(&monitor->mutex);
+
+	if (write && io_pcm_write(monitor, buffer, samples) == -1 && errno != EBADFD)
+		debug("Couldn't write monitor PCM: %s", strerror(errno));
+
+}
+
+/**
+ * Read PCM signal from the transport PCM FIFO.
+ *
+ * For the compressed stream format, data are read with no conversion and
+ * both the buffer size and the returned value are given in bytes. */
+ssize_t io_pcm_read(
+		struct ba_transport_pcm *pcm,
+		void *buffer,
+		size_t samples) {
+
+	pthread_mutex_lock(&pcm->mutex);
+
+	const uint16_t format = pcm->format;
+	const uint16_t codec_format = pcm->codec_format;
+	/* compressed stream is read as it is, byte by byte */
+	const bool compressed = BA_TRANSPORT_PCM_FORMAT_IS_COMPRESSED(format);
+	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(format);
+	const size_t codec_sample_size = compressed ? 1 :
+		BA_TRANSPORT_PCM_FORMAT_BYTES(codec_format);
+	struct resampler *resampler = &pcm->resampler;
+	const bool resample = resampler_is_initialized(resampler);
+	const bool remap = !compressed && io_pcm_remap_is_required(pcm);
+	/* other clients are mixed into the stream frame by frame */
+	const bool mix = !compressed && pcm->mix_clients_len > 0;
+	const unsigned int channels = pcm->channels;
+	const unsigned int client_channels = pcm->client_channels;
+	/* with the channel conversion only whole frames can be processed */
+	const size_t unit_size = remap || mix ?
+		sample_size * client_channels : sample_size;
+	const int fd = pcm->fd;
+	size_t len = samples;
+	ssize_t ret = -1;
+
+	/* The buffer is sized for the codec format. If the client format is
+	 * wider, read less samples, so the signal will fit after conversion. */
+	if (sample_size > codec_sample_size)
+		len = len * codec_sample_size / sample_size;
+
+	/* The buffer has to fit the signal with the larger number of channels
+	 * at every stage of the channel conversion. */
+	if (remap)
+		len = len / MAX(channels, client_channels) * channels;
+
+	/* Read only as much as the resampler needs in order to fill the buffer,
+	 * so the signal will not accumulate in the resampler history. */
+	if (resample)
+		len = MIN(len, MIN(resampler_get_needed(resampler, samples),
+					resampler_get_space(resampler)));
+
+	/* the number of samples the encoder has asked for */
+	const size_t len_mix = len - len % channels;
+
+	/* convert the number of codec samples to the client samples */
+	if (remap)
+		len = len / channels * client_channels;
+
+	if (fd == -1) {
+		errno = EBADFD;
+		goto final;
+	}
+
+	if (len > 0) {
+
+		if (shm_ring_is_mapped(&pcm->shm)) {
+			/* read whole samples (or frames) only */
+			size_t len_out = shm_ring_len_out(&pcm->shm);
+			len_out = MIN(len * sample_size, len_out - len_out % unit_size);
+			if ((ret = shm_ring_read(&pcm->shm, buffer, len_out)) == 0) {
+				if (shm_ring_is_closed(&pcm->shm)) {
+					debug("PCM has been closed: %d", fd);
+					ba_transport_pcm_release_client(pcm);
+					if (pcm->fd != -1) {
+						/* mixed client has taken over the PCM */
+						errno = EAGAIN;
+						ret = -1;
+					}
+				}
+				else {
+					errno = EAGAIN;
+					ret = -1;
+				}
+			}
+		}
+		else {
+			const size_t tail_len = pcm->read_tail_len;
+			memcpy(buffer, pcm->read_tail, tail_len);
+			while ((ret = read(fd, (uint8_t *)buffer + tail_len,
+							len * sample_size - tail_len)) == -1 &&
+					errno == EINTR)
+				continue;
+			if (ret == 0) {
+				debug("PCM has been closed: %d", fd);
+				ba_transport_pcm_release_client(pcm);
+				if (pcm->fd != -1) {
+					/* mixed client has taken over the PCM */
+					errno = EAGAIN;
+					ret = -1;
+				}
+			}
+			else if (ret > 0) {
+				/* keep incomplete sample (or frame) for the next read */
+				const size_t total = tail_len + ret;
+				pcm->read_tail_len = total % unit_size;
+				memcpy(pcm->read_tail, (uint8_t *)buffer + total - pcm->read_tail_len,
+						pcm->read_tail_len);
+				if ((ret = total - pcm->read_tail_len) == 0) {
+					errno = EAGAIN;
+					ret = -1;
+				}
+			}
+		}
+
+		if (ret <= 0) {
+			/* Mixed clients shall be read even if the main client has not
+			 * delivered any data, because it is the encoder which drives
+			 * the transfer. */
+			if (!(ret == -1 && errno == EAGAIN && pcm->mix_clients_len > 0))
+				goto final;
+			ret = 0;
+		}
+
+		len = ret / sample_size;
+		if (compressed) {
+			/* position is updated by the packetizer, which knows the
+			 * number of frames carried by the compressed data */
+			trace_probe2(pcm_read, pcm->th, len);
+			ret = len;
+			goto final;
+		}
+
+		if (format != codec_format)
+			io_pcm_convert(buffer, codec_format, buffer, format, len);
+		if (remap) {
+			io_pcm_remap(pcm, buffer, channels, buffer, client_channels,
+					len / client_channels);
+			len = len / client_channels * channels;
+		}
+		if (pcm->mix_clients_len > 0 &&
+				(len = io_pcm_mix(pcm, buffer, len, len_mix)) == 0) {
+			errno = EAGAIN;
+			ret = -1;
+			goto final;
+		}
+
+		ba_transport_pcm_position_update(pcm, len);
+		trace_probe2(pcm_read, pcm->th, len);
+
+	}
+
+	if (resample) {
+		resampler_push(resampler, buffer, len);
+		if ((len = resampler_pull(resampler, buffer, samples)) == 0) {
+			/* wait for more data */
+			errno = EAGAIN;
+			ret = -1;
+			goto final;
+		}
+	}
+
+	ret = len;
+
+final:
+	pthread_mutex_unlock(&pcm->mutex);
+
+	if (ret > 0 && !compressed)
+		io_pcm_scale(pcm, buffer, ret);
+	if (ret > 0 && pcm->monitor != NULL)
+		io_pcm_monitor_write(pcm->monitor, buffer, ret, compressed);
+	return ret;
+}
+
+/**
+ * Write data to the transport PCM FIFO or shared memory ring.
+ *
+ * This function waits for the client to consume data, if needed.
+ *
+ * This function shall be called with the PCM mutex locked.
+ *
+ * @return On success this function returns the number of bytes written,
+ *   which is always equal to the requested length. If the PCM has been
+ *   closed, 0 is returned. Otherwise, -1 is returned and errno is set. */
+static ssize_t io_pcm_write_fifo_block(
+		struct ba_transport_pcm *pcm,
+		const void *buffer,
+		size_t len) {
+
+	const size_t total = len;
+	ssize_t ret;
+
+	do {
+
+		const int fd = pcm->fd;
+		if (fd == -1) {
+			errno = EBADFD;
+			ret = -1;
+			goto final;
+		}
+
+		if (shm_ring_is_mapped(&pcm->shm)) {
+			if ((ret = shm_ring_write(&pcm->shm, buffer, len)) == 0) {
+				ba_transport_thread_stats_add(pcm->th, overruns, 1);
+				/* Wait for the client to consume data. Since the shared memory
+				 * will not report peer disconnection, poll the controller socket
+				 * for hang-up as well. */
+				struct pollfd pfds[2] = {
+					{ pcm->shm.efd_space, POLLIN, 0 },
+					{ pcm->shm_ctrl_fd, 0, 0 }};
+				pthread_cleanup_push(PTHREAD_CLEANUP(pthread_mutex_unlock), &pcm->mutex);
+				pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+				poll(pfds, ARRAYSIZE(pfds), -1);
+				pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+				pthread_cleanup_pop(0);
+				if (pfds[1].revents & (POLLERR | POLLHUP) ||
+						shm_ring_is_closed(&pcm->shm)) {
+					debug("PCM has been closed: %d", fd);
+					ba_transport_pcm_release(pcm);
+					goto final;
+				}
+				continue;
+			}
+		}
+		else if ((ret = write(fd, buffer, len)) == -1)
+			switch (errno) {
+			case EINTR:
+				continue;
+			case EAGAIN:
+				ba_transport_thread_stats_add(pcm->th, overruns, 1);
+				/* In order to provide a way of escaping from the infinite poll()
+				 * we have to temporally re-enable thread cancellation. */
+				pthread_cleanup_push(PTHREAD_CLEANUP(pthread_mutex_unlock), &pcm->mutex);
+				pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+				struct pollfd pfd = { fd, POLLOUT, 0 };
+				poll(&pfd, 1, -1);
+				pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+				pthread_cleanup_pop(0);
+				continue;
+			case EPIPE:
+				/* This errno value will be received only, when the SIGPIPE
+				 * signal is caught, blocked or ignored. */
+				debug("PCM has been closed: %d", fd);
+				ba_transport_pcm_release(pcm);
+				ret = 0;
+				/* fall-through */
+			default:
+				goto final;
+			}
+
+		buffer += ret;
+		len -= ret;
+
+	} while (len != 0);
+
+	ret = total;
+
+final:
+	return ret;
+}
+
+/**
+ * Write as much data as possible without waiting for the client.
+ *
+ * This function shall be called with the PCM mutex locked.
+ *
+ * @return On success this function returns the number of bytes written,
+ *   which might be less than requested. If the PCM has been closed, 0 is
+ *   returned. Otherwise, -1 is returned and errno is set to indicate the
+ *   error - EAGAIN means that there is no space for data at all. */
+static ssize_t io_pcm_write_fifo_try(
+		struct ba_transport_pcm *pcm,
+		const void *buffer,
+		size_t len) {
+
+	const int fd = pcm->fd;
+	ssize_t ret;
+
+	if (fd == -1)
+		return errno = EBADFD, -1;
+
+	if (shm_ring_is_mapped(&pcm->shm)) {
+		if ((ret = shm_ring_write(&pcm->shm, buffer, len)) > 0)
+			return ret;
+		/* check for the client hang-up without waiting */
+		struct pollfd pfd = { pcm->shm_ctrl_fd, 0, 0 };
+		if (shm_ring_is_closed(&pcm->shm) ||
+				(poll(&pfd, 1, 0) > 0 && pfd.revents & (POLLERR | POLLHUP))) {
+			debug("PCM has been closed: %d", fd);
+			ba_transport_pcm_release(pcm);
+			return 0;
+		}
+		return errno = EAGAIN, -1;
+	}
+
+	while ((ret = write(fd, buffer, len)) == -1)
+		switch (errno) {
+		case EINTR:
+			continue;
+		case EPIPE:
+			debug("PCM has been closed: %d", fd);
+			ba_transport_pcm_release(pcm);
+			return 0;
+		default:
+			return -1;
+		}
+
+	return ret;
+}
+
+/**
+ * Write data to the transport PCM FIFO according to the overrun policy.
+ *
+ * Data which can not be written without waiting for the client are either
+ * dropped or kept in the backlog buffer, which is flushed before writing
+ * new data. In both cases only whole frames are dropped, so the stream
+ * received by the client stays aligned to the frame boundary.
+ *
+ * This function shall be called with the PCM mutex locked.
+ *
+ * @return On success this function returns the number of bytes consumed,
+ *   which is always equal to the requested length. If the PCM has been
+ *   closed, 0 is returned. Otherwise, -1 is returned and errno is set. */
+static ssize_t io_pcm_write_fifo_drop(
+		struct ba_transport_pcm *pcm,
+		const void *buffer,
+		size_t len) {
+
+	const size_t frame_size = pcm->client_channels * BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->format);
+	ffb_t *backlog = &pcm->overrun_backlog;
+	const size_t total = len;
+	ssize_t ret = 0;
+
+	if (backlog->data == NULL) {
+		const size_t frames = pcm->sampling * IO_PCM_OVERRUN_BACKLOG_MS / 1000;
+		if (ffb_init_uint8_t(backlog, MAX(frames, 2) * frame_size) == -1)
+			return -1;
+	}
+
+	/* flush the backlog first, so the order of data is preserved */
+	while (ffb_blen_out(backlog) > 0 &&
+			(ret = io_pcm_write_fifo_try(pcm, backlog->data, ffb_blen_out(backlog))) > 0) {
+		pcm->overrun_frame_offset = (pcm->overrun_frame_offset + ret) % frame_size;
+		ffb_shift(backlog, ret);
+	}
+
+	while (ffb_blen_out(backlog) == 0 && len > 0 &&
+			(ret = io_pcm_write_fifo_try(pcm, buffer, len)) > 0) {
+		pcm->overrun_frame_offset = (pcm->overrun_frame_offset + ret) % frame_size;
+		buffer = (const uint8_t *)buffer + ret;
+		len -= ret;
+	}
+
+	if (ret == 0)
+		return 0;
+	if (ret == -1 && errno != EAGAIN)
+		return -1;
+	if (len == 0)
+		return total;
+
+	ba_transport_thread_stats_add(pcm->th, overruns, 1);
+
+	/* The unwritten stream (the backlog followed by new data) starts with
+	 * the remaining part of the frame which has partially reached the FIFO.
+	 * This part has to be kept regardless of the policy. */
+	const size_t head = (frame_size - pcm->overrun_frame_offset) % frame_size;
+	if (ffb_blen_out(backlog) < head) {
+		const size_t n = MIN(head - ffb_blen_out(backlog), len);
+		memcpy(backlog->tail, buffer, n);
+		ffb_seek(backlog, n);
+		buffer = (const uint8_t *)buffer + n;
+		len -= n;
+	}
+
+	size_t drops = len / frame_size;
+
+	if (pcm->overrun == BA_TRANSPORT_PCM_OVERRUN_DROP_OLDEST && len > 0) {
+
+		const size_t backlog_frames = (ffb_blen_out(backlog) - head) / frame_size;
+		const size_t capacity_frames = (backlog->nmemb - head) / frame_size;
+		const size_t frames = backlog_frames + len / frame_size;
+
+		/* make room for new data by dropping the oldest whole frames */
+		drops = frames > capacity_frames ? frames - capacity_frames : 0;
+
+		const size_t drops_backlog = MIN(drops, backlog_frames);
+		uint8_t *data = (uint8_t *)backlog->data + head;
+		memmove(data, data + drops_backlog * frame_size,
+				(backlog_frames - drops_backlog) * frame_size);
+		backlog->tail = (uint8_t *)backlog->tail - drops_backlog * frame_size;
+
+		const size_t skip = (drops - drops_backlog) * frame_size;
+		memcpy(backlog->tail, (const uint8_t *)buffer + skip, len - skip);
+		ffb_seek(backlog, len - skip);
+
+	}
+
+	ba_transport_thread_stats_add(pcm->th, overrun_drops, drops);
+	return total;
+}
+
+/**
+ * Write data to the transport PCM FIFO or shared memory ring.
+ *
+ * This function shall be called with the PCM mutex locked.
+ *
+ * @return On success this function returns the number of bytes written
+ *   or dropped according to the overrun policy, which is always equal to
+ *   the requested length. If the PCM has been closed, 0 is returned.
+ *   Otherwise, -1 is returned and errno is set to indicate the error. */
+static ssize_t io_pcm_write_fifo(
+		struct ba_transport_pcm *pcm,
+		const void *buffer,
+		size_t len) {
+
+	if (pcm->overrun != BA_TRANSPORT_PCM_OVERRUN_BLOCK)
+		return io_pcm_write_fifo_drop(pcm, buffer, len);
+
+	/* write data left in the backlog by the previously used policy */
+	ffb_t *backlog = &pcm->overrun_backlog;
+	if (backlog->data != NULL && ffb_blen_out(backlog) > 0) {
+		ssize_t ret;
+		if ((ret = io_pcm_write_fifo_block(pcm, backlog->data, ffb_blen_out(backlog))) <= 0)
+			return ret;
+		ffb_rewind(backlog);
+		pcm->overrun_frame_offset = 0;
+	}
+
+	return io_pcm_write_fifo_block(pcm, buffer, len);
+}
+
+/**
+ * Get the FIFO file descriptor to poll for the backlog flush.
+ *
+ * @return If there are data in the overrun backlog, this function returns
+ *   the PCM FIFO file descriptor. Otherwise, -1 is returned. */
+static int io_pcm_backlog_poll_fd(struct ba_transport_pcm *pcm) {
+
+	int fd = -1;
+
+	pthread_mutex_lock(&pcm->mutex);
+	if (pcm->overrun != BA_TRANSPORT_PCM_OVERRUN_BLOCK &&
+			ffb_blen_out(&pcm->overrun_backlog) > 0 &&
+			!shm_ring_is_mapped(&pcm->shm))
+		fd = pcm->fd;
+	pthread_mutex_unlock(&pcm->mutex);
+
+	return fd;
+}
+
+/**
+ * Write data from the overrun backlog without waiting for the client.
+ *
+ * Normally, the backlog is flushed before writing new data. However, when
+ * the remote device does not send anything (e.g. during silence), data
+ * would be stuck in the backlog, so the IO thread shall call this function
+ * when the FIFO becomes writable. */
+static void io_pcm_flush_backlog(struct ba_transport_pcm *pcm) {
+	pthread_mutex_lock(&pcm->mutex);
+	if (pcm->overrun != BA_TRANSPORT_PCM_OVERRUN_BLOCK &&
+			ffb_blen_out(&pcm->overrun_backlog) > 0 &&
+			pcm->fd != -1)
+		io_pcm_write_fifo_drop(pcm, NULL, 0);
+	pthread_mutex_unlock(&pcm->mutex);
+}
+
+static ssize_t io_pcm_write_stream(
+		struct ba_transport_pcm *pcm,
+		const void *buffer,
+		size_t samples) {
+
+	pthread_mutex_lock(&pcm->mutex);
+
+	const uint16_t format = pcm->format;
+	const uint16_t codec_format = pcm->codec_format;
+	/* compressed stream is written as it is, byte by byte */
+	const bool compressed = BA_TRANSPORT_PCM_FORMAT_IS_COMPRESSED(format);
+	const bool remap = !compressed && io_pcm_remap_is_required(pcm);
+	ssize_t ret = 0;
+
+	if (compressed || (format == codec_format && !remap))
+		ret = io_pcm_write_fifo(pcm, buffer,
+				samples * BA_TRANSPORT_PCM_FORMAT_BYTES(format));
+	else {
+
+		/* Convert the signal to the client format in chunks which fit
+		 * the intermediate buffer. All chunks are written while holding
+		 * the PCM lock, so the write is still atomic. With the channel
+		 * conversion, chunks consist of whole frames. */
+		const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(format);
+		const size_t codec_sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(codec_format);
+		const size_t unit = remap ? pcm->channels : 1;
+		const size_t client_unit = remap ? pcm->client_channels : 1;
+		int32_t tmp[1024];
+
+		for (size_t i = 0; i + unit <= samples; ) {
+			const size_t n = MIN((samples - i) / unit, ARRAYSIZE(tmp) / MAX(unit, client_unit));
+			const void *src = (const uint8_t *)buffer + i * codec_sample_size;
+			if (remap) {
+				io_pcm_remap(pcm, tmp, client_unit, src, unit, n);
+				src = tmp;
+			}
+			if (format != codec_format)
+				io_pcm_convert(tmp, format, src, codec_format, n * client_unit);
+			if ((ret = io_pcm_write_fifo(pcm, tmp, n * client_unit * sample_size)) <= 0)
+				break;
+			i += n * unit;
+		}
+
+	}
+
+	/* It is guaranteed, that this function will write data atomically. */
+	if (ret > 0) {
+		if (!compressed)
+			ba_transport_pcm_position_update(pcm, samples);
+		trace_probe2(fifo_write, pcm->th, samples);
+		ret = samples;
+	}
+
+	pthread_mutex_unlock(&pcm->mutex);
+	return ret;
+}
+
+/**
+ * Arm or disarm the jitter buffer playout timer. */
+static void io_pcm_jitter_arm(
+		struct ba_transport_pcm *pcm,
+		bool arm) {
+
+	if (pcm->jitter.armed == arm)
+		return;
+
+	const long period = arm ? IO_PCM_JITTER_PERIOD_MS * 1000000 : 0;
+	const struct itimerspec ts = {
+		.it_interval.tv_nsec = period,
+		.it_value.tv_nsec = period };
+
+	if (timerfd_settime(pcm->jitter.timer_fd, 0, &ts, NULL) == -1) {
+		warn("Couldn't set jitter buffer timer: %s", strerror(errno));
+		return;
+	}
+
+	pcm->jitter.armed = arm;
+}
+
+/**
+ * Discard the signal buffered in the jitter buffer. */
+static void io_pcm_jitter_reset(
+		struct ba_transport_pcm *pcm) {
+	jitter_buffer_reset(&pcm->jitter.jb);
+	atomic_store_explicit(&pcm->jitter.delay, 0, memory_order_relaxed);
+	io_pcm_jitter_arm(pcm, false);
+}
+
+/**
+ * Initialize the jitter buffer of the given PCM.
+ *
+ * The jitter buffer stores the signal in the codec format, so the client
+ * format conversion is done by the playout. */
+static int io_pcm_jitter_init(
+		struct ba_transport_pcm *pcm) {
+
+	const size_t frame_size =
+		BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->codec_format) * pcm->channels;
+	if (jitter_buffer_init(&pcm->jitter.jb, frame_size, pcm->sampling,
+				config.a2dp.jitter_buffer) == -1)
+		return -1;
+
+	if (pcm->jitter.timer_fd == -1 &&
+			(pcm->jitter.timer_fd = timerfd_create(CLOCK_MONOTONIC,
+					TFD_CLOEXEC | TFD_NONBLOCK)) == -1) {
+		jitter_buffer_free(&pcm->jitter.jb);
+		return -1;
+	}
+
+	pcm->jitter.armed = true;
+	io_pcm_jitter_reset(pcm);
+
+	debug("Jitter buffer initialized: %u ms", config.a2dp.jitter_buffer);
+	return 0;
+}
+
+/**
+ * Write the signal from the jitter buffer to the PCM FIFO.
+ *
+ * This function shall be called when the playout timer expires. One period
+ * of the signal is written for every timer expiration, so the playout will
+ * catch up if the IO thread was not scheduled on time. */
+static void io_pcm_jitter_playout(
+		struct ba_transport_pcm *pcm) {
+
+	/* buffer for one playout period at the highest supported sampling */
+	int32_t buffer[96000 * IO_PCM_JITTER_PERIOD_MS / 1000 * 2];
+	uint64_t expirations = 0;
+
+	if (read(pcm->jitter.timer_fd, &expirations, sizeof(expirations)) == -1 &&
+			errno != EAGAIN)
+		warn("Couldn't read jitter buffer timer: %s", strerror(errno));
+
+	if (!ba_transport_pcm_is_active(pcm)) {
+		io_pcm_jitter_reset(pcm);
+		return;
+	}
+
+	const size_t frame_size = pcm->jitter.jb.frame_size;
+	const size_t frames = MIN((size_t)pcm->sampling * IO_PCM_JITTER_PERIOD_MS / 1000,
+			sizeof(buffer) / frame_size);
+
+	/* Do not flood the client with the signal in case when the IO thread
+	 * was suspended for a long time - the signal is stale anyway. */
+	for (expirations = MIN(expirations, 4); expirations > 0; expirations--) {
+
+		size_t len;
+		if ((len = jitter_buffer_pull(&pcm->jitter.jb, buffer, frames)) == 0) {
+			/* stop the playout clock if there is nothing to wait for */
+			if (pcm->jitter.jb.frames == 0)
+				io_pcm_jitter_arm(pcm, false);
+			break;
+		}
+
+		if (io_pcm_write_stream(pcm, buffer, len * pcm->channels) <= 0) {
+			io_pcm_jitter_reset(pcm);
+			return;
+		}
+
+	}
+
+	atomic_store_explicit(&pcm->jitter.delay,
+			jitter_buffer_get_delay(&pcm->jitter.jb), memory_order_relaxed);
+
+}
+
+/**
+ * Write PCM signal to the transport PCM FIFO.
+ *
+ * If the jitter buffer is enabled for the given PCM, the signal is queued
+ * in the jitter buffer and it will be written to the FIFO by the playout
+ * clock of the io_poll_and_read_bt() function.
+ *
+ * Note:
+ * This function may temporally re-enable thread cancellation! */
+ssize_t io_pcm_write(
+		struct ba_transport_pcm *pcm,
+		const void *buffer,
+		size_t samples) {
+
+	if (!jitter_buffer_is_initialized(&pcm->jitter.jb))
+		return io_pcm_write_stream(pcm, buffer, samples);
+
+	/* The signal is time-stamped with the arrival time of the BT packet
+	 * it has been decoded from, not with the time of the decoding. */
+	struct timespec ts = pcm->th->bt_rx_ts;
+	if (ts.tv_sec == 0 && ts.tv_nsec == 0)
+		gettimestamp(&ts);
+
+	jitter_buffer_push(&pcm->jitter.jb, buffer, samples / pcm->channels, &ts);
+	atomic_store_explicit(&pcm->jitter.delay,
+			jitter_buffer_get_delay(&pcm->jitter.jb), memory_order_relaxed);
+	io_pcm_jitter_arm(pcm, true);
+
+	return samples;
+}
+
+/**
+ * Fill the gap in the PCM signal caused by lost BT packets.
+ *
+ * The concealed signal is written to the transport PCM FIFO in place of
+ * the lost data, so the client will not run out of samples. In order not
+ * to grow the latency indefinitely, at most IO_PCM_CONCEAL_MAX_MS of the
+ * signal is synthesized, regardless of the number of lost blocks.
+ *
+ * @param pcm Pointer to the transport PCM structure.
+ * @param plc Pointer to the packet loss concealment structure.
+ * @param buffer Address of the buffer which can be used for storing one
+ *   concealed block.
+ * @param blocks The number of lost blocks.
+ * @return On success this function returns the number of samples written
+ *   to the PCM FIFO. Otherwise, -1 is returned and errno is set to indicate
+ *   the error. */
+ssize_t io_pcm_conceal(
+		struct ba_transport_pcm *pcm,
+		struct audio_plc *plc,
+		void *buffer,
+		size_t blocks) {
+
+	const size_t max = (size_t)pcm->sampling * pcm->channels * IO_PCM_CONCEAL_MAX_MS / 1000;
+	size_t total = 0;
+	size_t samples;
+	ssize_t ret;
+
+	while (blocks-- > 0 && total < max &&
+			(samples = audio_plc_conceal(plc, buffer)) > 0) {
+		if ((ret = io_pcm_write(pcm, buffer, samples)) <= 0)
+			return ret;
+		total += samples;
+	}
+
+	if (total > 0) {
+		debug("Concealed PCM samples: %zu", total);
+		atomic_fetch_add_explicit(&pcm->concealed_frames,
+				total / pcm->channels, memory_order_relaxed);
+	}
+
+	return total;
+}
+
+/**
+ * Set up the jitter buffer for the PCM decoded by the given thread.
+ *
+ * The jitter buffer is used for the A2DP sink only, if enabled in the
+ * configuration. This function returns the PCM with the jitter buffer
+ * or NULL if the jitter buffer is not used. */
+static struct ba_transport_pcm *io_poll_jitter_setup(
+		struct io_poll *io,
+		struct ba_transport_thread *th) {
+
+	if (io->jitter_setup)
+		return io->jitter_pcm;
+	io->jitter_setup = true;
+
+	struct ba_transport *t = th->t;
+	if (config.a2dp.jitter_buffer == 0 ||
+			t->type.profile != BA_TRANSPORT_PROFILE_A2DP_SINK ||
+			t->a2dp.pcm.th != th)
+		return NULL;
+
+	if (io_pcm_jitter_init(&t->a2dp.pcm) == -1) {
+		warn("Couldn't initialize jitter buffer: %s", strerror(errno));
+		return NULL;
+	}
+
+	return io->jitter_pcm = &t->a2dp.pcm;
+}
+
+static enum ba_transport_thread_signal io_poll_signal_filter_none(
+		enum ba_transport_thread_signal signal,
+		void *userdata) {
+	(void)userdata;
+	return signal;
+}
+
+/**
+ * Dispatch signal of the back-channel PCM serviced by the duplex thread.
+ *
+ * The back-channel PCM is written by the BT reader callback only, so there
+ * is no state of the music stream which should be affected by its signals. */
+static void io_poll_bc_dispatch_signal(
+		struct ba_transport_pcm *pcm,
+		enum ba_transport_thread_signal signal) {
+	switch (signal) {
+	case BA_TRANSPORT_THREAD_SIGNAL_PCM_CLOSE:
+	case BA_TRANSPORT_THREAD_SIGNAL_PCM_DROP:
+		io_pcm_jitter_reset(pcm);
+		break;
+	case BA_TRANSPORT_THREAD_SIGNAL_PCM_SYNC:
+		/* there is nothing to drain in the capture stream */
+		ba_transport_pcm_drain_complete(pcm);
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * Dispatch all pending transport thread signals of the BT reading loop. */
+static void io_poll_bt_dispatch_signals(
+		struct io_poll *io,
+		struct ba_transport_thread *th,
+		struct ba_transport_pcm *pcm) {
+	io_poll_signal_filter *filter = io->signal.filter != NULL ?
+		io->signal.filter : io_poll_signal_filter_none;
+	enum ba_transport_thread_signal signal;
+	while (ba_transport_thread_signal_recv(th, &signal, NULL) == 0) {
+		if (pcm != NULL && (signal == BA_TRANSPORT_THREAD_SIGNAL_PCM_CLOSE ||
+					signal == BA_TRANSPORT_THREAD_SIGNAL_PCM_DROP))
+			io_pcm_jitter_reset(pcm);
+		filter(signal, io->signal.userdata);
+	}
+}
+
+/**
+ * Get the PCM which is decoded by the given transport thread.
+ *
+ * @return This function returns the PCM written by the given thread or
+ *   NULL if the thread does not write any PCM. */
+static struct ba_transport_pcm *io_thread_get_dec_pcm(
+		struct ba_transport_thread *th) {
+
+	struct ba_transport *t = th->t;
+	struct ba_transport_pcm *pcm = NULL;
+
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP)
+		pcm = t->a2dp.pcm.mode == BA_TRANSPORT_PCM_MODE_SOURCE ?
+			&t->a2dp.pcm : &t->a2dp.pcm_bc;
+	else if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO)
+		pcm = &t->sco.mic_pcm;
+	else if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_BAP)
+		pcm = &t->bap.pcm;
+
+	if (pcm == NULL || pcm->th != th ||
+			pcm->mode != BA_TRANSPORT_PCM_MODE_SOURCE)
+		return NULL;
+	return pcm;
+}
+
+#if ENABLE_IO_URING
+/**
+ * Get the io_uring receive path of the transport thread.
+ *
+ * The ring is created on the first read and it is freed together with
+ * the BT socket duplicate. If the io_uring is not available (e.g. it is
+ * disabled by the kernel or by the seccomp filter), this function returns
+ * NULL and the poll() based receive path is used instead. */
+static struct bt_uring *io_bt_uring_get(
+		struct ba_transport_thread *th,
+		size_t count) {
+
+	if (th->bt_uring_failed || th->bt_fd == -1)
+		return NULL;
+
+	if (th->bt_uring != NULL && th->bt_uring->iov.iov_len >= count)
+		return th->bt_uring;
+
+	bt_uring_free(th->bt_uring);
+	if ((th->bt_uring = bt_uring_new(th->bt_fd, th->event_fd, count)) == NULL) {
+		warn("Couldn't setup io_uring receive path: %s", strerror(errno));
+		th->bt_uring_failed = true;
+	}
+
+	return th->bt_uring;
+}
+
+/**
+ * Wait and read data from the BT transport socket using the io_uring.
+ *
+ * Submission of the receive operation and waiting for its completion (or
+ * for the thread signal) is done with a single system call, instead of the
+ * poll() and recvmsg() pair. */
+static ssize_t io_poll_and_read_bt_uring(
+		struct io_poll *io,
+		struct ba_transport_thread *th,
+		struct ba_transport_pcm *pcm,
+		struct bt_uring *u,
+		void *buffer,
+		size_t count) {
+
+	struct ba_transport_pcm *dec_pcm = io_thread_get_dec_pcm(th);
+	const struct msghdr *msg;
+	int events;
+
+	for (;;) {
+
+		const int timer_fd = pcm != NULL && pcm->jitter.armed ? pcm->jitter.timer_fd : -1;
+
+		/* The io_uring_enter() is not a cancellation point, so check for
+		 * the cancellation explicitly around every wait. The cancellation
+		 * request is followed by the ping signal, which wakes up the wait.
+		 * However, the ping might have been already consumed by the signal
+		 * dispatching, hence the check before the wait. */
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		pthread_testcancel();
+		events = bt_uring_wait(u, timer_fd, io->timeout);
+		pthread_testcancel();
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+		if (events == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		if (events & BT_URING_EVENT_SIGNAL)
+			io_poll_bt_dispatch_signals(io, th, pcm);
+
+		if (events & BT_URING_EVENT_TIMER && pcm != NULL && pcm->jitter.armed)
+			io_pcm_jitter_playout(pcm);
+
+		/* The FIFO is not polled by the io_uring wait, so the backlog is
+		 * flushed (without waiting) every time the thread wakes up. */
+		if (dec_pcm != NULL)
+			io_pcm_flush_backlog(dec_pcm);
+
+		if (events & BT_URING_EVENT_RECV)
+			break;
+
+		/* nothing has been received within the timeout */
+		if (events == 0)
+			return errno = ETIMEDOUT, -1;
+
+	}
+
+	uint32_t drops = th->bt_rxq_drops;
+	struct timespec ts;
+	ssize_t ret;
+
+	if ((ret = bt_uring_recv(u, &msg)) > 0) {
+		io_bt_recv_cmsg(msg, &drops, &ts);
+		ret = MIN((size_t)ret, count);
+		memcpy(buffer, msg->msg_iov->iov_base, ret);
+	}
+
+	return io_bt_read_complete(th, buffer, ret, drops, &ts);
+}
+#endif
+
+/**
+ * Poll and read data from the BT transport socket.
+ *
+ * Note:
+ * This function temporally re-enables thread cancellation! */
+ssize_t io_poll_and_read_bt(
+		struct io_poll *io,
+		struct ba_transport_thread *th,
+		void *buffer,
+		size_t count) {
+
+	struct ba_transport_pcm *pcm = io_poll_jitter_setup(io, th);
+
+#if ENABLE_IO_URING
+	struct bt_uring *u;
+	if (io->receiver == NULL &&
+			(u = io_bt_uring_get(th, count)) != NULL)
+		return io_poll_and_read_bt_uring(io, th, pcm, u, buffer, count);
+#endif
+
+	struct ba_transport_pcm *dec_pcm = io_thread_get_dec_pcm(th);
+
+	/* In the receiver mode the BT socket is drained by the BT reader
+	 * thread, so we have to wait for its notification instead. */
+	struct pollfd fds[4] = {
+		{ th->event_fd, POLLIN, 0 },
+		{ io->receiver != NULL ? io->receiver->event_fd : th->bt_fd, POLLIN, 0 },
+		{ -1, POLLIN, 0 },
+		{ -1, POLLOUT, 0 }};
+	ssize_t ret;
+
+	/* Allow escaping from the poll() by thread cancellation. */
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+
+repoll:
+
+	fds[2].fd = pcm != NULL && pcm->jitter.armed ? pcm->jitter.timer_fd : -1;
+	/* wait for the FIFO space if there are data in the overrun backlog */
+	fds[3].fd = dec_pcm != NULL ? io_pcm_backlog_poll_fd(dec_pcm) : -1;
 
-	/* Poll for reading with optional sync timeout. */
 	switch (poll(fds, ARRAYSIZE(fds), io->timeout)) {
 	case 0:
+		/* nothing has been received within the timeout */
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		return errno = ETIMEDOUT, -1;
+	case -1:
+		if (errno == EINTR)
+			goto repoll;
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		return -1;
+	}
+
+	if (fds[0].revents & POLLIN) {
+		/* dispatch all pending events */
+		io_poll_bt_dispatch_signals(io, th, pcm);
+		goto repoll;
+	}
+
+	if (fds[2].revents & POLLIN) {
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		io_pcm_jitter_playout(pcm);
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		if (!(fds[1].revents & (POLLIN | POLLERR | POLLHUP)))
+			goto repoll;
+	}
+
+	if (fds[3].revents & (POLLOUT | POLLERR | POLLHUP)) {
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		io_pcm_flush_backlog(dec_pcm);
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		if (!(fds[1].revents & (POLLIN | POLLERR | POLLHUP)))
+			goto repoll;
+	}
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+	if (io->receiver == NULL)
+		return io_bt_read(th, buffer, count);
+
+	uint32_t drops = th->bt_rxq_drops;
+	struct timespec ts;
+	if ((ret = io_bt_receiver_read(io->receiver, buffer, count, &drops, &ts)) == -1 &&
+			errno == EAGAIN) {
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		goto repoll;
+	}
+
+	return io_bt_read_complete(th, buffer, ret, drops, &ts);
+}
+
+/**
+ * Prime the encoder with silence at the beginning of the stream.
+ *
+ * The silence is inserted before the data which has been read, so the
+ * buffer will contain a complete codec frame and the first packet can be
+ * sent right away. The synchronization reference time point is moved back
+ * by the duration of the inserted silence, so the transfer pacing will not
+ * be delayed by it.
+ *
+ * @return This function returns the number of samples in the buffer. */
+static size_t io_poll_fast_start(
+		struct io_poll *io,
+		const struct ba_transport_pcm *pcm,
+		void *buffer,
+		size_t samples_read,
+		size_t samples) {
+
+	io->fast_start.primed = true;
+
+	size_t silence = MIN(io->fast_start.samples, samples);
+	if (silence <= samples_read)
+		return samples_read;
+
+	silence -= samples_read;
+	silence -= silence % pcm->channels;
+
+	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->codec_format);
+	memmove((uint8_t *)buffer + silence * sample_size, buffer, samples_read * sample_size);
+	memset(buffer, 0, silence * sample_size);
+
+	const unsigned int frames = silence / pcm->channels;
+	const unsigned int rate = pcm->sampling;
+	const struct timespec ts = {
+		.tv_sec = frames / rate,
+		.tv_nsec = 1000000000L / rate * (frames % rate) };
+	timespecsub(&io->asrs.ts0, &ts, &io->asrs.ts0);
+
+	debug("Fast start: Silence inserted: %u frames", frames);
+	return samples_read + silence;
+}
+
+/**
+ * The peak level (in the 32-bit scale) below which the signal is treated
+ * as a silence. It corresponds to about -78 dBFS, so the dither noise will
+ * not keep the stream running. */
+#define IO_POLL_SILENCE_THRESHOLD (4 << 16)
+
+/**
+ * Resume streaming suspended due to the silence on the PCM input.
+ *
+ * The BlueZ transport acquisition is a blocking D-Bus call, so it is not
+ * made from the IO thread. Instead, the acquisition is requested from the
+ * main loop and the stream is resumed once the BT socket becomes valid.
+ *
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. If the transport acquisition
+ *   is still in progress, errno is set to EAGAIN. */
+static int io_poll_silence_resume(
+		struct io_poll *io,
+		struct ba_transport_pcm *pcm) {
+
+	struct ba_transport_thread *th = pcm->th;
+	struct ba_transport *t = pcm->t;
+
+	pthread_mutex_lock(&t->bt_fd_mtx);
+	const bool acquired = t->bt_fd != -1;
+	pthread_mutex_unlock(&t->bt_fd_mtx);
+
+	if (!acquired) {
+		if (!io->silence.resuming) {
+			debug("Silence detection: Acquiring transport: %d", pcm->fd);
+			ba_transport_acquire_async(t);
+			io->silence.resuming = true;
+		}
+		return errno = EAGAIN, -1;
+	}
+
+	io->silence.resuming = false;
+	if (ba_transport_thread_bt_acquire(th) == -1)
+		return -1;
+
+	debug("Silence detection: Resuming stream: %d", pcm->fd);
+
+	pthread_mutex_lock(&pcm->mutex);
+	pcm->silence_suspended = false;
+	pthread_mutex_unlock(&pcm->mutex);
+
+	io->silence.frames = 0;
+	io->silence.suspended = false;
+	/* restart the transfer synchronization */
+	io->asrs.frames = 0;
+	io->paced = false;
+
+	return 0;
+}
+
+/**
+ * Check the just read PCM signal for the silence.
+ *
+ * When the silence lasts longer than the configured timeout, the BT socket
+ * of the IO thread is released and the transport is scheduled for release
+ * in the same way as when there are no PCM clients. The PCM stays open, so
+ * the streaming is resumed as soon as the client writes non-silent signal.
+ *
+ * @return This function returns true if the signal shall be discarded,
+ *   because the streaming is suspended. */
+static bool io_poll_silence_check(
+		struct io_poll *io,
+		struct ba_transport_pcm *pcm,
+		const void *buffer,
+		size_t samples) {
+
+	uint32_t peak;
+
+	switch (pcm->codec_format) {
+	case BA_TRANSPORT_PCM_FORMAT_S16_2LE:
+		peak = audio_peak_s16_2le(buffer, samples) << 16;
+		break;
+	case BA_TRANSPORT_PCM_FORMAT_S24_4LE:
+		peak = audio_peak_s24_4le(buffer, samples) << 8;
+		break;
+	case BA_TRANSPORT_PCM_FORMAT_S32_4LE:
+		peak = audio_peak_s32_4le(buffer, samples);
+		break;
+	default:
+		return false;
+	}
+
+	if (peak > IO_POLL_SILENCE_THRESHOLD || io->silence.resuming) {
+		io->silence.frames = 0;
+		if (!io->silence.suspended)
+			return false;
+		if (io_poll_silence_resume(io, pcm) == 0)
+			return false;
+		if (errno != EAGAIN)
+			error("Couldn't resume stream: %s", strerror(errno));
+		return true;
+	}
+
+	if (io->silence.suspended)
+		return true;
+
+	io->silence.frames += samples / pcm->channels;
+	if ((uint64_t)io->silence.frames * 1000 <
+			(uint64_t)config.a2dp.silence_timeout * pcm->sampling)
+		return false;
+
+	debug("Silence detection: Suspending stream: %d", pcm->fd);
+
+	pthread_mutex_lock(&pcm->mutex);
+	pcm->silence_suspended = true;
+	pthread_mutex_unlock(&pcm->mutex);
+
+	io->silence.suspended = true;
+	ba_transport_thread_bt_release(pcm->th);
+	ba_transport_stop_if_no_clients(pcm->t);
+
+	/* From now on the signal is discarded in real time. */
+	io->asrs.frames = 0;
+	io->paced = false;
+
+	return true;
+}
+
+/**
+ * Flush the encoder when the PCM FIFO has been drained.
+ *
+ * The encoder transfers data in blocks, so the tail of the stream smaller
+ * than the block would be kept in the encoder buffer forever. In order to
+ * push it out, the buffer is filled with the silence which covers the codec
+ * block and the algorithmic delay of the encoder.
+ *
+ * @return This function returns the number of silence samples stored in
+ *   the buffer. For the compressed PCM formats, it returns zero. */
+static size_t io_poll_drain_flush(
+		struct ba_transport_pcm *pcm,
+		void *buffer,
+		size_t samples) {
+
+	if (BA_TRANSPORT_PCM_FORMAT_IS_COMPRESSED(pcm->format))
+		return 0;
+
+	size_t frames = pcm->block_frames;
+	frames += (size_t)pcm->codec_delay * pcm->sampling / 10000;
+	samples = MIN(samples, frames * pcm->channels);
+	samples -= samples % pcm->channels;
+
+	memset(buffer, 0, samples * BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->codec_format));
+	return samples;
+}
+
+/**
+ * Check whether all encoded data have been sent over the BT link.
+ *
+ * The data is gone when the BT writer thread queue (if any) is empty and
+ * the BT socket output queue is back at its initial level. The output
+ * queue is monitored for A2DP transports only. */
+static bool io_poll_drain_bt_is_empty(
+		struct io_poll *io,
+		struct ba_transport_thread *th) {
+
+	struct ba_transport *t = th->t;
+
+	if (io->pipeline != NULL) {
+		pthread_mutex_lock(&io->pipeline->mutex);
+		const bool empty = io->pipeline->head == io->pipeline->tail;
+		pthread_mutex_unlock(&io->pipeline->mutex);
+		if (!empty)
+			return false;
+	}
+
+	if (!(t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP))
+		return true;
+
+	int queued;
+	if (th->bt_fd == -1 || ioctl(th->bt_fd, TIOCOUTQ, &queued) == -1)
+		return true;
+
+	return abs(t->a2dp.bt_fd_coutq_init - queued) == 0;
+}
+
+/**
+ * Check whether the encoder shall be fed with silence.
+ *
+ * The A2DP stream of the warm device is kept running when there is no PCM
+ * client, so the playback can start right away. */
+static bool io_poll_warm_check(
+		const struct io_poll *io,
+		struct ba_transport_pcm *pcm) {
+	const struct ba_transport *t = pcm->t;
+	return t->type.profile == BA_TRANSPORT_PROFILE_A2DP_SOURCE &&
+		pcm == &t->a2dp.pcm &&
+		!BA_TRANSPORT_PCM_FORMAT_IS_COMPRESSED(pcm->format) &&
+		!io->drain.pending && !io->silence.suspended &&
+		!ba_transport_pcm_is_active(pcm) &&
+		atomic_load_explicit(&t->d->warm, memory_order_relaxed);
+}
+
+/**
+ * Fill the buffer with silence in place of the PCM client data. */
+static size_t io_poll_warm_fill(
+		struct io_poll *io,
+		struct ba_transport_pcm *pcm,
+		void *buffer,
+		size_t samples) {
+
+	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->codec_format);
+	size_t silence = MIN(samples, pcm->sampling * IO_PCM_WARM_FILL_MS / 1000 * pcm->channels);
+	silence -= silence % pcm->channels;
+
+	memset(buffer, 0, silence * sample_size);
+
+	if (io->asrs.frames == 0)
+		asrsync_init(&io->asrs, pcm->sampling);
+
+	return silence;
+}
+
+/**
+ * Poll and read data from the PCM FIFO.
+ *
+ * If the pacing timer has been armed with the io_poll_pace(), this function
+ * keeps reading PCM data into the given buffer until the timer expires, so
+ * the PCM FIFO is drained while waiting for the next transfer deadline.
+ *
+ * Note:
+ * This function temporally re-enables thread cancellation! */
+ssize_t io_poll_and_read_pcm(
+		struct io_poll *io,
+		struct ba_transport_pcm *pcm,
+		void *buffer,
+		size_t samples) {
+
+	struct ba_transport_thread *th = pcm->th;
+	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_IS_COMPRESSED(pcm->format) ?
+		1 : BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->codec_format);
+	/* the PCM FIFO is followed by FIFOs of mixed clients */
+	struct pollfd fds[4 + BA_TRANSPORT_PCM_MIX_CLIENTS_MAX] = {
+		{ th->event_fd, POLLIN, 0 },
+		{ -1, POLLIN, 0 },
+		{ -1, POLLIN, 0 },
+		{ -1, POLLIN, 0 }};
+	size_t nfds;
+	/* samples read while waiting for the pacing timer */
+	size_t samples_paced = 0;
+	/* check whether data are available when the transfer is due */
+	bool underrun_check = io->asrs.frames != 0 && !io->paced && io->timeout == -1 &&
+		!io->drain.pending;
+	/* PCM FIFO has been found empty while draining */
+	bool drain_fifo_empty = false;
+	/* encoder of the warm device is fed with silence */
+	bool warm_fill;
+
+repoll:
+
+	warm_fill = io_poll_warm_check(io, pcm);
+
+	/* Allow escaping from the poll() by thread cancellation. */
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+
+	/* Add PCM socket to the poll if it is active and there is
+	 * still some space left in the buffer. */
+	fds[1].fd = ba_transport_pcm_is_active(pcm) &&
+		samples_paced < samples && !drain_fifo_empty ? pcm->fd : -1;
+	fds[2].fd = io->paced ? th->pacing_timer_fd : -1;
+	fds[3].fd = io->bt.reader != NULL ? th->bt_fd : -1;
+
+	/* Mixed clients shall wake us up as well, since the main client might
+	 * not deliver any data at all. */
+	nfds = 4;
+	if (fds[1].fd != -1) {
+		pthread_mutex_lock(&pcm->mutex);
+		for (size_t i = 0; i < pcm->mix_clients_len; i++)
+			if (pcm->mix_clients[i].fd != -1 && !pcm->mix_clients[i].paused)
+				fds[nfds++] = (struct pollfd){ pcm->mix_clients[i].fd, POLLIN, 0 };
+		pthread_mutex_unlock(&pcm->mutex);
+	}
+
+	/* If the stream is running, the PCM data shall be available right
+	 * away. Otherwise, the client has not delivered data on time. */
+	const bool underrun_probe = underrun_check && fds[1].fd != -1;
+	underrun_check = false;
+
+	int timeout = underrun_probe ? 0 : io->timeout;
+	if (io->drain.pending) {
+		if (io->drain.flushed)
+			timeout = IO_PCM_DRAIN_POLL_MS;
+		else if (drain_fifo_empty)
+			/* flush the encoder when the transfer is due */
+			timeout = io->paced ? -1 : 0;
+		else
+			/* If there is no data available right away, the FIFO is
+			 * empty, because the client has already written all of it. */
+			timeout = fds[1].fd != -1 || !ba_transport_pcm_is_active(pcm) ? 0 : -1;
+	}
+	else if (warm_fill)
+		/* generate silence when the transfer is due */
+		timeout = io->paced ? -1 : 0;
+
+	/* Poll for reading with optional sync timeout. */
+	switch (poll(fds, nfds, timeout)) {
+	case 0:
+		if (underrun_probe) {
+			ba_transport_thread_stats_add(th, underruns, 1);
+			goto repoll;
+		}
 		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-		pthread_cond_signal(&pcm->synced);
+		if (io->drain.pending) {
+			if (!io->drain.flushed) {
+				drain_fifo_empty = true;
+				if (io->paced)
+					goto repoll;
+				const struct timespec ts_timeout = {
+					.tv_sec = IO_PCM_DRAIN_TIMEOUT_MS / 1000,
+					.tv_nsec = (IO_PCM_DRAIN_TIMEOUT_MS % 1000) * 1000000 };
+				io->drain.flushed = true;
+				gettimestamp(&io->drain.deadline);
+				timespecadd(&io->drain.deadline, &ts_timeout, &io->drain.deadline);
+				size_t flushed;
+				if ((flushed = io_poll_drain_flush(pcm, buffer, samples)) > 0)
+					return flushed;
+			}
+			struct timespec now;
+			gettimestamp(&now);
+			if (!io_poll_drain_bt_is_empty(io, th)) {
+				if (timespeccmp(&now, &io->drain.deadline, <))
+					goto repoll;
+				warn("BT queue not drained in %d ms: %d", IO_PCM_DRAIN_TIMEOUT_MS, pcm->fd);
+			}
+			io->drain.pending = false;
+			ba_transport_pcm_drain_complete(pcm);
+			return 0;
+		}
+		if (warm_fill)
+			break;
 		io->timeout = -1;
 		return 0;
 	case -1:
@@ -342,35 +2564,121 @@ repoll:
 	}
 
 	if (fds[0].revents & POLLIN) {
-		/* dispatch incoming event */
+		/* Dispatch all pending events, so a burst of signals will be
+		 * handled within a single wakeup. */
 		io_poll_signal_filter *filter = io->signal.filter != NULL ?
 			io->signal.filter : io_poll_signal_filter_none;
 		enum ba_transport_thread_signal signal;
-		ba_transport_thread_signal_recv(th, &signal);
-		switch (filter(signal, io->signal.userdata)) {
-		case BA_TRANSPORT_THREAD_SIGNAL_PCM_OPEN:
-		case BA_TRANSPORT_THREAD_SIGNAL_PCM_RESUME:
-			io->asrs.frames = 0;
-			io->timeout = -1;
-			goto repoll;
-		case BA_TRANSPORT_THREAD_SIGNAL_PCM_CLOSE:
-			/* reuse PCM read disconnection logic */
-			break;
-		case BA_TRANSPORT_THREAD_SIGNAL_PCM_SYNC:
-			io->timeout = 100;
-			goto repoll;
-		case BA_TRANSPORT_THREAD_SIGNAL_PCM_DROP:
-			io_pcm_flush(pcm);
-			goto repoll;
-		default:
+		struct ba_transport_pcm *signal_pcm;
+		bool closed = false;
+		/* Stop on the PCM close signal, so the close is handled before any
+		 * subsequent signal (e.g. the PCM open by a new client). Remaining
+		 * signals keep the event armed, so they will be handled right away
+		 * in the next poll. */
+		while (!closed && ba_transport_thread_signal_recv(th, &signal, &signal_pcm) == 0) {
+			if (signal_pcm != NULL && signal_pcm != pcm) {
+				/* signal for the back-channel PCM of the duplex thread */
+				io_poll_bc_dispatch_signal(signal_pcm, signal);
+				continue;
+			}
+			switch (filter(signal, io->signal.userdata)) {
+			case BA_TRANSPORT_THREAD_SIGNAL_PCM_OPEN:
+				/* The transport has been acquired by the new client, so the
+				 * suspended streaming can be resumed right away. */
+				io->silence.frames = 0;
+				if (io->silence.suspended) {
+					/* retry the acquisition which might have failed */
+					io->silence.resuming = false;
+					pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+					if (io_poll_silence_resume(io, pcm) == -1 && errno != EAGAIN)
+						error("Couldn't resume stream: %s", strerror(errno));
+					pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+				}
+				/* fall-through */
+			case BA_TRANSPORT_THREAD_SIGNAL_PCM_RESUME:
+				io->asrs.frames = 0;
+				io->paced = false;
+				io->fast_start.primed = false;
+				io->timeout = -1;
+				break;
+			case BA_TRANSPORT_THREAD_SIGNAL_PCM_CLOSE:
+				/* reuse PCM read disconnection logic */
+				closed = true;
+				break;
+			case BA_TRANSPORT_THREAD_SIGNAL_PCM_SYNC:
+				io->drain.pending = true;
+				io->drain.flushed = false;
+				break;
+			case BA_TRANSPORT_THREAD_SIGNAL_PCM_DROP:
+				io_pcm_flush(pcm);
+				samples_paced = 0;
+				break;
+			default:
+				break;
+			}
+		}
+		if (!closed)
 			goto repoll;
+	}
+
+	if (fds[3].revents & (POLLIN | POLLERR | POLLHUP)) {
+		/* Data received from the remote device are handled right away, so
+		 * the incoming stream is not delayed by the outgoing one. */
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		const ssize_t ret = io->bt.reader(th, io->bt.userdata);
+		if (ret == 0 || (ret == -1 && (errno != EAGAIN ||
+						fds[3].revents & (POLLERR | POLLHUP)))) {
+			/* The BT socket is shared by both directions, so the link is not
+			 * usable for the outgoing stream either. Release it, otherwise
+			 * the poll would report the error condition over and over. */
+			error("BT back-channel disconnected: %d", fds[3].fd);
+			ba_transport_thread_bt_release(th);
 		}
+		bool pcm_ready = fds[1].revents & POLLIN;
+		for (size_t i = 4; i < nfds; i++)
+			pcm_ready |= fds[i].revents & (POLLIN | POLLHUP);
+		if (!pcm_ready && !(fds[2].revents & POLLIN))
+			goto repoll;
+	}
+
+	if (fds[2].revents & POLLIN) {
+		/* transfer deadline has been reached */
+		uint64_t expirations;
+		if (read(th->pacing_timer_fd, &expirations, sizeof(expirations)) == -1 &&
+				errno != EAGAIN)
+			warn("Couldn't read pacing timer: %s", strerror(errno));
+		io->paced = false;
 	}
 
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
+	if (ba_transport_thread_bt_coutq_congested(th)) {
+		/* In case of persistent BT congestion, data waiting in the PCM FIFO
+		 * will not be transferred on time anyway. Drop it, so the end-to-end
+		 * latency will not grow, and restart the transfer synchronization. */
+		debug("BT socket congested: Dropping PCM data: %d", pcm->fd);
+		th->bt_coutq.congested = 0;
+		ba_transport_thread_stats_add(th, congestion_drops, 1);
+		io_pcm_flush(pcm);
+		io->asrs.frames = 0;
+		io->paced = false;
+		samples_paced = 0;
+	}
+
+	if (warm_fill) {
+		if (io->paced)
+			goto repoll;
+		return io_poll_warm_fill(io, pcm, buffer, samples);
+	}
+
+	if (!io->paced && samples_paced > 0)
+		return samples_paced;
+	if (samples_paced == samples)
+		goto repoll;
+
 	ssize_t samples_read;
-	if ((samples_read = io_pcm_read(pcm, buffer, samples)) == -1) {
+	if ((samples_read = io_pcm_read(pcm, (uint8_t *)buffer + samples_paced * sample_size,
+					samples - samples_paced)) == -1) {
 		if (errno == EAGAIN)
 			goto repoll;
 		if (errno != EBADFD)
@@ -381,12 +2689,163 @@ repoll:
 	if (samples_read == 0)
 		return 0;
 
+	/* Streaming encoded by the pipeline writer thread is never suspended,
+	 * because the BT socket is used by that thread as well. */
+	if (config.a2dp.silence_timeout > 0 &&
+			io->pipeline == NULL &&
+			pcm->t->type.profile == BA_TRANSPORT_PROFILE_A2DP_SOURCE &&
+			!BA_TRANSPORT_PCM_FORMAT_IS_COMPRESSED(pcm->format) &&
+			io_poll_silence_check(io, pcm,
+				(uint8_t *)buffer + samples_paced * sample_size, samples_read)) {
+		/* Discard the signal in real time, so the client will not notice
+		 * that the streaming has been suspended. */
+		if (io->asrs.frames == 0)
+			asrsync_init(&io->asrs, pcm->sampling);
+		asrsync_sync(&io->asrs, samples_read / pcm->channels);
+		samples_paced = 0;
+		goto repoll;
+	}
+
 	/* When the thread is created, there might be no data in the FIFO. In fact
 	 * there might be no data for a long time - until client starts playback.
 	 * In order to correctly calculate time drift, the zero time point has to
 	 * be obtained after the stream has started. */
-	if (io->asrs.frames == 0)
+	if (io->asrs.frames == 0) {
 		asrsync_init(&io->asrs, pcm->sampling);
+		if (!io->fast_start.primed && samples_paced == 0)
+			samples_read = io_poll_fast_start(io, pcm, buffer, samples_read, samples);
+	}
+
+	if (io->paced) {
+		samples_paced += samples_read;
+		goto repoll;
+	}
 
 	return samples_read;
 }
+
+/**
+ * Get the PCM which is encoded by the given transport thread. */
+static struct ba_transport_pcm *io_thread_get_enc_pcm(
+		struct ba_transport_thread *th) {
+	struct ba_transport *t = th->t;
+	if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_A2DP)
+		return t->a2dp.pcm.th == th ? &t->a2dp.pcm : &t->a2dp.pcm_bc;
+	return &t->sco.spk_pcm;
+}
+
+/**
+ * Update the delay caused by the data queued in the BT socket.
+ *
+ * The number of queued bytes is converted to time with the bit rate of the
+ * encoded stream, which is estimated from the number of bytes written to the
+ * BT socket and the number of PCM frames encoded in at least 100 ms. */
+static void io_poll_update_queue_delay(
+		struct io_poll *io,
+		struct ba_transport_thread *th,
+		struct ba_transport_pcm *pcm,
+		unsigned int frames) {
+
+	const unsigned int tx_bytes = atomic_load_explicit(&th->stats.tx_bytes,
+			memory_order_relaxed);
+
+	if (io->coutq.tx_bytes_valid) {
+		io->coutq.bytes += tx_bytes - io->coutq.tx_bytes;
+		io->coutq.frames += frames;
+	}
+	else
+		/* discard the estimation of the previous stream */
+		atomic_store_explicit(&pcm->queue_delay, 0, memory_order_relaxed);
+
+	io->coutq.tx_bytes = tx_bytes;
+	io->coutq.tx_bytes_valid = true;
+
+	if (io->coutq.frames < pcm->sampling / 10)
+		return;
+
+	if (io->coutq.bytes > 0) {
+		const unsigned int queued = atomic_load_explicit(&th->bt_coutq.queued,
+				memory_order_relaxed);
+		const unsigned int delay = (uint64_t)queued * io->coutq.frames * 10000 /
+			io->coutq.bytes / pcm->sampling;
+		atomic_store_explicit(&pcm->queue_delay, delay, memory_order_relaxed);
+		/* notify clients about significant (10 ms) delay changes only */
+		if (abs((int)delay - (int)io->coutq.delay_notified) >= 100) {
+			bluealsa_dbus_pcm_update(pcm, BA_DBUS_PCM_UPDATE_DELAY);
+			io->coutq.delay_notified = delay;
+		}
+	}
+
+	io->coutq.bytes = 0;
+	io->coutq.frames = 0;
+
+}
+
+/**
+ * Keep data transfer at a constant bit rate.
+ *
+ * If the pacing timer is available, this function does not block. Instead,
+ * it arms the timer and the subsequent io_poll_and_read_pcm() call will not
+ * return until the timer expires.
+ *
+ * @param io Address of the IO polling structure.
+ * @param th Transport thread which owns the IO polling structure.
+ * @param frames Number of frames transferred since the last call.
+ * @return This function returns a positive value or zero respectively for
+ *   the case, when the synchronization was required or not. If an error has
+ *   occurred, -1 is returned and errno is set to indicate the error. */
+int io_poll_pace(
+		struct io_poll *io,
+		struct ba_transport_thread *th,
+		unsigned int frames) {
+
+	struct ba_transport_pcm *pcm = io_thread_get_enc_pcm(th);
+
+	/* Frames have been just written to the BT socket (or queued for the BT
+	 * writer thread), so publish the new presentation position. */
+	ba_transport_pcm_presentation_update(pcm, frames);
+	io_poll_update_queue_delay(io, th, pcm, frames);
+
+	if (io->pipeline != NULL) {
+		/* frames will be synchronized by the BT writer thread */
+		io_bt_pipeline_check_resync(io->pipeline, io);
+		io->pipeline->frames += frames;
+		io->pipeline->frames_total += frames;
+		io->asrs.frames += frames;
+		return 0;
+	}
+
+	int ret;
+	if (th->pacing_timer_fd == -1)
+		ret = asrsync_sync(&io->asrs, frames);
+	else if ((ret = asrsync_sync_timer(&io->asrs, frames, th->pacing_timer_fd)) > 0)
+		io->paced = true;
+
+	if (ret != -1)
+		ba_transport_thread_stats_add_busy(th, &io->asrs.ts_busy);
+	if (ret == 0)
+		ba_transport_thread_stats_add(th, overdue, 1);
+
+	return ret;
+}
+
+/**
+ * Write data to the BT socket directly or via the BT writer thread.
+ *
+ * Note:
+ * This function may temporally re-enable thread cancellation!
+ *
+ * @param io Address of the IO polling structure.
+ * @param th Transport thread which owns the IO polling structure.
+ * @param buffer Address of the data to write.
+ * @param count The number of bytes to write.
+ * @return This function returns values like the io_bt_write(). */
+ssize_t io_poll_bt_write(
+		struct io_poll *io,
+		struct ba_transport_thread *th,
+		const void *buffer,
+		size_t count) {
+	if (io->pipeline != NULL)
+		return io_bt_pipeline_write(io->pipeline, io, buffer, count);
+	return io_bt_write(th, buffer, count);
+}
@@ -16,7 +16,12 @@
 # include <config.h>
 #endif
 
+#include <pthread.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "ba-transport.h"
 #include "shared/rt.h"
@@ -27,6 +32,16 @@ typedef enum ba_transport_thread_signal io_poll_signal_filter(
 		enum ba_transport_thread_signal signal,
 		void *userdata);
 
+/**
+ * Callback function for reading the BT socket while polling the PCM. */
+typedef ssize_t io_poll_bt_reader(
+		struct ba_transport_thread *th,
+		void *userdata);
+
+struct audio_plc;
+struct io_bt_pipeline;
+struct io_bt_receiver;
+
 /**
  * Data associated with IO polling.
  *
@@ -38,12 +53,87 @@ struct io_poll {
 		io_poll_signal_filter *filter;
 		void *userdata;
 	} signal;
+	struct {
+		/* BT socket reading callback used by the duplex IO threads */
+		io_poll_bt_reader *reader;
+		void *userdata;
+	} bt;
 	/* transfer bit rate synchronization */
 	struct asrsync asrs;
+	/* pacing timer has been armed */
+	bool paced;
+	/* optional BT writer thread */
+	struct io_bt_pipeline *pipeline;
+	/* optional BT reader thread */
+	struct io_bt_receiver *receiver;
+	struct {
+		/* number of silence samples used for priming */
+		size_t samples;
+		/* priming has been done for the current stream */
+		bool primed;
+	} fast_start;
 	/* keep-alive and sync timeout */
 	int timeout;
+	struct {
+		/* PCM drain has been requested */
+		bool pending;
+		/* encoder has been flushed, waiting for the BT queue */
+		bool flushed;
+		/* give up waiting for the BT queue after this time */
+		struct timespec deadline;
+	} drain;
+	struct {
+		/* number of consecutive silent frames */
+		unsigned int frames;
+		/* streaming has been suspended */
+		bool suspended;
+		/* transport acquisition has been requested */
+		bool resuming;
+	} silence;
+	/* BT socket output queue delay estimation */
+	struct {
+		/* the value of the BT writes statistics counter */
+		unsigned int tx_bytes;
+		bool tx_bytes_valid;
+		/* bytes written and frames encoded in the current window */
+		unsigned int bytes;
+		unsigned int frames;
+		/* delay reported with the last D-Bus update */
+		unsigned int delay_notified;
+	} coutq;
+	/* jitter buffer of the decoded signal has been set up */
+	bool jitter_setup;
+	struct ba_transport_pcm *jitter_pcm;
 };
 
+/**
+ * The maximal number of packets in the BT write batch. */
+#define IO_BT_BATCH_SIZE 16
+
+/**
+ * Batch of BT packets which shall be written with a single system call.
+ *
+ * Every packet consists of an optional header and a payload. Both of them
+ * are referenced, not copied, so the memory has to be valid until the
+ * batch is written. */
+struct io_bt_batch {
+	struct mmsghdr msgs[IO_BT_BATCH_SIZE];
+	struct iovec iov[IO_BT_BATCH_SIZE][2];
+	/* number of queued packets */
+	size_t len;
+};
+
+/**
+ * Check whether there is no room for another packet in the batch. */
+#define io_bt_batch_is_full(b) ((b)->len == IO_BT_BATCH_SIZE)
+
+void io_bt_batch_add(
+		struct io_bt_batch *batch,
+		const void *header,
+		size_t header_len,
+		const void *payload,
+		size_t payload_len);
+
 ssize_t io_bt_read(
 		struct ba_transport_thread *th,
 		void *buffer,
@@ -54,6 +144,167 @@ ssize_t io_bt_write(
 		const void *buffer,
 		size_t count);
 
+ssize_t io_bt_write_batch(
+		struct ba_transport_thread *th,
+		struct io_bt_batch *batch);
+
+/**
+ * The maximal number of packets queued for the BT writer thread. */
+#define IO_BT_PIPELINE_SIZE 4
+
+/**
+ * BT writer thread with a bounded packet queue.
+ *
+ * In the pipelined mode, encoded packets are copied into the queue and
+ * written to the BT socket by a dedicated thread, which also keeps the
+ * transfer at a constant bit rate. The IO thread is then free to read and
+ * encode the next packet while the writer waits for the next deadline. */
+struct io_bt_pipeline {
+
+	struct ba_transport_thread *th;
+	pthread_t writer;
+	bool running;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t changed;
+
+	struct {
+		uint8_t *data;
+		size_t len;
+		/* frames transferred before this packet */
+		unsigned int frames;
+		/* restart transfer synchronization */
+		bool resync;
+	} packets[IO_BT_PIPELINE_SIZE];
+	size_t packet_size;
+	/* monotonic read and write positions */
+	size_t head;
+	size_t tail;
+
+	/* result of the last BT write and its error code */
+	ssize_t writer_ret;
+	int writer_err;
+	/* writer side transfer synchronization */
+	struct asrsync asrs;
+
+	/* frames to be attached to the next packet */
+	unsigned int frames;
+	/* copy of the IO polling frame counter */
+	uint32_t frames_total;
+	bool resync;
+
+};
+
+int io_bt_pipeline_init(
+		struct io_bt_pipeline *p,
+		struct ba_transport_thread *th,
+		size_t packet_size);
+void io_bt_pipeline_free(
+		struct io_bt_pipeline *p);
+
+/**
+ * The maximal number of packets queued by the BT reader thread. */
+#define IO_BT_RECEIVER_SIZE 32
+
+/**
+ * BT reader thread with a packet queue.
+ *
+ * In the receiver mode, the BT socket is drained by a dedicated thread, so
+ * the socket receive queue does not overflow when the IO thread is blocked
+ * by a slow PCM client. If the queue is full, the oldest packet is dropped
+ * and the gap is concealed by the decoder, exactly as if the packet has
+ * been lost on the air. */
+struct io_bt_receiver {
+
+	struct ba_transport_thread *th;
+	pthread_t reader;
+	bool running;
+
+	pthread_mutex_t mutex;
+	/* notification for the IO thread polling */
+	int event_fd;
+
+	/* One extra slot is reserved for the packet which is being read, so
+	 * the reader never writes into the packet seen by the IO thread. */
+	struct {
+		uint8_t *data;
+		size_t len;
+		/* packet arrival time */
+		struct timespec ts;
+	} packets[IO_BT_RECEIVER_SIZE + 1];
+	size_t packet_size;
+	/* monotonic read and write positions */
+	size_t head;
+	size_t tail;
+
+	/* result of the last BT read and its error code */
+	ssize_t reader_ret;
+	int reader_err;
+	/* number of packets dropped due to the queue overflow */
+	unsigned int dropped;
+	/* kernel receive queue drop counter of the last packet */
+	uint32_t drops;
+
+};
+
+int io_bt_receiver_init(
+		struct io_bt_receiver *r,
+		struct ba_transport_thread *th,
+		size_t packet_size);
+void io_bt_receiver_free(
+		struct io_bt_receiver *r);
+
+/**
+ * The number of writes for which the ABR value is not changed after it
+ * has been lowered due to the BT congestion. */
+#define IO_BT_ABR_HOLD_WRITES 10
+
+/**
+ * The number of consecutive writes with an empty BT socket output queue
+ * required for raising the ABR value. */
+#define IO_BT_ABR_RAISE_WRITES 100
+
+/**
+ * Codec-neutral adaptive bit rate controller.
+ *
+ * The controlled value (e.g. SBC bit-pool or AAC bit rate) is lowered
+ * by one step when the BT socket output queue gets congested, and it is
+ * raised by one step after a number of consecutive uncongested writes.
+ *
+ * In the battery saver mode, the value is additionally capped, regardless
+ * of whether the adaptation itself is enabled or not. */
+struct io_bt_abr {
+	/* range of the controlled value */
+	unsigned int min;
+	unsigned int max;
+	/* the maximal value in the battery saver mode */
+	unsigned int max_low_power;
+	/* the adjustment step */
+	unsigned int step;
+	/* current value */
+	unsigned int value;
+	/* number of consecutive uncongested writes */
+	unsigned int clean;
+	/* number of writes to skip after lowering the value */
+	unsigned int hold;
+};
+
+void io_bt_abr_init(
+		struct io_bt_abr *abr,
+		unsigned int min,
+		unsigned int max,
+		unsigned int step);
+
+/**
+ * Set the maximal value used in the battery saver mode. */
+#define io_bt_abr_set_low_power(abr, value) \
+	((abr)->max_low_power = MAX(MIN(value, (abr)->max), (abr)->min))
+
+bool io_bt_abr_update(
+		struct io_bt_abr *abr,
+		const struct ba_transport_thread *th,
+		bool adaptive);
+
 void io_pcm_scale(
 		const struct ba_transport_pcm *pcm,
 		void *buffer,
@@ -72,6 +323,44 @@ ssize_t io_pcm_write(
 		const void *buffer,
 		size_t samples);
 
+/**
+ * The maximal duration of the signal synthesized by the packet loss
+ * concealment for a single gap, in milliseconds. */
+#define IO_PCM_CONCEAL_MAX_MS 200
+
+/**
+ * Interval in milliseconds at which the BT socket output queue is checked
+ * while waiting for the PCM drain completion. */
+#define IO_PCM_DRAIN_POLL_MS 5
+
+/**
+ * The maximal time in milliseconds for which the PCM drain waits for the
+ * BT socket output queue to become empty. */
+#define IO_PCM_DRAIN_TIMEOUT_MS 1000
+
+/**
+ * The duration of the silence in milliseconds read at once by the encoder
+ * of the warm device when there is no PCM client. It limits the latency
+ * of the playback start, because the silence is encoded before the data
+ * written by the newly connected client. */
+#define IO_PCM_WARM_FILL_MS 10
+
+/**
+ * The capacity of the PCM overrun backlog buffer in milliseconds. With the
+ * drop-oldest policy, this is the maximal amount of the signal which is
+ * kept in the daemon for the client which does not keep up. */
+#define IO_PCM_OVERRUN_BACKLOG_MS 200
+
+/**
+ * The playout period of the jitter buffer in milliseconds. */
+#define IO_PCM_JITTER_PERIOD_MS 10
+
+ssize_t io_pcm_conceal(
+		struct ba_transport_pcm *pcm,
+		struct audio_plc *plc,
+		void *buffer,
+		size_t blocks);
+
 ssize_t io_poll_and_read_bt(
 		struct io_poll *io,
 		struct ba_transport_thread *th,
@@ -84,4 +373,15 @@ ssize_t io_poll_and_read_pcm(
 		void *buffer,
 		size_t samples);
 
+int io_poll_pace(
+		struct io_poll *io,
+		struct ba_transport_thread *th,
+		unsigned int frames);
+
+ssize_t io_poll_bt_write(
+		struct io_poll *io,
+		struct ba_transport_thread *th,
+		const void *buffer,
+		size_t count);
+
 #endif
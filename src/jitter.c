@@ -0,0 +1,355 @@
+/*
+ * BlueALSA - jitter.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "jitter.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "shared/defs.h"
+#include "shared/log.h"
+
+/**
+ * Initialize jitter buffer.
+ *
+ * @param jb Pointer to the jitter buffer structure.
+ * @param frame_size The size of a single PCM frame in bytes.
+ * @param rate The sampling frequency.
+ * @param target_ms The minimal target latency in milliseconds. It shall
+ *   not exceed the JITTER_BUFFER_MAX_MS value.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int jitter_buffer_init(struct jitter_buffer *jb, size_t frame_size,
+		unsigned int rate, unsigned int target_ms) {
+
+	jitter_buffer_free(jb);
+
+	if (frame_size == 0 || rate == 0 ||
+			target_ms == 0 || target_ms > JITTER_BUFFER_MAX_MS)
+		return errno = EINVAL, -1;
+
+	/* leave room for bursts on top of the maximal latency */
+	const size_t capacity = 2 * (size_t)rate * JITTER_BUFFER_MAX_MS / 1000;
+	if ((jb->data = malloc(capacity * frame_size)) == NULL)
+		return -1;
+
+	jb->capacity = capacity;
+	jb->frame_size = frame_size;
+	jb->rate = rate;
+	jb->target_min = rate * target_ms / 1000;
+	jb->target = jb->target_min;
+	jb->jitter = 0;
+	jb->underruns = 0;
+	jb->overflows = 0;
+	jb->drift_frames = 0;
+	jb->clock.started = false;
+	jb->clock.valid = false;
+
+	jitter_buffer_reset(jb);
+	return 0;
+}
+
+/**
+ * Free jitter buffer resources. */
+void jitter_buffer_free(struct jitter_buffer *jb) {
+	free(jb->data);
+	jb->data = NULL;
+}
+
+/**
+ * Discard buffered signal.
+ *
+ * The inter-arrival jitter estimation and the target latency are kept,
+ * because they describe the link rather than the stream. */
+void jitter_buffer_reset(struct jitter_buffer *jb) {
+	jb->head = 0;
+	jb->frames = 0;
+	jb->playing = false;
+	jb->frames_last = 0;
+	jb->level = 0;
+	jb->drift_hold = JITTER_BUFFER_DRIFT_HOLD;
+}
+
+/**
+ * Get the latency of the buffered signal in 1/10 of millisecond. */
+unsigned int jitter_buffer_get_delay(const struct jitter_buffer *jb) {
+	return jb->frames * 10000 / jb->rate;
+}
+
+/**
+ * Update the inter-arrival jitter estimation and the target latency. */
+static void jitter_buffer_update_target(struct jitter_buffer *jb,
+		const struct timespec *ts) {
+
+	const unsigned int target_max = jb->rate * JITTER_BUFFER_MAX_MS / 1000;
+
+	/* The expected time between two consecutive arrivals is the duration
+	 * of the previously delivered signal. The difference is the variation
+	 * of the transit time, which is smoothed with the 1/16 gain. */
+	const int64_t elapsed = (int64_t)(ts->tv_sec - jb->ts_last.tv_sec) * jb->rate +
+		(int64_t)(ts->tv_nsec - jb->ts_last.tv_nsec) * jb->rate / 1000000000;
+
+	/* skip the estimation after the stream has been paused */
+	if (elapsed < 0 || elapsed > (int64_t)target_max)
+		return;
+
+	const int64_t d = llabs(elapsed - (int64_t)jb->frames_last) * 16;
+	jb->jitter += (d - (int64_t)jb->jitter) / 16;
+
+	/* Four times the jitter covers almost all arrivals for the typical
+	 * distribution of the transit time variations. */
+	unsigned int target = MAX(jb->target_min, jb->jitter / 16 * 4);
+	target = MIN(target, target_max);
+
+	if (target != jb->target)
+		debug("Jitter buffer target latency: %u.%u ms",
+				target * 1000 / jb->rate, target * 10000 / jb->rate % 10);
+	jb->target = target;
+
+}
+
+/**
+ * Update the source clock estimation.
+ *
+ * Arrival times of the signal are compared with the duration of the signal
+ * delivered so far. For every window the lowest difference (i.e. the least
+ * delayed arrival) is taken and the slope of these values gives the drift
+ * of the source clock. */
+static void jitter_buffer_update_clock(struct jitter_buffer *jb,
+		const struct timespec *ts, size_t frames) {
+
+	const int64_t window_ns = (int64_t)JITTER_BUFFER_CLOCK_WINDOW_MS * 1000000;
+	const int64_t target_max_ns = (int64_t)JITTER_BUFFER_MAX_MS * 1000000;
+
+	/* restart the estimation after the stream has been paused */
+	if (jb->clock.started) {
+		const int64_t gap = (int64_t)(ts->tv_sec - jb->ts_last.tv_sec) * 1000000000 +
+			(ts->tv_nsec - jb->ts_last.tv_nsec);
+		if (gap < 0 || gap > target_max_ns)
+			jb->clock.started = false;
+	}
+
+	if (!jb->clock.started) {
+		jb->clock.started = true;
+		jb->clock.anchor = *ts;
+		jb->clock.frames = frames;
+		jb->clock.window = 0;
+		jb->clock.offset_min = 0;
+		jb->clock.valid = false;
+		jb->clock.drift = 0;
+		return;
+	}
+
+	const int64_t elapsed = (int64_t)(ts->tv_sec - jb->clock.anchor.tv_sec) * 1000000000 +
+		(ts->tv_nsec - jb->clock.anchor.tv_nsec);
+	const int64_t offset = elapsed - (int64_t)(jb->clock.frames * 1000000000 / jb->rate);
+	const unsigned int window = elapsed / window_ns;
+	jb->clock.frames += frames;
+
+	if (window == jb->clock.window) {
+		jb->clock.offset_min = MIN(jb->clock.offset_min, offset);
+		return;
+	}
+
+	if (jb->clock.window == 0)
+		jb->clock.offset_base = jb->clock.offset_min;
+	else if (jb->clock.window >= JITTER_BUFFER_CLOCK_WINDOWS_MIN - 1) {
+		const int ppm = (jb->clock.offset_base - jb->clock.offset_min) * 1000000 /
+			((int64_t)jb->clock.window * window_ns);
+		if (!jb->clock.valid || ppm != jb->clock.ppm)
+			debug("Jitter buffer source clock drift: %+d ppm", ppm);
+		jb->clock.ppm = ppm;
+		jb->clock.valid = true;
+	}
+
+	jb->clock.window = window;
+	jb->clock.offset_min = offset;
+
+}
+
+/**
+ * Copy frames from the ring buffer, starting at the given offset from the
+ * oldest frame. */
+static void jitter_buffer_copy_out(const struct jitter_buffer *jb, void *buffer,
+		size_t offset, size_t frames) {
+	const size_t pos = (jb->head + offset) % jb->capacity;
+	const size_t n = MIN(frames, jb->capacity - pos);
+	memcpy(buffer, jb->data + pos * jb->frame_size, n * jb->frame_size);
+	memcpy((uint8_t *)buffer + n * jb->frame_size, jb->data, (frames - n) * jb->frame_size);
+}
+
+/**
+ * Discard the given number of the oldest frames. */
+static void jitter_buffer_shift(struct jitter_buffer *jb, size_t frames) {
+	jb->head = (jb->head + frames) % jb->capacity;
+	jb->frames -= frames;
+}
+
+/**
+ * Push PCM signal into the jitter buffer.
+ *
+ * If there is not enough space in the buffer, the oldest frames are
+ * discarded, so the buffer will always contain the most recent signal.
+ *
+ * @param jb Pointer to the jitter buffer structure.
+ * @param buffer Address of the PCM signal.
+ * @param frames The number of frames in the buffer.
+ * @param ts The arrival time of the signal.
+ * @return This function returns the number of pushed frames. */
+size_t jitter_buffer_push(struct jitter_buffer *jb, const void *buffer,
+		size_t frames, const struct timespec *ts) {
+
+	const size_t frame_size = jb->frame_size;
+	const uint8_t *src = buffer;
+
+	if (jb->frames_last > 0)
+		jitter_buffer_update_target(jb, ts);
+	jitter_buffer_update_clock(jb, ts, frames);
+	jb->ts_last = *ts;
+	jb->frames_last = frames;
+
+	if (frames > jb->capacity) {
+		src += (frames - jb->capacity) * frame_size;
+		frames = jb->capacity;
+		jitter_buffer_shift(jb, jb->frames);
+		jb->overflows++;
+	}
+
+	if (frames > jb->capacity - jb->frames) {
+		jitter_buffer_shift(jb, frames - (jb->capacity - jb->frames));
+		jb->overflows++;
+	}
+
+	const size_t pos = (jb->head + jb->frames) % jb->capacity;
+	const size_t n = MIN(frames, jb->capacity - pos);
+	memcpy(jb->data + pos * frame_size, src, n * frame_size);
+	memcpy(jb->data, src + n * frame_size, (frames - n) * frame_size);
+	jb->frames += frames;
+
+	return frames;
+}
+
+/**
+ * Get the number of pulls until the next level driven compensation step.
+ *
+ * The hold period is inversely proportional to the deviation of the buffer
+ * level from the target. */
+static unsigned int jitter_buffer_drift_hold(size_t deviation, size_t tolerance) {
+	return JITTER_BUFFER_DRIFT_HOLD * tolerance / MAX(deviation, tolerance);
+}
+
+/**
+ * Get the drift compensation step based on the source clock estimation.
+ *
+ * @return This function returns -1 if a frame shall be dropped, 1 if a frame
+ *   shall be duplicated and 0 otherwise. */
+static int jitter_buffer_clock_step(struct jitter_buffer *jb, size_t frames) {
+
+	if (!jb->clock.valid || abs(jb->clock.ppm) < JITTER_BUFFER_CLOCK_PPM_MIN)
+		return 0;
+
+	jb->clock.drift += (int64_t)jb->clock.ppm * frames;
+
+	if (jb->clock.drift >= 1000000) {
+		jb->clock.drift -= 1000000;
+		return -1;
+	}
+	if (jb->clock.drift <= -1000000) {
+		jb->clock.drift += 1000000;
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Pull PCM signal from the jitter buffer.
+ *
+ * This function shall be called by the playout clock with the constant
+ * number of frames.
+ *
+ * @param jb Pointer to the jitter buffer structure.
+ * @param buffer Address of the buffer where the signal shall be stored.
+ * @param frames The number of frames to pull.
+ * @return This function returns the number of pulled frames. It might be
+ *   less than requested in case of an underrun. If the buffer is waiting
+ *   for the signal to reach the target latency, 0 is returned. */
+size_t jitter_buffer_pull(struct jitter_buffer *jb, void *buffer,
+		size_t frames) {
+
+	uint8_t *dst = buffer;
+
+	if (!jb->playing) {
+		if (jb->frames < MAX((size_t)jb->target, frames))
+			return 0;
+		jb->playing = true;
+		jb->level = jb->frames * 16;
+		jb->drift_hold = JITTER_BUFFER_DRIFT_HOLD;
+	}
+
+	jb->level += ((int64_t)jb->frames * 16 - (int64_t)jb->level) / 16;
+
+	/* The buffer level may fluctuate by the playout period and by the
+	 * arrival jitter, only the drift above this range is compensated. */
+	const size_t tolerance = frames + jb->jitter / 16;
+	const size_t level = jb->level / 16;
+
+	/* Once the source clock drift estimation is reliable, the drift is
+	 * compensated at the estimated rate, so the buffer level does not have
+	 * to deviate from the target first. The step is skipped if the level
+	 * is already off in the opposite direction - the estimation error is
+	 * corrected by the level driven steps. */
+	int step = jitter_buffer_clock_step(jb, frames);
+	if ((step < 0 && level + tolerance < jb->target) ||
+			(step > 0 && level > jb->target + tolerance))
+		step = 0;
+
+	if (step == 0) {
+		if (jb->drift_hold > 0)
+			jb->drift_hold--;
+		else if (level > jb->target + tolerance) {
+			jb->drift_hold = jitter_buffer_drift_hold(level - jb->target, tolerance);
+			step = -1;
+		}
+		else if (level + tolerance < jb->target) {
+			jb->drift_hold = jitter_buffer_drift_hold(jb->target - level, tolerance);
+			step = 1;
+		}
+	}
+
+	if (step < 0 && jb->frames > frames) {
+		/* remote clock is faster: drop the oldest frame */
+		jb->drift_frames--;
+		jitter_buffer_shift(jb, 1);
+	}
+	else if (step > 0 && jb->frames >= frames && frames > 1) {
+		/* remote clock is slower: duplicate the oldest frame */
+		jb->drift_frames++;
+		jitter_buffer_copy_out(jb, dst, 0, 1);
+		dst += jb->frame_size;
+		frames--;
+	}
+
+	if (jb->frames < frames) {
+		debug("Jitter buffer underrun: %zu < %zu", jb->frames, frames);
+		jb->underruns++;
+		jb->playing = false;
+		frames = jb->frames;
+	}
+
+	jitter_buffer_copy_out(jb, dst, 0, frames);
+	jitter_buffer_shift(jb, frames);
+	dst += frames * jb->frame_size;
+
+	return (dst - (uint8_t *)buffer) / jb->frame_size;
+}
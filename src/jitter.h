@@ -0,0 +1,129 @@
+/*
+ * BlueALSA - jitter.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_JITTER_H_
+#define BLUEALSA_JITTER_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * The maximal latency of the jitter buffer in milliseconds. The adaptive
+ * target latency will not exceed this value, regardless of the observed
+ * inter-arrival jitter. */
+#define JITTER_BUFFER_MAX_MS 500
+
+/**
+ * The maximal number of pulls between consecutive drift compensation steps
+ * driven by the buffer level. Every step drops or duplicates a single frame.
+ * The actual hold period is shortened proportionally to the deviation of the
+ * buffer level from the target, so the compensation rate follows the drift
+ * instead of being limited to 1 frame per 100 pulls. */
+#define JITTER_BUFFER_DRIFT_HOLD 100
+
+/**
+ * The length of the source clock estimation window in milliseconds. The
+ * earliest arrival in every window is taken as the reference point, so the
+ * estimation is not affected by the packets delayed on the way. */
+#define JITTER_BUFFER_CLOCK_WINDOW_MS 2000
+
+/**
+ * The number of estimation windows after which the source clock estimation
+ * is considered to be reliable. */
+#define JITTER_BUFFER_CLOCK_WINDOWS_MIN 5
+
+/**
+ * The minimal estimated clock drift in ppm which is compensated at the
+ * estimated rate. Below this value the drift compensation relies solely on
+ * the buffer level. */
+#define JITTER_BUFFER_CLOCK_PPM_MIN 20
+
+/**
+ * Jitter buffer of the decoded PCM signal.
+ *
+ * PCM signal which arrives in bursts is buffered and pulled by the playout
+ * clock in equal periods. The playout starts (and restarts after underrun)
+ * when the buffer is filled up to the target latency. The target latency is
+ * adjusted according to the inter-arrival jitter estimated in the same way
+ * as the RTP interarrival jitter (RFC 3550). The clock drift between the
+ * remote device and the playout clock is compensated by dropping or
+ * duplicating single frames, so the buffer level stays around the target. */
+struct jitter_buffer {
+	/* ring buffer of the signal (frames x channels) */
+	uint8_t *data;
+	/* the position of the oldest frame in the ring */
+	size_t head;
+	/* the number of buffered frames and the capacity in frames */
+	size_t frames;
+	size_t capacity;
+	/* the size of a single frame in bytes */
+	size_t frame_size;
+	unsigned int rate;
+	/* configured and current target latency in frames */
+	unsigned int target_min;
+	unsigned int target;
+	/* the playout is in progress */
+	bool playing;
+	/* the arrival time and the size of the last push */
+	struct timespec ts_last;
+	size_t frames_last;
+	/* inter-arrival jitter estimation in frames scaled by 16 */
+	unsigned int jitter;
+	/* buffer level average in frames scaled by 16 */
+	unsigned int level;
+	/* pulls until the next drift compensation step */
+	unsigned int drift_hold;
+	/* Source clock estimation based on the arrival times. The offset is the
+	 * difference between the arrival time and the duration of the signal
+	 * delivered since the anchor arrival. */
+	struct {
+		bool started;
+		struct timespec anchor;
+		uint64_t frames;
+		unsigned int window;
+		/* the lowest offset in the first and in the current window (ns) */
+		int64_t offset_base;
+		int64_t offset_min;
+		/* estimated drift of the source clock in ppm - positive value means
+		 * that the source clock is faster than the local one */
+		int ppm;
+		bool valid;
+		/* drift accumulated since the last step in frames scaled by 10^6 */
+		int64_t drift;
+	} clock;
+	/* statistics */
+	unsigned int underruns;
+	unsigned int overflows;
+	int drift_frames;
+};
+
+int jitter_buffer_init(struct jitter_buffer *jb, size_t frame_size,
+		unsigned int rate, unsigned int target_ms);
+void jitter_buffer_free(struct jitter_buffer *jb);
+void jitter_buffer_reset(struct jitter_buffer *jb);
+
+/**
+ * Check whether the jitter buffer has been initialized. */
+#define jitter_buffer_is_initialized(jb) ((jb)->data != NULL)
+
+unsigned int jitter_buffer_get_delay(const struct jitter_buffer *jb);
+
+size_t jitter_buffer_push(struct jitter_buffer *jb, const void *buffer,
+		size_t frames, const struct timespec *ts);
+size_t jitter_buffer_pull(struct jitter_buffer *jb, void *buffer,
+		size_t frames);
+
+#endif
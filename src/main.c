@@ -12,6 +12,7 @@
 # include <config.h>
 #endif
 
+#include <errno.h>
 #include <getopt.h>
 #include <signal.h>
 #include <stdbool.h>
@@ -20,6 +21,7 @@
 #include <string.h>
 #include <strings.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <gio/gio.h>
 #include <glib-unix.h>
@@ -30,15 +32,21 @@
 #endif
 
 #include "a2dp.h"
+#include "a2dp-policy.h"
 #include "audio.h"
 #include "bluealsa.h"
 #include "bluealsa-dbus.h"
 #include "bluealsa-iface.h"
 #include "bluez.h"
+#include "codec-calibrate.h"
+#include "codec-plugin.h"
 #include "codec-sbc.h"
+#include "jitter.h"
+#include "metrics.h"
 #if ENABLE_OFONO
 # include "ofono.h"
 #endif
+#include "storage.h"
 #include "utils.h"
 #if ENABLE_UPOWER
 # include "upower.h"
@@ -60,7 +68,7 @@ static char *get_a2dp_codecs(
 		const struct a2dp_codec **codecs,
 		enum a2dp_dir dir) {
 
-	const char *tmp[16] = { NULL };
+	const char *tmp[A2DP_CODECS_MAX + 1] = { NULL };
 	int i = 0;
 
 	while (*codecs != NULL) {
@@ -100,14 +108,39 @@ int main(int argc, char **argv) {
 		{ "profile", required_argument, NULL, 'p' },
 		{ "initial-volume", required_argument, NULL, 17 },
 		{ "keep-alive", required_argument, NULL, 8 },
+		{ "timer-pacing", no_argument, NULL, 19 },
+		{ "resampler", required_argument, NULL, 24 },
+		{ "dbus-update-interval", required_argument, NULL, 27 },
+		{ "pcm-overrun", required_argument, NULL, 40 },
+		{ "bt-capture", required_argument, NULL, 34 },
+		{ "metrics", optional_argument, NULL, 41 },
+		{ "codec-calibrate", no_argument, NULL, 42 },
 		{ "a2dp-force-mono", no_argument, NULL, 6 },
 		{ "a2dp-force-audio-cd", no_argument, NULL, 7 },
 		{ "a2dp-volume", no_argument, NULL, 9 },
+		{ "a2dp-abr", no_argument, NULL, 20 },
+		{ "a2dp-pipeline", optional_argument, NULL, 21 },
+		{ "a2dp-receiver", no_argument, NULL, 38 },
+		{ "a2dp-battery-saver", required_argument, NULL, 39 },
+		{ "a2dp-fast-start", no_argument, NULL, 22 },
+		{ "a2dp-auto-codec", no_argument, NULL, 31 },
+		{ "a2dp-mixer", no_argument, NULL, 32 },
+		{ "a2dp-monitor", no_argument, NULL, 43 },
+		{ "a2dp-jitter-buffer", required_argument, NULL, 33 },
+		{ "a2dp-silence-timeout", required_argument, NULL, 35 },
+		{ "a2dp-duplex", no_argument, NULL, 36 },
+		{ "a2dp-plugin", required_argument, NULL, 37 },
+		{ "a2dp-sched", required_argument, NULL, 25 },
+		{ "sco-sched", required_argument, NULL, 26 },
+		{ "sco-duplex", no_argument, NULL, 28 },
+		{ "sco-aec", no_argument, NULL, 29 },
+		{ "sco-offload", no_argument, NULL, 30 },
 		{ "sbc-quality", required_argument, NULL, 14 },
 #if ENABLE_AAC
 		{ "aac-afterburner", no_argument, NULL, 4 },
 		{ "aac-latm-version", required_argument, NULL, 15 },
 		{ "aac-vbr-mode", required_argument, NULL, 5 },
+		{ "aac-low-delay", no_argument, NULL, 23 },
 #endif
 #if ENABLE_LDAC
 		{ "ldac-abr", no_argument, NULL, 10 },
@@ -163,14 +196,39 @@ int main(int argc, char **argv) {
 					"  -p, --profile=NAME\tenable BT profile\n"
 					"  --initial-volume=NB\tinitial volume level [0-100]\n"
 					"  --keep-alive=SEC\tkeep Bluetooth transport alive\n"
+					"  --timer-pacing\t\tuse timer for transfer pacing\n"
+					"  --resampler=NAME\tset PCM resampler quality\n"
+					"  --dbus-update-interval=MSEC\tmerge PCM updates\n"
+					"  --pcm-overrun=POLICY\thandle slow PCM clients\n"
+					"  --bt-capture=DIR\tcapture BT traffic to pcap files\n"
+					"  --metrics[=FILE]\tpublish IO statistics in a file\n"
+					"  --codec-calibrate\tadjust encoders to the host CPU\n"
 					"  --a2dp-force-mono\tforce monophonic sound\n"
 					"  --a2dp-force-audio-cd\tforce 44.1 kHz sampling\n"
 					"  --a2dp-volume\t\tnative volume control by default\n"
+					"  --a2dp-abr\t\tadaptive bit rate for SBC and AAC\n"
+					"  --a2dp-pipeline[=CPU]\tseparate encoding and BT writing\n"
+					"  --a2dp-receiver\tseparate BT reading and decoding\n"
+					"  --a2dp-battery-saver=PERCENT\tlower encoder cost on low battery\n"
+					"  --a2dp-fast-start\tsend first packet without delay\n"
+					"  --a2dp-auto-codec\tswitch codec on link degradation\n"
+					"  --a2dp-mixer\t\tmix multiple PCM clients\n"
+					"  --a2dp-monitor\texpose A2DP source monitor PCM\n"
+					"  --a2dp-jitter-buffer=MSEC\tbuffer received audio\n"
+					"  --a2dp-silence-timeout=SEC\tsuspend streaming on silence\n"
+					"  --a2dp-duplex\t\tuse single FastStream IO thread\n"
+					"  --a2dp-plugin=PATH\tload A2DP codec plug-in\n"
+					"  --a2dp-sched=SPEC\tset A2DP IO threads scheduling\n"
+					"  --sco-sched=SPEC\tset SCO IO threads scheduling\n"
+					"  --sco-duplex\t\tuse single SCO IO thread\n"
+					"  --sco-aec\t\tcancel echo and noise in SCO mic\n"
+					"  --sco-offload\t\troute SCO audio via PCM interface\n"
 					"  --sbc-quality=NB\tset SBC encoder quality\n"
 #if ENABLE_AAC
 					"  --aac-afterburner\tenable FDK AAC afterburner\n"
 					"  --aac-latm-version=NB\tselect LATM syntax version\n"
 					"  --aac-vbr-mode=NB\tselect FDK AAC encoder VBR mode\n"
+					"  --aac-low-delay\tuse low delay AAC-ELD if possible\n"
 #endif
 #if ENABLE_LDAC
 					"  --ldac-abr\t\tenable LDAC adaptive bit rate\n"
@@ -191,6 +249,10 @@ int main(int argc, char **argv) {
 					"  - hfp-ag\tHands-Free Audio Gateway (%s)\n"
 					"  - hsp-hs\tHeadset (%s)\n"
 					"  - hsp-ag\tHeadset Audio Gateway (%s)\n"
+#if ENABLE_LE_AUDIO
+					"  - bap-source\tLE Audio Unicast Source (LC3)\n"
+					"  - bap-sink\tLE Audio Unicast Sink (LC3)\n"
+#endif
 					"\n"
 					"By default only output profiles are enabled, which includes A2DP Source and\n"
 					"HSP/HFP Audio Gateways. If one wants to enable other set of profiles, it is\n"
@@ -232,6 +294,10 @@ int main(int argc, char **argv) {
 				{ "hfp-ag", &config.enable.hfp_ag },
 				{ "hsp-hs", &config.enable.hsp_hs },
 				{ "hsp-ag", &config.enable.hsp_ag },
+#if ENABLE_LE_AUDIO
+				{ "bap-source", &config.enable.bap_source },
+				{ "bap-sink", &config.enable.bap_sink },
+#endif
 			};
 
 			for (i = 0; i < ARRAYSIZE(map); i++)
@@ -262,6 +328,63 @@ int main(int argc, char **argv) {
 		case 8 /* --keep-alive=SEC */ :
 			config.keep_alive_time = atof(optarg) * 1000;
 			break;
+		case 19 /* --timer-pacing */ :
+			config.pacing_timer = true;
+			break;
+		case 24 /* --resampler=NAME */ : {
+
+			static const struct {
+				const char *name;
+				enum resampler_quality quality;
+			} map[] = {
+				{ "none", RESAMPLER_QUALITY_NONE },
+				{ "low", RESAMPLER_QUALITY_LOW },
+				{ "medium", RESAMPLER_QUALITY_MEDIUM },
+				{ "high", RESAMPLER_QUALITY_HIGH },
+			};
+
+			size_t i;
+			for (i = 0; i < ARRAYSIZE(map); i++)
+				if (strcasecmp(optarg, map[i].name) == 0) {
+					config.resampler_quality = map[i].quality;
+					break;
+				}
+
+			if (i == ARRAYSIZE(map)) {
+				error("Invalid resampler quality: %s", optarg);
+				return EXIT_FAILURE;
+			}
+
+			break;
+		}
+		case 27 /* --dbus-update-interval=MSEC */ : {
+			unsigned int interval = atoi(optarg);
+			if (interval > 1000) {
+				error("Invalid D-Bus update interval [0, 1000]: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			config.dbus_update_interval = interval;
+			break;
+		}
+		case 40 /* --pcm-overrun=POLICY */ :
+			if (ba_transport_pcm_overrun_from_string(optarg, &config.pcm_overrun) == -1) {
+				error("Invalid PCM overrun policy: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 34 /* --bt-capture=DIR */ :
+			if (access(optarg, W_OK) == -1) {
+				error("Invalid BT capture directory: %s: %s", optarg, strerror(errno));
+				return EXIT_FAILURE;
+			}
+			config.bt_capture_dir = optarg;
+			break;
+		case 41 /* --metrics[=FILE] */ :
+			config.metrics_path = optarg != NULL ? optarg : METRICS_DEFAULT_PATH;
+			break;
+		case 42 /* --codec-calibrate */ :
+			config.codec_calibrate = true;
+			break;
 
 		case 6 /* --a2dp-force-mono */ :
 			config.a2dp.force_mono = true;
@@ -272,6 +395,89 @@ int main(int argc, char **argv) {
 		case 9 /* --a2dp-volume */ :
 			config.a2dp.volume = true;
 			break;
+		case 20 /* --a2dp-abr */ :
+			config.a2dp.abr = true;
+			break;
+		case 21 /* --a2dp-pipeline[=CPU] */ :
+			config.a2dp.pipeline = true;
+			if (optarg != NULL)
+				config.a2dp.pipeline_cpu = atoi(optarg);
+			break;
+		case 38 /* --a2dp-receiver */ :
+			config.a2dp.receiver = true;
+			break;
+		case 39 /* --a2dp-battery-saver=PERCENT */ :
+			config.a2dp.battery_saver = atoi(optarg);
+			if (config.a2dp.battery_saver > 100) {
+				error("Invalid battery saver threshold [0, 100]: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 22 /* --a2dp-fast-start */ :
+			config.a2dp.fast_start = true;
+			break;
+		case 31 /* --a2dp-auto-codec */ :
+			config.a2dp.auto_codec = true;
+			break;
+		case 32 /* --a2dp-mixer */ :
+			config.a2dp.mixer = true;
+			break;
+		case 43 /* --a2dp-monitor */ :
+			config.a2dp.monitor = true;
+			break;
+		case 33 /* --a2dp-jitter-buffer=MSEC */ :
+			config.a2dp.jitter_buffer = atoi(optarg);
+			if (config.a2dp.jitter_buffer > JITTER_BUFFER_MAX_MS) {
+				error("Invalid jitter buffer latency [0, %d]: %s", JITTER_BUFFER_MAX_MS, optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 35 /* --a2dp-silence-timeout=SEC */ : {
+			char *endptr;
+			double timeout = strtod(optarg, &endptr);
+			if (endptr == optarg || *endptr != '\0' ||
+					!(timeout >= 0 && timeout <= 3600)) {
+				error("Invalid silence timeout [0, 3600]: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			config.a2dp.silence_timeout = timeout * 1000;
+			break;
+		}
+		case 36 /* --a2dp-duplex */ :
+			info("Activating timer pacing for A2DP duplex mode");
+			config.a2dp.duplex = true;
+			config.pacing_timer = true;
+			break;
+		case 37 /* --a2dp-plugin=PATH */ :
+			if (codec_plugin_load(optarg) == -1) {
+				error("Couldn't load A2DP codec plug-in: %s: %s", optarg, strerror(errno));
+				return EXIT_FAILURE;
+			}
+			break;
+
+		case 25 /* --a2dp-sched=SPEC */ :
+			if (sched_policy_parse(&config.a2dp.sched, optarg) == -1) {
+				error("Invalid scheduling policy: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 26 /* --sco-sched=SPEC */ :
+			if (sched_policy_parse(&config.sco.sched, optarg) == -1) {
+				error("Invalid scheduling policy: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 28 /* --sco-duplex */ :
+			config.sco.duplex = true;
+			break;
+		case 29 /* --sco-aec */ :
+			info("Activating SCO duplex mode for echo cancellation");
+			config.sco.aec = true;
+			config.sco.duplex = true;
+			break;
+		case 30 /* --sco-offload */ :
+			config.sco.offload = true;
+			break;
 
 		case 14 /* --sbc-quality=NB */ :
 			config.sbc_quality = atoi(optarg);
@@ -279,10 +485,6 @@ int main(int argc, char **argv) {
 				error("Invalid encoder quality [0, %d]: %s", SBC_QUALITY_XQ, optarg);
 				return EXIT_FAILURE;
 			}
-			if (config.sbc_quality == SBC_QUALITY_XQ) {
-				info("Activating SBC Dual Channel HD (SBC XQ)");
-				config.a2dp.force_44100 = true;
-			}
 			break;
 
 #if ENABLE_AAC
@@ -303,6 +505,9 @@ int main(int argc, char **argv) {
 				return EXIT_FAILURE;
 			}
 			break;
+		case 23 /* --aac-low-delay */ :
+			config.aac_low_delay = true;
+			break;
 #endif
 
 #if ENABLE_LDAC
@@ -384,6 +589,28 @@ int main(int argc, char **argv) {
 	}
 #endif
 
+	if (config.codec_calibrate &&
+			codec_calibrate() == -1)
+		warn("Couldn't calibrate codecs: %s", strerror(errno));
+
+	/* The SBC quality might have been lowered by the calibration,
+	 * so the XQ requirements are applied only now. */
+	if (config.sbc_quality == SBC_QUALITY_XQ) {
+		info("Activating SBC Dual Channel HD (SBC XQ)");
+		config.a2dp.force_44100 = true;
+	}
+
+	a2dp_codecs_init();
+
+	if (config.metrics_path != NULL &&
+			metrics_init(config.metrics_path) == -1)
+		warn("Couldn't initialize metrics page: %s: %s",
+				config.metrics_path, strerror(errno));
+
+	if (storage_init(BLUEALSA_STORAGE_DIR) == -1)
+		warn("Couldn't initialize persistent storage: %s: %s",
+				BLUEALSA_STORAGE_DIR, strerror(errno));
+
 	bluez_subscribe_signals();
 	bluez_register();
 
@@ -397,6 +624,9 @@ int main(int argc, char **argv) {
 	upower_initialize();
 #endif
 
+	if (config.a2dp.auto_codec)
+		a2dp_policy_init();
+
 	/* In order to receive EPIPE while writing to the pipe whose reading end
 	 * is closed, the SIGPIPE signal has to be handled. For more information
 	 * see the io_thread_write_pcm() function. */
@@ -412,10 +642,18 @@ int main(int argc, char **argv) {
 	g_bus_own_name_on_connection(config.dbus, dbus_service,
 			G_BUS_NAME_OWNER_FLAGS_DO_NOT_QUEUE, NULL, dbus_name_lost, loop, NULL);
 
+	/* From now on, messages are written by the background thread, so
+	 * logging in the IO threads will not stall the audio transfer. */
+	if (log_async_start() == -1)
+		warn("Couldn't start asynchronous logging: %s", strerror(errno));
+
 	/* main dispatching loop */
 	debug("Starting main dispatching loop");
 	g_main_loop_run(loop);
 
 	debug("Exiting main loop");
+	storage_destroy();
+	metrics_free();
+	log_async_stop();
 	return retval;
 }
@@ -0,0 +1,271 @@
+/*
+ * BlueALSA - metrics.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <bluetooth/bluetooth.h>
+
+#include <glib.h>
+
+#include "utils.h"
+#include "shared/log.h"
+#include "shared/metrics-page.h"
+
+static struct {
+	pthread_mutex_t mutex;
+	/* mapped metrics page */
+	struct metrics_page_header *hdr;
+	/* path of the metrics page file */
+	char *path;
+	/* IO threads published in the slots */
+	struct ba_transport_thread *threads[METRICS_PAGE_SLOTS];
+	pthread_t thread;
+	bool running;
+} metrics = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/**
+ * Copy IO thread statistics to the metrics page slot.
+ *
+ * This function shall be called with the metrics mutex locked. */
+static void metrics_slot_publish(struct metrics_page_slot *slot,
+		const struct ba_transport_thread *th) {
+
+	const struct ba_transport_thread_stats *stats = &th->stats;
+	uint32_t *counters = slot->counters;
+
+	metrics_page_slot_write_begin(slot);
+
+	counters[METRICS_PAGE_COUNTER_TX_PACKETS] = atomic_load_explicit(&stats->tx_packets, memory_order_relaxed);
+	counters[METRICS_PAGE_COUNTER_TX_BYTES] = atomic_load_explicit(&stats->tx_bytes, memory_order_relaxed);
+	counters[METRICS_PAGE_COUNTER_RX_PACKETS] = atomic_load_explicit(&stats->rx_packets, memory_order_relaxed);
+	counters[METRICS_PAGE_COUNTER_RX_BYTES] = atomic_load_explicit(&stats->rx_bytes, memory_order_relaxed);
+	counters[METRICS_PAGE_COUNTER_OVERDUE] = atomic_load_explicit(&stats->overdue, memory_order_relaxed);
+	counters[METRICS_PAGE_COUNTER_UNDERRUNS] = atomic_load_explicit(&stats->underruns, memory_order_relaxed);
+	counters[METRICS_PAGE_COUNTER_OVERRUNS] = atomic_load_explicit(&stats->overruns, memory_order_relaxed);
+	counters[METRICS_PAGE_COUNTER_RTP_LOST] = atomic_load_explicit(&stats->rtp_lost, memory_order_relaxed);
+	counters[METRICS_PAGE_COUNTER_CONGESTION_DROPS] = atomic_load_explicit(&stats->congestion_drops, memory_order_relaxed);
+	counters[METRICS_PAGE_COUNTER_RX_OVERFLOWS] = atomic_load_explicit(&stats->rx_overflows, memory_order_relaxed);
+	counters[METRICS_PAGE_COUNTER_OVERRUN_DROPS] = atomic_load_explicit(&stats->overrun_drops, memory_order_relaxed);
+
+	metrics_page_slot_write_end(slot);
+
+}
+
+/**
+ * Metrics publishing loop.
+ *
+ * The IO threads update their statistics counters anyway, so the metrics
+ * page is updated by this low-priority thread in order not to add any
+ * overhead to the audio processing. */
+static void *metrics_loop(void *userdata) {
+	(void)userdata;
+
+	const struct timespec interval = {
+		.tv_sec = METRICS_PUBLISH_INTERVAL_MS / 1000,
+		.tv_nsec = (METRICS_PUBLISH_INTERVAL_MS % 1000) * 1000000 };
+
+	/* Run only when there is nothing else to do, so publishing will never
+	 * preempt IO threads. Stale metrics are harmless. */
+	const struct sched_param param = { .sched_priority = 0 };
+	int ret;
+	if ((ret = pthread_setschedparam(pthread_self(), SCHED_IDLE, &param)) != 0)
+		warn("Couldn't set metrics thread idle policy: %s", strerror(ret));
+
+	for (;;) {
+
+		nanosleep(&interval, NULL);
+
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		pthread_mutex_lock(&metrics.mutex);
+
+		for (size_t i = 0; i < METRICS_PAGE_SLOTS; i++)
+			if (metrics.threads[i] != NULL)
+				metrics_slot_publish(metrics_page_slot(metrics.hdr, i), metrics.threads[i]);
+
+		pthread_mutex_unlock(&metrics.mutex);
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+
+	}
+
+	return NULL;
+}
+
+/**
+ * Initialize metrics page.
+ *
+ * @param path The path of the metrics page file. Missing parent directories
+ *   will be created.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int metrics_init(const char *path) {
+
+	char *dir = g_path_get_dirname(path);
+	int fd = -1;
+	int ret;
+
+	if (g_mkdir_with_parents(dir, 0755) == -1)
+		goto fail;
+
+	if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1)
+		goto fail;
+	if (ftruncate(fd, METRICS_PAGE_SIZE) == -1)
+		goto fail;
+
+	void *addr;
+	if ((addr = mmap(NULL, METRICS_PAGE_SIZE, PROT_READ | PROT_WRITE,
+					MAP_SHARED, fd, 0)) == MAP_FAILED)
+		goto fail;
+
+	metrics.hdr = addr;
+	metrics.hdr->version = METRICS_PAGE_VERSION;
+	metrics.hdr->slots = METRICS_PAGE_SLOTS;
+	metrics.hdr->slot_size = sizeof(struct metrics_page_slot);
+	metrics.hdr->interval_ms = METRICS_PUBLISH_INTERVAL_MS;
+	metrics.hdr->pid = getpid();
+	/* magic number marks the header as initialized */
+	atomic_thread_fence(memory_order_release);
+	metrics.hdr->magic = METRICS_PAGE_MAGIC;
+
+	if ((ret = pthread_create(&metrics.thread, NULL, metrics_loop, NULL)) != 0) {
+		munmap(addr, METRICS_PAGE_SIZE);
+		metrics.hdr = NULL;
+		errno = ret;
+		goto fail;
+	}
+
+	pthread_setname_np(metrics.thread, "ba-metrics");
+	metrics.path = g_strdup(path);
+	metrics.running = true;
+
+	debug("Publishing metrics: %s", path);
+
+	close(fd);
+	g_free(dir);
+	return 0;
+
+fail:
+	ret = errno;
+	if (fd != -1) {
+		close(fd);
+		unlink(path);
+	}
+	g_free(dir);
+	errno = ret;
+	return -1;
+}
+
+/**
+ * Stop publishing metrics and remove the metrics page file. */
+void metrics_free(void) {
+
+	if (!metrics.running)
+		return;
+
+	pthread_cancel(metrics.thread);
+	pthread_join(metrics.thread, NULL);
+	metrics.running = false;
+
+	pthread_mutex_lock(&metrics.mutex);
+	munmap(metrics.hdr, METRICS_PAGE_SIZE);
+	metrics.hdr = NULL;
+	pthread_mutex_unlock(&metrics.mutex);
+
+	unlink(metrics.path);
+	g_free(metrics.path);
+	metrics.path = NULL;
+
+}
+
+/**
+ * Assign metrics page slot to the IO thread.
+ *
+ * If the metrics page is not initialized or there is no free slot left,
+ * this function does nothing - metrics are not essential for the IO.
+ *
+ * @param th Pointer to the transport thread structure.
+ * @param name The name of the IO thread. */
+void metrics_thread_register(
+		struct ba_transport_thread *th,
+		const char *name) {
+
+	struct ba_transport *t = th->t;
+	struct metrics_page_slot *slot = NULL;
+	size_t i;
+
+	pthread_mutex_lock(&metrics.mutex);
+
+	if (metrics.hdr == NULL)
+		goto final;
+
+	/* reuse the slot if the thread is restarted */
+	for (i = 0; i < METRICS_PAGE_SLOTS; i++)
+		if (metrics.threads[i] == th)
+			goto assign;
+	for (i = 0; i < METRICS_PAGE_SLOTS; i++)
+		if (metrics.threads[i] == NULL)
+			goto assign;
+
+	warn("Couldn't assign metrics slot: %s", strerror(ENOSPC));
+	goto final;
+
+assign:
+	slot = metrics_page_slot(metrics.hdr, i);
+	metrics.threads[i] = th;
+
+	metrics_page_slot_write_begin(slot);
+	slot->used = 1;
+	ba2str(&t->d->addr, slot->device);
+	snprintf(slot->thread, sizeof(slot->thread), "%s", name);
+	snprintf(slot->transport, sizeof(slot->transport), "%s",
+			ba_transport_type_to_string(t->type));
+	memset(slot->counters, 0, sizeof(slot->counters));
+	metrics_page_slot_write_end(slot);
+
+final:
+	pthread_mutex_unlock(&metrics.mutex);
+}
+
+/**
+ * Release metrics page slot of the IO thread. */
+void metrics_thread_unregister(
+		struct ba_transport_thread *th) {
+
+	pthread_mutex_lock(&metrics.mutex);
+
+	if (metrics.hdr == NULL)
+		goto final;
+
+	for (size_t i = 0; i < METRICS_PAGE_SLOTS; i++)
+		if (metrics.threads[i] == th) {
+			struct metrics_page_slot *slot = metrics_page_slot(metrics.hdr, i);
+			metrics_page_slot_write_begin(slot);
+			slot->used = 0;
+			metrics_page_slot_write_end(slot);
+			metrics.threads[i] = NULL;
+			break;
+		}
+
+final:
+	pthread_mutex_unlock(&metrics.mutex);
+}
@@ -0,0 +1,35 @@
+/*
+ * BlueALSA - metrics.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_METRICS_H_
+#define BLUEALSA_METRICS_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "ba-transport.h"
+#include "shared/metrics-page.h"
+
+/**
+ * The interval in milliseconds at which the IO thread statistics are
+ * copied to the metrics page. */
+#define METRICS_PUBLISH_INTERVAL_MS 1000
+
+int metrics_init(const char *path);
+void metrics_free(void);
+
+void metrics_thread_register(
+		struct ba_transport_thread *th,
+		const char *name);
+void metrics_thread_unregister(
+		struct ba_transport_thread *th);
+
+#endif
@@ -24,6 +24,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -49,13 +50,26 @@
 #include "shared/log.h"
 
 /**
- * Lookup data associated with oFono card. */
+ * Lookup data associated with oFono card.
+ *
+ * This data is kept after the card removal, so it can be reused when the
+ * same card is added again (e.g. after oFono restart), without the need
+ * to parse card properties and to lookup HCI route one more time. */
 struct ofono_card_data {
 	int hci_dev_id;
 	bdaddr_t bt_addr;
+	struct ba_transport_type type;
 	char transport_path[32];
 };
 
+/**
+ * Pending oFono SCO connection. */
+struct ofono_sco_connection {
+	struct ba_transport *t;
+	uint8_t codec;
+	int fd;
+};
+
 static GHashTable *ofono_card_data_map = NULL;
 static const char *dbus_agent_object_path = "/org/bluez/HFP/oFono";
 static unsigned int dbus_agent_object_id = 0;
@@ -83,44 +97,63 @@ static int ofono_sco_socket_authorize(int fd) {
 }
 
 /**
- * Ask oFono to connect to a card (in return it will call NewConnection). */
-static int ofono_acquire_bt_sco(struct ba_transport *t) {
+ * Callback for the oFono card Connect method call. */
+static void ofono_acquire_bt_sco_finish(GObject *source, GAsyncResult *result,
+		void *userdata) {
 
-	GDBusMessage *msg = NULL, *rep = NULL;
+	struct ba_transport *t = userdata;
+	GDBusMessage *rep;
 	GError *err = NULL;
-	int ret = 0;
-
-	debug("Requesting new oFono SCO connection: %s", t->bluez_dbus_path);
-
-	const char *ofono_dbus_path = &t->bluez_dbus_path[6];
-	msg = g_dbus_message_new_method_call(t->bluez_dbus_owner, ofono_dbus_path,
-			OFONO_IFACE_HF_AUDIO_CARD, "Connect");
 
-	if ((rep = g_dbus_connection_send_message_with_reply_sync(config.dbus, msg,
-					G_DBUS_SEND_MESSAGE_FLAGS_NONE, -1, NULL, NULL, &err)) == NULL)
-		goto fail;
-
-	if (g_dbus_message_get_message_type(rep) == G_DBUS_MESSAGE_TYPE_ERROR) {
+	if ((rep = g_dbus_connection_send_message_with_reply_finish(
+					G_DBUS_CONNECTION(source), result, &err)) != NULL &&
+			g_dbus_message_get_message_type(rep) == G_DBUS_MESSAGE_TYPE_ERROR)
 		g_dbus_message_to_gerror(rep, &err);
-		goto fail;
-	}
-
-	goto final;
 
-fail:
-	ret = -1;
-
-final:
-	if (msg != NULL)
-		g_object_unref(msg);
 	if (rep != NULL)
 		g_object_unref(rep);
 	if (err != NULL) {
 		warn("Couldn't connect to card: %s", err->message);
 		g_error_free(err);
+		/* The NewConnection will not be called, so the IO threads will not
+		 * be started. Notify pending PCM open requests about that. */
+		ba_transport_thread_set_state(&t->thread_enc, BA_TRANSPORT_THREAD_STATE_NONE, true);
+		ba_transport_thread_set_state(&t->thread_dec, BA_TRANSPORT_THREAD_STATE_NONE, true);
 	}
 
-	return ret;
+	ba_transport_unref(t);
+}
+
+/**
+ * Ask oFono to connect to a card (in return it will call NewConnection).
+ *
+ * The connection request is sent asynchronously. The SCO link will be set
+ * up when oFono calls our NewConnection method, and the transport IO threads
+ * will be started there, in the same way as for the incoming connection.
+ *
+ * @return This function always returns -1. If the request has been sent,
+ *   errno is set to EINPROGRESS. Otherwise, errno is set to indicate the
+ *   error. */
+static int ofono_acquire_bt_sco(struct ba_transport *t) {
+
+	GDBusMessage *msg;
+
+	debug("Requesting new oFono SCO connection: %s", t->bluez_dbus_path);
+
+	if (g_dbus_connection_is_closed(config.dbus))
+		return errno = ENOTCONN, -1;
+
+	const char *ofono_dbus_path = &t->bluez_dbus_path[6];
+	if ((msg = g_dbus_message_new_method_call(t->bluez_dbus_owner, ofono_dbus_path,
+					OFONO_IFACE_HF_AUDIO_CARD, "Connect")) == NULL)
+		return errno = ENOMEM, -1;
+
+	g_dbus_connection_send_message_with_reply(config.dbus, msg,
+			G_DBUS_SEND_MESSAGE_FLAGS_NONE, -1, NULL, NULL,
+			ofono_acquire_bt_sco_finish, ba_transport_ref(t));
+
+	g_object_unref(msg);
+	return errno = EINPROGRESS, -1;
 }
 
 /**
@@ -220,6 +253,18 @@ static void ofono_card_add(const char *dbus_sender, const char *card,
 		.codec = HFP_CODEC_UNDEFINED,
 	};
 
+	/* Reuse data of the card which was seen before. In such case, the
+	 * transport will be created with the last negotiated codec. */
+	struct ofono_card_data *ocd_cached;
+	if ((ocd_cached = g_hash_table_lookup(ofono_card_data_map, card)) != NULL &&
+			(a = ba_adapter_lookup(ocd_cached->hci_dev_id)) != NULL) {
+		debug("Using cached oFono card data: %s", card);
+		hci_dev_id = ocd_cached->hci_dev_id;
+		addr_dev = ocd_cached->bt_addr;
+		ttype = ocd_cached->type;
+		goto setup;
+	}
+
 	while (g_variant_iter_next(properties, "{&sv}", &key, &value)) {
 		if (strcmp(key, "RemoteAddress") == 0)
 			str2ba(g_variant_get_string(value, NULL), &addr_dev);
@@ -242,13 +287,14 @@ static void ofono_card_add(const char *dbus_sender, const char *card,
 		value = NULL;
 	}
 
-	debug("Adding new oFono card: %s", card);
-
 	if ((a = ba_adapter_lookup(hci_dev_id)) == NULL) {
 		error("Couldn't lookup adapter: hci%d: %s", hci_dev_id, strerror(errno));
 		goto fail;
 	}
 
+setup:
+	debug("Adding new oFono card: %s", card);
+
 	if ((d = ba_device_lookup(a, &addr_dev)) == NULL &&
 			(d = ba_device_new(a, &addr_dev)) == NULL) {
 		error("Couldn't create new device: %s", strerror(errno));
@@ -258,6 +304,7 @@ static void ofono_card_add(const char *dbus_sender, const char *card,
 	struct ofono_card_data ocd = {
 		.hci_dev_id = hci_dev_id,
 		.bt_addr = addr_dev,
+		.type = ttype,
 	};
 
 	snprintf(ocd.transport_path, sizeof(ocd.transport_path), "/ofono%s", card);
@@ -283,23 +330,21 @@ fail:
 }
 
 /**
- * Get all oFono cards (phones). */
-static int ofono_get_all_cards(void) {
+ * Callback for the GetCards method call. */
+static void ofono_get_all_cards_finish(GObject *source, GAsyncResult *result,
+		void *userdata) {
+	(void)userdata;
 
-	GDBusMessage *msg = NULL, *rep = NULL;
+	GDBusMessage *rep;
 	GError *err = NULL;
-	int ret = 0;
 
-	msg = g_dbus_message_new_method_call(OFONO_SERVICE, "/",
-			OFONO_IFACE_HF_AUDIO_MANAGER, "GetCards");
-
-	if ((rep = g_dbus_connection_send_message_with_reply_sync(config.dbus, msg,
-					G_DBUS_SEND_MESSAGE_FLAGS_NONE, -1, NULL, NULL, &err)) == NULL)
-		goto fail;
+	if ((rep = g_dbus_connection_send_message_with_reply_finish(
+					G_DBUS_CONNECTION(source), result, &err)) == NULL)
+		goto final;
 
 	if (g_dbus_message_get_message_type(rep) == G_DBUS_MESSAGE_TYPE_ERROR) {
 		g_dbus_message_to_gerror(rep, &err);
-		goto fail;
+		goto final;
 	}
 
 	const char *sender = g_dbus_message_get_sender(rep);
@@ -310,17 +355,14 @@ static int ofono_get_all_cards(void) {
 	const char *card;
 
 	g_variant_get(body, "(a(oa{sv}))", &cards);
-	while (g_variant_iter_next(cards, "(&oa{sv})", &card, &properties))
+	while (g_variant_iter_next(cards, "(&oa{sv})", &card, &properties)) {
 		ofono_card_add(sender, card, properties);
+		g_variant_iter_free(properties);
+	}
 
-	goto final;
-
-fail:
-	ret = -1;
+	g_variant_iter_free(cards);
 
 final:
-	if (msg != NULL)
-		g_object_unref(msg);
 	if (rep != NULL)
 		g_object_unref(rep);
 	if (err != NULL) {
@@ -328,7 +370,23 @@ final:
 		g_error_free(err);
 	}
 
-	return ret;
+}
+
+/**
+ * Get all oFono cards (phones).
+ *
+ * Cards are added asynchronously, so the main loop is not blocked while
+ * waiting for oFono, e.g. right after its restart. */
+static void ofono_get_all_cards(void) {
+
+	GDBusMessage *msg = g_dbus_message_new_method_call(OFONO_SERVICE, "/",
+			OFONO_IFACE_HF_AUDIO_MANAGER, "GetCards");
+
+	g_dbus_connection_send_message_with_reply(config.dbus, msg,
+			G_DBUS_SEND_MESSAGE_FLAGS_NONE, -1, NULL, NULL,
+			ofono_get_all_cards_finish, NULL);
+
+	g_object_unref(msg);
 }
 
 /**
@@ -363,11 +421,55 @@ fail:
 
 }
 
+static void ofono_sco_connection_free(struct ofono_sco_connection *c) {
+	if (c->fd != -1)
+		close(c->fd);
+	ba_transport_unref(c->t);
+	free(c);
+}
+
+/**
+ * Setup transport when the SCO link becomes established.
+ *
+ * Waiting for the SCO connection is done in the main loop instead of in the
+ * hci_sco_get_mtu() function, so other D-Bus calls are not blocked. */
+static gboolean ofono_sco_connection_ready(GIOChannel *ch, GIOCondition condition,
+		void *userdata) {
+	(void)ch;
+
+	struct ofono_sco_connection *c = userdata;
+	struct ba_transport *t = c->t;
+
+	if (condition & (G_IO_ERR | G_IO_HUP)) {
+		error("Couldn't establish oFono SCO link: %d", c->fd);
+		return G_SOURCE_REMOVE;
+	}
+
+	ba_transport_stop(t);
+
+	pthread_mutex_lock(&t->bt_fd_mtx);
+
+	debug("New oFono SCO connection (codec: %#x): %d", c->codec, c->fd);
+
+	t->bt_fd = c->fd;
+	t->mtu_read = t->mtu_write = hci_sco_get_mtu(c->fd);
+	ba_transport_set_codec(t, c->codec);
+	c->fd = -1;
+
+	pthread_mutex_unlock(&t->bt_fd_mtx);
+
+	ba_transport_start(t);
+
+	return G_SOURCE_REMOVE;
+}
+
 static void ofono_agent_new_connection(GDBusMethodInvocation *inv) {
 
 	GDBusMessage *msg = g_dbus_method_invocation_get_message(inv);
 	GVariant *params = g_dbus_method_invocation_get_parameters(inv);
 
+	struct ofono_sco_connection *c = NULL;
+	struct ofono_card_data *ocd;
 	struct ba_transport *t = NULL;
 	GError *err = NULL;
 	GUnixFDList *fd_list;
@@ -393,19 +495,23 @@ static void ofono_agent_new_connection(GDBusMethodInvocation *inv) {
 		goto fail;
 	}
 
-	ba_transport_stop(t);
-
-	pthread_mutex_lock(&t->bt_fd_mtx);
-
-	debug("New oFono SCO connection (codec: %#x): %d", codec, fd);
+	if ((c = malloc(sizeof(*c))) == NULL) {
+		error("Couldn't create SCO connection: %s", strerror(errno));
+		goto fail;
+	}
 
-	t->bt_fd = fd;
-	t->mtu_read = t->mtu_write = hci_sco_get_mtu(fd);
-	ba_transport_set_codec(t, codec);
+	c->t = t;
+	c->codec = codec;
+	c->fd = fd;
 
-	pthread_mutex_unlock(&t->bt_fd_mtx);
+	/* remember negotiated codec for the next card setup */
+	if ((ocd = g_hash_table_lookup(ofono_card_data_map, card)) != NULL)
+		ocd->type.codec = codec;
 
-	ba_transport_start(t);
+	GIOChannel *ch = g_io_channel_unix_new(fd);
+	g_io_add_watch_full(ch, G_PRIORITY_DEFAULT, G_IO_OUT | G_IO_ERR | G_IO_HUP,
+			ofono_sco_connection_ready, c, (GDestroyNotify)ofono_sco_connection_free);
+	g_io_channel_unref(ch);
 
 	g_dbus_method_invocation_return_value(inv, NULL);
 	goto final;
@@ -413,12 +519,12 @@ static void ofono_agent_new_connection(GDBusMethodInvocation *inv) {
 fail:
 	g_dbus_method_invocation_return_error(inv, G_DBUS_ERROR,
 		G_DBUS_ERROR_INVALID_ARGS, "Unable to get connection");
+	if (t != NULL)
+		ba_transport_unref(t);
 	if (fd != -1)
 		close(fd);
 
 final:
-	if (t != NULL)
-		ba_transport_unref(t);
 	if (err != NULL)
 		g_error_free(err);
 }
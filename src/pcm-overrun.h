@@ -0,0 +1,29 @@
+/*
+ * BlueALSA - pcm-overrun.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_PCMOVERRUN_H_
+#define BLUEALSA_PCMOVERRUN_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+/**
+ * Policy applied when the PCM client does not consume data fast enough. */
+enum ba_transport_pcm_overrun {
+	/* wait for the client to consume data */
+	BA_TRANSPORT_PCM_OVERRUN_BLOCK,
+	/* drop data which do not fit into the FIFO */
+	BA_TRANSPORT_PCM_OVERRUN_DROP_NEWEST,
+	/* keep the latest data in the backlog, drop the oldest */
+	BA_TRANSPORT_PCM_OVERRUN_DROP_OLDEST,
+};
+
+#endif
@@ -0,0 +1,281 @@
+/*
+ * BlueALSA - resampler.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "resampler.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The maximal number of filter phases. It is enough for conversion
+ * between all standard sampling frequencies, e.g. 8 kHz to 44.1 kHz
+ * requires 441 phases. */
+#define RESAMPLER_MAX_PHASES 1024
+
+static const struct {
+	/* the number of sinc zero-crossings on each side */
+	unsigned int zero_crossings;
+	/* the cutoff frequency relative to the Nyquist frequency */
+	double rolloff;
+	/* the Kaiser window shape parameter */
+	double beta;
+} resampler_qualities[] = {
+	[RESAMPLER_QUALITY_LOW] = { 8, 0.90, 6.0 },
+	[RESAMPLER_QUALITY_MEDIUM] = { 16, 0.94, 8.0 },
+	[RESAMPLER_QUALITY_HIGH] = { 32, 0.97, 10.0 },
+};
+
+static unsigned int gcd(unsigned int a, unsigned int b) {
+	while (b != 0) {
+		unsigned int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/**
+ * Zeroth order modified Bessel function of the first kind. */
+static double bessel_i0(double x) {
+	double sum = 1, term = 1;
+	for (unsigned int k = 1; term > sum * 1e-12; k++) {
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+/**
+ * Initialize sample rate converter.
+ *
+ * @param r Pointer to the resampler structure.
+ * @param quality The conversion quality.
+ * @param width The sample bit-width. Samples with the width of 16 bits
+ *   shall be stored in 2 bytes, all other samples in 4 bytes.
+ * @param channels The number of channels.
+ * @param rate_in The input sampling frequency.
+ * @param rate_out The output sampling frequency.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int resampler_init(struct resampler *r, enum resampler_quality quality,
+		unsigned int width, unsigned int channels,
+		unsigned int rate_in, unsigned int rate_out) {
+
+	resampler_free(r);
+
+	if (quality == RESAMPLER_QUALITY_NONE ||
+			quality > RESAMPLER_QUALITY_HIGH ||
+			(width != 16 && width != 24 && width != 32) ||
+			channels == 0 || rate_in == 0 || rate_out == 0)
+		return errno = EINVAL, -1;
+
+	const unsigned int d = gcd(rate_in, rate_out);
+	const unsigned int l = rate_out / d;
+	const unsigned int m = rate_in / d;
+
+	if (l > RESAMPLER_MAX_PHASES)
+		return errno = EINVAL, -1;
+
+	/* In case of down-sampling, the cutoff frequency has to be lowered to
+	 * the output Nyquist frequency, so the filter has to be longer. */
+	const double fc = resampler_qualities[quality].rolloff * (l < m ? (double)l / m : 1.0);
+	const unsigned int half = ceil(resampler_qualities[quality].zero_crossings / fc);
+	const unsigned int taps = 2 * half;
+	const double beta = resampler_qualities[quality].beta;
+	const double i0_beta = bessel_i0(beta);
+
+	if ((r->filter = malloc(sizeof(*r->filter) * l * taps)) == NULL ||
+			(r->history = malloc(sizeof(*r->history) *
+					(RESAMPLER_CAPACITY + taps) * channels)) == NULL) {
+		resampler_free(r);
+		return -1;
+	}
+
+	for (unsigned int p = 0; p < l; p++) {
+
+		float *h = &r->filter[p * taps];
+		double sum = 0;
+
+		/* Tap k is applied to the input frame which precedes the output
+		 * frame by (half - 1 - k + p / l) input frames. */
+		for (unsigned int k = 0; k < taps; k++) {
+			const double x = (double)k - (half - 1) - (double)p / l;
+			const double u = x / half;
+			const double window = fabs(u) >= 1 ? 0 :
+				bessel_i0(beta * sqrt(1 - u * u)) / i0_beta;
+			const double sinc = x == 0 ? 1 : sin(M_PI * fc * x) / (M_PI * fc * x);
+			sum += h[k] = fc * sinc * window;
+		}
+
+		/* normalize DC gain of every phase */
+		for (unsigned int k = 0; k < taps; k++)
+			h[k] /= sum;
+
+	}
+
+	r->l = l;
+	r->m = m;
+	r->taps = taps;
+	r->rate_in = rate_in;
+	r->channels = channels;
+	r->width = width;
+
+	resampler_reset(r);
+	return 0;
+}
+
+/**
+ * Free resources allocated by the resampler_init().
+ *
+ * @param r Pointer to the resampler structure. */
+void resampler_free(struct resampler *r) {
+	free(r->filter);
+	free(r->history);
+	r->filter = NULL;
+	r->history = NULL;
+}
+
+/**
+ * Discard the input signal history.
+ *
+ * @param r Pointer to initialized resampler structure. */
+void resampler_reset(struct resampler *r) {
+	/* Prefill the history with silence, so the very first output frame
+	 * can be calculated as soon as the filter look-ahead is available. */
+	r->index = r->taps / 2 - 1;
+	r->history_len = r->index * r->channels;
+	memset(r->history, 0, sizeof(*r->history) * r->history_len);
+	r->phase = 0;
+}
+
+/**
+ * Get the number of input samples required to produce given output samples.
+ *
+ * @param r Pointer to initialized resampler structure.
+ * @param samples The number of requested output samples.
+ * @return This function returns the number of input samples which has to
+ *   be pushed to the resampler in order to pull the given number of samples.
+ *   Note, that this number might exceed the available space. */
+size_t resampler_get_needed(const struct resampler *r, size_t samples) {
+
+	const size_t frames = samples / r->channels;
+	if (frames == 0)
+		return 0;
+
+	const size_t last = r->index + (r->phase + (frames - 1) * r->m) / r->l;
+	const size_t needed = (last + r->taps / 2 + 1) * r->channels;
+
+	return needed > r->history_len ? needed - r->history_len : 0;
+}
+
+/**
+ * Get the number of samples which can be pushed to the resampler. */
+size_t resampler_get_space(const struct resampler *r) {
+	return (RESAMPLER_CAPACITY + r->taps) * r->channels - r->history_len;
+}
+
+/**
+ * Get the delay introduced by the resampler in 1/10 of millisecond. */
+unsigned int resampler_get_delay(const struct resampler *r) {
+	return (r->taps / 2) * 10000 / r->rate_in;
+}
+
+/**
+ * Push input signal to the resampler.
+ *
+ * It is allowed to push incomplete frames. Remaining samples of such
+ * frames shall be pushed with the next call.
+ *
+ * @param r Pointer to initialized resampler structure.
+ * @param buffer Address of the buffer with the interleaved PCM signal.
+ * @param samples The number of samples in the buffer.
+ * @return This function returns the number of consumed samples, which
+ *   might be less than requested if there is not enough space. */
+size_t resampler_push(struct resampler *r, const void *buffer, size_t samples) {
+
+	const size_t space = resampler_get_space(r);
+	if (samples > space)
+		samples = space;
+
+	float *dst = &r->history[r->history_len];
+	size_t i;
+
+	if (r->width == 16)
+		for (i = 0; i < samples; i++)
+			dst[i] = ((const int16_t *)buffer)[i];
+	else
+		for (i = 0; i < samples; i++)
+			dst[i] = ((const int32_t *)buffer)[i];
+
+	r->history_len += samples;
+	return samples;
+}
+
+/**
+ * Pull resampled signal from the resampler.
+ *
+ * @param r Pointer to initialized resampler structure.
+ * @param buffer Address of the buffer where the resampled signal shall be
+ *   stored. Samples are stored in the same format as the input signal.
+ * @param samples The number of samples which can be stored in the buffer.
+ * @return This function returns the number of stored samples. This number
+ *   is always a multiple of the number of channels. */
+size_t resampler_pull(struct resampler *r, void *buffer, size_t samples) {
+
+	const unsigned int channels = r->channels;
+	const unsigned int taps = r->taps;
+	const unsigned int half = taps / 2;
+	const size_t frames = samples / channels;
+	const size_t frames_in = r->history_len / channels;
+	const double max = r->width == 32 ? INT32_MAX : (1 << (r->width - 1)) - 1;
+	const double min = -max - 1;
+	size_t n;
+
+	for (n = 0; n < frames && r->index + half < frames_in; n++) {
+
+		const float *h = &r->filter[r->phase * taps];
+		const float *x = &r->history[(r->index + 1 - half) * channels];
+
+		for (unsigned int c = 0; c < channels; c++) {
+
+			float acc = 0;
+			for (unsigned int k = 0; k < taps; k++)
+				acc += h[k] * x[k * channels + c];
+
+			double v = round(acc);
+			v = v > max ? max : v < min ? min : v;
+
+			if (r->width == 16)
+				((int16_t *)buffer)[n * channels + c] = v;
+			else
+				((int32_t *)buffer)[n * channels + c] = v;
+
+		}
+
+		r->phase += r->m;
+		r->index += r->phase / r->l;
+		r->phase %= r->l;
+
+	}
+
+	/* Discard input frames which are no longer needed. */
+	const size_t shift = r->index + 1 - half;
+	if (shift > 0) {
+		r->history_len -= shift * channels;
+		memmove(r->history, &r->history[shift * channels],
+				sizeof(*r->history) * r->history_len);
+		r->index -= shift;
+	}
+
+	return n * channels;
+}
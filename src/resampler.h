@@ -0,0 +1,78 @@
+/*
+ * BlueALSA - resampler.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_RESAMPLER_H_
+#define BLUEALSA_RESAMPLER_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * The number of input frames which can be buffered by the resampler
+ * on top of the filter look-ahead. */
+#define RESAMPLER_CAPACITY 4096
+
+enum resampler_quality {
+	RESAMPLER_QUALITY_NONE = 0,
+	RESAMPLER_QUALITY_LOW,
+	RESAMPLER_QUALITY_MEDIUM,
+	RESAMPLER_QUALITY_HIGH,
+};
+
+/**
+ * Polyphase sample rate converter.
+ *
+ * The conversion ratio is reduced to the rational number L/M, and for every
+ * one of L phases a windowed-sinc filter is precomputed. Output frames are
+ * calculated directly from the input signal history, so there is no need
+ * for the explicit up-sampling nor the down-sampling stage. */
+struct resampler {
+	/* precomputed filter coefficients (phases x taps) */
+	float *filter;
+	/* input signal history (frames x channels) */
+	float *history;
+	/* the number of samples in the history */
+	size_t history_len;
+	/* interpolation and decimation factors */
+	unsigned int l;
+	unsigned int m;
+	/* the number of taps per phase */
+	unsigned int taps;
+	/* the position of the next output frame (in frames) */
+	size_t index;
+	unsigned int phase;
+	unsigned int rate_in;
+	unsigned int channels;
+	/* sample bit-width (16, 24 or 32) */
+	unsigned int width;
+};
+
+int resampler_init(struct resampler *r, enum resampler_quality quality,
+		unsigned int width, unsigned int channels,
+		unsigned int rate_in, unsigned int rate_out);
+void resampler_free(struct resampler *r);
+void resampler_reset(struct resampler *r);
+
+/**
+ * Check whether the resampler has been initialized. */
+#define resampler_is_initialized(r) ((r)->filter != NULL)
+
+size_t resampler_get_needed(const struct resampler *r, size_t samples);
+size_t resampler_get_space(const struct resampler *r);
+unsigned int resampler_get_delay(const struct resampler *r);
+
+size_t resampler_push(struct resampler *r, const void *buffer, size_t samples);
+size_t resampler_pull(struct resampler *r, void *buffer, size_t samples);
+
+#endif
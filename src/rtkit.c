@@ -0,0 +1,115 @@
+/*
+ * BlueALSA - rtkit.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "rtkit.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <gio/gio.h>
+#include <glib.h>
+
+#include "bluealsa.h"
+#include "dbus.h"
+#include "shared/log.h"
+
+/**
+ * Get integer property of the RealtimeKit service. */
+static int rtkit_get_property(const char *property, int64_t *value) {
+
+	GError *err = NULL;
+	GVariant *v;
+
+	if ((v = g_dbus_get_property(config.dbus, RTKIT_SERVICE, RTKIT_PATH_RTKIT,
+					RTKIT_IFACE_RTKIT, property, &err)) == NULL) {
+		debug("Couldn't get RealtimeKit property: %s: %s", property, err->message);
+		g_error_free(err);
+		return -1;
+	}
+
+	int rv = 0;
+	if (g_variant_is_of_type(v, G_VARIANT_TYPE_INT32))
+		*value = g_variant_get_int32(v);
+	else if (g_variant_is_of_type(v, G_VARIANT_TYPE_INT64))
+		*value = g_variant_get_int64(v);
+	else
+		rv = -1;
+
+	g_variant_unref(v);
+	return rv;
+}
+
+/**
+ * Make thread real-time with the help of the RealtimeKit service.
+ *
+ * The RealtimeKit grants the SCHED_RR policy only. If the requested priority
+ * exceeds the maximum allowed by the service, it will be lowered.
+ *
+ * @param tid The kernel thread ID (not the pthread_t value).
+ * @param priority The real-time priority.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int rtkit_make_thread_realtime(pid_t tid, int priority) {
+
+	GDBusMessage *msg = NULL, *rep = NULL;
+	GError *err = NULL;
+	int64_t value;
+	int rv = -1;
+
+	if (config.dbus == NULL)
+		return errno = ENOTCONN, -1;
+
+	if (rtkit_get_property("MaxRealtimePriority", &value) == 0 &&
+			priority > value) {
+		debug("Limiting real-time priority to RealtimeKit maximum: %d", (int)value);
+		priority = value;
+	}
+
+	/* The RealtimeKit refuses to elevate threads of processes which have
+	 * no limit for the CPU time consumed under the real-time scheduling. */
+	struct rlimit rl;
+	if (rtkit_get_property("RTTimeUSecMax", &value) == 0 &&
+			getrlimit(RLIMIT_RTTIME, &rl) == 0 &&
+			(rl.rlim_max == RLIM_INFINITY || rl.rlim_max > (rlim_t)value)) {
+		rl.rlim_cur = rl.rlim_max = value;
+		if (setrlimit(RLIMIT_RTTIME, &rl) == -1)
+			warn("Couldn't set real-time CPU time limit: %s", strerror(errno));
+	}
+
+	msg = g_dbus_message_new_method_call(RTKIT_SERVICE, RTKIT_PATH_RTKIT,
+			RTKIT_IFACE_RTKIT, "MakeThreadRealtime");
+	g_dbus_message_set_body(msg, g_variant_new("(tu)",
+				(uint64_t)tid, (uint32_t)priority));
+
+	if ((rep = g_dbus_connection_send_message_with_reply_sync(config.dbus, msg,
+					G_DBUS_SEND_MESSAGE_FLAGS_NONE, -1, NULL, NULL, &err)) == NULL)
+		goto fail;
+
+	if (g_dbus_message_get_message_type(rep) == G_DBUS_MESSAGE_TYPE_ERROR) {
+		g_dbus_message_to_gerror(rep, &err);
+		goto fail;
+	}
+
+	rv = 0;
+
+fail:
+	if (msg != NULL)
+		g_object_unref(msg);
+	if (rep != NULL)
+		g_object_unref(rep);
+	if (err != NULL) {
+		debug("Couldn't make thread real-time via RealtimeKit: %s", err->message);
+		g_error_free(err);
+		errno = EPERM;
+	}
+	return rv;
+}
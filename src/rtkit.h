@@ -0,0 +1,27 @@
+/*
+ * BlueALSA - rtkit.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_RTKIT_H_
+#define BLUEALSA_RTKIT_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <sys/types.h>
+
+#define RTKIT_SERVICE "org.freedesktop.RealtimeKit1"
+
+#define RTKIT_IFACE_RTKIT             RTKIT_SERVICE
+#define RTKIT_PATH_RTKIT              "/org/freedesktop/RealtimeKit1"
+
+int rtkit_make_thread_realtime(pid_t tid, int priority);
+
+#endif
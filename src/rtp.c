@@ -18,6 +18,9 @@
 /**
  * Initialize RTP headers.
  *
+ * Initialized headers shall be used as a template for outgoing packets. The
+ * sequence number and the timestamp are set by the rtp_state_new_packet().
+ *
  * @param s The memory area where the RTP headers will be initialized.
  * @param hdr The address where the pointer to the RTP header will be stored.
  * @param phdr The address where the pointer to the RTP payload header will
@@ -30,8 +33,6 @@ void *rtp_a2dp_init(void *s, rtp_header_t **hdr, void **phdr, size_t phdr_size)
 	memset(header, 0, RTP_HEADER_LEN + phdr_size);
 	header->paytype = 96;
 	header->version = 2;
-	header->seq_number = random();
-	header->timestamp = random();
 
 	uint8_t *data = (uint8_t *)&header->csrc[header->cc];
 
@@ -46,9 +47,15 @@ void *rtp_a2dp_init(void *s, rtp_header_t **hdr, void **phdr, size_t phdr_size)
  *
  * @param hdr The pointer to data with RTP header to validate.
  * @param seq_number The pointer to a local RTP sequence number.
+ * @param missing The address where the number of packets lost just before
+ *   the given one will be stored. This parameter might be NULL.
  * @return On success, this function returns pointer to data just after
  *   the RTP header - RTP header payload. On failure, NULL is returned. */
-void *rtp_a2dp_payload(const rtp_header_t *hdr, uint16_t *seq_number) {
+void *rtp_a2dp_payload(const rtp_header_t *hdr, uint16_t *seq_number,
+		unsigned int *missing) {
+
+	if (missing != NULL)
+		*missing = 0;
 
 #if ENABLE_PAYLOADCHECK
 	if (hdr->paytype < 96) {
@@ -61,10 +68,80 @@ void *rtp_a2dp_payload(const rtp_header_t *hdr, uint16_t *seq_number) {
 	uint16_t hdr_seq_number = be16toh(hdr->seq_number);
 
 	if (hdr_seq_number != loc_seq_number) {
-		if (loc_seq_number != 1)
+		if (loc_seq_number != 1) {
 			warn("Missing RTP packet: %u != %u", hdr_seq_number, loc_seq_number);
+			/* do not report packets which were reordered or duplicated */
+			const uint16_t lost = hdr_seq_number - loc_seq_number;
+			if (missing != NULL && lost < 0x8000)
+				*missing = lost;
+		}
 		*seq_number = hdr_seq_number;
 	}
 
 	return (void *)&hdr->csrc[hdr->cc];
 }
+
+/**
+ * Initialize the state of the outgoing RTP stream.
+ *
+ * @param rtp The RTP stream state structure.
+ * @param pcm_samplerate The sampling rate of the PCM stream.
+ * @param clock_rate The RTP timestamp clock rate. For most A2DP codecs it
+ *   is equal to the PCM sampling rate, however, e.g. the MPEG audio payload
+ *   uses the 90 kHz clock. */
+void rtp_state_init(struct rtp_state *rtp, unsigned int pcm_samplerate,
+		unsigned int clock_rate) {
+	rtp->seq_number = random();
+	rtp->ts_offset = random();
+	rtp->pcm_frames = 0;
+	rtp->pcm_samplerate = pcm_samplerate;
+	rtp->clock_rate = clock_rate;
+}
+
+/**
+ * Get RTP timestamp of the current PCM frame.
+ *
+ * The timestamp is calculated from the overall number of PCM frames, so it
+ * does not accumulate rounding errors when the number of PCM frames in the
+ * packet does not translate into an integral number of clock ticks. */
+uint32_t rtp_state_get_timestamp(const struct rtp_state *rtp) {
+	if (rtp->clock_rate == rtp->pcm_samplerate)
+		return rtp->ts_offset + rtp->pcm_frames;
+	return rtp->ts_offset + rtp->pcm_frames * rtp->clock_rate / rtp->pcm_samplerate;
+}
+
+/**
+ * Update RTP header for the new outgoing packet.
+ *
+ * The sequence number is incremented and the timestamp is set to the one
+ * of the current PCM frame. All packets created between subsequent state
+ * updates (e.g. fragments of a single frame) will share the timestamp.
+ *
+ * @param rtp The RTP stream state structure.
+ * @param hdr The RTP header of the outgoing packet. */
+void rtp_state_new_packet(struct rtp_state *rtp, rtp_header_t *hdr) {
+	hdr->seq_number = htobe16(++rtp->seq_number);
+	hdr->timestamp = htobe32(rtp_state_get_timestamp(rtp));
+}
+
+/**
+ * Create RTP headers for the new outgoing packet from the template.
+ *
+ * The RTP header and the payload header are copied from the template into
+ * the given memory area, and the RTP header is updated as it is done by the
+ * rtp_state_new_packet(). Such headers can be attached to the payload with
+ * the scatter-gather IO, so fragmented frames do not have to be copied.
+ *
+ * @param rtp The RTP stream state structure.
+ * @param s The memory area where the RTP headers will be stored. It shall
+ *   be big enough to hold the RTP header and the payload header.
+ * @param tmpl The RTP headers template initialized by the rtp_a2dp_init().
+ * @param phdr_size The size of the RTP payload header.
+ * @return This function returns the address of the RTP header. */
+rtp_header_t *rtp_state_new_packet_from(struct rtp_state *rtp, void *s,
+		const rtp_header_t *tmpl, size_t phdr_size) {
+	rtp_header_t *header = s;
+	memcpy(header, tmpl, RTP_HEADER_LEN + tmpl->cc * sizeof(*tmpl->csrc) + phdr_size);
+	rtp_state_new_packet(rtp, header);
+	return header;
+}
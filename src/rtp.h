@@ -72,7 +72,38 @@ typedef struct rtp_mpeg_audio_header {
 	uint16_t offset;
 } __attribute__ ((packed)) rtp_mpeg_audio_header_t;
 
+/**
+ * RTP timestamp clock rate of the MPEG audio payload. */
+#define RTP_MPEG_AUDIO_CLOCK_RATE 90000
+
+/**
+ * State of the outgoing RTP stream. */
+struct rtp_state {
+	/* sequence number of the last packet */
+	uint16_t seq_number;
+	/* RTP timestamp of the first PCM frame */
+	uint32_t ts_offset;
+	/* number of PCM frames since the stream start */
+	uint64_t pcm_frames;
+	/* sampling rate of the PCM stream */
+	unsigned int pcm_samplerate;
+	/* RTP timestamp clock rate */
+	unsigned int clock_rate;
+};
+
 void *rtp_a2dp_init(void *s, rtp_header_t **hdr, void **phdr, size_t phdr_size);
-void *rtp_a2dp_payload(const rtp_header_t *hdr, uint16_t *seq_number);
+void *rtp_a2dp_payload(const rtp_header_t *hdr, uint16_t *seq_number,
+		unsigned int *missing);
+
+void rtp_state_init(struct rtp_state *rtp, unsigned int pcm_samplerate,
+		unsigned int clock_rate);
+void rtp_state_new_packet(struct rtp_state *rtp, rtp_header_t *hdr);
+rtp_header_t *rtp_state_new_packet_from(struct rtp_state *rtp, void *s,
+		const rtp_header_t *tmpl, size_t phdr_size);
+uint32_t rtp_state_get_timestamp(const struct rtp_state *rtp);
+
+/**
+ * Advance the RTP stream by the given number of PCM frames. */
+#define rtp_state_update(rtp, frames) ((rtp)->pcm_frames += (frames))
 
 #endif
@@ -0,0 +1,223 @@
+/*
+ * BlueALSA - sched-policy.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "sched-policy.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "rtkit.h"
+#include "shared/defs.h"
+#include "shared/log.h"
+
+static const struct {
+	const char *name;
+	int policy;
+} policies[] = {
+	{ "other", SCHED_OTHER },
+	{ "fifo", SCHED_FIFO },
+	{ "rr", SCHED_RR },
+};
+
+/**
+ * Parse CPU list, e.g. "0-2,4". */
+static int sched_policy_parse_cpus(cpu_set_t *cpus, const char *str) {
+
+	CPU_ZERO(cpus);
+
+	do {
+		char *tmp;
+		unsigned long first, last;
+		first = last = strtoul(str, &tmp, 10);
+		if (tmp == str)
+			return errno = EINVAL, -1;
+		if (*tmp == '-') {
+			str = tmp + 1;
+			last = strtoul(str, &tmp, 10);
+			if (tmp == str)
+				return errno = EINVAL, -1;
+		}
+		if (first > last || last >= CPU_SETSIZE)
+			return errno = EINVAL, -1;
+		for (unsigned long i = first; i <= last; i++)
+			CPU_SET(i, cpus);
+		if (*tmp != ',' && *tmp != '\0')
+			return errno = EINVAL, -1;
+		str = tmp + 1;
+	} while (str[-1] == ',');
+
+	return 0;
+}
+
+/**
+ * Parse scheduling policy specification.
+ *
+ * The specification has the form of "POLICY[:PRIORITY][@CPUS]", where the
+ * POLICY is one of "other", "fifo" or "rr", the PRIORITY is the static
+ * priority of real-time policies and the CPUS is a comma-separated list
+ * of CPU numbers or ranges, e.g. "fifo:50@0-1,3".
+ *
+ * @param p Address of the structure where the policy shall be stored.
+ * @param str The policy specification.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int sched_policy_parse(struct sched_policy *p, const char *str) {
+
+	struct sched_policy tmp = { .policy = -1 };
+	const size_t len = strcspn(str, ":@");
+
+	for (size_t i = 0; i < ARRAYSIZE(policies); i++)
+		if (strlen(policies[i].name) == len &&
+				strncasecmp(str, policies[i].name, len) == 0)
+			tmp.policy = policies[i].policy;
+
+	if (tmp.policy == -1)
+		return errno = EINVAL, -1;
+
+	const int min = sched_get_priority_min(tmp.policy);
+	const int max = sched_get_priority_max(tmp.policy);
+
+	str += len;
+	tmp.priority = min;
+
+	if (*str == ':') {
+		char *end;
+		tmp.priority = strtol(++str, &end, 10);
+		if (end == str || (*end != '@' && *end != '\0'))
+			return errno = EINVAL, -1;
+		str = end;
+	}
+
+	if (tmp.priority < min || tmp.priority > max)
+		return errno = EINVAL, -1;
+
+	if (*str == '@' &&
+			sched_policy_parse_cpus(&tmp.cpus, str + 1) == -1)
+		return -1;
+
+	*p = tmp;
+	return 0;
+}
+
+/**
+ * Convert scheduling policy to the human-readable string.
+ *
+ * The string has the same form as the one accepted by the parser.
+ *
+ * @param p Pointer to the scheduling policy structure.
+ * @param buffer Address of the buffer where the string shall be stored.
+ * @param size The size of the buffer.
+ * @return On success this function returns the length of the string.
+ *   If the buffer is too small, -1 is returned and errno is set to
+ *   ENOSPC. */
+int sched_policy_to_string(const struct sched_policy *p, char *buffer, size_t size) {
+
+	const char *name = "unknown";
+	for (size_t i = 0; i < ARRAYSIZE(policies); i++)
+		if (policies[i].policy == p->policy)
+			name = policies[i].name;
+
+	size_t len = snprintf(buffer, size, "%s", name);
+	if ((p->policy == SCHED_FIFO || p->policy == SCHED_RR) && len < size)
+		len += snprintf(&buffer[len], size - len, ":%d", p->priority);
+
+	char sep = '@';
+	for (int i = 0; i < CPU_SETSIZE; i++) {
+		if (!CPU_ISSET(i, &p->cpus))
+			continue;
+		int last = i;
+		while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &p->cpus))
+			last++;
+		if (len >= size)
+			break;
+		if (last == i)
+			len += snprintf(&buffer[len], size - len, "%c%d", sep, i);
+		else
+			len += snprintf(&buffer[len], size - len, "%c%d-%d", sep, i, last);
+		sep = ',';
+		i = last;
+	}
+
+	if (len >= size)
+		return errno = ENOSPC, -1;
+	return len;
+}
+
+/**
+ * Apply scheduling policy to the calling thread.
+ *
+ * If the real-time policy can not be set due to insufficient privileges,
+ * the RealtimeKit service will be used instead (if available).
+ *
+ * @param p Pointer to the scheduling policy structure.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int sched_policy_apply(const struct sched_policy *p) {
+
+	const pthread_t self = pthread_self();
+	int err = 0;
+	int ret;
+
+	if (CPU_COUNT(&p->cpus) > 0)
+		err = pthread_setaffinity_np(self, sizeof(p->cpus), &p->cpus);
+
+	if (p->policy == SCHED_OTHER)
+		goto final;
+
+	const struct sched_param param = { .sched_priority = p->priority };
+	if ((ret = pthread_setschedparam(self, p->policy, &param)) == EPERM) {
+		debug("Couldn't set real-time policy, trying RealtimeKit");
+		ret = rtkit_make_thread_realtime(syscall(SYS_gettid), p->priority) == 0 ? 0 : errno;
+	}
+
+	if (err == 0)
+		err = ret;
+
+final:
+	if (err != 0)
+		return errno = err, -1;
+	return 0;
+}
+
+/**
+ * Get effective scheduling policy of the calling thread.
+ *
+ * @param p Address of the structure where the policy shall be stored.
+ *   If the thread is allowed to run on every online CPU, the CPU affinity
+ *   mask will be cleared.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int sched_policy_get(struct sched_policy *p) {
+
+	const pthread_t self = pthread_self();
+	struct sched_param param;
+	int err;
+
+	if ((err = pthread_getschedparam(self, &p->policy, &param)) != 0 ||
+			(err = pthread_getaffinity_np(self, sizeof(p->cpus), &p->cpus)) != 0)
+		return errno = err, -1;
+
+#ifdef SCHED_RESET_ON_FORK
+	p->policy &= ~SCHED_RESET_ON_FORK;
+#endif
+	p->priority = param.sched_priority;
+
+	if (CPU_COUNT(&p->cpus) >= sysconf(_SC_NPROCESSORS_ONLN))
+		CPU_ZERO(&p->cpus);
+
+	return 0;
+}
@@ -0,0 +1,38 @@
+/*
+ * BlueALSA - sched-policy.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_SCHEDPOLICY_H_
+#define BLUEALSA_SCHEDPOLICY_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <sched.h>
+#include <stddef.h>
+
+/**
+ * Thread scheduling policy. */
+struct sched_policy {
+	/* scheduling policy, e.g. SCHED_FIFO */
+	int policy;
+	/* static priority for real-time policies */
+	int priority;
+	/* CPU affinity mask, if empty the thread is not pinned */
+	cpu_set_t cpus;
+};
+
+int sched_policy_parse(struct sched_policy *p, const char *str);
+int sched_policy_to_string(const struct sched_policy *p, char *buffer, size_t size);
+
+int sched_policy_apply(const struct sched_policy *p);
+int sched_policy_get(struct sched_policy *p);
+
+#endif
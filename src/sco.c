@@ -11,11 +11,14 @@
 #include "sco.h"
 
 #include <errno.h>
-#include <poll.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
@@ -24,147 +27,315 @@
 #include <bluetooth/hci_lib.h>
 #include <bluetooth/sco.h>
 
+#include <bsd/sys/time.h>
+
+#include "aec.h"
 #include "ba-device.h"
 #include "bluealsa.h"
+#if ENABLE_LC3_SWB
+# include "codec-lc3-swb.h"
+#endif
 #include "codec-msbc.h"
 #include "hci.h"
 #include "hfp.h"
 #include "io.h"
+#include "trace.h"
 #include "utils.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
 #include "shared/log.h"
+#include "shared/rb.h"
 #include "shared/rt.h"
 
 /**
- * SCO dispatcher internal data. */
-struct sco_data {
-	struct ba_adapter *a;
-	struct pollfd pfd;
-};
-
-static void sco_dispatcher_cleanup(struct sco_data *data) {
-	debug("SCO dispatcher cleanup: %s", data->a->hci.name);
-	if (data->pfd.fd != -1)
-		close(data->pfd.fd);
-}
-
-static void *sco_dispatcher_thread(struct ba_adapter *a) {
+ * The maximal number of events handled by the SCO dispatcher at once. */
+#define SCO_DISPATCHER_EVENTS 8
 
-	struct sco_data data = { .a = a, .pfd = { -1, POLLIN, 0 } };
+/**
+ * Dispatcher of incoming SCO links shared by all adapters. */
+static struct {
+	pthread_mutex_t mutex;
+	pthread_t thread;
+	/* epoll set with the listening sockets of all adapters */
+	int epoll_fd;
+} sco_dispatcher = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.epoll_fd = -1,
+};
 
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_push(PTHREAD_CLEANUP(sco_dispatcher_cleanup), &data);
+/**
+ * Open SCO socket listening for incoming links on the given adapter. */
+static int sco_dispatcher_listen(struct ba_adapter *a) {
 
-	if ((data.pfd.fd = hci_sco_open(data.a->hci.dev_id)) == -1) {
+	int fd, err;
+	if ((fd = hci_sco_open(a->hci.dev_id)) == -1) {
 		error("Couldn't open SCO socket: %s", strerror(errno));
+		return -1;
+	}
+
+	/* Adapter might be removed between the poll and the accept, so the
+	 * listening socket must not block the dispatcher of other adapters. */
+	if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1) {
+		error("Couldn't set non-blocking SCO socket: %s", strerror(errno));
 		goto fail;
 	}
 
 #if ENABLE_MSBC
 	uint32_t defer = 1;
-	if (setsockopt(data.pfd.fd, SOL_BLUETOOTH, BT_DEFER_SETUP, &defer, sizeof(defer)) == -1) {
+	if (setsockopt(fd, SOL_BLUETOOTH, BT_DEFER_SETUP, &defer, sizeof(defer)) == -1) {
 		error("Couldn't set deferred connection setup: %s", strerror(errno));
 		goto fail;
 	}
 #endif
 
-	if (listen(data.pfd.fd, 10) == -1) {
+	if (listen(fd, 10) == -1) {
 		error("Couldn't listen on SCO socket: %s", strerror(errno));
 		goto fail;
 	}
 
-	debug("Starting SCO dispatcher loop: %s", a->hci.name);
-	for (;;) {
+	return fd;
 
-		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+fail:
+	err = errno;
+	close(fd);
+	return errno = err, -1;
+}
 
-		if (poll(&data.pfd, 1, -1) == -1) {
-			if (errno == EINTR)
-				continue;
-			error("SCO dispatcher poll error: %s", strerror(errno));
-			goto fail;
-		}
+/**
+ * Incoming SCO link waiting for the hand-over. */
+struct sco_link {
+	struct ba_transport *t;
+	int fd;
+};
 
-		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+/**
+ * Hand over incoming SCO link to the transport.
+ *
+ * The link authorization and the transport restart are blocking operations,
+ * so this function runs in a dedicated thread, not to stall the shared SCO
+ * dispatcher. The thread inherits the dispatcher scheduling policy. */
+static void *sco_dispatcher_handover(struct sco_link *link) {
 
-		struct sockaddr_sco addr;
-		socklen_t addrlen = sizeof(addr);
-		struct ba_device *d = NULL;
-		struct ba_transport *t = NULL;
-		int fd = -1;
+	struct ba_transport *t = link->t;
+	int fd = link->fd;
+	free(link);
 
-		if ((fd = accept(data.pfd.fd, (struct sockaddr *)&addr, &addrlen)) == -1) {
-			error("Couldn't accept incoming SCO link: %s", strerror(errno));
-			goto cleanup;
-		}
+#if ENABLE_MSBC
+	struct bt_voice voice = { .setting = BT_VOICE_TRANSPARENT };
+	if ((t->type.codec == HFP_CODEC_MSBC || t->type.codec == HFP_CODEC_LC3_SWB) &&
+			setsockopt(fd, SOL_BLUETOOTH, BT_VOICE, &voice, sizeof(voice)) == -1) {
+		error("Couldn't setup transparent voice: %s", strerror(errno));
+		goto cleanup;
+	}
+	if (read(fd, &voice, 1) == -1) {
+		error("Couldn't authorize SCO connection: %s", strerror(errno));
+		goto cleanup;
+	}
+#endif
 
-		debug("New incoming SCO link: %s: %d", batostr_(&addr.sco_bdaddr), fd);
+	ba_transport_stop(t);
+	/* Without IO threads (offload mode) the previous
+	 * link is not released by the thread cleanup. */
+	ba_transport_release(t);
 
-		if ((d = ba_device_lookup(data.a, &addr.sco_bdaddr)) == NULL) {
-			error("Couldn't lookup device: %s", batostr_(&addr.sco_bdaddr));
-			goto cleanup;
-		}
+	pthread_mutex_lock(&t->bt_fd_mtx);
 
-		if ((t = ba_transport_lookup(d, d->bluez_dbus_path)) == NULL) {
-			error("Couldn't lookup transport: %s", d->bluez_dbus_path);
-			goto cleanup;
-		}
+	t->bt_fd = fd;
+	t->mtu_read = t->mtu_write = hci_sco_get_mtu(fd);
+	fd = -1;
+
+	pthread_mutex_unlock(&t->bt_fd_mtx);
+
+	ba_transport_start(t);
 
 #if ENABLE_MSBC
-		struct bt_voice voice = { .setting = BT_VOICE_TRANSPARENT };
-		if (t->type.codec == HFP_CODEC_MSBC &&
-				setsockopt(fd, SOL_BLUETOOTH, BT_VOICE, &voice, sizeof(voice)) == -1) {
-			error("Couldn't setup transparent voice: %s", strerror(errno));
-			goto cleanup;
-		}
-		if (read(fd, &voice, 1) == -1) {
-			error("Couldn't authorize SCO connection: %s", strerror(errno));
-			goto cleanup;
-		}
+cleanup:
 #endif
+	ba_transport_unref(t);
+	if (fd != -1)
+		close(fd);
+	return NULL;
+}
+
+/**
+ * Accept incoming SCO link and pass it to the hand-over thread. */
+static void sco_dispatcher_accept(struct ba_adapter *a, int listen_fd) {
+
+	struct sockaddr_sco addr;
+	socklen_t addrlen = sizeof(addr);
+	struct ba_device *d = NULL;
+	struct ba_transport *t = NULL;
+	struct sco_link *link = NULL;
+	pthread_t thread;
+	int fd = -1;
+	int ret;
+
+	if ((fd = accept(listen_fd, (struct sockaddr *)&addr, &addrlen)) == -1) {
+		if (errno != EAGAIN)
+			error("Couldn't accept incoming SCO link: %s", strerror(errno));
+		goto cleanup;
+	}
 
-		ba_transport_stop(t);
+	debug("New incoming SCO link: %s: %d", batostr_(&addr.sco_bdaddr), fd);
 
-		pthread_mutex_lock(&t->bt_fd_mtx);
+	if ((d = ba_device_lookup(a, &addr.sco_bdaddr)) == NULL) {
+		error("Couldn't lookup device: %s", batostr_(&addr.sco_bdaddr));
+		goto cleanup;
+	}
 
-		t->bt_fd = fd;
-		t->mtu_read = t->mtu_write = hci_sco_get_mtu(fd);
-		fd = -1;
+	if ((t = ba_transport_lookup(d, d->bluez_dbus_path)) == NULL) {
+		error("Couldn't lookup transport: %s", d->bluez_dbus_path);
+		goto cleanup;
+	}
 
-		pthread_mutex_unlock(&t->bt_fd_mtx);
+	if ((link = malloc(sizeof(*link))) == NULL) {
+		error("Couldn't hand over SCO link: %s", strerror(errno));
+		goto cleanup;
+	}
 
-		ba_transport_start(t);
+	link->t = t;
+	link->fd = fd;
+
+	if ((ret = pthread_create(&thread, NULL,
+					PTHREAD_ROUTINE(sco_dispatcher_handover), link)) != 0) {
+		error("Couldn't create SCO hand-over thread: %s", strerror(ret));
+		free(link);
+		goto cleanup;
+	}
+
+	pthread_detach(thread);
+	/* ownership passed to the hand-over thread */
+	t = NULL;
+	fd = -1;
 
 cleanup:
-		if (d != NULL)
-			ba_device_unref(d);
-		if (t != NULL)
-			ba_transport_unref(t);
-		if (fd != -1)
-			close(fd);
+	if (d != NULL)
+		ba_device_unref(d);
+	if (t != NULL)
+		ba_transport_unref(t);
+	if (fd != -1)
+		close(fd);
+}
+
+/**
+ * Stop listening for incoming SCO links on the broken socket.
+ *
+ * Listening socket will be reopened with the next SCO transport setup. */
+static void sco_dispatcher_remove(struct ba_adapter *a, int listen_fd) {
+
+	pthread_mutex_lock(&sco_dispatcher.mutex);
+
+	if (a->sco_listen_fd == listen_fd) {
+		warn("SCO listening socket error: %s", a->hci.name);
+		epoll_ctl(sco_dispatcher.epoll_fd, EPOLL_CTL_DEL, listen_fd, NULL);
+		close(listen_fd);
+		a->sco_listen_fd = -1;
+	}
+
+	pthread_mutex_unlock(&sco_dispatcher.mutex);
+}
+
+static void *sco_dispatcher_thread(void *userdata) {
+	(void)userdata;
+
+	if (sched_policy_apply(&config.sco.sched) == -1)
+		warn("Couldn't apply SCO dispatcher scheduling policy: %s", strerror(errno));
+
+	debug("Starting SCO dispatcher loop");
+	for (;;) {
+
+		struct epoll_event events[SCO_DISPATCHER_EVENTS];
+		int count;
+
+		if ((count = epoll_wait(sco_dispatcher.epoll_fd, events, ARRAYSIZE(events), -1)) == -1) {
+			if (errno == EINTR)
+				continue;
+			error("SCO dispatcher poll error: %s", strerror(errno));
+			break;
+		}
+
+		for (int i = 0; i < count; i++) {
+
+			struct ba_adapter *a;
+			/* Adapter might have been removed in the meantime. In such case
+			 * its listening socket is closed, so there is nothing to do. */
+			if ((a = ba_adapter_lookup(events[i].data.u32)) == NULL)
+				continue;
+
+			const int listen_fd = a->sco_listen_fd;
+			if (listen_fd != -1) {
+				if (events[i].events & (EPOLLERR | EPOLLHUP))
+					sco_dispatcher_remove(a, listen_fd);
+				else
+					sco_dispatcher_accept(a, listen_fd);
+			}
+
+			ba_adapter_unref(a);
+
+		}
 
 	}
 
-fail:
-	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-	pthread_cleanup_pop(1);
 	return NULL;
 }
 
-int sco_setup_connection_dispatcher(struct ba_adapter *a) {
+/**
+ * Create shared SCO dispatcher thread.
+ *
+ * This function shall be called with the dispatcher mutex locked. */
+static int sco_dispatcher_init(void) {
+
+	int ret;
 
-	/* skip setup if dispatcher thread is already running */
-	if (!pthread_equal(a->sco_dispatcher, config.main_thread))
+	if (sco_dispatcher.epoll_fd != -1)
 		return 0;
 
+	if ((sco_dispatcher.epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		error("Couldn't create SCO dispatcher epoll: %s", strerror(errno));
+		return -1;
+	}
+
+	if ((ret = pthread_create(&sco_dispatcher.thread, NULL,
+					sco_dispatcher_thread, NULL)) != 0) {
+		error("Couldn't create SCO dispatcher: %s", strerror(ret));
+		close(sco_dispatcher.epoll_fd);
+		sco_dispatcher.epoll_fd = -1;
+		return errno = ret, -1;
+	}
+
+	pthread_setname_np(sco_dispatcher.thread, "ba-sco-dispatch");
+	debug("Created SCO dispatcher [%s]", "ba-sco-dispatch");
+
+	return 0;
+}
+
+/**
+ * Start dispatching incoming SCO links of the given adapter.
+ *
+ * All adapters share a single dispatcher thread, which waits for incoming
+ * links on the listening sockets of all adapters at once. */
+int sco_setup_connection_dispatcher(struct ba_adapter *a) {
+
+	int ret = 0;
+
+	pthread_mutex_lock(&sco_dispatcher.mutex);
+
+	/* skip setup if adapter is already dispatched */
+	if (a->sco_listen_fd != -1)
+		goto final;
+
 	/* XXX: It is a known issue with Broadcom chips, that by default, the SCO
 	 *      packets are routed via the chip's PCM interface. However, the IO
-	 *      thread expects data to be available via the transport interface. */
-	if (a->chip.manufacturer == BT_COMPID_BROADCOM) {
-
-		int dd;
+	 *      thread expects data to be available via the transport interface.
+	 *      In the offload mode we will keep (or set) the PCM routing, so the
+	 *      SCO audio will be handled by the hardware codec. */
+	if (a->chip.manufacturer == BT_COMPID_BROADCOM ||
+			a->chip.manufacturer == BT_COMPID_CYPRESS) {
+
+		const uint8_t target = config.sco.offload ?
+			BT_BCM_PARAM_ROUTING_PCM : BT_BCM_PARAM_ROUTING_TRANSPORT;
 		uint8_t routing, clock, frame, sync, clk;
+		int dd;
 
 		debug("Checking Broadcom internal SCO routing");
 
@@ -173,12 +344,18 @@ int sco_setup_connection_dispatcher(struct ba_adapter *a) {
 			error("Couldn't read SCO routing params: %s", strerror(errno));
 		else {
 			debug("Current SCO interface setup: %u %u %u %u %u", routing, clock, frame, sync, clk);
-			if (routing != BT_BCM_PARAM_ROUTING_TRANSPORT) {
-				debug("Setting SCO routing via transport interface");
-				if (hci_bcm_write_sco_pcm_params(dd, BT_BCM_PARAM_ROUTING_TRANSPORT,
+			if (routing != target) {
+				debug("Setting SCO routing via %s interface",
+						target == BT_BCM_PARAM_ROUTING_PCM ? "PCM" : "transport");
+				if (hci_bcm_write_sco_pcm_params(dd, target,
 						clock, frame, sync, clk, 1000) == -1)
-				error("Couldn't write SCO routing params: %s", strerror(errno));
+					error("Couldn't write SCO routing params: %s", strerror(errno));
+				else
+					routing = target;
 			}
+			/* Do not assume offload if the transport routing could not be
+			 * restored, because the user has not asked for it. */
+			a->sco_offload = config.sco.offload && routing == BT_BCM_PARAM_ROUTING_PCM;
 		}
 
 		if (dd != -1)
@@ -186,23 +363,115 @@ int sco_setup_connection_dispatcher(struct ba_adapter *a) {
 
 	}
 
-	int ret;
+	if (config.sco.offload && !a->sco_offload)
+		warn("SCO offload not supported: %s", a->hci.name);
+	if (a->sco_offload)
+		info("SCO audio routed via PCM interface: %s", a->hci.name);
 
-	/* Please note, that during the SCO dispatcher thread creation the adapter
-	 * is not referenced. It is guaranteed that the adapter will be available
-	 * during the whole live-span of the thread, because the thread is canceled
-	 * in the adapter cleanup routine. See the ba_adapter_unref() function. */
-	if ((ret = pthread_create(&a->sco_dispatcher, NULL,
-					PTHREAD_ROUTINE(sco_dispatcher_thread), a)) != 0) {
-		error("Couldn't create SCO dispatcher: %s", strerror(ret));
-		a->sco_dispatcher = config.main_thread;
-		return -1;
+	if (sco_dispatcher_init() == -1)
+		goto fail;
+
+	int fd;
+	if ((fd = sco_dispatcher_listen(a)) == -1)
+		goto fail;
+
+	/* Please note, that the adapter is not referenced by the dispatcher. The
+	 * event carries the HCI device ID only, and the adapter is looked up when
+	 * the incoming link arrives. The listening socket is closed (hence removed
+	 * from the epoll set) in the adapter cleanup routine. */
+	struct epoll_event event = { .events = EPOLLIN, .data.u32 = a->hci.dev_id };
+	a->sco_listen_fd = fd;
+
+	if (epoll_ctl(sco_dispatcher.epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+		error("Couldn't add SCO socket to dispatcher: %s", strerror(errno));
+		a->sco_listen_fd = -1;
+		close(fd);
+		goto fail;
 	}
 
-	pthread_setname_np(a->sco_dispatcher, "ba-sco-dispatch");
-	debug("Created SCO dispatcher [%s]: %s", "ba-sco-dispatch", a->hci.name);
+	debug("Dispatching incoming SCO links: %s", a->hci.name);
+	goto final;
 
-	return 0;
+fail:
+	ret = -1;
+final:
+	pthread_mutex_unlock(&sco_dispatcher.mutex);
+	return ret;
+}
+
+/**
+ * The maximal size of the SCO packet which can be handled by the IO threads.
+ * It is the size of the biggest eSCO packet (3-EV5) supported by the BT. */
+#define SCO_MTU_MAX 540
+/**
+ * The number of consecutive packets of the same size required to adapt
+ * the transport MTU. */
+#define SCO_MTU_DETECT_PACKETS 16
+
+/**
+ * SCO packet size detector state. */
+struct sco_mtu_detect {
+	/* size of the last received packet */
+	size_t len;
+	/* number of subsequent packets of the same size */
+	unsigned int count;
+};
+
+/**
+ * Adapt transport MTU to the size of received SCO packets.
+ *
+ * The MTU reported by the kernel is not reliable, and some BT controllers
+ * (especially USB dongles) require the packet size which matches the one
+ * selected for the SCO link, otherwise the audio is garbled or its latency
+ * grows. So, once the size of received packets has been stable for a number
+ * of consecutive packets, it is used as the transport MTU. */
+static void sco_mtu_detect_update(
+		struct ba_transport *t,
+		struct sco_mtu_detect *detect,
+		size_t len,
+		size_t size) {
+
+	/* Packet which has filled the whole read buffer might have been
+	 * truncated, so its size can not be used for the detection. */
+	if (len >= size)
+		len = 0;
+
+	if (len != detect->len) {
+		detect->len = len;
+		detect->count = 0;
+		return;
+	}
+
+	if (len == 0 || ++detect->count != SCO_MTU_DETECT_PACKETS ||
+			len > SCO_MTU_MAX)
+		return;
+
+	/* CVSD packet has to carry whole samples */
+	if (t->type.codec == HFP_CODEC_CVSD && len % sizeof(int16_t) != 0)
+		return;
+
+	/* MTU is read by the encoding thread, so update it with the
+	 * lock held, in the same way as the transport acquisition does */
+	pthread_mutex_lock(&t->bt_fd_mtx);
+	if (len != t->mtu_write) {
+		debug("Adapting SCO MTU to the received packet size: R:%zu W:%zu -> %zu",
+				t->mtu_read, t->mtu_write, len);
+		t->mtu_read = t->mtu_write = len;
+	}
+	pthread_mutex_unlock(&t->bt_fd_mtx);
+
+}
+
+/**
+ * Get the write MTU of the SCO transport.
+ *
+ * The MTU might be updated by the decoding thread at any time, so the
+ * encoding thread shall not read it directly. */
+static size_t sco_get_mtu_write(struct ba_transport *t) {
+	pthread_mutex_lock(&t->bt_fd_mtx);
+	const size_t mtu_write = t->mtu_write;
+	pthread_mutex_unlock(&t->bt_fd_mtx);
+	return mtu_write;
 }
 
 static void *sco_cvsd_enc_thread(struct ba_transport_thread *th) {
@@ -214,14 +483,12 @@ static void *sco_cvsd_enc_thread(struct ba_transport_thread *th) {
 	struct ba_transport_pcm *pcm = &t->sco.spk_pcm;
 	struct io_poll io = { .timeout = -1 };
 
-	const size_t mtu_samples = t->mtu_write / sizeof(int16_t);
-	const size_t mtu_write = t->mtu_write;
+	rb_t buffer = { 0 };
+	pthread_cleanup_push(PTHREAD_CLEANUP(rb_free), &buffer);
 
-	ffb_t buffer = { 0 };
-	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &buffer);
-
-	/* define a bigger buffer to enhance read performance */
-	if (ffb_init_int16_t(&buffer, mtu_samples * 4) == -1) {
+	/* Define a bigger buffer to enhance read performance. Also, the MTU
+	 * might be adapted at runtime, so make room for the biggest one. */
+	if (rb_init_int16_t(&buffer, SCO_MTU_MAX / sizeof(int16_t) * 4) == -1) {
 		error("Couldn't create data buffer: %s", strerror(errno));
 		goto fail_init;
 	}
@@ -229,8 +496,8 @@ static void *sco_cvsd_enc_thread(struct ba_transport_thread *th) {
 	debug_transport_thread_loop(th, "START");
 	for (ba_transport_thread_set_state_running(th);;) {
 
-		ssize_t samples = ffb_len_in(&buffer);
-		if ((samples = io_poll_and_read_pcm(&io, pcm, buffer.tail, samples)) <= 0) {
+		ssize_t samples = rb_len_in(&buffer);
+		if ((samples = io_poll_and_read_pcm(&io, pcm, rb_tail(&buffer), samples)) <= 0) {
 			if (samples == -1)
 				error("PCM poll and read error: %s", strerror(errno));
 			else if (samples == 0)
@@ -238,10 +505,14 @@ static void *sco_cvsd_enc_thread(struct ba_transport_thread *th) {
 			continue;
 		}
 
-		ffb_seek(&buffer, samples);
-		samples = ffb_len_out(&buffer);
+		rb_seek(&buffer, samples);
+		samples = rb_len_out(&buffer);
+
+		/* MTU might be updated by the decoding thread */
+		const size_t mtu_write = sco_get_mtu_write(t);
+		const size_t mtu_samples = mtu_write / sizeof(int16_t);
 
-		const int16_t *input = buffer.data;
+		const int16_t *input = rb_head(&buffer);
 		size_t input_samples = samples;
 
 		while (input_samples >= mtu_samples) {
@@ -257,13 +528,13 @@ static void *sco_cvsd_enc_thread(struct ba_transport_thread *th) {
 			input_samples -= mtu_samples;
 
 			/* keep data transfer at a constant bit rate */
-			asrsync_sync(&io.asrs, mtu_samples);
+			io_poll_pace(&io, th, mtu_samples);
 			/* update busy delay (encoding overhead) */
 			pcm->delay = asrsync_get_busy_usec(&io.asrs) / 100;
 
 		}
 
-		ffb_shift(&buffer, samples - input_samples);
+		rb_shift(&buffer, samples - input_samples);
 
 	}
 
@@ -285,11 +556,12 @@ static void *sco_cvsd_dec_thread(struct ba_transport_thread *th) {
 	struct ba_transport *t = th->t;
 	struct ba_transport_pcm *pcm = &t->sco.mic_pcm;
 	struct io_poll io = { .timeout = -1 };
+	struct sco_mtu_detect mtu_detect = { 0 };
 
 	ffb_t buffer = { 0 };
 	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &buffer);
 
-	if (ffb_init_int16_t(&buffer, t->mtu_read) == -1) {
+	if (ffb_init_int16_t(&buffer, SCO_MTU_MAX / sizeof(int16_t)) == -1) {
 		error("Couldn't create data buffers: %s", strerror(errno));
 		goto fail_ffb;
 	}
@@ -303,6 +575,9 @@ static void *sco_cvsd_dec_thread(struct ba_transport_thread *th) {
 		else if (len == 0)
 			goto exit;
 
+		if (len > 0)
+			sco_mtu_detect_update(t, &mtu_detect, len, ffb_blen_in(&buffer));
+
 		if (!ba_transport_pcm_is_active(pcm))
 			continue;
 
@@ -325,8 +600,109 @@ fail_ffb:
 	return NULL;
 }
 
+#if ENABLE_MSBC || ENABLE_LC3_SWB
+/**
+ * Wide-band speech codec carried in eSCO frames with the H2 header.
+ *
+ * Both mSBC and LC3-SWB codecs use the same framing and the same layout of
+ * the codec state (eSCO data and PCM buffers, frame counters), so the IO
+ * threads are shared. The common fields are accessed via their offsets in
+ * the codec specific state structure. */
+struct sco_h2_codec {
+	/* codec name used in log messages */
+	const char *name;
+	/* names of the cached encoder and decoder states */
+	const char *name_enc;
+	const char *name_dec;
+	/* the number of PCM samples in a single codec frame */
+	size_t codesamples;
+	/* the size of a single eSCO frame */
+	size_t frame_size;
+	size_t state_size;
+	int (*init)(void *state);
+	void (*finish)(void *state);
+	int (*encode)(void *state);
+	int (*decode)(void *state);
+	/* offsets of the common fields in the codec state */
+	size_t offset_data;
+	size_t offset_pcm;
+	size_t offset_frames;
+	size_t offset_frames_concealed;
+};
+
+/**
+ * Storage for the state of any eSCO H2 codec. */
+union sco_h2_codec_state {
+#if ENABLE_MSBC
+	struct esco_msbc msbc;
+#endif
+#if ENABLE_LC3_SWB
+	struct esco_lc3_swb lc3_swb;
+#endif
+};
+
+/**
+ * View of the common fields of the eSCO H2 codec state. */
+struct sco_h2 {
+	void *state;
+	rb_t *data;
+	rb_t *pcm;
+	size_t *frames;
+	size_t *frames_concealed;
+};
+
+static void sco_h2_bind(struct sco_h2 *h2, const struct sco_h2_codec *c,
+		union sco_h2_codec_state *state) {
+	memset(state, 0, sizeof(*state));
+	h2->state = state;
+	h2->data = (rb_t *)((uint8_t *)state + c->offset_data);
+	h2->pcm = (rb_t *)((uint8_t *)state + c->offset_pcm);
+	h2->frames = (size_t *)((uint8_t *)state + c->offset_frames);
+	h2->frames_concealed = (size_t *)((uint8_t *)state + c->offset_frames_concealed);
+}
+#endif
+
 #if ENABLE_MSBC
-static void *sco_msbc_enc_thread(struct ba_transport_thread *th) {
+static const struct sco_h2_codec sco_h2_msbc = {
+	.name = "mSBC",
+	.name_enc = "msbc-enc",
+	.name_dec = "msbc-dec",
+	.codesamples = MSBC_CODESAMPLES,
+	.frame_size = sizeof(esco_msbc_frame_t),
+	.state_size = sizeof(struct esco_msbc),
+	.init = (int (*)(void *))msbc_init,
+	.finish = (void (*)(void *))msbc_finish,
+	.encode = (int (*)(void *))msbc_encode,
+	.decode = (int (*)(void *))msbc_decode,
+	.offset_data = offsetof(struct esco_msbc, data),
+	.offset_pcm = offsetof(struct esco_msbc, pcm),
+	.offset_frames = offsetof(struct esco_msbc, frames),
+	.offset_frames_concealed = offsetof(struct esco_msbc, frames_concealed),
+};
+#endif
+
+#if ENABLE_LC3_SWB
+static const struct sco_h2_codec sco_h2_lc3_swb = {
+	.name = "LC3-SWB",
+	.name_enc = "lc3-swb-enc",
+	.name_dec = "lc3-swb-dec",
+	.codesamples = LC3_SWB_CODESAMPLES,
+	.frame_size = sizeof(esco_lc3_swb_frame_t),
+	.state_size = sizeof(struct esco_lc3_swb),
+	.init = (int (*)(void *))lc3_swb_init,
+	.finish = (void (*)(void *))lc3_swb_finish,
+	.encode = (int (*)(void *))lc3_swb_encode,
+	.decode = (int (*)(void *))lc3_swb_decode,
+	.offset_data = offsetof(struct esco_lc3_swb, data),
+	.offset_pcm = offsetof(struct esco_lc3_swb, pcm),
+	.offset_frames = offsetof(struct esco_lc3_swb, frames),
+	.offset_frames_concealed = offsetof(struct esco_lc3_swb, frames_concealed),
+};
+#endif
+
+#if ENABLE_MSBC || ENABLE_LC3_SWB
+static void *sco_h2_enc_thread(struct ba_transport_thread *th,
+		const struct sco_h2_codec *c) {
 
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_thread_cleanup), th);
@@ -334,21 +710,48 @@ static void *sco_msbc_enc_thread(struct ba_transport_thread *th) {
 	struct ba_transport *t = th->t;
 	struct ba_transport_pcm *pcm = &t->sco.spk_pcm;
 	struct io_poll io = { .timeout = -1 };
-	const size_t mtu_write = t->mtu_write;
 
-	struct esco_msbc msbc = { .initialized = false };
-	pthread_cleanup_push(PTHREAD_CLEANUP(msbc_finish), &msbc);
-
-	if (msbc_init(&msbc) != 0) {
-		error("Couldn't initialize mSBC codec: %s", strerror(errno));
-		goto fail_msbc;
+	union sco_h2_codec_state state;
+	struct sco_h2 enc;
+	sco_h2_bind(&enc, c, &state);
+
+	struct ba_device_codec codec = {
+		.d = t->d,
+		.name = c->name_enc,
+		.state = enc.state,
+		.state_size = c->state_size,
+		.destroy = c->finish,
+	};
+
+	/* Cached codec is marked as initialized, so
+	 * the initialization will only reset its state. */
+	ba_device_codec_acquire(&codec);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_device_codec_release), &codec);
+
+	if (c->init(enc.state) != 0) {
+		error("Couldn't initialize %s codec: %s", c->name, strerror(errno));
+		goto fail_init;
 	}
 
+	codec.ready = true;
+
 	debug_transport_thread_loop(th, "START");
 	for (ba_transport_thread_set_state_running(th);;) {
 
-		ssize_t samples = ffb_len_in(&msbc.pcm);
-		if ((samples = io_poll_and_read_pcm(&io, pcm, msbc.pcm.tail, samples)) <= 0) {
+		/* MTU might be updated by the decoding thread */
+		const size_t mtu_write = sco_get_mtu_write(t);
+
+		/* The data and PCM buffers can hold many codec frames, but read only
+		 * as many samples as required to complete the next BT packet. Other
+		 * way, the signal would be buffered in the IO thread for up to the
+		 * whole buffer length, which would not be reported to the client. */
+		const size_t frames = (mtu_write - MIN(rb_blen_out(enc.data), mtu_write) +
+				c->frame_size - 1) / c->frame_size;
+		const size_t needed = MAX(frames, 1) * c->codesamples;
+
+		ssize_t samples = rb_len_out(enc.pcm) < needed ? needed - rb_len_out(enc.pcm) : 0;
+		samples = MIN((size_t)samples, rb_len_in(enc.pcm));
+		if ((samples = io_poll_and_read_pcm(&io, pcm, rb_tail(enc.pcm), samples)) <= 0) {
 			if (samples == -1)
 				error("PCM poll and read error: %s", strerror(errno));
 			else if (samples == 0)
@@ -356,17 +759,20 @@ static void *sco_msbc_enc_thread(struct ba_transport_thread *th) {
 			continue;
 		}
 
-		ffb_seek(&msbc.pcm, samples);
-		if (msbc_encode(&msbc) == -1) {
-			warn("Couldn't encode mSBC: %s", strerror(errno));
-			ffb_rewind(&msbc.pcm);
+		rb_seek(enc.pcm, samples);
+		trace_probe2(encode_begin, th, rb_len_out(enc.pcm));
+		if (c->encode(enc.state) == -1) {
+			warn("Couldn't encode %s: %s", c->name, strerror(errno));
+			rb_rewind(enc.pcm);
 		}
+		trace_probe2(encode_end, th, rb_blen_out(enc.data));
 
-		if (msbc.frames == 0)
+		if (*enc.frames == 0)
 			continue;
 
-		uint8_t *data = msbc.data.data;
-		size_t data_len = ffb_blen_out(&msbc.data);
+		const size_t data_len_total = rb_blen_out(enc.data);
+		uint8_t *data = rb_head(enc.data);
+		size_t data_len = data_len_total;
 
 		while (data_len >= mtu_write) {
 
@@ -383,14 +789,16 @@ static void *sco_msbc_enc_thread(struct ba_transport_thread *th) {
 		}
 
 		/* keep data transfer at a constant bit rate */
-		asrsync_sync(&io.asrs, msbc.frames * MSBC_CODESAMPLES);
-		/* update busy delay (encoding overhead) */
-		pcm->delay = asrsync_get_busy_usec(&io.asrs) / 100;
+		io_poll_pace(&io, th, *enc.frames * c->codesamples);
 
-		/* Move unprocessed data to the front of our linear
-		 * buffer and clear the mSBC frame counter. */
-		ffb_shift(&msbc.data, ffb_blen_out(&msbc.data) - data_len);
-		msbc.frames = 0;
+		/* Consume transferred data and clear the frame counter. */
+		rb_shift(enc.data, data_len_total - data_len);
+		*enc.frames = 0;
+
+		/* update busy delay (encoding overhead) and the delay of the signal
+		 * which has been encoded but not transferred yet */
+		pcm->delay = asrsync_get_busy_usec(&io.asrs) / 100 +
+			data_len * c->codesamples / c->frame_size * 10000 / pcm->sampling;
 
 	}
 
@@ -398,15 +806,16 @@ exit:
 	debug_transport_thread_loop(th, "EXIT");
 	ba_transport_thread_set_state_stopping(th);
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-fail_msbc:
+fail_init:
 	pthread_cleanup_pop(1);
 	pthread_cleanup_pop(1);
 	return NULL;
 }
 #endif
 
-#if ENABLE_MSBC
-static void *sco_msbc_dec_thread(struct ba_transport_thread *th) {
+#if ENABLE_MSBC || ENABLE_LC3_SWB
+static void *sco_h2_dec_thread(struct ba_transport_thread *th,
+		const struct sco_h2_codec *c) {
 
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_thread_cleanup), th);
@@ -414,44 +823,302 @@ static void *sco_msbc_dec_thread(struct ba_transport_thread *th) {
 	struct ba_transport *t = th->t;
 	struct ba_transport_pcm *pcm = &t->sco.mic_pcm;
 	struct io_poll io = { .timeout = -1 };
-
-	struct esco_msbc msbc = { .initialized = false };
-	pthread_cleanup_push(PTHREAD_CLEANUP(msbc_finish), &msbc);
-
-	if (msbc_init(&msbc) != 0) {
-		error("Couldn't initialize mSBC codec: %s", strerror(errno));
-		goto fail_msbc;
+	struct sco_mtu_detect mtu_detect = { 0 };
+
+	union sco_h2_codec_state state;
+	struct sco_h2 dec;
+	sco_h2_bind(&dec, c, &state);
+
+	struct ba_device_codec codec = {
+		.d = t->d,
+		.name = c->name_dec,
+		.state = dec.state,
+		.state_size = c->state_size,
+		.destroy = c->finish,
+	};
+
+	/* Cached codec is marked as initialized, so
+	 * the initialization will only reset its state. */
+	ba_device_codec_acquire(&codec);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_device_codec_release), &codec);
+
+	if (c->init(dec.state) != 0) {
+		error("Couldn't initialize %s codec: %s", c->name, strerror(errno));
+		goto fail_init;
 	}
 
+	codec.ready = true;
+
 	debug_transport_thread_loop(th, "START");
 	for (ba_transport_thread_set_state_running(th);;) {
 
-		ssize_t len = ffb_blen_in(&msbc.data);
-		if ((len = io_poll_and_read_bt(&io, th, msbc.data.tail, len)) == -1)
+		ssize_t len = rb_blen_in(dec.data);
+		if ((len = io_poll_and_read_bt(&io, th, rb_tail(dec.data), len)) == -1)
 			error("BT poll and read error: %s", strerror(errno));
 		else if (len == 0)
 			goto exit;
 
+		if (len > 0)
+			sco_mtu_detect_update(t, &mtu_detect, len, rb_blen_in(dec.data));
+
 		if (!ba_transport_pcm_is_active(pcm))
 			continue;
 
-		ffb_seek(&msbc.data, len);
-		if (msbc_decode(&msbc) == -1) {
-			warn("Couldn't decode mSBC: %s", strerror(errno));
-			ffb_rewind(&msbc.data);
+		rb_seek(dec.data, len);
+		trace_probe2(decode_begin, th, rb_blen_out(dec.data));
+		if (c->decode(dec.state) == -1) {
+			warn("Couldn't decode %s: %s", c->name, strerror(errno));
+			rb_rewind(dec.data);
+		}
+		trace_probe2(decode_end, th, rb_len_out(dec.pcm));
+
+		if (*dec.frames_concealed > 0) {
+			atomic_fetch_add_explicit(&pcm->concealed_frames,
+					*dec.frames_concealed * c->codesamples, memory_order_relaxed);
+			*dec.frames_concealed = 0;
 		}
 
 		ssize_t samples;
-		if ((samples = ffb_len_out(&msbc.pcm)) <= 0)
+		if ((samples = rb_len_out(dec.pcm)) <= 0)
 			continue;
 
-		io_pcm_scale(pcm, msbc.pcm.data, samples);
-		if ((samples = io_pcm_write(pcm, msbc.pcm.data, samples)) == -1)
+		int16_t *output = rb_head(dec.pcm);
+		io_pcm_scale(pcm, output, samples);
+		if ((samples = io_pcm_write(pcm, output, samples)) == -1)
 			error("FIFO write error: %s", strerror(errno));
 		else if (samples == 0)
 			ba_transport_stop_if_no_clients(t);
 
-		ffb_shift(&msbc.pcm, samples);
+		rb_shift(dec.pcm, samples);
+
+	}
+
+exit:
+	debug_transport_thread_loop(th, "EXIT");
+	ba_transport_thread_set_state_stopping(th);
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+fail_init:
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+#endif
+
+/**
+ * Data shared by the duplex IO thread and its signal filter. */
+struct sco_duplex {
+	/* poll of the duplex IO thread */
+	struct io_poll *io;
+	/* pending speaker PCM drain request */
+	bool sync;
+	/* give up waiting for the BT link after this time */
+	struct timespec sync_deadline;
+	/* pending speaker PCM drop request */
+	bool drop;
+};
+
+static enum ba_transport_thread_signal sco_duplex_signal_filter(
+		enum ba_transport_thread_signal signal,
+		struct sco_duplex *duplex) {
+	switch (signal) {
+	case BA_TRANSPORT_THREAD_SIGNAL_PCM_SYNC: {
+		const struct timespec ts_timeout = {
+			.tv_sec = IO_PCM_DRAIN_TIMEOUT_MS / 1000,
+			.tv_nsec = (IO_PCM_DRAIN_TIMEOUT_MS % 1000) * 1000000 };
+		duplex->sync = true;
+		gettimestamp(&duplex->sync_deadline);
+		timespecadd(&duplex->sync_deadline, &ts_timeout, &duplex->sync_deadline);
+		/* The transmission is clocked by the remote device, so wake up the
+		 * thread periodically, in case the remote device stops sending. */
+		duplex->io->timeout = IO_PCM_DRAIN_POLL_MS;
+		break;
+	}
+	case BA_TRANSPORT_THREAD_SIGNAL_PCM_DROP:
+		duplex->drop = true;
+		break;
+	default:
+		break;
+	}
+	return signal;
+}
+
+/**
+ * Read available speaker PCM signal without blocking.
+ *
+ * @return This function returns the number of samples stored in the ring
+ *   buffer, which might be zero if there was no data in the PCM FIFO. */
+static size_t sco_duplex_read_pcm(
+		struct ba_transport_thread *th,
+		struct sco_duplex *duplex,
+		rb_t *buffer) {
+
+	struct ba_transport_pcm *pcm = &th->t->sco.spk_pcm;
+
+	if (duplex->drop) {
+		io_pcm_flush(pcm);
+		rb_rewind(buffer);
+		duplex->drop = false;
+	}
+
+	if (!ba_transport_pcm_is_active(pcm) || rb_len_in(buffer) == 0)
+		return 0;
+
+	ssize_t samples;
+	if ((samples = io_pcm_read(pcm, rb_tail(buffer), rb_len_in(buffer))) > 0) {
+		rb_seek(buffer, samples);
+		return samples;
+	}
+
+	if (samples == 0)
+		ba_transport_stop_if_no_clients(th->t);
+	else if (errno != EAGAIN && errno != EBADFD)
+		error("PCM read error: %s", strerror(errno));
+
+	return 0;
+}
+
+/**
+ * Notify the speaker PCM drain waiter if all data has been transferred.
+ *
+ * If the remote device does not clock the transmission (e.g. the link has
+ * stalled), the drain is completed after the timeout anyway. */
+static void sco_duplex_check_sync(
+		struct ba_transport_thread *th,
+		struct sco_duplex *duplex,
+		bool drained) {
+
+	if (!duplex->sync)
+		return;
+
+	if (!drained) {
+		struct timespec now;
+		gettimestamp(&now);
+		if (timespeccmp(&now, &duplex->sync_deadline, <))
+			return;
+		warn("BT link not drained in %d ms: %d", IO_PCM_DRAIN_TIMEOUT_MS,
+				th->t->sco.spk_pcm.fd);
+	}
+
+	ba_transport_pcm_drain_complete(&th->t->sco.spk_pcm);
+	duplex->io->timeout = -1;
+	duplex->sync = false;
+
+}
+
+static void *sco_cvsd_duplex_thread(struct ba_transport_thread *th) {
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_thread_cleanup), th);
+
+	struct ba_transport *t = th->t;
+	struct ba_transport_pcm *spk_pcm = &t->sco.spk_pcm;
+	struct ba_transport_pcm *mic_pcm = &t->sco.mic_pcm;
+	struct sco_duplex duplex = { 0 };
+	struct io_poll io = {
+		.signal.filter = (io_poll_signal_filter *)sco_duplex_signal_filter,
+		.signal.userdata = &duplex,
+		.timeout = -1 };
+	duplex.io = &io;
+
+	struct sco_mtu_detect mtu_detect = { 0 };
+	/* number of samples received but not yet answered */
+	size_t credit = 0;
+
+	ffb_t bt_in = { 0 };
+	rb_t bt_out = { 0 };
+	struct aec aec = { 0 };
+	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &bt_in);
+	pthread_cleanup_push(PTHREAD_CLEANUP(rb_free), &bt_out);
+	pthread_cleanup_push(PTHREAD_CLEANUP(aec_free), &aec);
+
+	if (ffb_init_int16_t(&bt_in, SCO_MTU_MAX / sizeof(int16_t)) == -1 ||
+			rb_init_int16_t(&bt_out, SCO_MTU_MAX / sizeof(int16_t) * 4) == -1) {
+		error("Couldn't create data buffers: %s", strerror(errno));
+		goto fail_init;
+	}
+
+	if (config.sco.aec &&
+			aec_init(&aec, mic_pcm->sampling, true) == -1) {
+		error("Couldn't initialize echo canceller: %s", strerror(errno));
+		goto fail_init;
+	}
+
+	debug_transport_thread_loop(th, "START");
+	for (ba_transport_thread_set_state_running(th);;) {
+
+		ssize_t len = ffb_blen_in(&bt_in);
+		if ((len = io_poll_and_read_bt(&io, th, bt_in.tail, len)) == -1) {
+			if (errno == ETIMEDOUT) {
+				/* no packet from the remote device, check the drain anyway */
+				sco_duplex_read_pcm(th, &duplex, &bt_out);
+				sco_duplex_check_sync(th, &duplex,
+						rb_len_out(&bt_out) < t->mtu_write / sizeof(int16_t));
+			}
+			else
+				error("BT poll and read error: %s", strerror(errno));
+			continue;
+		}
+		else if (len == 0)
+			goto exit;
+
+		/* the transmitted packet shall match the received one */
+		sco_mtu_detect_update(t, &mtu_detect, len, ffb_blen_in(&bt_in));
+		const size_t mtu_write = t->mtu_write;
+		const size_t mtu_samples = mtu_write / sizeof(int16_t);
+
+		ssize_t samples = len / sizeof(int16_t);
+		if (ba_transport_pcm_is_active(mic_pcm)) {
+			if (aec_is_initialized(&aec))
+				aec_process(&aec, bt_in.data, samples);
+			io_pcm_scale(mic_pcm, bt_in.data, samples);
+			if ((samples = io_pcm_write(mic_pcm, bt_in.data, samples)) == -1)
+				error("FIFO write error: %s", strerror(errno));
+			else if (samples == 0)
+				ba_transport_stop_if_no_clients(t);
+		}
+
+		sco_duplex_read_pcm(th, &duplex, &bt_out);
+		sco_duplex_check_sync(th, &duplex, rb_len_out(&bt_out) < mtu_samples);
+
+		/* Nothing is transmitted unless the speaker PCM has been opened,
+		 * which is the same behavior as in the case of the encoder thread. */
+		if (!ba_transport_pcm_is_active(spk_pcm)) {
+			credit = 0;
+			continue;
+		}
+
+		/* Answer every received packet with the same amount of the signal,
+		 * so the transmission is clocked by the remote device. */
+		credit += len / sizeof(int16_t);
+		if (credit < mtu_samples)
+			continue;
+
+		if (rb_len_out(&bt_out) < mtu_samples) {
+			/* The client has not delivered data on time, so transmit the
+			 * missing part of the packet as silence. */
+			const size_t missing = mtu_samples - rb_len_out(&bt_out);
+			memset(rb_tail(&bt_out), 0, missing * sizeof(int16_t));
+			rb_seek(&bt_out, missing);
+			ba_transport_thread_stats_add(th, underruns, 1);
+		}
+
+		if ((len = io_bt_write(th, rb_head(&bt_out), mtu_write)) <= 0) {
+			if (len == -1)
+				error("BT write error: %s", strerror(errno));
+			goto exit;
+		}
+
+		/* The reference signal is required only if someone is listening,
+		 * otherwise it would accumulate and its alignment would be lost. */
+		if (aec_is_initialized(&aec) && ba_transport_pcm_is_active(mic_pcm))
+			aec_push_ref(&aec, rb_head(&bt_out), mtu_samples);
+
+		ba_transport_pcm_presentation_update(spk_pcm, mtu_samples);
+		rb_shift(&bt_out, mtu_samples);
+		credit -= mtu_samples;
+
+		/* update the delay of the signal buffered in the IO thread */
+		spk_pcm->delay = rb_len_out(&bt_out) * 10000 / spk_pcm->sampling;
 
 	}
 
@@ -459,13 +1126,213 @@ exit:
 	debug_transport_thread_loop(th, "EXIT");
 	ba_transport_thread_set_state_stopping(th);
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-fail_msbc:
+fail_init:
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+
+#if ENABLE_MSBC || ENABLE_LC3_SWB
+static void *sco_h2_duplex_thread(struct ba_transport_thread *th,
+		const struct sco_h2_codec *c) {
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_thread_cleanup), th);
+
+	struct ba_transport *t = th->t;
+	struct ba_transport_pcm *spk_pcm = &t->sco.spk_pcm;
+	struct ba_transport_pcm *mic_pcm = &t->sco.mic_pcm;
+	struct sco_duplex duplex = { 0 };
+	struct io_poll io = {
+		.signal.filter = (io_poll_signal_filter *)sco_duplex_signal_filter,
+		.signal.userdata = &duplex,
+		.timeout = -1 };
+	duplex.io = &io;
+
+	struct sco_mtu_detect mtu_detect = { 0 };
+	/* number of bytes received but not yet answered */
+	size_t credit = 0;
+
+	union sco_h2_codec_state state_enc;
+	union sco_h2_codec_state state_dec;
+	struct sco_h2 enc;
+	struct sco_h2 dec;
+	sco_h2_bind(&enc, c, &state_enc);
+	sco_h2_bind(&dec, c, &state_dec);
+
+	struct ba_device_codec codec_enc = {
+		.d = t->d,
+		.name = c->name_enc,
+		.state = enc.state,
+		.state_size = c->state_size,
+		.destroy = c->finish,
+	};
+	struct ba_device_codec codec_dec = {
+		.d = t->d,
+		.name = c->name_dec,
+		.state = dec.state,
+		.state_size = c->state_size,
+		.destroy = c->finish,
+	};
+
+	/* Cached codecs are marked as initialized, so
+	 * the initialization will only reset their state. */
+	ba_device_codec_acquire(&codec_enc);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_device_codec_release), &codec_enc);
+	ba_device_codec_acquire(&codec_dec);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ba_device_codec_release), &codec_dec);
+
+	struct aec aec = { 0 };
+	pthread_cleanup_push(PTHREAD_CLEANUP(aec_free), &aec);
+
+	if (c->init(enc.state) != 0 || c->init(dec.state) != 0) {
+		error("Couldn't initialize %s codec: %s", c->name, strerror(errno));
+		goto fail_init;
+	}
+
+	if (config.sco.aec &&
+			aec_init(&aec, mic_pcm->sampling, true) == -1) {
+		error("Couldn't initialize echo canceller: %s", strerror(errno));
+		goto fail_init;
+	}
+
+	codec_enc.ready = true;
+	codec_dec.ready = true;
+
+	debug_transport_thread_loop(th, "START");
+	for (ba_transport_thread_set_state_running(th);;) {
+
+		ssize_t len = rb_blen_in(dec.data);
+		if ((len = io_poll_and_read_bt(&io, th, rb_tail(dec.data), len)) == -1) {
+			if (errno == ETIMEDOUT) {
+				/* no packet from the remote device, check the drain anyway */
+				sco_duplex_read_pcm(th, &duplex, enc.pcm);
+				sco_duplex_check_sync(th, &duplex, rb_len_out(enc.pcm) < c->codesamples &&
+						rb_blen_out(enc.data) < t->mtu_write);
+			}
+			else
+				error("BT poll and read error: %s", strerror(errno));
+			continue;
+		}
+		else if (len == 0)
+			goto exit;
+
+		/* the transmitted packet shall match the received one */
+		sco_mtu_detect_update(t, &mtu_detect, len, rb_blen_in(dec.data));
+		const size_t mtu_write = t->mtu_write;
+
+		if (ba_transport_pcm_is_active(mic_pcm)) {
+
+			rb_seek(dec.data, len);
+			trace_probe2(decode_begin, th, rb_blen_out(dec.data));
+			if (c->decode(dec.state) == -1) {
+				warn("Couldn't decode %s: %s", c->name, strerror(errno));
+				rb_rewind(dec.data);
+			}
+			trace_probe2(decode_end, th, rb_len_out(dec.pcm));
+
+			if (*dec.frames_concealed > 0) {
+				atomic_fetch_add_explicit(&mic_pcm->concealed_frames,
+						*dec.frames_concealed * c->codesamples, memory_order_relaxed);
+				*dec.frames_concealed = 0;
+			}
+
+			ssize_t samples;
+			if ((samples = rb_len_out(dec.pcm)) > 0) {
+				int16_t *output = rb_head(dec.pcm);
+				if (aec_is_initialized(&aec))
+					aec_process(&aec, output, samples);
+				io_pcm_scale(mic_pcm, output, samples);
+				if ((samples = io_pcm_write(mic_pcm, output, samples)) == -1)
+					error("FIFO write error: %s", strerror(errno));
+				else if (samples == 0)
+					ba_transport_stop_if_no_clients(t);
+				rb_shift(dec.pcm, samples);
+			}
+
+		}
+
+		sco_duplex_read_pcm(th, &duplex, enc.pcm);
+		sco_duplex_check_sync(th, &duplex, rb_len_out(enc.pcm) < c->codesamples &&
+				rb_blen_out(enc.data) < mtu_write);
+
+		/* Nothing is transmitted unless the speaker PCM has been opened,
+		 * which is the same behavior as in the case of the encoder thread. */
+		if (!ba_transport_pcm_is_active(spk_pcm)) {
+			credit = 0;
+			continue;
+		}
+
+		/* Answer every received packet with the same amount of data, so
+		 * the transmission is clocked by the remote device. */
+		credit += len;
+		if (credit < mtu_write)
+			continue;
+
+		if (rb_blen_out(enc.data) < mtu_write &&
+				rb_len_out(enc.pcm) < c->codesamples) {
+			/* The client has not delivered data on time, so encode the
+			 * missing part of the codec frame as silence. */
+			const size_t missing = c->codesamples - rb_len_out(enc.pcm);
+			memset(rb_tail(enc.pcm), 0, missing * sizeof(int16_t));
+			rb_seek(enc.pcm, missing);
+			ba_transport_thread_stats_add(th, underruns, 1);
+		}
+
+		if (rb_len_out(enc.pcm) >= c->codesamples) {
+			/* Encoded samples are consumed from the head of the mirrored
+			 * ring buffer, but they stay intact until the next PCM read. */
+			const int16_t *ref = rb_head(enc.pcm);
+			trace_probe2(encode_begin, th, rb_len_out(enc.pcm));
+			if (c->encode(enc.state) == -1) {
+				warn("Couldn't encode %s: %s", c->name, strerror(errno));
+				rb_rewind(enc.pcm);
+			}
+			trace_probe2(encode_end, th, rb_blen_out(enc.data));
+			/* The reference signal is required only if someone is listening,
+			 * otherwise it would accumulate and its alignment would be lost. */
+			if (aec_is_initialized(&aec) && ba_transport_pcm_is_active(mic_pcm))
+				aec_push_ref(&aec, ref, *enc.frames * c->codesamples);
+		}
+
+		if (*enc.frames > 0) {
+			ba_transport_pcm_presentation_update(spk_pcm, *enc.frames * c->codesamples);
+			*enc.frames = 0;
+		}
+
+		if (rb_blen_out(enc.data) < mtu_write)
+			continue;
+
+		if ((len = io_bt_write(th, rb_head(enc.data), mtu_write)) <= 0) {
+			if (len == -1)
+				error("BT write error: %s", strerror(errno));
+			goto exit;
+		}
+
+		rb_shift(enc.data, mtu_write);
+		credit -= mtu_write;
+
+		/* update the delay of the signal buffered in the IO thread */
+		spk_pcm->delay = rb_len_out(enc.pcm) * 10000 / spk_pcm->sampling;
+
+	}
+
+exit:
+	debug_transport_thread_loop(th, "EXIT");
+	ba_transport_thread_set_state_stopping(th);
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+fail_init:
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
 	pthread_cleanup_pop(1);
 	pthread_cleanup_pop(1);
 	return NULL;
 }
 #endif
 
+
 void *sco_enc_thread(struct ba_transport_thread *th) {
 	switch (th->t->type.codec) {
 	case HFP_CODEC_CVSD:
@@ -473,7 +1340,11 @@ void *sco_enc_thread(struct ba_transport_thread *th) {
 		return sco_cvsd_enc_thread(th);
 #if ENABLE_MSBC
 	case HFP_CODEC_MSBC:
-		return sco_msbc_enc_thread(th);
+		return sco_h2_enc_thread(th, &sco_h2_msbc);
+#endif
+#if ENABLE_LC3_SWB
+	case HFP_CODEC_LC3_SWB:
+		return sco_h2_enc_thread(th, &sco_h2_lc3_swb);
 #endif
 	}
 }
@@ -485,7 +1356,27 @@ void *sco_dec_thread(struct ba_transport_thread *th) {
 		return sco_cvsd_dec_thread(th);
 #if ENABLE_MSBC
 	case HFP_CODEC_MSBC:
-		return sco_msbc_dec_thread(th);
+		return sco_h2_dec_thread(th, &sco_h2_msbc);
+#endif
+#if ENABLE_LC3_SWB
+	case HFP_CODEC_LC3_SWB:
+		return sco_h2_dec_thread(th, &sco_h2_lc3_swb);
+#endif
+	}
+}
+
+void *sco_duplex_thread(struct ba_transport_thread *th) {
+	switch (th->t->type.codec) {
+	case HFP_CODEC_CVSD:
+	default:
+		return sco_cvsd_duplex_thread(th);
+#if ENABLE_MSBC
+	case HFP_CODEC_MSBC:
+		return sco_h2_duplex_thread(th, &sco_h2_msbc);
+#endif
+#if ENABLE_LC3_SWB
+	case HFP_CODEC_LC3_SWB:
+		return sco_h2_duplex_thread(th, &sco_h2_lc3_swb);
 #endif
 	}
 }
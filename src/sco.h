@@ -23,5 +23,6 @@ int sco_setup_connection_dispatcher(struct ba_adapter *a);
 
 void *sco_enc_thread(struct ba_transport_thread *th);
 void *sco_dec_thread(struct ba_transport_thread *th);
+void *sco_duplex_thread(struct ba_transport_thread *th);
 
 #endif
@@ -11,11 +11,14 @@
 #include "shared/dbus-client.h"
 
 #include <errno.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "shared/defs.h"
@@ -84,8 +87,15 @@ dbus_bool_t bluealsa_dbus_connection_ctx_init(
 	return TRUE;
 }
 
+static DBusHandlerResult bluealsa_dbus_pcm_cache_filter(DBusConnection *conn,
+		DBusMessage *message, void *data);
+
 void bluealsa_dbus_connection_ctx_free(
 		struct ba_dbus_ctx *ctx) {
+	if (ctx->conn != NULL && ctx->pcms_cache)
+		dbus_connection_remove_filter(ctx->conn, bluealsa_dbus_pcm_cache_filter, ctx);
+	bluealsa_dbus_pcm_cache_invalidate(ctx);
+	ctx->pcms_cache = FALSE;
 	if (ctx->conn != NULL) {
 		dbus_connection_close(ctx->conn);
 		dbus_connection_unref(ctx->conn);
@@ -104,35 +114,51 @@ void bluealsa_dbus_connection_ctx_free(
 	}
 }
 
-dbus_bool_t bluealsa_dbus_connection_signal_match_add(
-		struct ba_dbus_ctx *ctx,
+/**
+ * Build D-Bus signal match rule. */
+static void bluealsa_dbus_match_build(
+		char *match,
+		size_t size,
 		const char *sender,
 		const char *path,
 		const char *iface,
 		const char *member,
 		const char *extra) {
 
-	char match[512] = "type='signal'";
-	size_t len = 13;
+	size_t len = snprintf(match, size, "type='signal'");
 
 	if (sender != NULL) {
-		snprintf(&match[len], sizeof(match) - len, ",sender='%s'", sender);
+		snprintf(&match[len], size - len, ",sender='%s'", sender);
 		len += strlen(&match[len]);
 	}
 	if (path != NULL) {
-		snprintf(&match[len], sizeof(match) - len, ",path='%s'", path);
+		snprintf(&match[len], size - len, ",path='%s'", path);
 		len += strlen(&match[len]);
 	}
 	if (iface != NULL) {
-		snprintf(&match[len], sizeof(match) - len, ",interface='%s'", iface);
+		snprintf(&match[len], size - len, ",interface='%s'", iface);
 		len += strlen(&match[len]);
 	}
 	if (member != NULL) {
-		snprintf(&match[len], sizeof(match) - len, ",member='%s'", member);
+		snprintf(&match[len], size - len, ",member='%s'", member);
 		len += strlen(&match[len]);
 	}
 	if (extra != NULL)
-		snprintf(&match[len], sizeof(match) - len, ",%s", extra);
+		snprintf(&match[len], size - len, ",%s", extra);
+
+}
+
+dbus_bool_t bluealsa_dbus_connection_signal_match_add(
+		struct ba_dbus_ctx *ctx,
+		const char *sender,
+		const char *path,
+		const char *iface,
+		const char *member,
+		const char *extra) {
+
+	char match[512];
+	bluealsa_dbus_match_build(match, sizeof(match),
+			sender, path, iface, member, extra);
 
 	char **tmp = ctx->matches;
 	size_t tmp_len = ctx->matches_len;
@@ -321,10 +347,16 @@ fail:
 	return ret;
 }
 
-dbus_bool_t bluealsa_dbus_get_pcms(
+/**
+ * Get all PCMs with the GetPCMs() method call.
+ *
+ * The serial number of the reply message is stored in the serial argument,
+ * so signals sent by the service before the reply can be recognized. */
+static dbus_bool_t bluealsa_dbus_fetch_pcms(
 		struct ba_dbus_ctx *ctx,
 		struct ba_pcm **pcms,
 		size_t *length,
+		dbus_uint32_t *serial,
 		DBusError *error) {
 
 	DBusMessage *msg;
@@ -384,6 +416,7 @@ dbus_bool_t bluealsa_dbus_get_pcms(
 
 	*pcms = _pcms;
 	*length = i;
+	*serial = dbus_message_get_serial(rep);
 
 	goto success;
 
@@ -399,6 +432,226 @@ success:
 	return rv;
 }
 
+/**
+ * Get BlueALSA PCM from the cache by its D-Bus path. */
+static struct ba_pcm *bluealsa_dbus_pcm_cache_lookup(
+		struct ba_dbus_ctx *ctx,
+		const char *path) {
+	size_t i;
+	for (i = 0; i < ctx->pcms_len; i++)
+		if (strcmp(ctx->pcms[i].pcm_path, path) == 0)
+			return &ctx->pcms[i];
+	return NULL;
+}
+
+/**
+ * Update the cache of BlueALSA PCMs with the service signals.
+ *
+ * Signals which have been sent before the reply to the GetPCMs() call are
+ * ignored, because the cached state already includes their changes. */
+static DBusHandlerResult bluealsa_dbus_pcm_cache_filter(DBusConnection *conn,
+		DBusMessage *message, void *data) {
+	struct ba_dbus_ctx *ctx = data;
+	(void)conn;
+
+	if (dbus_message_get_type(message) != DBUS_MESSAGE_TYPE_SIGNAL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	const char *interface = dbus_message_get_interface(message);
+	const char *signal = dbus_message_get_member(message);
+	DBusMessageIter iter;
+	const char *path;
+
+	if (interface == NULL || signal == NULL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	if (strcmp(interface, DBUS_INTERFACE_DBUS) == 0 &&
+			strcmp(signal, "NameOwnerChanged") == 0) {
+		/* BlueALSA service has been started or stopped */
+		if (dbus_message_iter_init(message, &iter) &&
+				dbus_message_iter_get_arg_type(&iter) == DBUS_TYPE_STRING) {
+			dbus_message_iter_get_basic(&iter, &path);
+			if (strcmp(path, ctx->ba_service) == 0)
+				bluealsa_dbus_pcm_cache_invalidate(ctx);
+		}
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+	}
+
+	if (!ctx->pcms_valid ||
+			dbus_message_get_serial(message) <= ctx->pcms_serial)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	if (strcmp(interface, BLUEALSA_INTERFACE_MANAGER) == 0) {
+
+		if (strcmp(signal, "PCMAdded") == 0) {
+
+			struct ba_pcm pcm;
+			if (!dbus_message_iter_init(message, &iter) ||
+					!bluealsa_dbus_message_iter_get_pcm(&iter, NULL, &pcm))
+				goto fail;
+
+			struct ba_pcm *tmp;
+			if ((tmp = bluealsa_dbus_pcm_cache_lookup(ctx, pcm.pcm_path)) != NULL) {
+				memcpy(tmp, &pcm, sizeof(*tmp));
+				return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+			}
+
+			if ((tmp = realloc(ctx->pcms, (ctx->pcms_len + 1) * sizeof(*tmp))) == NULL)
+				goto fail;
+			ctx->pcms = tmp;
+			memcpy(&ctx->pcms[ctx->pcms_len++], &pcm, sizeof(pcm));
+
+		}
+		else if (strcmp(signal, "PCMRemoved") == 0) {
+
+			if (!dbus_message_iter_init(message, &iter) ||
+					dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_OBJECT_PATH)
+				goto fail;
+			dbus_message_iter_get_basic(&iter, &path);
+
+			struct ba_pcm *pcm;
+			if ((pcm = bluealsa_dbus_pcm_cache_lookup(ctx, path)) != NULL) {
+				const size_t i = pcm - ctx->pcms;
+				memmove(pcm, pcm + 1, (ctx->pcms_len - i - 1) * sizeof(*pcm));
+				ctx->pcms_len--;
+			}
+
+		}
+
+	}
+	else if (strcmp(interface, DBUS_INTERFACE_PROPERTIES) == 0 &&
+			strcmp(signal, "PropertiesChanged") == 0) {
+
+		struct ba_pcm *pcm;
+		if ((path = dbus_message_get_path(message)) == NULL ||
+				(pcm = bluealsa_dbus_pcm_cache_lookup(ctx, path)) == NULL)
+			return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+		if (!dbus_message_iter_init(message, &iter) ||
+				dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_STRING)
+			goto fail;
+		dbus_message_iter_get_basic(&iter, &interface);
+		if (strcmp(interface, BLUEALSA_INTERFACE_PCM) != 0)
+			return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+		dbus_message_iter_next(&iter);
+		if (!bluealsa_dbus_message_iter_get_pcm_props(&iter, NULL, pcm))
+			goto fail;
+
+	}
+
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+fail:
+	/* the cache can not be trusted anymore */
+	bluealsa_dbus_pcm_cache_invalidate(ctx);
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+/**
+ * Enable client-side cache of BlueALSA PCMs.
+ *
+ * The cache is populated with the first bluealsa_dbus_get_pcms() call and
+ * then it is kept up to date with the service signals. These signals are
+ * processed when the application dispatches D-Bus messages, so it shall
+ * call bluealsa_dbus_connection_dispatch() (or dispatch messages on its
+ * own) from time to time. The cache filter shall be enabled before any
+ * application filter is added, so the cache is updated before application
+ * filters are called.
+ *
+ * Note, that properties which are changing without the update signal (e.g.
+ * Delay) are cached as well. In order to get their current value, call the
+ * bluealsa_dbus_pcm_cache_invalidate() first. */
+dbus_bool_t bluealsa_dbus_pcm_cache_enable(
+		struct ba_dbus_ctx *ctx,
+		DBusError *error) {
+
+	if (ctx->pcms_cache)
+		return TRUE;
+
+	if (!dbus_connection_add_filter(ctx->conn,
+				bluealsa_dbus_pcm_cache_filter, ctx, NULL)) {
+		dbus_set_error(error, DBUS_ERROR_NO_MEMORY, NULL);
+		return FALSE;
+	}
+
+	/* Matches for the cache are not registered in the context, so
+	 * they will not be removed by the signal match clean function. */
+	char dbus_args[64];
+	char match[512];
+
+	bluealsa_dbus_match_build(match, sizeof(match), ctx->ba_service, NULL,
+			BLUEALSA_INTERFACE_MANAGER, "PCMAdded", NULL);
+	dbus_bus_add_match(ctx->conn, match, NULL);
+	bluealsa_dbus_match_build(match, sizeof(match), ctx->ba_service, NULL,
+			BLUEALSA_INTERFACE_MANAGER, "PCMRemoved", NULL);
+	dbus_bus_add_match(ctx->conn, match, NULL);
+	bluealsa_dbus_match_build(match, sizeof(match), ctx->ba_service, NULL,
+			DBUS_INTERFACE_PROPERTIES, "PropertiesChanged", "arg0='"BLUEALSA_INTERFACE_PCM"'");
+	dbus_bus_add_match(ctx->conn, match, NULL);
+	snprintf(dbus_args, sizeof(dbus_args), "arg0='%s'", ctx->ba_service);
+	bluealsa_dbus_match_build(match, sizeof(match), DBUS_SERVICE_DBUS, NULL,
+			DBUS_INTERFACE_DBUS, "NameOwnerChanged", dbus_args);
+	dbus_bus_add_match(ctx->conn, match, NULL);
+
+	ctx->pcms_cache = TRUE;
+	ctx->pcms_valid = FALSE;
+	return TRUE;
+}
+
+/**
+ * Drop cached BlueALSA PCMs.
+ *
+ * The next bluealsa_dbus_get_pcms() call will populate the cache with
+ * the current state of the service. */
+void bluealsa_dbus_pcm_cache_invalidate(
+		struct ba_dbus_ctx *ctx) {
+	free(ctx->pcms);
+	ctx->pcms = NULL;
+	ctx->pcms_len = 0;
+	ctx->pcms_valid = FALSE;
+}
+
+/**
+ * Get all BlueALSA PCMs.
+ *
+ * If the cache is enabled, PCMs are copied from the cache, so there is no
+ * D-Bus round trip unless the cache has been invalidated. The returned
+ * array shall be freed with the free() function. */
+dbus_bool_t bluealsa_dbus_get_pcms(
+		struct ba_dbus_ctx *ctx,
+		struct ba_pcm **pcms,
+		size_t *length,
+		DBusError *error) {
+
+	dbus_uint32_t serial;
+
+	if (!ctx->pcms_cache)
+		return bluealsa_dbus_fetch_pcms(ctx, pcms, length, &serial, error);
+
+	if (!ctx->pcms_valid) {
+		bluealsa_dbus_pcm_cache_invalidate(ctx);
+		if (!bluealsa_dbus_fetch_pcms(ctx, &ctx->pcms, &ctx->pcms_len,
+					&ctx->pcms_serial, error))
+			return FALSE;
+		ctx->pcms_valid = TRUE;
+	}
+
+	struct ba_pcm *tmp = NULL;
+	if (ctx->pcms_len > 0 &&
+			(tmp = malloc(ctx->pcms_len * sizeof(*tmp))) == NULL) {
+		dbus_set_error(error, DBUS_ERROR_NO_MEMORY, NULL);
+		return FALSE;
+	}
+
+	if (ctx->pcms_len > 0)
+		memcpy(tmp, ctx->pcms, ctx->pcms_len * sizeof(*tmp));
+
+	*pcms = tmp;
+	*length = ctx->pcms_len;
+	return TRUE;
+}
+
 dbus_bool_t bluealsa_dbus_get_pcm(
 		struct ba_dbus_ctx *ctx,
 		const bdaddr_t *addr,
@@ -446,6 +699,186 @@ dbus_bool_t bluealsa_dbus_get_pcm(
 	return rv;
 }
 
+/**
+ * Callback function for BlueALSA PCM statistics parser. */
+static dbus_bool_t bluealsa_dbus_message_iter_get_pcm_stats_cb(const char *key,
+		DBusMessageIter *variant, void *userdata, DBusError *error) {
+	struct ba_pcm_stats *stats = (struct ba_pcm_stats *)userdata;
+
+	static const struct {
+		const char *key;
+		size_t offset;
+	} counters[] = {
+		{ "TxPackets", offsetof(struct ba_pcm_stats, tx_packets) },
+		{ "TxBytes", offsetof(struct ba_pcm_stats, tx_bytes) },
+		{ "RxPackets", offsetof(struct ba_pcm_stats, rx_packets) },
+		{ "RxBytes", offsetof(struct ba_pcm_stats, rx_bytes) },
+		{ "Overdue", offsetof(struct ba_pcm_stats, overdue) },
+		{ "Underruns", offsetof(struct ba_pcm_stats, underruns) },
+		{ "Overruns", offsetof(struct ba_pcm_stats, overruns) },
+		{ "RTPLost", offsetof(struct ba_pcm_stats, rtp_lost) },
+		{ "CongestionDrops", offsetof(struct ba_pcm_stats, congestion_drops) },
+		{ "RxOverflows", offsetof(struct ba_pcm_stats, rx_overflows) },
+		{ "OverrunDrops", offsetof(struct ba_pcm_stats, overrun_drops) },
+		{ "SendQueue", offsetof(struct ba_pcm_stats, send_queue) },
+		{ "CPUTime", offsetof(struct ba_pcm_stats, cpu_time) },
+	};
+
+	char type = dbus_message_iter_get_arg_type(variant);
+	size_t i;
+
+	/* ignore unknown and non-counter properties */
+	for (i = 0; i < ARRAYSIZE(counters); i++)
+		if (strcmp(key, counters[i].key) == 0) {
+			if (type != DBUS_TYPE_UINT32) {
+				dbus_set_error(error, DBUS_ERROR_INVALID_SIGNATURE,
+						"Incorrect variant for '%s': %c != %c", key, type, DBUS_TYPE_UINT32);
+				return FALSE;
+			}
+			dbus_message_iter_get_basic(variant, (uint8_t *)stats + counters[i].offset);
+			break;
+		}
+
+	return TRUE;
+}
+
+/**
+ * Get IO statistics of BlueALSA PCM. */
+dbus_bool_t bluealsa_dbus_get_pcm_stats(
+		struct ba_dbus_ctx *ctx,
+		const char *pcm_path,
+		struct ba_pcm_stats *stats,
+		DBusError *error) {
+
+	static const char *interface = BLUEALSA_INTERFACE_PCM;
+	static const char *property = "Statistics";
+	DBusMessage *msg = NULL, *rep = NULL;
+	dbus_bool_t ret = FALSE;
+
+	if ((msg = dbus_message_new_method_call(ctx->ba_service, pcm_path,
+					DBUS_INTERFACE_PROPERTIES, "Get")) == NULL) {
+		dbus_set_error(error, DBUS_ERROR_NO_MEMORY, NULL);
+		goto fail;
+	}
+
+	if (!dbus_message_append_args(msg,
+				DBUS_TYPE_STRING, &interface,
+				DBUS_TYPE_STRING, &property,
+				DBUS_TYPE_INVALID)) {
+		dbus_set_error(error, DBUS_ERROR_NO_MEMORY, NULL);
+		goto fail;
+	}
+
+	if ((rep = dbus_connection_send_with_reply_and_block(ctx->conn,
+					msg, DBUS_TIMEOUT_USE_DEFAULT, error)) == NULL)
+		goto fail;
+
+	DBusMessageIter iter;
+	if (!dbus_message_iter_init(rep, &iter) ||
+			dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_VARIANT) {
+		dbus_set_error(error, DBUS_ERROR_INVALID_SIGNATURE, "Empty response message");
+		goto fail;
+	}
+
+	DBusMessageIter iter_val;
+	dbus_message_iter_recurse(&iter, &iter_val);
+
+	memset(stats, 0, sizeof(*stats));
+	if (!bluealsa_dbus_message_iter_dict(&iter_val, error,
+				bluealsa_dbus_message_iter_get_pcm_stats_cb, stats))
+		goto fail;
+
+	ret = TRUE;
+
+fail:
+	if (rep != NULL)
+		dbus_message_unref(rep);
+	if (msg != NULL)
+		dbus_message_unref(msg);
+	return ret;
+}
+
+/**
+ * Open several BlueALSA PCM streams with a single method call.
+ *
+ * On success, file descriptors of the i-th PCM are stored in the i-th
+ * element of the fds_pcm and fds_pcm_ctrl arrays. */
+dbus_bool_t bluealsa_dbus_open_pcms(
+		struct ba_dbus_ctx *ctx,
+		const char **pcm_paths,
+		size_t length,
+		int *fds_pcm,
+		int *fds_pcm_ctrl,
+		DBusError *error) {
+
+	DBusMessage *msg = NULL, *rep = NULL;
+	dbus_bool_t rv = FALSE;
+	size_t i, n = 0;
+
+	if ((msg = dbus_message_new_method_call(ctx->ba_service, "/org/bluealsa",
+					BLUEALSA_INTERFACE_MANAGER, "OpenPCMs")) == NULL ||
+			!dbus_message_append_args(msg,
+				DBUS_TYPE_ARRAY, DBUS_TYPE_OBJECT_PATH, &pcm_paths, (int)length,
+				DBUS_TYPE_INVALID)) {
+		dbus_set_error(error, DBUS_ERROR_NO_MEMORY, NULL);
+		goto fail;
+	}
+
+	if ((rep = dbus_connection_send_with_reply_and_block(ctx->conn,
+					msg, DBUS_TIMEOUT_USE_DEFAULT, error)) == NULL)
+		goto fail;
+
+	DBusMessageIter iter;
+	DBusMessageIter iter_fds;
+	if (!dbus_message_iter_init(rep, &iter) ||
+			dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY)
+		goto fail_signature;
+
+	for (dbus_message_iter_recurse(&iter, &iter_fds);
+			dbus_message_iter_get_arg_type(&iter_fds) != DBUS_TYPE_INVALID;
+			dbus_message_iter_next(&iter_fds)) {
+
+		DBusMessageIter iter_pair;
+		if (n == length ||
+				dbus_message_iter_get_arg_type(&iter_fds) != DBUS_TYPE_STRUCT)
+			goto fail_signature;
+
+		dbus_message_iter_recurse(&iter_fds, &iter_pair);
+		if (dbus_message_iter_get_arg_type(&iter_pair) != DBUS_TYPE_UNIX_FD)
+			goto fail_signature;
+		dbus_message_iter_get_basic(&iter_pair, &fds_pcm[n]);
+		if (!dbus_message_iter_next(&iter_pair) ||
+				dbus_message_iter_get_arg_type(&iter_pair) != DBUS_TYPE_UNIX_FD) {
+			close(fds_pcm[n]);
+			goto fail_signature;
+		}
+		dbus_message_iter_get_basic(&iter_pair, &fds_pcm_ctrl[n]);
+		n++;
+
+	}
+
+	if (n != length)
+		goto fail_signature;
+
+	rv = TRUE;
+	goto final;
+
+fail_signature:
+	dbus_set_error(error, DBUS_ERROR_INVALID_SIGNATURE,
+			"Incorrect signature: %s != a(hh)", dbus_message_get_signature(rep));
+fail:
+	for (i = 0; i < n; i++) {
+		close(fds_pcm[i]);
+		close(fds_pcm_ctrl[i]);
+	}
+final:
+	if (rep != NULL)
+		dbus_message_unref(rep);
+	if (msg != NULL)
+		dbus_message_unref(msg);
+	return rv;
+}
+
 /**
  * Open BlueALSA PCM stream. */
 dbus_bool_t bluealsa_dbus_open_pcm(
@@ -480,6 +913,44 @@ dbus_bool_t bluealsa_dbus_open_pcm(
 	return rv;
 }
 
+/**
+ * Open BlueALSA PCM stream backed by the shared memory ring. */
+dbus_bool_t bluealsa_dbus_open_pcm_shm(
+		struct ba_dbus_ctx *ctx,
+		const char *pcm_path,
+		int *fd_shm,
+		int *fd_shm_data,
+		int *fd_shm_space,
+		int *fd_pcm_ctrl,
+		DBusError *error) {
+
+	DBusMessage *msg;
+	if ((msg = dbus_message_new_method_call(ctx->ba_service, pcm_path,
+					BLUEALSA_INTERFACE_PCM, "OpenSharedMemory")) == NULL) {
+		dbus_set_error(error, DBUS_ERROR_NO_MEMORY, NULL);
+		return FALSE;
+	}
+
+	DBusMessage *rep;
+	if ((rep = dbus_connection_send_with_reply_and_block(ctx->conn,
+					msg, DBUS_TIMEOUT_USE_DEFAULT, error)) == NULL) {
+		dbus_message_unref(msg);
+		return FALSE;
+	}
+
+	dbus_bool_t rv;
+	rv = dbus_message_get_args(rep, error,
+			DBUS_TYPE_UNIX_FD, fd_shm,
+			DBUS_TYPE_UNIX_FD, fd_shm_data,
+			DBUS_TYPE_UNIX_FD, fd_shm_space,
+			DBUS_TYPE_UNIX_FD, fd_pcm_ctrl,
+			DBUS_TYPE_INVALID);
+
+	dbus_message_unref(rep);
+	dbus_message_unref(msg);
+	return rv;
+}
+
 /**
  * Open BlueALSA RFCOMM socket for dispatching AT commands. */
 dbus_bool_t bluealsa_dbus_open_rfcomm(
@@ -527,6 +998,24 @@ dbus_bool_t bluealsa_dbus_pcm_update(
 	int type = -1;
 
 	switch (property) {
+	case BLUEALSA_PCM_FORMAT:
+		_property = "Format";
+		variant = DBUS_TYPE_UINT16_AS_STRING;
+		value = &pcm->format;
+		type = DBUS_TYPE_UINT16;
+		break;
+	case BLUEALSA_PCM_CHANNELS:
+		_property = "Channels";
+		variant = DBUS_TYPE_BYTE_AS_STRING;
+		value = &pcm->channels;
+		type = DBUS_TYPE_BYTE;
+		break;
+	case BLUEALSA_PCM_SAMPLING:
+		_property = "Sampling";
+		variant = DBUS_TYPE_UINT32_AS_STRING;
+		value = &pcm->sampling;
+		type = DBUS_TYPE_UINT32;
+		break;
 	case BLUEALSA_PCM_SOFT_VOLUME:
 		_property = "SoftVolume";
 		variant = DBUS_TYPE_BOOLEAN_AS_STRING;
@@ -570,6 +1059,58 @@ fail:
 	return FALSE;
 }
 
+/**
+ * Check whether the PCM controller message is a binary reply. */
+static bool bluealsa_dbus_pcm_ctrl_is_binary(const void *msg, size_t len) {
+	/* text replies consist of printable characters only */
+	return len >= sizeof(struct ba_pcm_ctrl_query) &&
+		((const unsigned char *)msg)[0] < 0x20;
+}
+
+/**
+ * Read message from the BlueALSA PCM controller socket.
+ *
+ * PCM controller socket is created in the non-blocking mode, so we have
+ * to poll for reading by ourself.
+ *
+ * @param fd_pcm_ctrl PCM controller socket.
+ * @param buffer Buffer for the message.
+ * @param size Size of the buffer.
+ * @param deadline Monotonic time after which the reading shall be given up
+ *   or NULL to wait indefinitely.
+ * @return On success this function returns the message length. Otherwise,
+ *   -1 is returned and errno is set to indicate the error. */
+static ssize_t bluealsa_dbus_pcm_ctrl_read(int fd_pcm_ctrl, void *buffer,
+		size_t size, const struct timespec *deadline) {
+
+	ssize_t len;
+	while ((len = read(fd_pcm_ctrl, buffer, size)) == -1) {
+
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN)
+			return -1;
+
+		int timeout = -1;
+		if (deadline != NULL) {
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			long ms = (deadline->tv_sec - now.tv_sec) * 1000 +
+				(deadline->tv_nsec - now.tv_nsec) / 1000000;
+			if (ms <= 0)
+				return errno = ETIMEDOUT, -1;
+			timeout = ms;
+		}
+
+		struct pollfd pfd = { fd_pcm_ctrl, POLLIN, 0 };
+		if (poll(&pfd, 1, timeout) == -1 && errno != EINTR)
+			return -1;
+
+	}
+
+	return len;
+}
+
 /**
  * Send command to the BlueALSA PCM controller socket. */
 dbus_bool_t bluealsa_dbus_pcm_ctrl_send(
@@ -583,24 +1124,127 @@ dbus_bool_t bluealsa_dbus_pcm_ctrl_send(
 		return FALSE;
 	}
 
-	/* PCM controller socket is created in the non-blocking
-	 * mode, so we have to poll for reading by ourself. */
-	struct pollfd pfd = { fd_pcm_ctrl, POLLIN, 0 };
-	poll(&pfd, 1, -1);
+	/* The reply to the "Drain" command is sent when the server has finished
+	 * draining, so there is no timeout for text commands. However, we have
+	 * to skip binary replies to queries which have already timed out. */
+	char rep[64];
+	do {
+		if ((len = bluealsa_dbus_pcm_ctrl_read(fd_pcm_ctrl, rep, sizeof(rep), NULL)) == -1) {
+			dbus_set_error(error, DBUS_ERROR_FAILED, "Read: %s", strerror(errno));
+			return FALSE;
+		}
+	} while (bluealsa_dbus_pcm_ctrl_is_binary(rep, len));
 
-	char rep[32];
-	if ((len = read(fd_pcm_ctrl, rep, sizeof(rep))) == -1) {
-		dbus_set_error(error, DBUS_ERROR_FAILED, "Read: %s", strerror(errno));
+	if (len == 0 || strncmp(rep, "OK", len) != 0) {
+		dbus_set_error(error, DBUS_ERROR_FAILED, "Response: %.*s", (int)len, rep);
+		errno = ENOMSG;
 		return FALSE;
 	}
 
-	if (strncmp(rep, "OK", len) != 0) {
-		dbus_set_error(error, DBUS_ERROR_FAILED, "Response: %s", rep);
-		errno = ENOMSG;
+	return TRUE;
+}
+
+/**
+ * Send binary query to the BlueALSA PCM controller socket.
+ *
+ * The reply is awaited for at most BA_PCM_CTRL_QUERY_TIMEOUT milliseconds.
+ * Text replies and binary replies to other (timed out) queries which are
+ * received in the meantime are discarded.
+ *
+ * @param fd_pcm_ctrl PCM controller socket.
+ * @param command Binary query command.
+ * @param reply Buffer for the reply. The reply structure shall start with
+ *   the echoed command and query ID.
+ * @param size Size of the reply structure.
+ * @param error D-Bus error structure.
+ * @return On success this function returns TRUE. */
+static dbus_bool_t bluealsa_dbus_pcm_ctrl_query(
+		int fd_pcm_ctrl,
+		uint32_t command,
+		void *reply,
+		size_t size,
+		DBusError *error) {
+
+	static atomic_uint query_id = 0;
+	const struct ba_pcm_ctrl_query query = {
+		.command = command,
+		.id = atomic_fetch_add(&query_id, 1) };
+
+	if (write(fd_pcm_ctrl, &query, sizeof(query)) == -1) {
+		dbus_set_error(error, DBUS_ERROR_FAILED, "Write: %s", strerror(errno));
 		return FALSE;
 	}
 
-	return TRUE;
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_nsec += BA_PCM_CTRL_QUERY_TIMEOUT * 1000000L;
+	deadline.tv_sec += deadline.tv_nsec / 1000000000;
+	deadline.tv_nsec %= 1000000000;
+
+	for (;;) {
+
+		char rep[128];
+		ssize_t len;
+
+		if ((len = bluealsa_dbus_pcm_ctrl_read(fd_pcm_ctrl, rep, sizeof(rep), &deadline)) == -1) {
+			if (errno == ETIMEDOUT)
+				dbus_set_error(error, DBUS_ERROR_TIMEOUT, "Query timed out");
+			else
+				dbus_set_error(error, DBUS_ERROR_FAILED, "Read: %s", strerror(errno));
+			return FALSE;
+		}
+
+		if (!bluealsa_dbus_pcm_ctrl_is_binary(rep, len)) {
+			/* server without binary protocol support replies with "Invalid",
+			 * other text replies were meant for text commands */
+			if (len > 0 && strncmp(rep, "Invalid", len) == 0) {
+				dbus_set_error(error, DBUS_ERROR_NOT_SUPPORTED, "Query not supported");
+				errno = ENOTSUP;
+				return FALSE;
+			}
+			continue;
+		}
+
+		struct ba_pcm_ctrl_query echo;
+		memcpy(&echo, rep, sizeof(echo));
+		if (echo.command != query.command || echo.id != query.id)
+			continue;
+
+		if ((size_t)len != size) {
+			dbus_set_error(error, DBUS_ERROR_NOT_SUPPORTED, "Query not supported");
+			errno = ENOTSUP;
+			return FALSE;
+		}
+
+		memcpy(reply, rep, size);
+		return TRUE;
+	}
+
+}
+
+/**
+ * Query BlueALSA PCM controller for the stream status.
+ *
+ * This query does not involve D-Bus at all, so it can be used at a high
+ * rate, e.g. for audio-video synchronization. */
+dbus_bool_t bluealsa_dbus_pcm_ctrl_get_status(
+		int fd_pcm_ctrl,
+		struct ba_pcm_ctrl_status *status,
+		DBusError *error) {
+	return bluealsa_dbus_pcm_ctrl_query(fd_pcm_ctrl, BA_PCM_CTRL_QUERY_STATUS,
+			status, sizeof(*status), error);
+}
+
+/**
+ * Query BlueALSA PCM controller for the presentation position.
+ *
+ * Similarly to the status query, this query does not involve D-Bus. */
+dbus_bool_t bluealsa_dbus_pcm_ctrl_get_position(
+		int fd_pcm_ctrl,
+		struct ba_pcm_ctrl_position *position,
+		DBusError *error) {
+	return bluealsa_dbus_pcm_ctrl_query(fd_pcm_ctrl, BA_PCM_CTRL_QUERY_POSITION,
+			position, sizeof(*position), error);
 }
 
 /**
@@ -763,6 +1407,10 @@ static dbus_bool_t bluealsa_dbus_message_iter_get_pcm_props_cb(const char *key,
 			pcm->transport = BA_PCM_TRANSPORT_HSP_AG;
 		else if (strstr(tmp, "HSP-HS") != NULL)
 			pcm->transport = BA_PCM_TRANSPORT_HSP_HS;
+		else if (strstr(tmp, "BAP-source") != NULL)
+			pcm->transport = BA_PCM_TRANSPORT_BAP_SOURCE;
+		else if (strstr(tmp, "BAP-sink") != NULL)
+			pcm->transport = BA_PCM_TRANSPORT_BAP_SINK;
 	}
 	else if (strcmp(key, "Mode") == 0) {
 		if (type != (type_expected = DBUS_TYPE_STRING))
@@ -778,6 +1426,20 @@ static dbus_bool_t bluealsa_dbus_message_iter_get_pcm_props_cb(const char *key,
 			goto fail;
 		dbus_message_iter_get_basic(variant, &pcm->format);
 	}
+	else if (strcmp(key, "Formats") == 0) {
+		if (type != (type_expected = DBUS_TYPE_ARRAY) ||
+				dbus_message_iter_get_element_type(variant) != DBUS_TYPE_UINT16)
+			goto fail;
+		DBusMessageIter iter;
+		const dbus_uint16_t *formats;
+		int length;
+		dbus_message_iter_recurse(variant, &iter);
+		dbus_message_iter_get_fixed_array(&iter, &formats, &length);
+		pcm->formats_len = length;
+		if (pcm->formats_len > ARRAYSIZE(pcm->formats))
+			pcm->formats_len = ARRAYSIZE(pcm->formats);
+		memcpy(pcm->formats, formats, pcm->formats_len * sizeof(*formats));
+	}
 	else if (strcmp(key, "Channels") == 0) {
 		if (type != (type_expected = DBUS_TYPE_BYTE))
 			goto fail;
@@ -788,17 +1450,47 @@ static dbus_bool_t bluealsa_dbus_message_iter_get_pcm_props_cb(const char *key,
 			goto fail;
 		dbus_message_iter_get_basic(variant, &pcm->sampling);
 	}
+	else if (strcmp(key, "Samplings") == 0) {
+		if (type != (type_expected = DBUS_TYPE_ARRAY) ||
+				dbus_message_iter_get_element_type(variant) != DBUS_TYPE_UINT32)
+			goto fail;
+		DBusMessageIter iter;
+		const dbus_uint32_t *samplings;
+		int length;
+		dbus_message_iter_recurse(variant, &iter);
+		dbus_message_iter_get_fixed_array(&iter, &samplings, &length);
+		pcm->samplings_len = length;
+		if (pcm->samplings_len > ARRAYSIZE(pcm->samplings))
+			pcm->samplings_len = ARRAYSIZE(pcm->samplings);
+		memcpy(pcm->samplings, samplings, pcm->samplings_len * sizeof(*samplings));
+	}
 	else if (strcmp(key, "Codec") == 0) {
 		if (type != (type_expected = DBUS_TYPE_STRING))
 			goto fail;
 		dbus_message_iter_get_basic(variant, &tmp);
 		strncpy(pcm->codec, tmp, sizeof(pcm->codec) - 1);
 	}
+	else if (strcmp(key, "BlockFrames") == 0) {
+		if (type != (type_expected = DBUS_TYPE_UINT32))
+			goto fail;
+		dbus_message_iter_get_basic(variant, &pcm->block_frames);
+	}
 	else if (strcmp(key, "Delay") == 0) {
 		if (type != (type_expected = DBUS_TYPE_UINT16))
 			goto fail;
 		dbus_message_iter_get_basic(variant, &pcm->delay);
 	}
+	else if (strcmp(key, "ConcealedFrames") == 0) {
+		if (type != (type_expected = DBUS_TYPE_UINT32))
+			goto fail;
+		dbus_message_iter_get_basic(variant, &pcm->concealed_frames);
+	}
+	else if (strcmp(key, "Scheduling") == 0) {
+		if (type != (type_expected = DBUS_TYPE_STRING))
+			goto fail;
+		dbus_message_iter_get_basic(variant, &tmp);
+		strncpy(pcm->scheduling, tmp, sizeof(pcm->scheduling) - 1);
+	}
 	else if (strcmp(key, "SoftVolume") == 0) {
 		if (type != (type_expected = DBUS_TYPE_BOOLEAN))
 			goto fail;
@@ -17,6 +17,8 @@
 #include <bluetooth/hci.h>
 #include <dbus/dbus.h>
 
+#include "shared/pcm-ctrl.h"
+
 #define BLUEALSA_SERVICE           "org.bluealsa"
 #define BLUEALSA_INTERFACE_MANAGER "org.bluealsa.Manager1"
 #define BLUEALSA_INTERFACE_PCM     "org.bluealsa.PCM1"
@@ -28,6 +30,8 @@
 #define BA_PCM_TRANSPORT_HFP_HF      (2 << 2)
 #define BA_PCM_TRANSPORT_HSP_AG      (1 << 4)
 #define BA_PCM_TRANSPORT_HSP_HS      (2 << 4)
+#define BA_PCM_TRANSPORT_BAP_SOURCE  (1 << 6)
+#define BA_PCM_TRANSPORT_BAP_SINK    (2 << 6)
 
 #define BA_PCM_TRANSPORT_MASK_A2DP \
 	(BA_PCM_TRANSPORT_A2DP_SOURCE | BA_PCM_TRANSPORT_A2DP_SINK)
@@ -35,6 +39,8 @@
 	(BA_PCM_TRANSPORT_HFP_HF | BA_PCM_TRANSPORT_HFP_AG)
 #define BA_PCM_TRANSPORT_MASK_HSP \
 	(BA_PCM_TRANSPORT_HSP_HS | BA_PCM_TRANSPORT_HSP_AG)
+#define BA_PCM_TRANSPORT_MASK_BAP \
+	(BA_PCM_TRANSPORT_BAP_SOURCE | BA_PCM_TRANSPORT_BAP_SINK)
 #define BA_PCM_TRANSPORT_MASK_SCO \
 	(BA_PCM_TRANSPORT_MASK_HFP | BA_PCM_TRANSPORT_MASK_HSP)
 #define BA_PCM_TRANSPORT_MASK_AG \
@@ -58,6 +64,12 @@ struct ba_dbus_ctx {
 	size_t matches_len;
 	/* BlueALSA service name */
 	char ba_service[32];
+	/* optional cache of BlueALSA PCMs */
+	dbus_bool_t pcms_cache;
+	dbus_bool_t pcms_valid;
+	dbus_uint32_t pcms_serial;
+	struct ba_pcm *pcms;
+	size_t pcms_len;
 };
 
 /**
@@ -72,6 +84,9 @@ struct ba_service_props {
 /**
  * BlueALSA PCM object property. */
 enum ba_pcm_property {
+	BLUEALSA_PCM_FORMAT,
+	BLUEALSA_PCM_CHANNELS,
+	BLUEALSA_PCM_SAMPLING,
 	BLUEALSA_PCM_SOFT_VOLUME,
 	BLUEALSA_PCM_VOLUME,
 };
@@ -95,17 +110,29 @@ struct ba_pcm {
 
 	/* PCM stream format */
 	dbus_uint16_t format;
+	/* formats supported by the PCM (native one first) */
+	dbus_uint16_t formats[4];
+	size_t formats_len;
 	/* number of audio channels */
 	unsigned char channels;
 	/* PCM sampling frequency */
 	dbus_uint32_t sampling;
+	/* sampling frequencies supported by the PCM (native one first) */
+	dbus_uint32_t samplings[16];
+	size_t samplings_len;
 
 	/* device address */
 	bdaddr_t addr;
 	/* transport codec */
 	char codec[16];
+	/* number of PCM frames in the codec block */
+	dbus_uint32_t block_frames;
 	/* approximate PCM delay */
 	dbus_uint16_t delay;
+	/* number of concealed PCM frames */
+	dbus_uint32_t concealed_frames;
+	/* effective scheduling policy of the IO thread */
+	char scheduling[64];
 	/* software volume */
 	dbus_bool_t soft_volume;
 
@@ -122,6 +149,34 @@ struct ba_pcm {
 
 };
 
+/**
+ * BlueALSA PCM IO thread statistics. */
+struct ba_pcm_stats {
+	/* packets and bytes written to the BT socket */
+	dbus_uint32_t tx_packets;
+	dbus_uint32_t tx_bytes;
+	/* packets and bytes read from the BT socket */
+	dbus_uint32_t rx_packets;
+	dbus_uint32_t rx_bytes;
+	/* transfers which missed the deadline */
+	dbus_uint32_t overdue;
+	/* PCM FIFO underruns and overruns */
+	dbus_uint32_t underruns;
+	dbus_uint32_t overruns;
+	/* missing RTP packets */
+	dbus_uint32_t rtp_lost;
+	/* PCM data drops due to the BT congestion */
+	dbus_uint32_t congestion_drops;
+	/* packets dropped by the kernel due to the BT socket overflow */
+	dbus_uint32_t rx_overflows;
+	/* PCM frames dropped due to the overrun policy */
+	dbus_uint32_t overrun_drops;
+	/* bytes queued in the BT socket output buffer */
+	dbus_uint32_t send_queue;
+	/* CPU time consumed by the IO thread in milliseconds */
+	dbus_uint32_t cpu_time;
+};
+
 dbus_bool_t bluealsa_dbus_connection_ctx_init(
 		struct ba_dbus_ctx *ctx,
 		const char *ba_service_name,
@@ -159,6 +214,13 @@ dbus_bool_t bluealsa_dbus_get_props(
 		struct ba_service_props *props,
 		DBusError *error);
 
+dbus_bool_t bluealsa_dbus_pcm_cache_enable(
+		struct ba_dbus_ctx *ctx,
+		DBusError *error);
+
+void bluealsa_dbus_pcm_cache_invalidate(
+		struct ba_dbus_ctx *ctx);
+
 dbus_bool_t bluealsa_dbus_get_pcms(
 		struct ba_dbus_ctx *ctx,
 		struct ba_pcm **pcms,
@@ -173,6 +235,12 @@ dbus_bool_t bluealsa_dbus_get_pcm(
 		struct ba_pcm *pcm,
 		DBusError *error);
 
+dbus_bool_t bluealsa_dbus_get_pcm_stats(
+		struct ba_dbus_ctx *ctx,
+		const char *pcm_path,
+		struct ba_pcm_stats *stats,
+		DBusError *error);
+
 dbus_bool_t bluealsa_dbus_open_pcm(
 		struct ba_dbus_ctx *ctx,
 		const char *pcm_path,
@@ -180,6 +248,23 @@ dbus_bool_t bluealsa_dbus_open_pcm(
 		int *fd_pcm_ctrl,
 		DBusError *error);
 
+dbus_bool_t bluealsa_dbus_open_pcms(
+		struct ba_dbus_ctx *ctx,
+		const char **pcm_paths,
+		size_t length,
+		int *fds_pcm,
+		int *fds_pcm_ctrl,
+		DBusError *error);
+
+dbus_bool_t bluealsa_dbus_open_pcm_shm(
+		struct ba_dbus_ctx *ctx,
+		const char *pcm_path,
+		int *fd_shm,
+		int *fd_shm_data,
+		int *fd_shm_space,
+		int *fd_pcm_ctrl,
+		DBusError *error);
+
 dbus_bool_t bluealsa_dbus_open_rfcomm(
 		struct ba_dbus_ctx *ctx,
 		const char *rfcomm_path,
@@ -209,6 +294,16 @@ dbus_bool_t bluealsa_dbus_pcm_ctrl_send(
 #define bluealsa_dbus_pcm_ctrl_send_resume(fd, err) \
 	bluealsa_dbus_pcm_ctrl_send(fd, "Resume", err)
 
+dbus_bool_t bluealsa_dbus_pcm_ctrl_get_status(
+		int fd_pcm_ctrl,
+		struct ba_pcm_ctrl_status *status,
+		DBusError *error);
+
+dbus_bool_t bluealsa_dbus_pcm_ctrl_get_position(
+		int fd_pcm_ctrl,
+		struct ba_pcm_ctrl_position *position,
+		DBusError *error);
+
 dbus_bool_t bluealsa_dbus_message_iter_array_get_strings(
 		DBusMessageIter *iter,
 		DBusError *error,
@@ -41,7 +41,7 @@ void ffb_free(ffb_t *ffb) {
 	if (ffb->data == NULL)
 		return;
 	free(ffb->data);
-	ffb->data = NULL;
+	ffb->data = ffb->tail = NULL;
 }
 
 /**
@@ -10,14 +10,20 @@
 
 #include "shared/log.h"
 
+#include <errno.h>
+#include <poll.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <syslog.h>
 #include <time.h>
+#include <unistd.h>
 
 #if WITH_LIBUNWIND
 # define UNW_LOCAL_ONLY
@@ -29,6 +35,21 @@
 #include "shared/defs.h"
 #include "shared/rt.h"
 
+/**
+ * The number of messages in the asynchronous logger ring. It shall be
+ * a power of 2. */
+#define LOG_RING_SIZE 128
+
+/**
+ * The maximal length of a single message queued for the asynchronous logger
+ * including the terminating null byte. Longer messages are truncated. */
+#define LOG_MESSAGE_MAX 1024
+
+/**
+ * The interval in seconds after which the number of suppressed repetitions
+ * of the same message is reported. */
+#define LOG_REPEAT_INTERVAL 5
+
 /* internal logging identifier */
 static char *_ident = NULL;
 /* if true, system logging is enabled */
@@ -36,6 +57,49 @@ static bool _syslog = false;
 /* if true, print logging time */
 static bool _time = BLUEALSA_LOGTIME;
 
+static const char *priority2str[] = {
+	[LOG_EMERG] = "X",
+	[LOG_ALERT] = "A",
+	[LOG_CRIT] = "C",
+	[LOG_ERR] = "E",
+	[LOG_WARNING] = "W",
+	[LOG_NOTICE] = "N",
+	[LOG_INFO] = "I",
+	[LOG_DEBUG] = "D",
+};
+
+/**
+ * Single message queued for the asynchronous logger. */
+struct log_record {
+	/* slot sequence number used for the queue synchronization */
+	atomic_size_t seq;
+	int priority;
+	struct timespec ts;
+	char text[LOG_MESSAGE_MAX];
+};
+
+/**
+ * Asynchronous logger data.
+ *
+ * Messages are formatted by the calling thread and queued in the bounded
+ * multi-producer ring, which is drained by the logger thread. In case when
+ * the ring is full, the message is dropped, so the caller never waits for
+ * the output (e.g. for a slow syslog daemon). */
+static struct {
+	atomic_bool running;
+	pthread_t thread;
+	int event_fd;
+	struct log_record *records;
+	atomic_size_t head;
+	size_t tail;
+	/* messages dropped due to the ring overrun */
+	atomic_uint dropped;
+	/* threads which are about to queue a message */
+	atomic_uint producers;
+} log_async = {
+	.event_fd = -1,
+};
+
 void log_open(const char *ident, bool syslog, bool time) {
 
 	free(_ident);
@@ -48,18 +112,244 @@ void log_open(const char *ident, bool syslog, bool time) {
 
 }
 
-static void vlog(int priority, const char *format, va_list ap) {
+/**
+ * Write already formatted message to the log output. */
+static void log_write(int priority, const struct timespec *ts, const char *text) {
+
+	if (_syslog)
+		syslog(priority, "%s", text);
+
+	flockfile(stderr);
+
+	if (_ident != NULL)
+		fprintf(stderr, "%s: ", _ident);
+	if (_time)
+		fprintf(stderr, "%lu.%.9lu: ", (long int)ts->tv_sec, ts->tv_nsec);
+	fprintf(stderr, "%s: %s\n", priority2str[priority], text);
+
+	funlockfile(stderr);
 
-	static const char *priority2str[] = {
-		[LOG_EMERG] = "X",
-		[LOG_ALERT] = "A",
-		[LOG_CRIT] = "C",
-		[LOG_ERR] = "E",
-		[LOG_WARNING] = "W",
-		[LOG_NOTICE] = "N",
-		[LOG_INFO] = "I",
-		[LOG_DEBUG] = "D",
-	};
+}
+
+/**
+ * Queue message for the asynchronous logger - producer side.
+ *
+ * @return On success this function returns 0. If the ring is full, -1 is
+ *   returned and errno is set to ENOBUFS. */
+static int log_async_push(int priority, const char *format, va_list ap) {
+
+	const size_t mask = LOG_RING_SIZE - 1;
+	size_t pos = atomic_load_explicit(&log_async.head, memory_order_relaxed);
+	struct log_record *rec;
+
+	for (;;) {
+		rec = &log_async.records[pos & mask];
+		const size_t seq = atomic_load_explicit(&rec->seq, memory_order_acquire);
+		const ptrdiff_t diff = (ptrdiff_t)(seq - pos);
+		if (diff == 0) {
+			/* slot is free, try to claim it */
+			if (atomic_compare_exchange_weak_explicit(&log_async.head, &pos,
+						pos + 1, memory_order_relaxed, memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0) {
+			atomic_fetch_add_explicit(&log_async.dropped, 1, memory_order_relaxed);
+			return errno = ENOBUFS, -1;
+		}
+		else
+			pos = atomic_load_explicit(&log_async.head, memory_order_relaxed);
+	}
+
+	rec->priority = priority;
+	clock_gettime(RT_CLOCK_ID, &rec->ts);
+	vsnprintf(rec->text, sizeof(rec->text), format, ap);
+	atomic_store_explicit(&rec->seq, pos + 1, memory_order_release);
+
+	eventfd_write(log_async.event_fd, 1);
+	return 0;
+}
+
+/**
+ * Take message from the ring - consumer side. */
+static struct log_record *log_async_pop(void) {
+
+	const size_t mask = LOG_RING_SIZE - 1;
+	const size_t pos = log_async.tail;
+	struct log_record *rec = &log_async.records[pos & mask];
+
+	if (atomic_load_explicit(&rec->seq, memory_order_acquire) != pos + 1)
+		return NULL;
+
+	return rec;
+}
+
+/**
+ * Release message slot for the next round of producers. */
+static void log_async_release(struct log_record *rec) {
+	const size_t pos = log_async.tail++;
+	atomic_store_explicit(&rec->seq, pos + LOG_RING_SIZE, memory_order_release);
+}
+
+/**
+ * Repeated messages suppression state of the logger thread. */
+struct log_repeat {
+	int priority;
+	char text[LOG_MESSAGE_MAX];
+	/* number of suppressed repetitions */
+	unsigned int count;
+	/* time of the last output of the suppressed message */
+	struct timespec ts;
+};
+
+/* Suppression state is used by the logger thread, and by the thread which
+ * stops the logger, after the logger thread has been joined. */
+static struct log_repeat log_async_repeat = { .priority = -1 };
+
+static void log_repeat_flush(struct log_repeat *r) {
+	if (r->count == 0)
+		return;
+	struct timespec ts;
+	clock_gettime(RT_CLOCK_ID, &ts);
+	char text[64];
+	snprintf(text, sizeof(text), "Last message repeated %u times", r->count);
+	log_write(r->priority, &ts, text);
+	r->count = 0;
+	r->ts = ts;
+}
+
+static void log_async_drain(struct log_repeat *r) {
+
+	struct log_record *rec;
+	while ((rec = log_async_pop()) != NULL) {
+
+		if (rec->priority == r->priority && strcmp(rec->text, r->text) == 0) {
+			r->count++;
+			/* do not hide the repeated message for too long */
+			if (rec->ts.tv_sec - r->ts.tv_sec >= LOG_REPEAT_INTERVAL)
+				log_repeat_flush(r);
+		}
+		else {
+			log_repeat_flush(r);
+			log_write(rec->priority, &rec->ts, rec->text);
+			r->priority = rec->priority;
+			strcpy(r->text, rec->text);
+			r->ts = rec->ts;
+		}
+
+		log_async_release(rec);
+	}
+
+	unsigned int dropped;
+	if ((dropped = atomic_exchange_explicit(&log_async.dropped, 0,
+					memory_order_relaxed)) > 0) {
+		log_repeat_flush(r);
+		struct timespec ts;
+		clock_gettime(RT_CLOCK_ID, &ts);
+		char text[64];
+		snprintf(text, sizeof(text), "Logging ring overrun: %u messages dropped", dropped);
+		log_write(LOG_WARNING, &ts, text);
+		/* the next message shall be printed regardless of the previous one */
+		r->text[0] = '\0';
+	}
+
+}
+
+static void *log_async_loop(void *userdata) {
+	(void)userdata;
+
+	struct log_repeat *repeat = &log_async_repeat;
+	struct pollfd pfds[] = {{ log_async.event_fd, POLLIN, 0 }};
+	eventfd_t event;
+
+	for (;;) {
+
+		/* wake up periodically if there are suppressed messages */
+		int timeout = repeat->count > 0 ? LOG_REPEAT_INTERVAL * 1000 : -1;
+		if (poll(pfds, ARRAYSIZE(pfds), timeout) == 0) {
+			log_repeat_flush(repeat);
+			continue;
+		}
+
+		eventfd_read(log_async.event_fd, &event);
+		log_async_drain(repeat);
+
+		if (!atomic_load_explicit(&log_async.running, memory_order_acquire))
+			break;
+
+	}
+
+	return NULL;
+}
+
+/**
+ * Start asynchronous logger thread.
+ *
+ * Once started, messages are written to the log output by the background
+ * thread. Logger resources are not released until the process exits, so
+ * it is safe to log messages concurrently with the log_async_stop() call.
+ *
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int log_async_start(void) {
+
+	if (atomic_load_explicit(&log_async.running, memory_order_relaxed))
+		return 0;
+
+	if (log_async.records == NULL) {
+
+		if ((log_async.records = malloc(LOG_RING_SIZE * sizeof(*log_async.records))) == NULL)
+			return -1;
+		for (size_t i = 0; i < LOG_RING_SIZE; i++)
+			atomic_init(&log_async.records[i].seq, i);
+
+		if ((log_async.event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1) {
+			free(log_async.records);
+			log_async.records = NULL;
+			return -1;
+		}
+
+	}
+
+	/* discard notifications of messages drained by the previous stop */
+	eventfd_t event;
+	eventfd_read(log_async.event_fd, &event);
+
+	int ret;
+	if ((ret = pthread_create(&log_async.thread, NULL, log_async_loop, NULL)) != 0)
+		return errno = ret, -1;
+
+	pthread_setname_np(log_async.thread, "ba-logger");
+
+	/* Messages are queued only after the logger thread ID has been set,
+	 * because it is used to detect messages logged by the logger itself. */
+	atomic_store(&log_async.running, true);
+	return 0;
+}
+
+/**
+ * Stop asynchronous logger thread.
+ *
+ * All queued messages are written before this function returns. Messages
+ * logged afterwards are written synchronously. */
+void log_async_stop(void) {
+
+	if (!atomic_exchange(&log_async.running, false))
+		return;
+
+	eventfd_write(log_async.event_fd, 1);
+	pthread_join(log_async.thread, NULL);
+
+	/* Wait for threads which have seen the logger running, so messages
+	 * queued just before the stop request will not be lost. */
+	while (atomic_load(&log_async.producers) > 0)
+		sched_yield();
+
+	log_async_drain(&log_async_repeat);
+	log_repeat_flush(&log_async_repeat);
+
+}
+
+static void vlog(int priority, const char *format, va_list ap) {
 
 	int oldstate;
 
@@ -69,6 +359,19 @@ static void vlog(int priority, const char *format, va_list ap) {
 	 * has to be temporally disabled. */
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
 
+	/* Messages logged by the logger thread itself (if any) are written
+	 * synchronously, because the logger thread can not wait for itself.
+	 * The producers counter is updated before checking the logger state,
+	 * so the log_async_stop() can wait for messages being queued. */
+	atomic_fetch_add(&log_async.producers, 1);
+	if (atomic_load(&log_async.running) &&
+			!pthread_equal(pthread_self(), log_async.thread)) {
+		log_async_push(priority, format, ap);
+		atomic_fetch_sub(&log_async.producers, 1);
+		goto final;
+	}
+	atomic_fetch_sub(&log_async.producers, 1);
+
 	if (_syslog) {
 		va_list ap_syslog;
 		va_copy(ap_syslog, ap);
@@ -81,8 +384,10 @@ static void vlog(int priority, const char *format, va_list ap) {
 	if (_ident != NULL)
 		fprintf(stderr, "%s: ", _ident);
 	if (_time) {
+		/* Logging time is always taken from the system clock, even if
+		 * the time synchronization uses the free-running clock. */
 		struct timespec ts;
-		gettimestamp(&ts);
+		clock_gettime(RT_CLOCK_ID, &ts);
 		fprintf(stderr, "%lu.%.9lu: ", (long int)ts.tv_sec, ts.tv_nsec);
 	}
 	fprintf(stderr, "%s: ", priority2str[priority]);
@@ -91,6 +396,7 @@ static void vlog(int priority, const char *format, va_list ap) {
 
 	funlockfile(stderr);
 
+final:
 	pthread_setcancelstate(oldstate, NULL);
 
 }
@@ -0,0 +1,92 @@
+/*
+ * BlueALSA - metrics-page.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "shared/metrics-page.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "shared/defs.h"
+
+/**
+ * The number of attempts to read consistent slot data. */
+#define METRICS_PAGE_READ_RETRIES 100
+
+static const char *metrics_page_counter_names[] = {
+	[METRICS_PAGE_COUNTER_TX_PACKETS] = "tx_packets",
+	[METRICS_PAGE_COUNTER_TX_BYTES] = "tx_bytes",
+	[METRICS_PAGE_COUNTER_RX_PACKETS] = "rx_packets",
+	[METRICS_PAGE_COUNTER_RX_BYTES] = "rx_bytes",
+	[METRICS_PAGE_COUNTER_OVERDUE] = "overdue",
+	[METRICS_PAGE_COUNTER_UNDERRUNS] = "underruns",
+	[METRICS_PAGE_COUNTER_OVERRUNS] = "overruns",
+	[METRICS_PAGE_COUNTER_RTP_LOST] = "rtp_lost",
+	[METRICS_PAGE_COUNTER_CONGESTION_DROPS] = "congestion_drops",
+	[METRICS_PAGE_COUNTER_RX_OVERFLOWS] = "rx_overflows",
+	[METRICS_PAGE_COUNTER_OVERRUN_DROPS] = "overrun_drops",
+};
+
+/**
+ * Get the name of the metrics page counter. */
+const char *metrics_page_counter_name(enum metrics_page_counter counter) {
+	if ((size_t)counter >= ARRAYSIZE(metrics_page_counter_names))
+		return NULL;
+	return metrics_page_counter_names[counter];
+}
+
+/**
+ * Mark the beginning of the slot update.
+ *
+ * There shall be only one writer of the given slot at a time. */
+void metrics_page_slot_write_begin(struct metrics_page_slot *slot) {
+	const uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+	atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+/**
+ * Mark the end of the slot update. */
+void metrics_page_slot_write_end(struct metrics_page_slot *slot) {
+	const uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+	atomic_store_explicit(&slot->seq, seq + 1, memory_order_release);
+}
+
+/**
+ * Read consistent snapshot of the metrics page slot.
+ *
+ * @param slot Pointer to the slot in the shared memory.
+ * @param copy Address where the snapshot will be stored.
+ * @return On success this function returns 0. If the slot is constantly
+ *   being updated, -1 is returned and errno is set to EAGAIN. */
+int metrics_page_slot_read(
+		const struct metrics_page_slot *slot,
+		struct metrics_page_slot *copy) {
+
+	for (size_t i = 0; i < METRICS_PAGE_READ_RETRIES; i++) {
+
+		const uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		if (seq & 1)
+			continue;
+
+		memcpy(copy, slot, sizeof(*copy));
+		atomic_thread_fence(memory_order_acquire);
+
+		if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq) {
+			/* make sure that labels are always terminated */
+			copy->device[sizeof(copy->device) - 1] = '\0';
+			copy->thread[sizeof(copy->thread) - 1] = '\0';
+			copy->transport[sizeof(copy->transport) - 1] = '\0';
+			return 0;
+		}
+
+	}
+
+	return errno = EAGAIN, -1;
+}
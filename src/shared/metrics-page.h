@@ -0,0 +1,109 @@
+/*
+ * BlueALSA - metrics-page.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_SHARED_METRICSPAGE_H_
+#define BLUEALSA_SHARED_METRICSPAGE_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Default location of the metrics page file. */
+#define METRICS_DEFAULT_PATH "/run/bluealsa/metrics"
+
+/**
+ * Magic number identifying the metrics page ("BAMP"). */
+#define METRICS_PAGE_MAGIC 0x504d4142
+
+/**
+ * Version of the metrics page layout. It shall be increased whenever
+ * the layout of the header or the slot structure changes. */
+#define METRICS_PAGE_VERSION 1
+
+/**
+ * The number of IO thread slots in the metrics page. */
+#define METRICS_PAGE_SLOTS 64
+
+/**
+ * Counters published for every IO thread. */
+enum metrics_page_counter {
+	METRICS_PAGE_COUNTER_TX_PACKETS,
+	METRICS_PAGE_COUNTER_TX_BYTES,
+	METRICS_PAGE_COUNTER_RX_PACKETS,
+	METRICS_PAGE_COUNTER_RX_BYTES,
+	METRICS_PAGE_COUNTER_OVERDUE,
+	METRICS_PAGE_COUNTER_UNDERRUNS,
+	METRICS_PAGE_COUNTER_OVERRUNS,
+	METRICS_PAGE_COUNTER_RTP_LOST,
+	METRICS_PAGE_COUNTER_CONGESTION_DROPS,
+	METRICS_PAGE_COUNTER_RX_OVERFLOWS,
+	METRICS_PAGE_COUNTER_OVERRUN_DROPS,
+	METRICS_PAGE_COUNTERS,
+};
+
+/**
+ * Header placed at the beginning of the metrics page. */
+struct metrics_page_header {
+	uint32_t magic;
+	uint32_t version;
+	/* the number of slots following the header */
+	uint32_t slots;
+	/* the size of a single slot in bytes */
+	uint32_t slot_size;
+	/* the interval at which the slots are updated */
+	uint32_t interval_ms;
+	/* the process ID of the publisher */
+	uint32_t pid;
+};
+
+/**
+ * Metrics of a single IO thread.
+ *
+ * The slot is updated with the sequence lock semantics. The sequence number
+ * is odd while the update is in progress, so the reader shall retry if the
+ * sequence number was odd or it has changed during the read. */
+struct metrics_page_slot {
+	_Atomic uint32_t seq;
+	/* non-zero if the slot is in use */
+	uint32_t used;
+	/* Bluetooth address of the device */
+	char device[18];
+	/* IO thread name */
+	char thread[16];
+	/* human-readable transport type */
+	char transport[34];
+	uint32_t counters[METRICS_PAGE_COUNTERS];
+};
+
+/**
+ * The size of the whole metrics page in bytes. */
+#define METRICS_PAGE_SIZE (sizeof(struct metrics_page_header) + \
+		METRICS_PAGE_SLOTS * sizeof(struct metrics_page_slot))
+
+/**
+ * Get the address of the slot with the given index. */
+#define metrics_page_slot(hdr, i) \
+	(&((struct metrics_page_slot *)((struct metrics_page_header *)(hdr) + 1))[i])
+
+const char *metrics_page_counter_name(enum metrics_page_counter counter);
+
+void metrics_page_slot_write_begin(struct metrics_page_slot *slot);
+void metrics_page_slot_write_end(struct metrics_page_slot *slot);
+
+int metrics_page_slot_read(
+		const struct metrics_page_slot *slot,
+		struct metrics_page_slot *copy);
+
+#endif
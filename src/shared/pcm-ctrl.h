@@ -0,0 +1,86 @@
+/*
+ * BlueALSA - pcm-ctrl.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_SHARED_PCMCTRL_H_
+#define BLUEALSA_SHARED_PCMCTRL_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdint.h>
+
+/**
+ * Binary PCM controller status query.
+ *
+ * Text commands sent over the PCM controller socket consist of printable
+ * characters only, so the binary query (which contains NUL bytes) can not
+ * be mistaken for any of them. The same applies to replies: text replies
+ * are printable, while every binary reply starts with the echoed command
+ * and query ID, so the client can match the reply with its query and skip
+ * replies which have arrived after the query has timed out. */
+#define BA_PCM_CTRL_QUERY_STATUS 0x01
+/**
+ * Binary PCM controller presentation position query. */
+#define BA_PCM_CTRL_QUERY_POSITION 0x02
+
+/**
+ * Timeout for the binary query reply in milliseconds. */
+#define BA_PCM_CTRL_QUERY_TIMEOUT 200
+
+/**
+ * Request packet of the binary status query. */
+struct ba_pcm_ctrl_query {
+	uint32_t command;
+	/* ID echoed in the reply */
+	uint32_t id;
+};
+
+/**
+ * Reply packet of the binary status query. */
+struct ba_pcm_ctrl_status {
+	/* echoed query command and ID */
+	uint32_t command;
+	uint32_t id;
+	/* The number of frames transferred between the client and the IO
+	 * thread since the PCM has been opened. */
+	uint64_t frames;
+	/* time of the last frames update taken with gettimestamp() */
+	int64_t ts_sec;
+	int64_t ts_nsec;
+	/* server-side delay in 1/10 of millisecond */
+	uint32_t delay;
+};
+
+/**
+ * Reply packet of the binary presentation position query.
+ *
+ * All values are taken at the same time, so the client can calculate the
+ * number of frames buffered by the server as the difference between the
+ * frames and frames_bt fields. */
+struct ba_pcm_ctrl_position {
+	/* echoed query command and ID */
+	uint32_t command;
+	uint32_t id;
+	/* The number of frames transferred between the client and the IO
+	 * thread since the PCM has been opened. */
+	uint64_t frames;
+	/* The number of frames written to the Bluetooth socket since the PCM
+	 * has been opened. This value is expressed in the client sampling and
+	 * is available for the playback (sink) PCM only. */
+	uint64_t frames_bt;
+	/* time of the last Bluetooth write taken with gettimestamp() */
+	int64_t ts_sec;
+	int64_t ts_nsec;
+	/* codec and transport delay in 1/10 of millisecond */
+	uint32_t delay;
+};
+
+#endif
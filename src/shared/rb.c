@@ -0,0 +1,163 @@
+/*
+ * BlueALSA - rb.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "shared/rb.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if HAVE_MEMFD_CREATE
+/**
+ * Map the same memory region twice, one copy just after another. */
+static void *rb_mmap_mirrored(size_t size) {
+
+	void *addr = MAP_FAILED;
+	int fd;
+
+	if ((fd = memfd_create("bluealsa-rb", MFD_CLOEXEC)) == -1)
+		return NULL;
+	if (ftruncate(fd, size) == -1)
+		goto final;
+
+	/* reserve address space for both copies */
+	if ((addr = mmap(NULL, size * 2, PROT_NONE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+		goto final;
+
+	if (mmap(addr, size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+			mmap((uint8_t *)addr + size, size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap(addr, size * 2);
+		addr = MAP_FAILED;
+	}
+
+final:
+	close(fd);
+	return addr != MAP_FAILED ? addr : NULL;
+}
+#endif
+
+/**
+ * Allocate resources for the ring buffer.
+ *
+ * Please note, that unlike ffb_init(), this function does not preserve
+ * data stored in the buffer during reallocation.
+ *
+ * @param rb Pointer to the buffer structure.
+ * @param nmemb Number of elements in the buffer.
+ * @param size The size of the element.
+ * @param mirrored If true, try to allocate mirrored memory mapping, so the
+ *   data can be accessed as a contiguous span regardless of its position
+ *   within the buffer. If such mapping is not available, the buffer will
+ *   silently fallback to the linear mode.
+ * @return On success this function returns 0, otherwise -1. */
+int rb_init(rb_t *rb, size_t nmemb, size_t size, bool mirrored) {
+
+	rb_free(rb);
+
+	atomic_init(&rb->head, 0);
+	atomic_init(&rb->tail, 0);
+	rb->nmemb = nmemb;
+	rb->size = size;
+	rb->mask = SIZE_MAX;
+	rb->mmap_size = 0;
+
+#if HAVE_MEMFD_CREATE
+	const size_t page_size = sysconf(_SC_PAGESIZE);
+	/* Mirrored mapping requires the buffer to be a multiple of the page size
+	 * and the power of two number of elements - for the position masking.
+	 * If the page size is not a multiple of the element size, it is not
+	 * possible to satisfy these requirements. */
+	if (mirrored && page_size % size == 0) {
+
+		size_t capacity = page_size / size;
+		while (capacity < nmemb)
+			capacity <<= 1;
+
+		if ((rb->data = rb_mmap_mirrored(capacity * size)) != NULL) {
+			rb->mask = capacity - 1;
+			rb->mmap_size = capacity * size;
+			return 0;
+		}
+
+	}
+#else
+	(void)mirrored;
+#endif
+
+	if ((rb->data = malloc(nmemb * size)) == NULL)
+		return -1;
+
+	return 0;
+}
+
+/**
+ * Free resources allocated with the rb_init().
+ *
+ * @param rb Pointer to initialized buffer structure. */
+void rb_free(rb_t *rb) {
+	if (rb->data == NULL)
+		return;
+	if (rb->mmap_size != 0)
+		munmap(rb->data, rb->mmap_size * 2);
+	else
+		free(rb->data);
+	rb->data = NULL;
+	rb->mmap_size = 0;
+}
+
+/**
+ * Discard all data available for reading.
+ *
+ * @param rb Pointer to initialized buffer structure. */
+void rb_rewind(rb_t *rb) {
+	if (rb_is_mirrored(rb))
+		atomic_store_explicit(&rb->head,
+				atomic_load_explicit(&rb->tail, memory_order_acquire),
+				memory_order_release);
+	else {
+		atomic_store_explicit(&rb->head, 0, memory_order_relaxed);
+		atomic_store_explicit(&rb->tail, 0, memory_order_relaxed);
+	}
+}
+
+/**
+ * Consume data by the given number of elements.
+ *
+ * In the mirrored mode this function does not touch the data at all, it
+ * only advances the read position. In the linear mode, remaining data is
+ * moved to the front of the buffer.
+ *
+ * @param rb Pointer to initialized buffer structure.
+ * @param nmemb Number of elements to consume.
+ * @return Number of consumed elements. Might be less than requested
+ *   nmemb in case where rb_len_out(rb) < nmemb. */
+size_t rb_shift(rb_t *rb, size_t nmemb) {
+
+	const size_t len_out = rb_len_out(rb);
+	if (nmemb > len_out)
+		nmemb = len_out;
+
+	if (rb_is_mirrored(rb)) {
+		atomic_fetch_add_explicit(&rb->head, nmemb, memory_order_release);
+		return nmemb;
+	}
+
+	const size_t len_move = len_out - nmemb;
+	if (len_move > 0)
+		memmove(rb->data, (uint8_t *)rb->data + nmemb * rb->size, len_move * rb->size);
+	atomic_store_explicit(&rb->tail, len_move, memory_order_relaxed);
+
+	return nmemb;
+}
@@ -0,0 +1,95 @@
+/*
+ * BlueALSA - rb.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_SHARED_RB_H_
+#define BLUEALSA_SHARED_RB_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Single-producer single-consumer ring buffer.
+ *
+ * Read and write positions are monotonic element counters, so the producer
+ * and the consumer do not have to share anything but these two atomics. If
+ * the buffer is mirrored (the same memory pages are mapped twice, one after
+ * another), data available for reading and space available for writing are
+ * always contiguous, and as such they can be passed directly to the codec.
+ * Otherwise, this buffer falls back to the linear behavior of the ffb_t,
+ * i.e. the unread data is moved to the front of the buffer upon shift -
+ * in such a case the buffer shall not be shared between threads. */
+typedef struct {
+	/* pointer to the allocated memory block */
+	void *data;
+	/* monotonic read position */
+	atomic_size_t head;
+	/* monotonic write position */
+	atomic_size_t tail;
+	/* number of elements in the buffer */
+	size_t nmemb;
+	/* the size of each element */
+	size_t size;
+	/* position to offset mask */
+	size_t mask;
+	/* size of the memory mapping or zero */
+	size_t mmap_size;
+} rb_t;
+
+int rb_init(rb_t *rb, size_t nmemb, size_t size, bool mirrored);
+void rb_free(rb_t *rb);
+
+#define rb_init_uint8_t(p, n) rb_init(p, n, sizeof(uint8_t), true)
+#define rb_init_int16_t(p, n) rb_init(p, n, sizeof(int16_t), true)
+#define rb_init_int32_t(p, n) rb_init(p, n, sizeof(int32_t), true)
+
+/**
+ * Check whether the buffer memory is mirrored. */
+#define rb_is_mirrored(p) ((p)->mmap_size != 0)
+
+/**
+ * Get number of unite blocks available for writing. */
+#define rb_len_in(p) ((p)->nmemb - rb_len_out(p))
+/**
+ * Get number of unite blocks available for reading. */
+#define rb_len_out(p) ((size_t)( \
+			atomic_load_explicit(&(p)->tail, memory_order_acquire) - \
+			atomic_load_explicit(&(p)->head, memory_order_acquire)))
+
+/**
+ * Get number of bytes available for writing. */
+#define rb_blen_in(p) (rb_len_in(p) * (p)->size)
+/**
+ * Get number of bytes available for reading. */
+#define rb_blen_out(p) (rb_len_out(p) * (p)->size)
+
+/**
+ * Get the address of the contiguous data span available for reading. */
+#define rb_head(p) ((void *)((uint8_t *)(p)->data + \
+			(atomic_load_explicit(&(p)->head, memory_order_relaxed) & (p)->mask) * (p)->size))
+/**
+ * Get the address of the contiguous space available for writing. */
+#define rb_tail(p) ((void *)((uint8_t *)(p)->data + \
+			(atomic_load_explicit(&(p)->tail, memory_order_relaxed) & (p)->mask) * (p)->size))
+
+/**
+ * Move the write position by the given number of unite blocks. */
+#define rb_seek(p, n) \
+	atomic_fetch_add_explicit(&(p)->tail, n, memory_order_release)
+
+void rb_rewind(rb_t *rb);
+size_t rb_shift(rb_t *rb, size_t nmemb);
+
+#endif
@@ -10,30 +10,91 @@
 
 #include "shared/rt.h"
 
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <sys/timerfd.h>
 #include <bsd/sys/time.h>
 
+static int rt_clock_system_gettime(struct timespec *ts) {
+	return clock_gettime(RT_CLOCK_ID, ts);
+}
+
+static int rt_clock_system_sleep(const struct timespec *ts) {
+	return nanosleep(ts, NULL);
+}
+
+static const struct rt_clock rt_clock_system = {
+	.gettime = rt_clock_system_gettime,
+	.sleep = rt_clock_system_sleep,
+};
+
+/* current time of the free-running clock in nanoseconds */
+static atomic_uint_fast64_t rt_clock_freerun_ns = 0;
+
+static int rt_clock_freerun_gettime(struct timespec *ts) {
+	const uint64_t ns = atomic_load_explicit(&rt_clock_freerun_ns, memory_order_relaxed);
+	ts->tv_sec = ns / 1000000000;
+	ts->tv_nsec = ns % 1000000000;
+	return 0;
+}
+
+static int rt_clock_freerun_sleep(const struct timespec *ts) {
+	uint_fast64_t ns = atomic_load_explicit(&rt_clock_freerun_ns, memory_order_relaxed);
+	const uint64_t target = ns + (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+	while (ns < target && !atomic_compare_exchange_weak_explicit(&rt_clock_freerun_ns,
+				&ns, target, memory_order_relaxed, memory_order_relaxed))
+		continue;
+	return 0;
+}
+
+const struct rt_clock rt_clock_freerun = {
+	.gettime = rt_clock_freerun_gettime,
+	.sleep = rt_clock_freerun_sleep,
+};
+
+static const struct rt_clock *rt_clock = &rt_clock_system;
+
 /**
- * Synchronize time with the sampling rate.
+ * Set clock source of the time-stamps and of the time synchronization.
  *
- * Notes:
- * 1. Time synchronization relies on the frame counter being linear.
- * 2. In order to prevent frame counter overflow (for more information see
- *   the asrsync structure definition), this counter should be initialized
- *   (zeroed) upon every transfer stop.
+ * This function shall be called before any IO thread is started.
+ *
+ * @param clock Pointer to the clock structure. If NULL, the system clock
+ *   will be restored. */
+void rt_clock_set(const struct rt_clock *clock) {
+	rt_clock = clock != NULL ? clock : &rt_clock_system;
+}
+
+/**
+ * Check whether the system clock is used as the time source. */
+bool rt_clock_is_system(void) {
+	return rt_clock == &rt_clock_system;
+}
+
+/**
+ * Get monotonic time-stamp.
+ *
+ * @param ts Address to the timespec structure where the time-stamp will
+ *   be stored.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int gettimestamp(struct timespec *ts) {
+	return rt_clock->gettime(ts);
+}
+
+/**
+ * Update time synchronization and calculate required idle time.
  *
  * @param asrs Pointer to the time synchronization structure.
  * @param frames Number of frames since the last call to this function.
- * @return This function returns a positive value or zero respectively for
- *   the case, when the synchronization was required or when blocking was
- *   not necessary. If an error has occurred, -1 is returned and errno is
- *   set to indicate the error. */
-int asrsync_sync(struct asrsync *asrs, unsigned int frames) {
+ * @return This function returns 1 if the synchronization is required, in
+ *   which case the ts_idle contains the required idle time. Otherwise, 0
+ *   is returned and the ts_idle contains an overdue time. */
+static int asrsync_get_idle(struct asrsync *asrs, unsigned int frames) {
 
 	const unsigned int rate = asrs->rate;
 	struct timespec ts_rate;
 	struct timespec ts;
-	int rv = 0;
 
 	asrs->frames += frames;
 	frames = asrs->frames;
@@ -47,12 +108,82 @@ int asrsync_sync(struct asrsync *asrs, unsigned int frames) {
 
 	/* maintain constant rate */
 	timespecsub(&ts, &asrs->ts0, &ts);
-	if (difftimespec(&ts, &ts_rate, &asrs->ts_idle) > 0) {
-		nanosleep(&asrs->ts_idle, NULL);
-		rv = 1;
+	return difftimespec(&ts, &ts_rate, &asrs->ts_idle) > 0 ? 1 : 0;
+}
+
+/**
+ * Synchronize time with the sampling rate.
+ *
+ * Notes:
+ * 1. Time synchronization relies on the frame counter being linear.
+ * 2. In order to prevent frame counter overflow (for more information see
+ *   the asrsync structure definition), this counter should be initialized
+ *   (zeroed) upon every transfer stop.
+ *
+ * @param asrs Pointer to the time synchronization structure.
+ * @param frames Number of frames since the last call to this function.
+ * @return This function returns a positive value or zero respectively for
+ *   the case, when the synchronization was required or when blocking was
+ *   not necessary. If an error has occurred, -1 is returned and errno is
+ *   set to indicate the error. */
+int asrsync_sync(struct asrsync *asrs, unsigned int frames) {
+
+	int rv;
+	if ((rv = asrsync_get_idle(asrs, frames)) > 0)
+		rt_clock->sleep(&asrs->ts_idle);
+
+	gettimestamp(&asrs->ts);
+	return rv;
+}
+
+/**
+ * Synchronize time with the sampling rate using timer.
+ *
+ * This function works exactly like the asrsync_sync(), however, instead of
+ * blocking, it arms the given timer file descriptor with the absolute time
+ * point at which the transfer of given frames shall be completed. It is up
+ * to the caller to wait for the timer expiration, e.g. by polling it along
+ * with other file descriptors.
+ *
+ * The timer file descriptor can not follow the free-running clock. In such
+ * case this function works exactly like the asrsync_sync(), but it returns 0,
+ * so the caller will not wait for the timer expiration.
+ *
+ * @param asrs Pointer to the time synchronization structure.
+ * @param frames Number of frames since the last call to this function.
+ * @param fd Timer file descriptor created with the CLOCK_MONOTONIC clock.
+ * @return This function returns a positive value or zero respectively for
+ *   the case, when the timer was armed or when waiting was not necessary.
+ *   If an error has occurred, -1 is returned and errno is set to indicate
+ *   the error. */
+int asrsync_sync_timer(struct asrsync *asrs, unsigned int frames, int fd) {
+
+	struct itimerspec its = { 0 };
+	int rv;
+
+	if (!rt_clock_is_system()) {
+		asrsync_sync(asrs, frames);
+		return 0;
 	}
 
+	if ((rv = asrsync_get_idle(asrs, frames)) > 0) {
+
+		/* The time-stamp clock might not be supported by the timerfd, so
+		 * the deadline is calculated with respect to the CLOCK_MONOTONIC. */
+		clock_gettime(CLOCK_MONOTONIC, &its.it_value);
+		timespecadd(&its.it_value, &asrs->ts_idle, &its.it_value);
+
+		if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL) == -1)
+			return -1;
+
+	}
+
+	/* Busy time shall be measured since the deadline, not since now,
+	 * because caller is supposed to wait for the timer expiration. */
 	gettimestamp(&asrs->ts);
+	if (rv > 0)
+		timespecadd(&asrs->ts, &asrs->ts_idle, &asrs->ts);
+
 	return rv;
 }
 
@@ -12,10 +12,46 @@
 #ifndef BLUEALSA_SHARED_RT_H_
 #define BLUEALSA_SHARED_RT_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <sys/time.h>
 #include <time.h>
 
+/**
+ * Identifier of the system clock used for time-stamps. */
+#ifdef CLOCK_MONOTONIC_RAW
+# define RT_CLOCK_ID CLOCK_MONOTONIC_RAW
+#else
+# define RT_CLOCK_ID CLOCK_MONOTONIC
+#endif
+
+/**
+ * Clock source of the time-stamps and of the time synchronization.
+ *
+ * By default, the system monotonic clock is used. Tests might replace it
+ * with the free-running clock, so the IO threads will run at the maximum
+ * speed while their time-stamps still follow the sampling rate. */
+struct rt_clock {
+	/* get current time-stamp */
+	int (*gettime)(struct timespec *ts);
+	/* suspend execution for the given time interval */
+	int (*sleep)(const struct timespec *ts);
+};
+
+/**
+ * Free-running clock which starts at zero and which is advanced by the sleep
+ * calls only - a sleep returns immediately after moving the clock forward.
+ *
+ * Please note, that it is not a discrete-event clock. Threads are neither
+ * ordered nor blocked by their wake-up times, so sleep requests of concurrent
+ * threads overlap and the clock advances to the latest requested wake-up
+ * time. It is thus suitable for a single paced thread, or for threads which
+ * synchronize with each other by other means (e.g. by the data flow). */
+extern const struct rt_clock rt_clock_freerun;
+
+void rt_clock_set(const struct rt_clock *clock);
+bool rt_clock_is_system(void);
+
 /**
  * Structure used for time synchronization.
  *
@@ -57,24 +93,14 @@ struct asrsync {
 	} while (0)
 
 int asrsync_sync(struct asrsync *asrs, unsigned int frames);
+int asrsync_sync_timer(struct asrsync *asrs, unsigned int frames, int fd);
 
 /**
  * Get the number of microseconds spent outside of the sync function. */
 #define asrsync_get_busy_usec(asrs) \
 	((asrs)->ts_busy.tv_nsec / 1000)
 
-/**
- * Get system monotonic time-stamp.
- *
- * @param ts Address to the timespec structure where the time-stamp will
- *   be stored.
- * @return On success this function returns 0. Otherwise, -1 is returned
- *   and errno is set to indicate the error. */
-#ifdef CLOCK_MONOTONIC_RAW
-# define gettimestamp(ts) clock_gettime(CLOCK_MONOTONIC_RAW, ts)
-#else
-# define gettimestamp(ts) clock_gettime(CLOCK_MONOTONIC, ts)
-#endif
+int gettimestamp(struct timespec *ts);
 
 int difftimespec(
 		const struct timespec *ts1,
@@ -0,0 +1,306 @@
+/*
+ * BlueALSA - shm.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "shared/shm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/**
+ * Map shared memory ring region. */
+static int shm_ring_map(shm_ring_t *r, int fd, size_t size) {
+
+	void *addr;
+	if ((addr = mmap(NULL, SHM_RING_HEADER_SIZE + size, PROT_READ | PROT_WRITE,
+					MAP_SHARED, fd, 0)) == MAP_FAILED)
+		return -1;
+
+	r->hdr = addr;
+	r->data = (uint8_t *)addr + SHM_RING_HEADER_SIZE;
+	r->size = size;
+
+	return 0;
+}
+
+/**
+ * Create new shared memory ring buffer.
+ *
+ * @param r Pointer to the ring structure.
+ * @param size The minimal size of the data area in bytes. The actual size
+ *   will be rounded up to the power of 2.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int shm_ring_create(shm_ring_t *r, size_t size) {
+
+#if HAVE_MEMFD_CREATE
+
+	int fd = -1, efd_data = -1, efd_space = -1;
+	int err;
+
+	size_t capacity = 1;
+	while (capacity < size)
+		capacity <<= 1;
+
+	if ((fd = memfd_create("bluealsa-pcm", MFD_CLOEXEC | MFD_ALLOW_SEALING)) == -1 ||
+			(efd_data = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1 ||
+			(efd_space = eventfd(1, EFD_CLOEXEC | EFD_NONBLOCK)) == -1)
+		goto fail;
+
+	/* The ring is shared with clients, so make sure that none of them can
+	 * resize it. Otherwise, access to the mapped memory might cause SIGBUS
+	 * in our process. */
+	if (ftruncate(fd, SHM_RING_HEADER_SIZE + capacity) == -1 ||
+			fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1 ||
+			shm_ring_map(r, fd, capacity) == -1)
+		goto fail;
+
+	r->hdr->magic = SHM_RING_MAGIC;
+	r->hdr->size = capacity;
+	atomic_init(&r->hdr->head, 0);
+	atomic_init(&r->hdr->tail, 0);
+	atomic_init(&r->hdr->closed, 0);
+
+	r->fd = fd;
+	r->efd_data = efd_data;
+	r->efd_space = efd_space;
+
+	return 0;
+
+fail:
+	err = errno;
+	if (fd != -1)
+		close(fd);
+	if (efd_data != -1)
+		close(efd_data);
+	if (efd_space != -1)
+		close(efd_space);
+	return errno = err, -1;
+
+#else
+	(void)r;
+	(void)size;
+	return errno = ENOSYS, -1;
+#endif
+
+}
+
+/**
+ * Attach to the shared memory ring buffer created by another process.
+ *
+ * Please note, that all given file descriptors are owned by the ring
+ * structure regardless of the result of this call.
+ *
+ * @param r Pointer to the ring structure.
+ * @param fd Shared memory file descriptor.
+ * @param efd_data Data available event file descriptor.
+ * @param efd_space Space available event file descriptor.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int shm_ring_attach(shm_ring_t *r, int fd, int efd_data, int efd_space) {
+
+	struct shm_ring_header hdr;
+	struct stat st;
+	int err;
+
+	if (fstat(fd, &st) == -1)
+		goto fail;
+	if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+		goto fail_inval;
+
+	if (hdr.magic != SHM_RING_MAGIC ||
+			hdr.size == 0 || (hdr.size & (hdr.size - 1)) != 0 ||
+			(size_t)st.st_size < SHM_RING_HEADER_SIZE + hdr.size)
+		goto fail_inval;
+
+	if (shm_ring_map(r, fd, hdr.size) == -1)
+		goto fail;
+
+	r->fd = fd;
+	r->efd_data = efd_data;
+	r->efd_space = efd_space;
+
+	return 0;
+
+fail_inval:
+	errno = EINVAL;
+fail:
+	err = errno;
+	close(fd);
+	close(efd_data);
+	close(efd_space);
+	return errno = err, -1;
+}
+
+/**
+ * Free resources allocated by the shm_ring_create() or shm_ring_attach().
+ *
+ * @param r Pointer to the ring structure. */
+void shm_ring_free(shm_ring_t *r) {
+	if (r->hdr == NULL)
+		return;
+	munmap(r->hdr, SHM_RING_HEADER_SIZE + r->size);
+	close(r->fd);
+	close(r->efd_data);
+	close(r->efd_space);
+	r->hdr = NULL;
+	r->data = NULL;
+}
+
+/**
+ * Mark the ring as closed and wake up the other side.
+ *
+ * @param r Pointer to the ring structure. */
+void shm_ring_close(shm_ring_t *r) {
+	atomic_store_explicit(&r->hdr->closed, 1, memory_order_release);
+	eventfd_write(r->efd_data, 1);
+	eventfd_write(r->efd_space, 1);
+}
+
+/**
+ * Validate positions loaded from the shared memory header.
+ *
+ * Positions are stored in the memory which is writable by the other side,
+ * so they can not be trusted. If the distance between them exceeds the
+ * size of the ring, the ring is considered corrupted and it is closed.
+ *
+ * @return This function returns the number of bytes in the ring or -1 if
+ *   the ring is corrupted. */
+static ssize_t shm_ring_validate(shm_ring_t *r, uint32_t head, uint32_t tail) {
+	const size_t len = (uint32_t)(tail - head);
+	if (len > r->size) {
+		shm_ring_close(r);
+		return -1;
+	}
+	return len;
+}
+
+/**
+ * Get the number of bytes available for reading.
+ *
+ * @param r Pointer to the ring structure.
+ * @return This function returns the number of bytes available for reading.
+ *   If the ring is corrupted, it is closed and zero is returned. */
+size_t shm_ring_len_out(shm_ring_t *r) {
+	const ssize_t len = shm_ring_validate(r,
+			atomic_load_explicit(&r->hdr->head, memory_order_acquire),
+			atomic_load_explicit(&r->hdr->tail, memory_order_acquire));
+	return len == -1 ? 0 : (size_t)len;
+}
+
+/**
+ * Get the number of bytes available for writing.
+ *
+ * @param r Pointer to the ring structure.
+ * @return This function returns the number of bytes available for writing.
+ *   If the ring is corrupted, it is closed and zero is returned. */
+size_t shm_ring_len_in(shm_ring_t *r) {
+	const ssize_t len = shm_ring_validate(r,
+			atomic_load_explicit(&r->hdr->head, memory_order_acquire),
+			atomic_load_explicit(&r->hdr->tail, memory_order_acquire));
+	return len == -1 ? 0 : r->size - len;
+}
+
+/**
+ * Read data from the ring buffer.
+ *
+ * This function never blocks. If there is no data available, the caller
+ * shall poll the data event file descriptor for reading.
+ *
+ * @param r Pointer to the ring structure.
+ * @param buffer Address of the buffer where the data shall be stored. If
+ *   NULL, the data will be discarded.
+ * @param len The maximal number of bytes to read.
+ * @return This function returns the number of bytes read. */
+size_t shm_ring_read(shm_ring_t *r, void *buffer, size_t len) {
+
+	struct shm_ring_header *hdr = r->hdr;
+	eventfd_t event;
+
+	/* Reset data notification before checking the position, so we will
+	 * not miss the notification sent by the producer in the meantime. */
+	eventfd_read(r->efd_data, &event);
+
+	const uint32_t head = atomic_load_explicit(&hdr->head, memory_order_relaxed);
+	const uint32_t tail = atomic_load_explicit(&hdr->tail, memory_order_acquire);
+	const ssize_t ret = shm_ring_validate(r, head, tail);
+	if (ret == -1)
+		return 0;
+
+	const size_t len_out = ret;
+	if (len > len_out)
+		len = len_out;
+
+	if (buffer != NULL && len > 0) {
+		const size_t offset = head & (r->size - 1);
+		const size_t len_1st = len < r->size - offset ? len : r->size - offset;
+		memcpy(buffer, r->data + offset, len_1st);
+		memcpy((uint8_t *)buffer + len_1st, r->data, len - len_1st);
+	}
+
+	atomic_store_explicit(&hdr->head, head + len, memory_order_release);
+
+	if (len > 0)
+		eventfd_write(r->efd_space, 1);
+	if (len < len_out)
+		eventfd_write(r->efd_data, 1);
+
+	return len;
+}
+
+/**
+ * Write data to the ring buffer.
+ *
+ * This function never blocks. If there is no space available, the caller
+ * shall poll the space event file descriptor for reading.
+ *
+ * @param r Pointer to the ring structure.
+ * @param buffer Address of the buffer with the data to be written.
+ * @param len The number of bytes to write.
+ * @return This function returns the number of bytes written. */
+size_t shm_ring_write(shm_ring_t *r, const void *buffer, size_t len) {
+
+	struct shm_ring_header *hdr = r->hdr;
+	eventfd_t event;
+
+	/* Reset space notification - see the comment in the read function. */
+	eventfd_read(r->efd_space, &event);
+
+	const uint32_t tail = atomic_load_explicit(&hdr->tail, memory_order_relaxed);
+	const uint32_t head = atomic_load_explicit(&hdr->head, memory_order_acquire);
+	const ssize_t ret = shm_ring_validate(r, head, tail);
+	if (ret == -1)
+		return 0;
+
+	const size_t len_in = r->size - ret;
+	if (len > len_in)
+		len = len_in;
+
+	if (len > 0) {
+		const size_t offset = tail & (r->size - 1);
+		const size_t len_1st = len < r->size - offset ? len : r->size - offset;
+		memcpy(r->data + offset, buffer, len_1st);
+		memcpy(r->data, (const uint8_t *)buffer + len_1st, len - len_1st);
+	}
+
+	atomic_store_explicit(&hdr->tail, tail + len, memory_order_release);
+
+	if (len > 0)
+		eventfd_write(r->efd_data, 1);
+	if (len < len_in)
+		eventfd_write(r->efd_space, 1);
+
+	return len;
+}
@@ -0,0 +1,91 @@
+/*
+ * BlueALSA - shm.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_SHARED_SHM_H_
+#define BLUEALSA_SHARED_SHM_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Magic number identifying the shared memory ring ("BASR"). */
+#define SHM_RING_MAGIC 0x52534142
+
+/**
+ * The size of the shared memory ring header. The data area starts just
+ * after it, so it shall not share a cache line with the positions. */
+#define SHM_RING_HEADER_SIZE 64
+
+/**
+ * Header placed at the beginning of the shared memory region. */
+struct shm_ring_header {
+	uint32_t magic;
+	/* the size of the data area */
+	uint32_t size;
+	/* monotonic read position in bytes */
+	_Atomic uint32_t head;
+	/* monotonic write position in bytes */
+	_Atomic uint32_t tail;
+	/* set by either side when the stream is closed */
+	_Atomic uint32_t closed;
+};
+
+/**
+ * Single-producer single-consumer ring buffer shared between processes.
+ *
+ * The ring is backed by a memfd, which can be passed to another process
+ * together with two event file descriptors used for wakeups: the data one
+ * is signaled by the producer after writing, the space one is signaled
+ * by the consumer after reading. Both event file descriptors are kept
+ * readable (by re-arming) as long as there is something left to read or
+ * there is space left to write, respectively, so they can be polled in
+ * a level-triggered manner. */
+typedef struct {
+	/* mapped shared memory header */
+	struct shm_ring_header *hdr;
+	/* address of the data area */
+	uint8_t *data;
+	/* the size of the data area (power of 2) */
+	size_t size;
+	/* shared memory file descriptor */
+	int fd;
+	/* data available notification */
+	int efd_data;
+	/* space available notification */
+	int efd_space;
+} shm_ring_t;
+
+int shm_ring_create(shm_ring_t *r, size_t size);
+int shm_ring_attach(shm_ring_t *r, int fd, int efd_data, int efd_space);
+void shm_ring_free(shm_ring_t *r);
+
+void shm_ring_close(shm_ring_t *r);
+
+/**
+ * Check whether the ring is mapped. */
+#define shm_ring_is_mapped(r) ((r)->hdr != NULL)
+/**
+ * Check whether the ring has been closed by any side. */
+#define shm_ring_is_closed(r) \
+	(atomic_load_explicit(&(r)->hdr->closed, memory_order_acquire) != 0)
+
+size_t shm_ring_len_out(shm_ring_t *r);
+size_t shm_ring_len_in(shm_ring_t *r);
+
+size_t shm_ring_read(shm_ring_t *r, void *buffer, size_t len);
+size_t shm_ring_write(shm_ring_t *r, const void *buffer, size_t len);
+
+#endif
@@ -0,0 +1,623 @@
+/*
+ * BlueALSA - storage.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "storage.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "a2dp.h"
+#include "ba-device.h"
+#include "ba-transport.h"
+#include "shared/defs.h"
+#include "shared/log.h"
+
+#define STORAGE_GROUP_SEP "A2DP SEP"
+#define STORAGE_GROUP_PCM "PCM"
+#define STORAGE_GROUP_DEVICE "Device"
+
+#define STORAGE_KEY_PATH "Path"
+#define STORAGE_KEY_DIRECTION "Direction"
+#define STORAGE_KEY_CODEC "Codec"
+#define STORAGE_KEY_CAPABILITIES "Capabilities"
+#define STORAGE_KEY_SOFT_VOLUME "SoftVolume"
+#define STORAGE_KEY_VOLUME "Volume"
+#define STORAGE_KEY_MUTE "Mute"
+#define STORAGE_KEY_KEEP_WARM "KeepWarm"
+
+/**
+ * In-memory copy of the device cache file. */
+struct storage {
+	/* address of the Bluetooth device in the string form */
+	char addr[18];
+	GKeyFile *keyfile;
+	/* data not written to the file yet */
+	bool dirty;
+};
+
+/* persistent storage root directory */
+static char *storage_root = NULL;
+
+/* cached device data, keyed by the Bluetooth address string */
+static GHashTable *storage_map = NULL;
+static pthread_mutex_t storage_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* pending write-back of the dirty cache entries */
+static unsigned int storage_sync_timer = 0;
+
+static void storage_free(struct storage *st) {
+	g_key_file_free(st->keyfile);
+	g_free(st);
+}
+
+struct storage_file {
+	char name[18];
+	time_t mtime;
+};
+
+static int storage_file_cmp_mtime(const void *a, const void *b) {
+	const struct storage_file *fa = a;
+	const struct storage_file *fb = b;
+	/* the most recently modified entry first */
+	return (fa->mtime < fb->mtime) - (fa->mtime > fb->mtime);
+}
+
+/**
+ * Remove data of devices which have not been seen for a long time.
+ *
+ * Device data are written every time the device connects, so the file
+ * modification time tells when the device was used for the last time. */
+static void storage_prune(void) {
+
+	GDir *dir;
+	if ((dir = g_dir_open(storage_root, 0, NULL)) == NULL)
+		return;
+
+	GArray *files = g_array_new(FALSE, FALSE, sizeof(struct storage_file));
+	const time_t threshold = time(NULL) - STORAGE_PRUNE_AGE_DAYS * 24 * 3600;
+	const char *name;
+	size_t i;
+
+	while ((name = g_dir_read_name(dir)) != NULL) {
+
+		struct storage_file file = { 0 };
+		struct stat st;
+
+		/* files other than device data are not touched */
+		if (strlen(name) != sizeof(file.name) - 1 || bachk(name) != 0)
+			continue;
+
+		char *path = g_build_filename(storage_root, name, NULL);
+		if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+			strcpy(file.name, name);
+			file.mtime = st.st_mtime;
+			g_array_append_val(files, file);
+		}
+		g_free(path);
+
+	}
+
+	g_array_sort(files, storage_file_cmp_mtime);
+
+	for (i = 0; i < files->len; i++) {
+		const struct storage_file *file = &g_array_index(files, struct storage_file, i);
+		if (i < STORAGE_DEVICES_MAX && file->mtime >= threshold)
+			continue;
+		char *path = g_build_filename(storage_root, file->name, NULL);
+		debug("Removing stale device data: %s", file->name);
+		if (unlink(path) == -1)
+			warn("Couldn't remove device data: %s: %s", path, strerror(errno));
+		g_free(path);
+	}
+
+	g_array_unref(files);
+	g_dir_close(dir);
+}
+
+/**
+ * Initialize persistent storage.
+ *
+ * @param root Path to the storage root directory. If the directory does
+ *   not exist, it will be created.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int storage_init(const char *root) {
+
+	if (g_mkdir_with_parents(root, S_IRWXU) == -1)
+		return -1;
+
+	g_free(storage_root);
+	storage_root = g_strdup(root);
+
+	if (storage_map == NULL)
+		storage_map = g_hash_table_new_full(g_str_hash, g_str_equal,
+				NULL, (GDestroyNotify)storage_free);
+
+	storage_prune();
+
+	debug("Persistent storage: %s", storage_root);
+	return 0;
+}
+
+/**
+ * Release resources associated with the persistent storage.
+ *
+ * Not yet written data are synchronized with the storage beforehand. */
+void storage_destroy(void) {
+
+	storage_sync();
+
+	pthread_mutex_lock(&storage_mutex);
+	if (storage_sync_timer != 0) {
+		g_source_remove(storage_sync_timer);
+		storage_sync_timer = 0;
+	}
+	if (storage_map != NULL) {
+		g_hash_table_destroy(storage_map);
+		storage_map = NULL;
+	}
+	pthread_mutex_unlock(&storage_mutex);
+
+	g_free(storage_root);
+	storage_root = NULL;
+}
+
+/**
+ * Get cached data of given device.
+ *
+ * If the device is not cached yet, its data are loaded from the storage.
+ * This function shall be called with the storage mutex locked. */
+static struct storage *storage_device_get(const bdaddr_t *addr) {
+
+	char tmp[18];
+	ba2str(addr, tmp);
+
+	struct storage *st;
+	if ((st = g_hash_table_lookup(storage_map, tmp)) != NULL)
+		return st;
+
+	st = g_new0(struct storage, 1);
+	strcpy(st->addr, tmp);
+	st->keyfile = g_key_file_new();
+
+	char *path = g_build_filename(storage_root, st->addr, NULL);
+	GError *err = NULL;
+
+	if (!g_key_file_load_from_file(st->keyfile, path, G_KEY_FILE_NONE, &err)) {
+		if (err->domain != G_FILE_ERROR || err->code != G_FILE_ERROR_NOENT)
+			warn("Couldn't load device cache: %s: %s", path, err->message);
+		g_error_free(err);
+	}
+
+	g_hash_table_insert(storage_map, st->addr, st);
+	g_free(path);
+	return st;
+}
+
+/**
+ * Write cached device data to the storage.
+ *
+ * This function shall be called with the storage mutex locked. */
+static int storage_device_write(struct storage *st) {
+
+	char *path = g_build_filename(storage_root, st->addr, NULL);
+	GError *err = NULL;
+	int rv = -1;
+
+	gsize size;
+	char *data = g_key_file_to_data(st->keyfile, &size, NULL);
+
+	/* file is replaced atomically, so a crash can not leave it truncated */
+	if (!g_file_set_contents(path, data, size, &err)) {
+		debug("Couldn't save device cache: %s: %s", path, err->message);
+		g_error_free(err);
+		errno = EIO;
+		goto fail;
+	}
+
+	st->dirty = false;
+	rv = 0;
+
+fail:
+	g_free(path);
+	g_free(data);
+	return rv;
+}
+
+/**
+ * Write all not yet written data to the storage.
+ *
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int storage_sync(void) {
+
+	GHashTableIter iter;
+	struct storage *st;
+	int rv = 0;
+
+	pthread_mutex_lock(&storage_mutex);
+
+	if (storage_map != NULL) {
+		g_hash_table_iter_init(&iter, storage_map);
+		while (g_hash_table_iter_next(&iter, NULL, (gpointer)&st))
+			if (st->dirty && storage_device_write(st) == -1)
+				rv = -1;
+	}
+
+	pthread_mutex_unlock(&storage_mutex);
+	return rv;
+}
+
+static gboolean storage_sync_dispatch(void *userdata) {
+	(void)userdata;
+
+	pthread_mutex_lock(&storage_mutex);
+	storage_sync_timer = 0;
+	pthread_mutex_unlock(&storage_mutex);
+
+	if (storage_sync() == -1)
+		warn("Couldn't synchronize persistent storage: %s", strerror(errno));
+
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * Mark cached device data as modified.
+ *
+ * Data are written to the storage by the timer, so a burst of changes
+ * (e.g. volume adjustment) results in a single write. This function shall
+ * be called with the storage mutex locked. */
+static void storage_device_touch(struct storage *st) {
+	st->dirty = true;
+	if (storage_sync_timer == 0)
+		storage_sync_timer = g_timeout_add_seconds(STORAGE_SYNC_DELAY,
+				storage_sync_dispatch, NULL);
+}
+
+static char *storage_bin2hex(const void *bin, size_t size) {
+	char *hex = g_malloc(size * 2 + 1);
+	const uint8_t *data = bin;
+	size_t i;
+	for (i = 0; i < size; i++)
+		sprintf(&hex[i * 2], "%02x", data[i]);
+	hex[size * 2] = '\0';
+	return hex;
+}
+
+static void *storage_hex2bin(const char *hex, size_t *size) {
+
+	const size_t len = strlen(hex);
+	if (len % 2 != 0)
+		return NULL;
+
+	uint8_t *bin = g_malloc(len / 2 + 1);
+	size_t i;
+
+	for (i = 0; i < len / 2; i++) {
+		int hi, lo;
+		if ((hi = g_ascii_xdigit_value(hex[i * 2])) == -1 ||
+				(lo = g_ascii_xdigit_value(hex[i * 2 + 1])) == -1) {
+			g_free(bin);
+			return NULL;
+		}
+		bin[i] = (hi << 4) | lo;
+	}
+
+	*size = len / 2;
+	return bin;
+}
+
+/**
+ * Get the storage group name prefix of SEPs seen via given adapter.
+ *
+ * Remote SEPs are exposed by BlueZ per adapter, so the same device
+ * paired with several adapters has separate sets of SEPs. */
+static void storage_seps_group_prefix(const bdaddr_t *adapter, char *prefix, size_t size) {
+	char tmp[18];
+	ba2str(adapter, tmp);
+	snprintf(prefix, size, STORAGE_GROUP_SEP " %s ", tmp);
+}
+
+/**
+ * Load cached remote Stream End-Points for given device.
+ *
+ * @param adapter Address of the local Bluetooth adapter.
+ * @param addr Address of the remote Bluetooth device.
+ * @return On success this function returns an array of a2dp_sep structures,
+ *   which shall be freed in the same way as the one created by the BlueZ
+ *   integration layer. If there is no cached data for given device, NULL is
+ *   returned and errno is set to ENOENT. */
+GArray *storage_device_load_seps(const bdaddr_t *adapter, const bdaddr_t *addr) {
+
+	if (storage_root == NULL)
+		return errno = ENOENT, NULL;
+
+	char prefix[32];
+	storage_seps_group_prefix(adapter, prefix, sizeof(prefix));
+
+	pthread_mutex_lock(&storage_mutex);
+
+	struct storage *st = storage_device_get(addr);
+	GArray *seps = g_array_new(FALSE, FALSE, sizeof(struct a2dp_sep));
+	char **groups = g_key_file_get_groups(st->keyfile, NULL);
+	size_t i;
+
+	for (i = 0; groups[i] != NULL; i++) {
+
+		if (strncmp(groups[i], prefix, strlen(prefix)) != 0)
+			continue;
+
+		struct a2dp_sep sep = { 0 };
+		char *sep_path = NULL;
+		char *caps = NULL;
+
+		if ((sep_path = g_key_file_get_string(st->keyfile, groups[i], STORAGE_KEY_PATH, NULL)) == NULL ||
+				(caps = g_key_file_get_string(st->keyfile, groups[i], STORAGE_KEY_CAPABILITIES, NULL)) == NULL ||
+				(sep.capabilities = storage_hex2bin(caps, &sep.capabilities_size)) == NULL)
+			goto invalid;
+
+		sep.dir = g_key_file_get_integer(st->keyfile, groups[i], STORAGE_KEY_DIRECTION, NULL);
+		sep.codec_id = g_key_file_get_integer(st->keyfile, groups[i], STORAGE_KEY_CODEC, NULL);
+		if (sep.dir != A2DP_SOURCE && sep.dir != A2DP_SINK)
+			goto invalid;
+
+		strncpy(sep.bluez_dbus_path, sep_path, sizeof(sep.bluez_dbus_path) - 1);
+		sep.configuration = g_malloc(sep.capabilities_size);
+		g_array_append_val(seps, sep);
+
+		g_free(sep_path);
+		g_free(caps);
+		continue;
+
+invalid:
+		warn("Invalid device cache entry: %s: %s", st->addr, groups[i]);
+		g_free(sep.capabilities);
+		g_free(sep_path);
+		g_free(caps);
+
+	}
+
+	/* device cache might contain PCM data only */
+	if (seps->len == 0) {
+		g_array_unref(seps);
+		seps = NULL;
+		errno = ENOENT;
+	}
+	else
+		debug("Loaded cached Stream End-Points: %s: %u", st->addr, seps->len);
+
+	pthread_mutex_unlock(&storage_mutex);
+	g_strfreev(groups);
+	return seps;
+}
+
+/**
+ * Store remote Stream End-Points of given device.
+ *
+ * BlueZ announces SEPs one by one, so in the same way as the PCM data,
+ * SEPs are written to the storage by the timer in a single write.
+ *
+ * @param adapter Address of the local Bluetooth adapter.
+ * @param addr Address of the remote Bluetooth device.
+ * @param seps An array of a2dp_sep structures.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int storage_device_save_seps(const bdaddr_t *adapter, const bdaddr_t *addr,
+		const GArray *seps) {
+
+	if (storage_root == NULL)
+		return errno = ENOTSUP, -1;
+
+	char prefix[32];
+	storage_seps_group_prefix(adapter, prefix, sizeof(prefix));
+
+	pthread_mutex_lock(&storage_mutex);
+
+	struct storage *st = storage_device_get(addr);
+	char **groups = g_key_file_get_groups(st->keyfile, NULL);
+	size_t i;
+
+	/* remove stale entries, the number of SEPs might have changed */
+	for (i = 0; groups[i] != NULL; i++)
+		if (strncmp(groups[i], prefix, strlen(prefix)) == 0)
+			g_key_file_remove_group(st->keyfile, groups[i], NULL);
+
+	for (i = 0; i < seps->len; i++) {
+
+		const struct a2dp_sep *sep = &g_array_index(seps, struct a2dp_sep, i);
+		char *caps = storage_bin2hex(sep->capabilities, sep->capabilities_size);
+		char group[48];
+
+		snprintf(group, sizeof(group), "%s%zu", prefix, i);
+		g_key_file_set_string(st->keyfile, group, STORAGE_KEY_PATH, sep->bluez_dbus_path);
+		g_key_file_set_integer(st->keyfile, group, STORAGE_KEY_DIRECTION, sep->dir);
+		g_key_file_set_integer(st->keyfile, group, STORAGE_KEY_CODEC, sep->codec_id);
+		g_key_file_set_string(st->keyfile, group, STORAGE_KEY_CAPABILITIES, caps);
+
+		g_free(caps);
+
+	}
+
+	storage_device_touch(st);
+
+	pthread_mutex_unlock(&storage_mutex);
+	g_strfreev(groups);
+	return 0;
+}
+
+/**
+ * Load the warm mode setting of given device.
+ *
+ * @param addr Address of the remote Bluetooth device.
+ * @param warm Address where the setting will be stored.
+ * @return On success this function returns 0. If there is no cached data
+ *   for given device, -1 is returned and errno is set to ENOENT. */
+int storage_device_load_warm(const bdaddr_t *addr, bool *warm) {
+
+	if (storage_root == NULL)
+		return errno = ENOENT, -1;
+
+	pthread_mutex_lock(&storage_mutex);
+
+	struct storage *st = storage_device_get(addr);
+	GError *err = NULL;
+	int rv = 0;
+
+	gboolean value = g_key_file_get_boolean(st->keyfile, STORAGE_GROUP_DEVICE,
+			STORAGE_KEY_KEEP_WARM, &err);
+	if (err == NULL)
+		*warm = value;
+	else {
+		g_error_free(err);
+		errno = ENOENT;
+		rv = -1;
+	}
+
+	pthread_mutex_unlock(&storage_mutex);
+	return rv;
+}
+
+/**
+ * Store the warm mode setting of given device.
+ *
+ * @param addr Address of the remote Bluetooth device.
+ * @param warm The warm mode setting.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int storage_device_save_warm(const bdaddr_t *addr, bool warm) {
+
+	if (storage_root == NULL)
+		return errno = ENOTSUP, -1;
+
+	pthread_mutex_lock(&storage_mutex);
+
+	struct storage *st = storage_device_get(addr);
+	g_key_file_set_boolean(st->keyfile, STORAGE_GROUP_DEVICE, STORAGE_KEY_KEEP_WARM, warm);
+	storage_device_touch(st);
+
+	pthread_mutex_unlock(&storage_mutex);
+	return 0;
+}
+
+/**
+ * Get the storage group name of given PCM.
+ *
+ * The group name is derived from the PCM D-Bus object path relative to the
+ * device path, e.g. "PCM a2dpsrc/sink", so it is stable across reconnects. */
+static char *storage_pcm_group(const struct ba_transport_pcm *pcm) {
+	const char *path = pcm->ba_dbus_path + strlen(pcm->t->d->ba_dbus_path);
+	return g_strdup_printf(STORAGE_GROUP_PCM " %s", path + 1);
+}
+
+/**
+ * Restore PCM state from the persistent storage.
+ *
+ * This function restores the software volume flag and the volume of both
+ * channels. Note, that volume scale factors are not updated, so the caller
+ * shall recalculate them afterwards.
+ *
+ * @param pcm Pointer to the transport PCM structure.
+ * @return On success this function returns 0. If there is no cached data
+ *   for given PCM, -1 is returned and errno is set to ENOENT. */
+int storage_pcm_data_sync(struct ba_transport_pcm *pcm) {
+
+	if (storage_root == NULL)
+		return errno = ENOENT, -1;
+
+	pthread_mutex_lock(&storage_mutex);
+
+	struct storage *st = storage_device_get(&pcm->t->d->addr);
+	char *group = storage_pcm_group(pcm);
+	gboolean *mute = NULL;
+	int *volume = NULL;
+	gsize length;
+	int rv = -1;
+
+	if (!g_key_file_has_group(st->keyfile, group)) {
+		errno = ENOENT;
+		goto final;
+	}
+
+	GError *err = NULL;
+	gboolean soft_volume = g_key_file_get_boolean(st->keyfile, group,
+			STORAGE_KEY_SOFT_VOLUME, &err);
+	if (err == NULL)
+		pcm->soft_volume = soft_volume;
+	else
+		g_clear_error(&err);
+
+	if ((volume = g_key_file_get_integer_list(st->keyfile, group,
+					STORAGE_KEY_VOLUME, &length, NULL)) != NULL &&
+			length == ARRAYSIZE(pcm->volume)) {
+		pcm->volume[0].level = MIN(MAX(volume[0], -9600), 9600);
+		pcm->volume[1].level = MIN(MAX(volume[1], -9600), 9600);
+	}
+
+	if ((mute = g_key_file_get_boolean_list(st->keyfile, group,
+					STORAGE_KEY_MUTE, &length, NULL)) != NULL &&
+			length == ARRAYSIZE(pcm->volume)) {
+		pcm->volume[0].muted = mute[0];
+		pcm->volume[1].muted = mute[1];
+	}
+
+	debug("Restored PCM state: %s: %s", st->addr, group);
+	rv = 0;
+
+final:
+	pthread_mutex_unlock(&storage_mutex);
+	g_free(volume);
+	g_free(mute);
+	g_free(group);
+	return rv;
+}
+
+/**
+ * Update PCM state in the persistent storage.
+ *
+ * The state is stored in the in-memory cache and it is written to the
+ * storage in the background - see storage_device_touch().
+ *
+ * @param pcm Pointer to the transport PCM structure.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int storage_pcm_data_update(const struct ba_transport_pcm *pcm) {
+
+	if (storage_root == NULL)
+		return errno = ENOTSUP, -1;
+
+	const int volume[] = { pcm->volume[0].level, pcm->volume[1].level };
+	const gboolean mute[] = { pcm->volume[0].muted, pcm->volume[1].muted };
+
+	pthread_mutex_lock(&storage_mutex);
+
+	struct storage *st = storage_device_get(&pcm->t->d->addr);
+	char *group = storage_pcm_group(pcm);
+
+	g_key_file_set_boolean(st->keyfile, group, STORAGE_KEY_SOFT_VOLUME, pcm->soft_volume);
+	g_key_file_set_integer_list(st->keyfile, group, STORAGE_KEY_VOLUME, (int *)volume, ARRAYSIZE(volume));
+	g_key_file_set_boolean_list(st->keyfile, group, STORAGE_KEY_MUTE, (gboolean *)mute, ARRAYSIZE(mute));
+	/* codec is negotiated with the remote device on every connection,
+	 * so the last used codec is stored for the reference only */
+	g_key_file_set_integer(st->keyfile, group, STORAGE_KEY_CODEC, pcm->t->type.codec);
+
+	storage_device_touch(st);
+
+	pthread_mutex_unlock(&storage_mutex);
+	g_free(group);
+	return 0;
+}
@@ -0,0 +1,54 @@
+/*
+ * BlueALSA - storage.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_STORAGE_H_
+#define BLUEALSA_STORAGE_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdbool.h>
+
+#include <bluetooth/bluetooth.h>
+
+#include <glib.h>
+
+#include "ba-transport.h"
+
+/**
+ * The delay in seconds after which modified PCM data are written
+ * to the persistent storage. */
+#define STORAGE_SYNC_DELAY 5
+
+/**
+ * Device data which have not been written for this number of days are
+ * removed from the persistent storage during the initialization. */
+#define STORAGE_PRUNE_AGE_DAYS 90
+
+/**
+ * The maximal number of devices kept in the persistent storage. */
+#define STORAGE_DEVICES_MAX 64
+
+int storage_init(const char *root);
+void storage_destroy(void);
+int storage_sync(void);
+
+GArray *storage_device_load_seps(const bdaddr_t *adapter, const bdaddr_t *addr);
+int storage_device_save_seps(const bdaddr_t *adapter, const bdaddr_t *addr,
+		const GArray *seps);
+
+int storage_device_load_warm(const bdaddr_t *addr, bool *warm);
+int storage_device_save_warm(const bdaddr_t *addr, bool warm);
+
+int storage_pcm_data_sync(struct ba_transport_pcm *pcm);
+int storage_pcm_data_update(const struct ba_transport_pcm *pcm);
+
+#endif
@@ -0,0 +1,43 @@
+/*
+ * BlueALSA - trace.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_TRACE_H_
+#define BLUEALSA_TRACE_H_
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+/**
+ * Static tracing probes of the audio data path.
+ *
+ * Probes are implemented as SystemTap SDT markers (USDT), which compile to
+ * a single NOP instruction, so they can be left enabled in release builds.
+ * All probes are defined within the "bluealsa" provider, and the first
+ * argument of every probe is the address of the transport thread structure,
+ * which uniquely identifies the PCM stream.
+ *
+ *  - pcm_read(th, samples): PCM samples read from the client
+ *  - encode_begin(th, samples): encoding of PCM samples is about to start
+ *  - encode_end(th, bytes): encoded data is ready for the transfer
+ *  - bt_write(th, bytes): data written to the BT socket
+ *  - bt_read(th, bytes): data read from the BT socket
+ *  - decode_begin(th, bytes): decoding of BT data is about to start
+ *  - decode_end(th, samples): PCM samples have been decoded
+ *  - fifo_write(th, samples): PCM samples written to the client */
+
+#if ENABLE_SYSTEMTAP
+# include <sys/sdt.h>
+# define trace_probe2(name, th, arg) STAP_PROBE2(bluealsa, name, th, arg)
+#else
+# define trace_probe2(name, th, arg) do { (void)(th); (void)(arg); } while (0)
+#endif
+
+#endif
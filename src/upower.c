@@ -29,6 +29,37 @@
 #include "utils.h"
 #include "shared/log.h"
 
+/**
+ * Update low battery state according to the battery saver threshold. */
+static void upower_update_battery_low(void) {
+
+	const unsigned int threshold = config.a2dp.battery_saver;
+	const bool low_prev = atomic_load_explicit(&config.battery.low, memory_order_relaxed);
+	bool low = false;
+
+	if (threshold > 0 && config.battery.available && config.battery.discharging) {
+		low = config.battery.level <= threshold;
+		/* do not toggle the mode back and forth around the threshold */
+		if (low_prev && config.battery.level <= threshold + UPOWER_BATTERY_SAVER_HYSTERESIS)
+			low = true;
+	}
+
+	if (low != low_prev)
+		debug("Host battery saver: %s (%u%%)", low ? "enabled" : "disabled",
+				config.battery.level);
+
+	atomic_store_explicit(&config.battery.low, low, memory_order_relaxed);
+
+}
+
+/**
+ * Check whether the UPower device state means running on battery. */
+static bool upower_state_is_discharging(GVariant *value) {
+	const uint32_t state = g_variant_get_uint32(value);
+	return state == UPOWER_DEVICE_STATE_DISCHARGING ||
+		state == UPOWER_DEVICE_STATE_PENDING_DISCHARGE;
+}
+
 /**
  * Get initial setup from UPower service.
  *
@@ -39,6 +70,8 @@ int upower_initialize(void) {
 			UPOWER_PATH_DISPLAY_DEVICE, UPOWER_IFACE_DEVICE, "IsPresent", NULL);
 	GVariant *percentage = g_dbus_get_property(config.dbus, UPOWER_SERVICE,
 			UPOWER_PATH_DISPLAY_DEVICE, UPOWER_IFACE_DEVICE, "Percentage", NULL);
+	GVariant *state = g_dbus_get_property(config.dbus, UPOWER_SERVICE,
+			UPOWER_PATH_DISPLAY_DEVICE, UPOWER_IFACE_DEVICE, "State", NULL);
 
 	if (present != NULL) {
 		config.battery.available = g_variant_get_boolean(present);
@@ -50,6 +83,12 @@ int upower_initialize(void) {
 		g_variant_unref(percentage);
 	}
 
+	if (state != NULL) {
+		config.battery.discharging = upower_state_is_discharging(state);
+		g_variant_unref(state);
+	}
+
+	upower_update_battery_low();
 	return 0;
 }
 
@@ -81,10 +120,20 @@ static void upower_signal_display_device_changed(GDBusConnection *conn, const ch
 			config.battery.level = g_variant_get_double(value);
 			updated = true;
 		}
+		else if (strcmp(property, "State") == 0 &&
+				g_variant_validate_value(value, G_VARIANT_TYPE_UINT32, property)) {
+			config.battery.discharging = upower_state_is_discharging(value);
+			/* battery level has not changed, so there is no need to notify
+			 * connected devices about this change */
+		}
 
 		g_variant_unref(value);
 	}
 
+	/* Encoder threads will pick up the new state by themselves, with the
+	 * next bit rate controller update. */
+	upower_update_battery_low();
+
 	if (updated) {
 
 		GHashTableIter iter_d, iter_t;
@@ -97,18 +146,18 @@ static void upower_signal_display_device_changed(GDBusConnection *conn, const ch
 		for (i = 0; i < HCI_MAX_DEV; i++) {
 			if ((a = ba_adapter_lookup(i)) == NULL)
 				continue;
-			pthread_mutex_lock(&a->devices_mutex);
+			pthread_rwlock_rdlock(&a->devices_lock);
 			g_hash_table_iter_init(&iter_d, a->devices);
 			while (g_hash_table_iter_next(&iter_d, NULL, (gpointer)&d)) {
-				pthread_mutex_lock(&d->transports_mutex);
+				pthread_rwlock_rdlock(&d->transports_lock);
 				g_hash_table_iter_init(&iter_t, d->transports);
 				while (g_hash_table_iter_next(&iter_t, NULL, (gpointer)&t))
 					if (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO &&
 							t->sco.rfcomm != NULL)
 						ba_rfcomm_send_signal(t->sco.rfcomm, BA_RFCOMM_SIGNAL_UPDATE_BATTERY);
-				pthread_mutex_unlock(&d->transports_mutex);
+				pthread_rwlock_unlock(&d->transports_lock);
 			}
-			pthread_mutex_unlock(&a->devices_mutex);
+			pthread_rwlock_unlock(&a->devices_lock);
 			ba_adapter_unref(a);
 		}
 
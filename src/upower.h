@@ -17,6 +17,14 @@
 #define UPOWER_IFACE_DEVICE           UPOWER_SERVICE ".Device"
 #define UPOWER_PATH_DISPLAY_DEVICE    "/org/freedesktop/UPower/devices/DisplayDevice"
 
+#define UPOWER_DEVICE_STATE_DISCHARGING         2
+#define UPOWER_DEVICE_STATE_PENDING_DISCHARGE   6
+
+/**
+ * Battery level margin (percentage) above the battery saver threshold, which
+ * has to be reached before the low battery mode is left. */
+#define UPOWER_BATTERY_SAVER_HYSTERESIS 5
+
 int upower_initialize(void);
 int upower_subscribe_signals(void);
 
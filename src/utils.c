@@ -22,6 +22,8 @@
 #endif
 
 #include "a2dp-codecs.h"
+#include "bap.h"
+#include "codec-plugin.h"
 #include "hfp.h"
 #include "shared/defs.h"
 #include "shared/log.h"
@@ -69,6 +71,7 @@ bdaddr_t *g_dbus_bluez_object_path_to_bdaddr(const char *path, bdaddr_t *addr) {
  * @param type Transport type structure.
  * @return This function returns BlueZ D-Bus object path. */
 const char *g_dbus_transport_type_to_bluez_object_path(struct ba_transport_type type) {
+	const struct codec_plugin *plugin;
 	switch (type.profile) {
 	case BA_TRANSPORT_PROFILE_A2DP_SOURCE:
 		switch (type.codec) {
@@ -85,6 +88,8 @@ const char *g_dbus_transport_type_to_bluez_object_path(struct ba_transport_type
 #if ENABLE_APTX
 		case A2DP_CODEC_VENDOR_APTX:
 			return "/A2DP/aptX/Source";
+		case A2DP_CODEC_VENDOR_APTX_LL:
+			return "/A2DP/aptXLL/Source";
 #endif
 #if ENABLE_APTX_HD
 		case A2DP_CODEC_VENDOR_APTX_HD:
@@ -99,6 +104,8 @@ const char *g_dbus_transport_type_to_bluez_object_path(struct ba_transport_type
 			return "/A2DP/LDAC/Source";
 #endif
 		default:
+			if ((plugin = codec_plugin_lookup(type.codec)) != NULL)
+				return plugin->bluez_dbus_path[A2DP_SOURCE];
 			error("Unsupported A2DP codec: %#x", type.codec);
 			g_assert_not_reached();
 		}
@@ -117,6 +124,8 @@ const char *g_dbus_transport_type_to_bluez_object_path(struct ba_transport_type
 #if ENABLE_APTX
 		case A2DP_CODEC_VENDOR_APTX:
 			return "/A2DP/aptX/Sink";
+		case A2DP_CODEC_VENDOR_APTX_LL:
+			return "/A2DP/aptXLL/Sink";
 #endif
 #if ENABLE_APTX_HD
 		case A2DP_CODEC_VENDOR_APTX_HD:
@@ -131,6 +140,8 @@ const char *g_dbus_transport_type_to_bluez_object_path(struct ba_transport_type
 			return "/A2DP/LDAC/Sink";
 #endif
 		default:
+			if ((plugin = codec_plugin_lookup(type.codec)) != NULL)
+				return plugin->bluez_dbus_path[A2DP_SINK];
 			error("Unsupported A2DP codec: %#x", type.codec);
 			g_assert_not_reached();
 		}
@@ -142,6 +153,10 @@ const char *g_dbus_transport_type_to_bluez_object_path(struct ba_transport_type
 		return "/HSP/Headset";
 	case BA_TRANSPORT_PROFILE_HSP_AG:
 		return "/HSP/AudioGateway";
+	case BA_TRANSPORT_PROFILE_BAP_SOURCE:
+		return "/BAP/LC3/Source";
+	case BA_TRANSPORT_PROFILE_BAP_SINK:
+		return "/BAP/LC3/Sink";
 	}
 	return "/";
 }
@@ -215,6 +230,7 @@ uint16_t ba_transport_codecs_a2dp_from_string(const char *str) {
 #endif
 #if ENABLE_APTX
 		A2DP_CODEC_VENDOR_APTX,
+		A2DP_CODEC_VENDOR_APTX_LL,
 #endif
 #if ENABLE_APTX_HD
 		A2DP_CODEC_VENDOR_APTX_HD,
@@ -232,6 +248,10 @@ uint16_t ba_transport_codecs_a2dp_from_string(const char *str) {
 		if (strcmp(str, ba_transport_codecs_a2dp_to_string(codecs[i])) == 0)
 			return codecs[i];
 
+	const struct codec_plugin *plugin;
+	if ((plugin = codec_plugin_lookup_name(str)) != NULL)
+		return plugin->codec_id;
+
 	return 0xFFFF;
 }
 
@@ -274,9 +294,13 @@ const char *ba_transport_codecs_a2dp_to_string(uint16_t codec) {
 		return "samsung-HD";
 	case A2DP_CODEC_VENDOR_SAMSUNG_SC:
 		return "samsung-SC";
-	default:
+	default: {
+		const struct codec_plugin *plugin;
+		if ((plugin = codec_plugin_lookup(codec)) != NULL)
+			return plugin->abi->name;
 		return NULL;
 	}
+	}
 }
 
 /**
@@ -290,6 +314,9 @@ uint16_t ba_transport_codecs_hfp_from_string(const char *str) {
 		HFP_CODEC_CVSD,
 #if ENABLE_MSBC
 		HFP_CODEC_MSBC,
+#endif
+#if ENABLE_LC3_SWB
+		HFP_CODEC_LC3_SWB,
 #endif
 	};
 
@@ -312,6 +339,22 @@ const char *ba_transport_codecs_hfp_to_string(uint16_t codec) {
 		return "CVSD";
 	case HFP_CODEC_MSBC:
 		return "mSBC";
+	case HFP_CODEC_LC3_SWB:
+		return "LC3-SWB";
+	default:
+		return NULL;
+	}
+}
+
+/**
+ * Convert LE Audio codec into a human-readable string.
+ *
+ * @param codec LE Audio coding format.
+ * @return Human-readable string or NULL for unknown codec. */
+const char *ba_transport_codecs_bap_to_string(uint16_t codec) {
+	switch (codec) {
+	case BAP_CODEC_LC3:
+		return "LC3";
 	default:
 		return NULL;
 	}
@@ -339,6 +382,8 @@ const char *ba_transport_type_to_string(struct ba_transport_type type) {
 #if ENABLE_APTX
 		case A2DP_CODEC_VENDOR_APTX:
 			return "A2DP Source (aptX)";
+		case A2DP_CODEC_VENDOR_APTX_LL:
+			return "A2DP Source (aptX LL)";
 #endif
 #if ENABLE_APTX_HD
 		case A2DP_CODEC_VENDOR_APTX_HD:
@@ -370,6 +415,8 @@ const char *ba_transport_type_to_string(struct ba_transport_type type) {
 #if ENABLE_APTX
 		case A2DP_CODEC_VENDOR_APTX:
 			return "A2DP Sink (aptX)";
+		case A2DP_CODEC_VENDOR_APTX_LL:
+			return "A2DP Sink (aptX LL)";
 #endif
 #if ENABLE_APTX_HD
 		case A2DP_CODEC_VENDOR_APTX_HD:
@@ -392,6 +439,8 @@ const char *ba_transport_type_to_string(struct ba_transport_type type) {
 			return "HFP Hands-Free (CVSD)";
 		case HFP_CODEC_MSBC:
 			return "HFP Hands-Free (mSBC)";
+		case HFP_CODEC_LC3_SWB:
+			return "HFP Hands-Free (LC3-SWB)";
 		default:
 			return "HFP Hands-Free";
 		}
@@ -401,6 +450,8 @@ const char *ba_transport_type_to_string(struct ba_transport_type type) {
 			return "HFP Audio Gateway (CVSD)";
 		case HFP_CODEC_MSBC:
 			return "HFP Audio Gateway (mSBC)";
+		case HFP_CODEC_LC3_SWB:
+			return "HFP Audio Gateway (LC3-SWB)";
 		default:
 			return "HFP Audio Gateway";
 		}
@@ -408,6 +459,20 @@ const char *ba_transport_type_to_string(struct ba_transport_type type) {
 		return "HSP Headset";
 	case BA_TRANSPORT_PROFILE_HSP_AG:
 		return "HSP Audio Gateway";
+	case BA_TRANSPORT_PROFILE_BAP_SOURCE:
+		switch (type.codec) {
+		case BAP_CODEC_LC3:
+			return "BAP Source (LC3)";
+		default:
+			return "BAP Source";
+		}
+	case BA_TRANSPORT_PROFILE_BAP_SINK:
+		switch (type.codec) {
+		case BAP_CODEC_LC3:
+			return "BAP Sink (LC3)";
+		default:
+			return "BAP Sink";
+		}
 	}
 	debug("Unknown transport type: %#x %#x", type.profile, type.codec);
 	return "N/A";
@@ -39,6 +39,7 @@ uint16_t ba_transport_codecs_a2dp_from_string(const char *str);
 const char *ba_transport_codecs_a2dp_to_string(uint16_t codec);
 uint16_t ba_transport_codecs_hfp_from_string(const char *str);
 const char *ba_transport_codecs_hfp_to_string(uint16_t codec);
+const char *ba_transport_codecs_bap_to_string(uint16_t codec);
 
 const char *ba_transport_type_to_string(struct ba_transport_type type);
 
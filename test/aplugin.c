@@ -0,0 +1,145 @@
+/*
+ * aplugin.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+/*
+ * Test A2DP codec plug-in which transfers raw 16-bit PCM signal.
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/a2dp-plugin-abi.h"
+
+#define APLUGIN_CHANNELS_MONO    (1 << 0)
+#define APLUGIN_CHANNELS_STEREO  (1 << 1)
+#define APLUGIN_SAMPLING_44100   (1 << 4)
+#define APLUGIN_SAMPLING_48000   (1 << 5)
+
+#define APLUGIN_BLOCK_FRAMES 64
+
+struct aplugin_caps {
+	uint8_t vendor_id[4];
+	uint8_t codec_id[2];
+	uint8_t config;
+} __attribute__ ((packed));
+
+static const struct aplugin_caps aplugin_caps = {
+	.vendor_id = { 0xFF, 0xFF, 0x00, 0x00 },
+	.codec_id = { 0x01, 0x00 },
+	.config = APLUGIN_CHANNELS_MONO | APLUGIN_CHANNELS_STEREO |
+		APLUGIN_SAMPLING_44100 | APLUGIN_SAMPLING_48000,
+};
+
+static int aplugin_select_configuration(void *capabilities, size_t size) {
+	struct aplugin_caps *caps = capabilities;
+	(void)size;
+	uint8_t config = 0;
+	if (caps->config & APLUGIN_CHANNELS_STEREO)
+		config |= APLUGIN_CHANNELS_STEREO;
+	else if (caps->config & APLUGIN_CHANNELS_MONO)
+		config |= APLUGIN_CHANNELS_MONO;
+	else
+		return -1;
+	if (caps->config & APLUGIN_SAMPLING_48000)
+		config |= APLUGIN_SAMPLING_48000;
+	else if (caps->config & APLUGIN_SAMPLING_44100)
+		config |= APLUGIN_SAMPLING_44100;
+	else
+		return -1;
+	caps->config = config;
+	return 0;
+}
+
+static int aplugin_get_stream(const void *configuration, size_t size,
+		struct ba_a2dp_plugin_stream *stream) {
+	const struct aplugin_caps *caps = configuration;
+	(void)size;
+	switch (caps->config & (APLUGIN_CHANNELS_MONO | APLUGIN_CHANNELS_STEREO)) {
+	case APLUGIN_CHANNELS_MONO:
+		stream->channels = 1;
+		break;
+	case APLUGIN_CHANNELS_STEREO:
+		stream->channels = 2;
+		break;
+	default:
+		return -1;
+	}
+	switch (caps->config & (APLUGIN_SAMPLING_44100 | APLUGIN_SAMPLING_48000)) {
+	case APLUGIN_SAMPLING_44100:
+		stream->sampling = 44100;
+		break;
+	case APLUGIN_SAMPLING_48000:
+		stream->sampling = 48000;
+		break;
+	default:
+		return -1;
+	}
+	stream->block_frames = APLUGIN_BLOCK_FRAMES;
+	stream->delay_frames = 0;
+	return 0;
+}
+
+static void *aplugin_init(const void *configuration, size_t size, int encoder) {
+	struct ba_a2dp_plugin_stream *stream;
+	(void)encoder;
+	if ((stream = malloc(sizeof(*stream))) == NULL)
+		return NULL;
+	if (aplugin_get_stream(configuration, size, stream) == -1) {
+		free(stream);
+		return NULL;
+	}
+	return stream;
+}
+
+static void aplugin_destroy(void *handle) {
+	free(handle);
+}
+
+static ssize_t aplugin_encode(void *handle, const int16_t *pcm,
+		void *buffer, size_t size) {
+	const struct ba_a2dp_plugin_stream *stream = handle;
+	const size_t len = stream->block_frames * stream->channels * sizeof(*pcm);
+	if (len > size)
+		return -1;
+	memcpy(buffer, pcm, len);
+	return len;
+}
+
+static ssize_t aplugin_decode(void *handle, const void *buffer, size_t size,
+		int16_t *pcm) {
+	const struct ba_a2dp_plugin_stream *stream = handle;
+	const size_t frame_size = stream->channels * sizeof(*pcm);
+	if (size > stream->block_frames * frame_size)
+		size = stream->block_frames * frame_size;
+	memcpy(pcm, buffer, size);
+	return size / frame_size;
+}
+
+static const struct ba_a2dp_plugin aplugin = {
+	.abi_version = BA_A2DP_PLUGIN_ABI_VERSION,
+	.name = "PCM",
+	.flags = BA_A2DP_PLUGIN_FLAG_RTP,
+	.capabilities = &aplugin_caps,
+	.capabilities_size = sizeof(aplugin_caps),
+	.select_configuration = aplugin_select_configuration,
+	.get_stream = aplugin_get_stream,
+	.init = aplugin_init,
+	.destroy = aplugin_destroy,
+	.encode = aplugin_encode,
+	.decode = aplugin_decode,
+};
+
+const struct ba_a2dp_plugin *ba_a2dp_plugin_entry(void) {
+	return &aplugin;
+}
@@ -0,0 +1,153 @@
+/*
+ * bench-at.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ * This program measures the throughput of the AT message parser, which is
+ * fed with the stream of messages typically exchanged with the iPhone. The
+ * stream is delivered to the incremental reader in chunks of given size, in
+ * the same way as it is done by the RFCOMM thread.
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "at.h"
+#include "shared/defs.h"
+#include "shared/log.h"
+
+static const char *messages[] = {
+	"AT+BRSF=191\r",
+	"\r\n+BRSF:1536\r\n",
+	"\r\nOK\r\n",
+	"AT+XAPL=ABCD-1234-0100,10\r",
+	"\r\n+XAPL=iPhone,6\r\n",
+	"AT+IPHONEACCEV=2,1,8,2,0\r",
+	"AT+BIEV=2,87\r",
+	"\r\n+CIND: 1,0,0,0,4,0,5\r\n",
+	"\r\n+CIEV: 5,3\r\n",
+	"AT+VGS=12\r",
+};
+
+static uint64_t bench_get_nsec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+
+	int opt;
+	const char *opts = "hc:n:";
+	struct option longopts[] = {
+		{ "help", no_argument, NULL, 'h' },
+		{ "chunk-size", required_argument, NULL, 'c' },
+		{ "messages", required_argument, NULL, 'n' },
+		{ 0, 0, 0, 0 },
+	};
+
+	size_t chunk = 64;
+	size_t count = 1000000;
+
+	while ((opt = getopt_long(argc, argv, opts, longopts, NULL)) != -1)
+		switch (opt) {
+		case 'h' /* --help */ :
+			printf("Usage:\n"
+					"  %s [OPTION]...\n"
+					"\nOptions:\n"
+					"  -h, --help\t\tprint this help and exit\n"
+					"  -c, --chunk-size=BYTES\tsize of a single RFCOMM read\n"
+					"  -n, --messages=NUM\tnumber of parsed messages\n",
+					argv[0]);
+			return EXIT_SUCCESS;
+		case 'c' /* --chunk-size=BYTES */ :
+			if ((chunk = atoi(optarg)) == 0) {
+				error("Invalid chunk size: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'n' /* --messages=NUM */ :
+			if ((count = atoi(optarg)) == 0) {
+				error("Invalid number of messages: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		default:
+			fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+
+	log_open(argv[0], false, false);
+
+	/* concatenate messages into a single stream */
+	char stream[1024] = "";
+	for (size_t i = 0; i < ARRAYSIZE(messages); i++)
+		strcat(stream, messages[i]);
+	const size_t stream_len = strlen(stream);
+
+	struct bt_at at;
+	size_t parsed = 0;
+
+	uint64_t t0 = bench_get_nsec();
+	while (parsed < count) {
+		const char *str = stream;
+		while (parsed < count && (str = at_parse(str, &at)) != NULL)
+			parsed++;
+	}
+	const double parse_sec = (bench_get_nsec() - t0) / 1e9;
+
+	struct at_reader reader = { .len = 0 };
+	size_t offset = 0;
+	size_t invalid = 0;
+
+	parsed = 0;
+	t0 = bench_get_nsec();
+	while (parsed < count) {
+
+		size_t len;
+		char *tail = at_reader_tail(&reader, &len);
+		if (len > chunk)
+			len = chunk;
+
+		/* simulate RFCOMM read of the endless stream */
+		for (size_t i = 0; i < len; i++) {
+			tail[i] = stream[offset++];
+			if (offset == stream_len)
+				offset = 0;
+		}
+
+		at_reader_seek(&reader, len);
+
+		for (;;) {
+			if (at_reader_parse(&reader) == 0)
+				parsed++;
+			else if (errno == EBADMSG)
+				invalid++;
+			else
+				break;
+		}
+
+	}
+	const double reader_sec = (bench_get_nsec() - t0) / 1e9;
+
+	printf("AT parser: %zu messages\n", count);
+	printf("  String: %.0f messages/s\n", count / parse_sec);
+	printf("  Reader (chunk %zu B): %.0f messages/s\n", chunk, parsed / reader_sec);
+	if (invalid > 0)
+		printf("  Invalid messages: %zu\n", invalid);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,180 @@
+/*
+ * bench-msbc.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ * This program measures the throughput of the mSBC encoder and decoder,
+ * including the slicing of encoded eSCO frames into MTU-sized packets, in
+ * the same way as it is done by the SCO IO threads.
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include "codec-msbc.h"
+#include "shared/defs.h"
+#include "shared/log.h"
+#include "shared/rb.h"
+
+#include "inc/sine.inc"
+
+struct bench_result {
+	/* the number of processed mSBC frames */
+	size_t frames;
+	/* the number of MTU-sized packets */
+	size_t packets;
+	/* processing time in nanoseconds */
+	uint64_t encode_nsec;
+	uint64_t decode_nsec;
+};
+
+static uint64_t bench_get_nsec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int bench_msbc(size_t mtu, unsigned int duration, struct bench_result *r) {
+
+	struct esco_msbc enc = { .initialized = false };
+	struct esco_msbc dec = { .initialized = false };
+	int16_t sine[MSBC_CODESAMPLES * MSBC_DATA_FRAMES];
+	int rv = -1;
+	int x = 0;
+
+	memset(r, 0, sizeof(*r));
+
+	if (msbc_init(&enc) == -1 || msbc_init(&dec) == -1)
+		goto final;
+
+	const size_t frames = (size_t)duration * 16000 / MSBC_CODESAMPLES;
+	while (r->frames < frames) {
+
+		const size_t samples = MIN(ARRAYSIZE(sine), rb_len_in(&enc.pcm));
+		x = snd_pcm_sine_s16le(sine, samples, 1, x, 1.0 / 128);
+		memcpy(rb_tail(&enc.pcm), sine, samples * sizeof(*sine));
+		rb_seek(&enc.pcm, samples);
+
+		uint64_t t0 = bench_get_nsec();
+		if (msbc_encode(&enc) == -1)
+			goto final;
+		r->encode_nsec += bench_get_nsec() - t0;
+		r->frames += enc.frames;
+		enc.frames = 0;
+
+		/* Slice encoded frames into MTU-sized packets (the decoder
+		 * socket receives them one by one) and decode them. */
+		const uint8_t *data = rb_head(&enc.data);
+		size_t data_len = rb_blen_out(&enc.data);
+		for (; data_len >= mtu; data += mtu, data_len -= mtu) {
+
+			memcpy(rb_tail(&dec.data), data, mtu);
+			rb_seek(&dec.data, mtu);
+			r->packets++;
+
+			t0 = bench_get_nsec();
+			while (msbc_decode(&dec) == 1)
+				continue;
+			r->decode_nsec += bench_get_nsec() - t0;
+			rb_rewind(&dec.pcm);
+
+		}
+
+		rb_shift(&enc.data, rb_blen_out(&enc.data) - data_len);
+
+	}
+
+	rv = 0;
+
+final:
+	if (rv == -1)
+		error("mSBC codec error: %s", strerror(errno));
+	msbc_finish(&enc);
+	msbc_finish(&dec);
+	return rv;
+}
+
+int main(int argc, char *argv[]) {
+
+	int opt;
+	const char *opts = "hd:";
+	struct option longopts[] = {
+		{ "help", no_argument, NULL, 'h' },
+		{ "duration", required_argument, NULL, 'd' },
+		{ 0, 0, 0, 0 },
+	};
+
+	unsigned int duration = 60;
+
+	while ((opt = getopt_long(argc, argv, opts, longopts, NULL)) != -1)
+		switch (opt) {
+		case 'h' /* --help */ :
+			printf("Usage:\n"
+					"  %s [OPTION]... [MTU]...\n"
+					"\nOptions:\n"
+					"  -h, --help\t\tprint this help and exit\n"
+					"  -d, --duration=SEC\tduration of the processed signal\n",
+					argv[0]);
+			return EXIT_SUCCESS;
+		case 'd' /* --duration=SEC */ :
+			if ((duration = atoi(optarg)) == 0) {
+				error("Invalid signal duration: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		default:
+			fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+
+	/* typical eSCO MTUs reported by BT controllers */
+	size_t mtus[16] = { 24, 48, 60 };
+	size_t mtus_count = 3;
+
+	if (optind < argc)
+		for (mtus_count = 0; optind < argc && mtus_count < ARRAYSIZE(mtus); optind++) {
+			const int mtu = atoi(argv[optind]);
+			if (mtu <= 0 || mtu > (int)(sizeof(esco_msbc_frame_t) * MSBC_DATA_FRAMES)) {
+				error("Invalid MTU: %s", argv[optind]);
+				return EXIT_FAILURE;
+			}
+			mtus[mtus_count++] = mtu;
+		}
+
+	log_open(argv[0], false, false);
+
+	for (size_t i = 0; i < mtus_count; i++) {
+
+		struct bench_result r;
+		if (bench_msbc(mtus[i], duration, &r) == -1)
+			return EXIT_FAILURE;
+
+		const double encode_sec = r.encode_nsec / 1e9;
+		const double decode_sec = r.decode_nsec / 1e9;
+
+		printf("mSBC: MTU %zu, %u s\n", mtus[i], duration);
+		printf("  Packets: %zu (%.1f/s)\n", r.packets, (double)r.packets / duration);
+		printf("  Encoding: %.0f frames/s (%.1fx real-time)\n",
+				r.frames / encode_sec, duration / encode_sec);
+		printf("  Decoding: %.0f frames/s (%.1fx real-time)\n",
+				r.frames / decode_sec, duration / decode_sec);
+
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,950 @@
+/*
+ * bluealsa-bench.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ * This program runs a number of concurrent mock A2DP and SCO transports
+ * with synthetic PCM signal through every enabled codec, and reports CPU
+ * usage, BT packet rate, encoding and decoding latency and memory usage.
+ * It might be used for a reproducible comparison of BlueALSA releases.
+ *
+ * Results might be stored as a baseline and compared with the baseline in
+ * subsequent runs. In such case, the program fails if any of the real-time
+ * factors or the 99th percentile of the per-packet latency regresses beyond
+ * the configured margin.
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <bluetooth/bluetooth.h>
+#include <glib.h>
+#if ENABLE_LDAC
+# include <ldacBT.h>
+#endif
+
+struct ba_transport_thread;
+static void bench_trace_encode_begin(struct ba_transport_thread *th, size_t arg);
+static void bench_trace_encode_end(struct ba_transport_thread *th, size_t arg);
+static void bench_trace_decode_begin(struct ba_transport_thread *th, size_t arg);
+static void bench_trace_decode_end(struct ba_transport_thread *th, size_t arg);
+
+/* Route tracing probes of the included IO threads to the latency
+ * collector of this benchmark, regardless of the SystemTap support. */
+#define BLUEALSA_TRACE_H_
+#define trace_probe2(name, th, arg) bench_trace_ ## name(th, arg)
+
+#include "a2dp-codecs.h"
+#include "a2dp.h"
+#include "ba-adapter.h"
+#include "ba-device.h"
+#include "ba-rfcomm.h"
+#include "ba-transport.h"
+#include "bluealsa-dbus.h"
+#include "bluealsa.h"
+#include "bluez.h"
+#include "hfp.h"
+#include "rtp.h"
+#include "sco.h"
+#include "utils.h"
+#include "shared/defs.h"
+#include "shared/log.h"
+#include "shared/rt.h"
+
+#include "../src/a2dp.c"
+#include "../src/a2dp-sbc.c"
+#if ENABLE_AAC
+# include "../src/a2dp-aac.c"
+#endif
+#if ENABLE_APTX
+# include "../src/a2dp-aptx.c"
+#endif
+#if ENABLE_APTX_HD
+# include "../src/a2dp-aptx-hd.c"
+#endif
+#if ENABLE_FASTSTREAM
+# include "../src/a2dp-faststream.c"
+#endif
+#if ENABLE_LDAC
+# include "../src/a2dp-ldac.c"
+#endif
+#if ENABLE_MPEG
+# include "../src/a2dp-mpeg.c"
+#endif
+#include "../src/a2dp-plugin.c"
+#include "../src/ba-transport.c"
+#include "../src/sco.c"
+#include "inc/sine.inc"
+
+unsigned int bluealsa_dbus_pcm_register(struct ba_transport_pcm *pcm, GError **error) {
+	debug("%s: %p", __func__, (void *)pcm); (void)error; return 0; }
+void bluealsa_dbus_pcm_update(struct ba_transport_pcm *pcm, unsigned int mask) {
+	debug("%s: %p %#x", __func__, (void *)pcm, mask); }
+void bluealsa_dbus_pcm_unregister(struct ba_transport_pcm *pcm) {
+	debug("%s: %p", __func__, (void *)pcm); }
+int bluealsa_dbus_pcm_handover_detach(struct ba_transport_pcm *pcm,
+		struct ba_transport_pcm_handover *h) {
+	debug("%s: %p", __func__, (void *)pcm); (void)h; return errno = ENOTSUP, -1; }
+int bluealsa_dbus_pcm_handover_attach(struct ba_transport_pcm *pcm,
+		struct ba_transport_pcm_handover *h) {
+	debug("%s: %p", __func__, (void *)pcm); (void)h; return errno = ENOTSUP, -1; }
+struct ba_rfcomm *ba_rfcomm_new(struct ba_transport *sco, int fd) {
+	debug("%s: %p", __func__, (void *)sco); (void)fd; return NULL; }
+void ba_rfcomm_destroy(struct ba_rfcomm *r) {
+	debug("%s: %p", __func__, (void *)r); }
+int ba_rfcomm_send_signal(struct ba_rfcomm *r, enum ba_rfcomm_signal sig) {
+	debug("%s: %p: %#x", __func__, (void *)r, sig); return 0; }
+bool bluez_a2dp_set_configuration(const char *current_dbus_sep_path,
+		const struct a2dp_sep *sep, GError **error) {
+	debug("%s: %s", __func__, current_dbus_sep_path); (void)sep;
+	(void)error; return false; }
+
+static const a2dp_sbc_t config_sbc_44100_stereo = {
+	.frequency = SBC_SAMPLING_FREQ_44100,
+	.channel_mode = SBC_CHANNEL_MODE_JOINT_STEREO,
+	.block_length = SBC_BLOCK_LENGTH_16,
+	.subbands = SBC_SUBBANDS_8,
+	.allocation_method = SBC_ALLOCATION_LOUDNESS,
+	.min_bitpool = SBC_MIN_BITPOOL,
+	.max_bitpool = SBC_MAX_BITPOOL,
+};
+
+__attribute__ ((unused))
+static const a2dp_mpeg_t config_mp3_44100_stereo = {
+	.layer = MPEG_LAYER_MP3,
+	.channel_mode = MPEG_CHANNEL_MODE_STEREO,
+	.frequency = MPEG_SAMPLING_FREQ_44100,
+	.vbr = 1,
+	MPEG_INIT_BITRATE(0xFFFF)
+};
+
+__attribute__ ((unused))
+static const a2dp_aac_t config_aac_44100_stereo = {
+	.object_type = AAC_OBJECT_TYPE_MPEG2_AAC_LC,
+	AAC_INIT_FREQUENCY(AAC_SAMPLING_FREQ_44100)
+	.channels = AAC_CHANNELS_2,
+	.vbr = 1,
+	AAC_INIT_BITRATE(0xFFFF)
+};
+
+__attribute__ ((unused))
+static const a2dp_aptx_t config_aptx_44100_stereo = {
+	.info = A2DP_SET_VENDOR_ID_CODEC_ID(APTX_VENDOR_ID, APTX_CODEC_ID),
+	.frequency = APTX_SAMPLING_FREQ_44100,
+	.channel_mode = APTX_CHANNEL_MODE_STEREO,
+};
+
+__attribute__ ((unused))
+static const a2dp_aptx_hd_t config_aptx_hd_44100_stereo = {
+	.aptx.info = A2DP_SET_VENDOR_ID_CODEC_ID(APTX_HD_VENDOR_ID, APTX_HD_CODEC_ID),
+	.aptx.frequency = APTX_SAMPLING_FREQ_44100,
+	.aptx.channel_mode = APTX_CHANNEL_MODE_STEREO,
+};
+
+__attribute__ ((unused))
+static const a2dp_faststream_t config_faststream_44100_16000 = {
+	.info = A2DP_SET_VENDOR_ID_CODEC_ID(FASTSTREAM_VENDOR_ID, FASTSTREAM_CODEC_ID),
+	.direction = FASTSTREAM_DIRECTION_MUSIC | FASTSTREAM_DIRECTION_VOICE,
+	.frequency_music = FASTSTREAM_SAMPLING_FREQ_MUSIC_44100,
+	.frequency_voice = FASTSTREAM_SAMPLING_FREQ_VOICE_16000,
+};
+
+__attribute__ ((unused))
+static const a2dp_ldac_t config_ldac_44100_stereo = {
+	.info = A2DP_SET_VENDOR_ID_CODEC_ID(LDAC_VENDOR_ID, LDAC_CODEC_ID),
+	.frequency = LDAC_SAMPLING_FREQ_44100,
+	.channel_mode = LDAC_CHANNEL_MODE_STEREO,
+};
+
+struct bench_codec {
+	const char *name;
+	/* A2DP codecs for source and sink transports, NULL for SCO */
+	const struct a2dp_codec *codec_source;
+	const struct a2dp_codec *codec_sink;
+	const void *configuration;
+	/* SCO transport type */
+	struct ba_transport_type sco_type;
+	size_t mtu;
+	void *(*enc)(struct ba_transport_thread *);
+	void *(*dec)(struct ba_transport_thread *);
+};
+
+static const struct bench_codec codecs[] = {
+	{ "SBC", &a2dp_codec_source_sbc, &a2dp_codec_sink_sbc,
+		&config_sbc_44100_stereo, { 0 }, 153 * 3,
+		a2dp_sbc_enc_thread, a2dp_sbc_dec_thread },
+#if ENABLE_MP3LAME
+	{ "MP3", &a2dp_codec_source_mpeg, &a2dp_codec_sink_mpeg,
+		&config_mp3_44100_stereo, { 0 }, 1024,
+		a2dp_mp3_enc_thread, a2dp_mpeg_dec_thread },
+#endif
+#if ENABLE_AAC
+	{ "AAC", &a2dp_codec_source_aac, &a2dp_codec_sink_aac,
+		&config_aac_44100_stereo, { 0 }, 450,
+		a2dp_aac_enc_thread, a2dp_aac_dec_thread },
+#endif
+#if ENABLE_APTX
+	{ "aptX", &a2dp_codec_source_aptx, &a2dp_codec_sink_aptx,
+		&config_aptx_44100_stereo, { 0 }, 400,
+		a2dp_aptx_enc_thread, a2dp_aptx_dec_thread },
+#endif
+#if ENABLE_APTX_HD
+	{ "aptX-HD", &a2dp_codec_source_aptx_hd, &a2dp_codec_sink_aptx_hd,
+		&config_aptx_hd_44100_stereo, { 0 }, 600,
+		a2dp_aptx_hd_enc_thread, a2dp_aptx_hd_dec_thread },
+#endif
+#if ENABLE_FASTSTREAM
+	{ "FastStream", &a2dp_codec_source_faststream, &a2dp_codec_sink_faststream,
+		&config_faststream_44100_16000, { 0 }, 72 * 3,
+		a2dp_faststream_enc_thread, a2dp_faststream_dec_thread },
+#endif
+#if ENABLE_LDAC
+	{ "LDAC", &a2dp_codec_source_ldac, &a2dp_codec_sink_ldac,
+		&config_ldac_44100_stereo, { 0 }, RTP_HEADER_LEN + sizeof(rtp_media_header_t) + 990 + 6,
+		a2dp_ldac_enc_thread,
+# if HAVE_LDAC_DECODE
+		a2dp_ldac_dec_thread },
+# else
+		NULL },
+# endif
+#endif
+	{ "CVSD", NULL, NULL, NULL,
+		{ BA_TRANSPORT_PROFILE_HSP_AG, HFP_CODEC_CVSD }, 48,
+		sco_enc_thread, sco_dec_thread },
+#if ENABLE_MSBC
+	{ "mSBC", NULL, NULL, NULL,
+		{ BA_TRANSPORT_PROFILE_HFP_AG, HFP_CODEC_MSBC }, 24,
+		sco_enc_thread, sco_dec_thread },
+#endif
+#if ENABLE_LC3_SWB
+	{ "LC3-SWB", NULL, NULL, NULL,
+		{ BA_TRANSPORT_PROFILE_HFP_AG, HFP_CODEC_LC3_SWB }, 60,
+		sco_enc_thread, sco_dec_thread },
+#endif
+};
+
+/**
+ * Benchmark results of a single codec which are compared with the baseline.
+ * The real-time factor is the CPU time consumed by the encoding or decoding
+ * thread divided by the duration of the processed signal. */
+struct bench_result {
+	bool valid;
+	double enc_rtf;
+	double dec_rtf;
+	/* 99th percentile of the per-packet latency in microseconds */
+	unsigned int enc_p99;
+	unsigned int dec_p99;
+};
+
+/**
+ * Baseline metrics in the order of the bench_result_metric() indexes. The
+ * absolute tolerance is added to the relative margin, so the measurement
+ * noise of very small values will not be reported as a regression. */
+static const struct {
+	const char *name;
+	double tolerance;
+} bench_metrics[] = {
+	{ "enc-rtf", 0.001 },
+	{ "dec-rtf", 0.001 },
+	{ "enc-p99-us", 5 },
+	{ "dec-p99-us", 5 },
+};
+
+static double bench_result_metric(const struct bench_result *r, size_t metric) {
+	switch (metric) {
+	case 0:
+		return r->enc_rtf;
+	case 1:
+		return r->dec_rtf;
+	case 2:
+		return r->enc_p99;
+	case 3:
+	default:
+		return r->dec_p99;
+	}
+}
+
+/**
+ * The maximal number of latency samples kept for every stream. If there
+ * are more samples, the oldest ones are overwritten. */
+#define BENCH_LATENCY_SAMPLES (16 * 1024)
+
+struct bench_latency {
+	/* processing time samples in microseconds */
+	uint32_t samples[BENCH_LATENCY_SAMPLES];
+	/* total number of recorded samples */
+	size_t count;
+};
+
+struct bench_stream {
+	/* A2DP source or SCO transport */
+	struct ba_transport *t_src;
+	/* A2DP sink transport, NULL for SCO */
+	struct ba_transport *t_snk;
+	/* benchmark side of the PCM and BT sockets */
+	int pcm_write_fd;
+	int pcm_read_fd;
+	int bt_fd;
+	/* synthetic PCM signal */
+	uint8_t *pcm;
+	size_t pcm_len;
+	size_t pcm_offset;
+	struct bench_latency enc;
+	struct bench_latency dec;
+};
+
+static struct ba_adapter *adapter = NULL;
+static struct bench_stream *streams = NULL;
+static size_t streams_count = 0;
+
+static __thread struct bench_latency *bench_latency = NULL;
+static __thread struct timespec bench_latency_ts;
+
+/**
+ * Get latency collector associated with the transport thread. */
+static struct bench_latency *bench_latency_lookup(struct ba_transport_thread *th) {
+	for (size_t i = 0; i < streams_count; i++) {
+		struct bench_stream *s = &streams[i];
+		if (th == &s->t_src->thread_enc)
+			return &s->enc;
+		if (s->t_snk == NULL && th == &s->t_src->thread_dec)
+			return &s->dec;
+		if (s->t_snk != NULL && th == &s->t_snk->thread_dec)
+			return &s->dec;
+	}
+	return NULL;
+}
+
+static void bench_trace_begin(struct ba_transport_thread *th) {
+	if (bench_latency == NULL)
+		bench_latency = bench_latency_lookup(th);
+	gettimestamp(&bench_latency_ts);
+}
+
+static void bench_trace_end(void) {
+
+	struct timespec ts;
+	gettimestamp(&ts);
+
+	if (bench_latency == NULL)
+		return;
+
+	difftimespec(&bench_latency_ts, &ts, &ts);
+	const uint32_t usec = ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	bench_latency->samples[bench_latency->count++ % BENCH_LATENCY_SAMPLES] = usec;
+
+}
+
+static void bench_trace_encode_begin(struct ba_transport_thread *th, size_t arg) {
+	(void)arg; bench_trace_begin(th); }
+static void bench_trace_encode_end(struct ba_transport_thread *th, size_t arg) {
+	(void)th; (void)arg; bench_trace_end(); }
+static void bench_trace_decode_begin(struct ba_transport_thread *th, size_t arg) {
+	(void)arg; bench_trace_begin(th); }
+static void bench_trace_decode_end(struct ba_transport_thread *th, size_t arg) {
+	(void)th; (void)arg; bench_trace_end(); }
+
+static int bench_transport_acquire(struct ba_transport *t) {
+	debug("Acquire transport: %d", t->bt_fd);
+	return 0;
+}
+
+static int bench_transport_release_bt_a2dp(struct ba_transport *t) {
+	free(t->bluez_dbus_owner); t->bluez_dbus_owner = NULL;
+	return transport_release_bt_a2dp(t);
+}
+
+/**
+ * Get resident set size of this process in KiB. */
+static long bench_get_rss(void) {
+
+	long size = 0, resident = 0;
+	FILE *f;
+
+	if ((f = fopen("/proc/self/statm", "r")) == NULL)
+		return 0;
+	if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+		resident = 0;
+	fclose(f);
+
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/**
+ * Get CPU time consumed by the transport thread in nanoseconds. */
+static uint64_t bench_get_thread_cpu(const struct ba_transport_thread *th) {
+
+	struct timespec ts;
+	clockid_t id;
+
+	if (pthread_equal(th->id, config.main_thread) ||
+			pthread_getcpuclockid(th->id, &id) != 0 ||
+			clock_gettime(id, &ts) == -1)
+		return 0;
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int bench_cmp_uint32(const void *a, const void *b) {
+	const uint32_t x = *(const uint32_t *)a;
+	const uint32_t y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * Print latency percentiles of all streams combined.
+ *
+ * @return This function returns the 99th percentile of the latency in
+ *   microseconds, or 0 if there are no samples. */
+static unsigned int bench_print_latency(const char *label, bool enc) {
+
+	size_t count = 0;
+	for (size_t i = 0; i < streams_count; i++) {
+		const struct bench_latency *l = enc ? &streams[i].enc : &streams[i].dec;
+		count += MIN(l->count, BENCH_LATENCY_SAMPLES);
+	}
+
+	if (count == 0) {
+		printf("  %s latency [us]: n/a\n", label);
+		return 0;
+	}
+
+	uint32_t *samples = malloc(sizeof(*samples) * count);
+	size_t n = 0;
+
+	for (size_t i = 0; i < streams_count; i++) {
+		const struct bench_latency *l = enc ? &streams[i].enc : &streams[i].dec;
+		const size_t len = MIN(l->count, BENCH_LATENCY_SAMPLES);
+		memcpy(&samples[n], l->samples, sizeof(*samples) * len);
+		n += len;
+	}
+
+	qsort(samples, count, sizeof(*samples), bench_cmp_uint32);
+	printf("  %s latency [us]: p50=%u p90=%u p99=%u max=%u (samples: %zu)\n", label,
+			samples[count * 50 / 100], samples[count * 90 / 100],
+			samples[count * 99 / 100], samples[count - 1], count);
+
+	const unsigned int p99 = samples[count * 99 / 100];
+	free(samples);
+	return p99;
+}
+
+static struct ba_transport_pcm *bench_stream_pcm_src(struct bench_stream *s) {
+	if (s->t_snk == NULL)
+		return &s->t_src->sco.spk_pcm;
+	return &s->t_src->a2dp.pcm;
+}
+
+static struct ba_transport_pcm *bench_stream_pcm_snk(struct bench_stream *s) {
+	if (s->t_snk == NULL)
+		return &s->t_src->sco.mic_pcm;
+	return &s->t_snk->a2dp.pcm;
+}
+
+/**
+ * Generate synthetic PCM signal in the client format of the given PCM. */
+static int bench_stream_init_pcm(struct bench_stream *s, const struct ba_transport_pcm *pcm) {
+
+	const size_t frames = 1024;
+	const size_t samples = frames * pcm->channels;
+	const size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(pcm->format);
+	const unsigned int width = BA_TRANSPORT_PCM_FORMAT_WIDTH(pcm->format);
+	int16_t buffer[2 * 1024];
+	size_t i;
+
+	if ((s->pcm = malloc(samples * sample_size)) == NULL)
+		return -1;
+
+	snd_pcm_sine_s16le(buffer, samples, pcm->channels, 0, 1.0 / 128);
+
+	if (sample_size == sizeof(int16_t))
+		memcpy(s->pcm, buffer, samples * sizeof(int16_t));
+	else
+		for (i = 0; i < samples; i++)
+			((int32_t *)s->pcm)[i] = (int32_t)buffer[i] << (width - 16);
+
+	s->pcm_len = samples * sample_size;
+	s->pcm_offset = 0;
+	return 0;
+}
+
+static int bench_stream_init(struct bench_stream *s, const struct bench_codec *c, size_t id) {
+
+	struct ba_transport_type ttype = { 0 };
+	struct ba_device *d1, *d2;
+	bdaddr_t addr1 = {{ id, 0, 0, 0, 0, 1 }};
+	bdaddr_t addr2 = {{ id, 0, 0, 0, 0, 2 }};
+	int bt_fds[2], pcm_src_fds[2], pcm_snk_fds[2];
+
+	d1 = ba_device_new(adapter, &addr1);
+	d2 = ba_device_new(adapter, &addr2);
+
+	if (c->codec_source != NULL) {
+		ttype.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE;
+		ttype.codec = c->codec_source->codec_id;
+		s->t_src = ba_transport_new_a2dp(d1, ttype, ":bench", "/bench/source",
+				c->codec_source, c->configuration);
+		ttype.profile = BA_TRANSPORT_PROFILE_A2DP_SINK;
+		s->t_snk = ba_transport_new_a2dp(d2, ttype, ":bench", "/bench/sink",
+				c->codec_sink, c->configuration);
+	}
+	else {
+		s->t_src = ba_transport_new_sco(d1, c->sco_type, ":bench", "/bench/sco", -1);
+		s->t_snk = NULL;
+	}
+
+	ba_device_unref(d1);
+	ba_device_unref(d2);
+
+	if (s->t_src == NULL || (c->codec_source != NULL && s->t_snk == NULL)) {
+		if (s->t_src != NULL)
+			ba_transport_destroy(s->t_src);
+		s->t_src = NULL;
+		return -1;
+	}
+
+	s->t_src->acquire = bench_transport_acquire;
+	s->t_src->mtu_read = s->t_src->mtu_write = c->mtu;
+	if (s->t_snk != NULL) {
+		s->t_src->release = bench_transport_release_bt_a2dp;
+		s->t_snk->acquire = bench_transport_acquire;
+		s->t_snk->release = bench_transport_release_bt_a2dp;
+		s->t_snk->mtu_read = s->t_snk->mtu_write = c->mtu;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, bt_fds) == -1 ||
+			socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pcm_src_fds) == -1 ||
+			socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pcm_snk_fds) == -1)
+		return -1;
+
+	/* For A2DP the source transport writes to the sink one, unless the sink
+	 * decoder is not available. For SCO the BT data is looped back. */
+	s->t_src->bt_fd = bt_fds[1];
+	s->bt_fd = bt_fds[0];
+	if (s->t_snk != NULL && c->dec != NULL) {
+		s->t_snk->bt_fd = bt_fds[0];
+		s->bt_fd = -1;
+	}
+
+	bench_stream_pcm_src(s)->fd = pcm_src_fds[1];
+	s->pcm_write_fd = pcm_src_fds[0];
+	bench_stream_pcm_snk(s)->fd = pcm_snk_fds[1];
+	s->pcm_read_fd = pcm_snk_fds[0];
+
+	/* fault-in latency buffers, so they will not affect memory usage */
+	memset(&s->enc, 0, sizeof(s->enc));
+	memset(&s->dec, 0, sizeof(s->dec));
+
+	return bench_stream_init_pcm(s, bench_stream_pcm_src(s));
+}
+
+static int bench_stream_start(struct bench_stream *s, const struct bench_codec *c) {
+
+	if (s->t_snk == NULL)
+		return ba_transport_thread_create(&s->t_src->thread_enc, c->enc, "ba-bench-enc", true) |
+			ba_transport_thread_create(&s->t_src->thread_dec, c->dec, "ba-bench-dec", false);
+
+	if (c->dec != NULL &&
+			ba_transport_thread_create(&s->t_snk->thread_dec, c->dec, "ba-bench-dec", true) == -1)
+		return -1;
+	return ba_transport_thread_create(&s->t_src->thread_enc, c->enc, "ba-bench-enc", true);
+}
+
+static void bench_stream_stop(struct bench_stream *s) {
+
+	if (s->t_src == NULL)
+		return;
+
+	struct ba_transport_pcm *pcm_src = bench_stream_pcm_src(s);
+	struct ba_transport_pcm *pcm_snk = bench_stream_pcm_snk(s);
+
+	pthread_mutex_lock(&pcm_src->mutex);
+	ba_transport_pcm_release(pcm_src);
+	pthread_mutex_unlock(&pcm_src->mutex);
+
+	pthread_mutex_lock(&pcm_snk->mutex);
+	ba_transport_pcm_release(pcm_snk);
+	pthread_mutex_unlock(&pcm_snk->mutex);
+
+	transport_thread_cancel(&s->t_src->thread_enc);
+	if (s->t_snk != NULL)
+		transport_thread_cancel(&s->t_snk->thread_dec);
+	else
+		transport_thread_cancel(&s->t_src->thread_dec);
+
+}
+
+static void bench_stream_free(struct bench_stream *s) {
+	if (s->t_src != NULL)
+		ba_transport_destroy(s->t_src);
+	if (s->t_snk != NULL)
+		ba_transport_destroy(s->t_snk);
+	if (s->pcm_write_fd != -1)
+		close(s->pcm_write_fd);
+	if (s->pcm_read_fd != -1)
+		close(s->pcm_read_fd);
+	if (s->bt_fd != -1)
+		close(s->bt_fd);
+	free(s->pcm);
+}
+
+/**
+ * Play the role of BlueALSA clients and Bluetooth devices. */
+static void bench_loop(unsigned int duration) {
+
+	struct pollfd *pfds = calloc(streams_count * 3, sizeof(*pfds));
+	struct timespec ts_end, ts;
+	uint8_t buffer[4096];
+	size_t i;
+
+	for (i = 0; i < streams_count; i++) {
+		pfds[i * 3 + 0] = (struct pollfd){ streams[i].pcm_write_fd, POLLOUT, 0 };
+		pfds[i * 3 + 1] = (struct pollfd){ streams[i].pcm_read_fd, POLLIN, 0 };
+		pfds[i * 3 + 2] = (struct pollfd){ streams[i].bt_fd, POLLIN, 0 };
+	}
+
+	gettimestamp(&ts_end);
+	ts_end.tv_sec += duration;
+
+	for (;;) {
+
+		gettimestamp(&ts);
+		if (difftimespec(&ts, &ts_end, &ts) <= 0)
+			break;
+
+		if (poll(pfds, streams_count * 3, 100) == -1) {
+			if (errno == EINTR)
+				continue;
+			error("Couldn't poll benchmark sockets: %s", strerror(errno));
+			break;
+		}
+
+		for (i = 0; i < streams_count; i++) {
+
+			struct bench_stream *s = &streams[i];
+			ssize_t len;
+
+			if (pfds[i * 3 + 0].revents & POLLOUT &&
+					(len = write(s->pcm_write_fd, s->pcm + s->pcm_offset,
+							s->pcm_len - s->pcm_offset)) > 0)
+				s->pcm_offset = (s->pcm_offset + len) % s->pcm_len;
+
+			if (pfds[i * 3 + 1].revents & POLLIN)
+				while (read(s->pcm_read_fd, buffer, sizeof(buffer)) > 0)
+					continue;
+
+			if (pfds[i * 3 + 2].revents & POLLIN)
+				while ((len = read(s->bt_fd, buffer, sizeof(buffer))) > 0)
+					/* loop back SCO data, drop A2DP data */
+					if (s->t_snk == NULL && write(s->bt_fd, buffer, len) == -1)
+						break;
+
+		}
+
+	}
+
+	free(pfds);
+}
+
+static int bench_codec(const struct bench_codec *c, size_t count, unsigned int duration,
+		struct bench_result *result) {
+
+	uint64_t cpu_enc = 0;
+	uint64_t cpu_dec = 0;
+	uint64_t tx_packets = 0;
+	size_t i;
+	int rv = -1;
+
+	if ((streams = calloc(count, sizeof(*streams))) == NULL)
+		return -1;
+	for (i = 0; i < count; i++)
+		streams[i].pcm_write_fd = streams[i].pcm_read_fd = streams[i].bt_fd = -1;
+
+	for (i = 0; i < count; i++)
+		if (streams_count++, bench_stream_init(&streams[i], c, i) == -1) {
+			error("Couldn't create %s stream: %s", c->name, strerror(errno));
+			goto final;
+		}
+
+	const long rss = bench_get_rss();
+
+	for (i = 0; i < count; i++)
+		if (bench_stream_start(&streams[i], c) == -1) {
+			error("Couldn't start %s stream: %s", c->name, strerror(errno));
+			goto final;
+		}
+
+	bench_loop(duration);
+
+	const long rss_delta = bench_get_rss() - rss;
+
+	for (i = 0; i < count; i++) {
+		struct bench_stream *s = &streams[i];
+		cpu_enc += bench_get_thread_cpu(&s->t_src->thread_enc);
+		if (s->t_snk != NULL)
+			cpu_dec += bench_get_thread_cpu(&s->t_snk->thread_dec);
+		else
+			cpu_dec += bench_get_thread_cpu(&s->t_src->thread_dec);
+		tx_packets += s->t_src->thread_enc.stats.tx_packets;
+	}
+
+	/* every stream is paced in real time, so the duration of the processed
+	 * signal is equal to the benchmark duration */
+	result->enc_rtf = (double)cpu_enc / count / duration / 1000000000;
+	result->dec_rtf = (double)cpu_dec / count / duration / 1000000000;
+
+	printf("%s: %zu streams, %u s\n", c->name, count, duration);
+	printf("  CPU per stream: %.2f%%\n", 100.0 * (result->enc_rtf + result->dec_rtf));
+	printf("  Real-time factor: encoding=%.5f decoding=%.5f\n",
+			result->enc_rtf, result->dec_rtf);
+	printf("  BT packets per stream: %.1f/s\n", (double)tx_packets / count / duration);
+	result->enc_p99 = bench_print_latency("Encoding", true);
+	result->dec_p99 = bench_print_latency("Decoding", false);
+	printf("  RSS growth: %ld KiB (%ld KiB per stream)\n", rss_delta, rss_delta / (long)count);
+	result->valid = true;
+
+	rv = 0;
+
+final:
+	for (i = 0; i < streams_count; i++)
+		bench_stream_stop(&streams[i]);
+	for (i = 0; i < streams_count; i++)
+		bench_stream_free(&streams[i]);
+	free(streams);
+	streams = NULL;
+	streams_count = 0;
+	return rv;
+}
+
+/**
+ * Store benchmark results as a baseline.
+ *
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+static int bench_baseline_save(const char *path, const struct bench_result *results) {
+
+	FILE *f;
+	if ((f = fopen(path, "w")) == NULL)
+		return -1;
+
+	for (size_t i = 0; i < ARRAYSIZE(codecs); i++) {
+		if (!results[i].valid)
+			continue;
+		for (size_t j = 0; j < ARRAYSIZE(bench_metrics); j++)
+			fprintf(f, "%s %s %.6f\n", codecs[i].name, bench_metrics[j].name,
+					bench_result_metric(&results[i], j));
+	}
+
+	return fclose(f);
+}
+
+/**
+ * Compare benchmark results with the stored baseline.
+ *
+ * Metrics which are not present in the baseline, or which were not measured
+ * in this run, are skipped. Regressed metrics are reported on stderr.
+ *
+ * @param path Path to the baseline file.
+ * @param results Results of all codecs.
+ * @param margin Allowed regression in percents.
+ * @return On success this function returns the number of regressed metrics.
+ *   Otherwise, -1 is returned and errno is set to indicate the error. */
+static int bench_baseline_check(const char *path, const struct bench_result *results,
+		unsigned int margin) {
+
+	char codec[32], metric[32];
+	double baseline;
+	int regressions = 0;
+	int rv;
+	FILE *f;
+
+	if ((f = fopen(path, "r")) == NULL)
+		return -1;
+
+	while ((rv = fscanf(f, "%31s %31s %lf", codec, metric, &baseline)) == 3) {
+
+		size_t i, j;
+		for (i = 0; i < ARRAYSIZE(codecs); i++)
+			if (strcmp(codecs[i].name, codec) == 0)
+				break;
+		for (j = 0; j < ARRAYSIZE(bench_metrics); j++)
+			if (strcmp(bench_metrics[j].name, metric) == 0)
+				break;
+
+		if (i == ARRAYSIZE(codecs) || j == ARRAYSIZE(bench_metrics) ||
+				!results[i].valid)
+			continue;
+
+		const double value = bench_result_metric(&results[i], j);
+		if (value > baseline * (100 + margin) / 100 + bench_metrics[j].tolerance) {
+			error("%s %s regression: %.6f > %.6f (+%u%%)",
+					codec, metric, value, baseline, margin);
+			regressions++;
+		}
+
+	}
+
+	if (rv != EOF) {
+		fclose(f);
+		return errno = EINVAL, -1;
+	}
+
+	fclose(f);
+	return regressions;
+}
+
+int main(int argc, char *argv[]) {
+
+	int opt;
+	const char *opts = "hn:d:b:s:m:";
+	struct option longopts[] = {
+		{ "help", no_argument, NULL, 'h' },
+		{ "streams", required_argument, NULL, 'n' },
+		{ "duration", required_argument, NULL, 'd' },
+		{ "baseline", required_argument, NULL, 'b' },
+		{ "save-baseline", required_argument, NULL, 's' },
+		{ "margin", required_argument, NULL, 'm' },
+		{ 0, 0, 0, 0 },
+	};
+
+	size_t count = 4;
+	unsigned int duration = 10;
+	const char *baseline = NULL;
+	const char *baseline_save = NULL;
+	unsigned int margin = 20;
+
+	while ((opt = getopt_long(argc, argv, opts, longopts, NULL)) != -1)
+		switch (opt) {
+		case 'h' /* --help */ :
+			printf("Usage:\n"
+					"  %s [OPTION]... [CODEC]...\n"
+					"\nOptions:\n"
+					"  -h, --help\t\tprint this help and exit\n"
+					"  -n, --streams=NUM\tnumber of concurrent streams per codec\n"
+					"  -d, --duration=SEC\tbenchmark duration per codec\n"
+					"  -b, --baseline=FILE\tfail on regression against baseline\n"
+					"  -s, --save-baseline=FILE\tstore results as a baseline\n"
+					"  -m, --margin=PCT\tallowed regression (default: 20%%)\n",
+					argv[0]);
+			printf("\nAvailable codecs:");
+			for (size_t i = 0; i < ARRAYSIZE(codecs); i++)
+				printf(" %s", codecs[i].name);
+			printf("\n");
+			return EXIT_SUCCESS;
+		case 'n' /* --streams=NUM */ :
+			if ((count = atoi(optarg)) == 0 || count > 255) {
+				error("Invalid number of streams {1..255}: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'd' /* --duration=SEC */ :
+			if ((duration = atoi(optarg)) == 0) {
+				error("Invalid benchmark duration: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'b' /* --baseline=FILE */ :
+			baseline = optarg;
+			break;
+		case 's' /* --save-baseline=FILE */ :
+			baseline_save = optarg;
+			break;
+		case 'm' /* --margin=PCT */ : {
+			char *tmp;
+			margin = strtoul(optarg, &tmp, 10);
+			if (*optarg == '\0' || *tmp != '\0' || margin > 1000) {
+				error("Invalid regression margin {0..1000}: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		}
+		default:
+			fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+
+	bool enabled[ARRAYSIZE(codecs)];
+	size_t i, j;
+
+	for (i = 0; i < ARRAYSIZE(codecs); i++)
+		enabled[i] = optind == argc;
+	for (j = optind; j < (size_t)argc; j++) {
+		for (i = 0; i < ARRAYSIZE(codecs); i++)
+			if (strcasecmp(argv[j], codecs[i].name) == 0)
+				break;
+		if (i == ARRAYSIZE(codecs)) {
+			error("Unsupported codec: %s", argv[j]);
+			return EXIT_FAILURE;
+		}
+		enabled[i] = true;
+	}
+
+	log_open(argv[0], false, false);
+	if (bluealsa_config_init() != 0) {
+		error("Couldn't initialize bluealsa config");
+		return EXIT_FAILURE;
+	}
+
+#if ENABLE_AAC
+	config.aac_afterburner = true;
+#endif
+#if ENABLE_LDAC
+	config.ldac_abr = true;
+	config.ldac_eqmid = LDACBT_EQMID_HQ;
+#endif
+
+	/* receive EPIPE error code */
+	struct sigaction sigact = { .sa_handler = SIG_IGN };
+	sigaction(SIGPIPE, &sigact, NULL);
+
+	adapter = ba_adapter_new(0);
+
+	struct bench_result results[ARRAYSIZE(codecs)] = { 0 };
+	int rv = EXIT_SUCCESS;
+	int ret;
+
+	for (i = 0; i < ARRAYSIZE(codecs); i++)
+		if (enabled[i] && bench_codec(&codecs[i], count, duration, &results[i]) == -1)
+			rv = EXIT_FAILURE;
+
+	ba_adapter_destroy(adapter);
+
+	if (baseline_save != NULL &&
+			bench_baseline_save(baseline_save, results) == -1) {
+		error("Couldn't save baseline: %s: %s", baseline_save, strerror(errno));
+		rv = EXIT_FAILURE;
+	}
+
+	if (baseline != NULL) {
+		if ((ret = bench_baseline_check(baseline, results, margin)) == -1) {
+			error("Couldn't check baseline: %s: %s", baseline, strerror(errno));
+			rv = EXIT_FAILURE;
+		}
+		else if (ret > 0) {
+			error("Performance regressions: %d", ret);
+			rv = EXIT_FAILURE;
+		}
+	}
+
+	return rv;
+}
@@ -27,8 +27,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <bsd/sys/time.h>
 #include <gio/gio.h>
 #include <glib-unix.h>
 #include <glib.h>
@@ -42,6 +44,7 @@
 #include "bluealsa-iface.h"
 #include "bluealsa.h"
 #include "bluez.h"
+#include "bt-capture.h"
 #include "codec-sbc.h"
 #include "hfp.h"
 #include "io.h"
@@ -94,6 +97,7 @@ static bool a2dp_sink = false;
 static bool sco_hfp = false;
 static bool sco_hsp = false;
 static bool dump_output = false;
+static const char *replay = NULL;
 static bool fuzzing = false;
 
 static gboolean main_loop_exit_handler(void *userdata) {
@@ -146,7 +150,7 @@ static void *mock_a2dp_dec(struct ba_transport_thread *th) {
 
 	const unsigned int channels = t_a2dp_pcm->channels;
 	const unsigned int samplerate = t_a2dp_pcm->sampling;
-	struct pollfd fds[1] = {{ th->pipe[0], POLLIN, 0 }};
+	struct pollfd fds[1] = {{ th->event_fd, POLLIN, 0 }};
 	struct asrsync asrs = { .frames = 0 };
 	int16_t buffer[1024 * 2];
 	int x = 0;
@@ -164,7 +168,7 @@ static void *mock_a2dp_dec(struct ba_transport_thread *th) {
 				fds[0].revents & POLLIN) {
 			/* dispatch incoming event */
 			enum ba_transport_thread_signal signal;
-			ba_transport_thread_signal_recv(th, &signal);
+			ba_transport_thread_signal_recv(th, &signal, NULL);
 			switch (signal) {
 			case BA_TRANSPORT_THREAD_SIGNAL_PCM_OPEN:
 			case BA_TRANSPORT_THREAD_SIGNAL_PCM_RESUME:
@@ -224,9 +228,91 @@ static void *mock_bt_dump_thread(void *userdata) {
 	return NULL;
 }
 
+struct mock_bt_replay {
+	struct ba_transport_type type;
+	int bt_fd;
+};
+
+/**
+ * Replay received packets from the BT capture file.
+ *
+ * Only packets captured on the transport with the same profile and codec
+ * are replayed. The original inter-arrival times are preserved, so the
+ * jitter and the packet loss observed in the field can be reproduced. */
+static void *mock_bt_replay_thread(void *userdata) {
+
+	struct mock_bt_replay *r = userdata;
+	struct bt_capture capture = { NULL };
+	struct bt_capture_packet packet;
+	struct timespec ts_packet0;
+	struct timespec ts0;
+	uint8_t buffer[4096];
+	size_t count = 0;
+	ssize_t len;
+
+	if (bt_capture_open_read(&capture, replay) == -1) {
+		error("Couldn't open BT capture: %s: %s", replay, strerror(errno));
+		goto final;
+	}
+
+	while ((len = bt_capture_read(&capture, &packet, buffer, sizeof(buffer))) != 0) {
+
+		if (len == -1) {
+			if (errno == EMSGSIZE)
+				continue;
+			error("Couldn't read BT capture: %s", strerror(errno));
+			break;
+		}
+
+		if (packet.direction != BT_CAPTURE_DIRECTION_RX ||
+				packet.profile != r->type.profile ||
+				packet.codec != r->type.codec)
+			continue;
+
+		if (count++ == 0) {
+			clock_gettime(CLOCK_MONOTONIC, &ts0);
+			ts_packet0 = packet.ts;
+		}
+
+		struct timespec ts;
+		timespecsub(&packet.ts, &ts_packet0, &ts);
+		timespecadd(&ts0, &ts, &ts);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+		if (write(r->bt_fd, buffer, len) == -1) {
+			if (errno != EPIPE)
+				error("BT write error: %s", strerror(errno));
+			break;
+		}
+
+	}
+
+	debug("BT capture replay finished: %zu packets", count);
+
+final:
+	bt_capture_close(&capture);
+	close(r->bt_fd);
+	free(r);
+	return NULL;
+}
+
+static void mock_bt_replay_start(struct ba_transport *t, int bt_fd) {
+	struct mock_bt_replay *r = malloc(sizeof(*r));
+	r->type = t->type;
+	r->bt_fd = bt_fd;
+	g_thread_unref(g_thread_new(NULL, mock_bt_replay_thread, r));
+}
+
 static void mock_transport_start(struct ba_transport *t, int bt_fd) {
 
-	if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE) {
+	if (replay != NULL && (t->type.profile & BA_TRANSPORT_PROFILE_MASK_SCO ||
+				(t->type.profile == BA_TRANSPORT_PROFILE_A2DP_SINK &&
+				 t->type.codec == A2DP_CODEC_SBC))) {
+		/* use real decoder for the replayed traffic */
+		mock_bt_replay_start(t, bt_fd);
+		assert(ba_transport_start(t) == 0);
+	}
+	else if (t->type.profile & BA_TRANSPORT_PROFILE_A2DP_SOURCE) {
 		g_thread_unref(g_thread_new(NULL, mock_bt_dump_thread, GINT_TO_POINTER(bt_fd)));
 		assert(ba_transport_start(t) == 0);
 	}
@@ -259,7 +345,8 @@ static int mock_transport_acquire(struct ba_transport *t) {
 	assert(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, bt_fds) == 0);
 
 	t->bt_fd = bt_fds[0];
-	t->mtu_read = 256;
+	/* captured packets might be larger than packets generated by the mock */
+	t->mtu_read = replay != NULL ? 1024 : 256;
 	t->mtu_write = 256;
 
 	debug("New transport: %d (MTU: R:%zu W:%zu)", t->bt_fd, t->mtu_read, t->mtu_write);
@@ -452,6 +539,7 @@ int main(int argc, char *argv[]) {
 		{ "sco-hsp", no_argument, NULL, 5 },
 		{ "dump-output", no_argument, NULL, 6 },
 		{ "fuzzing", no_argument, NULL, 7 },
+		{ "replay", required_argument, NULL, 8 },
 		{ 0, 0, 0, 0 },
 	};
 
@@ -470,7 +558,8 @@ int main(int argc, char *argv[]) {
 					"  --sco-hfp\t\tregister HFP endpoints\n"
 					"  --sco-hsp\t\tregister HSP endpoints\n"
 					"  --dump-output\t\tdump Bluetooth transport data\n"
-					"  --fuzzing\t\tmock human actions with timings\n",
+					"  --fuzzing\t\tmock human actions with timings\n"
+					"  --replay=FILE\t\treplay BT traffic capture\n",
 					argv[0]);
 			return EXIT_SUCCESS;
 		case 'B' /* --dbus=NAME */ :
@@ -500,6 +589,9 @@ int main(int argc, char *argv[]) {
 		case 7 /* --fuzzing */ :
 			fuzzing = true;
 			break;
+		case 8 /* --replay=FILE */ :
+			replay = optarg;
+			break;
 		default:
 			fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
 			return EXIT_FAILURE;
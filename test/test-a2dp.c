@@ -12,6 +12,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <check.h>
 #include <glib.h>
@@ -19,6 +20,7 @@
 #include "a2dp-codecs.h"
 #include "a2dp.h"
 #include "bluealsa.h"
+#include "codec-plugin.h"
 #include "codec-sbc.h"
 #include "shared/log.h"
 
@@ -34,6 +36,28 @@ START_TEST(test_a2dp_codec_lookup) {
 	ck_assert_ptr_eq(a2dp_codec_lookup(0xFFFF, A2DP_SOURCE), NULL);
 } END_TEST
 
+START_TEST(test_a2dp_codec_masks) {
+
+	const struct a2dp_codec **cc;
+	size_t slot, i;
+
+	for (cc = a2dp_codecs; *cc != NULL; cc++)
+		for (slot = 0; slot < 2; slot++) {
+
+			uint16_t channels_mask = 0;
+			for (i = 0; i < (*cc)->channels_size[slot]; i++)
+				channels_mask |= (*cc)->channels[slot][i].value;
+			ck_assert_int_eq((*cc)->channels_mask[slot], channels_mask);
+
+			uint16_t samplings_mask = 0;
+			for (i = 0; i < (*cc)->samplings_size[slot]; i++)
+				samplings_mask |= (*cc)->samplings[slot][i].value;
+			ck_assert_int_eq((*cc)->samplings_mask[slot], samplings_mask);
+
+		}
+
+} END_TEST
+
 START_TEST(test_a2dp_get_vendor_codec_id) {
 
 	uint8_t cfg0[4] = { 0xDE, 0xAD, 0xB0, 0xBE };
@@ -142,6 +166,63 @@ START_TEST(test_a2dp_select_configuration) {
 	ck_assert_int_eq(cfg.min_bitpool, 42);
 	ck_assert_int_eq(cfg.max_bitpool, 250);
 
+#if ENABLE_AAC
+
+	a2dp_aac_t cfg_aac;
+	const a2dp_aac_t cfg_aac_ = {
+		.object_type = AAC_OBJECT_TYPE_MPEG4_AAC_LC | AAC_OBJECT_TYPE_MPEG4_AAC_ELD2,
+		AAC_INIT_FREQUENCY(AAC_SAMPLING_FREQ_44100 | AAC_SAMPLING_FREQ_48000)
+		.channels = AAC_CHANNELS_1 | AAC_CHANNELS_2,
+		AAC_INIT_BITRATE(256000)
+	};
+
+	cfg_aac = cfg_aac_;
+	config.aac_low_delay = false;
+	ck_assert_int_eq(a2dp_select_configuration(&a2dp_codec_source_aac, &cfg_aac, sizeof(cfg_aac)), 0);
+	ck_assert_int_eq(cfg_aac.object_type, AAC_OBJECT_TYPE_MPEG4_AAC_LC);
+
+	cfg_aac = cfg_aac_;
+	config.aac_low_delay = true;
+	ck_assert_int_eq(a2dp_select_configuration(&a2dp_codec_source_aac, &cfg_aac, sizeof(cfg_aac)), 0);
+	ck_assert_int_eq(cfg_aac.object_type, AAC_OBJECT_TYPE_MPEG4_AAC_ELD2);
+	ck_assert_int_eq(cfg_aac.channels, AAC_CHANNELS_2);
+
+#endif
+
+} END_TEST
+
+START_TEST(test_a2dp_codec_plugin) {
+
+	ck_assert_int_eq(codec_plugin_load("/nonexistent/aplugin.so"), -1);
+	ck_assert_int_eq(codec_plugin_load(".libs/aplugin.so"), 0);
+	ck_assert_int_eq(codec_plugin_load(".libs/aplugin.so"), -1);
+	ck_assert_int_eq(errno, EEXIST);
+
+	const struct codec_plugin *p;
+	ck_assert_ptr_ne(p = codec_plugin_get(0), NULL);
+	ck_assert_ptr_eq(codec_plugin_get(1), NULL);
+	ck_assert_int_eq(p->codec_id, CODEC_PLUGIN_CODEC_ID(0));
+	ck_assert_ptr_eq(codec_plugin_lookup_name("PCM"), p);
+
+	a2dp_codecs_init();
+	ck_assert_ptr_eq(a2dp_codec_lookup(p->codec_id, A2DP_SOURCE), &p->codecs[A2DP_SOURCE]);
+	ck_assert_ptr_eq(a2dp_codec_lookup(p->codec_id, A2DP_SINK), &p->codecs[A2DP_SINK]);
+
+	uint8_t caps[7];
+	memcpy(caps, p->abi->capabilities, sizeof(caps));
+	ck_assert_int_eq(a2dp_get_vendor_codec_id(caps, sizeof(caps)), p->codec_id);
+
+	/* stereo at 48 kHz shall be preferred */
+	const struct a2dp_codec *codec = &p->codecs[A2DP_SOURCE];
+	ck_assert_int_eq(a2dp_filter_capabilities(codec, caps, sizeof(caps)), 0);
+	ck_assert_int_eq(a2dp_select_configuration(codec, caps, sizeof(caps)), 0);
+	ck_assert_int_eq(caps[6], (1 << 1) | (1 << 5));
+	ck_assert_int_eq(a2dp_check_configuration(codec, caps, sizeof(caps)), A2DP_CHECK_OK);
+
+	caps[6] = 0;
+	ck_assert_int_eq(a2dp_select_configuration(codec, caps, sizeof(caps)), -1);
+	ck_assert_int_eq(a2dp_check_configuration(codec, caps, sizeof(caps)), A2DP_CHECK_ERR_PLUGIN);
+
 } END_TEST
 
 int main(void) {
@@ -154,10 +235,12 @@ int main(void) {
 
 	tcase_add_test(tc, test_a2dp_dir);
 	tcase_add_test(tc, test_a2dp_codec_lookup);
+	tcase_add_test(tc, test_a2dp_codec_masks);
 	tcase_add_test(tc, test_a2dp_get_vendor_codec_id);
 	tcase_add_test(tc, test_a2dp_check_configuration);
 	tcase_add_test(tc, test_a2dp_filter_capabilities);
 	tcase_add_test(tc, test_a2dp_select_configuration);
+	tcase_add_test(tc, test_a2dp_codec_plugin);
 
 	srunner_run_all(sr, CK_ENV);
 	int nf = srunner_ntests_failed(sr);
@@ -0,0 +1,192 @@
+/*
+ * test-aec.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include "aec.h"
+#include "shared/defs.h"
+
+/**
+ * Simple linear congruential generator of white noise. */
+static void test_noise_s16(int16_t *buffer, size_t samples, int amplitude, uint32_t *seed) {
+	for (size_t i = 0; i < samples; i++) {
+		*seed = *seed * 1103515245 + 12345;
+		buffer[i] = (int32_t)((*seed >> 16) % (2 * amplitude + 1)) - amplitude;
+	}
+}
+
+static double test_energy_s16(const int16_t *buffer, size_t samples) {
+	double energy = 0;
+	for (size_t i = 0; i < samples; i++)
+		energy += (double)buffer[i] * buffer[i];
+	return energy;
+}
+
+START_TEST(test_aec_init) {
+
+	struct aec a = { 0 };
+
+	ck_assert_int_eq(aec_init(&a, 0, false), -1);
+	ck_assert_int_eq(aec_is_initialized(&a), false);
+
+	ck_assert_int_eq(aec_init(&a, 16000, true), 0);
+	ck_assert_int_eq(aec_is_initialized(&a), true);
+	ck_assert_uint_eq(a.taps, 16000 * AEC_TAIL_MS / 1000);
+	aec_free(&a);
+
+	/* the filter length shall not grow with the sampling frequency */
+	ck_assert_int_eq(aec_init(&a, 32000, true), 0);
+	ck_assert_uint_eq(a.taps, AEC_TAPS_MAX);
+	aec_free(&a);
+
+	ck_assert_int_eq(aec_is_initialized(&a), false);
+
+} END_TEST
+
+START_TEST(test_aec_ref_queue) {
+
+	struct aec a = { 0 };
+	int16_t buffer[8000] = { 0 };
+
+	ck_assert_int_eq(aec_init(&a, 8000, false), 0);
+
+	aec_push_ref(&a, buffer, 120);
+	ck_assert_uint_eq(a.ref_len, 120);
+	aec_process(&a, buffer, 100);
+	ck_assert_uint_eq(a.ref_len, 20);
+
+	/* overflow discards the oldest samples */
+	aec_push_ref(&a, buffer, ARRAYSIZE(buffer));
+	ck_assert_uint_eq(a.ref_len, a.ref_capacity);
+
+	aec_free(&a);
+
+} END_TEST
+
+START_TEST(test_aec_echo) {
+
+	const unsigned int rate = 8000;
+	const size_t delay = 200;
+	struct aec a = { 0 };
+	uint32_t seed = 1;
+
+	ck_assert_int_eq(aec_init(&a, rate, false), 0);
+
+	int16_t ref[80];
+	int16_t mic[80];
+	/* echo path: delayed and attenuated far-end signal */
+	int16_t line[80 + 200] = { 0 };
+
+	double energy_in = 0;
+	double energy_out = 0;
+
+	/* process 3 seconds of audio in 10 ms chunks */
+	for (size_t i = 0; i < 300; i++) {
+
+		test_noise_s16(ref, ARRAYSIZE(ref), 8000, &seed);
+		memmove(line, &line[ARRAYSIZE(ref)], sizeof(*line) * delay);
+		memcpy(&line[delay], ref, sizeof(ref));
+		for (size_t j = 0; j < ARRAYSIZE(mic); j++)
+			mic[j] = line[j] / 4;
+
+		aec_push_ref(&a, ref, ARRAYSIZE(ref));
+
+		/* measure the last second only */
+		if (i >= 200)
+			energy_in += test_energy_s16(mic, ARRAYSIZE(mic));
+		aec_process(&a, mic, ARRAYSIZE(mic));
+		if (i >= 200)
+			energy_out += test_energy_s16(mic, ARRAYSIZE(mic));
+
+	}
+
+	/* echo shall be attenuated by at least 20 dB */
+	ck_assert_double_lt(10 * log10(energy_out / energy_in), -20);
+
+	aec_free(&a);
+
+} END_TEST
+
+START_TEST(test_aec_double_talk) {
+
+	struct aec a = { 0 };
+	int16_t ref[160] = { 0 };
+	int16_t mic[160];
+	uint32_t seed = 1;
+
+	ck_assert_int_eq(aec_init(&a, 16000, false), 0);
+
+	/* near-end speech without far-end signal shall pass through intact */
+	test_noise_s16(mic, ARRAYSIZE(mic), 8000, &seed);
+	int16_t tmp[ARRAYSIZE(mic)];
+	memcpy(tmp, mic, sizeof(mic));
+	aec_push_ref(&a, ref, ARRAYSIZE(ref));
+	aec_process(&a, mic, ARRAYSIZE(mic));
+	ck_assert_int_eq(memcmp(tmp, mic, sizeof(mic)), 0);
+
+	aec_free(&a);
+
+} END_TEST
+
+START_TEST(test_aec_ns) {
+
+	const unsigned int rate = 16000;
+	struct aec a = { 0 };
+	int16_t mic[160];
+	uint32_t seed = 1;
+
+	ck_assert_int_eq(aec_init(&a, rate, true), 0);
+
+	double energy_in = 0;
+	double energy_out = 0;
+
+	/* process 5 seconds of stationary noise in 10 ms chunks */
+	for (size_t i = 0; i < 500; i++) {
+		test_noise_s16(mic, ARRAYSIZE(mic), 500, &seed);
+		if (i >= 400)
+			energy_in += test_energy_s16(mic, ARRAYSIZE(mic));
+		aec_process(&a, mic, ARRAYSIZE(mic));
+		if (i >= 400)
+			energy_out += test_energy_s16(mic, ARRAYSIZE(mic));
+	}
+
+	/* stationary noise shall be attenuated by at least 10 dB */
+	ck_assert_double_lt(10 * log10(energy_out / energy_in), -10);
+
+	aec_free(&a);
+
+} END_TEST
+
+int main(void) {
+
+	Suite *s = suite_create(__FILE__);
+	TCase *tc = tcase_create(__FILE__);
+	SRunner *sr = srunner_create(s);
+
+	suite_add_tcase(s, tc);
+
+	tcase_add_test(tc, test_aec_init);
+	tcase_add_test(tc, test_aec_ref_queue);
+	tcase_add_test(tc, test_aec_echo);
+	tcase_add_test(tc, test_aec_double_talk);
+	tcase_add_test(tc, test_aec_ns);
+
+	srunner_run_all(sr, CK_ENV);
+	int nf = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return nf == 0 ? 0 : 1;
+}
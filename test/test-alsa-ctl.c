@@ -56,7 +56,7 @@ fail:
 
 static int test_ctl_open(pid_t *pid, snd_ctl_t **ctl, int mode) {
 	const char *service = "test";
-	if ((*pid = spawn_bluealsa_server(service, 1, true, false, true, true)) == -1)
+	if ((*pid = spawn_bluealsa_server(service, 1, true, false, true, true, false)) == -1)
 		return -1;
 	return snd_ctl_open_bluealsa(ctl, service, mode);
 }
@@ -121,6 +121,62 @@ START_TEST(test_db_range) {
 
 } END_TEST
 
+START_TEST(test_elem_update) {
+
+	snd_ctl_t *ctl = NULL;
+	pid_t pid = -1;
+
+	/* in the fuzzing mode PCMs are added and removed one by one */
+	const char *service = "test";
+	ck_assert_int_ne(pid = spawn_bluealsa_server(service, 4, false, true, true, false, false), -1);
+	ck_assert_int_eq(snd_ctl_open_bluealsa(&ctl, service, SND_CTL_NONBLOCK), 0);
+	ck_assert_int_eq(snd_ctl_subscribe_events(ctl, 1), 0);
+
+	snd_ctl_elem_list_t *elems;
+	snd_ctl_elem_list_alloca(&elems);
+	snd_ctl_event_t *event;
+	snd_ctl_event_alloca(&event);
+
+	size_t added = 0, removed = 0;
+	bool all_added = false;
+
+	while (removed < 4 && snd_ctl_wait(ctl, 2500) > 0) {
+
+		while (snd_ctl_read(ctl, event) == 1) {
+			ck_assert_int_eq(snd_ctl_event_get_type(event), SND_CTL_EVENT_ELEM);
+			const unsigned int mask = snd_ctl_event_elem_get_mask(event);
+			if (mask == SND_CTL_EVENT_MASK_REMOVE)
+				removed++;
+			else if (mask & SND_CTL_EVENT_MASK_ADD)
+				added++;
+		}
+
+		/* element list shall be consistent with reported events */
+		ck_assert_int_eq(snd_ctl_elem_list(ctl, elems), 0);
+		ck_assert_uint_eq(snd_ctl_elem_list_get_count(elems), added - removed);
+
+		if (added - removed == 4) {
+			all_added = true;
+			ck_assert_int_eq(snd_ctl_elem_list_alloc_space(elems, 4), 0);
+			ck_assert_int_eq(snd_ctl_elem_list(ctl, elems), 0);
+			/* new elements are inserted in the sorted order */
+			ck_assert_str_eq(snd_ctl_elem_list_get_name(elems, 0), "12:34:56:78:9A:BC - A2DP Playback Switch");
+			ck_assert_str_eq(snd_ctl_elem_list_get_name(elems, 1), "12:34:56:78:9A:BC - A2DP Playback Volume");
+			ck_assert_str_eq(snd_ctl_elem_list_get_name(elems, 2), "23:45:67:89:AB:CD - A2DP Playback Switch");
+			ck_assert_str_eq(snd_ctl_elem_list_get_name(elems, 3), "23:45:67:89:AB:CD - A2DP Playback Volume");
+			snd_ctl_elem_list_free_space(elems);
+		}
+
+	}
+
+	ck_assert_int_eq(all_added, true);
+	ck_assert_int_eq(added, 4);
+	ck_assert_int_eq(removed, 4);
+
+	ck_assert_int_eq(test_pcm_close(pid, ctl), 0);
+
+} END_TEST
+
 int main(int argc, char *argv[]) {
 
 	preload(argc, argv, ".libs/aloader.so");
@@ -133,9 +189,11 @@ int main(int argc, char *argv[]) {
 	SRunner *sr = srunner_create(s);
 
 	suite_add_tcase(s, tc);
+	tcase_set_timeout(tc, 10);
 
 	tcase_add_test(tc, test_control);
 	tcase_add_test(tc, test_db_range);
+	tcase_add_test(tc, test_elem_update);
 
 	srunner_run_all(sr, CK_ENV);
 	int nf = srunner_ntests_failed(sr);
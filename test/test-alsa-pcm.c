@@ -161,7 +161,7 @@ static int test_pcm_open(pid_t *pid, snd_pcm_t **pcm, snd_pcm_stream_t stream) {
 	const char *service = "test";
 	if ((*pid = spawn_bluealsa_server(service, 1, true, false,
 					stream == SND_PCM_STREAM_PLAYBACK,
-					stream == SND_PCM_STREAM_CAPTURE)) == -1)
+					stream == SND_PCM_STREAM_CAPTURE, false)) == -1)
 		return -1;
 	return snd_pcm_open_bluealsa(pcm, service, stream, 0);
 }
@@ -0,0 +1,268 @@
+/*
+ * test-aptx.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include <check.h>
+
+#include "../src/codec-aptx.c"
+#include "shared/defs.h"
+
+#include "inc/sine.inc"
+#include "inc/timer.inc"
+
+#if ENABLE_APTX
+/**
+ * Fill buffer with samples which cover the whole 16-bit range. */
+static void test_fill_s16(int16_t *buffer, size_t size) {
+	size_t i;
+	for (i = 0; i < size; i++)
+		buffer[i] = i * 7919 - 32768;
+	buffer[0] = INT16_MIN;
+	buffer[1] = INT16_MAX;
+	buffer[2] = -1;
+}
+#endif
+
+#if ENABLE_APTX_HD
+/**
+ * Fill buffer with samples which cover the whole 32-bit range with the
+ * 24-bit resolution used by the apt-X HD. */
+static void test_fill_s32(int32_t *buffer, size_t size) {
+	size_t i;
+	for (i = 0; i < size; i++)
+		buffer[i] = (int32_t)(i * 2654435761u) >> 8;
+	buffer[0] = -0x800000;
+	buffer[1] = 0x7FFFFF;
+	buffer[2] = -1;
+}
+#endif
+
+#if !WITH_LIBOPENAPTX
+START_TEST(test_aptx_kernel_interleave) {
+
+	int32_t l[4], r[4];
+	size_t i, j;
+
+#if ENABLE_APTX
+	int16_t pcm[64 * 8];
+	test_fill_s16(pcm, ARRAYSIZE(pcm));
+	for (j = 0; j < ARRAYSIZE(pcm); j += 8) {
+		aptx_deinterleave_s16(&pcm[j], l, r);
+		for (i = 0; i < 4; i++) {
+			ck_assert_int_eq(l[i], pcm[j + i * 2 + 0]);
+			ck_assert_int_eq(r[i], pcm[j + i * 2 + 1]);
+		}
+# if HAVE_APTX_DECODE
+		int16_t out[8];
+		aptx_interleave_s16(l, r, out);
+		ck_assert_mem_eq(out, &pcm[j], sizeof(out));
+# endif
+	}
+#endif
+
+#if ENABLE_APTX_HD
+	int32_t pcm_hd[64 * 8];
+	test_fill_s32(pcm_hd, ARRAYSIZE(pcm_hd));
+	for (j = 0; j < ARRAYSIZE(pcm_hd); j += 8) {
+		aptx_deinterleave_s32(&pcm_hd[j], l, r);
+		for (i = 0; i < 4; i++) {
+			ck_assert_int_eq(l[i], pcm_hd[j + i * 2 + 0]);
+			ck_assert_int_eq(r[i], pcm_hd[j + i * 2 + 1]);
+		}
+# if HAVE_APTX_HD_DECODE
+		int32_t out[8];
+		aptx_interleave_s32(l, r, out);
+		ck_assert_mem_eq(out, &pcm_hd[j], sizeof(out));
+# endif
+	}
+#endif
+
+} END_TEST
+#endif
+
+#if WITH_LIBOPENAPTX
+START_TEST(test_aptx_kernel_pack_s24le) {
+
+	uint8_t s24[3 * 8];
+	size_t i, j;
+
+#if ENABLE_APTX
+	int16_t pcm[64 * 8];
+	test_fill_s16(pcm, ARRAYSIZE(pcm));
+	for (j = 0; j < ARRAYSIZE(pcm); j += 8) {
+		aptx_pack_s16_s24le(&pcm[j], s24);
+		/* scalar reference: 16-bit sample in the upper 2 bytes */
+		for (i = 0; i < 8; i++) {
+			const uint32_t v = (uint32_t)(int32_t)pcm[j + i] << 8;
+			ck_assert_uint_eq(s24[i * 3 + 0], v & 0xFF);
+			ck_assert_uint_eq(s24[i * 3 + 1], (v >> 8) & 0xFF);
+			ck_assert_uint_eq(s24[i * 3 + 2], (v >> 16) & 0xFF);
+		}
+# if HAVE_APTX_DECODE
+		int16_t out[8];
+		aptx_unpack_s24le_s16(s24, out);
+		ck_assert_mem_eq(out, &pcm[j], sizeof(out));
+# endif
+	}
+#endif
+
+#if ENABLE_APTX_HD
+	int32_t pcm_hd[64 * 8];
+	test_fill_s32(pcm_hd, ARRAYSIZE(pcm_hd));
+	for (j = 0; j < ARRAYSIZE(pcm_hd); j += 8) {
+		aptx_pack_s32_s24le(&pcm_hd[j], s24);
+		for (i = 0; i < 8; i++) {
+			const uint32_t v = pcm_hd[j + i];
+			ck_assert_uint_eq(s24[i * 3 + 0], v & 0xFF);
+			ck_assert_uint_eq(s24[i * 3 + 1], (v >> 8) & 0xFF);
+			ck_assert_uint_eq(s24[i * 3 + 2], (v >> 16) & 0xFF);
+		}
+# if HAVE_APTX_HD_DECODE
+		/* unpacking shall sign-extend 24-bit samples */
+		int32_t out[8];
+		aptx_unpack_s24le_s32(s24, out);
+		ck_assert_mem_eq(out, &pcm_hd[j], sizeof(out));
+# endif
+	}
+#endif
+
+} END_TEST
+#endif
+
+#if ENABLE_APTX
+START_TEST(test_aptx_encode_decode) {
+
+	int16_t pcm[4 * 2 * 64];
+	uint8_t code[4 * 64];
+	size_t i, len;
+
+	snd_pcm_sine_s16le(pcm, ARRAYSIZE(pcm), 2, 0, 1.0 / 128);
+
+	HANDLE_APTX enc;
+	ck_assert_ptr_ne(enc = aptxenc_init(), NULL);
+
+	for (i = 0; i < ARRAYSIZE(pcm) / 8; i++) {
+		len = 4;
+		ck_assert_int_eq(aptxenc_encode(enc, &pcm[i * 8], 8, &code[i * 4], &len), 8);
+		ck_assert_uint_eq(len, 4);
+	}
+
+	aptxenc_destroy(enc);
+
+#if HAVE_APTX_DECODE
+
+	int16_t pcm_out[4 * 2 * 2];
+	size_t samples;
+
+	HANDLE_APTX dec;
+	ck_assert_ptr_ne(dec = aptxdec_init(), NULL);
+
+	for (i = 0; i < sizeof(code) / 4; i++) {
+		samples = ARRAYSIZE(pcm_out);
+		ck_assert_int_eq(aptxdec_decode(dec, &code[i * 4], 4, pcm_out, &samples), 4);
+		ck_assert_uint_eq(samples % 2, 0);
+	}
+
+	aptxdec_destroy(dec);
+
+#endif
+
+} END_TEST
+#endif
+
+#if ENABLE_APTX_HD
+START_TEST(test_aptx_hd_encode_decode_benchmark) {
+
+	int16_t pcm_s16[4 * 2 * 256];
+	int32_t pcm[4 * 2 * 256];
+	uint8_t code[6 * 256];
+	struct timespec ts0;
+	size_t i, j, len;
+
+	const size_t iterations = 400;
+	snd_pcm_sine_s16le(pcm_s16, ARRAYSIZE(pcm_s16), 2, 0, 1.0 / 128);
+	for (i = 0; i < ARRAYSIZE(pcm); i++)
+		pcm[i] = pcm_s16[i] * 256;
+
+	HANDLE_APTX enc;
+	ck_assert_ptr_ne(enc = aptxhdenc_init(), NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	for (j = 0; j < iterations; j++)
+		for (i = 0; i < ARRAYSIZE(pcm) / 8; i++) {
+			len = 6;
+			ck_assert_int_eq(aptxhdenc_encode(enc, &pcm[i * 8], 8, &code[i * 6], &len), 8);
+			ck_assert_uint_eq(len, 6);
+		}
+	const double enc_fps = iterations * ARRAYSIZE(pcm) / 2 / get_time_diff(&ts0);
+
+	aptxhdenc_destroy(enc);
+	fprintf(stderr, "apt-X HD encoding: %.0f frames/s\n", enc_fps);
+
+#if HAVE_APTX_HD_DECODE
+
+	int32_t pcm_out[4 * 2 * 2];
+	size_t samples;
+
+	HANDLE_APTX dec;
+	ck_assert_ptr_ne(dec = aptxhddec_init(), NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	for (j = 0; j < iterations; j++)
+		for (i = 0; i < sizeof(code) / 6; i++) {
+			samples = ARRAYSIZE(pcm_out);
+			ck_assert_int_eq(aptxhddec_decode(dec, &code[i * 6], 6, pcm_out, &samples), 6);
+			ck_assert_uint_eq(samples % 2, 0);
+		}
+	const double dec_fps = iterations * ARRAYSIZE(pcm) / 2 / get_time_diff(&ts0);
+
+	aptxhddec_destroy(dec);
+	fprintf(stderr, "apt-X HD decoding: %.0f frames/s\n", dec_fps);
+
+#endif
+
+} END_TEST
+#endif
+
+int main(void) {
+
+	Suite *s = suite_create(__FILE__);
+	TCase *tc = tcase_create(__FILE__);
+	SRunner *sr = srunner_create(s);
+
+	suite_add_tcase(s, tc);
+
+#if !WITH_LIBOPENAPTX
+	tcase_add_test(tc, test_aptx_kernel_interleave);
+#else
+	tcase_add_test(tc, test_aptx_kernel_pack_s24le);
+#endif
+#if ENABLE_APTX
+	tcase_add_test(tc, test_aptx_encode_decode);
+#endif
+#if ENABLE_APTX_HD
+	tcase_add_test(tc, test_aptx_hd_encode_decode_benchmark);
+#endif
+
+	srunner_run_all(sr, CK_ENV);
+	int nf = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return nf == 0 ? 0 : 1;
+}
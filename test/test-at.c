@@ -8,7 +8,9 @@
  *
  */
 
+#include <errno.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <check.h>
@@ -126,6 +128,152 @@ START_TEST(test_at_parse_multiple_cmds) {
 	ck_assert_str_eq(at.value, "OK");
 } END_TEST
 
+static size_t reader_write(struct at_reader *reader, const char *data, size_t len) {
+	size_t size;
+	char *tail = at_reader_tail(reader, &size);
+	if (len > size)
+		len = size;
+	memcpy(tail, data, len);
+	at_reader_seek(reader, len);
+	return len;
+}
+
+START_TEST(test_at_reader) {
+
+	struct at_reader reader = { .len = 0 };
+	const char *data = "\r\nOK\r\n\r\n+CIEV: 1,0\r\nAT+XAPL=ABCD-1234-0100,10\r";
+
+	ck_assert_int_eq(at_reader_parse(&reader), -1);
+	ck_assert_int_eq(errno, EAGAIN);
+
+	reader_write(&reader, data, strlen(data));
+	ck_assert_int_eq(at_reader_has_message(&reader), true);
+
+	ck_assert_int_eq(at_reader_parse(&reader), 0);
+	ck_assert_int_eq(reader.at.type, AT_TYPE_RESP);
+	ck_assert_str_eq(reader.at.command, "");
+	ck_assert_str_eq(reader.at.value, "OK");
+
+	ck_assert_int_eq(at_reader_parse(&reader), 0);
+	ck_assert_int_eq(reader.at.type, AT_TYPE_RESP);
+	ck_assert_str_eq(reader.at.command, "+CIEV");
+	ck_assert_str_eq(reader.at.value, " 1,0");
+
+	ck_assert_int_eq(at_reader_parse(&reader), 0);
+	ck_assert_int_eq(reader.at.type, AT_TYPE_CMD_SET);
+	ck_assert_str_eq(reader.at.command, "+XAPL");
+	ck_assert_str_eq(reader.at.value, "ABCD-1234-0100,10");
+	/* parsed message shall point to the reader buffer */
+	ck_assert_ptr_eq(reader.at.command, &reader.buffer[strlen(data) - 24]);
+
+	ck_assert_int_eq(at_reader_has_message(&reader), false);
+	ck_assert_int_eq(at_reader_parse(&reader), -1);
+	ck_assert_int_eq(errno, EAGAIN);
+
+} END_TEST
+
+START_TEST(test_at_reader_split) {
+
+	struct at_reader reader = { .len = 0 };
+	const char *data = "AT+BRSF=191\r\r\nOK\r\n\r\n+BIEV: 2,100\r\n";
+	size_t count = 0;
+
+	/* feed the reader with a single byte at a time */
+	for (size_t i = 0; i < strlen(data); i++) {
+		reader_write(&reader, &data[i], 1);
+		while (at_reader_parse(&reader) == 0) {
+			switch (count++) {
+			case 0:
+				ck_assert_int_eq(reader.at.type, AT_TYPE_CMD_SET);
+				ck_assert_str_eq(reader.at.command, "+BRSF");
+				ck_assert_str_eq(reader.at.value, "191");
+				break;
+			case 1:
+				ck_assert_int_eq(reader.at.type, AT_TYPE_RESP);
+				ck_assert_str_eq(reader.at.command, "");
+				ck_assert_str_eq(reader.at.value, "OK");
+				break;
+			case 2:
+				ck_assert_int_eq(reader.at.type, AT_TYPE_RESP);
+				ck_assert_str_eq(reader.at.command, "+BIEV");
+				ck_assert_str_eq(reader.at.value, " 2,100");
+				break;
+			}
+		}
+		ck_assert_int_eq(errno, EAGAIN);
+	}
+
+	ck_assert_uint_eq(count, 3);
+
+} END_TEST
+
+START_TEST(test_at_reader_invalid) {
+
+	struct at_reader reader = { .len = 0 };
+	char data[512];
+
+	reader_write(&reader, "ABC\rAT+CIND?\r", 13);
+	ck_assert_int_eq(at_reader_parse(&reader), -1);
+	ck_assert_int_eq(errno, EBADMSG);
+	ck_assert_int_eq(reader.at.type, AT_TYPE_RAW);
+	ck_assert_str_eq(reader.at.command, "ABC");
+	/* invalid message shall not affect the next one */
+	ck_assert_int_eq(at_reader_parse(&reader), 0);
+	ck_assert_int_eq(reader.at.type, AT_TYPE_CMD_GET);
+	ck_assert_str_eq(reader.at.command, "+CIND");
+
+	/* overlong message shall be discarded */
+	memset(data, 'A', sizeof(data));
+	ck_assert_uint_eq(reader_write(&reader, data, sizeof(data)), sizeof(reader.buffer) - 1);
+	ck_assert_int_eq(at_reader_parse(&reader), -1);
+	ck_assert_int_eq(errno, EBADMSG);
+	ck_assert_uint_eq(strlen(reader.at.command), sizeof(reader.buffer) - 1);
+	ck_assert_int_eq(at_reader_parse(&reader), -1);
+	ck_assert_int_eq(errno, EAGAIN);
+
+} END_TEST
+
+START_TEST(test_at_reader_fuzz) {
+
+	static const char alphabet[] = "AaTt+=?:,\r\n\r\n01XYZ ";
+	struct at_reader reader = { .len = 0 };
+	char data[4096];
+
+	srand(1234);
+	for (size_t i = 0; i < sizeof(data); i++)
+		data[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+
+	for (size_t n = 0; n < 100; n++) {
+		for (size_t i = 0; i < sizeof(data);) {
+
+			size_t len = 1 + rand() % 64;
+			if (len > sizeof(data) - i)
+				len = sizeof(data) - i;
+			i += reader_write(&reader, &data[i], len);
+
+			int rv;
+			while ((rv = at_reader_parse(&reader)) == 0 || errno == EBADMSG) {
+				/* parsed message shall point to the reader buffer */
+				ck_assert(reader.at.command >= reader.buffer);
+				ck_assert(reader.at.command < reader.buffer + sizeof(reader.buffer));
+				if (rv == 0 && reader.at.value != NULL) {
+					ck_assert(reader.at.value >= reader.buffer);
+					ck_assert(reader.at.value < reader.buffer + sizeof(reader.buffer));
+				}
+			}
+
+			ck_assert_int_eq(errno, EAGAIN);
+			ck_assert_uint_le(reader.offset, reader.len);
+			ck_assert_uint_lt(reader.len, sizeof(reader.buffer));
+
+		}
+		/* shuffle input data for the next round */
+		for (size_t i = 0; i < sizeof(data); i++)
+			data[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+	}
+
+} END_TEST
+
 START_TEST(test_at_parse_bia) {
 
 	const bool state_ok1[__HFP_IND_MAX] = { 0, true, true, true, true, true, true, true };
@@ -221,6 +369,10 @@ int main(void) {
 	tcase_add_test(tc, test_at_parse_resp_unsolicited);
 	tcase_add_test(tc, test_at_parse_case_sensitivity);
 	tcase_add_test(tc, test_at_parse_multiple_cmds);
+	tcase_add_test(tc, test_at_reader);
+	tcase_add_test(tc, test_at_reader_split);
+	tcase_add_test(tc, test_at_reader_invalid);
+	tcase_add_test(tc, test_at_reader_fuzz);
 	tcase_add_test(tc, test_at_parse_bia);
 	tcase_add_test(tc, test_at_parse_cind);
 	tcase_add_test(tc, test_at_parse_cmer);
@@ -9,12 +9,15 @@
  */
 
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include <check.h>
 
 #include "audio.h"
 #include "shared/defs.h"
+#include "shared/rt.h"
 
 START_TEST(test_audio_scale_s16_2le) {
 
@@ -57,6 +60,37 @@ START_TEST(test_audio_scale_s16_2le) {
 
 } END_TEST
 
+START_TEST(test_audio_scale_s16_2le_saturation) {
+
+	const int16_t in[] = { 0x6000, (int16_t)0xA000, 0x1000, (int16_t)0xF000,
+		0x6000, (int16_t)0xA000, 0x1000, (int16_t)0xF000, 0x6000, (int16_t)0xA000 };
+	const int16_t out[] = { 0x7FFF, (int16_t)0x8000, 0x1800, (int16_t)0xE800,
+		0x7FFF, (int16_t)0x8000, 0x1800, (int16_t)0xE800, 0x7FFF, (int16_t)0x8000 };
+	int16_t tmp[ARRAYSIZE(in)];
+
+	memcpy(tmp, in, sizeof(tmp));
+	audio_scale_s16_2le(tmp, 1, ARRAYSIZE(tmp), 1.5, 0);
+	ck_assert_int_eq(memcmp(tmp, out, sizeof(out)), 0);
+
+} END_TEST
+
+START_TEST(test_audio_scale_s16_2le_mute_and_scale) {
+
+	const int16_t half_l_mute_r[] = { 0x1234 / 2, 0x0000, (int16_t)0xBCDE / 2, 0x0000 };
+	const int16_t mute_l_half_r[] = { 0x0000, 0x2345 / 2, 0x0000, (int16_t)0xCDEF / 2 };
+	const int16_t in[] = { 0x1234, 0x2345, (int16_t)0xBCDE, (int16_t)0xCDEF };
+	int16_t tmp[ARRAYSIZE(in)];
+
+	memcpy(tmp, in, sizeof(tmp));
+	audio_scale_s16_2le(tmp, 2, ARRAYSIZE(tmp) / 2, 0.5, 0);
+	ck_assert_int_eq(memcmp(tmp, half_l_mute_r, sizeof(half_l_mute_r)), 0);
+
+	memcpy(tmp, in, sizeof(tmp));
+	audio_scale_s16_2le(tmp, 2, ARRAYSIZE(tmp) / 2, 0, 0.5);
+	ck_assert_int_eq(memcmp(tmp, mute_l_half_r, sizeof(mute_l_half_r)), 0);
+
+} END_TEST
+
 START_TEST(test_audio_scale_s32_4le) {
 
 	const int32_t mute[] = { 0, 0, 0, 0 };
@@ -84,7 +118,314 @@ START_TEST(test_audio_scale_s32_4le) {
 
 } END_TEST
 
-int main(void) {
+START_TEST(test_audio_scale_s32_4le_mute_and_scale) {
+
+	const int32_t half_l_mute_r[] = { 0x123456 / 2, 0x0000, (int32_t)0xBCDEF0 / 2, 0x0000 };
+	const int32_t mute_l_half_r[] = { 0x0000, 0x234567 / 2, 0x0000, (int32_t)0xCDEF01 / 2 };
+	const int32_t in[] = { 0x123456, 0x234567, (int32_t)0xBCDEF0, (int32_t)0xCDEF01 };
+	int32_t tmp[ARRAYSIZE(in)];
+
+	memcpy(tmp, in, sizeof(tmp));
+	audio_scale_s32_4le(tmp, 2, ARRAYSIZE(tmp) / 2, 0.5, 0);
+	ck_assert_int_eq(memcmp(tmp, half_l_mute_r, sizeof(half_l_mute_r)), 0);
+
+	memcpy(tmp, in, sizeof(tmp));
+	audio_scale_s32_4le(tmp, 2, ARRAYSIZE(tmp) / 2, 0, 0.5);
+	ck_assert_int_eq(memcmp(tmp, mute_l_half_r, sizeof(mute_l_half_r)), 0);
+
+} END_TEST
+
+START_TEST(test_audio_scale_s32_4le_saturation) {
+
+	const int32_t in[] = { 0x60000000, (int32_t)0xA0000000, 0x10000000, (int32_t)0xF0000000,
+		0x60000000, (int32_t)0xA0000000, 0x10000000, (int32_t)0xF0000000, 0x60000000 };
+	const int32_t out[] = { 0x7FFFFFFF, (int32_t)0x80000000, 0x18000000, (int32_t)0xE8000000,
+		0x7FFFFFFF, (int32_t)0x80000000, 0x18000000, (int32_t)0xE8000000, 0x7FFFFFFF };
+	int32_t tmp[ARRAYSIZE(in)];
+
+	memcpy(tmp, in, sizeof(tmp));
+	audio_scale_s32_4le(tmp, 1, ARRAYSIZE(tmp), 1.5, 0);
+	ck_assert_int_eq(memcmp(tmp, out, sizeof(out)), 0);
+
+} END_TEST
+
+START_TEST(test_audio_mix_s16_2le) {
+
+	const int16_t in1[] = { 0x1000, (int16_t)0xF000, 0x6000, (int16_t)0xA000,
+		0x1000, (int16_t)0xF000, 0x6000, (int16_t)0xA000, 0x0100 };
+	const int16_t in2[] = { 0x2000, 0x2000, 0x3000, (int16_t)0xD000,
+		0x2000, 0x2000, 0x3000, (int16_t)0xD000, 0x0200 };
+	const int16_t out_sum[] = { 0x3000, 0x1000, 0x7FFF, (int16_t)0x8000,
+		0x3000, 0x1000, 0x7FFF, (int16_t)0x8000, 0x0300 };
+	const int16_t out_half[] = { 0x2800, 0x1800, 0x6000, (int16_t)0xA000,
+		0x2800, 0x1800, 0x6000, (int16_t)0xA000, 0x0280 };
+	int16_t tmp[ARRAYSIZE(in1)];
+
+	memset(tmp, 0, sizeof(tmp));
+	audio_mix_s16_2le(tmp, in1, ARRAYSIZE(tmp), 1.0);
+	ck_assert_int_eq(memcmp(tmp, in1, sizeof(in1)), 0);
+
+	memcpy(tmp, in1, sizeof(tmp));
+	audio_mix_s16_2le(tmp, in2, ARRAYSIZE(tmp), 1.0);
+	ck_assert_int_eq(memcmp(tmp, out_sum, sizeof(out_sum)), 0);
+
+	memcpy(tmp, in2, sizeof(tmp));
+	audio_mix_s16_2le(tmp, in1, ARRAYSIZE(tmp), 0.5);
+	ck_assert_int_eq(memcmp(tmp, out_half, sizeof(out_half)), 0);
+
+	/* mixing with zero gain shall not modify the signal */
+	memcpy(tmp, in1, sizeof(tmp));
+	audio_mix_s16_2le(tmp, in2, ARRAYSIZE(tmp), 0);
+	ck_assert_int_eq(memcmp(tmp, in1, sizeof(in1)), 0);
+
+} END_TEST
+
+START_TEST(test_audio_mix_s32_4le) {
+
+	const int32_t in1[] = { 0x10000000, (int32_t)0xF0000000, 0x60000000, (int32_t)0xA0000000,
+		0x10000000, (int32_t)0xF0000000, 0x60000000, (int32_t)0xA0000000, 0x01000000 };
+	const int32_t in2[] = { 0x20000000, 0x20000000, 0x30000000, (int32_t)0xD0000000,
+		0x20000000, 0x20000000, 0x30000000, (int32_t)0xD0000000, 0x02000000 };
+	const int32_t out[] = { 0x30000000, 0x10000000, 0x7FFFFFFF, (int32_t)0x80000000,
+		0x30000000, 0x10000000, 0x7FFFFFFF, (int32_t)0x80000000, 0x03000000 };
+	const int32_t in1_s24[] = { 0x100000, -0x100000, 0x600000, -0x600000 };
+	const int32_t in2_s24[] = { 0x200000, 0x200000, 0x300000, -0x300000 };
+	const int32_t out_s24[] = { 0x300000, 0x100000, 0x7FFFFF, -0x800000 };
+	int32_t tmp[ARRAYSIZE(in1)];
+
+	memcpy(tmp, in1, sizeof(tmp));
+	audio_mix_s32_4le(tmp, in2, ARRAYSIZE(tmp), 1.0);
+	ck_assert_int_eq(memcmp(tmp, out, sizeof(out)), 0);
+
+	memcpy(tmp, in1_s24, sizeof(in1_s24));
+	audio_mix_s24_4le(tmp, in2_s24, ARRAYSIZE(in2_s24), 1.0);
+	ck_assert_int_eq(memcmp(tmp, out_s24, sizeof(out_s24)), 0);
+
+} END_TEST
+
+START_TEST(test_audio_peak) {
+
+	int16_t s16[37] = { 0 };
+	int32_t s32[37] = { 0 };
+
+	ck_assert_uint_eq(audio_peak_s16_2le(s16, 0), 0);
+	ck_assert_uint_eq(audio_peak_s16_2le(s16, ARRAYSIZE(s16)), 0);
+	ck_assert_uint_eq(audio_peak_s32_4le(s32, ARRAYSIZE(s32)), 0);
+
+	/* peaks in the vector part and in the scalar tail */
+	s16[3] = -100;
+	s16[20] = 50;
+	ck_assert_uint_eq(audio_peak_s16_2le(s16, ARRAYSIZE(s16)), 100);
+	s16[36] = 200;
+	ck_assert_uint_eq(audio_peak_s16_2le(s16, ARRAYSIZE(s16)), 200);
+	s16[10] = INT16_MIN;
+	ck_assert_uint_eq(audio_peak_s16_2le(s16, ARRAYSIZE(s16)), 32768);
+	ck_assert_uint_eq(audio_peak_s16_2le(s16, 10), 100);
+
+	s32[5] = 7;
+	s32[30] = 999;
+	ck_assert_uint_eq(audio_peak_s32_4le(s32, ARRAYSIZE(s32)), 999);
+	ck_assert_uint_eq(audio_peak_s32_4le(s32, 30), 7);
+	s32[12] = INT32_MIN;
+	ck_assert_uint_eq(audio_peak_s32_4le(s32, ARRAYSIZE(s32)), INT32_MAX);
+
+} END_TEST
+
+START_TEST(test_audio_convert) {
+
+	const int16_t in[] = { 0x1234, (int16_t)0x8000, 0x7FFF, -1, 0x0001,
+		(int16_t)0xBCDE, 0x0000, 0x4321, (int16_t)0xFEDC, 0x00FF, (int16_t)0xFF00 };
+	int32_t s24[ARRAYSIZE(in)];
+	int32_t s32[ARRAYSIZE(in)];
+	int16_t tmp[ARRAYSIZE(in) * 2];
+	size_t i;
+
+	audio_s16_to_s32(s24, in, ARRAYSIZE(in), 8);
+	audio_s16_to_s32(s32, in, ARRAYSIZE(in), 16);
+	for (i = 0; i < ARRAYSIZE(in); i++) {
+		ck_assert_int_eq(s24[i], in[i] * 0x100);
+		ck_assert_int_eq(s32[i], in[i] * 0x10000);
+	}
+
+	/* in-place widening */
+	memcpy(tmp, in, sizeof(in));
+	audio_s16_to_s32((int32_t *)tmp, tmp, ARRAYSIZE(in), 16);
+	ck_assert_int_eq(memcmp(tmp, s32, sizeof(s32)), 0);
+
+	/* in-place narrowing */
+	audio_s32_to_s16(tmp, (int32_t *)tmp, ARRAYSIZE(in), 16);
+	ck_assert_int_eq(memcmp(tmp, in, sizeof(in)), 0);
+
+	audio_s32_shift(s24, ARRAYSIZE(s24), 8);
+	ck_assert_int_eq(memcmp(s24, s32, sizeof(s32)), 0);
+	audio_s32_shift(s24, ARRAYSIZE(s24), -8);
+	audio_s32_to_s16(tmp, s24, ARRAYSIZE(s24), 8);
+	ck_assert_int_eq(memcmp(tmp, in, sizeof(in)), 0);
+
+	uint8_t s24_3[ARRAYSIZE(in) * 3];
+	int32_t tmp32[ARRAYSIZE(in)];
+
+	audio_s32_to_s24_3le(s24_3, s24, ARRAYSIZE(s24), 0);
+	for (i = 0; i < ARRAYSIZE(in); i++) {
+		ck_assert_int_eq(s24_3[i * 3 + 0], (uint8_t)s24[i]);
+		ck_assert_int_eq(s24_3[i * 3 + 1], (uint8_t)(s24[i] >> 8));
+		ck_assert_int_eq(s24_3[i * 3 + 2], (uint8_t)(s24[i] >> 16));
+	}
+
+	audio_s24_3le_to_s32(tmp32, s24_3, ARRAYSIZE(tmp32), 0);
+	ck_assert_int_eq(memcmp(tmp32, s24, sizeof(s24)), 0);
+	audio_s24_3le_to_s32(tmp32, s24_3, ARRAYSIZE(tmp32), 8);
+	ck_assert_int_eq(memcmp(tmp32, s32, sizeof(s32)), 0);
+
+	/* the S24_3LE conversion shall work in place */
+	audio_s32_to_s24_3le(tmp32, tmp32, ARRAYSIZE(tmp32), 8);
+	ck_assert_int_eq(memcmp(tmp32, s24_3, sizeof(s24_3)), 0);
+	audio_s24_3le_to_s32(tmp32, tmp32, ARRAYSIZE(tmp32), 0);
+	ck_assert_int_eq(memcmp(tmp32, s24, sizeof(s24)), 0);
+
+} END_TEST
+
+START_TEST(test_audio_remap) {
+
+	int16_t s16[21 * 2];
+	int32_t s32[21 * 2];
+	int16_t mono16[21];
+	int32_t mono32[21];
+	size_t i;
+
+	for (i = 0; i < ARRAYSIZE(mono16); i++) {
+		s16[i * 2] = i * 1000 - 0x4000;
+		s16[i * 2 + 1] = 0x2000 - i * 3;
+		s32[i * 2] = (i * 1000 - 0x4000) * 0x10000;
+		s32[i * 2 + 1] = (0x2000 - i * 3) * 0x10000;
+	}
+
+	audio_downmix_s16_2le(mono16, s16, ARRAYSIZE(mono16));
+	audio_downmix_s32_4le(mono32, s32, ARRAYSIZE(mono32));
+	for (i = 0; i < ARRAYSIZE(mono16); i++) {
+		ck_assert_int_eq(mono16[i], (s16[i * 2] + s16[i * 2 + 1]) >> 1);
+		ck_assert_int_eq(mono32[i], ((int64_t)s32[i * 2] + s32[i * 2 + 1]) >> 1);
+	}
+
+	audio_swap_s16_2le(s16, ARRAYSIZE(mono16));
+	audio_swap_s32_4le(s32, ARRAYSIZE(mono32));
+	for (i = 0; i < ARRAYSIZE(mono16); i++) {
+		ck_assert_int_eq(s16[i * 2], (int16_t)(0x2000 - i * 3));
+		ck_assert_int_eq(s16[i * 2 + 1], (int16_t)(i * 1000 - 0x4000));
+		ck_assert_int_eq(s32[i * 2], (int32_t)(0x2000 - i * 3) * 0x10000);
+		ck_assert_int_eq(s32[i * 2 + 1], (int32_t)(i * 1000 - 0x4000) * 0x10000);
+	}
+
+	/* up-mixing shall work in place */
+	memcpy(s16, mono16, sizeof(mono16));
+	memcpy(s32, mono32, sizeof(mono32));
+	audio_upmix_s16_2le(s16, s16, ARRAYSIZE(mono16));
+	audio_upmix_s32_4le(s32, s32, ARRAYSIZE(mono32));
+	for (i = 0; i < ARRAYSIZE(mono16); i++) {
+		ck_assert_int_eq(s16[i * 2], mono16[i]);
+		ck_assert_int_eq(s16[i * 2 + 1], mono16[i]);
+		ck_assert_int_eq(s32[i * 2], mono32[i]);
+		ck_assert_int_eq(s32[i * 2 + 1], mono32[i]);
+	}
+
+	/* and so shall down-mixing */
+	audio_downmix_s16_2le(s16, s16, ARRAYSIZE(mono16));
+	ck_assert_int_eq(memcmp(s16, mono16, sizeof(mono16)), 0);
+
+} END_TEST
+
+START_TEST(test_audio_plc) {
+
+	const int16_t in[] = { 0x4000, -0x4000, 0x4000, -0x4000 };
+	int16_t out[ARRAYSIZE(in)];
+	struct audio_plc plc = { 0 };
+	size_t i;
+
+	ck_assert_int_eq(audio_plc_init(&plc, sizeof(int16_t), 2, ARRAYSIZE(in)), 0);
+
+	/* nothing to conceal without decoded data */
+	ck_assert_uint_eq(audio_plc_conceal(&plc, out), 0);
+
+	audio_plc_update(&plc, in, ARRAYSIZE(in));
+
+	/* the first concealed block starts with the full gain */
+	ck_assert_uint_eq(audio_plc_conceal(&plc, out), ARRAYSIZE(in));
+	ck_assert_int_eq(out[0], in[0]);
+	ck_assert_int_eq(out[1], in[1]);
+	ck_assert_int_lt(out[2], in[0]);
+	ck_assert_int_gt(out[3], in[1]);
+
+	/* the signal fades out monotonically */
+	int16_t prev = out[2];
+	for (i = 1; i < AUDIO_PLC_FADE_BLOCKS; i++) {
+		ck_assert_uint_eq(audio_plc_conceal(&plc, out), ARRAYSIZE(in));
+		ck_assert_int_lt(out[0], prev);
+		ck_assert_int_lt(out[2], out[0]);
+		prev = out[2];
+	}
+
+	/* and then there is a silence */
+	ck_assert_uint_eq(audio_plc_conceal(&plc, out), ARRAYSIZE(in));
+	for (i = 0; i < ARRAYSIZE(out); i++)
+		ck_assert_int_eq(out[i], 0);
+
+	/* correctly decoded block resets the fade-out */
+	audio_plc_update(&plc, in, 2);
+	ck_assert_uint_eq(audio_plc_conceal(&plc, out), 2);
+	ck_assert_int_eq(out[0], in[0]);
+
+	audio_plc_free(&plc);
+
+} END_TEST
+
+/**
+ * Reference floating-point implementation of the stereo S16_2LE scaling. */
+static void scale_s16_2le_reference(int16_t *buffer, size_t frames, double ch1, double ch2) {
+	while (frames--) {
+		buffer[2 * frames] *= ch1;
+		buffer[2 * frames + 1] *= ch2;
+	}
+}
+
+static unsigned long int benchmark_usec(const struct timespec *ts0) {
+	struct timespec ts;
+	gettimestamp(&ts);
+	return (ts.tv_sec - ts0->tv_sec) * 1000000 + (ts.tv_nsec - ts0->tv_nsec) / 1000;
+}
+
+/**
+ * Compare the performance of the volume scaling kernel with the
+ * reference floating-point implementation. */
+static int benchmark(void) {
+
+	static int16_t buffer[1024 * 2];
+	const size_t rounds = 100000;
+	struct timespec ts0;
+	size_t i;
+
+	for (i = 0; i < ARRAYSIZE(buffer); i++)
+		buffer[i] = i * 31;
+
+	gettimestamp(&ts0);
+	for (i = 0; i < rounds; i++)
+		scale_s16_2le_reference(buffer, ARRAYSIZE(buffer) / 2, 0.99, 0.98);
+	unsigned long int usec_ref = benchmark_usec(&ts0);
+
+	gettimestamp(&ts0);
+	for (i = 0; i < rounds; i++)
+		audio_scale_s16_2le(buffer, 2, ARRAYSIZE(buffer) / 2, 0.99, 0.98);
+	unsigned long int usec = benchmark_usec(&ts0);
+
+	printf("audio_scale_s16_2le: reference: %lu us, kernel: %lu us, speedup: %.2fx\n",
+			usec_ref, usec, usec > 0 ? 1.0 * usec_ref / usec : 0);
+
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+
+	if (argc == 2 && strcmp(argv[1], "--benchmark") == 0)
+		return benchmark();
 
 	Suite *s = suite_create(__FILE__);
 	TCase *tc = tcase_create(__FILE__);
@@ -93,7 +434,17 @@ int main(void) {
 	suite_add_tcase(s, tc);
 
 	tcase_add_test(tc, test_audio_scale_s16_2le);
+	tcase_add_test(tc, test_audio_scale_s16_2le_saturation);
+	tcase_add_test(tc, test_audio_scale_s16_2le_mute_and_scale);
 	tcase_add_test(tc, test_audio_scale_s32_4le);
+	tcase_add_test(tc, test_audio_scale_s32_4le_saturation);
+	tcase_add_test(tc, test_audio_scale_s32_4le_mute_and_scale);
+	tcase_add_test(tc, test_audio_mix_s16_2le);
+	tcase_add_test(tc, test_audio_mix_s32_4le);
+	tcase_add_test(tc, test_audio_peak);
+	tcase_add_test(tc, test_audio_convert);
+	tcase_add_test(tc, test_audio_remap);
+	tcase_add_test(tc, test_audio_plc);
 
 	srunner_run_all(sr, CK_ENV);
 	int nf = srunner_ntests_failed(sr);
@@ -12,9 +12,16 @@
 # include <config.h>
 #endif
 
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <bluetooth/bluetooth.h>
@@ -23,6 +30,7 @@
 #include <glib.h>
 
 #include "a2dp-codecs.h"
+#include "a2dp-policy.h"
 #include "a2dp.h"
 #include "ba-adapter.h"
 #include "ba-device.h"
@@ -31,9 +39,11 @@
 #include "bluealsa-dbus.h"
 #include "bluez.h"
 #include "sco.h"
+#include "storage.h"
 #include "shared/log.h"
 
 #include "../src/a2dp.c"
+#include "../src/a2dp-policy.c"
 #include "../src/ba-transport.c"
 
 void a2dp_aac_transport_set_codec(struct ba_transport *t) { (void)t; }
@@ -48,7 +58,17 @@ void a2dp_ldac_transport_set_codec(struct ba_transport *t) { (void)t; }
 int a2dp_ldac_transport_start(struct ba_transport *t) { (void)t; return 0; }
 void a2dp_mpeg_transport_set_codec(struct ba_transport *t) { (void)t; }
 int a2dp_mpeg_transport_start(struct ba_transport *t) { (void)t; return 0; }
-void a2dp_sbc_transport_set_codec(struct ba_transport *t) { (void)t; }
+int a2dp_plugin_transport_set_codec(struct ba_transport *t) { (void)t; return 0; }
+int a2dp_plugin_transport_start(struct ba_transport *t) { (void)t; return 0; }
+void a2dp_sbc_transport_set_codec(struct ba_transport *t) {
+	const a2dp_sbc_t *configuration = (a2dp_sbc_t *)t->a2dp.configuration;
+	t->a2dp.pcm.format = BA_TRANSPORT_PCM_FORMAT_S16_2LE;
+	t->a2dp.pcm.channels = a2dp_codec_lookup_channels(t->a2dp.codec,
+			configuration->channel_mode, false);
+	t->a2dp.pcm.sampling = a2dp_codec_lookup_frequency(t->a2dp.codec,
+			configuration->frequency, false);
+	t->a2dp.pcm.block_frames = (configuration->block_length == SBC_BLOCK_LENGTH_8 ? 8 : 16) *
+		(configuration->subbands == SBC_SUBBANDS_4 ? 4 : 8); }
 int a2dp_sbc_transport_start(struct ba_transport *t) { (void)t; return 0; }
 
 void *ba_rfcomm_thread(struct ba_transport *t) { (void)t; return 0; }
@@ -60,6 +80,24 @@ void bluealsa_dbus_pcm_update(struct ba_transport_pcm *pcm, unsigned int mask) {
 	debug("%s: %p %#x", __func__, (void *)pcm, mask); }
 void bluealsa_dbus_pcm_unregister(struct ba_transport_pcm *pcm) {
 	debug("%s: %p", __func__, (void *)pcm); }
+int bluealsa_dbus_pcm_handover_detach(struct ba_transport_pcm *pcm,
+		struct ba_transport_pcm_handover *h) {
+	debug("%s: %p", __func__, (void *)pcm);
+	h->mode = pcm->mode;
+	h->format = pcm->format;
+	h->channels = pcm->channels;
+	h->client_sampling = pcm->client_sampling;
+	h->fd = pcm->fd;
+	pcm->fd = -1;
+	return 0; }
+int bluealsa_dbus_pcm_handover_attach(struct ba_transport_pcm *pcm,
+		struct ba_transport_pcm_handover *h) {
+	debug("%s: %p", __func__, (void *)pcm);
+	if (h->mode != pcm->mode)
+		return errno = EINVAL, -1;
+	pcm->fd = h->fd;
+	h->fd = -1;
+	return 0; }
 struct ba_rfcomm *ba_rfcomm_new(struct ba_transport *sco, int fd) {
 	debug("%s: %p", __func__, (void *)sco); (void)fd; return NULL; }
 void ba_rfcomm_destroy(struct ba_rfcomm *r) {
@@ -69,7 +107,8 @@ int ba_rfcomm_send_signal(struct ba_rfcomm *r, enum ba_rfcomm_signal sig) {
 bool bluez_a2dp_set_configuration(const char *current_dbus_sep_path,
 		const struct a2dp_sep *sep, GError **error) {
 	debug("%s: %s", __func__, current_dbus_sep_path); (void)sep;
-	(void)error; return false; }
+	g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_NOT_SUPPORTED, "Not supported");
+	return false; }
 
 START_TEST(test_ba_adapter) {
 
@@ -112,6 +151,82 @@ START_TEST(test_ba_device) {
 
 } END_TEST
 
+static unsigned int codec_state_destroyed = 0;
+static void codec_state_destroy(void *state) {
+	(void)state;
+	codec_state_destroyed++;
+}
+
+START_TEST(test_ba_device_codec_cache) {
+
+	struct ba_adapter *a;
+	struct ba_device *d;
+
+	ck_assert_ptr_ne(a = ba_adapter_new(0), NULL);
+	bdaddr_t addr = {{ 0x12, 0x34, 0x56, 0x78, 0x90, 0xAB }};
+	ck_assert_ptr_ne(d = ba_device_new(a, &addr), NULL);
+	ba_adapter_unref(a);
+
+	const uint8_t config1[] = { 0x01, 0x02, 0x03 };
+	const uint8_t config2[] = { 0x01, 0x02, 0x04 };
+	unsigned int state = 0;
+	size_t i;
+
+	struct ba_device_codec codec = {
+		.d = d,
+		.name = "test",
+		.config = config1,
+		.config_size = sizeof(config1),
+		.state = &state,
+		.state_size = sizeof(state),
+		.destroy = codec_state_destroy,
+	};
+
+	codec_state_destroyed = 0;
+
+	/* cache shall be empty at start */
+	ck_assert_int_eq(ba_device_codec_acquire(&codec), -1);
+	ck_assert_int_eq(errno, ENOENT);
+
+	/* not ready state shall be destroyed upon release */
+	ba_device_codec_release(&codec);
+	ck_assert_uint_eq(codec_state_destroyed, 1);
+	ck_assert_int_eq(ba_device_codec_acquire(&codec), -1);
+
+	state = 0xC0DE;
+	codec.ready = true;
+	ba_device_codec_release(&codec);
+	ck_assert_uint_eq(codec_state_destroyed, 1);
+
+	/* cached state shall be identified by the name and configuration */
+	codec.config = config2;
+	ck_assert_int_eq(ba_device_codec_acquire(&codec), -1);
+	codec.config = config1;
+	codec.name = "test2";
+	ck_assert_int_eq(ba_device_codec_acquire(&codec), -1);
+	codec.name = "test";
+
+	state = 0;
+	ck_assert_int_eq(ba_device_codec_acquire(&codec), 0);
+	ck_assert_uint_eq(state, 0xC0DE);
+	/* state shall be removed from the cache upon acquire */
+	ck_assert_int_eq(ba_device_codec_acquire(&codec), -1);
+
+	/* the oldest state shall be evicted when the cache is full */
+	for (i = 0; i < BA_DEVICE_CODEC_CACHE_SIZE + 1; i++) {
+		codec.config = i == 0 ? config2 : config1;
+		ba_device_codec_release(&codec);
+	}
+	ck_assert_uint_eq(codec_state_destroyed, 2);
+	codec.config = config2;
+	ck_assert_int_eq(ba_device_codec_acquire(&codec), -1);
+
+	/* all cached states shall be destroyed with the device */
+	ba_device_unref(d);
+	ck_assert_uint_eq(codec_state_destroyed, 2 + BA_DEVICE_CODEC_CACHE_SIZE);
+
+} END_TEST
+
 START_TEST(test_ba_transport) {
 
 	struct ba_adapter *a;
@@ -138,6 +253,204 @@ START_TEST(test_ba_transport) {
 
 } END_TEST
 
+START_TEST(test_ba_transport_thread_manager) {
+
+	struct ba_adapter *a;
+	struct ba_device *d;
+	struct ba_transport *t1, *t2;
+	bdaddr_t addr = { 0 };
+
+	const int keep_alive_time = config.keep_alive_time;
+	config.keep_alive_time = 100;
+
+	ck_assert_ptr_ne(a = ba_adapter_new(0), NULL);
+	ck_assert_ptr_ne(d = ba_device_new(a, &addr), NULL);
+
+	ck_assert_ptr_ne(t1 = transport_new(d, "/owner", "/path/1"), NULL);
+	ck_assert_ptr_ne(t2 = transport_new(d, "/owner", "/path/2"), NULL);
+
+	ba_adapter_unref(a);
+	ba_device_unref(d);
+
+	/* keep-alive timers shall be handled by the shared manager */
+	ck_assert_int_eq(transport_thread_manager_send_command(t1,
+				BA_TRANSPORT_THREAD_MANAGER_CANCEL_IF_NO_CLIENTS), 0);
+	ck_assert_int_eq(transport_thread_manager_send_command(t2,
+				BA_TRANSPORT_THREAD_MANAGER_CANCEL_IF_NO_CLIENTS), 0);
+	ck_assert_int_eq(t1->thread_manager.wheel_armed, true);
+	ck_assert_int_eq(t2->thread_manager.wheel_armed, true);
+
+	/* threads cancellation shall disarm the keep-alive timer */
+	ck_assert_int_eq(transport_thread_manager_send_command(t2,
+				BA_TRANSPORT_THREAD_MANAGER_CANCEL_THREADS), 0);
+	ck_assert_int_eq(t2->thread_manager.wheel_armed, false);
+
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += 5;
+
+	/* wait until the expired keep-alive timer is processed by the manager */
+	pthread_mutex_lock(&transport_thread_manager.mutex);
+	while (t1->thread_manager.wheel_armed ||
+			t1->thread_manager.commands != 0 ||
+			transport_thread_manager.current == t1)
+		ck_assert_int_ne(pthread_cond_timedwait(&transport_thread_manager.changed,
+					&transport_thread_manager.mutex, &deadline), ETIMEDOUT);
+	ck_assert_int_eq(t1->thread_manager.wheel_armed, false);
+	ck_assert_uint_eq(transport_thread_manager.wheel_armed, 0);
+	pthread_mutex_unlock(&transport_thread_manager.mutex);
+
+	/* transport with armed timer shall be removed from the manager */
+	ck_assert_int_eq(transport_thread_manager_send_command(t1,
+				BA_TRANSPORT_THREAD_MANAGER_CANCEL_IF_NO_CLIENTS), 0);
+	ba_transport_unref(t1);
+
+	pthread_mutex_lock(&transport_thread_manager.mutex);
+	ck_assert_uint_eq(transport_thread_manager.wheel_armed, 0);
+	pthread_mutex_unlock(&transport_thread_manager.mutex);
+
+	ba_transport_unref(t2);
+
+	pthread_mutex_lock(&transport_thread_manager.mutex);
+	ck_assert_int_eq(g_queue_is_empty(&transport_thread_manager.queue), 1);
+	pthread_mutex_unlock(&transport_thread_manager.mutex);
+
+	config.keep_alive_time = keep_alive_time;
+
+} END_TEST
+
+static void *test_dummy_thread(void *userdata) {
+	return userdata;
+}
+
+static void *test_signal_consumer_thread(void *userdata) {
+	struct ba_transport_thread *th = userdata;
+	enum ba_transport_thread_signal signal;
+	usleep(50000);
+	ck_assert_int_eq(ba_transport_thread_signal_recv(th, &signal, NULL), 0);
+	ck_assert_int_eq(signal, BA_TRANSPORT_THREAD_SIGNAL_PCM_RESUME);
+	return NULL;
+}
+
+START_TEST(test_ba_transport_thread_signal) {
+
+	struct ba_transport_thread th;
+	enum ba_transport_thread_signal signal;
+
+	ck_assert_int_eq(transport_thread_init(&th, NULL), 0);
+	ck_assert_int_eq(transport_thread_open(&th), 0);
+
+	/* signals can not be sent to not running thread */
+	ck_assert_int_eq(ba_transport_thread_signal_send(&th, BA_TRANSPORT_THREAD_SIGNAL_PING), -1);
+
+	ck_assert_int_eq(pthread_create(&th.id, NULL, test_dummy_thread, NULL), 0);
+	ck_assert_int_eq(pthread_join(th.id, NULL), 0);
+
+	ck_assert_int_eq(ba_transport_thread_signal_send(&th, BA_TRANSPORT_THREAD_SIGNAL_PCM_OPEN), 0);
+	ck_assert_int_eq(ba_transport_thread_signal_send(&th, BA_TRANSPORT_THREAD_SIGNAL_PCM_SYNC), 0);
+	ck_assert_int_eq(ba_transport_thread_signal_send(&th, BA_TRANSPORT_THREAD_SIGNAL_PCM_DROP), 0);
+
+	/* burst of signals shall be received in order */
+	ck_assert_int_eq(ba_transport_thread_signal_recv(&th, &signal, NULL), 0);
+	ck_assert_int_eq(signal, BA_TRANSPORT_THREAD_SIGNAL_PCM_OPEN);
+	ck_assert_int_eq(ba_transport_thread_signal_recv(&th, &signal, NULL), 0);
+	ck_assert_int_eq(signal, BA_TRANSPORT_THREAD_SIGNAL_PCM_SYNC);
+	ck_assert_int_eq(ba_transport_thread_signal_recv(&th, &signal, NULL), 0);
+	ck_assert_int_eq(signal, BA_TRANSPORT_THREAD_SIGNAL_PCM_DROP);
+	ck_assert_int_eq(ba_transport_thread_signal_recv(&th, &signal, NULL), -1);
+	ck_assert_int_eq(errno, EAGAIN);
+
+	/* drained queue shall not leave the event armed */
+	struct pollfd pfd = { th.event_fd, POLLIN, 0 };
+	ck_assert_int_eq(poll(&pfd, 1, 0), 0);
+
+	struct ba_transport_pcm pcm = { 0 };
+	struct ba_transport_pcm *signal_pcm;
+	ck_assert_int_eq(ba_transport_thread_signal_send_pcm(&th, BA_TRANSPORT_THREAD_SIGNAL_PCM_CLOSE, &pcm), 0);
+	ck_assert_int_eq(ba_transport_thread_signal_send(&th, BA_TRANSPORT_THREAD_SIGNAL_PCM_OPEN), 0);
+
+	/* partially drained queue shall keep the event armed */
+	ck_assert_int_eq(ba_transport_thread_signal_recv(&th, &signal, &signal_pcm), 0);
+	ck_assert_int_eq(signal, BA_TRANSPORT_THREAD_SIGNAL_PCM_CLOSE);
+	ck_assert_ptr_eq(signal_pcm, &pcm);
+	ck_assert_int_eq(poll(&pfd, 1, 0), 1);
+	ck_assert_int_eq(ba_transport_thread_signal_recv(&th, &signal, &signal_pcm), 0);
+	ck_assert_int_eq(signal, BA_TRANSPORT_THREAD_SIGNAL_PCM_OPEN);
+	ck_assert_ptr_eq(signal_pcm, NULL);
+	ck_assert_int_eq(ba_transport_thread_signal_recv(&th, &signal, NULL), -1);
+	ck_assert_int_eq(poll(&pfd, 1, 0), 0);
+
+	size_t i;
+	for (i = 0; i < BA_TRANSPORT_THREAD_SIGNAL_QUEUE_SIZE; i++)
+		ck_assert_int_eq(ba_transport_thread_signal_send(&th, BA_TRANSPORT_THREAD_SIGNAL_PCM_RESUME), 0);
+
+	/* ping signal shall be coalesced with the full queue */
+	ck_assert_int_eq(ba_transport_thread_signal_send(&th, BA_TRANSPORT_THREAD_SIGNAL_PING), 0);
+
+	/* other signals shall wait for the free slot */
+	pthread_t consumer;
+	ck_assert_int_eq(pthread_create(&consumer, NULL, test_signal_consumer_thread, &th), 0);
+	ck_assert_int_eq(ba_transport_thread_signal_send_pcm(&th, BA_TRANSPORT_THREAD_SIGNAL_PCM_CLOSE, &pcm), 0);
+	ck_assert_int_eq(pthread_join(consumer, NULL), 0);
+
+	/* queue overflow shall be reported after the timeout */
+	ck_assert_int_eq(ba_transport_thread_signal_send(&th, BA_TRANSPORT_THREAD_SIGNAL_PCM_DROP), -1);
+	ck_assert_int_eq(errno, ENOBUFS);
+
+	for (i = 1; i < BA_TRANSPORT_THREAD_SIGNAL_QUEUE_SIZE; i++) {
+		ck_assert_int_eq(ba_transport_thread_signal_recv(&th, &signal, NULL), 0);
+		ck_assert_int_eq(signal, BA_TRANSPORT_THREAD_SIGNAL_PCM_RESUME);
+	}
+	/* the waiting signal shall not be reordered */
+	ck_assert_int_eq(ba_transport_thread_signal_recv(&th, &signal, &signal_pcm), 0);
+	ck_assert_int_eq(signal, BA_TRANSPORT_THREAD_SIGNAL_PCM_CLOSE);
+	ck_assert_ptr_eq(signal_pcm, &pcm);
+	ck_assert_int_eq(ba_transport_thread_signal_recv(&th, &signal, NULL), -1);
+
+	th.id = config.main_thread;
+	transport_thread_free(&th);
+
+} END_TEST
+
+START_TEST(test_ba_transport_thread_bt_coutq) {
+
+	struct ba_adapter *a;
+	struct ba_device *d;
+	struct ba_transport *t;
+	bdaddr_t addr = { 0 };
+
+	ck_assert_ptr_ne(a = ba_adapter_new(0), NULL);
+	ck_assert_ptr_ne(d = ba_device_new(a, &addr), NULL);
+	ck_assert_ptr_ne(t = transport_new(d, "/owner", "/path"), NULL);
+
+	ba_adapter_unref(a);
+	ba_device_unref(d);
+
+	struct ba_transport_thread *th = &t->thread_enc;
+	t->mtu_write = 100;
+
+	size_t i;
+	for (i = 0; i < BA_TRANSPORT_THREAD_BT_COUTQ_CONGESTED_WRITES - 1; i++) {
+		th->bt_coutq.queued = 250;
+		ba_transport_thread_bt_coutq_update(th);
+	}
+	ck_assert_int_eq(ba_transport_thread_bt_coutq_congested(th), false);
+
+	/* non-congested write shall reset the counter */
+	th->bt_coutq.queued = 100;
+	ba_transport_thread_bt_coutq_update(th);
+	ck_assert_uint_eq(th->bt_coutq.congested, 0);
+
+	th->bt_coutq.queued = 0;
+	th->bt_coutq.blocked = true;
+	for (i = 0; i < BA_TRANSPORT_THREAD_BT_COUTQ_CONGESTED_WRITES; i++)
+		ba_transport_thread_bt_coutq_update(th);
+	ck_assert_int_eq(ba_transport_thread_bt_coutq_congested(th), true);
+
+	ba_transport_unref(t);
+
+} END_TEST
+
 START_TEST(test_ba_transport_pcm_format) {
 
 	uint16_t format_u8 = BA_TRANSPORT_PCM_FORMAT_U8;
@@ -202,6 +515,569 @@ START_TEST(test_ba_transport_pcm_volume) {
 
 } END_TEST
 
+START_TEST(test_ba_transport_pcm_volume_restore) {
+
+	char root[] = "/tmp/bluealsa-test-ba-XXXXXX";
+	struct ba_adapter *a;
+	struct ba_device *d;
+	struct ba_transport *t;
+	bdaddr_t addr = {{ 0xBC, 0x9A, 0x78, 0x56, 0x34, 0x12 }};
+
+	ck_assert_ptr_ne(mkdtemp(root), NULL);
+	ck_assert_int_eq(storage_init(root), 0);
+
+	ck_assert_ptr_ne(a = ba_adapter_new(0), NULL);
+	ck_assert_ptr_ne(d = ba_device_new(a, &addr), NULL);
+
+	struct ba_transport_type ttype = { .profile = BA_TRANSPORT_PROFILE_A2DP_SINK };
+	a2dp_sbc_t configuration = { .channel_mode = SBC_CHANNEL_MODE_STEREO };
+	ck_assert_ptr_ne(t = ba_transport_new_a2dp(d, ttype,
+				"/owner", "/path", &a2dp_codec_sink_sbc, &configuration), NULL);
+
+	int level = -2400;
+	bool muted = true;
+	ba_transport_pcm_volume_set(&t->a2dp.pcm.volume[0], &level, &muted);
+	ba_transport_pcm_volume_set(&t->a2dp.pcm.volume[1], &level, NULL);
+	ck_assert_int_eq(storage_pcm_data_update(&t->a2dp.pcm), 0);
+	ck_assert_int_eq(storage_sync(), 0);
+	ba_transport_destroy(t);
+
+	/* reconnected device shall come back with the saved volume */
+	storage_destroy();
+	ck_assert_int_eq(storage_init(root), 0);
+	ck_assert_ptr_ne(t = ba_transport_new_a2dp(d, ttype,
+				"/owner", "/path", &a2dp_codec_sink_sbc, &configuration), NULL);
+
+	ck_assert_int_eq(t->a2dp.pcm.volume[0].level, -2400);
+	ck_assert_int_eq(t->a2dp.pcm.volume[0].muted, true);
+	ck_assert_int_eq(t->a2dp.pcm.volume[1].level, -2400);
+	ck_assert_int_eq(t->a2dp.pcm.volume[1].muted, false);
+
+	ba_transport_destroy(t);
+	ba_device_unref(d);
+	ba_adapter_unref(a);
+
+	char path[sizeof(root) + 32];
+	snprintf(path, sizeof(path), "%s/12:34:56:78:9A:BC", root);
+	ck_assert_int_eq(unlink(path), 0);
+	ck_assert_int_eq(rmdir(root), 0);
+	storage_destroy();
+
+} END_TEST
+
+START_TEST(test_ba_transport_pcm_format_select) {
+
+	struct ba_adapter *a;
+	struct ba_device *d;
+	struct ba_transport *t;
+	bdaddr_t addr = { 0 };
+	uint16_t formats[4];
+
+	ck_assert_ptr_ne(a = ba_adapter_new(0), NULL);
+	ck_assert_ptr_ne(d = ba_device_new(a, &addr), NULL);
+
+	struct ba_transport_type ttype = { .profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE };
+	a2dp_sbc_t configuration = { .channel_mode = SBC_CHANNEL_MODE_STEREO };
+	ck_assert_ptr_ne(t = ba_transport_new_a2dp(d, ttype,
+				"/owner", "/path", &a2dp_codec_source_sbc, &configuration), NULL);
+
+	ba_adapter_unref(a);
+	ba_device_unref(d);
+
+	struct ba_transport_pcm *pcm = &t->a2dp.pcm;
+	ck_assert_int_eq(pcm->format, BA_TRANSPORT_PCM_FORMAT_S16_2LE);
+	ck_assert_int_eq(pcm->codec_format, BA_TRANSPORT_PCM_FORMAT_S16_2LE);
+
+	ck_assert_uint_eq(ba_transport_pcm_get_formats(pcm, formats, ARRAYSIZE(formats)), 3);
+	ck_assert_int_eq(formats[0], BA_TRANSPORT_PCM_FORMAT_S16_2LE);
+	ck_assert_int_eq(formats[1], BA_TRANSPORT_PCM_FORMAT_S24_4LE);
+	ck_assert_int_eq(formats[2], BA_TRANSPORT_PCM_FORMAT_S32_4LE);
+
+	ck_assert_int_eq(ba_transport_pcm_set_format(pcm, BA_TRANSPORT_PCM_FORMAT_S32_4LE), 0);
+	ck_assert_int_eq(pcm->format, BA_TRANSPORT_PCM_FORMAT_S32_4LE);
+	ck_assert_int_eq(pcm->codec_format, BA_TRANSPORT_PCM_FORMAT_S16_2LE);
+
+	ck_assert_int_eq(ba_transport_pcm_set_format(pcm, BA_TRANSPORT_PCM_FORMAT_U8), -1);
+	ck_assert_int_eq(errno, EINVAL);
+
+	/* format can not be changed while the PCM is opened */
+	pcm->fd = 0;
+	ck_assert_int_eq(ba_transport_pcm_set_format(pcm, BA_TRANSPORT_PCM_FORMAT_S16_2LE), -1);
+	ck_assert_int_eq(errno, EBUSY);
+	pcm->fd = -1;
+
+	/* compressed stream is not supported by SBC */
+	ck_assert_int_eq(ba_transport_pcm_set_format(pcm, BA_TRANSPORT_PCM_FORMAT_MPEG), -1);
+	ck_assert_int_eq(errno, EINVAL);
+
+#if ENABLE_MPEG && ENABLE_MP3LAME
+
+	struct ba_transport *t_mpeg;
+	a2dp_mpeg_t configuration_mpeg = { .layer = MPEG_LAYER_MP3 };
+	ttype.codec = A2DP_CODEC_MPEG12;
+	ck_assert_ptr_ne(t_mpeg = ba_transport_new_a2dp(d, ttype,
+				"/owner", "/path/mpeg", &a2dp_codec_source_mpeg, &configuration_mpeg), NULL);
+
+	/* compressed stream is offered as the last format */
+	pcm = &t_mpeg->a2dp.pcm;
+	ck_assert_uint_eq(ba_transport_pcm_get_formats(pcm, formats, ARRAYSIZE(formats)), 4);
+	ck_assert_int_eq(formats[3], BA_TRANSPORT_PCM_FORMAT_MPEG);
+	ck_assert_int_eq(BA_TRANSPORT_PCM_FORMAT_IS_COMPRESSED(formats[3]), true);
+	ck_assert_int_eq(BA_TRANSPORT_PCM_FORMAT_IS_COMPRESSED(formats[0]), false);
+
+	ck_assert_int_eq(ba_transport_pcm_set_format(pcm, BA_TRANSPORT_PCM_FORMAT_MPEG), 0);
+	ck_assert_int_eq(pcm->format, BA_TRANSPORT_PCM_FORMAT_MPEG);
+	ck_assert_int_eq(pcm->codec_format, BA_TRANSPORT_PCM_FORMAT_S16_2LE);
+
+	ba_transport_unref(t_mpeg);
+
+#endif
+
+	ba_transport_unref(t);
+
+} END_TEST
+
+START_TEST(test_ba_transport_pcm_handover) {
+
+	struct ba_adapter *a;
+	struct ba_device *d;
+	struct ba_transport *t;
+	bdaddr_t addr = { 0 };
+	char buffer[8];
+	int fds[2];
+
+	ck_assert_ptr_ne(a = ba_adapter_new(0), NULL);
+	ck_assert_ptr_ne(d = ba_device_new(a, &addr), NULL);
+	ba_adapter_unref(a);
+
+	struct ba_transport_type ttype = { .profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE };
+	a2dp_sbc_t configuration = {
+		.frequency = SBC_SAMPLING_FREQ_48000,
+		.channel_mode = SBC_CHANNEL_MODE_STEREO };
+	ck_assert_ptr_ne(t = ba_transport_new_a2dp(d, ttype,
+				"/owner", "/path", &a2dp_codec_source_sbc, &configuration), NULL);
+
+	ck_assert_int_eq(ba_transport_pcm_set_format(&t->a2dp.pcm, BA_TRANSPORT_PCM_FORMAT_S32_4LE), 0);
+	ck_assert_int_eq(pipe(fds), 0);
+	t->a2dp.pcm.fd = fds[1];
+
+	/* stream shall be detached and kept in the device */
+	struct ba_transport_pcm_handover *h;
+	ck_assert_ptr_ne(h = transport_pcm_handover_new(&t->a2dp.pcm), NULL);
+	ck_assert_ptr_eq(d->pcm_handover, h);
+	ck_assert_int_eq(t->a2dp.pcm.fd, -1);
+	ba_transport_destroy(t);
+
+	/* new transport shall take over the stream and its configuration */
+	ck_assert_ptr_ne(t = ba_transport_new_a2dp(d, ttype,
+				"/owner", "/path", &a2dp_codec_source_sbc, &configuration), NULL);
+	ck_assert_ptr_eq(d->pcm_handover, NULL);
+	ck_assert_int_eq(t->a2dp.pcm.fd, fds[1]);
+	ck_assert_int_eq(t->a2dp.pcm.format, BA_TRANSPORT_PCM_FORMAT_S32_4LE);
+	ck_assert_uint_eq(t->a2dp.pcm.client_sampling, 48000);
+
+	ck_assert_ptr_ne(h = transport_pcm_handover_new(&t->a2dp.pcm), NULL);
+	ba_transport_destroy(t);
+
+	/* stream shall be closed if the new codec can not serve it */
+	configuration.channel_mode = SBC_CHANNEL_MODE_MONO;
+	ck_assert_ptr_ne(t = ba_transport_new_a2dp(d, ttype,
+				"/owner", "/path", &a2dp_codec_source_sbc, &configuration), NULL);
+	ck_assert_ptr_eq(d->pcm_handover, NULL);
+	ck_assert_int_eq(t->a2dp.pcm.fd, -1);
+	ck_assert_int_eq(read(fds[0], buffer, sizeof(buffer)), 0);
+
+	close(fds[0]);
+	ba_transport_destroy(t);
+	ba_device_unref(d);
+
+} END_TEST
+
+START_TEST(test_ba_transport_pcm_handover_select_codec_fail) {
+
+	struct ba_adapter *a;
+	struct ba_device *d;
+	struct ba_transport *t;
+	bdaddr_t addr = { 0 };
+	int fds[2];
+
+	ck_assert_ptr_ne(a = ba_adapter_new(0), NULL);
+	ck_assert_ptr_ne(d = ba_device_new(a, &addr), NULL);
+	ba_adapter_unref(a);
+
+	struct ba_transport_type ttype = { .profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE };
+	a2dp_sbc_t configuration = {
+		.frequency = SBC_SAMPLING_FREQ_48000,
+		.channel_mode = SBC_CHANNEL_MODE_STEREO };
+	ck_assert_ptr_ne(t = ba_transport_new_a2dp(d, ttype,
+				"/owner", "/path", &a2dp_codec_source_sbc, &configuration), NULL);
+
+	ck_assert_int_eq(pipe(fds), 0);
+	t->a2dp.pcm.fd = fds[1];
+
+	a2dp_sbc_t configuration_new = {
+		.frequency = SBC_SAMPLING_FREQ_44100,
+		.channel_mode = SBC_CHANNEL_MODE_STEREO };
+	struct a2dp_sep sep = {
+		.codec_id = A2DP_CODEC_SBC,
+		.capabilities_size = sizeof(configuration_new),
+		.configuration = &configuration_new };
+
+	/* stream shall be given back if the reconfiguration fails */
+	ck_assert_int_eq(ba_transport_select_codec_a2dp(t, &sep), -1);
+	ck_assert_int_eq(errno, EIO);
+	ck_assert_ptr_eq(d->pcm_handover, NULL);
+	ck_assert_int_eq(t->a2dp.pcm.fd, fds[1]);
+
+	close(fds[0]);
+	ba_transport_destroy(t);
+	ba_device_unref(d);
+
+} END_TEST
+
+START_TEST(test_ba_transport_pcm_block_frames) {
+
+	struct ba_adapter *a;
+	struct ba_device *d;
+	struct ba_transport *t_a2dp;
+	struct ba_transport *t_sco;
+	bdaddr_t addr = { 0 };
+
+	ck_assert_ptr_ne(a = ba_adapter_new(0), NULL);
+	ck_assert_ptr_ne(d = ba_device_new(a, &addr), NULL);
+
+	struct ba_transport_type ttype_a2dp = { .profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE };
+	a2dp_sbc_t configuration = {
+		.channel_mode = SBC_CHANNEL_MODE_STEREO,
+		.block_length = SBC_BLOCK_LENGTH_8,
+		.subbands = SBC_SUBBANDS_4 };
+	ck_assert_ptr_ne(t_a2dp = ba_transport_new_a2dp(d, ttype_a2dp,
+				"/owner", "/path", &a2dp_codec_source_sbc, &configuration), NULL);
+
+	struct ba_transport_type ttype_sco = { .profile = BA_TRANSPORT_PROFILE_HFP_AG };
+	ck_assert_ptr_ne(t_sco = ba_transport_new_sco(d, ttype_sco, "/owner", "/path", -1), NULL);
+
+	ba_adapter_unref(a);
+	ba_device_unref(d);
+
+	ck_assert_uint_eq(t_a2dp->a2dp.pcm.block_frames, 8 * 4);
+
+	ba_transport_set_codec(t_sco, HFP_CODEC_CVSD);
+	ck_assert_uint_eq(t_sco->sco.spk_pcm.block_frames, 1);
+	ck_assert_uint_eq(t_sco->sco.mic_pcm.block_frames, 1);
+
+	ba_transport_set_codec(t_sco, HFP_CODEC_MSBC);
+	ck_assert_uint_eq(t_sco->sco.spk_pcm.block_frames, 120);
+	ck_assert_uint_eq(t_sco->sco.mic_pcm.block_frames, 120);
+
+	ba_transport_unref(t_a2dp);
+	ba_transport_unref(t_sco);
+
+} END_TEST
+
+START_TEST(test_ba_transport_pcm_position) {
+
+	struct ba_adapter *a;
+	struct ba_device *d;
+	struct ba_transport *t;
+	bdaddr_t addr = { 0 };
+	struct timespec ts0, ts1, ts2;
+	uint64_t samples;
+
+	ck_assert_ptr_ne(a = ba_adapter_new(0), NULL);
+	ck_assert_ptr_ne(d = ba_device_new(a, &addr), NULL);
+
+	struct ba_transport_type ttype = { .profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE };
+	a2dp_sbc_t configuration = { .channel_mode = SBC_CHANNEL_MODE_STEREO };
+	ck_assert_ptr_ne(t = ba_transport_new_a2dp(d, ttype,
+				"/owner", "/path", &a2dp_codec_source_sbc, &configuration), NULL);
+
+	ba_adapter_unref(a);
+	ba_device_unref(d);
+
+	struct ba_transport_pcm *pcm = &t->a2dp.pcm;
+
+	gettimestamp(&ts0);
+	ba_transport_pcm_position_reset(pcm);
+	ba_transport_pcm_position_get(pcm, &samples, &ts1);
+	ck_assert_uint_eq(samples, 0);
+	ck_assert(timespeccmp(&ts1, &ts0, >=));
+
+	ba_transport_pcm_position_update(pcm, 256);
+	ba_transport_pcm_position_update(pcm, 512);
+	ba_transport_pcm_position_get(pcm, &samples, &ts2);
+	ck_assert_uint_eq(samples, 768);
+	ck_assert(timespeccmp(&ts2, &ts1, >=));
+
+	ba_transport_pcm_presentation_update(pcm, 128);
+	ba_transport_pcm_presentation_get(pcm, &samples, &ts2);
+	ck_assert_uint_eq(samples, 128);
+
+	ba_transport_pcm_position_reset(pcm);
+	ba_transport_pcm_position_get(pcm, &samples, &ts2);
+	ck_assert_uint_eq(samples, 0);
+	ba_transport_pcm_presentation_get(pcm, &samples, &ts2);
+	ck_assert_uint_eq(samples, 0);
+
+	ba_transport_unref(t);
+
+} END_TEST
+
+static int test_ba_transport_group_acquire(struct ba_transport *t) {
+	int fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds), 0);
+	close(fds[1]);
+	t->mtu_read = t->mtu_write = 256;
+	return t->bt_fd = fds[0];
+}
+
+static int test_ba_transport_group_acquire_leader(struct ba_transport *t) {
+	const int fd = test_ba_transport_group_acquire(t);
+	t->mtu_read = t->mtu_write = 1024;
+	return fd;
+}
+
+static int test_ba_transport_group_release(struct ba_transport *t) {
+	close(t->bt_fd);
+	t->bt_fd = -1;
+	return 0;
+}
+
+START_TEST(test_ba_transport_group) {
+
+	struct ba_adapter *a;
+	struct ba_device *d;
+	struct ba_transport *t_leader;
+	struct ba_transport *t_member;
+	struct ba_transport *t_other;
+	struct ba_transport *t_sink;
+	bdaddr_t addr = { 0 };
+
+	ck_assert_ptr_ne(a = ba_adapter_new(0), NULL);
+	ck_assert_ptr_ne(d = ba_device_new(a, &addr), NULL);
+
+	struct ba_transport_type ttype = { .profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE };
+	a2dp_sbc_t configuration = { .channel_mode = SBC_CHANNEL_MODE_STEREO };
+	a2dp_sbc_t configuration_mono = { .channel_mode = SBC_CHANNEL_MODE_MONO };
+	ck_assert_ptr_ne(t_leader = ba_transport_new_a2dp(d, ttype,
+				"/owner", "/path/1", &a2dp_codec_source_sbc, &configuration), NULL);
+	ck_assert_ptr_ne(t_member = ba_transport_new_a2dp(d, ttype,
+				"/owner", "/path/2", &a2dp_codec_source_sbc, &configuration), NULL);
+	ck_assert_ptr_ne(t_other = ba_transport_new_a2dp(d, ttype,
+				"/owner", "/path/3", &a2dp_codec_source_sbc, &configuration_mono), NULL);
+	struct ba_transport_type ttype_sink = { .profile = BA_TRANSPORT_PROFILE_A2DP_SINK };
+	ck_assert_ptr_ne(t_sink = ba_transport_new_a2dp(d, ttype_sink,
+				"/owner", "/path/4", &a2dp_codec_sink_sbc, &configuration), NULL);
+
+	t_leader->acquire = test_ba_transport_group_acquire_leader;
+	t_leader->release = test_ba_transport_group_release;
+	t_member->acquire = test_ba_transport_group_acquire;
+	t_member->release = test_ba_transport_group_release;
+
+	ba_adapter_unref(a);
+	ba_device_unref(d);
+
+	/* only A2DP source transports can be grouped */
+	ck_assert_int_eq(ba_transport_group_join(t_leader, t_sink), -1);
+	ck_assert_int_eq(errno, ENOTSUP);
+	/* transport can not lead itself */
+	ck_assert_int_eq(ba_transport_group_join(t_leader, t_leader), -1);
+	ck_assert_int_eq(errno, EINVAL);
+	/* codec configuration has to be the same */
+	ck_assert_int_eq(ba_transport_group_join(t_leader, t_other), -1);
+	ck_assert_int_eq(errno, EINVAL);
+
+	/* member link has to carry packets sized for the leader link */
+	t_leader->mtu_write = 512;
+	ck_assert_int_eq(ba_transport_group_join(t_leader, t_member), -1);
+	ck_assert_int_eq(errno, EMSGSIZE);
+	ck_assert_int_eq(ba_transport_group_is_member(t_member), false);
+	ck_assert_int_eq(t_member->bt_fd, -1);
+	ck_assert_uint_eq(t_leader->a2dp.group.members_len, 0);
+	t_leader->mtu_write = 0;
+
+	ck_assert_int_eq(ba_transport_group_join(t_leader, t_member), 0);
+	ck_assert_int_eq(ba_transport_group_is_member(t_member), true);
+	ck_assert_int_eq(t_member->bt_fd != -1, true);
+	ck_assert_uint_eq(t_leader->a2dp.group.members_len, 1);
+	ck_assert_int_ne(t_leader->a2dp.group.members[0].bt_fd, -1);
+
+	/* joining twice is not allowed */
+	ck_assert_int_eq(ba_transport_group_join(t_leader, t_member), -1);
+	ck_assert_int_eq(errno, EBUSY);
+	/* groups can not be nested */
+	ck_assert_int_eq(ba_transport_group_join(t_member, t_leader), -1);
+	ck_assert_int_eq(errno, EINVAL);
+
+	/* leader acquired afterwards shall be clamped to the member MTU */
+	ck_assert_int_ne(ba_transport_acquire(t_leader), -1);
+	ck_assert_uint_eq(t_leader->mtu_write, 256);
+	ck_assert_int_eq(ba_transport_release(t_leader), 0);
+
+	ck_assert_int_eq(ba_transport_group_leave(t_member), 0);
+	ck_assert_int_eq(ba_transport_group_is_member(t_member), false);
+	ck_assert_int_eq(t_member->bt_fd, -1);
+	ck_assert_uint_eq(t_leader->a2dp.group.members_len, 0);
+
+	ck_assert_int_eq(ba_transport_group_leave(t_member), -1);
+	ck_assert_int_eq(errno, ENOENT);
+
+	ba_transport_unref(t_leader);
+	ba_transport_unref(t_member);
+	ba_transport_unref(t_other);
+	ba_transport_unref(t_sink);
+
+} END_TEST
+
+START_TEST(test_ba_device_warm) {
+
+	char root[] = "/tmp/bluealsa-test-ba-XXXXXX";
+	struct ba_adapter *a;
+	struct ba_device *d;
+	struct ba_transport *t;
+	bdaddr_t addr = {{ 0xBC, 0x9A, 0x78, 0x56, 0x34, 0x12 }};
+
+	ck_assert_ptr_ne(mkdtemp(root), NULL);
+	ck_assert_int_eq(storage_init(root), 0);
+
+	ck_assert_ptr_ne(a = ba_adapter_new(0), NULL);
+	ck_assert_ptr_ne(d = ba_device_new(a, &addr), NULL);
+	ck_assert_int_eq(d->warm, false);
+	ck_assert_int_eq(ba_device_set_warm(d, true), 0);
+	ba_device_unref(d);
+
+	/* reconnected device shall come back in the warm mode */
+	storage_destroy();
+	ck_assert_int_eq(storage_init(root), 0);
+	ck_assert_ptr_ne(d = ba_device_new(a, &addr), NULL);
+	ck_assert_int_eq(d->warm, true);
+
+	struct ba_transport_type ttype = { .profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE };
+	a2dp_sbc_t configuration = { .channel_mode = SBC_CHANNEL_MODE_STEREO };
+	ck_assert_ptr_ne(t = ba_transport_new_a2dp(d, ttype,
+				"/owner", "/path", &a2dp_codec_source_sbc, &configuration), NULL);
+	t->acquire = test_ba_transport_group_acquire;
+	t->release = test_ba_transport_group_release;
+
+	/* new source transport shall be acquired by the main loop */
+	ck_assert_int_eq(t->bt_fd, -1);
+	while (g_main_context_iteration(NULL, FALSE))
+		continue;
+	ck_assert_int_ne(t->bt_fd, -1);
+
+	ba_transport_destroy(t);
+	ba_device_unref(d);
+	ba_adapter_unref(a);
+
+	storage_destroy();
+	char path[sizeof(root) + 32];
+	snprintf(path, sizeof(path), "%s/12:34:56:78:9A:BC", root);
+	ck_assert_int_eq(unlink(path), 0);
+	ck_assert_int_eq(rmdir(root), 0);
+
+} END_TEST
+
+START_TEST(test_ba_transport_thread_stats) {
+
+	struct ba_transport_thread th = { 0 };
+	const struct timespec ts[] = {
+		{ 0, 500000 }, { 0, 1000000 }, { 0, 4999999 },
+		{ 0, 9000000 }, { 0, 19000000 }, { 0, 20000000 },
+		{ 1, 0 }, { -1, 999000000 }};
+
+	ba_transport_thread_stats_reset(&th);
+	for (size_t i = 0; i < ARRAYSIZE(ts); i++)
+		ba_transport_thread_stats_add_busy(&th, &ts[i]);
+
+	ck_assert_uint_eq(th.stats.busy_hist[0], 2);
+	ck_assert_uint_eq(th.stats.busy_hist[1], 1);
+	ck_assert_uint_eq(th.stats.busy_hist[2], 1);
+	ck_assert_uint_eq(th.stats.busy_hist[3], 1);
+	ck_assert_uint_eq(th.stats.busy_hist[4], 1);
+	ck_assert_uint_eq(th.stats.busy_hist[5], 2);
+
+	ba_transport_thread_stats_add(&th, tx_packets, 3);
+	ba_transport_thread_stats_add(&th, tx_bytes, 1024);
+	ck_assert_uint_eq(th.stats.tx_packets, 3);
+	ck_assert_uint_eq(th.stats.tx_bytes, 1024);
+
+	ba_transport_thread_stats_reset(&th);
+	ck_assert_uint_eq(th.stats.tx_packets, 0);
+	ck_assert_uint_eq(th.stats.busy_hist[5], 0);
+
+} END_TEST
+
+START_TEST(test_a2dp_policy_get_quality) {
+
+	struct a2dp_policy_metrics m = { .tx_packets = 100 };
+	ck_assert_int_eq(a2dp_policy_get_quality(&m), A2DP_POLICY_QUALITY_GOOD);
+
+	/* RSSI within the hysteresis gap */
+	m.rssi_valid = true;
+	m.rssi = A2DP_POLICY_RSSI_GOOD - 1;
+	ck_assert_int_eq(a2dp_policy_get_quality(&m), A2DP_POLICY_QUALITY_FAIR);
+	m.rssi = A2DP_POLICY_RSSI_POOR - 1;
+	ck_assert_int_eq(a2dp_policy_get_quality(&m), A2DP_POLICY_QUALITY_POOR);
+	m.rssi = 0;
+
+	m.queued = 1;
+	ck_assert_int_eq(a2dp_policy_get_quality(&m), A2DP_POLICY_QUALITY_FAIR);
+	m.queued = A2DP_POLICY_QUEUE_POOR;
+	ck_assert_int_eq(a2dp_policy_get_quality(&m), A2DP_POLICY_QUALITY_POOR);
+	m.queued = 0;
+
+	m.overdue = 10;
+	ck_assert_int_eq(a2dp_policy_get_quality(&m), A2DP_POLICY_QUALITY_FAIR);
+	m.overdue = 11;
+	ck_assert_int_eq(a2dp_policy_get_quality(&m), A2DP_POLICY_QUALITY_POOR);
+	m.overdue = 0;
+
+	m.congestion_drops = 1;
+	ck_assert_int_eq(a2dp_policy_get_quality(&m), A2DP_POLICY_QUALITY_POOR);
+
+} END_TEST
+
+START_TEST(test_a2dp_policy_link_update) {
+
+	struct a2dp_policy_link link;
+	size_t i;
+
+	a2dp_policy_link_init(&link);
+
+	/* single good sample between poor ones resets the counter */
+	for (i = 0; i < A2DP_POLICY_DOWNGRADE_SAMPLES - 1; i++)
+		ck_assert_int_eq(a2dp_policy_link_update(&link, A2DP_POLICY_QUALITY_POOR), A2DP_POLICY_ACTION_NONE);
+	ck_assert_int_eq(a2dp_policy_link_update(&link, A2DP_POLICY_QUALITY_GOOD), A2DP_POLICY_ACTION_NONE);
+	for (i = 0; i < A2DP_POLICY_DOWNGRADE_SAMPLES - 1; i++)
+		ck_assert_int_eq(a2dp_policy_link_update(&link, A2DP_POLICY_QUALITY_POOR), A2DP_POLICY_ACTION_NONE);
+	ck_assert_int_eq(a2dp_policy_link_update(&link, A2DP_POLICY_QUALITY_POOR), A2DP_POLICY_ACTION_DOWNGRADE);
+
+	/* fair quality does not trigger upgrade */
+	for (i = 0; i < A2DP_POLICY_UPGRADE_SAMPLES * 2; i++)
+		ck_assert_int_eq(a2dp_policy_link_update(&link, i % 2 ?
+					A2DP_POLICY_QUALITY_GOOD : A2DP_POLICY_QUALITY_FAIR), A2DP_POLICY_ACTION_NONE);
+
+	for (i = 0; i < A2DP_POLICY_UPGRADE_SAMPLES - 1; i++)
+		ck_assert_int_eq(a2dp_policy_link_update(&link, A2DP_POLICY_QUALITY_GOOD), A2DP_POLICY_ACTION_NONE);
+	ck_assert_int_eq(a2dp_policy_link_update(&link, A2DP_POLICY_QUALITY_GOOD), A2DP_POLICY_ACTION_UPGRADE);
+	a2dp_policy_link_upgraded(&link);
+
+	/* failed upgrade doubles the upgrade period */
+	for (i = 0; i < A2DP_POLICY_DOWNGRADE_SAMPLES; i++)
+		a2dp_policy_link_update(&link, A2DP_POLICY_QUALITY_POOR);
+	ck_assert_uint_eq(link.upgrade_samples, A2DP_POLICY_UPGRADE_SAMPLES * 2);
+	for (i = 0; i < A2DP_POLICY_UPGRADE_SAMPLES * 2 - 1; i++)
+		ck_assert_int_eq(a2dp_policy_link_update(&link, A2DP_POLICY_QUALITY_GOOD), A2DP_POLICY_ACTION_NONE);
+	ck_assert_int_eq(a2dp_policy_link_update(&link, A2DP_POLICY_QUALITY_GOOD), A2DP_POLICY_ACTION_UPGRADE);
+	a2dp_policy_link_upgraded(&link);
+
+	/* successful upgrade restores the default period */
+	for (i = 0; i < A2DP_POLICY_UPGRADE_SAMPLES * 2; i++)
+		a2dp_policy_link_update(&link, A2DP_POLICY_QUALITY_GOOD);
+	ck_assert_uint_eq(link.upgrade_samples, A2DP_POLICY_UPGRADE_SAMPLES);
+
+} END_TEST
+
 static int test_cascade_free_transport_unref(struct ba_transport *t) {
 	return ba_transport_unref(t), 0;
 }
@@ -233,9 +1109,24 @@ int main(void) {
 
 	tcase_add_test(tc, test_ba_adapter);
 	tcase_add_test(tc, test_ba_device);
+	tcase_add_test(tc, test_ba_device_codec_cache);
 	tcase_add_test(tc, test_ba_transport);
+	tcase_add_test(tc, test_ba_transport_thread_manager);
+	tcase_add_test(tc, test_ba_transport_thread_signal);
+	tcase_add_test(tc, test_ba_transport_thread_bt_coutq);
 	tcase_add_test(tc, test_ba_transport_pcm_format);
 	tcase_add_test(tc, test_ba_transport_pcm_volume);
+	tcase_add_test(tc, test_ba_transport_pcm_volume_restore);
+	tcase_add_test(tc, test_ba_transport_pcm_format_select);
+	tcase_add_test(tc, test_ba_transport_pcm_handover);
+	tcase_add_test(tc, test_ba_transport_pcm_handover_select_codec_fail);
+	tcase_add_test(tc, test_ba_transport_pcm_block_frames);
+	tcase_add_test(tc, test_ba_transport_pcm_position);
+	tcase_add_test(tc, test_ba_transport_group);
+	tcase_add_test(tc, test_ba_device_warm);
+	tcase_add_test(tc, test_ba_transport_thread_stats);
+	tcase_add_test(tc, test_a2dp_policy_get_quality);
+	tcase_add_test(tc, test_a2dp_policy_link_update);
 	tcase_add_test(tc, test_cascade_free);
 
 	srunner_run_all(sr, CK_ENV);
@@ -0,0 +1,231 @@
+/*
+ * test-bap.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <check.h>
+
+#include "bap.h"
+
+START_TEST(test_bap_lc3_parse_configuration) {
+
+	static const uint8_t config_stereo[] = {
+		0x02, LC3_CONFIG_TYPE_SAMPLING, LC3_CONFIG_SAMPLING_48000,
+		0x02, LC3_CONFIG_TYPE_FRAME_DURATION, LC3_CONFIG_FRAME_DURATION_10,
+		0x05, LC3_CONFIG_TYPE_LOCATIONS, 0x03, 0x00, 0x00, 0x00,
+		0x03, LC3_CONFIG_TYPE_FRAME_LEN, 100, 0,
+		0x02, LC3_CONFIG_TYPE_FRAME_BLOCKS, 1,
+	};
+
+	static const uint8_t config_mono[] = {
+		0x02, LC3_CONFIG_TYPE_SAMPLING, LC3_CONFIG_SAMPLING_16000,
+		/* empty structure used as a padding */
+		0x00,
+		0x02, LC3_CONFIG_TYPE_FRAME_DURATION, LC3_CONFIG_FRAME_DURATION_7_5,
+		0x03, LC3_CONFIG_TYPE_FRAME_LEN, 30, 0,
+	};
+
+	struct bap_lc3_configuration conf;
+
+	ck_assert_int_eq(bap_lc3_parse_configuration(&conf, config_stereo, sizeof(config_stereo)), 0);
+	ck_assert_uint_eq(conf.sampling, 48000);
+	ck_assert_uint_eq(conf.frame_us, 10000);
+	ck_assert_uint_eq(conf.locations, BAP_LOCATION_FRONT_LEFT | BAP_LOCATION_FRONT_RIGHT);
+	ck_assert_uint_eq(conf.channels, 2);
+	ck_assert_uint_eq(conf.frame_len, 100);
+	ck_assert_uint_eq(conf.frame_blocks, 1);
+	ck_assert_uint_eq(bap_lc3_frame_samples(&conf), 480);
+	ck_assert_uint_eq(bap_lc3_sdu_size(&conf), 200);
+
+	ck_assert_int_eq(bap_lc3_parse_configuration(&conf, config_mono, sizeof(config_mono)), 0);
+	ck_assert_uint_eq(conf.sampling, 16000);
+	ck_assert_uint_eq(conf.frame_us, 7500);
+	ck_assert_uint_eq(conf.locations, 0);
+	ck_assert_uint_eq(conf.channels, 1);
+	ck_assert_uint_eq(conf.frame_blocks, 1);
+	ck_assert_uint_eq(bap_lc3_frame_samples(&conf), 120);
+
+} END_TEST
+
+START_TEST(test_bap_lc3_parse_configuration_invalid) {
+
+	static const uint8_t config_no_frame_len[] = {
+		0x02, LC3_CONFIG_TYPE_SAMPLING, LC3_CONFIG_SAMPLING_48000,
+		0x02, LC3_CONFIG_TYPE_FRAME_DURATION, LC3_CONFIG_FRAME_DURATION_10,
+	};
+
+	static const uint8_t config_truncated[] = {
+		0x02, LC3_CONFIG_TYPE_SAMPLING, LC3_CONFIG_SAMPLING_48000,
+		0x02, LC3_CONFIG_TYPE_FRAME_DURATION, LC3_CONFIG_FRAME_DURATION_10,
+		0x03, LC3_CONFIG_TYPE_FRAME_LEN, 100,
+	};
+
+	static const uint8_t config_44100[] = {
+		0x02, LC3_CONFIG_TYPE_SAMPLING, 0x07,
+		0x02, LC3_CONFIG_TYPE_FRAME_DURATION, LC3_CONFIG_FRAME_DURATION_10,
+		0x03, LC3_CONFIG_TYPE_FRAME_LEN, 100, 0,
+	};
+
+	static const uint8_t config_3ch[] = {
+		0x02, LC3_CONFIG_TYPE_SAMPLING, LC3_CONFIG_SAMPLING_48000,
+		0x02, LC3_CONFIG_TYPE_FRAME_DURATION, LC3_CONFIG_FRAME_DURATION_10,
+		0x05, LC3_CONFIG_TYPE_LOCATIONS, 0x07, 0x00, 0x00, 0x00,
+		0x03, LC3_CONFIG_TYPE_FRAME_LEN, 100, 0,
+	};
+
+	static const uint8_t config_frame_len_short[] = {
+		0x02, LC3_CONFIG_TYPE_SAMPLING, LC3_CONFIG_SAMPLING_48000,
+		0x02, LC3_CONFIG_TYPE_FRAME_DURATION, LC3_CONFIG_FRAME_DURATION_10,
+		0x03, LC3_CONFIG_TYPE_FRAME_LEN, 19, 0,
+	};
+
+	static const uint8_t config_frame_len_long[] = {
+		0x02, LC3_CONFIG_TYPE_SAMPLING, LC3_CONFIG_SAMPLING_48000,
+		0x02, LC3_CONFIG_TYPE_FRAME_DURATION, LC3_CONFIG_FRAME_DURATION_10,
+		0x03, LC3_CONFIG_TYPE_FRAME_LEN, 0x91, 0x01,
+	};
+
+	struct bap_lc3_configuration conf = { .sampling = 1234 };
+
+	errno = 0;
+	ck_assert_int_eq(bap_lc3_parse_configuration(&conf,
+				config_no_frame_len, sizeof(config_no_frame_len)), -1);
+	ck_assert_int_eq(errno, EINVAL);
+	ck_assert_int_eq(bap_lc3_parse_configuration(&conf,
+				config_truncated, sizeof(config_truncated)), -1);
+	ck_assert_int_eq(bap_lc3_parse_configuration(&conf,
+				config_44100, sizeof(config_44100)), -1);
+	ck_assert_int_eq(bap_lc3_parse_configuration(&conf,
+				config_3ch, sizeof(config_3ch)), -1);
+	errno = 0;
+	ck_assert_int_eq(bap_lc3_parse_configuration(&conf,
+				config_frame_len_short, sizeof(config_frame_len_short)), -1);
+	ck_assert_int_eq(errno, EINVAL);
+	errno = 0;
+	ck_assert_int_eq(bap_lc3_parse_configuration(&conf,
+				config_frame_len_long, sizeof(config_frame_len_long)), -1);
+	ck_assert_int_eq(errno, EINVAL);
+
+	/* configuration shall not be modified on error */
+	ck_assert_uint_eq(conf.sampling, 1234);
+
+} END_TEST
+
+START_TEST(test_bap_lc3_select_configuration) {
+
+	static const uint8_t caps_stereo[] = {
+		0x03, LC3_CAPS_TYPE_SAMPLING,
+			LC3_CAPS_SAMPLING_16000 | LC3_CAPS_SAMPLING_48000, 0x00,
+		0x02, LC3_CAPS_TYPE_FRAME_DURATION,
+			LC3_CAPS_FRAME_DURATION_7_5 | LC3_CAPS_FRAME_DURATION_10,
+		0x02, LC3_CAPS_TYPE_CHANNELS, LC3_CAPS_CHANNELS_1 | LC3_CAPS_CHANNELS_2,
+		0x05, LC3_CAPS_TYPE_FRAME_LEN, 40, 0, 120, 0,
+	};
+
+	static const uint8_t caps_mono[] = {
+		0x03, LC3_CAPS_TYPE_SAMPLING, LC3_CAPS_SAMPLING_16000, 0x00,
+		0x02, LC3_CAPS_TYPE_FRAME_DURATION, LC3_CAPS_FRAME_DURATION_7_5,
+		/* frame length range which excludes the preset value */
+		0x05, LC3_CAPS_TYPE_FRAME_LEN, 36, 0, 60, 0,
+	};
+
+	struct bap_lc3_configuration conf;
+	uint8_t buffer[32];
+	ssize_t len;
+
+	len = bap_lc3_select_configuration(caps_stereo, sizeof(caps_stereo),
+			BAP_LOCATION_FRONT_LEFT | BAP_LOCATION_FRONT_RIGHT, buffer, sizeof(buffer));
+	ck_assert_int_gt(len, 0);
+	ck_assert_int_eq(bap_lc3_parse_configuration(&conf, buffer, len), 0);
+	ck_assert_uint_eq(conf.sampling, 48000);
+	ck_assert_uint_eq(conf.frame_us, 10000);
+	ck_assert_uint_eq(conf.channels, 2);
+	ck_assert_uint_eq(conf.frame_len, 100);
+
+	/* only one location supported by the remote device */
+	len = bap_lc3_select_configuration(caps_stereo, sizeof(caps_stereo),
+			BAP_LOCATION_FRONT_RIGHT, buffer, sizeof(buffer));
+	ck_assert_int_gt(len, 0);
+	ck_assert_int_eq(bap_lc3_parse_configuration(&conf, buffer, len), 0);
+	ck_assert_uint_eq(conf.locations, BAP_LOCATION_FRONT_RIGHT);
+	ck_assert_uint_eq(conf.channels, 1);
+
+	len = bap_lc3_select_configuration(caps_mono, sizeof(caps_mono),
+			BAP_LOCATION_FRONT_LEFT | BAP_LOCATION_FRONT_RIGHT, buffer, sizeof(buffer));
+	ck_assert_int_gt(len, 0);
+	ck_assert_int_eq(bap_lc3_parse_configuration(&conf, buffer, len), 0);
+	ck_assert_uint_eq(conf.sampling, 16000);
+	ck_assert_uint_eq(conf.frame_us, 7500);
+	ck_assert_uint_eq(conf.locations, BAP_LOCATION_FRONT_LEFT);
+	ck_assert_uint_eq(conf.channels, 1);
+	ck_assert_uint_eq(conf.frame_len, 36);
+
+	/* mono stream without channel allocation */
+	len = bap_lc3_select_configuration(caps_mono, sizeof(caps_mono),
+			0, buffer, sizeof(buffer));
+	ck_assert_int_gt(len, 0);
+	ck_assert_int_eq(bap_lc3_parse_configuration(&conf, buffer, len), 0);
+	ck_assert_uint_eq(conf.locations, 0);
+	ck_assert_uint_eq(conf.channels, 1);
+
+	errno = 0;
+	ck_assert_int_eq(bap_lc3_select_configuration(caps_stereo, sizeof(caps_stereo),
+				BAP_LOCATION_FRONT_LEFT, buffer, 4), -1);
+	ck_assert_int_eq(errno, ENOBUFS);
+
+} END_TEST
+
+START_TEST(test_bap_lc3_select_configuration_invalid) {
+
+	static const uint8_t caps_44100[] = {
+		0x03, LC3_CAPS_TYPE_SAMPLING, LC3_CAPS_SAMPLING_44100, 0x00,
+		0x02, LC3_CAPS_TYPE_FRAME_DURATION, LC3_CAPS_FRAME_DURATION_10,
+	};
+
+	static const uint8_t caps_truncated[] = {
+		0x03, LC3_CAPS_TYPE_SAMPLING, LC3_CAPS_SAMPLING_48000, 0x00,
+		0x05, LC3_CAPS_TYPE_FRAME_LEN, 40, 0,
+	};
+
+	uint8_t buffer[32];
+
+	errno = 0;
+	ck_assert_int_eq(bap_lc3_select_configuration(caps_44100, sizeof(caps_44100),
+				BAP_LOCATION_FRONT_LEFT, buffer, sizeof(buffer)), -1);
+	ck_assert_int_eq(errno, ENOTSUP);
+
+	errno = 0;
+	ck_assert_int_eq(bap_lc3_select_configuration(caps_truncated, sizeof(caps_truncated),
+				BAP_LOCATION_FRONT_LEFT, buffer, sizeof(buffer)), -1);
+	ck_assert_int_eq(errno, EINVAL);
+
+} END_TEST
+
+int main(void) {
+
+	Suite *s = suite_create(__FILE__);
+	TCase *tc = tcase_create(__FILE__);
+	SRunner *sr = srunner_create(s);
+
+	suite_add_tcase(s, tc);
+
+	tcase_add_test(tc, test_bap_lc3_parse_configuration);
+	tcase_add_test(tc, test_bap_lc3_parse_configuration_invalid);
+	tcase_add_test(tc, test_bap_lc3_select_configuration);
+	tcase_add_test(tc, test_bap_lc3_select_configuration_invalid);
+
+	srunner_run_all(sr, CK_ENV);
+	int nf = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return nf == 0 ? 0 : 1;
+}
@@ -0,0 +1,182 @@
+/*
+ * test-bt-uring.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include "bt-uring.h"
+#include "shared/defs.h"
+#include "shared/rt.h"
+
+struct test_uring {
+	int bt_fds[2];
+	int event_fd;
+	struct bt_uring *u;
+};
+
+static void test_uring_init(struct test_uring *tu) {
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, tu->bt_fds), 0);
+	ck_assert_int_ne(tu->event_fd = eventfd(0, EFD_NONBLOCK), -1);
+	ck_assert_ptr_ne(tu->u = bt_uring_new(tu->bt_fds[0], tu->event_fd, 64), NULL);
+}
+
+static void test_uring_free(struct test_uring *tu) {
+	bt_uring_free(tu->u);
+	close(tu->bt_fds[0]);
+	if (tu->bt_fds[1] != -1)
+		close(tu->bt_fds[1]);
+	close(tu->event_fd);
+}
+
+START_TEST(test_bt_uring_recv) {
+
+	struct test_uring tu;
+	test_uring_init(&tu);
+
+	const struct msghdr *msg;
+	const char data[] = "BlueALSA";
+
+	/* nothing has been received yet */
+	ck_assert_int_eq(bt_uring_wait(tu.u, -1, 10), 0);
+	ck_assert_int_eq(bt_uring_recv(tu.u, &msg), -1);
+	ck_assert_int_eq(errno, EAGAIN);
+
+	ck_assert_int_eq(write(tu.bt_fds[1], data, sizeof(data)), sizeof(data));
+	ck_assert_int_eq(bt_uring_wait(tu.u, -1, -1), BT_URING_EVENT_RECV);
+	/* completed receive shall be reported until it is consumed */
+	ck_assert_int_eq(bt_uring_wait(tu.u, -1, -1), BT_URING_EVENT_RECV);
+	ck_assert_int_eq(bt_uring_recv(tu.u, &msg), sizeof(data));
+	ck_assert_int_eq(memcmp(msg->msg_iov->iov_base, data, sizeof(data)), 0);
+	ck_assert_int_eq(bt_uring_recv(tu.u, &msg), -1);
+	ck_assert_int_eq(errno, EAGAIN);
+
+	/* closed connection shall be reported as zero-length receive */
+	close(tu.bt_fds[1]);
+	tu.bt_fds[1] = -1;
+	ck_assert_int_eq(bt_uring_wait(tu.u, -1, -1), BT_URING_EVENT_RECV);
+	ck_assert_int_eq(bt_uring_recv(tu.u, &msg), 0);
+
+	test_uring_free(&tu);
+
+} END_TEST
+
+START_TEST(test_bt_uring_signal) {
+
+	struct test_uring tu;
+	test_uring_init(&tu);
+
+	eventfd_t value;
+
+	ck_assert_int_eq(eventfd_write(tu.event_fd, 1), 0);
+	ck_assert_int_eq(bt_uring_wait(tu.u, -1, -1), BT_URING_EVENT_SIGNAL);
+	ck_assert_int_eq(eventfd_read(tu.event_fd, &value), 0);
+	ck_assert_int_eq(value, 1);
+
+	/* drained event file descriptor shall not wake up the wait */
+	ck_assert_int_eq(bt_uring_wait(tu.u, -1, 10), 0);
+
+	test_uring_free(&tu);
+
+} END_TEST
+
+START_TEST(test_bt_uring_timer) {
+
+	struct test_uring tu;
+	test_uring_init(&tu);
+
+	const struct itimerspec ts = { .it_value.tv_nsec = 10000000 };
+	int timer_fd;
+
+	ck_assert_int_ne(timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK), -1);
+	ck_assert_int_eq(timerfd_settime(timer_fd, 0, &ts, NULL), 0);
+	ck_assert_int_eq(bt_uring_wait(tu.u, timer_fd, -1), BT_URING_EVENT_TIMER);
+
+	close(timer_fd);
+	test_uring_free(&tu);
+
+} END_TEST
+
+static void *test_bt_uring_cancel_thread(void *userdata) {
+
+	struct test_uring *tu = userdata;
+	eventfd_t value;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+	/* mimic the IO thread loop, see the io_poll_and_read_bt_uring() */
+	for (;;) {
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		pthread_testcancel();
+		int events = bt_uring_wait(tu->u, -1, -1);
+		pthread_testcancel();
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		if (events & BT_URING_EVENT_SIGNAL)
+			eventfd_read(tu->event_fd, &value);
+	}
+
+	return NULL;
+}
+
+START_TEST(test_bt_uring_cancel) {
+
+	struct test_uring tu;
+	test_uring_init(&tu);
+
+	struct timespec ts0, ts, diff;
+	pthread_t thread;
+
+	ck_assert_int_eq(pthread_create(&thread, NULL,
+				PTHREAD_ROUTINE(test_bt_uring_cancel_thread), &tu), 0);
+	/* make sure that the thread is blocked in the wait */
+	usleep(50000);
+
+	gettimestamp(&ts0);
+	ck_assert_int_eq(pthread_cancel(thread), 0);
+	ck_assert_int_eq(eventfd_write(tu.event_fd, 1), 0);
+	ck_assert_int_eq(pthread_join(thread, NULL), 0);
+	gettimestamp(&ts);
+
+	/* the wake-up shall terminate the thread without any delay */
+	difftimespec(&ts0, &ts, &diff);
+	ck_assert_int_eq(diff.tv_sec, 0);
+	ck_assert_int_lt(diff.tv_nsec, 20000000);
+
+	test_uring_free(&tu);
+
+} END_TEST
+
+int main(void) {
+
+	Suite *s = suite_create(__FILE__);
+	TCase *tc = tcase_create(__FILE__);
+	SRunner *sr = srunner_create(s);
+
+	suite_add_tcase(s, tc);
+
+	tcase_add_test(tc, test_bt_uring_recv);
+	tcase_add_test(tc, test_bt_uring_signal);
+	tcase_add_test(tc, test_bt_uring_timer);
+	tcase_add_test(tc, test_bt_uring_cancel);
+
+	srunner_run_all(sr, CK_ENV);
+	int nf = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return nf == 0 ? 0 : 1;
+}
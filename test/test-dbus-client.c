@@ -0,0 +1,341 @@
+/*
+ * test-dbus-client.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <libgen.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <check.h>
+#include <dbus/dbus.h>
+
+#include "shared/dbus-client.h"
+#include "shared/defs.h"
+
+#include "inc/server.inc"
+
+#define PCM_A2DP_PLAYBACK "/org/bluealsa/hci0/dev_12_34_56_78_9A_BC/a2dpsrc/sink"
+#define PCM_HFP_PLAYBACK "/org/bluealsa/hci0/dev_12_34_56_78_9A_BC/hfpag/sink"
+#define PCM_HFP_CAPTURE "/org/bluealsa/hci0/dev_12_34_56_78_9A_BC/hfpag/source"
+
+static pid_t test_dbus_server_spawn(struct ba_dbus_ctx *ctx) {
+
+	const char *service = "test";
+	DBusError err = DBUS_ERROR_INIT;
+	pid_t pid;
+
+	if ((pid = spawn_bluealsa_server(service, 5, true, false, true, false, true)) == -1)
+		return -1;
+
+	if (!bluealsa_dbus_connection_ctx_init(ctx, "org.bluealsa.test", &err)) {
+		fprintf(stderr, "D-Bus context: %s\n", err.message);
+		dbus_error_free(&err);
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+		return -1;
+	}
+
+	return pid;
+}
+
+static void test_dbus_server_kill(pid_t pid, struct ba_dbus_ctx *ctx) {
+	bluealsa_dbus_connection_ctx_free(ctx);
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+}
+
+START_TEST(test_open_pcms_hfp) {
+
+	struct ba_dbus_ctx ctx;
+	pid_t pid;
+
+	ck_assert_int_ne(pid = test_dbus_server_spawn(&ctx), -1);
+
+	const char *paths[] = { PCM_HFP_PLAYBACK, PCM_HFP_CAPTURE };
+	int fds_pcm[ARRAYSIZE(paths)];
+	int fds_pcm_ctrl[ARRAYSIZE(paths)];
+	DBusError err = DBUS_ERROR_INIT;
+
+	/* speaker and microphone are opened with a single call */
+	ck_assert_int_eq(bluealsa_dbus_open_pcms(&ctx, paths, ARRAYSIZE(paths),
+				fds_pcm, fds_pcm_ctrl, &err), TRUE);
+
+	size_t i;
+	for (i = 0; i < ARRAYSIZE(paths); i++) {
+		ck_assert_int_ne(fds_pcm[i], -1);
+		ck_assert_int_ne(fds_pcm_ctrl[i], -1);
+	}
+
+	/* both PCMs are claimed by the batch */
+	ck_assert_int_eq(bluealsa_dbus_open_pcm(&ctx, PCM_HFP_CAPTURE,
+				&fds_pcm[0], &fds_pcm_ctrl[0], &err), FALSE);
+	ck_assert_ptr_ne(strstr(err.message, strerror(EBUSY)), NULL);
+	dbus_error_free(&err);
+
+	for (i = 0; i < ARRAYSIZE(paths); i++) {
+		close(fds_pcm[i]);
+		close(fds_pcm_ctrl[i]);
+	}
+
+	test_dbus_server_kill(pid, &ctx);
+
+} END_TEST
+
+START_TEST(test_open_pcms_partial_failure) {
+
+	struct ba_dbus_ctx ctx;
+	pid_t pid;
+
+	ck_assert_int_ne(pid = test_dbus_server_spawn(&ctx), -1);
+
+	DBusError err = DBUS_ERROR_INIT;
+	int fd_pcm, fd_pcm_ctrl;
+
+	/* claim the HFP microphone, so the batch will fail */
+	ck_assert_int_eq(bluealsa_dbus_open_pcm(&ctx, PCM_HFP_CAPTURE,
+				&fd_pcm, &fd_pcm_ctrl, &err), TRUE);
+
+	const char *paths[] = { PCM_A2DP_PLAYBACK, PCM_HFP_CAPTURE };
+	int fds_pcm[ARRAYSIZE(paths)];
+	int fds_pcm_ctrl[ARRAYSIZE(paths)];
+
+	ck_assert_int_eq(bluealsa_dbus_open_pcms(&ctx, paths, ARRAYSIZE(paths),
+				fds_pcm, fds_pcm_ctrl, &err), FALSE);
+	ck_assert_ptr_ne(strstr(err.message, strerror(EBUSY)), NULL);
+	dbus_error_free(&err);
+
+	/* PCM opened by the failed batch shall be released */
+	dbus_bool_t rv = FALSE;
+	size_t i;
+	for (i = 0; !rv && i < 20; i++) {
+		if ((rv = bluealsa_dbus_open_pcm(&ctx, PCM_A2DP_PLAYBACK,
+						&fds_pcm[0], &fds_pcm_ctrl[0], &err)) == FALSE) {
+			dbus_error_free(&err);
+			usleep(50000);
+		}
+	}
+	ck_assert_int_eq(rv, TRUE);
+
+	close(fds_pcm[0]);
+	close(fds_pcm_ctrl[0]);
+	close(fd_pcm);
+	close(fd_pcm_ctrl);
+
+	/* unknown PCM is reported before anything is opened */
+	paths[1] = "/org/bluealsa/hci0/dev_12_34_56_78_9A_BC/a2dpsnk/source";
+	ck_assert_int_eq(bluealsa_dbus_open_pcms(&ctx, paths, ARRAYSIZE(paths),
+				fds_pcm, fds_pcm_ctrl, &err), FALSE);
+	ck_assert_str_eq(err.name, DBUS_ERROR_UNKNOWN_OBJECT);
+	dbus_error_free(&err);
+
+	test_dbus_server_kill(pid, &ctx);
+
+} END_TEST
+
+/**
+ * Find PCM with the given path in the PCM list. */
+static const struct ba_pcm *test_pcm_find(const struct ba_pcm *pcms,
+		size_t count, const char *path) {
+	size_t i;
+	for (i = 0; i < count; i++)
+		if (strcmp(pcms[i].pcm_path, path) == 0)
+			return &pcms[i];
+	return NULL;
+}
+
+START_TEST(test_pcm_cache_update) {
+
+	struct ba_dbus_ctx ctx;
+	pid_t pid;
+
+	ck_assert_int_ne(pid = test_dbus_server_spawn(&ctx), -1);
+
+	DBusError err = DBUS_ERROR_INIT;
+	ck_assert_int_eq(bluealsa_dbus_pcm_cache_enable(&ctx, &err), TRUE);
+
+	struct ba_pcm *pcms;
+	size_t count;
+	const struct ba_pcm *tmp;
+
+	ck_assert_int_eq(bluealsa_dbus_get_pcms(&ctx, &pcms, &count, &err), TRUE);
+	ck_assert_ptr_ne(tmp = test_pcm_find(pcms, count, PCM_A2DP_PLAYBACK), NULL);
+
+	struct ba_pcm pcm = *tmp;
+	const unsigned int volume = pcm.volume.ch1_volume;
+	free(pcms);
+
+	pcm.volume.ch1_volume = pcm.volume.ch2_volume = volume / 2;
+	ck_assert_int_eq(bluealsa_dbus_pcm_update(&ctx, &pcm, BLUEALSA_PCM_VOLUME, &err), TRUE);
+
+	/* cached PCM shall be updated with the PropertiesChanged signal */
+	size_t i;
+	for (i = 0; i < 20; i++) {
+		usleep(50000);
+		bluealsa_dbus_connection_dispatch(&ctx);
+		ck_assert_int_eq(bluealsa_dbus_get_pcms(&ctx, &pcms, &count, &err), TRUE);
+		ck_assert_ptr_ne(tmp = test_pcm_find(pcms, count, PCM_A2DP_PLAYBACK), NULL);
+		pcm = *tmp;
+		free(pcms);
+		if (pcm.volume.ch1_volume != volume)
+			break;
+	}
+	ck_assert_int_ne(pcm.volume.ch1_volume, volume);
+
+	/* cached state shall match the state of the service */
+	bluealsa_dbus_pcm_cache_invalidate(&ctx);
+	ck_assert_int_eq(bluealsa_dbus_get_pcms(&ctx, &pcms, &count, &err), TRUE);
+	ck_assert_ptr_ne(tmp = test_pcm_find(pcms, count, PCM_A2DP_PLAYBACK), NULL);
+	ck_assert_uint_eq(tmp->volume.raw, pcm.volume.raw);
+	free(pcms);
+
+	test_dbus_server_kill(pid, &ctx);
+
+} END_TEST
+
+START_TEST(test_pcm_cache_add_remove) {
+
+	struct ba_dbus_ctx ctx;
+	DBusError err = DBUS_ERROR_INIT;
+	pid_t pid;
+
+	/* in the fuzzing mode PCMs are added and removed one by one */
+	ck_assert_int_ne(pid = spawn_bluealsa_server("test", 3, false, true, true, false, false), -1);
+	ck_assert_int_eq(bluealsa_dbus_connection_ctx_init(&ctx, "org.bluealsa.test", &err), TRUE);
+	ck_assert_int_eq(bluealsa_dbus_pcm_cache_enable(&ctx, &err), TRUE);
+
+	struct ba_pcm *pcms;
+	size_t count = 0, count_max = 0;
+	size_t i;
+
+	for (i = 0; i < 150; i++) {
+		usleep(50000);
+		bluealsa_dbus_connection_dispatch(&ctx);
+		/* the service has terminated and the cache has been dropped */
+		if (!bluealsa_dbus_get_pcms(&ctx, &pcms, &count, &err)) {
+			dbus_error_free(&err);
+			break;
+		}
+		free(pcms);
+		if (count > count_max)
+			count_max = count;
+		if (count_max == 2 && count == 0)
+			break;
+	}
+
+	ck_assert_uint_eq(count_max, 2);
+	ck_assert_uint_eq(count, 0);
+
+	test_dbus_server_kill(pid, &ctx);
+
+} END_TEST
+
+START_TEST(test_pcm_ctrl_query) {
+
+	struct ba_dbus_ctx ctx;
+	pid_t pid;
+
+	ck_assert_int_ne(pid = test_dbus_server_spawn(&ctx), -1);
+
+	DBusError err = DBUS_ERROR_INIT;
+	int fd_pcm, fd_pcm_ctrl;
+
+	ck_assert_int_eq(bluealsa_dbus_open_pcm(&ctx, PCM_A2DP_PLAYBACK,
+				&fd_pcm, &fd_pcm_ctrl, &err), TRUE);
+
+	struct ba_pcm_ctrl_status status;
+	struct ba_pcm_ctrl_position position;
+
+	/* binary queries interleaved with text commands */
+	ck_assert_int_eq(bluealsa_dbus_pcm_ctrl_get_status(fd_pcm_ctrl, &status, &err), TRUE);
+	ck_assert_int_eq(status.command, BA_PCM_CTRL_QUERY_STATUS);
+	ck_assert_int_eq(bluealsa_dbus_pcm_ctrl_send_pause(fd_pcm_ctrl, &err), TRUE);
+	ck_assert_int_eq(bluealsa_dbus_pcm_ctrl_get_position(fd_pcm_ctrl, &position, &err), TRUE);
+	ck_assert_int_eq(position.command, BA_PCM_CTRL_QUERY_POSITION);
+	ck_assert_uint_eq(position.id, status.id + 1);
+	ck_assert_int_eq(bluealsa_dbus_pcm_ctrl_send_resume(fd_pcm_ctrl, &err), TRUE);
+
+	close(fd_pcm);
+	close(fd_pcm_ctrl);
+
+	test_dbus_server_kill(pid, &ctx);
+
+} END_TEST
+
+START_TEST(test_pcm_ctrl_query_timeout) {
+
+	int fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, fds), 0);
+
+	/* text reply and binary reply to some other query */
+	const struct ba_pcm_ctrl_status stale = {
+		.command = BA_PCM_CTRL_QUERY_STATUS, .id = 0xFFFFFFFF };
+	ck_assert_int_eq(write(fds[1], "OK", 2), 2);
+	ck_assert_int_eq(write(fds[1], &stale, sizeof(stale)), sizeof(stale));
+
+	DBusError err = DBUS_ERROR_INIT;
+	struct ba_pcm_ctrl_status status;
+
+	/* stale replies are discarded and the query times out */
+	ck_assert_int_eq(bluealsa_dbus_pcm_ctrl_get_status(fds[0], &status, &err), FALSE);
+	ck_assert_int_eq(errno, ETIMEDOUT);
+	dbus_error_free(&err);
+
+	/* text command skips binary reply for the timed out query */
+	ck_assert_int_eq(write(fds[1], &stale, sizeof(stale)), sizeof(stale));
+	ck_assert_int_eq(write(fds[1], "OK", 2), 2);
+	ck_assert_int_eq(bluealsa_dbus_pcm_ctrl_send_drop(fds[0], &err), TRUE);
+
+	/* server without binary protocol support */
+	ck_assert_int_eq(write(fds[1], "Invalid", 7), 7);
+	ck_assert_int_eq(bluealsa_dbus_pcm_ctrl_get_status(fds[0], &status, &err), FALSE);
+	ck_assert_int_eq(errno, ENOTSUP);
+	dbus_error_free(&err);
+
+	close(fds[0]);
+	close(fds[1]);
+
+} END_TEST
+
+int main(int argc, char *argv[]) {
+	(void)argc;
+
+	/* test-dbus-client and bluealsa-mock shall be placed in the same directory */
+	bluealsa_mock_path = dirname(strdup(argv[0]));
+
+	Suite *s = suite_create(__FILE__);
+	TCase *tc = tcase_create(__FILE__);
+	SRunner *sr = srunner_create(s);
+
+	suite_add_tcase(s, tc);
+	tcase_set_timeout(tc, 10);
+
+	tcase_add_test(tc, test_open_pcms_hfp);
+	tcase_add_test(tc, test_open_pcms_partial_failure);
+	tcase_add_test(tc, test_pcm_cache_update);
+	tcase_add_test(tc, test_pcm_cache_add_remove);
+	tcase_add_test(tc, test_pcm_ctrl_query);
+	tcase_add_test(tc, test_pcm_ctrl_query_timeout);
+
+	srunner_run_all(sr, CK_ENV);
+	int nf = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return nf == 0 ? 0 : 1;
+}
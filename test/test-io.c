@@ -12,11 +12,14 @@
 # include <config.h>
 #endif
 
+#include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <libgen.h>
 #include <poll.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -43,12 +46,14 @@
 #include "bluealsa-dbus.h"
 #include "bluealsa.h"
 #include "bluez.h"
+#include "codec-plugin.h"
 #include "hfp.h"
 #include "rtp.h"
 #include "sco.h"
 #include "utils.h"
 #include "shared/defs.h"
 #include "shared/log.h"
+#include "shared/rt.h"
 
 #include "../src/a2dp.c"
 #include "../src/a2dp-sbc.c"
@@ -70,7 +75,11 @@
 #if ENABLE_MPEG
 # include "../src/a2dp-mpeg.c"
 #endif
+#include "../src/a2dp-plugin.c"
 #include "../src/ba-transport.c"
+#if ENABLE_LE_AUDIO
+# include "../src/bap-lc3.c"
+#endif
 #include "inc/sine.inc"
 
 unsigned int bluealsa_dbus_pcm_register(struct ba_transport_pcm *pcm, GError **error) {
@@ -79,6 +88,12 @@ void bluealsa_dbus_pcm_update(struct ba_transport_pcm *pcm, unsigned int mask) {
 	debug("%s: %p %#x", __func__, (void *)pcm, mask); }
 void bluealsa_dbus_pcm_unregister(struct ba_transport_pcm *pcm) {
 	debug("%s: %p", __func__, (void *)pcm); }
+int bluealsa_dbus_pcm_handover_detach(struct ba_transport_pcm *pcm,
+		struct ba_transport_pcm_handover *h) {
+	debug("%s: %p", __func__, (void *)pcm); (void)h; return errno = ENOTSUP, -1; }
+int bluealsa_dbus_pcm_handover_attach(struct ba_transport_pcm *pcm,
+		struct ba_transport_pcm_handover *h) {
+	debug("%s: %p", __func__, (void *)pcm); (void)h; return errno = ENOTSUP, -1; }
 struct ba_rfcomm *ba_rfcomm_new(struct ba_transport *sco, int fd) {
 	debug("%s: %p", __func__, (void *)sco); (void)fd; return NULL; }
 void ba_rfcomm_destroy(struct ba_rfcomm *r) {
@@ -90,6 +105,62 @@ bool bluez_a2dp_set_configuration(const char *current_dbus_sep_path,
 	debug("%s: %s", __func__, current_dbus_sep_path); (void)sep;
 	(void)error; return false; }
 
+#if defined(__GLIBC__)
+/**
+ * Count memory allocations made by the IO thread under test.
+ *
+ * Only threads with the tracking flag set are taken into account, so
+ * allocations made by the test harness itself do not disturb the counter. */
+# define TEST_ALLOC_COUNTER 1
+static atomic_uint test_alloc_count = 0;
+static __thread bool test_alloc_track = false;
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *malloc(size_t size) {
+	if (test_alloc_track)
+		atomic_fetch_add_explicit(&test_alloc_count, 1, memory_order_relaxed);
+	return __libc_malloc(size); }
+void *calloc(size_t nmemb, size_t size) {
+	if (test_alloc_track)
+		atomic_fetch_add_explicit(&test_alloc_count, 1, memory_order_relaxed);
+	return __libc_calloc(nmemb, size); }
+void *realloc(void *ptr, size_t size) {
+	if (test_alloc_track)
+		atomic_fetch_add_explicit(&test_alloc_count, 1, memory_order_relaxed);
+	return __libc_realloc(ptr, size); }
+#endif
+
+/**
+ * Number of allocations made by the IO thread after the first packet
+ * (or the first chunk of decoded PCM) has been received by the dump
+ * thread. At this point the IO thread setup shall be completed. */
+static unsigned int test_alloc_steady_state = 0;
+
+static unsigned int test_alloc_count_get(void) {
+#if TEST_ALLOC_COUNTER
+	return atomic_load_explicit(&test_alloc_count, memory_order_relaxed);
+#else
+	return 0;
+#endif
+}
+
+static void *test_io_thread_alloc_track(struct ba_transport_thread *th,
+		void *(*routine)(struct ba_transport_thread *)) {
+#if TEST_ALLOC_COUNTER
+	test_alloc_track = true;
+#endif
+	return routine(th);
+}
+
+static void *test_a2dp_sbc_enc_thread(struct ba_transport_thread *th) {
+	return test_io_thread_alloc_track(th, a2dp_sbc_enc_thread);
+}
+
+static void *test_a2dp_sbc_dec_thread(struct ba_transport_thread *th) {
+	return test_io_thread_alloc_track(th, a2dp_sbc_dec_thread);
+}
+
 static const a2dp_sbc_t config_sbc_44100_stereo = {
 	.frequency = SBC_SAMPLING_FREQ_44100,
 	.channel_mode = SBC_CHANNEL_MODE_STEREO,
@@ -118,6 +189,14 @@ static const a2dp_aac_t config_aac_44100_stereo = {
 	AAC_INIT_BITRATE(0xFFFF)
 };
 
+__attribute__ ((unused))
+static const a2dp_aac_t config_aac_eld_44100_stereo = {
+	.object_type = AAC_OBJECT_TYPE_MPEG4_AAC_ELD2,
+	AAC_INIT_FREQUENCY(AAC_SAMPLING_FREQ_44100)
+	.channels = AAC_CHANNELS_2,
+	AAC_INIT_BITRATE(256000)
+};
+
 __attribute__ ((unused))
 static const a2dp_aptx_t config_aptx_44100_stereo = {
 	.info = A2DP_SET_VENDOR_ID_CODEC_ID(APTX_VENDOR_ID, APTX_CODEC_ID),
@@ -125,6 +204,13 @@ static const a2dp_aptx_t config_aptx_44100_stereo = {
 	.channel_mode = APTX_CHANNEL_MODE_STEREO,
 };
 
+__attribute__ ((unused))
+static const a2dp_aptx_ll_t config_aptx_ll_48000_stereo = {
+	.aptx.info = A2DP_SET_VENDOR_ID_CODEC_ID(APTX_LL_VENDOR_ID, APTX_LL_CODEC_ID),
+	.aptx.frequency = APTX_SAMPLING_FREQ_48000,
+	.aptx.channel_mode = APTX_CHANNEL_MODE_STEREO,
+};
+
 __attribute__ ((unused))
 static const a2dp_aptx_hd_t config_aptx_hd_44100_stereo = {
 	.aptx.info = A2DP_SET_VENDOR_ID_CODEC_ID(APTX_HD_VENDOR_ID, APTX_HD_CODEC_ID),
@@ -147,6 +233,13 @@ static const a2dp_ldac_t config_ldac_44100_stereo = {
 	.channel_mode = LDAC_CHANNEL_MODE_STEREO,
 };
 
+__attribute__ ((unused))
+static const a2dp_ldac_t config_ldac_96000_stereo = {
+	.info = A2DP_SET_VENDOR_ID_CODEC_ID(LDAC_VENDOR_ID, LDAC_CODEC_ID),
+	.frequency = LDAC_SAMPLING_FREQ_96000,
+	.channel_mode = LDAC_CHANNEL_MODE_STEREO,
+};
+
 static struct ba_adapter *adapter = NULL;
 static struct ba_device *device1 = NULL;
 static struct ba_device *device2 = NULL;
@@ -260,6 +353,23 @@ static void bt_data_push(uint8_t *data, size_t len) {
 	bt_data_end = bt_data_end->next;
 }
 
+/**
+ * Concatenate payloads of the generated BT data, skipping the given number
+ * of header bytes in every packet. */
+__attribute__ ((unused))
+static size_t bt_data_reassemble(size_t headers_len, uint8_t *buffer, size_t size) {
+	struct bt_data *bt_data_head = &bt_data;
+	size_t len = 0;
+	for (; bt_data_head != bt_data_end; bt_data_head = bt_data_head->next) {
+		ck_assert_uint_gt(bt_data_head->len, headers_len);
+		const size_t payload_len = bt_data_head->len - headers_len;
+		ck_assert_uint_le(len + payload_len, size);
+		memcpy(buffer + len, bt_data_head->data + headers_len, payload_len);
+		len += payload_len;
+	}
+	return len;
+}
+
 static void bt_data_write(int fd) {
 	struct bt_data *bt_data_head = &bt_data;
 	struct pollfd pfds[] = {{ fd, POLLOUT, 0 }};
@@ -289,6 +399,8 @@ static void *test_io_thread_a2dp_dump_bt(struct ba_transport_thread *th) {
 	pthread_cleanup_push(PTHREAD_CLEANUP(ba_transport_thread_cleanup), th);
 
 	struct pollfd pfds[] = {{ th->bt_fd, POLLIN, 0 }};
+	unsigned int allocs = 0;
+	size_t packets = 0;
 	uint8_t buffer[1024];
 	ssize_t len;
 
@@ -301,6 +413,9 @@ static void *test_io_thread_a2dp_dump_bt(struct ba_transport_thread *th) {
 			continue;
 		}
 
+		if (packets++ == 0)
+			allocs = test_alloc_count_get();
+
 		bt_data_push(buffer, len);
 
 		char label[35];
@@ -309,6 +424,9 @@ static void *test_io_thread_a2dp_dump_bt(struct ba_transport_thread *th) {
 
 	}
 
+	test_alloc_steady_state = test_alloc_count_get() - allocs;
+	debug("IO thread steady-state allocations: %u", test_alloc_steady_state);
+
 	/* signal termination and wait for cancellation */
 	test_a2dp_start_terminate_timer(0);
 	sleep(3600);
@@ -330,6 +448,7 @@ static void *test_io_thread_a2dp_dump_pcm(struct ba_transport_thread *th) {
 
 	struct pollfd pfds[] = {{ t_a2dp_pcm->fd, POLLIN, 0 }};
 	size_t decoded_samples_total = 0;
+	unsigned int allocs = 0;
 	int16_t buffer[2048];
 	ssize_t len;
 	char fname[64];
@@ -349,6 +468,9 @@ static void *test_io_thread_a2dp_dump_pcm(struct ba_transport_thread *th) {
 			continue;
 		}
 
+		if (decoded_samples_total == 0)
+			allocs = test_alloc_count_get();
+
 		size_t sample_size = BA_TRANSPORT_PCM_FORMAT_BYTES(t_a2dp_pcm->format);
 		debug("Decoded samples: %zd", len / sample_size);
 		decoded_samples_total += len / sample_size;
@@ -357,6 +479,9 @@ static void *test_io_thread_a2dp_dump_pcm(struct ba_transport_thread *th) {
 			fwrite(buffer, 1, len, f);
 	}
 
+	test_alloc_steady_state = test_alloc_count_get() - allocs;
+	debug("IO thread steady-state allocations: %u", test_alloc_steady_state);
+
 	debug("Decoded samples total: %zd", decoded_samples_total);
 	ck_assert_int_gt(decoded_samples_total, 0);
 
@@ -376,6 +501,12 @@ static void *test_io_thread_a2dp_dump_pcm(struct ba_transport_thread *th) {
  * initialization. Remember to restore it to its original value afterwards. */
 static int test_a2dp_pcm_samples_boost = 1;
 
+/**
+ * Compressed stream written to the PCM instead of the test PCM signal. Set
+ * it for the transport with the compressed PCM format only. */
+static const uint8_t *test_a2dp_stream = NULL;
+static size_t test_a2dp_stream_len = 0;
+
 /**
  * Drive PCM signal through A2DP source/sink loop. */
 static void test_a2dp(struct ba_transport *t_src, struct ba_transport *t_snk,
@@ -418,7 +549,11 @@ static void test_a2dp(struct ba_transport *t_src, struct ba_transport *t_snk,
 	}
 	else {
 		ck_assert_int_eq(ba_transport_thread_create(&t_src->thread_enc, enc, enc_name, true), 0);
-		write_test_pcm(pcm_fds[0], t_src_a2dp_pcm->channels, 4 * 1024 * test_a2dp_pcm_samples_boost);
+		if (test_a2dp_stream != NULL)
+			ck_assert_int_eq(write(pcm_fds[0], test_a2dp_stream, test_a2dp_stream_len),
+					test_a2dp_stream_len);
+		else
+			write_test_pcm(pcm_fds[0], t_src_a2dp_pcm->channels, 4 * 1024 * test_a2dp_pcm_samples_boost);
 		ck_assert_int_eq(ba_transport_thread_create(&t_snk->thread_dec, dec, dec_name, true), 0);
 	}
 
@@ -443,6 +578,11 @@ static void test_a2dp(struct ba_transport *t_src, struct ba_transport *t_snk,
 static void test_sco(struct ba_transport *t,
 		void *(*enc)(struct ba_transport_thread *), void *(*dec)(struct ba_transport_thread *)) {
 
+	/* In the duplex mode, there is no decoding thread and
+	 * every transmitted packet is triggered by a received one. */
+	const bool duplex = dec == NULL;
+	size_t packets = 0;
+
 	int sco_fds[2];
 	int pcm_mic_fds[2];
 	int pcm_spk_fds[2];
@@ -454,27 +594,36 @@ static void test_sco(struct ba_transport *t,
 	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, pcm_spk_fds), 0);
 	debug("Created PCM spk socket pair: %d, %d", pcm_spk_fds[0], pcm_spk_fds[1]);
 	write_test_pcm(pcm_spk_fds[0], t->sco.spk_pcm.channels, 1024);
+	/* internal PCM endpoint is non-blocking, as it is in the daemon */
+	ck_assert_int_ne(fcntl(pcm_spk_fds[1], F_SETFL, O_NONBLOCK), -1);
 
 	t->bt_fd = sco_fds[1];
 	t->sco.mic_pcm.fd = pcm_mic_fds[1];
 	t->sco.spk_pcm.fd = pcm_spk_fds[1];
 
 	ck_assert_int_eq(ba_transport_thread_create(&t->thread_enc, enc, "sco-enc", true), 0);
-	ck_assert_int_eq(ba_transport_thread_create(&t->thread_dec, dec, "sco-dec", false), 0);
+	if (!duplex)
+		ck_assert_int_eq(ba_transport_thread_create(&t->thread_dec, dec, "sco-dec", false), 0);
 
 	struct pollfd pfds[] = {
 		{ sco_fds[0], POLLIN, 0 },
 		{ pcm_mic_fds[0], POLLIN, 0 }};
 	size_t decoded_samples_total = 0;
-	uint8_t buffer[1024];
+	uint8_t buffer[1024] = { 0 };
 	ssize_t len;
 
+	/* kick off the packet exchange */
+	if (duplex)
+		ck_assert_int_gt(write(sco_fds[0], buffer, t->mtu_read), 0);
+
 	while (poll(pfds, ARRAYSIZE(pfds), 500) > 0) {
 
 		if (pfds[0].revents & POLLIN) {
 
 			ck_assert_int_gt(len = read(sco_fds[0], buffer, t->mtu_write), 0);
-			ck_assert_int_gt(write(sco_fds[0], buffer, len), 0);
+			/* stop the exchange after all PCM data has been transferred */
+			if (!duplex || ++packets < 200)
+				ck_assert_int_gt(write(sco_fds[0], buffer, len), 0);
 
 			char label[35];
 			sprintf(label, "BT data [len: %3zd]", len);
@@ -512,6 +661,421 @@ static int test_transport_release_bt_a2dp(struct ba_transport *t) {
 	return transport_release_bt_a2dp(t);
 }
 
+START_TEST(test_io_bt_abr) {
+
+	struct ba_transport t = { .mtu_write = 100 };
+	struct ba_transport_thread th = { .t = &t };
+	struct io_bt_abr abr;
+
+	io_bt_abr_init(&abr, 10, 50, 2);
+	io_bt_abr_set_low_power(&abr, 30);
+
+	/* without congestion the value is kept at the maximum */
+	ck_assert_int_eq(io_bt_abr_update(&abr, &th, true), false);
+	ck_assert_uint_eq(abr.value, 50);
+
+	/* congestion lowers the value by one step */
+	th.bt_coutq.queued = 200;
+	ck_assert_int_eq(io_bt_abr_update(&abr, &th, true), true);
+	ck_assert_uint_eq(abr.value, 48);
+	th.bt_coutq.queued = 0;
+
+	/* battery saver caps the value even without the adaptation */
+	config.battery.low = true;
+	ck_assert_int_eq(io_bt_abr_update(&abr, &th, false), true);
+	ck_assert_uint_eq(abr.value, 30);
+	ck_assert_int_eq(io_bt_abr_update(&abr, &th, false), false);
+	config.battery.low = false;
+	ck_assert_int_eq(io_bt_abr_update(&abr, &th, false), true);
+	ck_assert_uint_eq(abr.value, 50);
+
+} END_TEST
+
+START_TEST(test_io_pcm_overrun) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_A2DP_SINK,
+		.codec = A2DP_CODEC_SBC };
+	struct ba_transport *t = ba_transport_new_a2dp(device2, ttype, ":test", "/path/sbc",
+			&a2dp_codec_sink_sbc, &config_sbc_44100_stereo);
+	struct ba_transport_pcm *pcm = &t->a2dp.pcm;
+	struct ba_transport_thread_stats *stats = &t->thread_dec.stats;
+
+	int fds[2];
+	ck_assert_int_eq(pipe2(fds, O_NONBLOCK), 0);
+	const size_t capacity = fcntl(fds[1], F_SETPIPE_SZ, 4096);
+	const size_t capacity_frames = capacity / (2 * sizeof(int16_t));
+	const size_t backlog_frames = 44100 * IO_PCM_OVERRUN_BACKLOG_MS / 1000;
+	pcm->fd = fds[1];
+
+	/* every frame carries its sequence number */
+	const size_t frames = capacity_frames + backlog_frames + 100;
+	int16_t *buffer = malloc(frames * 2 * sizeof(*buffer));
+	for (size_t i = 0; i < frames; i++)
+		buffer[i * 2] = buffer[i * 2 + 1] = i;
+
+	int16_t tmp[2];
+	uint8_t rest[4096 * 4];
+
+	/* data which do not fit into the FIFO are dropped */
+	ck_assert_int_eq(ba_transport_pcm_set_overrun(pcm, BA_TRANSPORT_PCM_OVERRUN_DROP_NEWEST), 0);
+	ck_assert_int_eq(io_pcm_write(pcm, buffer, (capacity_frames + 100) * 2), (capacity_frames + 100) * 2);
+	ck_assert_uint_eq(atomic_load(&stats->overrun_drops), 100);
+	ck_assert_int_eq(read(fds[0], tmp, sizeof(tmp)), sizeof(tmp));
+	ck_assert_int_eq(tmp[0], 0);
+	ck_assert_int_eq(read(fds[0], rest, sizeof(rest)), capacity - sizeof(tmp));
+
+	/* the latest data are kept in the backlog */
+	atomic_store(&stats->overrun_drops, 0);
+	ck_assert_int_eq(ba_transport_pcm_set_overrun(pcm, BA_TRANSPORT_PCM_OVERRUN_DROP_OLDEST), 0);
+	ck_assert_int_eq(io_pcm_write(pcm, buffer, frames * 2), frames * 2);
+	ck_assert_uint_eq(atomic_load(&stats->overrun_drops), 100);
+	ck_assert_int_eq(read(fds[0], tmp, sizeof(tmp)), sizeof(tmp));
+	ck_assert_int_eq(tmp[0], 0);
+	ck_assert_int_eq(read(fds[0], rest, sizeof(rest)), capacity - sizeof(tmp));
+
+	/* backlog is flushed before new data, oldest frames are gone */
+	ck_assert_int_eq(io_pcm_write(pcm, buffer, 2), 2);
+	ck_assert_int_eq(read(fds[0], tmp, sizeof(tmp)), sizeof(tmp));
+	ck_assert_int_eq(tmp[0], capacity_frames + 100);
+	ck_assert_int_eq(tmp[1], capacity_frames + 100);
+
+	/* Backlog shall be flushed by the IO thread when the FIFO becomes
+	 * writable, even if the remote device does not send anything. */
+	struct io_poll io = { .timeout = 10 };
+	uint8_t bt[16];
+	int16_t last = -1;
+	ssize_t len, n;
+	do {
+		ck_assert_int_eq(io_poll_and_read_bt(&io, &t->thread_dec, bt, sizeof(bt)), -1);
+		ck_assert_int_eq(errno, ETIMEDOUT);
+		for (n = 0; (len = read(fds[0], rest, sizeof(rest))) > 0; n += len)
+			last = ((int16_t *)rest)[len / sizeof(int16_t) - 1];
+	} while (n > 0);
+	/* the last frame written to the PCM shall reach the client */
+	ck_assert_int_eq(last, 0);
+
+	free(buffer);
+	close(fds[0]);
+	ba_transport_destroy(t);
+
+} END_TEST
+
+START_TEST(test_io_bt_read_rx_overflows) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_A2DP_SINK,
+		.codec = A2DP_CODEC_SBC };
+	struct ba_transport *t = ba_transport_new_a2dp(device2, ttype, ":test", "/path/sbc",
+			&a2dp_codec_sink_sbc, &config_sbc_44100_stereo);
+	struct ba_transport_thread *th = &t->thread_dec;
+
+	/* The UDP socket is used as a replacement of the BT socket, because
+	 * it reports the receive queue overflows in the same way. */
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	socklen_t addr_len = sizeof(addr);
+	int fd_rx, fd_tx;
+	ck_assert_int_ne(fd_rx = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0), -1);
+	ck_assert_int_ne(fd_tx = socket(AF_INET, SOCK_DGRAM, 0), -1);
+	ck_assert_int_eq(bind(fd_rx, (struct sockaddr *)&addr, addr_len), 0);
+	ck_assert_int_eq(getsockname(fd_rx, (struct sockaddr *)&addr, &addr_len), 0);
+	ck_assert_int_eq(connect(fd_tx, (struct sockaddr *)&addr, addr_len), 0);
+
+	/* use the smallest possible receive buffer */
+	const int size = 1, enable = 1;
+	ck_assert_int_eq(setsockopt(fd_rx, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)), 0);
+	ck_assert_int_eq(setsockopt(fd_rx, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable)), 0);
+	th->bt_fd = fd_rx;
+
+	struct pollfd pfd = { fd_rx, POLLIN, 0 };
+	unsigned int dropped = 0;
+	uint8_t buffer[16];
+
+	/* The kernel counter is cumulative, so the second round checks that
+	 * drops are not accounted twice. */
+	for (size_t round = 0; round < 2; round++) {
+
+		const size_t packets = 64;
+		size_t received = 0;
+		for (size_t i = 0; i < packets; i++)
+			ck_assert_int_eq(send(fd_tx, &i, 1, 0), 1);
+
+		usleep(10000);
+		while (io_bt_read(th, buffer, sizeof(buffer)) == 1)
+			received++;
+		ck_assert_int_eq(errno, EAGAIN);
+		ck_assert_uint_lt(received, packets);
+		dropped += packets - received;
+
+		/* the counter is reported with the next queued packet */
+		ck_assert_int_eq(send(fd_tx, buffer, 1, 0), 1);
+		ck_assert_int_eq(poll(&pfd, 1, 1000), 1);
+		ck_assert_int_eq(io_bt_read(th, buffer, sizeof(buffer)), 1);
+
+		ck_assert_uint_eq(atomic_load(&th->stats.rx_overflows), dropped);
+		ck_assert_uint_eq(th->bt_rxq_drops, dropped);
+
+	}
+
+	/* statistics reset does not affect the socket counter */
+	ba_transport_thread_stats_reset(th);
+	ck_assert_int_eq(send(fd_tx, buffer, 1, 0), 1);
+	ck_assert_int_eq(poll(&pfd, 1, 1000), 1);
+	ck_assert_int_eq(io_bt_read(th, buffer, sizeof(buffer)), 1);
+	ck_assert_uint_eq(atomic_load(&th->stats.rx_overflows), 0);
+
+	th->bt_fd = -1;
+	close(fd_rx);
+	close(fd_tx);
+	ba_transport_destroy(t);
+
+} END_TEST
+
+START_TEST(test_io_bt_receiver_overflow) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_A2DP_SINK,
+		.codec = A2DP_CODEC_SBC };
+	struct ba_transport *t = ba_transport_new_a2dp(device2, ttype, ":test", "/path/sbc",
+			&a2dp_codec_sink_sbc, &config_sbc_44100_stereo);
+	struct ba_transport_thread *th = &t->thread_dec;
+
+	int bt_fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, bt_fds), 0);
+	th->bt_fd = bt_fds[0];
+
+	struct io_bt_receiver receiver;
+	ck_assert_int_eq(io_bt_receiver_init(&receiver, th, 16), 0);
+
+	/* every packet carries its sequence number */
+	const size_t packets = IO_BT_RECEIVER_SIZE + 8;
+	for (size_t i = 0; i < packets; i++) {
+		const uint8_t seq = i;
+		ck_assert_int_eq(write(bt_fds[1], &seq, sizeof(seq)), sizeof(seq));
+	}
+
+	/* wait for the reader to drain the socket */
+	size_t tail = 0;
+	for (size_t i = 0; tail != packets && i < 1000; i++) {
+		usleep(1000);
+		pthread_mutex_lock(&receiver.mutex);
+		tail = receiver.tail;
+		pthread_mutex_unlock(&receiver.mutex);
+	}
+	ck_assert_uint_eq(tail, packets);
+
+	/* the oldest packets are dropped when the queue overflows */
+	ck_assert_uint_eq(receiver.dropped, packets - IO_BT_RECEIVER_SIZE);
+
+	struct io_poll io = { .timeout = 10, .receiver = &receiver };
+	uint8_t buffer[16];
+	for (size_t i = packets - IO_BT_RECEIVER_SIZE; i < packets; i++) {
+		ck_assert_int_eq(io_poll_and_read_bt(&io, th, buffer, sizeof(buffer)), 1);
+		ck_assert_uint_eq(buffer[0], i);
+	}
+
+	/* the queue is empty */
+	ck_assert_int_eq(io_poll_and_read_bt(&io, th, buffer, sizeof(buffer)), -1);
+	ck_assert_int_eq(errno, ETIMEDOUT);
+
+	/* the reader result is passed to the IO thread */
+	close(bt_fds[1]);
+	ck_assert_int_eq(io_poll_and_read_bt(&io, th, buffer, sizeof(buffer)), 0);
+
+	io_bt_receiver_free(&receiver);
+	ba_transport_destroy(t);
+
+} END_TEST
+
+START_TEST(test_io_pcm_mix_partial_frame) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE,
+		.codec = A2DP_CODEC_SBC };
+	struct ba_transport *t = ba_transport_new_a2dp(device1, ttype, ":test", "/path/sbc",
+			&a2dp_codec_source_sbc, &config_sbc_44100_stereo);
+	struct ba_transport_pcm *pcm = &t->a2dp.pcm;
+	struct ba_transport_pcm_mix_client *c = &pcm->mix_clients[0];
+
+	int pcm_fds[2];
+	int mix_fds[2];
+	ck_assert_int_eq(pipe2(pcm_fds, O_NONBLOCK), 0);
+	ck_assert_int_eq(pipe2(mix_fds, O_NONBLOCK), 0);
+	pcm->fd = pcm_fds[0];
+	*c = (struct ba_transport_pcm_mix_client){ .fd = mix_fds[0], .ctrl_fd = -1 };
+	pcm->mix_clients_len = 1;
+
+	const int16_t mix[2] = { 10, 20 };
+	const int16_t frame[2] = { 100, 200 };
+	int16_t buffer[64];
+
+	/* no data from any client */
+	ck_assert_int_eq(io_pcm_read(pcm, buffer, ARRAYSIZE(buffer)), -1);
+	ck_assert_int_eq(errno, EAGAIN);
+
+	/* single sample of the stereo stream is kept for the next read, but
+	 * the mixed client is read anyway, because the encoder drives the
+	 * transfer, not the main client */
+	ck_assert_int_eq(write(mix_fds[1], mix, sizeof(mix)), sizeof(mix));
+	ck_assert_int_eq(write(pcm_fds[1], frame, sizeof(frame[0])), sizeof(frame[0]));
+	ck_assert_int_eq(io_pcm_read(pcm, buffer, ARRAYSIZE(buffer)), 2);
+	ck_assert_int_eq(buffer[0], 10);
+	ck_assert_int_eq(buffer[1], 20);
+	ck_assert_int_eq(c->fd, mix_fds[0]);
+	ck_assert_uint_eq(pcm->read_tail_len, sizeof(frame[0]));
+
+	/* incomplete frame of the mixed client is kept for the next read */
+	ck_assert_int_eq(write(mix_fds[1], mix, sizeof(mix[0])), sizeof(mix[0]));
+	ck_assert_int_eq(write(pcm_fds[1], &frame[1], sizeof(frame[1])), sizeof(frame[1]));
+	ck_assert_int_eq(io_pcm_read(pcm, buffer, ARRAYSIZE(buffer)), 2);
+	ck_assert_int_eq(buffer[0], 100);
+	ck_assert_int_eq(buffer[1], 200);
+	ck_assert_uint_eq(c->tail_len, sizeof(mix[0]));
+
+	/* complete frame shall be mixed with the pending client data */
+	ck_assert_int_eq(write(mix_fds[1], &mix[1], sizeof(mix[1])), sizeof(mix[1]));
+	ck_assert_int_eq(write(pcm_fds[1], frame, sizeof(frame)), sizeof(frame));
+	ck_assert_int_eq(io_pcm_read(pcm, buffer, ARRAYSIZE(buffer)), 2);
+	ck_assert_int_eq(buffer[0], 100 + 10);
+	ck_assert_int_eq(buffer[1], 200 + 20);
+	ck_assert_uint_eq(c->tail_len, 0);
+
+	/* mixed client delivering more data than the main one shall not be
+	 * truncated to the length of the main client data */
+	const int16_t mix2[6] = { 1, 2, 3, 4, 5, 6 };
+	ck_assert_int_eq(write(mix_fds[1], mix2, sizeof(mix2)), sizeof(mix2));
+	ck_assert_int_eq(write(pcm_fds[1], frame, sizeof(frame)), sizeof(frame));
+	ck_assert_int_eq(io_pcm_read(pcm, buffer, ARRAYSIZE(buffer)), 6);
+	ck_assert_int_eq(buffer[0], 100 + 1);
+	ck_assert_int_eq(buffer[1], 200 + 2);
+	ck_assert_int_eq(buffer[2], 3);
+	ck_assert_int_eq(buffer[5], 6);
+
+	close(pcm_fds[1]);
+	close(mix_fds[1]);
+	ba_transport_destroy(t);
+
+} END_TEST
+
+START_TEST(test_io_pcm_remap) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE,
+		.codec = A2DP_CODEC_SBC };
+	struct ba_transport *t_src = ba_transport_new_a2dp(device1, ttype, ":test", "/path/sbc",
+			&a2dp_codec_source_sbc, &config_sbc_44100_stereo);
+	ttype.profile = BA_TRANSPORT_PROFILE_A2DP_SINK;
+	struct ba_transport *t_snk = ba_transport_new_a2dp(device2, ttype, ":test", "/path/sbc",
+			&a2dp_codec_sink_sbc, &config_sbc_44100_stereo);
+	struct ba_transport_pcm *pcm_src = &t_src->a2dp.pcm;
+	struct ba_transport_pcm *pcm_snk = &t_snk->a2dp.pcm;
+
+	/* channels can be selected only when the PCM is not opened */
+	ck_assert_int_eq(ba_transport_pcm_set_channels(pcm_src, 1), 0);
+	ck_assert_int_eq(ba_transport_pcm_set_channels(pcm_snk, 1), 0);
+
+	int src_fds[2];
+	int snk_fds[2];
+	ck_assert_int_eq(pipe2(src_fds, O_NONBLOCK), 0);
+	ck_assert_int_eq(pipe2(snk_fds, O_NONBLOCK), 0);
+	pcm_src->fd = src_fds[0];
+	pcm_snk->fd = snk_fds[1];
+
+	const int16_t mono[3] = { 100, 200, 300 };
+	const int16_t stereo[6] = { 100, 200, -100, -300, 1000, 0 };
+	int16_t buffer[64];
+
+	/* mono client signal is up-mixed for the stereo encoder */
+	ck_assert_int_eq(write(src_fds[1], mono, sizeof(mono)), sizeof(mono));
+	ck_assert_int_eq(io_pcm_read(pcm_src, buffer, ARRAYSIZE(buffer)), 6);
+	ck_assert_int_eq(buffer[0], 100);
+	ck_assert_int_eq(buffer[1], 100);
+	ck_assert_int_eq(buffer[2], 200);
+	ck_assert_int_eq(buffer[3], 200);
+	ck_assert_int_eq(buffer[4], 300);
+	ck_assert_int_eq(buffer[5], 300);
+
+	/* stereo decoder signal is down-mixed for the mono client */
+	ck_assert_int_eq(io_pcm_write(pcm_snk, stereo, ARRAYSIZE(stereo)), ARRAYSIZE(stereo));
+	ck_assert_int_eq(read(snk_fds[0], buffer, sizeof(buffer)), 3 * sizeof(int16_t));
+	ck_assert_int_eq(buffer[0], 150);
+	ck_assert_int_eq(buffer[1], -200);
+	ck_assert_int_eq(buffer[2], 500);
+
+	/* swapped channels of the stereo client signal */
+	pcm_src->fd = -1;
+	ck_assert_int_eq(ba_transport_pcm_set_channels(pcm_src, 2), 0);
+	ck_assert_int_eq(ba_transport_pcm_set_swap_channels(pcm_src, true), 0);
+	pcm_src->fd = src_fds[0];
+	ck_assert_int_eq(write(src_fds[1], stereo, 2 * sizeof(int16_t)), 2 * sizeof(int16_t));
+	ck_assert_int_eq(io_pcm_read(pcm_src, buffer, ARRAYSIZE(buffer)), 2);
+	ck_assert_int_eq(buffer[0], 200);
+	ck_assert_int_eq(buffer[1], 100);
+
+	close(src_fds[1]);
+	close(snk_fds[0]);
+	ba_transport_destroy(t_src);
+	ba_transport_destroy(t_snk);
+
+} END_TEST
+
+START_TEST(test_io_pcm_monitor) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE,
+		.codec = A2DP_CODEC_SBC };
+	config.a2dp.monitor = true;
+	struct ba_transport *t = ba_transport_new_a2dp(device1, ttype, ":test", "/path/sbc",
+			&a2dp_codec_source_sbc, &config_sbc_44100_stereo);
+	config.a2dp.monitor = false;
+	struct ba_transport_pcm *pcm = &t->a2dp.pcm;
+	struct ba_transport_pcm *monitor = &t->a2dp.pcm_monitor;
+
+	ck_assert_ptr_eq(pcm->monitor, monitor);
+	ck_assert(g_str_has_suffix(monitor->ba_dbus_path, "/a2dpsrc/monitor"));
+	ck_assert_int_eq(monitor->mode, BA_TRANSPORT_PCM_MODE_SOURCE);
+	ck_assert_uint_eq(monitor->format, pcm->codec_format);
+	ck_assert_uint_eq(monitor->channels, pcm->channels);
+	ck_assert_uint_eq(monitor->sampling, pcm->sampling);
+
+	/* monitor shall never block the encoder */
+	ck_assert_int_eq(ba_transport_pcm_set_overrun(monitor, BA_TRANSPORT_PCM_OVERRUN_BLOCK), -1);
+
+	int pcm_fds[2];
+	int monitor_fds[2];
+	ck_assert_int_eq(pipe2(pcm_fds, O_NONBLOCK), 0);
+	ck_assert_int_eq(pipe2(monitor_fds, O_NONBLOCK), 0);
+	pcm->fd = pcm_fds[0];
+	monitor->fd = monitor_fds[1];
+
+	int16_t input[2 * 64];
+	for (size_t i = 0; i < ARRAYSIZE(input); i++)
+		input[i] = i * 100;
+
+	int16_t buffer[ARRAYSIZE(input)];
+	int16_t mirror[ARRAYSIZE(input) + 1];
+
+	/* data read from the PCM are mirrored to the monitor */
+	ck_assert_int_eq(write(pcm_fds[1], input, sizeof(input)), sizeof(input));
+	ck_assert_int_eq(io_pcm_read(pcm, buffer, ARRAYSIZE(buffer)), ARRAYSIZE(input));
+	ck_assert_int_eq(read(monitor_fds[0], mirror, sizeof(mirror)), sizeof(buffer));
+	ck_assert_int_eq(memcmp(mirror, buffer, sizeof(buffer)), 0);
+
+	/* paused monitor does not receive any data */
+	ba_transport_pcm_pause(monitor);
+	ck_assert_int_eq(write(pcm_fds[1], input, sizeof(input)), sizeof(input));
+	ck_assert_int_eq(io_pcm_read(pcm, buffer, ARRAYSIZE(buffer)), ARRAYSIZE(input));
+	ck_assert_int_eq(read(monitor_fds[0], mirror, sizeof(mirror)), -1);
+	ck_assert_int_eq(errno, EAGAIN);
+
+	close(pcm_fds[1]);
+	close(monitor_fds[0]);
+	ba_transport_destroy(t);
+
+} END_TEST
+
 START_TEST(test_a2dp_sbc) {
 
 	struct ba_transport_type ttype = {
@@ -533,8 +1097,15 @@ START_TEST(test_a2dp_sbc) {
 	else {
 		debug("\n\n*** A2DP codec: SBC ***");
 		t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write = 153 * 3;
+		test_a2dp(t1, t2, test_a2dp_sbc_enc_thread, test_io_thread_a2dp_dump_bt);
+		/* there shall be no memory allocations per packet */
+		ck_assert_uint_eq(test_alloc_steady_state, 0);
+		/* encode with the encoder primed with silence */
+		config.a2dp.fast_start = true;
 		test_a2dp(t1, t2, a2dp_sbc_enc_thread, test_io_thread_a2dp_dump_bt);
-		test_a2dp(t1, t2, test_io_thread_a2dp_dump_pcm, a2dp_sbc_dec_thread);
+		config.a2dp.fast_start = false;
+		test_a2dp(t1, t2, test_io_thread_a2dp_dump_pcm, test_a2dp_sbc_dec_thread);
+		ck_assert_uint_eq(test_alloc_steady_state, 0);
 	}
 
 	ba_transport_destroy(t1);
@@ -542,6 +1113,185 @@ START_TEST(test_a2dp_sbc) {
 
 } END_TEST
 
+static void test_a2dp_drain_complete(struct ba_transport_pcm *pcm, void *userdata) {
+	(void)pcm;
+	atomic_store((atomic_bool *)userdata, true);
+}
+
+START_TEST(test_a2dp_sbc_drain) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE,
+		.codec = A2DP_CODEC_SBC };
+	struct ba_transport *t = ba_transport_new_a2dp(device1, ttype, ":test", "/path/sbc",
+			&a2dp_codec_source_sbc, &config_sbc_44100_stereo);
+	struct ba_transport_pcm *pcm = &t->a2dp.pcm;
+
+	t->acquire = test_transport_acquire;
+	t->release = test_transport_release_bt_a2dp;
+	t->mtu_read = t->mtu_write = 153 * 3;
+
+	int bt_fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, bt_fds), 0);
+	t->bt_fd = bt_fds[1];
+
+	int pcm_fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pcm_fds), 0);
+	pcm->fd = pcm_fds[1];
+
+	/* there is nothing to drain without the IO thread */
+	ck_assert_int_eq(ba_transport_pcm_drain(pcm, NULL, NULL), -1);
+	ck_assert_int_eq(errno, ESRCH);
+
+	ck_assert_int_eq(ba_transport_thread_create(&t->thread_enc, a2dp_sbc_enc_thread, "encode", true), 0);
+
+	/* the number of frames is not aligned to the SBC frame */
+	static const int16_t silence[2 * 1000] = { 0 };
+	ck_assert_int_eq(write(pcm_fds[0], silence, sizeof(silence)), sizeof(silence));
+
+	atomic_bool drained = false;
+	ck_assert_int_eq(ba_transport_pcm_drain(pcm, test_a2dp_drain_complete, &drained), 0);
+	ck_assert_int_eq(ba_transport_pcm_drain(pcm, NULL, NULL), -1);
+	ck_assert_int_eq(errno, EBUSY);
+
+	struct timespec ts_start, ts_now, ts_diff;
+	gettimestamp(&ts_start);
+
+	/* The drain shall not be completed until all the packets are taken
+	 * out of the BT socket, so keep reading until the notification. */
+	unsigned int frames = 0;
+	while (!atomic_load(&drained)) {
+		uint8_t buffer[1024];
+		struct pollfd pfds[] = {{ bt_fds[0], POLLIN, 0 }};
+		ck_assert_int_ne(poll(pfds, ARRAYSIZE(pfds), 10), -1);
+		ssize_t len;
+		while ((len = read(bt_fds[0], buffer, sizeof(buffer))) > 0)
+			frames += ((rtp_media_header_t *)(buffer + RTP_HEADER_LEN))->frame_count;
+		gettimestamp(&ts_now);
+		timespecsub(&ts_now, &ts_start, &ts_diff);
+		ck_assert_int_lt(ts_diff.tv_sec * 1000 + ts_diff.tv_nsec / 1000000, 200);
+	}
+
+	/* the tail of the stream shall be flushed out of the encoder */
+	ck_assert_uint_ge(frames * pcm->block_frames, 1000);
+
+	pthread_mutex_lock(&pcm->mutex);
+	ba_transport_pcm_release(pcm);
+	pthread_mutex_unlock(&pcm->mutex);
+	transport_thread_cancel(&t->thread_enc);
+
+	close(pcm_fds[0]);
+	close(bt_fds[0]);
+	ba_transport_destroy(t);
+
+} END_TEST
+
+static pthread_t test_a2dp_silence_acquire_thread;
+static int test_a2dp_silence_bt_fd = -1;
+static int test_a2dp_silence_transport_acquire(struct ba_transport *t) {
+	int bt_fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, bt_fds), 0);
+	debug("Acquire transport: %d", bt_fds[1]);
+	test_a2dp_silence_acquire_thread = pthread_self();
+	test_a2dp_silence_bt_fd = bt_fds[0];
+	t->mtu_read = t->mtu_write = 153 * 3;
+	return t->bt_fd = bt_fds[1];
+}
+
+START_TEST(test_a2dp_sbc_silence_suspend) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE,
+		.codec = A2DP_CODEC_SBC };
+	struct ba_transport *t = ba_transport_new_a2dp(device1, ttype, ":test", "/path/sbc",
+			&a2dp_codec_source_sbc, &config_sbc_44100_stereo);
+	struct ba_transport_pcm *pcm = &t->a2dp.pcm;
+
+	t->acquire = test_a2dp_silence_transport_acquire;
+	t->release = test_transport_release_bt_a2dp;
+	t->a2dp.state = BLUEZ_A2DP_TRANSPORT_STATE_ACTIVE;
+	ck_assert_int_ne(ba_transport_acquire(t), -1);
+
+	int pcm_fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pcm_fds), 0);
+	pcm->fd = pcm_fds[1];
+
+	const unsigned int silence_timeout = config.a2dp.silence_timeout;
+	config.a2dp.silence_timeout = 100;
+
+	ck_assert_int_eq(ba_transport_thread_create(&t->thread_enc, a2dp_sbc_enc_thread, "encode", true), 0);
+
+	int16_t buffer[2 * 441];
+	uint8_t bt_buffer[1024];
+	struct timespec ts_start, ts_now, ts_diff;
+
+	/* Feed the encoder with silence until the transport is released. The
+	 * IO thread shall not be stopped, because the client is connected. */
+	memset(buffer, 0, sizeof(buffer));
+	gettimestamp(&ts_start);
+	for (;;) {
+		pthread_mutex_lock(&t->bt_fd_mtx);
+		const int bt_fd = t->bt_fd;
+		pthread_mutex_unlock(&t->bt_fd_mtx);
+		if (bt_fd == -1)
+			break;
+		if (write(pcm_fds[0], buffer, sizeof(buffer)) == -1)
+			ck_assert_int_eq(errno, EAGAIN);
+		while (read(test_a2dp_silence_bt_fd, bt_buffer, sizeof(bt_buffer)) > 0)
+			continue;
+		usleep(5000);
+		gettimestamp(&ts_now);
+		timespecsub(&ts_now, &ts_start, &ts_diff);
+		ck_assert_int_lt(ts_diff.tv_sec, 2);
+	}
+
+	ck_assert_int_eq(pcm->silence_suspended, true);
+	/* BlueZ notification about the transport becoming idle */
+	ck_assert_int_eq(t->a2dp.silence_released, true);
+	ck_assert_int_eq(ba_transport_set_a2dp_state(t, BLUEZ_A2DP_TRANSPORT_STATE_IDLE), 0);
+	ck_assert_int_eq(t->a2dp.silence_released, false);
+	ck_assert_int_eq(pthread_equal(t->thread_enc.id, config.main_thread), 0);
+	close(test_a2dp_silence_bt_fd);
+	test_a2dp_silence_bt_fd = -1;
+
+	/* Signal on the PCM input shall trigger the transport acquisition,
+	 * which has to be done by the main loop, not by the IO thread. */
+	snd_pcm_sine_s16le(buffer, ARRAYSIZE(buffer), 2, 0, 1.0 / 128);
+	gettimestamp(&ts_start);
+	size_t bt_bytes = 0;
+	while (bt_bytes == 0) {
+		if (write(pcm_fds[0], buffer, sizeof(buffer)) == -1)
+			ck_assert_int_eq(errno, EAGAIN);
+		while (g_main_context_iteration(NULL, FALSE))
+			continue;
+		ssize_t len;
+		if (test_a2dp_silence_bt_fd != -1)
+			while ((len = read(test_a2dp_silence_bt_fd, bt_buffer, sizeof(bt_buffer))) > 0)
+				bt_bytes += len;
+		usleep(5000);
+		gettimestamp(&ts_now);
+		timespecsub(&ts_now, &ts_start, &ts_diff);
+		ck_assert_int_lt(ts_diff.tv_sec, 2);
+	}
+
+	ck_assert_int_ne(pthread_equal(test_a2dp_silence_acquire_thread, pthread_self()), 0);
+	ck_assert_int_eq(pcm->silence_suspended, false);
+	/* BlueZ notification about the transport becoming active again */
+	ck_assert_int_eq(ba_transport_set_a2dp_state(t, BLUEZ_A2DP_TRANSPORT_STATE_ACTIVE), 0);
+
+	pthread_mutex_lock(&pcm->mutex);
+	ba_transport_pcm_release(pcm);
+	pthread_mutex_unlock(&pcm->mutex);
+	transport_thread_cancel(&t->thread_enc);
+	config.a2dp.silence_timeout = silence_timeout;
+
+	close(pcm_fds[0]);
+	close(test_a2dp_silence_bt_fd);
+	test_a2dp_silence_bt_fd = -1;
+	ba_transport_destroy(t);
+
+} END_TEST
+
 #if ENABLE_MP3LAME
 START_TEST(test_a2dp_mp3) {
 
@@ -571,6 +1321,35 @@ START_TEST(test_a2dp_mp3) {
 		debug("\n\n*** A2DP codec: MP3 ***");
 		t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write = 250;
 		test_a2dp(t1, t2, a2dp_mp3_enc_thread, test_io_thread_a2dp_dump_bt);
+
+		const size_t headers_len = RTP_HEADER_LEN + sizeof(rtp_mpeg_audio_header_t);
+		static uint8_t mp3[64 * 1024];
+		static uint8_t mp3_passthrough[sizeof(mp3)];
+
+		/* garbage before the first frame shall be skipped */
+		memcpy(mp3, "ID3", 3);
+		size_t mp3_len = 3 + bt_data_reassemble(headers_len, mp3 + 3, sizeof(mp3) - 3);
+		ck_assert_uint_gt(mp3_len, 3);
+
+		struct a2dp_mpeg_frame frame;
+		ck_assert_int_eq(a2dp_mpeg_frame_parse(mp3, &frame), -1);
+		ck_assert_int_eq(a2dp_mpeg_frame_parse(mp3 + 3, &frame), 0);
+		ck_assert_uint_eq(frame.layer, MPEG_LAYER_MP3);
+		ck_assert_uint_eq(frame.sampling, 44100);
+		ck_assert_uint_eq(frame.channels, 2);
+		ck_assert_uint_eq(frame.frames, 1152);
+
+		/* compressed stream shall be sent as it is */
+		t1->a2dp.pcm.format = BA_TRANSPORT_PCM_FORMAT_MPEG;
+		test_a2dp_stream = mp3;
+		test_a2dp_stream_len = mp3_len;
+		test_a2dp(t1, t2, a2dp_mpeg_passthrough_thread, test_io_thread_a2dp_dump_bt);
+		test_a2dp_stream = NULL;
+		t1->a2dp.pcm.format = BA_TRANSPORT_PCM_FORMAT_S16_2LE;
+		ck_assert_uint_eq(bt_data_reassemble(headers_len, mp3_passthrough,
+					sizeof(mp3_passthrough)), mp3_len - 3);
+		ck_assert_int_eq(memcmp(mp3_passthrough, mp3 + 3, mp3_len - 3), 0);
+
 		test_a2dp(t1, t2, test_io_thread_a2dp_dump_pcm, a2dp_mpeg_dec_thread);
 	}
 
@@ -606,11 +1385,88 @@ START_TEST(test_a2dp_aac) {
 		t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write = 64;
 		test_a2dp(t1, t2, a2dp_aac_enc_thread, test_io_thread_a2dp_dump_bt);
 		test_a2dp(t1, t2, test_io_thread_a2dp_dump_pcm, a2dp_aac_dec_thread);
+
+		/* AudioMuxElement with StreamMuxConfig: AAC LC, 44100 Hz, stereo */
+		const uint8_t ame_stereo[] = { 0x20, 0x00, 0x12, 0x10 };
+		const uint8_t ame_mono[] = { 0x20, 0x00, 0x12, 0x08 };
+		const uint8_t ame_same[] = { 0x80 };
+		ck_assert_int_eq(a2dp_aac_latm_check_config(ame_stereo, sizeof(ame_stereo), 2, 44100, 2), 1);
+		ck_assert_int_eq(a2dp_aac_latm_check_config(ame_stereo, sizeof(ame_stereo), 2, 48000, 2), -1);
+		ck_assert_int_eq(a2dp_aac_latm_check_config(ame_stereo, sizeof(ame_stereo), 39, 44100, 2), -1);
+		ck_assert_int_eq(a2dp_aac_latm_check_config(ame_stereo, 2, 2, 44100, 2), -1);
+		ck_assert_int_eq(a2dp_aac_latm_check_config(ame_mono, sizeof(ame_mono), 2, 44100, 2), -1);
+		ck_assert_int_eq(a2dp_aac_latm_check_config(ame_same, sizeof(ame_same), 2, 44100, 2), 0);
+
+		/* Frames with mismatched configuration shall be skipped, as well as
+		 * the ones which refer to the skipped configuration. */
+		const uint8_t *frames[] = {
+			ame_same, ame_stereo, ame_same, ame_mono, ame_same, ame_stereo };
+		const bool frames_sent[] = { false, true, true, false, false, true };
+		static uint8_t loas[6 * 103];
+		static uint8_t expected[sizeof(loas)];
+		static uint8_t aac_passthrough[sizeof(loas)];
+		size_t loas_len = 0;
+		size_t expected_len = 0;
+		for (size_t i = 0; i < ARRAYSIZE(frames); i++) {
+			uint8_t *ame = &loas[loas_len + 3];
+			const size_t ame_len = 100;
+			const size_t config_len = frames[i] == ame_same ? 1 : 4;
+			loas[loas_len + 0] = 0x56;
+			loas[loas_len + 1] = 0xE0 | (ame_len >> 8);
+			loas[loas_len + 2] = ame_len & 0xFF;
+			memcpy(ame, frames[i], config_len);
+			memset(ame + config_len, i, ame_len - config_len);
+			if (frames_sent[i]) {
+				memcpy(&expected[expected_len], ame, ame_len);
+				expected_len += ame_len;
+			}
+			loas_len += 3 + ame_len;
+		}
+
+		t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write = 250;
+		t1->a2dp.pcm.format = BA_TRANSPORT_PCM_FORMAT_AAC_LOAS;
+		test_a2dp_stream = loas;
+		test_a2dp_stream_len = loas_len;
+		test_a2dp(t1, t2, a2dp_aac_passthrough_thread, test_io_thread_a2dp_dump_bt);
+		test_a2dp_stream = NULL;
+		t1->a2dp.pcm.format = BA_TRANSPORT_PCM_FORMAT_S16_2LE;
+		ck_assert_uint_eq(bt_data_reassemble(RTP_HEADER_LEN, aac_passthrough,
+					sizeof(aac_passthrough)), expected_len);
+		ck_assert_int_eq(memcmp(aac_passthrough, expected, expected_len), 0);
+
 	}
 
 	ba_transport_destroy(t1);
 	ba_transport_destroy(t2);
 
+} END_TEST
+
+START_TEST(test_a2dp_aac_eld) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE,
+		.codec = A2DP_CODEC_MPEG24 };
+	struct ba_transport *t1 = ba_transport_new_a2dp(device1, ttype, ":test", "/path/aac",
+			&a2dp_codec_source_aac, &config_aac_eld_44100_stereo);
+	ttype.profile = BA_TRANSPORT_PROFILE_A2DP_SINK;
+	struct ba_transport *t2 = ba_transport_new_a2dp(device2, ttype, ":test", "/path/aac",
+			&a2dp_codec_sink_aac, &config_aac_eld_44100_stereo);
+
+	t1->acquire = t2->acquire = test_transport_acquire;
+	t1->release = t2->release = test_transport_release_bt_a2dp;
+
+	/* block size shall match the frame length of the AAC-ELD encoder */
+	ck_assert_uint_eq(t1->a2dp.pcm.block_frames, 480);
+
+	debug("\n\n*** A2DP codec: AAC-ELD ***");
+	t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write = 450;
+	test_a2dp(t1, t2, a2dp_aac_enc_thread, test_io_thread_a2dp_dump_bt);
+	ck_assert_uint_eq(t1->a2dp.pcm.block_frames, 480);
+	test_a2dp(t1, t2, test_io_thread_a2dp_dump_pcm, a2dp_aac_dec_thread);
+
+	ba_transport_destroy(t1);
+	ba_transport_destroy(t2);
+
 } END_TEST
 #endif
 
@@ -647,6 +1503,43 @@ START_TEST(test_a2dp_aptx) {
 	ba_transport_destroy(t1);
 	ba_transport_destroy(t2);
 
+} END_TEST
+
+START_TEST(test_a2dp_aptx_ll) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE,
+		.codec = A2DP_CODEC_VENDOR_APTX_LL };
+	struct ba_transport *t1 = ba_transport_new_a2dp(device1, ttype, ":test", "/path/aptxll",
+			&a2dp_codec_source_aptx_ll, &config_aptx_ll_48000_stereo);
+	ttype.profile = BA_TRANSPORT_PROFILE_A2DP_SINK;
+	struct ba_transport *t2 = ba_transport_new_a2dp(device2, ttype, ":test", "/path/aptxll",
+			&a2dp_codec_sink_aptx_ll, &config_aptx_ll_48000_stereo);
+
+	t1->acquire = t2->acquire = test_transport_acquire;
+	t1->release = t2->release = test_transport_release_bt_a2dp;
+
+	/* packets shall be limited to 4 ms (48 apt-X codewords) */
+	t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write = 400;
+
+	if (aging_duration) {
+#if HAVE_APTX_DECODE
+		test_a2dp(t1, t2, a2dp_aptx_enc_thread, a2dp_aptx_dec_thread);
+#endif
+	}
+	else {
+		debug("\n\n*** A2DP codec: apt-X LL ***");
+		test_a2dp(t1, t2, a2dp_aptx_enc_thread, test_io_thread_a2dp_dump_bt);
+		/* QMF delay (90 frames) and 192 frames of the packet at 48 kHz */
+		ck_assert_int_eq(t1->a2dp.pcm.codec_delay, (90 + 192) * 10000 / 48000);
+#if HAVE_APTX_DECODE
+		test_a2dp(t1, t2, test_io_thread_a2dp_dump_pcm, a2dp_aptx_dec_thread);
+#endif
+	};
+
+	ba_transport_destroy(t1);
+	ba_transport_destroy(t2);
+
 } END_TEST
 #endif
 
@@ -675,8 +1568,16 @@ START_TEST(test_a2dp_aptx_hd) {
 		debug("\n\n*** A2DP codec: apt-X HD ***");
 		t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write = 60;
 		test_a2dp(t1, t2, a2dp_aptx_hd_enc_thread, test_io_thread_a2dp_dump_bt);
+		/* encode with the BT writer thread */
+		config.a2dp.pipeline = true;
+		test_a2dp(t1, t2, a2dp_aptx_hd_enc_thread, test_io_thread_a2dp_dump_bt);
+		config.a2dp.pipeline = false;
 #if HAVE_APTX_HD_DECODE
 		test_a2dp(t1, t2, test_io_thread_a2dp_dump_pcm, a2dp_aptx_hd_dec_thread);
+		/* decode with the BT reader thread */
+		config.a2dp.receiver = true;
+		test_a2dp(t1, t2, test_io_thread_a2dp_dump_pcm, a2dp_aptx_hd_dec_thread);
+		config.a2dp.receiver = false;
 #endif
 	};
 
@@ -715,6 +1616,119 @@ START_TEST(test_a2dp_faststream) {
 		test_a2dp(t2, t1, test_io_thread_a2dp_dump_pcm, a2dp_faststream_dec_thread);
 	}
 
+	ck_assert_int_eq(a2dp_faststream_is_duplex(t1), false);
+	ck_assert_ptr_eq(t1->a2dp.pcm_bc.th, &t1->thread_dec);
+
+	ba_transport_destroy(t1);
+	ba_transport_destroy(t2);
+
+	/* in the duplex mode voice is serviced by the music encoder thread */
+	config.a2dp.duplex = true;
+	ttype.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE;
+	t1 = ba_transport_new_a2dp(device1, ttype, ":test", "/path/faststream",
+			&a2dp_codec_source_faststream, &config_faststream_44100_16000);
+	ttype.profile = BA_TRANSPORT_PROFILE_A2DP_SINK;
+	t2 = ba_transport_new_a2dp(device2, ttype, ":test", "/path/faststream",
+			&a2dp_codec_sink_faststream, &config_faststream_44100_16000);
+	ck_assert_int_eq(a2dp_faststream_is_duplex(t1), true);
+	ck_assert_ptr_eq(t1->a2dp.pcm_bc.th, &t1->thread_enc);
+	ck_assert_int_eq(a2dp_faststream_is_duplex(t2), false);
+	ck_assert_ptr_eq(t2->a2dp.pcm_bc.th, &t2->thread_enc);
+	config.a2dp.duplex = false;
+
+	ba_transport_destroy(t1);
+	ba_transport_destroy(t2);
+
+} END_TEST
+
+START_TEST(test_a2dp_faststream_duplex) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE,
+		.codec = A2DP_CODEC_VENDOR_FASTSTREAM };
+	config.a2dp.duplex = true;
+	struct ba_transport *t1 = ba_transport_new_a2dp(device1, ttype, ":test", "/path/faststream",
+			&a2dp_codec_source_faststream, &config_faststream_44100_16000);
+	config.a2dp.duplex = false;
+	ttype.profile = BA_TRANSPORT_PROFILE_A2DP_SINK;
+	struct ba_transport *t2 = ba_transport_new_a2dp(device2, ttype, ":test", "/path/faststream",
+			&a2dp_codec_sink_faststream, &config_faststream_44100_16000);
+	ck_assert_ptr_eq(t1->a2dp.pcm_bc.th, &t1->thread_enc);
+
+	t1->acquire = t2->acquire = test_transport_acquire;
+	t1->release = t2->release = test_transport_release_bt_a2dp;
+	t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write = 72 * 3;
+
+	int bt_fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, bt_fds), 0);
+	t1->bt_fd = bt_fds[1];
+	t2->bt_fd = bt_fds[0];
+
+	int pcm_fds[2][2];
+	int pcm_bc_fds[2][2];
+	for (size_t i = 0; i < 2; i++) {
+		ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pcm_fds[i]), 0);
+		ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pcm_bc_fds[i]), 0);
+	}
+	t1->a2dp.pcm.fd = pcm_fds[0][1];
+	t1->a2dp.pcm_bc.fd = pcm_bc_fds[0][1];
+	t2->a2dp.pcm.fd = pcm_fds[1][1];
+	t2->a2dp.pcm_bc.fd = pcm_bc_fds[1][1];
+
+	/* music from the source and voice from the sink */
+	write_test_pcm(pcm_fds[0][0], t1->a2dp.pcm.channels, 4 * 1024);
+	write_test_pcm(pcm_bc_fds[1][0], t2->a2dp.pcm_bc.channels, 1024);
+
+	ck_assert_int_eq(ba_transport_thread_create(&t1->thread_enc,
+				a2dp_faststream_enc_thread, "duplex", true), 0);
+	ck_assert_int_eq(ba_transport_thread_create(&t2->thread_enc,
+				a2dp_faststream_enc_thread, "voice-enc", true), 0);
+	ck_assert_int_eq(ba_transport_thread_create(&t2->thread_dec,
+				a2dp_faststream_dec_thread, "music-dec", false), 0);
+
+	/* Drain request of the back-channel PCM shall be completed right away,
+	 * regardless of the state of the music stream. */
+	ck_assert_int_eq(ba_transport_pcm_drain(&t1->a2dp.pcm_bc, NULL, NULL), 0);
+
+	struct pollfd pfds[] = {
+		{ pcm_fds[1][0], POLLIN, 0 },
+		{ pcm_bc_fds[0][0], POLLIN, 0 }};
+	size_t music_samples = 0;
+	size_t voice_samples = 0;
+	int16_t buffer[1024];
+	ssize_t len;
+
+	while (poll(pfds, ARRAYSIZE(pfds), 500) > 0) {
+		if (pfds[0].revents & POLLIN &&
+				(len = read(pfds[0].fd, buffer, sizeof(buffer))) > 0)
+			music_samples += len / sizeof(int16_t);
+		if (pfds[1].revents & POLLIN &&
+				(len = read(pfds[1].fd, buffer, sizeof(buffer))) > 0)
+			voice_samples += len / sizeof(int16_t);
+	}
+
+	debug("Decoded samples: music: %zu, voice: %zu", music_samples, voice_samples);
+	ck_assert_uint_gt(music_samples, 0);
+	ck_assert_uint_gt(voice_samples, 0);
+
+	/* Disconnection of the remote device shall release the BT socket of
+	 * the duplex thread, instead of reporting it over and over again. */
+	transport_thread_cancel(&t2->thread_enc);
+	transport_thread_cancel(&t2->thread_dec);
+	close(bt_fds[0]);
+	t2->bt_fd = -1;
+	write_test_pcm(pcm_fds[0][0], t1->a2dp.pcm.channels, 1024);
+	for (size_t i = 0; i < 100 && t1->thread_enc.bt_fd != -1; i++)
+		usleep(10000);
+	ck_assert_int_eq(t1->thread_enc.bt_fd, -1);
+
+	transport_thread_cancel(&t1->thread_enc);
+
+	for (size_t i = 0; i < 2; i++) {
+		close(pcm_fds[i][0]);
+		close(pcm_bc_fds[i][0]);
+	}
+
 	ba_transport_destroy(t1);
 	ba_transport_destroy(t2);
 
@@ -748,17 +1762,90 @@ START_TEST(test_a2dp_ldac) {
 		t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write =
 			RTP_HEADER_LEN + sizeof(rtp_media_header_t) + 660 + 6;
 		test_a2dp(t1, t2, a2dp_ldac_enc_thread, test_io_thread_a2dp_dump_bt);
+		/* MDCT overlap and collection of a single LDAC frame */
+		ck_assert_int_eq(t1->a2dp.pcm.codec_delay, 2 * 128 * 10000 / 44100);
 #if HAVE_LDAC_DECODE
 		test_a2dp(t1, t2, test_io_thread_a2dp_dump_pcm, a2dp_ldac_dec_thread);
+		/* MDCT overlap of a single LDAC frame (128 frames at 44.1 kHz) */
+		ck_assert_int_eq(t2->a2dp.pcm.codec_delay, 128 * 10000 / 44100);
 #endif
 	}
 
 	ba_transport_destroy(t1);
 	ba_transport_destroy(t2);
 
+	if (aging_duration)
+		return;
+
+	/* LDAC frame at 96 kHz covers 256 PCM frames */
+	ttype.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE;
+	t1 = ba_transport_new_a2dp(device1, ttype, ":test", "/path/ldac",
+			&a2dp_codec_source_ldac, &config_ldac_96000_stereo);
+	ttype.profile = BA_TRANSPORT_PROFILE_A2DP_SINK;
+	t2 = ba_transport_new_a2dp(device2, ttype, ":test", "/path/ldac",
+			&a2dp_codec_sink_ldac, &config_ldac_96000_stereo);
+
+	t1->acquire = t2->acquire = test_transport_acquire;
+	t1->release = t2->release = test_transport_release_bt_a2dp;
+
+	debug("\n\n*** A2DP codec: LDAC (96 kHz) ***");
+	t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write =
+		RTP_HEADER_LEN + sizeof(rtp_media_header_t) + 660 + 6;
+	test_a2dp(t1, t2, a2dp_ldac_enc_thread, test_io_thread_a2dp_dump_bt);
+	ck_assert_int_eq(t1->a2dp.pcm.codec_delay, 2 * 256 * 10000 / 96000);
+#if HAVE_LDAC_DECODE
+	test_a2dp(t1, t2, test_io_thread_a2dp_dump_pcm, a2dp_ldac_dec_thread);
+	ck_assert_int_eq(t2->a2dp.pcm.codec_delay, 256 * 10000 / 96000);
+#endif
+
+	ba_transport_destroy(t1);
+	ba_transport_destroy(t2);
+
 } END_TEST
 #endif
 
+START_TEST(test_a2dp_plugin) {
+
+	const struct codec_plugin *plugin;
+	ck_assert_ptr_ne(plugin = codec_plugin_get(0), NULL);
+
+	const size_t size = plugin->abi->capabilities_size;
+	uint8_t configuration[32];
+	ck_assert_uint_le(size, sizeof(configuration));
+	memcpy(configuration, plugin->abi->capabilities, size);
+	ck_assert_int_eq(plugin->abi->select_configuration(configuration, size), 0);
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE,
+		.codec = plugin->codec_id };
+	struct ba_transport *t1 = ba_transport_new_a2dp(device1, ttype, ":test", "/path/plugin",
+			&plugin->codecs[A2DP_SOURCE], configuration);
+	ttype.profile = BA_TRANSPORT_PROFILE_A2DP_SINK;
+	struct ba_transport *t2 = ba_transport_new_a2dp(device2, ttype, ":test", "/path/plugin",
+			&plugin->codecs[A2DP_SINK], configuration);
+	ck_assert_ptr_ne(t1, NULL);
+	ck_assert_ptr_ne(t2, NULL);
+
+	t1->acquire = t2->acquire = test_transport_acquire;
+	t1->release = t2->release = test_transport_release_bt_a2dp;
+
+	debug("\n\n*** A2DP codec: %s (plug-in) ***", plugin->abi->name);
+	t1->mtu_read = t1->mtu_write = t2->mtu_read = t2->mtu_write = 1024;
+	test_a2dp(t1, t2, a2dp_plugin_enc_thread, test_io_thread_a2dp_dump_bt);
+	test_a2dp(t1, t2, test_io_thread_a2dp_dump_pcm, a2dp_plugin_dec_thread);
+
+	ba_transport_destroy(t1);
+	ba_transport_destroy(t2);
+
+	/* configuration rejected by the plug-in shall fail the transport setup */
+	memset(configuration + sizeof(a2dp_vendor_codec_t), 0, size - sizeof(a2dp_vendor_codec_t));
+	ttype.profile = BA_TRANSPORT_PROFILE_A2DP_SOURCE;
+	ck_assert_ptr_eq(ba_transport_new_a2dp(device1, ttype, ":test", "/path/plugin",
+				&plugin->codecs[A2DP_SOURCE], configuration), NULL);
+	ck_assert_int_eq(errno, EINVAL);
+
+} END_TEST
+
 START_TEST(test_sco_cvsd) {
 
 	struct ba_transport_type ttype = {
@@ -775,6 +1862,124 @@ START_TEST(test_sco_cvsd) {
 
 } END_TEST
 
+START_TEST(test_sco_cvsd_duplex) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_HSP_AG };
+	config.sco.duplex = true;
+	struct ba_transport *t = ba_transport_new_sco(device1, ttype, ":test", "/path/sco/cvsd", -1);
+	config.sco.duplex = false;
+
+	t->acquire = test_transport_acquire;
+
+	debug("\n\n*** SCO codec: CVSD (duplex) ***");
+	t->mtu_read = t->mtu_write = 48;
+	/* run echo canceller in the loop as well */
+	config.sco.aec = true;
+	test_sco(t, sco_duplex_thread, NULL);
+	config.sco.aec = false;
+
+	ba_transport_destroy(t);
+
+} END_TEST
+
+START_TEST(test_sco_cvsd_duplex_drain) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_HSP_AG };
+	config.sco.duplex = true;
+	struct ba_transport *t = ba_transport_new_sco(device1, ttype, ":test", "/path/sco/cvsd", -1);
+	config.sco.duplex = false;
+	struct ba_transport_pcm *pcm = &t->sco.spk_pcm;
+
+	t->acquire = test_transport_acquire;
+	t->mtu_read = t->mtu_write = 48;
+
+	int sco_fds[2];
+	int pcm_fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sco_fds), 0);
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pcm_fds), 0);
+	t->bt_fd = sco_fds[1];
+	pcm->fd = pcm_fds[1];
+
+	ck_assert_int_eq(ba_transport_thread_create(&t->thread_enc, sco_duplex_thread, "sco-duplex", true), 0);
+
+	struct timespec ts_start, ts_now, ts_diff;
+	atomic_bool drained = false;
+
+	/* Less than a single packet is treated as drained, so the drain shall
+	 * be completed even though the remote device does not send anything. */
+	static const int16_t samples[1000] = { 0 };
+	ck_assert_int_eq(write(pcm_fds[0], samples, 10 * sizeof(*samples)), 10 * sizeof(*samples));
+	gettimestamp(&ts_start);
+	ck_assert_int_eq(ba_transport_pcm_drain(pcm, test_a2dp_drain_complete, &drained), 0);
+	while (!atomic_load(&drained)) {
+		usleep(1000);
+		gettimestamp(&ts_now);
+		timespecsub(&ts_now, &ts_start, &ts_diff);
+		ck_assert_int_lt(ts_diff.tv_sec * 1000 + ts_diff.tv_nsec / 1000000, 200);
+	}
+
+	/* With the stalled link, the drain shall be completed after the timeout,
+	 * so the client will not wait forever. */
+	drained = false;
+	ck_assert_int_eq(write(pcm_fds[0], samples, sizeof(samples)), sizeof(samples));
+	gettimestamp(&ts_start);
+	ck_assert_int_eq(ba_transport_pcm_drain(pcm, test_a2dp_drain_complete, &drained), 0);
+	while (!atomic_load(&drained)) {
+		usleep(1000);
+		gettimestamp(&ts_now);
+		timespecsub(&ts_now, &ts_start, &ts_diff);
+		ck_assert_int_lt(ts_diff.tv_sec * 1000 + ts_diff.tv_nsec / 1000000, IO_PCM_DRAIN_TIMEOUT_MS + 500);
+	}
+	ck_assert_int_ge(ts_diff.tv_sec * 1000 + ts_diff.tv_nsec / 1000000, IO_PCM_DRAIN_TIMEOUT_MS);
+
+	pthread_mutex_lock(&pcm->mutex);
+	ba_transport_pcm_release(pcm);
+	pthread_mutex_unlock(&pcm->mutex);
+	transport_thread_cancel(&t->thread_enc);
+
+	close(pcm_fds[0]);
+	close(sco_fds[0]);
+	ba_transport_destroy(t);
+
+} END_TEST
+
+START_TEST(test_sco_cvsd_mtu_detect) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_HSP_AG };
+	struct ba_transport *t = ba_transport_new_sco(device1, ttype, ":test", "/path/sco/cvsd", -1);
+
+	t->acquire = test_transport_acquire;
+
+	debug("\n\n*** SCO codec: CVSD (MTU detection) ***");
+	t->mtu_read = t->mtu_write = 48;
+
+	int sco_fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sco_fds), 0);
+	t->bt_fd = sco_fds[1];
+
+	ck_assert_int_eq(ba_transport_thread_create(&t->thread_dec, sco_dec_thread, "sco-dec", true), 0);
+
+	/* remote device sends packets bigger than the MTU guessed by us */
+	uint8_t buffer[60] = { 0 };
+	for (size_t i = 0; i < 32; i++)
+		ck_assert_int_eq(write(sco_fds[0], buffer, sizeof(buffer)), sizeof(buffer));
+
+	for (size_t i = 0; i < 50 && t->mtu_write != sizeof(buffer); i++)
+		usleep(10000);
+
+	ck_assert_uint_eq(t->mtu_read, sizeof(buffer));
+	ck_assert_uint_eq(t->mtu_write, sizeof(buffer));
+
+	transport_thread_cancel(&t->thread_dec);
+	close(sco_fds[0]);
+
+	ba_transport_destroy(t);
+
+} END_TEST
+
 #if ENABLE_MSBC
 START_TEST(test_sco_msbc) {
 
@@ -791,6 +1996,179 @@ START_TEST(test_sco_msbc) {
 
 	ba_transport_destroy(t);
 
+} END_TEST
+
+START_TEST(test_sco_msbc_duplex) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_HFP_AG,
+		.codec = HFP_CODEC_MSBC };
+	config.sco.duplex = true;
+	struct ba_transport *t = ba_transport_new_sco(device1, ttype, ":test", "/path/sco/msbc", -1);
+	config.sco.duplex = false;
+
+	t->acquire = test_transport_acquire;
+
+	debug("\n\n*** SCO codec: mSBC (duplex) ***");
+	t->mtu_read = t->mtu_write = 24;
+	test_sco(t, sco_duplex_thread, NULL);
+
+	ba_transport_destroy(t);
+
+} END_TEST
+#endif
+
+#if ENABLE_LC3_SWB
+START_TEST(test_sco_lc3_swb) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_HFP_AG,
+		.codec = HFP_CODEC_LC3_SWB };
+	struct ba_transport *t = ba_transport_new_sco(device1, ttype, ":test", "/path/sco/lc3", -1);
+
+	t->acquire = test_transport_acquire;
+
+	debug("\n\n*** SCO codec: LC3-SWB ***");
+	t->mtu_read = t->mtu_write = 60;
+	test_sco(t, sco_enc_thread, sco_dec_thread);
+
+	ba_transport_destroy(t);
+
+} END_TEST
+
+START_TEST(test_sco_lc3_swb_duplex) {
+
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_HFP_AG,
+		.codec = HFP_CODEC_LC3_SWB };
+	config.sco.duplex = true;
+	struct ba_transport *t = ba_transport_new_sco(device1, ttype, ":test", "/path/sco/lc3", -1);
+	config.sco.duplex = false;
+
+	t->acquire = test_transport_acquire;
+
+	debug("\n\n*** SCO codec: LC3-SWB (duplex) ***");
+	t->mtu_read = t->mtu_write = 60;
+	test_sco(t, sco_duplex_thread, NULL);
+
+	ba_transport_destroy(t);
+
+} END_TEST
+#endif
+
+#if ENABLE_LE_AUDIO
+static const struct bap_lc3_configuration config_lc3_48000_stereo = {
+	.sampling = 48000,
+	.frame_us = 10000,
+	.locations = BAP_LOCATION_FRONT_LEFT | BAP_LOCATION_FRONT_RIGHT,
+	.channels = 2,
+	.frame_len = 100,
+	.frame_blocks = 1,
+};
+
+START_TEST(test_bap_lc3) {
+
+	const struct bap_lc3_configuration *conf = &config_lc3_48000_stereo;
+	struct ba_transport_type ttype = {
+		.profile = BA_TRANSPORT_PROFILE_BAP_SOURCE,
+		.codec = BAP_CODEC_LC3 };
+	struct ba_transport *t1 = ba_transport_new_bap(device1, ttype, ":test", "/path/lc3", conf);
+	ttype.profile = BA_TRANSPORT_PROFILE_BAP_SINK;
+	struct ba_transport *t2 = ba_transport_new_bap(device2, ttype, ":test", "/path/lc3", conf);
+
+	t1->acquire = t2->acquire = test_transport_acquire;
+
+	const size_t sdu_size = bap_lc3_sdu_size(conf);
+	const size_t sdu_samples = bap_lc3_frame_samples(conf) * conf->frame_blocks * conf->channels;
+	/* allow reading SDUs bigger than the configured one */
+	t1->mtu_write = sdu_size;
+	t2->mtu_read = 2 * sdu_size;
+
+	int bt1_fds[2];
+	int bt2_fds[2];
+	int pcm1_fds[2];
+	int pcm2_fds[2];
+
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, bt1_fds), 0);
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, bt2_fds), 0);
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, pcm1_fds), 0);
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, pcm2_fds), 0);
+	/* internal PCM endpoints are non-blocking, as they are in the daemon */
+	ck_assert_int_ne(fcntl(pcm1_fds[1], F_SETFL, O_NONBLOCK), -1);
+	ck_assert_int_ne(fcntl(pcm2_fds[1], F_SETFL, O_NONBLOCK), -1);
+
+	t1->bt_fd = bt1_fds[1];
+	t1->bap.pcm.fd = pcm1_fds[1];
+	t2->bt_fd = bt2_fds[1];
+	t2->bap.pcm.fd = pcm2_fds[1];
+
+	debug("\n\n*** BAP codec: LC3 ***");
+	write_test_pcm(pcm1_fds[0], conf->channels, 10 * sdu_samples / conf->channels);
+
+	ck_assert_int_eq(ba_transport_thread_create(&t1->thread_enc, bap_lc3_enc_thread, "bap-enc", true), 0);
+	ck_assert_int_eq(ba_transport_thread_create(&t2->thread_dec, bap_lc3_dec_thread, "bap-dec", true), 0);
+
+	struct pollfd pfds[] = {
+		{ bt1_fds[0], POLLIN, 0 },
+		{ pcm2_fds[0], POLLIN, 0 }};
+	size_t sdus_total = 0;
+	size_t decoded_samples_total = 0;
+	int decoded_samples_peak = 0;
+	uint8_t buffer[1024];
+	ssize_t len;
+
+	while (poll(pfds, ARRAYSIZE(pfds), 500) > 0) {
+
+		if (pfds[0].revents & POLLIN) {
+
+			/* encoder shall write the whole SDU at once */
+			ck_assert_int_gt(len = read(bt1_fds[0], buffer, sizeof(buffer)), 0);
+			ck_assert_int_eq(len, sdu_size);
+
+			char label[35];
+			sprintf(label, "BT data [len: %3zd]", len);
+			hexdump(label, buffer, len);
+
+			/* Corrupt SDUs by truncating and by extending them. All frames
+			 * of such SDUs shall be concealed by the decoder. */
+			if (sdus_total == 3)
+				len = sdu_size / 2;
+			if (sdus_total == 6)
+				len = sdu_size + 1;
+
+			ck_assert_int_eq(write(bt2_fds[0], buffer, len), len);
+			sdus_total++;
+
+		}
+
+		if (pfds[1].revents & POLLIN) {
+			int16_t *samples = (int16_t *)buffer;
+			ck_assert_int_gt(len = read(pcm2_fds[0], buffer, sizeof(buffer)), 0);
+			for (size_t i = 0; i < len / sizeof(*samples); i++)
+				decoded_samples_peak = MAX(decoded_samples_peak, abs(samples[i]));
+			decoded_samples_total += len / sizeof(*samples);
+		}
+
+	}
+
+	debug("Decoded samples total: %zd", decoded_samples_total);
+	/* every SDU, including the concealed ones, shall be decoded */
+	ck_assert_uint_gt(sdus_total, 6);
+	ck_assert_uint_eq(decoded_samples_total, sdus_total * sdu_samples);
+	/* the decoded signal shall not be silence */
+	ck_assert_int_gt(decoded_samples_peak, 1000);
+
+	transport_thread_cancel(&t1->thread_enc);
+	transport_thread_cancel(&t2->thread_dec);
+
+	close(pcm1_fds[0]);
+	close(pcm2_fds[0]);
+	close(bt1_fds[0]);
+	close(bt2_fds[0]);
+
+	ba_transport_destroy(t1);
+	ba_transport_destroy(t2);
+
 } END_TEST
 #endif
 
@@ -803,6 +2181,7 @@ int main(int argc, char *argv[]) {
 		{ "aging", required_argument, NULL, 'a' },
 		{ "dump", no_argument, NULL, 'd' },
 		{ "input", required_argument, NULL, 'i' },
+		{ "freerun-clock", no_argument, NULL, 'f' },
 		{ 0, 0, 0, 0 },
 	};
 
@@ -828,12 +2207,16 @@ int main(int argc, char *argv[]) {
 		{ ba_transport_codecs_hfp_to_string(HFP_CODEC_CVSD), TEST_CODEC_CVSD },
 #define TEST_CODEC_MSBC (1 << 8)
 		{ ba_transport_codecs_hfp_to_string(HFP_CODEC_MSBC), TEST_CODEC_MSBC },
+#define TEST_CODEC_LC3_SWB (1 << 9)
+		{ ba_transport_codecs_hfp_to_string(HFP_CODEC_LC3_SWB), TEST_CODEC_LC3_SWB },
+#define TEST_CODEC_LC3 (1 << 10)
+		{ ba_transport_codecs_bap_to_string(BAP_CODEC_LC3), TEST_CODEC_LC3 },
 	};
 
 	while ((opt = getopt_long(argc, argv, opts, longopts, NULL)) != -1)
 		switch (opt) {
 		case 'h' /* --help */ :
-			printf("usage: %s [--aging=SEC] [--dump] [--input=FILE] [codec ...]\n", argv[0]);
+			printf("usage: %s [--aging=SEC] [--dump] [--input=FILE] [--freerun-clock] [codec ...]\n", argv[0]);
 			return 0;
 		case 'a' /* --aging=SEC */ :
 			aging_duration = atoi(optarg);
@@ -844,6 +2227,10 @@ int main(int argc, char *argv[]) {
 		case 'i' /* --input=FILE */ :
 			input_pcm_file = optarg;
 			break;
+		case 'f' /* --freerun-clock */ :
+			/* run IO threads at the maximum speed */
+			rt_clock_set(&rt_clock_freerun);
+			break;
 		default:
 			fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
 			return 1;
@@ -865,6 +2252,11 @@ int main(int argc, char *argv[]) {
 	device1 = ba_device_new(adapter, &addr1);
 	device2 = ba_device_new(adapter, &addr2);
 
+	/* test-io and the test codec plug-in shall be placed in the same directory */
+	char plugin_path[256];
+	snprintf(plugin_path, sizeof(plugin_path), "%s/.libs/aplugin.so", dirname(strdup(argv[0])));
+	codec_plugin_load(plugin_path);
+
 	Suite *s = suite_create(__FILE__);
 	TCase *tc = tcase_create(__FILE__);
 	SRunner *sr = srunner_create(s);
@@ -873,8 +2265,19 @@ int main(int argc, char *argv[]) {
 	tcase_set_timeout(tc, aging_duration +
 			(input_pcm_file != NULL ? 180 : 5));
 
-	if (enabled_codecs & TEST_CODEC_SBC)
+	tcase_add_test(tc, test_io_bt_abr);
+	tcase_add_test(tc, test_io_pcm_overrun);
+	tcase_add_test(tc, test_io_bt_read_rx_overflows);
+	tcase_add_test(tc, test_io_bt_receiver_overflow);
+	tcase_add_test(tc, test_io_pcm_mix_partial_frame);
+	tcase_add_test(tc, test_io_pcm_remap);
+	tcase_add_test(tc, test_io_pcm_monitor);
+
+	if (enabled_codecs & TEST_CODEC_SBC) {
 		tcase_add_test(tc, test_a2dp_sbc);
+		tcase_add_test(tc, test_a2dp_sbc_drain);
+		tcase_add_test(tc, test_a2dp_sbc_silence_suspend);
+	}
 #if ENABLE_MP3LAME
 	if (enabled_codecs & TEST_CODEC_MP3)
 		tcase_add_test(tc, test_a2dp_mp3);
@@ -883,10 +2286,14 @@ int main(int argc, char *argv[]) {
 	config.aac_afterburner = true;
 	if (enabled_codecs & TEST_CODEC_AAC)
 		tcase_add_test(tc, test_a2dp_aac);
+	if (enabled_codecs & TEST_CODEC_AAC)
+		tcase_add_test(tc, test_a2dp_aac_eld);
 #endif
 #if ENABLE_APTX
 	if (enabled_codecs & TEST_CODEC_APTX)
 		tcase_add_test(tc, test_a2dp_aptx);
+	if (enabled_codecs & TEST_CODEC_APTX)
+		tcase_add_test(tc, test_a2dp_aptx_ll);
 #endif
 #if ENABLE_APTX_HD
 	if (enabled_codecs & TEST_CODEC_APTX_HD)
@@ -895,6 +2302,8 @@ int main(int argc, char *argv[]) {
 #if ENABLE_FASTSTREAM
 	if (enabled_codecs & TEST_CODEC_FASTSTREAM)
 		tcase_add_test(tc, test_a2dp_faststream);
+	if (enabled_codecs & TEST_CODEC_FASTSTREAM)
+		tcase_add_test(tc, test_a2dp_faststream_duplex);
 #endif
 #if ENABLE_LDAC
 	config.ldac_abr = true;
@@ -902,11 +2311,30 @@ int main(int argc, char *argv[]) {
 	if (enabled_codecs & TEST_CODEC_LDAC)
 		tcase_add_test(tc, test_a2dp_ldac);
 #endif
+	tcase_add_test(tc, test_a2dp_plugin);
 	if (enabled_codecs & TEST_CODEC_CVSD)
 		tcase_add_test(tc, test_sco_cvsd);
+	if (enabled_codecs & TEST_CODEC_CVSD)
+		tcase_add_test(tc, test_sco_cvsd_duplex);
+	if (enabled_codecs & TEST_CODEC_CVSD)
+		tcase_add_test(tc, test_sco_cvsd_duplex_drain);
+	if (enabled_codecs & TEST_CODEC_CVSD)
+		tcase_add_test(tc, test_sco_cvsd_mtu_detect);
 #if ENABLE_MSBC
 	if (enabled_codecs & TEST_CODEC_MSBC)
 		tcase_add_test(tc, test_sco_msbc);
+	if (enabled_codecs & TEST_CODEC_MSBC)
+		tcase_add_test(tc, test_sco_msbc_duplex);
+#endif
+#if ENABLE_LC3_SWB
+	if (enabled_codecs & TEST_CODEC_LC3_SWB)
+		tcase_add_test(tc, test_sco_lc3_swb);
+	if (enabled_codecs & TEST_CODEC_LC3_SWB)
+		tcase_add_test(tc, test_sco_lc3_swb_duplex);
+#endif
+#if ENABLE_LE_AUDIO
+	if (enabled_codecs & TEST_CODEC_LC3)
+		tcase_add_test(tc, test_bap_lc3);
 #endif
 
 	srunner_run_all(sr, CK_ENV);
@@ -0,0 +1,301 @@
+/*
+ * test-jitter.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <check.h>
+
+#include "jitter.h"
+#include "shared/defs.h"
+
+/* with such a rate, one frame lasts exactly one millisecond */
+#define TEST_RATE 1000
+
+static struct timespec test_ts(unsigned int ms) {
+	struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L };
+	return ts;
+}
+
+static struct timespec test_ts_us(uint64_t us) {
+	struct timespec ts = { .tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000 };
+	return ts;
+}
+
+static void test_push_ramp(struct jitter_buffer *jb, int16_t start,
+		size_t frames, unsigned int ms) {
+	int16_t buffer[2048];
+	for (size_t i = 0; i < frames; i++)
+		buffer[i] = start + i;
+	const struct timespec ts = test_ts(ms);
+	ck_assert_uint_eq(jitter_buffer_push(jb, buffer, frames, &ts), frames);
+}
+
+START_TEST(test_jitter_init) {
+
+	struct jitter_buffer jb = { 0 };
+
+	ck_assert_int_eq(jitter_buffer_init(&jb, sizeof(int16_t), TEST_RATE, 0), -1);
+	ck_assert_int_eq(jitter_buffer_init(&jb, sizeof(int16_t), TEST_RATE, JITTER_BUFFER_MAX_MS + 1), -1);
+	ck_assert_int_eq(jitter_buffer_init(&jb, 0, TEST_RATE, 20), -1);
+	ck_assert_int_eq(jitter_buffer_is_initialized(&jb), false);
+
+	ck_assert_int_eq(jitter_buffer_init(&jb, sizeof(int16_t), TEST_RATE, 20), 0);
+	ck_assert_int_eq(jitter_buffer_is_initialized(&jb), true);
+	ck_assert_uint_eq(jb.target, 20);
+	ck_assert_uint_eq(jitter_buffer_get_delay(&jb), 0);
+	jitter_buffer_free(&jb);
+
+	ck_assert_int_eq(jitter_buffer_is_initialized(&jb), false);
+
+} END_TEST
+
+START_TEST(test_jitter_playout) {
+
+	struct jitter_buffer jb = { 0 };
+	int16_t buffer[10];
+	size_t i;
+
+	ck_assert_int_eq(jitter_buffer_init(&jb, sizeof(int16_t), TEST_RATE, 20), 0);
+
+	/* playout does not start until the target latency is reached */
+	test_push_ramp(&jb, 0, 15, 0);
+	ck_assert_uint_eq(jitter_buffer_pull(&jb, buffer, ARRAYSIZE(buffer)), 0);
+	test_push_ramp(&jb, 15, 15, 15);
+	ck_assert_uint_eq(jitter_buffer_get_delay(&jb), 300);
+
+	for (i = 0; i < 3; i++) {
+		ck_assert_uint_eq(jitter_buffer_pull(&jb, buffer, ARRAYSIZE(buffer)), 10);
+		ck_assert_int_eq(buffer[0], i * 10);
+		ck_assert_int_eq(buffer[9], i * 10 + 9);
+	}
+
+	/* underrun stops the playout */
+	ck_assert_uint_eq(jitter_buffer_pull(&jb, buffer, ARRAYSIZE(buffer)), 0);
+	ck_assert_uint_eq(jb.underruns, 1);
+	test_push_ramp(&jb, 30, 15, 30);
+	ck_assert_uint_eq(jitter_buffer_pull(&jb, buffer, ARRAYSIZE(buffer)), 0);
+
+	/* discard buffered signal */
+	jitter_buffer_reset(&jb);
+	ck_assert_uint_eq(jitter_buffer_get_delay(&jb), 0);
+
+	jitter_buffer_free(&jb);
+
+} END_TEST
+
+START_TEST(test_jitter_overflow) {
+
+	struct jitter_buffer jb = { 0 };
+	int16_t buffer[500];
+
+	ck_assert_int_eq(jitter_buffer_init(&jb, sizeof(int16_t), TEST_RATE, 20), 0);
+
+	/* the oldest signal shall be discarded */
+	test_push_ramp(&jb, 0, jb.capacity - 5, 0);
+	test_push_ramp(&jb, jb.capacity - 5, 10, 0);
+	ck_assert_uint_eq(jb.frames, jb.capacity);
+	ck_assert_uint_eq(jb.overflows, 1);
+
+	ck_assert_uint_eq(jitter_buffer_pull(&jb, buffer, 10), 10);
+	ck_assert_int_eq(buffer[0], 5);
+
+	/* data shall wrap around the ring */
+	test_push_ramp(&jb, jb.capacity + 5, 10, 10);
+	ck_assert_uint_eq(jb.frames, jb.capacity);
+	ck_assert_uint_eq(jitter_buffer_pull(&jb, buffer, 500), 500);
+	ck_assert_int_eq(buffer[0], 15);
+	ck_assert_uint_eq(jitter_buffer_pull(&jb, buffer, 500), 500);
+	ck_assert_int_eq(buffer[499], jb.capacity + 14);
+
+	jitter_buffer_free(&jb);
+
+} END_TEST
+
+START_TEST(test_jitter_drift) {
+
+	struct jitter_buffer jb = { 0 };
+	int16_t buffer[10];
+	unsigned int i;
+
+	/* remote clock is faster than the playout clock */
+	ck_assert_int_eq(jitter_buffer_init(&jb, sizeof(int16_t), TEST_RATE, 50), 0);
+	test_push_ramp(&jb, 0, 50, 0);
+	for (i = 1; i <= 150; i++) {
+		test_push_ramp(&jb, 0, 11, i * 11);
+		ck_assert_uint_eq(jitter_buffer_pull(&jb, buffer, ARRAYSIZE(buffer)), 10);
+	}
+	ck_assert_int_lt(jb.drift_frames, 0);
+
+	/* remote clock is slower than the playout clock */
+	ck_assert_int_eq(jitter_buffer_init(&jb, sizeof(int16_t), TEST_RATE, 200), 0);
+	test_push_ramp(&jb, 0, 200, 0);
+	for (i = 1; i <= 150; i++) {
+		test_push_ramp(&jb, 0, 9, i * 9);
+		ck_assert_uint_eq(jitter_buffer_pull(&jb, buffer, ARRAYSIZE(buffer)), 10);
+	}
+	ck_assert_int_gt(jb.drift_frames, 0);
+	ck_assert_uint_eq(jb.underruns, 0);
+
+	jitter_buffer_free(&jb);
+
+} END_TEST
+
+START_TEST(test_jitter_drift_tracking) {
+
+	struct jitter_buffer jb = { 0 };
+	int16_t buffer[10] = { 0 };
+	uint64_t us_push = 0, us_pull = 50000;
+	unsigned int i;
+
+	ck_assert_int_eq(jitter_buffer_init(&jb, sizeof(int16_t), TEST_RATE, 50), 0);
+
+	/* Source clock is 2000 ppm faster, which is twice as much as the fixed
+	 * rate of single frame steps would compensate. Simulate 60 seconds of
+	 * the playout with interleaved arrivals and pulls. */
+	for (i = 0; i < 6000; ) {
+		if (us_push <= us_pull) {
+			const struct timespec ts = test_ts_us(us_push);
+			ck_assert_uint_eq(jitter_buffer_push(&jb, buffer, 10, &ts), 10);
+			us_push += 9980;
+			continue;
+		}
+		ck_assert_uint_eq(jitter_buffer_pull(&jb, buffer, ARRAYSIZE(buffer)), 10);
+		us_pull += 10000;
+		i++;
+	}
+
+	ck_assert_int_eq(jb.clock.valid, true);
+	/* all excess frames shall be dropped and the level shall not run away */
+	ck_assert_int_le(jb.drift_frames, -100);
+	ck_assert_uint_le(jb.frames, jb.target + 2 * ARRAYSIZE(buffer));
+	ck_assert_uint_eq(jb.underruns, 0);
+	ck_assert_uint_eq(jb.overflows, 0);
+
+	jitter_buffer_free(&jb);
+
+} END_TEST
+
+START_TEST(test_jitter_drift_estimated) {
+
+	struct jitter_buffer jb = { 0 };
+	int16_t buffer[10] = { 0 };
+	uint64_t us_push = 0, us_pull = 50000;
+	unsigned int i, j;
+	int drift_frames = 0;
+
+	ck_assert_int_eq(jitter_buffer_init(&jb, sizeof(int16_t), TEST_RATE, 50), 0);
+
+	/* Source clock is 1000 ppm faster and every third packet is delayed.
+	 * Once the estimation is reliable, the drift shall be compensated at
+	 * the estimated rate: 1 frame per 1000 pulled frames. */
+	for (i = 0, j = 0; i < 6000; ) {
+		if (us_push <= us_pull) {
+			const struct timespec ts = test_ts_us(us_push + (j++ % 3 == 0 ? 4000 : 0));
+			ck_assert_uint_eq(jitter_buffer_push(&jb, buffer, 10, &ts), 10);
+			us_push += 9990;
+			continue;
+		}
+		ck_assert_uint_eq(jitter_buffer_pull(&jb, buffer, ARRAYSIZE(buffer)), 10);
+		us_pull += 10000;
+		if (++i == 1500) {
+			ck_assert_int_eq(jb.clock.valid, true);
+			drift_frames = jb.drift_frames;
+		}
+	}
+
+	/* 45 seconds of the playout with the estimation */
+	ck_assert_int_ge(jb.drift_frames - drift_frames, -45 - 3);
+	ck_assert_int_le(jb.drift_frames - drift_frames, -45 + 3);
+	/* the level does not have to reach the tolerance limit */
+	const size_t tolerance = ARRAYSIZE(buffer) + jb.jitter / 16;
+	ck_assert_uint_lt(jb.level / 16, jb.target + tolerance);
+	ck_assert_uint_eq(jb.underruns, 0);
+	ck_assert_uint_eq(jb.overflows, 0);
+
+	jitter_buffer_free(&jb);
+
+} END_TEST
+
+START_TEST(test_jitter_adaptive_target) {
+
+	struct jitter_buffer jb = { 0 };
+	unsigned int i;
+
+	ck_assert_int_eq(jitter_buffer_init(&jb, sizeof(int16_t), TEST_RATE, 20), 0);
+
+	/* regular arrivals shall not change the target latency */
+	for (i = 0; i < 100; i++)
+		test_push_ramp(&jb, 0, 10, i * 10);
+	ck_assert_uint_eq(jb.target, 20);
+
+	/* packets delivered in bursts of two */
+	jitter_buffer_reset(&jb);
+	for (i = 0; i < 100; i++)
+		test_push_ramp(&jb, 0, 10, 1000 + i / 2 * 20);
+	ck_assert_uint_gt(jb.target, 20);
+	ck_assert_uint_le(jb.target, JITTER_BUFFER_MAX_MS);
+
+	jitter_buffer_free(&jb);
+
+} END_TEST
+
+START_TEST(test_jitter_clock) {
+
+	struct jitter_buffer jb = { 0 };
+	int16_t buffer[10] = { 0 };
+	struct timespec ts;
+	unsigned int i;
+
+	ck_assert_int_eq(jitter_buffer_init(&jb, sizeof(int16_t), TEST_RATE, 20), 0);
+
+	/* source clock is 1000 ppm faster, some packets are delayed */
+	for (i = 0; i < 1500; i++) {
+		ts = test_ts_us(i * 9990 + (i % 3 == 0 ? 4000 : 0));
+		ck_assert_uint_eq(jitter_buffer_push(&jb, buffer, 10, &ts), 10);
+		jitter_buffer_reset(&jb);
+	}
+	ck_assert_int_eq(jb.clock.valid, true);
+	ck_assert_int_ge(jb.clock.ppm, 1000 - 10);
+	ck_assert_int_le(jb.clock.ppm, 1000 + 10);
+
+	/* pause in the stream restarts the estimation */
+	ts = test_ts_us(i * 9990 + 1000000);
+	jitter_buffer_push(&jb, buffer, 10, &ts);
+	ck_assert_int_eq(jb.clock.valid, false);
+
+	jitter_buffer_free(&jb);
+
+} END_TEST
+
+int main(void) {
+
+	Suite *s = suite_create(__FILE__);
+	TCase *tc = tcase_create(__FILE__);
+	SRunner *sr = srunner_create(s);
+
+	suite_add_tcase(s, tc);
+
+	tcase_add_test(tc, test_jitter_init);
+	tcase_add_test(tc, test_jitter_playout);
+	tcase_add_test(tc, test_jitter_overflow);
+	tcase_add_test(tc, test_jitter_drift);
+	tcase_add_test(tc, test_jitter_drift_tracking);
+	tcase_add_test(tc, test_jitter_drift_estimated);
+	tcase_add_test(tc, test_jitter_adaptive_target);
+	tcase_add_test(tc, test_jitter_clock);
+
+	srunner_run_all(sr, CK_ENV);
+	int nf = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return nf == 0 ? 0 : 1;
+}
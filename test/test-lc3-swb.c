@@ -0,0 +1,187 @@
+/*
+ * test-lc3-swb.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <check.h>
+#include <glib.h>
+
+#include "codec-lc3-swb.h"
+#include "shared/defs.h"
+#include "shared/rb.h"
+
+#include "inc/sine.inc"
+#include "../src/codec-lc3-swb.c"
+
+static size_t test_lc3_swb_encode(int16_t *pcm, size_t samples, uint8_t *data) {
+
+	struct esco_lc3_swb lc3_swb = { .initialized = false };
+	uint8_t *data_tail = data;
+	size_t len;
+	size_t i;
+	int rv;
+
+	ck_assert_int_eq(lc3_swb_init(&lc3_swb), 0);
+	for (rv = 1, i = 0; rv == 1;) {
+
+		len = MIN(samples - i, rb_len_in(&lc3_swb.pcm));
+		memcpy(rb_tail(&lc3_swb.pcm), &pcm[i], len * lc3_swb.pcm.size);
+		rb_seek(&lc3_swb.pcm, len);
+		i += len;
+
+		rv = lc3_swb_encode(&lc3_swb);
+
+		len = rb_blen_out(&lc3_swb.data);
+		memcpy(data_tail, rb_head(&lc3_swb.data), len);
+		rb_shift(&lc3_swb.data, len);
+		data_tail += len;
+
+	}
+
+	lc3_swb_finish(&lc3_swb);
+	return data_tail - data;
+}
+
+START_TEST(test_lc3_swb_init) {
+
+	struct esco_lc3_swb lc3_swb = { .initialized = false };
+
+	ck_assert_int_eq(lc3_swb_init(&lc3_swb), 0);
+	ck_assert_int_eq(lc3_swb.initialized, true);
+	ck_assert_int_eq(rb_len_out(&lc3_swb.pcm), 0);
+
+	rb_seek(&lc3_swb.pcm, 16);
+	ck_assert_int_eq(rb_len_out(&lc3_swb.pcm), 16);
+
+	ck_assert_int_eq(lc3_swb_init(&lc3_swb), 0);
+	ck_assert_int_eq(lc3_swb.initialized, true);
+	ck_assert_int_eq(rb_len_out(&lc3_swb.pcm), 0);
+
+	lc3_swb_finish(&lc3_swb);
+
+} END_TEST
+
+START_TEST(test_lc3_swb_encode_decode) {
+
+	struct esco_lc3_swb lc3_swb = { .initialized = false };
+	int16_t sine[LC3_SWB_CODESAMPLES * 8];
+	uint8_t data[sizeof(sine)];
+	size_t len;
+	size_t i;
+	int rv;
+
+	snd_pcm_sine_s16le(sine, ARRAYSIZE(sine), 1, 0, 1.0 / 128);
+
+	const size_t data_len = test_lc3_swb_encode(sine, ARRAYSIZE(sine), data);
+	ck_assert_int_eq(data_len, sizeof(esco_lc3_swb_frame_t) * 8);
+	ck_assert_int_eq(sizeof(esco_lc3_swb_frame_t), 60);
+
+	/* frames are stored back-to-back with consecutive sequence numbers */
+	const esco_lc3_swb_frame_t *frames = (esco_lc3_swb_frame_t *)data;
+	for (i = 0; i < 8; i++) {
+		const uint16_t h2 = le16toh(frames[i].header);
+		ck_assert_int_eq(ESCO_H2_GET_SYNCWORD(h2), ESCO_H2_SYNCWORD);
+		ck_assert_int_eq(ESCO_H2_GET_SEQ(h2), i % 4);
+	}
+
+	int16_t pcm[ARRAYSIZE(sine)];
+	int16_t *pcm_tail = pcm;
+
+	ck_assert_int_eq(lc3_swb_init(&lc3_swb), 0);
+	for (rv = 1, i = 0; rv == 1; ) {
+
+		len = MIN(data_len - i, rb_blen_in(&lc3_swb.data));
+		memcpy(rb_tail(&lc3_swb.data), &data[i], len);
+		rb_seek(&lc3_swb.data, len);
+		i += len;
+
+		rv = lc3_swb_decode(&lc3_swb);
+
+		len = rb_len_out(&lc3_swb.pcm);
+		memcpy(pcm_tail, rb_head(&lc3_swb.pcm), len * lc3_swb.pcm.size);
+		rb_shift(&lc3_swb.pcm, len);
+		pcm_tail += len;
+
+	}
+
+	ck_assert_int_eq(pcm_tail - pcm, ARRAYSIZE(sine));
+	ck_assert_int_eq(lc3_swb.frames_concealed, 0);
+
+	lc3_swb_finish(&lc3_swb);
+
+} END_TEST
+
+START_TEST(test_lc3_swb_decode_plc) {
+
+	struct esco_lc3_swb lc3_swb = { .initialized = false };
+	int16_t sine[LC3_SWB_CODESAMPLES * 8];
+	uint8_t data[sizeof(sine)];
+	size_t len;
+	size_t i;
+	int rv;
+
+	snd_pcm_sine_s16le(sine, ARRAYSIZE(sine), 1, 0, 1.0 / 128);
+
+	size_t data_len = test_lc3_swb_encode(sine, ARRAYSIZE(sine), data);
+	ck_assert_int_eq(data_len, sizeof(esco_lc3_swb_frame_t) * 8);
+
+	/* drop the 4th frame */
+	const size_t frame_len = sizeof(esco_lc3_swb_frame_t);
+	memmove(&data[frame_len * 3], &data[frame_len * 4], data_len - frame_len * 4);
+	data_len -= frame_len;
+
+	int16_t pcm[ARRAYSIZE(sine)];
+	int16_t *pcm_tail = pcm;
+
+	ck_assert_int_eq(lc3_swb_init(&lc3_swb), 0);
+	for (rv = 1, i = 0; rv == 1; ) {
+
+		len = MIN(data_len - i, rb_blen_in(&lc3_swb.data));
+		memcpy(rb_tail(&lc3_swb.data), &data[i], len);
+		rb_seek(&lc3_swb.data, len);
+		i += len;
+
+		rv = lc3_swb_decode(&lc3_swb);
+
+		len = rb_len_out(&lc3_swb.pcm);
+		memcpy(pcm_tail, rb_head(&lc3_swb.pcm), len * lc3_swb.pcm.size);
+		rb_shift(&lc3_swb.pcm, len);
+		pcm_tail += len;
+
+	}
+
+	/* lost frame shall be replaced */
+	ck_assert_int_eq(pcm_tail - pcm, ARRAYSIZE(sine));
+	ck_assert_int_eq(lc3_swb.frames_concealed, 1);
+
+	lc3_swb_finish(&lc3_swb);
+
+} END_TEST
+
+int main(void) {
+
+	Suite *s = suite_create(__FILE__);
+	TCase *tc = tcase_create(__FILE__);
+	SRunner *sr = srunner_create(s);
+
+	suite_add_tcase(s, tc);
+
+	tcase_add_test(tc, test_lc3_swb_init);
+	tcase_add_test(tc, test_lc3_swb_encode_decode);
+	tcase_add_test(tc, test_lc3_swb_decode_plc);
+
+	srunner_run_all(sr, CK_ENV);
+	int nf = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return nf == 0 ? 0 : 1;
+}
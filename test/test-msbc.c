@@ -17,7 +17,7 @@
 
 #include "codec-msbc.h"
 #include "shared/defs.h"
-#include "shared/ffb.h"
+#include "shared/rb.h"
 
 #include "inc/sine.inc"
 #include "../src/codec-msbc.c"
@@ -28,20 +28,20 @@ START_TEST(test_msbc_init) {
 
 	ck_assert_int_eq(msbc_init(&msbc), 0);
 	ck_assert_int_eq(msbc.initialized, true);
-	ck_assert_int_eq(ffb_len_out(&msbc.pcm), 0);
+	ck_assert_int_eq(rb_len_out(&msbc.pcm), 0);
 
-	ffb_seek(&msbc.pcm, 16);
-	ck_assert_int_eq(ffb_len_out(&msbc.pcm), 16);
+	rb_seek(&msbc.pcm, 16);
+	ck_assert_int_eq(rb_len_out(&msbc.pcm), 16);
 
 	ck_assert_int_eq(msbc_init(&msbc), 0);
 	ck_assert_int_eq(msbc.initialized, true);
-	ck_assert_int_eq(ffb_len_out(&msbc.pcm), 0);
+	ck_assert_int_eq(rb_len_out(&msbc.pcm), 0);
 
 	msbc_finish(&msbc);
 
 } END_TEST
 
-START_TEST(test_msbc_find_h2_header) {
+START_TEST(test_esco_h2_find_header) {
 
 	static const uint8_t raw[][10] = {
 		{ 0 },
@@ -59,27 +59,27 @@ START_TEST(test_msbc_find_h2_header) {
 	size_t len;
 
 	len = sizeof(*raw);
-	ck_assert_ptr_eq(msbc_find_h2_header(raw[0], &len), NULL);
+	ck_assert_ptr_eq(esco_h2_find_header(raw[0], &len), NULL);
 	ck_assert_int_eq(len, 1);
 
 	len = sizeof(*raw);
-	ck_assert_ptr_eq(msbc_find_h2_header(raw[1], &len), (esco_h2_header_t *)&raw[1][0]);
+	ck_assert_ptr_eq(esco_h2_find_header(raw[1], &len), (esco_h2_header_t *)&raw[1][0]);
 	ck_assert_int_eq(len, sizeof(*raw) - 0);
 
 	len = sizeof(*raw);
-	ck_assert_ptr_eq(msbc_find_h2_header(raw[2], &len), (esco_h2_header_t *)&raw[2][4]);
+	ck_assert_ptr_eq(esco_h2_find_header(raw[2], &len), (esco_h2_header_t *)&raw[2][4]);
 	ck_assert_int_eq(len, sizeof(*raw) - 4);
 
 	len = sizeof(*raw);
-	ck_assert_ptr_eq(msbc_find_h2_header(raw[3], &len), (esco_h2_header_t *)&raw[3][1]);
+	ck_assert_ptr_eq(esco_h2_find_header(raw[3], &len), (esco_h2_header_t *)&raw[3][1]);
 	ck_assert_int_eq(len, sizeof(*raw) - 1);
 
 	len = sizeof(*raw);
-	ck_assert_ptr_eq(msbc_find_h2_header(raw[4], &len), NULL);
+	ck_assert_ptr_eq(esco_h2_find_header(raw[4], &len), NULL);
 	ck_assert_int_eq(len, 1);
 
 	len = sizeof(*raw);
-	ck_assert_ptr_eq(msbc_find_h2_header(raw[5], &len), NULL);
+	ck_assert_ptr_eq(esco_h2_find_header(raw[5], &len), NULL);
 	ck_assert_int_eq(len, 1);
 
 } END_TEST
@@ -101,16 +101,16 @@ START_TEST(test_msbc_encode_decode) {
 	ck_assert_int_eq(msbc_init(&msbc), 0);
 	for (rv = 1, i = 0; rv == 1;) {
 
-		len = MIN(ARRAYSIZE(sine) - i, ffb_len_in(&msbc.pcm));
-		memcpy(msbc.pcm.tail, &sine[i], len * msbc.pcm.size);
-		ffb_seek(&msbc.pcm, len);
+		len = MIN(ARRAYSIZE(sine) - i, rb_len_in(&msbc.pcm));
+		memcpy(rb_tail(&msbc.pcm), &sine[i], len * msbc.pcm.size);
+		rb_seek(&msbc.pcm, len);
 		i += len;
 
 		rv = msbc_encode(&msbc);
 
-		len = ffb_blen_out(&msbc.data);
-		memcpy(data_tail, msbc.data.data, len);
-		ffb_shift(&msbc.data, len);
+		len = rb_blen_out(&msbc.data);
+		memcpy(data_tail, rb_head(&msbc.data), len);
+		rb_shift(&msbc.data, len);
 		data_tail += len;
 
 	}
@@ -126,16 +126,16 @@ START_TEST(test_msbc_encode_decode) {
 	ck_assert_int_eq(msbc_init(&msbc), 0);
 	for (rv = 1, i = 0; rv == 1; ) {
 
-		len = MIN((data_tail - data) - i, ffb_blen_in(&msbc.data));
-		memcpy(msbc.data.tail, &data[i], len);
-		ffb_seek(&msbc.data, len);
+		len = MIN((data_tail - data) - i, rb_blen_in(&msbc.data));
+		memcpy(rb_tail(&msbc.data), &data[i], len);
+		rb_seek(&msbc.data, len);
 		i += len;
 
 		rv = msbc_decode(&msbc);
 
-		len = ffb_len_out(&msbc.pcm);
-		memcpy(pcm_tail, msbc.pcm.data, len * msbc.pcm.size);
-		ffb_shift(&msbc.pcm, len);
+		len = rb_len_out(&msbc.pcm);
+		memcpy(pcm_tail, rb_head(&msbc.pcm), len * msbc.pcm.size);
+		rb_shift(&msbc.pcm, len);
 		pcm_tail += len;
 
 	}
@@ -146,6 +146,108 @@ START_TEST(test_msbc_encode_decode) {
 
 } END_TEST
 
+START_TEST(test_msbc_encode_multiple) {
+
+	struct esco_msbc msbc = { .initialized = false };
+	int16_t sine[MSBC_CODESAMPLES * MSBC_DATA_FRAMES];
+
+	snd_pcm_sine_s16le(sine, ARRAYSIZE(sine), 1, 0, 1.0 / 128);
+
+	ck_assert_int_eq(msbc_init(&msbc), 0);
+	ck_assert_int_ge(rb_len_in(&msbc.pcm), ARRAYSIZE(sine));
+	memcpy(rb_tail(&msbc.pcm), sine, sizeof(sine));
+	rb_seek(&msbc.pcm, ARRAYSIZE(sine));
+
+	/* all frames shall be encoded with a single call */
+	ck_assert_int_eq(msbc_encode(&msbc), 1);
+	ck_assert_int_eq(msbc.frames, MSBC_DATA_FRAMES);
+	ck_assert_int_eq(rb_len_out(&msbc.pcm), 0);
+	ck_assert_int_eq(rb_blen_out(&msbc.data), sizeof(esco_msbc_frame_t) * MSBC_DATA_FRAMES);
+
+	/* frames are stored back-to-back with consecutive sequence numbers */
+	const esco_msbc_frame_t *frames = rb_head(&msbc.data);
+	for (size_t i = 0; i < MSBC_DATA_FRAMES; i++) {
+		const uint16_t h2 = le16toh(frames[i].header);
+		ck_assert_int_eq(ESCO_H2_GET_SYNCWORD(h2), ESCO_H2_SYNCWORD);
+		ck_assert_int_eq(ESCO_H2_GET_SN0(h2) & 1, (i & 1) ? 1 : 0);
+	}
+
+	/* no space left in the data buffer */
+	rb_seek(&msbc.pcm, MSBC_CODESAMPLES);
+	ck_assert_int_eq(msbc_encode(&msbc), 0);
+
+	msbc_finish(&msbc);
+
+} END_TEST
+
+START_TEST(test_msbc_decode_plc) {
+
+	struct esco_msbc msbc = { 0 };
+	int16_t sine[1024];
+	size_t len;
+	size_t i;
+	int rv;
+
+	snd_pcm_sine_s16le(sine, ARRAYSIZE(sine), 1, 0, 1.0 / 128);
+
+	uint8_t data[sizeof(sine)];
+	uint8_t *data_tail = data;
+
+	msbc.initialized = false;
+	ck_assert_int_eq(msbc_init(&msbc), 0);
+	for (rv = 1, i = 0; rv == 1;) {
+
+		len = MIN(ARRAYSIZE(sine) - i, rb_len_in(&msbc.pcm));
+		memcpy(rb_tail(&msbc.pcm), &sine[i], len * msbc.pcm.size);
+		rb_seek(&msbc.pcm, len);
+		i += len;
+
+		rv = msbc_encode(&msbc);
+
+		len = rb_blen_out(&msbc.data);
+		memcpy(data_tail, rb_head(&msbc.data), len);
+		rb_shift(&msbc.data, len);
+		data_tail += len;
+
+	}
+
+	msbc_finish(&msbc);
+
+	/* drop the 4th frame and corrupt the 6th one */
+	const size_t frame_len = sizeof(esco_msbc_frame_t);
+	memmove(&data[frame_len * 3], &data[frame_len * 4], (data_tail - data) - frame_len * 4);
+	data_tail -= frame_len;
+	data[frame_len * 4 + 2 + 5] ^= 0xFF;
+
+	int16_t pcm[sizeof(sine)];
+	int16_t *pcm_tail = pcm;
+
+	msbc.initialized = false;
+	ck_assert_int_eq(msbc_init(&msbc), 0);
+	for (rv = 1, i = 0; rv == 1; ) {
+
+		len = MIN((data_tail - data) - i, rb_blen_in(&msbc.data));
+		memcpy(rb_tail(&msbc.data), &data[i], len);
+		rb_seek(&msbc.data, len);
+		i += len;
+
+		rv = msbc_decode(&msbc);
+
+		len = rb_len_out(&msbc.pcm);
+		memcpy(pcm_tail, rb_head(&msbc.pcm), len * msbc.pcm.size);
+		rb_shift(&msbc.pcm, len);
+		pcm_tail += len;
+
+	}
+
+	/* lost and corrupted frames shall be replaced */
+	ck_assert_int_eq(pcm_tail - pcm, 960);
+	ck_assert_int_eq(msbc.frames_concealed, 2);
+
+	msbc_finish(&msbc);
+
+} END_TEST
+
 int main(void) {
 
 	Suite *s = suite_create(__FILE__);
@@ -155,8 +257,10 @@ int main(void) {
 	suite_add_tcase(s, tc);
 
 	tcase_add_test(tc, test_msbc_init);
-	tcase_add_test(tc, test_msbc_find_h2_header);
+	tcase_add_test(tc, test_esco_h2_find_header);
 	tcase_add_test(tc, test_msbc_encode_decode);
+	tcase_add_test(tc, test_msbc_encode_multiple);
+	tcase_add_test(tc, test_msbc_decode_plc);
 
 	srunner_run_all(sr, CK_ENV);
 	int nf = srunner_ntests_failed(sr);
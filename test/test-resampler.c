@@ -0,0 +1,179 @@
+/*
+ * test-resampler.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include "resampler.h"
+#include "shared/defs.h"
+
+static void test_sine_s16(int16_t *buffer, size_t frames, unsigned int channels,
+		unsigned int rate, double freq, size_t offset) {
+	for (size_t i = 0; i < frames; i++)
+		for (size_t c = 0; c < channels; c++)
+			buffer[i * channels + c] = 16384 * sin(2 * M_PI * freq * (offset + i) / rate);
+}
+
+START_TEST(test_resampler_init) {
+
+	struct resampler r = { 0 };
+
+	ck_assert_int_eq(resampler_init(&r, RESAMPLER_QUALITY_NONE, 16, 2, 48000, 44100), -1);
+	ck_assert_int_eq(resampler_init(&r, RESAMPLER_QUALITY_LOW, 8, 2, 48000, 44100), -1);
+	ck_assert_int_eq(resampler_init(&r, RESAMPLER_QUALITY_LOW, 16, 0, 48000, 44100), -1);
+	ck_assert_int_eq(resampler_is_initialized(&r), false);
+
+	ck_assert_int_eq(resampler_init(&r, RESAMPLER_QUALITY_MEDIUM, 16, 2, 48000, 44100), 0);
+	ck_assert_int_eq(resampler_is_initialized(&r), true);
+	ck_assert_uint_eq(r.l, 147);
+	ck_assert_uint_eq(r.m, 160);
+	ck_assert_uint_gt(resampler_get_delay(&r), 0);
+	resampler_free(&r);
+
+	ck_assert_int_eq(resampler_is_initialized(&r), false);
+
+} END_TEST
+
+START_TEST(test_resampler_ratio) {
+
+	static const unsigned int rates[][2] = {
+		{ 48000, 44100 }, { 44100, 48000 }, { 16000, 48000 }, { 48000, 16000 } };
+
+	for (size_t i = 0; i < ARRAYSIZE(rates); i++) {
+
+		struct resampler r = { 0 };
+		int16_t in[480 * 2];
+		int16_t out[1600 * 2];
+		size_t frames_in = 0;
+		size_t frames_out = 0;
+
+		ck_assert_int_eq(resampler_init(&r, RESAMPLER_QUALITY_LOW, 16, 2,
+					rates[i][0], rates[i][1]), 0);
+
+		/* process 1 second of audio in 10 ms chunks */
+		const size_t chunk = rates[i][0] / 100;
+		for (size_t j = 0; j < 100; j++) {
+			test_sine_s16(in, chunk, 2, rates[i][0], 1000, frames_in);
+			ck_assert_uint_eq(resampler_push(&r, in, chunk * 2), chunk * 2);
+			frames_in += chunk;
+			frames_out += resampler_pull(&r, out, ARRAYSIZE(out)) / 2;
+		}
+
+		/* only the filter look-ahead shall be pending */
+		const size_t expected = rates[i][1] - (r.taps / 2) * rates[i][1] / rates[i][0];
+		ck_assert_uint_le(frames_out, rates[i][1]);
+		ck_assert_uint_ge(frames_out + 2, expected);
+
+		resampler_free(&r);
+	}
+
+} END_TEST
+
+START_TEST(test_resampler_needed) {
+
+	struct resampler r = { 0 };
+	int16_t in[4096] = { 0 };
+	int16_t out[4096];
+
+	ck_assert_int_eq(resampler_init(&r, RESAMPLER_QUALITY_HIGH, 16, 2, 44100, 48000), 0);
+
+	size_t needed = resampler_get_needed(&r, 480 * 2);
+	ck_assert_uint_eq(needed % 2, 0);
+	ck_assert_uint_eq(resampler_push(&r, in, needed), needed);
+	ck_assert_uint_eq(resampler_pull(&r, out, ARRAYSIZE(out)), 480 * 2);
+	ck_assert_uint_eq(resampler_get_needed(&r, 2), 2);
+
+	/* incomplete frame is kept until the rest of it is pushed */
+	ck_assert_uint_eq(resampler_push(&r, in, 1), 1);
+	ck_assert_uint_eq(resampler_pull(&r, out, ARRAYSIZE(out)), 0);
+	ck_assert_uint_eq(resampler_get_needed(&r, 2), 1);
+	ck_assert_uint_eq(resampler_push(&r, in, 1), 1);
+	ck_assert_uint_ge(resampler_pull(&r, out, ARRAYSIZE(out)), 2);
+
+	resampler_free(&r);
+
+} END_TEST
+
+START_TEST(test_resampler_sine) {
+
+	struct resampler r = { 0 };
+	int16_t in[4000];
+	int16_t out[4000];
+
+	ck_assert_int_eq(resampler_init(&r, RESAMPLER_QUALITY_HIGH, 16, 1, 48000, 44100), 0);
+
+	test_sine_s16(in, ARRAYSIZE(in), 1, 48000, 1000, 0);
+	ck_assert_uint_eq(resampler_push(&r, in, ARRAYSIZE(in)), ARRAYSIZE(in));
+	size_t frames = resampler_pull(&r, out, ARRAYSIZE(out));
+
+	/* Compare with the ideal signal, taking into account the delay
+	 * of the filter look-ahead (the first output frame is aligned
+	 * with the first input frame). */
+	double err = 0;
+	int16_t ref[ARRAYSIZE(out)];
+	test_sine_s16(ref, frames, 1, 44100, 1000, 0);
+	for (size_t i = 100; i < frames; i++)
+		err = fmax(err, fabs((double)out[i] - ref[i]));
+	ck_assert_double_lt(err, 16);
+
+	resampler_free(&r);
+
+} END_TEST
+
+START_TEST(test_resampler_saturation) {
+
+	struct resampler r = { 0 };
+	int32_t in[2048];
+	int32_t out[2048];
+
+	ck_assert_int_eq(resampler_init(&r, RESAMPLER_QUALITY_LOW, 24, 1, 32000, 48000), 0);
+
+	/* full-scale square wave produces overshoots (Gibbs phenomenon) */
+	for (size_t i = 0; i < ARRAYSIZE(in); i++)
+		in[i] = (i / 16) % 2 ? 0x7FFFFF : -0x800000;
+
+	resampler_push(&r, in, ARRAYSIZE(in));
+	size_t frames = resampler_pull(&r, out, ARRAYSIZE(out));
+	ck_assert_uint_gt(frames, 0);
+
+	for (size_t i = 0; i < frames; i++) {
+		ck_assert_int_le(out[i], 0x7FFFFF);
+		ck_assert_int_ge(out[i], -0x800000);
+	}
+
+	resampler_free(&r);
+
+} END_TEST
+
+int main(void) {
+
+	Suite *s = suite_create(__FILE__);
+	TCase *tc = tcase_create(__FILE__);
+	SRunner *sr = srunner_create(s);
+
+	suite_add_tcase(s, tc);
+
+	tcase_add_test(tc, test_resampler_init);
+	tcase_add_test(tc, test_resampler_ratio);
+	tcase_add_test(tc, test_resampler_needed);
+	tcase_add_test(tc, test_resampler_sine);
+	tcase_add_test(tc, test_resampler_saturation);
+
+	srunner_run_all(sr, CK_ENV);
+	int nf = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return nf == 0 ? 0 : 1;
+}
@@ -12,6 +12,8 @@
 # include <config.h>
 #endif
 
+#include <errno.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
@@ -36,6 +38,13 @@
 #include "hfp.h"
 #include "shared/log.h"
 
+#if ENABLE_LC3_SWB
+/* super-wideband speech is preferred if both sides support it */
+# define TEST_HFP_CODEC_ESCO HFP_CODEC_LC3_SWB
+#elif ENABLE_MSBC
+# define TEST_HFP_CODEC_ESCO HFP_CODEC_MSBC
+#endif
+
 static struct ba_adapter *adapter = NULL;
 static struct ba_device *device = NULL;
 
@@ -57,6 +66,8 @@ void *sco_enc_thread(struct ba_transport_thread *th) { return sleep(3600), th; }
 void *sco_dec_thread(struct ba_transport_thread *th) { return sleep(3600), th; }
 void a2dp_mpeg_transport_set_codec(struct ba_transport *t) { (void)t; }
 int a2dp_mpeg_transport_start(struct ba_transport *t) { (void)t; return 0; }
+int a2dp_plugin_transport_set_codec(struct ba_transport *t) { (void)t; return 0; }
+int a2dp_plugin_transport_start(struct ba_transport *t) { (void)t; return 0; }
 void a2dp_sbc_transport_set_codec(struct ba_transport *t) { (void)t; }
 int a2dp_sbc_transport_start(struct ba_transport *t) { (void)t; return 0; }
 
@@ -72,6 +83,12 @@ void bluealsa_dbus_pcm_update(struct ba_transport_pcm *pcm, unsigned int mask) {
 		pthread_mutex_unlock(&transport_codec_updated_mtx); }}
 void bluealsa_dbus_pcm_unregister(struct ba_transport_pcm *pcm) {
 	debug("%s: %p", __func__, (void *)pcm); }
+int bluealsa_dbus_pcm_handover_detach(struct ba_transport_pcm *pcm,
+		struct ba_transport_pcm_handover *h) {
+	debug("%s: %p", __func__, (void *)pcm); (void)h; return errno = ENOTSUP, -1; }
+int bluealsa_dbus_pcm_handover_attach(struct ba_transport_pcm *pcm,
+		struct ba_transport_pcm_handover *h) {
+	debug("%s: %p", __func__, (void *)pcm); (void)h; return errno = ENOTSUP, -1; }
 unsigned int bluealsa_dbus_rfcomm_register(struct ba_rfcomm *r, GError **error) {
 	debug("%s: %p", __func__, (void *)r); (void)error; return 0; }
 void bluealsa_dbus_rfcomm_update(struct ba_rfcomm *r, unsigned int mask) {
@@ -166,8 +183,8 @@ START_TEST(test_rfcomm_esco) {
 #endif
 
 #if ENABLE_MSBC
-	ck_assert_int_eq(ag->type.codec, HFP_CODEC_MSBC);
-	ck_assert_int_eq(hf->type.codec, HFP_CODEC_MSBC);
+	ck_assert_int_eq(ag->type.codec, TEST_HFP_CODEC_ESCO);
+	ck_assert_int_eq(hf->type.codec, TEST_HFP_CODEC_ESCO);
 #else
 	ck_assert_int_eq(ag->type.codec, HFP_CODEC_CVSD);
 	ck_assert_int_eq(hf->type.codec, HFP_CODEC_CVSD);
@@ -182,6 +199,159 @@ START_TEST(test_rfcomm_esco) {
 
 } END_TEST
 
+START_TEST(test_rfcomm_stalled_link) {
+
+	transport_codec_updated_cnt = 0;
+	memset(adapter->hci.features, 0, sizeof(adapter->hci.features));
+
+	int fds_stalled[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, fds_stalled), 0);
+	/* make sure that responses will not fit in the socket buffer */
+	int sndbuf = 1024;
+	ck_assert_int_eq(setsockopt(fds_stalled[0], SOL_SOCKET, SO_SNDBUF,
+				&sndbuf, sizeof(sndbuf)), 0);
+
+	struct ba_transport_type ttype_ag = { .profile = BA_TRANSPORT_PROFILE_HFP_AG };
+	struct ba_transport *stalled = ba_transport_new_sco(device, ttype_ag, ":test",
+			"/sco/stalled", fds_stalled[0]);
+	stalled->sco.rfcomm->link_lost_quirk = false;
+
+	/* Send a bunch of AT commands (each one is answered with "ERROR") to
+	 * the audio gateway, but do not read any responses. */
+	const char cmd[] = "AT+NREC=0\r";
+	const size_t commands = 1000;
+	for (size_t i = 0; i < commands; i++)
+		ck_assert_int_eq(write(fds_stalled[1], cmd, sizeof(cmd) - 1), sizeof(cmd) - 1);
+
+	int fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+	struct ba_transport *ag = ba_transport_new_sco(device, ttype_ag, ":test", "/sco/ag", fds[0]);
+	struct ba_transport_type ttype_hf = { .profile = BA_TRANSPORT_PROFILE_HFP_HF };
+	struct ba_transport *hf = ba_transport_new_sco(device, ttype_hf, ":test", "/sco/hf", fds[1]);
+
+	ag->sco.rfcomm->link_lost_quirk = false;
+	hf->sco.rfcomm->link_lost_quirk = false;
+
+	pthread_mutex_lock(&transport_codec_updated_mtx);
+	/* the stalled link shall not prevent SLC establishment on other links */
+	while (transport_codec_updated_cnt < 0 + (2 + 2))
+		pthread_cond_wait(&transport_codec_updated, &transport_codec_updated_mtx);
+	pthread_mutex_unlock(&transport_codec_updated_mtx);
+
+	/* now, all queued responses shall be delivered in order */
+	const char resp[] = "\r\nERROR\r\n";
+	struct pollfd pfd = { fds_stalled[1], POLLIN, 0 };
+	size_t received = 0;
+	while (received < commands * (sizeof(resp) - 1) && poll(&pfd, 1, 1000) == 1) {
+		char buffer[1024];
+		ssize_t len;
+		ck_assert_int_gt(len = read(fds_stalled[1], buffer, sizeof(buffer)), 0);
+		for (ssize_t i = 0; i < len; i++, received++)
+			ck_assert_int_eq(buffer[i], resp[received % (sizeof(resp) - 1)]);
+	}
+
+	ck_assert_uint_eq(received, commands * (sizeof(resp) - 1));
+
+	ba_transport_destroy(stalled);
+	ba_transport_destroy(ag);
+	ba_transport_destroy(hf);
+	close(fds_stalled[1]);
+
+	ck_assert_int_eq(device->ref_count, 1);
+
+} END_TEST
+
+START_TEST(test_rfcomm_write_coalesce) {
+
+	transport_codec_updated_cnt = 0;
+	memset(adapter->hci.features, 0, sizeof(adapter->hci.features));
+
+	int fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+	/* Pipeline several AT commands (each one is answered with "ERROR"),
+	 * so all of them will be received by the audio gateway at once. */
+	const char cmd[] = "AT+NREC=0\rAT+NREC=0\rAT+NREC=0\r";
+	ck_assert_int_eq(write(fds[1], cmd, sizeof(cmd) - 1), sizeof(cmd) - 1);
+
+	struct ba_transport_type ttype_ag = { .profile = BA_TRANSPORT_PROFILE_HFP_AG };
+	struct ba_transport *ag = ba_transport_new_sco(device, ttype_ag, ":test", "/sco/ag", fds[0]);
+	ag->sco.rfcomm->link_lost_quirk = false;
+
+	/* all responses shall be sent with a single write */
+	const char resp[] = "\r\nERROR\r\n\r\nERROR\r\n\r\nERROR\r\n";
+	struct pollfd pfd = { fds[1], POLLIN, 0 };
+	char buffer[1024];
+	ssize_t len;
+
+	ck_assert_int_eq(poll(&pfd, 1, 1000), 1);
+	ck_assert_int_eq(len = read(fds[1], buffer, sizeof(buffer)), sizeof(resp) - 1);
+	ck_assert_int_eq(memcmp(buffer, resp, len), 0);
+
+	ba_transport_destroy(ag);
+	close(fds[1]);
+
+	ck_assert_int_eq(device->ref_count, 1);
+
+} END_TEST
+
+START_TEST(test_rfcomm_write_partial) {
+
+	transport_codec_updated_cnt = 0;
+	memset(adapter->hci.features, 0, sizeof(adapter->hci.features));
+
+	int fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+	/* make sure that responses will not fit in the socket buffer */
+	int sndbuf = 1024;
+	ck_assert_int_eq(setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF,
+				&sndbuf, sizeof(sndbuf)), 0);
+
+	const char cmd[] = "AT+NREC=0\r";
+	const size_t commands = 500;
+	for (size_t i = 0; i < commands; i++)
+		ck_assert_int_eq(write(fds[1], cmd, sizeof(cmd) - 1), sizeof(cmd) - 1);
+
+	struct ba_transport_type ttype_ag = { .profile = BA_TRANSPORT_PROFILE_HFP_AG };
+	struct ba_transport *ag = ba_transport_new_sco(device, ttype_ag, ":test", "/sco/ag", fds[0]);
+	ag->sco.rfcomm->link_lost_quirk = false;
+
+	/* give the audio gateway some time to fill up the socket buffer */
+	usleep(100000);
+
+	const char resp[] = "\r\nERROR\r\n";
+	const size_t total = commands * (sizeof(resp) - 1);
+	size_t received = 0;
+	char buffer[1024];
+	ssize_t len;
+
+	/* only the part of responses shall be in the socket buffer */
+	while ((len = recv(fds[1], buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+		for (ssize_t i = 0; i < len; i++, received++)
+			ck_assert_int_eq(buffer[i], resp[received % (sizeof(resp) - 1)]);
+	ck_assert_uint_gt(received, 0);
+	ck_assert_uint_lt(received, total);
+
+	/* The rest of responses shall be kept in the queue and sent when the
+	 * socket becomes writable. Read them in chunks which are not aligned
+	 * with the response size, so we will see partially written ones. */
+	struct pollfd pfd = { fds[1], POLLIN, 0 };
+	while (received < total && poll(&pfd, 1, 1000) == 1) {
+		ck_assert_int_gt(len = read(fds[1], buffer, 7), 0);
+		for (ssize_t i = 0; i < len; i++, received++)
+			ck_assert_int_eq(buffer[i], resp[received % (sizeof(resp) - 1)]);
+	}
+
+	ck_assert_uint_eq(received, total);
+
+	ba_transport_destroy(ag);
+	close(fds[1]);
+
+	ck_assert_int_eq(device->ref_count, 1);
+
+} END_TEST
+
 #if ENABLE_MSBC
 START_TEST(test_rfcomm_set_codec) {
 
@@ -216,8 +386,8 @@ START_TEST(test_rfcomm_set_codec) {
 	 * function. */
 	usleep(10000);
 
-	ck_assert_int_eq(ag->type.codec, HFP_CODEC_MSBC);
-	ck_assert_int_eq(hf->type.codec, HFP_CODEC_MSBC);
+	ck_assert_int_eq(ag->type.codec, TEST_HFP_CODEC_ESCO);
+	ck_assert_int_eq(hf->type.codec, TEST_HFP_CODEC_ESCO);
 
 	/* select different audio codec */
 	ck_assert_int_eq(ba_transport_select_codec_sco(ag, HFP_CODEC_CVSD), 0);
@@ -252,6 +422,70 @@ START_TEST(test_rfcomm_set_codec) {
 } END_TEST
 #endif
 
+#if ENABLE_LC3_SWB
+START_TEST(test_rfcomm_set_codec_lc3_swb) {
+
+	transport_codec_updated_cnt = 0;
+	adapter->hci.features[2] = LMP_TRSP_SCO;
+	adapter->hci.features[3] = LMP_ESCO;
+
+	int fds[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+	struct ba_transport_type ttype_ag = { .profile = BA_TRANSPORT_PROFILE_HFP_AG };
+	struct ba_transport *ag = ba_transport_new_sco(device, ttype_ag, ":test", "/sco/ag", fds[0]);
+	struct ba_transport_type ttype_hf = { .profile = BA_TRANSPORT_PROFILE_HFP_HF };
+	struct ba_transport *hf = ba_transport_new_sco(device, ttype_hf, ":test", "/sco/hf", fds[1]);
+
+	ag->sco.rfcomm->link_lost_quirk = false;
+	hf->sco.rfcomm->link_lost_quirk = false;
+
+	pthread_mutex_lock(&transport_codec_updated_mtx);
+	/* wait for SLC established signals */
+	while (transport_codec_updated_cnt < 0 + (2 + 2))
+		pthread_cond_wait(&transport_codec_updated, &transport_codec_updated_mtx);
+	/* wait for codec selection signals */
+	while (transport_codec_updated_cnt < 4 + (2 + 2))
+		pthread_cond_wait(&transport_codec_updated, &transport_codec_updated_mtx);
+	pthread_mutex_unlock(&transport_codec_updated_mtx);
+
+	/* allow RFCOMM thread to finalize internal codec selection */
+	usleep(10000);
+
+	/* HF advertises LC3-SWB in the AT+BAC, so it shall be selected by AG */
+	ck_assert_int_eq(ag->type.codec, HFP_CODEC_LC3_SWB);
+	ck_assert_int_eq(hf->type.codec, HFP_CODEC_LC3_SWB);
+
+	/* fall back to the wide-band speech */
+	ck_assert_int_eq(ba_transport_select_codec_sco(ag, HFP_CODEC_MSBC), 0);
+
+	pthread_mutex_lock(&transport_codec_updated_mtx);
+	/* wait for codec selection signals */
+	while (transport_codec_updated_cnt < 8 + (2 + 2))
+		pthread_cond_wait(&transport_codec_updated, &transport_codec_updated_mtx);
+	pthread_mutex_unlock(&transport_codec_updated_mtx);
+
+	ck_assert_int_eq(ag->type.codec, HFP_CODEC_MSBC);
+	ck_assert_int_eq(hf->type.codec, HFP_CODEC_MSBC);
+
+	/* switch back to the super-wideband speech */
+	ck_assert_int_eq(ba_transport_select_codec_sco(ag, HFP_CODEC_LC3_SWB), 0);
+
+	pthread_mutex_lock(&transport_codec_updated_mtx);
+	/* wait for codec selection signals */
+	while (transport_codec_updated_cnt < 12 + (2 + 2))
+		pthread_cond_wait(&transport_codec_updated, &transport_codec_updated_mtx);
+	pthread_mutex_unlock(&transport_codec_updated_mtx);
+
+	ck_assert_int_eq(ag->type.codec, HFP_CODEC_LC3_SWB);
+	ck_assert_int_eq(hf->type.codec, HFP_CODEC_LC3_SWB);
+
+	ba_transport_destroy(ag);
+	ba_transport_destroy(hf);
+
+} END_TEST
+#endif
+
 int main(void) {
 
 	struct sigaction sigact = { .sa_handler = SIG_IGN };
@@ -273,9 +507,15 @@ int main(void) {
 
 	tcase_add_test(tc, test_rfcomm);
 	tcase_add_test(tc, test_rfcomm_esco);
+	tcase_add_test(tc, test_rfcomm_stalled_link);
+	tcase_add_test(tc, test_rfcomm_write_coalesce);
+	tcase_add_test(tc, test_rfcomm_write_partial);
 #if ENABLE_MSBC
 	tcase_add_test(tc, test_rfcomm_set_codec);
 #endif
+#if ENABLE_LC3_SWB
+	tcase_add_test(tc, test_rfcomm_set_codec_lc3_swb);
+#endif
 
 	srunner_run_all(sr, CK_ENV);
 	int nf = srunner_ntests_failed(sr);
@@ -0,0 +1,154 @@
+/*
+ * test-sbc.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include <check.h>
+#include <sbc/sbc.h>
+
+#include "codec-sbc.h"
+#include "shared/defs.h"
+
+#include "inc/sine.inc"
+#include "inc/timer.inc"
+
+/**
+ * Encode SBC frames one by one - reference implementation. */
+static ssize_t sbc_encode_frames_loop(sbc_t *sbc, const void *input, size_t input_len,
+		void *output, size_t output_len, size_t *written, size_t *frames) {
+
+	const size_t codesize = sbc_get_codesize(sbc);
+	const size_t frame_len = sbc_get_frame_length(sbc);
+	const uint8_t *in = input;
+	uint8_t *out = output;
+	size_t n;
+
+	for (n = 0; n < *frames && input_len >= codesize && output_len >= frame_len; n++) {
+		ssize_t len, encoded;
+		if ((len = sbc_encode(sbc, in, input_len, out, output_len, &encoded)) < 0)
+			return len;
+		in += len;
+		input_len -= len;
+		out += encoded;
+		output_len -= encoded;
+	}
+
+	*written = out - (uint8_t *)output;
+	*frames = n;
+	return in - (const uint8_t *)input;
+}
+
+START_TEST(test_sbc_encode_frames) {
+
+	int16_t pcm[128 * 2 * 20];
+	uint8_t out1[1024], out2[1024];
+	size_t written1, written2;
+	size_t frames1, frames2;
+	sbc_t sbc1, sbc2;
+
+	snd_pcm_sine_s16le(pcm, ARRAYSIZE(pcm), 2, 0, 1.0 / 128);
+
+	ck_assert_int_eq(sbc_init(&sbc1, 0), 0);
+	ck_assert_int_eq(sbc_init(&sbc2, 0), 0);
+
+	const size_t codesize = sbc_get_codesize(&sbc1);
+	const size_t frame_len = sbc_get_frame_length(&sbc1);
+
+	/* encoding shall be limited by the maximal number of frames */
+	frames1 = frames2 = 3;
+	ck_assert_int_eq(sbc_encode_frames_loop(&sbc1, pcm, sizeof(pcm),
+				out1, sizeof(out1), &written1, &frames1), codesize * 3);
+	ck_assert_int_eq(sbc_encode_frames(&sbc2, pcm, sizeof(pcm),
+				out2, sizeof(out2), &written2, &frames2), codesize * 3);
+	ck_assert_uint_eq(frames2, 3);
+	ck_assert_uint_eq(written2, frame_len * 3);
+	ck_assert_int_eq(memcmp(out1, out2, written1), 0);
+
+	/* encoding shall be limited by the output buffer size */
+	frames1 = frames2 = 15;
+	ck_assert_int_eq(sbc_encode_frames_loop(&sbc1, pcm, sizeof(pcm),
+				out1, frame_len * 5 + 1, &written1, &frames1), codesize * 5);
+	ck_assert_int_eq(sbc_encode_frames(&sbc2, pcm, sizeof(pcm),
+				out2, frame_len * 5 + 1, &written2, &frames2), codesize * 5);
+	ck_assert_uint_eq(frames2, 5);
+	ck_assert_int_eq(memcmp(out1, out2, written1), 0);
+
+	/* encoding shall be limited by the input data length */
+	frames1 = frames2 = 15;
+	ck_assert_int_eq(sbc_encode_frames(&sbc2, pcm, codesize * 2 + 4,
+				out2, sizeof(out2), &written2, &frames2), codesize * 2);
+	ck_assert_uint_eq(frames2, 2);
+
+	sbc_finish(&sbc1);
+	sbc_finish(&sbc2);
+
+} END_TEST
+
+START_TEST(test_sbc_encode_frames_benchmark) {
+
+	int16_t pcm[128 * 2 * 15];
+	uint8_t out[4096];
+	size_t written, frames;
+	struct timespec ts0;
+	sbc_t sbc;
+	size_t i;
+
+	const size_t payloads = 2000;
+	snd_pcm_sine_s16le(pcm, ARRAYSIZE(pcm), 2, 0, 1.0 / 128);
+	ck_assert_int_eq(sbc_init(&sbc, 0), 0);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	for (i = 0; i < payloads; i++) {
+		frames = 15;
+		sbc_encode_frames_loop(&sbc, pcm, sizeof(pcm), out, sizeof(out), &written, &frames);
+		ck_assert_uint_eq(frames, 15);
+	}
+	const double loop_fps = payloads * 15 / get_time_diff(&ts0);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	for (i = 0; i < payloads; i++) {
+		frames = 15;
+		sbc_encode_frames(&sbc, pcm, sizeof(pcm), out, sizeof(out), &written, &frames);
+		ck_assert_uint_eq(frames, 15);
+	}
+	const double batch_fps = payloads * 15 / get_time_diff(&ts0);
+
+	fprintf(stderr, "SBC encoding: loop: %.0f frames/s, batch: %.0f frames/s\n",
+			loop_fps, batch_fps);
+
+	sbc_finish(&sbc);
+
+} END_TEST
+
+int main(void) {
+
+	Suite *s = suite_create(__FILE__);
+	TCase *tc = tcase_create(__FILE__);
+	SRunner *sr = srunner_create(s);
+
+	suite_add_tcase(s, tc);
+
+	tcase_add_test(tc, test_sbc_encode_frames);
+	tcase_add_test(tc, test_sbc_encode_frames_benchmark);
+
+	srunner_run_all(sr, CK_ENV);
+	int nf = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return nf == 0 ? 0 : 1;
+}
@@ -0,0 +1,227 @@
+/*
+ * test-storage.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <bluetooth/bluetooth.h>
+#include <check.h>
+#include <glib.h>
+
+#include "a2dp.h"
+#include "a2dp-codecs.h"
+#include "ba-device.h"
+#include "ba-transport.h"
+#include "storage.h"
+
+static void test_storage_seps_free(GArray *seps) {
+	size_t i;
+	for (i = 0; i < seps->len; i++) {
+		g_free(g_array_index(seps, struct a2dp_sep, i).capabilities);
+		g_free(g_array_index(seps, struct a2dp_sep, i).configuration);
+	}
+	g_array_unref(seps);
+}
+
+START_TEST(test_storage_device_seps) {
+
+	char root[] = "/tmp/bluealsa-test-storage-XXXXXX";
+	bdaddr_t adapter = {{ 0x01, 0x00, 0x00, 0x00, 0x00, 0x00 }};
+	bdaddr_t adapter2 = {{ 0x02, 0x00, 0x00, 0x00, 0x00, 0x00 }};
+	bdaddr_t addr = {{ 0xBC, 0x9A, 0x78, 0x56, 0x34, 0x12 }};
+	GArray *seps;
+
+	ck_assert_ptr_ne(mkdtemp(root), NULL);
+	ck_assert_int_eq(storage_init(root), 0);
+
+	char path[sizeof(root) + 32];
+	snprintf(path, sizeof(path), "%s/12:34:56:78:9A:BC", root);
+
+	/* there is no cache for unknown device */
+	ck_assert_ptr_eq(storage_device_load_seps(&adapter, &addr), NULL);
+	ck_assert_int_eq(errno, ENOENT);
+
+	a2dp_sbc_t caps_sbc = {
+		.frequency = SBC_SAMPLING_FREQ_44100 | SBC_SAMPLING_FREQ_48000,
+		.channel_mode = SBC_CHANNEL_MODE_JOINT_STEREO,
+		.block_length = SBC_BLOCK_LENGTH_16,
+		.subbands = SBC_SUBBANDS_8,
+		.allocation_method = SBC_ALLOCATION_LOUDNESS,
+		.min_bitpool = 2,
+		.max_bitpool = 53,
+	};
+
+	struct a2dp_sep sep = {
+		.dir = A2DP_SINK,
+		.codec_id = A2DP_CODEC_SBC,
+		.capabilities = &caps_sbc,
+		.capabilities_size = sizeof(caps_sbc),
+		.bluez_dbus_path = "/org/bluez/hci0/dev_12_34_56_78_9A_BC/sep1",
+	};
+
+	seps = g_array_new(FALSE, FALSE, sizeof(sep));
+	g_array_append_val(seps, sep);
+	ck_assert_int_eq(storage_device_save_seps(&adapter, &addr, seps), 0);
+	g_array_unref(seps);
+
+	/* SEPs are not written until synchronized */
+	ck_assert_int_eq(access(path, F_OK), -1);
+	ck_assert_int_eq(storage_sync(), 0);
+	ck_assert_int_eq(access(path, F_OK), 0);
+
+	/* SEPs seen via other adapter are not shared */
+	ck_assert_ptr_eq(storage_device_load_seps(&adapter2, &addr), NULL);
+	ck_assert_int_eq(errno, ENOENT);
+
+	/* reload cache from the storage */
+	storage_destroy();
+	ck_assert_int_eq(storage_init(root), 0);
+
+	ck_assert_ptr_ne(seps = storage_device_load_seps(&adapter, &addr), NULL);
+	ck_assert_int_eq(seps->len, 1);
+
+	const struct a2dp_sep *tmp = &g_array_index(seps, struct a2dp_sep, 0);
+	ck_assert_int_eq(tmp->dir, A2DP_SINK);
+	ck_assert_int_eq(tmp->codec_id, A2DP_CODEC_SBC);
+	ck_assert_str_eq(tmp->bluez_dbus_path, sep.bluez_dbus_path);
+	ck_assert_int_eq(tmp->capabilities_size, sizeof(caps_sbc));
+	ck_assert_int_eq(memcmp(tmp->capabilities, &caps_sbc, sizeof(caps_sbc)), 0);
+	ck_assert_ptr_ne(tmp->configuration, NULL);
+
+	test_storage_seps_free(seps);
+
+	ck_assert_int_eq(unlink(path), 0);
+	ck_assert_int_eq(rmdir(root), 0);
+	storage_destroy();
+
+} END_TEST
+
+START_TEST(test_storage_pcm_data) {
+
+	char root[] = "/tmp/bluealsa-test-storage-XXXXXX";
+	struct ba_device d = {
+		.addr = {{ 0xBC, 0x9A, 0x78, 0x56, 0x34, 0x12 }},
+		.ba_dbus_path = "/org/bluealsa/hci0/dev_12_34_56_78_9A_BC" };
+	struct ba_transport t = {
+		.d = &d,
+		.type = { BA_TRANSPORT_PROFILE_A2DP_SOURCE, A2DP_CODEC_SBC } };
+	struct ba_transport_pcm pcm = {
+		.t = &t,
+		.ba_dbus_path = "/org/bluealsa/hci0/dev_12_34_56_78_9A_BC/a2dpsrc/sink",
+		.soft_volume = false,
+		.volume = { { .level = -1200 }, { .level = -600, .muted = true } } };
+
+	ck_assert_ptr_ne(mkdtemp(root), NULL);
+	ck_assert_int_eq(storage_init(root), 0);
+
+	char path[sizeof(root) + 32];
+	snprintf(path, sizeof(path), "%s/12:34:56:78:9A:BC", root);
+
+	/* there is no cache for unknown device */
+	ck_assert_int_eq(storage_pcm_data_sync(&pcm), -1);
+	ck_assert_int_eq(errno, ENOENT);
+
+	/* PCM data are not written until synchronized */
+	ck_assert_int_eq(storage_pcm_data_update(&pcm), 0);
+	ck_assert_int_eq(access(path, F_OK), -1);
+	ck_assert_int_eq(storage_sync(), 0);
+	ck_assert_int_eq(access(path, F_OK), 0);
+
+	/* reload cache from the storage */
+	storage_destroy();
+	ck_assert_int_eq(storage_init(root), 0);
+
+	struct ba_transport_pcm pcm2 = {
+		.t = &t,
+		.ba_dbus_path = pcm.ba_dbus_path,
+		.soft_volume = true };
+
+	ck_assert_int_eq(storage_pcm_data_sync(&pcm2), 0);
+	ck_assert_int_eq(pcm2.soft_volume, false);
+	ck_assert_int_eq(pcm2.volume[0].level, -1200);
+	ck_assert_int_eq(pcm2.volume[0].muted, false);
+	ck_assert_int_eq(pcm2.volume[1].level, -600);
+	ck_assert_int_eq(pcm2.volume[1].muted, true);
+
+	/* PCM data shall not be taken as Stream End-Points */
+	bdaddr_t adapter = {{ 0x01, 0x00, 0x00, 0x00, 0x00, 0x00 }};
+	ck_assert_ptr_eq(storage_device_load_seps(&adapter, &d.addr), NULL);
+	ck_assert_int_eq(errno, ENOENT);
+
+	ck_assert_int_eq(unlink(path), 0);
+	ck_assert_int_eq(rmdir(root), 0);
+	storage_destroy();
+
+} END_TEST
+
+START_TEST(test_storage_prune) {
+
+	char root[] = "/tmp/bluealsa-test-storage-XXXXXX";
+	ck_assert_ptr_ne(mkdtemp(root), NULL);
+
+	char path_stale[sizeof(root) + 32];
+	char path_fresh[sizeof(root) + 32];
+	char path_other[sizeof(root) + 32];
+	snprintf(path_stale, sizeof(path_stale), "%s/12:34:56:78:9A:BC", root);
+	snprintf(path_fresh, sizeof(path_fresh), "%s/23:45:67:89:AB:CD", root);
+	snprintf(path_other, sizeof(path_other), "%s/README", root);
+
+	FILE *f;
+	ck_assert_ptr_ne(f = fopen(path_stale, "w"), NULL);
+	fclose(f);
+	ck_assert_ptr_ne(f = fopen(path_fresh, "w"), NULL);
+	fclose(f);
+	ck_assert_ptr_ne(f = fopen(path_other, "w"), NULL);
+	fclose(f);
+
+	const time_t stale = time(NULL) - (STORAGE_PRUNE_AGE_DAYS + 1) * 24 * 3600;
+	struct utimbuf times = { .actime = stale, .modtime = stale };
+	ck_assert_int_eq(utime(path_stale, &times), 0);
+	ck_assert_int_eq(utime(path_other, &times), 0);
+
+	/* only stale device data shall be removed */
+	ck_assert_int_eq(storage_init(root), 0);
+	ck_assert_int_eq(access(path_stale, F_OK), -1);
+	ck_assert_int_eq(access(path_fresh, F_OK), 0);
+	ck_assert_int_eq(access(path_other, F_OK), 0);
+
+	ck_assert_int_eq(unlink(path_fresh), 0);
+	ck_assert_int_eq(unlink(path_other), 0);
+	ck_assert_int_eq(rmdir(root), 0);
+	storage_destroy();
+
+} END_TEST
+
+int main(void) {
+
+	Suite *s = suite_create(__FILE__);
+	TCase *tc = tcase_create(__FILE__);
+	SRunner *sr = srunner_create(s);
+
+	suite_add_tcase(s, tc);
+	tcase_add_test(tc, test_storage_device_seps);
+	tcase_add_test(tc, test_storage_pcm_data);
+	tcase_add_test(tc, test_storage_prune);
+
+	srunner_run_all(sr, CK_ENV);
+	int nf = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return nf == 0 ? 0 : 1;
+}
@@ -12,21 +12,36 @@
 # include <config.h>
 #endif
 
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/timerfd.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <bluetooth/bluetooth.h>
 #include <check.h>
 
 #include "a2dp-codecs.h"
 #include "ba-transport.h"
+#include "bt-capture.h"
 #include "hci.h"
 #include "hfp.h"
+#include "rtp.h"
+#include "sched-policy.h"
 #include "utils.h"
 #include "shared/defs.h"
 #include "shared/ffb.h"
+#include "shared/log.h"
+#include "shared/metrics-page.h"
+#include "shared/rb.h"
 #include "shared/rt.h"
+#include "shared/shm.h"
 
 START_TEST(test_g_dbus_bluez_object_path_to_hci_dev_id) {
 
@@ -79,6 +94,8 @@ START_TEST(test_dbus_profile_object_path) {
 #if ENABLE_APTX
 		{ { BA_TRANSPORT_PROFILE_A2DP_SOURCE, A2DP_CODEC_VENDOR_APTX }, "/A2DP/aptX/Source" },
 		{ { BA_TRANSPORT_PROFILE_A2DP_SINK, A2DP_CODEC_VENDOR_APTX }, "/A2DP/aptX/Sink" },
+		{ { BA_TRANSPORT_PROFILE_A2DP_SOURCE, A2DP_CODEC_VENDOR_APTX_LL }, "/A2DP/aptXLL/Source" },
+		{ { BA_TRANSPORT_PROFILE_A2DP_SINK, A2DP_CODEC_VENDOR_APTX_LL }, "/A2DP/aptXLL/Sink" },
 #endif
 #if ENABLE_APTX_HD
 		{ { BA_TRANSPORT_PROFILE_A2DP_SOURCE, A2DP_CODEC_VENDOR_APTX_HD }, "/A2DP/aptXHD/Source" },
@@ -183,6 +200,113 @@ START_TEST(test_difftimespec) {
 
 } END_TEST
 
+START_TEST(test_asrsync_sync_timer) {
+
+	struct asrsync asrs;
+	struct pollfd pfd = { -1, POLLIN, 0 };
+	struct timespec ts0, ts;
+	uint64_t expirations;
+
+	ck_assert_int_ne(pfd.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK), -1);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	asrsync_init(&asrs, 1000);
+
+	/* 50 frames at 1 kHz shall arm timer for about 50 ms */
+	ck_assert_int_eq(asrsync_sync_timer(&asrs, 50, pfd.fd), 1);
+	ck_assert_int_eq(poll(&pfd, 1, 0), 0);
+	ck_assert_int_eq(poll(&pfd, 1, 500), 1);
+	ck_assert_int_eq(read(pfd.fd, &expirations, sizeof(expirations)), sizeof(expirations));
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	difftimespec(&ts0, &ts, &ts);
+	ck_assert_int_ge(ts.tv_nsec, 50 * 1000000);
+
+	/* overdue transfer shall not arm the timer */
+	usleep(100000);
+	ck_assert_int_eq(asrsync_sync_timer(&asrs, 10, pfd.fd), 0);
+	ck_assert_int_eq(poll(&pfd, 1, 50), 0);
+
+	close(pfd.fd);
+
+} END_TEST
+
+START_TEST(test_asrsync_freerun_clock) {
+
+	struct asrsync asrs;
+	struct timespec ts0, ts;
+	size_t i;
+
+	rt_clock_set(&rt_clock_freerun);
+	ck_assert_int_eq(rt_clock_is_system(), false);
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+
+	/* one hour of 48 kHz transfer in 10 ms blocks */
+	asrsync_init(&asrs, 48000);
+	for (i = 0; i < 360000; i++)
+		ck_assert_int_eq(asrsync_sync(&asrs, 480), 1);
+
+	gettimestamp(&ts);
+	difftimespec(&asrs.ts0, &ts, &ts);
+	ck_assert_int_eq(ts.tv_sec, 3600);
+	ck_assert_int_eq(ts.tv_nsec, 0);
+
+	/* timer shall not be armed with the free-running clock */
+	ck_assert_int_eq(asrsync_sync_timer(&asrs, 48000, -1), 0);
+	gettimestamp(&ts);
+	difftimespec(&asrs.ts0, &ts, &ts);
+	ck_assert_int_eq(ts.tv_sec, 3601);
+
+	/* simulated hour shall not take an hour */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	difftimespec(&ts0, &ts, &ts);
+	ck_assert_int_lt(ts.tv_sec, 5);
+
+	rt_clock_set(NULL);
+	ck_assert_int_eq(rt_clock_is_system(), true);
+
+} END_TEST
+
+START_TEST(test_asrsync_freerun_clock_overlap) {
+
+	struct asrsync asrs1, asrs2;
+	struct timespec ts_start, ts;
+	size_t i;
+
+	rt_clock_set(&rt_clock_freerun);
+	gettimestamp(&ts_start);
+
+	asrsync_init(&asrs1, 48000);
+	asrsync_init(&asrs2, 48000);
+
+	/* The free-running clock is not a discrete-event clock, so sleeps of
+	 * two streams paced with the same rate overlap, and only the first
+	 * one advances the clock. The other one is not delayed at all. */
+	for (i = 0; i < 100; i++) {
+		ck_assert_int_eq(asrsync_sync(&asrs1, 480), 1);
+		ck_assert_int_eq(asrsync_sync(&asrs2, 480), 0);
+	}
+
+	gettimestamp(&ts);
+	difftimespec(&ts_start, &ts, &ts);
+	ck_assert_int_eq(ts.tv_sec, 1);
+	ck_assert_int_eq(ts.tv_nsec, 0);
+
+	/* faster stream is overdue once the clock has been advanced by the
+	 * slower one, i.e. the clock follows the latest wake-up time */
+	ck_assert_int_eq(asrsync_sync(&asrs1, 48000), 1);
+	ck_assert_int_eq(asrsync_sync(&asrs2, 480), 0);
+	ck_assert_int_gt(asrs2.ts_idle.tv_nsec, 0);
+
+	gettimestamp(&ts);
+	difftimespec(&ts_start, &ts, &ts);
+	ck_assert_int_eq(ts.tv_sec, 2);
+	ck_assert_int_eq(ts.tv_nsec, 0);
+
+	rt_clock_set(NULL);
+
+} END_TEST
+
 START_TEST(test_fifo_buffer) {
 
 	ffb_t ffb_u8 = { 0 };
@@ -241,6 +365,490 @@ START_TEST(test_fifo_buffer) {
 
 } END_TEST
 
+START_TEST(test_ring_buffer) {
+
+	const bool modes[] = { false, true };
+	size_t i;
+
+	for (i = 0; i < ARRAYSIZE(modes); i++) {
+
+		rb_t rb = { 0 };
+
+		/* allow free before allocation */
+		rb_free(&rb);
+
+		ck_assert_int_eq(rb_init(&rb, 64, sizeof(int16_t), modes[i]), 0);
+		ck_assert_ptr_eq(rb_head(&rb), rb_tail(&rb));
+		ck_assert_int_eq(rb_len_in(&rb), 64);
+		ck_assert_int_eq(rb_len_out(&rb), 0);
+
+		int16_t value_in = 0;
+		int16_t value_out = 0;
+		size_t n;
+
+		/* Write and read in chunks which are not aligned with the buffer size,
+		 * so the contiguous span has to wrap around the physical end of the
+		 * buffer (in the mirrored mode) several times. */
+		for (n = 0; n < 1000; n++) {
+
+			size_t len = MIN(rb_len_in(&rb), 23);
+			int16_t *tail = rb_tail(&rb);
+			for (size_t j = 0; j < len; j++)
+				tail[j] = value_in++;
+			rb_seek(&rb, len);
+
+			ck_assert_int_eq(rb_blen_out(&rb), rb_len_out(&rb) * sizeof(int16_t));
+
+			len = MIN(rb_len_out(&rb), 17);
+			const int16_t *head = rb_head(&rb);
+			for (size_t j = 0; j < len; j++)
+				ck_assert_int_eq(head[j], value_out++);
+			ck_assert_int_eq(rb_shift(&rb, len), len);
+
+		}
+
+		const size_t len_out = rb_len_out(&rb);
+		ck_assert_int_gt(len_out, 0);
+		ck_assert_int_eq(rb_shift(&rb, 1000), len_out);
+		ck_assert_int_eq(rb_len_out(&rb), 0);
+
+		rb_seek(&rb, 4);
+		ck_assert_int_eq(rb_len_out(&rb), 4);
+
+		rb_rewind(&rb);
+		ck_assert_int_eq(rb_len_out(&rb), 0);
+		ck_assert_int_eq(rb_len_in(&rb), 64);
+
+		rb_free(&rb);
+		ck_assert_ptr_eq(rb.data, NULL);
+
+	}
+
+} END_TEST
+
+START_TEST(test_shm_ring) {
+
+	shm_ring_t w = { 0 };
+	shm_ring_t r = { 0 };
+
+	/* allow free before allocation */
+	shm_ring_free(&w);
+
+	ck_assert_int_eq(shm_ring_create(&w, 100), 0);
+	ck_assert_int_eq(w.size, 128);
+	ck_assert_int_eq(shm_ring_len_out(&w), 0);
+	ck_assert_int_eq(shm_ring_len_in(&w), 128);
+
+	/* attach to the ring just like the other process would do */
+	ck_assert_int_eq(shm_ring_attach(&r, dup(w.fd), dup(w.efd_data), dup(w.efd_space)), 0);
+	ck_assert_int_eq(r.size, w.size);
+
+	/* the other process shall not be able to resize shared memory */
+	ck_assert_int_eq(ftruncate(r.fd, 0), -1);
+	ck_assert_int_eq(errno, EPERM);
+	ck_assert_int_eq(ftruncate(r.fd, 1024 * 1024), -1);
+	ck_assert_int_eq(errno, EPERM);
+	ck_assert_int_eq(fcntl(r.fd, F_ADD_SEALS, F_SEAL_WRITE), -1);
+
+	struct pollfd pfd_data = { r.efd_data, POLLIN, 0 };
+	struct pollfd pfd_space = { w.efd_space, POLLIN, 0 };
+
+	/* space shall be available */
+	ck_assert_int_eq(poll(&pfd_space, 1, 0), 1);
+	/* but there shall be nothing to read */
+	ck_assert_int_eq(poll(&pfd_data, 1, 0), 0);
+
+	uint8_t value_in = 0;
+	uint8_t value_out = 0;
+	uint8_t buffer[64];
+	size_t n, i, len;
+
+	for (n = 0; n < 100; n++) {
+
+		for (i = 0; i < 37; i++)
+			buffer[i] = value_in++;
+		ck_assert_int_eq(shm_ring_write(&w, buffer, 37), 37);
+		ck_assert_int_eq(poll(&pfd_data, 1, 0), 1);
+
+		/* read less than available - data event shall be re-armed */
+		ck_assert_int_eq(shm_ring_read(&r, buffer, 20), 20);
+		ck_assert_int_eq(poll(&pfd_data, 1, 0), 1);
+		ck_assert_int_eq(shm_ring_read(&r, buffer + 20, sizeof(buffer) - 20), 17);
+		ck_assert_int_eq(poll(&pfd_data, 1, 0), 0);
+
+		for (i = 0; i < 37; i++)
+			ck_assert_int_eq(buffer[i], value_out++);
+
+	}
+
+	/* fill up the ring */
+	memset(buffer, 0, sizeof(buffer));
+	for (len = 0, n = 0; n < 3; n++)
+		len += shm_ring_write(&w, buffer, sizeof(buffer));
+	ck_assert_int_eq(len, 128);
+	ck_assert_int_eq(poll(&pfd_space, 1, 0), 0);
+	ck_assert_int_eq(shm_ring_write(&w, buffer, sizeof(buffer)), 0);
+
+	/* discard data */
+	ck_assert_int_eq(shm_ring_read(&r, NULL, 1000), 128);
+	ck_assert_int_eq(shm_ring_len_out(&w), 0);
+	ck_assert_int_eq(poll(&pfd_space, 1, 0), 1);
+
+	ck_assert_int_eq(shm_ring_is_closed(&r), false);
+	shm_ring_close(&w);
+	ck_assert_int_eq(shm_ring_is_closed(&r), true);
+	ck_assert_int_eq(poll(&pfd_data, 1, 0), 1);
+
+	shm_ring_free(&r);
+	ck_assert_ptr_eq(r.hdr, NULL);
+	shm_ring_free(&w);
+
+	/* attaching to not compatible memory shall fail */
+	int fds[2];
+	ck_assert_int_eq(pipe(fds), 0);
+	ck_assert_int_eq(shm_ring_attach(&r, fds[0], fds[1], dup(fds[1])), -1);
+
+} END_TEST
+
+START_TEST(test_shm_ring_corrupted) {
+
+	shm_ring_t w = { 0 };
+	shm_ring_t r = { 0 };
+	uint8_t buffer[64] = { 0 };
+
+	ck_assert_int_eq(shm_ring_create(&w, 128), 0);
+	ck_assert_int_eq(shm_ring_attach(&r, dup(w.fd), dup(w.efd_data), dup(w.efd_space)), 0);
+	ck_assert_int_eq(shm_ring_write(&w, buffer, 16), 16);
+
+	/* write position set by the other side beyond the ring size */
+	atomic_store(&r.hdr->tail, 1000);
+	ck_assert_int_eq(shm_ring_len_out(&r), 0);
+	ck_assert_int_eq(shm_ring_is_closed(&r), true);
+	ck_assert_int_eq(shm_ring_read(&r, buffer, sizeof(buffer)), 0);
+
+	shm_ring_free(&r);
+	shm_ring_free(&w);
+
+	ck_assert_int_eq(shm_ring_create(&w, 128), 0);
+	ck_assert_int_eq(shm_ring_attach(&r, dup(w.fd), dup(w.efd_data), dup(w.efd_space)), 0);
+
+	/* read position set by the other side ahead of the write position */
+	atomic_store(&r.hdr->head, 20);
+	ck_assert_int_eq(shm_ring_len_in(&w), 0);
+	ck_assert_int_eq(shm_ring_is_closed(&w), true);
+	ck_assert_int_eq(shm_ring_write(&w, buffer, sizeof(buffer)), 0);
+	ck_assert_int_eq(atomic_load(&w.hdr->tail), 0);
+
+	shm_ring_free(&r);
+	shm_ring_free(&w);
+
+} END_TEST
+
+START_TEST(test_metrics_page) {
+
+	struct metrics_page_slot slot = { 0 };
+	struct metrics_page_slot copy;
+
+	ck_assert_str_eq(metrics_page_counter_name(METRICS_PAGE_COUNTER_TX_PACKETS), "tx_packets");
+	ck_assert_str_eq(metrics_page_counter_name(METRICS_PAGE_COUNTER_OVERRUN_DROPS), "overrun_drops");
+	ck_assert_ptr_eq(metrics_page_counter_name(METRICS_PAGE_COUNTERS), NULL);
+
+	metrics_page_slot_write_begin(&slot);
+	slot.used = 1;
+	strcpy(slot.device, "12:34:56:78:9A:BC");
+	slot.counters[METRICS_PAGE_COUNTER_RX_BYTES] = 1024;
+
+	/* slot being updated shall not be read */
+	ck_assert_int_eq(metrics_page_slot_read(&slot, &copy), -1);
+	ck_assert_int_eq(errno, EAGAIN);
+
+	metrics_page_slot_write_end(&slot);
+	ck_assert_uint_eq(slot.seq, 2);
+
+	ck_assert_int_eq(metrics_page_slot_read(&slot, &copy), 0);
+	ck_assert_uint_eq(copy.used, 1);
+	ck_assert_str_eq(copy.device, "12:34:56:78:9A:BC");
+	ck_assert_uint_eq(copy.counters[METRICS_PAGE_COUNTER_RX_BYTES], 1024);
+
+	/* labels of the snapshot shall be always terminated */
+	metrics_page_slot_write_begin(&slot);
+	memset(slot.thread, 'X', sizeof(slot.thread));
+	metrics_page_slot_write_end(&slot);
+	ck_assert_int_eq(metrics_page_slot_read(&slot, &copy), 0);
+	ck_assert_uint_eq(strlen(copy.thread), sizeof(copy.thread) - 1);
+
+} END_TEST
+
+START_TEST(test_sched_policy) {
+
+	struct sched_policy p;
+	char buffer[64];
+
+	ck_assert_int_eq(sched_policy_parse(&p, "fifo:50@0-1,3"), 0);
+	ck_assert_int_eq(p.policy, SCHED_FIFO);
+	ck_assert_int_eq(p.priority, 50);
+	ck_assert_int_eq(CPU_COUNT(&p.cpus), 3);
+	ck_assert_int_eq(CPU_ISSET(2, &p.cpus), 0);
+	ck_assert_int_eq(sched_policy_to_string(&p, buffer, sizeof(buffer)), 13);
+	ck_assert_str_eq(buffer, "fifo:50@0-1,3");
+
+	/* real-time policy with the default priority */
+	ck_assert_int_eq(sched_policy_parse(&p, "RR"), 0);
+	ck_assert_int_eq(p.priority, sched_get_priority_min(SCHED_RR));
+	ck_assert_int_eq(CPU_COUNT(&p.cpus), 0);
+
+	ck_assert_int_eq(sched_policy_parse(&p, "other@2"), 0);
+	ck_assert_int_eq(sched_policy_to_string(&p, buffer, sizeof(buffer)), 7);
+	ck_assert_str_eq(buffer, "other@2");
+
+	/* too small buffer */
+	ck_assert_int_eq(sched_policy_to_string(&p, buffer, 4), -1);
+
+	/* invalid specifications */
+	ck_assert_int_eq(sched_policy_parse(&p, "idle"), -1);
+	ck_assert_int_eq(sched_policy_parse(&p, "other:5"), -1);
+	ck_assert_int_eq(sched_policy_parse(&p, "fifo:100"), -1);
+	ck_assert_int_eq(sched_policy_parse(&p, "fifo:5x"), -1);
+	ck_assert_int_eq(sched_policy_parse(&p, "fifo@"), -1);
+	ck_assert_int_eq(sched_policy_parse(&p, "fifo@2-1"), -1);
+	ck_assert_int_eq(sched_policy_parse(&p, "fifo@1,"), -1);
+
+	/* non real-time policy can be always applied */
+	ck_assert_int_eq(sched_policy_parse(&p, "other@0"), 0);
+	ck_assert_int_eq(sched_policy_apply(&p), 0);
+	ck_assert_int_eq(sched_policy_get(&p), 0);
+	ck_assert_int_eq(p.policy, SCHED_OTHER);
+
+} END_TEST
+
+START_TEST(test_log_async) {
+
+	char buffer[1024] = { 0 };
+	int fds[2];
+
+	/* redirect log output to the pipe */
+	ck_assert_int_eq(pipe(fds), 0);
+	int fd_stderr = dup(STDERR_FILENO);
+	ck_assert_int_ne(dup2(fds[1], STDERR_FILENO), -1);
+
+	ck_assert_int_eq(log_async_start(), 0);
+	for (size_t i = 0; i < 5; i++)
+		log_message(LOG_WARNING, "FIFO write error: %s", "Broken pipe");
+	log_message(LOG_INFO, "Stream stopped");
+	log_async_stop();
+
+	/* logging after stop shall be synchronous */
+	log_message(LOG_INFO, "Synchronous");
+
+	dup2(fd_stderr, STDERR_FILENO);
+	close(fd_stderr);
+	close(fds[1]);
+
+	ck_assert_int_gt(read(fds[0], buffer, sizeof(buffer) - 1), 0);
+	close(fds[0]);
+
+	/* repeated messages are suppressed */
+	const char *p = buffer;
+	ck_assert_ptr_ne(p = strstr(p, "W: FIFO write error: Broken pipe\n"), NULL);
+	ck_assert_ptr_eq(strstr(p + 1, "FIFO write error"), NULL);
+	ck_assert_ptr_ne(p = strstr(p, "W: Last message repeated 4 times\n"), NULL);
+	ck_assert_ptr_ne(p = strstr(p, "I: Stream stopped\n"), NULL);
+	ck_assert_ptr_ne(p = strstr(p, "I: Synchronous\n"), NULL);
+
+} END_TEST
+
+static void *test_log_async_producer(void *userdata) {
+	const unsigned int id = (uintptr_t)userdata;
+	for (size_t i = 0; i < 100; i++)
+		log_message(LOG_INFO, "Message %u:%zu", id, i);
+	return NULL;
+}
+
+START_TEST(test_log_async_stop) {
+
+	static char buffer[64 * 1024];
+	pthread_t threads[4];
+	size_t len = 0;
+	ssize_t ret;
+	int fds[2];
+
+	/* redirect log output to the pipe, which can hold all messages */
+	ck_assert_int_eq(pipe(fds), 0);
+	ck_assert_int_ge(fcntl(fds[1], F_SETPIPE_SZ, sizeof(buffer)), sizeof(buffer));
+	int fd_stderr = dup(STDERR_FILENO);
+	ck_assert_int_ne(dup2(fds[1], STDERR_FILENO), -1);
+
+	ck_assert_int_eq(log_async_start(), 0);
+	for (size_t i = 0; i < ARRAYSIZE(threads); i++)
+		ck_assert_int_eq(pthread_create(&threads[i], NULL,
+					test_log_async_producer, (void *)(uintptr_t)i), 0);
+
+	/* stop the logger while other threads are logging */
+	log_async_stop();
+
+	for (size_t i = 0; i < ARRAYSIZE(threads); i++)
+		pthread_join(threads[i], NULL);
+
+	dup2(fd_stderr, STDERR_FILENO);
+	close(fd_stderr);
+	close(fds[1]);
+
+	while ((ret = read(fds[0], buffer + len, sizeof(buffer) - 1 - len)) > 0)
+		len += ret;
+	buffer[len] = '\0';
+	close(fds[0]);
+
+	/* every message shall be either written or reported as dropped */
+	size_t messages = 0;
+	unsigned int dropped = 0;
+	for (const char *p = buffer; (p = strchr(p, ':')) != NULL; p++) {
+		unsigned int n;
+		if (strncmp(p, ": Message ", 10) == 0)
+			messages++;
+		else if (sscanf(p, ": Logging ring overrun: %u messages dropped", &n) == 1)
+			dropped += n;
+	}
+
+	ck_assert_uint_eq(messages + dropped, ARRAYSIZE(threads) * 100);
+
+} END_TEST
+
+START_TEST(test_bt_capture) {
+
+	char path[] = "/tmp/bt-capture-XXXXXX";
+	int fd = mkstemp(path);
+	ck_assert_int_ne(fd, -1);
+	close(fd);
+
+	struct bt_capture c = { NULL };
+	const uint8_t header[] = { 0x80, 0x60 };
+	const uint8_t payload[] = { 0x01, 0x02, 0x03, 0x04 };
+	const struct iovec iov[] = {
+		{ (void *)header, sizeof(header) },
+		{ (void *)payload, sizeof(payload) } };
+
+	ck_assert_int_eq(bt_capture_open(&c, path,
+				BA_TRANSPORT_PROFILE_A2DP_SINK, A2DP_CODEC_SBC), 0);
+	ck_assert_int_eq(bt_capture_write(&c, BT_CAPTURE_DIRECTION_RX, iov, 2, 6), 0);
+	/* partial write shall capture written data only */
+	ck_assert_int_eq(bt_capture_write(&c, BT_CAPTURE_DIRECTION_TX, iov, 2, 3), 0);
+	bt_capture_close(&c);
+
+	struct bt_capture_packet p1, p2;
+	uint8_t buffer[16];
+
+	ck_assert_int_eq(bt_capture_open_read(&c, path), 0);
+
+	ck_assert_int_eq(bt_capture_read(&c, &p1, buffer, sizeof(buffer)), 6);
+	ck_assert_int_eq(p1.direction, BT_CAPTURE_DIRECTION_RX);
+	ck_assert_int_eq(p1.profile, BA_TRANSPORT_PROFILE_A2DP_SINK);
+	ck_assert_int_eq(p1.codec, A2DP_CODEC_SBC);
+	ck_assert_int_eq(p1.seq, 0);
+	ck_assert_int_eq(memcmp(buffer, header, sizeof(header)), 0);
+	ck_assert_int_eq(memcmp(&buffer[2], payload, sizeof(payload)), 0);
+
+	/* too small buffer */
+	ck_assert_int_eq(bt_capture_read(&c, &p2, buffer, 2), -1);
+	ck_assert_int_eq(errno, EMSGSIZE);
+
+	ck_assert_int_eq(bt_capture_read(&c, &p2, buffer, sizeof(buffer)), 0);
+	bt_capture_close(&c);
+
+	ck_assert_int_eq(bt_capture_open_read(&c, path), 0);
+	ck_assert_int_eq(bt_capture_read(&c, &p1, buffer, sizeof(buffer)), 6);
+	ck_assert_int_eq(bt_capture_read(&c, &p2, buffer, sizeof(buffer)), 3);
+	ck_assert_int_eq(p2.direction, BT_CAPTURE_DIRECTION_TX);
+	ck_assert_int_eq(p2.seq, 1);
+	ck_assert_int_eq(memcmp(&buffer[2], payload, 1), 0);
+	/* time-stamps are monotonic */
+	ck_assert_int_ge(p2.ts.tv_sec * 1000000000LL + p2.ts.tv_nsec,
+			p1.ts.tv_sec * 1000000000LL + p1.ts.tv_nsec);
+	bt_capture_close(&c);
+
+	/* burst of large packets shall not block the writer, all packets which
+	 * were not dropped shall be written before the capture is closed */
+	static uint8_t big[60000];
+	const struct iovec iov_big[] = { { big, sizeof(big) } };
+	ck_assert_int_eq(bt_capture_open(&c, path,
+				BA_TRANSPORT_PROFILE_A2DP_SOURCE, A2DP_CODEC_SBC), 0);
+	for (size_t i = 0; i < 32; i++)
+		ck_assert_int_eq(bt_capture_write(&c, BT_CAPTURE_DIRECTION_TX, iov_big, 1, sizeof(big)), 0);
+	const unsigned int dropped = atomic_load(&c.dropped);
+	bt_capture_close(&c);
+
+	static uint8_t big_read[sizeof(big)];
+	size_t packets = 0;
+	ck_assert_int_eq(bt_capture_open_read(&c, path), 0);
+	while (bt_capture_read(&c, &p1, big_read, sizeof(big_read)) == sizeof(big))
+		packets++;
+	bt_capture_close(&c);
+	ck_assert_uint_eq(packets + dropped, 32);
+
+	/* not a capture file */
+	ck_assert_int_eq(bt_capture_open_read(&c, "/dev/null"), -1);
+	ck_assert_int_eq(errno, EINVAL);
+
+	unlink(path);
+
+} END_TEST
+
+START_TEST(test_rtp_state) {
+
+	struct rtp_state rtp;
+	rtp_header_t hdr = { 0 };
+
+	rtp_state_init(&rtp, 44100, 44100);
+	const uint16_t seq = rtp.seq_number;
+	const uint32_t ts = rtp_state_get_timestamp(&rtp);
+
+	rtp_state_new_packet(&rtp, &hdr);
+	ck_assert_uint_eq(be16toh(hdr.seq_number), (uint16_t)(seq + 1));
+	ck_assert_uint_eq(be32toh(hdr.timestamp), ts);
+
+	/* fragments of a single frame share the timestamp */
+	rtp_state_new_packet(&rtp, &hdr);
+	ck_assert_uint_eq(be16toh(hdr.seq_number), (uint16_t)(seq + 2));
+	ck_assert_uint_eq(be32toh(hdr.timestamp), ts);
+
+	rtp_state_update(&rtp, 128);
+	rtp_state_new_packet(&rtp, &hdr);
+	ck_assert_uint_eq(be16toh(hdr.seq_number), (uint16_t)(seq + 3));
+	ck_assert_uint_eq(be32toh(hdr.timestamp), ts + 128);
+
+	/* 90 kHz clock shall not accumulate rounding errors */
+	rtp_state_init(&rtp, 44100, RTP_MPEG_AUDIO_CLOCK_RATE);
+	const uint32_t ts_mpeg = rtp_state_get_timestamp(&rtp);
+	for (size_t i = 0; i < 100; i++)
+		rtp_state_update(&rtp, 1152);
+	ck_assert_uint_eq((uint32_t)(rtp_state_get_timestamp(&rtp) - ts_mpeg),
+			100ULL * 1152 * 90000 / 44100);
+
+	uint8_t tmpl_data[RTP_HEADER_LEN + sizeof(rtp_mpeg_audio_header_t)];
+	uint8_t data[sizeof(tmpl_data)];
+	rtp_mpeg_audio_header_t *tmpl_mpeg_header;
+	rtp_header_t *tmpl;
+
+	uint8_t *payload = rtp_a2dp_init(tmpl_data, &tmpl,
+			(void **)&tmpl_mpeg_header, sizeof(*tmpl_mpeg_header));
+	ck_assert_ptr_eq(payload, tmpl_data + sizeof(tmpl_data));
+	ck_assert_uint_eq(tmpl->version, 2);
+	ck_assert_uint_eq(tmpl->paytype, 96);
+	tmpl_mpeg_header->rfa = htobe16(0xABCD);
+
+	rtp_header_t *header = rtp_state_new_packet_from(&rtp, data, tmpl,
+			sizeof(*tmpl_mpeg_header));
+	ck_assert_ptr_eq(header, data);
+	ck_assert_uint_eq(header->version, 2);
+	ck_assert_uint_eq(header->paytype, 96);
+	ck_assert_uint_eq(be16toh(header->seq_number), (uint16_t)(rtp.seq_number));
+	ck_assert_uint_eq(be32toh(header->timestamp), rtp_state_get_timestamp(&rtp));
+	ck_assert_int_eq(memcmp(data + RTP_HEADER_LEN,
+				tmpl_data + RTP_HEADER_LEN, sizeof(*tmpl_mpeg_header)), 0);
+	/* the template itself shall not be modified */
+	ck_assert_uint_eq(tmpl->seq_number, 0);
+
+} END_TEST
+
 int main(void) {
 
 	Suite *s = suite_create(__FILE__);
@@ -255,7 +863,19 @@ int main(void) {
 	tcase_add_test(tc, test_g_variant_sanitize_object_path);
 	tcase_add_test(tc, test_batostr_);
 	tcase_add_test(tc, test_difftimespec);
+	tcase_add_test(tc, test_asrsync_sync_timer);
+	tcase_add_test(tc, test_asrsync_freerun_clock);
+	tcase_add_test(tc, test_asrsync_freerun_clock_overlap);
 	tcase_add_test(tc, test_fifo_buffer);
+	tcase_add_test(tc, test_ring_buffer);
+	tcase_add_test(tc, test_shm_ring);
+	tcase_add_test(tc, test_shm_ring_corrupted);
+	tcase_add_test(tc, test_metrics_page);
+	tcase_add_test(tc, test_sched_policy);
+	tcase_add_test(tc, test_log_async);
+	tcase_add_test(tc, test_log_async_stop);
+	tcase_add_test(tc, test_bt_capture);
+	tcase_add_test(tc, test_rtp_state);
 
 	srunner_run_all(sr, CK_ENV);
 	int nf = srunner_ntests_failed(sr);
@@ -12,7 +12,9 @@
 # include <config.h>
 #endif
 
+#include <ctype.h>
 #include <getopt.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 #include <strings.h>
@@ -116,11 +118,11 @@ static int check_blob_size(size_t size, size_t value) {
 	return -1;
 }
 
-static void dump_sbc(const void *blob, size_t size) {
+static void dump_sbc(FILE *f, const void *blob, size_t size) {
 	const a2dp_sbc_t *sbc = blob;
 	if (check_blob_size(sizeof(*sbc), size) == -1)
 		return;
-	printf("SBC <hex:%s> {\n"
+	fprintf(f, "SBC <hex:%s> {\n"
 			"  sampling-frequency:4 =%s%s%s%s\n"
 			"  channel-mode:4 =%s%s%s%s\n"
 			"  block-length:4 =%s%s%s%s\n"
@@ -149,11 +151,11 @@ static void dump_sbc(const void *blob, size_t size) {
 			sbc->min_bitpool, sbc->max_bitpool);
 }
 
-static void dump_mpeg(const void *blob, size_t size) {
+static void dump_mpeg(FILE *f, const void *blob, size_t size) {
 	const a2dp_mpeg_t *mpeg = blob;
 	if (check_blob_size(sizeof(*mpeg), size) == -1)
 		return;
-	printf("MPEG-1,2 Audio <hex:%s> {\n"
+	fprintf(f, "MPEG-1,2 Audio <hex:%s> {\n"
 			"  layer:3 =%s%s%s\n"
 			"  crc:1 = %s\n"
 			"  channel-mode:4 =%s%s%s%s\n"
@@ -183,11 +185,11 @@ static void dump_mpeg(const void *blob, size_t size) {
 			MPEG_GET_BITRATE(*mpeg));
 }
 
-static void dump_aac(const void *blob, size_t size) {
+static void dump_aac(FILE *f, const void *blob, size_t size) {
 	const a2dp_aac_t *aac = blob;
 	if (check_blob_size(sizeof(*aac), size) == -1)
 		return;
-	printf("MPEG-2,4 AAC <hex:%s> {\n"
+	fprintf(f, "MPEG-2,4 AAC <hex:%s> {\n"
 			"  object-type:8 =%s%s%s%s\n"
 			"  sampling-frequency:12 =%s%s%s%s%s%s%s%s%s%s%s%s\n"
 			"  channel-mode:2 =%s%s\n"
@@ -218,11 +220,11 @@ static void dump_aac(const void *blob, size_t size) {
 			AAC_GET_BITRATE(*aac));
 }
 
-static void dump_atrac(const void *blob, size_t size) {
+static void dump_atrac(FILE *f, const void *blob, size_t size) {
 	const a2dp_atrac_t *atrac = blob;
 	if (check_blob_size(sizeof(*atrac), size) == -1)
 		return;
-	printf("ATRAC <hex:%s> {\n"
+	fprintf(f, "ATRAC <hex:%s> {\n"
 			"  version:3 = ATRAC%u\n"
 			"  channel-mode:3 =%s%s%s\n"
 			"  <reserved>:4\n"
@@ -244,13 +246,13 @@ static void dump_atrac(const void *blob, size_t size) {
 			ATRAC_GET_MAX_SUL(*atrac));
 }
 
-static void dump_vendor(const void *blob, size_t size) {
+static void dump_vendor(FILE *f, const void *blob, size_t size) {
 	const a2dp_vendor_codec_t *info = blob;
 	if (size <= sizeof(*info))
 		return;
 	const void *data = info + 1;
 	size_t data_size = size - sizeof(*info);
-	printf("<hex:%s> {\n"
+	fprintf(f, "<hex:%s> {\n"
 			"  vendor-id:32 = %#x [%s]\n"
 			"  vendor-codec-id:16 = %#x\n"
 			"  data:%zu = hex:%s\n"
@@ -263,11 +265,11 @@ static void dump_vendor(const void *blob, size_t size) {
 			bintohex(data, data_size));
 }
 
-static void _dump_aptx(const void *blob, size_t size, const char *name) {
+static void _dump_aptx(FILE *f, const void *blob, size_t size, const char *name) {
 	const a2dp_aptx_t *aptx = blob;
 	if (check_blob_size(sizeof(*aptx), size) == -1)
 		return;
-	printf("%s <hex:%s> {\n"
+	fprintf(f, "%s <hex:%s> {\n"
 			"  vendor-id:32 = %#x [%s]\n"
 			"  vendor-codec-id:16 = %#x\n"
 			"  channel-mode:4 =%s%s%s\n"
@@ -287,19 +289,19 @@ static void _dump_aptx(const void *blob, size_t size, const char *name) {
 			aptx->frequency & APTX_SAMPLING_FREQ_16000 ? " 16000" : "");
 }
 
-static void dump_aptx(const void *blob, size_t size) {
-	_dump_aptx(blob, size, "aptX");
+static void dump_aptx(FILE *f, const void *blob, size_t size) {
+	_dump_aptx(f, blob, size, "aptX");
 }
 
-static void dump_aptx_tws(const void *blob, size_t size) {
-	_dump_aptx(blob, size, "aptX-TWS");
+static void dump_aptx_tws(FILE *f, const void *blob, size_t size) {
+	_dump_aptx(f, blob, size, "aptX-TWS");
 }
 
-static void dump_aptx_hd(const void *blob, size_t size) {
+static void dump_aptx_hd(FILE *f, const void *blob, size_t size) {
 	const a2dp_aptx_hd_t *aptx_hd = blob;
 	if (check_blob_size(sizeof(*aptx_hd), size) == -1)
 		return;
-	printf("aptX HD <hex:%s> {\n"
+	fprintf(f, "aptX HD <hex:%s> {\n"
 			"  vendor-id:32 = %#x [%s]\n"
 			"  vendor-codec-id:16 = %#x\n"
 			"  channel-mode:4 =%s%s\n"
@@ -318,11 +320,11 @@ static void dump_aptx_hd(const void *blob, size_t size) {
 			aptx_hd->aptx.frequency & APTX_SAMPLING_FREQ_16000 ? " 16000" : "");
 }
 
-static void dump_faststream(const void *blob, size_t size) {
+static void dump_faststream(FILE *f, const void *blob, size_t size) {
 	const a2dp_faststream_t *faststream = blob;
 	if (check_blob_size(sizeof(*faststream), size) == -1)
 		return;
-	printf("FastStream <hex:%s> {\n"
+	fprintf(f, "FastStream <hex:%s> {\n"
 			"  vendor-id:32 = %#x [%s]\n"
 			"  vendor-codec-id:16 = %#x\n"
 			"  direction:8 =%s%s\n"
@@ -340,11 +342,11 @@ static void dump_faststream(const void *blob, size_t size) {
 			faststream->frequency_music & FASTSTREAM_SAMPLING_FREQ_MUSIC_44100 ? " 44100" : "");
 }
 
-static void dump_ldac(const void *blob, size_t size) {
+static void dump_ldac(FILE *f, const void *blob, size_t size) {
 	const a2dp_ldac_t *ldac = blob;
 	if (check_blob_size(sizeof(*ldac), size) == -1)
 		return;
-	printf("LDAC <hex:%s> {\n"
+	fprintf(f, "LDAC <hex:%s> {\n"
 			"  vendor-id:32 = %#x [%s]\n"
 			"  vendor-codec-id:16 = %#x\n"
 			"  <reserved>:2\n"
@@ -370,7 +372,7 @@ static void dump_ldac(const void *blob, size_t size) {
 static struct {
 	uint16_t codec_id;
 	size_t blob_size;
-	void (*dump)(const void *, size_t);
+	void (*dump)(FILE *, const void *, size_t);
 } dumps[] = {
 	{ A2DP_CODEC_SBC, sizeof(a2dp_sbc_t), dump_sbc },
 	{ A2DP_CODEC_MPEG12, sizeof(a2dp_mpeg_t), dump_mpeg },
@@ -390,17 +392,380 @@ static struct {
 	{ A2DP_CODEC_VENDOR_SAMSUNG_SC, -1, dump_vendor },
 };
 
+/**
+ * Dump codec configuration blob to the given stream.
+ *
+ * @return On success this function returns 0. If the codec type can not be
+ *   determined, -1 is returned. */
+static int dump_blob(FILE *f, uint16_t codec_id, const void *blob, size_t size,
+		bool detect) {
+
+	for (size_t i = 0; i < ARRAYSIZE(dumps); i++)
+		if (dumps[i].codec_id == codec_id) {
+			dumps[i].dump(f, blob, size);
+			return 0;
+		}
+
+	if (!detect)
+		return -1;
+
+	for (size_t i = 0; i < ARRAYSIZE(dumps); i++)
+		if (dumps[i].blob_size == size)
+			dumps[i].dump(f, blob, size);
+	dump_vendor(f, blob, size);
+
+	return 0;
+}
+
+static const char *get_codec_name(uint16_t codec_id) {
+	for (size_t i = 0; i < ARRAYSIZE(codecs); i++)
+		if (codecs[i].codec_id == codec_id)
+			return codecs[i].name;
+	return "Unknown";
+}
+
+/**
+ * Aggregated statistics of the chosen configurations. */
+struct stats_entry {
+	/* codec name */
+	char *codec;
+	/* configuration blob (hex) or description */
+	char *config;
+	/* decoded codec ID, if configuration is a blob */
+	uint16_t codec_id;
+	bool blob;
+	unsigned int count;
+};
+
+struct stats {
+	struct stats_entry *entries;
+	size_t len;
+	size_t size;
+	unsigned int total;
+};
+
+static int stats_add(struct stats *stats, const char *codec, const char *config,
+		uint16_t codec_id, bool blob) {
+
+	stats->total++;
+
+	for (size_t i = 0; i < stats->len; i++)
+		if (strcmp(stats->entries[i].config, config) == 0 &&
+				strcmp(stats->entries[i].codec, codec) == 0) {
+			stats->entries[i].count++;
+			return 0;
+		}
+
+	if (stats->len == stats->size) {
+		const size_t size = stats->size == 0 ? 16 : stats->size * 2;
+		struct stats_entry *tmp;
+		if ((tmp = realloc(stats->entries, size * sizeof(*tmp))) == NULL)
+			return -1;
+		stats->entries = tmp;
+		stats->size = size;
+	}
+
+	struct stats_entry *e = &stats->entries[stats->len++];
+	e->codec = strdup(codec);
+	e->config = strdup(config);
+	e->codec_id = codec_id;
+	e->blob = blob;
+	e->count = 1;
+
+	return 0;
+}
+
+static int stats_entry_cmp(const void *a, const void *b) {
+	const struct stats_entry *ea = a;
+	const struct stats_entry *eb = b;
+	int rv;
+	if ((rv = strcmp(ea->codec, eb->codec)) != 0)
+		return rv;
+	return (int)eb->count - (int)ea->count;
+}
+
+/**
+ * Print configurations grouped by the codec, the most frequent first. */
+static void stats_print(struct stats *stats, bool verbose) {
+
+	qsort(stats->entries, stats->len, sizeof(*stats->entries), stats_entry_cmp);
+
+	printf("Total configurations: %u\n", stats->total);
+
+	for (size_t i = 0; i < stats->len; ) {
+
+		const char *codec = stats->entries[i].codec;
+		unsigned int count = 0;
+		size_t j;
+
+		for (j = i; j < stats->len && strcmp(stats->entries[j].codec, codec) == 0; j++)
+			count += stats->entries[j].count;
+
+		printf("%s: %u (%.1f%%)\n", codec, count, 100.0 * count / stats->total);
+		for (; i < j; i++) {
+			const struct stats_entry *e = &stats->entries[i];
+			printf("  %8u %5.1f%%  %s%s\n", e->count, 100.0 * e->count / count,
+					e->blob ? "hex:" : "", e->config);
+			if (verbose && e->blob) {
+				uint8_t blob[64];
+				ssize_t size;
+				if ((size = get_codec_blob(e->config, blob, sizeof(blob))) != -1)
+					dump_blob(stdout, e->codec_id, blob, size, false);
+			}
+		}
+
+	}
+
+}
+
+static bool is_hex_string(const char *s) {
+	if (*s == '\0')
+		return false;
+	for (; *s != '\0'; s++)
+		if (!isxdigit((unsigned char)*s))
+			return false;
+	return true;
+}
+
+/**
+ * Add all CODEC:HEX tokens found in the given line. */
+static void batch_parse_tokens(struct stats *stats, char *line) {
+
+	char *saveptr;
+	char *token;
+
+	for (token = strtok_r(line, " \t\r\n,;'\"()[]{}", &saveptr); token != NULL;
+			token = strtok_r(NULL, " \t\r\n,;'\"()[]{}", &saveptr)) {
+
+		char *hex;
+		if ((hex = strchr(token, ':')) == NULL || !is_hex_string(hex + 1))
+			continue;
+
+		/* Unlike the command line, codec names in logs shall not be
+		 * abbreviated, otherwise any "x:00" token would be a match. */
+		uint16_t codec_id = 0xFFFF;
+		for (size_t i = 0; i < ARRAYSIZE(codecs); i++)
+			if (strlen(codecs[i].name) == (size_t)(hex - token) &&
+					strncasecmp(token, codecs[i].name, hex - token) == 0)
+				codec_id = codecs[i].codec_id;
+		if (codec_id == 0xFFFF)
+			continue;
+
+		size_t len = strlen(++hex);
+		if (len % 2 != 0 || len > 2 * 64)
+			continue;
+
+		for (size_t i = 0; i < len; i++)
+			hex[i] = tolower((unsigned char)hex[i]);
+		stats_add(stats, get_codec_name(codec_id), hex, codec_id, true);
+
+	}
+
+}
+
+/**
+ * Parser state of the btmon log. */
+struct btmon_state {
+	/* within AVDTP Set Configuration or Reconfigure command */
+	bool configuration;
+	/* indentation of the "Media Codec" line */
+	int indent;
+	char codec[64];
+	char config[512];
+};
+
+static void btmon_flush(struct stats *stats, struct btmon_state *state) {
+	if (state->indent == -1)
+		return;
+	stats_add(stats, state->codec, state->config, 0xFFFF, false);
+	state->indent = -1;
+}
+
+static void btmon_set_name(char *dest, size_t size, const char *s) {
+	const char *end;
+	if ((end = strstr(s, " (0x")) == NULL)
+		end = s + strcspn(s, "\r\n");
+	snprintf(dest, size, "%.*s", (int)(end - s), s);
+}
+
+/**
+ * Parse the btmon (BlueZ monitor) log line.
+ *
+ * The btmon does not print the raw codec configuration blob, so decoded
+ * codec-specific fields of the AVDTP Set Configuration command are used
+ * as a configuration description. */
+static void batch_parse_btmon(struct stats *stats, struct btmon_state *state,
+		const char *line) {
+
+	const int indent = strspn(line, " ");
+	const char *tmp;
+
+	if ((tmp = strstr(line, "AVDTP: ")) != NULL) {
+		btmon_flush(stats, state);
+		state->configuration = strstr(tmp, " Command") != NULL &&
+			(strstr(tmp, "Set Configuration") != NULL || strstr(tmp, "Reconfigure") != NULL);
+		return;
+	}
+
+	if (!state->configuration)
+		return;
+
+	if (state->indent != -1) {
+
+		if (indent <= state->indent)
+			btmon_flush(stats, state);
+		else {
+
+			line += indent;
+			if ((tmp = strstr(line, "Vendor Specific Codec ID: ")) != NULL) {
+				btmon_set_name(state->codec, sizeof(state->codec),
+						tmp + strlen("Vendor Specific Codec ID: "));
+				return;
+			}
+			if (strncmp(line, "Vendor ID: ", 11) == 0)
+				return;
+
+			size_t len = strlen(state->config);
+			snprintf(state->config + len, sizeof(state->config) - len, "%s%.*s",
+					len > 0 ? ", " : "", (int)strcspn(line, "\r\n"), line);
+			return;
+
+		}
+
+	}
+
+	if ((tmp = strstr(line, "Media Codec: ")) != NULL) {
+		btmon_set_name(state->codec, sizeof(state->codec), tmp + strlen("Media Codec: "));
+		state->config[0] = '\0';
+		state->indent = indent;
+	}
+
+}
+
+/**
+ * Read configurations from the standard input and print statistics. */
+static int batch(bool verbose) {
+
+	struct stats stats = { 0 };
+	struct btmon_state state = { .indent = -1 };
+	char *line = NULL;
+	size_t size = 0;
+
+	while (getline(&line, &size, stdin) != -1) {
+		if (strstr(line, "AVDTP: ") != NULL || state.configuration)
+			batch_parse_btmon(&stats, &state, line);
+		if (!state.configuration)
+			batch_parse_tokens(&stats, line);
+	}
+
+	btmon_flush(&stats, &state);
+	free(line);
+
+	stats_print(&stats, verbose);
+
+	for (size_t i = 0; i < stats.len; i++) {
+		free(stats.entries[i].codec);
+		free(stats.entries[i].config);
+	}
+	free(stats.entries);
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Dump configuration blob into the newly allocated string. */
+static char *dump_to_string(uint16_t codec_id, const void *blob, size_t size) {
+
+	char *buffer = NULL;
+	size_t len = 0;
+	FILE *f;
+
+	if ((f = open_memstream(&buffer, &len)) == NULL)
+		return NULL;
+	if (dump_blob(f, codec_id, blob, size, false) == -1) {
+		fclose(f);
+		free(buffer);
+		return NULL;
+	}
+
+	fclose(f);
+	return buffer;
+}
+
+/**
+ * Print the decoded configurations side by side marking differences.
+ *
+ * It is useful for comparing capabilities of the remote SEP with the
+ * selected configuration, or two configurations with each other. */
+static int diff(const char *codec1, const char *codec2) {
+
+	uint16_t codec_id = get_codec(codec1);
+	ssize_t size1, size2;
+	uint8_t blob1[64];
+	uint8_t blob2[64];
+
+	/* the second blob might be given without the codec name */
+	if (strchr(codec2, ':') != NULL && get_codec(codec2) != codec_id) {
+		fprintf(stderr, "Codec type mismatch: %s != %s\n", codec1, codec2);
+		return EXIT_FAILURE;
+	}
+
+	if ((size1 = get_codec_blob(codec1, blob1, sizeof(blob1))) == -1 ||
+			(size2 = get_codec_blob(codec2, blob2, sizeof(blob2))) == -1)
+		return EXIT_FAILURE;
+
+	char *dump1 = dump_to_string(codec_id, blob1, size1);
+	char *dump2 = dump_to_string(codec_id, blob2, size2);
+	int rv = EXIT_FAILURE;
+
+	if (dump1 == NULL || dump2 == NULL) {
+		fprintf(stderr, "Couldn't detect codec type: %s\n", codec1);
+		goto final;
+	}
+
+	char *saveptr1, *saveptr2;
+	char *line1 = strtok_r(dump1, "\n", &saveptr1);
+	char *line2 = strtok_r(dump2, "\n", &saveptr2);
+
+	/* the header line contains the hex blob, so it always differs */
+	for (; line1 != NULL || line2 != NULL;
+			line1 = strtok_r(NULL, "\n", &saveptr1),
+			line2 = strtok_r(NULL, "\n", &saveptr2)) {
+		if (line1 != NULL && line2 != NULL && strcmp(line1, line2) == 0)
+			printf("  %s\n", line1);
+		else {
+			if (line1 != NULL)
+				printf("- %s\n", line1);
+			if (line2 != NULL)
+				printf("+ %s\n", line2);
+		}
+	}
+
+	rv = EXIT_SUCCESS;
+
+final:
+	free(dump1);
+	free(dump2);
+	return rv;
+}
+
 int main(int argc, char *argv[]) {
 
 	int opt;
-	const char *opts = "hVx";
+	const char *opts = "hVbdvx";
 	const struct option longopts[] = {
 		{ "help", no_argument, NULL, 'h' },
 		{ "version", no_argument, NULL, 'V' },
+		{ "batch", no_argument, NULL, 'b' },
+		{ "diff", no_argument, NULL, 'd' },
+		{ "verbose", no_argument, NULL, 'v' },
 		{ "auto-detect", no_argument, NULL, 'x' },
 		{ 0, 0, 0, 0 },
 	};
 
+	bool batch_mode = false;
+	bool diff_mode = false;
+	bool verbose = false;
 	bool detect = false;
 
 	while ((opt = getopt_long(argc, argv, opts, longopts, NULL)) != -1)
@@ -409,20 +774,37 @@ int main(int argc, char *argv[]) {
 usage:
 			printf("Usage:\n"
 					"  %s [OPTION]... <CODEC>\n"
+					"  %s --diff <CODEC> <CODEC>\n"
+					"  %s --batch [--verbose] < FILE\n"
 					"\nOptions:\n"
 					"  -h, --help\t\tprint this help and exit\n"
 					"  -V, --version\t\tprint version and exit\n"
+					"  -b, --batch\t\tread configurations from stdin\n"
+					"  -d, --diff\t\tcompare two configurations\n"
+					"  -v, --verbose\t\tdecode configurations in batch mode\n"
 					"  -x, --auto-detect\ttry to auto-detect codec\n"
 					"\nExamples:\n"
 					"  %s sbc:ffff0235\n"
-					"  %s aptx:4f0000000100ff\n",
-					argv[0], argv[0], argv[0]);
+					"  %s aptx:4f0000000100ff\n"
+					"  %s --diff sbc:ffff0235 sbc:21150235\n"
+					"  btmon -r trace.log | %s --batch\n",
+					argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
 			return EXIT_SUCCESS;
 
 		case 'V' /* --version */ :
 			printf("%s\n", PACKAGE_VERSION);
 			return EXIT_SUCCESS;
 
+		case 'b' /* --batch */ :
+			batch_mode = true;
+			break;
+		case 'd' /* --diff */ :
+			diff_mode = true;
+			break;
+		case 'v' /* --verbose */ :
+			verbose = true;
+			break;
+
 		case 'x' /* --auto-detect */ :
 			detect = true;
 			break;
@@ -432,6 +814,18 @@ usage:
 			return EXIT_FAILURE;
 		}
 
+	if (batch_mode) {
+		if (argc - optind != 0)
+			goto usage;
+		return batch(verbose);
+	}
+
+	if (diff_mode) {
+		if (argc - optind != 2)
+			goto usage;
+		return diff(argv[optind], argv[optind + 1]);
+	}
+
 	if (argc - optind != 1)
 		goto usage;
 
@@ -446,19 +840,7 @@ usage:
 	if (get_codec_blob(codec, blob, blob_size) == -1)
 		return EXIT_FAILURE;
 
-	for (size_t i = 0; i < ARRAYSIZE(dumps); i++)
-		if (dumps[i].codec_id == codec_id) {
-			dumps[i].dump(blob, blob_size);
-			return EXIT_SUCCESS;
-		}
-
-	if (detect) {
-		for (size_t i = 0; i < ARRAYSIZE(dumps); i++)
-			if (dumps[i].blob_size == (size_t)blob_size)
-				dumps[i].dump(blob, blob_size);
-		dump_vendor(blob, blob_size);
-	}
-	else {
+	if (dump_blob(stdout, codec_id, blob, blob_size, detect) == -1) {
 		fprintf(stderr, "Couldn't detect codec type: %s\n", codec);
 		return EXIT_FAILURE;
 	}
@@ -14,10 +14,10 @@
 #include <stdlib.h>
 #include <string.h>
 
-static int alsa_pcm_set_hw_params(snd_pcm_t *pcm, snd_pcm_format_t format, int channels,
-		int rate, unsigned int *buffer_time, unsigned int *period_time, char **msg) {
+static int alsa_pcm_set_hw_params(snd_pcm_t *pcm, snd_pcm_access_t access,
+		snd_pcm_format_t format, int channels, int rate,
+		unsigned int *buffer_time, unsigned int *period_time, char **msg) {
 
-	const snd_pcm_access_t access = SND_PCM_ACCESS_RW_INTERLEAVED;
 	snd_pcm_hw_params_t *params;
 	char buf[256];
 	int dir;
@@ -115,7 +115,7 @@ fail:
 	return err;
 }
 
-int alsa_pcm_open(snd_pcm_t **pcm, const char *name,
+int alsa_pcm_open(snd_pcm_t **pcm, const char *name, snd_pcm_access_t access,
 		snd_pcm_format_t format, int channels, int rate,
 		unsigned int *buffer_time, unsigned int *period_time,
 		char **msg) {
@@ -130,7 +130,8 @@ int alsa_pcm_open(snd_pcm_t **pcm, const char *name,
 		goto fail;
 	}
 
-	if ((err = alsa_pcm_set_hw_params(_pcm, format, channels, rate, buffer_time, period_time, &tmp)) != 0) {
+	if ((err = alsa_pcm_set_hw_params(_pcm, access, format, channels, rate,
+					buffer_time, period_time, &tmp)) != 0) {
 		snprintf(buf, sizeof(buf), "Set HW params: %s", tmp);
 		goto fail;
 	}
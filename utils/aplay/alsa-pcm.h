@@ -13,7 +13,7 @@
 
 #include <alsa/asoundlib.h>
 
-int alsa_pcm_open(snd_pcm_t **pcm, const char *name,
+int alsa_pcm_open(snd_pcm_t **pcm, const char *name, snd_pcm_access_t access,
 		snd_pcm_format_t format, int channels, int rate,
 		unsigned int *buffer_time, unsigned int *period_time,
 		char **msg);
@@ -14,13 +14,17 @@
 
 #include <errno.h>
 #include <getopt.h>
+#include <math.h>
 #include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/param.h>
 #include <unistd.h>
 
 #include <alsa/asoundlib.h>
@@ -33,6 +37,8 @@
 #include "shared/log.h"
 #include "alsa-pcm.h"
 #include "dbus.h"
+#include "drift.h"
+#include "mixer.h"
 
 struct pcm_worker {
 	pthread_t thread;
@@ -44,6 +50,12 @@ struct pcm_worker {
 	int ba_pcm_ctrl_fd;
 	/* opened playback PCM device */
 	snd_pcm_t *pcm;
+	/* if true, PCM is opened with the mmap access */
+	bool pcm_mmap;
+	/* stream of the software mixer */
+	struct mixer_stream *mix;
+	/* clock drift compensator */
+	struct drift drift;
 	/* if true, playback is active */
 	bool active;
 	/* human-readable BT address */
@@ -60,7 +72,21 @@ static bdaddr_t *ba_addrs = NULL;
 static size_t ba_addrs_count = 0;
 static unsigned int pcm_buffer_time = 500000;
 static unsigned int pcm_period_time = 100000;
+static unsigned int pcm_keep_open_time = 30;
 static bool pcm_mixer = true;
+static bool pcm_drift_compensation = false;
+static bool pcm_mmap = false;
+
+/* mix all streams into a single playback PCM */
+static bool mix_streams = false;
+static struct mixer mixer;
+/* per-device mixer gains in dB */
+static struct mix_gain {
+	bdaddr_t addr;
+	double db;
+} *mix_gains = NULL;
+static size_t mix_gains_count = 0;
+static double mix_gain_default = 0;
 
 static struct ba_dbus_ctx dbus_ctx;
 static char dbus_ba_service[32] = BLUEALSA_SERVICE;
@@ -101,6 +127,52 @@ static int parse_bt_addresses(char *argv[], size_t count) {
 	return 0;
 }
 
+/**
+ * Parse mixer gain given as [BT-ADDR=]DB string. */
+static int parse_mix_gain(const char *str) {
+
+	const char *db = str;
+	char *end;
+
+	if (strchr(str, '=') != NULL) {
+
+		struct mix_gain *tmp = mix_gains;
+		if ((mix_gains = realloc(mix_gains, (mix_gains_count + 1) * sizeof(*mix_gains))) == NULL) {
+			mix_gains = tmp;
+			return -1;
+		}
+
+		char addr[18] = "";
+		strncpy(addr, str, MIN(sizeof(addr) - 1, (size_t)(strchr(str, '=') - str)));
+		if (str2ba(addr, &mix_gains[mix_gains_count].addr) != 0)
+			return errno = EINVAL, -1;
+
+		db = strchr(str, '=') + 1;
+		mix_gains[mix_gains_count].db = strtod(db, &end);
+		if (end == db || *end != '\0')
+			return errno = EINVAL, -1;
+
+		mix_gains_count++;
+		return 0;
+	}
+
+	mix_gain_default = strtod(db, &end);
+	if (end == db || *end != '\0')
+		return errno = EINVAL, -1;
+
+	return 0;
+}
+
+/**
+ * Get the mixer scaling factor for the given device. */
+static double get_mix_scale(const bdaddr_t *addr) {
+	double db = mix_gain_default;
+	for (size_t i = 0; i < mix_gains_count; i++)
+		if (bacmp(&mix_gains[i].addr, addr) == 0)
+			db = mix_gains[i].db;
+	return pow(10, db / 20);
+}
+
 static const char *bluealsa_get_profile(const struct ba_pcm *pcm) {
 	switch (pcm->transport) {
 	case BA_PCM_TRANSPORT_A2DP_SOURCE:
@@ -302,15 +374,126 @@ static void pcm_worker_routine_exit(struct pcm_worker *worker) {
 		snd_pcm_close(worker->pcm);
 		worker->pcm = NULL;
 	}
+	if (worker->mix != NULL) {
+		mixer_stream_free(worker->mix);
+		worker->mix = NULL;
+	}
+	drift_free(&worker->drift);
 	debug("Exiting PCM worker %s", worker->addr);
 }
 
+/**
+ * Reset drift compensator and prefill PCM with the target latency. */
+static void pcm_worker_drift_reset(struct pcm_worker *w, ffb_t *buffer) {
+
+	snd_pcm_uframes_t buffer_size;
+	snd_pcm_uframes_t period_size;
+	snd_pcm_get_params(w->pcm, &buffer_size, &period_size);
+
+	/* Aim at the half of the buffer, so there is enough room for the
+	 * jitter in both directions, but not less than a single period. */
+	snd_pcm_uframes_t target = MAX(buffer_size / 2, period_size);
+	drift_reset(&w->drift, target);
+
+	/* Without prefill, the controller would have to build the latency up
+	 * with the slightly slowed down signal, which would take minutes. */
+	ffb_rewind(buffer);
+	snd_pcm_format_set_silence(w->drift.format, buffer->data, buffer->nmemb);
+	while (target > 0) {
+		snd_pcm_sframes_t frames = MIN(target, buffer->nmemb / w->ba_pcm.channels);
+		if ((frames = snd_pcm_writei(w->pcm, buffer->data, frames)) < 0)
+			break;
+		target -= frames;
+	}
+
+}
+
+/**
+ * Get the number of frames buffered on the way to the playback PCM. */
+static snd_pcm_sframes_t pcm_worker_get_latency(struct pcm_worker *w, size_t samples) {
+
+	snd_pcm_sframes_t delay = 0;
+	int fifo = 0;
+
+	if (snd_pcm_delay(w->pcm, &delay) != 0)
+		delay = 0;
+	if (ioctl(w->ba_pcm_fd, FIONREAD, &fifo) == -1)
+		fifo = 0;
+
+	return delay + (fifo / snd_pcm_frames_to_bytes(w->pcm, 1)) +
+		samples / w->ba_pcm.channels;
+}
+
+/**
+ * Transfer PCM data from the FIFO directly to the mmap-ed PCM buffer.
+ *
+ * @param w Pointer to the PCM worker opened with the mmap access.
+ * @param max_frames The maximal number of frames to transfer.
+ * @return On success this function returns the number of transferred frames,
+ *   which might be 0 if the PCM buffer is full. Otherwise, negative error
+ *   code is returned. */
+static snd_pcm_sframes_t pcm_worker_mmap_transfer(struct pcm_worker *w,
+		snd_pcm_uframes_t max_frames) {
+
+	const ssize_t frame_size = snd_pcm_frames_to_bytes(w->pcm, 1);
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t buffer_size;
+	snd_pcm_uframes_t period_size;
+	snd_pcm_uframes_t offset;
+	snd_pcm_uframes_t frames;
+	snd_pcm_sframes_t avail;
+	int err;
+
+	if ((avail = snd_pcm_avail_update(w->pcm)) < 0)
+		return avail;
+
+	/* Contrary to the snd_pcm_writei(), committing frames to the mmap-ed
+	 * buffer does not start the PCM, so we have to do it on our own when
+	 * the start threshold has been reached. */
+	snd_pcm_get_params(w->pcm, &buffer_size, &period_size);
+	if (snd_pcm_state(w->pcm) == SND_PCM_STATE_PREPARED &&
+			(snd_pcm_uframes_t)avail <= buffer_size % period_size &&
+			(err = snd_pcm_start(w->pcm)) < 0)
+		return err;
+
+	if (avail == 0) {
+		snd_pcm_wait(w->pcm, 500);
+		return 0;
+	}
+
+	frames = MIN(max_frames, (snd_pcm_uframes_t)avail);
+	if ((err = snd_pcm_mmap_begin(w->pcm, &areas, &offset, &frames)) < 0)
+		return err;
+
+	/* With the interleaved access all channels share the same area. */
+	uint8_t *ptr = (uint8_t *)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8;
+	ssize_t len = 0;
+	ssize_t ret;
+
+	/* Read whole frames only. The remaining part of the incomplete frame
+	 * is going to be delivered in no time, so wait for it. */
+	for (;;) {
+		if ((ret = read(w->ba_pcm_fd, ptr + len, frames * frame_size - len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			err = -errno;
+			snd_pcm_mmap_commit(w->pcm, offset, len / frame_size);
+			return err;
+		}
+		if ((len += ret) % frame_size == 0 || ret == 0)
+			break;
+	}
+
+	return snd_pcm_mmap_commit(w->pcm, offset, len / frame_size);
+}
+
 static void *pcm_worker_routine(struct pcm_worker *w) {
 
 	snd_pcm_format_t pcm_format = bluealsa_get_snd_pcm_format(&w->ba_pcm);
 	ssize_t pcm_format_size = snd_pcm_format_size(pcm_format, 1);
 	size_t pcm_1s_samples = w->ba_pcm.sampling * w->ba_pcm.channels;
 	ffb_t buffer = { 0 };
+	ffb_t drift_buffer = { 0 };
 
 	/* Cancellation should be possible only in the carefully selected place
 	 * in order to prevent memory leaks and resources not being released. */
@@ -318,6 +501,7 @@ static void *pcm_worker_routine(struct pcm_worker *w) {
 
 	pthread_cleanup_push(PTHREAD_CLEANUP(pcm_worker_routine_exit), w);
 	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &buffer);
+	pthread_cleanup_push(PTHREAD_CLEANUP(ffb_free), &drift_buffer);
 
 	/* create buffer big enough to hold 100 ms of PCM data */
 	if (ffb_init(&buffer, pcm_1s_samples / 10, pcm_format_size) == -1) {
@@ -325,6 +509,17 @@ static void *pcm_worker_routine(struct pcm_worker *w) {
 		goto fail;
 	}
 
+	if (pcm_drift_compensation) {
+		const size_t frames = buffer.nmemb / w->ba_pcm.channels;
+		if (drift_init(&w->drift, pcm_format, w->ba_pcm.channels, w->ba_pcm.sampling, frames) == -1)
+			warn("Couldn't initialize drift compensation: %s", strerror(errno));
+		else if (ffb_init(&drift_buffer, DRIFT_OUT_FRAMES(frames) * w->ba_pcm.channels,
+					pcm_format_size) == -1) {
+			error("Couldn't create PCM buffer: %s", strerror(errno));
+			goto fail;
+		}
+	}
+
 	DBusError err = DBUS_ERROR_INIT;
 	if (!bluealsa_dbus_open_pcm(&dbus_ctx, w->ba_pcm.pcm_path,
 				&w->ba_pcm_fd, &w->ba_pcm_ctrl_fd, &err)) {
@@ -333,6 +528,12 @@ static void *pcm_worker_routine(struct pcm_worker *w) {
 		goto fail;
 	}
 
+	/* Streams which can not be mixed (e.g. with the sampling rate other than
+	 * the one used by the mixer) will be played with a separate PCM. */
+	if (mix_streams && (w->mix = mixer_stream_new(&mixer, pcm_format,
+					w->ba_pcm.channels, w->ba_pcm.sampling, get_mix_scale(&w->ba_pcm.addr))) == NULL)
+		warn("Couldn't add %s to the mixer: %s", w->addr, strerror(errno));
+
 	/* Initialize the max read length to 10 ms. Later, when the PCM device
 	 * will be opened, this value will be adjusted to one period size. */
 	size_t pcm_max_read_len_init = pcm_1s_samples / 100 * pcm_format_size;
@@ -366,16 +567,31 @@ static void *pcm_worker_routine(struct pcm_worker *w) {
 			error("PCM FIFO poll error: %s", strerror(errno));
 			goto fail;
 		case 0:
-			debug("Device marked as inactive: %s", w->addr);
 			pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-			pcm_max_read_len = pcm_max_read_len_init;
-			pause_counter = pause_bytes = 0;
-			ffb_rewind(&buffer);
+			if (w->active) {
+				debug("Device marked as inactive: %s", w->addr);
+				pause_counter = pause_bytes = 0;
+				ffb_rewind(&buffer);
+				if (w->mix != NULL)
+					mixer_stream_set_active(w->mix, false);
+				w->active = false;
+				/* Keep the PCM device opened and prepared during the stream gap
+				 * (e.g. playback paused on the phone), so the playback can be
+				 * resumed without the costly PCM reconfiguration. Leftovers are
+				 * dropped, so the stale audio will not be played on resume. */
+				if (w->pcm != NULL && pcm_keep_open_time > 0) {
+					snd_pcm_drop(w->pcm);
+					snd_pcm_prepare(w->pcm);
+					timeout = pcm_keep_open_time * 1000;
+					continue;
+				}
+			}
 			if (w->pcm != NULL) {
+				debug("Releasing PCM device: %s", w->addr);
 				snd_pcm_close(w->pcm);
 				w->pcm = NULL;
 			}
-			w->active = false;
+			pcm_max_read_len = pcm_max_read_len_init;
 			timeout = -1;
 			continue;
 		}
@@ -384,7 +600,33 @@ static void *pcm_worker_routine(struct pcm_worker *w) {
 		if (pfds[0].revents & POLLHUP)
 			break;
 
-		#define MIN(a,b) a < b ? a : b
+		/* With the mmap access, PCM data are read from the FIFO directly into
+		 * the PCM buffer, so there is no need for the intermediate buffer. */
+		if (w->pcm != NULL && w->pcm_mmap &&
+				(pcm_mixer || get_active_worker() == w)) {
+
+			snd_pcm_sframes_t frames;
+			frames = pcm_worker_mmap_transfer(w, pcm_max_read_len / pcm_format_size / w->ba_pcm.channels);
+
+			pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+			w->active = true;
+			timeout = 500;
+
+			if (frames < 0)
+				switch (-frames) {
+				case EPIPE:
+					debug("An underrun has occurred");
+					snd_pcm_prepare(w->pcm);
+					break;
+				default:
+					error("Couldn't write to PCM: %s", snd_strerror(frames));
+					goto fail;
+				}
+
+			continue;
+		}
+
 		size_t _in = MIN(pcm_max_read_len, ffb_blen_in(&buffer));
 		if ((ret = read(w->ba_pcm_fd, buffer.tail, _in)) == -1) {
 			if (errno == EINTR)
@@ -399,6 +641,12 @@ static void *pcm_worker_routine(struct pcm_worker *w) {
 		if (!pcm_mixer) {
 			struct pcm_worker *worker = get_active_worker();
 			if (worker != NULL && worker != w) {
+				/* release PCM device, so it can be used by the active worker */
+				if (w->pcm != NULL) {
+					snd_pcm_close(w->pcm);
+					w->pcm = NULL;
+					pcm_max_read_len = pcm_max_read_len_init;
+				}
 				if (pause_counter < 5 && (pause_bytes += ret) > pause_threshold) {
 					if (pause_device_player(&w->ba_pcm) == -1)
 						/* pause command does not work, stop further requests */
@@ -411,6 +659,23 @@ static void *pcm_worker_routine(struct pcm_worker *w) {
 			}
 		}
 
+		if (w->mix != NULL) {
+
+			w->active = true;
+			timeout = 500;
+
+			mixer_stream_set_active(w->mix, true);
+			ffb_seek(&buffer, ret / pcm_format_size);
+
+			/* pass complete frames only, keep the leftover for later */
+			size_t samples = ffb_len_out(&buffer) / w->ba_pcm.channels * w->ba_pcm.channels;
+			if (mixer_stream_write(w->mix, buffer.data, samples) > 0)
+				debug("Mixer overrun: %s", w->addr);
+			ffb_shift(&buffer, samples);
+
+			continue;
+		}
+
 		if (w->pcm == NULL) {
 
 			unsigned int buffer_time = pcm_buffer_time;
@@ -426,8 +691,22 @@ static void *pcm_worker_routine(struct pcm_worker *w) {
 				continue;
 			}
 
-			if (alsa_pcm_open(&w->pcm, pcm_device, pcm_format, w->ba_pcm.channels,
-						w->ba_pcm.sampling, &buffer_time, &period_time, &tmp) != 0) {
+			/* The mmap access is not used with the drift compensation, because
+			 * in such case PCM data have to be processed anyway. */
+			w->pcm_mmap = pcm_mmap && !drift_is_initialized(&w->drift);
+			if (w->pcm_mmap && alsa_pcm_open(&w->pcm, pcm_device, SND_PCM_ACCESS_MMAP_INTERLEAVED,
+						pcm_format, w->ba_pcm.channels, w->ba_pcm.sampling,
+						&buffer_time, &period_time, &tmp) != 0) {
+				warn("Couldn't open PCM with mmap access: %s", tmp);
+				w->pcm_mmap = false;
+				buffer_time = pcm_buffer_time;
+				period_time = pcm_period_time;
+				free(tmp);
+			}
+
+			if (!w->pcm_mmap && alsa_pcm_open(&w->pcm, pcm_device, SND_PCM_ACCESS_RW_INTERLEAVED,
+						pcm_format, w->ba_pcm.channels, w->ba_pcm.sampling,
+						&buffer_time, &period_time, &tmp) != 0) {
 				warn("Couldn't open PCM: %s", tmp);
 				pcm_max_read_len = pcm_max_read_len_init;
 				usleep(50000);
@@ -456,21 +735,44 @@ static void *pcm_worker_routine(struct pcm_worker *w) {
 
 		}
 
+		/* The PCM device might have been kept opened during the stream gap,
+		 * so the drift compensator has to be reset on every playback start. */
+		if (!w->active && drift_is_initialized(&w->drift))
+			pcm_worker_drift_reset(w, &drift_buffer);
+
 		/* mark device as active and set timeout to 500ms */
 		w->active = true;
 		timeout = 500;
 
 		ffb_seek(&buffer, ret / pcm_format_size);
 
+		ffb_t *out = &buffer;
+		if (drift_is_initialized(&w->drift)) {
+			/* resample complete frames only and keep the leftover for later */
+			size_t frames = ffb_len_out(&buffer) / w->ba_pcm.channels;
+			if (DRIFT_OUT_FRAMES(frames) * w->ba_pcm.channels <= ffb_len_in(&drift_buffer)) {
+				ffb_seek(&drift_buffer, w->ba_pcm.channels *
+						drift_process(&w->drift, buffer.data, frames, drift_buffer.tail));
+				ffb_shift(&buffer, frames * w->ba_pcm.channels);
+			}
+			out = &drift_buffer;
+		}
+
 		/* calculate the overall number of frames in the buffer */
-		snd_pcm_sframes_t frames = ffb_len_out(&buffer) / w->ba_pcm.channels;
+		snd_pcm_sframes_t frames = ffb_len_out(out) / w->ba_pcm.channels;
 
-		if ((frames = snd_pcm_writei(w->pcm, buffer.data, frames)) < 0)
+		if ((frames = w->pcm_mmap ?
+					snd_pcm_mmap_writei(w->pcm, out->data, frames) :
+					snd_pcm_writei(w->pcm, out->data, frames)) < 0)
 			switch (-frames) {
 			case EPIPE:
 				debug("An underrun has occurred");
 				snd_pcm_prepare(w->pcm);
 				usleep(50000);
+				if (drift_is_initialized(&w->drift)) {
+					pcm_worker_drift_reset(w, &drift_buffer);
+					continue;
+				}
 				frames = 0;
 				break;
 			default:
@@ -479,7 +781,11 @@ static void *pcm_worker_routine(struct pcm_worker *w) {
 			}
 
 		/* move leftovers to the beginning and reposition tail */
-		ffb_shift(&buffer, frames * w->ba_pcm.channels);
+		ffb_shift(out, frames * w->ba_pcm.channels);
+
+		if (drift_is_initialized(&w->drift))
+			drift_update(&w->drift, pcm_worker_get_latency(w,
+						ffb_len_out(&buffer) + ffb_len_out(&drift_buffer)), frames);
 
 	}
 
@@ -487,15 +793,41 @@ fail:
 	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 	pthread_cleanup_pop(1);
 	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
 	return NULL;
 }
 
+static int supervise_pcm_worker_stop(struct ba_pcm *ba_pcm) {
+
+	size_t i;
+	for (i = 0; i < workers_count; i++)
+		if (strcmp(workers[i].ba_pcm.pcm_path, ba_pcm->pcm_path) == 0) {
+			pthread_rwlock_wrlock(&workers_lock);
+			pthread_cancel(workers[i].thread);
+			pthread_join(workers[i].thread, NULL);
+			memcpy(&workers[i], &workers[--workers_count], sizeof(workers[i]));
+			pthread_rwlock_unlock(&workers_lock);
+		}
+
+	return 0;
+}
+
 static int supervise_pcm_worker_start(struct ba_pcm *ba_pcm) {
 
 	size_t i;
 	for (i = 0; i < workers_count; i++)
-		if (strcmp(workers[i].ba_pcm.pcm_path, ba_pcm->pcm_path) == 0)
-			return 0;
+		if (strcmp(workers[i].ba_pcm.pcm_path, ba_pcm->pcm_path) == 0) {
+			const struct ba_pcm *pcm = &workers[i].ba_pcm;
+			/* PCM worker (and its playback PCM device) is configured for the
+			 * given audio format, so restart it on the format change only */
+			if (pcm->format == ba_pcm->format &&
+					pcm->channels == ba_pcm->channels &&
+					pcm->sampling == ba_pcm->sampling)
+				return 0;
+			debug("PCM format changed: %s", workers[i].addr);
+			supervise_pcm_worker_stop(ba_pcm);
+			break;
+		}
 
 	pthread_rwlock_wrlock(&workers_lock);
 
@@ -518,6 +850,9 @@ static int supervise_pcm_worker_start(struct ba_pcm *ba_pcm) {
 	worker->ba_pcm_fd = -1;
 	worker->ba_pcm_ctrl_fd = -1;
 	worker->pcm = NULL;
+	worker->pcm_mmap = false;
+	worker->mix = NULL;
+	memset(&worker->drift, 0, sizeof(worker->drift));
 
 	pthread_rwlock_unlock(&workers_lock);
 
@@ -533,21 +868,6 @@ static int supervise_pcm_worker_start(struct ba_pcm *ba_pcm) {
 	return 0;
 }
 
-static int supervise_pcm_worker_stop(struct ba_pcm *ba_pcm) {
-
-	size_t i;
-	for (i = 0; i < workers_count; i++)
-		if (strcmp(workers[i].ba_pcm.pcm_path, ba_pcm->pcm_path) == 0) {
-			pthread_rwlock_wrlock(&workers_lock);
-			pthread_cancel(workers[i].thread);
-			pthread_join(workers[i].thread, NULL);
-			memcpy(&workers[i], &workers[--workers_count], sizeof(workers[i]));
-			pthread_rwlock_unlock(&workers_lock);
-		}
-
-	return 0;
-}
-
 static int supervise_pcm_worker(struct ba_pcm *ba_pcm) {
 
 	if (ba_pcm == NULL)
@@ -660,9 +980,14 @@ int main(int argc, char *argv[]) {
 		{ "pcm", required_argument, NULL, 'D' },
 		{ "pcm-buffer-time", required_argument, NULL, 3 },
 		{ "pcm-period-time", required_argument, NULL, 4 },
+		{ "pcm-keep-open", required_argument, NULL, 10 },
 		{ "profile-a2dp", no_argument, NULL, 1 },
 		{ "profile-sco", no_argument, NULL, 2 },
 		{ "single-audio", no_argument, NULL, 5 },
+		{ "mix", no_argument, NULL, 6 },
+		{ "mix-gain", required_argument, NULL, 7 },
+		{ "drift-compensation", no_argument, NULL, 8 },
+		{ "pcm-mmap", no_argument, NULL, 9 },
 		{ 0, 0, 0, 0 },
 	};
 
@@ -681,9 +1006,14 @@ int main(int argc, char *argv[]) {
 					"  -D, --pcm=NAME\tplayback PCM device to use\n"
 					"  --pcm-buffer-time=INT\tplayback PCM buffer time\n"
 					"  --pcm-period-time=INT\tplayback PCM period time\n"
+					"  --pcm-keep-open=SEC\tkeep idle playback PCM opened\n"
+					"  --pcm-mmap\t\tuse mmap access for playback PCM\n"
 					"  --profile-a2dp\tuse A2DP profile (default)\n"
 					"  --profile-sco\t\tuse SCO profile\n"
 					"  --single-audio\tsingle audio mode\n"
+					"  --mix\t\t\tmix all streams into one PCM\n"
+					"  --mix-gain=[ADDR=]DB\tmixer gain for the given device\n"
+					"  --drift-compensation\tcompensate BT and PCM clock drift\n"
 					"\nNote:\n"
 					"If one wants to receive audio from more than one Bluetooth device, it is\n"
 					"possible to specify more than one MAC address. By specifying any/empty MAC\n"
@@ -732,11 +1062,43 @@ int main(int argc, char *argv[]) {
 			pcm_mixer = false;
 			break;
 
+		case 6 /* --mix */ :
+			mix_streams = true;
+			break;
+		case 7 /* --mix-gain=[BT-ADDR=]DB */ :
+			if (parse_mix_gain(optarg) == -1) {
+				error("Invalid mixer gain: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+
+		case 8 /* --drift-compensation */ :
+			pcm_drift_compensation = true;
+			break;
+
+		case 9 /* --pcm-mmap */ :
+			pcm_mmap = true;
+			break;
+
+		case 10 /* --pcm-keep-open=SEC */ :
+			pcm_keep_open_time = atoi(optarg);
+			break;
+
 		default:
 			fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
 			return EXIT_FAILURE;
 		}
 
+	if (mix_streams && !pcm_mixer) {
+		error("Options --mix and --single-audio are mutually exclusive");
+		return EXIT_FAILURE;
+	}
+
+	if (mix_streams && pcm_drift_compensation) {
+		error("Options --mix and --drift-compensation are mutually exclusive");
+		return EXIT_FAILURE;
+	}
+
 	log_open(argv[0], false, false);
 	dbus_threads_init_default();
 
@@ -784,11 +1146,15 @@ int main(int argc, char *argv[]) {
 				"  PCM buffer time: %u us\n"
 				"  PCM period time: %u us\n"
 				"  Bluetooth device(s): %s\n"
-				"  Profile: %s\n",
+				"  Profile: %s\n"
+				"  Software mixer: %s\n"
+				"  Drift compensation: %s\n",
 				dbus_ba_service,
 				pcm_device, pcm_buffer_time, pcm_period_time,
 				ba_addr_any ? "ANY" : &ba_str[2],
-				ba_profile_a2dp ? "A2DP" : "SCO");
+				ba_profile_a2dp ? "A2DP" : "SCO",
+				mix_streams ? "enabled" : "disabled",
+				pcm_drift_compensation ? "enabled" : "disabled");
 
 		free(ba_str);
 	}
@@ -806,6 +1172,12 @@ int main(int argc, char *argv[]) {
 		return EXIT_FAILURE;
 	}
 
+	if (mix_streams && mixer_init(&mixer, pcm_device,
+				pcm_buffer_time, pcm_period_time, verbose) == -1) {
+		error("Couldn't start mixer: %s", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
 	if (!bluealsa_dbus_get_pcms(&dbus_ctx, &ba_pcms, &ba_pcms_count, &err))
 		warn("Couldn't get BlueALSA PCM list: %s", err.message);
 
@@ -838,5 +1210,18 @@ int main(int argc, char *argv[]) {
 
 	}
 
+	/* Stop all workers, so their streams will be removed from the mixer
+	 * before the mixer thread is terminated. The list of workers is not
+	 * modified by anyone else, so there is no need to lock it here - and
+	 * the lock must not be held, because workers might wait for it. */
+	for (i = 0; i < workers_count; i++) {
+		pthread_cancel(workers[i].thread);
+		pthread_join(workers[i].thread, NULL);
+	}
+	workers_count = 0;
+
+	if (mix_streams)
+		mixer_free(&mixer);
+
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,208 @@
+/*
+ * BlueALSA - drift.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "drift.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The proportional and integral gains of the controller. The latency error
+ * is expressed in seconds. With these values the controller is critically
+ * damped with the time constant of about 100 seconds, which is a lot more
+ * than the period of the latency jitter caused by the Bluetooth link. */
+#define DRIFT_KP 2e-2
+#define DRIFT_KI 1e-4
+
+/**
+ * Initialize clock drift compensator.
+ *
+ * @param d Pointer to the drift structure.
+ * @param format The PCM format. Supported formats are S16_LE, S24_LE and
+ *   S32_LE only.
+ * @param channels The number of channels.
+ * @param sampling The sampling frequency.
+ * @param capacity The maximal number of input frames processed at once.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int drift_init(struct drift *d, snd_pcm_format_t format, unsigned int channels,
+		unsigned int sampling, size_t capacity) {
+
+	drift_free(d);
+
+	if ((format != SND_PCM_FORMAT_S16_LE &&
+				format != SND_PCM_FORMAT_S24_LE &&
+				format != SND_PCM_FORMAT_S32_LE) ||
+			channels == 0 || sampling == 0 || capacity == 0)
+		return errno = EINVAL, -1;
+
+	/* On top of the given capacity, the history holds three frames required
+	 * by the interpolation and the leading silence frame. */
+	if ((d->history = malloc(sizeof(*d->history) * (capacity + 4) * channels)) == NULL)
+		return -1;
+
+	d->format = format;
+	d->channels = channels;
+	d->sampling = sampling;
+	d->capacity = capacity;
+
+	drift_reset(d, 0);
+	return 0;
+}
+
+/**
+ * Free resources allocated by the drift_init(). */
+void drift_free(struct drift *d) {
+	free(d->history);
+	d->history = NULL;
+}
+
+/**
+ * Reset drift compensator state.
+ *
+ * @param d Pointer to initialized drift structure.
+ * @param target The target latency in frames. */
+void drift_reset(struct drift *d, snd_pcm_uframes_t target) {
+	/* The interpolation of the very first output frame requires one frame
+	 * preceding it, so prefill the history with a single silence frame. */
+	memset(d->history, 0, sizeof(*d->history) * d->channels);
+	d->history_len = 1;
+	d->mu = 0;
+	d->step = 1;
+	d->target = target;
+	d->error = 0;
+	d->integral = 0;
+}
+
+/**
+ * Update the conversion ratio based on the measured latency.
+ *
+ * @param d Pointer to initialized drift structure.
+ * @param latency The number of frames buffered between the source and the
+ *   playback device, including the ALSA PCM delay.
+ * @param frames The number of frames written since the last update. */
+void drift_update(struct drift *d, snd_pcm_sframes_t latency, size_t frames) {
+
+	const double max = DRIFT_MAX_PPM * 1e-6;
+	const double dt = (double)frames / d->sampling;
+
+	/* Smooth out the latency jitter with the time constant of 1 second,
+	 * because data from the Bluetooth link arrives in bursts. */
+	d->error += (dt < 1 ? dt : 1) * (latency - d->target - d->error);
+
+	const double error = d->error / d->sampling;
+	d->integral += error * dt;
+
+	/* prevent integral windup */
+	if (DRIFT_KI * d->integral > max)
+		d->integral = max / DRIFT_KI;
+	if (DRIFT_KI * d->integral < -max)
+		d->integral = -max / DRIFT_KI;
+
+	double correction = DRIFT_KP * error + DRIFT_KI * d->integral;
+	correction = correction > max ? max : correction < -max ? -max : correction;
+
+	/* If the latency is above the target, the input signal has to be
+	 * consumed faster than the nominal rate. */
+	d->step = 1 + correction;
+
+}
+
+/**
+ * Get the current ratio correction in parts per million. */
+int drift_get_ppm(const struct drift *d) {
+	return lround((d->step - 1) * 1e6);
+}
+
+/**
+ * Resample given input signal.
+ *
+ * @param d Pointer to initialized drift structure.
+ * @param in Address of the buffer with the interleaved PCM signal.
+ * @param frames The number of frames in the input buffer. This number
+ *   shall not exceed the capacity given during initialization.
+ * @param out Address of the buffer where the resampled signal shall be
+ *   stored. The buffer shall be big enough to hold DRIFT_OUT_FRAMES()
+ *   frames.
+ * @return This function returns the number of stored frames. */
+size_t drift_process(struct drift *d, const void *in, size_t frames, void *out) {
+
+	const unsigned int channels = d->channels;
+	const size_t samples = (frames < d->capacity ? frames : d->capacity) * channels;
+	float *dst = &d->history[d->history_len * channels];
+	size_t i;
+
+	double max = INT32_MAX;
+	if (d->format == SND_PCM_FORMAT_S16_LE)
+		max = INT16_MAX;
+	else if (d->format == SND_PCM_FORMAT_S24_LE)
+		max = 0x7FFFFF;
+	const double min = -max - 1;
+
+	if (d->format == SND_PCM_FORMAT_S16_LE)
+		for (i = 0; i < samples; i++)
+			dst[i] = ((const int16_t *)in)[i];
+	else
+		for (i = 0; i < samples; i++)
+			dst[i] = ((const int32_t *)in)[i];
+
+	d->history_len += samples / channels;
+
+	/* The output frame is interpolated between frames pos and pos + 1,
+	 * so one preceding and two following frames have to be available. */
+	size_t pos = 1;
+	size_t n;
+
+	for (n = 0; pos + 2 < d->history_len; n++) {
+
+		const float *x = &d->history[(pos - 1) * channels];
+		const double t = d->mu;
+
+		for (unsigned int c = 0; c < channels; c++) {
+
+			const double x0 = x[c];
+			const double x1 = x[channels + c];
+			const double x2 = x[2 * channels + c];
+			const double x3 = x[3 * channels + c];
+
+			/* Catmull-Rom spline */
+			const double a = -0.5 * x0 + 1.5 * x1 - 1.5 * x2 + 0.5 * x3;
+			const double b = x0 - 2.5 * x1 + 2 * x2 - 0.5 * x3;
+			const double c1 = -0.5 * x0 + 0.5 * x2;
+
+			double v = round(((a * t + b) * t + c1) * t + x1);
+			v = v > max ? max : v < min ? min : v;
+
+			if (d->format == SND_PCM_FORMAT_S16_LE)
+				((int16_t *)out)[n * channels + c] = v;
+			else
+				((int32_t *)out)[n * channels + c] = v;
+
+		}
+
+		d->mu += d->step;
+		const double whole = floor(d->mu);
+		pos += whole;
+		d->mu -= whole;
+
+	}
+
+	/* Keep frames which are required for the next output frame. Since the
+	 * step is less than 2, the position never moves past the history end. */
+	const size_t shift = pos - 1;
+	d->history_len -= shift;
+	memmove(d->history, &d->history[shift * channels],
+			sizeof(*d->history) * d->history_len * channels);
+
+	return n;
+}
@@ -0,0 +1,72 @@
+/*
+ * BlueALSA - drift.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_APLAY_DRIFT_H_
+#define BLUEALSA_APLAY_DRIFT_H_
+
+#include <stddef.h>
+
+#include <alsa/asoundlib.h>
+
+/**
+ * The maximal correction of the conversion ratio in parts per million.
+ *
+ * Clock drift of typical audio hardware is well below 100 ppm, so this
+ * limit leaves enough headroom, while keeping the pitch change inaudible. */
+#define DRIFT_MAX_PPM 1000
+
+/**
+ * Get the maximal number of output frames for the given input frames. */
+#define DRIFT_OUT_FRAMES(frames) ((frames) + (frames) / 500 + 5)
+
+/**
+ * Adaptive resampler which compensates clock drift.
+ *
+ * The conversion ratio is kept close to 1:1 and it is adjusted with the PI
+ * controller, which drives the measured playback latency (data buffered on
+ * the way from the Bluetooth source to the ALSA sink) towards the target.
+ * Output frames are interpolated with the cubic Hermite spline. */
+struct drift {
+	snd_pcm_format_t format;
+	unsigned int channels;
+	unsigned int sampling;
+	/* input signal history (frames x channels) */
+	float *history;
+	/* the number of frames in the history */
+	size_t history_len;
+	/* the maximal number of input frames per single call */
+	size_t capacity;
+	/* fractional position of the next output frame */
+	double mu;
+	/* input frames consumed per one output frame */
+	double step;
+	/* target latency in frames */
+	double target;
+	/* smoothed latency error in frames */
+	double error;
+	/* the integral term of the controller */
+	double integral;
+};
+
+int drift_init(struct drift *d, snd_pcm_format_t format, unsigned int channels,
+		unsigned int sampling, size_t capacity);
+void drift_free(struct drift *d);
+void drift_reset(struct drift *d, snd_pcm_uframes_t target);
+
+/**
+ * Check whether the drift compensator has been initialized. */
+#define drift_is_initialized(d) ((d)->history != NULL)
+
+void drift_update(struct drift *d, snd_pcm_sframes_t latency, size_t frames);
+int drift_get_ppm(const struct drift *d);
+
+size_t drift_process(struct drift *d, const void *in, size_t frames, void *out);
+
+#endif
@@ -0,0 +1,412 @@
+/*
+ * BlueALSA - mixer.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#include "mixer.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "audio.h"
+#include "shared/defs.h"
+#include "shared/log.h"
+#include "alsa-pcm.h"
+
+/**
+ * Check whether at least one of the streams is active. */
+static bool mixer_is_active(const struct mixer *m) {
+	for (size_t i = 0; i < m->streams_count; i++)
+		if (m->streams[i]->active)
+			return true;
+	return false;
+}
+
+/**
+ * Check whether there is enough data to mix the given number of samples.
+ *
+ * @param m Pointer to the mixer structure.
+ * @param samples The number of samples to mix.
+ * @param all If true, check whether all active streams have delivered
+ *   enough data. Otherwise, check whether at least one stream did. */
+static bool mixer_is_ready(const struct mixer *m, size_t samples, bool all) {
+	for (size_t i = 0; i < m->streams_count; i++) {
+		if (!m->streams[i]->active)
+			continue;
+		if ((ffb_len_out(&m->streams[i]->buffer) >= samples) != all)
+			return !all;
+	}
+	return all;
+}
+
+static void mixer_mix(struct mixer *m, void *buffer, size_t samples) {
+
+	memset(buffer, 0, samples * snd_pcm_format_physical_width(m->format) / 8);
+
+	for (size_t i = 0; i < m->streams_count; i++) {
+		struct mixer_stream *s = m->streams[i];
+
+		if (!s->active)
+			continue;
+
+		size_t len = ffb_len_out(&s->buffer);
+		if (len > samples)
+			len = samples;
+
+		switch (m->format) {
+		case SND_PCM_FORMAT_S16_LE:
+			audio_mix_s16_2le(buffer, s->buffer.data, len, s->scale);
+			break;
+		case SND_PCM_FORMAT_S24_LE:
+			audio_mix_s24_4le(buffer, s->buffer.data, len, s->scale);
+			break;
+		case SND_PCM_FORMAT_S32_LE:
+			audio_mix_s32_4le(buffer, s->buffer.data, len, s->scale);
+			break;
+		default:
+			break;
+		}
+
+		ffb_shift(&s->buffer, len);
+
+	}
+
+}
+
+static void mixer_pcm_close(struct mixer *m) {
+	if (m->pcm != NULL) {
+		debug("Closing mixer PCM");
+		snd_pcm_close(m->pcm);
+		m->pcm = NULL;
+	}
+}
+
+static void *mixer_thread(struct mixer *m) {
+
+	snd_pcm_uframes_t period_size = 0;
+	void *buffer = NULL;
+	/* deadline for streams which have not delivered the whole period */
+	struct timespec deadline;
+	bool deadline_armed = false;
+
+	pthread_mutex_lock(&m->mutex);
+
+	debug("Starting mixer loop");
+	while (m->running) {
+
+		if (!mixer_is_active(m)) {
+			mixer_pcm_close(m);
+			pthread_cond_wait(&m->cond, &m->mutex);
+			continue;
+		}
+
+		if (m->pcm == NULL) {
+
+			unsigned int buffer_time = m->buffer_time;
+			unsigned int period_time = m->period_time;
+			snd_pcm_uframes_t buffer_size;
+			char *tmp;
+
+			if (alsa_pcm_open(&m->pcm, m->device, SND_PCM_ACCESS_RW_INTERLEAVED,
+						m->format, m->channels, m->sampling, &buffer_time, &period_time, &tmp) != 0) {
+				warn("Couldn't open mixer PCM: %s", tmp);
+				free(tmp);
+				/* try again after one second */
+				struct timespec ts;
+				clock_gettime(CLOCK_REALTIME, &ts);
+				ts.tv_sec++;
+				pthread_cond_timedwait(&m->cond, &m->mutex, &ts);
+				continue;
+			}
+
+			snd_pcm_get_params(m->pcm, &buffer_size, &period_size);
+
+			void *tmp_buffer;
+			if ((tmp_buffer = realloc(buffer, snd_pcm_frames_to_bytes(m->pcm, period_size))) == NULL) {
+				error("Couldn't create mixer buffer: %s", strerror(ENOMEM));
+				mixer_pcm_close(m);
+				break;
+			}
+			buffer = tmp_buffer;
+
+			if (m->verbose >= 2) {
+				printf("Used configuration for mixer:\n"
+						"  PCM buffer time: %u us (%zu bytes)\n"
+						"  PCM period time: %u us (%zu bytes)\n"
+						"  PCM format: %s\n"
+						"  Sampling rate: %u Hz\n"
+						"  Channels: %u\n",
+						buffer_time, snd_pcm_frames_to_bytes(m->pcm, buffer_size),
+						period_time, snd_pcm_frames_to_bytes(m->pcm, period_size),
+						snd_pcm_format_name(m->format),
+						m->sampling,
+						m->channels);
+			}
+
+		}
+
+		if (!mixer_is_ready(m, period_size * m->channels, false)) {
+			deadline_armed = false;
+			pthread_cond_wait(&m->cond, &m->mutex);
+			continue;
+		}
+
+		/* The mixer is paced by the stream which delivers data the fastest.
+		 * Other streams are waited for up to the period time, so a stream
+		 * which is just a bit late will not be padded with silence. Only
+		 * then streams which are still late contribute as many samples as
+		 * they have. */
+		if (!mixer_is_ready(m, period_size * m->channels, true)) {
+			if (!deadline_armed) {
+				const uint64_t period_ns = (uint64_t)period_size * 1000000000 / m->sampling;
+				clock_gettime(CLOCK_REALTIME, &deadline);
+				deadline.tv_sec += (deadline.tv_nsec + period_ns) / 1000000000;
+				deadline.tv_nsec = (deadline.tv_nsec + period_ns) % 1000000000;
+				deadline_armed = true;
+			}
+			if (pthread_cond_timedwait(&m->cond, &m->mutex, &deadline) != ETIMEDOUT)
+				continue;
+			if (!m->running)
+				break;
+		}
+
+		deadline_armed = false;
+		mixer_mix(m, buffer, period_size * m->channels);
+
+		/* The PCM handle is closed by this thread only, so it is safe
+		 * to use it without holding the lock. */
+		snd_pcm_t *pcm = m->pcm;
+		pthread_mutex_unlock(&m->mutex);
+
+		snd_pcm_sframes_t frames;
+		if ((frames = snd_pcm_writei(pcm, buffer, period_size)) < 0)
+			switch (-frames) {
+			case EPIPE:
+				debug("An underrun has occurred");
+				snd_pcm_prepare(pcm);
+				break;
+			default:
+				error("Couldn't write to mixer PCM: %s", snd_strerror(frames));
+				pthread_mutex_lock(&m->mutex);
+				mixer_pcm_close(m);
+				continue;
+			}
+
+		pthread_mutex_lock(&m->mutex);
+
+	}
+
+	mixer_pcm_close(m);
+	pthread_mutex_unlock(&m->mutex);
+
+	free(buffer);
+	return NULL;
+}
+
+/**
+ * Initialize software mixer and start the mixer thread.
+ *
+ * @param m Pointer to the mixer structure.
+ * @param device The name of the playback PCM device.
+ * @param buffer_time The requested PCM buffer time in microseconds.
+ * @param period_time The requested PCM period time in microseconds.
+ * @param verbose The verbosity level.
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+int mixer_init(struct mixer *m, const char *device,
+		unsigned int buffer_time, unsigned int period_time, unsigned int verbose) {
+
+	*m = (struct mixer){
+		.device = device,
+		.buffer_time = buffer_time,
+		.period_time = period_time,
+		.format = SND_PCM_FORMAT_UNKNOWN,
+		.running = true,
+		.verbose = verbose,
+	};
+
+	pthread_mutex_init(&m->mutex, NULL);
+	pthread_cond_init(&m->cond, NULL);
+
+	if ((errno = pthread_create(&m->thread, NULL, PTHREAD_ROUTINE(mixer_thread), m)) != 0) {
+		pthread_mutex_destroy(&m->mutex);
+		pthread_cond_destroy(&m->cond);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Stop the mixer thread and release resources.
+ *
+ * All streams shall be freed before calling this function. */
+void mixer_free(struct mixer *m) {
+
+	pthread_mutex_lock(&m->mutex);
+	m->running = false;
+	pthread_cond_signal(&m->cond);
+	pthread_mutex_unlock(&m->mutex);
+
+	pthread_join(m->thread, NULL);
+
+	pthread_mutex_destroy(&m->mutex);
+	pthread_cond_destroy(&m->cond);
+	free(m->streams);
+
+}
+
+/**
+ * Add new stream to the mixer.
+ *
+ * @param m Pointer to the mixer structure.
+ * @param format The PCM format of the stream.
+ * @param channels The number of channels.
+ * @param sampling The sampling frequency.
+ * @param scale The gain applied to the stream while mixing.
+ * @return On success this function returns newly allocated stream, which
+ *   shall be freed with the mixer_stream_free() function. On error NULL is
+ *   returned and errno is set appropriately. If the stream can not be mixed
+ *   because of the configuration mismatch, errno is set to EINVAL. */
+struct mixer_stream *mixer_stream_new(struct mixer *m, snd_pcm_format_t format,
+		unsigned int channels, unsigned int sampling, double scale) {
+
+	struct mixer_stream *s = NULL;
+	struct mixer_stream **tmp;
+
+	if (format != SND_PCM_FORMAT_S16_LE &&
+			format != SND_PCM_FORMAT_S24_LE &&
+			format != SND_PCM_FORMAT_S32_LE)
+		return errno = EINVAL, NULL;
+
+	pthread_mutex_lock(&m->mutex);
+
+	if (m->streams_count == 0) {
+		m->format = format;
+		m->channels = channels;
+		m->sampling = sampling;
+	}
+	else if (m->format != format ||
+			m->channels != channels ||
+			m->sampling != sampling) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	if ((s = calloc(1, sizeof(*s))) == NULL)
+		goto fail;
+
+	/* buffer big enough to hold the whole playback PCM buffer */
+	const size_t samples = (size_t)sampling * (m->buffer_time / 1000) / 1000 * channels;
+	if (ffb_init(&s->buffer, samples, snd_pcm_format_physical_width(format) / 8) == -1)
+		goto fail;
+
+	if ((tmp = realloc(m->streams, (m->streams_count + 1) * sizeof(*tmp))) == NULL)
+		goto fail;
+
+	m->streams = tmp;
+	m->streams[m->streams_count++] = s;
+
+	s->mixer = m;
+	s->scale = scale;
+
+	pthread_mutex_unlock(&m->mutex);
+	return s;
+
+fail:
+	pthread_mutex_unlock(&m->mutex);
+	if (s != NULL) {
+		ffb_free(&s->buffer);
+		free(s);
+	}
+	return NULL;
+}
+
+/**
+ * Remove stream from the mixer and free its resources. */
+void mixer_stream_free(struct mixer_stream *s) {
+
+	struct mixer *m = s->mixer;
+
+	pthread_mutex_lock(&m->mutex);
+
+	for (size_t i = 0; i < m->streams_count; i++)
+		if (m->streams[i] == s) {
+			m->streams[i] = m->streams[--m->streams_count];
+			break;
+		}
+
+	pthread_cond_signal(&m->cond);
+	pthread_mutex_unlock(&m->mutex);
+
+	ffb_free(&s->buffer);
+	free(s);
+
+}
+
+/**
+ * Mark stream as active or inactive.
+ *
+ * Samples buffered by the inactive stream are discarded. */
+void mixer_stream_set_active(struct mixer_stream *s, bool active) {
+
+	struct mixer *m = s->mixer;
+
+	pthread_mutex_lock(&m->mutex);
+
+	if (s->active != active) {
+		s->active = active;
+		ffb_rewind(&s->buffer);
+		pthread_cond_signal(&m->cond);
+	}
+
+	pthread_mutex_unlock(&m->mutex);
+
+}
+
+/**
+ * Write samples to the mixer stream.
+ *
+ * This function never blocks. If there is not enough space in the stream
+ * buffer, the oldest samples are discarded.
+ *
+ * @param s Pointer to the mixer stream.
+ * @param buffer Address of the buffer with the interleaved PCM signal.
+ * @param samples The number of samples in the buffer.
+ * @return This function returns the number of discarded samples. */
+size_t mixer_stream_write(struct mixer_stream *s, const void *buffer, size_t samples) {
+
+	struct mixer *m = s->mixer;
+	size_t dropped = 0;
+
+	pthread_mutex_lock(&m->mutex);
+
+	if (samples > s->buffer.nmemb) {
+		dropped = samples - s->buffer.nmemb;
+		buffer = (const uint8_t *)buffer + dropped * s->buffer.size;
+		samples = s->buffer.nmemb;
+	}
+
+	const size_t space = ffb_len_in(&s->buffer);
+	if (samples > space) {
+		ffb_shift(&s->buffer, samples - space);
+		dropped += samples - space;
+	}
+
+	memcpy(s->buffer.tail, buffer, samples * s->buffer.size);
+	ffb_seek(&s->buffer, samples);
+
+	pthread_cond_signal(&m->cond);
+	pthread_mutex_unlock(&m->mutex);
+
+	return dropped;
+}
@@ -0,0 +1,74 @@
+/*
+ * BlueALSA - mixer.h
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#ifndef BLUEALSA_APLAY_MIXER_H_
+#define BLUEALSA_APLAY_MIXER_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <alsa/asoundlib.h>
+
+#include "shared/ffb.h"
+
+struct mixer;
+
+/**
+ * Single audio stream mixed by the mixer. */
+struct mixer_stream {
+	struct mixer *mixer;
+	/* samples waiting to be mixed */
+	ffb_t buffer;
+	/* gain applied to the stream while mixing */
+	double scale;
+	/* if false, the stream is not mixed at all */
+	bool active;
+};
+
+/**
+ * Software mixer which sums several audio streams into one ALSA PCM.
+ *
+ * All streams have to share the same PCM format, number of channels and
+ * sampling rate. These parameters are taken from the first added stream.
+ * The playback PCM is opened when at least one of the streams is active,
+ * and it is closed when all streams become inactive. */
+struct mixer {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	/* playback PCM configuration */
+	const char *device;
+	unsigned int buffer_time;
+	unsigned int period_time;
+	snd_pcm_format_t format;
+	unsigned int channels;
+	unsigned int sampling;
+	/* opened playback PCM device */
+	snd_pcm_t *pcm;
+	/* mixed streams */
+	struct mixer_stream **streams;
+	size_t streams_count;
+	bool running;
+	unsigned int verbose;
+};
+
+int mixer_init(struct mixer *m, const char *device,
+		unsigned int buffer_time, unsigned int period_time, unsigned int verbose);
+void mixer_free(struct mixer *m);
+
+struct mixer_stream *mixer_stream_new(struct mixer *m, snd_pcm_format_t format,
+		unsigned int channels, unsigned int sampling, double scale);
+void mixer_stream_free(struct mixer_stream *s);
+
+void mixer_stream_set_active(struct mixer_stream *s, bool active);
+size_t mixer_stream_write(struct mixer_stream *s, const void *buffer, size_t samples);
+
+#endif
@@ -14,11 +14,13 @@
 
 #include <errno.h>
 #include <getopt.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <dbus/dbus.h>
@@ -50,12 +52,18 @@ static const char *transport_code_to_string(int transport_code) {
 		return "HSP-AG";
 	case BA_PCM_TRANSPORT_HSP_HS:
 		return "HSP-HS";
+	case BA_PCM_TRANSPORT_BAP_SOURCE:
+		return "BAP-source";
+	case BA_PCM_TRANSPORT_BAP_SINK:
+		return "BAP-sink";
 	case BA_PCM_TRANSPORT_MASK_A2DP:
 		return "A2DP";
 	case BA_PCM_TRANSPORT_MASK_HFP:
 		return "HFP";
 	case BA_PCM_TRANSPORT_MASK_HSP:
 		return "HSP";
+	case BA_PCM_TRANSPORT_MASK_BAP:
+		return "BAP";
 	case BA_PCM_TRANSPORT_MASK_SCO:
 		return "SCO";
 	case BA_PCM_TRANSPORT_MASK_AG:
@@ -90,6 +98,10 @@ static const char *pcm_format_to_string(int pcm_format) {
 		return "S24_LE";
 	case 0x8420:
 		return "S32_LE";
+	case 0x0100:
+		return "MPEG";
+	case 0x4100:
+		return "AAC_LOAS";
 	default:
 		return "Invalid";
 	}
@@ -331,11 +343,21 @@ static int cmd_info(int argc, char *argv[]) {
 	printf("Transport: %s\n", transport_code_to_string(pcm.transport));
 	printf("Mode: %s\n", pcm_mode_to_string(pcm.mode));
 	printf("Format: %s\n", pcm_format_to_string(pcm.format));
+	printf("Available formats:");
+	for (size_t i = 0; i < pcm.formats_len; i++)
+		printf(" %s", pcm_format_to_string(pcm.formats[i]));
+	printf("\n");
 	printf("Channels: %d\n", pcm.channels);
 	printf("Sampling: %d Hz\n", pcm.sampling);
+	printf("Available samplings:");
+	for (size_t i = 0; i < pcm.samplings_len; i++)
+		printf(" %u", pcm.samplings[i]);
+	printf("\n");
 	print_codecs(path, &err);
 	printf("Selected codec: %s\n", pcm.codec);
 	printf("Delay: %#.1f ms\n", (double)pcm.delay / 10);
+	printf("ConcealedFrames: %u\n", pcm.concealed_frames);
+	printf("Scheduling: %s\n", pcm.scheduling);
 	printf("SoftVolume: %s\n", pcm.soft_volume ? "Y" : "N");
 	print_volume(&pcm);
 	print_mute(&pcm);
@@ -548,59 +570,111 @@ static int cmd_softvol(int argc, char *argv[]) {
 	return EXIT_SUCCESS;
 }
 
+static bool is_capture_pcm_path(const char *path) {
+	size_t len = strlen(path);
+	return (len >= strlen("source") && strcmp(path + len - strlen("source"), "source") == 0) ||
+		(len >= strlen("monitor") && strcmp(path + len - strlen("monitor"), "monitor") == 0);
+}
+
+static bool write_all(int fd, const void *buffer, size_t count) {
+	const char *pos = buffer;
+	while (count > 0) {
+		ssize_t res;
+		if ((res = write(fd, pos, count)) <= 0)
+			return false;
+		count -= res;
+		pos += res;
+	}
+	return true;
+}
+
 static int cmd_open(int argc, char *argv[]) {
 
-	if (argc != 2) {
+	if (argc < 2 || argc > 3) {
 		cmd_print_error("Invalid number of arguments");
 		return EXIT_FAILURE;
 	}
 
-	const char *path = argv[1];
-	if (!dbus_validate_path(path, NULL)) {
-		cmd_print_error("Invalid PCM path: %s", path);
-		return EXIT_FAILURE;
+	const char *paths[2];
+	const size_t paths_len = argc - 1;
+	int fds_pcm[2], fds_pcm_ctrl[2];
+	struct pollfd pfds[2];
+	int outputs[2];
+	size_t i, active;
+
+	for (i = 0; i < paths_len; i++) {
+		paths[i] = argv[i + 1];
+		if (!dbus_validate_path(paths[i], NULL)) {
+			cmd_print_error("Invalid PCM path: %s", paths[i]);
+			return EXIT_FAILURE;
+		}
 	}
 
-	int fd_pcm, fd_pcm_ctrl, input, output;
-	size_t len = strlen(path);
+	/* With two PCMs, one is played from stdin and the other one is
+	 * captured to stdout, e.g. the HFP speaker and microphone pair. */
+	if (paths_len == 2 &&
+			is_capture_pcm_path(paths[0]) == is_capture_pcm_path(paths[1])) {
+		cmd_print_error("PCMs shall have opposite directions");
+		return EXIT_FAILURE;
+	}
 
 	DBusError err = DBUS_ERROR_INIT;
-	if (!bluealsa_dbus_open_pcm(&dbus_ctx, path, &fd_pcm, &fd_pcm_ctrl, &err)) {
+	if (!bluealsa_dbus_open_pcms(&dbus_ctx, paths, paths_len,
+				fds_pcm, fds_pcm_ctrl, &err)) {
 		cmd_print_error("Cannot open PCM: %s", err.message);
 		return EXIT_FAILURE;
 	}
 
-	if (strcmp(path + len - strlen("source"), "source") == 0) {
-		input = fd_pcm;
-		output = STDOUT_FILENO;
-	}
-	else {
-		input = STDIN_FILENO;
-		output = fd_pcm;
+	for (i = 0; i < paths_len; i++) {
+		if (is_capture_pcm_path(paths[i])) {
+			pfds[i].fd = fds_pcm[i];
+			outputs[i] = STDOUT_FILENO;
+		}
+		else {
+			pfds[i].fd = STDIN_FILENO;
+			outputs[i] = fds_pcm[i];
+		}
+		pfds[i].events = POLLIN;
 	}
 
-	ssize_t count;
 	char buffer[4096];
-	while ((count = read(input, buffer, sizeof(buffer))) > 0) {
-		ssize_t written = 0;
-		const char *pos = buffer;
-		while (written < count) {
-			ssize_t res = write(output, pos, count - written);
-			if (res <= 0) {
+	for (active = paths_len; active > 0; ) {
+
+		if (poll(pfds, paths_len, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (i = 0; i < paths_len; i++) {
+
+			if (pfds[i].revents == 0)
+				continue;
+
+			ssize_t count;
+			if ((count = read(pfds[i].fd, buffer, sizeof(buffer))) > 0) {
 				/* Cannot write any more, so just terminate */
-				goto finish;
+				if (!write_all(outputs[i], buffer, count))
+					goto finish;
+				continue;
 			}
-			written += res;
-			pos += res;
+
+			if (outputs[i] == fds_pcm[i])
+				bluealsa_dbus_pcm_ctrl_send_drain(fds_pcm_ctrl[i], &err);
+
+			/* negative descriptors are ignored by poll() */
+			pfds[i].fd = -1;
+			active--;
+
 		}
-	}
 
-	if (output == fd_pcm)
-		bluealsa_dbus_pcm_ctrl_send_drain(fd_pcm_ctrl, &err);
+	}
 
 finish:
-	close(fd_pcm);
-	close(fd_pcm_ctrl);
+	for (i = 0; i < paths_len; i++) {
+		close(fds_pcm[i]);
+		close(fds_pcm_ctrl[i]);
+	}
 	return EXIT_SUCCESS;
 }
 
@@ -663,6 +737,134 @@ static int cmd_monitor(int argc, char *argv[]) {
 	return EXIT_SUCCESS;
 }
 
+/**
+ * IO statistics snapshot of a single PCM. */
+struct pcm_stats_snapshot {
+	char pcm_path[128];
+	struct ba_pcm_stats stats;
+	bool valid;
+};
+
+static const struct pcm_stats_snapshot *pcm_stats_snapshot_lookup(
+		const struct pcm_stats_snapshot *snapshots, size_t len, const char *path) {
+	for (size_t i = 0; i < len; i++)
+		if (snapshots[i].valid && strcmp(snapshots[i].pcm_path, path) == 0)
+			return &snapshots[i];
+	return NULL;
+}
+
+/**
+ * Get the counter increment. If the counter value is lower than the
+ * previous one, the IO thread has been restarted in the meantime. */
+static unsigned int pcm_stats_delta(dbus_uint32_t value, dbus_uint32_t prev) {
+	return value >= prev ? value - prev : value;
+}
+
+static int cmd_stats(int argc, char *argv[]) {
+
+	if (argc > 2) {
+		cmd_print_error("Invalid number of arguments");
+		return EXIT_FAILURE;
+	}
+
+	int interval = 1;
+	if (argc == 2 && (interval = atoi(argv[1])) <= 0) {
+		cmd_print_error("Invalid refresh interval: %s", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	/* clear the screen only if the output is not redirected */
+	const bool refresh = isatty(STDOUT_FILENO);
+
+	struct pcm_stats_snapshot *prev = NULL;
+	size_t prev_len = 0;
+	struct timespec ts_prev = { 0 };
+
+	/* The PCM list is refreshed with every interval, so keep it in the
+	 * cache updated with signals instead of calling GetPCMs() each time. */
+	DBusError err = DBUS_ERROR_INIT;
+	if (!bluealsa_dbus_pcm_cache_enable(&dbus_ctx, &err)) {
+		cmd_print_error("Couldn't enable PCM cache: %s", err.message);
+		dbus_error_free(&err);
+	}
+
+	for (;;) {
+
+		struct pcm_stats_snapshot *curr;
+		struct ba_pcm *pcms = NULL;
+		size_t pcms_count = 0;
+		struct timespec ts;
+		size_t i;
+
+		bluealsa_dbus_connection_dispatch(&dbus_ctx);
+		if (!bluealsa_dbus_get_pcms(&dbus_ctx, &pcms, &pcms_count, &err)) {
+			cmd_print_error("Couldn't get BlueALSA PCM list: %s", err.message);
+			goto fail;
+		}
+
+		if ((curr = calloc(pcms_count + 1, sizeof(*curr))) == NULL) {
+			cmd_print_error("%s", strerror(ENOMEM));
+			free(pcms);
+			goto fail;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		const double elapsed = prev == NULL ? 0 :
+			ts.tv_sec - ts_prev.tv_sec + (ts.tv_nsec - ts_prev.tv_nsec) / 1e9;
+
+		if (refresh)
+			printf("\033[H\033[2J");
+		printf("%-56s %-9s %8s %8s %9s %8s %6s\n",
+				"PCM", "Codec", "kbit/s", "Delay", "Underruns", "Queue", "CPU");
+
+		for (i = 0; i < pcms_count; i++) {
+
+			struct pcm_stats_snapshot *s = &curr[i];
+			strncpy(s->pcm_path, pcms[i].pcm_path, sizeof(s->pcm_path) - 1);
+
+			/* PCM might have been removed in the meantime */
+			if (!bluealsa_dbus_get_pcm_stats(&dbus_ctx, s->pcm_path, &s->stats, &err)) {
+				dbus_error_free(&err);
+				continue;
+			}
+
+			s->valid = true;
+
+			const struct pcm_stats_snapshot *p;
+			double bitrate = 0;
+			double cpu = 0;
+
+			if (elapsed > 0 &&
+					(p = pcm_stats_snapshot_lookup(prev, prev_len, s->pcm_path)) != NULL) {
+				const unsigned int bytes =
+					pcm_stats_delta(s->stats.tx_bytes, p->stats.tx_bytes) +
+					pcm_stats_delta(s->stats.rx_bytes, p->stats.rx_bytes);
+				bitrate = bytes * 8 / elapsed / 1000;
+				cpu = pcm_stats_delta(s->stats.cpu_time, p->stats.cpu_time) / elapsed / 10;
+			}
+
+			printf("%-56s %-9s %8.1f %6.1fms %9u %8u %5.1f%%\n",
+					s->pcm_path, pcms[i].codec, bitrate, (double)pcms[i].delay / 10,
+					s->stats.underruns, s->stats.send_queue, cpu);
+
+		}
+
+		fflush(stdout);
+		free(pcms);
+
+		free(prev);
+		prev = curr;
+		prev_len = pcms_count;
+		ts_prev = ts;
+
+		sleep(interval);
+	}
+
+fail:
+	free(prev);
+	return EXIT_FAILURE;
+}
+
 static struct command {
 	const char *name;
 	int (*func)(int argc, char *arg[]);
@@ -678,7 +880,8 @@ static struct command {
 	{ "mute", cmd_mute, "<pcm-path> [y|n] [y|n]", "Mute/unmute audio" },
 	{ "soft-volume", cmd_softvol, "<pcm-path> [y|n]", "Enable/disable SoftVolume property" },
 	{ "monitor", cmd_monitor, "", "Display PCMAdded & PCMRemoved signals" },
-	{ "open", cmd_open, "<pcm-path>", "Transfer raw PCM via stdin or stdout" },
+	{ "stats", cmd_stats, "[<sec>]", "Display live PCM IO statistics" },
+	{ "open", cmd_open, "<pcm-path> [pcm-path]", "Transfer raw PCM via stdin or stdout" },
 };
 
 static void usage(const char *progname) {
@@ -1,6 +1,6 @@
 /*
  * BlueALSA - hcitop.c
- * Copyright (c) 2016-2019 Arkadiusz Bokowy
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
  *
  * This file is a part of bluez-alsa.
  *
@@ -12,10 +12,19 @@
 # include <config.h>
 #endif
 
+#include <errno.h>
 #include <getopt.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <ncurses.h>
 #include <bsd/stdlib.h>
@@ -24,6 +33,42 @@
 #include <bluetooth/hci.h>
 #include <bluetooth/hci_lib.h>
 
+#include <dbus/dbus.h>
+
+#include "shared/dbus-client.h"
+
+/**
+ * The maximal number of tracked connections per HCI. */
+#define HCI_CONN_MAX 16
+
+/**
+ * The number of samples used for the rate averaging. */
+#define RATE_SAMPLES 3
+
+struct hci_conn_stats {
+	uint16_t handle;
+	bdaddr_t bdaddr;
+	/* ACL_LINK, SCO_LINK or ESCO_LINK */
+	uint8_t type;
+	/* historic data bytes counters */
+	unsigned int byte_rx[RATE_SAMPLES];
+	unsigned int byte_tx[RATE_SAMPLES];
+	/* BlueALSA transports which use this connection */
+	char transports[64];
+	/* connection is present in the HCI connection list */
+	bool alive;
+};
+
+struct hci_dev_stats {
+	/* raw socket for data packets sniffing */
+	int sniffer_fd;
+	/* historic ACL and SCO data bytes counters (RX + TX) */
+	unsigned int byte_acl[RATE_SAMPLES];
+	unsigned int byte_sco[RATE_SAMPLES];
+	struct hci_conn_stats conns[HCI_CONN_MAX];
+	size_t conns_len;
+};
+
 static const struct {
 	unsigned int bit;
 	char flag;
@@ -50,7 +95,7 @@ static int get_devinfo(struct hci_dev_info di[HCI_MAX_DEV]) {
 	return num;
 }
 
-static unsigned int get_average_rate(unsigned int *array, size_t size) {
+static unsigned int get_average_rate(const unsigned int *array, size_t size) {
 
 	/* at least two points are required */
 	if (size < 2)
@@ -88,17 +133,236 @@ static void sprint_hci_flags(char *str, unsigned int flags) {
 	str[i] = '\0';
 }
 
+static const char *hci_link_type_to_string(uint8_t type) {
+	switch (type) {
+	case ACL_LINK:
+		return "ACL";
+	case SCO_LINK:
+		return "SCO";
+	case ESCO_LINK:
+		return "eSCO";
+	default:
+		return "?";
+	}
+}
+
+static const char *transport_to_string(unsigned int transport) {
+	switch (transport) {
+	case BA_PCM_TRANSPORT_A2DP_SOURCE:
+		return "A2DP-source";
+	case BA_PCM_TRANSPORT_A2DP_SINK:
+		return "A2DP-sink";
+	case BA_PCM_TRANSPORT_HFP_AG:
+		return "HFP-AG";
+	case BA_PCM_TRANSPORT_HFP_HF:
+		return "HFP-HF";
+	case BA_PCM_TRANSPORT_HSP_AG:
+		return "HSP-AG";
+	case BA_PCM_TRANSPORT_HSP_HS:
+		return "HSP-HS";
+	default:
+		return "?";
+	}
+}
+
+/**
+ * Open raw HCI socket which receives copies of all ACL and SCO data
+ * packets exchanged with the controller. It requires CAP_NET_RAW. */
+static int hci_sniffer_open(int dev_id) {
+
+	struct sockaddr_hci addr = {
+		.hci_family = AF_BLUETOOTH,
+		.hci_dev = dev_id,
+		.hci_channel = HCI_CHANNEL_RAW };
+	struct hci_filter filter;
+	int opt = 1;
+	int fd;
+
+	if ((fd = socket(AF_BLUETOOTH, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, BTPROTO_HCI)) == -1)
+		return -1;
+
+	hci_filter_clear(&filter);
+	hci_filter_set_ptype(HCI_ACLDATA_PKT, &filter);
+	hci_filter_set_ptype(HCI_SCODATA_PKT, &filter);
+
+	if (setsockopt(fd, SOL_HCI, HCI_FILTER, &filter, sizeof(filter)) == -1 ||
+			setsockopt(fd, SOL_HCI, HCI_DATA_DIR, &opt, sizeof(opt)) == -1 ||
+			bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		const int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	return fd;
+}
+
+static struct hci_conn_stats *hci_conn_lookup(struct hci_dev_stats *dev, uint16_t handle) {
+	for (size_t i = 0; i < dev->conns_len; i++)
+		if (dev->conns[i].handle == handle)
+			return &dev->conns[i];
+	return NULL;
+}
+
+/**
+ * Account all pending data packets captured by the sniffer. */
+static int hci_sniffer_read(struct hci_dev_stats *dev) {
+
+	uint8_t buffer[HCI_MAX_FRAME_SIZE];
+	uint8_t control[64];
+	struct iovec iov = { buffer, sizeof(buffer) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1 };
+	ssize_t len;
+
+	for (;;) {
+
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if ((len = recvmsg(dev->sniffer_fd, &msg, 0)) == -1)
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+
+		struct cmsghdr *cmsg;
+		int incoming = 0;
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+			if (cmsg->cmsg_level == SOL_HCI && cmsg->cmsg_type == HCI_CMSG_DIR)
+				memcpy(&incoming, CMSG_DATA(cmsg), sizeof(incoming));
+
+		uint16_t handle;
+		unsigned int bytes;
+
+		if (buffer[0] == HCI_ACLDATA_PKT && len >= 1 + HCI_ACL_HDR_SIZE) {
+			const hci_acl_hdr *hdr = (hci_acl_hdr *)&buffer[1];
+			handle = acl_handle(btohs(hdr->handle));
+			bytes = btohs(hdr->dlen);
+			dev->byte_acl[0] += bytes;
+		}
+		else if (buffer[0] == HCI_SCODATA_PKT && len >= 1 + HCI_SCO_HDR_SIZE) {
+			const hci_sco_hdr *hdr = (hci_sco_hdr *)&buffer[1];
+			handle = acl_handle(btohs(hdr->handle));
+			bytes = hdr->dlen;
+			dev->byte_sco[0] += bytes;
+		}
+		else
+			continue;
+
+		/* Packets of connections which are not known yet are accounted
+		 * in the HCI totals only. The connection list is updated with
+		 * every refresh of the view. */
+		struct hci_conn_stats *conn;
+		if ((conn = hci_conn_lookup(dev, handle)) == NULL)
+			continue;
+
+		if (incoming)
+			conn->byte_rx[0] += bytes;
+		else
+			conn->byte_tx[0] += bytes;
+
+	}
+
+}
+
+/**
+ * Synchronize tracked connections with the HCI connection list. */
+static int hci_conn_update(int ctl, int dev_id, struct hci_dev_stats *dev) {
+
+	struct hci_conn_list_req *cl;
+	size_t i, j;
+
+	if ((cl = malloc(sizeof(*cl) + HCI_CONN_MAX * sizeof(*cl->conn_info))) == NULL)
+		return -1;
+
+	cl->dev_id = dev_id;
+	cl->conn_num = HCI_CONN_MAX;
+
+	if (ioctl(ctl, HCIGETCONNLIST, cl) == -1) {
+		free(cl);
+		return -1;
+	}
+
+	for (i = 0; i < dev->conns_len; i++)
+		dev->conns[i].alive = false;
+
+	for (i = 0; i < cl->conn_num; i++) {
+		const struct hci_conn_info *ci = &cl->conn_info[i];
+		struct hci_conn_stats *conn;
+		if ((conn = hci_conn_lookup(dev, ci->handle)) == NULL) {
+			if (dev->conns_len == HCI_CONN_MAX)
+				continue;
+			conn = &dev->conns[dev->conns_len++];
+			memset(conn, 0, sizeof(*conn));
+			conn->handle = ci->handle;
+		}
+		bacpy(&conn->bdaddr, &ci->bdaddr);
+		conn->type = ci->type;
+		conn->alive = true;
+	}
+
+	/* remove disconnected links */
+	for (i = j = 0; i < dev->conns_len; i++)
+		if (dev->conns[i].alive)
+			dev->conns[j++] = dev->conns[i];
+	dev->conns_len = j;
+
+	free(cl);
+	return 0;
+}
+
+/**
+ * Assign BlueALSA transports to the connections with the remote device.
+ *
+ * A2DP transports are assigned to the ACL link, while HFP and HSP ones to
+ * the SCO link, because that is the link which carries the audio. */
+static void hci_conn_update_transports(struct hci_dev_stats *dev,
+		const struct ba_pcm *pcms, size_t pcms_count) {
+
+	for (size_t i = 0; i < dev->conns_len; i++) {
+
+		struct hci_conn_stats *conn = &dev->conns[i];
+		const unsigned int mask = conn->type == ACL_LINK ?
+			BA_PCM_TRANSPORT_MASK_A2DP : BA_PCM_TRANSPORT_MASK_SCO;
+		const size_t size = sizeof(conn->transports);
+
+		conn->transports[0] = '\0';
+
+		for (size_t j = 0; j < pcms_count; j++) {
+
+			if (bacmp(&pcms[j].addr, &conn->bdaddr) != 0 ||
+					!(pcms[j].transport & mask))
+				continue;
+
+			char tmp[sizeof(conn->transports)];
+			snprintf(tmp, sizeof(tmp), "%s:%s",
+					transport_to_string(pcms[j].transport), pcms[j].codec);
+
+			/* sink and source PCMs share the same transport */
+			if (strstr(conn->transports, tmp) != NULL)
+				continue;
+
+			const size_t len = strlen(conn->transports);
+			snprintf(conn->transports + len, size - len, "%s%s", len > 0 ? " " : "", tmp);
+
+		}
+
+	}
+
+}
+
 int main(int argc, char *argv[]) {
 
 	int opt;
-	const char *opts = "hVd:";
+	const char *opts = "hVB:d:";
 	const struct option longopts[] = {
 		{ "help", no_argument, NULL, 'h' },
 		{ "version", no_argument, NULL, 'V' },
+		{ "dbus", required_argument, NULL, 'B' },
 		{ "delay", required_argument, NULL, 'd' },
 		{ 0, 0, 0, 0 },
 	};
 
+	char dbus_ba_service[32] = BLUEALSA_SERVICE;
 	int delay_sec = 1;
 	int delay_msec = 0;
 
@@ -108,6 +372,7 @@ int main(int argc, char *argv[]) {
 			printf("usage: %s [ -d sec ]\n"
 					"  -h, --help\t\tprint this help and exit\n"
 					"  -V, --version\t\tprint version and exit\n"
+					"  -B, --dbus=NAME\tBlueALSA service name suffix\n"
 					"  -d, --delay=SEC\tdelay time interval\n",
 					argv[0]);
 			return EXIT_SUCCESS;
@@ -116,6 +381,10 @@ int main(int argc, char *argv[]) {
 			printf("%s\n", PACKAGE_VERSION);
 			return EXIT_SUCCESS;
 
+		case 'B' /* --dbus=NAME */ :
+			snprintf(dbus_ba_service, sizeof(dbus_ba_service), BLUEALSA_SERVICE ".%s", optarg);
+			break;
+
 		case 'd' /* --delay=SEC */ :
 			delay_sec = atoi(optarg);
 			delay_msec = (int)((atof(optarg) - delay_sec) * 10) * 100;
@@ -131,26 +400,66 @@ int main(int argc, char *argv[]) {
 		}
 
 	struct hci_dev_info devices[HCI_MAX_DEV];
-	unsigned int byte_rx[HCI_MAX_DEV][3];
-	unsigned int byte_tx[HCI_MAX_DEV][3];
+	unsigned int byte_rx[HCI_MAX_DEV][RATE_SAMPLES];
+	unsigned int byte_tx[HCI_MAX_DEV][RATE_SAMPLES];
+	static struct hci_dev_stats stats[HCI_MAX_DEV];
+	struct ba_dbus_ctx dbus_ctx;
+	bool dbus_ok;
+	int ctl;
 	size_t ii;
 
 	memset(byte_rx, 0, sizeof(byte_rx));
 	memset(byte_tx, 0, sizeof(byte_tx));
+	for (ii = 0; ii < HCI_MAX_DEV; ii++)
+		stats[ii].sniffer_fd = -1;
+
+	if ((ctl = socket(AF_BLUETOOTH, SOCK_RAW | SOCK_CLOEXEC, BTPROTO_HCI)) == -1) {
+		fprintf(stderr, "%s: Couldn't open HCI socket: %s\n", argv[0], strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	/* BlueALSA is optional, without it connections are not correlated
+	 * with the audio transports */
+	DBusError err = DBUS_ERROR_INIT;
+	if (!(dbus_ok = bluealsa_dbus_connection_ctx_init(&dbus_ctx, dbus_ba_service, &err)))
+		dbus_error_free(&err);
+
+	/* The PCM list is refreshed with every interval, so keep it in the
+	 * cache updated with signals instead of calling GetPCMs() each time. */
+	if (dbus_ok && !bluealsa_dbus_pcm_cache_enable(&dbus_ctx, &err))
+		dbus_error_free(&err);
 
 	initscr();
 	cbreak();
 	noecho();
 	curs_set(0);
+	timeout(0);
 
 	for (ii = 1;; ii++) {
 
-		const char *template_top = "%5s %9s %8s %8s %8s %8s";
-		const char *template_row = "%5s %9s %8s %8s %8s %8s";
-		int i, count;
+		const char *template_top = "%5s %9s %8s %8s %8s %8s %8s %8s";
+		const char *template_row = "%5s %9s %8s %8s %8s %8s %8s %8s";
+		const char *template_conn_top = "%5s %17s %4s %8s %8s %6s  %s";
+		const char *template_conn_row = "%5s %17s %4s %8s %8s %5u%%  %s";
+		const size_t ii_max = RATE_SAMPLES;
+		const size_t samples = ii < ii_max ? ii : ii_max;
+		const int interval = delay_sec * 10 + delay_msec / 100;
+		struct ba_pcm *pcms = NULL;
+		size_t pcms_count = 0;
+		bool sniffer_denied = false;
+		int i, count, row;
+
+		if (dbus_ok)
+			bluealsa_dbus_connection_dispatch(&dbus_ctx);
+		if (dbus_ok && !bluealsa_dbus_get_pcms(&dbus_ctx, &pcms, &pcms_count, &err)) {
+			dbus_error_free(&err);
+			pcms_count = 0;
+		}
+
+		erase();
 
 		attron(A_REVERSE);
-		mvprintw(0, 0, template_top, "HCI", "FLAGS", "RX", "TX", "RX/s", "TX/s");
+		mvprintw(0, 0, template_top, "HCI", "FLAGS", "RX", "TX", "RX/s", "TX/s", "ACL/s", "SCO/s");
 		attroff(A_REVERSE);
 
 		count = get_devinfo(devices);
@@ -163,6 +472,32 @@ int main(int argc, char *argv[]) {
 			if (i >= count)
 				continue;
 
+			struct hci_dev_stats *dev = &stats[devices[i].dev_id];
+
+			memmove(&dev->byte_acl[1], &dev->byte_acl[0], sizeof(dev->byte_acl) - sizeof(*dev->byte_acl));
+			memmove(&dev->byte_sco[1], &dev->byte_sco[0], sizeof(dev->byte_sco) - sizeof(*dev->byte_sco));
+			for (size_t j = 0; j < dev->conns_len; j++) {
+				struct hci_conn_stats *conn = &dev->conns[j];
+				memmove(&conn->byte_rx[1], &conn->byte_rx[0], sizeof(conn->byte_rx) - sizeof(*conn->byte_rx));
+				memmove(&conn->byte_tx[1], &conn->byte_tx[0], sizeof(conn->byte_tx) - sizeof(*conn->byte_tx));
+			}
+
+			if (!hci_test_bit(HCI_UP, &devices[i].flags)) {
+				if (dev->sniffer_fd != -1)
+					close(dev->sniffer_fd);
+				dev->sniffer_fd = -1;
+				dev->conns_len = 0;
+			}
+			else {
+				if (dev->sniffer_fd == -1 &&
+						(dev->sniffer_fd = hci_sniffer_open(devices[i].dev_id)) == -1 &&
+						(errno == EPERM || errno == EACCES))
+					sniffer_denied = true;
+				if (hci_conn_update(ctl, devices[i].dev_id, dev) == -1)
+					dev->conns_len = 0;
+				hci_conn_update_transports(dev, pcms, pcms_count);
+			}
+
 			char flags[sizeof(hci_flags_map) / sizeof(*hci_flags_map) + 1];
 
 			sprint_hci_flags(flags, devices[i].flags);
@@ -170,31 +505,137 @@ int main(int argc, char *argv[]) {
 			byte_rx[i][0] = devices[i].stat.byte_rx;
 			byte_tx[i][0] = devices[i].stat.byte_tx;
 
-			const size_t ii_max = sizeof(*byte_rx) / sizeof(**byte_rx);
-			const size_t samples = ii < ii_max ? ii : ii_max;
 			unsigned int rate_rx = get_average_rate(byte_rx[i], samples);
 			unsigned int rate_tx = get_average_rate(byte_tx[i], samples);
+			unsigned int rate_acl = get_average_rate(dev->byte_acl, samples);
+			unsigned int rate_sco = get_average_rate(dev->byte_sco, samples);
 
-			rate_rx = rate_rx * 10 / (delay_sec * 10 + delay_msec / 100);
-			rate_tx = rate_tx * 10 / (delay_sec * 10 + delay_msec / 100);
+			rate_rx = rate_rx * 10 / interval;
+			rate_tx = rate_tx * 10 / interval;
+			rate_acl = rate_acl * 10 / interval;
+			rate_sco = rate_sco * 10 / interval;
 
 			char rx[7], rx_rate[9];
 			char tx[7], tx_rate[9];
+			char acl_rate[9] = "-";
+			char sco_rate[9] = "-";
 
 			humanize_number(rx, sizeof(rx), byte_rx[i][0], "B", HN_AUTOSCALE, 0);
 			humanize_number(tx, sizeof(tx), byte_tx[i][0], "B", HN_AUTOSCALE, 0);
 			humanize_number(rx_rate, sizeof(rx_rate), rate_rx, "B", HN_AUTOSCALE, 0);
 			humanize_number(tx_rate, sizeof(tx_rate), rate_tx, "B", HN_AUTOSCALE, 0);
+			if (dev->sniffer_fd != -1) {
+				humanize_number(acl_rate, sizeof(acl_rate), rate_acl, "B", HN_AUTOSCALE, 0);
+				humanize_number(sco_rate, sizeof(sco_rate), rate_sco, "B", HN_AUTOSCALE, 0);
+			}
 
-			mvprintw(i + 1, 0, template_row, devices[i].name, flags, rx, tx, rx_rate, tx_rate);
+			mvprintw(i + 1, 0, template_row, devices[i].name, flags,
+					rx, tx, rx_rate, tx_rate, acl_rate, sco_rate);
 		}
 
-		timeout(delay_sec * 1000 + delay_msec);
-		if (getch() == 'q')
-			break;
+		row = count + 2;
+		attron(A_REVERSE);
+		mvprintw(row++, 0, template_conn_top, "HCI", "ADDRESS", "LINK", "RX/s", "TX/s", "SHARE", "BLUEALSA");
+		attroff(A_REVERSE);
+
+		for (i = 0; i < count; i++) {
+
+			const struct hci_dev_stats *dev = &stats[devices[i].dev_id];
+			const unsigned int rate_total = (get_average_rate(dev->byte_acl, samples) +
+					get_average_rate(dev->byte_sco, samples)) * 10 / interval;
+
+			for (size_t j = 0; j < dev->conns_len; j++) {
+
+				const struct hci_conn_stats *conn = &dev->conns[j];
+				unsigned int rate_rx = get_average_rate(conn->byte_rx, samples) * 10 / interval;
+				unsigned int rate_tx = get_average_rate(conn->byte_tx, samples) * 10 / interval;
+				unsigned int share = 0;
+
+				char addr[18];
+				char rx_rate[9] = "-";
+				char tx_rate[9] = "-";
+
+				ba2str(&conn->bdaddr, addr);
+				if (dev->sniffer_fd != -1) {
+					humanize_number(rx_rate, sizeof(rx_rate), rate_rx, "B", HN_AUTOSCALE, 0);
+					humanize_number(tx_rate, sizeof(tx_rate), rate_tx, "B", HN_AUTOSCALE, 0);
+					if (rate_total > 0)
+						share = (unsigned long long)(rate_rx + rate_tx) * 100 / rate_total;
+				}
+
+				mvprintw(row++, 0, template_conn_row, devices[i].name, addr,
+						hci_link_type_to_string(conn->type), rx_rate, tx_rate, share,
+						conn->transports);
+
+			}
+
+		}
+
+		if (sniffer_denied)
+			mvprintw(row + 1, 0, "Per-connection statistics require CAP_NET_RAW capability");
+
+		refresh();
+		free(pcms);
+
+		/* Account captured HCI data packets until the next refresh. Any key
+		 * press triggers the refresh right away. */
+
+		struct timespec ts_refresh;
+		clock_gettime(CLOCK_MONOTONIC, &ts_refresh);
+		ts_refresh.tv_sec += delay_sec;
+		ts_refresh.tv_nsec += delay_msec * 1000000L;
+		if (ts_refresh.tv_nsec >= 1000000000L) {
+			ts_refresh.tv_nsec -= 1000000000L;
+			ts_refresh.tv_sec++;
+		}
+
+		for (;;) {
+
+			struct pollfd pfds[1 + HCI_MAX_DEV] = {{ STDIN_FILENO, POLLIN, 0 }};
+			struct hci_dev_stats *pdevs[1 + HCI_MAX_DEV] = { NULL };
+			nfds_t nfds = 1;
+			struct timespec ts;
+
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			const long remaining = (ts_refresh.tv_sec - ts.tv_sec) * 1000 +
+				(ts_refresh.tv_nsec - ts.tv_nsec) / 1000000;
+			if (remaining <= 0)
+				break;
+
+			for (i = 0; i < HCI_MAX_DEV; i++)
+				if (stats[i].sniffer_fd != -1) {
+					pfds[nfds].fd = stats[i].sniffer_fd;
+					pfds[nfds].events = POLLIN;
+					pdevs[nfds++] = &stats[i];
+				}
+
+			if (poll(pfds, nfds, remaining) == -1 && errno != EINTR)
+				break;
+
+			for (nfds_t n = 1; n < nfds; n++)
+				if (pfds[n].revents != 0 && hci_sniffer_read(pdevs[n]) == -1) {
+					/* the HCI has been removed or brought down */
+					close(pdevs[n]->sniffer_fd);
+					pdevs[n]->sniffer_fd = -1;
+				}
+
+			if (pfds[0].revents & POLLIN) {
+				if (getch() == 'q')
+					goto quit;
+				break;
+			}
+
+		}
 
 	}
 
+quit:
 	endwin();
+	for (ii = 0; ii < HCI_MAX_DEV; ii++)
+		if (stats[ii].sniffer_fd != -1)
+			close(stats[ii].sniffer_fd);
+	if (dbus_ok)
+		bluealsa_dbus_connection_ctx_free(&dbus_ctx);
+	close(ctl);
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,338 @@
+/*
+ * BlueALSA - metrics.c
+ * Copyright (c) 2016-2021 Arkadiusz Bokowy
+ *
+ * This file is a part of bluez-alsa.
+ *
+ * This project is licensed under the terms of the MIT license.
+ *
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "shared/defs.h"
+#include "shared/metrics-page.h"
+
+static const char *counter_help[] = {
+	[METRICS_PAGE_COUNTER_TX_PACKETS] = "Packets written to the Bluetooth socket.",
+	[METRICS_PAGE_COUNTER_TX_BYTES] = "Bytes written to the Bluetooth socket.",
+	[METRICS_PAGE_COUNTER_RX_PACKETS] = "Packets read from the Bluetooth socket.",
+	[METRICS_PAGE_COUNTER_RX_BYTES] = "Bytes read from the Bluetooth socket.",
+	[METRICS_PAGE_COUNTER_OVERDUE] = "Transfers which missed the synchronization deadline.",
+	[METRICS_PAGE_COUNTER_UNDERRUNS] = "PCM FIFO was empty when the transfer was due.",
+	[METRICS_PAGE_COUNTER_OVERRUNS] = "PCM FIFO was full, so the write had to wait for the client.",
+	[METRICS_PAGE_COUNTER_RTP_LOST] = "Missing RTP packets detected by the sequence number.",
+	[METRICS_PAGE_COUNTER_CONGESTION_DROPS] = "PCM data drops due to the Bluetooth congestion.",
+	[METRICS_PAGE_COUNTER_RX_OVERFLOWS] = "Packets dropped due to the Bluetooth socket receive buffer overflow.",
+	[METRICS_PAGE_COUNTER_OVERRUN_DROPS] = "PCM frames dropped due to the overrun policy.",
+};
+
+/**
+ * Write label value escaped according to the Prometheus text format. */
+static void print_label_value(FILE *f, const char *value) {
+	for (; *value != '\0'; value++)
+		switch (*value) {
+		case '\\':
+		case '"':
+			fputc('\\', f);
+			/* fall-through */
+		default:
+			fputc(*value, f);
+			break;
+		case '\n':
+			fputs("\\n", f);
+			break;
+		}
+}
+
+/**
+ * Map the metrics page for reading.
+ *
+ * @return On success this function returns the address of the mapped page,
+ *   which shall be unmapped with munmap(). Otherwise, NULL is returned and
+ *   errno is set to indicate the error. */
+static const struct metrics_page_header *metrics_page_map(const char *path) {
+
+	struct stat st;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+		return NULL;
+
+	void *addr = MAP_FAILED;
+	if (fstat(fd, &st) == -1)
+		goto final;
+	if ((size_t)st.st_size < METRICS_PAGE_SIZE) {
+		errno = EPROTO;
+		goto final;
+	}
+
+	addr = mmap(NULL, METRICS_PAGE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+
+final:
+	close(fd);
+	if (addr == MAP_FAILED)
+		return NULL;
+
+	const struct metrics_page_header *hdr = addr;
+	if (hdr->magic != METRICS_PAGE_MAGIC ||
+			hdr->version != METRICS_PAGE_VERSION ||
+			hdr->slots != METRICS_PAGE_SLOTS ||
+			hdr->slot_size != sizeof(struct metrics_page_slot)) {
+		munmap(addr, METRICS_PAGE_SIZE);
+		errno = EPROTO;
+		return NULL;
+	}
+
+	return hdr;
+}
+
+/**
+ * Print metrics in the Prometheus text format.
+ *
+ * @return On success this function returns 0. Otherwise, -1 is returned
+ *   and errno is set to indicate the error. */
+static int metrics_print(FILE *f, const char *path) {
+
+	static struct metrics_page_slot slots[METRICS_PAGE_SLOTS];
+	const struct metrics_page_header *hdr;
+	size_t i, ii;
+
+	if ((hdr = metrics_page_map(path)) == NULL)
+		return -1;
+
+	/* take snapshot of all slots at once, so every counter
+	 * family will contain the same set of IO threads */
+	for (i = 0; i < METRICS_PAGE_SLOTS; i++)
+		if (metrics_page_slot_read(metrics_page_slot(hdr, i), &slots[i]) == -1)
+			slots[i].used = 0;
+
+	munmap((void *)hdr, METRICS_PAGE_SIZE);
+
+	for (i = 0; i < METRICS_PAGE_COUNTERS; i++) {
+
+		const char *name = metrics_page_counter_name(i);
+		fprintf(f, "# HELP bluealsa_%s_total %s\n", name, counter_help[i]);
+		fprintf(f, "# TYPE bluealsa_%s_total counter\n", name);
+
+		for (ii = 0; ii < METRICS_PAGE_SLOTS; ii++) {
+			if (!slots[ii].used)
+				continue;
+			fprintf(f, "bluealsa_%s_total{device=\"", name);
+			print_label_value(f, slots[ii].device);
+			fputs("\",transport=\"", f);
+			print_label_value(f, slots[ii].transport);
+			fputs("\",thread=\"", f);
+			print_label_value(f, slots[ii].thread);
+			fprintf(f, "\"} %u\n", slots[ii].counters[i]);
+		}
+
+	}
+
+	return 0;
+}
+
+/**
+ * Serve single HTTP request on the accepted connection. */
+static void http_serve(int fd, const char *path) {
+
+	char request[1024];
+	ssize_t len;
+
+	/* The request line is all we need, so there is no need to
+	 * parse headers - they will be discarded with the socket. */
+	if ((len = recv(fd, request, sizeof(request) - 1, 0)) <= 0)
+		return;
+	request[len] = '\0';
+
+	char *body = NULL;
+	size_t body_len = 0;
+	FILE *f;
+
+	if ((f = open_memstream(&body, &body_len)) == NULL)
+		return;
+
+	const char *status = "200 OK";
+	if (strncmp(request, "GET ", 4) != 0) {
+		status = "405 Method Not Allowed";
+		fprintf(f, "Method not allowed\n");
+	}
+	else if (metrics_print(f, path) == -1) {
+		status = "503 Service Unavailable";
+		fprintf(f, "Couldn't read metrics: %s: %s\n", path, strerror(errno));
+	}
+
+	fclose(f);
+
+	char header[256];
+	int header_len = snprintf(header, sizeof(header),
+			"HTTP/1.0 %s\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %zu\r\n"
+			"Connection: close\r\n"
+			"\r\n", status, body_len);
+
+	if (send(fd, header, header_len, MSG_NOSIGNAL) == header_len)
+		send(fd, body, body_len, MSG_NOSIGNAL);
+
+	free(body);
+}
+
+/**
+ * Create listening socket for the given address. */
+static int http_listen(const char *address) {
+
+	char host[256] = "";
+	const char *port = address;
+	const char *ptr;
+
+	/* split the [HOST:]PORT address, IPv6 host shall be given in brackets */
+	if ((ptr = strrchr(address, ':')) != NULL) {
+		const char *begin = address;
+		size_t len = ptr - address;
+		if (len >= 2 && begin[0] == '[' && begin[len - 1] == ']') {
+			begin++;
+			len -= 2;
+		}
+		snprintf(host, sizeof(host), "%.*s", (int)len, begin);
+		port = ptr + 1;
+	}
+
+	const struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE };
+	struct addrinfo *res;
+	int ret;
+
+	if ((ret = getaddrinfo(host[0] != '\0' ? host : NULL, port, &hints, &res)) != 0) {
+		fprintf(stderr, "Couldn't resolve address: %s: %s\n", address, gai_strerror(ret));
+		return -1;
+	}
+
+	int fd = -1;
+	for (const struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+
+		if ((fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol)) == -1)
+			continue;
+
+		const int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 &&
+				listen(fd, 16) == 0)
+			break;
+
+		close(fd);
+		fd = -1;
+
+	}
+
+	if (fd == -1)
+		fprintf(stderr, "Couldn't listen on address: %s: %s\n", address, strerror(errno));
+
+	freeaddrinfo(res);
+	return fd;
+}
+
+int main(int argc, char *argv[]) {
+
+	int opt;
+	const char *opts = "hVf:l:";
+	const struct option longopts[] = {
+		{ "help", no_argument, NULL, 'h' },
+		{ "version", no_argument, NULL, 'V' },
+		{ "file", required_argument, NULL, 'f' },
+		{ "listen", required_argument, NULL, 'l' },
+		{ 0, 0, 0, 0 },
+	};
+
+	const char *path = METRICS_DEFAULT_PATH;
+	const char *address = NULL;
+
+	while ((opt = getopt_long(argc, argv, opts, longopts, NULL)) != -1)
+		switch (opt) {
+		case 'h' /* --help */ :
+			printf("usage: %s [ -f file ] [ -l [host:]port ]\n"
+					"  -h, --help\t\tprint this help and exit\n"
+					"  -V, --version\t\tprint version and exit\n"
+					"  -f, --file=FILE\tmetrics page file\n"
+					"  -l, --listen=[HOST:]PORT\tserve metrics over HTTP\n",
+					argv[0]);
+			return EXIT_SUCCESS;
+
+		case 'V' /* --version */ :
+			printf("%s\n", PACKAGE_VERSION);
+			return EXIT_SUCCESS;
+
+		case 'f' /* --file=FILE */ :
+			path = optarg;
+			break;
+
+		case 'l' /* --listen=[HOST:]PORT */ :
+			address = optarg;
+			break;
+
+		default:
+			fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+
+	/* without the listening address print metrics once, e.g. for
+	 * the text file collector of the Prometheus node exporter */
+	if (address == NULL) {
+		if (metrics_print(stdout, path) == -1) {
+			fprintf(stderr, "%s: Couldn't read metrics: %s: %s\n", argv[0], path, strerror(errno));
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	int fd;
+	if ((fd = http_listen(address)) == -1)
+		return EXIT_FAILURE;
+
+	struct sigaction sigact = { .sa_handler = SIG_IGN };
+	sigaction(SIGPIPE, &sigact, NULL);
+
+	for (;;) {
+
+		int conn;
+		if ((conn = accept4(fd, NULL, NULL, SOCK_CLOEXEC)) == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			fprintf(stderr, "%s: Couldn't accept connection: %s\n", argv[0], strerror(errno));
+			break;
+		}
+
+		/* do not let a stalled client block the server */
+		const struct timeval tv = { .tv_sec = 5 };
+		setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+		http_serve(conn, path);
+		close(conn);
+
+	}
+
+	close(fd);
+	return EXIT_FAILURE;
+}
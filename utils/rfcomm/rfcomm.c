@@ -21,6 +21,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <bluetooth/bluetooth.h>
@@ -69,21 +71,25 @@ static char *strtrim(char *str) {
 	return str;
 }
 
-static char *build_rfcomm_command(const char *cmd) {
-
-	static char command[512];
-	bool at;
-
-	command[0] = '\0';
-	if (!(at = strncmp(cmd, "AT", 2) == 0))
-		strcpy(command, "\r\n");
-
-	strcat(command, cmd);
-	strcat(command, "\r");
-	if (!at)
-		strcat(command, "\n");
+/**
+ * Send RFCOMM command or response.
+ *
+ * Commands (starting with "AT") are terminated with the carriage return,
+ * everything else is framed as the AG response. The given data is sent as
+ * it is, so it might contain arbitrary bytes. */
+static ssize_t rfcomm_send(const char *cmd, size_t len) {
+
+	const bool at = len >= 2 && strncmp(cmd, "AT", 2) == 0;
+	const struct iovec iov[] = {
+		{ "\r\n", at ? 0 : 2 },
+		{ (void *)cmd, len },
+		{ "\r\n", at ? 1 : 2 },
+	};
 
-	return command;
+	ssize_t ret;
+	while ((ret = writev(rfcomm_fd, iov, 3)) == -1 && errno == EINTR)
+		continue;
+	return ret;
 }
 
 static void rl_callback_handler(char *line) {
@@ -98,26 +104,291 @@ static void rl_callback_handler(char *line) {
 	if (strlen(line) == 0)
 		return;
 
-	char *cmd = build_rfcomm_command(line);
-	if (write(rfcomm_fd, cmd, strlen(cmd)) == -1)
+	if (rfcomm_send(line, strlen(line)) == -1)
 		warn("Couldn't send RFCOMM command: %s", strerror(errno));
 
 	add_history(line);
 
 }
 
+/**
+ * Command sent in the batch mode, waiting for the final result code. */
+struct batch_command {
+	/* sequence number of the command within the script */
+	unsigned int id;
+	char *data;
+	size_t len;
+	struct timespec ts;
+};
+
+struct batch_stats {
+	unsigned int commands;
+	unsigned int errors;
+	unsigned int timeouts;
+	/* round-trip time statistics in microseconds */
+	unsigned long rtt_min;
+	unsigned long rtt_max;
+	unsigned long long rtt_sum;
+};
+
+static unsigned long timespec_diff_usec(
+		const struct timespec *ts1,
+		const struct timespec *ts2) {
+	return (ts2->tv_sec - ts1->tv_sec) * 1000000 +
+		(ts2->tv_nsec - ts1->tv_nsec) / 1000;
+}
+
+/**
+ * Check whether the line is the final result code of the AT command. */
+static bool is_final_result(const char *line, size_t len) {
+	static const char *codes[] = { "OK", "ERROR", "+CME ERROR:", "+CMS ERROR:" };
+	for (size_t i = 0; i < sizeof(codes) / sizeof(*codes); i++) {
+		const size_t n = strlen(codes[i]);
+		if (len >= n && memcmp(line, codes[i], n) == 0 &&
+				(len == n || codes[i][n - 1] == ':'))
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Print batch mode result of the command. */
+static void batch_print(const struct batch_command *cmd,
+		const char *result, size_t result_len, unsigned long rtt) {
+	fprintf(stdout, "%u\t%lu.%03lu\t", cmd->id, rtt / 1000, rtt % 1000);
+	fwrite(cmd->data, 1, cmd->len, stdout);
+	fputc('\t', stdout);
+	fwrite(result, 1, result_len, stdout);
+	fputc('\n', stdout);
+}
+
+/**
+ * Run RFCOMM commands from the script in the non-interactive mode.
+ *
+ * Up to the given number of commands is sent without waiting for the
+ * final result code of the previous ones. Since AT commands are not
+ * tagged, result codes are matched with commands in the sending order.
+ * For every command the command ID, the round-trip time (in milliseconds),
+ * the command and the final result code are printed in a single
+ * tab-separated line. Other lines received from the device are printed
+ * with the "> " prefix.
+ *
+ * Command which has timed out is kept in the queue, so its late result
+ * code will not be attributed to the next command. Such a result code is
+ * printed with the "LATE " prefix and the ID of the timed out command.
+ * Timed out commands are dropped when there are no other commands in
+ * flight and nothing has been received for another timeout period.
+ *
+ * @param script Opened command script - one command per line. Empty lines
+ *   and lines starting with '#' are ignored.
+ * @param pipeline The maximal number of commands in flight.
+ * @param timeout Result code timeout in milliseconds.
+ * @param stats Address where the batch statistics shall be stored.
+ * @return On success this function returns 0. If the RFCOMM connection
+ *   is lost, -1 is returned. */
+static int batch_run(FILE *script, unsigned int pipeline, int timeout,
+		struct batch_stats *stats) {
+
+	struct batch_command *queue;
+	size_t queue_head = 0;
+	size_t queue_len = 0;
+	/* number of timed out commands at the queue head */
+	size_t queue_expired = 0;
+	struct timespec expired_ts = { 0 };
+	unsigned int id = 0;
+	char buffer[4096];
+	size_t buffer_len = 0;
+	char *line = NULL;
+	size_t line_size = 0;
+	bool eof = false;
+	int rv = -1;
+
+	if ((queue = calloc(pipeline, sizeof(*queue))) == NULL)
+		return -1;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->rtt_min = (unsigned long)-1;
+
+	while (!eof || queue_len > 0) {
+
+		struct timespec now;
+		ssize_t len;
+
+		while (!eof && queue_len < pipeline) {
+
+			if ((len = getline(&line, &line_size, script)) == -1) {
+				eof = true;
+				break;
+			}
+
+			/* strip line terminator and surrounding white spaces */
+			char *cmd = line;
+			while (len > 0 && isspace((unsigned char)cmd[len - 1]))
+				len--;
+			while (len > 0 && isspace((unsigned char)*cmd))
+				cmd++, len--;
+			if (len == 0 || *cmd == '#')
+				continue;
+
+			struct batch_command *c = &queue[(queue_head + queue_len) % pipeline];
+			if ((c->data = malloc(len)) == NULL)
+				goto final;
+			memcpy(c->data, cmd, len);
+			c->len = len;
+			c->id = ++id;
+
+			clock_gettime(CLOCK_MONOTONIC, &c->ts);
+			if (rfcomm_send(c->data, c->len) == -1) {
+				error("Couldn't send RFCOMM command: %s", strerror(errno));
+				free(c->data);
+				goto final;
+			}
+
+			queue_len++;
+			stats->commands++;
+
+		}
+
+		if (queue_len == 0)
+			continue;
+
+		/* Wait for the result code of the oldest command which has not timed
+		 * out yet. If all commands in flight have timed out, wait for their
+		 * late result codes for another timeout period. */
+		struct batch_command *c = NULL;
+		const struct timespec *ts = &expired_ts;
+		if (queue_expired < queue_len) {
+			c = &queue[(queue_head + queue_expired) % pipeline];
+			ts = &c->ts;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long elapsed = timespec_diff_usec(ts, &now) / 1000;
+
+		struct pollfd pfd = { rfcomm_fd, POLLIN, 0 };
+		if (elapsed >= timeout || poll(&pfd, 1, timeout - elapsed) == 0) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (c != NULL) {
+				batch_print(c, "TIMEOUT", 7, timespec_diff_usec(&c->ts, &now));
+				stats->timeouts++;
+				expired_ts = now;
+				queue_expired++;
+				continue;
+			}
+			/* the link is idle, result codes will not arrive */
+			while (queue_len > 0) {
+				free(queue[queue_head].data);
+				queue_head = (queue_head + 1) % pipeline;
+				queue_len--;
+			}
+			queue_expired = 0;
+			continue;
+		}
+
+		if ((len = read(rfcomm_fd, &buffer[buffer_len], sizeof(buffer) - buffer_len)) <= 0) {
+			if (len == -1 && errno == EINTR)
+				continue;
+			error("RFCOMM disconnected");
+			goto final;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		buffer_len += len;
+
+		/* process all complete lines */
+		char *head = buffer;
+		char *end = buffer + buffer_len;
+		for (char *tail = buffer; tail < end; tail++) {
+
+			if (*tail != '\r' && *tail != '\n')
+				continue;
+
+			char *ln = head;
+			const size_t ln_len = tail - head;
+			head = tail + 1;
+
+			if (ln_len == 0)
+				continue;
+
+			if (queue_len > 0 && is_final_result(ln, ln_len)) {
+
+				c = &queue[queue_head];
+				const unsigned long rtt = timespec_diff_usec(&c->ts, &now);
+
+				if (queue_expired > 0) {
+					/* already reported as timed out */
+					fputs("LATE ", stdout);
+					batch_print(c, ln, ln_len, rtt);
+					queue_expired--;
+				}
+				else {
+
+					batch_print(c, ln, ln_len, rtt);
+
+					if (ln_len != 2 || memcmp(ln, "OK", 2) != 0)
+						stats->errors++;
+					stats->rtt_sum += rtt;
+					if (rtt < stats->rtt_min)
+						stats->rtt_min = rtt;
+					if (rtt > stats->rtt_max)
+						stats->rtt_max = rtt;
+
+				}
+
+				free(c->data);
+				queue_head = (queue_head + 1) % pipeline;
+				queue_len--;
+
+			}
+			else {
+				fputs("> ", stdout);
+				fwrite(ln, 1, ln_len, stdout);
+				fputc('\n', stdout);
+			}
+
+		}
+
+		/* keep incomplete line for the next read */
+		buffer_len = end - head;
+		if (buffer_len == sizeof(buffer)) {
+			warn("RFCOMM line too long: %zu", buffer_len);
+			buffer_len = 0;
+		}
+		memmove(buffer, head, buffer_len);
+
+	}
+
+	rv = 0;
+
+final:
+	while (queue_len > 0) {
+		free(queue[queue_head].data);
+		queue_head = (queue_head + 1) % pipeline;
+		queue_len--;
+	}
+	free(queue);
+	free(line);
+	return rv;
+}
+
 int main(int argc, char *argv[]) {
 
 	int opt;
-	const char *opts = "hVB:";
+	const char *opts = "hVB:b:p:t:";
 	const struct option longopts[] = {
 		{ "help", no_argument, NULL, 'h' },
 		{ "version", no_argument, NULL, 'V' },
 		{ "dbus", required_argument, NULL, 'B' },
+		{ "batch", required_argument, NULL, 'b' },
+		{ "pipeline", required_argument, NULL, 'p' },
+		{ "timeout", required_argument, NULL, 't' },
 		{ 0, 0, 0, 0 },
 	};
 
 	char dbus_ba_service[32] = BLUEALSA_SERVICE;
+	const char *batch = NULL;
+	unsigned int pipeline = 1;
+	int timeout = 1000;
 
 	log_open(argv[0], false, false);
 
@@ -130,7 +401,10 @@ usage:
 					"\nOptions:\n"
 					"  -h, --help\t\tprint this help and exit\n"
 					"  -V, --version\t\tprint version and exit\n"
-					"  -B, --dbus=NAME\tBlueALSA service name suffix\n",
+					"  -B, --dbus=NAME\tBlueALSA service name suffix\n"
+					"  -b, --batch=FILE\trun commands from the script\n"
+					"  -p, --pipeline=NUM\tcommands sent without waiting\n"
+					"  -t, --timeout=MSEC\tresult code timeout in batch mode\n",
 					argv[0]);
 			return EXIT_SUCCESS;
 
@@ -142,6 +416,22 @@ usage:
 			snprintf(dbus_ba_service, sizeof(dbus_ba_service), BLUEALSA_SERVICE ".%s", optarg);
 			break;
 
+		case 'b' /* --batch=FILE */ :
+			batch = optarg;
+			break;
+		case 'p' /* --pipeline=NUM */ :
+			if ((pipeline = atoi(optarg)) == 0) {
+				error("Invalid number of pipelined commands: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 't' /* --timeout=MSEC */ :
+			if ((timeout = atoi(optarg)) <= 0) {
+				error("Invalid result code timeout: %s", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+
 		default:
 			fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
 			return EXIT_FAILURE;
@@ -175,6 +465,35 @@ usage:
 		return EXIT_FAILURE;
 	}
 
+	if (batch != NULL) {
+
+		FILE *script = stdin;
+		if (strcmp(batch, "-") != 0 &&
+				(script = fopen(batch, "r")) == NULL) {
+			error("Couldn't open command script: %s: %s", batch, strerror(errno));
+			return EXIT_FAILURE;
+		}
+
+		struct batch_stats stats;
+		int rv = batch_run(script, pipeline, timeout, &stats);
+		if (script != stdin)
+			fclose(script);
+
+		const unsigned int replies = stats.commands - stats.timeouts;
+		fprintf(stderr, "Commands: %u, errors: %u, timeouts: %u\n",
+				stats.commands, stats.errors, stats.timeouts);
+		if (replies > 0) {
+			const unsigned long avg = stats.rtt_sum / replies;
+			fprintf(stderr, "Round-trip time [ms]: min %lu.%03lu, avg %lu.%03lu, max %lu.%03lu\n",
+					stats.rtt_min / 1000, stats.rtt_min % 1000, avg / 1000, avg % 1000,
+					stats.rtt_max / 1000, stats.rtt_max % 1000);
+		}
+
+		if (rv == -1 || stats.errors > 0 || stats.timeouts > 0)
+			return EXIT_FAILURE;
+		return EXIT_SUCCESS;
+	}
+
 	char prompt[32];
 	sprintf(prompt, "%.2X:%.2X:%.2X:%.2X:%.2X:%.2X> ",
 			addr.b[5], addr.b[4], addr.b[3], addr.b[2], addr.b[1], addr.b[0]);